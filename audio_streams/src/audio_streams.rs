@@ -93,6 +93,8 @@ pub enum StreamEffect {
 }
 
 pub mod capture;
+pub mod guest_streams;
+pub mod reactor;
 pub mod shm_streams;
 
 impl Default for StreamEffect {
@@ -181,6 +183,12 @@ pub trait StreamSource: Send {
 /// `PlaybackBufferStream` provides `PlaybackBuffer`s to fill with audio samples for playback.
 pub trait PlaybackBufferStream: Send {
     fn next_playback_buffer(&mut self) -> Result<PlaybackBuffer, BoxError>;
+
+    /// Returns a file descriptor that becomes readable when `next_playback_buffer` won't block,
+    /// for waiting on the stream with a `reactor::FdReactor`. `None` if the stream has none.
+    fn wait_fd(&self) -> Option<RawFd> {
+        None
+    }
 }
 
 /// `StreamControl` provides a way to set the volume and mute states of a stream. `StreamControl`
@@ -31,6 +31,7 @@ use std::{
     error,
     fmt::{self, Display},
     io::{self, Read, Write},
+    os::unix::io::RawFd,
     time::{Duration, Instant},
 };
 
@@ -39,6 +40,12 @@ use super::{AudioBuffer, BoxError, BufferDrop, NoopBufferDrop, SampleFormat};
 /// `CaptureBufferStream` provides `CaptureBuffer`s to read with audio samples from capture.
 pub trait CaptureBufferStream: Send {
     fn next_capture_buffer(&mut self) -> Result<CaptureBuffer, BoxError>;
+
+    /// Returns a file descriptor that becomes readable when `next_capture_buffer` won't block,
+    /// for waiting on the stream with a `reactor::FdReactor`. `None` if the stream has none.
+    fn wait_fd(&self) -> Option<RawFd> {
+        None
+    }
 }
 
 /// `CaptureBuffer` contains a block of audio samples got from capture stream. It provides
@@ -0,0 +1,577 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//! Serves the PCM streams of VM guests from shm streams without copying the audio.
+//!
+//! A virtio-snd device, or a vhost-user-snd backend, receives PCM transfers from the guest as
+//! chains of buffers in guest memory. When the shared memory backing guest memory is the
+//! `client_shm` of the stream, those buffers are already where the server can reach them:
+//! `GuestStream` translates each transfer to regions of `client_shm` and hands them to the server
+//! with `ServerRequest::set_buffer_regions`, and the server reads from or writes to guest memory
+//! directly. The virtqueue handling stays in the device, which queues transfers on the
+//! `TransferQueue` of a stream and completes the ones returned by `take_completed`.
+//!
+//! All the streams of all the guests served by a process can run on one `FdReactor`, see
+//! `serve_streams`.
+
+use std::cell::RefCell;
+use std::collections::VecDeque;
+use std::error;
+use std::fmt;
+use std::future::Future;
+use std::pin::Pin;
+use std::rc::Rc;
+use std::task::{Context, Poll};
+
+use crate::reactor::{next_action, FdReactor};
+use crate::shm_streams::{BufferRegion, ServerRequest, ShmStream};
+use crate::{BoxError, StreamDirection};
+
+#[derive(Debug)]
+pub enum Error {
+    /// A buffer of a transfer isn't a whole number of frames.
+    PartialFrame(u64, usize),
+    /// A buffer of a transfer isn't all in guest memory shared with the server.
+    Unmapped(u64, usize),
+}
+
+impl error::Error for Error {}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        match self {
+            Error::PartialFrame(addr, len) => write!(
+                f,
+                "Buffer of {} bytes at {:#x} isn't a whole number of frames",
+                len, addr
+            ),
+            Error::Unmapped(addr, len) => write!(
+                f,
+                "Buffer of {} bytes at {:#x} isn't in shared guest memory",
+                len, addr
+            ),
+        }
+    }
+}
+
+/// A range of guest memory and where it is in the shared memory of the streams.
+#[derive(Copy, Clone, Debug, PartialEq)]
+pub struct GuestMemoryRange {
+    pub guest_addr: u64,
+    pub len: u64,
+    pub shm_offset: u64,
+}
+
+/// The layout of guest memory in the shared memory of the streams.
+#[derive(Clone, Debug, Default)]
+pub struct GuestMemoryMap {
+    ranges: Vec<GuestMemoryRange>,
+}
+
+impl GuestMemoryMap {
+    pub fn new(mut ranges: Vec<GuestMemoryRange>) -> Self {
+        ranges.sort_by_key(|r| r.guest_addr);
+        GuestMemoryMap { ranges }
+    }
+
+    /// Calls `f` with the shm offset and length of each piece of the `len` bytes at `guest_addr`,
+    /// which may span several ranges.
+    fn translate<F>(&self, guest_addr: u64, len: usize, mut f: F) -> Result<(), Error>
+    where
+        F: FnMut(u64, u64),
+    {
+        let end = guest_addr
+            .checked_add(len as u64)
+            .ok_or(Error::Unmapped(guest_addr, len))?;
+        let mut addr = guest_addr;
+        let first = self
+            .ranges
+            .partition_point(|r| r.guest_addr + r.len <= guest_addr);
+        for range in &self.ranges[first..] {
+            if addr == end || range.guest_addr > addr {
+                break;
+            }
+            let piece = (range.guest_addr + range.len).min(end) - addr;
+            f(range.shm_offset + addr - range.guest_addr, piece);
+            addr += piece;
+        }
+        if addr != end {
+            return Err(Error::Unmapped(guest_addr, len));
+        }
+        Ok(())
+    }
+}
+
+/// A PCM transfer from the guest: the audio is in `buffers`, in order, each one an address in
+/// guest memory and a length in bytes.
+#[derive(Clone, Debug)]
+pub struct PcmTransfer {
+    pub id: u64,
+    pub buffers: Vec<(u64, usize)>,
+}
+
+/// A transfer the server is done with.
+#[derive(Copy, Clone, Debug, PartialEq)]
+pub struct CompletedTransfer {
+    pub id: u64,
+    /// The number of bytes the server played or captured.
+    pub bytes: usize,
+}
+
+struct Pending {
+    id: u64,
+    regions: VecDeque<BufferRegion>,
+    bytes: usize,
+}
+
+/// The transfers queued on a stream, waiting for the server or being used by it.
+pub struct TransferQueue {
+    direction: StreamDirection,
+    frame_size: usize,
+    pending: VecDeque<Pending>,
+    /// Transfers whose last region was handed to the server.
+    in_flight: Vec<CompletedTransfer>,
+    completed: Vec<CompletedTransfer>,
+    /// Scratch space for the regions of a request.
+    regions: Vec<BufferRegion>,
+}
+
+impl TransferQueue {
+    fn new(direction: StreamDirection, frame_size: usize) -> Self {
+        TransferQueue {
+            direction,
+            frame_size,
+            pending: VecDeque::new(),
+            in_flight: Vec::new(),
+            completed: Vec::new(),
+            regions: Vec::new(),
+        }
+    }
+
+    /// Queues `transfer` after the ones already queued. Its buffers are translated to regions of
+    /// the shared memory through `memory`, they must each hold whole frames.
+    pub fn push(&mut self, memory: &GuestMemoryMap, transfer: &PcmTransfer) -> Result<(), Error> {
+        let frame_size = self.frame_size as u64;
+        let mut regions: VecDeque<BufferRegion> = VecDeque::new();
+        let mut bytes = 0;
+
+        for &(addr, len) in &transfer.buffers {
+            if len as u64 % frame_size != 0 {
+                return Err(Error::PartialFrame(addr, len));
+            }
+            memory.translate(addr, len, |offset, piece| {
+                // A frame split between two ranges is caught below.
+                let frames = (piece / frame_size) as usize;
+                match regions.back_mut() {
+                    Some(last)
+                        if (last.offset + last.frames * frame_size as usize) as u64 == offset =>
+                    {
+                        last.frames += frames
+                    }
+                    _ => regions.push_back(BufferRegion {
+                        offset: offset as usize,
+                        frames,
+                    }),
+                }
+            })?;
+            if regions.iter().map(|r| r.frames).sum::<usize>() * self.frame_size != bytes + len {
+                return Err(Error::PartialFrame(addr, len));
+            }
+            bytes += len;
+        }
+        self.pending.push_back(Pending {
+            id: transfer.id,
+            regions,
+            bytes,
+        });
+        Ok(())
+    }
+
+    /// Returns the number of frames queued and not handed to the server yet.
+    pub fn queued_frames(&self) -> usize {
+        self.pending
+            .iter()
+            .flat_map(|p| p.regions.iter())
+            .map(|r| r.frames)
+            .sum()
+    }
+
+    /// Returns the transfers the server is done with since the last call, in order.
+    pub fn take_completed(&mut self) -> Vec<CompletedTransfer> {
+        std::mem::take(&mut self.completed)
+    }
+
+    /// Answers `request` with as many queued frames as it asks for.
+    ///
+    /// The server asks again once it is done with the buffer it was given, for playback when it
+    /// has read it and for capture when it has written it, so the transfers handed out by the
+    /// last request are complete by now. CRAS captures into one contiguous buffer, a capture
+    /// request only gets the next region.
+    fn answer(&mut self, request: ServerRequest) -> Result<(), BoxError> {
+        self.completed.append(&mut self.in_flight);
+
+        let mut wanted = request.requested_frames();
+        self.regions.clear();
+        while wanted > 0 {
+            let front = match self.pending.front_mut() {
+                Some(front) => front,
+                None => break,
+            };
+            if let Some(region) = front.regions.front_mut() {
+                let frames = region.frames.min(wanted);
+                self.regions.push(BufferRegion {
+                    offset: region.offset,
+                    frames,
+                });
+                region.offset += frames * self.frame_size;
+                region.frames -= frames;
+                wanted -= frames;
+                if region.frames == 0 {
+                    front.regions.pop_front();
+                }
+            }
+            if front.regions.is_empty() {
+                self.in_flight.push(CompletedTransfer {
+                    id: front.id,
+                    bytes: front.bytes,
+                });
+                self.pending.pop_front();
+            }
+            if self.direction == StreamDirection::Capture {
+                break;
+            }
+        }
+
+        if self.regions.is_empty() {
+            return request.ignore_request();
+        }
+        request.set_buffer_regions(&self.regions)
+    }
+}
+
+/// A stream of a guest, served from the transfers queued on it.
+pub struct GuestStream {
+    stream: Box<dyn ShmStream>,
+    queue: Rc<RefCell<TransferQueue>>,
+}
+
+impl GuestStream {
+    /// Serves `stream`, whose `client_shm` must be the shared memory guest memory is mapped
+    /// from.
+    pub fn new(stream: Box<dyn ShmStream>, direction: StreamDirection) -> Self {
+        let queue = TransferQueue::new(direction, stream.frame_size());
+        GuestStream {
+            stream,
+            queue: Rc::new(RefCell::new(queue)),
+        }
+    }
+
+    /// Returns the queue transfers for this stream are pushed on. It is shared with the device
+    /// running on the same thread.
+    pub fn queue(&self) -> Rc<RefCell<TransferQueue>> {
+        self.queue.clone()
+    }
+
+    /// Waits for the next request of the server and answers it.
+    pub async fn serve_next(&mut self, reactor: &FdReactor) -> Result<(), BoxError> {
+        if let Some(request) = next_action(self.stream.as_mut(), reactor).await? {
+            self.queue.borrow_mut().answer(request)?;
+        }
+        Ok(())
+    }
+
+    /// Answers the requests of the server until an error occurs.
+    pub async fn serve(&mut self, reactor: &FdReactor) -> Result<(), BoxError> {
+        loop {
+            self.serve_next(reactor).await?;
+        }
+    }
+}
+
+type ServeFuture<'a> = Pin<Box<dyn Future<Output = Result<(), BoxError>> + 'a>>;
+
+/// Future returned by `serve_streams`.
+pub struct ServeStreams<'a> {
+    streams: Vec<ServeFuture<'a>>,
+}
+
+impl Future for ServeStreams<'_> {
+    type Output = Result<(), BoxError>;
+
+    fn poll(mut self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+        for stream in self.streams.iter_mut() {
+            if let Poll::Ready(result) = stream.as_mut().poll(cx) {
+                return Poll::Ready(result);
+            }
+        }
+        Poll::Pending
+    }
+}
+
+/// Serves all of `streams` on `reactor`, for instance with `FdReactor::block_on`. Completes with
+/// the first error of any of them.
+pub fn serve_streams<'a>(
+    streams: &'a mut [GuestStream],
+    reactor: &'a FdReactor,
+) -> ServeStreams<'a> {
+    ServeStreams {
+        streams: streams
+            .iter_mut()
+            .map(|s| Box::pin(s.serve(reactor)) as ServeFuture)
+            .collect(),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use std::time::Duration;
+
+    use sys_util::SharedMemory;
+
+    use crate::shm_streams::{MockShmStream, MockShmStreamSource, ShmStreamSource};
+    use crate::SampleFormat;
+
+    fn memory() -> GuestMemoryMap {
+        // Guest memory with a hole at 0x1000.
+        GuestMemoryMap::new(vec![
+            GuestMemoryRange {
+                guest_addr: 0x2000,
+                len: 0x1000,
+                shm_offset: 0x1000,
+            },
+            GuestMemoryRange {
+                guest_addr: 0,
+                len: 0x1000,
+                shm_offset: 0,
+            },
+            GuestMemoryRange {
+                guest_addr: 0x3000,
+                len: 0x1000,
+                shm_offset: 0x4000,
+            },
+        ])
+    }
+
+    struct Regions(Vec<BufferRegion>);
+
+    impl crate::shm_streams::BufferSet for Regions {
+        fn callback(&mut self, offset: usize, frames: usize) -> Result<(), BoxError> {
+            self.0 = vec![BufferRegion { offset, frames }];
+            Ok(())
+        }
+
+        fn callback_vectored(&mut self, regions: &[BufferRegion]) -> Result<(), BoxError> {
+            self.0 = regions.to_vec();
+            Ok(())
+        }
+
+        fn ignore(&mut self) -> Result<(), BoxError> {
+            self.0.clear();
+            Ok(())
+        }
+    }
+
+    #[test]
+    fn translate_transfers() {
+        let memory = memory();
+        let mut queue = TransferQueue::new(StreamDirection::Playback, 4);
+
+        assert!(queue
+            .push(
+                &memory,
+                &PcmTransfer {
+                    id: 0,
+                    buffers: vec![(0xff0, 0x20)],
+                },
+            )
+            .is_err());
+        assert!(queue
+            .push(
+                &memory,
+                &PcmTransfer {
+                    id: 0,
+                    buffers: vec![(0, 6)],
+                },
+            )
+            .is_err());
+
+        // Contiguous buffers become one region, a range boundary splits them.
+        queue
+            .push(
+                &memory,
+                &PcmTransfer {
+                    id: 1,
+                    buffers: vec![(0x100, 0x40), (0x140, 0x40), (0x2ff0, 0x20)],
+                },
+            )
+            .expect("Failed to push transfer");
+        assert_eq!(queue.queued_frames(), 0x28);
+        let pending = &queue.pending[0];
+        assert_eq!(pending.bytes, 0xa0);
+        assert_eq!(
+            pending.regions,
+            vec![
+                BufferRegion {
+                    offset: 0x100,
+                    frames: 0x20,
+                },
+                BufferRegion {
+                    offset: 0x1ff0,
+                    frames: 4,
+                },
+                BufferRegion {
+                    offset: 0x4000,
+                    frames: 4,
+                },
+            ]
+        );
+    }
+
+    #[test]
+    fn answer_requests() {
+        let memory = memory();
+        let mut queue = TransferQueue::new(StreamDirection::Playback, 4);
+        let mut regions = Regions(Vec::new());
+        for id in 0..2 {
+            queue
+                .push(
+                    &memory,
+                    &PcmTransfer {
+                        id,
+                        buffers: vec![(0x100 * id, 0x40), (0x2000 + 0x100 * id, 0x40)],
+                    },
+                )
+                .expect("Failed to push transfer");
+        }
+
+        // The first transfer and part of the second one, straight from guest memory.
+        queue
+            .answer(ServerRequest::new(0x28, &mut regions))
+            .expect("Failed to answer");
+        assert_eq!(
+            regions.0,
+            vec![
+                BufferRegion {
+                    offset: 0,
+                    frames: 0x10,
+                },
+                BufferRegion {
+                    offset: 0x1000,
+                    frames: 0x10,
+                },
+                BufferRegion {
+                    offset: 0x100,
+                    frames: 0x8,
+                },
+            ]
+        );
+        assert!(queue.take_completed().is_empty());
+
+        queue
+            .answer(ServerRequest::new(0x18, &mut regions))
+            .expect("Failed to answer");
+        assert_eq!(
+            queue.take_completed(),
+            vec![CompletedTransfer { id: 0, bytes: 0x80 }]
+        );
+        assert_eq!(queue.queued_frames(), 0);
+
+        // Nothing left, the request is ignored and the last transfer completes on the next one.
+        queue
+            .answer(ServerRequest::new(0x18, &mut regions))
+            .expect("Failed to answer");
+        assert!(regions.0.is_empty());
+        assert_eq!(
+            queue.take_completed(),
+            vec![CompletedTransfer { id: 1, bytes: 0x80 }]
+        );
+    }
+
+    #[test]
+    fn capture_gets_contiguous_buffers() {
+        let memory = memory();
+        let mut queue = TransferQueue::new(StreamDirection::Capture, 4);
+        let mut regions = Regions(Vec::new());
+        queue
+            .push(
+                &memory,
+                &PcmTransfer {
+                    id: 7,
+                    buffers: vec![(0, 0x40), (0x2000, 0x40)],
+                },
+            )
+            .expect("Failed to push transfer");
+
+        queue
+            .answer(ServerRequest::new(0x20, &mut regions))
+            .expect("Failed to answer");
+        assert_eq!(
+            regions.0,
+            vec![BufferRegion {
+                offset: 0,
+                frames: 0x10,
+            }]
+        );
+        queue
+            .answer(ServerRequest::new(0x20, &mut regions))
+            .expect("Failed to answer");
+        assert_eq!(
+            regions.0,
+            vec![BufferRegion {
+                offset: 0x1000,
+                frames: 0x10,
+            }]
+        );
+        queue
+            .answer(ServerRequest::new(0x20, &mut regions))
+            .expect("Failed to answer");
+        assert_eq!(
+            queue.take_completed(),
+            vec![CompletedTransfer { id: 7, bytes: 0x80 }]
+        );
+    }
+
+    #[test]
+    fn serve_on_reactor() {
+        let reactor = FdReactor::new().expect("Failed to create reactor");
+        let mut source = MockShmStreamSource::new();
+        let shm = SharedMemory::anon().expect("Failed to create shm");
+        let stream = source
+            .new_stream(
+                StreamDirection::Playback,
+                2,
+                SampleFormat::S16LE,
+                48000,
+                0x10,
+                &[],
+                &shm,
+                [0, 0],
+            )
+            .expect("Failed to create stream");
+        let mut mock: MockShmStream = source.get_last_stream();
+        let mut guest = GuestStream::new(stream, StreamDirection::Playback);
+        guest
+            .queue()
+            .borrow_mut()
+            .push(
+                &memory(),
+                &PcmTransfer {
+                    id: 3,
+                    buffers: vec![(0x40, 0x40)],
+                },
+            )
+            .expect("Failed to push transfer");
+
+        let server =
+            std::thread::spawn(move || mock.trigger_callback_with_timeout(Duration::from_secs(1)));
+        // The mock stream has no wait_fd, the reactor is only polled through.
+        reactor
+            .block_on(guest.serve_next(&reactor))
+            .expect("Failed to run reactor")
+            .expect("Failed to serve");
+        assert!(server.join().expect("Failed to join server"));
+        assert_eq!(guest.queue().borrow().queued_frames(), 0);
+    }
+}
@@ -0,0 +1,357 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//! Async access to audio streams.
+//!
+//! Streams that wait for the server on a file descriptor report it through `wait_fd`. An
+//! `FdReactor` waits on the descriptors of any number of streams at once and wakes the tasks
+//! waiting for them, so a single thread can drive many streams. The reactor only uses
+//! `std::task::Waker`, it works with any executor: run the executor's tasks, then call
+//! `FdReactor::run_once` to block until one of the streams needs attention.
+//!
+//! ```
+//! use audio_streams::reactor::{next_playback_buffer, FdReactor};
+//! use audio_streams::{BoxError, NoopStreamSource, SampleFormat, StreamSource};
+//! use std::io::Write;
+//!
+//! # fn main() -> std::result::Result<(), BoxError> {
+//! let reactor = FdReactor::new()?;
+//! let mut stream_source = NoopStreamSource::new();
+//! let (_, mut stream) = stream_source.new_playback_stream(2, SampleFormat::S16LE, 48000, 480)?;
+//! let play = async {
+//!     let mut buffer = next_playback_buffer(stream.as_mut(), &reactor).await?;
+//!     buffer.write_all(&[0u8; 480 * 4])?;
+//!     Ok::<(), BoxError>(())
+//! };
+//! # drop(play);
+//! # Ok(())
+//! # }
+//! ```
+
+use std::cell::RefCell;
+use std::collections::HashMap;
+use std::future::Future;
+use std::os::unix::io::{AsRawFd, RawFd};
+use std::pin::Pin;
+use std::sync::atomic::{AtomicBool, Ordering};
+use std::sync::Arc;
+use std::task::{Context, Poll, Wake, Waker};
+use std::time::Duration;
+
+use sys_util::PollContext;
+
+use crate::capture::{CaptureBuffer, CaptureBufferStream};
+use crate::shm_streams::{ServerRequest, ShmStream};
+use crate::{BoxError, PlaybackBuffer, PlaybackBufferStream};
+
+/// How long `next_action` blocks on a stream without a `wait_fd`.
+const FALLBACK_WAIT: Duration = Duration::from_secs(1);
+
+struct Fd(RawFd);
+
+impl AsRawFd for Fd {
+    fn as_raw_fd(&self) -> RawFd {
+        self.0
+    }
+}
+
+/// A file descriptor a task is waiting on.
+struct Waiter {
+    waker: Waker,
+    ready: bool,
+}
+
+/// Waits for file descriptors to become readable and wakes the tasks waiting on them.
+///
+/// Each wait is one-shot: a descriptor is watched from the first poll of a `Readable` future
+/// until it becomes readable or the future is dropped. The reactor is meant to be owned by the
+/// thread running the executor.
+pub struct FdReactor {
+    poll_ctx: PollContext<u64>,
+    waiters: RefCell<HashMap<RawFd, Waiter>>,
+}
+
+impl FdReactor {
+    pub fn new() -> Result<Self, BoxError> {
+        Ok(FdReactor {
+            poll_ctx: PollContext::new()?,
+            waiters: RefCell::new(HashMap::new()),
+        })
+    }
+
+    /// Returns a future that completes once `fd` is readable.
+    pub fn readable(&self, fd: RawFd) -> Readable {
+        Readable { reactor: self, fd }
+    }
+
+    /// Returns the number of descriptors waited on.
+    pub fn num_waiting(&self) -> usize {
+        self.waiters.borrow().values().filter(|w| !w.ready).count()
+    }
+
+    /// Blocks until at least one watched descriptor is readable or `timeout` elapses, then wakes
+    /// the tasks waiting on the readable descriptors.
+    ///
+    /// Returns the number of tasks woken.
+    pub fn run_once(&self, timeout: Option<Duration>) -> Result<usize, BoxError> {
+        let events = match timeout {
+            None => self.poll_ctx.wait()?,
+            Some(duration) => self.poll_ctx.wait_timeout(duration)?,
+        };
+
+        let mut woken = 0;
+        for event in events.iter_readable() {
+            let fd = event.token() as RawFd;
+            self.poll_ctx.delete(&Fd(fd))?;
+            if let Some(waiter) = self.waiters.borrow_mut().get_mut(&fd) {
+                waiter.ready = true;
+                waiter.waker.wake_by_ref();
+                woken += 1;
+            }
+        }
+        Ok(woken)
+    }
+
+    /// Runs `future` to completion on the current thread, blocking in `run_once` whenever it
+    /// waits on the reactor. The future may join any number of streams waiting on the reactor.
+    pub fn block_on<F: Future>(&self, future: F) -> Result<F::Output, BoxError> {
+        let woken = Arc::new(WakeFlag(AtomicBool::new(true)));
+        let waker = Waker::from(woken.clone());
+        let mut cx = Context::from_waker(&waker);
+        let mut future = Box::pin(future);
+
+        loop {
+            if woken.0.swap(false, Ordering::AcqRel) {
+                if let Poll::Ready(output) = future.as_mut().poll(&mut cx) {
+                    return Ok(output);
+                }
+                continue;
+            }
+            self.run_once(None)?;
+        }
+    }
+
+    fn poll_readable(&self, fd: RawFd, cx: &mut Context) -> Poll<Result<(), BoxError>> {
+        let mut waiters = self.waiters.borrow_mut();
+        match waiters.get(&fd).map(|w| w.ready) {
+            Some(true) => {
+                waiters.remove(&fd);
+                Poll::Ready(Ok(()))
+            }
+            Some(false) => {
+                if let Some(waiter) = waiters.get_mut(&fd) {
+                    if !waiter.waker.will_wake(cx.waker()) {
+                        waiter.waker = cx.waker().clone();
+                    }
+                }
+                Poll::Pending
+            }
+            None => {
+                if let Err(e) = self.poll_ctx.add(&Fd(fd), fd as u64) {
+                    return Poll::Ready(Err(Box::new(e)));
+                }
+                waiters.insert(
+                    fd,
+                    Waiter {
+                        waker: cx.waker().clone(),
+                        ready: false,
+                    },
+                );
+                Poll::Pending
+            }
+        }
+    }
+
+    fn cancel(&self, fd: RawFd) {
+        if let Some(waiter) = self.waiters.borrow_mut().remove(&fd) {
+            if !waiter.ready {
+                // Nothing to do if the fd was already closed.
+                let _ = self.poll_ctx.delete(&Fd(fd));
+            }
+        }
+    }
+}
+
+/// The waker of `FdReactor::block_on`, which polls its future again once set.
+struct WakeFlag(AtomicBool);
+
+impl Wake for WakeFlag {
+    fn wake(self: Arc<Self>) {
+        self.0.store(true, Ordering::Release);
+    }
+}
+
+/// Future returned by `FdReactor::readable`.
+pub struct Readable<'a> {
+    reactor: &'a FdReactor,
+    fd: RawFd,
+}
+
+impl Future for Readable<'_> {
+    type Output = Result<(), BoxError>;
+
+    fn poll(self: Pin<&mut Self>, cx: &mut Context) -> Poll<Self::Output> {
+        self.reactor.poll_readable(self.fd, cx)
+    }
+}
+
+impl Drop for Readable<'_> {
+    fn drop(&mut self) {
+        self.reactor.cancel(self.fd);
+    }
+}
+
+/// Async version of `PlaybackBufferStream::next_playback_buffer`.
+///
+/// Waits for the stream on `reactor` when it has a `wait_fd`, otherwise blocks in
+/// `next_playback_buffer`.
+pub async fn next_playback_buffer<'a>(
+    stream: &'a mut dyn PlaybackBufferStream,
+    reactor: &FdReactor,
+) -> Result<PlaybackBuffer<'a>, BoxError> {
+    if let Some(fd) = stream.wait_fd() {
+        reactor.readable(fd).await?;
+    }
+    stream.next_playback_buffer()
+}
+
+/// Async version of `CaptureBufferStream::next_capture_buffer`.
+///
+/// Waits for the stream on `reactor` when it has a `wait_fd`, otherwise blocks in
+/// `next_capture_buffer`.
+pub async fn next_capture_buffer<'a>(
+    stream: &'a mut dyn CaptureBufferStream,
+    reactor: &FdReactor,
+) -> Result<CaptureBuffer<'a>, BoxError> {
+    if let Some(fd) = stream.wait_fd() {
+        reactor.readable(fd).await?;
+    }
+    stream.next_capture_buffer()
+}
+
+/// Async version of `ShmStream::wait_for_next_action_with_timeout`.
+///
+/// Waits for the stream on `reactor` when it has a `wait_fd`, otherwise blocks for up to a second
+/// in `wait_for_next_action_with_timeout`. Returns `None` if no action was pending yet, the caller
+/// should wait again.
+pub async fn next_action<'a>(
+    stream: &'a mut dyn ShmStream,
+    reactor: &FdReactor,
+) -> Result<Option<ServerRequest<'a>>, BoxError> {
+    match stream.wait_fd() {
+        Some(fd) => {
+            reactor.readable(fd).await?;
+            stream.wait_for_next_action_with_timeout(Duration::from_secs(0))
+        }
+        None => stream.wait_for_next_action_with_timeout(FALLBACK_WAIT),
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    use std::io::Write;
+    use std::os::unix::net::UnixStream;
+    use std::sync::atomic::{AtomicUsize, Ordering};
+    use std::task::{RawWaker, RawWakerVTable};
+
+    use crate::{NoopStreamSource, SampleFormat, StreamSource};
+
+    static WAKES: AtomicUsize = AtomicUsize::new(0);
+
+    fn counting_waker() -> Waker {
+        fn clone(_: *const ()) -> RawWaker {
+            RawWaker::new(std::ptr::null(), &VTABLE)
+        }
+        fn wake(_: *const ()) {
+            WAKES.fetch_add(1, Ordering::SeqCst);
+        }
+        fn drop(_: *const ()) {}
+        static VTABLE: RawWakerVTable = RawWakerVTable::new(clone, wake, wake, drop);
+        unsafe { Waker::from_raw(RawWaker::new(std::ptr::null(), &VTABLE)) }
+    }
+
+    fn poll_once<F: Future>(future: Pin<&mut F>) -> Poll<F::Output> {
+        let waker = counting_waker();
+        let mut cx = Context::from_waker(&waker);
+        future.poll(&mut cx)
+    }
+
+    #[test]
+    fn wakes_on_readable() {
+        let reactor = FdReactor::new().expect("Failed to create reactor");
+        let (mut tx, rx) = UnixStream::pair().expect("Failed to create socket pair");
+
+        let mut readable = Box::pin(reactor.readable(rx.as_raw_fd()));
+        assert!(poll_once(readable.as_mut()).is_pending());
+        assert_eq!(reactor.num_waiting(), 1);
+        assert_eq!(
+            reactor
+                .run_once(Some(Duration::from_millis(1)))
+                .expect("Failed to run reactor"),
+            0
+        );
+
+        let wakes = WAKES.load(Ordering::SeqCst);
+        tx.write_all(&[1u8]).expect("Failed to write");
+        assert_eq!(reactor.run_once(None).expect("Failed to run reactor"), 1);
+        assert_eq!(WAKES.load(Ordering::SeqCst), wakes + 1);
+        match poll_once(readable.as_mut()) {
+            Poll::Ready(r) => r.expect("Readable failed"),
+            Poll::Pending => panic!("Readable should have completed"),
+        }
+        assert_eq!(reactor.num_waiting(), 0);
+    }
+
+    #[test]
+    fn drop_cancels_wait() {
+        let reactor = FdReactor::new().expect("Failed to create reactor");
+        let (mut tx, rx) = UnixStream::pair().expect("Failed to create socket pair");
+
+        {
+            let mut readable = Box::pin(reactor.readable(rx.as_raw_fd()));
+            assert!(poll_once(readable.as_mut()).is_pending());
+        }
+        assert_eq!(reactor.num_waiting(), 0);
+        tx.write_all(&[1u8]).expect("Failed to write");
+        assert_eq!(
+            reactor
+                .run_once(Some(Duration::from_millis(1)))
+                .expect("Failed to run reactor"),
+            0
+        );
+    }
+
+    #[test]
+    fn block_on_waits_for_readable() {
+        let reactor = FdReactor::new().expect("Failed to create reactor");
+        let (mut tx, rx) = UnixStream::pair().expect("Failed to create socket pair");
+
+        let writer = std::thread::spawn(move || {
+            std::thread::sleep(Duration::from_millis(10));
+            tx.write_all(&[1u8]).expect("Failed to write");
+        });
+        reactor
+            .block_on(reactor.readable(rx.as_raw_fd()))
+            .expect("Failed to run reactor")
+            .expect("Readable failed");
+        writer.join().expect("Failed to join writer");
+        assert_eq!(reactor.num_waiting(), 0);
+    }
+
+    #[test]
+    fn stream_without_fd() {
+        let reactor = FdReactor::new().expect("Failed to create reactor");
+        let mut server = NoopStreamSource::new();
+        let (_, mut stream) = server
+            .new_playback_stream(2, SampleFormat::S16LE, 48000, 480)
+            .unwrap();
+
+        let mut next = Box::pin(next_playback_buffer(stream.as_mut(), &reactor));
+        match poll_once(next.as_mut()) {
+            Poll::Ready(buffer) => assert_eq!(buffer.unwrap().frame_capacity(), 480),
+            Poll::Pending => panic!("A stream without wait_fd should not wait on the reactor"),
+        };
+    }
+}
@@ -25,13 +25,36 @@ pub trait BufferSet {
     /// the buffer.
     fn callback(&mut self, offset: usize, frames: usize) -> GenericResult<()>;
 
+    /// Called when the client sets a buffer made of several regions of shared
+    /// memory, in order.
+    ///
+    /// The default implementation only accepts a single region, streams that
+    /// can hand scattered regions to the server override it.
+    fn callback_vectored(&mut self, regions: &[BufferRegion]) -> GenericResult<()> {
+        match regions {
+            [region] => self.callback(region.offset, region.frames),
+            _ => Err(Box::new(Error::VectoredUnsupported)),
+        }
+    }
+
     /// Called when the client ignores a request from the server.
     fn ignore(&mut self) -> GenericResult<()>;
 }
 
+/// A region of shared memory holding part of a buffer.
+#[derive(Copy, Clone, Debug, PartialEq)]
+pub struct BufferRegion {
+    /// The offset of the region within shared memory.
+    pub offset: usize,
+    /// The number of audio frames in the region.
+    pub frames: usize,
+}
+
 #[derive(Debug)]
 pub enum Error {
+    NoRegions,
     TooManyFrames(usize, usize),
+    VectoredUnsupported,
 }
 
 impl error::Error for Error {}
@@ -39,11 +62,15 @@ impl error::Error for Error {}
 impl fmt::Display for Error {
     fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
         match self {
+            Error::NoRegions => write!(f, "No buffer regions provided"),
             Error::TooManyFrames(provided, requested) => write!(
                 f,
                 "Provided number of frames {} exceeds requested number of frames {}",
                 provided, requested
             ),
+            Error::VectoredUnsupported => {
+                write!(f, "The stream doesn't support buffers of several regions")
+            }
         }
     }
 }
@@ -111,6 +138,37 @@ impl<'a> ServerRequest<'a> {
         self.buffer_set.callback(offset, frames)
     }
 
+    /// Sets the regions of the buffer for the requested buffer.
+    ///
+    /// Like [`set_buffer_offset_and_frames`](ServerRequest::set_buffer_offset_and_frames)
+    /// for a buffer scattered over several regions of `client_shm`, which are
+    /// read from/written to in order. Saves copying the regions together when
+    /// the client's buffers aren't contiguous.
+    ///
+    /// # Arguments
+    ///
+    /// * `regions` - The regions of the next buffer.
+    ///
+    /// # Errors
+    ///
+    /// * If `regions` is empty.
+    /// * If the frames of all regions add up to more than `requested_frames`.
+    /// * If the stream doesn't support several regions.
+    pub fn set_buffer_regions(self, regions: &[BufferRegion]) -> GenericResult<()> {
+        if regions.is_empty() {
+            return Err(Box::new(Error::NoRegions));
+        }
+        let frames = regions.iter().map(|r| r.frames).sum();
+        if frames > self.requested_frames {
+            return Err(Box::new(Error::TooManyFrames(
+                frames,
+                self.requested_frames,
+            )));
+        }
+
+        self.buffer_set.callback_vectored(regions)
+    }
+
     /// Ignore this request
     ///
     /// If the client does not intend to respond to this ServerRequest with a
@@ -162,6 +220,12 @@ pub trait ShmStream: Send {
         &mut self,
         timeout: Duration,
     ) -> GenericResult<Option<ServerRequest>>;
+
+    /// Returns a file descriptor that becomes readable when the next server message is pending,
+    /// for waiting on the stream with a `reactor::FdReactor`. `None` if the stream has none.
+    fn wait_fd(&self) -> Option<RawFd> {
+        None
+    }
 }
 
 /// `ShmStreamSource` creates streams for playback or capture of audio.
@@ -253,6 +317,10 @@ impl BufferSet for NullShmStream {
         Ok(())
     }
 
+    fn callback_vectored(&mut self, _regions: &[BufferRegion]) -> GenericResult<()> {
+        Ok(())
+    }
+
     fn ignore(&mut self) -> GenericResult<()> {
         Ok(())
     }
@@ -380,6 +448,11 @@ impl BufferSet for MockShmStream {
         Ok(())
     }
 
+    fn callback_vectored(&mut self, _regions: &[BufferRegion]) -> GenericResult<()> {
+        self.notify_request();
+        Ok(())
+    }
+
     fn ignore(&mut self) -> GenericResult<()> {
         self.notify_request();
         Ok(())
@@ -515,6 +588,60 @@ pub mod tests {
         assert_eq!(requested_frames, buffer_size);
     }
 
+    #[test]
+    fn buffer_regions() {
+        struct TestBufferSet {
+            frames: usize,
+        }
+        impl BufferSet for TestBufferSet {
+            fn callback(&mut self, _offset: usize, frames: usize) -> GenericResult<()> {
+                self.frames += frames;
+                Ok(())
+            }
+
+            fn ignore(&mut self) -> GenericResult<()> {
+                Ok(())
+            }
+        }
+
+        let mut buffer_set = TestBufferSet { frames: 0 };
+        let one = [BufferRegion {
+            offset: 0,
+            frames: 100,
+        }];
+        let two = [
+            BufferRegion {
+                offset: 400,
+                frames: 100,
+            },
+            BufferRegion {
+                offset: 0,
+                frames: 100,
+            },
+        ];
+
+        // A single region goes through the plain callback by default.
+        ServerRequest::new(100, &mut buffer_set)
+            .set_buffer_regions(&one)
+            .expect("Failed to set one region");
+        assert_eq!(buffer_set.frames, 100);
+
+        assert!(ServerRequest::new(200, &mut buffer_set)
+            .set_buffer_regions(&two)
+            .is_err());
+        assert!(ServerRequest::new(100, &mut buffer_set)
+            .set_buffer_regions(&[])
+            .is_err());
+
+        let mut stream = NullShmStream::new(200, 2, SampleFormat::S16LE, 48000);
+        assert!(ServerRequest::new(150, &mut stream)
+            .set_buffer_regions(&two)
+            .is_err());
+        ServerRequest::new(200, &mut stream)
+            .set_buffer_regions(&two)
+            .expect("Failed to set two regions");
+    }
+
     #[test]
     fn null_consumption_rate() {
         let frame_rate = 44100;
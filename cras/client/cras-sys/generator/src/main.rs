@@ -32,10 +32,12 @@ fn copy_headers(src_dir: &Path, dst_dir: &Path) -> Result<(), String> {
     let header_files = vec![
         "cras_audio_format.h",
         "cras_iodev_info.h",
+        "cras_latency_hist.h",
         "cras_messages.h",
         "cras_shm.h",
         "cras_types.h",
         "cras_util.h",
+        "hfp_link_stats.h",
         "packet_status_logger.h",
     ];
 
@@ -130,10 +132,12 @@ fn write_output(output_path: &Path, output: String) -> std::io::Result<()> {
  * generated from files in cras/src/common in adhd:
  * cras_audio_format.h
  * cras_iodev_info.h
+ * cras_latency_hist.h
  * cras_messages.h
  * cras_shm.h
  * cras_types.h
  * cras_util.h
+ * hfp_link_stats.h
  * packet_status_logger.h
  */
 
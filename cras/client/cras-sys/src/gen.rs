@@ -6,10 +6,12 @@
  * generated from files in cras/src/common in adhd:
  * cras_audio_format.h
  * cras_iodev_info.h
+ * cras_latency_hist.h
  * cras_messages.h
  * cras_shm.h
  * cras_types.h
  * cras_util.h
+ * hfp_link_stats.h
  * packet_status_logger.h
  */
 
@@ -22,17 +24,24 @@ pub const CRAS_NODE_TYPE_BUFFER_SIZE: u32 = 32;
 pub const CRAS_NODE_MIC_POS_BUFFER_SIZE: u32 = 128;
 pub const CRAS_NODE_NAME_BUFFER_SIZE: u32 = 64;
 pub const CRAS_NODE_HOTWORD_MODEL_BUFFER_SIZE: u32 = 16;
+pub const CRAS_LATENCY_HIST_SUB_BITS: u32 = 2;
+pub const CRAS_LATENCY_HIST_BUCKETS: u32 = 64;
 pub const CRAS_MAX_IODEVS: u32 = 20;
 pub const CRAS_MAX_IONODES: u32 = 20;
 pub const CRAS_MAX_ATTACHED_CLIENTS: u32 = 20;
 pub const CRAS_MAX_AUDIO_THREAD_SNAPSHOTS: u32 = 10;
+pub const CRAS_AUDIO_THREAD_SNAPSHOT_BUFFER_SIZE: u32 = 524288;
 pub const CRAS_MAX_HOTWORD_MODEL_NAME_SIZE: u32 = 12;
+pub const CRAS_STATE_JOURNAL_SIZE: u32 = 32;
+pub const CRAS_OBSERVER_EVENT_RING_SIZE: u32 = 64;
 pub const MAX_DEBUG_DEVS: u32 = 4;
 pub const MAX_DEBUG_STREAMS: u32 = 8;
+pub const CRAS_NUM_DEV_IO_STAGES: u32 = 2;
 pub const CRAS_BT_EVENT_LOG_SIZE: u32 = 1024;
-pub const CRAS_SERVER_STATE_VERSION: u32 = 2;
+pub const CRAS_SERVER_STATE_VERSION: u32 = 18;
 pub const CRAS_PROTO_VER: u32 = 7;
-pub const CRAS_SERV_MAX_MSG_SIZE: u32 = 256;
+pub const CRAS_SERV_MAX_MSG_SIZE: u32 = 1024;
+pub const CRAS_SERV_MAX_MSG_FDS: u32 = 16;
 pub const CRAS_CLIENT_MAX_MSG_SIZE: u32 = 256;
 pub const CRAS_MAX_HOTWORD_MODELS: u32 = 243;
 pub const CRAS_MAX_REMIX_CHANNELS: u32 = 8;
@@ -40,6 +49,8 @@ pub const CRAS_MAX_TEST_DATA_LEN: u32 = 224;
 pub const CRAS_AEC_DUMP_FILE_NAME_LEN: u32 = 128;
 pub const CRAS_NUM_SHM_BUFFERS: u32 = 2;
 pub const CRAS_SHM_BUFFERS_MASK: u32 = 1;
+pub const CRAS_SHM_MAX_SEGMENTS: u32 = 8;
+pub const CRAS_SHM_RING_BUFFERS: u32 = 4;
 pub type __int8_t = ::std::os::raw::c_schar;
 pub type __uint8_t = ::std::os::raw::c_uchar;
 pub type __int32_t = ::std::os::raw::c_int;
@@ -613,6 +624,205 @@ fn bindgen_test_layout_cras_audio_format_packed() {
         )
     );
 }
+#[repr(C, packed)]
+#[derive(Copy, Clone)]
+pub struct cras_latency_hist {
+    pub counts: [u32; 64usize],
+    pub max_usec: u32,
+}
+#[test]
+fn bindgen_test_layout_cras_latency_hist() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_latency_hist>(),
+        260usize,
+        concat!("Size of: ", stringify!(cras_latency_hist))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_latency_hist>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_latency_hist))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_latency_hist>())).counts as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_latency_hist),
+            "::",
+            stringify!(counts)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_latency_hist>())).max_usec as *const _ as usize },
+        256usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_latency_hist),
+            "::",
+            stringify!(max_usec)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct hfp_link_stats {
+    pub packets: u32,
+    pub lost: u32,
+    pub burst: u32,
+    pub max_burst: u32,
+    pub bursts: [u32; 6usize],
+    pub plc_calls: u32,
+    pub plc_usec: u32,
+    pub max_plc_usec: u32,
+    pub wakes: u32,
+    pub jitter_usec: u32,
+    pub max_jitter_usec: u32,
+    pub queue_depth: u32,
+    pub max_queue_depth: u32,
+}
+#[test]
+fn bindgen_test_layout_hfp_link_stats() {
+    assert_eq!(
+        ::std::mem::size_of::<hfp_link_stats>(),
+        72usize,
+        concat!("Size of: ", stringify!(hfp_link_stats))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<hfp_link_stats>(),
+        1usize,
+        concat!("Alignment of ", stringify!(hfp_link_stats))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).packets as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(packets)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).lost as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(lost)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).burst as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(burst)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).max_burst as *const _ as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(max_burst)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).bursts as *const _ as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(bursts)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).plc_calls as *const _ as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(plc_calls)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).plc_usec as *const _ as usize },
+        44usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(plc_usec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).max_plc_usec as *const _ as usize },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(max_plc_usec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).wakes as *const _ as usize },
+        52usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(wakes)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).jitter_usec as *const _ as usize },
+        56usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(jitter_usec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).max_jitter_usec as *const _ as usize },
+        60usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(max_jitter_usec)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).queue_depth as *const _ as usize },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(queue_depth)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<hfp_link_stats>())).max_queue_depth as *const _ as usize },
+        68usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(hfp_link_stats),
+            "::",
+            stringify!(max_queue_depth)
+        )
+    );
+}
 #[repr(C)]
 #[derive(Copy, Clone)]
 pub struct packet_status_logger {
@@ -734,6 +944,7 @@ pub enum CRAS_SPECIAL_DEVICE {
     MAX_SPECIAL_DEVICE_IDX = 4,
 }
 pub const TEST_IODEV_TYPE_TEST_IODEV_HOTWORD: TEST_IODEV_TYPE = 0;
+pub const TEST_IODEV_TYPE_TEST_IODEV_OFFLINE: TEST_IODEV_TYPE = 1;
 pub type TEST_IODEV_TYPE = u32;
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
@@ -779,6 +990,14 @@ pub enum CRAS_LOOPBACK_TYPE {
 }
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_LOOPBACK_TARGET_MODE {
+    LOOPBACK_TARGET_ALL = 0,
+    LOOPBACK_TARGET_INCLUDE = 1,
+    LOOPBACK_TARGET_EXCLUDE = 2,
+    LOOPBACK_NUM_TARGET_MODES = 3,
+}
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
 pub enum CRAS_STREAM_TYPE {
     CRAS_STREAM_TYPE_DEFAULT = 0,
     CRAS_STREAM_TYPE_MULTIMEDIA = 1,
@@ -845,6 +1064,359 @@ impl ::std::ops::BitAndAssign for CRAS_STREAM_EFFECT {
 #[repr(C)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
 pub struct CRAS_STREAM_EFFECT(pub u32);
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_STATE_CHANGE {
+    CRAS_STATE_CHANGE_DEVICES = 1,
+    CRAS_STATE_CHANGE_NODES = 2,
+    CRAS_STATE_CHANGE_CLIENTS = 4,
+    CRAS_STATE_CHANGE_STREAMS = 8,
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_state_change {
+    pub update_count: u32,
+    pub changes: u32,
+}
+#[test]
+fn bindgen_test_layout_cras_state_change() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_state_change>(),
+        8usize,
+        concat!("Size of: ", stringify!(cras_state_change))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_state_change>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_state_change))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_state_change>())).update_count as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_state_change),
+            "::",
+            stringify!(update_count)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_state_change>())).changes as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_state_change),
+            "::",
+            stringify!(changes)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_observer_event {
+    pub id: u32,
+    pub direction: u32,
+    pub node_id: u64,
+    pub values: [i32; 3usize],
+}
+#[test]
+fn bindgen_test_layout_cras_observer_event() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_observer_event>(),
+        28usize,
+        concat!("Size of: ", stringify!(cras_observer_event))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_observer_event>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_observer_event))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_observer_event>())).id as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_observer_event),
+            "::",
+            stringify!(id)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_observer_event>())).direction as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_observer_event),
+            "::",
+            stringify!(direction)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_observer_event>())).node_id as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_observer_event),
+            "::",
+            stringify!(node_id)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_observer_event>())).values as *const _ as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_observer_event),
+            "::",
+            stringify!(values)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Copy, Clone)]
+pub struct cras_observer_event_ring {
+    pub write_pos: u64,
+    pub events: [cras_observer_event; 64usize],
+}
+#[test]
+fn bindgen_test_layout_cras_observer_event_ring() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_observer_event_ring>(),
+        1800usize,
+        concat!("Size of: ", stringify!(cras_observer_event_ring))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_observer_event_ring>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_observer_event_ring))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_observer_event_ring>())).write_pos as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_observer_event_ring),
+            "::",
+            stringify!(write_pos)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_observer_event_ring>())).events as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_observer_event_ring),
+            "::",
+            stringify!(events)
+        )
+    );
+}
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_MEM_SUBSYS {
+    CRAS_MEM_SHM = 0,
+    CRAS_MEM_FMT_CONV = 1,
+    CRAS_MEM_DSP = 2,
+    CRAS_MEM_APM = 3,
+    CRAS_MEM_BT = 4,
+    CRAS_NUM_MEM_SUBSYS = 5,
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_mem_usage {
+    pub bytes: [u64; 5usize],
+    pub peak_bytes: [u64; 5usize],
+}
+#[test]
+fn bindgen_test_layout_cras_mem_usage() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_mem_usage>(),
+        80usize,
+        concat!("Size of: ", stringify!(cras_mem_usage))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_mem_usage>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_mem_usage))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_mem_usage>())).bytes as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_mem_usage),
+            "::",
+            stringify!(bytes)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_mem_usage>())).peak_bytes as *const _ as usize },
+        40usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_mem_usage),
+            "::",
+            stringify!(peak_bytes)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_perf_profile {
+    pub rt_priority: i32,
+    pub playback_wake_fuzz_us: i32,
+    pub capture_wake_fuzz_us: i32,
+    pub resampler_quality: i32,
+    pub max_audio_threads: u32,
+    pub audio_thread_cpu_mask: u32,
+    pub audio_thread_uclamp_min: u32,
+    pub sched_deadline: i32,
+    pub audio_thread_log_size: u32,
+    pub default_output_buffer_size: i32,
+}
+#[test]
+fn bindgen_test_layout_cras_perf_profile() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_perf_profile>(),
+        40usize,
+        concat!("Size of: ", stringify!(cras_perf_profile))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_perf_profile>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_perf_profile))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).rt_priority as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(rt_priority)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).playback_wake_fuzz_us as *const _ as usize },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(playback_wake_fuzz_us)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).capture_wake_fuzz_us as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(capture_wake_fuzz_us)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).resampler_quality as *const _ as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(resampler_quality)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).max_audio_threads as *const _ as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(max_audio_threads)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).audio_thread_cpu_mask as *const _ as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(audio_thread_cpu_mask)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).audio_thread_uclamp_min as *const _ as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(audio_thread_uclamp_min)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).sched_deadline as *const _ as usize },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(sched_deadline)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).audio_thread_log_size as *const _ as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(audio_thread_log_size)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_perf_profile>())).default_output_buffer_size as *const _ as usize },
+        36usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_perf_profile),
+            "::",
+            stringify!(default_output_buffer_size)
+        )
+    );
+}
+pub const CRAS_MAX_LEVEL_METERS: u32 = 64;
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_LEVEL_METER_TYPE {
+    CRAS_LEVEL_METER_NONE = 0,
+    CRAS_LEVEL_METER_DEVICE = 1,
+    CRAS_LEVEL_METER_STREAM = 2,
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
+pub struct cras_level_meter {
+    pub seq: u32,
+    pub type_: u32,
+    pub id: u32,
+    pub peak: f32,
+    pub rms: f32,
+}
+#[test]
+fn bindgen_test_layout_cras_level_meter() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_level_meter>(),
+        20usize,
+        concat!("Size of: ", stringify!(cras_level_meter))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_level_meter>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_level_meter))
+    );
+}
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
 pub struct cras_attached_client_info {
@@ -938,6 +1510,10 @@ pub enum CRAS_BT_LOG_EVENTS {
     BT_TRANSPORT_RELEASE = 25,
     BT_TRANSPORT_SET_VOLUME = 26,
     BT_TRANSPORT_UPDATE_VOLUME = 27,
+    BT_PROPERTIES_BATCH = 28,
+    BT_INTERFACES_ADDED = 29,
+    BT_INTERFACES_REMOVED = 30,
+    BT_MANAGED_OBJECTS = 31,
 }
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
@@ -1096,12 +1672,14 @@ pub struct audio_dev_debug_info {
     pub longest_wake_sec: u32,
     pub longest_wake_nsec: u32,
     pub software_gain_scaler: f64,
+    pub stage_hist: [cras_latency_hist; 2usize],
+    pub num_coalesced_fetches: u32,
 }
 #[test]
 fn bindgen_test_layout_audio_dev_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<audio_dev_debug_info>(),
-        133usize,
+        657usize,
         concat!("Size of: ", stringify!(audio_dev_debug_info))
     );
     assert_eq!(
@@ -1309,6 +1887,29 @@ fn bindgen_test_layout_audio_dev_debug_info() {
             stringify!(software_gain_scaler)
         )
     );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_dev_debug_info>())).stage_hist as *const _ as usize },
+        133usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_dev_debug_info),
+            "::",
+            stringify!(stage_hist)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_dev_debug_info>())).num_coalesced_fetches as *const _
+                as usize
+        },
+        653usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_dev_debug_info),
+            "::",
+            stringify!(num_coalesced_fetches)
+        )
+    );
 }
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
@@ -1332,14 +1933,24 @@ pub struct audio_stream_debug_info {
     pub pinned_dev_idx: u32,
     pub runtime_sec: u32,
     pub runtime_nsec: u32,
+    pub latency_us: u32,
     pub stream_volume: f64,
     pub channel_layout: [i8; 11usize],
+    pub stage_hist: [cras_latency_hist; 2usize],
+    pub cpu_ns: u64,
+    pub num_fetches: u32,
+    pub shm_bytes: u32,
+    pub conv_bytes: u32,
+    pub device_delay_us: u32,
+    pub dsp_delay_us: u32,
+    pub conv_delay_us: u32,
+    pub processing_delay_us: u32,
 }
 #[test]
 fn bindgen_test_layout_audio_stream_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<audio_stream_debug_info>(),
-        103usize,
+        663usize,
         concat!("Size of: ", stringify!(audio_stream_debug_info))
     );
     assert_eq!(
@@ -1508,91 +2119,196 @@ fn bindgen_test_layout_audio_stream_debug_info() {
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(num_missed_cb)
+            stringify!(num_missed_cb)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).num_overruns as *const _ as usize
+        },
+        64usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(num_overruns)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).is_pinned as *const _ as usize
+        },
+        68usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(is_pinned)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).pinned_dev_idx as *const _ as usize
+        },
+        72usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(pinned_dev_idx)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).runtime_sec as *const _ as usize
+        },
+        76usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(runtime_sec)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).runtime_nsec as *const _ as usize
+        },
+        80usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(runtime_nsec)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).latency_us as *const _ as usize
+        },
+        84usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(latency_us)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).stream_volume as *const _ as usize
+        },
+        88usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(stream_volume)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).channel_layout as *const _ as usize
+        },
+        96usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(channel_layout)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).stage_hist as *const _ as usize
+        },
+        107usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(stage_hist)
         )
     );
     assert_eq!(
-        unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).num_overruns as *const _ as usize
-        },
-        64usize,
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).cpu_ns as *const _ as usize },
+        627usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(num_overruns)
+            stringify!(cpu_ns)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).is_pinned as *const _ as usize
+            &(*(::std::ptr::null::<audio_stream_debug_info>())).num_fetches as *const _ as usize
         },
-        68usize,
+        635usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(is_pinned)
+            stringify!(num_fetches)
+        )
+    );    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).shm_bytes as *const _ as usize },
+        639usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_stream_debug_info),
+            "::",
+            stringify!(shm_bytes)
         )
     );
     assert_eq!(
-        unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).pinned_dev_idx as *const _ as usize
-        },
-        72usize,
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).conv_bytes as *const _ as usize },
+        643usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(pinned_dev_idx)
+            stringify!(conv_bytes)
         )
     );
     assert_eq!(
-        unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).runtime_sec as *const _ as usize
-        },
-        76usize,
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).device_delay_us as *const _ as usize },
+        647usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(runtime_sec)
+            stringify!(device_delay_us)
         )
     );
     assert_eq!(
-        unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).runtime_nsec as *const _ as usize
-        },
-        80usize,
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).dsp_delay_us as *const _ as usize },
+        651usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(runtime_nsec)
+            stringify!(dsp_delay_us)
         )
     );
     assert_eq!(
-        unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).stream_volume as *const _ as usize
-        },
-        84usize,
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).conv_delay_us as *const _ as usize },
+        655usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(stream_volume)
+            stringify!(conv_delay_us)
         )
     );
     assert_eq!(
-        unsafe {
-            &(*(::std::ptr::null::<audio_stream_debug_info>())).channel_layout as *const _ as usize
-        },
-        92usize,
+        unsafe { &(*(::std::ptr::null::<audio_stream_debug_info>())).processing_delay_us as *const _ as usize },
+        659usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_stream_debug_info),
             "::",
-            stringify!(channel_layout)
+            stringify!(processing_delay_us)
         )
     );
 }
@@ -1601,6 +2317,14 @@ fn bindgen_test_layout_audio_stream_debug_info() {
 pub struct audio_debug_info {
     pub num_streams: u32,
     pub num_devs: u32,
+    pub cpu: i32,
+    pub cpu_migrations: u32,
+    pub minor_faults: u32,
+    pub major_faults: u32,
+    pub rt_locked_bytes: u32,
+    pub rt_unlocked_bytes: u32,
+    pub rt_allocs: u32,
+    pub rt_blocking_calls: u32,
     pub devs: [audio_dev_debug_info; 4usize],
     pub streams: [audio_stream_debug_info; 8usize],
     pub log: audio_thread_event_log,
@@ -1609,7 +2333,7 @@ pub struct audio_debug_info {
 fn bindgen_test_layout_audio_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<audio_debug_info>(),
-        124264usize,
+        130872usize,
         concat!("Size of: ", stringify!(audio_debug_info))
     );
     assert_eq!(
@@ -1638,8 +2362,88 @@ fn bindgen_test_layout_audio_debug_info() {
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).devs as *const _ as usize },
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).cpu as *const _ as usize },
         8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(cpu)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).cpu_migrations as *const _ as usize },
+        12usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(cpu_migrations)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).minor_faults as *const _ as usize },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(minor_faults)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).major_faults as *const _ as usize },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(major_faults)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).rt_locked_bytes as *const _ as usize },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(rt_locked_bytes)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).rt_unlocked_bytes as *const _ as usize },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(rt_unlocked_bytes)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).rt_allocs as *const _ as usize },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(rt_allocs)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).rt_blocking_calls as *const _ as usize },
+        36usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(audio_debug_info),
+            "::",
+            stringify!(rt_blocking_calls)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<audio_debug_info>())).devs as *const _ as usize },
+        40usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_debug_info),
@@ -1649,7 +2453,7 @@ fn bindgen_test_layout_audio_debug_info() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<audio_debug_info>())).streams as *const _ as usize },
-        540usize,
+        2668usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_debug_info),
@@ -1659,7 +2463,7 @@ fn bindgen_test_layout_audio_debug_info() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<audio_debug_info>())).log as *const _ as usize },
-        1364usize,
+        7972usize,
         concat!(
             "Offset of field: ",
             stringify!(audio_debug_info),
@@ -1790,16 +2594,32 @@ fn bindgen_test_layout_main_thread_event_log() {
         )
     );
 }
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_MAIN_HANDLER {
+    CRAS_MAIN_HANDLER_CLIENT = 0,
+    CRAS_MAIN_HANDLER_DBUS = 1,
+    CRAS_MAIN_HANDLER_UDEV = 2,
+    CRAS_MAIN_HANDLER_TIMER = 3,
+    CRAS_MAIN_HANDLER_MAIN_MSG = 4,
+    CRAS_MAIN_HANDLER_TASK = 5,
+    CRAS_MAIN_HANDLER_FD = 6,
+    CRAS_MAIN_HANDLER_ALERT = 7,
+    CRAS_NUM_MAIN_HANDLERS = 8,
+}
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
 pub struct main_thread_debug_info {
     pub main_log: main_thread_event_log,
+    pub handler_hist: [cras_latency_hist; 8usize],
+    pub loop_hist: cras_latency_hist,
+    pub num_stalls: u32,
 }
 #[test]
 fn bindgen_test_layout_main_thread_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<main_thread_debug_info>(),
-        20488usize,
+        22832usize,
         concat!("Size of: ", stringify!(main_thread_debug_info))
     );
     assert_eq!(
@@ -1816,6 +2636,35 @@ fn bindgen_test_layout_main_thread_debug_info() {
             "::",
             stringify!(main_log)
         )
+    );    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_debug_info>())).handler_hist as *const _ as usize },
+        20488usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_debug_info),
+            "::",
+            stringify!(handler_hist)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_debug_info>())).loop_hist as *const _ as usize },
+        22568usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_debug_info),
+            "::",
+            stringify!(loop_hist)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<main_thread_debug_info>())).num_stalls as *const _ as usize },
+        22828usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(main_thread_debug_info),
+            "::",
+            stringify!(num_stalls)
+        )
     );
 }
 #[repr(C, packed)]
@@ -1934,121 +2783,268 @@ fn bindgen_test_layout_cras_bt_event_log() {
 pub struct cras_bt_debug_info {
     pub bt_log: cras_bt_event_log,
     pub wbs_logger: packet_status_logger,
+    pub hfp_link_stats: hfp_link_stats,
 }
 #[test]
 fn bindgen_test_layout_cras_bt_debug_info() {
     assert_eq!(
         ::std::mem::size_of::<cras_bt_debug_info>(),
-        16488usize,
+        16560usize,
         concat!("Size of: ", stringify!(cras_bt_debug_info))
     );
     assert_eq!(
-        ::std::mem::align_of::<cras_bt_debug_info>(),
-        1usize,
-        concat!("Alignment of ", stringify!(cras_bt_debug_info))
+        ::std::mem::align_of::<cras_bt_debug_info>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_bt_debug_info))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).bt_log as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_debug_info),
+            "::",
+            stringify!(bt_log)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).wbs_logger as *const _ as usize },
+        16392usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_debug_info),
+            "::",
+            stringify!(wbs_logger)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_bt_debug_info>())).hfp_link_stats as *const _ as usize
+        },
+        16488usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_bt_debug_info),
+            "::",
+            stringify!(hfp_link_stats)
+        )
+    );
+}
+#[repr(u32)]
+#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
+pub enum CRAS_AUDIO_THREAD_EVENT_TYPE {
+    AUDIO_THREAD_EVENT_A2DP_OVERRUN = 0,
+    AUDIO_THREAD_EVENT_A2DP_THROTTLE = 1,
+    AUDIO_THREAD_EVENT_BUSYLOOP = 2,
+    AUDIO_THREAD_EVENT_DEBUG = 3,
+    AUDIO_THREAD_EVENT_SEVERE_UNDERRUN = 4,
+    AUDIO_THREAD_EVENT_UNDERRUN = 5,
+    AUDIO_THREAD_EVENT_DROP_SAMPLES = 6,
+    AUDIO_THREAD_EVENT_DEV_OVERRUN = 7,
+    AUDIO_THREAD_EVENT_TYPE_COUNT = 8,
+}
+#[repr(C, packed)]
+#[derive(Copy, Clone)]
+pub struct cras_audio_thread_snapshot {
+    pub timestamp: timespec,
+    pub event_type: CRAS_AUDIO_THREAD_EVENT_TYPE,
+    pub size: u32,
+    pub num_devs: u32,
+    pub num_streams: u32,
+    pub num_events: u32,
+    pub cpu: i32,
+    pub cpu_migrations: u32,
+    pub minor_faults: u32,
+    pub major_faults: u32,
+    pub rt_locked_bytes: u32,
+    pub rt_unlocked_bytes: u32,
+    pub log_write_pos: u64,
+}
+#[test]
+fn bindgen_test_layout_cras_audio_thread_snapshot() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_audio_thread_snapshot>(),
+        68usize,
+        concat!("Size of: ", stringify!(cras_audio_thread_snapshot))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_audio_thread_snapshot>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_audio_thread_snapshot))
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).timestamp as *const _ as usize
+        },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(timestamp)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).event_type as *const _ as usize
+        },
+        16usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(event_type)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).size as *const _ as usize
+        },
+        20usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(size)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).num_devs as *const _ as usize
+        },
+        24usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(num_devs)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).num_streams as *const _ as usize
+        },
+        28usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(num_streams)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).num_events as *const _ as usize
+        },
+        32usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(num_events)
+        )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).bt_log as *const _ as usize },
-        0usize,
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).cpu as *const _ as usize
+        },
+        36usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_debug_info),
+            stringify!(cras_audio_thread_snapshot),
             "::",
-            stringify!(bt_log)
+            stringify!(cpu)
         )
     );
     assert_eq!(
-        unsafe { &(*(::std::ptr::null::<cras_bt_debug_info>())).wbs_logger as *const _ as usize },
-        16392usize,
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).cpu_migrations as *const _
+                as usize
+        },
+        40usize,
         concat!(
             "Offset of field: ",
-            stringify!(cras_bt_debug_info),
+            stringify!(cras_audio_thread_snapshot),
             "::",
-            stringify!(wbs_logger)
+            stringify!(cpu_migrations)
         )
     );
-}
-#[repr(u32)]
-#[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
-pub enum CRAS_AUDIO_THREAD_EVENT_TYPE {
-    AUDIO_THREAD_EVENT_A2DP_OVERRUN = 0,
-    AUDIO_THREAD_EVENT_A2DP_THROTTLE = 1,
-    AUDIO_THREAD_EVENT_BUSYLOOP = 2,
-    AUDIO_THREAD_EVENT_DEBUG = 3,
-    AUDIO_THREAD_EVENT_SEVERE_UNDERRUN = 4,
-    AUDIO_THREAD_EVENT_UNDERRUN = 5,
-    AUDIO_THREAD_EVENT_DROP_SAMPLES = 6,
-    AUDIO_THREAD_EVENT_DEV_OVERRUN = 7,
-    AUDIO_THREAD_EVENT_TYPE_COUNT = 8,
-}
-#[repr(C, packed)]
-#[derive(Copy, Clone)]
-pub struct cras_audio_thread_snapshot {
-    pub timestamp: timespec,
-    pub event_type: CRAS_AUDIO_THREAD_EVENT_TYPE,
-    pub audio_debug_info: audio_debug_info,
-}
-#[test]
-fn bindgen_test_layout_cras_audio_thread_snapshot() {
     assert_eq!(
-        ::std::mem::size_of::<cras_audio_thread_snapshot>(),
-        124284usize,
-        concat!("Size of: ", stringify!(cras_audio_thread_snapshot))
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).minor_faults as *const _ as usize
+        },
+        44usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(minor_faults)
+        )
     );
     assert_eq!(
-        ::std::mem::align_of::<cras_audio_thread_snapshot>(),
-        1usize,
-        concat!("Alignment of ", stringify!(cras_audio_thread_snapshot))
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).major_faults as *const _ as usize
+        },
+        48usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot),
+            "::",
+            stringify!(major_faults)
+        )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).timestamp as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).rt_locked_bytes as *const _
+                as usize
         },
-        0usize,
+        52usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_thread_snapshot),
             "::",
-            stringify!(timestamp)
+            stringify!(rt_locked_bytes)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).event_type as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).rt_unlocked_bytes as *const _
+                as usize
         },
-        16usize,
+        56usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_thread_snapshot),
             "::",
-            stringify!(event_type)
+            stringify!(rt_unlocked_bytes)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).audio_debug_info as *const _
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot>())).log_write_pos as *const _
                 as usize
         },
-        20usize,
+        60usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_thread_snapshot),
             "::",
-            stringify!(audio_debug_info)
+            stringify!(log_write_pos)
         )
     );
 }
 #[repr(C, packed)]
 #[derive(Copy, Clone)]
 pub struct cras_audio_thread_snapshot_buffer {
-    pub snapshots: [cras_audio_thread_snapshot; 10usize],
-    pub pos: ::std::os::raw::c_int,
+    pub num_snapshots: u32,
+    pub size: u32,
+    pub data: [u8; 524288usize],
 }
 #[test]
 fn bindgen_test_layout_cras_audio_thread_snapshot_buffer() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_thread_snapshot_buffer>(),
-        1242844usize,
+        524296usize,
         concat!("Size of: ", stringify!(cras_audio_thread_snapshot_buffer))
     );
     assert_eq!(
@@ -2061,7 +3057,7 @@ fn bindgen_test_layout_cras_audio_thread_snapshot_buffer() {
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_thread_snapshot_buffer>())).snapshots as *const _
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot_buffer>())).num_snapshots as *const _
                 as usize
         },
         0usize,
@@ -2069,19 +3065,31 @@ fn bindgen_test_layout_cras_audio_thread_snapshot_buffer() {
             "Offset of field: ",
             stringify!(cras_audio_thread_snapshot_buffer),
             "::",
-            stringify!(snapshots)
+            stringify!(num_snapshots)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot_buffer>())).size as *const _ as usize
+        },
+        4usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_thread_snapshot_buffer),
+            "::",
+            stringify!(size)
         )
     );
     assert_eq!(
         unsafe {
-            &(*(::std::ptr::null::<cras_audio_thread_snapshot_buffer>())).pos as *const _ as usize
+            &(*(::std::ptr::null::<cras_audio_thread_snapshot_buffer>())).data as *const _ as usize
         },
-        1242840usize,
+        8usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_audio_thread_snapshot_buffer),
             "::",
-            stringify!(pos)
+            stringify!(data)
         )
     );
 }
@@ -2126,12 +3134,18 @@ pub struct cras_server_state {
     pub num_input_streams_with_permission: [u32; 11usize],
     pub noise_cancellation_enabled: i32,
     pub hotword_pause_at_suspend: i32,
+    pub journal_head: u32,
+    pub journal: [cras_state_change; 32usize],
+    pub observer_events: cras_observer_event_ring,
+    pub mem_usage: cras_mem_usage,
+    pub level_meters: [cras_level_meter; 64usize],
+    pub perf_profile: cras_perf_profile,
 }
 #[test]
 fn bindgen_test_layout_cras_server_state() {
     assert_eq!(
         ::std::mem::size_of::<cras_server_state>(),
-        1414344usize,
+        708280usize,
         concat!("Size of: ", stringify!(cras_server_state))
     );
     assert_eq!(
@@ -2429,7 +3443,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).default_output_buffer_size as *const _
                 as usize
         },
-        134448usize,
+        141056usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2441,7 +3455,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).non_empty_status as *const _ as usize
         },
-        134452usize,
+        141060usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2451,7 +3465,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).aec_supported as *const _ as usize },
-        134456usize,
+        141064usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2461,7 +3475,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).aec_group_id as *const _ as usize },
-        134460usize,
+        141068usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2473,7 +3487,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).snapshot_buffer as *const _ as usize
         },
-        134464usize,
+        141072usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2483,7 +3497,7 @@ fn bindgen_test_layout_cras_server_state() {
     );
     assert_eq!(
         unsafe { &(*(::std::ptr::null::<cras_server_state>())).bt_debug_info as *const _ as usize },
-        1377308usize,
+        665368usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2495,7 +3509,7 @@ fn bindgen_test_layout_cras_server_state() {
         unsafe {
             &(*(::std::ptr::null::<cras_server_state>())).bt_wbs_enabled as *const _ as usize
         },
-        1393796usize,
+        681928usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2508,7 +3522,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).deprioritize_bt_wbs_mic as *const _
                 as usize
         },
-        1393800usize,
+        681932usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2521,7 +3535,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).main_thread_debug_info as *const _
                 as usize
         },
-        1393804usize,
+        681936usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2534,7 +3548,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).num_input_streams_with_permission
                 as *const _ as usize
         },
-        1414292usize,
+        704760usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2547,7 +3561,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).noise_cancellation_enabled as *const _
                 as usize
         },
-        1414336usize,
+        704812usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2560,7 +3574,7 @@ fn bindgen_test_layout_cras_server_state() {
             &(*(::std::ptr::null::<cras_server_state>())).hotword_pause_at_suspend as *const _
                 as usize
         },
-        1414340usize,
+        704816usize,
         concat!(
             "Offset of field: ",
             stringify!(cras_server_state),
@@ -2568,6 +3582,67 @@ fn bindgen_test_layout_cras_server_state() {
             stringify!(hotword_pause_at_suspend)
         )
     );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_server_state>())).journal_head as *const _ as usize
+        },
+        704820usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(journal_head)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_server_state>())).journal as *const _ as usize },
+        704824usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(journal)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_server_state>())).observer_events as *const _ as usize },
+        705080usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(observer_events)
+        )
+    );    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_server_state>())).mem_usage as *const _ as usize },
+        706880usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(mem_usage)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_server_state>())).level_meters as *const _ as usize },
+        706960usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(level_meters)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_server_state>())).perf_profile as *const _ as usize },
+        708240usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_server_state),
+            "::",
+            stringify!(perf_profile)
+        )
+    );
 }
 pub const cras_notify_device_action_CRAS_DEVICE_ACTION_ADD: cras_notify_device_action = 0;
 pub const cras_notify_device_action_CRAS_DEVICE_ACTION_REMOVE: cras_notify_device_action = 1;
@@ -2691,6 +3766,7 @@ pub enum CRAS_NODE_TYPE {
     CRAS_NODE_TYPE_UNKNOWN = 14,
     CRAS_NODE_TYPE_ECHO_REFERENCE = 15,
     CRAS_NODE_TYPE_ALSA_LOOPBACK = 16,
+    CRAS_NODE_TYPE_NETWORK = 17,
 }
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
@@ -2736,6 +3812,16 @@ pub enum CRAS_SERVER_MESSAGE_ID {
     CRAS_SERVER_SET_BT_WBS_ENABLED = 29,
     CRAS_SERVER_GET_ATLOG_FD = 30,
     CRAS_SERVER_DUMP_MAIN = 31,
+    CRAS_SERVER_BATCH = 32,
+    CRAS_SERVER_GET_OBSERVER_EVENT_FD = 33,
+    CRAS_SERVER_SET_LOOPBACK_TARGET = 34,
+    CRAS_SERVER_UPLOAD_SAMPLE = 35,
+    CRAS_SERVER_PLAY_SAMPLE = 36,
+    CRAS_SERVER_REMOVE_SAMPLE = 37,
+    CRAS_SERVER_ADD_MONITOR_ROUTE = 38,
+    CRAS_SERVER_RM_MONITOR_ROUTE = 39,
+    CRAS_SERVER_RESUME_CLIENT = 40,
+    CRAS_SERVER_DRAIN_STREAM = 41,
 }
 #[repr(u32)]
 #[derive(Debug, Copy, Clone, PartialEq, Eq, Hash)]
@@ -2755,6 +3841,9 @@ pub enum CRAS_CLIENT_MESSAGE_ID {
     CRAS_CLIENT_INPUT_NODE_GAIN_CHANGED = 12,
     CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED = 13,
     CRAS_CLIENT_ATLOG_FD_READY = 14,
+    CRAS_CLIENT_OBSERVER_EVENT_FD_READY = 15,
+    CRAS_CLIENT_RESUMED = 16,
+    CRAS_CLIENT_STREAM_DRAINED = 17,
 }
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
@@ -4715,6 +5804,45 @@ fn bindgen_test_layout_cras_audio_shm_config() {
 }
 #[repr(C, packed)]
 #[derive(Debug, Copy, Clone)]
+pub struct cras_shm_segment {
+    pub offset: u64,
+    pub bytes: u32,
+}
+#[test]
+fn bindgen_test_layout_cras_shm_segment() {
+    assert_eq!(
+        ::std::mem::size_of::<cras_shm_segment>(),
+        12usize,
+        concat!("Size of: ", stringify!(cras_shm_segment))
+    );
+    assert_eq!(
+        ::std::mem::align_of::<cras_shm_segment>(),
+        1usize,
+        concat!("Alignment of ", stringify!(cras_shm_segment))
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_shm_segment>())).offset as *const _ as usize },
+        0usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_shm_segment),
+            "::",
+            stringify!(offset)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_shm_segment>())).bytes as *const _ as usize },
+        8usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_shm_segment),
+            "::",
+            stringify!(bytes)
+        )
+    );
+}
+#[repr(C, packed)]
+#[derive(Debug, Copy, Clone)]
 pub struct cras_audio_shm_header {
     pub config: cras_audio_shm_config,
     pub read_buf_idx: u32,
@@ -4728,12 +5856,22 @@ pub struct cras_audio_shm_header {
     pub num_overruns: u32,
     pub ts: cras_timespec,
     pub buffer_offset: [u64; 2usize],
+    pub doorbell: i32,
+    pub doorbell_seq: u32,
+    pub doorbell_id: u32,
+    pub doorbell_frames: u32,
+    pub reply_wanted: i32,
+    pub num_segments: [u32; 2usize],
+    pub segments: [[cras_shm_segment; 8usize]; 2usize],
+    pub ring_size: u32,
+    pub ring_read: u32,
+    pub ring_write: u32,
 }
 #[test]
 fn bindgen_test_layout_cras_audio_shm_header() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_shm_header>(),
-        88usize,
+        320usize,
         concat!("Size of: ", stringify!(cras_audio_shm_header))
     );
     assert_eq!(
@@ -4879,6 +6017,114 @@ fn bindgen_test_layout_cras_audio_shm_header() {
             stringify!(buffer_offset)
         )
     );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).doorbell as *const _ as usize },
+        88usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(doorbell)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).doorbell_seq as *const _ as usize
+        },
+        92usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(doorbell_seq)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).doorbell_id as *const _ as usize
+        },
+        96usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(doorbell_id)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).doorbell_frames as *const _ as usize
+        },
+        100usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(doorbell_frames)
+        )
+    );
+    assert_eq!(
+        unsafe {
+            &(*(::std::ptr::null::<cras_audio_shm_header>())).reply_wanted as *const _ as usize
+        },
+        104usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(reply_wanted)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).num_segments as *const _ as usize },
+        108usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(num_segments)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).segments as *const _ as usize },
+        116usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(segments)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).ring_size as *const _ as usize },
+        308usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(ring_size)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).ring_read as *const _ as usize },
+        312usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(ring_read)
+        )
+    );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm_header>())).ring_write as *const _ as usize },
+        316usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm_header),
+            "::",
+            stringify!(ring_write)
+        )
+    );
 }
 #[repr(C)]
 #[derive(Copy, Clone)]
@@ -4938,12 +6184,13 @@ pub struct cras_audio_shm {
     pub header: *mut cras_audio_shm_header,
     pub samples_info: cras_shm_info,
     pub samples: *mut u8,
+    pub ring_size: u32,
 }
 #[test]
 fn bindgen_test_layout_cras_audio_shm() {
     assert_eq!(
         ::std::mem::size_of::<cras_audio_shm>(),
-        568usize,
+        576usize,
         concat!("Size of: ", stringify!(cras_audio_shm))
     );
     assert_eq!(
@@ -5001,4 +6248,14 @@ fn bindgen_test_layout_cras_audio_shm() {
             stringify!(samples)
         )
     );
+    assert_eq!(
+        unsafe { &(*(::std::ptr::null::<cras_audio_shm>())).ring_size as *const _ as usize },
+        568usize,
+        concat!(
+            "Offset of field: ",
+            stringify!(cras_audio_shm),
+            "::",
+            stringify!(ring_size)
+        )
+    );
 }
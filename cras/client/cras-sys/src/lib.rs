@@ -21,8 +21,8 @@ pub mod gen;
 use gen::{
     _snd_pcm_format, audio_dev_debug_info, audio_message, audio_stream_debug_info,
     cras_audio_format_packed, cras_iodev_info, cras_ionode_info, cras_ionode_info__bindgen_ty_1,
-    cras_timespec, snd_pcm_format_t, CRAS_AUDIO_MESSAGE_ID, CRAS_CHANNEL, CRAS_CLIENT_TYPE,
-    CRAS_NODE_TYPE, CRAS_STREAM_DIRECTION, CRAS_STREAM_EFFECT, CRAS_STREAM_TYPE,
+    cras_latency_hist, cras_timespec, snd_pcm_format_t, CRAS_AUDIO_MESSAGE_ID, CRAS_CHANNEL,
+    CRAS_CLIENT_TYPE, CRAS_NODE_TYPE, CRAS_STREAM_DIRECTION, CRAS_STREAM_EFFECT, CRAS_STREAM_TYPE,
 };
 
 use audio_streams::{SampleFormat, StreamDirection, StreamEffect};
@@ -38,6 +38,7 @@ unsafe impl data_model::DataInit for gen::cras_disconnect_stream_message {}
 unsafe impl data_model::DataInit for gen::cras_dump_audio_thread {}
 unsafe impl data_model::DataInit for gen::cras_iodev_info {}
 unsafe impl data_model::DataInit for gen::cras_ionode_info {}
+unsafe impl data_model::DataInit for gen::cras_register_notification {}
 unsafe impl data_model::DataInit for gen::cras_server_state {}
 unsafe impl data_model::DataInit for gen::cras_set_system_mute {}
 unsafe impl data_model::DataInit for gen::cras_set_system_volume {}
@@ -306,6 +307,15 @@ impl From<u32> for CRAS_STREAM_DIRECTION {
     }
 }
 
+impl Default for cras_latency_hist {
+    fn default() -> Self {
+        Self {
+            counts: [0; 64],
+            max_usec: 0,
+        }
+    }
+}
+
 impl Default for audio_dev_debug_info {
     fn default() -> Self {
         Self {
@@ -326,6 +336,8 @@ impl Default for audio_dev_debug_info {
             longest_wake_sec: 0,
             longest_wake_nsec: 0,
             software_gain_scaler: 0.0,
+            stage_hist: [Default::default(); 2],
+            num_coalesced_fetches: 0,
         }
     }
 }
@@ -463,8 +475,10 @@ impl Default for audio_stream_debug_info {
             pinned_dev_idx: 0,
             runtime_sec: 0,
             runtime_nsec: 0,
+            latency_us: 0,
             stream_volume: 0.0,
             channel_layout: [0; 11],
+            stage_hist: [Default::default(); 2],
         }
     }
 }
@@ -511,6 +525,7 @@ pub struct AudioStreamDebugInfo {
     pub is_pinned: bool,
     pub pinned_dev_idx: u32,
     pub runtime: Duration,
+    pub latency: Duration,
     pub stream_volume: f64,
     pub channel_layout: Vec<CRAS_CHANNEL>,
 }
@@ -543,6 +558,7 @@ impl TryFrom<audio_stream_debug_info> for AudioStreamDebugInfo {
             is_pinned: info.is_pinned != 0,
             pinned_dev_idx: info.pinned_dev_idx,
             runtime: Duration::new(info.runtime_sec.into(), info.runtime_nsec),
+            latency: Duration::from_micros(info.latency_us.into()),
             stream_volume: info.stream_volume,
             channel_layout,
         })
@@ -579,6 +595,7 @@ impl fmt::Display for AudioStreamDebugInfo {
             _ => (),
         };
         writeln!(f, "  Runtime: {:?}", self.runtime)?;
+        writeln!(f, "  Latency: {:?}", self.latency)?;
         write!(f, "  Channel map:")?;
         for channel in &self.channel_layout {
             write!(f, " {:?}", channel)?;
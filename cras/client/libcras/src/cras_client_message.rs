@@ -27,6 +27,7 @@ pub enum Error {
     MessageTruncated,
     MessageIdError,
     MessageFromSliceError,
+    StreamConnectError(i32),
 }
 
 impl error::Error for Error {}
@@ -44,6 +45,11 @@ impl fmt::Display for Error {
             Error::MessageIdError => write!(f, "No such id"),
             Error::MessageFromSliceError => write!(f, "Message from slice error"),
             Error::InvalidSize => write!(f, "Invalid data size"),
+            Error::StreamConnectError(err) => write!(
+                f,
+                "Server failed to connect stream: {}",
+                io::Error::from_raw_os_error(-err)
+            ),
         }
     }
 }
@@ -81,6 +87,7 @@ pub enum ServerResult {
     /// stream_id, header_fd, samples_fd
     StreamConnected(u32, CrasAudioShmHeaderFd, CrasShmFd),
     DebugInfoReady,
+    NodesChanged,
 }
 
 impl ServerResult {
@@ -115,6 +122,7 @@ impl ServerResult {
             CRAS_CLIENT_MESSAGE_ID::CRAS_CLIENT_AUDIO_DEBUG_INFO_READY => {
                 Ok(ServerResult::DebugInfoReady)
             }
+            CRAS_CLIENT_MESSAGE_ID::CRAS_CLIENT_NODES_CHANGED => Ok(ServerResult::NodesChanged),
             _ => Err(Error::MessageTypeError),
         }
     }
@@ -162,14 +170,19 @@ impl CrasClientMessage {
                 1 => Ok(()),
                 _ => Err(Error::MessageNumFdError),
             },
-            CRAS_CLIENT_STREAM_CONNECTED => match fd_nums {
-                // CRAS should return two shared memory areas the first which has
-                // mem::size_of::<cras_audio_shm_header>() bytes, and the second which has
-                // `samples_shm_size` bytes.
-                2 => Ok(()),
-                _ => Err(Error::MessageNumFdError),
-            },
-            CRAS_CLIENT_AUDIO_DEBUG_INFO_READY => match fd_nums {
+            CRAS_CLIENT_STREAM_CONNECTED => {
+                let cmsg: &cras_client_stream_connected = self.get_message()?;
+                match (cmsg.err, fd_nums) {
+                    // CRAS should return two shared memory areas the first which has
+                    // mem::size_of::<cras_audio_shm_header>() bytes, and the second which has
+                    // `samples_shm_size` bytes.
+                    (0, 2) => Ok(()),
+                    // A stream the server rejected is replied to with its error and no fds.
+                    (err, 0) if err != 0 => Err(Error::StreamConnectError(err)),
+                    _ => Err(Error::MessageNumFdError),
+                }
+            }
+            CRAS_CLIENT_AUDIO_DEBUG_INFO_READY | CRAS_CLIENT_NODES_CHANGED => match fd_nums {
                 0 => Ok(()),
                 _ => Err(Error::MessageNumFdError),
             },
@@ -186,6 +199,7 @@ impl CrasClientMessage {
             id if id == (CRAS_CLIENT_AUDIO_DEBUG_INFO_READY as u32) => {
                 Ok(CRAS_CLIENT_AUDIO_DEBUG_INFO_READY)
             }
+            id if id == (CRAS_CLIENT_NODES_CHANGED as u32) => Ok(CRAS_CLIENT_NODES_CHANGED),
             _ => Err(Error::MessageIdError),
         }
     }
@@ -198,3 +212,52 @@ impl CrasClientMessage {
         T::from_slice(&self.data[..mem::size_of::<T>()]).ok_or(Error::MessageFromSliceError)
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use cras_sys::gen::{_snd_pcm_format, cras_audio_format_packed, CRAS_STREAM_DIRECTION};
+
+    fn stream_connected_message(stream_id: u32, err: i32) -> cras_client_stream_connected {
+        cras_client_stream_connected {
+            header: cras_client_message {
+                length: mem::size_of::<cras_client_stream_connected>() as u32,
+                id: CRAS_CLIENT_STREAM_CONNECTED,
+            },
+            err,
+            stream_id,
+            format: cras_audio_format_packed::new(
+                _snd_pcm_format::SND_PCM_FORMAT_S16_LE,
+                48000,
+                2,
+                CRAS_STREAM_DIRECTION::CRAS_STREAM_OUTPUT,
+            ),
+            samples_shm_size: 0,
+            effects: 0,
+        }
+    }
+
+    #[test]
+    fn stream_connected_with_error() {
+        let (server, client) = CrasServerSocket::pair().unwrap();
+        server
+            .send_server_message_with_fds(&stream_connected_message(1, -libc::EINVAL), &[])
+            .unwrap();
+        match ServerResult::handle_server_message(&client) {
+            Err(Error::StreamConnectError(err)) => assert_eq!(err, -libc::EINVAL),
+            _ => panic!("Expected StreamConnectError"),
+        }
+    }
+
+    #[test]
+    fn stream_connected_without_fds() {
+        let (server, client) = CrasServerSocket::pair().unwrap();
+        server
+            .send_server_message_with_fds(&stream_connected_message(1, 0), &[])
+            .unwrap();
+        match ServerResult::handle_server_message(&client) {
+            Err(Error::MessageNumFdError) => (),
+            _ => panic!("Expected MessageNumFdError"),
+        }
+    }
+}
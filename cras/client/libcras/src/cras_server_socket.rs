@@ -82,6 +82,16 @@ impl CrasServerSocket {
         Ok(CrasServerSocket { socket: new_sock })
     }
 
+    /// Creates a pair of connected sockets, so tests can play the server on one of them.
+    #[cfg(test)]
+    pub fn pair() -> io::Result<(CrasServerSocket, CrasServerSocket)> {
+        let (sock1, sock2) = UnixSeqpacket::pair()?;
+        Ok((
+            CrasServerSocket { socket: sock1 },
+            CrasServerSocket { socket: sock2 },
+        ))
+    }
+
     /// Send a message to request disconnection of the given stream.
     ///
     /// Builds a `cras_disconnect_stream_message` containing `stream_id` and
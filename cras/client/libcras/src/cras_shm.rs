@@ -13,8 +13,9 @@ use std::thread;
 
 use cras_sys::gen::{
     audio_dev_debug_info, audio_stream_debug_info, cras_audio_shm_header, cras_iodev_info,
-    cras_ionode_info, cras_server_state, CRAS_MAX_IODEVS, CRAS_MAX_IONODES, CRAS_NUM_SHM_BUFFERS,
-    CRAS_SERVER_STATE_VERSION, CRAS_SHM_BUFFERS_MASK, MAX_DEBUG_DEVS, MAX_DEBUG_STREAMS,
+    cras_ionode_info, cras_server_state, cras_shm_segment, CRAS_MAX_IODEVS, CRAS_MAX_IONODES,
+    CRAS_NUM_SHM_BUFFERS, CRAS_SERVER_STATE_VERSION, CRAS_SHM_BUFFERS_MASK, CRAS_SHM_MAX_SEGMENTS,
+    MAX_DEBUG_DEVS, MAX_DEBUG_STREAMS,
 };
 use cras_sys::{
     AudioDebugInfo, AudioDevDebugInfo, AudioStreamDebugInfo, CrasIodevInfo, CrasIonodeInfo,
@@ -63,6 +64,7 @@ pub struct CrasAudioHeader<'a> {
     read_offset: [VolatileRef<'a, u32>; CRAS_NUM_SHM_BUFFERS as usize],
     write_offset: [VolatileRef<'a, u32>; CRAS_NUM_SHM_BUFFERS as usize],
     buffer_offset: [VolatileRef<'a, u64>; CRAS_NUM_SHM_BUFFERS as usize],
+    num_segments: [VolatileRef<'a, u32>; CRAS_NUM_SHM_BUFFERS as usize],
 }
 
 // It is safe to send audio buffers between threads as this struct has exclusive ownership of the
@@ -133,6 +135,10 @@ impl<'a> CrasAudioHeader<'a> {
                     vref_from_addr!(addr, buffer_offset[0]),
                     vref_from_addr!(addr, buffer_offset[1]),
                 ],
+                num_segments: [
+                    vref_from_addr!(addr, num_segments[0]),
+                    vref_from_addr!(addr, num_segments[1]),
+                ],
             })
         }
     }
@@ -386,6 +392,84 @@ impl<'a> CrasAudioHeader<'a> {
 
         let buffer_offset = self.buffer_offset.get(idx).ok_or_else(index_out_of_range)?;
         buffer_offset.store(offset as u64);
+        self.num_segments[idx].store(0);
+        Ok(())
+    }
+
+    /// Sets the audio buffer `idx` to be made of several regions of the
+    /// samples area, in order, so that CRAS reads the samples for that buffer
+    /// from them without the client copying them together first. Only
+    /// playback buffers can be split.
+    ///
+    /// # Arguments
+    /// `idx` - 0 <= `idx` < `CRAS_NUM_SHM_BUFFERS`
+    /// `segments` - The `(offset, length)` in bytes of each region.
+    ///
+    /// # Errors
+    /// If `idx` is out of range
+    /// If the segments are invalid, which can happen if
+    ///  * there are none or more than `CRAS_SHM_MAX_SEGMENTS`
+    ///  * one is outside of the samples area
+    ///  * a length isn't a multiple of `frame_size`
+    ///  * the lengths add up to more than `used_size`
+    pub fn set_buffer_segments(
+        &mut self,
+        idx: usize,
+        segments: &[(usize, usize)],
+    ) -> io::Result<()> {
+        if idx >= CRAS_NUM_SHM_BUFFERS as usize {
+            return Err(index_out_of_range());
+        }
+        if segments.is_empty() || segments.len() > CRAS_SHM_MAX_SEGMENTS as usize {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                format!("Invalid number of buffer segments {}.", segments.len()),
+            ));
+        }
+
+        let frame_size = self.get_frame_size();
+        let mut total = 0;
+        for &(offset, len) in segments {
+            if offset > self.samples_len || len > self.samples_len - offset || len % frame_size != 0
+            {
+                return Err(io::Error::new(
+                    io::ErrorKind::InvalidInput,
+                    format!(
+                        "Invalid buffer segment [{}, {}) in samples area of length {}.",
+                        offset,
+                        offset + len,
+                        self.samples_len
+                    ),
+                ));
+            }
+            total += len;
+        }
+        if total > self.get_used_size() {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidInput,
+                "Buffer segments are larger than used_size",
+            ));
+        }
+
+        let header = self.addr as *mut cras_audio_shm_header;
+        for (i, &(offset, len)) in segments.iter().enumerate() {
+            // Safe because `header` points to the mapped cras_audio_shm_header
+            // owned by this struct and `idx` and `i` are in range. The packed
+            // segments aren't aligned, so they are written unaligned. The
+            // server reads them only after the next message on the audio
+            // socket.
+            unsafe {
+                ptr::write_unaligned(
+                    ptr::addr_of_mut!((*header).segments[idx][i]),
+                    cras_shm_segment {
+                        offset: offset as u64,
+                        bytes: len as u32,
+                    },
+                );
+            }
+        }
+        self.buffer_offset[idx].store(segments[0].0 as u64);
+        self.num_segments[idx].store(segments.len() as u32);
         Ok(())
     }
 
@@ -1,11 +1,12 @@
 // Copyright 2019 The Chromium OS Authors. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
+use std::os::unix::io::{AsRawFd, RawFd};
 use std::time::Duration;
 use std::{error, fmt};
 
 use audio_streams::{
-    shm_streams::{BufferSet, ServerRequest, ShmStream},
+    shm_streams::{BufferRegion, BufferSet, ServerRequest, ShmStream},
     BoxError, SampleFormat, StreamDirection,
 };
 use cras_sys::gen::CRAS_AUDIO_MESSAGE_ID;
@@ -19,6 +20,7 @@ use crate::cras_shm::{self, CrasAudioHeader, CrasAudioShmHeaderFd};
 pub enum Error {
     MessageTypeError,
     CaptureBufferTooSmall,
+    CaptureBufferSplit,
 }
 
 impl error::Error for Error {}
@@ -31,6 +33,7 @@ impl fmt::Display for Error {
                 f,
                 "Capture buffer too small, must have size at least 'used_size'."
             ),
+            Error::CaptureBufferSplit => write!(f, "Capture buffers can't be split in regions."),
         }
     }
 }
@@ -143,6 +146,10 @@ impl<'a> ShmStream for CrasShmStream<'a> {
             _ => Err(Box::new(Error::MessageTypeError)),
         }
     }
+
+    fn wait_fd(&self) -> Option<RawFd> {
+        Some(self.audio_socket.as_raw_fd())
+    }
 }
 
 impl BufferSet for CrasShmStream<'_> {
@@ -176,6 +183,30 @@ impl BufferSet for CrasShmStream<'_> {
         Ok(())
     }
 
+    fn callback_vectored(&mut self, regions: &[BufferRegion]) -> Result<(), BoxError> {
+        if let [region] = regions {
+            return self.callback(region.offset, region.frames);
+        }
+        // CRAS writes captured samples contiguously.
+        if self.direction == StreamDirection::Capture {
+            return Err(Box::new(Error::CaptureBufferSplit));
+        }
+
+        let segments: Vec<(usize, usize)> = regions
+            .iter()
+            .map(|r| (r.offset, r.frames * self.frame_size))
+            .collect();
+        self.header
+            .set_buffer_segments(self.next_buffer_idx, &segments)?;
+        self.next_buffer_idx ^= 1;
+        let frames = regions.iter().map(|r| r.frames).sum::<usize>() as u32;
+
+        self.header.commit_written_frames(frames)?;
+        // Notify CRAS that we've made playback data available.
+        self.audio_socket.data_ready(frames)?;
+        Ok(())
+    }
+
     fn ignore(&mut self) -> Result<(), BoxError> {
         // We send an empty buffer for an ignored playback request since the
         // server will not read from a 0-length buffer. We don't do anything for
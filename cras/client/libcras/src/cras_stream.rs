@@ -4,6 +4,7 @@
 use std::cmp::min;
 use std::io;
 use std::marker::PhantomData;
+use std::os::unix::io::{AsRawFd, RawFd};
 use std::{error, fmt};
 
 use audio_streams::{
@@ -46,6 +47,7 @@ pub trait CrasStreamData<'a>: Send {
     // Creates `CrasStreamData` with only `AudioSocket`.
     fn new(audio_sock: AudioSocket, header: CrasAudioHeader<'a>) -> Self;
     fn header_mut(&mut self) -> &mut CrasAudioHeader<'a>;
+    fn audio_sock(&self) -> &AudioSocket;
     fn audio_sock_mut(&mut self) -> &mut AudioSocket;
 }
 
@@ -64,6 +66,10 @@ impl<'a> CrasStreamData<'a> for CrasPlaybackData<'a> {
         &mut self.header
     }
 
+    fn audio_sock(&self) -> &AudioSocket {
+        &self.audio_sock
+    }
+
     fn audio_sock_mut(&mut self) -> &mut AudioSocket {
         &mut self.audio_sock
     }
@@ -96,6 +102,10 @@ impl<'a> CrasStreamData<'a> for CrasCaptureData<'a> {
         &mut self.header
     }
 
+    fn audio_sock(&self) -> &AudioSocket {
+        &self.audio_sock
+    }
+
     fn audio_sock_mut(&mut self) -> &mut AudioSocket {
         &mut self.audio_sock
     }
@@ -206,6 +216,10 @@ impl<'a, T: CrasStreamData<'a> + BufferDrop> PlaybackBufferStream for CrasStream
 
         PlaybackBuffer::new(frame_size, buf, &mut self.controls).map_err(Box::from)
     }
+
+    fn wait_fd(&self) -> Option<RawFd> {
+        Some(self.controls.audio_sock().as_raw_fd())
+    }
 }
 
 impl<'a, T: CrasStreamData<'a> + BufferDrop> CaptureBufferStream for CrasStream<'a, T> {
@@ -221,4 +235,8 @@ impl<'a, T: CrasStreamData<'a> + BufferDrop> CaptureBufferStream for CrasStream<
 
         CaptureBuffer::new(frame_size, buf, &mut self.controls).map_err(Box::from)
     }
+
+    fn wait_fd(&self) -> Option<RawFd> {
+        Some(self.controls.audio_sock().as_raw_fd())
+    }
 }
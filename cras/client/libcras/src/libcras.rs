@@ -122,6 +122,7 @@ use std::os::unix::{
     io::{AsRawFd, RawFd},
     net::UnixStream,
 };
+use std::time::Duration;
 use std::{error, fmt};
 
 pub use audio_streams::BoxError;
@@ -145,7 +146,7 @@ mod cras_server_socket;
 use crate::cras_server_socket::CrasServerSocket;
 pub use crate::cras_server_socket::CrasSocketType;
 mod cras_shm;
-use crate::cras_shm::CrasServerState;
+use crate::cras_shm::{CrasAudioShmHeaderFd, CrasServerState, CrasShmFd};
 pub mod cras_shm_stream;
 use crate::cras_shm_stream::CrasShmStream;
 mod cras_stream;
@@ -378,6 +379,48 @@ impl<'a> CrasClient<'a> {
         }
     }
 
+    /// Asks the server to notify this client when nodes are added or removed.
+    ///
+    /// Register before inspecting the nodes that are waited for, so that a change right
+    /// after the inspection is not missed by `wait_node_change`.
+    ///
+    /// # Errors
+    ///
+    /// If writing the message to the server socket failed.
+    pub fn register_node_change(&mut self) -> Result<()> {
+        let header = cras_server_message {
+            length: mem::size_of::<cras_register_notification>() as u32,
+            id: CRAS_SERVER_MESSAGE_ID::CRAS_SERVER_REGISTER_NOTIFICATION,
+        };
+        let msg = cras_register_notification {
+            header,
+            msg_id: CRAS_CLIENT_MESSAGE_ID::CRAS_CLIENT_NODES_CHANGED as u32,
+            do_register: 1,
+        };
+
+        self.server_socket.send_server_message_with_fds(&msg, &[])?;
+        Ok(())
+    }
+
+    /// Blocks until the server notifies a node change or `timeout` passes.
+    /// `register_node_change` must have been called first.
+    ///
+    /// # Results
+    ///
+    /// * `true` if the nodes changed, `false` if it timed out.
+    ///
+    /// # Errors
+    ///
+    /// * If waiting on the server socket failed.
+    /// * If an unexpected message is received.
+    pub fn wait_node_change(&mut self, timeout: Duration) -> Result<bool> {
+        match CrasClient::wait_for_message_timeout(&mut self.server_socket, Some(timeout))? {
+            Some(ServerResult::NodesChanged) => Ok(true),
+            Some(_) => Err(Error::MessageTypeError),
+            None => Ok(false),
+        }
+    }
+
     // Gets next server_stream_id from client and increment stream_id counter.
     fn next_server_stream_id(&mut self) -> u32 {
         let res = self.next_stream_id;
@@ -435,24 +478,21 @@ impl<'a> CrasClient<'a> {
             .send_server_message_with_fds(&server_cmsg, &socks)?;
 
         let audio_socket = AudioSocket::new(sock1);
-        loop {
-            let result = CrasClient::wait_for_message(&mut self.server_socket)?;
-            if let ServerResult::StreamConnected(_stream_id, header_fd, samples_fd) = result {
-                return CrasStream::try_new(
-                    stream_id,
-                    self.server_socket.try_clone()?,
-                    block_size,
-                    direction,
-                    rate,
-                    channel_num,
-                    format.into(),
-                    audio_socket,
-                    header_fd,
-                    samples_fd,
-                )
-                .map_err(Error::CrasStreamError);
-            }
-        }
+        let (header_fd, samples_fd) =
+            CrasClient::wait_for_stream_connected(&mut self.server_socket, stream_id)?;
+        CrasStream::try_new(
+            stream_id,
+            self.server_socket.try_clone()?,
+            block_size,
+            direction,
+            rate,
+            channel_num,
+            format.into(),
+            audio_socket,
+            header_fd,
+            samples_fd,
+        )
+        .map_err(Error::CrasStreamError)
     }
 
     /// Creates a new playback stream pinned to the device at `device_index`.
@@ -523,6 +563,15 @@ impl<'a> CrasClient<'a> {
 
     // Blocks handling the first server message received from `socket`.
     fn wait_for_message(socket: &mut CrasServerSocket) -> Result<ServerResult> {
+        CrasClient::wait_for_message_timeout(socket, None)?.ok_or(Error::UnexpectedExit)
+    }
+
+    // Blocks handling the first server message received from `socket`, or returns `None`
+    // if there is none in `timeout`.
+    fn wait_for_message_timeout(
+        socket: &mut CrasServerSocket,
+        timeout: Option<Duration>,
+    ) -> Result<Option<ServerResult>> {
         #[derive(PollToken)]
         enum Token {
             ServerMsg,
@@ -530,18 +579,34 @@ impl<'a> CrasClient<'a> {
         let poll_ctx: PollContext<Token> =
             PollContext::new().and_then(|pc| pc.add(socket, Token::ServerMsg).and(Ok(pc)))?;
 
-        let events = poll_ctx.wait()?;
+        let events = match timeout {
+            Some(timeout) => poll_ctx.wait_timeout(timeout)?,
+            None => poll_ctx.wait()?,
+        };
         // Check the first readable message
         let tokens: Vec<Token> = events.iter_readable().map(|e| e.token()).collect();
-        tokens
-            .get(0)
-            .ok_or(Error::UnexpectedExit)
-            .and_then(|ref token| {
-                match token {
-                    Token::ServerMsg => ServerResult::handle_server_message(socket),
+        match tokens.get(0) {
+            Some(Token::ServerMsg) => Ok(Some(ServerResult::handle_server_message(socket)?)),
+            None if timeout.is_some() => Ok(None),
+            None => Err(Error::UnexpectedExit),
+        }
+    }
+
+    // Blocks until the server replies to the connect of `stream_id`, skipping the replies
+    // to other streams.
+    fn wait_for_stream_connected(
+        socket: &mut CrasServerSocket,
+        stream_id: u32,
+    ) -> Result<(CrasAudioShmHeaderFd, CrasShmFd)> {
+        loop {
+            if let ServerResult::StreamConnected(id, header_fd, samples_fd) =
+                CrasClient::wait_for_message(socket)?
+            {
+                if id == stream_id {
+                    return Ok((header_fd, samples_fd));
                 }
-                .map_err(Into::into)
-            })
+            }
+        }
     }
 
     /// Returns any open file descriptors needed by CrasClient.
@@ -673,27 +738,69 @@ impl<'a> ShmStreamSource for CrasClient<'a> {
         self.server_socket
             .send_server_message_with_fds(&server_cmsg, &fds)?;
 
-        loop {
-            let result = CrasClient::wait_for_message(&mut self.server_socket)?;
-            if let ServerResult::StreamConnected(_stream_id, header_fd, _samples_fd) = result {
-                let audio_socket = AudioSocket::new(sock1);
-                let stream = CrasShmStream::try_new(
-                    stream_id,
-                    self.server_socket.try_clone()?,
-                    audio_socket,
-                    direction,
-                    num_channels,
-                    frame_rate,
-                    format,
-                    header_fd,
-                    client_shm.size() as usize,
-                )?;
-                return Ok(Box::new(stream));
-            }
-        }
+        let (header_fd, _samples_fd) =
+            CrasClient::wait_for_stream_connected(&mut self.server_socket, stream_id)?;
+        let audio_socket = AudioSocket::new(sock1);
+        let stream = CrasShmStream::try_new(
+            stream_id,
+            self.server_socket.try_clone()?,
+            audio_socket,
+            direction,
+            num_channels,
+            frame_rate,
+            format,
+            header_fd,
+            client_shm.size() as usize,
+        )?;
+        Ok(Box::new(stream))
     }
 
     fn keep_fds(&self) -> Vec<RawFd> {
         CrasClient::keep_fds(self)
     }
 }
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn stream_connected_message(stream_id: u32) -> cras_client_stream_connected {
+        cras_client_stream_connected {
+            header: cras_sys::gen::cras_client_message {
+                length: mem::size_of::<cras_client_stream_connected>() as u32,
+                id: CRAS_CLIENT_MESSAGE_ID::CRAS_CLIENT_STREAM_CONNECTED,
+            },
+            err: 0,
+            stream_id,
+            format: cras_audio_format_packed::new(
+                _snd_pcm_format::SND_PCM_FORMAT_S16_LE,
+                48000,
+                2,
+                CRAS_STREAM_DIRECTION::CRAS_STREAM_OUTPUT,
+            ),
+            samples_shm_size: 0,
+            effects: 0,
+        }
+    }
+
+    #[test]
+    fn stream_connected_for_other_stream_is_skipped() {
+        let (server, mut client) = CrasServerSocket::pair().unwrap();
+        let (sock1, sock2) = UnixStream::pair().unwrap();
+        let fds = [sock1.as_raw_fd(), sock2.as_raw_fd()];
+        server
+            .send_server_message_with_fds(&stream_connected_message(2), &fds)
+            .unwrap();
+        server
+            .send_server_message_with_fds(&stream_connected_message(1), &fds)
+            .unwrap();
+
+        assert!(CrasClient::wait_for_stream_connected(&mut client, 1).is_ok());
+        // Both replies have been read.
+        assert!(
+            CrasClient::wait_for_message_timeout(&mut client, Some(Duration::from_millis(0)))
+                .unwrap()
+                .is_none()
+        );
+    }
+}
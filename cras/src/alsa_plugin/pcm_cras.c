@@ -110,6 +110,23 @@ static snd_pcm_sframes_t snd_pcm_cras_pointer(snd_pcm_ioplug_t *io)
 	return pcm_cras->hw_ptr;
 }
 
+/* Returns non-zero if the ALSA areas are a single interleaved buffer, laid out
+ * like the CRAS samples so that frames can be copied as one block. */
+static int areas_match_cras(const snd_pcm_ioplug_t *io,
+			    const snd_pcm_channel_area_t *areas)
+{
+	unsigned int sample_bits = snd_pcm_format_physical_width(io->format);
+	size_t chan;
+
+	for (chan = 0; chan < io->channels; chan++) {
+		if (areas[chan].addr != areas[0].addr ||
+		    areas[chan].first != chan * sample_bits ||
+		    areas[chan].step != sample_bits * io->channels)
+			return 0;
+	}
+	return 1;
+}
+
 /* Main callback for processing audio.  This is called by CRAS when more samples
  * are needed (playback) or ready (capture).  Copies bytes between ALSA and CRAS
  * buffers. */
@@ -126,8 +143,8 @@ static int pcm_cras_process_cb(struct cras_client *client,
 	snd_pcm_uframes_t copied_frames;
 	char empty_byte;
 	size_t chan, frame_bytes, sample_bytes;
-	int rc;
-	uint8_t *samples;
+	int rc, block_copy;
+	uint8_t *samples, *alsa_samples;
 	const struct timespec *sample_time;
 
 	samples = capture_samples ?: playback_samples;
@@ -169,6 +186,7 @@ static int pcm_cras_process_cb(struct cras_client *client,
 	}
 
 	areas = snd_pcm_ioplug_mmap_areas(io);
+	block_copy = areas_match_cras(io, areas);
 
 	copied_frames = 0;
 	while (copied_frames < nframes) {
@@ -178,18 +196,31 @@ static int pcm_cras_process_cb(struct cras_client *client,
 		if (frames > remain)
 			frames = remain;
 
-		for (chan = 0; chan < io->channels; chan++)
+		if (block_copy) {
+			alsa_samples = (uint8_t *)areas[0].addr +
+				       pcm_cras->hw_ptr * frame_bytes;
 			if (io->stream == SND_PCM_STREAM_PLAYBACK)
-				snd_pcm_area_copy(&pcm_cras->areas[chan],
-						  copied_frames, &areas[chan],
-						  pcm_cras->hw_ptr, frames,
-						  io->format);
+				memcpy(samples + copied_frames * frame_bytes,
+				       alsa_samples, frames * frame_bytes);
 			else
-				snd_pcm_area_copy(&areas[chan],
-						  pcm_cras->hw_ptr,
-						  &pcm_cras->areas[chan],
-						  copied_frames, frames,
-						  io->format);
+				memcpy(alsa_samples,
+				       samples + copied_frames * frame_bytes,
+				       frames * frame_bytes);
+		} else {
+			for (chan = 0; chan < io->channels; chan++)
+				if (io->stream == SND_PCM_STREAM_PLAYBACK)
+					snd_pcm_area_copy(
+						&pcm_cras->areas[chan],
+						copied_frames, &areas[chan],
+						pcm_cras->hw_ptr, frames,
+						io->format);
+				else
+					snd_pcm_area_copy(
+						&areas[chan], pcm_cras->hw_ptr,
+						&pcm_cras->areas[chan],
+						copied_frames, frames,
+						io->format);
+		}
 
 		pcm_cras->hw_ptr += frames;
 		pcm_cras->hw_ptr %= io->buffer_size;
@@ -0,0 +1,120 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include <memory>
+
+extern "C" {
+#include "audio_thread_log.h"
+#include "cras_main_thread_log.h"
+#include "cras_util.h"
+}
+
+#include "offline_render.h"
+
+namespace {
+
+// One 10ms period at 48kHz.
+static const size_t kCbThreshold = 480;
+// Virtual time rendered per iteration.
+static const timespec kRenderTime = {0, 500000000};
+
+// How the streams differ from the 48kHz stereo device.
+enum StreamKind {
+  kSameFormat,  // 48kHz stereo, mixed as is.
+  kResampled,   // 44.1kHz stereo, resampled.
+  kMono,        // 48kHz mono, channel converted.
+  kMixed,       // The three above in turn.
+};
+
+static cras_audio_format Format(size_t rate, size_t num_channels) {
+  cras_audio_format fmt = {};
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = rate;
+  fmt.num_channels = num_channels;
+  for (size_t i = 0; i < CRAS_CH_MAX; i++)
+    fmt.channel_layout[i] = i < num_channels ? i : -1;
+  return fmt;
+}
+
+static cras_audio_format StreamFormat(StreamKind kind, unsigned int idx) {
+  if (kind == kMixed)
+    kind = static_cast<StreamKind>(idx % kMixed);
+  switch (kind) {
+    case kResampled:
+      return Format(44100, 2);
+    case kMono:
+      return Format(48000, 1);
+    default:
+      return Format(48000, 2);
+  }
+}
+
+// The server logs to these, as the audio thread and main thread do.
+static void InitLogs() {
+  if (!atlog) {
+    atlog = static_cast<audio_thread_event_log*>(calloc(1, sizeof(*atlog)));
+    atlog->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+  }
+  if (!main_log)
+    main_log = main_thread_event_log_init();
+}
+
+// Args: stream kind, streams, devices.
+// Renders playback through dev_io_run, with the mixing, conversion and
+// volume code of the server, on offline devices that play to nowhere.
+// Reports the host time per dev_io_run and per device frame.
+static void BM_DevIoRunOutput(benchmark::State& state) {
+  StreamKind kind = static_cast<StreamKind>(state.range(0));
+  unsigned int num_streams = state.range(1);
+  unsigned int num_devs = state.range(2);
+  cras_audio_format dev_fmt = Format(48000, 2);
+  uint64_t real_ns = 0, num_wakes = 0;
+
+  InitLogs();
+  OfflineRender render(CRAS_STREAM_OUTPUT, dev_fmt, kCbThreshold, -1);
+  if (!render.Ok()) {
+    state.SkipWithError("Failed to open the device");
+    return;
+  }
+  for (unsigned int i = 1; i < num_devs; i++)
+    if (render.AddDevice(-1)) {
+      state.SkipWithError("Failed to open a device");
+      return;
+    }
+  for (unsigned int i = 0; i < num_streams; i++) {
+    cras_audio_format fmt = StreamFormat(kind, i);
+    size_t cb_threshold = kCbThreshold * fmt.frame_rate / dev_fmt.frame_rate;
+
+    if (render.AddStream(fmt, cb_threshold, -1)) {
+      state.SkipWithError("Failed to add a stream");
+      return;
+    }
+  }
+  // Get past the start of the streams and devices.
+  render.Run(kRenderTime);
+
+  for (auto _ : state) {
+    OfflineRenderStats stats = render.Run(kRenderTime);
+
+    real_ns += stats.real_ns;
+    num_wakes += stats.num_wakes;
+  }
+
+  uint64_t frames = state.iterations() * num_devs * dev_fmt.frame_rate *
+                    timespec_to_ms(&kRenderTime) / 1000;
+  state.SetItemsProcessed(frames);
+  state.counters["ns_per_wake"] = num_wakes ? real_ns / num_wakes : 0;
+  state.counters["ns_per_frame"] = frames ? (double)real_ns / frames : 0;
+}
+
+BENCHMARK(BM_DevIoRunOutput)
+    ->ArgsProduct({benchmark::CreateDenseRange(kSameFormat, kMixed, 1),
+                   {1, 2, 4, 8},
+                   {1, 2, 4}})
+    ->ArgNames({"kind", "streams", "devs"});
+
+}  // namespace
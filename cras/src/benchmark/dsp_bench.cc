@@ -0,0 +1,186 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+#include <math.h>
+
+#include <vector>
+
+extern "C" {
+#include "crossover2.h"
+#include "drc.h"
+#include "dsp_util.h"
+#include "eq2.h"
+}
+
+namespace {
+
+static const float kSampleRate = 48000;
+static const float kNyquist = kSampleRate / 2;
+
+// Fills buf with a 1kHz tone at half scale, so the filters and the
+// compressor work on a signal rather than on silence.
+static void FillTone(std::vector<float>& buf) {
+  for (size_t i = 0; i < buf.size(); i++)
+    buf[i] = 0.5f * sinf(2 * M_PI * 1000 * i / kSampleRate);
+}
+
+// The DRC can't take blocks longer than DRC_PROCESS_MAX_FRAMES.
+static void FrameBlocks(benchmark::internal::Benchmark* b) {
+  for (int frames : {64, 256, 480, DRC_PROCESS_MAX_FRAMES})
+    b->Arg(frames);
+  b->ArgName("frames");
+}
+
+// Args: biquads per channel, frames.
+static void BM_Eq2Process(benchmark::State& state) {
+  unsigned int frames = state.range(1);
+  std::vector<float> left(frames), right(frames);
+  struct eq2* eq2 = eq2_new();
+
+  for (int i = 0; i < state.range(0); i++)
+    for (int ch = 0; ch < 2; ch++)
+      eq2_append_biquad(eq2, ch, BQ_PEAKING, (i + 1) * 1000 / kNyquist, 1,
+                        3);
+  FillTone(left);
+  FillTone(right);
+  dsp_enable_flush_denormal_to_zero();
+
+  for (auto _ : state) {
+    eq2_process(eq2, left.data(), right.data(), frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  eq2_free(eq2);
+}
+
+BENCHMARK(BM_Eq2Process)
+    ->ArgsProduct({{1, 4, 8}, {64, 256, 480, 4096}})
+    ->ArgNames({"biquads", "frames"});
+
+// The three band setup from the DSP test tool. Args: channels, frames.
+static void BM_DrcProcess(benchmark::State& state) {
+  int channels = state.range(0);
+  unsigned int frames = state.range(1);
+  std::vector<std::vector<float>> buffers(channels);
+  float* data[DRC_MAX_CHANNELS];
+  const float lower_freq[DRC_NUM_KERNELS] = {0, 200 / kNyquist,
+                                             1200 / kNyquist};
+  struct drc* drc = drc_new(kSampleRate, channels);
+
+  drc->emphasis_disabled = 0;
+  for (int i = 0; i < DRC_NUM_KERNELS; i++) {
+    drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ, lower_freq[i]);
+    drc_set_param(drc, i, PARAM_ENABLED, 1);
+    drc_set_param(drc, i, PARAM_THRESHOLD, -29);
+    drc_set_param(drc, i, PARAM_KNEE, 3);
+    drc_set_param(drc, i, PARAM_RATIO, 6.677);
+    drc_set_param(drc, i, PARAM_ATTACK, 0.02);
+    drc_set_param(drc, i, PARAM_RELEASE, 0.2);
+  }
+  drc_init(drc);
+  for (int c = 0; c < channels; c++) {
+    buffers[c].resize(frames);
+    FillTone(buffers[c]);
+    data[c] = buffers[c].data();
+  }
+  dsp_enable_flush_denormal_to_zero();
+
+  for (auto _ : state) {
+    drc_process(drc, data, frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  drc_free(drc);
+}
+
+BENCHMARK(BM_DrcProcess)
+    ->ArgsProduct({{1, 2, 6, 8}, {64, 256, 480, DRC_PROCESS_MAX_FRAMES}})
+    ->ArgNames({"channels", "frames"});
+
+// Args: frames.
+static void BM_Crossover2Process(benchmark::State& state) {
+  unsigned int frames = state.range(0);
+  std::vector<float> bands[6];
+  struct crossover2 xo2;
+
+  for (auto& band : bands)
+    band.resize(frames);
+  FillTone(bands[0]);
+  FillTone(bands[1]);
+  crossover2_init(&xo2, 200 / kNyquist, 1200 / kNyquist);
+  dsp_enable_flush_denormal_to_zero();
+
+  for (auto _ : state) {
+    crossover2_process(&xo2, frames, bands[0].data(), bands[1].data(),
+                       bands[2].data(), bands[3].data(), bands[4].data(),
+                       bands[5].data());
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+}
+
+BENCHMARK(BM_Crossover2Process)->Apply(FrameBlocks);
+
+static const snd_pcm_format_t kFormats[] = {
+    SND_PCM_FORMAT_S16_LE,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S24_3LE,
+    SND_PCM_FORMAT_S32_LE,
+};
+
+static void InterleaveArgs(benchmark::internal::Benchmark* b) {
+  b->ArgsProduct({{0, 1, 2, 3}, {1, 2, 6}, {256, 480, 4096}})
+      ->ArgNames({"fmt", "ch", "frames"});
+}
+
+// Args: format index, channels, frames.
+static void BM_DspUtilInterleave(benchmark::State& state) {
+  snd_pcm_format_t fmt = kFormats[state.range(0)];
+  int channels = state.range(1);
+  int frames = state.range(2);
+  std::vector<std::vector<float>> planes(channels);
+  std::vector<float*> input;
+  std::vector<uint8_t> output(frames * channels * 4);
+
+  for (auto& plane : planes) {
+    plane.resize(frames);
+    FillTone(plane);
+    input.push_back(plane.data());
+  }
+
+  for (auto _ : state) {
+    dsp_util_interleave(input.data(), output.data(), channels, fmt, frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+}
+
+BENCHMARK(BM_DspUtilInterleave)->Apply(InterleaveArgs);
+
+// Args: format index, channels, frames.
+static void BM_DspUtilDeinterleave(benchmark::State& state) {
+  snd_pcm_format_t fmt = kFormats[state.range(0)];
+  int channels = state.range(1);
+  int frames = state.range(2);
+  std::vector<std::vector<float>> planes(channels);
+  std::vector<float*> output;
+  std::vector<uint8_t> input(frames * channels * 4);
+
+  for (auto& plane : planes) {
+    plane.resize(frames);
+    output.push_back(plane.data());
+  }
+
+  for (auto _ : state) {
+    dsp_util_deinterleave(input.data(), output.data(), channels, fmt,
+                          frames);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+}
+
+BENCHMARK(BM_DspUtilDeinterleave)->Apply(InterleaveArgs);
+
+}  // namespace
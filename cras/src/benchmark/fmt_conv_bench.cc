@@ -0,0 +1,164 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+extern "C" {
+#include "cras_audio_format.h"
+#include "cras_fmt_conv.h"
+#include "cras_util.h"
+#include "linear_resampler.h"
+}
+
+namespace {
+
+static const size_t kMaxFrames = 8192;
+
+// The formats converted to and from S16, which is what the rest of the
+// conversion pipeline works in.
+static const snd_pcm_format_t kFormats[] = {
+    SND_PCM_FORMAT_U8,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S24_3LE,
+    SND_PCM_FORMAT_S32_LE,
+};
+
+// Runs a converter over blocks of frames input frames. The output buffer is
+// sized for the worst case of the conversions below, 2x upsampling to 8
+// channels of 32 bit samples.
+static void RunConv(benchmark::State& state, struct cras_fmt_conv* conv,
+                    const struct cras_audio_format* in,
+                    unsigned int frames) {
+  std::vector<uint8_t> in_buf(frames * cras_get_format_bytes(in));
+  std::vector<uint8_t> out_buf(kMaxFrames * 2 * 8 * 4);
+  unsigned int in_frames;
+
+  if (!conv) {
+    state.SkipWithError("failed to create the converter");
+    return;
+  }
+  for (auto _ : state) {
+    in_frames = frames;
+    benchmark::DoNotOptimize(cras_fmt_conv_convert_frames(
+        conv, in_buf.data(), out_buf.data(), &in_frames, kMaxFrames * 2));
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  cras_fmt_conv_destroy(&conv);
+}
+
+// Sample format conversion only. Args: format index, 0 to convert from that
+// format to S16 or 1 to convert from S16 to it, channels, frames.
+static void BM_FmtConvFormat(benchmark::State& state) {
+  snd_pcm_format_t fmt = kFormats[state.range(0)];
+  struct cras_audio_format* in = cras_audio_format_create(
+      state.range(1) ? SND_PCM_FORMAT_S16_LE : fmt, 48000, state.range(2));
+  struct cras_audio_format* out = cras_audio_format_create(
+      state.range(1) ? fmt : SND_PCM_FORMAT_S16_LE, 48000, state.range(2));
+
+  RunConv(state, cras_fmt_conv_create(in, out, kMaxFrames, 0), in,
+          state.range(3));
+  cras_audio_format_destroy(in);
+  cras_audio_format_destroy(out);
+}
+
+static void FormatArgs(benchmark::internal::Benchmark* b) {
+  b->ArgsProduct({benchmark::CreateDenseRange(0, ARRAY_SIZE(kFormats) - 1, 1),
+                  {0, 1},
+                  {2, 6},
+                  {256, 480, 4096}})
+      ->ArgNames({"fmt", "from_s16", "ch", "frames"});
+}
+
+BENCHMARK(BM_FmtConvFormat)->Apply(FormatArgs);
+
+// Channel conversion of S16 samples. Args: input channels, output channels,
+// frames.
+static void BM_FmtConvChannels(benchmark::State& state) {
+  struct cras_audio_format* in =
+      cras_audio_format_create(SND_PCM_FORMAT_S16_LE, 48000, state.range(0));
+  struct cras_audio_format* out =
+      cras_audio_format_create(SND_PCM_FORMAT_S16_LE, 48000, state.range(1));
+
+  RunConv(state, cras_fmt_conv_create(in, out, kMaxFrames, 0), in,
+          state.range(2));
+  cras_audio_format_destroy(in);
+  cras_audio_format_destroy(out);
+}
+
+static void ChannelArgs(benchmark::internal::Benchmark* b) {
+  for (auto& pair : std::vector<std::pair<int, int>>{
+           {1, 2}, {2, 1}, {2, 6}, {6, 2}, {2, 8}})
+    for (int frames : {256, 480, 4096})
+      b->Args({pair.first, pair.second, frames});
+  b->ArgNames({"in_ch", "out_ch", "frames"});
+}
+
+BENCHMARK(BM_FmtConvChannels)->Apply(ChannelArgs);
+
+// Sample rate conversion of stereo S16 samples. Args: input rate, output rate,
+// resampler quality, frames.
+static void BM_FmtConvRate(benchmark::State& state) {
+  struct cras_audio_format* in =
+      cras_audio_format_create(SND_PCM_FORMAT_S16_LE, state.range(0), 2);
+  struct cras_audio_format* out =
+      cras_audio_format_create(SND_PCM_FORMAT_S16_LE, state.range(1), 2);
+
+  RunConv(state,
+          cras_fmt_conv_create_with_quality(
+              in, out, kMaxFrames, 0,
+              (enum CRAS_RESAMPLER_QUALITY)state.range(2)),
+          in, state.range(3));
+  cras_audio_format_destroy(in);
+  cras_audio_format_destroy(out);
+}
+
+static void RateArgs(benchmark::internal::Benchmark* b) {
+  for (auto& pair : std::vector<std::pair<int, int>>{
+           {44100, 48000}, {48000, 44100}, {16000, 48000}})
+    for (int quality = CRAS_RESAMPLER_QUALITY_DEFAULT;
+         quality <= CRAS_RESAMPLER_QUALITY_HIGH; quality++)
+      for (int frames : {441, 4096})
+        b->Args({pair.first, pair.second, quality, frames});
+  b->ArgNames({"in_rate", "out_rate", "quality", "frames"});
+}
+
+BENCHMARK(BM_FmtConvRate)->Apply(RateArgs);
+
+// The linear resampler on its own, as used to follow device rate drift. It
+// only handles S16 samples. Args: channels, frames.
+static void BM_LinearResampler(benchmark::State& state) {
+  unsigned int channels = state.range(0);
+  unsigned int frames = state.range(1);
+  unsigned int frame_bytes = 2 * channels;
+  std::vector<uint8_t> src(frames * frame_bytes);
+  std::vector<uint8_t> dst(frames * 2 * frame_bytes);
+  struct linear_resampler* lr;
+  unsigned int src_frames;
+
+  lr = linear_resampler_create(channels, frame_bytes, 48000, 48000 * 1.001);
+  if (!lr) {
+    state.SkipWithError("failed to create the resampler");
+    return;
+  }
+  for (auto _ : state) {
+    src_frames = frames;
+    benchmark::DoNotOptimize(linear_resampler_resample(
+        lr, src.data(), &src_frames, dst.data(), frames * 2));
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  linear_resampler_destroy(lr);
+}
+
+static void LinearResamplerArgs(benchmark::internal::Benchmark* b) {
+  for (int channels : {1, 2, 6})
+    for (int frames : {256, 480, 4096})
+      b->Args({channels, frames});
+  b->ArgNames({"ch", "frames"});
+}
+
+BENCHMARK(BM_LinearResampler)->Apply(LinearResamplerArgs);
+
+}  // namespace
@@ -0,0 +1,87 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+extern "C" {
+#include "cras_mix.h"
+#include "cras_util.h"
+}
+
+namespace {
+
+static const snd_pcm_format_t kFormats[] = {
+    SND_PCM_FORMAT_S16_LE,
+    SND_PCM_FORMAT_S24_LE,
+    SND_PCM_FORMAT_S24_3LE,
+    SND_PCM_FORMAT_S32_LE,
+};
+
+// The mixer implementations cras_mix_init() can select. Zero is the plain C
+// implementation. Flags of implementations that weren't built fall back to
+// it too.
+static const unsigned int kCpuFlags[] = {
+    0, CPU_X86_SSE4_2, CPU_X86_AVX, CPU_X86_AVX2, CPU_X86_FMA, CPU_ARM_NEON,
+};
+
+static bool CpuSupports(unsigned int flag) {
+#if defined(__x86_64__) || defined(__i386__)
+  switch (flag) {
+    case CPU_X86_SSE4_2:
+      return __builtin_cpu_supports("sse4.2");
+    case CPU_X86_AVX:
+      return __builtin_cpu_supports("avx");
+    case CPU_X86_AVX2:
+      return __builtin_cpu_supports("avx2");
+    case CPU_X86_FMA:
+      return __builtin_cpu_supports("fma");
+  }
+#elif defined(__aarch64__)
+  if (flag == CPU_ARM_NEON)
+    return true;
+#endif
+  return flag == 0;
+}
+
+// Args: format index, cpu flag index, channels, frames.
+static void BM_MixAdd(benchmark::State& state) {
+  snd_pcm_format_t fmt = kFormats[state.range(0)];
+  unsigned int flag = kCpuFlags[state.range(1)];
+  unsigned int channels = state.range(2);
+  unsigned int frames = state.range(3);
+  unsigned int samples = channels * frames;
+  size_t bytes = samples * snd_pcm_format_physical_width(fmt) / 8;
+  std::vector<uint8_t> dst(bytes), src(bytes, 0x11);
+
+  cras_mix_init(flag);
+
+  for (auto _ : state) {
+    // Index 1 takes the scale and accumulate path used by every stream
+    // after the first one.
+    cras_mix_add(fmt, dst.data(), src.data(), samples, 1, 0, 0.5);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * frames);
+  state.SetBytesProcessed(state.iterations() * bytes);
+  cras_mix_init(0);
+}
+
+static void MixAddArgs(benchmark::internal::Benchmark* b) {
+  std::vector<int64_t> ops;
+
+  for (size_t i = 0; i < ARRAY_SIZE(kCpuFlags); i++)
+    if (CpuSupports(kCpuFlags[i]))
+      ops.push_back(i);
+  b->ArgsProduct({benchmark::CreateDenseRange(0, ARRAY_SIZE(kFormats) - 1, 1),
+                  ops,
+                  {2, 6},
+                  {256, 480, 4096}})
+      ->ArgNames({"fmt", "ops", "ch", "frames"});
+}
+
+BENCHMARK(BM_MixAdd)->Apply(MixAddArgs);
+
+}  // namespace
@@ -0,0 +1,86 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+
+#include <vector>
+
+extern "C" {
+#include "rate_estimator.h"
+}
+
+namespace {
+
+// The window and smooth factor cras_iodev uses.
+static const struct timespec kWindow = {.tv_sec = 5, .tv_nsec = 0};
+static const double kSmoothFactor = 0.3;
+// One wake of the audio thread, 10ms at 48kHz.
+static const long kWakeNsec = 10000000;
+static const int kWakeFrames = 480;
+
+static void NextWake(struct timespec* t, int jitter) {
+  t->tv_nsec += kWakeNsec + jitter;
+  if (t->tv_nsec >= 1000000000) {
+    t->tv_sec++;
+    t->tv_nsec -= 1000000000;
+  }
+}
+
+// Args: outlier rejection.
+static void BM_RateEstimatorCheck(benchmark::State& state) {
+  struct rate_estimator* re =
+      rate_estimator_create(48000, &kWindow, kSmoothFactor);
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+  unsigned int seed = 1;
+
+  rate_estimator_set_outlier_rejection(re, state.range(0));
+  for (auto _ : state) {
+    rate_estimator_add_frames(re, kWakeFrames);
+    benchmark::DoNotOptimize(rate_estimator_check(re, 960, &t));
+    // Levels are stamped up to 0.1ms off, every window closes with a fit.
+    NextWake(&t, rand_r(&seed) % 100000);
+  }
+  state.SetItemsProcessed(state.iterations());
+  rate_estimator_destroy(re);
+}
+
+BENCHMARK(BM_RateEstimatorCheck)->Arg(0)->Arg(1)->ArgName("reject");
+
+// Args: devices, batched.
+static void BM_RateEstimatorWake(benchmark::State& state) {
+  unsigned int num = state.range(0);
+  bool batched = state.range(1);
+  std::vector<struct rate_estimator_sample> samples(num);
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+
+  for (auto& sample : samples) {
+    sample.re = rate_estimator_create(48000, &kWindow, kSmoothFactor);
+    rate_estimator_set_outlier_rejection(sample.re, 1);
+    sample.level = 960;
+  }
+  for (auto _ : state) {
+    for (auto& sample : samples) {
+      rate_estimator_add_frames(sample.re, kWakeFrames);
+      sample.now = t;
+    }
+    if (batched) {
+      benchmark::DoNotOptimize(
+          rate_estimator_check_batch(samples.data(), num));
+    } else {
+      for (auto& sample : samples)
+        benchmark::DoNotOptimize(
+            rate_estimator_check(sample.re, sample.level, &sample.now));
+    }
+    NextWake(&t, 0);
+  }
+  state.SetItemsProcessed(state.iterations() * num);
+  for (auto& sample : samples)
+    rate_estimator_destroy(sample.re);
+}
+
+BENCHMARK(BM_RateEstimatorWake)
+    ->ArgsProduct({{1, 4, 8}, {0, 1}})
+    ->ArgNames({"devs", "batch"});
+
+}  // namespace
@@ -0,0 +1,102 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <benchmark/benchmark.h>
+#include <math.h>
+
+#include <vector>
+
+extern "C" {
+#include "cras_sbc_codec.h"
+}
+
+namespace {
+
+// The SBC configuration most A2DP sinks pick, 48kHz joint stereo at the
+// highest bitpool of the middle quality.
+static const uint8_t kBitpool = 53;
+// An EDR link's MTU, which takes 7 frames of this configuration.
+static const size_t kLinkMtu = 895;
+// The mSBC frames carried by 60 byte SCO packets in one 7.5ms wake.
+static const unsigned int kMsbcFrames = 8;
+static const size_t kMsbcPktSize = 60;
+static const size_t kMsbcHeaderLen = 2;
+
+static void FillSine(std::vector<int16_t>* pcm, unsigned int rate) {
+  for (size_t i = 0; i < pcm->size(); i++)
+    (*pcm)[i] = 8192 * sin(2 * M_PI * 440 * (i / 2) / rate);
+}
+
+// Args: frames per call. One frame per call is how a caller without the
+// packet sized encode would feed the codec.
+static void BM_SbcEncodePacket(benchmark::State& state) {
+  struct cras_audio_codec* codec =
+      cras_sbc_codec_create(SBC_FREQ_48000, SBC_MODE_JOINT_STEREO, SBC_SB_8,
+                            SBC_AM_LOUDNESS, SBC_BLK_16, kBitpool);
+  size_t codesize = cras_sbc_get_codesize(codec);
+  size_t frames = kLinkMtu / cras_sbc_get_frame_length(codec);
+  size_t per_call = state.range(0) ? frames : 1;
+  std::vector<int16_t> pcm(frames * codesize / 2);
+  std::vector<uint8_t> packet(kLinkMtu);
+  size_t count;
+
+  FillSine(&pcm, 48000);
+  for (auto _ : state) {
+    const uint8_t* in = (const uint8_t*)pcm.data();
+    size_t used = 0;
+
+    for (size_t done = 0; done < frames; done += per_call) {
+      in += codec->encode(codec, in, per_call * codesize,
+                          packet.data() + used, kLinkMtu - used, &count);
+      used += count;
+    }
+    benchmark::DoNotOptimize(used);
+  }
+  state.SetItemsProcessed(state.iterations() * frames * codesize / 4);
+  state.counters["frames_per_packet"] = frames;
+  cras_sbc_codec_destroy(codec);
+}
+
+BENCHMARK(BM_SbcEncodePacket)->Arg(0)->Arg(1)->ArgName("packet");
+
+// Args: batched. Decodes one wake of SCO packets with one codec call per
+// frame, or one cras_msbc_decode_frames() for all of them.
+static void BM_MsbcDecodeWake(benchmark::State& state) {
+  struct cras_audio_codec* codec = cras_msbc_codec_create();
+  size_t codesize = cras_sbc_get_codesize(codec);
+  size_t frame_length = cras_sbc_get_frame_length(codec);
+  std::vector<int16_t> pcm(kMsbcFrames * codesize / 2);
+  std::vector<uint8_t> pkts(kMsbcFrames * kMsbcPktSize);
+  bool batched = state.range(0);
+  size_t count;
+
+  FillSine(&pcm, 16000);
+  for (unsigned int i = 0; i < kMsbcFrames; i++)
+    codec->encode(codec, (const uint8_t*)pcm.data() + i * codesize,
+                  codesize, &pkts[i * kMsbcPktSize + kMsbcHeaderLen],
+                  kMsbcPktSize - kMsbcHeaderLen, &count);
+  cras_sbc_codec_destroy(codec);
+  codec = cras_msbc_codec_create();
+
+  for (auto _ : state) {
+    uint8_t* out = (uint8_t*)pcm.data();
+
+    if (batched) {
+      benchmark::DoNotOptimize(cras_msbc_decode_frames(
+          codec, &pkts[kMsbcHeaderLen], kMsbcPktSize, kMsbcFrames, out,
+          pcm.size() * 2));
+      continue;
+    }
+    for (unsigned int i = 0; i < kMsbcFrames; i++)
+      codec->decode(codec, &pkts[i * kMsbcPktSize + kMsbcHeaderLen],
+                    frame_length, out + i * codesize, codesize, &count);
+    benchmark::ClobberMemory();
+  }
+  state.SetItemsProcessed(state.iterations() * kMsbcFrames * codesize / 2);
+  cras_sbc_codec_destroy(codec);
+}
+
+BENCHMARK(BM_MsbcDecodeWake)->Arg(0)->Arg(1)->ArgName("batch");
+
+}  // namespace
@@ -85,6 +85,43 @@
 #define MPEG_BIT_RATE_32000 0x0002
 #define MPEG_BIT_RATE_FREE 0x0001
 
+#define AAC_OBJECT_TYPE_MPEG2_AAC_LC 0x80
+#define AAC_OBJECT_TYPE_MPEG4_AAC_LC 0x40
+#define AAC_OBJECT_TYPE_MPEG4_AAC_LTP 0x20
+#define AAC_OBJECT_TYPE_MPEG4_AAC_SCA 0x10
+
+#define AAC_SAMPLING_FREQ_8000 0x0800
+#define AAC_SAMPLING_FREQ_11025 0x0400
+#define AAC_SAMPLING_FREQ_12000 0x0200
+#define AAC_SAMPLING_FREQ_16000 0x0100
+#define AAC_SAMPLING_FREQ_22050 0x0080
+#define AAC_SAMPLING_FREQ_24000 0x0040
+#define AAC_SAMPLING_FREQ_32000 0x0020
+#define AAC_SAMPLING_FREQ_44100 0x0010
+#define AAC_SAMPLING_FREQ_48000 0x0008
+#define AAC_SAMPLING_FREQ_64000 0x0004
+#define AAC_SAMPLING_FREQ_88200 0x0002
+#define AAC_SAMPLING_FREQ_96000 0x0001
+
+#define AAC_CHANNELS_1 0x02
+#define AAC_CHANNELS_2 0x01
+
+#define AAC_GET_BITRATE(a)                                                     \
+	((a).bitrate1 << 16 | (a).bitrate2 << 8 | (a).bitrate3)
+#define AAC_GET_FREQUENCY(a) ((a).frequency1 << 4 | (a).frequency2)
+
+#define AAC_SET_BITRATE(a, b)                                                  \
+	do {                                                                   \
+		(a).bitrate1 = ((b) >> 16) & 0x7f;                             \
+		(a).bitrate2 = ((b) >> 8) & 0xff;                              \
+		(a).bitrate3 = (b)&0xff;                                       \
+	} while (0)
+#define AAC_SET_FREQUENCY(a, f)                                                \
+	do {                                                                   \
+		(a).frequency1 = ((f) >> 4) & 0xff;                            \
+		(a).frequency2 = (f)&0x0f;                                     \
+	} while (0)
+
 #if __BYTE_ORDER == __LITTLE_ENDIAN
 
 typedef struct {
@@ -107,6 +144,18 @@ typedef struct {
 	uint16_t bitrate;
 } __attribute__((packed)) a2dp_mpeg_t;
 
+typedef struct {
+	uint8_t object_type;
+	uint8_t frequency1;
+	uint8_t rfa : 2;
+	uint8_t channels : 2;
+	uint8_t frequency2 : 4;
+	uint8_t bitrate1 : 7;
+	uint8_t vbr : 1;
+	uint8_t bitrate2;
+	uint8_t bitrate3;
+} __attribute__((packed)) a2dp_aac_t;
+
 #elif __BYTE_ORDER == __BIG_ENDIAN
 
 typedef struct {
@@ -129,6 +178,18 @@ typedef struct {
 	uint16_t bitrate;
 } __attribute__((packed)) a2dp_mpeg_t;
 
+typedef struct {
+	uint8_t object_type;
+	uint8_t frequency1;
+	uint8_t frequency2 : 4;
+	uint8_t channels : 2;
+	uint8_t rfa : 2;
+	uint8_t vbr : 1;
+	uint8_t bitrate1 : 7;
+	uint8_t bitrate2;
+	uint8_t bitrate3;
+} __attribute__((packed)) a2dp_aac_t;
+
 #else
 #error "Unknown byte order"
 #endif
@@ -82,3 +82,5 @@ struct bt_voice {
 #define BT_PKT_STATUS 16
 
 #define BT_SCM_PKT_STATUS 0x03
+
+#define BT_SCM_ERROR 0x04
@@ -10,13 +10,26 @@
 #include <stdlib.h>
 #include <sys/param.h>
 
+#include "cras_mirror.h"
+
+/* A ring of bytes.
+ *    write_idx - Where the next bytes are written.
+ *    read_idx - Where the next bytes are read.
+ *    level - The bytes queued.
+ *    max_size - The bytes allocated.
+ *    used_size - The bytes the ring wraps at, up to max_size.
+ *    mirrored - The bytes are mapped twice in a row, see cras_mirror_map(),
+ *        so all that is queued or free is contiguous.
+ *    bytes - The ring.
+ */
 struct byte_buffer {
 	unsigned int write_idx;
 	unsigned int read_idx;
 	unsigned int level;
 	unsigned int max_size;
 	unsigned int used_size;
-	uint8_t bytes[];
+	unsigned int mirrored;
+	uint8_t *bytes;
 };
 
 /* Create a byte buffer to hold buffer_size_bytes worth of data. */
@@ -27,20 +40,49 @@ static inline struct byte_buffer *byte_buffer_create(size_t buffer_size_bytes)
 						      buffer_size_bytes);
 	if (!buf)
 		return buf;
+	buf->bytes = (uint8_t *)(buf + 1);
 	buf->max_size = buffer_size_bytes;
 	buf->used_size = buffer_size_bytes;
 	return buf;
 }
 
+/* Create a byte buffer of at least buffer_size_bytes whose reads and writes
+ * are never split at the wrap. The size is rounded up to whole pages. Falls
+ * back to a plain buffer when the pages can't be mirrored. */
+static inline struct byte_buffer *
+byte_buffer_create_mirrored(size_t buffer_size_bytes)
+{
+	size_t size = cras_mirror_size(buffer_size_bytes);
+	struct byte_buffer *buf;
+
+	buf = (struct byte_buffer *)calloc(1, sizeof(struct byte_buffer));
+	if (!buf)
+		return buf;
+	buf->bytes = (uint8_t *)cras_mirror_map(size, 1);
+	if (!buf->bytes) {
+		free(buf);
+		return byte_buffer_create(buffer_size_bytes);
+	}
+	buf->max_size = size;
+	buf->used_size = size;
+	buf->mirrored = 1;
+	return buf;
+}
+
+/* A mirrored buffer wraps where its mapping does, its used size stays. */
 static inline void byte_buffer_set_used_size(struct byte_buffer *buf,
 					     size_t used_size)
 {
+	if (buf->mirrored)
+		return;
 	buf->used_size = MIN(used_size, buf->max_size);
 }
 
 /* Destory a byte_buffer created with byte_buffer_create. */
 static inline void byte_buffer_destroy(struct byte_buffer **buf)
 {
+	if (*buf && (*buf)->mirrored)
+		cras_mirror_unmap((*buf)->bytes, (*buf)->max_size, 1);
 	free(*buf);
 	*buf = NULL;
 }
@@ -49,6 +91,8 @@ static inline unsigned int buf_writable(struct byte_buffer *buf)
 {
 	if (buf->level >= buf->used_size)
 		return 0;
+	if (buf->mirrored)
+		return buf->used_size - buf->level;
 	if (buf->write_idx < buf->read_idx)
 		return buf->read_idx - buf->write_idx;
 
@@ -59,6 +103,8 @@ static inline unsigned int buf_readable(struct byte_buffer *buf)
 {
 	if (buf->level == 0)
 		return 0;
+	if (buf->mirrored)
+		return buf->level;
 
 	if (buf->read_idx < buf->write_idx)
 		return buf->write_idx - buf->read_idx;
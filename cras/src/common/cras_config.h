@@ -9,6 +9,8 @@
 #include "cras_types.h"
 
 #define CRAS_MIN_BUFFER_TIME_IN_US 1000 /* 1 milliseconds */
+/* Shortest buffer a LOW_LATENCY stream can ask for. */
+#define CRAS_MIN_LOW_LATENCY_BUFFER_TIME_IN_US 250
 #define CRAS_MAX_BUFFER_TIME_IN_S 10 /* 10 seconds */
 
 #define CRAS_SERVER_RT_THREAD_PRIORITY 12
@@ -0,0 +1,176 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+
+#include "cras_id_map.h"
+
+/* A new map has 1 << INITIAL_BITS slots. */
+#define INITIAL_BITS 4
+
+/* An id and its value, a NULL value marks a free slot. */
+struct id_slot {
+	uint32_t id;
+	void *value;
+};
+
+/* Members:
+ *    slots - The slot array, num_slots long.
+ *    num_slots - Number of slots, 1 << bits.
+ *    bits - log2 of num_slots.
+ *    size - Number of used slots.
+ */
+struct cras_id_map {
+	struct id_slot *slots;
+	size_t num_slots;
+	unsigned int bits;
+	size_t size;
+};
+
+/* Fibonacci hashing, the top bits of the product depend on all bits of the
+ * id. Stream ids differ in the low bits within a client and in the high bits
+ * across clients. */
+static inline size_t home_slot(const struct cras_id_map *map, uint32_t id)
+{
+	return (uint32_t)(id * 2654435769u) >> (32 - map->bits);
+}
+
+static struct id_slot *find_slot(const struct cras_id_map *map, uint32_t id)
+{
+	size_t i = home_slot(map, id);
+
+	while (map->slots[i].value) {
+		if (map->slots[i].id == id)
+			return &map->slots[i];
+		i = (i + 1) & (map->num_slots - 1);
+	}
+	return NULL;
+}
+
+static void place(struct cras_id_map *map, uint32_t id, void *value)
+{
+	size_t i = home_slot(map, id);
+
+	while (map->slots[i].value)
+		i = (i + 1) & (map->num_slots - 1);
+	map->slots[i].id = id;
+	map->slots[i].value = value;
+}
+
+static int grow(struct cras_id_map *map)
+{
+	struct id_slot *old = map->slots;
+	size_t old_num = map->num_slots;
+	size_t i;
+
+	map->slots = calloc(old_num * 2, sizeof(*map->slots));
+	if (!map->slots) {
+		map->slots = old;
+		return -ENOMEM;
+	}
+	map->num_slots = old_num * 2;
+	map->bits++;
+	for (i = 0; i < old_num; i++)
+		if (old[i].value)
+			place(map, old[i].id, old[i].value);
+	free(old);
+	return 0;
+}
+
+struct cras_id_map *cras_id_map_create()
+{
+	struct cras_id_map *map;
+
+	map = calloc(1, sizeof(*map));
+	if (!map)
+		return NULL;
+	map->bits = INITIAL_BITS;
+	map->num_slots = 1 << map->bits;
+	map->slots = calloc(map->num_slots, sizeof(*map->slots));
+	if (!map->slots) {
+		free(map);
+		return NULL;
+	}
+	return map;
+}
+
+void cras_id_map_destroy(struct cras_id_map *map)
+{
+	if (!map)
+		return;
+	free(map->slots);
+	free(map);
+}
+
+int cras_id_map_insert(struct cras_id_map *map, uint32_t id, void *value)
+{
+	int rc;
+
+	if (!value)
+		return -EINVAL;
+	if (find_slot(map, id))
+		return -EEXIST;
+
+	/* Keep the load under 3/4 so probe runs stay short. */
+	if ((map->size + 1) * 4 > map->num_slots * 3) {
+		rc = grow(map);
+		if (rc)
+			return rc;
+	}
+
+	place(map, id, value);
+	map->size++;
+	return 0;
+}
+
+void *cras_id_map_find(const struct cras_id_map *map, uint32_t id)
+{
+	struct id_slot *slot;
+
+	if (!map)
+		return NULL;
+	slot = find_slot(map, id);
+	return slot ? slot->value : NULL;
+}
+
+void *cras_id_map_remove(struct cras_id_map *map, uint32_t id)
+{
+	struct id_slot *slot;
+	size_t hole, i, home;
+	size_t mask;
+	void *value;
+
+	if (!map)
+		return NULL;
+	slot = find_slot(map, id);
+	if (!slot)
+		return NULL;
+
+	value = slot->value;
+	slot->value = NULL;
+	map->size--;
+
+	/* Shift back the entries after the hole that probed past it, so no
+	 * lookup stops early at the free slot. */
+	mask = map->num_slots - 1;
+	hole = slot - map->slots;
+	for (i = (hole + 1) & mask; map->slots[i].value; i = (i + 1) & mask) {
+		home = home_slot(map, map->slots[i].id);
+		/* Entries whose home is cyclically in (hole, i] stay. */
+		if (((i - home) & mask) < ((i - hole) & mask))
+			continue;
+		map->slots[hole] = map->slots[i];
+		map->slots[i].value = NULL;
+		hole = i;
+	}
+
+	return value;
+}
+
+size_t cras_id_map_size(const struct cras_id_map *map)
+{
+	return map ? map->size : 0;
+}
@@ -0,0 +1,44 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Hash map from 32 bit ids to pointers, used to look up streams and devices
+ * by id without walking their lists. Open addressing with linear probing,
+ * so lookups touch one or two cache lines. Not thread safe.
+ */
+
+#ifndef CRAS_ID_MAP_H_
+#define CRAS_ID_MAP_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cras_id_map;
+
+/* Creates an empty map, NULL if out of memory. */
+struct cras_id_map *cras_id_map_create();
+
+/* Destroys a map, the values it points to are left alone. NULL is ignored. */
+void cras_id_map_destroy(struct cras_id_map *map);
+
+/* Maps id to value.
+ * Args:
+ *    map - The map.
+ *    id - The key.
+ *    value - Value for id, must not be NULL.
+ * Returns:
+ *    0 on success, -EEXIST if id is already mapped, -EINVAL for a NULL
+ *    value or -ENOMEM.
+ */
+int cras_id_map_insert(struct cras_id_map *map, uint32_t id, void *value);
+
+/* Returns the value of id, NULL if it isn't mapped or map is NULL. */
+void *cras_id_map_find(const struct cras_id_map *map, uint32_t id);
+
+/* Removes id from the map. Returns its value, NULL if it wasn't mapped. */
+void *cras_id_map_remove(struct cras_id_map *map, uint32_t id);
+
+/* Returns the number of ids mapped, 0 for a NULL map. */
+size_t cras_id_map_size(const struct cras_id_map *map);
+
+#endif /* CRAS_ID_MAP_H_ */
@@ -0,0 +1,128 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_LATENCY_HIST_H_
+#define CRAS_LATENCY_HIST_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* Each power of two microseconds is split in 1 << CRAS_LATENCY_HIST_SUB_BITS
+ * buckets, so a bucket is at most 25% wide. Values below four microseconds
+ * get a bucket each and the last bucket holds everything from about 115ms.
+ */
+#define CRAS_LATENCY_HIST_SUB_BITS 2
+#define CRAS_LATENCY_HIST_BUCKETS 64
+
+/*
+ * Fixed size log-linear histogram of durations, in the spirit of HDR
+ * histograms. Recording is a few integer operations with no allocation, so
+ * it's cheap enough to run on every audio thread wake.
+ * Members:
+ *    counts - Number of samples that fell in each bucket.
+ *    max_usec - The longest duration recorded.
+ */
+struct __attribute__((__packed__)) cras_latency_hist {
+	uint32_t counts[CRAS_LATENCY_HIST_BUCKETS];
+	uint32_t max_usec;
+};
+
+/* Returns the bucket holding a duration of usec microseconds. */
+static inline unsigned int cras_latency_hist_bucket(uint32_t usec)
+{
+	unsigned int msb, idx;
+
+	if (usec < (1 << CRAS_LATENCY_HIST_SUB_BITS))
+		return usec;
+	msb = 31 - __builtin_clz(usec);
+	idx = ((msb - CRAS_LATENCY_HIST_SUB_BITS + 1)
+	       << CRAS_LATENCY_HIST_SUB_BITS) |
+	      ((usec >> (msb - CRAS_LATENCY_HIST_SUB_BITS)) &
+	       ((1 << CRAS_LATENCY_HIST_SUB_BITS) - 1));
+	return idx < CRAS_LATENCY_HIST_BUCKETS ? idx :
+						 CRAS_LATENCY_HIST_BUCKETS - 1;
+}
+
+/* Returns the smallest duration in microseconds that lands in bucket idx. */
+static inline uint32_t cras_latency_hist_bucket_start(unsigned int idx)
+{
+	unsigned int msb, sub;
+
+	if (idx < (1 << CRAS_LATENCY_HIST_SUB_BITS))
+		return idx;
+	msb = (idx >> CRAS_LATENCY_HIST_SUB_BITS) + CRAS_LATENCY_HIST_SUB_BITS -
+	      1;
+	sub = idx & ((1 << CRAS_LATENCY_HIST_SUB_BITS) - 1);
+	return ((1 << CRAS_LATENCY_HIST_SUB_BITS) | sub)
+	       << (msb - CRAS_LATENCY_HIST_SUB_BITS);
+}
+
+/* Records one duration of usec microseconds. */
+static inline void cras_latency_hist_add_usec(struct cras_latency_hist *hist,
+					      uint32_t usec)
+{
+	hist->counts[cras_latency_hist_bucket(usec)]++;
+	if (usec > hist->max_usec)
+		hist->max_usec = usec;
+}
+
+/* Records the time elapsed from start to end. */
+static inline void cras_latency_hist_add(struct cras_latency_hist *hist,
+					 const struct timespec *start,
+					 const struct timespec *end)
+{
+	int64_t nsec = (int64_t)(end->tv_sec - start->tv_sec) * 1000000000LL +
+		       end->tv_nsec - start->tv_nsec;
+
+	if (nsec < 0)
+		nsec = 0;
+	if (nsec > (int64_t)UINT32_MAX * 1000)
+		nsec = (int64_t)UINT32_MAX * 1000;
+	cras_latency_hist_add_usec(hist, nsec / 1000);
+}
+
+/* Returns the number of durations recorded. */
+static inline uint64_t
+cras_latency_hist_count(const struct cras_latency_hist *hist)
+{
+	uint64_t total = 0;
+	unsigned int i;
+
+	for (i = 0; i < CRAS_LATENCY_HIST_BUCKETS; i++)
+		total += hist->counts[i];
+	return total;
+}
+
+/* Returns an upper bound in microseconds of the given percentile, between 0
+ * and 100, of the recorded durations. That is the end of the bucket the
+ * percentile falls in, capped by the recorded maximum. Returns 0 if nothing
+ * was recorded.
+ */
+static inline uint32_t
+cras_latency_hist_percentile(const struct cras_latency_hist *hist,
+			     double percentile)
+{
+	uint64_t total = cras_latency_hist_count(hist);
+	uint64_t target, seen = 0;
+	uint32_t end;
+	unsigned int i;
+
+	if (!total)
+		return 0;
+	target = (uint64_t)(total * percentile / 100.0 + 0.5);
+	if (target < 1)
+		target = 1;
+	for (i = 0; i < CRAS_LATENCY_HIST_BUCKETS - 1; i++) {
+		seen += hist->counts[i];
+		if (seen >= target)
+			break;
+	}
+	if (i == CRAS_LATENCY_HIST_BUCKETS - 1)
+		return hist->max_usec;
+	end = cras_latency_hist_bucket_start(i + 1) - 1;
+	return end < hist->max_usec ? end : hist->max_usec;
+}
+
+#endif /* CRAS_LATENCY_HIST_H_ */
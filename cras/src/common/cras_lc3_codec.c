@@ -0,0 +1,118 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <lc3.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cras_lc3_codec.h"
+
+/* LC3 encodes one frame of PCM to one LC3 frame of a size picked by the
+ * caller. This structure holds related info about the LC3 codec.
+ * Members:
+ *    encoder - The LC3 encoder, in the memory following this structure.
+ *    decoder - The LC3 decoder, in the memory following the encoder.
+ *    codesize - The size of one PCM frame in bytes.
+ *    frame_bytes - The size of one LC3 frame in bytes.
+ */
+struct cras_lc3_data {
+	lc3_encoder_t encoder;
+	lc3_decoder_t decoder;
+	unsigned int codesize;
+	unsigned int frame_bytes;
+};
+
+static int cras_lc3_decode(struct cras_audio_codec *codec, const void *input,
+			   size_t input_len, void *output, size_t output_len,
+			   size_t *count)
+{
+	struct cras_lc3_data *data = (struct cras_lc3_data *)codec->priv_data;
+
+	*count = 0;
+	if (output_len < data->codesize)
+		return -ENOSPC;
+
+	/* No input asks the decoder to conceal the frame. */
+	if (lc3_decode(data->decoder, input_len ? input : NULL, input_len,
+		       LC3_PCM_FORMAT_S16, output, 1) < 0)
+		return -EINVAL;
+
+	*count = data->codesize;
+	return input_len;
+}
+
+static int cras_lc3_encode(struct cras_audio_codec *codec, const void *input,
+			   size_t input_len, void *output, size_t output_len,
+			   size_t *count)
+{
+	struct cras_lc3_data *data = (struct cras_lc3_data *)codec->priv_data;
+
+	*count = 0;
+	if (input_len < data->codesize)
+		return -EINVAL;
+	if (output_len < data->frame_bytes)
+		return -ENOSPC;
+
+	if (lc3_encode(data->encoder, LC3_PCM_FORMAT_S16, input, 1,
+		       data->frame_bytes, output) < 0)
+		return -EINVAL;
+
+	*count = data->frame_bytes;
+	return data->codesize;
+}
+
+struct cras_audio_codec *cras_lc3_codec_create(unsigned int rate,
+					       unsigned int frame_us,
+					       unsigned int frame_bytes)
+{
+	struct cras_audio_codec *codec;
+	struct cras_lc3_data *data;
+	unsigned int enc_size, dec_size;
+	int samples;
+	uint8_t *mem;
+
+	samples = lc3_frame_samples(frame_us, rate);
+	enc_size = lc3_encoder_size(frame_us, rate);
+	dec_size = lc3_decoder_size(frame_us, rate);
+	if (samples <= 0 || !enc_size || !dec_size)
+		return NULL;
+
+	codec = (struct cras_audio_codec *)calloc(1, sizeof(*codec));
+	if (!codec)
+		return NULL;
+
+	/* The encoder and decoder are laid out right after the data. */
+	mem = (uint8_t *)calloc(1, sizeof(*data) + enc_size + dec_size);
+	if (!mem) {
+		free(codec);
+		return NULL;
+	}
+	data = (struct cras_lc3_data *)mem;
+	data->encoder = lc3_setup_encoder(frame_us, rate, 0,
+					  mem + sizeof(*data));
+	data->decoder = lc3_setup_decoder(frame_us, rate, 0,
+					  mem + sizeof(*data) + enc_size);
+	data->codesize = samples * sizeof(int16_t);
+	data->frame_bytes = frame_bytes;
+
+	codec->priv_data = data;
+	codec->decode = cras_lc3_decode;
+	codec->encode = cras_lc3_encode;
+	return codec;
+}
+
+void cras_lc3_codec_destroy(struct cras_audio_codec *codec)
+{
+	free(codec->priv_data);
+	free(codec);
+}
+
+int cras_lc3_get_codesize(struct cras_audio_codec *codec)
+{
+	struct cras_lc3_data *data = (struct cras_lc3_data *)codec->priv_data;
+
+	return data->codesize;
+}
@@ -0,0 +1,32 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef COMMON_CRAS_LC3_CODEC_H_
+#define COMMON_CRAS_LC3_CODEC_H_
+
+#include "cras_audio_codec.h"
+
+/* Creates an LC3 codec for one channel of S16_LE samples. It encodes one
+ * frame of PCM to one LC3 frame of frame_bytes at a time, and decodes one
+ * LC3 frame at a time. Decoding an empty input conceals a lost frame.
+ * Args:
+ *    rate: The sample rate, 16000, 24000, 32000 or 48000.
+ *    frame_us: The frame duration, 7500 or 10000 us.
+ *    frame_bytes: The size of an encoded frame.
+ */
+struct cras_audio_codec *cras_lc3_codec_create(unsigned int rate,
+					       unsigned int frame_us,
+					       unsigned int frame_bytes);
+
+/* Destroys an LC3 codec.
+ * Args:
+ *    codec: the codec to destroy.
+ */
+void cras_lc3_codec_destroy(struct cras_audio_codec *codec);
+
+/* Gets the size of one frame of PCM in bytes. */
+int cras_lc3_get_codesize(struct cras_audio_codec *codec);
+
+#endif /* COMMON_CRAS_LC3_CODEC_H_ */
@@ -9,6 +9,8 @@
 #ifndef CRAS_MESSAGES_H_
 #define CRAS_MESSAGES_H_
 
+#include <errno.h>
+#include <stddef.h>
 #include <stdint.h>
 
 #include "cras_iodev_info.h"
@@ -17,7 +19,8 @@
 /* Rev when message format changes. If new messages are added, or message ID
  * values change. */
 #define CRAS_PROTO_VER 7
-#define CRAS_SERV_MAX_MSG_SIZE 256
+#define CRAS_SERV_MAX_MSG_SIZE 1024
+#define CRAS_SERV_MAX_MSG_FDS 16
 #define CRAS_CLIENT_MAX_MSG_SIZE 256
 #define CRAS_MAX_HOTWORD_MODELS 243
 #define CRAS_MAX_REMIX_CHANNELS 8
@@ -59,6 +62,16 @@ enum CRAS_SERVER_MESSAGE_ID {
 	CRAS_SERVER_SET_BT_WBS_ENABLED,
 	CRAS_SERVER_GET_ATLOG_FD,
 	CRAS_SERVER_DUMP_MAIN,
+	CRAS_SERVER_BATCH,
+	CRAS_SERVER_GET_OBSERVER_EVENT_FD,
+	CRAS_SERVER_SET_LOOPBACK_TARGET,
+	CRAS_SERVER_UPLOAD_SAMPLE,
+	CRAS_SERVER_PLAY_SAMPLE,
+	CRAS_SERVER_REMOVE_SAMPLE,
+	CRAS_SERVER_ADD_MONITOR_ROUTE,
+	CRAS_SERVER_RM_MONITOR_ROUTE,
+	CRAS_SERVER_RESUME_CLIENT,
+	CRAS_SERVER_DRAIN_STREAM,
 };
 
 enum CRAS_CLIENT_MESSAGE_ID {
@@ -80,6 +93,9 @@ enum CRAS_CLIENT_MESSAGE_ID {
 	CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED,
 	/* Server -> Client */
 	CRAS_CLIENT_ATLOG_FD_READY,
+	CRAS_CLIENT_OBSERVER_EVENT_FD_READY,
+	CRAS_CLIENT_RESUMED,
+	CRAS_CLIENT_STREAM_DRAINED,
 };
 
 /* Messages that control the server. These are sent from the client to affect
@@ -118,8 +134,17 @@ struct __attribute__((__packed__)) cras_connect_message {
 	/* Initial values for shm samples buffer offsets. These will be 0 for
 	 * streams that do not use client-provided shm */
 	uint64_t buffer_offsets[2];
+	/* Frames of the first samples buffer the client wrote before
+	 * connecting, played before the first request for audio. Only for
+	 * output streams with client-provided shm. */
+	uint32_t preroll_frames;
 };
 
+/* Clients built before preroll_frames was added send messages this long, the
+ * server takes them as having no preroll. */
+#define CRAS_CONNECT_MESSAGE_MIN_LEN                                          \
+	offsetof(struct cras_connect_message, preroll_frames)
+
 static inline void cras_fill_connect_message(
 	struct cras_connect_message *m, enum CRAS_STREAM_DIRECTION direction,
 	cras_stream_id_t stream_id, enum CRAS_STREAM_TYPE stream_type,
@@ -141,6 +166,7 @@ static inline void cras_fill_connect_message(
 	m->client_shm_size = 0;
 	m->buffer_offsets[0] = 0;
 	m->buffer_offsets[1] = 0;
+	m->preroll_frames = 0;
 	m->header.id = CRAS_SERVER_CONNECT_STREAM;
 	m->header.length = sizeof(struct cras_connect_message);
 }
@@ -159,6 +185,22 @@ cras_fill_disconnect_stream_message(struct cras_disconnect_stream_message *m,
 	m->header.length = sizeof(struct cras_disconnect_stream_message);
 }
 
+/* Sent by a client to remove a stream from the server once the samples the
+ * server holds are played. The server replies with cras_client_stream_drained.
+ */
+struct __attribute__((__packed__)) cras_drain_stream_message {
+	struct cras_server_message header;
+	cras_stream_id_t stream_id;
+};
+static inline void
+cras_fill_drain_stream_message(struct cras_drain_stream_message *m,
+			       cras_stream_id_t stream_id)
+{
+	m->stream_id = stream_id;
+	m->header.id = CRAS_SERVER_DRAIN_STREAM;
+	m->header.length = sizeof(*m);
+}
+
 /* Move streams of "type" to the iodev at "iodev_idx". */
 struct __attribute__((__packed__)) cras_switch_stream_type_iodev {
 	struct cras_server_message header;
@@ -331,6 +373,19 @@ static inline void cras_fill_get_atlog_fd(struct cras_get_atlog_fd *m)
 	m->header.length = sizeof(*m);
 }
 
+/* Requests the eventfd the server signals after adding a batch of events to
+ * the observer event ring in the server state. */
+struct __attribute__((__packed__)) cras_get_observer_event_fd {
+	struct cras_server_message header;
+};
+
+static inline void
+cras_fill_get_observer_event_fd(struct cras_get_observer_event_fd *m)
+{
+	m->header.id = CRAS_SERVER_GET_OBSERVER_EVENT_FD;
+	m->header.length = sizeof(*m);
+}
+
 /* Dump events in CRAS main thread. */
 struct __attribute__((__packed__)) cras_dump_main {
 	struct cras_server_message header;
@@ -401,6 +456,37 @@ static inline void cras_fill_test_dev_command(struct cras_test_dev_command *m,
 	memcpy(m->data, data, data_len);
 }
 
+/* A batch of control messages for the server to handle in one pass. The
+ * messages are packed back to back after the header, each one framed by its
+ * own cras_server_message header. Batches can't be nested. The fds of the
+ * stream connects in a batch are attached to the batch, in the order of the
+ * connects: the audio fd of each, followed by its client shm fd if it has
+ * client_shm_size set. The whole batch, header included, must fit in
+ * CRAS_SERV_MAX_MSG_SIZE and carry at most CRAS_SERV_MAX_MSG_FDS fds. */
+struct __attribute__((__packed__)) cras_server_batch {
+	struct cras_server_message header;
+	uint8_t messages[];
+};
+
+static inline void cras_fill_server_batch(struct cras_server_batch *m)
+{
+	m->header.id = CRAS_SERVER_BATCH;
+	m->header.length = sizeof(*m);
+}
+
+/* Appends msg to the batch m, which has room for max_size bytes. Returns 0 on
+ * success or -ENOSPC if msg doesn't fit. */
+static inline int cras_server_batch_append(struct cras_server_batch *m,
+					   size_t max_size,
+					   const struct cras_server_message *msg)
+{
+	if (m->header.length + msg->length > max_size)
+		return -ENOSPC;
+	memcpy((uint8_t *)m + m->header.length, msg, msg->length);
+	m->header.length += msg->length;
+	return 0;
+}
+
 static inline void cras_fill_suspend_message(struct cras_server_message *m,
 					     int is_suspend)
 {
@@ -503,6 +589,131 @@ cras_fill_set_bt_wbs_enabled(struct cras_set_bt_wbs_enabled *m,
 	m->enabled = enabled;
 }
 
+/* Selects the output streams the post mix loopback captures. With
+ * stream_id 0 all the streams of client_id are the target. */
+struct __attribute__((__packed__)) cras_set_loopback_target {
+	struct cras_server_message header;
+	uint32_t mode;
+	uint32_t client_id;
+	cras_stream_id_t stream_id;
+};
+static inline void
+cras_fill_set_loopback_target(struct cras_set_loopback_target *m,
+			      enum CRAS_LOOPBACK_TARGET_MODE mode,
+			      uint32_t client_id, cras_stream_id_t stream_id)
+{
+	m->header.id = CRAS_SERVER_SET_LOOPBACK_TARGET;
+	m->header.length = sizeof(*m);
+	m->mode = mode;
+	m->client_id = client_id;
+	m->stream_id = stream_id;
+}
+
+/* Adds a clip to the sample cache of the server, or replaces the one with
+ * the same id. The samples are read from the start of the fd sent with the
+ * message. */
+struct __attribute__((__packed__)) cras_upload_sample {
+	struct cras_server_message header;
+	uint32_t sample_id;
+	struct cras_audio_format_packed format;
+	uint32_t frames;
+};
+static inline void cras_fill_upload_sample(struct cras_upload_sample *m,
+					   uint32_t sample_id,
+					   const struct cras_audio_format *fmt,
+					   uint32_t frames)
+{
+	m->header.id = CRAS_SERVER_UPLOAD_SAMPLE;
+	m->header.length = sizeof(*m);
+	m->sample_id = sample_id;
+	pack_cras_audio_format(&m->format, fmt);
+	m->frames = frames;
+}
+
+/* Plays a cached clip once, on dev_idx or NO_DEVICE to follow the routing
+ * of the other output streams. */
+struct __attribute__((__packed__)) cras_play_sample {
+	struct cras_server_message header;
+	uint32_t sample_id;
+	uint32_t dev_idx;
+};
+static inline void cras_fill_play_sample(struct cras_play_sample *m,
+					 uint32_t sample_id, uint32_t dev_idx)
+{
+	m->header.id = CRAS_SERVER_PLAY_SAMPLE;
+	m->header.length = sizeof(*m);
+	m->sample_id = sample_id;
+	m->dev_idx = dev_idx;
+}
+
+/* Removes a clip from the sample cache. */
+struct __attribute__((__packed__)) cras_remove_sample {
+	struct cras_server_message header;
+	uint32_t sample_id;
+};
+static inline void cras_fill_remove_sample(struct cras_remove_sample *m,
+					   uint32_t sample_id)
+{
+	m->header.id = CRAS_SERVER_REMOVE_SAMPLE;
+	m->header.length = sizeof(*m);
+	m->sample_id = sample_id;
+}
+
+/* Plays what an input device captures on an output device, moved in format
+ * within the server, with the effects applied to it and scaled by gain. */
+struct __attribute__((__packed__)) cras_add_monitor_route {
+	struct cras_server_message header;
+	uint32_t input_dev_idx;
+	uint32_t output_dev_idx;
+	struct cras_audio_format_packed format;
+	uint32_t effects;
+	float gain;
+};
+static inline void
+cras_fill_add_monitor_route(struct cras_add_monitor_route *m,
+			    uint32_t input_dev_idx, uint32_t output_dev_idx,
+			    const struct cras_audio_format *fmt,
+			    uint32_t effects, float gain)
+{
+	m->header.id = CRAS_SERVER_ADD_MONITOR_ROUTE;
+	m->header.length = sizeof(*m);
+	m->input_dev_idx = input_dev_idx;
+	m->output_dev_idx = output_dev_idx;
+	pack_cras_audio_format(&m->format, fmt);
+	m->effects = effects;
+	m->gain = gain;
+}
+
+/* Removes the monitor route between two devices. */
+struct __attribute__((__packed__)) cras_rm_monitor_route {
+	struct cras_server_message header;
+	uint32_t input_dev_idx;
+	uint32_t output_dev_idx;
+};
+static inline void cras_fill_rm_monitor_route(struct cras_rm_monitor_route *m,
+					      uint32_t input_dev_idx,
+					      uint32_t output_dev_idx)
+{
+	m->header.id = CRAS_SERVER_RM_MONITOR_ROUTE;
+	m->header.length = sizeof(*m);
+	m->input_dev_idx = input_dev_idx;
+	m->output_dev_idx = output_dev_idx;
+}
+
+/* Asks to take back the id a client had before the server restarted, so
+ * that the client can connect its streams again with the same ids. */
+struct __attribute__((__packed__)) cras_resume_client {
+	struct cras_server_message header;
+	uint32_t client_id;
+};
+static inline void cras_fill_resume_client(struct cras_resume_client *m,
+					   uint32_t client_id)
+{
+	m->header.id = CRAS_SERVER_RESUME_CLIENT;
+	m->header.length = sizeof(*m);
+	m->client_id = client_id;
+}
+
 struct __attribute__((__packed__)) cras_register_notification {
 	struct cras_server_message header;
 	uint32_t msg_id;
@@ -536,6 +747,35 @@ static inline void cras_fill_client_connected(struct cras_client_connected *m,
 	m->header.length = sizeof(struct cras_client_connected);
 }
 
+/* Reply to cras_resume_client, client_id is the id the client has now. It is
+ * the id asked for if the server gave it back. */
+struct __attribute__((__packed__)) cras_client_resumed {
+	struct cras_client_message header;
+	uint32_t client_id;
+};
+static inline void cras_fill_client_resumed(struct cras_client_resumed *m,
+					    uint32_t client_id)
+{
+	m->header.id = CRAS_CLIENT_RESUMED;
+	m->header.length = sizeof(*m);
+	m->client_id = client_id;
+}
+
+/* Reply to cras_drain_stream_message, sent once the stream played its last
+ * samples and is gone from the server. */
+struct __attribute__((__packed__)) cras_client_stream_drained {
+	struct cras_client_message header;
+	cras_stream_id_t stream_id;
+};
+static inline void
+cras_fill_client_stream_drained(struct cras_client_stream_drained *m,
+				cras_stream_id_t stream_id)
+{
+	m->header.id = CRAS_CLIENT_STREAM_DRAINED;
+	m->header.length = sizeof(*m);
+	m->stream_id = stream_id;
+}
+
 /*
  * Reply from server that a stream has been successfully added.
  * Two file descriptors are added, input shm followed by out shm.
@@ -592,6 +832,18 @@ cras_fill_client_atlog_fd_ready(struct cras_client_atlog_fd_ready *m)
 	m->header.length = sizeof(*m);
 }
 
+/* Sent from server to client with the observer event ring eventfd attached. */
+struct __attribute__((__packed__)) cras_client_observer_event_fd_ready {
+	struct cras_client_message header;
+};
+
+static inline void cras_fill_client_observer_event_fd_ready(
+	struct cras_client_observer_event_fd_ready *m)
+{
+	m->header.id = CRAS_CLIENT_OBSERVER_EVENT_FD_READY;
+	m->header.length = sizeof(*m);
+}
+
 /* Sent from server to client when hotword models info is ready. */
 struct __attribute__((__packed__)) cras_client_get_hotword_models_ready {
 	struct cras_client_message header;
@@ -10,14 +10,45 @@
 #ifdef HAVE_LIB_METRICS
 #include <metrics/c_metrics_library.h>
 
+/* The handle of the calling thread's batch, see cras_metrics_begin_batch(). */
+static __thread CMetricsLibrary batch_handle;
+static __thread unsigned int batch_depth;
+
+static CMetricsLibrary get_handle()
+{
+	return batch_depth ? batch_handle : CMetricsLibraryNew();
+}
+
+static void put_handle(CMetricsLibrary handle)
+{
+	if (!batch_depth)
+		CMetricsLibraryDelete(handle);
+}
+
+void cras_metrics_begin_batch()
+{
+	if (batch_depth++ == 0)
+		batch_handle = CMetricsLibraryNew();
+}
+
+void cras_metrics_end_batch()
+{
+	if (!batch_depth)
+		return;
+	if (--batch_depth == 0) {
+		CMetricsLibraryDelete(batch_handle);
+		batch_handle = NULL;
+	}
+}
+
 void cras_metrics_log_event(const char *event)
 {
 	CMetricsLibrary handle;
 
 	syslog(LOG_DEBUG, "UMA event: %s", event);
-	handle = CMetricsLibraryNew();
+	handle = get_handle();
 	CMetricsLibrarySendCrosEventToUMA(handle, event);
-	CMetricsLibraryDelete(handle);
+	put_handle(handle);
 }
 
 void cras_metrics_log_histogram(const char *name, int sample, int min, int max,
@@ -26,9 +57,9 @@ void cras_metrics_log_histogram(const char *name, int sample, int min, int max,
 	CMetricsLibrary handle;
 
 	syslog(LOG_DEBUG, "UMA name: %s", name);
-	handle = CMetricsLibraryNew();
+	handle = get_handle();
 	CMetricsLibrarySendToUMA(handle, name, sample, min, max, nbuckets);
-	CMetricsLibraryDelete(handle);
+	put_handle(handle);
 }
 
 void cras_metrics_log_sparse_histogram(const char *name, int sample)
@@ -36,9 +67,9 @@ void cras_metrics_log_sparse_histogram(const char *name, int sample)
 	CMetricsLibrary handle;
 
 	syslog(LOG_DEBUG, "UMA name: %s", name);
-	handle = CMetricsLibraryNew();
+	handle = get_handle();
 	CMetricsLibrarySendSparseToUMA(handle, name, sample);
-	CMetricsLibraryDelete(handle);
+	put_handle(handle);
 }
 
 #else
@@ -55,4 +86,10 @@ void cras_metrics_log_enum_histogram(const char *name, int sample, int max)
 void cras_metrics_log_sparse_histogram(const char *name, int sample)
 {
 }
+void cras_metrics_begin_batch()
+{
+}
+void cras_metrics_end_batch()
+{
+}
 #endif
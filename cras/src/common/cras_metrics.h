@@ -16,4 +16,12 @@ void cras_metrics_log_histogram(const char *name, int sample, int min, int max,
 /* Sends sparse histogram data. */
 void cras_metrics_log_sparse_histogram(const char *name, int sample);
 
+/* Makes the calling thread send the metrics it logs until the matching
+ * cras_metrics_end_batch() through one metrics library handle, instead of
+ * setting one up for each sample. Batches can nest. */
+void cras_metrics_begin_batch();
+
+/* Ends a batch started by cras_metrics_begin_batch(). */
+void cras_metrics_end_batch();
+
 #endif /* CRAS_METRICS_H_ */
@@ -0,0 +1,69 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE /* For memfd_create() */
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_mirror.h"
+
+size_t cras_mirror_size(size_t size)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+
+	return (size + page - 1) / page * page;
+}
+
+void *cras_mirror_map(size_t size, unsigned int num_planes)
+{
+	uint8_t *base, *addr;
+	unsigned int i, j;
+	int fd;
+
+	if (!size || !num_planes || size != cras_mirror_size(size))
+		return NULL;
+
+	fd = memfd_create("cras-mirror", MFD_CLOEXEC);
+	if (fd < 0) {
+		syslog(LOG_ERR, "failed to memfd_create mirror: %s",
+		       strerror(errno));
+		return NULL;
+	}
+	if (ftruncate(fd, size * num_planes)) {
+		syslog(LOG_ERR, "failed to size mirror: %s", strerror(errno));
+		close(fd);
+		return NULL;
+	}
+
+	/* Reserves the address space, then puts each plane over it twice. */
+	base = mmap(NULL, 2 * size * num_planes, PROT_NONE,
+		    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return NULL;
+	}
+	for (i = 0; i < num_planes; i++) {
+		for (j = 0; j < 2; j++) {
+			addr = mmap(base + (2 * i + j) * size, size,
+				    PROT_READ | PROT_WRITE,
+				    MAP_SHARED | MAP_FIXED, fd, i * size);
+			if (addr != MAP_FAILED)
+				continue;
+			syslog(LOG_ERR, "failed to map mirror: %s",
+			       strerror(errno));
+			munmap(base, 2 * size * num_planes);
+			close(fd);
+			return NULL;
+		}
+	}
+
+	/* The mappings keep the pages. */
+	close(fd);
+	return base;
+}
@@ -0,0 +1,44 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_MIRROR_H_
+#define CRAS_MIRROR_H_
+
+#include <stddef.h>
+#include <sys/mman.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Rounds size up to the size of a plane cras_mirror_map() can map, a whole
+ * number of pages. */
+size_t cras_mirror_size(size_t size);
+
+/* Maps planes of memory each followed by a mirror of itself: the pages of
+ * plane i are mapped at base + 2 * i * size and again right after them.
+ * Any span of up to size bytes starting in a plane is then contiguous, what
+ * runs past the end of the plane lands at its start. Rings kept in a plane
+ * never have their reads or writes split at the wrap.
+ * Args:
+ *    size - The bytes of each plane, a result of cras_mirror_size().
+ *    num_planes - The number of planes.
+ * Returns:
+ *    The base of the planes or NULL on failure.
+ */
+void *cras_mirror_map(size_t size, unsigned int num_planes);
+
+/* Unmaps the planes mapped by cras_mirror_map(). */
+static inline void cras_mirror_unmap(void *base, size_t size,
+				     unsigned int num_planes)
+{
+	munmap(base, 2 * size * num_planes);
+}
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CRAS_MIRROR_H_ */
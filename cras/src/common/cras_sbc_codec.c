@@ -6,6 +6,7 @@
 #include <errno.h>
 #include <sbc/sbc.h>
 #include <stdlib.h>
+#include <sys/param.h>
 
 #include "cras_sbc_codec.h"
 
@@ -96,13 +97,18 @@ int cras_sbc_encode(struct cras_audio_codec *codec, const void *input,
 {
 	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
 	ssize_t written, encoded;
+	size_t frames, i;
 	int processed = 0, result = 0;
 
-	/* Proceed encode when input buffer has at least one input block and
-	 * there is still room in output buffer.
+	/* Encode every whole input block the output has room for, usually
+	 * filling the rest of a packet, without calling in to find out
+	 * where the room ends.
 	 */
-	while (input_len - processed >= data->codesize &&
-	       output_len >= result) {
+	frames = input_len / data->codesize;
+	if (data->frame_length)
+		frames = MIN(frames, output_len / data->frame_length);
+
+	for (i = 0; i < frames; i++) {
 		encoded = sbc_encode(&data->sbc, input + processed,
 				     data->codesize, output + result,
 				     output_len - result, &written);
@@ -118,6 +124,28 @@ int cras_sbc_encode(struct cras_audio_codec *codec, const void *input,
 	return processed;
 }
 
+int cras_msbc_decode_frames(struct cras_audio_codec *codec,
+			    const uint8_t *input, size_t stride,
+			    unsigned int frames, uint8_t *output,
+			    size_t output_len)
+{
+	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
+	size_t written, result = 0;
+	unsigned int i;
+	ssize_t decoded;
+
+	for (i = 0; i < frames && output_len - result >= data->codesize;
+	     i++) {
+		decoded = sbc_decode(&data->sbc, input + i * stride,
+				     data->frame_length, output + result,
+				     output_len - result, &written);
+		if (decoded <= 0 || written != data->codesize)
+			break;
+		result += written;
+	}
+	return i;
+}
+
 int cras_sbc_get_codesize(struct cras_audio_codec *codec)
 {
 	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
@@ -130,6 +158,15 @@ int cras_sbc_get_frame_length(struct cras_audio_codec *codec)
 	return data->frame_length;
 }
 
+void cras_sbc_set_bitpool(struct cras_audio_codec *codec, uint8_t bitpool)
+{
+	struct cras_sbc_data *data = (struct cras_sbc_data *)codec->priv_data;
+
+	/* The encoder picks the new bitpool up when it starts a frame. */
+	data->sbc.bitpool = bitpool;
+	data->frame_length = sbc_get_frame_length(&data->sbc);
+}
+
 struct cras_audio_codec *cras_msbc_codec_create()
 {
 	struct cras_audio_codec *codec;
@@ -27,6 +27,25 @@ struct cras_audio_codec *cras_sbc_codec_create(uint8_t freq, uint8_t mode,
  * wideband speech mode of HFP. */
 struct cras_audio_codec *cras_msbc_codec_create();
 
+/* Decodes frames mSBC frames spaced stride bytes apart, like the payloads
+ * of back to back SCO packets, in one call. The PCM of the frames is written
+ * back to back to output.
+ * Args:
+ *    codec: the mSBC codec.
+ *    input: the first frame.
+ *    stride: bytes from the start of one frame to the start of the next.
+ *    frames: the number of frames in input.
+ *    output: the buffer to decode to.
+ *    output_len: the size of output in bytes.
+ * Returns:
+ *    The number of frames decoded. Fewer than frames when one fails to
+ *    decode or output runs out of room for the next.
+ */
+int cras_msbc_decode_frames(struct cras_audio_codec *codec,
+			    const uint8_t *input, size_t stride,
+			    unsigned int frames, uint8_t *output,
+			    size_t output_len);
+
 /* Destroys an sbc codec.
  * Args:
  *    codec: the codec to destroy.
@@ -41,4 +60,12 @@ int cras_sbc_get_codesize(struct cras_audio_codec *codec);
  */
 int cras_sbc_get_frame_length(struct cras_audio_codec *codec);
 
+/* Changes the bitpool of an sbc encoder, which takes effect from the next
+ * frame it encodes. The frame_length changes with it.
+ * Args:
+ *    codec: the sbc codec.
+ *    bitpool: the new bitpool.
+ */
+void cras_sbc_set_bitpool(struct cras_audio_codec *codec, uint8_t bitpool);
+
 #endif /* COMMON_CRAS_SBC_CODEC_H_ */
@@ -3,21 +3,30 @@
  * found in the LICENSE file.
  */
 
+#define _GNU_SOURCE /* For memfd_create() and F_ADD_SEALS */
+
 #include <sys/cdefs.h>
 #include <sys/mman.h>
+#include <sys/syscall.h>
 #ifdef __BIONIC__
 #include <cutils/ashmem.h>
 #else
 #include <sys/shm.h>
 #endif
 #include <errno.h>
+#include <fcntl.h>
 #include <syslog.h>
 #include <stdio.h>
 #include <string.h>
 #include <unistd.h>
+#include <linux/futex.h>
 
 #include "cras_shm.h"
 
+#ifndef MFD_HUGETLB
+#define MFD_HUGETLB 0x0004U
+#endif
+
 int cras_shm_info_init(const char *stream_name, uint32_t length,
 		       struct cras_shm_info *info_out)
 {
@@ -26,10 +35,15 @@ int cras_shm_info_init(const char *stream_name, uint32_t length,
 	if (!info_out)
 		return -EINVAL;
 
-	strncpy(info.name, stream_name, sizeof(info.name) - 1);
-	info.name[sizeof(info.name) - 1] = '\0';
+	/* Anonymous memfds need no name in /dev/shm and no unlink. */
+	info.name[0] = '\0';
 	info.length = length;
-	info.fd = cras_shm_open_rw(info.name, info.length);
+	info.fd = cras_shm_memfd_create(stream_name, length, 0);
+	if (info.fd == -ENOSYS) {
+		strncpy(info.name, stream_name, sizeof(info.name) - 1);
+		info.name[sizeof(info.name) - 1] = '\0';
+		info.fd = cras_shm_open_rw(info.name, info.length);
+	}
 	if (info.fd < 0)
 		return info.fd;
 
@@ -38,6 +52,32 @@ int cras_shm_info_init(const char *stream_name, uint32_t length,
 	return 0;
 }
 
+int cras_shm_info_init_samples(const char *stream_name, uint32_t length,
+			       struct cras_shm_info *info_out)
+{
+	size_t huge_length;
+	int fd;
+
+	if (!info_out)
+		return -EINVAL;
+
+	if (length < CRAS_SHM_HUGEPAGE_SIZE)
+		return cras_shm_info_init(stream_name, length, info_out);
+
+	/* Explicit hugepages only work if the system reserved some, fall
+	 * back to normal pages otherwise. */
+	huge_length = (length + CRAS_SHM_HUGEPAGE_SIZE - 1) &
+		      ~(CRAS_SHM_HUGEPAGE_SIZE - 1);
+	fd = cras_shm_memfd_create(stream_name, huge_length, MFD_HUGETLB);
+	if (fd < 0)
+		return cras_shm_info_init(stream_name, length, info_out);
+
+	info_out->name[0] = '\0';
+	info_out->length = huge_length;
+	info_out->fd = fd;
+	return 0;
+}
+
 int cras_shm_info_init_with_fd(int fd, size_t length,
 			       struct cras_shm_info *info_out)
 {
@@ -143,6 +183,10 @@ int cras_audio_shm_create(struct cras_shm_info *header_info,
 		goto free_shm;
 	}
 
+	/* Transparent hugepages for shmem are opt-in per mapping. */
+	if (shm->samples_info.length >= CRAS_SHM_HUGEPAGE_SIZE)
+		madvise(shm->samples, shm->samples_info.length, MADV_HUGEPAGE);
+
 	cras_shm_set_volume_scaler(shm, 1.0);
 
 	*shm_out = shm;
@@ -156,6 +200,14 @@ cleanup_info:
 	return ret;
 }
 
+void cras_audio_shm_reset(struct cras_audio_shm *shm)
+{
+	memset(shm->header, 0, shm->header_info.length);
+	memset(&shm->config, 0, sizeof(shm->config));
+	shm->ring_size = 0;
+	cras_shm_set_volume_scaler(shm, 1.0);
+}
+
 void cras_audio_shm_destroy(struct cras_audio_shm *shm)
 {
 	if (!shm)
@@ -171,6 +223,57 @@ void cras_audio_shm_destroy(struct cras_audio_shm *shm)
 	free(shm);
 }
 
+/* The doorbell is shared between processes, so the futex calls can't be
+ * private. */
+static void doorbell_futex_wake(struct cras_audio_shm *shm)
+{
+	syscall(SYS_futex, &shm->header->doorbell_seq, FUTEX_WAKE, INT32_MAX,
+		NULL, NULL, 0);
+}
+
+void cras_shm_ring_doorbell(struct cras_audio_shm *shm, uint32_t id,
+			    uint32_t frames)
+{
+	struct cras_audio_shm_header *header = shm->header;
+
+	header->reply_wanted = 0;
+	header->doorbell_id = id;
+	header->doorbell_frames = frames;
+	__atomic_add_fetch(&header->doorbell_seq, 1, __ATOMIC_SEQ_CST);
+	doorbell_futex_wake(shm);
+}
+
+uint32_t cras_shm_wait_doorbell(struct cras_audio_shm *shm, uint32_t seq)
+{
+	struct cras_audio_shm_header *header = shm->header;
+
+	if (__atomic_load_n(&header->doorbell_seq, __ATOMIC_SEQ_CST) == seq)
+		syscall(SYS_futex, &header->doorbell_seq, FUTEX_WAIT, seq, NULL,
+			NULL, 0);
+	return __atomic_load_n(&header->doorbell_seq, __ATOMIC_SEQ_CST);
+}
+
+void cras_shm_wake_doorbell(struct cras_audio_shm *shm)
+{
+	__atomic_add_fetch(&shm->header->doorbell_seq, 1, __ATOMIC_SEQ_CST);
+	doorbell_futex_wake(shm);
+}
+
+/* The reply and the ask for it are ordered so that either the server sees
+ * the callback done or the client sees the ask. */
+int cras_shm_doorbell_reply(struct cras_audio_shm *shm)
+{
+	__atomic_store_n(&shm->header->callback_pending, 0, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&shm->header->reply_wanted, __ATOMIC_SEQ_CST);
+}
+
+int cras_shm_want_reply(struct cras_audio_shm *shm)
+{
+	__atomic_store_n(&shm->header->reply_wanted, 1, __ATOMIC_SEQ_CST);
+	return __atomic_load_n(&shm->header->callback_pending,
+			       __ATOMIC_SEQ_CST);
+}
+
 /* Set the correct SELinux label for SHM fds. */
 static void cras_shm_restorecon(int fd)
 {
@@ -236,6 +339,11 @@ void cras_shm_close_unlink(const char *name, int fd)
 	close(fd);
 }
 
+int cras_shm_memfd_create(const char *name, size_t size, unsigned int flags)
+{
+	return -ENOSYS;
+}
+
 #else
 
 int cras_shm_open_rw(const char *name, size_t size)
@@ -282,6 +390,48 @@ void cras_shm_close_unlink(const char *name, int fd)
 	close(fd);
 }
 
+int cras_shm_memfd_create(const char *name, size_t size, unsigned int flags)
+{
+	int fd;
+	int rc;
+
+	/* memfd names are only for debugging, drop the shm_open style '/'. */
+	if (name[0] == '/')
+		name++;
+	fd = memfd_create(name, MFD_CLOEXEC | MFD_ALLOW_SEALING | flags);
+	if (fd < 0) {
+		fd = -errno;
+		if (fd != -ENOSYS && !(flags & MFD_HUGETLB))
+			syslog(LOG_ERR, "failed to memfd_create %s: %s\n",
+			       name, strerror(-fd));
+		return fd;
+	}
+
+	/* Allocating up front also makes hugetlb fail here, rather than
+	 * fault later, when no hugepages are left. */
+	rc = posix_fallocate(fd, 0, size);
+	if (rc) {
+		if (!(flags & MFD_HUGETLB))
+			syslog(LOG_ERR, "failed to set size of memfd %s: %s\n",
+			       name, strerror(rc));
+		close(fd);
+		return -rc;
+	}
+
+	/* The size can't change once the server and client have mapped it,
+	 * truncating the file under a mapping would fault the server. */
+	if (fcntl(fd, F_ADD_SEALS,
+		  F_SEAL_SHRINK | F_SEAL_GROW | F_SEAL_SEAL) < 0) {
+		rc = -errno;
+		syslog(LOG_ERR, "failed to seal memfd %s: %s\n", name,
+		       strerror(-rc));
+		close(fd);
+		return rc;
+	}
+
+	return fd;
+}
+
 #endif
 
 void *cras_shm_setup(const char *name, size_t mmap_size, int *rw_fd_out,
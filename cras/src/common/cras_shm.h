@@ -16,6 +16,8 @@
 
 #define CRAS_NUM_SHM_BUFFERS 2U /* double buffer */
 #define CRAS_SHM_BUFFERS_MASK (CRAS_NUM_SHM_BUFFERS - 1)
+#define CRAS_SHM_MAX_SEGMENTS 8U
+#define CRAS_SHM_RING_BUFFERS 4U /* buffers of used_size in a ring */
 
 /* Configuration of the shm area.
  *
@@ -27,6 +29,16 @@ struct __attribute__((__packed__)) cras_audio_shm_config {
 	uint32_t frame_bytes;
 };
 
+/* A region of the samples area holding part of a buffer.
+ *
+ *  offset - Offset of the region from start of samples area.
+ *  bytes - Size of the region in bytes, a multiple of the frame size.
+ */
+struct __attribute__((__packed__)) cras_shm_segment {
+	uint64_t offset;
+	uint32_t bytes;
+};
+
 /* Structure containing stream metadata shared between client and server.
  *
  *  config - Size config data.  A copy of the config shared with clients.
@@ -46,6 +58,26 @@ struct __attribute__((__packed__)) cras_audio_shm_config {
  *    This is only valid in audio callbacks.
  *  buffer_offset - Offset of each buffer from start of samples area.
  *                  Valid range: 0 <= buffer_offset <= shm->samples_info.length
+ *  doorbell - Non-zero when the server rings the doorbell here instead of
+ *    sending audio messages through the stream socket.
+ *  doorbell_seq - Bumped for each audio message rung, the futex word the
+ *    client waits on.
+ *  doorbell_id - The CRAS_AUDIO_MESSAGE_ID of the last message rung.
+ *  doorbell_frames - The frames of the last message rung.
+ *  reply_wanted - Set by the server when it waits on a late reply, so the
+ *    client sends the reply through the stream socket to wake it.
+ *  num_segments - Number of regions in segments holding each buffer, 0 when
+ *    the buffer is the single region at buffer_offset. Lets a client with
+ *    scattered playback buffers in its shm hand them to the server without
+ *    copying them together. Only used when reading samples.
+ *  segments - The regions holding each buffer, in order.
+ *  ring_size - Non-zero when the samples area is a ring of this many bytes
+ *    instead of the A/B buffers. The client then queues any number of
+ *    callbacks ahead until the ring is full, and the server reads them in
+ *    place. The offsets and buffer indexes above are unused.
+ *  ring_read - Bytes read from the ring, wrapping. Only the server moves it.
+ *  ring_write - Bytes written to the ring, wrapping. Only the client moves
+ *    it. Both are accessed atomically, write - read is the bytes queued.
  */
 struct __attribute__((__packed__)) cras_audio_shm_header {
 	struct cras_audio_shm_config config;
@@ -60,6 +92,17 @@ struct __attribute__((__packed__)) cras_audio_shm_header {
 	uint32_t num_overruns;
 	struct cras_timespec ts;
 	uint64_t buffer_offset[CRAS_NUM_SHM_BUFFERS];
+	int32_t doorbell;
+	uint32_t doorbell_seq;
+	uint32_t doorbell_id;
+	uint32_t doorbell_frames;
+	int32_t reply_wanted;
+	uint32_t num_segments[CRAS_NUM_SHM_BUFFERS];
+	struct cras_shm_segment segments[CRAS_NUM_SHM_BUFFERS]
+					[CRAS_SHM_MAX_SEGMENTS];
+	uint32_t ring_size;
+	uint32_t ring_read;
+	uint32_t ring_write;
 };
 
 /* Returns the number of bytes needed to hold a cras_audio_shm_header. */
@@ -75,6 +118,13 @@ static inline uint32_t cras_shm_calculate_samples_size(uint32_t used_size)
 	return used_size * CRAS_NUM_SHM_BUFFERS;
 }
 
+/* Returns the number of bytes needed to hold the samples area for an audio
+ * shm used as a ring of buffers of the given used_size. */
+static inline uint32_t cras_shm_calculate_ring_size(uint32_t used_size)
+{
+	return used_size * CRAS_SHM_RING_BUFFERS;
+}
+
 /* Holds identifiers for a shm segment. All valid cras_shm_info objects will
  * have an fd and a length, and they may have the name of the shm file as well.
  *
@@ -89,7 +139,8 @@ struct cras_shm_info {
 };
 
 /* Initializes a cras_shm_info to be used as the backing shared memory for a
- * cras_audio_shm.
+ * cras_audio_shm. The area is a sealed memfd when the kernel supports it,
+ * otherwise a shm file named shm_name.
  *
  * shm_name - the name of the shm area to create.
  * length - the length of the shm area to create.
@@ -98,6 +149,16 @@ struct cras_shm_info {
 int cras_shm_info_init(const char *shm_name, uint32_t length,
 		       struct cras_shm_info *info_out);
 
+/* Size of the hugepages used for large samples areas. */
+#define CRAS_SHM_HUGEPAGE_SIZE (2U * 1024 * 1024)
+
+/* Like cras_shm_info_init, for a samples area. Areas of at least
+ * CRAS_SHM_HUGEPAGE_SIZE are backed by hugepages if the system has some
+ * reserved, and info_out->length is then rounded up to a whole hugepage.
+ */
+int cras_shm_info_init_samples(const char *shm_name, uint32_t length,
+			       struct cras_shm_info *info_out);
+
 /* Initializes a cras_shm_info to be used as the backing shared memory for a
  * cras_audio_shm.
  *
@@ -123,6 +184,8 @@ void cras_shm_info_cleanup(struct cras_shm_info *info);
  *  header - Shm region containing audio metadata
  *  samples_info - fd, name, and length of shm containing samples.
  *  samples - Shm region containing audio data.
+ *  ring_size - Bytes of the samples area used as a ring, 0 for A/B buffers.
+ *    Kept separate like config.
  */
 struct cras_audio_shm {
 	struct cras_audio_shm_config config;
@@ -130,6 +193,7 @@ struct cras_audio_shm {
 	struct cras_audio_shm_header *header;
 	struct cras_shm_info samples_info;
 	uint8_t *samples;
+	uint32_t ring_size;
 };
 
 /* Sets up a cras_audio_shm given info about the shared memory to use
@@ -153,12 +217,43 @@ int cras_audio_shm_create(struct cras_shm_info *header_info,
 			  struct cras_shm_info *samples_info, int samples_prot,
 			  struct cras_audio_shm **shm_out);
 
+/* Clears the header of a cras_audio_shm so it can be used for a new stream.
+ * The samples area is left as is, the new stream's offsets cover it.
+ *
+ * shm - the cras_audio_shm to reset.
+ */
+void cras_audio_shm_reset(struct cras_audio_shm *shm);
+
 /* Destroys a cras_audio_shm returned from cras_audio_shm_create.
  *
  * shm - the cras_audio_shm to destroy.
  */
 void cras_audio_shm_destroy(struct cras_audio_shm *shm);
 
+/* Returns non-zero if the samples area is a ring. */
+static inline int cras_shm_is_ring(const struct cras_audio_shm *shm)
+{
+	return shm->ring_size != 0;
+}
+
+/* Returns the bytes queued in the ring. The client may have moved
+ * ring_write anywhere, so it is limited to the ring. */
+static inline uint32_t cras_shm_ring_queued(const struct cras_audio_shm *shm)
+{
+	uint32_t read, write;
+
+	read = __atomic_load_n(&shm->header->ring_read, __ATOMIC_ACQUIRE);
+	write = __atomic_load_n(&shm->header->ring_write, __ATOMIC_ACQUIRE);
+	return MIN(write - read, shm->ring_size);
+}
+
+/* Returns the offset in the ring of the byte at counter pos. */
+static inline uint32_t cras_shm_ring_offset(const struct cras_audio_shm *shm,
+					    uint32_t pos)
+{
+	return pos % shm->ring_size;
+}
+
 /* Limit a buffer offset to within the samples area size. */
 static inline unsigned
 cras_shm_get_checked_buffer_offset(const struct cras_audio_shm *shm,
@@ -244,12 +339,26 @@ cras_shm_get_read_buffer_base(const struct cras_audio_shm *shm)
 	return cras_shm_buff_for_idx(shm, i);
 }
 
+/* Returns non-zero if the current read buffer is split in segments. */
+static inline int
+cras_shm_read_buffer_segmented(const struct cras_audio_shm *shm)
+{
+	unsigned i = shm->header->read_buf_idx & CRAS_SHM_BUFFERS_MASK;
+
+	if (cras_shm_is_ring(shm))
+		return 0;
+	return shm->header->num_segments[i] != 0;
+}
+
 /* Get the base of the current write buffer. */
 static inline uint8_t *
 cras_shm_get_write_buffer_base(const struct cras_audio_shm *shm)
 {
 	unsigned i = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	if (cras_shm_is_ring(shm))
+		return shm->samples +
+		       cras_shm_ring_offset(shm, shm->header->ring_write);
 	return cras_shm_buff_for_idx(shm, i);
 }
 
@@ -275,6 +384,38 @@ cras_shm_get_writeable_frames(const struct cras_audio_shm *shm,
 	return cras_shm_buff_for_idx(shm, buf_idx) + write_offset;
 }
 
+/* Get a pointer to 'offset' bytes into buffer buf_idx split in segments.
+ * 'frames' is limited to the frames left in the segment holding that byte,
+ * which is cut short at the end of the samples area. Returns NULL and sets
+ * 'frames' to 0 if offset is past the segments. */
+static inline uint8_t *cras_shm_segment_at(const struct cras_audio_shm *shm,
+					   unsigned buf_idx, unsigned offset,
+					   size_t *frames)
+{
+	const struct cras_shm_segment *segments = shm->header->segments[buf_idx];
+	const uint64_t length = shm->samples_info.length;
+	unsigned num, i;
+
+	num = MIN(shm->header->num_segments[buf_idx], CRAS_SHM_MAX_SEGMENTS);
+	for (i = 0; i < num; i++) {
+		uint64_t seg_offset = segments[i].offset;
+		uint32_t seg_bytes = segments[i].bytes;
+
+		if (offset < seg_bytes) {
+			if (seg_offset >= length || offset >= length - seg_offset)
+				break;
+			*frames = MIN(*frames,
+				      MIN(seg_bytes - offset,
+					  length - seg_offset - offset) /
+					      shm->config.frame_bytes);
+			return shm->samples + seg_offset + offset;
+		}
+		offset -= seg_bytes;
+	}
+	*frames = 0;
+	return NULL;
+}
+
 /* Get a pointer to the current read buffer plus an offset.  The offset might be
  * in the next buffer. 'frames' is filled with the number of frames that can be
  * copied from the returned buffer.
@@ -288,6 +429,23 @@ cras_shm_get_readable_frames(const struct cras_audio_shm *shm, size_t offset,
 
 	assert(frames != NULL);
 
+	if (cras_shm_is_ring(shm)) {
+		uint32_t queued = cras_shm_ring_queued(shm);
+		uint32_t pos;
+
+		offset *= shm->config.frame_bytes;
+		if (offset >= queued) {
+			*frames = 0;
+			return NULL;
+		}
+		/* Only contiguous up to the end of the ring. */
+		pos = cras_shm_ring_offset(shm,
+					   shm->header->ring_read + offset);
+		*frames = MIN(queued - offset, shm->ring_size - pos) /
+			  shm->config.frame_bytes;
+		return shm->samples + pos;
+	}
+
 	read_offset = cras_shm_get_checked_read_offset(shm, buf_idx);
 	write_offset = cras_shm_get_checked_write_offset(shm, buf_idx);
 	final_offset = read_offset + offset * shm->config.frame_bytes;
@@ -303,6 +461,8 @@ cras_shm_get_readable_frames(const struct cras_audio_shm *shm, size_t offset,
 		return NULL;
 	}
 	*frames = (write_offset - final_offset) / shm->config.frame_bytes;
+	if (shm->header->num_segments[buf_idx])
+		return cras_shm_segment_at(shm, buf_idx, final_offset, frames);
 	return cras_shm_buff_for_idx(shm, buf_idx) + final_offset;
 }
 
@@ -312,6 +472,9 @@ static inline size_t cras_shm_get_bytes_queued(const struct cras_audio_shm *shm)
 	size_t total, i;
 	const unsigned used_size = shm->config.used_size;
 
+	if (cras_shm_is_ring(shm))
+		return cras_shm_ring_queued(shm);
+
 	total = 0;
 	for (i = 0; i < CRAS_NUM_SHM_BUFFERS; i++) {
 		unsigned read_offset, write_offset;
@@ -358,6 +521,10 @@ static inline int cras_shm_is_buffer_available(const struct cras_audio_shm *shm)
 {
 	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	/* A ring is available while a whole buffer fits in it. */
+	if (cras_shm_is_ring(shm))
+		return shm->ring_size - cras_shm_ring_queued(shm) >=
+		       shm->config.used_size;
 	return (shm->header->write_offset[buf_idx] == 0);
 }
 
@@ -365,6 +532,16 @@ static inline int cras_shm_is_buffer_available(const struct cras_audio_shm *shm)
 static inline size_t
 cras_shm_get_num_writeable(const struct cras_audio_shm *shm)
 {
+	/* Writes into a ring stop at its end, the next one starts over. */
+	if (cras_shm_is_ring(shm)) {
+		uint32_t pos =
+			cras_shm_ring_offset(shm, shm->header->ring_write);
+
+		return MIN(shm->ring_size - cras_shm_ring_queued(shm),
+			   shm->ring_size - pos) /
+		       shm->config.frame_bytes;
+	}
+
 	/* Not allowed to write to a buffer twice. */
 	if (!cras_shm_is_buffer_available(shm))
 		return 0;
@@ -423,6 +600,9 @@ static inline void cras_shm_buffer_write_complete(struct cras_audio_shm *shm)
 {
 	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	if (cras_shm_is_ring(shm))
+		return;
+
 	shm->header->write_in_progress[buf_idx] = 0;
 
 	assert_on_compile_is_power_of_2(CRAS_NUM_SHM_BUFFERS);
@@ -436,11 +616,29 @@ static inline void cras_shm_buffer_written_start(struct cras_audio_shm *shm,
 {
 	size_t buf_idx = shm->header->write_buf_idx & CRAS_SHM_BUFFERS_MASK;
 
+	/* Publishes the samples written before it. */
+	if (cras_shm_is_ring(shm)) {
+		__atomic_add_fetch(&shm->header->ring_write,
+				   frames * shm->config.frame_bytes,
+				   __ATOMIC_RELEASE);
+		return;
+	}
+
 	shm->header->write_offset[buf_idx] = frames * shm->config.frame_bytes;
 	shm->header->read_offset[buf_idx] = 0;
 	cras_shm_buffer_write_complete(shm);
 }
 
+/* Moves the ring's read counter past frames, or all that are queued. */
+static inline void cras_shm_ring_read(struct cras_audio_shm *shm,
+				      size_t frames)
+{
+	uint32_t bytes = MIN(frames * shm->config.frame_bytes,
+			     cras_shm_ring_queued(shm));
+
+	__atomic_add_fetch(&shm->header->ring_read, bytes, __ATOMIC_RELEASE);
+}
+
 /* Increment the read pointer.  If it goes past the write pointer for this
  * buffer, move to the next buffer. */
 static inline void cras_shm_buffer_read(struct cras_audio_shm *shm,
@@ -454,6 +652,11 @@ static inline void cras_shm_buffer_read(struct cras_audio_shm *shm,
 	if (frames == 0)
 		return;
 
+	if (cras_shm_is_ring(shm)) {
+		cras_shm_ring_read(shm, frames);
+		return;
+	}
+
 	header->read_offset[buf_idx] += frames * config->frame_bytes;
 	if (header->read_offset[buf_idx] >= header->write_offset[buf_idx]) {
 		remainder = header->read_offset[buf_idx] -
@@ -482,6 +685,11 @@ static inline void cras_shm_buffer_read_current(struct cras_audio_shm *shm,
 	struct cras_audio_shm_header *header = shm->header;
 	struct cras_audio_shm_config *config = &shm->config;
 
+	if (cras_shm_is_ring(shm)) {
+		cras_shm_ring_read(shm, frames);
+		return;
+	}
+
 	header->read_offset[buf_idx] += frames * config->frame_bytes;
 	if (header->read_offset[buf_idx] >= header->write_offset[buf_idx]) {
 		header->read_offset[buf_idx] = 0;
@@ -533,6 +741,12 @@ static inline unsigned cras_shm_frame_bytes(const struct cras_audio_shm *shm)
 	return shm->config.frame_bytes;
 }
 
+/* Returns the bytes mapped for the header and samples of shm. */
+static inline size_t cras_shm_mapped_bytes(const struct cras_audio_shm *shm)
+{
+	return shm->header_info.length + shm->samples_info.length;
+}
+
 /* Sets if a callback is pending with the client. */
 static inline void cras_shm_set_callback_pending(struct cras_audio_shm *shm,
 						 int pending)
@@ -546,6 +760,46 @@ static inline int cras_shm_callback_pending(const struct cras_audio_shm *shm)
 	return shm->header->callback_pending;
 }
 
+/* Sets if audio messages are rung on the doorbell in the header. */
+static inline void cras_shm_set_doorbell(struct cras_audio_shm *shm,
+					 int enabled)
+{
+	shm->header->doorbell = !!enabled;
+}
+
+/* Returns non-zero if audio messages are rung on the doorbell. A header
+ * mapped from an older server is shorter, but the rest of the page it ends in
+ * reads as zero. */
+static inline int cras_shm_doorbell(const struct cras_audio_shm *shm)
+{
+	return shm->header->doorbell;
+}
+
+/* Server side, rings an audio message on the doorbell and wakes the client
+ * waiting on it. The callback must be marked pending before. */
+void cras_shm_ring_doorbell(struct cras_audio_shm *shm, uint32_t id,
+			    uint32_t frames);
+
+/* Client side, waits for a ring of the doorbell.
+ * Args:
+ *    shm - The shm to wait on.
+ *    seq - The doorbell_seq of the last message handled.
+ * Returns:
+ *    The doorbell_seq of a new message, or seq if woken without one.
+ */
+uint32_t cras_shm_wait_doorbell(struct cras_audio_shm *shm, uint32_t seq);
+
+/* Client side, wakes the thread waiting on the doorbell without a message. */
+void cras_shm_wake_doorbell(struct cras_audio_shm *shm);
+
+/* Client side, replies to the message rung by clearing the pending callback.
+ * Returns non-zero if the server asked for the reply on the socket too. */
+int cras_shm_doorbell_reply(struct cras_audio_shm *shm);
+
+/* Server side, asks for the reply to a pending callback on the socket.
+ * Returns non-zero if the callback is still pending after asking. */
+int cras_shm_want_reply(struct cras_audio_shm *shm);
+
 /* Sets the starting offset of a buffer */
 static inline void cras_shm_set_buffer_offset(struct cras_audio_shm *shm,
 					      uint32_t buf_idx, uint32_t offset)
@@ -553,6 +807,19 @@ static inline void cras_shm_set_buffer_offset(struct cras_audio_shm *shm,
 	shm->header->buffer_offset[buf_idx] = offset;
 }
 
+/* Sets the segments holding a buffer, num of them. 0 segments makes the
+ * buffer the single region at its buffer offset again. */
+static inline void
+cras_shm_set_buffer_segments(struct cras_audio_shm *shm, uint32_t buf_idx,
+			     const struct cras_shm_segment *segments,
+			     uint32_t num)
+{
+	num = MIN(num, CRAS_SHM_MAX_SEGMENTS);
+	memcpy(shm->header->segments[buf_idx], segments,
+	       num * sizeof(*segments));
+	shm->header->num_segments[buf_idx] = num;
+}
+
 /* Sets the used_size of the shm region.  This is the maximum number of bytes
  * that is exchanged each time a buffer is passed from client to server.
  *
@@ -572,6 +839,17 @@ static inline void cras_shm_set_used_size(struct cras_audio_shm *shm,
 	}
 }
 
+/* Sets the samples area up as a ring of ring_size bytes, or back to the A/B
+ * buffers when ring_size is 0. The ring starts empty. */
+static inline void cras_shm_set_ring(struct cras_audio_shm *shm,
+				     uint32_t ring_size)
+{
+	shm->ring_size = ring_size;
+	shm->header->ring_size = ring_size;
+	shm->header->ring_read = 0;
+	shm->header->ring_write = 0;
+}
+
 /* Returns the used size of the shm region in bytes. */
 static inline unsigned cras_shm_used_size(const struct cras_audio_shm *shm)
 {
@@ -601,7 +879,12 @@ static inline unsigned cras_shm_num_overruns(const struct cras_audio_shm *shm)
  */
 static inline void cras_shm_copy_shared_config(struct cras_audio_shm *shm)
 {
+	uint32_t ring_size = shm->header->ring_size;
+
 	memcpy(&shm->config, &shm->header->config, sizeof(shm->config));
+	if (ring_size <= shm->samples_info.length && shm->config.frame_bytes &&
+	    ring_size % shm->config.frame_bytes == 0)
+		shm->ring_size = ring_size;
 }
 
 /* Open a read/write shared memory area with the given name.
@@ -613,6 +896,18 @@ static inline void cras_shm_copy_shared_config(struct cras_audio_shm *shm)
  */
 int cras_shm_open_rw(const char *name, size_t size);
 
+/* Create an anonymous memfd of the given size. The size is sealed, so a
+ * client holding the fd can't shrink it under the server's mapping.
+ * Args:
+ *    name - Name shown for the memfd in /proc, for debugging.
+ *    size - Size of the shared-memory area.
+ *    flags - Extra memfd_create flags, e.g. MFD_HUGETLB.
+ * Returns:
+ *    >= 0 file descriptor value, or negative errno value on error. -ENOSYS
+ *    if memfds aren't supported.
+ */
+int cras_shm_memfd_create(const char *name, size_t size, unsigned int flags);
+
 /* Reopen an existing shared memory area read-only.
  * Args:
  *    name - Name of the shared-memory area.
@@ -0,0 +1,82 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+
+#include "cras_timebase.h"
+
+/* Number of reads of the clocks per calibration. */
+#define CALIBRATION_TRIES 3
+
+static int64_t timespec_to_ns(const struct timespec *ts)
+{
+	return (int64_t)ts->tv_sec * 1000000000LL + ts->tv_nsec;
+}
+
+static void ns_to_timespec(int64_t ns, struct timespec *ts)
+{
+	ts->tv_sec = ns / 1000000000LL;
+	ts->tv_nsec = ns % 1000000000LL;
+	if (ts->tv_nsec < 0) {
+		ts->tv_sec--;
+		ts->tv_nsec += 1000000000LL;
+	}
+}
+
+void cras_timebase_init(struct cras_timebase *tb, clockid_t from,
+			clockid_t to)
+{
+	tb->from = from;
+	tb->to = to;
+	tb->offset_ns = 0;
+	tb->calibrated_ns = 0;
+}
+
+int cras_timebase_calibrate(struct cras_timebase *tb)
+{
+	struct timespec before, to, after;
+	int64_t width, best_width = INT64_MAX;
+	int i;
+
+	for (i = 0; i < CALIBRATION_TRIES; i++) {
+		if (clock_gettime(tb->from, &before) ||
+		    clock_gettime(tb->to, &to) ||
+		    clock_gettime(tb->from, &after))
+			return -errno;
+
+		/* A preempted try spans longer, its offset is less certain. */
+		width = timespec_to_ns(&after) - timespec_to_ns(&before);
+		if (width >= best_width)
+			continue;
+		best_width = width;
+		tb->calibrated_ns = timespec_to_ns(&before) + width / 2;
+		tb->offset_ns = timespec_to_ns(&to) - tb->calibrated_ns;
+	}
+	return 0;
+}
+
+int cras_timebase_convert(struct cras_timebase *tb, const struct timespec *ts,
+			  struct timespec *out)
+{
+	int64_t ns = timespec_to_ns(ts);
+	int64_t age;
+	int rc;
+
+	if (tb->from == tb->to) {
+		*out = *ts;
+		return 0;
+	}
+
+	age = ns - tb->calibrated_ns;
+	if (!tb->calibrated_ns || age > CRAS_TIMEBASE_RECALIBRATE_NS ||
+	    age < -CRAS_TIMEBASE_RECALIBRATE_NS) {
+		rc = cras_timebase_calibrate(tb);
+		if (rc)
+			return rc;
+	}
+
+	ns_to_timespec(ns + tb->offset_ns, out);
+	return 0;
+}
@@ -0,0 +1,62 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Conversion of timestamps between kernel clocks. The server, the ALSA
+ * hardware timestamps and the shm timestamps all use CLOCK_MONOTONIC_RAW,
+ * which NTP doesn't slew, while applications schedule against
+ * CLOCK_MONOTONIC or CLOCK_REALTIME. These drift from the raw clock by up to
+ * 500 ppm, so an offset measured once goes stale within seconds. A timebase
+ * keeps its offset calibrated close to the timestamps it converts. Not thread
+ * safe, keep one per thread.
+ */
+
+#ifndef CRAS_TIMEBASE_H_
+#define CRAS_TIMEBASE_H_
+
+#include <stdint.h>
+#include <time.h>
+
+/* A timestamp further than this from the last calibration recalibrates it,
+ * bounding the drift error to 50us. */
+#define CRAS_TIMEBASE_RECALIBRATE_NS (100 * 1000 * 1000LL)
+
+/* Mapping from one clock to another.
+ *    from - The clock timestamps are converted from.
+ *    to - The clock timestamps are converted to.
+ *    offset_ns - Reading of to minus reading of from at calibration.
+ *    calibrated_ns - Reading of from at calibration, 0 before the first.
+ */
+struct cras_timebase {
+	clockid_t from;
+	clockid_t to;
+	int64_t offset_ns;
+	int64_t calibrated_ns;
+};
+
+/* Initializes a timebase from one clock to another, calibrated on first
+ * use. */
+void cras_timebase_init(struct cras_timebase *tb, clockid_t from,
+			clockid_t to);
+
+/* Measures the offset between the clocks of tb now. Reads to between two
+ * reads of from and keeps the tightest of a few tries.
+ * Returns:
+ *    0 on success, negative error from clock_gettime otherwise.
+ */
+int cras_timebase_calibrate(struct cras_timebase *tb);
+
+/* Converts a timestamp of the from clock of tb to its to clock,
+ * recalibrating first if ts is more than CRAS_TIMEBASE_RECALIBRATE_NS away
+ * from the last calibration.
+ * Args:
+ *    tb - The timebase.
+ *    ts - Timestamp of the from clock.
+ *    out - Filled with the same instant read from the to clock.
+ * Returns:
+ *    0 on success, negative error from clock_gettime otherwise.
+ */
+int cras_timebase_convert(struct cras_timebase *tb, const struct timespec *ts,
+			  struct timespec *out);
+
+#endif /* CRAS_TIMEBASE_H_ */
@@ -15,6 +15,8 @@
 
 #include "cras_audio_format.h"
 #include "cras_iodev_info.h"
+#include "cras_latency_hist.h"
+#include "hfp_link_stats.h"
 #include "packet_status_logger.h"
 
 /* Architecture independent timespec */
@@ -37,6 +39,7 @@ enum CRAS_SPECIAL_DEVICE {
  */
 enum TEST_IODEV_TYPE {
 	TEST_IODEV_HOTWORD,
+	TEST_IODEV_OFFLINE,
 };
 
 /* Commands for test iodevs. */
@@ -108,6 +111,40 @@ cras_stream_direction_mask(const enum CRAS_STREAM_DIRECTION dir)
  *      and does not want to receive data. Used with HOTWORD_STREAM.
  *  SERVER_ONLY - This stream doesn't associate to a client. It's used mainly
  *      for audio data to flow from hardware through iodev's dsp pipeline.
+ *  SILENCE_GATE_OK - This stream is OK with receiving zeros instead of the
+ *      converted and processed samples while the input is silence. Input
+ *      streams only.
+ *  SHM_DOORBELL - The client can wait for audio messages on the doorbell in
+ *      the shm header, and reply there. The server turns it on in the
+ *      header if it can, otherwise messages go through the socket.
+ *  LOW_LATENCY - The stream wants the shortest round trip the device allows.
+ *      It may ask for a callback level down to
+ *      CRAS_MIN_LOW_LATENCY_BUFFER_TIME_IN_US, which devices that opt in
+ *      follow, and output devices serve it ahead of their other streams.
+ *      Pair it with SHM_DOORBELL to skip the socket round trip.
+ *  ADAPTIVE_CB - The stream accepts callbacks of any size up to its buffer.
+ *      The server resizes them to the callback level its device wakes at
+ *      for its other streams: fewer wakes on devices with long periods,
+ *      smaller callbacks next to low latency streams. Requests for audio
+ *      and captured data carry the current size.
+ *  FAST_START - Output streams only. The first request for audio is sent as
+ *      soon as the stream is attached rather than when the device buffer
+ *      drains to the callback level, and the samples the stream already
+ *      holds then, like a preroll sent with the connect message, take the
+ *      place of the zeros a device that hasn't started is padded with.
+ *  PASSTHROUGH - Output streams only. The stream carries an IEC61937 framed
+ *      compressed bitstream, like AC-3 or DTS, in S16_LE frames of 2 or 8
+ *      channels, for the HDMI sink to decode. It only plays on outputs whose
+ *      sink lists a compressed format in its EDID, opened at its format, and
+ *      goes out untouched: no mixing, conversion, volume or DSP. It has the
+ *      output to itself, other streams there play as silence meanwhile. Only
+ *      one such stream can exist at a time.
+ *  SHM_RING - Output streams only. The samples area is a ring of
+ *      CRAS_SHM_RING_BUFFERS buffers rather than two, and the stream is
+ *      asked for another callback whenever a buffer's worth is free. The
+ *      client runs that many small callbacks ahead, riding out stalls of
+ *      its own without a larger callback level. The server turns it on in
+ *      the shm header if it can, otherwise the A/B buffers are used.
  */
 enum CRAS_INPUT_STREAM_FLAG {
 	BULK_AUDIO_OK = 0x01,
@@ -115,6 +152,13 @@ enum CRAS_INPUT_STREAM_FLAG {
 	HOTWORD_STREAM = BULK_AUDIO_OK | USE_DEV_TIMING,
 	TRIGGER_ONLY = 0x04,
 	SERVER_ONLY = 0x08,
+	SILENCE_GATE_OK = 0x10,
+	SHM_DOORBELL = 0x20,
+	LOW_LATENCY = 0x40,
+	ADAPTIVE_CB = 0x80,
+	FAST_START = 0x100,
+	PASSTHROUGH = 0x200,
+	SHM_RING = 0x400,
 };
 
 /*
@@ -126,6 +170,19 @@ enum CRAS_LOOPBACK_TYPE {
 	LOOPBACK_NUM_TYPES,
 };
 
+/*
+ * Which output streams the post mix loopback captures.
+ *    LOOPBACK_TARGET_ALL - The whole mix of the output device.
+ *    LOOPBACK_TARGET_INCLUDE - Only the streams of the target.
+ *    LOOPBACK_TARGET_EXCLUDE - The mix without the streams of the target.
+ */
+enum CRAS_LOOPBACK_TARGET_MODE {
+	LOOPBACK_TARGET_ALL,
+	LOOPBACK_TARGET_INCLUDE,
+	LOOPBACK_TARGET_EXCLUDE,
+	LOOPBACK_NUM_TARGET_MODES,
+};
+
 static inline int cras_stream_uses_output_hw(enum CRAS_STREAM_DIRECTION dir)
 {
 	return dir == CRAS_STREAM_OUTPUT;
@@ -229,6 +286,58 @@ enum CRAS_STREAM_EFFECT {
 	APM_VOICE_DETECTION = (1 << 3),
 };
 
+/* Parts of the server state that an update can change, as recorded in the
+ * state change journal. */
+enum CRAS_STATE_CHANGE {
+	CRAS_STATE_CHANGE_DEVICES = (1 << 0),
+	CRAS_STATE_CHANGE_NODES = (1 << 1),
+	CRAS_STATE_CHANGE_CLIENTS = (1 << 2),
+	CRAS_STATE_CHANGE_STREAMS = (1 << 3),
+	/* Volume, mute, their locks and the suspend state. */
+	CRAS_STATE_CHANGE_VOLUME = (1 << 4),
+};
+#define CRAS_STATE_CHANGE_ALL                                                  \
+	(CRAS_STATE_CHANGE_DEVICES | CRAS_STATE_CHANGE_NODES |                 \
+	 CRAS_STATE_CHANGE_CLIENTS | CRAS_STATE_CHANGE_STREAMS |               \
+	 CRAS_STATE_CHANGE_VOLUME)
+
+/* An entry in the server state change journal.
+ *    update_count - The update count once the update completed.
+ *    changes - Bitmask of enum CRAS_STATE_CHANGE touched by the update.
+ */
+#define CRAS_STATE_JOURNAL_SIZE 32
+struct __attribute__((__packed__)) cras_state_change {
+	uint32_t update_count;
+	uint32_t changes;
+};
+
+/* An observer notification in the server state event ring.
+ *    id - The enum CRAS_CLIENT_MESSAGE_ID of the matching notification
+ *        message.
+ *    direction - Stream direction, for active node and stream count events.
+ *    node_id - The node, for node volume, gain and swap events.
+ *    values - The notified values, in the order of the arguments of the
+ *        matching cras_observer_ops callback.
+ */
+struct __attribute__((__packed__)) cras_observer_event {
+	uint32_t id;
+	uint32_t direction;
+	uint64_t node_id;
+	int32_t values[3];
+};
+
+/* Ring of the most recent observer notifications.  Event n is at
+ * n % CRAS_OBSERVER_EVENT_RING_SIZE and write_pos is only advanced after the
+ * event is written, so readers can detect events overwritten while copying.
+ *    write_pos - Number of events ever written.
+ *    events - The event ring.
+ */
+#define CRAS_OBSERVER_EVENT_RING_SIZE 64
+struct __attribute__((packed, aligned(4))) cras_observer_event_ring {
+	uint64_t write_pos;
+	struct cras_observer_event events[CRAS_OBSERVER_EVENT_RING_SIZE];
+};
+
 /* Information about a client attached to the server. */
 struct __attribute__((__packed__)) cras_attached_client_info {
 	uint32_t id;
@@ -262,10 +371,17 @@ static inline uint32_t node_index_of(cras_node_id_t id)
 #define CRAS_MAX_IONODES 20
 #define CRAS_MAX_ATTACHED_CLIENTS 20
 #define CRAS_MAX_AUDIO_THREAD_SNAPSHOTS 10
+#define CRAS_AUDIO_THREAD_SNAPSHOT_BUFFER_SIZE (512 * 1024)
 #define CRAS_MAX_HOTWORD_MODEL_NAME_SIZE 12
 #define MAX_DEBUG_DEVS 4
 #define MAX_DEBUG_STREAMS 8
+/* Number of audio thread wake stages timed per device and per stream. Output
+ * devices and streams spend them in fetch and write, input ones in capture
+ * and send. */
+#define CRAS_NUM_DEV_IO_STAGES 2
 #define AUDIO_THREAD_EVENT_LOG_SIZE (1024 * 6)
+/* Upper bound of the live audio thread log, see audio_thread_event_log. */
+#define AUDIO_THREAD_EVENT_LOG_MAX_SIZE (1024 * 1024)
 #define CRAS_BT_EVENT_LOG_SIZE 1024
 #define MAIN_THREAD_EVENT_LOG_SIZE 1024
 
@@ -338,6 +454,11 @@ enum AUDIO_THREAD_LOG_EVENTS {
  * MAIN_THREAD_SUSPEND_DEVS - When system suspends and notifies CRAS.
  * MAIN_THREAD_STREAM_ADDED - When an audio stream is added.
  * MAIN_THREAD_STREAM_REMOVED - When an audio stream is removed.
+ * MAIN_THREAD_STARTUP_STAGE - When a stage of the daemon startup is done.
+ * MAIN_THREAD_LOOP_STALL - When a main loop pass ran longer than the stall
+ *    threshold, with the handler that took the longest.
+ * MAIN_THREAD_DEV_STANDBY - When an output is kept open without streams to
+ *    be switched to quickly.
  */
 enum MAIN_THREAD_LOG_EVENTS {
 	/* iodev related */
@@ -357,8 +478,63 @@ enum MAIN_THREAD_LOG_EVENTS {
 	/* stream related */
 	MAIN_THREAD_STREAM_ADDED,
 	MAIN_THREAD_STREAM_REMOVED,
+	/* startup related */
+	MAIN_THREAD_STARTUP_STAGE,
+	/* main loop related */
+	MAIN_THREAD_LOOP_STALL,
+	/* iodev standby */
+	MAIN_THREAD_DEV_STANDBY,
+};
+
+/* Stages of the daemon startup, logged with the ms since it began.
+ * CRAS_STARTUP_SERVING - Clients can connect and play to the default output.
+ * CRAS_STARTUP_COMPLETE - D-Bus and Bluetooth are up too.
+ */
+enum CRAS_STARTUP_STAGE {
+	CRAS_STARTUP_SERVING,
+	CRAS_STARTUP_COMPLETE,
 };
 
+/* What the main loop runs, timed separately.
+ *    CRAS_MAIN_HANDLER_CLIENT - Messages from clients and new connections.
+ *    CRAS_MAIN_HANDLER_DBUS - D-Bus watches and message dispatch.
+ *    CRAS_MAIN_HANDLER_UDEV - The udev sound subsystem monitor.
+ *    CRAS_MAIN_HANDLER_TIMER - Expired timers.
+ *    CRAS_MAIN_HANDLER_MAIN_MSG - Messages posted to the main thread.
+ *    CRAS_MAIN_HANDLER_TASK - Tasks added with cras_system_add_task.
+ *    CRAS_MAIN_HANDLER_FD - Other fd callbacks, such as jacks and HFP SLC.
+ *    CRAS_MAIN_HANDLER_ALERT - Pending alerts and observer notifications.
+ */
+enum CRAS_MAIN_HANDLER {
+	CRAS_MAIN_HANDLER_CLIENT,
+	CRAS_MAIN_HANDLER_DBUS,
+	CRAS_MAIN_HANDLER_UDEV,
+	CRAS_MAIN_HANDLER_TIMER,
+	CRAS_MAIN_HANDLER_MAIN_MSG,
+	CRAS_MAIN_HANDLER_TASK,
+	CRAS_MAIN_HANDLER_FD,
+	CRAS_MAIN_HANDLER_ALERT,
+	CRAS_NUM_MAIN_HANDLERS,
+};
+
+static inline const char *cras_main_handler_str(enum CRAS_MAIN_HANDLER handler)
+{
+	// clang-format off
+	switch (handler) {
+	ENUM_STR(CRAS_MAIN_HANDLER_CLIENT)
+	ENUM_STR(CRAS_MAIN_HANDLER_DBUS)
+	ENUM_STR(CRAS_MAIN_HANDLER_UDEV)
+	ENUM_STR(CRAS_MAIN_HANDLER_TIMER)
+	ENUM_STR(CRAS_MAIN_HANDLER_MAIN_MSG)
+	ENUM_STR(CRAS_MAIN_HANDLER_TASK)
+	ENUM_STR(CRAS_MAIN_HANDLER_FD)
+	ENUM_STR(CRAS_MAIN_HANDLER_ALERT)
+	default:
+		return "INVALID_MAIN_HANDLER";
+	}
+	// clang-format on
+}
+
 /* There are 8 bits of space for events. */
 enum CRAS_BT_LOG_EVENTS {
 	BT_ADAPTER_ADDED,
@@ -389,6 +565,10 @@ enum CRAS_BT_LOG_EVENTS {
 	BT_TRANSPORT_RELEASE,
 	BT_TRANSPORT_SET_VOLUME,
 	BT_TRANSPORT_UPDATE_VOLUME,
+	BT_PROPERTIES_BATCH,
+	BT_INTERFACES_ADDED,
+	BT_INTERFACES_REMOVED,
+	BT_MANAGED_OBJECTS,
 };
 
 struct __attribute__((__packed__)) audio_thread_event {
@@ -399,7 +579,11 @@ struct __attribute__((__packed__)) audio_thread_event {
 	uint32_t data3;
 };
 
-/* Ring buffer of log events from the audio thread. */
+/* Ring buffer of log events from the audio thread. Snapshots such as the one
+ * in audio_debug_info hold AUDIO_THREAD_EVENT_LOG_SIZE events. The live log
+ * shared through the atlog shm fd has the same layout but holds len events,
+ * up to AUDIO_THREAD_EVENT_LOG_MAX_SIZE, so its size must be taken from the
+ * shm region rather than sizeof(). */
 struct __attribute__((__packed__)) audio_thread_event_log {
 	uint64_t write_pos;
 	uint64_t sync_write_pos;
@@ -425,6 +609,8 @@ struct __attribute__((__packed__)) audio_dev_debug_info {
 	uint32_t longest_wake_sec;
 	uint32_t longest_wake_nsec;
 	double software_gain_scaler;
+	struct cras_latency_hist stage_hist[CRAS_NUM_DEV_IO_STAGES];
+	uint32_t num_coalesced_fetches;
 };
 
 struct __attribute__((__packed__)) audio_stream_debug_info {
@@ -447,14 +633,44 @@ struct __attribute__((__packed__)) audio_stream_debug_info {
 	uint32_t pinned_dev_idx;
 	uint32_t runtime_sec;
 	uint32_t runtime_nsec;
+	uint32_t latency_us;
 	double stream_volume;
 	int8_t channel_layout[CRAS_CH_MAX];
+	struct cras_latency_hist stage_hist[CRAS_NUM_DEV_IO_STAGES];
+	uint64_t cpu_ns;
+	uint32_t num_fetches;
+	uint32_t shm_bytes;
+	uint32_t conv_bytes;
+	uint32_t device_delay_us;
+	uint32_t dsp_delay_us;
+	uint32_t conv_delay_us;
+	uint32_t processing_delay_us;
 };
 
-/* Debug info shared from server to client. */
+/* Debug info shared from server to client.
+ *    cpu - CPU the audio thread last woke on.
+ *    cpu_migrations - Number of audio thread wakes on another CPU than the
+ *      previous one.
+ *    minor_faults, major_faults - Page faults taken by the audio thread.
+ *    rt_locked_bytes - Memory used by the audio thread locked in RAM.
+ *    rt_unlocked_bytes - Memory used by the audio thread only prefaulted,
+ *      past the lock budget.
+ *    rt_allocs - Heap calls made on the audio threads, counted by builds with
+ *      the RT guard only.
+ *    rt_blocking_calls - Syslog calls and contended locks on the audio
+ *      threads, also counted by the RT guard.
+ */
 struct __attribute__((__packed__)) audio_debug_info {
 	uint32_t num_streams;
 	uint32_t num_devs;
+	int32_t cpu;
+	uint32_t cpu_migrations;
+	uint32_t minor_faults;
+	uint32_t major_faults;
+	uint32_t rt_locked_bytes;
+	uint32_t rt_unlocked_bytes;
+	uint32_t rt_allocs;
+	uint32_t rt_blocking_calls;
 	struct audio_dev_debug_info devs[MAX_DEBUG_DEVS];
 	struct audio_stream_debug_info streams[MAX_DEBUG_STREAMS];
 	struct audio_thread_event_log log;
@@ -474,8 +690,17 @@ struct __attribute__((__packed__)) main_thread_event_log {
 	struct main_thread_event log[MAIN_THREAD_EVENT_LOG_SIZE];
 };
 
+/* Main thread debug info.
+ *    main_log - Ring of main thread events.
+ *    handler_hist - Time each handler ran per dispatch.
+ *    loop_hist - Time each main loop pass ran, not counting the wait.
+ *    num_stalls - Passes that ran longer than the stall threshold.
+ */
 struct __attribute__((__packed__)) main_thread_debug_info {
 	struct main_thread_event_log main_log;
+	struct cras_latency_hist handler_hist[CRAS_NUM_MAIN_HANDLERS];
+	struct cras_latency_hist loop_hist;
+	uint32_t num_stalls;
 };
 
 struct __attribute__((__packed__)) cras_bt_event {
@@ -494,6 +719,7 @@ struct __attribute__((__packed__)) cras_bt_event_log {
 struct __attribute__((__packed__)) cras_bt_debug_info {
 	struct cras_bt_event_log bt_log;
 	struct packet_status_logger wbs_logger;
+	struct hfp_link_stats hfp_link_stats;
 };
 
 /*
@@ -513,21 +739,158 @@ enum CRAS_AUDIO_THREAD_EVENT_TYPE {
 };
 
 /*
- * Structure of snapshot for audio thread.
+ * Header of a snapshot for audio thread. It's followed by num_devs
+ * audio_dev_debug_info, num_streams audio_stream_debug_info and num_events
+ * audio_thread_event, oldest first.
+ *    timestamp - Time the snapshot was taken.
+ *    event_type - The event that triggered the snapshot.
+ *    size - Bytes of the snapshot, this header included.
+ *    num_devs, num_streams - All the devices and streams of the thread.
+ *    num_events - Events logged since the previous snapshot, at most
+ *      AUDIO_THREAD_EVENT_LOG_SIZE.
+ *    log_write_pos - write_pos of the event log when the snapshot was taken,
+ *      the last event is the one written at log_write_pos - 1.
+ * The other fields are the ones of audio_debug_info.
  */
 struct __attribute__((__packed__)) cras_audio_thread_snapshot {
 	struct timespec timestamp;
 	enum CRAS_AUDIO_THREAD_EVENT_TYPE event_type;
-	struct audio_debug_info audio_debug_info;
+	uint32_t size;
+	uint32_t num_devs;
+	uint32_t num_streams;
+	uint32_t num_events;
+	int32_t cpu;
+	uint32_t cpu_migrations;
+	uint32_t minor_faults;
+	uint32_t major_faults;
+	uint32_t rt_locked_bytes;
+	uint32_t rt_unlocked_bytes;
+	uint64_t log_write_pos;
 };
 
+static inline const struct audio_dev_debug_info *
+cras_audio_thread_snapshot_devs(const struct cras_audio_thread_snapshot *s)
+{
+	return (const struct audio_dev_debug_info *)(s + 1);
+}
+
+static inline const struct audio_stream_debug_info *
+cras_audio_thread_snapshot_streams(const struct cras_audio_thread_snapshot *s)
+{
+	return (const struct audio_stream_debug_info *)(
+		cras_audio_thread_snapshot_devs(s) + s->num_devs);
+}
+
+static inline const struct audio_thread_event *
+cras_audio_thread_snapshot_events(const struct cras_audio_thread_snapshot *s)
+{
+	return (const struct audio_thread_event *)(
+		cras_audio_thread_snapshot_streams(s) + s->num_streams);
+}
+
 /*
- * Ring buffer for storing snapshots.
+ * The latest snapshots, packed one after the other from the oldest.
+ *    num_snapshots - Number of snapshots in data.
+ *    size - Bytes of data used.
+ *    data - The snapshots, each of them cras_audio_thread_snapshot.size long.
  */
 struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
-	struct cras_audio_thread_snapshot
-		snapshots[CRAS_MAX_AUDIO_THREAD_SNAPSHOTS];
-	int pos;
+	uint32_t num_snapshots;
+	uint32_t size;
+	uint8_t data[CRAS_AUDIO_THREAD_SNAPSHOT_BUFFER_SIZE];
+};
+
+/* Parts of the server whose memory use is accounted.
+ *    CRAS_MEM_SHM - Stream header and samples shm, including pooled areas.
+ *    CRAS_MEM_FMT_CONV - Format converter and dev_stream conversion buffers.
+ *    CRAS_MEM_DSP - Buffers of DSP pipelines.
+ *    CRAS_MEM_APM - Buffers of APM instances, not counting the APM itself.
+ *    CRAS_MEM_BT - PCM buffers of Bluetooth devices.
+ */
+enum CRAS_MEM_SUBSYS {
+	CRAS_MEM_SHM,
+	CRAS_MEM_FMT_CONV,
+	CRAS_MEM_DSP,
+	CRAS_MEM_APM,
+	CRAS_MEM_BT,
+	CRAS_NUM_MEM_SUBSYS,
+};
+
+static inline const char *cras_mem_subsys_str(enum CRAS_MEM_SUBSYS subsys)
+{
+	// clang-format off
+	switch (subsys) {
+	ENUM_STR(CRAS_MEM_SHM)
+	ENUM_STR(CRAS_MEM_FMT_CONV)
+	ENUM_STR(CRAS_MEM_DSP)
+	ENUM_STR(CRAS_MEM_APM)
+	ENUM_STR(CRAS_MEM_BT)
+	default:
+		return "INVALID_MEM_SUBSYS";
+	}
+	// clang-format on
+}
+
+/* Bytes allocated by each subsystem now and at most since the server
+ * started. */
+struct __attribute__((__packed__)) cras_mem_usage {
+	uint64_t bytes[CRAS_NUM_MEM_SUBSYS];
+	uint64_t peak_bytes[CRAS_NUM_MEM_SUBSYS];
+};
+
+/* The performance profile the server runs with, from board.ini once
+ * validated. Boards tune it to trade CPU for latency and quality.
+ *    rt_priority - The SCHED_RR priority of audio threads and the workers
+ *        they hand blocks to.
+ *    playback_wake_fuzz_us - How early a playback stream may be fetched.
+ *    capture_wake_fuzz_us - How early a capture callback may fire.
+ *    resampler_quality - The enum CRAS_RESAMPLER_QUALITY of streams whose
+ *        type doesn't pick one.
+ *    max_audio_threads - The most audio threads devices are spread over.
+ *    audio_thread_cpu_mask - The CPUs audio threads and their workers are
+ *        pinned to, 0 if they aren't pinned.
+ *    audio_thread_uclamp_min - Minimum utilization clamp of audio threads.
+ *    sched_deadline - 1 if audio threads try SCHED_DEADLINE.
+ *    audio_thread_log_size - Events kept by each audio thread's log.
+ *    default_output_buffer_size - In frames.
+ */
+struct __attribute__((__packed__)) cras_perf_profile {
+	int32_t rt_priority;
+	int32_t playback_wake_fuzz_us;
+	int32_t capture_wake_fuzz_us;
+	int32_t resampler_quality;
+	uint32_t max_audio_threads;
+	uint32_t audio_thread_cpu_mask;
+	uint32_t audio_thread_uclamp_min;
+	int32_t sched_deadline;
+	uint32_t audio_thread_log_size;
+	int32_t default_output_buffer_size;
+};
+
+/* What a level meter measures, CRAS_LEVEL_METER_NONE for a free one. */
+enum CRAS_LEVEL_METER_TYPE {
+	CRAS_LEVEL_METER_NONE,
+	CRAS_LEVEL_METER_DEVICE,
+	CRAS_LEVEL_METER_STREAM,
+};
+
+/* The level of an open device or a playback stream, updated by the audio
+ * thread from the frames it samples for their power as it mixes or captures.
+ *    seq - Odd while the meter is written. Readers wait for an even seq,
+ *        copy the meter, then retry if seq changed.
+ *    type - A CRAS_LEVEL_METER_TYPE.
+ *    id - The index of the device or the id of the stream.
+ *    peak - The largest sample magnitude, 0.0 to 1.0, falling back over
+ *        a few hundred milliseconds.
+ *    rms - The RMS level, 0.0 to 1.0, smoothed over 10 milliseconds.
+ */
+#define CRAS_MAX_LEVEL_METERS 64
+struct __attribute__((packed, aligned(4))) cras_level_meter {
+	uint32_t seq;
+	uint32_t type;
+	uint32_t id;
+	float peak;
+	float rms;
 };
 
 /* The server state that is shared with clients.
@@ -554,7 +917,9 @@ struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
  *    num_attached_clients - Number of clients attached to server.
  *    client_info - List of first 20 attached clients.
  *    update_count - Incremented twice each time the struct is updated.  Odd
- *        during updates.
+ *        during updates.  This is a seqlock: readers wait for an even count,
+ *        copy the fields they need, then retry if the count changed.  The
+ *        journal tells which groups of fields an update changed.
  *    num_active_streams - An array containing numbers or active
  *        streams of different directions.
  *    last_active_stream_time - Time the last stream was removed.  Can be used
@@ -568,7 +933,7 @@ struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
  *    aec_supported - Flag to indicate if system aec is supported.
  *    aec_group_id  - Group ID for the system aec to use for separating aec
  *        tunings.
- *    snapshot_buffer - ring buffer for storing audio thread snapshots.
+ *    snapshot_buffer - The latest audio thread snapshots, filled on request.
  *    bt_debug_info - ring buffer for storing bluetooth event logs.
  *    bt_wbs_enabled - Whether or not bluetooth wideband speech is enabled.
  *    deprioritize_bt_wbs_mic - Whether Bluetooth wideband speech mic
@@ -581,9 +946,23 @@ struct __attribute__((__packed__)) cras_audio_thread_snapshot_buffer {
  *        suspends. Hotword detection is resumed after system resumes.
  *        0 - Hotword detection is allowed to continue running after system
  *        suspends, so a detected hotword can wake up the device.
+ *    journal_head - Number of entries ever written to journal.
+ *    journal - Ring of the most recent updates and the parts they changed,
+ *        entry n is at n % CRAS_STATE_JOURNAL_SIZE.  Written under
+ *        update_count like the rest of the state.
+ *    observer_events - Ring of observer notifications that clients can read
+ *        at their own pace instead of receiving them as messages.  Not
+ *        covered by update_count.
+ *    mem_usage - Memory allocated by each subsystem.  Updated as buffers are
+ *        allocated and freed, not covered by update_count.
+ *    level_meters - Levels of the open devices and the playback streams, for
+ *        UIs to show without capturing.  Each meter has its own seq, they
+ *        are not covered by update_count.
+ *    perf_profile - The performance profile of the board, set once at
+ *        start.
  *
  */
-#define CRAS_SERVER_STATE_VERSION 2
+#define CRAS_SERVER_STATE_VERSION 18
 struct __attribute__((packed, aligned(4))) cras_server_state {
 	uint32_t state_version;
 	uint32_t volume;
@@ -623,6 +1002,12 @@ struct __attribute__((packed, aligned(4))) cras_server_state {
 	uint32_t num_input_streams_with_permission[CRAS_NUM_CLIENT_TYPE];
 	int32_t noise_cancellation_enabled;
 	int32_t hotword_pause_at_suspend;
+	uint32_t journal_head;
+	struct cras_state_change journal[CRAS_STATE_JOURNAL_SIZE];
+	struct cras_observer_event_ring observer_events;
+	struct cras_mem_usage mem_usage;
+	struct cras_level_meter level_meters[CRAS_MAX_LEVEL_METERS];
+	struct cras_perf_profile perf_profile;
 };
 
 /* Actions for card add/remove/change. */
@@ -699,6 +1084,8 @@ enum CRAS_NODE_TYPE {
 	CRAS_NODE_TYPE_UNKNOWN,
 	CRAS_NODE_TYPE_ECHO_REFERENCE,
 	CRAS_NODE_TYPE_ALSA_LOOPBACK,
+	/* Type for RTP sinks and sources on the network. */
+	CRAS_NODE_TYPE_NETWORK,
 };
 
 /* Position values to described where a node locates on the system.
@@ -3,7 +3,7 @@
  * found in the LICENSE file.
  */
 
-#define _GNU_SOURCE /* For ppoll() */
+#define _GNU_SOURCE /* For ppoll(), recvmmsg() and sendmmsg() */
 
 #include <errno.h>
 #include <fcntl.h>
@@ -54,6 +54,84 @@ int cras_set_thread_priority(int priority)
 	return err;
 }
 
+#ifndef SCHED_DEADLINE
+#define SCHED_DEADLINE 6
+#endif
+#ifndef SCHED_FLAG_KEEP_POLICY
+#define SCHED_FLAG_KEEP_POLICY 0x08
+#define SCHED_FLAG_KEEP_PARAMS 0x10
+#define SCHED_FLAG_UTIL_CLAMP_MIN 0x20
+#endif
+
+/* The argument of sched_setattr(2), which glibc doesn't declare. */
+struct cras_sched_attr {
+	uint32_t size;
+	uint32_t sched_policy;
+	uint64_t sched_flags;
+	int32_t sched_nice;
+	uint32_t sched_priority;
+	uint64_t sched_runtime;
+	uint64_t sched_deadline;
+	uint64_t sched_period;
+	uint32_t sched_util_min;
+	uint32_t sched_util_max;
+};
+
+int cras_set_thread_deadline(uint64_t runtime_ns, uint64_t deadline_ns,
+			     uint64_t period_ns)
+{
+#ifdef __NR_sched_setattr
+	struct cras_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_policy = SCHED_DEADLINE;
+	attr.sched_runtime = runtime_ns;
+	attr.sched_deadline = deadline_ns;
+	attr.sched_period = period_ns;
+
+	if (syscall(__NR_sched_setattr, 0, &attr, 0))
+		return -errno;
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+int cras_set_thread_uclamp_min(uint32_t util_min)
+{
+#ifdef __NR_sched_setattr
+	struct cras_sched_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.sched_flags = SCHED_FLAG_KEEP_POLICY | SCHED_FLAG_KEEP_PARAMS |
+			   SCHED_FLAG_UTIL_CLAMP_MIN;
+	attr.sched_util_min = util_min;
+
+	if (syscall(__NR_sched_setattr, 0, &attr, 0))
+		return -errno;
+	return 0;
+#else
+	return -ENOSYS;
+#endif
+}
+
+int cras_set_thread_affinity(uint32_t cpu_mask)
+{
+	cpu_set_t cpus;
+	int cpu;
+
+	CPU_ZERO(&cpus);
+	for (cpu = 0; cpu < 32; cpu++)
+		if (cpu_mask & (1U << cpu))
+			CPU_SET(cpu, &cpus);
+
+	if (sched_setaffinity(0, sizeof(cpus), &cpus))
+		return -errno;
+	return 0;
+}
+
 int cras_set_nice_level(int nice)
 {
 	int rc;
@@ -128,12 +206,32 @@ int cras_send_with_fds(int sockfd, const void *buf, size_t len, int *fd,
 	return rc;
 }
 
+/* Copies the fds carried by msg to fd, at most *num_fds of them, and sets
+ * *num_fds to the number copied. */
+static void get_received_fds(struct msghdr *msg, int *fd, unsigned int *num_fds)
+{
+	struct cmsghdr *cmsg;
+
+	for (cmsg = CMSG_FIRSTHDR(msg); cmsg != NULL;
+	     cmsg = CMSG_NXTHDR(msg, cmsg)) {
+		if (cmsg->cmsg_level == SOL_SOCKET &&
+		    cmsg->cmsg_type == SCM_RIGHTS) {
+			size_t fd_size = cmsg->cmsg_len - sizeof(*cmsg);
+			*num_fds = MIN(*num_fds, fd_size / sizeof(*fd));
+			memcpy(fd, CMSG_DATA(cmsg), *num_fds * sizeof(*fd));
+			return;
+		}
+	}
+
+	// If we reach here, we did not find any file descriptors.
+	*num_fds = 0;
+}
+
 int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
 		       unsigned int *num_fds)
 {
 	struct msghdr msg = { 0 };
 	struct iovec iov;
-	struct cmsghdr *cmsg;
 	char *control;
 	const unsigned int control_size = CMSG_SPACE(sizeof(*fd) * *num_fds);
 	int rc;
@@ -157,24 +255,86 @@ int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
 		goto exit;
 	}
 
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		if (cmsg->cmsg_level == SOL_SOCKET &&
-		    cmsg->cmsg_type == SCM_RIGHTS) {
-			size_t fd_size = cmsg->cmsg_len - sizeof(*cmsg);
-			*num_fds = MIN(*num_fds, fd_size / sizeof(*fd));
-			memcpy(fd, CMSG_DATA(cmsg), *num_fds * sizeof(*fd));
-			goto exit;
-		}
+	get_received_fds(&msg, fd, num_fds);
+exit:
+	free(control);
+	return rc;
+}
+
+int cras_recv_batch_with_fds(int sockfd, struct cras_recv_msg *msgs,
+			     unsigned int num_msgs)
+{
+	struct mmsghdr mmsg[num_msgs];
+	struct iovec iov[num_msgs];
+	size_t control_size[num_msgs];
+	char *control;
+	size_t total = 0;
+	unsigned int i, j;
+	int rc;
+
+	for (i = 0; i < num_msgs; i++) {
+		control_size[i] =
+			CMSG_SPACE(sizeof(*msgs[i].fds) * msgs[i].num_fds);
+		total += control_size[i];
+	}
+	control = calloc(total, 1);
+	if (!control)
+		return -ENOMEM;
+
+	memset(mmsg, 0, sizeof(mmsg));
+	for (i = 0, total = 0; i < num_msgs; i++) {
+		for (j = 0; j < msgs[i].num_fds; j++)
+			msgs[i].fds[j] = -1;
+		iov[i].iov_base = msgs[i].buf;
+		iov[i].iov_len = msgs[i].len;
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+		mmsg[i].msg_hdr.msg_control = control + total;
+		mmsg[i].msg_hdr.msg_controllen = control_size[i];
+		total += control_size[i];
 	}
 
-	// If we reach here, we did not find any file descriptors.
-	*num_fds = 0;
+	rc = recvmmsg(sockfd, mmsg, num_msgs, MSG_WAITFORONE, NULL);
+	if (rc < 0) {
+		rc = -errno;
+		goto exit;
+	}
+
+	for (i = 0; i < rc; i++) {
+		msgs[i].len = mmsg[i].msg_len;
+		get_received_fds(&mmsg[i].msg_hdr, msgs[i].fds,
+				 &msgs[i].num_fds);
+	}
 exit:
 	free(control);
 	return rc;
 }
 
+int cras_send_batch(int sockfd, const void *const *bufs, const size_t *lens,
+		    unsigned int num_msgs)
+{
+	struct mmsghdr mmsg[num_msgs];
+	struct iovec iov[num_msgs];
+	unsigned int i;
+	int rc;
+
+	memset(mmsg, 0, sizeof(mmsg));
+	for (i = 0; i < num_msgs; i++) {
+		iov[i].iov_base = (void *)bufs[i];
+		iov[i].iov_len = lens[i];
+		mmsg[i].msg_hdr.msg_iov = &iov[i];
+		mmsg[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	/* A blocking socket may still take only some of the messages. */
+	for (i = 0; i < num_msgs; i += rc) {
+		rc = sendmmsg(sockfd, mmsg + i, num_msgs - i, 0);
+		if (rc < 0)
+			return i ? i : -errno;
+	}
+	return num_msgs;
+}
+
 int cras_poll(struct pollfd *fds, nfds_t nfds, struct timespec *timeout,
 	      const sigset_t *sigmask)
 {
@@ -25,6 +25,20 @@ extern "C" {
 int cras_set_rt_scheduling(int rt_lim);
 /* Sets the priority. */
 int cras_set_thread_priority(int priority);
+/* Moves the current thread to SCHED_DEADLINE with the given runtime, relative
+ * deadline and period in nanoseconds. Returns 0 on success or a negative
+ * error, -EBUSY when the kernel can't admit the bandwidth. */
+int cras_set_thread_deadline(uint64_t runtime_ns, uint64_t deadline_ns,
+			     uint64_t period_ns);
+/* Highest utilization clamp, a fully loaded CPU. */
+#define CRAS_UCLAMP_MAX 1024
+/* Sets the minimum utilization clamp, 0 to CRAS_UCLAMP_MAX, of the current
+ * thread, keeping its policy. Returns 0 on success or a negative error,
+ * -EOPNOTSUPP on kernels without uclamp. */
+int cras_set_thread_uclamp_min(uint32_t util_min);
+/* Pins the current thread to the CPUs set in cpu_mask. Returns 0 on success
+ * or a negative error. */
+int cras_set_thread_affinity(uint32_t cpu_mask);
 /* Sets the niceness level of the current thread. */
 int cras_set_nice_level(int nice);
 
@@ -83,6 +97,38 @@ int cras_send_with_fds(int sockfd, const void *buf, size_t len, int *fd,
 int cras_recv_with_fds(int sockfd, void *buf, size_t len, int *fd,
 		       unsigned int *num_fds);
 
+/* A message of a batch received by cras_recv_batch_with_fds().
+ * Members:
+ *    buf - Where the message is put.
+ *    len - The size of buf, set to the length of the message received.
+ *    fds - Where file descriptors received with it are put, the rest are
+ *          set to -1.
+ *    num_fds - The size of fds, set to the number of fds received.
+ */
+struct cras_recv_msg {
+	void *buf;
+	size_t len;
+	int *fds;
+	unsigned int num_fds;
+};
+
+/* Receives up to num_msgs messages from a socket keeping message boundaries,
+ * in one call. Blocks for the first message only, the others are taken if
+ * already queued.
+ * Returns:
+ *    The number of messages received, or a negative error code.
+ */
+int cras_recv_batch_with_fds(int sockfd, struct cras_recv_msg *msgs,
+			     unsigned int num_msgs);
+
+/* Sends the num_msgs buffers in bufs, of the lengths in lens, as separate
+ * messages in one call.
+ * Returns:
+ *    The number of messages sent, or a negative error code.
+ */
+int cras_send_batch(int sockfd, const void *const *bufs, const size_t *lens,
+		    unsigned int num_msgs);
+
 /* This must be written a million times... */
 static inline void subtract_timespecs(const struct timespec *end,
 				      const struct timespec *beg,
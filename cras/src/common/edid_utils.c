@@ -565,6 +565,47 @@ done_dtd:
 	return 0;
 }
 
+int edid_sads_compressed_support(const unsigned char *sads, int num_sads)
+{
+	int formats = 0;
+	int i, atype;
+
+	for (i = 0; i < num_sads; i++) {
+		atype = (sads[i * DBCA_SIZE + DBCA_FORMAT] >> 3) & 0xf;
+		if (atype > DBCA_FMT_LPCM)
+			formats |= 1 << atype;
+	}
+	return formats;
+}
+
+int edid_compressed_support(const unsigned char *edid_data, int ext)
+{
+	const unsigned char *edid_ext = edid_data + EDID_SIZE;
+	int formats = 0;
+	int dbc;
+	int off_dtd = edid_ext[CEA_DTD_OFFSET];
+
+	if ((ext < 1) || (edid_data[EDID_EXT_FLAG] < 1))
+		return 0;
+
+	if (!((edid_ext[EEXT_TAG] == 0x02) && (edid_ext[EEXT_REV] == 0x03)))
+		return 0;
+
+	/* Unlike LPCM, compressed formats are only ever listed in the short
+	 * audio descriptors, a sink can have more than one audio block. */
+	dbc = CEA_DBC_START;
+	while (dbc < off_dtd) {
+		int db_len = edid_ext[dbc + DBC_TAG_LENGTH] & DBC_LEN_MASK;
+
+		if ((edid_ext[dbc + DBC_TAG_LENGTH] >> DBC_TAG_SHIFT) ==
+		    DBC_TAG_AUDIO)
+			formats |= edid_sads_compressed_support(
+				&edid_ext[dbc + 1], db_len / DBCA_SIZE);
+		dbc += db_len + 1;
+	}
+	return formats;
+}
+
 int edid_has_hdmi_info(const unsigned char *edid_data, int ext)
 {
 	const unsigned char *edid_ext = edid_data + EDID_SIZE;
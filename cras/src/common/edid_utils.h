@@ -129,6 +129,11 @@ extern "C" {
 #define DBCA_SIZE 3
 
 #define DBCA_FMT_LPCM 1
+#define DBCA_FMT_AC3 2
+#define DBCA_FMT_DTS 7
+#define DBCA_FMT_EAC3 10
+#define DBCA_FMT_DTS_HD 11
+#define DBCA_FMT_MLP 12
 
 #define DBCV_CODE 0
 #define DBCV_SIZE 1
@@ -179,6 +184,16 @@ extern "C" {
 int edid_valid(const unsigned char *edid_data);
 int edid_has_hdmi_info(const unsigned char *edid_data, int ext);
 int edid_lpcm_support(const unsigned char *edid_data, int ext);
+
+/* Returns a bitmap with bit (1 << code) set for each compressed audio format
+ * code, like DBCA_FMT_AC3, found in num_sads short audio descriptors, as in
+ * an audio data block or an ELD. */
+int edid_sads_compressed_support(const unsigned char *sads, int num_sads);
+
+/* Returns the bitmap of edid_sads_compressed_support() for the audio data
+ * blocks of the CEA extension, 0 if the sink takes no compressed audio. */
+int edid_compressed_support(const unsigned char *edid_data, int ext);
+
 void show_edid_data(FILE *outfile, unsigned char *edid_data, int items,
 		    int base);
 void show_edid(FILE *outfile, unsigned char *edid_data, int ext);
@@ -0,0 +1,73 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <string.h>
+#include <sys/param.h>
+
+#include "hfp_link_stats.h"
+
+/* Returns the bucket of a loss burst of len packets. */
+static unsigned int burst_bucket(unsigned int len)
+{
+	if (len <= 3)
+		return len - 1;
+	/* 4-7 in 3, 8-15 in 4, and the rest in the last. */
+	return MIN(32 - __builtin_clz(len), HFP_LINK_STATS_BURST_BUCKETS - 1);
+}
+
+void hfp_link_stats_init(struct hfp_link_stats *stats)
+{
+	memset(stats, 0, sizeof(*stats));
+}
+
+void hfp_link_stats_packet(struct hfp_link_stats *stats, bool lost)
+{
+	stats->packets++;
+	if (lost) {
+		stats->lost++;
+		stats->burst++;
+		stats->max_burst = MAX(stats->max_burst, stats->burst);
+		return;
+	}
+
+	if (stats->burst) {
+		stats->bursts[burst_bucket(stats->burst)]++;
+		stats->burst = 0;
+	}
+}
+
+void hfp_link_stats_plc(struct hfp_link_stats *stats, unsigned int usec)
+{
+	stats->plc_calls++;
+	stats->plc_usec += usec;
+	stats->max_plc_usec = MAX(stats->max_plc_usec, usec);
+}
+
+void hfp_link_stats_wake(struct hfp_link_stats *stats,
+			 unsigned int interval_usec, unsigned int audio_usec)
+{
+	unsigned int d;
+
+	/* The first read has no interval to go by. */
+	if (stats->wakes++ == 0)
+		return;
+
+	d = interval_usec > audio_usec ? interval_usec - audio_usec :
+					 audio_usec - interval_usec;
+	/* J += (|D| - J) / 16 */
+	if (d > stats->jitter_usec)
+		stats->jitter_usec += (d - stats->jitter_usec) / 16;
+	else
+		stats->jitter_usec -= (stats->jitter_usec - d) / 16;
+	stats->max_jitter_usec = MAX(stats->max_jitter_usec,
+				     stats->jitter_usec);
+}
+
+void hfp_link_stats_queue_depth(struct hfp_link_stats *stats,
+				unsigned int packets)
+{
+	stats->queue_depth = packets;
+	stats->max_queue_depth = MAX(stats->max_queue_depth, packets);
+}
@@ -0,0 +1,75 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef HFP_LINK_STATS_H_
+#define HFP_LINK_STATS_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Loss bursts are counted by length, 1, 2, 3, 4-7, 8-15 and 16 or more
+ * packets. */
+#define HFP_LINK_STATS_BURST_BUCKETS 6
+
+/*
+ * Statistics of the quality of a SCO link through a call, in fixed size so
+ * they can be shared in the BT debug info.
+ * Members:
+ *    packets - The number of mSBC packets expected, received or lost.
+ *    lost - The number of mSBC packets lost.
+ *    burst - The length of the loss burst in progress.
+ *    max_burst - The longest loss burst.
+ *    bursts - The number of loss bursts ended, by length.
+ *    plc_calls - The number of times packet loss was concealed.
+ *    plc_usec - The total time spent concealing packet loss.
+ *    max_plc_usec - The longest time spent concealing a packet loss.
+ *    wakes - The number of times packets were read from the SCO socket.
+ *    jitter_usec - The smoothed packet interarrival jitter, as in RFC 3550
+ *        from how far apart the reads are against the audio they bring.
+ *    max_jitter_usec - The highest jitter_usec.
+ *    queue_depth - The packets written and not transmitted at the last
+ *        write, known when the socket reports transmitted packets.
+ *    max_queue_depth - The highest queue_depth.
+ */
+struct __attribute__((__packed__)) hfp_link_stats {
+	uint32_t packets;
+	uint32_t lost;
+	uint32_t burst;
+	uint32_t max_burst;
+	uint32_t bursts[HFP_LINK_STATS_BURST_BUCKETS];
+	uint32_t plc_calls;
+	uint32_t plc_usec;
+	uint32_t max_plc_usec;
+	uint32_t wakes;
+	uint32_t jitter_usec;
+	uint32_t max_jitter_usec;
+	uint32_t queue_depth;
+	uint32_t max_queue_depth;
+};
+
+/* Resets the statistics for a new call. */
+void hfp_link_stats_init(struct hfp_link_stats *stats);
+
+/* Accounts an mSBC packet received, or lost when lost is true. */
+void hfp_link_stats_packet(struct hfp_link_stats *stats, bool lost);
+
+/* Accounts the time spent concealing a lost packet. */
+void hfp_link_stats_plc(struct hfp_link_stats *stats, unsigned int usec);
+
+/*
+ * Accounts a read of the SCO socket.
+ * Args:
+ *    stats - The statistics.
+ *    interval_usec - The time since the last read.
+ *    audio_usec - How long the audio in the packets read plays.
+ */
+void hfp_link_stats_wake(struct hfp_link_stats *stats,
+			 unsigned int interval_usec, unsigned int audio_usec);
+
+/* Accounts the packets written and not transmitted yet. */
+void hfp_link_stats_queue_depth(struct hfp_link_stats *stats,
+				unsigned int packets);
+
+#endif /* HFP_LINK_STATS_H_ */
@@ -0,0 +1,108 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "beamform.h"
+#include "dsp_util.h"
+
+struct beamform {
+	int num_inputs;
+	int num_beams;
+	float gain;
+	/* The delay of each input in each beam, the inputs of beam 0 first. */
+	int *delays;
+	/* The last BEAMFORM_MAX_DELAY samples of each input, oldest first. */
+	float *history;
+};
+
+struct beamform *beamform_new(int num_inputs, int num_beams)
+{
+	struct beamform *bf;
+
+	if (num_inputs < 1 || num_beams < 1)
+		return NULL;
+
+	bf = (struct beamform *)calloc(1, sizeof(*bf));
+	if (!bf)
+		return NULL;
+	bf->num_inputs = num_inputs;
+	bf->num_beams = num_beams;
+	bf->gain = 1.0f / num_inputs;
+	bf->delays = (int *)calloc(num_inputs * num_beams, sizeof(int));
+	bf->history = (float *)calloc(num_inputs * BEAMFORM_MAX_DELAY,
+				      sizeof(float));
+	if (!bf->delays || !bf->history) {
+		beamform_free(bf);
+		return NULL;
+	}
+	return bf;
+}
+
+void beamform_free(struct beamform *bf)
+{
+	free(bf->delays);
+	free(bf->history);
+	free(bf);
+}
+
+void beamform_set_delay(struct beamform *bf, int beam, int input, int delay)
+{
+	if (delay < 0)
+		delay = 0;
+	if (delay > BEAMFORM_MAX_DELAY)
+		delay = BEAMFORM_MAX_DELAY;
+	bf->delays[beam * bf->num_inputs + input] = delay;
+}
+
+int beamform_get_delay(const struct beamform *bf)
+{
+	int i, delay = BEAMFORM_MAX_DELAY;
+
+	for (i = 0; i < bf->num_inputs * bf->num_beams; i++)
+		if (bf->delays[i] < delay)
+			delay = bf->delays[i];
+	return delay;
+}
+
+/* Keeps the last samples of in as the history of an input. */
+static void update_history(float *history, const float *in, int count)
+{
+	if (count >= BEAMFORM_MAX_DELAY) {
+		memcpy(history, in + count - BEAMFORM_MAX_DELAY,
+		       BEAMFORM_MAX_DELAY * sizeof(float));
+		return;
+	}
+	memmove(history, history + count,
+		(BEAMFORM_MAX_DELAY - count) * sizeof(float));
+	memcpy(history + BEAMFORM_MAX_DELAY - count, in, count * sizeof(float));
+}
+
+void beamform_process(struct beamform *bf, float *const *in, float *const *out,
+		      int count)
+{
+	int b, i, delay, head;
+	float *history;
+
+	for (b = 0; b < bf->num_beams; b++) {
+		memset(out[b], 0, count * sizeof(float));
+		for (i = 0; i < bf->num_inputs; i++) {
+			delay = bf->delays[b * bf->num_inputs + i];
+			history = bf->history + i * BEAMFORM_MAX_DELAY;
+
+			/* The first delay samples out come from the end of
+			 * the last buffer, the rest from this one. */
+			head = delay < count ? delay : count;
+			dsp_util_accumulate(history + BEAMFORM_MAX_DELAY -
+						    delay,
+					    out[b], bf->gain, head);
+			dsp_util_accumulate(in[i], out[b] + head, bf->gain,
+					    count - head);
+		}
+	}
+	for (i = 0; i < bf->num_inputs; i++)
+		update_history(bf->history + i * BEAMFORM_MAX_DELAY, in[i],
+			       count);
+}
@@ -0,0 +1,69 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef BEAMFORM_H_
+#define BEAMFORM_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A delay-and-sum beamformer reducing the channels of a microphone array
+ * to one or a few beams.
+ *
+ * Each beam is the average of the inputs, each delayed by a fixed number of
+ * samples. Delaying every microphone so a wave from the steered direction
+ * lines up across the array sums it coherently, while sound and noise from
+ * elsewhere add out of phase.
+ */
+
+/* The longest delay of an input, in samples. 64 samples at 48kHz is a path
+ * difference of about 45 cm, more than the span of a laptop or conference
+ * device array. */
+#define BEAMFORM_MAX_DELAY 64
+
+struct beamform;
+
+/* Create a beamformer with all delays 0.
+ * Args:
+ *    num_inputs - The number of microphones.
+ *    num_beams - The number of beams formed.
+ * Returns:
+ *    The beamformer, or NULL on invalid arguments or allocation failure.
+ */
+struct beamform *beamform_new(int num_inputs, int num_beams);
+
+/* Free a beamformer. */
+void beamform_free(struct beamform *bf);
+
+/* Sets the delay of an input in a beam, clamped to 0..BEAMFORM_MAX_DELAY.
+ * Args:
+ *    bf - The beamformer.
+ *    beam - The beam, from 0 to num_beams - 1.
+ *    input - The input, from 0 to num_inputs - 1.
+ *    delay - The delay in samples.
+ */
+void beamform_set_delay(struct beamform *bf, int beam, int input, int delay);
+
+/* Returns the latency of the beamformer, the shortest delay of any input.
+ */
+int beamform_get_delay(const struct beamform *bf);
+
+/* Process a buffer of audio data through the beamformer.
+ * Args:
+ *    bf - The beamformer we want to use.
+ *    in - The num_inputs arrays of input samples.
+ *    out - The num_beams arrays of output samples, none of them the same as
+ *        an input.
+ *    count - The number of elements in each array to process.
+ */
+void beamform_process(struct beamform *bf, float *const *in, float *const *out,
+		      int count);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* BEAMFORM_H_ */
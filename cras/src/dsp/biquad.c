@@ -379,3 +379,21 @@ void biquad_set(struct biquad *bq, enum biquad_type type, double freq, double Q,
 		break;
 	}
 }
+
+void biquad_interpolate(struct biquad *bq, const struct biquad *target,
+			float frac)
+{
+	if (frac >= 1) {
+		bq->b0 = target->b0;
+		bq->b1 = target->b1;
+		bq->b2 = target->b2;
+		bq->a1 = target->a1;
+		bq->a2 = target->a2;
+		return;
+	}
+	bq->b0 += (target->b0 - bq->b0) * frac;
+	bq->b1 += (target->b1 - bq->b1) * frac;
+	bq->b2 += (target->b2 - bq->b2) * frac;
+	bq->a1 += (target->a1 - bq->a1) * frac;
+	bq->a2 += (target->a2 - bq->a2) * frac;
+}
@@ -50,6 +50,18 @@ enum biquad_type {
 void biquad_set(struct biquad *bq, enum biquad_type type, double freq, double Q,
 		double gain);
 
+/* When the parameters of a running filter change, the coefficients move to the
+ * new values linearly over BIQUAD_INTERP_FRAMES frames, in steps every
+ * BIQUAD_INTERP_BLOCK frames. */
+#define BIQUAD_INTERP_FRAMES 512
+#define BIQUAD_INTERP_BLOCK 64
+
+/* Moves the coefficients of bq the fraction frac of the way to the ones of
+ * target, keeping the history values of bq. With frac >= 1 the coefficients
+ * are set to the ones of target. */
+void biquad_interpolate(struct biquad *bq, const struct biquad *target,
+			float frac);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
@@ -30,39 +30,89 @@ void dcblock_free(struct dcblock *dcblock)
 	free(dcblock);
 }
 
-/* This is the prototype of the processing loop. */
+/* Applies the mix-in ramp to the output d of the filter while it lasts.
+ *
+ * It takes a while for this DC-block filter to completely filter out a
+ * large DC-offset, so apply a mix-in ramp to avoid any residual jump
+ * discontinuities that can lead to "pop" during capture.
+ */
+static inline float ramp(struct dcblock *dcblock, float d)
+{
+	if (dcblock->ramp_factor < 1.0) {
+		d *= dcblock->ramp_factor;
+		dcblock->ramp_factor += dcblock->ramp_increment;
+	}
+	return d;
+}
+
 void dcblock_process(struct dcblock *dcblock, float *data, int count)
 {
-	int n;
+	int n = 0;
 	float x_prev = dcblock->x_prev;
 	float y_prev = dcblock->y_prev;
 	float R = dcblock->R;
+	float x, d;
 
 	if (!dcblock->initialized) {
 		x_prev = data[0];
 		dcblock->initialized = 1;
 	}
 
-	for (n = 0; n < count; n++) {
-		float x = data[n];
-		float d = x - x_prev + R * y_prev;
-
+	for (; n < count && dcblock->ramp_factor < 1.0; n++) {
+		x = data[n];
+		d = x - x_prev + R * y_prev;
+		y_prev = d;
+		x_prev = x;
+		data[n] = ramp(dcblock, d);
+	}
+	/* Once the ramp is done the loop is left with the recursion only. */
+	for (; n < count; n++) {
+		x = data[n];
+		d = x - x_prev + R * y_prev;
 		y_prev = d;
 		x_prev = x;
-
-		/*
-		 * It takes a while for this DC-block filter to completely
-		 * filter out a large DC-offset, so apply a mix-in ramp to
-		 * avoid any residual jump discontinuities that can lead to
-		 * "pop" during capture.
-		 */
-		if (dcblock->ramp_factor < 1.0) {
-			d *= dcblock->ramp_factor;
-			dcblock->ramp_factor += dcblock->ramp_increment;
-		}
-
 		data[n] = d;
 	}
 	dcblock->x_prev = x_prev;
 	dcblock->y_prev = y_prev;
 }
+
+void dcblock_process_stereo(struct dcblock *left, struct dcblock *right,
+			    float *data0, float *data1, int count)
+{
+	int n = 0;
+	float xl_prev, yl_prev, xr_prev, yr_prev;
+	float Rl = left->R, Rr = right->R;
+	float xl, xr, dl, dr;
+
+	/* The first blocks, until both ramps are done, go one channel at a
+	 * time. */
+	if (left->ramp_factor < 1.0 || right->ramp_factor < 1.0) {
+		dcblock_process(left, data0, count);
+		dcblock_process(right, data1, count);
+		return;
+	}
+
+	xl_prev = left->x_prev;
+	yl_prev = left->y_prev;
+	xr_prev = right->x_prev;
+	yr_prev = right->y_prev;
+	/* The two recursions don't depend on each other, running them in the
+	 * same loop lets one fill the latency of the other. */
+	for (; n < count; n++) {
+		xl = data0[n];
+		xr = data1[n];
+		dl = xl - xl_prev + Rl * yl_prev;
+		dr = xr - xr_prev + Rr * yr_prev;
+		yl_prev = dl;
+		yr_prev = dr;
+		xl_prev = xl;
+		xr_prev = xr;
+		data0[n] = dl;
+		data1[n] = dr;
+	}
+	left->x_prev = xl_prev;
+	left->y_prev = yl_prev;
+	right->x_prev = xr_prev;
+	right->y_prev = yr_prev;
+}
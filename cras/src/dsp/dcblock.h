@@ -35,6 +35,16 @@ void dcblock_free(struct dcblock *dcblock);
  */
 void dcblock_process(struct dcblock *dcblock, float *data, int count);
 
+/* Process the two channels of a stereo pair through their filters, the same
+ * as calling dcblock_process() on each, in one pass over both.
+ * Args:
+ *    left, right - The filters of the two channels.
+ *    data0, data1 - The samples of the two channels.
+ *    count - The number of elements in each array to process.
+ */
+void dcblock_process_stereo(struct dcblock *left, struct dcblock *right,
+			    float *data0, float *data1, int count);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
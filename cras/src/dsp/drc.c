@@ -10,6 +10,7 @@
 
 #include <assert.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "drc.h"
 #include "drc_math.h"
@@ -19,14 +20,20 @@ static void init_data_buffer(struct drc *drc);
 static void init_emphasis_eq(struct drc *drc);
 static void init_crossover(struct drc *drc);
 static void init_kernel(struct drc *drc);
+static void set_kernel_parameters(struct drc *drc);
 static void free_data_buffer(struct drc *drc);
 static void free_emphasis_eq(struct drc *drc);
 static void free_kernel(struct drc *drc);
 
-struct drc *drc_new(float sample_rate)
+struct drc *drc_new(float sample_rate, int num_channels)
 {
-	struct drc *drc = (struct drc *)calloc(1, sizeof(struct drc));
+	struct drc *drc;
+
+	if (num_channels < 1 || num_channels > DRC_MAX_CHANNELS)
+		return NULL;
+	drc = (struct drc *)calloc(1, sizeof(struct drc));
 	drc->sample_rate = sample_rate;
+	drc->num_channels = num_channels;
 	set_default_parameters(drc);
 	return drc;
 }
@@ -39,6 +46,11 @@ void drc_init(struct drc *drc)
 	init_kernel(drc);
 }
 
+void drc_update(struct drc *drc)
+{
+	set_kernel_parameters(drc);
+}
+
 void drc_free(struct drc *drc)
 {
 	free_kernel(drc);
@@ -47,16 +59,24 @@ void drc_free(struct drc *drc)
 	free(drc);
 }
 
+/* Returns the number of channel pairs of the DRC. */
+static int num_pairs(const struct drc *drc)
+{
+	return (drc->num_channels + 1) / 2;
+}
+
 /* Allocates temporary buffers used during drc_process(). */
 static void init_data_buffer(struct drc *drc)
 {
 	int i;
 	size_t size = sizeof(float) * DRC_PROCESS_MAX_FRAMES;
 
-	for (i = 0; i < DRC_NUM_CHANNELS; i++) {
+	for (i = 0; i < num_pairs(drc) * 2; i++) {
 		drc->data1[i] = (float *)calloc(1, size);
 		drc->data2[i] = (float *)calloc(1, size);
 	}
+	if (drc->num_channels & 1)
+		drc->pad = (float *)calloc(1, size);
 }
 
 /* Frees temporary buffers */
@@ -64,10 +84,11 @@ static void free_data_buffer(struct drc *drc)
 {
 	int i;
 
-	for (i = 0; i < DRC_NUM_CHANNELS; i++) {
+	for (i = 0; i < DRC_MAX_CHANNEL_PAIRS * 2; i++) {
 		free(drc->data1[i]);
 		free(drc->data2[i]);
 	}
+	free(drc->pad);
 }
 
 void drc_set_param(struct drc *drc, int index, unsigned paramID, float value)
@@ -172,21 +193,27 @@ static void init_emphasis_eq(struct drc *drc)
 {
 	struct biquad e = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
 	struct biquad d = { 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f, 0.f };
-	int i, j;
+	int i, j, p;
 
 	float stage_gain = drc_get_param(drc, 0, PARAM_FILTER_STAGE_GAIN);
 	float stage_ratio = drc_get_param(drc, 0, PARAM_FILTER_STAGE_RATIO);
 	float anchor_freq = drc_get_param(drc, 0, PARAM_FILTER_ANCHOR);
 
-	drc->emphasis_eq = eq2_new();
-	drc->deemphasis_eq = eq2_new();
+	for (p = 0; p < num_pairs(drc); p++) {
+		drc->emphasis_eq[p] = eq2_new();
+		drc->deemphasis_eq[p] = eq2_new();
+	}
 
 	for (i = 0; i < 2; i++) {
 		emphasis_stage_pair_biquads(stage_gain, anchor_freq,
 					    anchor_freq / stage_ratio, &e, &d);
-		for (j = 0; j < 2; j++) {
-			eq2_append_biquad_direct(drc->emphasis_eq, j, &e);
-			eq2_append_biquad_direct(drc->deemphasis_eq, j, &d);
+		for (p = 0; p < num_pairs(drc); p++) {
+			for (j = 0; j < 2; j++) {
+				eq2_append_biquad_direct(drc->emphasis_eq[p], j,
+							 &e);
+				eq2_append_biquad_direct(drc->deemphasis_eq[p],
+							 j, &d);
+			}
 		}
 		anchor_freq /= (stage_ratio * stage_ratio);
 	}
@@ -195,8 +222,12 @@ static void init_emphasis_eq(struct drc *drc)
 /* Frees the emphasis and deemphasis filter */
 static void free_emphasis_eq(struct drc *drc)
 {
-	eq2_free(drc->emphasis_eq);
-	eq2_free(drc->deemphasis_eq);
+	int p;
+
+	for (p = 0; p < DRC_MAX_CHANNEL_PAIRS; p++) {
+		eq2_free(drc->emphasis_eq[p]);
+		eq2_free(drc->deemphasis_eq[p]);
+	}
 }
 
 /* Initializes the crossover filter */
@@ -204,18 +235,18 @@ static void init_crossover(struct drc *drc)
 {
 	float freq1 = drc->parameters[1][PARAM_CROSSOVER_LOWER_FREQ];
 	float freq2 = drc->parameters[2][PARAM_CROSSOVER_LOWER_FREQ];
+	int p;
 
-	crossover2_init(&drc->xo2, freq1, freq2);
+	for (p = 0; p < num_pairs(drc); p++)
+		crossover2_init(&drc->xo2[p], freq1, freq2);
 }
 
-/* Initializes the compressor kernels */
-static void init_kernel(struct drc *drc)
+/* Sets the parameters of the compressor kernels */
+static void set_kernel_parameters(struct drc *drc)
 {
 	int i;
 
 	for (i = 0; i < DRC_NUM_KERNELS; i++) {
-		dk_init(&drc->kernel[i], drc->sample_rate);
-
 		float db_threshold = drc_get_param(drc, i, PARAM_THRESHOLD);
 		float db_knee = drc_get_param(drc, i, PARAM_KNEE);
 		float ratio = drc_get_param(drc, i, PARAM_RATIO);
@@ -238,6 +269,16 @@ static void init_kernel(struct drc *drc)
 	}
 }
 
+/* Initializes the compressor kernels */
+static void init_kernel(struct drc *drc)
+{
+	int i;
+
+	for (i = 0; i < DRC_NUM_KERNELS; i++)
+		dk_init(&drc->kernel[i], drc->sample_rate, drc->num_channels);
+	set_kernel_parameters(drc);
+}
+
 /* Frees the compressor kernels */
 static void free_kernel(struct drc *drc)
 {
@@ -365,19 +406,35 @@ static void sum3(float *data, const float *data1, const float *data2, int n)
 }
 #endif
 
+/* Returns the right channel of the pair p, which is the pad channel for the
+ * last pair of an odd number of channels. */
+static float *pair_right(struct drc *drc, float **data, int p)
+{
+	return 2 * p + 1 < drc->num_channels ? data[2 * p + 1] : drc->pad;
+}
+
 void drc_process(struct drc *drc, float **data, int frames)
 {
-	int i;
+	int i, p;
 	float **data1 = drc->data1;
 	float **data2 = drc->data2;
 
-	/* Apply pre-emphasis filter if it is not disabled. */
-	if (!drc->emphasis_disabled)
-		eq2_process(drc->emphasis_eq, data[0], data[1], frames);
+	if (drc->pad)
+		memset(drc->pad, 0, sizeof(float) * frames);
 
-	/* Crossover */
-	crossover2_process(&drc->xo2, frames, data[0], data[1], data1[0],
-			   data1[1], data2[0], data2[1]);
+	for (p = 0; p < num_pairs(drc); p++) {
+		float *left = data[2 * p];
+		float *right = pair_right(drc, data, p);
+
+		/* Apply pre-emphasis filter if it is not disabled. */
+		if (!drc->emphasis_disabled)
+			eq2_process(drc->emphasis_eq[p], left, right, frames);
+
+		/* Crossover */
+		crossover2_process(&drc->xo2[p], frames, left, right,
+				   data1[2 * p], data1[2 * p + 1], data2[2 * p],
+				   data2[2 * p + 1]);
+	}
 
 	/* Apply compression to each band of the signal. The processing is
 	 * performed in place.
@@ -387,10 +444,13 @@ void drc_process(struct drc *drc, float **data, int frames)
 	dk_process(&drc->kernel[2], data2, frames);
 
 	/* Sum the three bands of signal */
-	for (i = 0; i < DRC_NUM_CHANNELS; i++)
+	for (i = 0; i < drc->num_channels; i++)
 		sum3(data[i], data1[i], data2[i], frames);
 
-	/* Apply de-emphasis filter if emphasis is not disabled. */
+	/* Apply de-emphasis filter if emphasis is not disabled. The pad
+	 * channel stays silent, so its filter state doesn't matter. */
 	if (!drc->emphasis_disabled)
-		eq2_process(drc->deemphasis_eq, data[0], data[1], frames);
+		for (p = 0; p < num_pairs(drc); p++)
+			eq2_process(drc->deemphasis_eq[p], data[2 * p],
+				    pair_right(drc, data, p), frames);
 }
@@ -24,9 +24,11 @@ extern "C" {
  * the loudest parts of the signal and raises the volume of the softest parts,
  * making the sound richer, fuller, and more controlled.
  *
- * This is a three band stereo DRC. There are three compressor kernels, and each
- * can have its own parameters. If a kernel is disabled, it only delays the
- * signal and does not compress it.
+ * This is a three band DRC of up to DRC_MAX_CHANNELS channels. There are three
+ * compressor kernels, and each can have its own parameters. If a kernel is
+ * disabled, it only delays the signal and does not compress it. All the
+ * channels of a band are compressed with the same gain. The emphasis and
+ * crossover filters run on pairs of channels.
  *
  *                   INPUT
  *                     |
@@ -104,31 +106,39 @@ enum { PARAM_THRESHOLD,
 /* The default value of PARAM_PRE_DELAY in seconds. */
 #define DRC_DEFAULT_PRE_DELAY 0.006f
 
+/* The number of channel pairs the emphasis and crossover filters run on. */
+#define DRC_MAX_CHANNEL_PAIRS ((DRC_MAX_CHANNELS + 1) / 2)
+
 struct drc {
 	/* sample rate in Hz */
 	float sample_rate;
 
+	/* The number of channels */
+	int num_channels;
+
 	/* 1 to disable the emphasis and deemphasis, 0 to enable it. */
 	int emphasis_disabled;
 
 	/* parameters holds the tweakable compressor parameters. */
 	float parameters[DRC_NUM_KERNELS][PARAM_LAST];
 
-	/* The emphasis filter and deemphasis filter */
-	struct eq2 *emphasis_eq;
-	struct eq2 *deemphasis_eq;
+	/* The emphasis filter and deemphasis filter of each channel pair */
+	struct eq2 *emphasis_eq[DRC_MAX_CHANNEL_PAIRS];
+	struct eq2 *deemphasis_eq[DRC_MAX_CHANNEL_PAIRS];
 
-	/* The crossover filter */
-	struct crossover2 xo2;
+	/* The crossover filter of each channel pair */
+	struct crossover2 xo2[DRC_MAX_CHANNEL_PAIRS];
 
 	/* The compressor kernels */
 	struct drc_kernel kernel[DRC_NUM_KERNELS];
 
 	/* Temporary buffer used during drc_process(). The mid and high band
 	 * signal is stored in these buffers (the low band is stored in the
-	 * original input buffer). */
-	float *data1[DRC_NUM_CHANNELS];
-	float *data2[DRC_NUM_CHANNELS];
+	 * original input buffer). With an odd number of channels the last
+	 * one is paired with the silent pad channel. */
+	float *data1[DRC_MAX_CHANNEL_PAIRS * 2];
+	float *data2[DRC_MAX_CHANNEL_PAIRS * 2];
+	float *pad;
 };
 
 /* DRC needs the parameters to be set before initialization. So drc_new() should
@@ -148,8 +158,9 @@ struct drc {
  *  drc_free();
  */
 
-/* Allocates a DRC. */
-struct drc *drc_new(float sample_rate);
+/* Allocates a DRC of num_channels channels, from 1 to DRC_MAX_CHANNELS.
+ * Returns NULL if num_channels is out of range. */
+struct drc *drc_new(float sample_rate, int num_channels);
 
 /* Initializes a DRC. */
 void drc_init(struct drc *drc);
@@ -160,8 +171,7 @@ void drc_free(struct drc *drc);
 /* Processes input data using a DRC.
  * Args:
  *    drc - The DRC we want to use.
- *    float **data - Pointers to input/output data. The input must be stereo
- *        and one channel is pointed by data[0], another pointed by data[1]. The
+ *    float **data - Pointers to input/output data, one per channel. The
  *        output data is stored in the same place.
  *    frames - The number of frames to process.
  */
@@ -176,6 +186,15 @@ void drc_process(struct drc *drc, float **data, int frames);
  */
 void drc_set_param(struct drc *drc, int index, unsigned paramID, float value);
 
+/* Applies the compressor parameters changed by drc_set_param() after
+ * drc_init(), while the DRC runs. It doesn't allocate or reset any state and
+ * the post gain moves to its new value smoothly. The crossover frequencies,
+ * emphasis filters and pre delay only change on drc_init().
+ * Args:
+ *    drc - The DRC we want to use.
+ */
+void drc_update(struct drc *drc);
+
 #ifdef __cplusplus
 } /* extern "C" */
 #endif
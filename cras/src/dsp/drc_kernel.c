@@ -25,10 +25,14 @@
 #define assert_on_compile_is_power_of_2(n)                                     \
 	assert_on_compile((n) != 0 && (((n) & ((n)-1)) == 0))
 
+/* The number of divisions the post gain takes to change when the parameters
+ * are set while running. */
+#define GAIN_RAMP_DIVISIONS 16
+
 const float uninitialized_value = -1;
 static int drc_math_initialized;
 
-void dk_init(struct drc_kernel *dk, float sample_rate)
+void dk_init(struct drc_kernel *dk, float sample_rate, int num_channels)
 {
 	int i;
 
@@ -38,6 +42,7 @@ void dk_init(struct drc_kernel *dk, float sample_rate)
 	}
 
 	dk->sample_rate = sample_rate;
+	dk->num_channels = num_channels;
 	dk->detector_average = 0;
 	dk->compressor_gain = 1;
 	dk->enabled = 0;
@@ -54,12 +59,14 @@ void dk_init(struct drc_kernel *dk, float sample_rate)
 	dk->knee_threshold = uninitialized_value;
 	dk->ratio_base = uninitialized_value;
 	dk->K = uninitialized_value;
+	dk->main_linear_gain = uninitialized_value;
+	dk->gain_ramp_left = 0;
 
 	assert_on_compile_is_power_of_2(DIVISION_FRAMES);
 	assert_on_compile(DIVISION_FRAMES % 4 == 0);
 	/* Allocate predelay buffers */
 	assert_on_compile_is_power_of_2(MAX_PRE_DELAY_FRAMES);
-	for (i = 0; i < DRC_NUM_CHANNELS; i++) {
+	for (i = 0; i < dk->num_channels; i++) {
 		size_t size = sizeof(float) * MAX_PRE_DELAY_FRAMES;
 		dk->pre_delay_buffers[i] = (float *)calloc(1, size);
 	}
@@ -68,7 +75,7 @@ void dk_init(struct drc_kernel *dk, float sample_rate)
 void dk_free(struct drc_kernel *dk)
 {
 	int i;
-	for (i = 0; i < DRC_NUM_CHANNELS; ++i)
+	for (i = 0; i < dk->num_channels; ++i)
 		free(dk->pre_delay_buffers[i]);
 }
 
@@ -93,7 +100,7 @@ static void set_pre_delay_time(struct drc_kernel *dk, float pre_delay_time)
 
 	if (dk->last_pre_delay_frames != pre_delay_frames) {
 		dk->last_pre_delay_frames = pre_delay_frames;
-		for (i = 0; i < DRC_NUM_CHANNELS; ++i) {
+		for (i = 0; i < dk->num_channels; ++i) {
 			size_t size = sizeof(float) * MAX_PRE_DELAY_FRAMES;
 			memset(dk->pre_delay_buffers[i], 0, size);
 		}
@@ -257,8 +264,17 @@ void dk_set_parameters(struct drc_kernel *dk, float db_threshold, float db_knee,
 	/* Empirical/perceptual tuning. */
 	full_range_makeup_gain = powf(full_range_makeup_gain, 0.6f);
 
-	dk->main_linear_gain =
+	dk->target_linear_gain =
 		decibels_to_linear(db_post_gain) * full_range_makeup_gain;
+	if (dk->main_linear_gain == uninitialized_value) {
+		dk->main_linear_gain = dk->target_linear_gain;
+	} else {
+		/* Ramp to the new gain so the output doesn't jump. */
+		dk->gain_ramp_left = GAIN_RAMP_DIVISIONS;
+		dk->linear_gain_step =
+			(dk->target_linear_gain - dk->main_linear_gain) /
+			GAIN_RAMP_DIVISIONS;
+	}
 
 	/* Attack parameters. */
 	attack_time = max(0.001f, attack_time);
@@ -497,6 +513,27 @@ static inline void max_abs_division(float *output, const float *data0,
 }
 #endif
 
+/* Stores the max abs value across all the channels of the division starting
+ * at div_start in output. */
+static void max_abs_channels(struct drc_kernel *dk, float *output,
+			     int div_start)
+{
+	float pair_max[DIVISION_FRAMES];
+	float *const *buffers = dk->pre_delay_buffers;
+	int n = dk->num_channels;
+	int c, i;
+
+	max_abs_division(output, &buffers[0][div_start],
+			 &buffers[n > 1 ? 1 : 0][div_start]);
+	for (c = 2; c < n; c += 2) {
+		max_abs_division(pair_max, &buffers[c][div_start],
+				 &buffers[c + 1 < n ? c + 1 : c][div_start]);
+		for (i = 0; i < DIVISION_FRAMES; i++)
+			output[i] = output[i] > pair_max[i] ? output[i] :
+							      pair_max[i];
+	}
+}
+
 /* Update detector_average from the last input division. */
 static void dk_update_detector_average(struct drc_kernel *dk)
 {
@@ -515,8 +552,7 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 	}
 
 	/* The max abs value across all channels for this frame */
-	max_abs_division(abs_input_array, &dk->pre_delay_buffers[0][div_start],
-			 &dk->pre_delay_buffers[1][div_start]);
+	max_abs_channels(dk, abs_input_array, div_start);
 
 	for (i = 0; i < DIVISION_FRAMES; i++) {
 		/* Compute compression amount from un-delayed signal */
@@ -560,19 +596,19 @@ static void dk_update_detector_average(struct drc_kernel *dk)
 }
 
 /* Calculate compress_gain from the envelope and apply total_gain to compress
- * the next output division. */
+ * the next output division of two channels. Returns the new compressor_gain,
+ * which only depends on the envelope, so every pair of channels gets the same
+ * gain. */
 /* TODO(fbarchard): Port to aarch64 */
 #if defined(__ARM_NEON__)
 #include <arm_neon.h>
-static void dk_compress_output(struct drc_kernel *dk)
+static float dk_compress_pair(const struct drc_kernel *dk, float *ptr_left,
+			      float *ptr_right)
 {
 	const float main_linear_gain = dk->main_linear_gain;
 	const float envelope_rate = dk->envelope_rate;
 	const float scaled_desired_gain = dk->scaled_desired_gain;
 	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
 	int count = DIVISION_FRAMES / 4;
 
 	/* See warp_sinf() for the details for the constants. */
@@ -642,7 +678,7 @@ static void dk_compress_output(struct drc_kernel *dk)
 			: /* clobber */
 			  "memory", "cc");
 		// clang-format on
-		dk->compressor_gain = x[3];
+		return x[3];
 	} else {
 		float c = compressor_gain;
 		float r = envelope_rate;
@@ -702,20 +738,18 @@ static void dk_compress_output(struct drc_kernel *dk)
 			: /* clobber */
 			  "memory", "cc");
 		// clang-format on
-		dk->compressor_gain = x[3];
+		return x[3];
 	}
 }
 #elif defined(__SSE3__) && defined(__x86_64__)
 #include <emmintrin.h>
-static void dk_compress_output(struct drc_kernel *dk)
+static float dk_compress_pair(const struct drc_kernel *dk, float *ptr_left,
+			      float *ptr_right)
 {
 	const float main_linear_gain = dk->main_linear_gain;
 	const float envelope_rate = dk->envelope_rate;
 	const float scaled_desired_gain = dk->scaled_desired_gain;
 	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
 	int count = DIVISION_FRAMES / 4;
 
 	/* See warp_sinf() for the details for the constants. */
@@ -793,7 +827,7 @@ static void dk_compress_output(struct drc_kernel *dk)
 			: /* clobber */
 			  "memory", "cc");
 		// clang-format on
-		dk->compressor_gain = x[3];
+		return x[3];
 	} else {
 		/* See warp_sinf() for the details for the constants. */
 		__m128 A7 = _mm_set1_ps(-4.3330336920917034149169921875e-3f);
@@ -866,19 +900,17 @@ static void dk_compress_output(struct drc_kernel *dk)
 			: /* clobber */
 			  "memory", "cc");
 		// clang-format on
-		dk->compressor_gain = x[3];
+		return x[3];
 	}
 }
 #else
-static void dk_compress_output(struct drc_kernel *dk)
+static float dk_compress_pair(const struct drc_kernel *dk, float *ptr_left,
+			      float *ptr_right)
 {
 	const float main_linear_gain = dk->main_linear_gain;
 	const float envelope_rate = dk->envelope_rate;
 	const float scaled_desired_gain = dk->scaled_desired_gain;
 	const float compressor_gain = dk->compressor_gain;
-	const int div_start = dk->pre_delay_read_index;
-	float *ptr_left = &dk->pre_delay_buffers[0][div_start];
-	float *ptr_right = &dk->pre_delay_buffers[1][div_start];
 	int count = DIVISION_FRAMES / 4;
 
 	int i, j;
@@ -918,7 +950,7 @@ static void dk_compress_output(struct drc_kernel *dk)
 				x[j] = x[j] * r4;
 		}
 
-		dk->compressor_gain = x[3] + base;
+		return x[3] + base;
 	} else {
 		/* Release - exponentially increase gain to 1.0 */
 		float c = compressor_gain;
@@ -952,11 +984,34 @@ static void dk_compress_output(struct drc_kernel *dk)
 				x[j] = min(1.0f, x[j] * r4);
 		}
 
-		dk->compressor_gain = x[3];
+		return x[3];
 	}
 }
 #endif
 
+/* Compresses the next output division of all the channels. The last one
+ * pairs with a scratch buffer when the number of channels is odd. */
+static void dk_compress_output(struct drc_kernel *dk)
+{
+	const int div_start = dk->pre_delay_read_index;
+	float scratch[DIVISION_FRAMES];
+	float compressor_gain = dk->compressor_gain;
+	float *left, *right;
+	int c;
+
+	for (c = 0; c < dk->num_channels; c += 2) {
+		left = &dk->pre_delay_buffers[c][div_start];
+		if (c + 1 < dk->num_channels) {
+			right = &dk->pre_delay_buffers[c + 1][div_start];
+		} else {
+			memset(scratch, 0, sizeof(scratch));
+			right = scratch;
+		}
+		compressor_gain = dk_compress_pair(dk, left, right);
+	}
+	dk->compressor_gain = compressor_gain;
+}
+
 /* After one complete divison of samples have been received (and one divison of
  * samples have been output), we calculate shaped power average
  * (detector_average) from the input division, update envelope parameters from
@@ -967,6 +1022,13 @@ static void dk_process_one_division(struct drc_kernel *dk)
 {
 	dk_update_detector_average(dk);
 	dk_update_envelope(dk);
+	if (dk->gain_ramp_left) {
+		dk->gain_ramp_left--;
+		dk->main_linear_gain = dk->gain_ramp_left ?
+					       dk->main_linear_gain +
+						       dk->linear_gain_step :
+					       dk->target_linear_gain;
+	}
 	dk_compress_output(dk);
 }
 
@@ -979,7 +1041,7 @@ static void dk_copy_fragment(struct drc_kernel *dk, float *data_channels[],
 	int read_index = dk->pre_delay_read_index;
 	int j;
 
-	for (j = 0; j < DRC_NUM_CHANNELS; ++j) {
+	for (j = 0; j < dk->num_channels; ++j) {
 		memcpy(&dk->pre_delay_buffers[j][write_index],
 		       &data_channels[j][frame_index],
 		       frames_to_process * sizeof(float));
@@ -1014,7 +1076,7 @@ static void dk_process_delay_only(struct drc_kernel *dk, float *data_channels[],
 		 * available input samples. */
 		int chunk = min(large - small, MAX_PRE_DELAY_FRAMES - large);
 		chunk = min(chunk, count - i);
-		for (j = 0; j < DRC_NUM_CHANNELS; ++j) {
+		for (j = 0; j < dk->num_channels; ++j) {
 			memcpy(&dk->pre_delay_buffers[j][write_index],
 			       &data_channels[j][i], chunk * sizeof(float));
 			memcpy(&data_channels[j][i],
@@ -15,11 +15,15 @@
 extern "C" {
 #endif
 
-#define DRC_NUM_CHANNELS 2
+/* The maximum number of channels a drc kernel can process. */
+#define DRC_MAX_CHANNELS 8
 
 struct drc_kernel {
 	float sample_rate;
 
+	/* The number of channels, which are compressed with the same gain */
+	int num_channels;
+
 	/* The detector_average is the target gain obtained by looking at the
 	 * future samples in the lookahead buffer and applying the compression
 	 * curve on them. compressor_gain is the gain applied to the current
@@ -33,7 +37,7 @@ struct drc_kernel {
 
 	/* Lookahead section. */
 	unsigned last_pre_delay_frames;
-	float *pre_delay_buffers[DRC_NUM_CHANNELS];
+	float *pre_delay_buffers[DRC_MAX_CHANNELS];
 	int pre_delay_read_index;
 	int pre_delay_write_index;
 
@@ -68,6 +72,13 @@ struct drc_kernel {
 
 	/* Calculated parameters */
 	float main_linear_gain;
+
+	/* When the parameters change while running, main_linear_gain moves
+	 * to target_linear_gain by linear_gain_step for gain_ramp_left more
+	 * divisions. */
+	float target_linear_gain;
+	float linear_gain_step;
+	int gain_ramp_left;
 	float attack_frames;
 	float sat_release_frames_inv_neg;
 	float sat_release_rate_at_neg_two_db;
@@ -78,8 +89,9 @@ struct drc_kernel {
 	float scaled_desired_gain;
 };
 
-/* Initializes a drc kernel */
-void dk_init(struct drc_kernel *dk, float sample_rate);
+/* Initializes a drc kernel for num_channels channels, from 1 to
+ * DRC_MAX_CHANNELS */
+void dk_init(struct drc_kernel *dk, float sample_rate, int num_channels);
 
 /* Frees a drc kernel */
 void dk_free(struct drc_kernel *dk);
@@ -94,7 +106,7 @@ void dk_set_parameters(struct drc_kernel *dk, float db_threshold, float db_knee,
 /* Enables or disables a drc kernel */
 void dk_set_enabled(struct drc_kernel *dk, int enabled);
 
-/* Performs stereo-linked compression.
+/* Performs linked compression of all the channels.
  * Args:
  *    dk - The DRC kernel.
  *    data - The pointers to the audio sample buffer. One pointer per channel.
@@ -26,6 +26,29 @@
 	})
 #endif
 
+/* Converts a float in range of -1.0f to 1.0f to a 16 bit sample, rounding
+ * away from zero and saturating. */
+static inline int16_t float_to_s16(float f)
+{
+	f *= 32768.0f;
+	f += (f >= 0) ? 0.5f : -0.5f;
+	return max(-32768.0f, min(32767.0f, f));
+}
+
+/* Converts a float in range of -1.0f to 1.0f to a 32 bit sample, rounding
+ * away from zero and saturating. Casting a float that doesn't fit in an
+ * int32_t is undefined, and 1.0f doesn't. */
+static inline int32_t float_to_s32(float f)
+{
+	f *= 2147483648.0f;
+	if (f >= 2147483648.0f)
+		return INT_MAX;
+	if (!(f > -2147483648.0f))
+		return INT_MIN;
+	f += (f >= 0) ? 0.5f : -0.5f;
+	return (int32_t)f;
+}
+
 #undef deinterleave_stereo
 #undef interleave_stereo
 
@@ -128,13 +151,8 @@ static void interleave_stereo(float *input1, float *input2, int16_t *output,
 
 	/* The remaining samples */
 	while (frames--) {
-		float f;
-		f = *input1++ * 32768.0f;
-		f += (f >= 0) ? 0.5f : -0.5f;
-		*output++ = max(-32768, min(32767, (int)(f)));
-		f = *input2++ * 32768.0f;
-		f += (f >= 0) ? 0.5f : -0.5f;
-		*output++ = max(-32768, min(32767, (int)(f)));
+		*output++ = float_to_s16(*input1++);
+		*output++ = float_to_s16(*input2++);
 	}
 }
 #define interleave_stereo interleave_stereo
@@ -245,13 +263,8 @@ static void interleave_stereo(float *input1, float *input2, int16_t *output,
 
 	/* The remaining samples */
 	while (frames--) {
-		float f;
-		f = *input1++ * 32768.0f;
-		f += (f >= 0) ? 0.5f : -0.5f;
-		*output++ = max(-32768, min(32767, (int)(f)));
-		f = *input2++ * 32768.0f;
-		f += (f >= 0) ? 0.5f : -0.5f;
-		*output++ = max(-32768, min(32767, (int)(f)));
+		*output++ = float_to_s16(*input1++);
+		*output++ = float_to_s16(*input2++);
 	}
 }
 #define interleave_stereo interleave_stereo
@@ -376,18 +389,426 @@ static void interleave_stereo(float *input1, float *input2, int16_t *output,
 
 	/* The remaining samples */
 	while (frames--) {
-		float f;
-		f = *input1++ * 32768.0f;
-		f += (f >= 0) ? 0.5f : -0.5f;
-		*output++ = max(-32768, min(32767, (int)(f)));
-		f = *input2++ * 32768.0f;
-		f += (f >= 0) ? 0.5f : -0.5f;
-		*output++ = max(-32768, min(32767, (int)(f)));
+		*output++ = float_to_s16(*input1++);
+		*output++ = float_to_s16(*input2++);
 	}
 }
 #define interleave_stereo interleave_stereo
 #endif
 
+/* Vector kernels for the formats and channel counts the stereo s16 paths
+ * above don't cover. Samples are converted between integers and floats four
+ * at a time while still interleaved, in blocks of VEC_BLOCK_SAMPLES staged in
+ * a buffer on the stack, and are moved between the block and the planes with
+ * register transposes for 2, 4 and 8 channels. The rounding of ties differs
+ * from the scalar code on Intel, same as interleave_stereo.
+ */
+#if defined(__aarch64__) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+typedef float32x4_t vec4f;
+typedef int32x4_t vec4i;
+
+#define vec4f_load(p) vld1q_f32(p)
+#define vec4f_store(p, v) vst1q_f32(p, v)
+#define vec4f_mul(v, s) vmulq_n_f32(v, s)
+#define vec4f_add(a, b) vaddq_f32(a, b)
+#define vec4f_neg(v) vnegq_f32(v)
+#define vec4f_clamp(v, lo, hi) vminq_f32(vmaxq_f32(v, vdupq_n_f32(lo)), \
+					 vdupq_n_f32(hi))
+#define vec4i_load(p) vld1q_s32(p)
+#define vec4i_store(p, v) vst1q_s32(p, v)
+#define vec4i_load_s16(p) vmovl_s16(vld1_s16(p))
+#define vec4i_store_s16(p, v) vst1_s16(p, vqmovn_s32(v))
+#define vec4i_to_float(v) vcvtq_f32_s32(v)
+#define vec4i_shl8(v) vshlq_n_s32(v, 8)
+#define vec4i_to_s24(v) vandq_s32(vshrq_n_s32(v, 8), vdupq_n_s32(0x00ffffff))
+
+/* Rounds to the nearest integer, saturating to the int32_t range. */
+static inline vec4i vec4f_to_int(vec4f v)
+{
+#ifdef __aarch64__
+	return vcvtnq_s32_f32(v);
+#else
+	/* Add 0.5 with the sign of v, vcvt truncates and saturates. */
+	vec4f half = vbslq_f32(vdupq_n_u32(0x80000000), v, vdupq_n_f32(0.5f));
+	return vcvtq_s32_f32(vaddq_f32(v, half));
+#endif
+}
+
+static inline void vec4f_unzip(vec4f a, vec4f b, vec4f *even, vec4f *odd)
+{
+	float32x4x2_t t = vuzpq_f32(a, b);
+	*even = t.val[0];
+	*odd = t.val[1];
+}
+
+static inline void vec4f_zip(vec4f a, vec4f b, vec4f *lo, vec4f *hi)
+{
+	float32x4x2_t t = vzipq_f32(a, b);
+	*lo = t.val[0];
+	*hi = t.val[1];
+}
+
+static inline void vec4f_transpose(vec4f *r0, vec4f *r1, vec4f *r2, vec4f *r3)
+{
+	float32x4x2_t t01 = vtrnq_f32(*r0, *r1);
+	float32x4x2_t t23 = vtrnq_f32(*r2, *r3);
+
+	*r0 = vcombine_f32(vget_low_f32(t01.val[0]), vget_low_f32(t23.val[0]));
+	*r1 = vcombine_f32(vget_low_f32(t01.val[1]), vget_low_f32(t23.val[1]));
+	*r2 = vcombine_f32(vget_high_f32(t01.val[0]),
+			   vget_high_f32(t23.val[0]));
+	*r3 = vcombine_f32(vget_high_f32(t01.val[1]),
+			   vget_high_f32(t23.val[1]));
+}
+#define HAVE_VEC4 1
+
+#elif defined(__SSE3__)
+#include <emmintrin.h>
+
+typedef __m128 vec4f;
+typedef __m128i vec4i;
+
+#define vec4f_load(p) _mm_loadu_ps(p)
+#define vec4f_store(p, v) _mm_storeu_ps(p, v)
+#define vec4f_mul(v, s) _mm_mul_ps(v, _mm_set1_ps(s))
+#define vec4f_add(a, b) _mm_add_ps(a, b)
+#define vec4f_neg(v) _mm_xor_ps(v, _mm_set1_ps(-0.0f))
+#define vec4f_clamp(v, lo, hi) _mm_min_ps(_mm_max_ps(v, _mm_set1_ps(lo)), \
+					  _mm_set1_ps(hi))
+#define vec4i_load(p) _mm_loadu_si128((const __m128i *)(p))
+#define vec4i_store(p, v) _mm_storeu_si128((__m128i *)(p), v)
+#define vec4i_load_s16(p)                                                      \
+	({                                                                     \
+		__m128i _x = _mm_loadl_epi64((const __m128i *)(p));            \
+		_mm_srai_epi32(_mm_unpacklo_epi16(_x, _x), 16);                \
+	})
+#define vec4i_store_s16(p, v)                                                  \
+	_mm_storel_epi64((__m128i *)(p), _mm_packs_epi32(v, v))
+#define vec4i_to_float(v) _mm_cvtepi32_ps(v)
+#define vec4i_shl8(v) _mm_slli_epi32(v, 8)
+#define vec4i_to_s24(v)                                                        \
+	_mm_and_si128(_mm_srai_epi32(v, 8), _mm_set1_epi32(0x00ffffff))
+
+/* Rounds to the nearest integer, saturating to the int32_t range. cvtps2dq
+ * returns INT_MIN for anything out of range, flip the positive overflows
+ * to INT_MAX. */
+static inline vec4i vec4f_to_int(vec4f v)
+{
+	__m128i over = _mm_castps_si128(
+		_mm_cmpge_ps(v, _mm_set1_ps(2147483648.0f)));
+	return _mm_xor_si128(_mm_cvtps_epi32(v), over);
+}
+
+static inline void vec4f_unzip(vec4f a, vec4f b, vec4f *even, vec4f *odd)
+{
+	*even = _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0));
+	*odd = _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+static inline void vec4f_zip(vec4f a, vec4f b, vec4f *lo, vec4f *hi)
+{
+	*lo = _mm_unpacklo_ps(a, b);
+	*hi = _mm_unpackhi_ps(a, b);
+}
+
+static inline void vec4f_transpose(vec4f *r0, vec4f *r1, vec4f *r2, vec4f *r3)
+{
+	_MM_TRANSPOSE4_PS(*r0, *r1, *r2, *r3);
+}
+#define HAVE_VEC4 1
+#endif
+
+#ifdef HAVE_VEC4
+#define VEC_BLOCK_SAMPLES 256
+#define VEC_MAX_CHANNELS 8
+
+static int sample_bytes(snd_pcm_format_t format)
+{
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		return 2;
+	case SND_PCM_FORMAT_S24_3LE:
+		return 3;
+	default:
+		return 4;
+	}
+}
+
+/* Returns non-zero if the vector kernels handle format and channels. The
+ * stereo s16 paths above are kept where they exist. */
+static int format_is_vectorized(snd_pcm_format_t format, int channels)
+{
+	if (channels < 1 || channels > VEC_MAX_CHANNELS)
+		return 0;
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+#if defined(deinterleave_stereo) && defined(interleave_stereo)
+		return channels != 2;
+#else
+		return 1;
+#endif
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S32_LE:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/* Converts n interleaved samples to floats in tmp. */
+static void vec_to_float(const uint8_t *input, float *tmp,
+			 snd_pcm_format_t format, int n)
+{
+	const int16_t *s16 = (const int16_t *)input;
+	const int32_t *s32 = (const int32_t *)input;
+	int32_t packed[4];
+	vec4i v;
+	int i = 0, k;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		for (; i + 4 <= n; i += 4) {
+			v = vec4i_load_s16(s16 + i);
+			vec4f_store(tmp + i,
+				    vec4f_mul(vec4i_to_float(v), 1.0f / 32768.0f));
+		}
+		for (; i < n; i++)
+			tmp[i] = s16[i] / 32768.0f;
+		return;
+	case SND_PCM_FORMAT_S24_LE:
+		for (; i + 4 <= n; i += 4) {
+			v = vec4i_shl8(vec4i_load(s32 + i));
+			vec4f_store(tmp + i, vec4f_mul(vec4i_to_float(v),
+						       1.0f / 2147483648.0f));
+		}
+		for (; i < n; i++)
+			tmp[i] = (s32[i] << 8) / 2147483648.0f;
+		return;
+	case SND_PCM_FORMAT_S24_3LE:
+		for (; i + 4 <= n; i += 4) {
+			for (k = 0; k < 4; k++) {
+				packed[k] = 0;
+				memcpy((uint8_t *)&packed[k] + 1,
+				       input + (i + k) * 3, 3);
+			}
+			v = vec4i_load(packed);
+			vec4f_store(tmp + i, vec4f_mul(vec4i_to_float(v),
+						       1.0f / 2147483648.0f));
+		}
+		for (; i < n; i++) {
+			packed[0] = 0;
+			memcpy((uint8_t *)&packed[0] + 1, input + i * 3, 3);
+			tmp[i] = packed[0] / 2147483648.0f;
+		}
+		return;
+	default:
+		for (; i + 4 <= n; i += 4) {
+			v = vec4i_load(s32 + i);
+			vec4f_store(tmp + i, vec4f_mul(vec4i_to_float(v),
+						       1.0f / 2147483648.0f));
+		}
+		for (; i < n; i++)
+			tmp[i] = s32[i] / 2147483648.0f;
+		return;
+	}
+}
+
+/* Converts n interleaved floats in tmp to samples. */
+static void vec_from_float(const float *tmp, uint8_t *output,
+			   snd_pcm_format_t format, int n)
+{
+	int16_t *s16 = (int16_t *)output;
+	int32_t *s32 = (int32_t *)output;
+	int32_t packed[4];
+	vec4f f;
+	int i = 0, k;
+
+	switch (format) {
+	case SND_PCM_FORMAT_S16_LE:
+		for (; i + 4 <= n; i += 4) {
+			f = vec4f_mul(vec4f_load(tmp + i), 32768.0f);
+			f = vec4f_clamp(f, -32768.0f, 32767.0f);
+			vec4i_store_s16(s16 + i, vec4f_to_int(f));
+		}
+		for (; i < n; i++)
+			s16[i] = float_to_s16(tmp[i]);
+		return;
+	case SND_PCM_FORMAT_S24_LE:
+		for (; i + 4 <= n; i += 4) {
+			f = vec4f_mul(vec4f_load(tmp + i), 2147483648.0f);
+			vec4i_store(s32 + i, vec4i_to_s24(vec4f_to_int(f)));
+		}
+		for (; i < n; i++)
+			s32[i] = (float_to_s32(tmp[i]) >> 8) & 0x00ffffff;
+		return;
+	case SND_PCM_FORMAT_S24_3LE:
+		for (; i + 4 <= n; i += 4) {
+			f = vec4f_mul(vec4f_load(tmp + i), 2147483648.0f);
+			vec4i_store(packed, vec4f_to_int(f));
+			for (k = 0; k < 4; k++)
+				memcpy(output + (i + k) * 3,
+				       (uint8_t *)&packed[k] + 1, 3);
+		}
+		for (; i < n; i++) {
+			packed[0] = float_to_s32(tmp[i]);
+			memcpy(output + i * 3, (uint8_t *)&packed[0] + 1, 3);
+		}
+		return;
+	default:
+		for (; i + 4 <= n; i += 4) {
+			f = vec4f_mul(vec4f_load(tmp + i), 2147483648.0f);
+			vec4i_store(s32 + i, vec4f_to_int(f));
+		}
+		for (; i < n; i++)
+			s32[i] = float_to_s32(tmp[i]);
+		return;
+	}
+}
+
+/* Splits n interleaved frames in tmp into the planes. */
+static void vec_split(const float *tmp, float *const *out, int channels,
+		      int n)
+{
+	vec4f r[8];
+	int i = 0, j;
+
+	switch (channels) {
+	case 1:
+		memcpy(out[0], tmp, n * sizeof(float));
+		return;
+	case 2:
+		for (; i + 4 <= n; i += 4) {
+			vec4f_unzip(vec4f_load(tmp + 2 * i),
+				    vec4f_load(tmp + 2 * i + 4), &r[0], &r[1]);
+			vec4f_store(out[0] + i, r[0]);
+			vec4f_store(out[1] + i, r[1]);
+		}
+		break;
+	case 4:
+		for (; i + 4 <= n; i += 4) {
+			for (j = 0; j < 4; j++)
+				r[j] = vec4f_load(tmp + 4 * i + 4 * j);
+			vec4f_transpose(&r[0], &r[1], &r[2], &r[3]);
+			for (j = 0; j < 4; j++)
+				vec4f_store(out[j] + i, r[j]);
+		}
+		break;
+	case 8:
+		/* The even rows hold channels 0-3 and the odd ones 4-7. */
+		for (; i + 4 <= n; i += 4) {
+			for (j = 0; j < 8; j++)
+				r[j] = vec4f_load(tmp + 8 * i + 4 * j);
+			vec4f_transpose(&r[0], &r[2], &r[4], &r[6]);
+			vec4f_transpose(&r[1], &r[3], &r[5], &r[7]);
+			for (j = 0; j < 4; j++) {
+				vec4f_store(out[j] + i, r[2 * j]);
+				vec4f_store(out[j + 4] + i, r[2 * j + 1]);
+			}
+		}
+		break;
+	}
+
+	for (; i < n; i++)
+		for (j = 0; j < channels; j++)
+			out[j][i] = tmp[i * channels + j];
+}
+
+/* Merges n frames of the planes into interleaved frames in tmp. */
+static void vec_merge(float *const *in, float *tmp, int channels, int n)
+{
+	vec4f r[8];
+	int i = 0, j;
+
+	switch (channels) {
+	case 1:
+		memcpy(tmp, in[0], n * sizeof(float));
+		return;
+	case 2:
+		for (; i + 4 <= n; i += 4) {
+			vec4f_zip(vec4f_load(in[0] + i), vec4f_load(in[1] + i),
+				  &r[0], &r[1]);
+			vec4f_store(tmp + 2 * i, r[0]);
+			vec4f_store(tmp + 2 * i + 4, r[1]);
+		}
+		break;
+	case 4:
+		for (; i + 4 <= n; i += 4) {
+			for (j = 0; j < 4; j++)
+				r[j] = vec4f_load(in[j] + i);
+			vec4f_transpose(&r[0], &r[1], &r[2], &r[3]);
+			for (j = 0; j < 4; j++)
+				vec4f_store(tmp + 4 * i + 4 * j, r[j]);
+		}
+		break;
+	case 8:
+		for (; i + 4 <= n; i += 4) {
+			for (j = 0; j < 4; j++) {
+				r[2 * j] = vec4f_load(in[j] + i);
+				r[2 * j + 1] = vec4f_load(in[j + 4] + i);
+			}
+			vec4f_transpose(&r[0], &r[2], &r[4], &r[6]);
+			vec4f_transpose(&r[1], &r[3], &r[5], &r[7]);
+			for (j = 0; j < 8; j++)
+				vec4f_store(tmp + 8 * i + 4 * j, r[j]);
+		}
+		break;
+	}
+
+	for (; i < n; i++)
+		for (j = 0; j < channels; j++)
+			tmp[i * channels + j] = in[j][i];
+}
+
+static void vec_deinterleave(const uint8_t *input, float *const *output,
+			     int channels, snd_pcm_format_t format, int frames)
+{
+	float tmp[VEC_BLOCK_SAMPLES];
+	float *out[VEC_MAX_CHANNELS];
+	int block = (VEC_BLOCK_SAMPLES / channels) & ~3;
+	int stride = channels * sample_bytes(format);
+	int i, n;
+
+	for (i = 0; i < channels; i++)
+		out[i] = output[i];
+
+	while (frames > 0) {
+		n = min(frames, block);
+		vec_to_float(input, tmp, format, n * channels);
+		vec_split(tmp, out, channels, n);
+		input += n * stride;
+		for (i = 0; i < channels; i++)
+			out[i] += n;
+		frames -= n;
+	}
+}
+
+static void vec_interleave(float *const *input, uint8_t *output, int channels,
+			   snd_pcm_format_t format, int frames)
+{
+	float tmp[VEC_BLOCK_SAMPLES];
+	float *in[VEC_MAX_CHANNELS];
+	int block = (VEC_BLOCK_SAMPLES / channels) & ~3;
+	int stride = channels * sample_bytes(format);
+	int i, n;
+
+	for (i = 0; i < channels; i++)
+		in[i] = input[i];
+
+	while (frames > 0) {
+		n = min(frames, block);
+		vec_merge(in, tmp, channels, n);
+		vec_from_float(tmp, output, format, n * channels);
+		output += n * stride;
+		for (i = 0; i < channels; i++)
+			in[i] += n;
+		frames -= n;
+	}
+}
+#endif /* HAVE_VEC4 */
+
 static void dsp_util_deinterleave_s16le(int16_t *input, float *const *output,
 					int channels, int frames)
 {
@@ -455,9 +876,30 @@ static void dsp_util_deinterleave_s32le(int32_t *input, float *const *output,
 			*(output_ptr[j]++) = *input / 2147483648.0f;
 }
 
+static void dsp_util_deinterleave_f32le(const float *input,
+					float *const *output, int channels,
+					int frames)
+{
+	float *output_ptr[channels];
+	int i, j;
+
+	for (i = 0; i < channels; i++)
+		output_ptr[i] = output[i];
+
+	for (i = 0; i < frames; i++)
+		for (j = 0; j < channels; j++)
+			*(output_ptr[j]++) = *input++;
+}
+
 int dsp_util_deinterleave(uint8_t *input, float *const *output, int channels,
 			  snd_pcm_format_t format, int frames)
 {
+#ifdef HAVE_VEC4
+	if (format_is_vectorized(format, channels)) {
+		vec_deinterleave(input, output, channels, format, frames);
+		return 0;
+	}
+#endif
 	switch (format) {
 	case SND_PCM_FORMAT_S16_LE:
 		dsp_util_deinterleave_s16le((int16_t *)input, output, channels,
@@ -474,6 +916,10 @@ int dsp_util_deinterleave(uint8_t *input, float *const *output, int channels,
 		dsp_util_deinterleave_s32le((int32_t *)input, output, channels,
 					    frames);
 		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		dsp_util_deinterleave_f32le((const float *)input, output,
+					    channels, frames);
+		break;
 	default:
 		syslog(LOG_ERR, "Invalid format to deinterleave");
 		return -EINVAL;
@@ -498,11 +944,8 @@ static void dsp_util_interleave_s16le(float *const *input, int16_t *output,
 		input_ptr[i] = input[i];
 
 	for (i = 0; i < frames; i++)
-		for (j = 0; j < channels; j++) {
-			float f = *(input_ptr[j]++) * 32768.0f;
-			f += (f >= 0) ? 0.5f : -0.5f;
-			*output++ = max(-32768, min(32767, (int)(f)));
-		}
+		for (j = 0; j < channels; j++)
+			*output++ = float_to_s16(*(input_ptr[j]++));
 }
 
 static void dsp_util_interleave_s24le(float *const *input, int32_t *output,
@@ -516,9 +959,7 @@ static void dsp_util_interleave_s24le(float *const *input, int32_t *output,
 
 	for (i = 0; i < frames; i++)
 		for (j = 0; j < channels; j++, output++) {
-			float f = *(input_ptr[j]++) * 2147483648.0f;
-			f += (f >= 0) ? 0.5f : -0.5f;
-			*output = max((float)INT_MIN, min((float)INT_MAX, f));
+			*output = float_to_s32(*(input_ptr[j]++));
 			*output = (*output >> 8) & 0x00ffffff;
 		}
 }
@@ -535,10 +976,7 @@ static void dsp_util_interleave_s243le(float *const *input, uint8_t *output,
 
 	for (i = 0; i < frames; i++)
 		for (j = 0; j < channels; j++, output += 3) {
-			float f = *(input_ptr[j]++) * 2147483648.0f;
-			f += (f >= 0) ? 0.5f : -0.5f;
-			tmp = max((float)INT_MIN, min((float)INT_MAX, f));
-			tmp >>= 8;
+			tmp = float_to_s32(*(input_ptr[j]++)) >> 8;
 			memcpy(output, &tmp, 3);
 		}
 }
@@ -554,15 +992,34 @@ static void dsp_util_interleave_s32le(float *const *input, int32_t *output,
 
 	for (i = 0; i < frames; i++)
 		for (j = 0; j < channels; j++, output++) {
-			float f = *(input_ptr[j]++) * 2147483648.0f;
-			f += (f >= 0) ? 0.5f : -0.5f;
-			*output = max((float)INT_MIN, min((float)INT_MAX, f));
+			*output = float_to_s32(*(input_ptr[j]++));
 		}
 }
 
+/* Floats are written as they are, a float device clips them itself. */
+static void dsp_util_interleave_f32le(float *const *input, float *output,
+				      int channels, int frames)
+{
+	float *input_ptr[channels];
+	int i, j;
+
+	for (i = 0; i < channels; i++)
+		input_ptr[i] = input[i];
+
+	for (i = 0; i < frames; i++)
+		for (j = 0; j < channels; j++)
+			*output++ = *(input_ptr[j]++);
+}
+
 int dsp_util_interleave(float *const *input, uint8_t *output, int channels,
 			snd_pcm_format_t format, int frames)
 {
+#ifdef HAVE_VEC4
+	if (format_is_vectorized(format, channels)) {
+		vec_interleave(input, output, channels, format, frames);
+		return 0;
+	}
+#endif
 	switch (format) {
 	case SND_PCM_FORMAT_S16_LE:
 		dsp_util_interleave_s16le(input, (int16_t *)output, channels,
@@ -579,6 +1036,10 @@ int dsp_util_interleave(float *const *input, uint8_t *output, int channels,
 		dsp_util_interleave_s32le(input, (int32_t *)output, channels,
 					  frames);
 		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		dsp_util_interleave_f32le(input, (float *)output, channels,
+					  frames);
+		break;
 	default:
 		syslog(LOG_ERR, "Invalid format to interleave");
 		return -EINVAL;
@@ -586,6 +1047,83 @@ int dsp_util_interleave(float *const *input, uint8_t *output, int channels,
 	return 0;
 }
 
+/* The stereo plane kernels below load both channels of four frames before
+ * storing any of them, so the outputs may be the inputs. */
+void dsp_util_swap_stereo(const float *in0, const float *in1, float *out0,
+			  float *out1, int frames)
+{
+	int i = 0;
+	float t;
+
+#ifdef HAVE_VEC4
+	for (; i + 4 <= frames; i += 4) {
+		vec4f l = vec4f_load(in0 + i);
+		vec4f r = vec4f_load(in1 + i);
+		vec4f_store(out0 + i, r);
+		vec4f_store(out1 + i, l);
+	}
+#endif
+	for (; i < frames; i++) {
+		t = in0[i];
+		out0[i] = in1[i];
+		out1[i] = t;
+	}
+}
+
+void dsp_util_invert_left(const float *in0, const float *in1, float *out0,
+			  float *out1, int frames)
+{
+	int i = 0;
+
+#ifdef HAVE_VEC4
+	for (; i + 4 <= frames; i += 4) {
+		vec4f l = vec4f_load(in0 + i);
+		vec4f r = vec4f_load(in1 + i);
+		vec4f_store(out0 + i, vec4f_neg(l));
+		vec4f_store(out1 + i, r);
+	}
+#endif
+	for (; i < frames; i++) {
+		out0[i] = -in0[i];
+		out1[i] = in1[i];
+	}
+}
+
+void dsp_util_mix_stereo(const float *in0, const float *in1, float *out0,
+			 float *out1, int frames)
+{
+	int i = 0;
+	float t;
+
+#ifdef HAVE_VEC4
+	for (; i + 4 <= frames; i += 4) {
+		vec4f m = vec4f_add(vec4f_load(in0 + i), vec4f_load(in1 + i));
+		vec4f_store(out0 + i, m);
+		vec4f_store(out1 + i, m);
+	}
+#endif
+	for (; i < frames; i++) {
+		t = in0[i] + in1[i];
+		out0[i] = t;
+		out1[i] = t;
+	}
+}
+
+void dsp_util_accumulate(const float *in, float *out, float gain,
+			 int frames)
+{
+	int i = 0;
+
+#ifdef HAVE_VEC4
+	for (; i + 4 <= frames; i += 4)
+		vec4f_store(out + i, vec4f_add(vec4f_load(out + i),
+					       vec4f_mul(vec4f_load(in + i),
+							 gain)));
+#endif
+	for (; i < frames; i++)
+		out[i] += gain * in[i];
+}
+
 void dsp_enable_flush_denormal_to_zero()
 {
 #if defined(__i386__) || defined(__x86_64__)
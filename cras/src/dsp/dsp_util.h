@@ -43,6 +43,35 @@ int dsp_util_deinterleave(uint8_t *input, float *const *output, int channels,
 int dsp_util_interleave(float *const *input, uint8_t *output, int channels,
 			snd_pcm_format_t format, int frames);
 
+/* Writes in1 to out0 and in0 to out1, swapping the channels of a stereo
+ * pair of planes. The outputs may be the same buffers as the inputs.
+ * Args:
+ *    in0, in1 - The left and right input planes.
+ *    out0, out1 - The left and right output planes.
+ *    frames - The number of samples in each plane.
+ */
+void dsp_util_swap_stereo(const float *in0, const float *in1, float *out0,
+			  float *out1, int frames);
+
+/* Same as dsp_util_swap_stereo(), but writes -in0 to out0 and in1 to out1,
+ * inverting the phase of the left channel. */
+void dsp_util_invert_left(const float *in0, const float *in1, float *out0,
+			  float *out1, int frames);
+
+/* Same as dsp_util_swap_stereo(), but writes in0 + in1 to both outputs. */
+void dsp_util_mix_stereo(const float *in0, const float *in1, float *out0,
+			 float *out1, int frames);
+
+/* Adds gain * in to out, sample by sample.
+ * Args:
+ *    in - The plane to add.
+ *    out - The plane added to, must not overlap in.
+ *    gain - The gain applied to in.
+ *    frames - The number of samples in each plane.
+ */
+void dsp_util_accumulate(const float *in, float *out, float gain,
+			 int frames);
+
 /* Disables denormal numbers in floating point calculation. Denormal numbers
  * happens often in IIR filters, and it can be very slow.
  */
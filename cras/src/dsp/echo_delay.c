@@ -0,0 +1,217 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include "echo_delay.h"
+
+/* Samples per second of the envelopes, one lag step is 1ms. */
+#define ENV_RATE 1000
+/* Capture envelope samples correlated in a round, one second. */
+#define WINDOW ENV_RATE
+#define MAX_LAG (ECHO_DELAY_MAX_MS * ENV_RATE / 1000)
+#define PERIOD (ECHO_DELAY_PERIOD_MS * ENV_RATE / 1000)
+/* Envelope history, a power of 2 so indexes survive the counters
+ * wrapping. */
+#define RING 2048
+/* Lags correlated per update, a round spreads over 11 updates. */
+#define LAGS_PER_UPDATE 40
+/* Normalized correlation a peak needs to be trusted. */
+#define MIN_CORR 0.4f
+/* How close the peaks of two rounds must be to agree. */
+#define AGREE_MS 5
+/* Below this variance per sample an envelope is taken as silence. */
+#define MIN_VARIANCE 1e-7f
+
+/* The RMS envelope of a signal at ENV_RATE.
+ *    ring - The last RING envelope samples.
+ *    written - The number of envelope samples produced.
+ *    acc, n - The sum of squares and count of the input samples going
+ *        into the next envelope sample.
+ *    phase - Advances by ENV_RATE per input sample, an envelope sample is
+ *        produced each time it passes rate.
+ *    rate - The rate of the input.
+ */
+struct envelope {
+	float ring[RING];
+	unsigned int written;
+	float acc;
+	unsigned int n;
+	unsigned int phase;
+	int rate;
+};
+
+struct echo_delay {
+	struct envelope ref;
+	struct envelope cap;
+	/* Copies of the envelopes taken at the start of a round, with their
+	 * mean removed. ref_snap[MAX_LAG + i] is from the time of
+	 * cap_snap[i]. */
+	float cap_snap[WINDOW];
+	float ref_snap[MAX_LAG + WINDOW];
+	float cap_energy;
+	/* The next lag to correlate, -1 between rounds. */
+	int next_lag;
+	/* The value of cap.written at which the next round starts. */
+	unsigned int next_round;
+	float best_corr;
+	int best_lag;
+	/* The delay found by the last round, -1 if it had no clear peak. */
+	int candidate_ms;
+	int delay_ms;
+};
+
+struct echo_delay *echo_delay_new()
+{
+	struct echo_delay *ed;
+
+	ed = (struct echo_delay *)calloc(1, sizeof(*ed));
+	if (!ed)
+		return NULL;
+	ed->next_lag = -1;
+	ed->next_round = MAX_LAG + WINDOW;
+	ed->candidate_ms = -1;
+	ed->delay_ms = -1;
+	return ed;
+}
+
+void echo_delay_free(struct echo_delay *ed)
+{
+	free(ed);
+}
+
+static void envelope_add(struct envelope *env, const float *x, int count,
+			 int rate)
+{
+	int i;
+
+	if (rate <= 0)
+		return;
+	if (rate != env->rate) {
+		env->rate = rate;
+		env->acc = 0;
+		env->n = 0;
+		env->phase = 0;
+	}
+
+	for (i = 0; i < count; i++) {
+		env->acc += x[i] * x[i];
+		env->n++;
+		env->phase += ENV_RATE;
+		if (env->phase < (unsigned int)rate)
+			continue;
+		env->phase -= rate;
+		env->ring[env->written++ % RING] = sqrtf(env->acc / env->n);
+		env->acc = 0;
+		env->n = 0;
+	}
+}
+
+void echo_delay_add_reference(struct echo_delay *ed, const float *x,
+			      int count, int rate)
+{
+	envelope_add(&ed->ref, x, count, rate);
+}
+
+void echo_delay_add_capture(struct echo_delay *ed, const float *x, int count,
+			    int rate)
+{
+	envelope_add(&ed->cap, x, count, rate);
+}
+
+/* Copies the last count samples of env to dst, minus their mean. Returns
+ * their energy. */
+static float snapshot(const struct envelope *env, float *dst, int count)
+{
+	unsigned int start = env->written - count;
+	float mean = 0, energy = 0;
+	int i;
+
+	for (i = 0; i < count; i++) {
+		dst[i] = env->ring[(start + i) % RING];
+		mean += dst[i];
+	}
+	mean /= count;
+	for (i = 0; i < count; i++) {
+		dst[i] -= mean;
+		energy += dst[i] * dst[i];
+	}
+	return energy;
+}
+
+static void start_round(struct echo_delay *ed)
+{
+	float ref_energy;
+
+	ed->next_round = ed->cap.written + PERIOD;
+	ed->cap_energy = snapshot(&ed->cap, ed->cap_snap, WINDOW);
+	ref_energy = snapshot(&ed->ref, ed->ref_snap, MAX_LAG + WINDOW);
+
+	/* Nothing to learn without playback, or with a muted mic. */
+	if (ed->cap_energy < MIN_VARIANCE * WINDOW ||
+	    ref_energy < MIN_VARIANCE * (MAX_LAG + WINDOW))
+		return;
+	ed->next_lag = 0;
+	ed->best_corr = 0;
+	ed->best_lag = 0;
+}
+
+static void finish_round(struct echo_delay *ed)
+{
+	int ms = ed->best_lag * 1000 / ENV_RATE;
+
+	ed->next_lag = -1;
+	if (ed->best_corr < MIN_CORR) {
+		ed->candidate_ms = -1;
+		return;
+	}
+	if (ed->candidate_ms >= 0 && abs(ms - ed->candidate_ms) <= AGREE_MS)
+		ed->delay_ms = ms;
+	ed->candidate_ms = ms;
+}
+
+void echo_delay_update(struct echo_delay *ed)
+{
+	const float *ref;
+	float corr, energy;
+	int lag, end, i;
+
+	if (ed->next_lag < 0) {
+		/* Wait for a full window of both signals. */
+		if ((int)(ed->cap.written - ed->next_round) < 0 ||
+		    ed->ref.written < MAX_LAG + WINDOW)
+			return;
+		start_round(ed);
+		return;
+	}
+
+	end = ed->next_lag + LAGS_PER_UPDATE;
+	if (end > MAX_LAG + 1)
+		end = MAX_LAG + 1;
+	for (lag = ed->next_lag; lag < end; lag++) {
+		ref = ed->ref_snap + MAX_LAG - lag;
+		corr = 0;
+		energy = 0;
+		for (i = 0; i < WINDOW; i++) {
+			corr += ed->cap_snap[i] * ref[i];
+			energy += ref[i] * ref[i];
+		}
+		if (energy <= 0)
+			continue;
+		corr /= sqrtf(energy * ed->cap_energy);
+		if (corr > ed->best_corr) {
+			ed->best_corr = corr;
+			ed->best_lag = lag;
+		}
+	}
+	ed->next_lag = end;
+	if (end > MAX_LAG)
+		finish_round(ed);
+}
+
+int echo_delay_get_ms(const struct echo_delay *ed)
+{
+	return ed->delay_ms;
+}
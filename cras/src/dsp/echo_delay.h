@@ -0,0 +1,67 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef ECHO_DELAY_H_
+#define ECHO_DELAY_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Estimates how long the echo of the playback takes to come back in the
+ * capture, so the echo reference can be delayed to match it.
+ *
+ * Both signals are reduced to their RMS envelope at 1kHz, which is cheap to
+ * correlate and doesn't depend on the phase response of the speaker, the
+ * room or the microphone. Every ECHO_DELAY_PERIOD_MS the last second of
+ * the capture envelope is correlated with the reference envelope at every
+ * lag up to ECHO_DELAY_MAX_MS. The work is spread over the following
+ * updates so each one stays short. A delay is only reported once two
+ * rounds with a clear correlation peak agree on it.
+ */
+
+/* The longest delay looked for. Bluetooth outputs can exceed 200ms. */
+#define ECHO_DELAY_MAX_MS 400
+/* Time between the starts of two rounds of estimation. */
+#define ECHO_DELAY_PERIOD_MS 2000
+
+struct echo_delay;
+
+/* Create an estimator with no delay known yet.
+ * Returns:
+ *    The estimator, or NULL on allocation failure.
+ */
+struct echo_delay *echo_delay_new();
+
+/* Free an estimator. */
+void echo_delay_free(struct echo_delay *ed);
+
+/* Adds samples of the echo reference, the audio sent to the speaker.
+ * Args:
+ *    ed - The estimator.
+ *    x - The samples of one channel.
+ *    count - The number of samples in x.
+ *    rate - The sample rate of x.
+ */
+void echo_delay_add_reference(struct echo_delay *ed, const float *x,
+			      int count, int rate);
+
+/* Adds samples of the capture, which holds the echo. The arguments are as
+ * those of echo_delay_add_reference.
+ */
+void echo_delay_add_capture(struct echo_delay *ed, const float *x, int count,
+			    int rate);
+
+/* Runs a slice of the estimation. Call after each block of capture. */
+void echo_delay_update(struct echo_delay *ed);
+
+/* Returns the estimated delay in ms, or -1 if it is unknown. */
+int echo_delay_get_ms(const struct echo_delay *ed);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* ECHO_DELAY_H_ */
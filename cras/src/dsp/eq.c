@@ -9,6 +9,11 @@
 struct eq {
 	int n;
 	struct biquad biquad[MAX_BIQUADS_PER_EQ];
+
+	/* The coefficients the biquads move to, and the number of frames left
+	 * until they get there. See eq_set_biquad(). */
+	struct biquad target[MAX_BIQUADS_PER_EQ];
+	int interp_left;
 };
 
 struct eq *eq_new()
@@ -27,7 +32,9 @@ int eq_append_biquad(struct eq *eq, enum biquad_type type, float freq, float Q,
 {
 	if (eq->n >= MAX_BIQUADS_PER_EQ)
 		return -1;
-	biquad_set(&eq->biquad[eq->n++], type, freq, Q, gain);
+	biquad_set(&eq->biquad[eq->n], type, freq, Q, gain);
+	eq->target[eq->n] = eq->biquad[eq->n];
+	eq->n++;
 	return 0;
 }
 
@@ -35,10 +42,25 @@ int eq_append_biquad_direct(struct eq *eq, const struct biquad *biquad)
 {
 	if (eq->n >= MAX_BIQUADS_PER_EQ)
 		return -1;
+	eq->target[eq->n] = *biquad;
 	eq->biquad[eq->n++] = *biquad;
 	return 0;
 }
 
+int eq_set_biquad(struct eq *eq, int index, enum biquad_type type, float freq,
+		  float Q, float gain)
+{
+	if (index < 0 || index >= MAX_BIQUADS_PER_EQ || index > eq->n)
+		return -1;
+	if (index == eq->n) {
+		biquad_set(&eq->biquad[index], BQ_NONE, 0, 0, 0);
+		eq->n++;
+	}
+	biquad_set(&eq->target[index], type, freq, Q, gain);
+	eq->interp_left = BIQUAD_INTERP_FRAMES;
+	return 0;
+}
+
 /* This is the prototype of the processing loop. */
 void eq_process1(struct eq *eq, float *data, int count)
 {
@@ -73,7 +95,7 @@ void eq_process1(struct eq *eq, float *data, int count)
 
 /* This is the actual processing loop used. It is the unrolled version of the
  * above prototype. */
-void eq_process(struct eq *eq, float *data, int count)
+static void eq_process_block(struct eq *eq, float *data, int count)
 {
 	int i, j;
 	for (i = 0; i < eq->n; i += 2) {
@@ -146,3 +168,21 @@ void eq_process(struct eq *eq, float *data, int count)
 		}
 	}
 }
+
+void eq_process(struct eq *eq, float *data, int count)
+{
+	int i, chunk;
+
+	while (eq->interp_left > 0 && count > 0) {
+		chunk = count < BIQUAD_INTERP_BLOCK ? count :
+						      BIQUAD_INTERP_BLOCK;
+		for (i = 0; i < eq->n; i++)
+			biquad_interpolate(&eq->biquad[i], &eq->target[i],
+					   (float)chunk / eq->interp_left);
+		eq->interp_left -= chunk;
+		eq_process_block(eq, data, chunk);
+		data += chunk;
+		count -= chunk;
+	}
+	eq_process_block(eq, data, count);
+}
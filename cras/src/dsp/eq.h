@@ -52,6 +52,20 @@ int eq_append_biquad(struct eq *eq, enum biquad_type type, float freq, float Q,
  */
 int eq_append_biquad_direct(struct eq *eq, const struct biquad *biquad);
 
+/* Change the parameters of a biquad filter of an EQ while it runs. The
+ * coefficients move to the new values over BIQUAD_INTERP_FRAMES frames of
+ * eq_process() and the filter state is kept, so the output doesn't jump.
+ * Args:
+ *    eq - The EQ we want to use.
+ *    index - The biquad to change. If it's the number of biquads, an
+ *        identity filter is appended and moves to the new parameters.
+ *    type, frequency, Q, gain - Same as eq_append_biquad().
+ * Returns:
+ *    0 if the biquad is changed, -1 if index is out of range.
+ */
+int eq_set_biquad(struct eq *eq, int index, enum biquad_type type, float freq,
+		  float Q, float gain);
+
 /* Process a buffer of audio data through the EQ.
  * Args:
  *    eq - The EQ we want to use.
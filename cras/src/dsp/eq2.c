@@ -9,6 +9,11 @@
 struct eq2 {
 	int n[2];
 	struct biquad biquad[MAX_BIQUADS_PER_EQ2][2];
+
+	/* The coefficients the biquads move to, and the number of frames left
+	 * until they get there. See eq2_set_biquad(). */
+	struct biquad target[MAX_BIQUADS_PER_EQ2][2];
+	int interp_left;
 };
 
 struct eq2 *eq2_new()
@@ -19,8 +24,10 @@ struct eq2 *eq2_new()
 	/* Initialize all biquads to identity filter, so if two channels have
 	 * different numbers of biquads, it still works. */
 	for (i = 0; i < MAX_BIQUADS_PER_EQ2; i++)
-		for (j = 0; j < 2; j++)
+		for (j = 0; j < 2; j++) {
 			biquad_set(&eq2->biquad[i][j], BQ_NONE, 0, 0, 0);
+			eq2->target[i][j] = eq2->biquad[i][j];
+		}
 
 	return eq2;
 }
@@ -33,10 +40,13 @@ void eq2_free(struct eq2 *eq2)
 int eq2_append_biquad(struct eq2 *eq2, int channel, enum biquad_type type,
 		      float freq, float Q, float gain)
 {
-	if (eq2->n[channel] >= MAX_BIQUADS_PER_EQ2)
+	int n = eq2->n[channel];
+
+	if (n >= MAX_BIQUADS_PER_EQ2)
 		return -1;
-	biquad_set(&eq2->biquad[eq2->n[channel]++][channel], type, freq, Q,
-		   gain);
+	biquad_set(&eq2->biquad[n][channel], type, freq, Q, gain);
+	eq2->target[n][channel] = eq2->biquad[n][channel];
+	eq2->n[channel]++;
 	return 0;
 }
 
@@ -45,10 +55,24 @@ int eq2_append_biquad_direct(struct eq2 *eq2, int channel,
 {
 	if (eq2->n[channel] >= MAX_BIQUADS_PER_EQ2)
 		return -1;
+	eq2->target[eq2->n[channel]][channel] = *biquad;
 	eq2->biquad[eq2->n[channel]++][channel] = *biquad;
 	return 0;
 }
 
+int eq2_set_biquad(struct eq2 *eq2, int channel, int index,
+		   enum biquad_type type, float freq, float Q, float gain)
+{
+	if (index < 0 || index >= MAX_BIQUADS_PER_EQ2 ||
+	    index > eq2->n[channel])
+		return -1;
+	if (index == eq2->n[channel])
+		eq2->n[channel]++;
+	biquad_set(&eq2->target[index][channel], type, freq, Q, gain);
+	eq2->interp_left = BIQUAD_INTERP_FRAMES;
+	return 0;
+}
+
 static inline void eq2_process_one(struct biquad (*bq)[2], float *data0,
 				   float *data1, int count)
 {
@@ -314,7 +338,8 @@ static inline void eq2_process_two_sse3(struct biquad (*bq)[2], float *data0,
 }
 #endif
 
-void eq2_process(struct eq2 *eq2, float *data0, float *data1, int count)
+static void eq2_process_block(struct eq2 *eq2, float *data0, float *data1,
+			      int count)
 {
 	int i;
 	int n;
@@ -341,3 +366,27 @@ void eq2_process(struct eq2 *eq2, float *data0, float *data1, int count)
 		}
 	}
 }
+
+void eq2_process(struct eq2 *eq2, float *data0, float *data1, int count)
+{
+	int i, chunk;
+	float frac;
+
+	while (eq2->interp_left > 0 && count > 0) {
+		chunk = count < BIQUAD_INTERP_BLOCK ? count :
+						      BIQUAD_INTERP_BLOCK;
+		frac = (float)chunk / eq2->interp_left;
+		for (i = 0; i < MAX_BIQUADS_PER_EQ2; i++) {
+			biquad_interpolate(&eq2->biquad[i][0],
+					   &eq2->target[i][0], frac);
+			biquad_interpolate(&eq2->biquad[i][1],
+					   &eq2->target[i][1], frac);
+		}
+		eq2->interp_left -= chunk;
+		eq2_process_block(eq2, data0, data1, chunk);
+		data0 += chunk;
+		data1 += chunk;
+		count -= chunk;
+	}
+	eq2_process_block(eq2, data0, data1, count);
+}
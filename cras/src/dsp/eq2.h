@@ -55,6 +55,22 @@ int eq2_append_biquad(struct eq2 *eq2, int channel, enum biquad_type type,
 int eq2_append_biquad_direct(struct eq2 *eq2, int channel,
 			     const struct biquad *biquad);
 
+/* Change the parameters of a biquad filter of an EQ2 while it runs. The
+ * coefficients move to the new values over BIQUAD_INTERP_FRAMES frames of
+ * eq2_process() and the filter state is kept, so the output doesn't jump.
+ * Args:
+ *    eq2 - The EQ2 we want to use.
+ *    channel - 0 or 1. The channel of the filter.
+ *    index - The biquad to change. If it's the number of biquads of the
+ *        channel, an identity filter is appended and moves to the new
+ *        parameters.
+ *    type, frequency, Q, gain - Same as eq2_append_biquad().
+ * Returns:
+ *    0 if the biquad is changed, -1 if index is out of range.
+ */
+int eq2_set_biquad(struct eq2 *eq2, int channel, int index,
+		   enum biquad_type type, float freq, float Q, float gain);
+
 /* Process a buffer of audio data through the EQ2.
  * Args:
  *    eq2 - The EQ2 we want to use.
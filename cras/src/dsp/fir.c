@@ -0,0 +1,387 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include "fir.h"
+
+/*
+ * The real FFTs have size N = 2 * block_size and are done with a complex
+ * FFT of size M = block_size on the samples packed in pairs, two real
+ * values to one complex. The spectra then have M + 1 bins, kept with the
+ * real and imaginary parts in separate arrays so the multiply-accumulate
+ * runs on four bins at a time.
+ */
+struct fir {
+	int block_size;
+	int num_partitions;
+	/* Distance between two spectra, M + 1 rounded up to a multiple of
+	 * four floats. */
+	int stride;
+	/* exp(-2 pi i k / M) for k < M / 2, used by the complex FFT. */
+	float *twiddle_re;
+	float *twiddle_im;
+	/* exp(-pi i k / M) for k <= M, used to split the packed spectrum. */
+	float *split_re;
+	float *split_im;
+	/* Bit reversed index of each of the M points. */
+	int *bitrev;
+	/* The spectra of the impulse response partitions. */
+	float *h_re;
+	float *h_im;
+	/* The spectra of the last num_partitions input blocks, newest at
+	 * head. */
+	float *x_re;
+	float *x_im;
+	int head;
+	float *acc_re;
+	float *acc_im;
+	/* The complex FFT work buffer. */
+	float *work_re;
+	float *work_im;
+	/* The previous and the current input blocks. */
+	float *in;
+	/* The output of the inverse FFT, its second half is the output of
+	 * the current block. */
+	float *time;
+	/* The number of samples of the current block received so far. */
+	int pos;
+};
+
+static void fft_butterflies(const struct fir *fir, float *re, float *im)
+{
+	int m = fir->block_size;
+	int size, half, step, start, j;
+
+	for (size = 2; size <= m; size <<= 1) {
+		half = size >> 1;
+		step = m / size;
+		for (start = 0; start < m; start += size) {
+			for (j = 0; j < half; j++) {
+				int a = start + j;
+				int b = a + half;
+				float wr = fir->twiddle_re[j * step];
+				float wi = fir->twiddle_im[j * step];
+				float tr = wr * re[b] - wi * im[b];
+				float ti = wr * im[b] + wi * re[b];
+
+				re[b] = re[a] - tr;
+				im[b] = im[a] - ti;
+				re[a] += tr;
+				im[a] += ti;
+			}
+		}
+	}
+}
+
+/* Transforms the 2 * block_size real samples in x to block_size + 1 bins. */
+static void rfft(struct fir *fir, const float *x, float *out_re,
+		 float *out_im)
+{
+	int m = fir->block_size;
+	float *re = fir->work_re;
+	float *im = fir->work_im;
+	int k;
+
+	for (k = 0; k < m; k++) {
+		re[fir->bitrev[k]] = x[2 * k];
+		im[fir->bitrev[k]] = x[2 * k + 1];
+	}
+	fft_butterflies(fir, re, im);
+
+	/* X[k] = E[k] + W^k O[k], where E and O are the spectra of the even
+	 * and odd samples and Z[k] = E[k] + i O[k]. */
+	for (k = 0; k <= m; k++) {
+		int a = k & (m - 1);
+		int b = (m - k) & (m - 1);
+		float e_re = 0.5f * (re[a] + re[b]);
+		float e_im = 0.5f * (im[a] - im[b]);
+		float o_re = 0.5f * (im[a] + im[b]);
+		float o_im = -0.5f * (re[a] - re[b]);
+		float wr = fir->split_re[k];
+		float wi = fir->split_im[k];
+
+		out_re[k] = e_re + wr * o_re - wi * o_im;
+		out_im[k] = e_im + wr * o_im + wi * o_re;
+	}
+}
+
+/* Transforms block_size + 1 bins back to 2 * block_size real samples,
+ * scaled by 2 * block_size. */
+static void irfft(struct fir *fir, const float *in_re, const float *in_im,
+		  float *x)
+{
+	int m = fir->block_size;
+	float *re = fir->work_re;
+	float *im = fir->work_im;
+	int k;
+
+	/* Rebuild Z[k] = E[k] + i O[k], conjugated so the forward FFT does
+	 * the inverse transform. */
+	for (k = 0; k < m; k++) {
+		float e_re = in_re[k] + in_re[m - k];
+		float e_im = in_im[k] - in_im[m - k];
+		float dr = in_re[k] - in_re[m - k];
+		float di = in_im[k] + in_im[m - k];
+		float wr = fir->split_re[k];
+		float wi = -fir->split_im[k];
+		float o_re = dr * wr - di * wi;
+		float o_im = dr * wi + di * wr;
+
+		re[fir->bitrev[k]] = e_re - o_im;
+		im[fir->bitrev[k]] = -(e_im + o_re);
+	}
+	fft_butterflies(fir, re, im);
+
+	for (k = 0; k < m; k++) {
+		x[2 * k] = re[k];
+		x[2 * k + 1] = -im[k];
+	}
+}
+
+/* acc += a * b over n complex values. */
+#if defined(__ARM_NEON__)
+#include <arm_neon.h>
+static void cmac(float *acc_re, float *acc_im, const float *a_re,
+		 const float *a_im, const float *b_re, const float *b_im, int n)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		float32x4_t ar = vld1q_f32(a_re + i);
+		float32x4_t ai = vld1q_f32(a_im + i);
+		float32x4_t br = vld1q_f32(b_re + i);
+		float32x4_t bi = vld1q_f32(b_im + i);
+		float32x4_t r = vld1q_f32(acc_re + i);
+		float32x4_t m = vld1q_f32(acc_im + i);
+
+		r = vmlaq_f32(r, ar, br);
+		r = vmlsq_f32(r, ai, bi);
+		m = vmlaq_f32(m, ar, bi);
+		m = vmlaq_f32(m, ai, br);
+		vst1q_f32(acc_re + i, r);
+		vst1q_f32(acc_im + i, m);
+	}
+	for (; i < n; i++) {
+		acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+		acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+	}
+}
+#elif defined(__SSE3__)
+#include <emmintrin.h>
+static void cmac(float *acc_re, float *acc_im, const float *a_re,
+		 const float *a_im, const float *b_re, const float *b_im, int n)
+{
+	int i;
+
+	for (i = 0; i + 4 <= n; i += 4) {
+		__m128 ar = _mm_load_ps(a_re + i);
+		__m128 ai = _mm_load_ps(a_im + i);
+		__m128 br = _mm_load_ps(b_re + i);
+		__m128 bi = _mm_load_ps(b_im + i);
+		__m128 r = _mm_load_ps(acc_re + i);
+		__m128 m = _mm_load_ps(acc_im + i);
+
+		r = _mm_add_ps(r, _mm_sub_ps(_mm_mul_ps(ar, br),
+					     _mm_mul_ps(ai, bi)));
+		m = _mm_add_ps(m, _mm_add_ps(_mm_mul_ps(ar, bi),
+					     _mm_mul_ps(ai, br)));
+		_mm_store_ps(acc_re + i, r);
+		_mm_store_ps(acc_im + i, m);
+	}
+	for (; i < n; i++) {
+		acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+		acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+	}
+}
+#else
+static void cmac(float *acc_re, float *acc_im, const float *a_re,
+		 const float *a_im, const float *b_re, const float *b_im, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++) {
+		acc_re[i] += a_re[i] * b_re[i] - a_im[i] * b_im[i];
+		acc_im[i] += a_re[i] * b_im[i] + a_im[i] * b_re[i];
+	}
+}
+#endif
+
+/* Filters the block in the second half of fir->in. */
+static void process_block(struct fir *fir)
+{
+	int b = fir->block_size;
+	int n = b + 1;
+	int p, idx;
+
+	fir->head = (fir->head + 1) % fir->num_partitions;
+	rfft(fir, fir->in, fir->x_re + fir->head * fir->stride,
+	     fir->x_im + fir->head * fir->stride);
+
+	memset(fir->acc_re, 0, sizeof(float) * fir->stride);
+	memset(fir->acc_im, 0, sizeof(float) * fir->stride);
+	idx = fir->head;
+	for (p = 0; p < fir->num_partitions; p++) {
+		cmac(fir->acc_re, fir->acc_im, fir->x_re + idx * fir->stride,
+		     fir->x_im + idx * fir->stride,
+		     fir->h_re + p * fir->stride, fir->h_im + p * fir->stride,
+		     n);
+		idx = idx ? idx - 1 : fir->num_partitions - 1;
+	}
+
+	/* The first half of the result wraps around, keep the second. */
+	irfft(fir, fir->acc_re, fir->acc_im, fir->time);
+	memcpy(fir->in, fir->in + b, sizeof(float) * b);
+}
+
+static float *alloc_floats(size_t count)
+{
+	void *p;
+
+	if (posix_memalign(&p, 16, count * sizeof(float)))
+		return NULL;
+	memset(p, 0, count * sizeof(float));
+	return (float *)p;
+}
+
+struct fir *fir_new(const float *ir, int ir_len, int block_size)
+{
+	struct fir *fir;
+	int b = block_size;
+	int bits, i, j, p, n;
+	float scale;
+
+	if (!ir || ir_len <= 0 || b < 4 || (b & (b - 1)))
+		return NULL;
+
+	fir = (struct fir *)calloc(1, sizeof(*fir));
+	if (!fir)
+		return NULL;
+	fir->block_size = b;
+	fir->num_partitions = (ir_len + b - 1) / b;
+	fir->stride = (b + 1 + 3) & ~3;
+	p = fir->num_partitions;
+
+	fir->twiddle_re = alloc_floats(b / 2);
+	fir->twiddle_im = alloc_floats(b / 2);
+	fir->split_re = alloc_floats(b + 1);
+	fir->split_im = alloc_floats(b + 1);
+	fir->bitrev = (int *)calloc(b, sizeof(int));
+	fir->h_re = alloc_floats((size_t)p * fir->stride);
+	fir->h_im = alloc_floats((size_t)p * fir->stride);
+	fir->x_re = alloc_floats((size_t)p * fir->stride);
+	fir->x_im = alloc_floats((size_t)p * fir->stride);
+	fir->acc_re = alloc_floats(fir->stride);
+	fir->acc_im = alloc_floats(fir->stride);
+	fir->work_re = alloc_floats(b);
+	fir->work_im = alloc_floats(b);
+	fir->in = alloc_floats(2 * b);
+	fir->time = alloc_floats(2 * b);
+	if (!fir->twiddle_re || !fir->twiddle_im || !fir->split_re ||
+	    !fir->split_im || !fir->bitrev || !fir->h_re || !fir->h_im ||
+	    !fir->x_re || !fir->x_im || !fir->acc_re || !fir->acc_im ||
+	    !fir->work_re || !fir->work_im || !fir->in || !fir->time) {
+		fir_free(fir);
+		return NULL;
+	}
+
+	for (i = 0; i < b / 2; i++) {
+		fir->twiddle_re[i] = cos(-2 * M_PI * i / b);
+		fir->twiddle_im[i] = sin(-2 * M_PI * i / b);
+	}
+	for (i = 0; i <= b; i++) {
+		fir->split_re[i] = cos(-M_PI * i / b);
+		fir->split_im[i] = sin(-M_PI * i / b);
+	}
+	for (bits = 0; (1 << bits) < b; bits++)
+		;
+	for (i = 0; i < b; i++) {
+		int r = 0;
+		for (j = 0; j < bits; j++)
+			if (i & (1 << j))
+				r |= 1 << (bits - 1 - j);
+		fir->bitrev[i] = r;
+	}
+
+	/* Each partition is zero padded to 2 * block_size taps. The scale
+	 * of the inverse transform is folded in. */
+	scale = 1.0f / (2 * b);
+	for (i = 0; i < p; i++) {
+		n = ir_len - i * b;
+		if (n > b)
+			n = b;
+		memset(fir->time, 0, sizeof(float) * 2 * b);
+		for (j = 0; j < n; j++)
+			fir->time[j] = ir[i * b + j] * scale;
+		rfft(fir, fir->time, fir->h_re + i * fir->stride,
+		     fir->h_im + i * fir->stride);
+	}
+	memset(fir->time, 0, sizeof(float) * 2 * b);
+
+	return fir;
+}
+
+void fir_free(struct fir *fir)
+{
+	if (!fir)
+		return;
+	free(fir->twiddle_re);
+	free(fir->twiddle_im);
+	free(fir->split_re);
+	free(fir->split_im);
+	free(fir->bitrev);
+	free(fir->h_re);
+	free(fir->h_im);
+	free(fir->x_re);
+	free(fir->x_im);
+	free(fir->acc_re);
+	free(fir->acc_im);
+	free(fir->work_re);
+	free(fir->work_im);
+	free(fir->in);
+	free(fir->time);
+	free(fir);
+}
+
+int fir_get_delay(const struct fir *fir)
+{
+	return fir->block_size;
+}
+
+void fir_process(struct fir *fir, float *data, int count)
+{
+	int b = fir->block_size;
+	float *in = fir->in + b;
+	float *out = fir->time + b;
+	int n, i;
+
+	while (count > 0) {
+		n = b - fir->pos;
+		if (n > count)
+			n = count;
+		for (i = 0; i < n; i++) {
+			float x = data[i];
+			data[i] = out[fir->pos + i];
+			in[fir->pos + i] = x;
+		}
+		fir->pos += n;
+		data += n;
+		count -= n;
+		if (fir->pos == b) {
+			process_block(fir);
+			fir->pos = 0;
+		}
+	}
+}
+
+void fir_process_block(struct fir *fir, float *data)
+{
+	int b = fir->block_size;
+
+	memcpy(fir->in + b, data, sizeof(float) * b);
+	process_block(fir);
+	memcpy(data, fir->time + b, sizeof(float) * b);
+}
@@ -0,0 +1,65 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef FIR_H_
+#define FIR_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* A FIR filter convolving the audio with an impulse response.
+ *
+ * It uses uniform partitioned overlap-save convolution: the impulse
+ * response is split in blocks of block_size taps, each one is transformed
+ * once with an FFT of twice that size, and every block_size input samples
+ * one forward FFT, one complex multiply-accumulate per partition and one
+ * inverse FFT produce block_size output samples. The work per block grows
+ * with the number of partitions instead of the number of taps, and the
+ * output is delayed by block_size samples.
+ */
+
+struct fir;
+
+/* Create a FIR filter.
+ * Args:
+ *    ir - The impulse response.
+ *    ir_len - The number of taps in ir.
+ *    block_size - The partition size, a power of two of at least 4. This
+ *        is also the latency of the filter in samples.
+ * Returns:
+ *    The filter, or NULL if the arguments are invalid or on allocation
+ *    failure.
+ */
+struct fir *fir_new(const float *ir, int ir_len, int block_size);
+
+/* Free a FIR filter. */
+void fir_free(struct fir *fir);
+
+/* Returns the latency of the filter in samples. */
+int fir_get_delay(const struct fir *fir);
+
+/* Process a buffer of audio data through the filter.
+ * Args:
+ *    fir - The filter we want to use.
+ *    data - The array of audio samples, processed in place.
+ *    count - The number of elements in the data array to process.
+ */
+void fir_process(struct fir *fir, float *data, int count);
+
+/* Process exactly one block of block_size samples in place, without the
+ * delay fir_process() adds to gather a block. Must not be mixed with
+ * fir_process() on the same filter.
+ * Args:
+ *    fir - The filter we want to use.
+ *    data - The block_size samples to process.
+ */
+void fir_process_block(struct fir *fir, float *data);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* FIR_H_ */
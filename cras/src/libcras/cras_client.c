@@ -32,12 +32,14 @@
 #include <pthread.h>
 #include <stdbool.h>
 #include <stdint.h>
+#include <sys/epoll.h>
 #include <sys/eventfd.h>
 #include <sys/ipc.h>
 #include <sys/mman.h>
 #include <sys/param.h>
 #include <sys/signal.h>
 #include <sys/socket.h>
+#include <sys/stat.h>
 #include <sys/timerfd.h>
 #include <sys/types.h>
 #include <sys/un.h>
@@ -47,9 +49,11 @@
 #include "cras_client.h"
 #include "cras_config.h"
 #include "cras_file_wait.h"
+#include "cras_id_map.h"
 #include "cras_messages.h"
 #include "cras_observer_ops.h"
 #include "cras_shm.h"
+#include "cras_timebase.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "utlist.h"
@@ -59,20 +63,40 @@ static const size_t SERVER_SHUTDOWN_TIMEOUT_US = 500000;
 static const size_t SERVER_CONNECT_TIMEOUT_MS = 1000;
 static const size_t HOTWORD_FRAME_RATE = 16000;
 static const size_t HOTWORD_BLOCK_SIZE = 320;
+#define SHARED_THREAD_MAX_EVENTS 16
 
 /* Commands sent from the user to the running client. */
 enum { CLIENT_STOP,
        CLIENT_ADD_STREAM,
        CLIENT_REMOVE_STREAM,
+       CLIENT_DRAIN_STREAM,
        CLIENT_SET_STREAM_VOLUME_SCALER,
        CLIENT_SERVER_CONNECT,
        CLIENT_SERVER_CONNECT_ASYNC,
 };
 
+/* A command, with async non-zero when the result goes in a completion with
+ * tag instead of the reply pipe. */
 struct command_msg {
 	unsigned len;
 	unsigned msg_id;
 	cras_stream_id_t stream_id;
+	int async;
+	uint64_t tag;
+};
+
+/* A completion of an asynchronous command in the queue. */
+struct completion_entry {
+	struct cras_client_completion completion;
+	struct completion_entry *prev, *next;
+};
+
+/* A stream removed with cras_client_drain_stream_async() that the server has
+ * yet to report played out. */
+struct pending_drain {
+	cras_stream_id_t stream_id;
+	uint64_t tag;
+	struct pending_drain *prev, *next;
 };
 
 struct set_stream_volume_command_message {
@@ -148,6 +172,11 @@ struct cras_stream_params {
  * tid - Thread id of the audio thread spawned for this stream.
  * running - Audio thread runs while this is non-zero.
  * wake_fds - Pipe to wake the audio thread.
+ * doorbell_seq - The doorbell_seq in shm of the last message handled, when the
+ *    server rings the doorbell instead of using aud_fd.
+ * shared - The shared audio thread servicing this stream, NULL when it has
+ *    an audio thread of its own.
+ * dev_idx - The device the stream is pinned to, or NO_DEVICE.
  * client - The client this stream is attached to.
  * config - Audio stream configuration.
  * shm - Shared memory used to exchange audio samples with the server.
@@ -161,12 +190,40 @@ struct client_stream {
 	float volume_scaler;
 	struct thread_state thread;
 	int wake_fds[2]; /* Pipe to wake the thread */
+	uint32_t doorbell_seq;
+	struct shared_aud_thread *shared;
+	uint32_t dev_idx;
 	struct cras_client *client;
 	struct cras_stream_params *config;
 	struct cras_audio_shm *shm;
 	struct client_stream *prev, *next;
 };
 
+/* A thread of the pool servicing all the streams of a client, see
+ * cras_client_set_shared_audio_threads.
+ * tid - Thread id.
+ * epoll_fd - Polls the aud_fd of the streams serviced.
+ * wake_fd - Eventfd to wake the thread to stop.
+ * lock - Held while servicing streams, so they aren't removed meanwhile.
+ * streams - The streams serviced, num_streams of them in an array of
+ *    max_streams.
+ * num_assigned - The streams assigned to this thread, connected or not.
+ * running - The thread runs while this is non-zero.
+ * client - The client the streams are attached to.
+ */
+struct shared_aud_thread {
+	pthread_t tid;
+	int epoll_fd;
+	int wake_fd;
+	pthread_mutex_t lock;
+	struct client_stream **streams;
+	unsigned int num_streams;
+	unsigned int max_streams;
+	unsigned int num_assigned;
+	int running;
+	struct cras_client *client;
+};
+
 /* State of the socket. */
 typedef enum cras_socket_state {
 	CRAS_SOCKET_STATE_DISCONNECTED,
@@ -207,6 +264,7 @@ typedef enum cras_socket_state {
  * tid - Thread ID of the client thread started by "cras_client_run_thread".
  * last_command_result - Passes back the result of the last user command.
  * streams - Linked list of streams attached to this client.
+ * stream_index - Maps the id of each entry in streams to it.
  * server_state - RO shared memory region holding server state.
  * atlog_ro - RO shared memory region holding audio thread log.
  * debug_info_callback - Function to call when debug info is received.
@@ -215,8 +273,31 @@ typedef enum cras_socket_state {
  * server_connection_cb - Function to called when a connection state changes.
  * server_connection_user_arg - User argument for server_connection_cb.
  * thread_priority_cb - Function to call for setting audio thread priority.
+ * num_shared_threads - The number of threads servicing all streams, 0 for an
+ *    audio thread per stream.
+ * shared_threads - The shared audio threads, started with the first stream.
+ * completion_cb - Function to call when an asynchronous command completes.
+ * completion_cb_arg - User argument for completion_cb.
+ * completion_fd - Semaphore eventfd counting the completions queued.
+ * completion_lock - Lock for the queue of completions.
+ * completions - Completions queued without completion_cb.
+ * batch_lock - Lock for the batch of held control messages.
+ * batch_depth - Nesting depth of cras_client_begin_batch() calls.
+ * batch - Control messages held to send together, see batch_buf.
+ * batch_buf - Storage for batch, sized for the server's message buffer.
+ * batch_fds - Copies of the fds of the stream connects held in batch.
+ * num_batch_fds - Number of fds in batch_fds.
+ * observer_event_fd - Eventfd the server signals after adding observer
+ *    events to the ring in server_state, -1 until received.
+ * observer_event_fd_callback - Function to call when observer_event_fd is
+ *    received.
  * observer_ops - Functions to call when system state changes.
  * observer_context - Context passed to client in state change callbacks.
+ * resume_id - The id the streams paused by a lost connection were added
+ *    with, -1 when no streams are paused.
+ * resume_pending - Set while waiting for the server to give resume_id back.
+ * pending_drains - Streams being drained, completed when the server reports
+ *    them played out. Only used by the client thread.
  */
 struct cras_client {
 	int id;
@@ -235,6 +316,7 @@ struct cras_client {
 	pthread_mutex_t stream_start_lock;
 	int last_command_result;
 	struct client_stream *streams;
+	struct cras_id_map *stream_index;
 	const struct cras_server_state *server_state;
 	struct audio_thread_event_log *atlog_ro;
 	void (*debug_info_callback)(struct cras_client *);
@@ -243,8 +325,26 @@ struct cras_client {
 	cras_connection_status_cb_t server_connection_cb;
 	void *server_connection_user_arg;
 	cras_thread_priority_cb_t thread_priority_cb;
+	unsigned int num_shared_threads;
+	struct shared_aud_thread *shared_threads;
+	cras_client_completion_cb_t completion_cb;
+	void *completion_cb_arg;
+	int completion_fd;
+	pthread_mutex_t completion_lock;
+	struct completion_entry *completions;
+	pthread_mutex_t batch_lock;
+	unsigned int batch_depth;
+	struct cras_server_batch *batch;
+	uint8_t batch_buf[CRAS_SERV_MAX_MSG_SIZE];
+	int batch_fds[CRAS_SERV_MAX_MSG_FDS];
+	unsigned int num_batch_fds;
+	int observer_event_fd;
+	void (*observer_event_fd_callback)(struct cras_client *);
 	struct cras_observer_ops observer_ops;
 	void *observer_context;
+	int resume_id;
+	bool resume_pending;
+	struct pending_drain *pending_drains;
 };
 
 /*
@@ -368,8 +468,20 @@ void libcras_stream_cb_data_destroy(struct libcras_stream_cb_data *data)
 
 static int client_thread_rm_stream(struct cras_client *client,
 				   cras_stream_id_t stream_id);
+static void pause_stream(struct client_stream *stream);
+static void fail_paused_streams(struct cras_client *client);
+static void complete_drain(struct cras_client *client,
+			   cras_stream_id_t stream_id, int rc);
+static void fail_pending_drains(struct cras_client *client, int rc);
+static void resume_streams(struct cras_client *client);
+static int request_resume(struct cras_client *client);
 static int handle_message_from_server(struct cras_client *client);
 static int reregister_notifications(struct cras_client *client);
+static int write_message_to_server(struct cras_client *client,
+				   const struct cras_server_message *msg);
+static int write_message_with_fds_to_server(
+	struct cras_client *client, const struct cras_server_message *msg,
+	int *fds, unsigned int num_fds);
 
 static struct libcras_node_info *
 libcras_node_info_create(struct cras_iodev_info *iodev,
@@ -445,10 +557,8 @@ static int server_state_wrlock(const struct cras_client *client)
 static struct client_stream *stream_from_id(const struct cras_client *client,
 					    unsigned int id)
 {
-	struct client_stream *out;
-
-	DL_SEARCH_SCALAR(client->streams, out, id, id);
-	return out;
+	return (struct client_stream *)cras_id_map_find(client->stream_index,
+							id);
 }
 
 /*
@@ -664,11 +774,16 @@ static int first_message_next_action(struct cras_client *client,
 	rc = handle_message_from_server(client);
 	if (rc < 0) {
 		syslog(LOG_ERR, "handle first message: %s", strerror(-rc));
-	} else if (client->id >= 0) {
-		rc = connect_transition_action(client);
-	} else {
+	} else if (client->id < 0) {
 		syslog(LOG_ERR, "did not get ID after first message!");
 		rc = -EINVAL;
+	} else if (!client->resume_pending) {
+		/* Paused streams can't keep their ids with another one. */
+		if (client->resume_id >= 0 && client->id != client->resume_id)
+			fail_paused_streams(client);
+		rc = connect_transition_action(client);
+		if (rc == 0)
+			resume_streams(client);
 	}
 	return rc;
 }
@@ -711,13 +826,15 @@ static void disconnect_transition_action(struct cras_client *client, bool force)
 	struct client_stream *s;
 	int lock_rc;
 
-	/* Stop all playing streams.
-	 * TODO(muirj): Pause and resume streams. */
-	DL_FOREACH (client->streams, s) {
-		s->config->err_cb(client, s->id, -ENOTCONN,
-				  s->config->user_data);
-		client_thread_rm_stream(client, s->id);
-	}
+	/* Pause the streams until the server is back, unless they were paused
+	 * already by an earlier attempt. */
+	if (client->streams && client->resume_id < 0)
+		client->resume_id = client->id;
+	client->resume_pending = false;
+	DL_FOREACH (client->streams, s)
+		pause_stream(s);
+	/* The streams being drained went with the server. */
+	fail_pending_drains(client, -ENOTCONN);
 
 	/* Clean up the server_state pointer. */
 	lock_rc = server_state_wrlock(client);
@@ -728,6 +845,12 @@ static void disconnect_transition_action(struct cras_client *client, bool force)
 	}
 	server_state_unlock(client, lock_rc);
 
+	/* The observer eventfd belongs to the server instance that is gone. */
+	if (client->observer_event_fd >= 0) {
+		close(client->observer_event_fd);
+		client->observer_event_fd = -1;
+	}
+
 	/* Our ID is unknown now. */
 	client->id = -1;
 
@@ -746,13 +869,15 @@ static void disconnect_transition_action(struct cras_client *client, bool force)
 
 	switch (old_state) {
 	case CRAS_SOCKET_STATE_DISCONNECTED:
-		/* Do nothing: already disconnected. */
+		/* Disconnected on purpose, the streams won't come back. */
+		fail_paused_streams(client);
 		break;
 	case CRAS_SOCKET_STATE_ERROR_DELAY:
 		/* We're disconnected and there was a failure to setup
 		 * automatic reconnection, so call the server error
 		 * callback now. */
 		server_fd_move_to_state(client, CRAS_SOCKET_STATE_DISCONNECTED);
+		fail_paused_streams(client);
 		if (client->server_connection_cb)
 			client->server_connection_cb(
 				client, CRAS_CONN_STATUS_FAILED,
@@ -1101,6 +1226,27 @@ static int read_with_wake_fd(int wake_fd, int read_fd, uint8_t *buf, size_t len)
 
 	return nread;
 }
+
+/* Blocks until the server rings the doorbell in shm, or until woken to stop.
+ * Returns the size of the audio message filled in msg, or 0 if woken
+ * without one. */
+static int read_doorbell(struct client_stream *stream,
+			 struct audio_message *msg)
+{
+	struct cras_audio_shm_header *header = stream->shm->header;
+	uint32_t seq;
+
+	seq = cras_shm_wait_doorbell(stream->shm, stream->doorbell_seq);
+	if (seq == stream->doorbell_seq || !thread_is_running(&stream->thread))
+		return 0;
+
+	stream->doorbell_seq = seq;
+	msg->id = (enum CRAS_AUDIO_MESSAGE_ID)header->doorbell_id;
+	msg->frames = header->doorbell_frames;
+	msg->error = 0;
+	return sizeof(*msg);
+}
+
 /* Check the availability and configures a capture buffer.
  * Args:
  *     stream - The input stream to configure buffer for.
@@ -1119,7 +1265,7 @@ static unsigned int config_capture_buf(struct client_stream *stream,
 	*captured_frames = cras_shm_get_read_buffer_base(stream->shm);
 
 	/* Don't ask for more frames than the client desires. */
-	if (stream->flags & BULK_AUDIO_OK)
+	if (stream->flags & (BULK_AUDIO_OK | ADAPTIVE_CB))
 		num_frames = MIN(num_frames, stream->config->buffer_frames);
 	else
 		num_frames = MIN(num_frames, stream->config->cb_threshold);
@@ -1148,6 +1294,11 @@ static int send_capture_reply(struct client_stream *stream, unsigned int frames,
 	if (!cras_stream_uses_input_hw(stream->direction))
 		return 0;
 
+	/* Errors go through the socket for the server to read them. */
+	if (!err && cras_shm_doorbell(stream->shm) &&
+	    !cras_shm_doorbell_reply(stream->shm))
+		return 0;
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_CAPTURED;
 	aud_msg.frames = frames;
 	aud_msg.error = err;
@@ -1232,6 +1383,10 @@ static int send_playback_reply(struct client_stream *stream,
 	if (!cras_stream_uses_output_hw(stream->direction))
 		return 0;
 
+	if (!error && cras_shm_doorbell(stream->shm) &&
+	    !cras_shm_doorbell_reply(stream->shm))
+		return 0;
+
 	aud_msg.id = AUDIO_MESSAGE_DATA_READY;
 	aud_msg.frames = frames;
 	aud_msg.error = error;
@@ -1267,8 +1422,15 @@ static int handle_playback_request(struct client_stream *stream,
 
 	buf = cras_shm_get_write_buffer_base(shm);
 
-	/* Limit the amount of frames to the configured amount. */
-	num_frames = MIN(num_frames, config->cb_threshold);
+	/* Limit the amount of frames to the configured amount, the server
+	 * resizes the callbacks of ADAPTIVE_CB streams. */
+	if (stream->flags & ADAPTIVE_CB)
+		num_frames = MIN(num_frames, config->buffer_frames);
+	else
+		num_frames = MIN(num_frames, config->cb_threshold);
+	/* The callback writes in place up to the end of the ring. */
+	if (cras_shm_is_ring(shm))
+		num_frames = MIN(num_frames, cras_shm_get_num_writeable(shm));
 
 	cras_timespec_to_timespec(&ts, &shm->header->ts);
 
@@ -1305,11 +1467,11 @@ reply_written:
 	return rc;
 }
 
-static void audio_thread_set_priority(struct client_stream *stream)
+static void audio_thread_set_priority(struct cras_client *client)
 {
 	/* Use provided callback to set priority if available. */
-	if (stream->client->thread_priority_cb) {
-		stream->client->thread_priority_cb(stream->client);
+	if (client->thread_priority_cb) {
+		client->thread_priority_cb(client);
 		return;
 	}
 
@@ -1319,6 +1481,21 @@ static void audio_thread_set_priority(struct client_stream *stream)
 		cras_set_nice_level(CRAS_CLIENT_NICENESS_LEVEL);
 }
 
+/* Handles an audio message from the server for the stream. Returns non-zero
+ * when the stream is not to be serviced anymore. */
+static int handle_audio_message(struct client_stream *stream,
+				const struct audio_message *aud_msg)
+{
+	switch (aud_msg->id) {
+	case AUDIO_MESSAGE_DATA_READY:
+		return handle_capture_data_ready(stream, aud_msg->frames);
+	case AUDIO_MESSAGE_REQUEST_DATA:
+		return handle_playback_request(stream, aud_msg->frames);
+	default:
+		return 0;
+	}
+}
+
 /* Listens to the audio socket for messages from the server indicating that
  * the stream needs to be serviced.  One of these runs per stream. */
 static void *audio_thread(void *arg)
@@ -1332,7 +1509,7 @@ static void *audio_thread(void *arg)
 	if (arg == NULL)
 		return (void *)-EIO;
 
-	audio_thread_set_priority(stream);
+	audio_thread_set_priority(stream->client);
 
 	/* Notify the control thread that we've started. */
 	pthread_mutex_lock(&stream->client->stream_start_lock);
@@ -1345,36 +1522,340 @@ static void *audio_thread(void *arg)
 		aud_fd = (stream->thread.state == CRAS_THREAD_WARMUP) ?
 				 -1 :
 				 stream->aud_fd;
-		num_read =
-			read_with_wake_fd(stream->wake_fds[0], aud_fd,
-					  (uint8_t *)&aud_msg, sizeof(aud_msg));
+		if (aud_fd >= 0 && cras_shm_doorbell(stream->shm))
+			num_read = read_doorbell(stream, &aud_msg);
+		else
+			num_read = read_with_wake_fd(stream->wake_fds[0],
+						     aud_fd, (uint8_t *)&aud_msg,
+						     sizeof(aud_msg));
 		if (num_read < 0)
 			return (void *)-EIO;
 		if (num_read == 0)
 			continue;
 
-		switch (aud_msg.id) {
-		case AUDIO_MESSAGE_DATA_READY:
-			thread_terminated = handle_capture_data_ready(
-				stream, aud_msg.frames);
-			break;
-		case AUDIO_MESSAGE_REQUEST_DATA:
-			thread_terminated =
-				handle_playback_request(stream, aud_msg.frames);
+		thread_terminated = handle_audio_message(stream, &aud_msg);
+	}
+
+	return NULL;
+}
+
+/*
+ * Shared audio threads.
+ */
+
+/* Returns the index of the stream in the thread's array, or -1. */
+static int shared_thread_find(const struct shared_aud_thread *shared,
+			      const struct client_stream *stream)
+{
+	unsigned int i;
+
+	for (i = 0; i < shared->num_streams; i++)
+		if (shared->streams[i] == stream)
+			return i;
+	return -1;
+}
+
+/* Stops servicing the stream, called with the lock held. */
+static void shared_thread_drop(struct shared_aud_thread *shared,
+			       struct client_stream *stream)
+{
+	int i = shared_thread_find(shared, stream);
+
+	if (i < 0)
+		return;
+
+	epoll_ctl(shared->epoll_fd, EPOLL_CTL_DEL, stream->aud_fd, NULL);
+	shared->streams[i] = shared->streams[--shared->num_streams];
+}
+
+/* Fills the time by which the stream has to be serviced. The next sample
+ * written plays at the shm timestamp, or for capture the samples read are
+ * overwritten after a buffer from their timestamp. */
+static void stream_deadline(const struct client_stream *stream,
+			    struct timespec *deadline)
+{
+	struct timespec buffer_ts;
+
+	cras_timespec_to_timespec(deadline, &stream->shm->header->ts);
+	if (stream->direction == CRAS_STREAM_OUTPUT)
+		return;
+
+	cras_frames_to_time(stream->config->buffer_frames,
+			    stream->config->format.frame_rate, &buffer_ts);
+	add_timespecs(deadline, &buffer_ts);
+}
+
+/* Reads and handles an audio message of the stream. Returns non-zero when
+ * the stream is not to be serviced anymore. */
+static int shared_thread_service(struct client_stream *stream)
+{
+	struct audio_message aud_msg;
+	int rc;
+
+	/* The readiness may be stale if the stream was removed and another one
+	 * added at the same address, so don't block. */
+	rc = recv(stream->aud_fd, &aud_msg, sizeof(aud_msg), MSG_DONTWAIT);
+	if (rc < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+		return 0;
+	if (rc != sizeof(aud_msg))
+		return -EIO;
+
+	return handle_audio_message(stream, &aud_msg);
+}
+
+/* Services the streams with events, in the order of their deadlines. Called
+ * with the lock held. */
+static void shared_thread_service_events(struct shared_aud_thread *shared,
+					 const struct epoll_event *events,
+					 int num_events)
+{
+	struct client_stream *ready[SHARED_THREAD_MAX_EVENTS];
+	struct timespec deadlines[SHARED_THREAD_MAX_EVENTS];
+	struct client_stream *stream;
+	struct timespec deadline;
+	int num_ready = 0;
+	int i, j;
+
+	for (i = 0; i < num_events; i++) {
+		stream = (struct client_stream *)events[i].data.ptr;
+		if (!stream || shared_thread_find(shared, stream) < 0)
+			continue;
+
+		stream_deadline(stream, &deadline);
+		for (j = num_ready; j > 0; j--) {
+			if (!timespec_after(&deadlines[j - 1], &deadline))
+				break;
+			ready[j] = ready[j - 1];
+			deadlines[j] = deadlines[j - 1];
+		}
+		ready[j] = stream;
+		deadlines[j] = deadline;
+		num_ready++;
+	}
+
+	for (i = 0; i < num_ready; i++)
+		if (shared_thread_service(ready[i]))
+			shared_thread_drop(shared, ready[i]);
+}
+
+/* Services the streams assigned to it until stopped. */
+static void *shared_aud_thread(void *arg)
+{
+	struct shared_aud_thread *shared = (struct shared_aud_thread *)arg;
+	struct epoll_event events[SHARED_THREAD_MAX_EVENTS];
+	int n;
+
+	audio_thread_set_priority(shared->client);
+
+	while (1) {
+		n = epoll_wait(shared->epoll_fd, events,
+			       SHARED_THREAD_MAX_EVENTS, -1);
+		if (n < 0 && errno != EINTR) {
+			syslog(LOG_ERR, "cras_client: epoll_wait: %s",
+			       strerror(errno));
 			break;
-		default:
+		}
+
+		pthread_mutex_lock(&shared->lock);
+		if (!shared->running) {
+			pthread_mutex_unlock(&shared->lock);
 			break;
 		}
+		if (n > 0)
+			shared_thread_service_events(shared, events, n);
+		pthread_mutex_unlock(&shared->lock);
 	}
 
 	return NULL;
 }
 
+static void shared_thread_cleanup(struct shared_aud_thread *shared)
+{
+	if (shared->epoll_fd >= 0)
+		close(shared->epoll_fd);
+	if (shared->wake_fd >= 0)
+		close(shared->wake_fd);
+	pthread_mutex_destroy(&shared->lock);
+	free(shared->streams);
+}
+
+static int shared_thread_start(struct cras_client *client,
+			       struct shared_aud_thread *shared)
+{
+	struct epoll_event ev = {};
+	int rc;
+
+	shared->client = client;
+	shared->running = 1;
+	pthread_mutex_init(&shared->lock, NULL);
+	shared->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	shared->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+	if (shared->epoll_fd < 0 || shared->wake_fd < 0) {
+		rc = -errno;
+		goto cleanup;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = NULL;
+	if (epoll_ctl(shared->epoll_fd, EPOLL_CTL_ADD, shared->wake_fd, &ev)) {
+		rc = -errno;
+		goto cleanup;
+	}
+
+	rc = pthread_create(&shared->tid, NULL, shared_aud_thread, shared);
+	if (rc) {
+		rc = -rc;
+		goto cleanup;
+	}
+	return 0;
+
+cleanup:
+	syslog(LOG_ERR, "cras_client: Couldn't start shared audio thread: %s",
+	       strerror(-rc));
+	shared_thread_cleanup(shared);
+	return rc;
+}
+
+static void shared_thread_stop(struct shared_aud_thread *shared)
+{
+	uint64_t one = 1;
+	int rc;
+
+	pthread_mutex_lock(&shared->lock);
+	shared->running = 0;
+	pthread_mutex_unlock(&shared->lock);
+
+	rc = write(shared->wake_fd, &one, sizeof(one));
+	if (rc != sizeof(one))
+		syslog(LOG_ERR, "cras_client: Failed to wake shared thread");
+	pthread_join(shared->tid, NULL);
+	shared_thread_cleanup(shared);
+}
+
+/* Stops the shared audio threads of the client, if started. */
+static void shared_threads_stop(struct cras_client *client)
+{
+	unsigned int i;
+
+	if (!client->shared_threads)
+		return;
+
+	for (i = 0; i < client->num_shared_threads; i++)
+		shared_thread_stop(&client->shared_threads[i]);
+	free(client->shared_threads);
+	client->shared_threads = NULL;
+}
+
+/* Starts the shared audio threads of the client. */
+static int shared_threads_start(struct cras_client *client)
+{
+	unsigned int i;
+	int rc;
+
+	client->shared_threads = (struct shared_aud_thread *)calloc(
+		client->num_shared_threads, sizeof(*client->shared_threads));
+	if (!client->shared_threads)
+		return -ENOMEM;
+
+	for (i = 0; i < client->num_shared_threads; i++) {
+		rc = shared_thread_start(client, &client->shared_threads[i]);
+		if (rc < 0) {
+			while (i--)
+				shared_thread_stop(&client->shared_threads[i]);
+			free(client->shared_threads);
+			client->shared_threads = NULL;
+			return rc;
+		}
+	}
+	return 0;
+}
+
+/* Assigns the stream to the shared audio thread with the fewest streams,
+ * starting the threads for the first stream. */
+static int shared_thread_assign(struct client_stream *stream)
+{
+	struct cras_client *client = stream->client;
+	struct shared_aud_thread *shared;
+	unsigned int i;
+	int rc;
+
+	if (!client->shared_threads) {
+		rc = shared_threads_start(client);
+		if (rc < 0)
+			return rc;
+	}
+
+	shared = &client->shared_threads[0];
+	for (i = 1; i < client->num_shared_threads; i++)
+		if (client->shared_threads[i].num_assigned <
+		    shared->num_assigned)
+			shared = &client->shared_threads[i];
+
+	shared->num_assigned++;
+	stream->shared = shared;
+	stream->thread.state = CRAS_THREAD_WARMUP;
+	return 0;
+}
+
+/* Starts servicing the connected stream on its shared audio thread. */
+static int shared_thread_add(struct client_stream *stream)
+{
+	struct shared_aud_thread *shared = stream->shared;
+	struct client_stream **streams;
+	struct epoll_event ev = {};
+	int rc = 0;
+
+	pthread_mutex_lock(&shared->lock);
+	if (shared->num_streams == shared->max_streams) {
+		streams = (struct client_stream **)realloc(
+			shared->streams,
+			(shared->max_streams + 4) * sizeof(*streams));
+		if (!streams) {
+			rc = -ENOMEM;
+			goto unlock;
+		}
+		shared->streams = streams;
+		shared->max_streams += 4;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = stream;
+	if (epoll_ctl(shared->epoll_fd, EPOLL_CTL_ADD, stream->aud_fd, &ev)) {
+		rc = -errno;
+		goto unlock;
+	}
+	shared->streams[shared->num_streams++] = stream;
+
+unlock:
+	pthread_mutex_unlock(&shared->lock);
+	return rc;
+}
+
+/* Stops servicing the stream on its shared audio thread. Returns once the
+ * thread is done with it. */
+static void shared_thread_remove(struct client_stream *stream)
+{
+	struct shared_aud_thread *shared = stream->shared;
+
+	pthread_mutex_lock(&shared->lock);
+	shared_thread_drop(shared, stream);
+	pthread_mutex_unlock(&shared->lock);
+
+	shared->num_assigned--;
+	stream->shared = NULL;
+	stream->thread.state = CRAS_THREAD_STOP;
+}
+
 /* Pokes the audio thread so that it can notice if it has been terminated. */
 static int wake_aud_thread(struct client_stream *stream)
 {
 	int rc;
 
+	/* Once running with the doorbell the thread waits on it instead. */
+	if (stream->thread.state == CRAS_THREAD_STOP && stream->shm &&
+	    cras_shm_doorbell(stream->shm))
+		cras_shm_wake_doorbell(stream->shm);
+
 	rc = write(stream->wake_fds[1], &rc, 1);
 	if (rc != 1)
 		return rc;
@@ -1389,6 +1870,11 @@ static int wake_aud_thread(struct client_stream *stream)
  */
 static void stop_aud_thread(struct client_stream *stream, int join)
 {
+	if (stream->shared) {
+		shared_thread_remove(stream);
+		return;
+	}
+
 	if (thread_is_running(&stream->thread)) {
 		stream->thread.state = CRAS_THREAD_STOP;
 		wake_aud_thread(stream);
@@ -1415,6 +1901,9 @@ static int start_aud_thread(struct client_stream *stream)
 	int rc;
 	struct timespec future;
 
+	if (stream->client->num_shared_threads)
+		return shared_thread_assign(stream);
+
 	rc = pipe(stream->wake_fds);
 	if (rc < 0) {
 		rc = -errno;
@@ -1532,8 +2021,15 @@ static int stream_connected(struct client_stream *stream,
 	cras_shm_copy_shared_config(stream->shm);
 	cras_shm_set_volume_scaler(stream->shm, stream->volume_scaler);
 
-	stream->thread.state = CRAS_THREAD_RUNNING;
-	wake_aud_thread(stream);
+	if (stream->shared) {
+		rc = shared_thread_add(stream);
+		if (rc < 0)
+			goto err_ret;
+		stream->thread.state = CRAS_THREAD_RUNNING;
+	} else {
+		stream->thread.state = CRAS_THREAD_RUNNING;
+		wake_aud_thread(stream);
+	}
 
 	close(stream_fds[0]);
 	close(stream_fds[1]);
@@ -1569,10 +2065,10 @@ static int send_connect_message(struct cras_client *client,
 				  stream->config->effects,
 				  stream->config->format, dev_idx);
 
-	rc = cras_send_with_fds(client->server_fd, &serv_msg, sizeof(serv_msg),
-				&sock[1], 1);
-	if (rc != sizeof(serv_msg)) {
-		rc = EIO;
+	/* Held with the other messages while a batch is open. */
+	rc = write_message_with_fds_to_server(client, &serv_msg.header,
+					      &sock[1], 1);
+	if (rc < 0) {
 		syslog(LOG_ERR,
 		       "cras_client: add_stream: Send server message failed.");
 		goto fail;
@@ -1600,7 +2096,6 @@ static int client_thread_add_stream(struct cras_client *client,
 {
 	int rc;
 	cras_stream_id_t new_id;
-	struct client_stream *out;
 
 	if ((stream->flags & HOTWORD_STREAM) == HOTWORD_STREAM) {
 		int hotword_idx;
@@ -1632,23 +2127,30 @@ static int client_thread_add_stream(struct cras_client *client,
 	do {
 		new_id = cras_get_stream_id(client->id, client->next_stream_id);
 		client->next_stream_id++;
-		DL_SEARCH_SCALAR(client->streams, out, id, new_id);
-	} while (out != NULL);
+	} while (stream_from_id(client, new_id) != NULL);
 
 	stream->id = new_id;
 	*stream_id_out = new_id;
 	stream->client = client;
+	stream->dev_idx = dev_idx;
+
+	rc = cras_id_map_insert(client->stream_index, new_id, stream);
+	if (rc < 0)
+		return rc;
 
 	/* Start the audio thread. */
 	rc = start_aud_thread(stream);
-	if (rc != 0)
+	if (rc != 0) {
+		cras_id_map_remove(client->stream_index, new_id);
 		return rc;
+	}
 
 	/* Start the thread associated with this stream. */
 	/* send a message to the server asking that the stream be started. */
 	rc = send_connect_message(client, stream, dev_idx);
 	if (rc != 0) {
 		stop_aud_thread(stream, 1);
+		cras_id_map_remove(client->stream_index, new_id);
 		return rc;
 	}
 
@@ -1658,6 +2160,23 @@ static int client_thread_add_stream(struct cras_client *client,
 	return 0;
 }
 
+/* Stops a stream and frees it, the server has been told to remove it. */
+static void destroy_stream(struct cras_client *client,
+			   struct client_stream *stream)
+{
+	stop_aud_thread(stream, 1);
+
+	free_shm(stream);
+
+	DL_DELETE(client->streams, stream);
+	cras_id_map_remove(client->stream_index, stream->id);
+	if (stream->aud_fd >= 0)
+		close(stream->aud_fd);
+
+	free(stream->config);
+	free(stream);
+}
+
 /* Removes a stream from a running client from within the running client's
  * context. */
 static int client_thread_rm_stream(struct cras_client *client,
@@ -1673,27 +2192,102 @@ static int client_thread_rm_stream(struct cras_client *client,
 	/* Tell server to remove. */
 	if (client->server_fd_state == CRAS_SOCKET_STATE_CONNECTED) {
 		cras_fill_disconnect_stream_message(&msg, stream_id);
-		rc = write(client->server_fd, &msg, sizeof(msg));
+		rc = write_message_to_server(client, &msg.header);
 		if (rc < 0)
 			syslog(LOG_ERR,
 			       "cras_client: error removing stream from server\n");
 	}
 
 	/* And shut down locally. */
-	stop_aud_thread(stream, 1);
+	destroy_stream(client, stream);
+	return 0;
+}
 
-	free_shm(stream);
+/* Removes a stream like client_thread_rm_stream(), but keeps the drain
+ * pending until the server reports the samples it holds played out. */
+static int client_thread_drain_stream(struct cras_client *client,
+				      cras_stream_id_t stream_id, uint64_t tag)
+{
+	struct cras_drain_stream_message msg;
+	struct client_stream *stream = stream_from_id(client, stream_id);
+	struct pending_drain *drain;
+	int rc;
 
-	DL_DELETE(client->streams, stream);
-	if (stream->aud_fd >= 0)
-		close(stream->aud_fd);
+	if (stream == NULL)
+		return -EINVAL;
+	if (client->server_fd_state != CRAS_SOCKET_STATE_CONNECTED)
+		return -ENOTCONN;
 
-	free(stream->config);
-	free(stream);
+	drain = (struct pending_drain *)calloc(1, sizeof(*drain));
+	if (!drain)
+		return -ENOMEM;
+	cras_fill_drain_stream_message(&msg, stream_id);
+	rc = write_message_to_server(client, &msg.header);
+	if (rc < 0) {
+		free(drain);
+		return rc;
+	}
+	drain->stream_id = stream_id;
+	drain->tag = tag;
+	DL_APPEND(client->pending_drains, drain);
 
+	destroy_stream(client, stream);
 	return 0;
 }
 
+/* Stops the stream and drops its connection to a server that went away. The
+ * stream keeps its id and config to be connected again by resume_streams().
+ */
+static void pause_stream(struct client_stream *stream)
+{
+	stop_aud_thread(stream, 1);
+	free_shm(stream);
+	if (stream->aud_fd >= 0) {
+		close(stream->aud_fd);
+		stream->aud_fd = -1;
+	}
+	stream->doorbell_seq = 0;
+}
+
+/* Removes the paused streams, telling their owners they are lost. */
+static void fail_paused_streams(struct cras_client *client)
+{
+	struct client_stream *s;
+
+	if (client->resume_id < 0)
+		return;
+	client->resume_id = -1;
+	DL_FOREACH (client->streams, s) {
+		s->config->err_cb(client, s->id, -ENOTCONN,
+				  s->config->user_data);
+		client_thread_rm_stream(client, s->id);
+	}
+}
+
+/* Connects the paused streams again with their ids, once the server gave the
+ * client its old id back. The server sets up new shm for them, audio picks up
+ * from where the new shm starts. */
+static void resume_streams(struct cras_client *client)
+{
+	struct client_stream *s;
+	int rc;
+
+	if (client->resume_id < 0)
+		return;
+	client->resume_id = -1;
+	DL_FOREACH (client->streams, s) {
+		rc = start_aud_thread(s);
+		if (rc == 0) {
+			rc = send_connect_message(client, s, s->dev_idx);
+			if (rc < 0)
+				stop_aud_thread(s, 1);
+		}
+		if (rc < 0)
+			s->config->err_cb(client, s->id, rc,
+					  s->config->user_data);
+	}
+}
+
 /* Sets the volume scaling factor for a playback or capture stream. */
 static int client_thread_set_stream_volume(struct cras_client *client,
 					   cras_stream_id_t stream_id,
@@ -1715,10 +2309,19 @@ static int client_thread_set_stream_volume(struct cras_client *client,
 /* Attach to the shm region containing the audio thread log. */
 static void attach_atlog_shm(struct cras_client *client, int fd)
 {
-	client->atlog_ro = (struct audio_thread_event_log *)mmap(
-		NULL, sizeof(*client->atlog_ro), PROT_READ, MAP_SHARED, fd, 0);
-	close(fd);
-}
+	struct stat st;
+	void *log;
+
+	/* The live log can be larger than a snapshot, map all of it. */
+	if (fstat(fd, &st) || st.st_size < sizeof(*client->atlog_ro)) {
+		close(fd);
+		return;
+	}
+	log = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	if (log != MAP_FAILED)
+		client->atlog_ro = (struct audio_thread_event_log *)log;
+	close(fd);
+}
 
 /* Attach to the shm region containing the server state. */
 static int client_attach_shm(struct cras_client *client, int shm_fd)
@@ -1794,7 +2397,25 @@ static int handle_message_from_server(struct cras_client *client)
 		if (rc)
 			return rc;
 		client->id = cmsg->client_id;
+		if (client->resume_id >= 0 && client->id != client->resume_id)
+			rc = request_resume(client);
+		break;
+	}
+	case CRAS_CLIENT_RESUMED: {
+		struct cras_client_resumed *cmsg =
+			(struct cras_client_resumed *)msg;
+
+		if (!client->resume_pending)
+			break;
+		client->id = cmsg->client_id;
+		client->resume_pending = false;
+		break;
+	}
+	case CRAS_CLIENT_STREAM_DRAINED: {
+		struct cras_client_stream_drained *cmsg =
+			(struct cras_client_stream_drained *)msg;
 
+		complete_drain(client, cmsg->stream_id, 0);
 		break;
 	}
 	case CRAS_CLIENT_STREAM_CONNECTED: {
@@ -1839,6 +2460,16 @@ static int handle_message_from_server(struct cras_client *client)
 			client->atlog_access_callback(client);
 		client->atlog_access_callback = NULL;
 		break;
+	case CRAS_CLIENT_OBSERVER_EVENT_FD_READY:
+		if (num_fds != 1 || server_fds[0] < 0)
+			return -EINVAL;
+		if (client->observer_event_fd >= 0)
+			close(client->observer_event_fd);
+		client->observer_event_fd = server_fds[0];
+		if (client->observer_event_fd_callback)
+			client->observer_event_fd_callback(client);
+		client->observer_event_fd_callback = NULL;
+		break;
 	case CRAS_CLIENT_GET_HOTWORD_MODELS_READY: {
 		struct cras_client_get_hotword_models_ready *cmsg =
 			(struct cras_client_get_hotword_models_ready *)msg;
@@ -1962,10 +2593,64 @@ static int handle_stream_message(struct cras_client *client, int poll_revents)
 }
 
 /* Handles messages from users to this client. */
+static void complete_async_command(struct cras_client *client, uint64_t tag,
+				   cras_stream_id_t stream_id, int rc)
+{
+	struct completion_entry *entry;
+	uint64_t one = 1;
+
+	if (client->completion_cb) {
+		struct cras_client_completion completion = { tag, rc,
+							     stream_id };
+
+		client->completion_cb(client, &completion,
+				      client->completion_cb_arg);
+		return;
+	}
+
+	entry = (struct completion_entry *)calloc(1, sizeof(*entry));
+	if (!entry) {
+		syslog(LOG_ERR, "cras_client: Dropped a completion");
+		return;
+	}
+	entry->completion.tag = tag;
+	entry->completion.result = rc;
+	entry->completion.stream_id = stream_id;
+
+	pthread_mutex_lock(&client->completion_lock);
+	DL_APPEND(client->completions, entry);
+	pthread_mutex_unlock(&client->completion_lock);
+
+	if (write(client->completion_fd, &one, sizeof(one)) != sizeof(one))
+		syslog(LOG_ERR, "cras_client: Failed to signal completion");
+}
+
+/* Completes the drain of a stream, if one is pending. */
+static void complete_drain(struct cras_client *client,
+			   cras_stream_id_t stream_id, int rc)
+{
+	struct pending_drain *drain;
+
+	DL_SEARCH_SCALAR(client->pending_drains, drain, stream_id, stream_id);
+	if (!drain)
+		return;
+	DL_DELETE(client->pending_drains, drain);
+	complete_async_command(client, drain->tag, stream_id, rc);
+	free(drain);
+}
+
+/* Completes all the pending drains with rc. */
+static void fail_pending_drains(struct cras_client *client, int rc)
+{
+	while (client->pending_drains)
+		complete_drain(client, client->pending_drains->stream_id, rc);
+}
+
 static int handle_command_message(struct cras_client *client, int poll_revents)
 {
 	uint8_t buf[MAX_CMD_MSG_LEN];
 	struct command_msg *msg = (struct command_msg *)buf;
+	cras_stream_id_t stream_id;
 	int rc, to_read;
 
 	if ((poll_revents & POLLIN) == 0)
@@ -1983,6 +2668,7 @@ static int handle_command_message(struct cras_client *client, int poll_revents)
 		goto cmd_msg_complete;
 	}
 
+	stream_id = msg->stream_id;
 	switch (msg->msg_id) {
 	case CLIENT_STOP: {
 		struct client_stream *s;
@@ -1999,14 +2685,28 @@ static int handle_command_message(struct cras_client *client, int poll_revents)
 	case CLIENT_ADD_STREAM: {
 		struct add_stream_command_message *add_msg =
 			(struct add_stream_command_message *)msg;
+		if (add_msg->stream_id_out == NULL)
+			add_msg->stream_id_out = &stream_id;
 		rc = client_thread_add_stream(client, add_msg->stream,
 					      add_msg->stream_id_out,
 					      add_msg->dev_idx);
+		/* Nobody waits to free it on failure. */
+		if (rc < 0 && msg->async) {
+			free(add_msg->stream->config);
+			free(add_msg->stream);
+		}
 		break;
 	}
 	case CLIENT_REMOVE_STREAM:
 		rc = client_thread_rm_stream(client, msg->stream_id);
 		break;
+	case CLIENT_DRAIN_STREAM:
+		rc = client_thread_drain_stream(client, msg->stream_id,
+						msg->tag);
+		/* Completed once the server reports the stream drained. */
+		if (rc == 0)
+			return 0;
+		break;
 	case CLIENT_SET_STREAM_VOLUME_SCALER: {
 		struct set_stream_volume_command_message *vol_msg =
 			(struct set_stream_volume_command_message *)msg;
@@ -2026,6 +2726,11 @@ static int handle_command_message(struct cras_client *client, int poll_revents)
 		break;
 	}
 
+	if (msg->async) {
+		complete_async_command(client, msg->tag, stream_id, rc);
+		return rc;
+	}
+
 cmd_msg_complete:
 	/* Wake the waiting main thread with the result of the command. */
 	if (write(client->command_reply_fds[1], &rc, sizeof(rc)) != sizeof(rc))
@@ -2110,6 +2815,7 @@ static int send_command_message(struct cras_client *client,
 	if (client == NULL || !thread_is_running(&client->thread))
 		return -EINVAL;
 
+	msg->async = 0;
 	rc = write(client->command_fds[1], msg, msg->len);
 	if (rc != (int)msg->len)
 		return -EPIPE;
@@ -2121,11 +2827,29 @@ static int send_command_message(struct cras_client *client,
 	return cmd_res;
 }
 
+/* Sends a message to the client thread to complete an action requested by the
+ * user, with the result in a completion with tag. */
+static int send_command_message_async(struct cras_client *client,
+				      struct command_msg *msg, uint64_t tag)
+{
+	int rc;
+
+	if (client == NULL || !thread_is_running(&client->thread))
+		return -EINVAL;
+
+	msg->async = 1;
+	msg->tag = tag;
+	rc = write(client->command_fds[1], msg, msg->len);
+	if (rc != (int)msg->len)
+		return -EPIPE;
+	return 0;
+}
+
 /* Send a simple message to the client thread that holds no data. */
 static int send_simple_cmd_msg(struct cras_client *client,
 			       cras_stream_id_t stream_id, unsigned msg_id)
 {
-	struct command_msg msg;
+	struct command_msg msg = {};
 
 	msg.len = sizeof(msg);
 	msg.stream_id = stream_id;
@@ -2134,24 +2858,28 @@ static int send_simple_cmd_msg(struct cras_client *client,
 	return send_command_message(client, &msg);
 }
 
-/* Sends the set volume message to the client thread. */
+/* Sends the set volume message to the client thread, asynchronously with tag
+ * if async is non-zero. */
 static int send_stream_volume_command_msg(struct cras_client *client,
 					  cras_stream_id_t stream_id,
-					  float volume_scaler)
+					  float volume_scaler, int async,
+					  uint64_t tag)
 {
-	struct set_stream_volume_command_message msg;
+	struct set_stream_volume_command_message msg = {};
 
 	msg.header.len = sizeof(msg);
 	msg.header.stream_id = stream_id;
 	msg.header.msg_id = CLIENT_SET_STREAM_VOLUME_SCALER;
 	msg.volume_scaler = volume_scaler;
 
+	if (async)
+		return send_command_message_async(client, &msg.header, tag);
 	return send_command_message(client, &msg.header);
 }
 
-/* Sends a message back to the client and returns the error code. */
-static int write_message_to_server(struct cras_client *client,
-				   const struct cras_server_message *msg)
+/* Writes a message to the server socket and returns the error code. */
+static int write_to_server(struct cras_client *client,
+			   const struct cras_server_message *msg)
 {
 	ssize_t write_rc = -EPIPE;
 
@@ -2174,6 +2902,184 @@ static int write_message_to_server(struct cras_client *client,
 		return 0;
 }
 
+/* Writes a message with fds attached to the server socket. */
+static int write_to_server_with_fds(struct cras_client *client,
+				    const struct cras_server_message *msg,
+				    int *fds, unsigned int num_fds)
+{
+	int rc;
+
+	if (num_fds == 0)
+		return write_to_server(client, msg);
+	if (client->server_fd_state != CRAS_SOCKET_STATE_CONNECTED)
+		return -EPIPE;
+	rc = cras_send_with_fds(client->server_fd, msg, msg->length, fds,
+				num_fds);
+	if (rc < 0)
+		return rc;
+	return rc == (int)msg->length ? 0 : -EIO;
+}
+
+/* Sends the held messages and empties the batch. A single message goes
+ * without the batch header. Called with batch_lock held. */
+static int flush_batch_locked(struct cras_client *client)
+{
+	const struct cras_server_message *first;
+	unsigned int i;
+	int rc;
+
+	if (client->batch->header.length == sizeof(*client->batch))
+		return 0;
+
+	first = (const struct cras_server_message *)client->batch->messages;
+	if (sizeof(*client->batch) + first->length ==
+	    client->batch->header.length)
+		rc = write_to_server_with_fds(client, first, client->batch_fds,
+					      client->num_batch_fds);
+	else
+		rc = write_to_server_with_fds(client, &client->batch->header,
+					      client->batch_fds,
+					      client->num_batch_fds);
+	cras_fill_server_batch(client->batch);
+	for (i = 0; i < client->num_batch_fds; i++)
+		close(client->batch_fds[i]);
+	client->num_batch_fds = 0;
+	return rc;
+}
+
+/* Returns non-zero if msg makes the held message queued pointless. */
+static int message_supersedes(const struct cras_server_message *queued,
+			      const struct cras_server_message *msg)
+{
+	if (queued->id != msg->id || queued->length != msg->length)
+		return 0;
+
+	switch (msg->id) {
+	case CRAS_SERVER_SET_SYSTEM_VOLUME:
+	case CRAS_SERVER_SET_SYSTEM_MUTE:
+	case CRAS_SERVER_SET_USER_MUTE:
+	case CRAS_SERVER_SET_SYSTEM_MUTE_LOCKED:
+	case CRAS_SERVER_SET_SYSTEM_CAPTURE_MUTE:
+	case CRAS_SERVER_SET_SYSTEM_CAPTURE_MUTE_LOCKED:
+	case CRAS_SERVER_SET_BT_WBS_ENABLED:
+	case CRAS_SERVER_SET_LOOPBACK_TARGET:
+		return 1;
+	case CRAS_SERVER_SET_NODE_ATTR: {
+		const struct cras_set_node_attr *a =
+			(const struct cras_set_node_attr *)queued;
+		const struct cras_set_node_attr *b =
+			(const struct cras_set_node_attr *)msg;
+		return a->node_id == b->node_id && a->attr == b->attr;
+	}
+	default:
+		return 0;
+	}
+}
+
+/* Removes the held messages that msg supersedes. Called with batch_lock
+ * held. */
+static void coalesce_batch_locked(struct cras_client *client,
+				  const struct cras_server_message *msg)
+{
+	uint8_t *pos = client->batch->messages;
+	uint8_t *end = (uint8_t *)client->batch + client->batch->header.length;
+	struct cras_server_message *queued;
+	uint32_t len;
+
+	while (pos < end) {
+		queued = (struct cras_server_message *)pos;
+		len = queued->length;
+		if (message_supersedes(queued, msg)) {
+			memmove(pos, pos + len, end - pos - len);
+			end -= len;
+			client->batch->header.length -= len;
+		} else {
+			pos += len;
+		}
+	}
+}
+
+/* Holds msg and copies of its fds in the batch. Returns 0 on success or a
+ * negative error code if they can't be held. Called with batch_lock held. */
+static int hold_in_batch_locked(struct cras_client *client,
+				const struct cras_server_message *msg,
+				int *fds, unsigned int num_fds)
+{
+	unsigned int i;
+	int fd;
+
+	if (client->num_batch_fds + num_fds > ARRAY_SIZE(client->batch_fds) ||
+	    client->batch->header.length + msg->length >
+		    sizeof(client->batch_buf))
+		return -ENOSPC;
+	for (i = 0; i < num_fds; i++) {
+		fd = dup(fds[i]);
+		if (fd < 0)
+			goto undo;
+		client->batch_fds[client->num_batch_fds++] = fd;
+	}
+	return cras_server_batch_append(client->batch,
+					sizeof(client->batch_buf), msg);
+undo:
+	fd = -errno;
+	while (i--)
+		close(client->batch_fds[--client->num_batch_fds]);
+	return fd;
+}
+
+/* Sends a message to the server, or holds it while a batch is open. Messages
+ * supersede the held ones they make pointless, and the rest keep their
+ * order. The fds attached to msg are only used during the call. */
+static int write_message_with_fds_to_server(
+	struct cras_client *client, const struct cras_server_message *msg,
+	int *fds, unsigned int num_fds)
+{
+	int rc = 0;
+
+	pthread_mutex_lock(&client->batch_lock);
+	if (client->batch_depth == 0) {
+		pthread_mutex_unlock(&client->batch_lock);
+		return write_to_server_with_fds(client, msg, fds, num_fds);
+	}
+
+	coalesce_batch_locked(client, msg);
+	if (hold_in_batch_locked(client, msg, fds, num_fds) == 0)
+		goto unlock;
+
+	/* Send what is held to make room. */
+	rc = flush_batch_locked(client);
+	if (rc < 0)
+		goto unlock;
+	if (hold_in_batch_locked(client, msg, fds, num_fds) == 0)
+		goto unlock;
+
+	/* Too big to batch at all. */
+	rc = write_to_server_with_fds(client, msg, fds, num_fds);
+unlock:
+	pthread_mutex_unlock(&client->batch_lock);
+	return rc;
+}
+
+static int write_message_to_server(struct cras_client *client,
+				   const struct cras_server_message *msg)
+{
+	return write_message_with_fds_to_server(client, msg, NULL, 0);
+}
+
+/* Asks the server for the id the paused streams were added with. The first
+ * message state lasts until the reply, it isn't held in a batch. */
+static int request_resume(struct cras_client *client)
+{
+	struct cras_resume_client msg;
+	int rc;
+
+	cras_fill_resume_client(&msg, client->resume_id);
+	rc = write_to_server(client, &msg.header);
+	if (rc == 0)
+		client->resume_pending = true;
+	return rc;
+}
+
 /* Fills server socket file to connect by client's connection type. */
 static int fill_socket_file(struct cras_client *client,
 			    enum CRAS_CONNECTION_TYPE conn_type)
@@ -2218,6 +3124,7 @@ int cras_client_create_with_type(struct cras_client **client,
 	*client = &client_int->client;
 	(*client)->server_fd = -1;
 	(*client)->id = -1;
+	(*client)->resume_id = -1;
 
 	rc = pthread_rwlock_init(&client_int->server_state_rwlock, NULL);
 	if (rc != 0) {
@@ -2250,9 +3157,28 @@ int cras_client_create_with_type(struct cras_client **client,
 		goto free_cond;
 	}
 
+	(*client)->completion_fd =
+		eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK | EFD_SEMAPHORE);
+	if ((*client)->completion_fd < 0) {
+		syslog(LOG_ERR, "cras_client: Could not setup completion fd.");
+		rc = -errno;
+		goto free_server_event_fd;
+	}
+	pthread_mutex_init(&(*client)->completion_lock, NULL);
+	pthread_mutex_init(&(*client)->batch_lock, NULL);
+	(*client)->batch = (struct cras_server_batch *)(*client)->batch_buf;
+	cras_fill_server_batch((*client)->batch);
+	(*client)->observer_event_fd = -1;
+
+	(*client)->stream_index = cras_id_map_create();
+	if (!(*client)->stream_index) {
+		rc = -ENOMEM;
+		goto free_completion_fd;
+	}
+
 	rc = fill_socket_file((*client), conn_type);
 	if (rc < 0) {
-		goto free_server_event_fd;
+		goto free_completion_fd;
 	}
 
 	rc = cras_file_wait_create((*client)->sock_file,
@@ -2287,6 +3213,11 @@ int cras_client_create_with_type(struct cras_client **client,
 free_error:
 	cras_file_wait_destroy((*client)->sock_file_wait);
 	free((void *)(*client)->sock_file);
+free_completion_fd:
+	cras_id_map_destroy((*client)->stream_index);
+	pthread_mutex_destroy(&(*client)->batch_lock);
+	pthread_mutex_destroy(&(*client)->completion_lock);
+	close((*client)->completion_fd);
 free_server_event_fd:
 	if ((*client)->server_event_fd >= 0)
 		close((*client)->server_event_fd);
@@ -2310,18 +3241,36 @@ int cras_client_create(struct cras_client **client)
 void cras_client_destroy(struct cras_client *client)
 {
 	struct client_int *client_int;
+	struct completion_entry *entry;
+	struct pending_drain *drain;
 	if (client == NULL)
 		return;
 	client_int = to_client_int(client);
 	client->server_connection_cb = NULL;
 	cras_client_stop(client);
+	/* Nobody is left to take the completions of the drains. */
+	DL_FOREACH (client->pending_drains, drain) {
+		DL_DELETE(client->pending_drains, drain);
+		free(drain);
+	}
 	server_disconnect(client);
+	shared_threads_stop(client);
+	DL_FOREACH (client->completions, entry) {
+		DL_DELETE(client->completions, entry);
+		free(entry);
+	}
+	while (client->num_batch_fds)
+		close(client->batch_fds[--client->num_batch_fds]);
+	pthread_mutex_destroy(&client->batch_lock);
+	pthread_mutex_destroy(&client->completion_lock);
+	close(client->completion_fd);
 	close(client->server_event_fd);
 	close(client->command_fds[0]);
 	close(client->command_fds[1]);
 	close(client->stream_fds[0]);
 	close(client->stream_fds[1]);
 	cras_file_wait_destroy(client->sock_file_wait);
+	cras_id_map_destroy(client->stream_index);
 	pthread_rwlock_destroy(&client_int->server_state_rwlock);
 	free((void *)client->sock_file);
 	free(client_int);
@@ -2456,15 +3405,18 @@ void cras_client_stream_params_destroy(struct cras_stream_params *params)
 	free(params);
 }
 
+/* Sends the add stream command, asynchronously with tag if stream_id_out is
+ * NULL. */
 static inline int cras_client_send_add_stream_command_message(
 	struct cras_client *client, uint32_t dev_idx,
-	cras_stream_id_t *stream_id_out, struct cras_stream_params *config)
+	cras_stream_id_t *stream_id_out, struct cras_stream_params *config,
+	uint64_t tag)
 {
-	struct add_stream_command_message cmd_msg;
+	struct add_stream_command_message cmd_msg = {};
 	struct client_stream *stream;
 	int rc = 0;
 
-	if (client == NULL || config == NULL || stream_id_out == NULL)
+	if (client == NULL || config == NULL)
 		return -EINVAL;
 
 	if (config->stream_cb == NULL && config->aud_cb == NULL &&
@@ -2490,7 +3442,11 @@ static inline int cras_client_send_add_stream_command_message(
 	stream->wake_fds[0] = -1;
 	stream->wake_fds[1] = -1;
 	stream->direction = config->direction;
+	/* The audio thread per stream can wait on the doorbell, the shared
+	 * ones poll the aud_fds. */
 	stream->flags = config->flags;
+	if (!client->num_shared_threads)
+		stream->flags |= SHM_DOORBELL;
 
 	/* Caller might not set this volume scaler after stream created,
 	 * so always initialize it to 1.0f */
@@ -2502,7 +3458,10 @@ static inline int cras_client_send_add_stream_command_message(
 	cmd_msg.stream = stream;
 	cmd_msg.stream_id_out = stream_id_out;
 	cmd_msg.dev_idx = dev_idx;
-	rc = send_command_message(client, &cmd_msg.header);
+	if (stream_id_out)
+		rc = send_command_message(client, &cmd_msg.header);
+	else
+		rc = send_command_message_async(client, &cmd_msg.header, tag);
 	if (rc < 0) {
 		syslog(LOG_ERR,
 		       "cras_client: adding stream failed in thread %d", rc);
@@ -2524,16 +3483,22 @@ int cras_client_add_stream(struct cras_client *client,
 			   cras_stream_id_t *stream_id_out,
 			   struct cras_stream_params *config)
 {
+	if (stream_id_out == NULL)
+		return -EINVAL;
+
 	return cras_client_send_add_stream_command_message(
-		client, NO_DEVICE, stream_id_out, config);
+		client, NO_DEVICE, stream_id_out, config, 0);
 }
 
 int cras_client_add_pinned_stream(struct cras_client *client, uint32_t dev_idx,
 				  cras_stream_id_t *stream_id_out,
 				  struct cras_stream_params *config)
 {
+	if (stream_id_out == NULL)
+		return -EINVAL;
+
 	return cras_client_send_add_stream_command_message(
-		client, dev_idx, stream_id_out, config);
+		client, dev_idx, stream_id_out, config, 0);
 }
 
 int cras_client_rm_stream(struct cras_client *client,
@@ -2552,7 +3517,141 @@ int cras_client_set_stream_volume(struct cras_client *client,
 	if (client == NULL)
 		return -EINVAL;
 
-	return send_stream_volume_command_msg(client, stream_id, volume_scaler);
+	return send_stream_volume_command_msg(client, stream_id, volume_scaler,
+					      0, 0);
+}
+
+void cras_client_set_completion_cb(struct cras_client *client,
+				   cras_client_completion_cb_t cb,
+				   void *user_arg)
+{
+	client->completion_cb = cb;
+	client->completion_cb_arg = user_arg;
+}
+
+int cras_client_get_completion_fd(const struct cras_client *client)
+{
+	if (client == NULL)
+		return -EINVAL;
+
+	return client->completion_fd;
+}
+
+int cras_client_get_completion(struct cras_client *client,
+			       struct cras_client_completion *completion)
+{
+	struct completion_entry *entry;
+	uint64_t count;
+
+	if (client == NULL || completion == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&client->completion_lock);
+	entry = client->completions;
+	if (entry)
+		DL_DELETE(client->completions, entry);
+	pthread_mutex_unlock(&client->completion_lock);
+
+	if (entry == NULL)
+		return -EAGAIN;
+
+	/* Counts the completion down in the semaphore. */
+	if (read(client->completion_fd, &count, sizeof(count)) !=
+	    sizeof(count))
+		syslog(LOG_ERR, "cras_client: Failed to count completion");
+
+	*completion = entry->completion;
+	free(entry);
+	return 0;
+}
+
+int cras_client_add_stream_async(struct cras_client *client,
+				 struct cras_stream_params *config,
+				 uint64_t tag)
+{
+	return cras_client_send_add_stream_command_message(client, NO_DEVICE,
+							   NULL, config, tag);
+}
+
+int cras_client_add_pinned_stream_async(struct cras_client *client,
+					uint32_t dev_idx,
+					struct cras_stream_params *config,
+					uint64_t tag)
+{
+	return cras_client_send_add_stream_command_message(client, dev_idx,
+							   NULL, config, tag);
+}
+
+int cras_client_rm_stream_async(struct cras_client *client,
+				cras_stream_id_t stream_id, uint64_t tag)
+{
+	struct command_msg msg = {};
+
+	msg.len = sizeof(msg);
+	msg.stream_id = stream_id;
+	msg.msg_id = CLIENT_REMOVE_STREAM;
+
+	return send_command_message_async(client, &msg, tag);
+}
+
+int cras_client_drain_stream_async(struct cras_client *client,
+				   cras_stream_id_t stream_id, uint64_t tag)
+{
+	struct command_msg msg = {};
+
+	msg.len = sizeof(msg);
+	msg.stream_id = stream_id;
+	msg.msg_id = CLIENT_DRAIN_STREAM;
+
+	return send_command_message_async(client, &msg, tag);
+}
+
+int cras_client_set_stream_volume_async(struct cras_client *client,
+					cras_stream_id_t stream_id,
+					float volume_scaler, uint64_t tag)
+{
+	return send_stream_volume_command_msg(client, stream_id, volume_scaler,
+					      1, tag);
+}
+
+int cras_client_begin_batch(struct cras_client *client)
+{
+	if (client == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&client->batch_lock);
+	client->batch_depth++;
+	pthread_mutex_unlock(&client->batch_lock);
+	return 0;
+}
+
+int cras_client_end_batch(struct cras_client *client)
+{
+	int rc = 0;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&client->batch_lock);
+	if (client->batch_depth == 0)
+		rc = -EINVAL;
+	else if (--client->batch_depth == 0)
+		rc = flush_batch_locked(client);
+	pthread_mutex_unlock(&client->batch_lock);
+	return rc;
+}
+
+int cras_client_flush_batch(struct cras_client *client)
+{
+	int rc;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	pthread_mutex_lock(&client->batch_lock);
+	rc = flush_batch_locked(client);
+	pthread_mutex_unlock(&client->batch_lock);
+	return rc;
 }
 
 int cras_client_set_system_volume(struct cras_client *client, size_t volume)
@@ -2735,6 +3834,70 @@ int cras_client_get_default_output_buffer_size(struct cras_client *client)
 	return default_output_buffer_size;
 }
 
+int cras_client_get_mem_usage(const struct cras_client *client,
+			      struct cras_mem_usage *usage)
+{
+	int lock_rc;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -EINVAL;
+
+	/* Not covered by update_count, it changes as buffers come and go. */
+	memcpy(usage, &client->server_state->mem_usage, sizeof(*usage));
+	server_state_unlock(client, lock_rc);
+	return 0;
+}
+
+int cras_client_get_perf_profile(const struct cras_client *client,
+				 struct cras_perf_profile *profile)
+{
+	int lock_rc;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -EINVAL;
+
+	/* Set once when the server starts. */
+	memcpy(profile, &client->server_state->perf_profile, sizeof(*profile));
+	server_state_unlock(client, lock_rc);
+	return 0;
+}
+
+int cras_client_get_level(const struct cras_client *client,
+			  enum CRAS_LEVEL_METER_TYPE type, uint32_t id,
+			  float *peak, float *rms)
+{
+	const struct cras_level_meter *m;
+	struct cras_level_meter copy;
+	unsigned int i, seq;
+	int lock_rc, rc = -ENOENT;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -EINVAL;
+
+	/* Each meter has its own seq, the audio thread writes it. */
+	for (i = 0; i < CRAS_MAX_LEVEL_METERS; i++) {
+		m = &client->server_state->level_meters[i];
+		do {
+			while ((seq = *(volatile uint32_t *)&m->seq) & 1)
+				sched_yield();
+			__sync_synchronize();
+			copy = *m;
+			__sync_synchronize();
+		} while (seq != *(volatile uint32_t *)&m->seq);
+		if (copy.type != type || copy.id != id)
+			continue;
+		*peak = copy.peak;
+		*rms = copy.rms;
+		rc = 0;
+		break;
+	}
+	server_state_unlock(client, lock_rc);
+	return rc;
+}
+
 const struct audio_debug_info *
 cras_client_get_audio_debug_info(const struct cras_client *client)
 {
@@ -2825,6 +3988,49 @@ read_active_streams_again:
 	return num_streams;
 }
 
+int cras_client_get_state_changes(const struct cras_client *client,
+				  uint32_t mask, uint32_t *since)
+{
+	const struct cras_server_state *state;
+	const struct cras_state_change *entry;
+	unsigned version, head, i;
+	uint32_t changes;
+	int lock_rc;
+
+	if (since == NULL)
+		return -EINVAL;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -lock_rc;
+	state = client->server_state;
+
+read_changes_again:
+	version = begin_server_state_read(state);
+	head = state->journal_head;
+	changes = 0;
+	if (*since == 0) {
+		changes = CRAS_STATE_CHANGE_ALL;
+	} else if (*since != version) {
+		/* Walk back to the first update already seen. */
+		for (i = 0; i < head && i < CRAS_STATE_JOURNAL_SIZE; i++) {
+			entry = &state->journal[(head - 1 - i) %
+						CRAS_STATE_JOURNAL_SIZE];
+			if ((int32_t)(entry->update_count - *since) <= 0)
+				break;
+			changes |= entry->changes;
+		}
+		if (i == CRAS_STATE_JOURNAL_SIZE)
+			changes = CRAS_STATE_CHANGE_ALL;
+	}
+	if (end_server_state_read(state, version))
+		goto read_changes_again;
+
+	server_state_unlock(client, lock_rc);
+	*since = version;
+	return changes & mask;
+}
+
 int cras_client_run_thread(struct cras_client *client)
 {
 	int rc;
@@ -2881,6 +4087,18 @@ void cras_client_set_thread_priority_cb(struct cras_client *client,
 	client->thread_priority_cb = cb;
 }
 
+int cras_client_set_shared_audio_threads(struct cras_client *client,
+					 unsigned int num_threads)
+{
+	if (client == NULL)
+		return -EINVAL;
+	if (client->shared_threads)
+		return -EBUSY;
+
+	client->num_shared_threads = num_threads;
+	return 0;
+}
+
 int cras_client_get_output_devices(const struct cras_client *client,
 				   struct cras_iodev_info *devs,
 				   struct cras_ionode_info *nodes,
@@ -3191,6 +4409,23 @@ int cras_client_calc_capture_latency(const struct timespec *sample_time,
 	return 0;
 }
 
+int cras_client_sample_time_to_clock(const struct timespec *sample_time,
+				     clockid_t clock, struct timespec *ts)
+{
+	/* Per thread, so audio callbacks of different streams don't lock. */
+	static __thread struct cras_timebase timebase;
+	static __thread bool timebase_init;
+
+	if (sample_time == NULL || ts == NULL)
+		return -EINVAL;
+
+	if (!timebase_init || timebase.to != clock) {
+		cras_timebase_init(&timebase, CLOCK_MONOTONIC_RAW, clock);
+		timebase_init = true;
+	}
+	return cras_timebase_convert(&timebase, sample_time, ts);
+}
+
 int cras_client_reload_dsp(struct cras_client *client)
 {
 	struct cras_reload_dsp msg;
@@ -3249,56 +4484,121 @@ int cras_client_read_atlog(struct cras_client *client, uint64_t *read_idx,
 			   uint64_t *missing,
 			   struct audio_thread_event_log *buf)
 {
-	struct audio_thread_event_log log;
-	uint64_t i, sync_write_pos, len = 0;
-	struct timespec timestamp, last_timestamp;
+	const struct audio_thread_event_log *log = client->atlog_ro;
+	uint64_t sync_write_pos, write_pos, start, count, skip, i;
+	uint32_t len;
 
-	if (!client->atlog_ro)
+	if (!log)
 		return -EINVAL;
 
-	sync_write_pos = client->atlog_ro->sync_write_pos;
+	len = log->len;
+	sync_write_pos = log->sync_write_pos;
 	__sync_synchronize();
-	memcpy(&log, client->atlog_ro, sizeof(log));
 
 	if (sync_write_pos <= *read_idx)
 		return 0;
 
-	*missing = 0;
-	for (i = sync_write_pos - 1; i >= *read_idx; --i) {
-		uint64_t pos = i % log.len;
-		timestamp.tv_sec = log.log[pos].tag_sec & 0x00ffffff;
-		timestamp.tv_nsec = log.log[pos].nsec;
-
-		if (i != sync_write_pos - 1 &&
-		    timespec_after(&timestamp, &last_timestamp)) {
-			if (*read_idx)
-				*missing = i - *read_idx + 1;
-			*read_idx = i + 1;
-			break;
-		}
-		last_timestamp = timestamp;
-
-		if (!i)
-			break;
+	/* Events older than one lap of the ring are gone. Of the rest take
+	 * the oldest first, at most what buf holds, so a reader that fell
+	 * behind a large log catches up over several calls. */
+	start = *read_idx;
+	if (sync_write_pos - start > len)
+		start = sync_write_pos - len;
+	count = MIN(sync_write_pos - start, AUDIO_THREAD_EVENT_LOG_SIZE);
+	for (i = 0; i < count; i++)
+		buf->log[i] = log->log[(start + i) % len];
+
+	/* Drop the events the writer lapped while they were being copied,
+	 * they may be torn. */
+	__sync_synchronize();
+	write_pos = log->write_pos;
+	if (write_pos > len && write_pos - len > start) {
+		skip = MIN(write_pos - len - start, count);
+		memmove(buf->log, &buf->log[skip],
+			sizeof(struct audio_thread_event) * (count - skip));
+		start += skip;
+		count -= skip;
 	}
 
-	/* Copies the continuous part of log. */
-	if ((sync_write_pos - 1) % log.len < *read_idx % log.len) {
-		len = log.len - *read_idx % log.len;
-		memcpy(buf->log, &log.log[*read_idx % log.len],
-		       sizeof(struct audio_thread_event) * len);
-		memcpy(&buf->log[len], log.log,
-		       sizeof(struct audio_thread_event) *
-			       ((sync_write_pos - 1) % log.len + 1));
-		len = sync_write_pos - *read_idx;
-	} else {
-		len = sync_write_pos - *read_idx;
-		memcpy(buf->log, &log.log[*read_idx % log.len],
-		       sizeof(struct audio_thread_event) * len);
+	*missing = *read_idx ? start - *read_idx : 0;
+	*read_idx = start + count;
+	return count;
+}
+
+int cras_client_get_observer_event_access(
+	struct cras_client *client, void (*observer_event_cb)(struct cras_client *))
+{
+	struct cras_get_observer_event_fd msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	if (client->observer_event_fd_callback != NULL)
+		return -EINVAL;
+	client->observer_event_fd_callback = observer_event_cb;
+
+	cras_fill_get_observer_event_fd(&msg);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_get_observer_event_fd(const struct cras_client *client)
+{
+	if (client == NULL)
+		return -EINVAL;
+
+	return client->observer_event_fd;
+}
+
+int cras_client_read_observer_events(const struct cras_client *client,
+				     uint64_t *read_idx, uint64_t *missing,
+				     struct cras_observer_event *buf,
+				     unsigned int len)
+{
+	const struct cras_observer_event_ring *ring;
+	uint64_t write_pos, start, count, skip, i;
+	int lock_rc;
+
+	if (read_idx == NULL || missing == NULL || buf == NULL)
+		return -EINVAL;
+
+	lock_rc = server_state_rdlock(client);
+	if (lock_rc)
+		return -lock_rc;
+	ring = &client->server_state->observer_events;
+
+	write_pos = ring->write_pos;
+	__sync_synchronize();
+
+	count = 0;
+	start = *read_idx;
+	if (write_pos > start) {
+		/* Like cras_client_read_atlog, events older than one lap of
+		 * the ring are gone and the oldest of the rest come first. */
+		if (write_pos - start > CRAS_OBSERVER_EVENT_RING_SIZE)
+			start = write_pos - CRAS_OBSERVER_EVENT_RING_SIZE;
+		count = MIN(write_pos - start, len);
+		for (i = 0; i < count; i++)
+			buf[i] = ring->events[(start + i) %
+					      CRAS_OBSERVER_EVENT_RING_SIZE];
+
+		/* Drop the events lapped while being copied. */
+		__sync_synchronize();
+		write_pos = ring->write_pos;
+		if (write_pos > CRAS_OBSERVER_EVENT_RING_SIZE &&
+		    write_pos - CRAS_OBSERVER_EVENT_RING_SIZE > start) {
+			skip = MIN(write_pos - CRAS_OBSERVER_EVENT_RING_SIZE -
+					   start,
+				   count);
+			memmove(buf, &buf[skip], sizeof(*buf) * (count - skip));
+			start += skip;
+			count -= skip;
+		}
+		*missing = *read_idx ? start - *read_idx : 0;
+		*read_idx = start + count;
 	}
 
-	*read_idx = sync_write_pos;
-	return len;
+	server_state_unlock(client, lock_rc);
+	return count;
 }
 
 int cras_client_update_main_thread_debug_info(
@@ -3637,6 +4937,105 @@ int cras_client_set_bt_wbs_enabled(struct cras_client *client, bool enabled)
 	return write_message_to_server(client, &msg.header);
 }
 
+int cras_client_set_loopback_target(struct cras_client *client,
+				    enum CRAS_LOOPBACK_TARGET_MODE mode,
+				    uint32_t client_id,
+				    cras_stream_id_t stream_id)
+{
+	struct cras_set_loopback_target msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	cras_fill_set_loopback_target(&msg, mode, client_id, stream_id);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_upload_sample(struct cras_client *client, uint32_t sample_id,
+			      const struct cras_audio_format *format,
+			      const void *samples, unsigned int frames)
+{
+	struct cras_upload_sample msg;
+	size_t bytes;
+	void *buf;
+	int fd, rc;
+
+	if (client == NULL || format == NULL || samples == NULL || !frames)
+		return -EINVAL;
+
+	/* The server copies the clip from a memfd, it can be larger than
+	 * any message. */
+	bytes = (size_t)frames * cras_get_format_bytes(format);
+	fd = cras_shm_memfd_create("cras-sample", bytes, 0);
+	if (fd < 0)
+		return fd;
+	buf = mmap(NULL, bytes, PROT_WRITE, MAP_SHARED, fd, 0);
+	if (buf == MAP_FAILED) {
+		rc = -errno;
+		close(fd);
+		return rc;
+	}
+	memcpy(buf, samples, bytes);
+	munmap(buf, bytes);
+
+	cras_fill_upload_sample(&msg, sample_id, format, frames);
+	rc = write_message_with_fds_to_server(client, &msg.header, &fd, 1);
+	close(fd);
+	return rc < 0 ? rc : 0;
+}
+
+int cras_client_play_sample(struct cras_client *client, uint32_t sample_id,
+			    uint32_t dev_idx)
+{
+	struct cras_play_sample msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	cras_fill_play_sample(&msg, sample_id, dev_idx);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_remove_sample(struct cras_client *client, uint32_t sample_id)
+{
+	struct cras_remove_sample msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	cras_fill_remove_sample(&msg, sample_id);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_add_monitor_route(struct cras_client *client,
+				  uint32_t input_dev_idx,
+				  uint32_t output_dev_idx,
+				  const struct cras_audio_format *format,
+				  uint32_t effects, float gain)
+{
+	struct cras_add_monitor_route msg;
+
+	if (client == NULL || format == NULL)
+		return -EINVAL;
+
+	cras_fill_add_monitor_route(&msg, input_dev_idx, output_dev_idx,
+				    format, effects, gain);
+	return write_message_to_server(client, &msg.header);
+}
+
+int cras_client_rm_monitor_route(struct cras_client *client,
+				 uint32_t input_dev_idx,
+				 uint32_t output_dev_idx)
+{
+	struct cras_rm_monitor_route msg;
+
+	if (client == NULL)
+		return -EINVAL;
+
+	cras_fill_rm_monitor_route(&msg, input_dev_idx, output_dev_idx);
+	return write_message_to_server(client, &msg.header);
+}
+
 void cras_client_set_state_change_callback_context(struct cras_client *client,
 						   void *context)
 {
@@ -3656,7 +5055,7 @@ static int cras_send_register_notification(struct cras_client *client,
 	 * reconnecting, so we can ignore message send failure due to no
 	 * connection. */
 	cras_fill_register_notification_message(&msg, msg_id, do_register);
-	rc = write_message_to_server(client, &msg.header);
+	rc = write_to_server(client, &msg.header);
 	if (rc == -EPIPE)
 		rc = 0;
 	return rc;
@@ -167,6 +167,29 @@ typedef int (*cras_hotword_error_cb_t)(struct cras_client *client,
 				       struct cras_hotword_handle *handle,
 				       int error, void *user_data);
 
+/* Completion of an asynchronous control operation.
+ *  tag - The tag given with the operation.
+ *  result - 0 on success or a negative error code.
+ *  stream_id - The stream of the operation, the new one for an add.
+ */
+struct cras_client_completion {
+	uint64_t tag;
+	int result;
+	cras_stream_id_t stream_id;
+};
+
+/* Callback for completions of asynchronous control operations. Called from
+ * the client thread, so it must not call the blocking client functions.
+ *
+ * Args:
+ *    client - The client created with cras_client_create().
+ *    completion - The completion, valid during the call.
+ *    user_arg - The argument given to cras_client_set_completion_cb().
+ */
+typedef void (*cras_client_completion_cb_t)(
+	struct cras_client *client,
+	const struct cras_client_completion *completion, void *user_arg);
+
 /*
  * Client handling.
  */
@@ -292,6 +315,19 @@ void cras_client_set_connection_status_cb(
 void cras_client_set_thread_priority_cb(struct cras_client *client,
 					cras_thread_priority_cb_t cb);
 
+/* Services all the streams of the client with a pool of shared audio threads
+ * instead of an audio thread per stream. The streams ready at once are
+ * serviced in the order of their deadlines. Must be called before the first
+ * stream is added.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    num_threads - The number of shared threads, 0 for a thread per stream.
+ * Returns:
+ *    0 on success, -EBUSY if the shared threads have started.
+ */
+int cras_client_set_shared_audio_threads(struct cras_client *client,
+					 unsigned int num_threads);
+
 /* Returns the current list of output devices.
  *
  * Requires that the connection to the server has been established.
@@ -509,9 +545,10 @@ int cras_client_get_atlog_access(struct cras_client *client,
 				 void (*atlog_access_cb)(struct cras_client *));
 
 /* Reads continuous audio thread log into 'buf', starting from 'read_idx'-th log
- * till the latest. The number of missing logs within the range will be stored
- * in 'missing'. Requires calling cras_client_get_atlog_access() beforehand
- * to get access to audio thread log.
+ * till the latest, at most AUDIO_THREAD_EVENT_LOG_SIZE logs per call. The
+ * number of missing logs within the range will be stored in 'missing'.
+ * Requires calling cras_client_get_atlog_access() beforehand to get access to
+ * audio thread log.
  * Args:
  *    client - The client from cras_client_create.
  *    read_idx - The log number to start reading with.
@@ -524,6 +561,52 @@ int cras_client_read_atlog(struct cras_client *client, uint64_t *read_idx,
 			   uint64_t *missing,
 			   struct audio_thread_event_log *buf);
 
+/* Gets the eventfd the server signals after adding observer events to the
+ * ring in the server state. Optional, a client can also poll the ring with
+ * cras_client_read_observer_events. The fd is dropped when the connection to
+ * the server is lost, get it again after reconnecting.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    observer_event_cb - Function to call once the fd is available.
+ * Returns:
+ *    0 on success, -EINVAL if the client isn't valid or a request is already
+ *    pending.
+ */
+int cras_client_get_observer_event_access(
+	struct cras_client *client,
+	void (*observer_event_cb)(struct cras_client *));
+
+/* Returns the eventfd from cras_client_get_observer_event_access, or -1 if it
+ * isn't available. Wait for it edge-triggered, for example with EPOLLET, and
+ * don't read it: the server resets it before each signal.
+ * Args:
+ *    client - The client from cras_client_create.
+ */
+int cras_client_get_observer_event_fd(const struct cras_client *client);
+
+/* Reads observer events from the ring in the server state, starting from the
+ * 'read_idx'-th event, oldest first. Lets a client follow volume, mute, node
+ * and active stream changes at its own pace without registering for
+ * notification messages. The number of events overwritten before they could
+ * be read is stored in 'missing'.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    read_idx - The event number to start reading with, 0 for the first
+ *        call. Advanced past the events read.
+ *    missing - The pointer to store the number of missing events.
+ *    buf - The buffer to which events will be copied.
+ *    len - The number of events buf holds.
+ * Returns:
+ *    The number of events copied. < 0 on failure.
+ */
+int cras_client_read_observer_events(const struct cras_client *client,
+				     uint64_t *read_idx, uint64_t *missing,
+				     struct cras_observer_event *buf,
+				     unsigned int len);
+
 /* Asks the server to dump current audio thread snapshots.
  *
  * Args:
@@ -687,6 +770,106 @@ int cras_client_set_stream_volume(struct cras_client *client,
 				  cras_stream_id_t stream_id,
 				  float volume_scaler);
 
+/*
+ * Asynchronous control operations. These return once the operation is queued
+ * to the client thread, and report the result in a completion instead of
+ * waiting for it. Completions go to the callback set with
+ * cras_client_set_completion_cb(), or without one, wait in a queue read with
+ * cras_client_get_completion().
+ */
+
+/* Sets the callback for completions of asynchronous operations.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    cb - The callback, NULL to queue the completions.
+ *    user_arg - Passed to the callback.
+ */
+void cras_client_set_completion_cb(struct cras_client *client,
+				   cras_client_completion_cb_t cb,
+				   void *user_arg);
+
+/* Returns an fd that polls readable while completions are queued. */
+int cras_client_get_completion_fd(const struct cras_client *client);
+
+/* Takes the oldest queued completion.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    completion - Filled with the completion.
+ * Returns:
+ *    0 on success, -EAGAIN if there is no completion queued.
+ */
+int cras_client_get_completion(struct cras_client *client,
+			       struct cras_client_completion *completion);
+
+/* Asynchronous cras_client_add_stream, the new stream id is in the
+ * completion. */
+int cras_client_add_stream_async(struct cras_client *client,
+				 struct cras_stream_params *config,
+				 uint64_t tag);
+
+/* Asynchronous cras_client_add_pinned_stream. */
+int cras_client_add_pinned_stream_async(struct cras_client *client,
+					uint32_t dev_idx,
+					struct cras_stream_params *config,
+					uint64_t tag);
+
+/* Asynchronous cras_client_rm_stream. */
+int cras_client_rm_stream_async(struct cras_client *client,
+				cras_stream_id_t stream_id, uint64_t tag);
+
+/* Removes a playback stream and lets the server play the samples it already
+ * holds. The stream stops locally right away, like with
+ * cras_client_rm_stream_async(), but the completion only comes once the
+ * server reports the stream played out and gone, or with -ENOTCONN if the
+ * connection to the server is lost first.
+ */
+int cras_client_drain_stream_async(struct cras_client *client,
+				   cras_stream_id_t stream_id, uint64_t tag);
+
+/* Asynchronous cras_client_set_stream_volume. */
+int cras_client_set_stream_volume_async(struct cras_client *client,
+					cras_stream_id_t stream_id,
+					float volume_scaler, uint64_t tag);
+
+/*
+ * Batching of control messages. Between cras_client_begin_batch() and
+ * cras_client_end_batch(), control messages to the server are held and sent
+ * together, handled by the server in one pass. A message that supersedes a
+ * held one, like another system volume or another value for the same node
+ * attribute, replaces it. Useful while the user drags a slider.
+ *
+ * Streams added and removed during a batch are connected and disconnected on
+ * the server when the batch is sent, and routed together there, so a client
+ * starting or stopping many streams pays for one round trip to the server's
+ * audio thread. A removed stream stops locally right away.
+ */
+
+/* Starts holding control messages. Calls can nest, messages are sent when the
+ * outermost batch ends.
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    0 on success, -EINVAL if client is NULL.
+ */
+int cras_client_begin_batch(struct cras_client *client);
+
+/* Ends a batch started with cras_client_begin_batch().
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    0 on success, or the negative error from sending the held messages.
+ *    -EINVAL if no batch was started.
+ */
+int cras_client_end_batch(struct cras_client *client);
+
+/* Sends the held messages now, without ending the batch.
+ * Args:
+ *    client - The client from cras_client_create.
+ * Returns:
+ *    0 on success, or the negative error from sending the held messages.
+ */
+int cras_client_flush_batch(struct cras_client *client);
+
 /*
  * System level functions.
  */
@@ -839,6 +1022,54 @@ long cras_client_get_system_max_volume(const struct cras_client *client);
  */
 int cras_client_get_default_output_buffer_size(struct cras_client *client);
 
+/* Gets the memory allocated by each subsystem of the server.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    usage - Filled with the bytes now and at most allocated, indexed by
+ *        enum CRAS_MEM_SUBSYS.
+ * Returns:
+ *    0 on success, -EINVAL if the server state isn't available.
+ */
+int cras_client_get_mem_usage(const struct cras_client *client,
+			      struct cras_mem_usage *usage);
+
+/* Gets the performance profile the server runs with, as configured for the
+ * board.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    profile - Filled with the profile.
+ * Returns:
+ *    0 on success, -EINVAL if the server state isn't available.
+ */
+int cras_client_get_perf_profile(const struct cras_client *client,
+				 struct cras_perf_profile *profile);
+
+/* Gets the level of an open device or a playback stream, as the server
+ * mixes or captures it. Reading it costs no message and no stream, a meter
+ * in a UI can poll it at its own refresh rate.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    type - CRAS_LEVEL_METER_DEVICE or CRAS_LEVEL_METER_STREAM.
+ *    id - The index of the device or the id of the stream.
+ *    peak - Filled with the peak sample magnitude, 0.0 to 1.0.
+ *    rms - Filled with the RMS level, 0.0 to 1.0.
+ * Returns:
+ *    0 on success, -ENOENT if the device isn't open or the stream isn't
+ *    metered, -EINVAL if the server state isn't available.
+ */
+int cras_client_get_level(const struct cras_client *client,
+			  enum CRAS_LEVEL_METER_TYPE type, uint32_t id,
+			  float *peak, float *rms);
+
 /* Gets audio debug info.
  *
  * Requires that the connection to the server has been established.
@@ -908,6 +1139,25 @@ cras_client_get_audio_thread_snapshot_buffer(const struct cras_client *client);
 unsigned cras_client_get_num_active_streams(const struct cras_client *client,
 					    struct timespec *ts);
 
+/* Checks which parts of the server state changed since a previous check, so
+ * that a caller polling the device or node lists only reads them again when
+ * they changed.
+ *
+ * Requires that the connection to the server has been established.
+ *
+ * Args:
+ *    client - The client from cras_client_create.
+ *    mask - Bitmask of enum CRAS_STATE_CHANGE, the parts of interest.
+ *    since - The update count from the previous check, 0 for the first one.
+ *        Filled with the current update count.
+ * Returns:
+ *    The bits of mask that changed, all of mask for the first check or when
+ *    the changes since the previous one are no longer in the journal.
+ *    Negative error code on failure.
+ */
+int cras_client_get_state_changes(const struct cras_client *client,
+				  uint32_t mask, uint32_t *since);
+
 /*
  * Utility functions.
  */
@@ -946,6 +1196,22 @@ int cras_client_calc_playback_latency(const struct timespec *sample_time,
 int cras_client_calc_capture_latency(const struct timespec *sample_time,
 				     struct timespec *delay);
 
+/* Converts the sample time stamp passed to the audio callback of a stream to
+ * another clock. The time stamp is the time the next sample written will be
+ * played for playback, or the time the next sample read was captured for
+ * capture, in CLOCK_MONOTONIC_RAW. Players syncing to CLOCK_MONOTONIC or
+ * CLOCK_REALTIME use this rather than add a latency to their clock, which
+ * drifts from the raw clock over long sessions.
+ * Args:
+ *    sample_time - The sample time stamp passed in to aud_cb.
+ *    clock - The clock to convert to.
+ *    ts - Filled with sample_time in clock.
+ * Returns:
+ *    0 on success, -EINVAL if sample_time or ts is NULL or clock invalid.
+ */
+int cras_client_sample_time_to_clock(const struct timespec *sample_time,
+				     clockid_t clock, struct timespec *ts);
+
 /* Set the volume of the given output node. Only for output nodes.
  *
  * Args:
@@ -1145,6 +1411,101 @@ int cras_client_get_aec_group_id(struct cras_client *client);
  */
 int cras_client_set_bt_wbs_enabled(struct cras_client *client, bool enabled);
 
+/*
+ * Selects the output streams the post mix loopback device captures, to
+ * record the audio of one client, or all but one client.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    mode - LOOPBACK_TARGET_ALL for the whole mix, LOOPBACK_TARGET_INCLUDE
+ *        or LOOPBACK_TARGET_EXCLUDE for the streams of the target only or
+ *        all but them.
+ *    client_id - The client of the target streams.
+ *    stream_id - A stream of client_id, or 0 for all its streams.
+ * Returns:
+ *    0 on success, or negative error code on failure (from errno.h).
+ */
+int cras_client_set_loopback_target(struct cras_client *client,
+				    enum CRAS_LOOPBACK_TARGET_MODE mode,
+				    uint32_t client_id,
+				    cras_stream_id_t stream_id);
+
+/*
+ * Uploads a short clip, like a UI sound, to the sample cache of the server,
+ * replacing the clip with the same id. The clip is played later with
+ * cras_client_play_sample() without setting up a stream. The ids are shared
+ * by all the clients.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    sample_id - The id to play the clip by.
+ *    format - The format of the samples.
+ *    samples - The interleaved samples, copied by the call.
+ *    frames - The number of frames in samples.
+ * Returns:
+ *    0 on success, or negative error code on failure (from errno.h).
+ */
+int cras_client_upload_sample(struct cras_client *client, uint32_t sample_id,
+			      const struct cras_audio_format *format,
+			      const void *samples, unsigned int frames);
+
+/*
+ * Plays a clip uploaded with cras_client_upload_sample() once.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    sample_id - The id of the clip.
+ *    dev_idx - The device to play it on, or NO_DEVICE to play it where the
+ *        other output streams play.
+ * Returns:
+ *    0 on success, or negative error code on failure (from errno.h).
+ */
+int cras_client_play_sample(struct cras_client *client, uint32_t sample_id,
+			    uint32_t dev_idx);
+
+/*
+ * Removes a clip uploaded with cras_client_upload_sample(). Plays of it in
+ * progress play to the end.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    sample_id - The id of the clip.
+ * Returns:
+ *    0 on success, or negative error code on failure (from errno.h).
+ */
+int cras_client_remove_sample(struct cras_client *client, uint32_t sample_id);
+
+/*
+ * Plays what an input device captures on an output device, for monitoring a
+ * mic or passing a line in through. The audio stays in the server and is
+ * mixed to the output in the wake it is captured in, without the latency of
+ * capturing and playing it in a client.
+ * Args:
+ *    client - The client from cras_client_create.
+ *    input_dev_idx - The device to capture from.
+ *    output_dev_idx - The device to play to.
+ *    format - The format the audio is moved in, the rate and channels it is
+ *        converted through.
+ *    effects - The APM effects to apply to the captured audio, like
+ *        APM_NOISE_SUPRESSION.
+ *    gain - The scaler the audio is played with, 1.0 to leave it as is.
+ * Returns:
+ *    0 on success, or negative error code on failure (from errno.h).
+ */
+int cras_client_add_monitor_route(struct cras_client *client,
+				  uint32_t input_dev_idx,
+				  uint32_t output_dev_idx,
+				  const struct cras_audio_format *format,
+				  uint32_t effects, float gain);
+
+/*
+ * Removes a route added with cras_client_add_monitor_route().
+ * Args:
+ *    client - The client from cras_client_create.
+ *    input_dev_idx, output_dev_idx - The devices of the route.
+ * Returns:
+ *    0 on success, or negative error code on failure (from errno.h).
+ */
+int cras_client_rm_monitor_route(struct cras_client *client,
+				 uint32_t input_dev_idx,
+				 uint32_t output_dev_idx);
+
 /* Set the context pointer for system state change callbacks.
  * Args:
  *    client - The client from cras_client_create.
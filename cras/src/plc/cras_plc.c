@@ -144,7 +144,8 @@ int cras_msbc_plc_handle_good_frames(struct cras_msbc_plc *state,
 		/* If there was no packet concealment before this good frame,
 		 * we just simply copy the input to output without reconverge.
 		 */
-		memmove(output, input, MSBC_FS * MSBC_SAMPLE_SIZE);
+		if (output != input)
+			memmove(output, input, MSBC_FS * MSBC_SAMPLE_SIZE);
 	} else {
 		frame_head = &state->hist[PLC_HL];
 		input_samples = (int16_t *)input;
@@ -174,25 +175,59 @@ int cras_msbc_plc_handle_good_frames(struct cras_msbc_plc *state,
 	return MSBC_CODE_SIZE;
 }
 
-float cross_correlation(int16_t *x, int16_t *y)
+/* Independent partial sums in dot_product, which lets the compiler vectorize
+ * the loop without reordering a single floating point sum. */
+#define PLC_DOT_LANES 8
+
+/* Returns the dot product of the PLC_TL samples at x and y. */
+static float dot_product(const int16_t *x, const int16_t *y)
 {
-	float sum = 0, x2 = 0, y2 = 0;
+	float sum[PLC_DOT_LANES] = { 0 };
+	float total = 0;
+	int i, j;
 
-	for (int i = 0; i < PLC_TL; i++) {
-		sum += ((float)x[i]) * y[i];
-		x2 += ((float)x[i]) * x[i];
-		y2 += ((float)y[i]) * y[i];
-	}
-	return sum / sqrtf(x2 * y2);
+	for (i = 0; i < PLC_TL; i += PLC_DOT_LANES)
+		for (j = 0; j < PLC_DOT_LANES; j++)
+			sum[j] += (float)x[i + j] * y[i + j];
+	for (j = 0; j < PLC_DOT_LANES; j++)
+		total += sum[j];
+	return total;
+}
+
+/* Returns the energy of the PLC_TL samples at x. */
+static int64_t energy(const int16_t *x)
+{
+	int64_t sum = 0;
+
+	for (int i = 0; i < PLC_TL; i++)
+		sum += (int32_t)x[i] * x[i];
+	return sum;
 }
 
+/* Finds the lag in the window whose PLC_TL samples correlate best with the
+ * template, the PLC_TL samples last received. The energy of the template is
+ * computed once, and the one of each candidate by sliding it on from the
+ * previous lag, which leaves one dot product per lag.
+ */
 int pattern_match(int16_t *hist)
 {
+	const int16_t *tmpl = &hist[PLC_HL - PLC_TL];
 	int best = 0;
 	float cn, max_cn = FLT_MIN;
+	float tmpl_energy = energy(tmpl);
+	int64_t y2 = energy(hist);
 
 	for (int i = 0; i < PLC_WL; i++) {
-		cn = cross_correlation(&hist[PLC_HL - PLC_TL], &hist[i]);
+		if (i) {
+			y2 -= (int32_t)hist[i - 1] * hist[i - 1];
+			y2 += (int32_t)hist[i + PLC_TL - 1] *
+			      hist[i + PLC_TL - 1];
+		}
+		/* Silence correlates with nothing. */
+		if (y2 == 0)
+			continue;
+		cn = dot_product(tmpl, &hist[i]) /
+		     sqrtf(tmpl_energy * (float)y2);
 		if (cn > max_cn) {
 			best = i;
 			max_cn = cn;
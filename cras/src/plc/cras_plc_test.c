@@ -14,6 +14,7 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cras_sbc_codec.h"
@@ -21,8 +22,16 @@
 
 #define MSBC_CODE_SIZE 240
 #define MSBC_PKT_FRAME_LEN 57
+#define MSBC_H2_HEADER_LEN 2
+#define MSBC_SYNC_WORD 0xAD
 #define RND_SEED 7
 
+/* Each packet parse_sco.py writes is a 3 bytes header, with the erroneous
+ * status flag in the high nibble of the second byte, and 60 bytes of SCO
+ * data. */
+#define SCO_TRACE_HDR_LEN 3
+#define SCO_TRACE_PKT_LEN (SCO_TRACE_HDR_LEN + 60)
+
 static const uint8_t msbc_zero_frame[] = {
 	0xad, 0x00, 0x00, 0xc5, 0x00, 0x00, 0x00, 0x00, 0x77, 0x6d, 0xb6, 0xdd,
 	0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb, 0x77, 0x6d, 0xb6,
@@ -147,6 +156,88 @@ void plc_experiment(const char *input_filename, bool *pl_seq, bool with_plc)
 	}
 }
 
+static double elapsed_us(const struct timespec *start,
+			 const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) * 1e6 +
+	       (end->tv_nsec - start->tv_nsec) / 1e3;
+}
+
+/* Replays the SCO RX packets parse_sco.py extracted from a btsnoop, and
+ * conceals the ones with erroneous status flag or without an mSBC frame
+ * where expected. Reports the time spent in concealment, which is spent in
+ * the audio thread when the link is the most congested. */
+void plc_benchmark(const char *trace_filename)
+{
+	const char *output_filename = "output_from_sco.raw";
+	int trace_fd = -1, output_fd = -1, rc;
+	struct cras_audio_codec *msbc = cras_msbc_codec_create();
+	struct cras_msbc_plc *plc = cras_msbc_plc_create();
+	uint8_t pkt[SCO_TRACE_PKT_LEN], buffer[MSBC_CODE_SIZE];
+	const uint8_t *frame = &pkt[SCO_TRACE_HDR_LEN + MSBC_H2_HEADER_LEN];
+	struct timespec start, end;
+	double us, total_us = 0, max_us = 0;
+	unsigned count = 0, lost = 0;
+	size_t decoded;
+
+	if (!msbc || !plc) {
+		fprintf(stderr, "Cannot create the mSBC codec and PLC\n");
+		goto cleanup;
+	}
+
+	trace_fd = open(trace_filename, O_RDONLY);
+	if (trace_fd == -1) {
+		fprintf(stderr, "Cannot open trace file %s\n", trace_filename);
+		goto cleanup;
+	}
+
+	output_fd = open(output_filename, O_CREAT | O_RDWR | O_TRUNC, 0644);
+	if (output_fd == -1) {
+		fprintf(stderr, "Cannot open output file %s\n",
+			output_filename);
+		goto cleanup;
+	}
+
+	while (read(trace_fd, pkt, SCO_TRACE_PKT_LEN) == SCO_TRACE_PKT_LEN) {
+		count++;
+		if ((pkt[1] >> 4) == 0 && frame[0] == MSBC_SYNC_WORD &&
+		    msbc->decode(msbc, frame, MSBC_PKT_FRAME_LEN, buffer,
+				 MSBC_CODE_SIZE, &decoded) >= 0) {
+			cras_msbc_plc_handle_good_frames(plc, buffer, buffer);
+		} else {
+			lost++;
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			cras_msbc_plc_handle_bad_frames(plc, msbc, buffer);
+			clock_gettime(CLOCK_MONOTONIC, &end);
+			us = elapsed_us(&start, &end);
+			total_us += us;
+			max_us = MAX(max_us, us);
+		}
+
+		rc = write(output_fd, buffer, MSBC_CODE_SIZE);
+		if (rc < 0) {
+			fprintf(stderr, "Cannot write file %s\n",
+				output_filename);
+			goto cleanup;
+		}
+	}
+
+	printf("%u packets, %u concealed\n", count, lost);
+	if (lost)
+		printf("PLC per lost packet: %.2f us average, %.2f us max\n",
+		       total_us / lost, max_us);
+
+cleanup:
+	if (trace_fd >= 0)
+		close(trace_fd);
+	if (output_fd >= 0)
+		close(output_fd);
+	if (plc)
+		cras_msbc_plc_destroy(plc);
+	if (msbc)
+		cras_sbc_codec_destroy(msbc);
+}
+
 static void show_usage()
 {
 	printf("This test only supports reading/writing raw audio with format:\n"
@@ -156,29 +247,33 @@ static void show_usage()
 	printf("--pattern - Hex string representing consecutive packets'"
 	       "status.\n");
 	printf("--random - Percentage of packet loss.\n");
+	printf("--sco - SCO packets extracted by parse_sco.py, to replay and "
+	       "time the PLC with.\n");
 }
 
 int main(int argc, char **argv)
 {
 	int fd;
 	struct stat st;
-	float pl_percent;
+	float pl_percent = 0;
 	int pl_percent_set = 0;
 	int option_character;
 	int option_index = 0;
 	const char *input_file = NULL;
 	const char *pl_hex = NULL;
+	const char *sco_trace = NULL;
 	bool *pl_seq = NULL;
 	static struct option long_options[] = {
 		{ "help", no_argument, NULL, 'h' },
 		{ "input", required_argument, NULL, 'i' },
 		{ "pattern", required_argument, NULL, 'p' },
 		{ "random", required_argument, NULL, 'r' },
+		{ "sco", required_argument, NULL, 's' },
 		{ NULL, 0, NULL, 0 },
 	};
 
 	while (true) {
-		option_character = getopt_long(argc, argv, "i:r:p:h",
+		option_character = getopt_long(argc, argv, "i:r:p:s:h",
 					       long_options, &option_index);
 		if (option_character == -1)
 			break;
@@ -196,11 +291,19 @@ int main(int argc, char **argv)
 			pl_percent = atof(optarg);
 			pl_percent_set = 1;
 			break;
+		case 's':
+			sco_trace = optarg;
+			break;
 		default:
 			break;
 		}
 	}
 
+	if (sco_trace) {
+		plc_benchmark(sco_trace);
+		return 0;
+	}
+
 	if ((!pl_percent_set && !pl_hex) || !input_file) {
 		show_usage();
 		return 1;
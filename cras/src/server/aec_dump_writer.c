@@ -0,0 +1,239 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for fopencookie */
+#endif
+
+#include <errno.h>
+#include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "aec_dump_writer.h"
+
+/* The size field in front of each record. */
+#define RECORD_HEADER_BYTES 4
+
+/*
+ * The ring holds bytes at positions counted by free running counters, a
+ * position p lives at p % capacity. The producer appends whole records at
+ * tail, the writer thread writes them out from head.
+ * Members:
+ *    fd - The file written to.
+ *    ring - The queued bytes.
+ *    capacity - The size of ring.
+ *    head - Where the writer thread reads next.
+ *    tail - Where the producer appends next.
+ *    header - The size field of the record being received.
+ *    header_bytes - How many bytes of header have been received.
+ *    record_left - The bytes still to come of the current record.
+ *    dropping - True if the current record is dropped.
+ *    closing - Set when the handle is closed.
+ *    dropped_records, dropped_bytes - What didn't fit in the ring.
+ *    wake - Posted when there is something for the writer thread.
+ *    tid - The writer thread.
+ */
+struct aec_dump_writer {
+	int fd;
+	uint8_t *ring;
+	size_t capacity;
+	uint64_t head;
+	uint64_t tail;
+	uint8_t header[RECORD_HEADER_BYTES];
+	unsigned int header_bytes;
+	uint64_t record_left;
+	int dropping;
+	int closing;
+	unsigned int dropped_records;
+	uint64_t dropped_bytes;
+	sem_t wake;
+	pthread_t tid;
+};
+
+/* Appends bytes to the ring, which the caller checked has room. */
+static void ring_append(struct aec_dump_writer *w, const uint8_t *buf,
+			size_t size)
+{
+	size_t first;
+
+	while (size) {
+		first = MIN(size, w->capacity - w->tail % w->capacity);
+		memcpy(w->ring + w->tail % w->capacity, buf, first);
+		__atomic_store_n(&w->tail, w->tail + first, __ATOMIC_RELEASE);
+		buf += first;
+		size -= first;
+	}
+}
+
+static size_t ring_free(struct aec_dump_writer *w)
+{
+	return w->capacity -
+	       (w->tail - __atomic_load_n(&w->head, __ATOMIC_ACQUIRE));
+}
+
+/* Starts a record once its size field is complete, queueing it only if
+ * it fits whole. */
+static void start_record(struct aec_dump_writer *w)
+{
+	uint32_t size;
+
+	memcpy(&size, w->header, sizeof(size));
+	w->record_left = size;
+	w->dropping = ring_free(w) < RECORD_HEADER_BYTES + (uint64_t)size;
+	if (w->dropping) {
+		w->dropped_records++;
+		w->dropped_bytes += RECORD_HEADER_BYTES + (uint64_t)size;
+		return;
+	}
+	ring_append(w, w->header, RECORD_HEADER_BYTES);
+}
+
+static ssize_t writer_write(void *cookie, const char *buf, size_t size)
+{
+	struct aec_dump_writer *w = (struct aec_dump_writer *)cookie;
+	const uint8_t *p = (const uint8_t *)buf;
+	size_t left = size, n;
+
+	while (left) {
+		if (w->header_bytes < RECORD_HEADER_BYTES) {
+			n = MIN(left, RECORD_HEADER_BYTES - w->header_bytes);
+			memcpy(w->header + w->header_bytes, p, n);
+			w->header_bytes += n;
+			if (w->header_bytes == RECORD_HEADER_BYTES)
+				start_record(w);
+		} else {
+			n = MIN(left, w->record_left);
+			if (!w->dropping)
+				ring_append(w, p, n);
+			w->record_left -= n;
+		}
+		p += n;
+		left -= n;
+		if (w->header_bytes == RECORD_HEADER_BYTES &&
+		    w->record_left == 0)
+			w->header_bytes = 0;
+	}
+	sem_post(&w->wake);
+	return size;
+}
+
+static int writer_close(void *cookie)
+{
+	struct aec_dump_writer *w = (struct aec_dump_writer *)cookie;
+
+	__atomic_store_n(&w->closing, 1, __ATOMIC_RELEASE);
+	sem_post(&w->wake);
+	return 0;
+}
+
+/* Writes out the queued bytes. Returns 0, or a negative error if writing
+ * to the file failed. */
+static int drain(struct aec_dump_writer *w)
+{
+	uint64_t tail = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+	size_t first;
+	ssize_t rc;
+
+	while (w->head != tail) {
+		first = MIN(tail - w->head,
+			    w->capacity - w->head % w->capacity);
+		rc = write(w->fd, w->ring + w->head % w->capacity, first);
+		if (rc < 0 && errno == EINTR)
+			continue;
+		if (rc < 0)
+			return -errno;
+		__atomic_store_n(&w->head, w->head + rc, __ATOMIC_RELEASE);
+	}
+	return 0;
+}
+
+static void *writer_thread(void *arg)
+{
+	struct aec_dump_writer *w = (struct aec_dump_writer *)arg;
+	int closing, rc = 0;
+
+	do {
+		sem_wait(&w->wake);
+		closing = __atomic_load_n(&w->closing, __ATOMIC_ACQUIRE);
+		if (rc == 0)
+			rc = drain(w);
+		else
+			w->head = __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE);
+	} while (!closing);
+
+	if (rc)
+		syslog(LOG_ERR, "Failed to write AEC dump: %d", rc);
+	if (w->dropped_records)
+		syslog(LOG_WARNING,
+		       "AEC dump dropped %u records, %" PRIu64 " bytes",
+		       w->dropped_records, w->dropped_bytes);
+	close(w->fd);
+	sem_destroy(&w->wake);
+	free(w->ring);
+	free(w);
+	return NULL;
+}
+
+FILE *aec_dump_writer_open(int fd, size_t ring_bytes)
+{
+	cookie_io_functions_t funcs = {
+		.read = NULL,
+		.write = writer_write,
+		.seek = NULL,
+		.close = writer_close,
+	};
+	struct aec_dump_writer *w;
+	pthread_attr_t attr;
+	FILE *handle;
+	int rc;
+
+	if (ring_bytes == 0)
+		return NULL;
+
+	w = (struct aec_dump_writer *)calloc(1, sizeof(*w));
+	if (w == NULL)
+		return NULL;
+	w->ring = (uint8_t *)malloc(ring_bytes);
+	if (w->ring == NULL) {
+		free(w);
+		return NULL;
+	}
+	w->fd = fd;
+	w->capacity = ring_bytes;
+	sem_init(&w->wake, 0, 0);
+
+	handle = fopencookie(w, "w", funcs);
+	if (handle == NULL)
+		goto error;
+	/* Pass every write through, so records are seen as they come. */
+	setvbuf(handle, NULL, _IONBF, 0);
+
+	pthread_attr_init(&attr);
+	pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+	rc = pthread_create(&w->tid, &attr, writer_thread, w);
+	pthread_attr_destroy(&attr);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to create AEC dump writer: %d", rc);
+		goto error_handle;
+	}
+	return handle;
+
+error_handle:
+	/* Keep fd open, the caller still owns it. */
+	w->fd = -1;
+	fclose(handle);
+error:
+	sem_destroy(&w->wake);
+	free(w->ring);
+	free(w);
+	return NULL;
+}
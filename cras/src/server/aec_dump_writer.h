@@ -0,0 +1,34 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef AEC_DUMP_WRITER_H_
+#define AEC_DUMP_WRITER_H_
+
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Writes an AEC dump to a file from a background thread, so the thread
+ * producing the records never waits on the filesystem. The records are
+ * queued in a bounded ring and the writer thread drains it to the file.
+ *
+ * An AEC dump is a sequence of records, each a 32 bit size followed by that
+ * many bytes. When a record doesn't fit in the ring it is dropped whole, so
+ * the file stays a valid dump. The dropped records are counted and logged
+ * when the dump is closed.
+ */
+
+/* Opens a handle to write an AEC dump to fd through a writer thread.
+ * Closing the handle doesn't block: the writer thread drains the ring,
+ * closes fd and exits on its own.
+ * Args:
+ *    fd - The file to write to. Owned by the writer on success.
+ *    ring_bytes - The size of the ring records are queued in.
+ * Returns:
+ *    The handle, or NULL on failure, in which case fd is left open.
+ */
+FILE *aec_dump_writer_open(int fd, size_t ring_bytes);
+
+#endif /* AEC_DUMP_WRITER_H_ */
@@ -4,34 +4,41 @@
  */
 
 #ifndef _GNU_SOURCE
-#define _GNU_SOURCE /* for ppoll and asprintf*/
+#define _GNU_SOURCE /* for asprintf*/
 #endif
 
 #include <pthread.h>
 #include <poll.h>
+#include <sched.h>
 #include <stdbool.h>
 #include <stdio.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
 #include <sys/param.h>
+#include <sys/prctl.h>
+#include <sys/resource.h>
+#include <sys/timerfd.h>
 #include <syslog.h>
 
 #include "audio_thread_log.h"
+#include "cmd_ring.h"
 #include "cras_audio_thread_monitor.h"
-#include "cras_config.h"
 #include "cras_device_monitor.h"
+#include "cras_dsp_pipeline.h"
 #include "cras_fmt_conv.h"
 #include "cras_iodev.h"
 #include "cras_rstream.h"
+#include "cras_rt_guard.h"
+#include "cras_rt_mem.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
+#include "cras_trace.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "dev_stream.h"
 #include "audio_thread.h"
 #include "utlist.h"
 
-#define MIN_PROCESS_TIME_US 500 /* 0.5ms - min amount of time to mix/src. */
-#define SLEEP_FUZZ_FRAMES 10 /* # to consider "close enough" to sleep frames. */
-#define MIN_READ_WAIT_US 2000 /* 2ms */
 /*
  * # to check whether a busyloop event happens
  */
@@ -44,6 +51,27 @@
  */
 #define MAX_CONTINUOUS_ZERO_SLEEP_METRIC_LIMIT 1000
 
+/*
+ * After this many continuous zero sleeps the devices and streams keeping the
+ * thread awake are logged, the devices are reset, and the thread sleeps at
+ * least BUSYLOOP_BACKOFF_US per loop until the busyloop stops.
+ */
+#define BUSYLOOP_MITIGATE_COUNT 100
+#define BUSYLOOP_BACKOFF_US 1000
+
+/* Max number of ready fds handled per wake, the rest are left for the next
+ * epoll_wait(). */
+#define MAX_EPOLL_EVENTS 32
+
+/*
+ * A wake may come up to 1/WAKE_SLACK_DIV of the shortest callback period of
+ * the open devices late, so the kernel can batch it with other timers. Below
+ * MIN_WAKE_SLACK_NS, as with any low latency stream, wakes stay exact.
+ */
+#define WAKE_SLACK_DIV 8
+#define MIN_WAKE_SLACK_NS (2 * 1000000ULL)
+#define MAX_WAKE_SLACK_NS (20 * 1000000ULL)
+
 /* Messages that can be sent from the main context to the audio thread. */
 enum AUDIO_THREAD_COMMAND {
 	AUDIO_THREAD_ADD_OPEN_DEV,
@@ -53,16 +81,24 @@ enum AUDIO_THREAD_COMMAND {
 	AUDIO_THREAD_DISCONNECT_STREAM,
 	AUDIO_THREAD_STOP,
 	AUDIO_THREAD_DUMP_THREAD_INFO,
+	AUDIO_THREAD_DUMP_SNAPSHOT,
 	AUDIO_THREAD_DRAIN_STREAM,
 	AUDIO_THREAD_CONFIG_GLOBAL_REMIX,
 	AUDIO_THREAD_DEV_START_RAMP,
 	AUDIO_THREAD_REMOVE_CALLBACK,
 	AUDIO_THREAD_AEC_DUMP,
+	AUDIO_THREAD_SYNC,
 };
 
+/* Members:
+ *    length - Size of the whole message, at most CMD_RING_SLOT_SIZE.
+ *    id - The command.
+ *    async - Non-zero if the sender doesn't wait for a response.
+ */
 struct audio_thread_msg {
 	size_t length;
 	enum AUDIO_THREAD_COMMAND id;
+	int async;
 };
 
 struct audio_thread_config_global_remix {
@@ -86,11 +122,16 @@ struct audio_thread_rm_callback_msg {
 	int fd;
 };
 
+/* async_devs holds a copy of devs for async messages, which outlive the
+ * caller's array. prepared holds the dev_streams built for the first devs
+ * of an add, owned by the message until the thread handles it. */
 struct audio_thread_add_rm_stream_msg {
 	struct audio_thread_msg header;
 	struct cras_rstream *stream;
 	struct cras_iodev **devs;
 	unsigned int num_devs;
+	struct cras_iodev *async_devs[MAX_ASYNC_STREAM_DEVS];
+	struct dev_stream *prepared[MAX_ASYNC_STREAM_DEVS];
 };
 
 struct audio_thread_dump_debug_info_msg {
@@ -98,6 +139,11 @@ struct audio_thread_dump_debug_info_msg {
 	struct audio_debug_info *info;
 };
 
+struct audio_thread_dump_snapshot_msg {
+	struct audio_thread_msg header;
+	struct audio_thread_snapshot_dump *dump;
+};
+
 struct audio_thread_dev_start_ramp_msg {
 	struct audio_thread_msg header;
 	unsigned int dev_idx;
@@ -120,25 +166,104 @@ char *atlog_name;
 int atlog_rw_shm_fd;
 int atlog_ro_shm_fd;
 
-static struct iodev_callback_list *iodev_callbacks;
+/* Number of audio threads sharing atlog. */
+static unsigned int num_atlog_users;
 
+/* The audio thread running the calling code, NULL outside audio threads. */
+static __thread struct audio_thread *current_thread;
+
+/* The thread callbacks added from outside any audio thread are registered
+ * with. */
+static struct audio_thread *main_callback_thread;
+
+/* Each audio thread waits on its own epoll set. Fds are added to it when they
+ * are registered, not rebuilt on every wake. The epoll data of the message
+ * pipe, timer and stream fds points at the tags below, callback fds point at
+ * their iodev_callback_list entry. */
+static int msg_event_tag;
+static int timer_event_tag;
+static int stream_event_tag;
+
+/* An fd with a callback to run in the audio thread.
+ * Members:
+ *    revents - Events reported for fd in the current wake.
+ *    in_epoll - Non-zero if fd is registered in the thread's epoll set.
+ */
 struct iodev_callback_list {
 	int fd;
 	int events;
 	enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger;
 	thread_callback cb;
 	void *cb_data;
-	struct pollfd *pollfd;
+	int revents;
+	int in_epoll;
 	struct iodev_callback_list *prev, *next;
 };
 
+/* A stream fd registered in the epoll set, once per rstream however many devices
+ * the stream is attached to.
+ * Members:
+ *    stream - The stream owning fd.
+ *    fd - The stream's fd.
+ *    seen - Scratch flag, set when a device still has the stream attached.
+ */
+struct thread_stream_fd {
+	const struct cras_rstream *stream;
+	int fd;
+	int seen;
+	struct thread_stream_fd *prev, *next;
+};
+
+/* Registers or unregisters a callback's fd in the epoll set according to its
+ * trigger. */
+static void update_callback_epoll(struct audio_thread *thread,
+				  struct iodev_callback_list *iodev_cb)
+{
+	struct epoll_event ev = {};
+	int want = iodev_cb->trigger == TRIGGER_POLL;
+
+	if (thread->epoll_fd < 0 || want == iodev_cb->in_epoll)
+		return;
+
+	if (!want) {
+		epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, iodev_cb->fd, NULL);
+		iodev_cb->in_epoll = 0;
+		return;
+	}
+
+	ev.events = iodev_cb->events;
+	ev.data.ptr = iodev_cb;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, iodev_cb->fd, &ev)) {
+		syslog(LOG_ERR, "Failed to add fd %d to epoll: %d",
+		       iodev_cb->fd, errno);
+		return;
+	}
+	iodev_cb->in_epoll = 1;
+}
+
+/* Returns the thread a callback call made from the calling context applies
+ * to. */
+static struct audio_thread *callback_thread()
+{
+	return current_thread ? current_thread : main_callback_thread;
+}
+
+void audio_thread_set_main_callback_thread(struct audio_thread *thread)
+{
+	main_callback_thread = thread;
+}
+
 void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
 				      int events)
 {
+	struct audio_thread *thread = callback_thread();
 	struct iodev_callback_list *iodev_cb;
 
+	if (!thread)
+		return;
+
 	/* Don't add iodev_cb twice */
-	DL_FOREACH (iodev_callbacks, iodev_cb)
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb)
 		if (iodev_cb->fd == fd && iodev_cb->cb_data == data)
 			return;
 
@@ -149,16 +274,23 @@ void audio_thread_add_events_callback(int fd, thread_callback cb, void *data,
 	iodev_cb->trigger = TRIGGER_POLL;
 	iodev_cb->events = events;
 
-	DL_APPEND(iodev_callbacks, iodev_cb);
+	DL_APPEND(thread->iodev_callbacks, iodev_cb);
+	update_callback_epoll(thread, iodev_cb);
 }
 
 void audio_thread_rm_callback(int fd)
 {
+	struct audio_thread *thread = callback_thread();
 	struct iodev_callback_list *iodev_cb;
 
-	DL_FOREACH (iodev_callbacks, iodev_cb) {
+	if (!thread)
+		return;
+
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
-			DL_DELETE(iodev_callbacks, iodev_cb);
+			iodev_cb->trigger = TRIGGER_NONE;
+			update_callback_epoll(thread, iodev_cb);
+			DL_DELETE(thread->iodev_callbacks, iodev_cb);
 			free(iodev_cb);
 			return;
 		}
@@ -168,11 +300,16 @@ void audio_thread_rm_callback(int fd)
 void audio_thread_config_events_callback(
 	int fd, enum AUDIO_THREAD_EVENTS_CB_TRIGGER trigger)
 {
+	struct audio_thread *thread = callback_thread();
 	struct iodev_callback_list *iodev_cb;
 
-	DL_FOREACH (iodev_callbacks, iodev_cb) {
+	if (!thread)
+		return;
+
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
 		if (iodev_cb->fd == fd) {
 			iodev_cb->trigger = trigger;
+			update_callback_epoll(thread, iodev_cb);
 			return;
 		}
 	}
@@ -222,43 +359,217 @@ static int read_until_finished(int fd, void *buf, size_t count)
 	return count;
 }
 
-/* Reads a command from the main thread.  Called from the playback/capture
- * thread.  This will read the next available command from the main thread and
- * put it in buf.
- * Args:
- *    thread - thread reading the command.
- *    buf - Message is stored here on return.
- *    max_len - maximum length of message to put into buf.
- * Returns:
- *    0 on success, negative error code on failure.
- */
-static int audio_thread_read_command(struct audio_thread *thread, uint8_t *buf,
-				     size_t max_len)
+
+/* Builds an initial buffer to avoid an underrun. Adds min_level of latency. */
+static void fill_odevs_zeros_min_level(struct cras_iodev *odev)
 {
-	int to_read, nread, rc;
-	struct audio_thread_msg *msg = (struct audio_thread_msg *)buf;
+	cras_iodev_fill_odev_zeros(odev, odev->min_buffer_level);
+}
 
-	/* Get the length of the message first */
-	nread = read_until_finished(thread->to_thread_fds[0], buf,
-				    sizeof(msg->length));
-	if (nread < 0)
-		return nread;
+/* The SCHED_DEADLINE runtime reserves this many times the wake cost, kept
+ * between min_deadline_runtime_ns and half the period. */
+#define DEADLINE_RUNTIME_COST_FACTOR 2
+static const uint64_t min_deadline_runtime_ns = 500 * 1000;
+/* The wake cost peak drops by 1/WAKE_COST_DECAY_DIV each wake. */
+#define WAKE_COST_DECAY_DIV 64
 
-	if (msg->length > max_len)
-		return -ENOMEM;
+/* Gets the shortest callback period of the open devices, 0 if none has
+ * one. */
+static uint64_t min_cb_period_ns(const struct audio_thread *thread)
+{
+	const struct open_dev *adev;
+	uint64_t period = 0, dev_period;
+	int dir;
 
-	to_read = msg->length - sizeof(msg->length);
-	rc = read_until_finished(thread->to_thread_fds[0],
-				 &buf[0] + sizeof(msg->length), to_read);
-	if (rc < 0)
-		return rc;
-	return 0;
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (thread->open_devs[dir], adev) {
+			const struct cras_iodev *dev = adev->dev;
+
+			if (!dev->format || !dev->format->frame_rate ||
+			    !dev->min_cb_level)
+				continue;
+			dev_period = (uint64_t)dev->min_cb_level * 1000000000ULL /
+				     dev->format->frame_rate;
+			if (!period || dev_period < period)
+				period = dev_period;
+		}
+	}
+	return period;
 }
 
-/* Builds an initial buffer to avoid an underrun. Adds min_level of latency. */
-static void fill_odevs_zeros_min_level(struct cras_iodev *odev)
+/* Computes the SCHED_DEADLINE reservation fitting the open devices: the period
+ * is the shortest callback period among them, the deadline equals it. Returns
+ * false when no open device has a callback period. */
+static bool get_deadline_params(const struct audio_thread *thread,
+				uint64_t *runtime_ns, uint64_t *period_ns)
 {
-	cras_iodev_fill_odev_zeros(odev, odev->min_buffer_level);
+	uint64_t period = min_cb_period_ns(thread), runtime;
+
+	if (!period)
+		return false;
+
+	runtime = MAX(thread->wake_cost_ns * DEADLINE_RUNTIME_COST_FACTOR,
+		      min_deadline_runtime_ns);
+	*runtime_ns = MIN(runtime, period / 2);
+	*period_ns = period;
+	return true;
+}
+
+static void use_sched_rr(struct audio_thread *thread)
+{
+	thread->deadline_runtime_ns = 0;
+	thread->deadline_period_ns = 0;
+	cras_set_thread_priority(cras_system_get_rt_priority());
+}
+
+/* Renegotiates the thread's SCHED_DEADLINE reservation after the open devices
+ * changed. Falls back to SCHED_RR when no device is open or the kernel
+ * refuses the reservation. */
+static void update_sched_deadline(struct audio_thread *thread)
+{
+	uint64_t runtime_ns, period_ns;
+	int rc;
+
+	if (!cras_system_get_sched_deadline_enabled())
+		return;
+
+	if (!get_deadline_params(thread, &runtime_ns, &period_ns)) {
+		if (thread->deadline_period_ns)
+			use_sched_rr(thread);
+		return;
+	}
+	if (runtime_ns == thread->deadline_runtime_ns &&
+	    period_ns == thread->deadline_period_ns)
+		return;
+
+	rc = cras_set_thread_deadline(runtime_ns, period_ns, period_ns);
+	if (rc == 0) {
+		thread->deadline_runtime_ns = runtime_ns;
+		thread->deadline_period_ns = period_ns;
+		return;
+	}
+	syslog(LOG_WARNING,
+	       "SCHED_DEADLINE runtime %llu period %llu ns refused: %d",
+	       (unsigned long long)runtime_ns, (unsigned long long)period_ns,
+	       rc);
+	use_sched_rr(thread);
+}
+
+/* Requests the board's minimum utilization clamp while devices are open, so
+ * cpufreq keeps the thread's CPU fast enough, and drops it once none is. */
+static void update_uclamp(struct audio_thread *thread)
+{
+	uint32_t util_min = 0;
+	int rc;
+
+	if (thread->open_devs[CRAS_STREAM_OUTPUT] ||
+	    thread->open_devs[CRAS_STREAM_INPUT])
+		util_min = cras_system_get_audio_thread_uclamp_min();
+	if (util_min == thread->uclamp_min)
+		return;
+
+	rc = cras_set_thread_uclamp_min(util_min);
+	if (rc) {
+		syslog(LOG_WARNING, "Failed to set uclamp_min %u: %d",
+		       util_min, rc);
+		return;
+	}
+	thread->uclamp_min = util_min;
+}
+
+/* Counts the wakes landing on another CPU than the previous one. */
+static void update_cpu(struct audio_thread *thread)
+{
+	int cpu = sched_getcpu();
+
+	if (cpu == thread->cpu)
+		return;
+	if (thread->cpu >= 0)
+		thread->cpu_migrations++;
+	thread->cpu = cpu;
+}
+
+/* Updates the wake cost with the time spent since the thread woke at
+ * wake_ts. */
+static void update_wake_cost(struct audio_thread *thread,
+			     const struct timespec *wake_ts)
+{
+	struct timespec now, busy;
+	uint64_t busy_ns;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, wake_ts, &busy);
+	busy_ns = (uint64_t)busy.tv_sec * 1000000000ULL + busy.tv_nsec;
+
+	thread->wake_cost_ns -= thread->wake_cost_ns / WAKE_COST_DECAY_DIV;
+	if (busy_ns > thread->wake_cost_ns)
+		thread->wake_cost_ns = busy_ns;
+}
+
+/*
+ * The thread is overloaded while the wake cost peak is above
+ * LOAD_SHED_HIGH_PCT of the shortest callback period of its devices. After
+ * LOAD_SHED_WAKES overloaded wakes in a row the least important priority
+ * class not yet shed is degraded, from background streams up to media,
+ * critical streams never are. Classes are restored in reverse once the peak
+ * stayed below LOAD_SHED_LOW_PCT as long. The peak decays by about a third
+ * in that many wakes, enough to see the effect of the last step.
+ */
+#define LOAD_SHED_HIGH_PCT 75
+#define LOAD_SHED_LOW_PCT 50
+#define LOAD_SHED_WAKES WAKE_COST_DECAY_DIV
+
+/* Degrades the streams of the shed priority classes and restores the
+ * others. */
+static void apply_load_shed(struct audio_thread *thread)
+{
+	struct open_dev *adev;
+	struct dev_stream *dev_stream;
+	int dir;
+
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
+		DL_FOREACH (thread->open_devs[dir], adev) {
+			DL_FOREACH (adev->dev->streams, dev_stream)
+				dev_stream_set_shed(
+					dev_stream,
+					cras_rstream_get_priority(
+						dev_stream->stream) >=
+						thread->shed_priority);
+		}
+	}
+}
+
+/* Sheds or restores a priority class when the wake cost stayed too close
+ * to, or well below, the callback period. */
+static void update_load_shed(struct audio_thread *thread)
+{
+	uint64_t period_ns = min_cb_period_ns(thread);
+	uint64_t cost = thread->wake_cost_ns * 100;
+	enum CRAS_STREAM_PRIORITY shed = thread->shed_priority;
+
+	if (period_ns && cost > period_ns * LOAD_SHED_HIGH_PCT) {
+		thread->shed_wakes = MAX(thread->shed_wakes, 0) + 1;
+		if (thread->shed_wakes < LOAD_SHED_WAKES ||
+		    shed == CRAS_STREAM_PRIORITY_MEDIA)
+			return;
+		shed = (enum CRAS_STREAM_PRIORITY)(shed - 1);
+	} else if (!period_ns || cost < period_ns * LOAD_SHED_LOW_PCT) {
+		thread->shed_wakes = MIN(thread->shed_wakes, 0) - 1;
+		if (-thread->shed_wakes < LOAD_SHED_WAKES ||
+		    shed == CRAS_NUM_STREAM_PRIORITIES)
+			return;
+		shed = (enum CRAS_STREAM_PRIORITY)(shed + 1);
+	} else {
+		thread->shed_wakes = 0;
+		return;
+	}
+
+	thread->shed_wakes = 0;
+	thread->shed_priority = shed;
+	syslog(LOG_WARNING, "Wake cost %llu of %llu ns, shed priority %d",
+	       (unsigned long long)thread->wake_cost_ns,
+	       (unsigned long long)period_ns, shed);
+	apply_load_shed(thread);
 }
 
 /* Handles messages from main thread to add a new active device. */
@@ -276,14 +587,18 @@ static int thread_add_open_dev(struct audio_thread *thread,
 
 	/*
 	 * Start output devices by padding the output. This avoids a burst of
-	 * audio callbacks when the stream starts
+	 * audio callbacks when the stream starts. Devices waiting for samples
+	 * to start are padded when their first stream attaches instead.
 	 */
-	if (iodev->direction == CRAS_STREAM_OUTPUT)
+	if (iodev->direction == CRAS_STREAM_OUTPUT &&
+	    cras_iodev_state(iodev) != CRAS_IODEV_STATE_OPEN)
 		fill_odevs_zeros_min_level(iodev);
 
 	ATLOG(atlog, AUDIO_THREAD_DEV_ADDED, iodev->info.idx, 0, 0);
 
 	DL_APPEND(thread->open_devs[iodev->direction], adev);
+	update_sched_deadline(thread);
+	update_uclamp(thread);
 
 	return 0;
 }
@@ -299,6 +614,8 @@ static int thread_rm_open_dev(struct audio_thread *thread,
 		return -EINVAL;
 
 	dev_io_rm_open_dev(&thread->open_devs[dir], adev);
+	update_sched_deadline(thread);
+	update_uclamp(thread);
 	return 0;
 }
 
@@ -367,10 +684,9 @@ static int thread_find_stream(struct audio_thread *thread,
 	struct dev_stream *s;
 
 	DL_FOREACH (thread->open_devs[rstream->direction], open_dev) {
-		DL_FOREACH (open_dev->dev->streams, s) {
-			if (s->stream == rstream)
-				return 1;
-		}
+		s = cras_iodev_find_stream(open_dev->dev, rstream->stream_id);
+		if (s && s->stream == rstream)
+			return 1;
 	}
 	return 0;
 }
@@ -435,20 +751,40 @@ static int thread_drain_stream(struct audio_thread *thread,
 	return ms_left;
 }
 
-/* Handles the add_stream message from the main thread. */
+/* Frees the prepared dev_streams of an add_stream message that were not
+ * attached. */
+static void discard_prepared(struct audio_thread_add_rm_stream_msg *msg)
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_ASYNC_STREAM_DEVS; i++) {
+		if (!msg->prepared[i])
+			continue;
+		dev_stream_discard(msg->prepared[i]);
+		msg->prepared[i] = NULL;
+	}
+}
+
+/* Handles the add_stream message from the main thread. prepared, if not
+ * NULL, holds MAX_ASYNC_STREAM_DEVS dev_streams built for the first iodevs.
+ */
 static int thread_add_stream(struct audio_thread *thread,
 			     struct cras_rstream *stream,
 			     struct cras_iodev **iodevs,
-			     unsigned int num_iodevs)
+			     unsigned int num_iodevs,
+			     struct dev_stream **prepared)
 {
 	int rc;
 
 	rc = dev_io_append_stream(&thread->open_devs[CRAS_STREAM_OUTPUT],
 				  &thread->open_devs[CRAS_STREAM_INPUT], stream,
-				  iodevs, num_iodevs);
+				  iodevs, num_iodevs, prepared,
+				  prepared ? MAX_ASYNC_STREAM_DEVS : 0);
 	if (rc < 0)
 		return rc;
 
+	if (thread->shed_priority != CRAS_NUM_STREAM_PRIORITIES)
+		apply_load_shed(thread);
 	return 0;
 }
 
@@ -480,6 +816,9 @@ static int thread_set_aec_dump(struct audio_thread *thread,
 /* Stop the playback thread */
 static void terminate_pb_thread()
 {
+	dev_stream_release_kept();
+	cras_fmt_conv_release_scratch();
+	cras_dsp_pipeline_release_scratch();
 	pthread_exit(0);
 }
 
@@ -508,6 +847,8 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 	di->runtime_nsec = time_since.tv_nsec;
 	di->longest_wake_sec = adev->longest_wake.tv_sec;
 	di->longest_wake_nsec = adev->longest_wake.tv_nsec;
+	memcpy(di->stage_hist, adev->stage_hist, sizeof(di->stage_hist));
+	di->num_coalesced_fetches = adev->num_coalesced_fetches;
 
 	if (fmt) {
 		di->frame_rate = fmt->frame_rate;
@@ -520,18 +861,40 @@ static void append_dev_dump_info(struct audio_dev_debug_info *di,
 	}
 }
 
+/* Gets the nominal latency of a stream on dev in microseconds: its callback
+ * level plus the frames dev keeps queued. */
+static uint32_t stream_latency_us(const struct dev_stream *stream,
+				  const struct cras_iodev *dev)
+{
+	size_t rate, frames;
+
+	if (!dev->format || !dev->format->frame_rate)
+		return 0;
+	rate = dev->format->frame_rate;
+	frames = cras_frames_at_rate(stream->stream->format.frame_rate,
+				     stream->stream->cb_threshold, rate) +
+		 dev->min_cb_level + dev->min_buffer_level;
+	return (uint64_t)frames * 1000000 / rate;
+}
+
+/* Converts frames at the rate of dev to microseconds. */
+static uint32_t dev_frames_to_us(const struct cras_iodev *dev,
+				 unsigned int frames)
+{
+	if (!dev->format || !dev->format->frame_rate)
+		return 0;
+	return (uint64_t)frames * 1000000 / dev->format->frame_rate;
+}
+
 /* Put stream info for the given stream into the info struct. */
-static void append_stream_dump_info(struct audio_debug_info *info,
+static void append_stream_dump_info(struct audio_stream_debug_info *si,
 				    struct dev_stream *stream,
-				    unsigned int dev_idx, int index)
+				    const struct cras_iodev *dev)
 {
-	struct audio_stream_debug_info *si;
 	struct timespec now, time_since;
 
-	si = &info->streams[index];
-
 	si->stream_id = stream->stream->stream_id;
-	si->dev_idx = dev_idx;
+	si->dev_idx = dev->info.idx;
 	si->direction = stream->stream->direction;
 	si->stream_type = stream->stream->stream_type;
 	si->client_type = stream->stream->client_type;
@@ -549,6 +912,17 @@ static void append_stream_dump_info(struct audio_debug_info *info,
 	si->is_pinned = stream->stream->is_pinned;
 	si->num_missed_cb = stream->stream->num_missed_cb;
 	si->stream_volume = cras_rstream_get_volume_scaler(stream->stream);
+	si->latency_us = stream_latency_us(stream, dev);
+	memcpy(si->stage_hist, stream->stage_hist, sizeof(si->stage_hist));
+	si->cpu_ns = stream->stream->cpu_ns;
+	si->num_fetches = stream->stream->num_fetches;
+	si->shm_bytes = cras_shm_mapped_bytes(stream->stream->shm);
+	si->conv_bytes = dev_stream_mem_bytes(stream);
+	si->device_delay_us = dev_frames_to_us(dev, stream->delay.device);
+	si->dsp_delay_us = dev_frames_to_us(dev, stream->delay.dsp);
+	si->conv_delay_us = dev_frames_to_us(dev, stream->delay.conv);
+	si->processing_delay_us =
+		dev_frames_to_us(dev, stream->delay.processing);
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	subtract_timespecs(&now, &stream->stream->start_ts, &time_since);
@@ -556,31 +930,81 @@ static void append_stream_dump_info(struct audio_debug_info *info,
 	si->runtime_nsec = time_since.tv_nsec;
 }
 
+/* Puts the info of the open devices of the thread and of their streams into
+ * devs and streams, up to max_devs and max_streams of them. Sets num_devs and
+ * num_streams to the numbers the thread has, which may be more. */
+static void dump_devs_and_streams(struct audio_thread *thread,
+				  struct audio_dev_debug_info *devs,
+				  unsigned int max_devs,
+				  struct audio_stream_debug_info *streams,
+				  unsigned int max_streams,
+				  unsigned int *num_devs,
+				  unsigned int *num_streams)
+{
+	struct dev_stream *curr;
+	struct open_dev *adev;
+	unsigned int d = 0, s = 0;
+	int dir;
+
+	for (dir = CRAS_STREAM_OUTPUT; dir <= CRAS_STREAM_INPUT; dir++) {
+		DL_FOREACH (thread->open_devs[dir], adev) {
+			if (d < max_devs)
+				append_dev_dump_info(&devs[d], adev);
+			d++;
+			DL_FOREACH (adev->dev->streams, curr) {
+				if (s < max_streams)
+					append_stream_dump_info(
+						&streams[s], curr, adev->dev);
+				s++;
+			}
+		}
+	}
+	*num_devs = d;
+	*num_streams = s;
+}
+
+/* Fills the scheduling and memory fields of a snapshot. Must run on the
+ * audio thread, the faults counted are the ones of the calling thread. */
+static void dump_thread_stats(struct audio_thread *thread,
+			      struct cras_audio_thread_snapshot *stats)
+{
+	struct rusage usage;
+	uint32_t locked_bytes, unlocked_bytes;
+
+	stats->cpu = thread->cpu;
+	stats->cpu_migrations = thread->cpu_migrations;
+	if (getrusage(RUSAGE_THREAD, &usage) == 0) {
+		stats->minor_faults = usage.ru_minflt;
+		stats->major_faults = usage.ru_majflt;
+	}
+	cras_rt_mem_get(&locked_bytes, &unlocked_bytes);
+	stats->rt_locked_bytes = locked_bytes;
+	stats->rt_unlocked_bytes = unlocked_bytes;
+}
+
 /* Handle a message sent from main thread to the audio thread.
  * Returns:
  *    Error code when reading or sending message fails.
  */
-static int handle_audio_thread_message(struct audio_thread *thread)
+static int handle_audio_thread_message(struct audio_thread *thread,
+				       struct audio_thread_msg *msg)
 {
-	uint8_t buf[256];
-	struct audio_thread_msg *msg = (struct audio_thread_msg *)buf;
 	int ret = 0;
 	int err;
 
-	err = audio_thread_read_command(thread, buf, 256);
-	if (err < 0)
-		return err;
-
 	ATLOG(atlog, AUDIO_THREAD_PB_MSG, msg->id, 0, 0);
 
 	switch (msg->id) {
 	case AUDIO_THREAD_ADD_STREAM: {
 		struct audio_thread_add_rm_stream_msg *amsg;
 		amsg = (struct audio_thread_add_rm_stream_msg *)msg;
+		if (msg->async)
+			amsg->devs = amsg->async_devs;
 		ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_WAIT,
 		      amsg->stream->stream_id, 0, 0);
 		ret = thread_add_stream(thread, amsg->stream, amsg->devs,
-					amsg->num_devs);
+					amsg->num_devs, amsg->prepared);
+		discard_prepared(amsg);
 		break;
 	}
 	case AUDIO_THREAD_DISCONNECT_STREAM: {
@@ -621,48 +1045,55 @@ static int handle_audio_thread_message(struct audio_thread *thread)
 		terminate_pb_thread();
 		break;
 	case AUDIO_THREAD_DUMP_THREAD_INFO: {
-		struct dev_stream *curr;
-		struct open_dev *adev;
 		struct audio_thread_dump_debug_info_msg *dmsg;
 		struct audio_debug_info *info;
-		unsigned int num_streams = 0;
-		unsigned int num_devs = 0;
+		struct cras_audio_thread_snapshot stats;
+		unsigned int num_devs, num_streams;
+		uint32_t rt_allocs, rt_blocking_calls;
 
 		ret = 0;
 		dmsg = (struct audio_thread_dump_debug_info_msg *)msg;
 		info = dmsg->info;
 
-		/* Go through all open devices. */
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_OUTPUT], adev) {
-			append_dev_dump_info(&info->devs[num_devs], adev);
-			if (++num_devs == MAX_DEBUG_DEVS)
-				break;
-			DL_FOREACH (adev->dev->streams, curr) {
-				if (num_streams == MAX_DEBUG_STREAMS)
-					break;
-				append_stream_dump_info(info, curr,
-							adev->dev->info.idx,
-							num_streams++);
-			}
-		}
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_INPUT], adev) {
-			if (num_devs == MAX_DEBUG_DEVS)
-				break;
-			append_dev_dump_info(&info->devs[num_devs], adev);
-			DL_FOREACH (adev->dev->streams, curr) {
-				if (num_streams == MAX_DEBUG_STREAMS)
-					break;
-				append_stream_dump_info(info, curr,
-							adev->dev->info.idx,
-							num_streams++);
-			}
-			++num_devs;
-		}
-		info->num_devs = num_devs;
-
-		info->num_streams = num_streams;
+		dump_devs_and_streams(thread, info->devs, MAX_DEBUG_DEVS,
+				      info->streams, MAX_DEBUG_STREAMS,
+				      &num_devs, &num_streams);
+		info->num_devs = MIN(num_devs, MAX_DEBUG_DEVS);
+		info->num_streams = MIN(num_streams, MAX_DEBUG_STREAMS);
+
+		memset(&stats, 0, sizeof(stats));
+		dump_thread_stats(thread, &stats);
+		info->cpu = stats.cpu;
+		info->cpu_migrations = stats.cpu_migrations;
+		info->minor_faults = stats.minor_faults;
+		info->major_faults = stats.major_faults;
+		info->rt_locked_bytes = stats.rt_locked_bytes;
+		info->rt_unlocked_bytes = stats.rt_unlocked_bytes;
+		cras_rt_guard_get(&rt_allocs, &rt_blocking_calls);
+		info->rt_allocs = rt_allocs;
+		info->rt_blocking_calls = rt_blocking_calls;
+
+		audio_thread_event_log_snapshot(&info->log, atlog);
+		break;
+	}
+	case AUDIO_THREAD_DUMP_SNAPSHOT: {
+		struct audio_thread_dump_snapshot_msg *dmsg;
+		struct audio_thread_snapshot_dump *dump;
+		unsigned int num_devs, num_streams;
 
-		memcpy(&info->log, atlog, sizeof(info->log));
+		ret = 0;
+		dmsg = (struct audio_thread_dump_snapshot_msg *)msg;
+		dump = dmsg->dump;
+
+		dump_devs_and_streams(thread, dump->devs, dump->max_devs,
+				      dump->streams, dump->max_streams,
+				      &num_devs, &num_streams);
+		dump->hdr.num_devs = num_devs;
+		dump->hdr.num_streams = num_streams;
+		dump_thread_stats(thread, &dump->hdr);
+		dump->hdr.num_events = audio_thread_event_log_copy_since(
+			dump->events, dump->max_events, atlog, dump->log_from);
+		dump->hdr.log_write_pos = atlog->write_pos;
 		break;
 	}
 	case AUDIO_THREAD_DRAIN_STREAM: {
@@ -707,17 +1138,52 @@ static int handle_audio_thread_message(struct audio_thread *thread)
 					  rmsg->fd);
 		break;
 	}
+	case AUDIO_THREAD_SYNC:
+		ret = thread->async_err;
+		thread->async_err = 0;
+		break;
 	default:
 		ret = -EINVAL;
 		break;
 	}
 
+	if (msg->async) {
+		if (ret < 0) {
+			syslog(LOG_ERR, "Async message %d failed: %d", msg->id,
+			       ret);
+			if (!thread->async_err)
+				thread->async_err = ret;
+		}
+		return 0;
+	}
+
 	err = audio_thread_send_response(thread, ret);
 	if (err < 0)
 		return err;
 	return 0;
 }
 
+/* Handles every message queued in the command ring. */
+static void handle_audio_thread_messages(struct audio_thread *thread)
+{
+	struct audio_thread_msg *msg;
+	uint64_t count;
+	int rc;
+
+	/* Clear the doorbell before draining, so a message queued after the
+	 * last check rings it again. */
+	if (read(thread->cmd_fd, &count, sizeof(count)) < 0 && errno != EAGAIN)
+		syslog(LOG_ERR, "Failed to read command doorbell: %d", errno);
+
+	while ((msg = (struct audio_thread_msg *)cmd_ring_front(
+			thread->cmd_ring))) {
+		rc = handle_audio_thread_message(thread, msg);
+		if (rc < 0)
+			syslog(LOG_ERR, "handle message %d", rc);
+		cmd_ring_pop(thread->cmd_ring);
+	}
+}
+
 /* Returns the number of active streams plus the number of active devices. */
 static int fill_next_sleep_interval(struct audio_thread *thread,
 				    struct timespec *ts)
@@ -743,25 +1209,182 @@ static int fill_next_sleep_interval(struct audio_thread *thread,
 	return ret;
 }
 
-static struct pollfd *add_pollfd(struct audio_thread *thread, int fd,
-				 int events)
+static struct thread_stream_fd *find_stream_fd(struct audio_thread *thread,
+					       const struct cras_rstream *stream,
+					       int fd)
 {
-	thread->pollfds[thread->num_pollfds].fd = fd;
-	thread->pollfds[thread->num_pollfds].events = events;
-	thread->num_pollfds++;
-	if (thread->num_pollfds >= thread->pollfds_size) {
-		thread->pollfds_size *= 2;
-		thread->pollfds = (struct pollfd *)realloc(
-			thread->pollfds,
-			sizeof(*thread->pollfds) * thread->pollfds_size);
-		return NULL;
+	struct thread_stream_fd *sfd;
+
+	DL_FOREACH (thread->stream_fds, sfd)
+		if (sfd->stream == stream && sfd->fd == fd)
+			return sfd;
+	return NULL;
+}
+
+/* Marks the entries of the streams attached to devs as seen. With add set,
+ * the fds of streams without an entry are registered too. */
+static void mark_stream_fds(struct audio_thread *thread, struct open_dev *devs,
+			    int add)
+{
+	struct open_dev *adev;
+	struct dev_stream *curr;
+	struct thread_stream_fd *sfd;
+	struct epoll_event ev = {};
+	int fd;
+
+	DL_FOREACH (devs, adev) {
+		DL_FOREACH (adev->dev->streams, curr) {
+			fd = dev_stream_wake_stream_fd(curr);
+			if (fd < 0)
+				continue;
+			sfd = find_stream_fd(thread, curr->stream, fd);
+			if (sfd) {
+				sfd->seen = 1;
+				continue;
+			}
+			if (!add)
+				continue;
+
+			/* Edge triggered, a reply wakes the thread once and
+			 * is read by dev_io as the stream's state calls for. */
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.ptr = &stream_event_tag;
+			if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, fd,
+				      &ev) &&
+			    (errno != EEXIST ||
+			     epoll_ctl(thread->epoll_fd, EPOLL_CTL_MOD, fd,
+				       &ev))) {
+				syslog(LOG_ERR, "Failed to add stream fd %d: %d",
+				       fd, errno);
+				continue;
+			}
+			sfd = (struct thread_stream_fd *)calloc(1, sizeof(*sfd));
+			sfd->stream = curr->stream;
+			sfd->fd = fd;
+			sfd->seen = 1;
+			DL_APPEND(thread->stream_fds, sfd);
+		}
+	}
+}
+
+/* Keeps the stream fds in the epoll set in line with the streams attached to
+ * open devices. Only adding or removing a stream touches the epoll set. */
+static void sync_stream_fds(struct audio_thread *thread)
+{
+	struct thread_stream_fd *sfd;
+
+	DL_FOREACH (thread->stream_fds, sfd)
+		sfd->seen = 0;
+
+	mark_stream_fds(thread, thread->open_devs[CRAS_STREAM_OUTPUT], 0);
+	mark_stream_fds(thread, thread->open_devs[CRAS_STREAM_INPUT], 0);
+
+	/* Removed before adding, a new stream may have been given the fd
+	 * number of a removed one. */
+	DL_FOREACH (thread->stream_fds, sfd) {
+		if (sfd->seen)
+			continue;
+		/* The fd may be closed already, which removed it. */
+		epoll_ctl(thread->epoll_fd, EPOLL_CTL_DEL, sfd->fd, NULL);
+		DL_DELETE(thread->stream_fds, sfd);
+		free(sfd);
 	}
 
-	return &thread->pollfds[thread->num_pollfds - 1];
+	mark_stream_fds(thread, thread->open_devs[CRAS_STREAM_OUTPUT], 1);
+	mark_stream_fds(thread, thread->open_devs[CRAS_STREAM_INPUT], 1);
 }
 
-static int continuous_zero_sleep_count = 0;
-static unsigned busyloop_count = 0;
+/* Returns how late the next wake may come, 0 if it has to be exact. */
+static uint64_t next_wake_slack_ns(const struct audio_thread *thread)
+{
+	uint64_t slack = min_cb_period_ns(thread) / WAKE_SLACK_DIV;
+
+	if (slack < MIN_WAKE_SLACK_NS)
+		return 0;
+	return MIN(slack, MAX_WAKE_SLACK_NS);
+}
+
+/* Returns the epoll_wait timeout sleeping wait_ts, with the thread's timer
+ * slack set so the kernel defers the wake by up to slack_ns. */
+static int slack_timeout(struct audio_thread *thread,
+			 const struct timespec *wait_ts, uint64_t slack_ns)
+{
+	uint64_t wait_ns = wait_ts->tv_sec * 1000000000ULL + wait_ts->tv_nsec;
+	/* Rounding the timeout up to a ms takes up to 1ms of the slack. */
+	uint64_t kernel_slack = slack_ns - 1000000;
+
+	if (kernel_slack != thread->timer_slack_ns) {
+		if (prctl(PR_SET_TIMERSLACK, kernel_slack, 0, 0, 0) == 0)
+			thread->timer_slack_ns = kernel_slack;
+		else
+			syslog(LOG_WARNING, "Failed to set timer slack: %d",
+			       errno);
+	}
+	return (wait_ns + 999999) / 1000000;
+}
+
+/* Fills the absolute expiry of a wait of wait_ts, rounded up to a ms grid
+ * as coarse as slack_ns allows. Timers of the system aligned on the same
+ * grid expire with it. */
+static void align_expiry(const struct timespec *wait_ts, uint64_t slack_ns,
+			 struct timespec *expiry)
+{
+	uint64_t grid = 1000000, ns;
+
+	while (grid * 2 <= slack_ns)
+		grid *= 2;
+	clock_gettime(CLOCK_MONOTONIC, expiry);
+	add_timespecs(expiry, wait_ts);
+	ns = expiry->tv_sec * 1000000000ULL + expiry->tv_nsec;
+	ns = (ns + grid - 1) / grid * grid;
+	expiry->tv_sec = ns / 1000000000ULL;
+	expiry->tv_nsec = ns % 1000000000ULL;
+}
+
+/*
+ * Arms the wake for the sleep interval and returns the epoll_wait timeout to
+ * use with it. A zero interval polls without sleeping, NULL sleeps until an
+ * fd is ready. The wake may come up to slack_ns late. The timer fd can't
+ * take slack, so a thread the kernel honors slack for sleeps on the
+ * epoll_wait timeout. The kernel gives real time threads none, their timer
+ * expires on a grid instead.
+ */
+static int arm_wake_timer(struct audio_thread *thread,
+			  const struct timespec *wait_ts, uint64_t slack_ns)
+{
+	struct itimerspec its = {};
+	int flags = 0, policy;
+
+	if (wait_ts && wait_ts->tv_sec == 0 && wait_ts->tv_nsec == 0)
+		return 0;
+
+	if (wait_ts && slack_ns) {
+		policy = sched_getscheduler(0);
+		if (policy == SCHED_OTHER || policy == SCHED_BATCH) {
+			if (thread->timer_armed &&
+			    timerfd_settime(thread->timer_fd, 0, &its, NULL))
+				syslog(LOG_ERR, "Failed to set wake timer: %d",
+				       errno);
+			thread->timer_armed = 0;
+			return slack_timeout(thread, wait_ts, slack_ns);
+		}
+		align_expiry(wait_ts, slack_ns, &its.it_value);
+		flags = TFD_TIMER_ABSTIME;
+	} else if (wait_ts) {
+		its.it_value = *wait_ts;
+	} else if (!thread->timer_armed) {
+		return -1;
+	}
+
+	if (timerfd_settime(thread->timer_fd, flags, &its, NULL))
+		syslog(LOG_ERR, "Failed to set wake timer: %d", errno);
+	thread->timer_armed = wait_ts != NULL;
+	return -1;
+}
+
+/* Busyloop accounting is kept per audio thread. */
+static __thread int continuous_zero_sleep_count = 0;
+static __thread unsigned busyloop_count = 0;
 
 /*
  * Logs the number of busyloop during one audio thread running state
@@ -769,8 +1392,8 @@ static unsigned busyloop_count = 0;
  */
 static void log_busyloop(struct timespec *wait_ts)
 {
-	static struct timespec start_time;
-	static bool started = false;
+	static __thread struct timespec start_time;
+	static __thread bool started = false;
 	struct timespec diff, now;
 
 	/* If wait_ts is NULL, there is no stream running. */
@@ -786,7 +1409,19 @@ static void log_busyloop(struct timespec *wait_ts)
 	}
 }
 
-static void check_busyloop(struct timespec *wait_ts)
+static void mitigate_busyloop(struct audio_thread *thread)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (!dev_io_mitigate_busyloop(&thread->open_devs[CRAS_STREAM_OUTPUT],
+				      &thread->open_devs[CRAS_STREAM_INPUT],
+				      &now))
+		syslog(LOG_WARNING, "Busyloop without a device or stream due");
+}
+
+static void check_busyloop(struct audio_thread *thread,
+			   struct timespec *wait_ts)
 {
 	if (wait_ts->tv_sec == 0 && wait_ts->tv_nsec == 0) {
 		continuous_zero_sleep_count++;
@@ -795,6 +1430,8 @@ static void check_busyloop(struct timespec *wait_ts)
 			busyloop_count++;
 			cras_audio_thread_event_busyloop();
 		}
+		if (continuous_zero_sleep_count == BUSYLOOP_MITIGATE_COUNT)
+			mitigate_busyloop(thread);
 		if (continuous_zero_sleep_count ==
 		    MAX_CONTINUOUS_ZERO_SLEEP_METRIC_LIMIT)
 			cras_server_metrics_busyloop_length(
@@ -821,28 +1458,37 @@ static void check_busyloop(struct timespec *wait_ts)
 static void *audio_io_thread(void *arg)
 {
 	struct audio_thread *thread = (struct audio_thread *)arg;
-	struct open_dev *adev;
-	struct dev_stream *curr;
-	struct timespec ts;
-	int msg_fd;
-	int rc;
-
-	msg_fd = thread->to_thread_fds[0];
+	struct epoll_event events[MAX_EPOLL_EVENTS];
+	struct timespec ts, wake_ts;
+	uint64_t expirations;
+	bool measure_wake_cost = false;
+	uint32_t cpu_mask;
+	int timeout;
+	int rc, i;
+
+	current_thread = thread;
+	cras_server_metrics_start_batching();
+	cras_system_state_snapshot_volume();
 
 	/* Attempt to get realtime scheduling */
-	if (cras_set_rt_scheduling(CRAS_SERVER_RT_THREAD_PRIORITY) == 0)
-		cras_set_thread_priority(CRAS_SERVER_RT_THREAD_PRIORITY);
+	if (cras_set_rt_scheduling(cras_system_get_rt_priority()) == 0)
+		cras_set_thread_priority(cras_system_get_rt_priority());
 
-	thread->pollfds[0].fd = msg_fd;
-	thread->pollfds[0].events = POLLIN;
+	cpu_mask = cras_system_get_audio_thread_cpu_mask();
+	if (cpu_mask && cras_set_thread_affinity(cpu_mask))
+		syslog(LOG_WARNING, "Failed to pin audio thread to CPUs %#x",
+		       cpu_mask);
+
+	/* Setting up isn't on the real time path, what follows is. */
+	cras_rt_guard_enter();
 
 	while (1) {
 		struct timespec *wait_ts;
 		struct iodev_callback_list *iodev_cb;
 		int non_empty;
+		int msg_ready = 0;
 
 		wait_ts = NULL;
-		thread->num_pollfds = 1;
 
 		/* device opened */
 		dev_io_run(&thread->open_devs[CRAS_STREAM_OUTPUT],
@@ -855,80 +1501,93 @@ static void *audio_io_thread(void *arg)
 		if (fill_next_sleep_interval(thread, &ts))
 			wait_ts = &ts;
 
-	restart_poll_loop:
-		thread->num_pollfds = 1;
-
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
-			if (iodev_cb->trigger != TRIGGER_POLL) {
-				iodev_cb->pollfd = NULL;
-				continue;
-			}
-			iodev_cb->pollfd = add_pollfd(thread, iodev_cb->fd,
-						      iodev_cb->events);
-			if (!iodev_cb->pollfd)
-				goto restart_poll_loop;
-		}
-
-		/* TODO(dgreid) - once per rstream not per dev_stream */
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_OUTPUT], adev) {
-			DL_FOREACH (adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				if (!add_pollfd(thread, fd, POLLIN))
-					goto restart_poll_loop;
-			}
-		}
-		DL_FOREACH (thread->open_devs[CRAS_STREAM_INPUT], adev) {
-			DL_FOREACH (adev->dev->streams, curr) {
-				int fd = dev_stream_poll_stream_fd(curr);
-				if (fd < 0)
-					continue;
-				if (!add_pollfd(thread, fd, POLLIN))
-					goto restart_poll_loop;
-			}
-		}
+		sync_stream_fds(thread);
 
 		log_busyloop(wait_ts);
 
 		ATLOG(atlog, AUDIO_THREAD_SLEEP, wait_ts ? wait_ts->tv_sec : 0,
 		      wait_ts ? wait_ts->tv_nsec : 0, non_empty);
-		if (wait_ts)
-			check_busyloop(wait_ts);
+		if (wait_ts) {
+			check_busyloop(thread, wait_ts);
+			/* Back off until the mitigated busyloop stops. */
+			if (continuous_zero_sleep_count >=
+			    BUSYLOOP_MITIGATE_COUNT) {
+				ts.tv_sec = 0;
+				ts.tv_nsec = BUSYLOOP_BACKOFF_US * 1000;
+			}
+		}
+
+		/* Hand held metrics to the main thread before sleeping with
+		 * nothing to run. */
+		cras_server_metrics_flush_batch(wait_ts == NULL);
 
 		/* Sync atlog with shared memory. */
 		__sync_synchronize();
 		atlog->sync_write_pos = atlog->write_pos;
 
-		rc = ppoll(thread->pollfds, thread->num_pollfds, wait_ts, NULL);
+		if (measure_wake_cost) {
+			update_wake_cost(thread, &wake_ts);
+			update_load_shed(thread);
+		}
+
+		timeout = arm_wake_timer(thread, wait_ts,
+					 next_wake_slack_ns(thread));
+		CRAS_TRACE1(sleep_begin, timeout);
+		rc = epoll_wait(thread->epoll_fd, events, MAX_EPOLL_EVENTS,
+				timeout);
+		CRAS_TRACE1(sleep_end, rc);
 		ATLOG(atlog, AUDIO_THREAD_WAKE, rc, 0, 0);
+		update_cpu(thread);
+
+		/* Time the wake, the cost sizes the reservation and tells when
+		 * to shed load. */
+		measure_wake_cost = true;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &wake_ts);
+
+		/* Read volume and mute once, everything run in this wake sees
+		 * the same values. */
+		cras_system_state_snapshot_volume();
 
 		/* Handle callbacks registered by TRIGGER_WAKEUP */
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
+		DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
 			if (iodev_cb->trigger == TRIGGER_WAKEUP) {
 				ATLOG(atlog, AUDIO_THREAD_IODEV_CB, 0, 0, 0);
 				iodev_cb->cb(iodev_cb->cb_data, 0);
 			}
 		}
 
-		/* If there's no pollfd ready to handle. */
+		/* If there's no fd ready to handle. */
 		if (rc <= 0)
 			continue;
 
-		if (thread->pollfds[0].revents & POLLIN) {
-			rc = handle_audio_thread_message(thread);
-			if (rc < 0)
-				syslog(LOG_ERR, "handle message %d", rc);
+		/* Record what fired before running any handler, a handler may
+		 * remove callbacks. */
+		for (i = 0; i < rc; i++) {
+			void *ptr = events[i].data.ptr;
+
+			if (ptr == &msg_event_tag) {
+				msg_ready = events[i].events & EPOLLIN;
+			} else if (ptr == &timer_event_tag) {
+				if (read(thread->timer_fd, &expirations,
+					 sizeof(expirations)) > 0)
+					thread->timer_armed = 0;
+			} else if (ptr != &stream_event_tag) {
+				iodev_cb = (struct iodev_callback_list *)ptr;
+				iodev_cb->revents = events[i].events;
+			}
 		}
 
-		DL_FOREACH (iodev_callbacks, iodev_cb) {
-			if (iodev_cb->pollfd &&
-			    iodev_cb->pollfd->revents & iodev_cb->events) {
-				ATLOG(atlog, AUDIO_THREAD_IODEV_CB,
-				      iodev_cb->pollfd->revents,
+		if (msg_ready)
+			handle_audio_thread_messages(thread);
+
+		DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
+			int revents = iodev_cb->revents;
+
+			iodev_cb->revents = 0;
+			if (revents & iodev_cb->events) {
+				ATLOG(atlog, AUDIO_THREAD_IODEV_CB, revents,
 				      iodev_cb->events, 0);
-				iodev_cb->cb(iodev_cb->cb_data,
-					     iodev_cb->pollfd->revents);
+				iodev_cb->cb(iodev_cb->cb_data, revents);
 			}
 		}
 	}
@@ -936,6 +1595,37 @@ static void *audio_io_thread(void *arg)
 	return NULL;
 }
 
+/* Queues a message in the command ring and rings the thread's doorbell. */
+static int audio_thread_queue_message(struct audio_thread *thread,
+				      struct audio_thread_msg *msg)
+{
+	uint64_t one = 1;
+	int err;
+
+	err = cmd_ring_push(thread->cmd_ring, msg, msg->length);
+	if (err < 0) {
+		syslog(LOG_ERR, "Failed to queue message %d to thread: %d",
+		       msg->id, err);
+		if (msg->id == AUDIO_THREAD_ADD_STREAM)
+			discard_prepared(
+				(struct audio_thread_add_rm_stream_msg *)msg);
+		return err;
+	}
+	if (write(thread->cmd_fd, &one, sizeof(one)) < 0) {
+		syslog(LOG_ERR, "Failed to wake audio thread: %d", errno);
+		return -errno;
+	}
+	return 0;
+}
+
+/* Queues a message for the thread without waiting for it to be handled. */
+static int audio_thread_post_message_async(struct audio_thread *thread,
+					   struct audio_thread_msg *msg)
+{
+	msg->async = 1;
+	return audio_thread_queue_message(thread, msg);
+}
+
 /* Write a message to the playback thread and wait for an ack, This keeps these
  * operations synchronous for the main server thread.  For instance when the
  * RM_STREAM message is sent, the stream can be deleted after the function
@@ -952,11 +1642,9 @@ static int audio_thread_post_message(struct audio_thread *thread,
 {
 	int err, rsp;
 
-	err = write(thread->to_thread_fds[1], msg, msg->length);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to post message to thread.");
+	err = audio_thread_queue_message(thread, msg);
+	if (err < 0)
 		return err;
-	}
 	/* Synchronous action, wait for response. */
 	err = read_until_finished(thread->to_main_fds[0], &rsp, sizeof(rsp));
 	if (err < 0) {
@@ -1002,6 +1690,26 @@ static void init_add_rm_stream_msg(struct audio_thread_add_rm_stream_msg *msg,
 	msg->num_devs = num_devs;
 }
 
+/*
+ * Builds the dev_streams of an add_stream message on the calling thread, so
+ * the audio thread attaching them doesn't spend its wake allocating
+ * converters and buffers next to the streams already playing. Devices past
+ * MAX_ASYNC_STREAM_DEVS or streams that can't be prepared are left to the
+ * audio thread.
+ */
+static void prepare_dev_streams(struct audio_thread_add_rm_stream_msg *msg,
+				struct cras_iodev **devs)
+{
+	unsigned int i;
+
+	for (i = 0; i < MIN(msg->num_devs, MAX_ASYNC_STREAM_DEVS); i++) {
+		if (!devs[i]->format)
+			continue;
+		msg->prepared[i] =
+			dev_stream_prepare(msg->stream, devs[i]->format);
+	}
+}
+
 static void
 init_dump_debug_info_msg(struct audio_thread_dump_debug_info_msg *msg,
 			 struct audio_debug_info *info)
@@ -1012,6 +1720,16 @@ init_dump_debug_info_msg(struct audio_thread_dump_debug_info_msg *msg,
 	msg->info = info;
 }
 
+static void
+init_dump_snapshot_msg(struct audio_thread_dump_snapshot_msg *msg,
+		       struct audio_thread_snapshot_dump *dump)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->header.id = AUDIO_THREAD_DUMP_SNAPSHOT;
+	msg->header.length = sizeof(*msg);
+	msg->dump = dump;
+}
+
 static void
 init_config_global_remix_msg(struct audio_thread_config_global_remix *msg)
 {
@@ -1052,9 +1770,31 @@ int audio_thread_add_stream(struct audio_thread *thread,
 
 	init_add_rm_stream_msg(&msg, AUDIO_THREAD_ADD_STREAM, stream, devs,
 			       num_devs);
+	prepare_dev_streams(&msg, devs);
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_add_stream_async(struct audio_thread *thread,
+				  struct cras_rstream *stream,
+				  struct cras_iodev **devs,
+				  unsigned int num_devs)
+{
+	struct audio_thread_add_rm_stream_msg msg;
+
+	assert(thread && stream);
+
+	if (!thread->started)
+		return -EINVAL;
+	if (num_devs > MAX_ASYNC_STREAM_DEVS)
+		return -EINVAL;
+
+	init_add_rm_stream_msg(&msg, AUDIO_THREAD_ADD_STREAM, stream, NULL,
+			       num_devs);
+	memcpy(msg.async_devs, devs, num_devs * sizeof(*devs));
+	prepare_dev_streams(&msg, devs);
+	return audio_thread_post_message_async(thread, &msg.header);
+}
+
 int audio_thread_disconnect_stream(struct audio_thread *thread,
 				   struct cras_rstream *stream,
 				   struct cras_iodev *dev)
@@ -1068,6 +1808,21 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_sync(struct audio_thread *thread)
+{
+	struct audio_thread_msg msg;
+
+	assert(thread);
+
+	if (!thread->started)
+		return 0;
+
+	memset(&msg, 0, sizeof(msg));
+	msg.id = AUDIO_THREAD_SYNC;
+	msg.length = sizeof(msg);
+	return audio_thread_post_message(thread, &msg);
+}
+
 int audio_thread_drain_stream(struct audio_thread *thread,
 			      struct cras_rstream *stream)
 {
@@ -1089,6 +1844,15 @@ int audio_thread_dump_thread_info(struct audio_thread *thread,
 	return audio_thread_post_message(thread, &msg.header);
 }
 
+int audio_thread_dump_snapshot(struct audio_thread *thread,
+			       struct audio_thread_snapshot_dump *dump)
+{
+	struct audio_thread_dump_snapshot_msg msg;
+
+	init_dump_snapshot_msg(&msg, dump);
+	return audio_thread_post_message(thread, &msg.header);
+}
+
 int audio_thread_set_aec_dump(struct audio_thread *thread,
 			      cras_stream_id_t stream_id, unsigned int start,
 			      int fd)
@@ -1101,7 +1865,7 @@ int audio_thread_set_aec_dump(struct audio_thread *thread,
 	msg.stream_id = stream_id;
 	msg.start = start;
 	msg.fd = fd;
-	return audio_thread_post_message(thread, &msg.header);
+	return audio_thread_post_message_async(thread, &msg.header);
 }
 
 int audio_thread_rm_callback_sync(struct audio_thread *thread, int fd)
@@ -1152,11 +1916,9 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
 			return -ENOMEM;
 	}
 
-	err = write(thread->to_thread_fds[1], &msg, msg.header.length);
-	if (err < 0) {
-		syslog(LOG_ERR, "Failed to post message to thread.");
+	err = audio_thread_queue_message(thread, &msg.header);
+	if (err < 0)
 		return err;
-	}
 	/* Synchronous action, wait for response. */
 	err = read_until_finished(thread->to_main_fds[0], &rsp, sizeof(rsp));
 	if (err < 0) {
@@ -1169,6 +1931,34 @@ int audio_thread_config_global_remix(struct audio_thread *thread,
 	return 0;
 }
 
+/* Creates the epoll set and wake timer, and registers the command doorbell. */
+static int init_epoll(struct audio_thread *thread)
+{
+	struct epoll_event ev = {};
+
+	thread->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (thread->epoll_fd < 0) {
+		syslog(LOG_ERR, "Failed to create epoll: %d", errno);
+		return -errno;
+	}
+	thread->timer_fd = timerfd_create(CLOCK_MONOTONIC,
+					  TFD_NONBLOCK | TFD_CLOEXEC);
+	if (thread->timer_fd < 0) {
+		syslog(LOG_ERR, "Failed to create timerfd: %d", errno);
+		return -errno;
+	}
+
+	ev.events = EPOLLIN;
+	ev.data.ptr = &msg_event_tag;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->cmd_fd, &ev))
+		return -errno;
+	ev.data.ptr = &timer_event_tag;
+	if (epoll_ctl(thread->epoll_fd, EPOLL_CTL_ADD, thread->timer_fd, &ev))
+		return -errno;
+
+	return 0;
+}
+
 struct audio_thread *audio_thread_create()
 {
 	int rc;
@@ -1178,15 +1968,25 @@ struct audio_thread *audio_thread_create()
 	if (!thread)
 		return NULL;
 
-	thread->to_thread_fds[0] = -1;
-	thread->to_thread_fds[1] = -1;
+	thread->cmd_fd = -1;
 	thread->to_main_fds[0] = -1;
 	thread->to_main_fds[1] = -1;
-
-	/* Two way pipes for communication with the device's audio thread. */
-	rc = pipe(thread->to_thread_fds);
-	if (rc < 0) {
-		syslog(LOG_ERR, "Failed to pipe");
+	thread->timer_fd = -1;
+	thread->epoll_fd = -1;
+	thread->cpu = -1;
+	thread->shed_priority = CRAS_NUM_STREAM_PRIORITIES;
+
+	/* Messages to the audio thread go through a ring with an eventfd
+	 * doorbell, synchronous responses come back through a pipe. */
+	thread->cmd_ring = cmd_ring_create();
+	if (!thread->cmd_ring) {
+		free(thread);
+		return NULL;
+	}
+	thread->cmd_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (thread->cmd_fd < 0) {
+		syslog(LOG_ERR, "Failed to create eventfd");
+		cmd_ring_destroy(thread->cmd_ring);
 		free(thread);
 		return NULL;
 	}
@@ -1197,16 +1997,26 @@ struct audio_thread *audio_thread_create()
 		return NULL;
 	}
 
-	if (asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0) {
-		syslog(LOG_ERR, "Failed to generate ATlog name.");
-		exit(-1);
+	/* All audio threads log to the same ATlog. */
+	if (!num_atlog_users++) {
+		if (asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0) {
+			syslog(LOG_ERR, "Failed to generate ATlog name.");
+			exit(-1);
+		}
+
+		atlog = audio_thread_event_log_init(
+			atlog_name, cras_system_get_audio_thread_log_size());
 	}
 
-	atlog = audio_thread_event_log_init(atlog_name);
+	/* Callbacks registered from main thread go to the first thread
+	 * until told otherwise. */
+	if (!main_callback_thread)
+		main_callback_thread = thread;
 
-	thread->pollfds_size = 32;
-	thread->pollfds = (struct pollfd *)malloc(sizeof(*thread->pollfds) *
-						  thread->pollfds_size);
+	if (init_epoll(thread)) {
+		audio_thread_destroy(thread);
+		return NULL;
+	}
 
 	return thread;
 }
@@ -1284,24 +2094,42 @@ int audio_thread_start(struct audio_thread *thread)
 
 void audio_thread_destroy(struct audio_thread *thread)
 {
+	struct thread_stream_fd *sfd;
+	struct iodev_callback_list *iodev_cb;
+
 	if (thread->started) {
 		struct audio_thread_msg msg;
 
+		memset(&msg, 0, sizeof(msg));
 		msg.id = AUDIO_THREAD_STOP;
 		msg.length = sizeof(msg);
 		audio_thread_post_message(thread, &msg);
 		pthread_join(thread->tid, NULL);
 	}
 
-	free(thread->pollfds);
-
-	audio_thread_event_log_deinit(atlog, atlog_name);
-	free(atlog_name);
-
-	if (thread->to_thread_fds[0] != -1) {
-		close(thread->to_thread_fds[0]);
-		close(thread->to_thread_fds[1]);
+	DL_FOREACH (thread->stream_fds, sfd) {
+		DL_DELETE(thread->stream_fds, sfd);
+		free(sfd);
+	}
+	DL_FOREACH (thread->iodev_callbacks, iodev_cb) {
+		DL_DELETE(thread->iodev_callbacks, iodev_cb);
+		free(iodev_cb);
 	}
+	if (thread->epoll_fd >= 0)
+		close(thread->epoll_fd);
+	if (thread->timer_fd >= 0)
+		close(thread->timer_fd);
+
+	if (!--num_atlog_users) {
+		audio_thread_event_log_deinit(atlog, atlog_name);
+		free(atlog_name);
+	}
+	if (main_callback_thread == thread)
+		main_callback_thread = NULL;
+
+	if (thread->cmd_fd != -1)
+		close(thread->cmd_fd);
+	cmd_ring_destroy(thread->cmd_ring);
 	if (thread->to_main_fds[0] != -1) {
 		close(thread->to_main_fds[0]);
 		close(thread->to_main_fds[1]);
@@ -10,39 +10,71 @@
 #include <stdint.h>
 
 #include "cras_iodev.h"
+#include "cras_rstream.h"
 #include "cras_types.h"
 #include "dev_io.h"
 
 struct buffer_share;
+struct cmd_ring;
 struct cras_fmt_conv;
 struct cras_iodev;
 struct cras_rstream;
 struct dev_stream;
+struct iodev_callback_list;
+struct thread_stream_fd;
 
 /* Hold communication pipes and pthread info for the thread used to play or
  * record audio.
- *    to_thread_fds - Send a message from main to running thread.
+ *    cmd_ring - Messages from main to running thread.
+ *    cmd_fd - Eventfd rung by main after queueing messages in cmd_ring.
  *    to_main_fds - Send a synchronous response to main from running thread.
  *    tid - Thread ID of the running playback/capture thread.
  *    started - Non-zero if the thread has started successfully.
  *    suspended - Non-zero if the thread is suspended.
  *    open_devs - Lists of open input and output devices.
- *    pollfds - What FDs wake up this thread.
- *    pollfds_size - Number of available poll fds.
- *    num_pollfds - Number of currently registered poll fds.
+ *    epoll_fd - The epoll set the thread waits on.
+ *    iodev_callbacks - Callbacks of devices open on this thread.
+ *    timer_fd - Armed with the sleep interval before each wait.
+ *    timer_armed - Non-zero if timer_fd is currently armed.
+ *    timer_slack_ns - The timer slack set for the thread, 0 until set.
+ *    stream_fds - Stream fds registered in the audio thread's epoll set.
  *    remix_converter - Format converter used to remix output channels.
+ *    wake_cost_ns - Decaying peak of the time a wake keeps the thread busy.
+ *    deadline_runtime_ns - Runtime of the SCHED_DEADLINE reservation.
+ *    deadline_period_ns - Period of the SCHED_DEADLINE reservation, 0 while
+ *        the thread runs SCHED_RR.
+ *    uclamp_min - Minimum utilization clamp currently requested.
+ *    cpu - CPU the thread last woke on, -1 before its first wake.
+ *    cpu_migrations - Number of wakes on a different CPU than the last one.
+ *    shed_priority - Streams of this priority class or less important are
+ *        degraded to save CPU, CRAS_NUM_STREAM_PRIORITIES when none are.
+ *    shed_wakes - Wakes in a row the thread was overloaded, or negated, in
+ *        a row it was well within its period.
  */
 struct audio_thread {
-	int to_thread_fds[2];
+	struct cmd_ring *cmd_ring;
+	int cmd_fd;
 	int to_main_fds[2];
 	pthread_t tid;
 	int started;
 	int suspended;
 	struct open_dev *open_devs[CRAS_NUM_DIRECTIONS];
-	struct pollfd *pollfds;
-	size_t pollfds_size;
-	size_t num_pollfds;
+	int epoll_fd;
+	struct iodev_callback_list *iodev_callbacks;
+	int timer_fd;
+	int timer_armed;
+	uint64_t timer_slack_ns;
+	struct thread_stream_fd *stream_fds;
 	struct cras_fmt_conv *remix_converter;
+	uint64_t wake_cost_ns;
+	uint64_t deadline_runtime_ns;
+	uint64_t deadline_period_ns;
+	uint32_t uclamp_min;
+	int cpu;
+	uint32_t cpu_migrations;
+	enum CRAS_STREAM_PRIORITY shed_priority;
+	int shed_wakes;
+	int async_err;
 };
 
 /*
@@ -96,6 +128,15 @@ int audio_thread_rm_open_dev(struct audio_thread *thread,
 int audio_thread_is_dev_open(struct audio_thread *thread,
 			     struct cras_iodev *dev);
 
+/* Sets the thread that callbacks added, removed or configured from outside
+ * any audio thread apply to, e.g. while main thread configures a device that
+ * will run on that thread. Calls from an audio thread always apply to the
+ * calling thread. Defaults to the first thread created.
+ * Args:
+ *    thread - The thread to direct callback calls from main thread to.
+ */
+void audio_thread_set_main_callback_thread(struct audio_thread *thread);
+
 /* Adds a thread_callback to audio thread for requested events. By default
  * the callback trigger is set to TRIGGER_POLL.
  * Args:
@@ -159,6 +200,26 @@ int audio_thread_add_stream(struct audio_thread *thread,
 			    struct cras_rstream *stream,
 			    struct cras_iodev **devs, unsigned int num_devs);
 
+/* Same as audio_thread_add_stream, but returns once the request is queued
+ * instead of waiting for the thread to handle it. A failure is only logged.
+ * devs is copied, so it holds at most MAX_ASYNC_STREAM_DEVS devices.
+ * Returns:
+ *    0 if the request is queued, negative error code otherwise.
+ */
+#define MAX_ASYNC_STREAM_DEVS 4
+int audio_thread_add_stream_async(struct audio_thread *thread,
+				  struct cras_rstream *stream,
+				  struct cras_iodev **devs,
+				  unsigned int num_devs);
+
+/* Waits until the thread has handled the messages queued to it before, like
+ * the requests of audio_thread_add_stream_async().
+ * Returns:
+ *    The first error of the requests queued without waiting since the last
+ *    sync, or 0.
+ */
+int audio_thread_sync(struct audio_thread *thread);
+
 /* Begin draining a stream and check the draining status.
  * Args:
  *    thread - a pointer to the audio thread.
@@ -187,12 +248,44 @@ int audio_thread_disconnect_stream(struct audio_thread *thread,
 int audio_thread_dump_thread_info(struct audio_thread *thread,
 				  struct audio_debug_info *info);
 
+/* What audio_thread_dump_snapshot() collects.
+ *    devs, streams, events - Arrays filled with the open devices, their
+ *      streams and the latest events, oldest first.
+ *    max_devs, max_streams, max_events - The number of entries each holds.
+ *    log_from - Events written to the log before this position, the
+ *      log_write_pos of the previous snapshot, are left out.
+ *    hdr - Filled like a snapshot, but for its timestamp, event_type and size.
+ *      num_devs and num_streams count all the devices and streams of the
+ *      thread, even the ones that didn't fit in devs and streams.
+ */
+struct audio_thread_snapshot_dump {
+	struct audio_dev_debug_info *devs;
+	struct audio_stream_debug_info *streams;
+	struct audio_thread_event *events;
+	unsigned int max_devs;
+	unsigned int max_streams;
+	unsigned int max_events;
+	uint64_t log_from;
+	struct cras_audio_thread_snapshot hdr;
+};
+
+/* Collects the state of the thread for a snapshot, waiting for it to be done.
+ * Args:
+ *    thread - The thread to dump.
+ *    dump - The arrays to fill, and where the numbers of entries are put.
+ * Returns:
+ *    0 on success, negative if error.
+ */
+int audio_thread_dump_snapshot(struct audio_thread *thread,
+			       struct audio_thread_snapshot_dump *dump);
+
 /* Starts or stops the aec dump task.
  * Args:
  *    thread - pointer to the audio thread.
  *    stream_id - id of the target stream for aec dump.
  *    start - True to start the aec dump, false to stop.
  *    fd - File to store aec dump result.
+ * The request is queued without waiting for the thread to handle it.
  */
 int audio_thread_set_aec_dump(struct audio_thread *thread,
 			      cras_stream_id_t stream_id, unsigned int start,
@@ -11,6 +11,7 @@
 #include <sys/mman.h>
 #include <pthread.h>
 #include <stdint.h>
+#include <string.h>
 #include <syslog.h>
 
 #include "cras_types.h"
@@ -29,8 +30,19 @@ extern struct audio_thread_event_log *atlog;
 extern int atlog_rw_shm_fd;
 extern int atlog_ro_shm_fd;
 
+/* Returns the size in bytes of a log holding len events. */
+static inline size_t audio_thread_event_log_bytes(unsigned int len)
+{
+	return sizeof(struct audio_thread_event_log) +
+	       ((size_t)len - AUDIO_THREAD_EVENT_LOG_SIZE) *
+		       sizeof(struct audio_thread_event);
+}
+
+/* Creates the live log, holding len events. len must be at least
+ * AUDIO_THREAD_EVENT_LOG_SIZE so a snapshot can always be taken from it.
+ */
 static inline struct audio_thread_event_log *
-audio_thread_event_log_init(char *name)
+audio_thread_event_log_init(char *name, unsigned int len)
 {
 	struct audio_thread_event_log *log;
 
@@ -38,16 +50,17 @@ audio_thread_event_log_init(char *name)
 	atlog_rw_shm_fd = -1;
 
 	log = (struct audio_thread_event_log *)cras_shm_setup(
-		name, sizeof(*log), &atlog_rw_shm_fd, &atlog_ro_shm_fd);
+		name, audio_thread_event_log_bytes(len), &atlog_rw_shm_fd,
+		&atlog_ro_shm_fd);
 	/* Fallback to calloc if device shared memory resource is empty and
 	 * cras_shm_setup fails.
 	 */
 	if (log == NULL) {
 		syslog(LOG_ERR, "Failed to create atlog by cras_shm_setup");
 		log = (struct audio_thread_event_log *)calloc(
-			1, sizeof(struct audio_thread_event_log));
+			1, audio_thread_event_log_bytes(len));
 	}
-	log->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+	log->len = len;
 
 	return log;
 }
@@ -57,7 +70,7 @@ audio_thread_event_log_deinit(struct audio_thread_event_log *log, char *name)
 {
 	if (log) {
 		if (atlog_rw_shm_fd >= 0) {
-			munmap(log, sizeof(*log));
+			munmap(log, audio_thread_event_log_bytes(log->len));
 			cras_shm_close_unlink(name, atlog_rw_shm_fd);
 		} else {
 			free(log);
@@ -68,6 +81,56 @@ audio_thread_event_log_deinit(struct audio_thread_event_log *log, char *name)
 	}
 }
 
+/* Copies the events of the live log written from write_pos from on into dst,
+ * oldest first. Only the newest max of them are copied if there are more.
+ * Returns the number of events copied. */
+static inline unsigned int
+audio_thread_event_log_copy_since(struct audio_thread_event *dst,
+				  unsigned int max,
+				  const struct audio_thread_event_log *log,
+				  uint64_t from)
+{
+	uint64_t end = log->write_pos;
+	uint64_t pos;
+	unsigned int n = 0;
+
+	if (max > log->len)
+		max = log->len;
+	pos = end > max ? end - max : 0;
+	if (pos < from)
+		pos = from;
+	for (; pos < end; pos++)
+		dst[n++] = log->log[pos % log->len];
+	return n;
+}
+
+/* Copies the newest AUDIO_THREAD_EVENT_LOG_SIZE events of the live log into
+ * a snapshot, keeping write_pos so readers walk it the same way. */
+static inline void
+audio_thread_event_log_snapshot(struct audio_thread_event_log *dst,
+				const struct audio_thread_event_log *log)
+{
+	uint64_t pos;
+	uint64_t end;
+
+	if (log->len == AUDIO_THREAD_EVENT_LOG_SIZE) {
+		memcpy(dst, log, sizeof(*dst));
+		return;
+	}
+
+	end = log->write_pos;
+	memset(dst->log, 0, sizeof(dst->log));
+	dst->write_pos = end;
+	dst->sync_write_pos = log->sync_write_pos;
+	dst->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+	pos = end > AUDIO_THREAD_EVENT_LOG_SIZE ?
+		      end - AUDIO_THREAD_EVENT_LOG_SIZE :
+		      0;
+	for (; pos < end; pos++)
+		dst->log[pos % AUDIO_THREAD_EVENT_LOG_SIZE] =
+			log->log[pos % log->len];
+}
+
 /* Log a tag and the current time, Uses two words, the first is split
  * 8 bits for tag and 24 for seconds, second word is micro seconds.
  */
@@ -77,7 +140,10 @@ audio_thread_event_log_data(struct audio_thread_event_log *log,
 			    uint32_t data2, uint32_t data3)
 {
 	struct timespec now;
-	uint64_t pos_mod_len = log->write_pos % AUDIO_THREAD_EVENT_LOG_SIZE;
+	/* Claim the entry atomically, several audio threads share the log. */
+	uint64_t pos_mod_len =
+		__atomic_fetch_add(&log->write_pos, 1, __ATOMIC_RELAXED) %
+		log->len;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
 	log->log[pos_mod_len].tag_sec =
@@ -86,8 +152,6 @@ audio_thread_event_log_data(struct audio_thread_event_log *log,
 	log->log[pos_mod_len].data1 = data1;
 	log->log[pos_mod_len].data2 = data2;
 	log->log[pos_mod_len].data3 = data3;
-
-	log->write_pos++;
 }
 
 #endif /* AUDIO_THREAD_LOG_H_ */
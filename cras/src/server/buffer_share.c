@@ -3,49 +3,35 @@
  * found in the LICENSE file.
  */
 
+#include <stdint.h>
 #include <stdlib.h>
 #include <sys/param.h>
 
+#include "cras_id_map.h"
 #include "cras_types.h"
 #include "buffer_share.h"
 
-static inline struct id_offset *find_unused(const struct buffer_share *mix)
-{
-	unsigned int i;
-
-	for (i = 0; i < mix->id_sz; i++) {
-		if (!mix->wr_idx[i].used)
-			return &mix->wr_idx[i];
-	}
-
-	return NULL;
-}
-
 static inline struct id_offset *find_id(const struct buffer_share *mix,
 					unsigned int id)
 {
-	unsigned int i;
+	uintptr_t pos = (uintptr_t)cras_id_map_find(mix->index, id);
 
-	for (i = 0; i < mix->id_sz; i++) {
-		if (mix->wr_idx[i].used && id == mix->wr_idx[i].id)
-			return &mix->wr_idx[i];
-	}
-
-	return NULL;
+	return pos ? &mix->wr_idx[pos - 1] : NULL;
 }
 
-static void alloc_more_ids(struct buffer_share *mix)
+static int alloc_more_ids(struct buffer_share *mix)
 {
 	unsigned int new_size = mix->id_sz * 2;
-	unsigned int i;
+	struct id_offset *wr_idx;
 
-	mix->wr_idx = (struct id_offset *)realloc(
-		mix->wr_idx, sizeof(mix->wr_idx[0]) * new_size);
-
-	for (i = mix->id_sz; i < new_size; i++)
-		mix->wr_idx[i].used = 0;
+	wr_idx = (struct id_offset *)realloc(mix->wr_idx,
+					     sizeof(mix->wr_idx[0]) * new_size);
+	if (!wr_idx)
+		return -ENOMEM;
 
+	mix->wr_idx = wr_idx;
 	mix->id_sz = new_size;
+	return 0;
 }
 
 struct buffer_share *buffer_share_create(unsigned int buf_sz)
@@ -56,6 +42,7 @@ struct buffer_share *buffer_share_create(unsigned int buf_sz)
 	mix->id_sz = INITIAL_ID_SIZE;
 	mix->wr_idx =
 		(struct id_offset *)calloc(mix->id_sz, sizeof(mix->wr_idx[0]));
+	mix->index = cras_id_map_create();
 	mix->buf_sz = buf_sz;
 
 	return mix;
@@ -65,6 +52,7 @@ void buffer_share_destroy(struct buffer_share *mix)
 {
 	if (!mix)
 		return;
+	cras_id_map_destroy(mix->index);
 	free(mix->wr_idx);
 	free(mix);
 }
@@ -72,17 +60,24 @@ void buffer_share_destroy(struct buffer_share *mix)
 int buffer_share_add_id(struct buffer_share *mix, unsigned int id, void *data)
 {
 	struct id_offset *o;
+	int rc;
 
 	o = find_id(mix, id);
 	if (o)
 		return -EEXIST;
 
-	o = find_unused(mix);
-	if (!o)
-		alloc_more_ids(mix);
+	if (mix->num_ids == mix->id_sz) {
+		rc = alloc_more_ids(mix);
+		if (rc)
+			return rc;
+	}
 
-	o = find_unused(mix);
-	o->used = 1;
+	rc = cras_id_map_insert(mix->index, id,
+				(void *)(uintptr_t)(mix->num_ids + 1));
+	if (rc)
+		return rc;
+
+	o = &mix->wr_idx[mix->num_ids++];
 	o->id = id;
 	o->offset = 0;
 	o->data = data;
@@ -92,13 +87,21 @@ int buffer_share_add_id(struct buffer_share *mix, unsigned int id, void *data)
 
 int buffer_share_rm_id(struct buffer_share *mix, unsigned int id)
 {
-	struct id_offset *o;
+	struct id_offset *o, *last;
 
 	o = find_id(mix, id);
 	if (!o)
 		return -ENOENT;
-	o->used = 0;
-	o->data = NULL;
+	cras_id_map_remove(mix->index, id);
+
+	/* Keep the users packed by moving the last one into the hole. */
+	last = &mix->wr_idx[--mix->num_ids];
+	if (o != last) {
+		*o = *last;
+		cras_id_map_remove(mix->index, o->id);
+		cras_id_map_insert(mix->index, o->id,
+				   (void *)(uintptr_t)(o - mix->wr_idx + 1));
+	}
 
 	return 0;
 }
@@ -106,15 +109,10 @@ int buffer_share_rm_id(struct buffer_share *mix, unsigned int id)
 int buffer_share_offset_update(struct buffer_share *mix, unsigned int id,
 			       unsigned int delta)
 {
-	unsigned int i;
+	struct id_offset *o = find_id(mix, id);
 
-	for (i = 0; i < mix->id_sz; i++) {
-		if (id != mix->wr_idx[i].id)
-			continue;
-
-		mix->wr_idx[i].offset += delta;
-		break;
-	}
+	if (o)
+		o->offset += delta;
 
 	return 0;
 }
@@ -124,18 +122,10 @@ unsigned int buffer_share_get_new_write_point(struct buffer_share *mix)
 	unsigned int min_written = mix->buf_sz + 1;
 	unsigned int i;
 
-	for (i = 0; i < mix->id_sz; i++) {
-		struct id_offset *o = &mix->wr_idx[i];
-
-		if (!o->used)
-			continue;
-
-		min_written = MIN(min_written, o->offset);
-	}
-	for (i = 0; i < mix->id_sz; i++) {
-		struct id_offset *o = &mix->wr_idx[i];
-		o->offset -= min_written;
-	}
+	for (i = 0; i < mix->num_ids; i++)
+		min_written = MIN(min_written, mix->wr_idx[i].offset);
+	for (i = 0; i < mix->num_ids; i++)
+		mix->wr_idx[i].offset -= min_written;
 
 	if (min_written > mix->buf_sz)
 		return 0;
@@ -143,29 +133,15 @@ unsigned int buffer_share_get_new_write_point(struct buffer_share *mix)
 	return min_written;
 }
 
-static struct id_offset *get_id_offset(const struct buffer_share *mix,
-				       unsigned int id)
-{
-	unsigned int i;
-	struct id_offset *o;
-
-	for (i = 0; i < mix->id_sz; i++) {
-		o = &mix->wr_idx[i];
-		if (o->used && o->id == id)
-			return o;
-	}
-	return NULL;
-}
-
 unsigned int buffer_share_id_offset(const struct buffer_share *mix,
 				    unsigned int id)
 {
-	struct id_offset *o = get_id_offset(mix, id);
+	struct id_offset *o = find_id(mix, id);
 	return o ? o->offset : 0;
 }
 
 void *buffer_share_get_data(const struct buffer_share *mix, unsigned int id)
 {
-	struct id_offset *o = get_id_offset(mix, id);
+	struct id_offset *o = find_id(mix, id);
 	return o ? o->data : NULL;
 }
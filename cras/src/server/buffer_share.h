@@ -8,17 +8,29 @@
 
 #define INITIAL_ID_SIZE 3
 
+struct cras_id_map;
+
 struct id_offset {
-	unsigned int used;
 	unsigned int id;
 	unsigned int offset;
 	void *data;
 };
 
+/* The users are kept packed in wr_idx[0, num_ids), and index maps an id to
+ * its position plus one, so finding a user doesn't depend on how many share
+ * the buffer.
+ *    buf_sz - Size of the shared buffer.
+ *    id_sz - Allocated length of wr_idx.
+ *    num_ids - Number of users.
+ *    wr_idx - The users.
+ *    index - Position in wr_idx of each id, plus one.
+ */
 struct buffer_share {
 	unsigned int buf_sz;
 	unsigned int id_sz;
+	unsigned int num_ids;
 	struct id_offset *wr_idx;
+	struct cras_id_map *index;
 };
 
 /*
@@ -0,0 +1,91 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+/*
+ * A lock-free ring of fixed size command slots, for exactly one producer
+ * thread and one consumer thread. The producer copies a command in with
+ * cmd_ring_push(). The consumer handles it in place through cmd_ring_front()
+ * and releases the slot with cmd_ring_pop().
+ */
+#ifndef CMD_RING_H_
+#define CMD_RING_H_
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define CMD_RING_NUM_SLOTS 64 /* Must be a power of two. */
+#define CMD_RING_SLOT_SIZE 256
+
+/* Members:
+ *    write_idx - Number of commands pushed, only written by the producer.
+ *    read_idx - Number of commands popped, only written by the consumer.
+ *    slots - Command storage, indexed by the free running indices.
+ * The indices sit on their own cache lines so the two threads don't bounce
+ * a line on every command.
+ */
+struct cmd_ring {
+	unsigned int write_idx __attribute__((aligned(64)));
+	unsigned int read_idx __attribute__((aligned(64)));
+	uint8_t slots[CMD_RING_NUM_SLOTS][CMD_RING_SLOT_SIZE]
+		__attribute__((aligned(64)));
+};
+
+static inline struct cmd_ring *cmd_ring_create()
+{
+	struct cmd_ring *ring;
+
+	if (posix_memalign((void **)&ring, 64, sizeof(*ring)))
+		return NULL;
+	memset(ring, 0, sizeof(*ring));
+	return ring;
+}
+
+static inline void cmd_ring_destroy(struct cmd_ring *ring)
+{
+	free(ring);
+}
+
+/* Copies a command into the next free slot. Producer only.
+ * Returns:
+ *    0 on success, -EINVAL if len doesn't fit a slot, -EAGAIN if the ring is
+ *    full.
+ */
+static inline int cmd_ring_push(struct cmd_ring *ring, const void *cmd,
+				size_t len)
+{
+	unsigned int w = ring->write_idx;
+	unsigned int r = __atomic_load_n(&ring->read_idx, __ATOMIC_ACQUIRE);
+
+	if (len > CMD_RING_SLOT_SIZE)
+		return -EINVAL;
+	if (w - r >= CMD_RING_NUM_SLOTS)
+		return -EAGAIN;
+
+	memcpy(ring->slots[w & (CMD_RING_NUM_SLOTS - 1)], cmd, len);
+	__atomic_store_n(&ring->write_idx, w + 1, __ATOMIC_RELEASE);
+	return 0;
+}
+
+/* Returns the oldest command not yet popped, or NULL if the ring is empty.
+ * Consumer only. */
+static inline void *cmd_ring_front(struct cmd_ring *ring)
+{
+	unsigned int r = ring->read_idx;
+	unsigned int w = __atomic_load_n(&ring->write_idx, __ATOMIC_ACQUIRE);
+
+	if (r == w)
+		return NULL;
+	return ring->slots[r & (CMD_RING_NUM_SLOTS - 1)];
+}
+
+/* Releases the slot returned by cmd_ring_front(). Consumer only. */
+static inline void cmd_ring_pop(struct cmd_ring *ring)
+{
+	__atomic_store_n(&ring->read_idx, ring->read_idx + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* CMD_RING_H_ */
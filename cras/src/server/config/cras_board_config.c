@@ -4,9 +4,14 @@
  */
 
 #include <errno.h>
+#include <string.h>
 #include <syslog.h>
 
 #include "cras_board_config.h"
+#include "cras_config.h"
+#include "cras_fmt_conv.h"
+#include "cras_types.h"
+#include "cras_util.h"
 #include "iniparser_wrapper.h"
 
 static const int32_t DEFAULT_OUTPUT_BUFFER_SIZE = 512;
@@ -15,6 +20,24 @@ static const int32_t AEC_GROUP_ID_DEFAULT = -1;
 static const int32_t BLUETOOTH_WBS_ENABLED_INI_DEFAULT = 1;
 static const int32_t BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_DEFAULT = 0;
 static const int32_t HOTWORD_PAUSE_AT_SUSPEND_DEFAULT = 0;
+static const int32_t MAX_AUDIO_THREADS_DEFAULT = 1;
+static const int32_t AUDIO_THREAD_LOG_SIZE_DEFAULT = AUDIO_THREAD_EVENT_LOG_SIZE;
+static const int32_t FLOAT_MIX_BUS_DEFAULT = 0;
+static const int32_t DSP_OFFLOAD_DEFAULT = 0;
+static const int32_t APM_OFFLOAD_DEFAULT = 0;
+static const int32_t IDLE_PAUSE_MS_DEFAULT = -1;
+static const int32_t HW_TIMESTAMP_RATE_EST_DEFAULT = 0;
+static const int32_t A2DP_ENCODE_OFFLOAD_DEFAULT = 0;
+static const int32_t SCHED_DEADLINE_DEFAULT = 0;
+static const int32_t CPU_AFFINITY_DEFAULT = 0;
+static const int32_t UCLAMP_MIN_DEFAULT = 0;
+static const int32_t MLOCK_BUDGET_KB_DEFAULT = 0;
+static const int32_t WARM_STANDBY_MS_DEFAULT = 0;
+static const int32_t MIC_KEEP_WARM_MS_DEFAULT = 0;
+static const int32_t NATIVE_RATE_DEFAULT = 0;
+static const int32_t RT_PRIORITY_DEFAULT = CRAS_SERVER_RT_THREAD_PRIORITY;
+static const int32_t PLAYBACK_WAKE_FUZZ_US_DEFAULT = 500;
+static const int32_t CAPTURE_WAKE_FUZZ_US_DEFAULT = 1000;
 
 #define CONFIG_NAME "board.ini"
 #define DEFAULT_OUTPUT_BUF_SIZE_INI_KEY "output:default_output_buffer_size"
@@ -24,6 +47,70 @@ static const int32_t HOTWORD_PAUSE_AT_SUSPEND_DEFAULT = 0;
 #define BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_KEY "bluetooth:deprioritize_wbs_mic"
 #define UCM_IGNORE_SUFFIX_KEY "ucm:ignore_suffix"
 #define HOTWORD_PAUSE_AT_SUSPEND "hotword:pause_at_suspend"
+#define MAX_AUDIO_THREADS_INI_KEY "audio_thread:max_threads"
+#define AUDIO_THREAD_LOG_SIZE_INI_KEY "audio_thread:event_log_size"
+#define FLOAT_MIX_BUS_INI_KEY "output:float_mix_bus"
+#define DSP_OFFLOAD_INI_KEY "output:dsp_offload"
+#define APM_OFFLOAD_INI_KEY "processing:apm_offload"
+#define IDLE_PAUSE_MS_INI_KEY "output:idle_pause_ms"
+#define HW_TIMESTAMP_RATE_EST_INI_KEY "alsa:hw_timestamp_rate_est"
+#define A2DP_ENCODE_OFFLOAD_INI_KEY "bluetooth:a2dp_encode_offload"
+#define SCHED_DEADLINE_INI_KEY "audio_thread:sched_deadline"
+#define CPU_AFFINITY_INI_KEY "audio_thread:cpu_affinity"
+#define UCLAMP_MIN_INI_KEY "audio_thread:uclamp_min"
+#define MLOCK_BUDGET_KB_INI_KEY "audio_thread:mlock_budget_kb"
+#define WARM_STANDBY_MS_INI_KEY "output:warm_standby_ms"
+#define MIC_KEEP_WARM_MS_INI_KEY "input:keep_warm_ms"
+#define NATIVE_RATE_INI_KEY "output:native_rate"
+#define RT_PRIORITY_INI_KEY "performance:rt_priority"
+#define PLAYBACK_WAKE_FUZZ_US_INI_KEY "performance:playback_wake_fuzz_us"
+#define CAPTURE_WAKE_FUZZ_US_INI_KEY "performance:capture_wake_fuzz_us"
+#define RESAMPLER_QUALITY_INI_KEY "performance:resampler_quality"
+
+/* The SCHED_RR priorities an audio thread can take. The A2DP encoder runs
+ * one below the audio threads, so the lowest leaves room for it. */
+#define MIN_RT_PRIORITY 2
+#define MAX_RT_PRIORITY 99
+/* Waking this much early costs more wakes than it saves. */
+#define MAX_WAKE_FUZZ_US 5000
+
+static const char *const resampler_quality_names[] = {
+	[CRAS_RESAMPLER_QUALITY_DEFAULT] = "default",
+	[CRAS_RESAMPLER_QUALITY_LOW] = "low",
+	[CRAS_RESAMPLER_QUALITY_MEDIUM] = "medium",
+	[CRAS_RESAMPLER_QUALITY_HIGH] = "high",
+};
+
+/* Reads an integer of the performance section, falling back to def when it
+ * isn't within [min, max]. */
+static int32_t get_perf_int(dictionary *ini, const char *key, int32_t def,
+			    int32_t min, int32_t max)
+{
+	int32_t value = iniparser_getint(ini, key, def);
+
+	if (value >= min && value <= max)
+		return value;
+	syslog(LOG_WARNING, "%s %d not in [%d, %d], using %d", key, value,
+	       min, max, def);
+	return def;
+}
+
+/* Reads the resampler quality from its name, DEFAULT if it isn't known. */
+static int32_t get_resampler_quality(dictionary *ini)
+{
+	const char *name;
+	int32_t i;
+
+	name = iniparser_getstring(ini, RESAMPLER_QUALITY_INI_KEY, NULL);
+	if (!name)
+		return CRAS_RESAMPLER_QUALITY_DEFAULT;
+	for (i = 0; i < (int32_t)ARRAY_SIZE(resampler_quality_names); i++) {
+		if (strcmp(name, resampler_quality_names[i]) == 0)
+			return i;
+	}
+	syslog(LOG_WARNING, "Unknown %s %s", RESAMPLER_QUALITY_INI_KEY, name);
+	return CRAS_RESAMPLER_QUALITY_DEFAULT;
+}
 
 void cras_board_config_get(const char *config_path,
 			   struct cras_board_config *board_config)
@@ -40,6 +127,25 @@ void cras_board_config_get(const char *config_path,
 	board_config->bt_wbs_enabled = BLUETOOTH_WBS_ENABLED_INI_DEFAULT;
 	board_config->deprioritize_bt_wbs_mic =
 		BLUETOOTH_DEPRIORITIZE_WBS_MIC_INI_DEFAULT;
+	board_config->max_audio_threads = MAX_AUDIO_THREADS_DEFAULT;
+	board_config->audio_thread_log_size = AUDIO_THREAD_LOG_SIZE_DEFAULT;
+	board_config->float_mix_bus = FLOAT_MIX_BUS_DEFAULT;
+	board_config->dsp_offload = DSP_OFFLOAD_DEFAULT;
+	board_config->apm_offload = APM_OFFLOAD_DEFAULT;
+	board_config->idle_pause_ms = IDLE_PAUSE_MS_DEFAULT;
+	board_config->hw_timestamp_rate_est = HW_TIMESTAMP_RATE_EST_DEFAULT;
+	board_config->a2dp_encode_offload = A2DP_ENCODE_OFFLOAD_DEFAULT;
+	board_config->sched_deadline = SCHED_DEADLINE_DEFAULT;
+	board_config->cpu_affinity = CPU_AFFINITY_DEFAULT;
+	board_config->uclamp_min = UCLAMP_MIN_DEFAULT;
+	board_config->mlock_budget_kb = MLOCK_BUDGET_KB_DEFAULT;
+	board_config->warm_standby_ms = WARM_STANDBY_MS_DEFAULT;
+	board_config->mic_keep_warm_ms = MIC_KEEP_WARM_MS_DEFAULT;
+	board_config->native_rate = NATIVE_RATE_DEFAULT;
+	board_config->rt_priority = RT_PRIORITY_DEFAULT;
+	board_config->playback_wake_fuzz_us = PLAYBACK_WAKE_FUZZ_US_DEFAULT;
+	board_config->capture_wake_fuzz_us = CAPTURE_WAKE_FUZZ_US_DEFAULT;
+	board_config->resampler_quality = CRAS_RESAMPLER_QUALITY_DEFAULT;
 	if (config_path == NULL)
 		return;
 
@@ -92,6 +198,92 @@ void cras_board_config_get(const char *config_path,
 	board_config->hotword_pause_at_suspend = iniparser_getint(
 		ini, ini_key, HOTWORD_PAUSE_AT_SUSPEND_DEFAULT);
 
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, MAX_AUDIO_THREADS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->max_audio_threads =
+		iniparser_getint(ini, ini_key, MAX_AUDIO_THREADS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, AUDIO_THREAD_LOG_SIZE_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->audio_thread_log_size =
+		iniparser_getint(ini, ini_key, AUDIO_THREAD_LOG_SIZE_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, FLOAT_MIX_BUS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->float_mix_bus =
+		iniparser_getint(ini, ini_key, FLOAT_MIX_BUS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, DSP_OFFLOAD_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->dsp_offload =
+		iniparser_getint(ini, ini_key, DSP_OFFLOAD_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, APM_OFFLOAD_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->apm_offload =
+		iniparser_getint(ini, ini_key, APM_OFFLOAD_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, IDLE_PAUSE_MS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->idle_pause_ms =
+		iniparser_getint(ini, ini_key, IDLE_PAUSE_MS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, HW_TIMESTAMP_RATE_EST_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->hw_timestamp_rate_est =
+		iniparser_getint(ini, ini_key, HW_TIMESTAMP_RATE_EST_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, A2DP_ENCODE_OFFLOAD_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->a2dp_encode_offload =
+		iniparser_getint(ini, ini_key, A2DP_ENCODE_OFFLOAD_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, SCHED_DEADLINE_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->sched_deadline =
+		iniparser_getint(ini, ini_key, SCHED_DEADLINE_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, CPU_AFFINITY_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->cpu_affinity =
+		iniparser_getint(ini, ini_key, CPU_AFFINITY_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, UCLAMP_MIN_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->uclamp_min =
+		iniparser_getint(ini, ini_key, UCLAMP_MIN_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, MLOCK_BUDGET_KB_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->mlock_budget_kb =
+		iniparser_getint(ini, ini_key, MLOCK_BUDGET_KB_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, WARM_STANDBY_MS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->warm_standby_ms =
+		iniparser_getint(ini, ini_key, WARM_STANDBY_MS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, MIC_KEEP_WARM_MS_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->mic_keep_warm_ms =
+		iniparser_getint(ini, ini_key, MIC_KEEP_WARM_MS_DEFAULT);
+
+	snprintf(ini_key, MAX_INI_KEY_LENGTH, NATIVE_RATE_INI_KEY);
+	ini_key[MAX_INI_KEY_LENGTH] = 0;
+	board_config->native_rate =
+		iniparser_getint(ini, ini_key, NATIVE_RATE_DEFAULT);
+
+	board_config->rt_priority =
+		get_perf_int(ini, RT_PRIORITY_INI_KEY, RT_PRIORITY_DEFAULT,
+			     MIN_RT_PRIORITY, MAX_RT_PRIORITY);
+	board_config->playback_wake_fuzz_us = get_perf_int(
+		ini, PLAYBACK_WAKE_FUZZ_US_INI_KEY,
+		PLAYBACK_WAKE_FUZZ_US_DEFAULT, 0, MAX_WAKE_FUZZ_US);
+	board_config->capture_wake_fuzz_us = get_perf_int(
+		ini, CAPTURE_WAKE_FUZZ_US_INI_KEY, CAPTURE_WAKE_FUZZ_US_DEFAULT,
+		0, MAX_WAKE_FUZZ_US);
+	board_config->resampler_quality = get_resampler_quality(ini);
+
 	iniparser_freedict(ini);
 	syslog(LOG_DEBUG, "Loaded ini file %s", ini_name);
 }
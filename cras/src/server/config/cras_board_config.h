@@ -16,9 +16,30 @@ struct cras_board_config {
 	int32_t deprioritize_bt_wbs_mic;
 	char *ucm_ignore_suffix;
 	int32_t hotword_pause_at_suspend;
+	int32_t max_audio_threads;
+	int32_t audio_thread_log_size;
+	int32_t float_mix_bus;
+	int32_t dsp_offload;
+	int32_t apm_offload;
+	int32_t idle_pause_ms;
+	int32_t hw_timestamp_rate_est;
+	int32_t a2dp_encode_offload;
+	int32_t sched_deadline;
+	int32_t cpu_affinity;
+	int32_t uclamp_min;
+	int32_t mlock_budget_kb;
+	int32_t warm_standby_ms;
+	int32_t mic_keep_warm_ms;
+	int32_t native_rate;
+	int32_t rt_priority;
+	int32_t playback_wake_fuzz_us;
+	int32_t capture_wake_fuzz_us;
+	int32_t resampler_quality;
 };
 
-/* Gets a configuration based on the config file specified.
+/* Gets a configuration based on the config file specified. Values of the
+ * performance section out of their range are logged and replaced by the
+ * defaults.
  * Args:
  *    config_path - Path containing the config files.
  *    board_config - The returned configs.
@@ -13,10 +13,12 @@
 #include "cras_apm_list.h"
 #include "cras_config.h"
 #include "cras_iodev_list.h"
+#include "cras_rtp_io.h"
 #include "cras_server.h"
 #include "cras_shm.h"
 #include "cras_system_state.h"
 #include "cras_dsp.h"
+#include "cras_flight_recorder.h"
 
 static struct option long_options[] = {
 	{ "dsp_config", required_argument, 0, 'd' },
@@ -24,6 +26,7 @@ static struct option long_options[] = {
 	{ "device_config_dir", required_argument, 0, 'c' },
 	{ "disable_profile", required_argument, 0, 'D' },
 	{ "internal_ucm_suffix", required_argument, 0, 'u' },
+	{ "flight_recorder_dir", required_argument, 0, 'f' },
 	{ 0, 0, 0, 0 }
 };
 
@@ -85,6 +88,10 @@ int main(int argc, char **argv)
 					profile_disable_mask |=
 						CRAS_SERVER_PROFILE_MASK_A2DP;
 				}
+				if (strncmp(optarg, "lea", 3) == 0) {
+					profile_disable_mask |=
+						CRAS_SERVER_PROFILE_MASK_LEA;
+				}
 				optarg = strchr(optarg, ',');
 				if (optarg != NULL) {
 					optarg++;
@@ -95,6 +102,11 @@ int main(int argc, char **argv)
 			if (*optarg != 0)
 				internal_ucm_suffix = optarg;
 			break;
+		/* Glitch records are only written when a directory is given. */
+		case 'f':
+			if (*optarg != 0)
+				cras_flight_recorder_init(optarg);
+			break;
 		default:
 			break;
 		}
@@ -140,6 +152,7 @@ int main(int argc, char **argv)
 	cras_apm_list_init(device_config_dir);
 	cras_iodev_list_init();
 	cras_alsa_plugin_io_init(device_config_dir);
+	cras_rtp_io_init(device_config_dir);
 
 	/* Start the server. */
 	return cras_server_run(profile_disable_mask);
@@ -0,0 +1,79 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <sys/param.h>
+
+#include "cras_a2dp_bitpool.h"
+#include "cras_util.h"
+
+/* How much the bitpool comes down at once on congestion. */
+#define BITPOOL_DECREASE_STEP 5
+/* How much the bitpool goes back up at once. */
+#define BITPOOL_INCREASE_STEP 2
+
+/* Packets written later than this count as congestion. */
+static const struct timespec max_late = {
+	0, 20000000 /* 20ms */
+};
+
+/* Time for the socket to drain after the bitpool is lowered, before it's
+ * lowered again. */
+static const struct timespec decrease_interval = {
+	0, 100000000 /* 100ms */
+};
+
+/* How long the link has to keep up before the bitpool goes back up. */
+static const struct timespec increase_interval = {
+	1, 0 /* 1s */
+};
+
+void cras_a2dp_bitpool_init(struct cras_a2dp_bitpool *bp, unsigned int min,
+			    unsigned int max, const struct timespec *now)
+{
+	bp->min = min;
+	bp->max = max;
+	bp->bitpool = max;
+	bp->last_decrease.tv_sec = 0;
+	bp->last_decrease.tv_nsec = 0;
+	bp->clear_since = *now;
+}
+
+unsigned int cras_a2dp_bitpool_update(struct cras_a2dp_bitpool *bp,
+				      unsigned int queued,
+				      unsigned int capacity,
+				      const struct timespec *late,
+				      const struct timespec *now)
+{
+	/* More than half the socket buffer still queued, or writes falling
+	 * behind schedule, mean the link doesn't carry the current bit rate.
+	 */
+	if (queued * 2 > capacity || timespec_after(late, &max_late)) {
+		bp->clear_since = *now;
+		if (bp->bitpool > bp->min &&
+		    !timespec_diff_shorter_than(now, &bp->last_decrease,
+						&decrease_interval)) {
+			if (bp->bitpool > bp->min + BITPOOL_DECREASE_STEP)
+				bp->bitpool -= BITPOOL_DECREASE_STEP;
+			else
+				bp->bitpool = bp->min;
+			bp->last_decrease = *now;
+		}
+		return bp->bitpool;
+	}
+
+	/* Some backlog, not enough to back off, keeps the bitpool as is. */
+	if (queued * 4 > capacity) {
+		bp->clear_since = *now;
+		return bp->bitpool;
+	}
+
+	if (bp->bitpool < bp->max &&
+	    !timespec_diff_shorter_than(now, &bp->clear_since,
+					&increase_interval)) {
+		bp->bitpool = MIN(bp->max, bp->bitpool + BITPOOL_INCREASE_STEP);
+		bp->clear_since = *now;
+	}
+	return bp->bitpool;
+}
@@ -0,0 +1,61 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_A2DP_BITPOOL_H_
+#define CRAS_A2DP_BITPOOL_H_
+
+#include <time.h>
+
+/*
+ * Adapts the bitpool of an A2DP stream to how congested the link is. It's
+ * fed with the backlog of the socket and how late the packets are written.
+ * The bitpool comes down quickly when packets pile up, before the socket
+ * fills and writes get throttled, and goes back up slowly once the link has
+ * been keeping up for a while.
+ * Members:
+ *    min - The lowest bitpool the configuration allows.
+ *    max - The highest bitpool the configuration allows.
+ *    bitpool - The bitpool to encode with.
+ *    last_decrease - When the bitpool was last lowered.
+ *    clear_since - When the link started keeping up, the time of the last
+ *        change or backlog otherwise.
+ */
+struct cras_a2dp_bitpool {
+	unsigned int min;
+	unsigned int max;
+	unsigned int bitpool;
+	struct timespec last_decrease;
+	struct timespec clear_since;
+};
+
+/*
+ * Initializes the controller to start at the highest bitpool.
+ * Args:
+ *    bp - The controller.
+ *    min - The lowest bitpool the configuration allows.
+ *    max - The highest bitpool the configuration allows.
+ *    now - The current time.
+ */
+void cras_a2dp_bitpool_init(struct cras_a2dp_bitpool *bp, unsigned int min,
+			    unsigned int max, const struct timespec *now);
+
+/*
+ * Updates the bitpool before a packet is written.
+ * Args:
+ *    bp - The controller.
+ *    queued - The bytes in the send buffer of the socket.
+ *    capacity - The size of the send buffer of the socket.
+ *    late - How late the packet is written.
+ *    now - The current time.
+ * Returns:
+ *    The bitpool to encode the next frames with.
+ */
+unsigned int cras_a2dp_bitpool_update(struct cras_a2dp_bitpool *bp,
+				      unsigned int queued,
+				      unsigned int capacity,
+				      const struct timespec *late,
+				      const struct timespec *now);
+
+#endif /* CRAS_A2DP_BITPOOL_H_ */
@@ -0,0 +1,355 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <sbc/sbc.h>
+#include <stdint.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "a2dp-codecs.h"
+#include "cras_a2dp_codec.h"
+#include "cras_sbc_codec.h"
+#include "cras_util.h"
+
+/* The highest AAC bit rate we ask for, in bits per second. */
+#define AAC_MAX_BITRATE 320000
+/* The dynamic rtp payload type used for AAC. */
+#define AAC_RTP_PAYLOAD_TYPE 96
+
+static void sbc_get_capabilities(void *caps)
+{
+	a2dp_sbc_t *sbc_caps = caps;
+
+	sbc_caps->channel_mode =
+		SBC_CHANNEL_MODE_MONO | SBC_CHANNEL_MODE_DUAL_CHANNEL |
+		SBC_CHANNEL_MODE_STEREO | SBC_CHANNEL_MODE_JOINT_STEREO;
+	sbc_caps->frequency = SBC_SAMPLING_FREQ_16000 |
+			      SBC_SAMPLING_FREQ_32000 |
+			      SBC_SAMPLING_FREQ_44100 | SBC_SAMPLING_FREQ_48000;
+	sbc_caps->allocation_method =
+		SBC_ALLOCATION_SNR | SBC_ALLOCATION_LOUDNESS;
+	sbc_caps->subbands = SBC_SUBBANDS_4 | SBC_SUBBANDS_8;
+	sbc_caps->block_length = SBC_BLOCK_LENGTH_4 | SBC_BLOCK_LENGTH_8 |
+				 SBC_BLOCK_LENGTH_12 | SBC_BLOCK_LENGTH_16;
+	sbc_caps->min_bitpool = MIN_BITPOOL;
+	sbc_caps->max_bitpool = MAX_BITPOOL;
+}
+
+static int sbc_select_configuration(const void *caps, void *config)
+{
+	const a2dp_sbc_t *sbc_caps = caps;
+	a2dp_sbc_t *sbc_config = config;
+
+	/* Pick the highest configuration. */
+	if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
+	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_STEREO) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_STEREO;
+	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
+	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_MONO) {
+		sbc_config->channel_mode = SBC_CHANNEL_MODE_MONO;
+	} else {
+		syslog(LOG_WARNING, "No supported channel modes.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->frequency & SBC_SAMPLING_FREQ_48000) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_48000;
+	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_44100) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_44100;
+	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_32000) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_32000;
+	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_16000) {
+		sbc_config->frequency = SBC_SAMPLING_FREQ_16000;
+	} else {
+		syslog(LOG_WARNING, "No supported sampling frequencies.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->allocation_method & SBC_ALLOCATION_LOUDNESS) {
+		sbc_config->allocation_method = SBC_ALLOCATION_LOUDNESS;
+	} else if (sbc_caps->allocation_method & SBC_ALLOCATION_SNR) {
+		sbc_config->allocation_method = SBC_ALLOCATION_SNR;
+	} else {
+		syslog(LOG_WARNING, "No supported allocation method.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->subbands & SBC_SUBBANDS_8) {
+		sbc_config->subbands = SBC_SUBBANDS_8;
+	} else if (sbc_caps->subbands & SBC_SUBBANDS_4) {
+		sbc_config->subbands = SBC_SUBBANDS_4;
+	} else {
+		syslog(LOG_WARNING, "No supported subbands.");
+		return -ENOSYS;
+	}
+
+	if (sbc_caps->block_length & SBC_BLOCK_LENGTH_16) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_16;
+	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_12) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_12;
+	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_8) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_8;
+	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_4) {
+		sbc_config->block_length = SBC_BLOCK_LENGTH_4;
+	} else {
+		syslog(LOG_WARNING, "No supported block length.");
+		return -ENOSYS;
+	}
+
+	sbc_config->min_bitpool =
+		(sbc_caps->min_bitpool > MIN_BITPOOL ? sbc_caps->min_bitpool :
+						       MIN_BITPOOL);
+	sbc_config->max_bitpool =
+		(sbc_caps->max_bitpool < MAX_BITPOOL ? sbc_caps->max_bitpool :
+						       MAX_BITPOOL);
+
+	return 0;
+}
+
+static int sbc_get_format(const void *config, size_t *rate, size_t *channels)
+{
+	const a2dp_sbc_t *sbc = config;
+
+	*channels = (sbc->channel_mode == SBC_CHANNEL_MODE_MONO) ? 1 : 2;
+
+	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
+		*rate = 48000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_44100)
+		*rate = 44100;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_32000)
+		*rate = 32000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_16000)
+		*rate = 16000;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+static void sbc_get_bitpool_range(const void *config, unsigned int *min,
+				  unsigned int *max)
+{
+	const a2dp_sbc_t *sbc = config;
+
+	*min = sbc->min_bitpool;
+	*max = sbc->max_bitpool;
+}
+
+static struct cras_audio_codec *sbc_create(const void *config)
+{
+	const a2dp_sbc_t *sbc = config;
+	uint8_t frequency = 0, mode = 0, subbands = 0, allocation, blocks = 0,
+		bitpool;
+
+	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
+		frequency = SBC_FREQ_48000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_44100)
+		frequency = SBC_FREQ_44100;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_32000)
+		frequency = SBC_FREQ_32000;
+	else if (sbc->frequency & SBC_SAMPLING_FREQ_16000)
+		frequency = SBC_FREQ_16000;
+
+	if (sbc->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO)
+		mode = SBC_MODE_JOINT_STEREO;
+	else if (sbc->channel_mode & SBC_CHANNEL_MODE_STEREO)
+		mode = SBC_MODE_STEREO;
+	else if (sbc->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL)
+		mode = SBC_MODE_DUAL_CHANNEL;
+	else if (sbc->channel_mode & SBC_CHANNEL_MODE_MONO)
+		mode = SBC_MODE_MONO;
+
+	if (sbc->allocation_method & SBC_ALLOCATION_LOUDNESS)
+		allocation = SBC_AM_LOUDNESS;
+	else
+		allocation = SBC_AM_SNR;
+
+	switch (sbc->subbands) {
+	case SBC_SUBBANDS_4:
+		subbands = SBC_SB_4;
+		break;
+	case SBC_SUBBANDS_8:
+		subbands = SBC_SB_8;
+		break;
+	}
+
+	switch (sbc->block_length) {
+	case SBC_BLOCK_LENGTH_4:
+		blocks = SBC_BLK_4;
+		break;
+	case SBC_BLOCK_LENGTH_8:
+		blocks = SBC_BLK_8;
+		break;
+	case SBC_BLOCK_LENGTH_12:
+		blocks = SBC_BLK_12;
+		break;
+	case SBC_BLOCK_LENGTH_16:
+		blocks = SBC_BLK_16;
+		break;
+	}
+
+	bitpool = sbc->max_bitpool;
+
+	return cras_sbc_codec_create(frequency, mode, subbands, allocation,
+				     blocks, bitpool);
+}
+
+static void sbc_set_bitpool(struct cras_audio_codec *codec,
+			    unsigned int bitpool)
+{
+	cras_sbc_set_bitpool(codec, bitpool);
+}
+
+static const struct cras_a2dp_codec_impl sbc_impl = {
+	.create = sbc_create,
+	.destroy = cras_sbc_codec_destroy,
+	.get_codesize = cras_sbc_get_codesize,
+	.get_frame_length = cras_sbc_get_frame_length,
+	.set_bitpool = sbc_set_bitpool,
+};
+
+static void aac_get_capabilities(void *caps)
+{
+	a2dp_aac_t *aac_caps = caps;
+
+	memset(aac_caps, 0, sizeof(*aac_caps));
+	aac_caps->object_type =
+		AAC_OBJECT_TYPE_MPEG2_AAC_LC | AAC_OBJECT_TYPE_MPEG4_AAC_LC;
+	AAC_SET_FREQUENCY(*aac_caps, AAC_SAMPLING_FREQ_32000 |
+					     AAC_SAMPLING_FREQ_44100 |
+					     AAC_SAMPLING_FREQ_48000);
+	aac_caps->channels = AAC_CHANNELS_1 | AAC_CHANNELS_2;
+	aac_caps->vbr = 1;
+	AAC_SET_BITRATE(*aac_caps, AAC_MAX_BITRATE);
+}
+
+static int aac_select_configuration(const void *caps, void *config)
+{
+	const a2dp_aac_t *aac_caps = caps;
+	a2dp_aac_t *aac_config = config;
+	unsigned int frequency = AAC_GET_FREQUENCY(*aac_caps);
+	unsigned int bitrate = AAC_GET_BITRATE(*aac_caps);
+
+	memset(aac_config, 0, sizeof(*aac_config));
+
+	if (aac_caps->object_type & AAC_OBJECT_TYPE_MPEG2_AAC_LC) {
+		aac_config->object_type = AAC_OBJECT_TYPE_MPEG2_AAC_LC;
+	} else if (aac_caps->object_type & AAC_OBJECT_TYPE_MPEG4_AAC_LC) {
+		aac_config->object_type = AAC_OBJECT_TYPE_MPEG4_AAC_LC;
+	} else {
+		syslog(LOG_WARNING, "No supported AAC object type.");
+		return -ENOSYS;
+	}
+
+	if (frequency & AAC_SAMPLING_FREQ_48000) {
+		AAC_SET_FREQUENCY(*aac_config, AAC_SAMPLING_FREQ_48000);
+	} else if (frequency & AAC_SAMPLING_FREQ_44100) {
+		AAC_SET_FREQUENCY(*aac_config, AAC_SAMPLING_FREQ_44100);
+	} else if (frequency & AAC_SAMPLING_FREQ_32000) {
+		AAC_SET_FREQUENCY(*aac_config, AAC_SAMPLING_FREQ_32000);
+	} else {
+		syslog(LOG_WARNING, "No supported AAC sampling frequencies.");
+		return -ENOSYS;
+	}
+
+	if (aac_caps->channels & AAC_CHANNELS_2) {
+		aac_config->channels = AAC_CHANNELS_2;
+	} else if (aac_caps->channels & AAC_CHANNELS_1) {
+		aac_config->channels = AAC_CHANNELS_1;
+	} else {
+		syslog(LOG_WARNING, "No supported AAC channels.");
+		return -ENOSYS;
+	}
+
+	/* A device that doesn't say takes any bit rate. */
+	if (bitrate == 0 || bitrate > AAC_MAX_BITRATE)
+		bitrate = AAC_MAX_BITRATE;
+	AAC_SET_BITRATE(*aac_config, bitrate);
+	aac_config->vbr = aac_caps->vbr;
+
+	return 0;
+}
+
+static int aac_get_format(const void *config, size_t *rate, size_t *channels)
+{
+	const a2dp_aac_t *aac = config;
+	unsigned int frequency = AAC_GET_FREQUENCY(*aac);
+
+	*channels = (aac->channels == AAC_CHANNELS_1) ? 1 : 2;
+
+	if (frequency & AAC_SAMPLING_FREQ_48000)
+		*rate = 48000;
+	else if (frequency & AAC_SAMPLING_FREQ_44100)
+		*rate = 44100;
+	else if (frequency & AAC_SAMPLING_FREQ_32000)
+		*rate = 32000;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+/* In order of preference. AAC gives better quality than SBC for the same
+ * air time, so it goes first when there's an encoder for it. */
+static struct cras_a2dp_codec codecs[] = {
+	{
+		.name = "AAC",
+		.id = A2DP_CODEC_MPEG24,
+		.caps_size = sizeof(a2dp_aac_t),
+		.rtp_payload_type = AAC_RTP_PAYLOAD_TYPE,
+		.payload_header = 0,
+		.max_frames_per_packet = 1,
+		.get_capabilities = aac_get_capabilities,
+		.select_configuration = aac_select_configuration,
+		.get_format = aac_get_format,
+	},
+	{
+		.name = "SBC",
+		.id = A2DP_CODEC_SBC,
+		.caps_size = sizeof(a2dp_sbc_t),
+		.rtp_payload_type = 1,
+		.payload_header = 1,
+		.max_frames_per_packet = 0,
+		.get_capabilities = sbc_get_capabilities,
+		.select_configuration = sbc_select_configuration,
+		.get_format = sbc_get_format,
+		.get_bitpool_range = sbc_get_bitpool_range,
+		.impl = &sbc_impl,
+	},
+};
+
+static struct cras_a2dp_codec *find_codec(uint8_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < ARRAY_SIZE(codecs); i++)
+		if (codecs[i].id == id)
+			return &codecs[i];
+	return NULL;
+}
+
+const struct cras_a2dp_codec *cras_a2dp_codec_get(uint8_t id)
+{
+	return find_codec(id);
+}
+
+const struct cras_a2dp_codec *cras_a2dp_codec_get_nth(unsigned int n)
+{
+	if (n >= ARRAY_SIZE(codecs))
+		return NULL;
+	return &codecs[n];
+}
+
+int cras_a2dp_codec_set_impl(uint8_t id,
+			     const struct cras_a2dp_codec_impl *impl)
+{
+	struct cras_a2dp_codec *codec = find_codec(id);
+
+	if (!codec)
+		return -EINVAL;
+	codec->impl = impl;
+	return 0;
+}
@@ -0,0 +1,84 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_A2DP_CODEC_H_
+#define CRAS_A2DP_CODEC_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cras_audio_codec;
+
+/* The largest capabilities or configuration of any codec, in bytes. */
+#define A2DP_CODEC_MAX_CAPS_SIZE 16
+
+/* The encoder of a codec. SBC comes with one, other codecs are only offered
+ * to devices once a board installs an encoder for them, which may be a
+ * library or one offloaded to the SoC.
+ * Members:
+ *    create - Creates an encoder for a configuration selected by the codec.
+ *        Returns NULL on failure.
+ *    destroy - Frees an encoder from create.
+ *    get_codesize - Returns the number of PCM bytes encoded into a frame.
+ *    get_frame_length - Returns the largest size of an encoded frame.
+ *    set_bitpool - Optional, changes the bitpool from the next frame on.
+ */
+struct cras_a2dp_codec_impl {
+	struct cras_audio_codec *(*create)(const void *config);
+	void (*destroy)(struct cras_audio_codec *codec);
+	int (*get_codesize)(struct cras_audio_codec *codec);
+	int (*get_frame_length)(struct cras_audio_codec *codec);
+	void (*set_bitpool)(struct cras_audio_codec *codec,
+			    unsigned int bitpool);
+};
+
+/* An A2DP codec, and how its frames are negotiated and packetized.
+ * Members:
+ *    name - Short name of the codec.
+ *    id - The A2DP_CODEC_* identifier.
+ *    caps_size - The size of the capabilities and configuration.
+ *    rtp_payload_type - The payload type in the rtp header.
+ *    payload_header - Whether packets have the one byte header with the
+ *        frame count after the rtp header.
+ *    max_frames_per_packet - The most frames in a packet, 0 for as many as
+ *        fit.
+ *    get_capabilities - Fills caps with everything supported.
+ *    select_configuration - Picks the best configuration out of the caps of
+ *        a device. Returns 0, or negative error code if nothing supported.
+ *    get_format - Gets the rate and the channel count of a configuration.
+ *    get_bitpool_range - Optional, gets the lowest and highest bitpool of a
+ *        configuration, for codecs whose bit rate can change between frames.
+ *    impl - The encoder, NULL if there's none.
+ */
+struct cras_a2dp_codec {
+	const char *name;
+	uint8_t id;
+	size_t caps_size;
+	uint8_t rtp_payload_type;
+	int payload_header;
+	unsigned int max_frames_per_packet;
+	void (*get_capabilities)(void *caps);
+	int (*select_configuration)(const void *caps, void *config);
+	int (*get_format)(const void *config, size_t *rate, size_t *channels);
+	void (*get_bitpool_range)(const void *config, unsigned int *min,
+				  unsigned int *max);
+	const struct cras_a2dp_codec_impl *impl;
+};
+
+/* Gets the codec of an A2DP_CODEC_* identifier, NULL if it's unknown. */
+const struct cras_a2dp_codec *cras_a2dp_codec_get(uint8_t id);
+
+/* Gets the nth codec, best first, or NULL past the last one. */
+const struct cras_a2dp_codec *cras_a2dp_codec_get_nth(unsigned int n);
+
+/* Installs the encoder of a codec, or removes it if impl is NULL. Must be
+ * done before the A2DP endpoints are created.
+ * Returns:
+ *    0 on success, -EINVAL if the codec is unknown.
+ */
+int cras_a2dp_codec_set_impl(uint8_t id,
+			     const struct cras_a2dp_codec_impl *impl);
+
+#endif /* CRAS_A2DP_CODEC_H_ */
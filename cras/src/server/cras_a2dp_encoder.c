@@ -0,0 +1,273 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <syslog.h>
+
+#include "cras_a2dp_encoder.h"
+#include "cras_a2dp_info.h"
+#include "cras_mem_stats.h"
+#include "cras_system_state.h"
+#include "cras_util.h"
+
+/* The number of encoded packets the worker keeps ready to send. */
+#define NUM_PACKETS 4
+
+/* A complete packet waiting to be sent.
+ * Members:
+ *    data - The packet, rtp header included.
+ *    len - The length of the packet.
+ *    frames - The number of PCM frames encoded in the packet.
+ */
+struct a2dp_packet {
+	uint8_t data[A2DP_BUF_SIZE_BYTES];
+	size_t len;
+	unsigned int frames;
+};
+
+/*
+ * The ring holds PCM frames at positions counted by free running frame
+ * counters, position p at p % capacity. The capacity is whole codec blocks,
+ * so the worker, which only takes whole blocks, never has one wrapping
+ * around. The packets are a ring too, indexed by free running packet
+ * counters.
+ * Members:
+ *    a2dp - The codec and the packet being encoded, used by the worker.
+ *    frame_bytes - The size of a PCM frame.
+ *    link_mtu - The maximum transmit unit.
+ *    capacity - The size of the ring, in frames.
+ *    ring - The PCM frames.
+ *    write - Where the audio thread writes next. Read by the worker.
+ *    read - Where the worker encodes from next. Read by the audio thread.
+ *    sent - The number of frames sent. Only used by the audio thread.
+ *    packets - The encoded packets.
+ *    packets_done - The number of packets encoded. Read by the audio thread.
+ *    packets_sent - The number of packets sent. Read by the worker.
+ *    error - The last error from encoding, or 0.
+ *    bitpool - The bitpool the worker switches to between packets, 0 to
+ *        keep the one the codec has.
+ *    running - Cleared to stop the worker.
+ *    wake - Posted when there are new frames or room for another packet.
+ *    tid - The worker thread.
+ */
+struct cras_a2dp_encoder {
+	struct a2dp_info *a2dp;
+	size_t frame_bytes;
+	size_t link_mtu;
+	unsigned int capacity;
+	uint8_t *ring;
+	uint64_t write;
+	uint64_t read;
+	uint64_t sent;
+	struct a2dp_packet packets[NUM_PACKETS];
+	unsigned int packets_done;
+	unsigned int packets_sent;
+	int error;
+	unsigned int bitpool;
+	int running;
+	sem_t wake;
+	pthread_t tid;
+};
+
+static inline uint8_t *ring_at(const struct cras_a2dp_encoder *enc,
+			       uint64_t pos)
+{
+	return enc->ring + (size_t)(pos % enc->capacity) * enc->frame_bytes;
+}
+
+/* Encodes the queued frames until they run out or all the packets are
+ * waiting to be sent. */
+static void encode_queued(struct cras_a2dp_encoder *enc)
+{
+	struct a2dp_packet *packet;
+	unsigned int sent, frames, bitpool;
+	uint64_t write;
+	int processed;
+
+	while (1) {
+		sent = __atomic_load_n(&enc->packets_sent, __ATOMIC_ACQUIRE);
+		if (enc->packets_done - sent == NUM_PACKETS)
+			break;
+
+		/* Only change the bitpool with no frames in the packet. */
+		bitpool = __atomic_load_n(&enc->bitpool, __ATOMIC_RELAXED);
+		if (bitpool && a2dp_queued_frames(enc->a2dp) == 0)
+			a2dp_set_bitpool(enc->a2dp, bitpool);
+
+		write = __atomic_load_n(&enc->write, __ATOMIC_ACQUIRE);
+		frames = MIN(write - enc->read,
+			     enc->capacity - enc->read % enc->capacity);
+		processed = a2dp_encode(enc->a2dp, ring_at(enc, enc->read),
+					frames * enc->frame_bytes,
+					enc->frame_bytes, enc->link_mtu);
+		if (processed < 0 && processed != -ENOSPC) {
+			__atomic_store_n(&enc->error, processed,
+					 __ATOMIC_RELAXED);
+			break;
+		}
+		if (processed > 0) {
+			frames = processed / enc->frame_bytes;
+			__atomic_store_n(&enc->read, enc->read + frames,
+					 __ATOMIC_RELEASE);
+		}
+
+		packet = &enc->packets[enc->packets_done % NUM_PACKETS];
+		packet->frames = a2dp_take_packet(enc->a2dp, enc->link_mtu,
+						  packet->data, &packet->len);
+		if (packet->frames) {
+			__atomic_store_n(&enc->packets_done,
+					 enc->packets_done + 1,
+					 __ATOMIC_RELEASE);
+			continue;
+		}
+		if (processed <= 0)
+			break;
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct cras_a2dp_encoder *enc = (struct cras_a2dp_encoder *)arg;
+	uint32_t cpu_mask;
+
+	/* Just below the audio thread, which shouldn't wait for the codec. */
+	if (cras_set_rt_scheduling(cras_system_get_rt_priority() - 1) == 0)
+		cras_set_thread_priority(cras_system_get_rt_priority() - 1);
+
+	/* Stay on the audio thread's CPUs, which share its cache. */
+	cpu_mask = cras_system_get_audio_thread_cpu_mask();
+	if (cpu_mask)
+		cras_set_thread_affinity(cpu_mask);
+
+	while (1) {
+		sem_wait(&enc->wake);
+		if (!__atomic_load_n(&enc->running, __ATOMIC_ACQUIRE))
+			break;
+		encode_queued(enc);
+	}
+	return NULL;
+}
+
+struct cras_a2dp_encoder *cras_a2dp_encoder_create(struct a2dp_info *a2dp,
+						   size_t frame_bytes,
+						   size_t link_mtu,
+						   unsigned int max_frames)
+{
+	struct cras_a2dp_encoder *enc;
+	unsigned int block_frames;
+	int rc;
+
+	if (!frame_bytes || a2dp_codesize(a2dp) <= 0)
+		return NULL;
+	block_frames = a2dp_codesize(a2dp) / frame_bytes;
+	if (!block_frames || max_frames < block_frames)
+		return NULL;
+
+	enc = (struct cras_a2dp_encoder *)calloc(1, sizeof(*enc));
+	if (!enc)
+		return NULL;
+
+	enc->a2dp = a2dp;
+	enc->frame_bytes = frame_bytes;
+	enc->link_mtu = link_mtu;
+	enc->capacity = max_frames / block_frames * block_frames;
+	enc->ring = (uint8_t *)calloc(enc->capacity, frame_bytes);
+	if (!enc->ring) {
+		free(enc);
+		return NULL;
+	}
+	enc->running = 1;
+	sem_init(&enc->wake, 0, 0);
+
+	rc = pthread_create(&enc->tid, NULL, worker_thread, enc);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to create a2dp encoder thread: %d", rc);
+		sem_destroy(&enc->wake);
+		free(enc->ring);
+		free(enc);
+		return NULL;
+	}
+	cras_mem_stats_add(CRAS_MEM_BT, (size_t)enc->capacity * frame_bytes);
+	return enc;
+}
+
+void cras_a2dp_encoder_destroy(struct cras_a2dp_encoder *enc)
+{
+	if (!enc)
+		return;
+
+	__atomic_store_n(&enc->running, 0, __ATOMIC_RELEASE);
+	sem_post(&enc->wake);
+	pthread_join(enc->tid, NULL);
+
+	sem_destroy(&enc->wake);
+	cras_mem_stats_sub(CRAS_MEM_BT,
+			   (size_t)enc->capacity * enc->frame_bytes);
+	free(enc->ring);
+	free(enc);
+}
+
+unsigned int cras_a2dp_encoder_writable_frames(struct cras_a2dp_encoder *enc)
+{
+	uint64_t read = __atomic_load_n(&enc->read, __ATOMIC_ACQUIRE);
+
+	return enc->capacity - (unsigned int)(enc->write - read);
+}
+
+uint8_t *cras_a2dp_encoder_get_buffer(struct cras_a2dp_encoder *enc,
+				      unsigned int *frames)
+{
+	*frames = MIN(*frames, cras_a2dp_encoder_writable_frames(enc));
+	*frames = MIN(*frames, enc->capacity - enc->write % enc->capacity);
+	return ring_at(enc, enc->write);
+}
+
+void cras_a2dp_encoder_put_buffer(struct cras_a2dp_encoder *enc,
+				  unsigned int frames)
+{
+	__atomic_store_n(&enc->write, enc->write + frames, __ATOMIC_RELEASE);
+	sem_post(&enc->wake);
+}
+
+unsigned int cras_a2dp_encoder_queued_frames(struct cras_a2dp_encoder *enc)
+{
+	return enc->write - enc->sent;
+}
+
+void cras_a2dp_encoder_set_bitpool(struct cras_a2dp_encoder *enc,
+				   unsigned int bitpool)
+{
+	__atomic_store_n(&enc->bitpool, bitpool, __ATOMIC_RELAXED);
+}
+
+int cras_a2dp_encoder_write(struct cras_a2dp_encoder *enc, int stream_fd)
+{
+	struct a2dp_packet *packet;
+	int err;
+
+	err = __atomic_exchange_n(&enc->error, 0, __ATOMIC_RELAXED);
+	if (err)
+		return err;
+
+	if (__atomic_load_n(&enc->packets_done, __ATOMIC_ACQUIRE) ==
+	    enc->packets_sent)
+		return 0;
+
+	packet = &enc->packets[enc->packets_sent % NUM_PACKETS];
+	if (send(stream_fd, packet->data, packet->len, MSG_DONTWAIT) < 0)
+		return -errno;
+
+	enc->sent += packet->frames;
+	__atomic_store_n(&enc->packets_sent, enc->packets_sent + 1,
+			 __ATOMIC_RELEASE);
+	/* There's room for another packet now. */
+	sem_post(&enc->wake);
+	return packet->frames;
+}
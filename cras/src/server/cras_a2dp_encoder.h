@@ -0,0 +1,75 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_A2DP_ENCODER_H_
+#define CRAS_A2DP_ENCODER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct a2dp_info;
+
+/*
+ * Encodes the PCM of an A2DP device on a worker thread, so the cost of the
+ * codec doesn't delay the other devices served by the audio thread. The audio
+ * thread writes PCM to a ring, the worker encodes it into a queue of a few
+ * complete packets, and the audio thread sends those when it's time to.
+ * Frames are counted as queued from when they are written to the ring until
+ * the packet holding them is sent.
+ */
+struct cras_a2dp_encoder;
+
+/* Creates an encoder and starts its worker thread.
+ * Args:
+ *    a2dp - The codec and packet state. Only the worker touches it while the
+ *        encoder exists.
+ *    frame_bytes - The size of a PCM frame.
+ *    link_mtu - The maximum transmit unit of the socket.
+ *    max_frames - The most frames the ring holds. Rounded down to whole
+ *        codec blocks.
+ * Returns:
+ *    The encoder, or NULL on failure.
+ */
+struct cras_a2dp_encoder *cras_a2dp_encoder_create(struct a2dp_info *a2dp,
+						   size_t frame_bytes,
+						   size_t link_mtu,
+						   unsigned int max_frames);
+
+/* Stops the worker thread and frees the encoder. */
+void cras_a2dp_encoder_destroy(struct cras_a2dp_encoder *enc);
+
+/* Gets the place to write PCM to, frames is limited to the contiguous room
+ * there. Must be called from the audio thread, as must the calls below. */
+uint8_t *cras_a2dp_encoder_get_buffer(struct cras_a2dp_encoder *enc,
+				      unsigned int *frames);
+
+/* Queues frames written to the buffer from cras_a2dp_encoder_get_buffer()
+ * and wakes the worker to encode them. */
+void cras_a2dp_encoder_put_buffer(struct cras_a2dp_encoder *enc,
+				  unsigned int frames);
+
+/* Returns the number of frames written and not sent yet. */
+unsigned int cras_a2dp_encoder_queued_frames(struct cras_a2dp_encoder *enc);
+
+/* Returns the number of frames there's room for in the ring. */
+unsigned int cras_a2dp_encoder_writable_frames(struct cras_a2dp_encoder *enc);
+
+/* Asks the worker to encode with another bitpool, from the next packet it
+ * starts on. */
+void cras_a2dp_encoder_set_bitpool(struct cras_a2dp_encoder *enc,
+				   unsigned int bitpool);
+
+/* Sends the oldest encoded packet.
+ * Args:
+ *    enc - The encoder.
+ *    stream_fd - The socket to send the packet to.
+ * Returns:
+ *    The number of frames sent, 0 if no packet is ready, or a negative error
+ *    code from the worker or from sending. The packet is kept and sent next
+ *    time on -EAGAIN.
+ */
+int cras_a2dp_encoder_write(struct cras_a2dp_encoder *enc, int stream_fd);
+
+#endif /* CRAS_A2DP_ENCODER_H_ */
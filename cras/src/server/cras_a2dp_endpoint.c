@@ -5,9 +5,11 @@
 
 #include <errno.h>
 #include <stdint.h>
+#include <stdio.h>
 #include <syslog.h>
 
 #include "a2dp-codecs.h"
+#include "cras_a2dp_codec.h"
 #include "cras_a2dp_endpoint.h"
 #include "cras_a2dp_iodev.h"
 #include "cras_iodev.h"
@@ -20,36 +22,35 @@
 #define A2DP_SOURCE_ENDPOINT_PATH "/org/chromium/Cras/Bluetooth/A2DPSource"
 #define A2DP_SINK_ENDPOINT_PATH "/org/chromium/Cras/Bluetooth/A2DPSink"
 
+/* The largest number of codecs offered, see cras_a2dp_codec_get_nth(). */
+#define MAX_A2DP_CODECS 4
+
 /* Pointers for the only connected a2dp device. */
 static struct a2dp {
 	struct cras_iodev *iodev;
 	struct cras_bt_device *device;
 } connected_a2dp;
 
+/* An endpoint for each codec with an encoder, the best one first. */
+static struct cras_bt_endpoint endpoints[MAX_A2DP_CODECS];
+static char endpoint_paths[MAX_A2DP_CODECS][64];
+static unsigned int num_endpoints;
+
 static int cras_a2dp_get_capabilities(struct cras_bt_endpoint *endpoint,
 				      void *capabilities, int *len)
 {
-	a2dp_sbc_t *sbc_caps = capabilities;
+	const struct cras_a2dp_codec *codec =
+		cras_a2dp_codec_get(endpoint->codec);
 
-	if (*len < sizeof(*sbc_caps))
+	if (!codec)
+		return -EINVAL;
+	if (*len < codec->caps_size)
 		return -ENOSPC;
 
-	*len = sizeof(*sbc_caps);
+	*len = codec->caps_size;
 
 	/* Return all capabilities. */
-	sbc_caps->channel_mode =
-		SBC_CHANNEL_MODE_MONO | SBC_CHANNEL_MODE_DUAL_CHANNEL |
-		SBC_CHANNEL_MODE_STEREO | SBC_CHANNEL_MODE_JOINT_STEREO;
-	sbc_caps->frequency = SBC_SAMPLING_FREQ_16000 |
-			      SBC_SAMPLING_FREQ_32000 |
-			      SBC_SAMPLING_FREQ_44100 | SBC_SAMPLING_FREQ_48000;
-	sbc_caps->allocation_method =
-		SBC_ALLOCATION_SNR | SBC_ALLOCATION_LOUDNESS;
-	sbc_caps->subbands = SBC_SUBBANDS_4 | SBC_SUBBANDS_8;
-	sbc_caps->block_length = SBC_BLOCK_LENGTH_4 | SBC_BLOCK_LENGTH_8 |
-				 SBC_BLOCK_LENGTH_12 | SBC_BLOCK_LENGTH_16;
-	sbc_caps->min_bitpool = MIN_BITPOOL;
-	sbc_caps->max_bitpool = MAX_BITPOOL;
+	codec->get_capabilities(capabilities);
 
 	return 0;
 }
@@ -58,75 +59,13 @@ static int cras_a2dp_select_configuration(struct cras_bt_endpoint *endpoint,
 					  void *capabilities, int len,
 					  void *configuration)
 {
-	a2dp_sbc_t *sbc_caps = capabilities;
-	a2dp_sbc_t *sbc_config = configuration;
-
-	/* Pick the highest configuration. */
-	if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_JOINT_STEREO;
-	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_STEREO) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_STEREO;
-	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_DUAL_CHANNEL;
-	} else if (sbc_caps->channel_mode & SBC_CHANNEL_MODE_MONO) {
-		sbc_config->channel_mode = SBC_CHANNEL_MODE_MONO;
-	} else {
-		syslog(LOG_WARNING, "No supported channel modes.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->frequency & SBC_SAMPLING_FREQ_48000) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_48000;
-	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_44100) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_44100;
-	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_32000) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_32000;
-	} else if (sbc_caps->frequency & SBC_SAMPLING_FREQ_16000) {
-		sbc_config->frequency = SBC_SAMPLING_FREQ_16000;
-	} else {
-		syslog(LOG_WARNING, "No supported sampling frequencies.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->allocation_method & SBC_ALLOCATION_LOUDNESS) {
-		sbc_config->allocation_method = SBC_ALLOCATION_LOUDNESS;
-	} else if (sbc_caps->allocation_method & SBC_ALLOCATION_SNR) {
-		sbc_config->allocation_method = SBC_ALLOCATION_SNR;
-	} else {
-		syslog(LOG_WARNING, "No supported allocation method.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->subbands & SBC_SUBBANDS_8) {
-		sbc_config->subbands = SBC_SUBBANDS_8;
-	} else if (sbc_caps->subbands & SBC_SUBBANDS_4) {
-		sbc_config->subbands = SBC_SUBBANDS_4;
-	} else {
-		syslog(LOG_WARNING, "No supported subbands.");
-		return -ENOSYS;
-	}
-
-	if (sbc_caps->block_length & SBC_BLOCK_LENGTH_16) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_16;
-	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_12) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_12;
-	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_8) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_8;
-	} else if (sbc_caps->block_length & SBC_BLOCK_LENGTH_4) {
-		sbc_config->block_length = SBC_BLOCK_LENGTH_4;
-	} else {
-		syslog(LOG_WARNING, "No supported block length.");
-		return -ENOSYS;
-	}
+	const struct cras_a2dp_codec *codec =
+		cras_a2dp_codec_get(endpoint->codec);
 
-	sbc_config->min_bitpool =
-		(sbc_caps->min_bitpool > MIN_BITPOOL ? sbc_caps->min_bitpool :
-						       MIN_BITPOOL);
-	sbc_config->max_bitpool =
-		(sbc_caps->max_bitpool < MAX_BITPOOL ? sbc_caps->max_bitpool :
-						       MAX_BITPOOL);
+	if (!codec || len < codec->caps_size)
+		return -EINVAL;
 
-	return 0;
+	return codec->select_configuration(capabilities, configuration);
 }
 
 static void cras_a2dp_set_configuration(struct cras_bt_endpoint *endpoint,
@@ -162,34 +101,73 @@ static void a2dp_transport_state_changed(struct cras_bt_endpoint *endpoint,
 	}
 }
 
-static struct cras_bt_endpoint cras_a2dp_endpoint = {
-	/* BlueZ connects the device A2DP Sink to our A2DP Source endpoint,
-	 * and the device A2DP Source to our A2DP Sink. It's best if you don't
-	 * think about it too hard.
-	 */
-	.object_path = A2DP_SOURCE_ENDPOINT_PATH,
-	.uuid = A2DP_SOURCE_UUID,
-	.codec = A2DP_CODEC_SBC,
-
-	.get_capabilities = cras_a2dp_get_capabilities,
-	.select_configuration = cras_a2dp_select_configuration,
-	.set_configuration = cras_a2dp_set_configuration,
-	.suspend = cras_a2dp_suspend,
-	.transport_state_changed = a2dp_transport_state_changed
-};
-
 int cras_a2dp_endpoint_create(DBusConnection *conn)
 {
-	return cras_bt_endpoint_add(conn, &cras_a2dp_endpoint);
+	const struct cras_a2dp_codec *codec;
+	struct cras_bt_endpoint *endpoint;
+	unsigned int i;
+	int rc, ret = 0;
+
+	for (i = 0; (codec = cras_a2dp_codec_get_nth(i)); i++) {
+		if (!codec->impl || num_endpoints == MAX_A2DP_CODECS)
+			continue;
+
+		/* SBC keeps the path it always had. */
+		endpoint = &endpoints[num_endpoints];
+		if (codec->id == A2DP_CODEC_SBC)
+			snprintf(endpoint_paths[num_endpoints],
+				 sizeof(endpoint_paths[0]), "%s",
+				 A2DP_SOURCE_ENDPOINT_PATH);
+		else
+			snprintf(endpoint_paths[num_endpoints],
+				 sizeof(endpoint_paths[0]), "%s/%s",
+				 A2DP_SOURCE_ENDPOINT_PATH, codec->name);
+
+		/* BlueZ connects the device A2DP Sink to our A2DP Source
+		 * endpoint, and the device A2DP Source to our A2DP Sink. It's
+		 * best if you don't think about it too hard.
+		 */
+		endpoint->object_path = endpoint_paths[num_endpoints];
+		endpoint->uuid = A2DP_SOURCE_UUID;
+		endpoint->codec = codec->id;
+		endpoint->get_capabilities = cras_a2dp_get_capabilities;
+		endpoint->select_configuration =
+			cras_a2dp_select_configuration;
+		endpoint->set_configuration = cras_a2dp_set_configuration;
+		endpoint->suspend = cras_a2dp_suspend;
+		endpoint->transport_state_changed =
+			a2dp_transport_state_changed;
+
+		rc = cras_bt_endpoint_add(conn, endpoint);
+		if (rc) {
+			syslog(LOG_ERR, "Failed to add %s A2DP endpoint: %d",
+			       codec->name, rc);
+			ret = rc;
+			continue;
+		}
+		num_endpoints++;
+	}
+	return ret;
 }
 
 void cras_a2dp_start(struct cras_bt_device *device)
 {
-	struct cras_bt_transport *transport = cras_a2dp_endpoint.transport;
+	struct cras_bt_transport *transport = NULL;
+	unsigned int i;
 
 	BTLOG(btlog, BT_A2DP_START, 0, 0);
 
-	if (!transport || device != cras_bt_transport_device(transport)) {
+	/* Use the endpoint of whichever codec the device was configured
+	 * with. */
+	for (i = 0; i < num_endpoints; i++) {
+		if (endpoints[i].transport &&
+		    device == cras_bt_transport_device(endpoints[i].transport)) {
+			transport = endpoints[i].transport;
+			break;
+		}
+	}
+
+	if (!transport) {
 		syslog(LOG_ERR, "Device and active transport not match.");
 		return;
 	}
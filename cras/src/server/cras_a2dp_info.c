@@ -3,80 +3,50 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <netinet/in.h>
-#include <sbc/sbc.h>
+#include <string.h>
+#include <sys/param.h>
 #include <syslog.h>
 
+#include "cras_a2dp_codec.h"
 #include "cras_a2dp_info.h"
-#include "cras_sbc_codec.h"
+#include "cras_audio_codec.h"
 #include "cras_types.h"
 #include "rtp.h"
 
-int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
-{
-	uint8_t frequency = 0, mode = 0, subbands = 0, allocation, blocks = 0,
-		bitpool;
-
-	if (sbc->frequency & SBC_SAMPLING_FREQ_48000)
-		frequency = SBC_FREQ_48000;
-	else if (sbc->frequency & SBC_SAMPLING_FREQ_44100)
-		frequency = SBC_FREQ_44100;
-	else if (sbc->frequency & SBC_SAMPLING_FREQ_32000)
-		frequency = SBC_FREQ_32000;
-	else if (sbc->frequency & SBC_SAMPLING_FREQ_16000)
-		frequency = SBC_FREQ_16000;
-
-	if (sbc->channel_mode & SBC_CHANNEL_MODE_JOINT_STEREO)
-		mode = SBC_MODE_JOINT_STEREO;
-	else if (sbc->channel_mode & SBC_CHANNEL_MODE_STEREO)
-		mode = SBC_MODE_STEREO;
-	else if (sbc->channel_mode & SBC_CHANNEL_MODE_DUAL_CHANNEL)
-		mode = SBC_MODE_DUAL_CHANNEL;
-	else if (sbc->channel_mode & SBC_CHANNEL_MODE_MONO)
-		mode = SBC_MODE_MONO;
-
-	if (sbc->allocation_method & SBC_ALLOCATION_LOUDNESS)
-		allocation = SBC_AM_LOUDNESS;
-	else
-		allocation = SBC_AM_SNR;
-
-	switch (sbc->subbands) {
-	case SBC_SUBBANDS_4:
-		subbands = SBC_SB_4;
-		break;
-	case SBC_SUBBANDS_8:
-		subbands = SBC_SB_8;
-		break;
-	}
-
-	switch (sbc->block_length) {
-	case SBC_BLOCK_LENGTH_4:
-		blocks = SBC_BLK_4;
-		break;
-	case SBC_BLOCK_LENGTH_8:
-		blocks = SBC_BLK_8;
-		break;
-	case SBC_BLOCK_LENGTH_12:
-		blocks = SBC_BLK_12;
-		break;
-	case SBC_BLOCK_LENGTH_16:
-		blocks = SBC_BLK_16;
-		break;
-	}
+/* Returns the size of the headers in front of the encoded frames. */
+static size_t header_len(const struct a2dp_info *a2dp)
+{
+	return sizeof(struct rtp_header) +
+	       (a2dp->a2dp_codec->payload_header ? sizeof(struct rtp_payload) :
+						    0);
+}
 
-	bitpool = sbc->max_bitpool;
+int init_a2dp(struct a2dp_info *a2dp, const struct cras_a2dp_codec *codec,
+	      const void *config)
+{
+	a2dp->a2dp_codec = codec;
+	if (!codec->impl)
+		return -1;
 
-	a2dp->codec = cras_sbc_codec_create(frequency, mode, subbands,
-					    allocation, blocks, bitpool);
+	a2dp->codec = codec->impl->create(config);
 	if (!a2dp->codec)
 		return -1;
 
-	/* SBC info */
-	a2dp->codesize = cras_sbc_get_codesize(a2dp->codec);
-	a2dp->frame_length = cras_sbc_get_frame_length(a2dp->codec);
+	/* Codec info */
+	a2dp->codesize = codec->impl->get_codesize(a2dp->codec);
+	a2dp->frame_length = codec->impl->get_frame_length(a2dp->codec);
+
+	/* The codec starts at the highest bitpool it was configured with. */
+	a2dp->min_bitpool = 0;
+	a2dp->max_bitpool = 0;
+	if (codec->get_bitpool_range && codec->impl->set_bitpool)
+		codec->get_bitpool_range(config, &a2dp->min_bitpool,
+					 &a2dp->max_bitpool);
+	a2dp->bitpool = a2dp->max_bitpool;
 
-	a2dp->a2dp_buf_used =
-		sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	a2dp->a2dp_buf_used = header_len(a2dp);
 	a2dp->frame_count = 0;
 	a2dp->seq_num = 0;
 	a2dp->samples = 0;
@@ -86,7 +56,8 @@ int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc)
 
 void destroy_a2dp(struct a2dp_info *a2dp)
 {
-	cras_sbc_codec_destroy(a2dp->codec);
+	if (a2dp->codec)
+		a2dp->a2dp_codec->impl->destroy(a2dp->codec);
 }
 
 int a2dp_codesize(struct a2dp_info *a2dp)
@@ -99,6 +70,39 @@ int a2dp_block_size(struct a2dp_info *a2dp, int a2dp_bytes)
 	return a2dp_bytes / a2dp->frame_length * a2dp->codesize;
 }
 
+int a2dp_packet_block_size(struct a2dp_info *a2dp, size_t link_mtu)
+{
+	unsigned int max = a2dp->a2dp_codec->max_frames_per_packet;
+	int frames;
+
+	if (link_mtu > A2DP_BUF_SIZE_BYTES)
+		link_mtu = A2DP_BUF_SIZE_BYTES;
+	if (link_mtu < header_len(a2dp))
+		return 0;
+
+	frames = (link_mtu - header_len(a2dp)) / a2dp->frame_length;
+	if (max && frames > max)
+		frames = max;
+	return frames * a2dp->codesize;
+}
+
+int a2dp_set_bitpool(struct a2dp_info *a2dp, unsigned int bitpool)
+{
+	if (!a2dp->max_bitpool)
+		return -ENOTSUP;
+
+	bitpool = MAX(bitpool, a2dp->min_bitpool);
+	bitpool = MIN(bitpool, a2dp->max_bitpool);
+	if (bitpool == a2dp->bitpool)
+		return 0;
+
+	a2dp->a2dp_codec->impl->set_bitpool(a2dp->codec, bitpool);
+	a2dp->frame_length =
+		a2dp->a2dp_codec->impl->get_frame_length(a2dp->codec);
+	a2dp->bitpool = bitpool;
+	return 0;
+}
+
 int a2dp_queued_frames(const struct a2dp_info *a2dp)
 {
 	return a2dp->samples;
@@ -106,40 +110,39 @@ int a2dp_queued_frames(const struct a2dp_info *a2dp)
 
 void a2dp_reset(struct a2dp_info *a2dp)
 {
-	a2dp->a2dp_buf_used =
-		sizeof(struct rtp_header) + sizeof(struct rtp_payload);
+	a2dp->a2dp_buf_used = header_len(a2dp);
 	a2dp->samples = 0;
 	a2dp->seq_num = 0;
 	a2dp->frame_count = 0;
 }
 
-static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
+/* Fills the rtp header of the packet in a2dp_buf. */
+static void fill_header(struct a2dp_info *a2dp)
 {
-	int err, samples;
 	struct rtp_header *header;
 	struct rtp_payload *payload;
 
 	header = (struct rtp_header *)a2dp->a2dp_buf;
-	payload = (struct rtp_payload *)(a2dp->a2dp_buf + sizeof(*header));
-	memset(a2dp->a2dp_buf, 0, sizeof(*header) + sizeof(*payload));
+	memset(a2dp->a2dp_buf, 0, header_len(a2dp));
 
-	payload->frame_count = a2dp->frame_count;
+	if (a2dp->a2dp_codec->payload_header) {
+		payload = (struct rtp_payload *)(a2dp->a2dp_buf +
+						 sizeof(*header));
+		payload->frame_count = a2dp->frame_count;
+	}
 	header->v = 2;
-	header->pt = 1;
+	header->pt = a2dp->a2dp_codec->rtp_payload_type;
 	header->sequence_number = htons(a2dp->seq_num);
 	header->timestamp = htonl(a2dp->nsamples);
 	header->ssrc = htonl(1);
+}
 
-	err = send(stream_fd, a2dp->a2dp_buf, a2dp->a2dp_buf_used,
-		   MSG_DONTWAIT);
-	if (err < 0)
-		return -errno;
-
-	/* Returns the number of samples in frame. */
-	samples = a2dp->samples;
+/* Starts the next packet, returns the number of samples in the last one. */
+static int next_packet(struct a2dp_info *a2dp)
+{
+	int samples = a2dp->samples;
 
-	/* Reset some data */
-	a2dp->a2dp_buf_used = sizeof(*header) + sizeof(*payload);
+	a2dp->a2dp_buf_used = header_len(a2dp);
 	a2dp->frame_count = 0;
 	a2dp->samples = 0;
 	a2dp->seq_num++;
@@ -147,9 +150,24 @@ static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
 	return samples;
 }
 
+static int avdtp_write(int stream_fd, struct a2dp_info *a2dp)
+{
+	int err;
+
+	fill_header(a2dp);
+	err = send(stream_fd, a2dp->a2dp_buf, a2dp->a2dp_buf_used,
+		   MSG_DONTWAIT);
+	if (err < 0)
+		return -errno;
+
+	/* Returns the number of samples in frame. */
+	return next_packet(a2dp);
+}
+
 int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 		int format_bytes, size_t link_mtu)
 {
+	unsigned int max = a2dp->a2dp_codec->max_frames_per_packet;
 	int processed;
 	size_t out_encoded;
 
@@ -158,6 +176,16 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 	if (link_mtu == a2dp->a2dp_buf_used)
 		return 0;
 
+	/* Don't encode more frames than the packet takes. */
+	if (max) {
+		if (a2dp->frame_count >= max)
+			return 0;
+		if (a2dp->codesize > 0)
+			pcm_buf_size = MIN(pcm_buf_size,
+					   (max - a2dp->frame_count) *
+						   a2dp->codesize);
+	}
+
 	processed = a2dp->codec->encode(a2dp->codec, pcm_buf, pcm_buf_size,
 					a2dp->a2dp_buf + a2dp->a2dp_buf_used,
 					link_mtu - a2dp->a2dp_buf_used,
@@ -177,11 +205,35 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
 	return processed;
 }
 
+/* Returns true when there's no room left for another frame in the packet. */
+static int packet_full(const struct a2dp_info *a2dp, size_t link_mtu)
+{
+	unsigned int max = a2dp->a2dp_codec->max_frames_per_packet;
+
+	if (max && a2dp->frame_count >= max)
+		return 1;
+	return a2dp->a2dp_buf_used + a2dp->frame_length > link_mtu;
+}
+
 int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu)
 {
-	/* Do avdtp write when the max number of SBC frames is reached. */
-	if (a2dp->a2dp_buf_used + a2dp->frame_length > link_mtu)
+	/* Do avdtp write when the max number of frames is reached. */
+	if (packet_full(a2dp, link_mtu))
 		return avdtp_write(stream_fd, a2dp);
 
 	return 0;
 }
+
+int a2dp_take_packet(struct a2dp_info *a2dp, size_t link_mtu, uint8_t *buf,
+		     size_t *len)
+{
+	if (link_mtu > A2DP_BUF_SIZE_BYTES)
+		link_mtu = A2DP_BUF_SIZE_BYTES;
+	if (!packet_full(a2dp, link_mtu))
+		return 0;
+
+	fill_header(a2dp);
+	memcpy(buf, a2dp->a2dp_buf, a2dp->a2dp_buf_used);
+	*len = a2dp->a2dp_buf_used;
+	return next_packet(a2dp);
+}
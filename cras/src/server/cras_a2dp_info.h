@@ -6,23 +6,32 @@
 #ifndef CRAS_A2DP_INFO_H_
 #define CRAS_A2DP_INFO_H_
 
-#include "a2dp-codecs.h"
+#include <stddef.h>
+#include <stdint.h>
+
+struct cras_a2dp_codec;
 
 #define A2DP_BUF_SIZE_BYTES 2048
 
 /* Represents the codec and encoded state of a2dp iodev.
  * Members:
+ *    a2dp_codec - The A2DP codec, how frames are packetized.
  *    codec - The codec used to encode PCM buffer to a2dp buffer.
  *    a2dp_buf - The buffer to hold encoded frames.
- *    codesize - Size of a SBC frame in bytes.
- *    frame_length - Size of an encoded SBC frame in bytes.
- *    frame_count - Queued SBC frame count currently in a2dp buffer.
+ *    codesize - Size of the PCM of a frame in bytes.
+ *    frame_length - Size of an encoded frame in bytes.
+ *    frame_count - Queued frame count currently in a2dp buffer.
  *    seq_num - Sequence number in rtp header.
  *    samples - Queued PCM frame count currently in a2dp buffer.
  *    nsamples - Cumulative number of encoded PCM frames.
  *    a2dp_buf_used - Used a2dp buffer counter in bytes.
+ *    min_bitpool - The lowest bitpool the configuration allows.
+ *    max_bitpool - The highest bitpool the configuration allows, 0 if the
+ *        bitpool of the codec can't change.
+ *    bitpool - The bitpool frames are encoded with.
  */
 struct a2dp_info {
+	const struct cras_a2dp_codec *a2dp_codec;
 	struct cras_audio_codec *codec;
 	uint8_t a2dp_buf[A2DP_BUF_SIZE_BYTES];
 	int codesize;
@@ -32,12 +41,16 @@ struct a2dp_info {
 	int samples;
 	int nsamples;
 	size_t a2dp_buf_used;
+	unsigned int min_bitpool;
+	unsigned int max_bitpool;
+	unsigned int bitpool;
 };
 
 /*
- * Set up codec for given sbc capability.
+ * Set up the encoder of a codec for given configuration.
  */
-int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc);
+int init_a2dp(struct a2dp_info *a2dp, const struct cras_a2dp_codec *codec,
+	      const void *config);
 
 /*
  * Destroys an a2dp_info.
@@ -45,7 +58,7 @@ int init_a2dp(struct a2dp_info *a2dp, a2dp_sbc_t *sbc);
 void destroy_a2dp(struct a2dp_info *a2dp);
 
 /*
- * Gets the codesize of the SBC codec.
+ * Gets the codesize of the codec.
  */
 int a2dp_codesize(struct a2dp_info *a2dp);
 
@@ -54,6 +67,19 @@ int a2dp_codesize(struct a2dp_info *a2dp);
  */
 int a2dp_block_size(struct a2dp_info *a2dp, int encoded_bytes);
 
+/*
+ * Gets the size of the PCM encoded into one full packet.
+ */
+int a2dp_packet_block_size(struct a2dp_info *a2dp, size_t link_mtu);
+
+/*
+ * Changes the bitpool the next frames are encoded with, limited to the range
+ * of the configuration. The frame_length changes with it.
+ * Returns:
+ *    0 on success, -ENOTSUP if the bitpool of the codec can't change.
+ */
+int a2dp_set_bitpool(struct a2dp_info *a2dp, unsigned int bitpool);
+
 /*
  * Gets the number of queued frames in a2dp_info.
  */
@@ -86,4 +112,17 @@ int a2dp_encode(struct a2dp_info *a2dp, const void *pcm_buf, int pcm_buf_size,
  */
 int a2dp_write(struct a2dp_info *a2dp, int stream_fd, size_t link_mtu);
 
+/*
+ * Takes the encoded packet when there's no room left in it for another
+ * frame, instead of writing it, so it can be sent later. Returns the number
+ * of frames in the packet, or 0 if it isn't full yet.
+ * Args:
+ *    a2dp: The a2dp info object.
+ *    link_mtu: The maximum transmit unit.
+ *    buf: Filled with the packet, at least A2DP_BUF_SIZE_BYTES long.
+ *    len: Set to the length of the packet.
+ */
+int a2dp_take_packet(struct a2dp_info *a2dp, size_t link_mtu, uint8_t *buf,
+		     size_t *len);
+
 #endif /* CRAS_A2DP_INFO_H_ */
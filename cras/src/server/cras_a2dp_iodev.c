@@ -16,15 +16,21 @@
 #include "audio_thread_log.h"
 #include "byte_buffer.h"
 #include "cras_iodev_list.h"
+#include "cras_a2dp_bitpool.h"
+#include "cras_a2dp_codec.h"
+#include "cras_a2dp_encoder.h"
 #include "cras_a2dp_endpoint.h"
 #include "cras_a2dp_info.h"
 #include "cras_a2dp_iodev.h"
 #include "cras_audio_area.h"
 #include "cras_audio_thread_monitor.h"
 #include "cras_bt_device.h"
+#include "cras_bt_tx_delay.h"
 #include "cras_iodev.h"
+#include "cras_mem_stats.h"
+#include "cras_system_state.h"
+#include "cras_trace.h"
 #include "cras_util.h"
-#include "rtp.h"
 #include "utlist.h"
 
 #define PCM_BUF_MAX_SIZE_FRAMES (4096 * 4)
@@ -46,7 +52,13 @@ static const struct timespec throttle_event_threshold = {
  *    a2dp - The codec and encoded state of a2dp_io.
  *    transport - The transport object for bluez media API.
  *    sock_depth_frames - Socket depth in frames of the a2dp socket.
+ *    tx_delay - The frames sent the controller hasn't transmitted yet, used
+ *        instead of sock_depth_frames when the socket reports completions.
+ *    sock_sndbuf - The size of the send buffer of the a2dp socket in bytes.
+ *    bitpool - Adapts the bitpool to the link, when the codec has one.
  *    pcm_buf - Buffer to hold pcm samples before encode.
+ *    encoder - Encodes on a worker thread when set, it then holds the pcm
+ *        samples instead of pcm_buf.
  *    destroyed - Flag to note if this a2dp_io is about to destroy.
  *    next_flush_time - The time when it is okay for next flush call.
  *    flush_period - The time period between two a2dp packet writes.
@@ -58,7 +70,11 @@ struct a2dp_io {
 	struct a2dp_info a2dp;
 	struct cras_bt_transport *transport;
 	unsigned sock_depth_frames;
+	struct cras_bt_tx_delay tx_delay;
+	unsigned int sock_sndbuf;
+	struct cras_a2dp_bitpool bitpool;
 	struct byte_buffer *pcm_buf;
+	struct cras_a2dp_encoder *encoder;
 	int destroyed;
 	struct timespec next_flush_time;
 	struct timespec flush_period;
@@ -71,21 +87,12 @@ static int update_supported_formats(struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
 	size_t rate = 0;
-	size_t channel;
-	a2dp_sbc_t a2dp;
+	size_t channel = 0;
+	uint8_t config[A2DP_CODEC_MAX_CAPS_SIZE];
 
-	cras_bt_transport_configuration(a2dpio->transport, &a2dp, sizeof(a2dp));
-
-	channel = (a2dp.channel_mode == SBC_CHANNEL_MODE_MONO) ? 1 : 2;
-
-	if (a2dp.frequency & SBC_SAMPLING_FREQ_48000)
-		rate = 48000;
-	else if (a2dp.frequency & SBC_SAMPLING_FREQ_44100)
-		rate = 44100;
-	else if (a2dp.frequency & SBC_SAMPLING_FREQ_32000)
-		rate = 32000;
-	else if (a2dp.frequency & SBC_SAMPLING_FREQ_16000)
-		rate = 16000;
+	cras_bt_transport_configuration(a2dpio->transport, config,
+					a2dpio->a2dp.a2dp_codec->caps_size);
+	a2dpio->a2dp.a2dp_codec->get_format(config, &rate, &channel);
 
 	free(iodev->supported_rates);
 	iodev->supported_rates = (size_t *)malloc(2 * sizeof(rate));
@@ -109,6 +116,9 @@ static int update_supported_formats(struct cras_iodev *iodev)
 static unsigned int bt_local_queued_frames(const struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
+
+	if (a2dpio->encoder)
+		return cras_a2dp_encoder_queued_frames(a2dpio->encoder);
 	return a2dp_queued_frames(&a2dpio->a2dp) +
 	       buf_queued(a2dpio->pcm_buf) /
 		       cras_get_format_bytes(iodev->format);
@@ -231,6 +241,10 @@ static int encode_a2dp_packet(struct a2dp_io *a2dpio)
 	int processed;
 	size_t format_bytes = cras_get_format_bytes(a2dpio->base.format);
 
+	/* The worker encodes as soon as samples are put. */
+	if (a2dpio->encoder)
+		return 0;
+
 	while (buf_queued(a2dpio->pcm_buf)) {
 		processed = a2dp_encode(
 			&a2dpio->a2dp, buf_read_pointer(a2dpio->pcm_buf),
@@ -246,6 +260,84 @@ static int encode_a2dp_packet(struct a2dp_io *a2dpio)
 	return 0;
 }
 
+/* Sends the encoded packet if it's complete.
+ * Returns:
+ *    The number of frames sent, or negative error code.
+ */
+static int write_a2dp_packet(struct a2dp_io *a2dpio)
+{
+	int fd = cras_bt_transport_fd(a2dpio->transport);
+
+	if (a2dpio->encoder)
+		return cras_a2dp_encoder_write(a2dpio->encoder, fd);
+	return a2dp_write(&a2dpio->a2dp, fd,
+			  cras_bt_transport_write_mtu(a2dpio->transport));
+}
+
+/* Returns the number of frames encoded and not sent yet. */
+static unsigned int encoded_queued_frames(struct a2dp_io *a2dpio)
+{
+	if (a2dpio->encoder)
+		return cras_a2dp_encoder_queued_frames(a2dpio->encoder);
+	return a2dp_queued_frames(&a2dpio->a2dp);
+}
+
+/* Returns the number of pcm frames waiting to be encoded and sent. */
+static unsigned int pcm_queued_frames(struct a2dp_io *a2dpio)
+{
+	if (a2dpio->encoder)
+		return cras_a2dp_encoder_queued_frames(a2dpio->encoder);
+	return buf_queued(a2dpio->pcm_buf) /
+	       cras_get_format_bytes(a2dpio->base.format);
+}
+
+/* Returns true if there's no room for more pcm frames. */
+static int local_buffer_full(struct a2dp_io *a2dpio)
+{
+	if (a2dpio->encoder)
+		return !cras_a2dp_encoder_writable_frames(a2dpio->encoder);
+	return a2dpio->base.buffer_size ==
+	       bt_local_queued_frames(&a2dpio->base);
+}
+
+/* Returns the bytes waiting in the send buffer of the socket, or negative
+ * error code. */
+static int socket_backlog(struct a2dp_io *a2dpio)
+{
+	int space;
+
+	/* Bluetooth sockets report the room left in the buffer. */
+	if (ioctl(cras_bt_transport_fd(a2dpio->transport), SIOCOUTQ, &space))
+		return -errno;
+	return space < a2dpio->sock_sndbuf ? a2dpio->sock_sndbuf - space : 0;
+}
+
+/* Moves the bitpool along with the congestion of the link, after a packet
+ * is sent.
+ * Args:
+ *    a2dpio - The a2dp iodev.
+ *    backlog - The bytes in the socket before the packet was sent.
+ *    late - How late the packet was sent.
+ *    now - The current time.
+ */
+static void adapt_bitpool(struct a2dp_io *a2dpio, int backlog,
+			  const struct timespec *late,
+			  const struct timespec *now)
+{
+	unsigned int bitpool;
+
+	if (!a2dpio->bitpool.max || backlog < 0)
+		return;
+
+	bitpool = cras_a2dp_bitpool_update(&a2dpio->bitpool, backlog,
+					   a2dpio->sock_sndbuf, late, now);
+	/* Both take it from the next packet on, the last one is gone. */
+	if (a2dpio->encoder)
+		cras_a2dp_encoder_set_bitpool(a2dpio->encoder, bitpool);
+	else
+		a2dp_set_bitpool(&a2dpio->a2dp, bitpool);
+}
+
 /*
  * To be called when a2dp socket becomes writable.
  */
@@ -258,10 +350,10 @@ static int a2dp_socket_write_cb(void *arg, int revent)
 static int configure_dev(struct cras_iodev *iodev)
 {
 	struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
-	int sock_depth;
+	int sock_depth, codesize;
 	int err;
 	socklen_t optlen;
-	int a2dp_payload_length;
+	struct timespec now;
 
 	err = cras_bt_transport_acquire(a2dpio->transport);
 	if (err < 0) {
@@ -280,10 +372,6 @@ static int configure_dev(struct cras_iodev *iodev)
 	iodev->format->format = SND_PCM_FORMAT_S16_LE;
 	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
 
-	a2dpio->pcm_buf = byte_buffer_create(PCM_BUF_MAX_SIZE_BYTES);
-	if (!a2dpio->pcm_buf)
-		return -ENOMEM;
-
 	/* Set up the socket to hold two MTUs full of data before returning
 	 * EAGAIN.  This will allow the write to be throttled when a reasonable
 	 * amount of data is queued. */
@@ -293,18 +381,32 @@ static int configure_dev(struct cras_iodev *iodev)
 	optlen = sizeof(sock_depth);
 	getsockopt(cras_bt_transport_fd(a2dpio->transport), SOL_SOCKET,
 		   SO_SNDBUF, &sock_depth, &optlen);
+	a2dpio->sock_sndbuf = sock_depth;
+
+	if (cras_bt_tx_delay_init(&a2dpio->tx_delay,
+				  cras_bt_transport_fd(a2dpio->transport)))
+		syslog(LOG_INFO, "A2DP delay estimated from socket depth");
+
+	/* Start from the highest bitpool, the sizes below are the smallest
+	 * number of frames in a packet then. */
+	memset(&a2dpio->bitpool, 0, sizeof(a2dpio->bitpool));
+	if (a2dp_set_bitpool(&a2dpio->a2dp, a2dpio->a2dp.max_bitpool) == 0) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		cras_a2dp_bitpool_init(&a2dpio->bitpool,
+				       a2dpio->a2dp.min_bitpool,
+				       a2dpio->a2dp.max_bitpool, &now);
+	}
+
 	a2dpio->sock_depth_frames = a2dp_block_size(&a2dpio->a2dp, sock_depth) /
 				    cras_get_format_bytes(iodev->format);
 	/*
-	 * Per avdtp_write, subtract the room for packet header first.
 	 * Calculate how many frames are encapsulated in one a2dp packet, and
 	 * the corresponding time period between two packets.
 	 */
-	a2dp_payload_length = cras_bt_transport_write_mtu(a2dpio->transport) -
-			      sizeof(struct rtp_header) -
-			      sizeof(struct rtp_payload);
 	a2dpio->write_block =
-		a2dp_block_size(&a2dpio->a2dp, a2dp_payload_length) /
+		a2dp_packet_block_size(
+			&a2dpio->a2dp,
+			cras_bt_transport_write_mtu(a2dpio->transport)) /
 		cras_get_format_bytes(iodev->format);
 	cras_frames_to_time(a2dpio->write_block, iodev->format->frame_rate,
 			    &a2dpio->flush_period);
@@ -319,6 +421,30 @@ static int configure_dev(struct cras_iodev *iodev)
 	 */
 	iodev->min_buffer_level = a2dpio->write_block;
 
+	if (cras_system_get_a2dp_encode_offload_enabled()) {
+		a2dpio->encoder = cras_a2dp_encoder_create(
+			&a2dpio->a2dp, cras_get_format_bytes(iodev->format),
+			cras_bt_transport_write_mtu(a2dpio->transport),
+			PCM_BUF_MAX_SIZE_FRAMES);
+		if (!a2dpio->encoder)
+			syslog(LOG_WARNING, "Encoding A2DP on audio thread");
+	}
+	if (!a2dpio->encoder) {
+		a2dpio->pcm_buf =
+			byte_buffer_create_mirrored(PCM_BUF_MAX_SIZE_BYTES);
+		if (!a2dpio->pcm_buf)
+			return -ENOMEM;
+		cras_mem_stats_add(CRAS_MEM_BT, PCM_BUF_MAX_SIZE_BYTES);
+		/* Whole codec blocks, like the encoder's ring, so no block is
+		 * split at the wrap and left unencoded. A mirrored buffer
+		 * never splits them and keeps its size. */
+		codesize = a2dp_codesize(&a2dpio->a2dp);
+		if (codesize > 0)
+			byte_buffer_set_used_size(a2dpio->pcm_buf,
+						  PCM_BUF_MAX_SIZE_BYTES /
+							  codesize * codesize);
+	}
+
 	audio_thread_add_events_callback(
 		cras_bt_transport_fd(a2dpio->transport), a2dp_socket_write_cb,
 		iodev, POLLOUT | POLLERR | POLLHUP);
@@ -362,7 +488,12 @@ static int close_dev(struct cras_iodev *iodev)
 	device = cras_bt_transport_device(a2dpio->transport);
 	if (device)
 		cras_bt_device_cancel_suspend(device);
+	/* Stop the worker before it loses the codec state. */
+	cras_a2dp_encoder_destroy(a2dpio->encoder);
+	a2dpio->encoder = NULL;
 	a2dp_reset(&a2dpio->a2dp);
+	if (a2dpio->pcm_buf)
+		cras_mem_stats_sub(CRAS_MEM_BT, PCM_BUF_MAX_SIZE_BYTES);
 	byte_buffer_destroy(&a2dpio->pcm_buf);
 	cras_iodev_free_format(iodev);
 	cras_iodev_free_audio_area(iodev);
@@ -397,21 +528,20 @@ static unsigned int frames_to_play_in_sleep(struct cras_iodev *iodev,
  * Returns:
  *    0 when the flush succeeded, -1 when error occurred.
  */
-static int encode_and_flush(const struct cras_iodev *iodev)
+static int do_encode_and_flush(const struct cras_iodev *iodev)
 {
 	int err;
-	size_t format_bytes;
 	int written = 0;
+	int backlog;
 	unsigned int queued_frames;
 	struct a2dp_io *a2dpio;
 	struct cras_bt_device *device;
-	struct timespec now, ts;
+	struct timespec now, ts, written_ts;
 	static const struct timespec flush_wake_fuzz_ts = {
 		0, 1000000 /* 1ms */
 	};
 
 	a2dpio = (struct a2dp_io *)iodev;
-	format_bytes = cras_get_format_bytes(iodev->format);
 	device = cras_bt_transport_device(a2dpio->transport);
 
 	/* If bt device has been destroyed, this a2dp iodev will soon be
@@ -427,6 +557,12 @@ static int encode_and_flush(const struct cras_iodev *iodev)
 	    (iodev->state != CRAS_IODEV_STATE_NO_STREAM_RUN))
 		return 0;
 
+	err = cras_bt_tx_delay_poll(&a2dpio->tx_delay,
+				    cras_bt_transport_fd(a2dpio->transport));
+	if (err < 0)
+		syslog(LOG_WARNING, "Failed to read A2DP TX completions: %d",
+		       err);
+
 	err = encode_a2dp_packet(a2dpio);
 	if (err < 0)
 		return err;
@@ -436,7 +572,7 @@ do_flush:
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	add_timespecs(&now, &flush_wake_fuzz_ts);
 	if (!timespec_after(&now, &a2dpio->next_flush_time)) {
-		if (iodev->buffer_size == bt_local_queued_frames(iodev)) {
+		if (local_buffer_full(a2dpio)) {
 			/*
 			 * If buffer is full, audio thread will no longer call
 			 * into get/put buffer in subsequent wake-ups. In that
@@ -464,11 +600,10 @@ do_flush:
 	if (timespec_after(&ts, &throttle_event_threshold))
 		cras_audio_thread_event_a2dp_throttle();
 
-	written = a2dp_write(&a2dpio->a2dp,
-			     cras_bt_transport_fd(a2dpio->transport),
-			     cras_bt_transport_write_mtu(a2dpio->transport));
+	backlog = socket_backlog(a2dpio);
+	written = write_a2dp_packet(a2dpio);
 	ATLOG(atlog, AUDIO_THREAD_A2DP_WRITE, written,
-	      a2dp_queued_frames(&a2dpio->a2dp), 0);
+	      encoded_queued_frames(a2dpio), 0);
 	if (written == -EAGAIN) {
 		/* If EAGAIN error lasts longer than 5 seconds, suspend the
 		 * a2dp connection. */
@@ -489,9 +624,16 @@ do_flush:
 		return written;
 	}
 
-	/* Update the next flush time if one block successfully been written. */
-	if (written)
-		add_timespecs(&a2dpio->next_flush_time, &a2dpio->flush_period);
+	/* Update the next flush time if one block successfully been written.
+	 * A lower bitpool fits more frames in a packet than write_block, so
+	 * go by the frames sent. */
+	if (written) {
+		cras_bt_tx_delay_sent(&a2dpio->tx_delay, written);
+		cras_frames_to_time(written, iodev->format->frame_rate,
+				    &written_ts);
+		add_timespecs(&a2dpio->next_flush_time, &written_ts);
+		adapt_bitpool(a2dpio, backlog, &ts, &now);
+	}
 
 	/* a2dp_write no longer return -EAGAIN when reaches here, disable
 	 * the polling write callback. */
@@ -506,7 +648,7 @@ do_flush:
 	 * encode more. But avoid the case when PCM buffer level is too close
 	 * to min_buffer_level so that another A2DP write could causes underrun.
 	 */
-	queued_frames = buf_queued(a2dpio->pcm_buf) / format_bytes;
+	queued_frames = pcm_queued_frames(a2dpio);
 	if (written &&
 	    (iodev->min_buffer_level + a2dpio->write_block < queued_frames)) {
 		err = encode_a2dp_packet(a2dpio);
@@ -518,12 +660,27 @@ do_flush:
 	return 0;
 }
 
+/* Runs do_encode_and_flush between the trace probes of the flush. */
+static int encode_and_flush(const struct cras_iodev *iodev)
+{
+	int rc;
+
+	CRAS_TRACE1(encode_and_flush_begin, iodev->info.idx);
+	rc = do_encode_and_flush(iodev);
+	CRAS_TRACE1(encode_and_flush_end, rc);
+	return rc;
+}
+
 static int delay_frames(const struct cras_iodev *iodev)
 {
 	const struct a2dp_io *a2dpio = (struct a2dp_io *)iodev;
 	struct timespec tstamp;
 
-	/* The number of frames in the pcm buffer plus two mtu packets */
+	/* The number of frames in the pcm buffer plus the ones sent and not
+	 * transmitted yet, or two mtu packets when that's not known. */
+	if (a2dpio->tx_delay.enabled)
+		return frames_queued(iodev, &tstamp) +
+		       cras_bt_tx_delay_frames(&a2dpio->tx_delay);
 	return frames_queued(iodev, &tstamp) + a2dpio->sock_depth_frames;
 }
 
@@ -532,6 +689,7 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 {
 	size_t format_bytes;
 	struct a2dp_io *a2dpio;
+	uint8_t *buf;
 
 	a2dpio = (struct a2dp_io *)iodev;
 
@@ -540,6 +698,15 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 	if (iodev->direction != CRAS_STREAM_OUTPUT)
 		return 0;
 
+	if (a2dpio->encoder) {
+		buf = cras_a2dp_encoder_get_buffer(a2dpio->encoder, frames);
+		iodev->area->frames = *frames;
+		cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
+						    buf);
+		*area = iodev->area;
+		return 0;
+	}
+
 	*frames = MIN(*frames, buf_writable(a2dpio->pcm_buf) / format_bytes);
 	iodev->area->frames = *frames;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
@@ -557,6 +724,15 @@ static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
 	format_bytes = cras_get_format_bytes(iodev->format);
 	written_bytes = nwritten * format_bytes;
 
+	if (a2dpio->encoder) {
+		struct cras_a2dp_encoder *enc = a2dpio->encoder;
+
+		if (nwritten > cras_a2dp_encoder_writable_frames(enc))
+			return -EINVAL;
+		cras_a2dp_encoder_put_buffer(enc, nwritten);
+		return encode_and_flush(iodev);
+	}
+
 	if (written_bytes > buf_writable(a2dpio->pcm_buf))
 		return -EINVAL;
 
@@ -612,17 +788,26 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 	struct a2dp_io *a2dpio;
 	struct cras_iodev *iodev;
 	struct cras_ionode *node;
-	a2dp_sbc_t a2dp;
+	const struct cras_a2dp_codec *codec;
+	uint8_t config[A2DP_CODEC_MAX_CAPS_SIZE];
 	struct cras_bt_device *device;
 	const char *name;
+	size_t rate = 0, channels = 0;
 
 	a2dpio = (struct a2dp_io *)calloc(1, sizeof(*a2dpio));
 	if (!a2dpio)
 		goto error;
 
 	a2dpio->transport = transport;
-	cras_bt_transport_configuration(a2dpio->transport, &a2dp, sizeof(a2dp));
-	err = init_a2dp(&a2dpio->a2dp, &a2dp);
+	codec = cras_a2dp_codec_get(cras_bt_transport_codec(transport));
+	if (!codec) {
+		syslog(LOG_ERR, "Unknown a2dp codec %d",
+		       cras_bt_transport_codec(transport));
+		goto error;
+	}
+	cras_bt_transport_configuration(a2dpio->transport, config,
+					codec->caps_size);
+	err = init_a2dp(&a2dpio->a2dp, codec, config);
 	if (err) {
 		syslog(LOG_ERR, "Fail to init a2dp");
 		goto error;
@@ -637,6 +822,7 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 	 * the readable name is not available, use address instead.
 	 */
 	device = cras_bt_transport_device(transport);
+	iodev->clock_domain = device;
 	name = cras_bt_device_name(device);
 	if (!name)
 		name = cras_bt_transport_object_path(a2dpio->transport);
@@ -677,8 +863,8 @@ struct cras_iodev *a2dp_iodev_create(struct cras_bt_transport *transport)
 		device, iodev, cras_bt_transport_profile(a2dpio->transport));
 
 	/* Record max supported channels into cras_iodev_info. */
-	iodev->info.max_supported_channels =
-		(a2dp.channel_mode == SBC_CHANNEL_MODE_MONO) ? 1 : 2;
+	codec->get_format(config, &rate, &channels);
+	iodev->info.max_supported_channels = channels;
 
 	ewma_power_disable(&iodev->ewma);
 
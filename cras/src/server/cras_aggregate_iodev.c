@@ -0,0 +1,650 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <syslog.h>
+
+#include "cras_aggregate_iodev.h"
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "cras_util.h"
+#include "linear_resampler.h"
+#include "rate_estimator.h"
+#include "sfh.h"
+
+/* The rate estimators of the members are set up like the ones of the
+ * devices opened by cras_iodev. */
+static const struct timespec rate_estimation_window_sz = {
+	5, 0 /* 5 sec. */
+};
+static const double rate_estimation_smooth_factor = 0.3f;
+
+/* Hz added to or taken from the rate a member is resampled to while its
+ * buffer level strays from the first member's, as dev_stream does for
+ * streams following another device. */
+static const int coarse_rate_adjust_step = 3;
+
+/*
+ * A device played through by an aggregate device.
+ * Members:
+ *    dev - The member device.
+ *    num_channels - The number of channels the member plays.
+ *    channel_offset - The first channel of the aggregate device it plays.
+ *    buf - Holds the frames of its channels before they are written.
+ *    resampler - Resamples the frames of members following the first one.
+ *    to_rate - The rate the resampler is set to resample to.
+ *    coarse_rate_adjust - Nudges to_rate when the levels stray apart.
+ */
+struct aggregate_member {
+	struct cras_iodev *dev;
+	unsigned int num_channels;
+	unsigned int channel_offset;
+	uint8_t *buf;
+	struct linear_resampler *resampler;
+	double to_rate;
+	int coarse_rate_adjust;
+};
+
+/*
+ * Members:
+ *    base - The base class cras_iodev.
+ *    members - The devices played through, the first one clocks the rest.
+ *    num_members - The number of members.
+ *    buf - The buffer streams are mixed into, handed out by get_buffer.
+ */
+struct aggregate_io {
+	struct cras_iodev base;
+	struct aggregate_member members[MAX_AGGREGATE_MEMBERS];
+	unsigned int num_members;
+	uint8_t *buf;
+};
+
+static int size_listed(const size_t *list, size_t value)
+{
+	for (; list && *list; list++)
+		if (*list == value)
+			return 1;
+	return 0;
+}
+
+static int format_listed(const snd_pcm_format_t *list, snd_pcm_format_t fmt)
+{
+	for (; list && *list; list++)
+		if (*list == fmt)
+			return 1;
+	return 0;
+}
+
+/* Frees the buffers and resamplers allocated in configure_dev. */
+static void free_member_buffers(struct aggregate_io *agg)
+{
+	unsigned int i;
+
+	for (i = 0; i < agg->num_members; i++) {
+		free(agg->members[i].buf);
+		agg->members[i].buf = NULL;
+		linear_resampler_destroy(agg->members[i].resampler);
+		agg->members[i].resampler = NULL;
+	}
+	free(agg->buf);
+	agg->buf = NULL;
+}
+
+static int open_dev(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		if (!dev->open_dev)
+			continue;
+		rc = dev->open_dev(dev);
+		if (rc) {
+			while (i--) {
+				dev = agg->members[i].dev;
+				dev->close_dev(dev);
+			}
+			return rc;
+		}
+	}
+	return 0;
+}
+
+/*
+ * The aggregate device takes the rates and formats all of the members
+ * support, and as many channels as they have together, each member playing
+ * as many channels as it can. Only the formats the linear resampler handles
+ * are taken.
+ */
+static int update_supported_formats(struct cras_iodev *iodev)
+{
+	static const snd_pcm_format_t resampler_formats[] = {
+		SND_PCM_FORMAT_S16_LE,
+		SND_PCM_FORMAT_S32_LE,
+	};
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct aggregate_member *m;
+	const size_t *rate, *count;
+	unsigned int i, j, n;
+	size_t channels = 0;
+	int rc;
+
+	for (i = 0; i < agg->num_members; i++) {
+		m = &agg->members[i];
+		if (m->dev->update_supported_formats) {
+			rc = m->dev->update_supported_formats(m->dev);
+			if (rc)
+				return rc;
+		}
+		m->num_channels = 0;
+		for (count = m->dev->supported_channel_counts; count && *count;
+		     count++)
+			m->num_channels = MAX(m->num_channels, *count);
+		if (!m->num_channels)
+			return -EINVAL;
+		m->channel_offset = channels;
+		channels += m->num_channels;
+	}
+
+	free(iodev->supported_rates);
+	free(iodev->supported_channel_counts);
+	free(iodev->supported_formats);
+	iodev->supported_rates = NULL;
+	iodev->supported_channel_counts = NULL;
+	iodev->supported_formats = NULL;
+
+	n = 0;
+	for (rate = agg->members[0].dev->supported_rates; rate && *rate; rate++)
+		n++;
+	iodev->supported_rates =
+		(size_t *)calloc(n + 1, sizeof(*iodev->supported_rates));
+	iodev->supported_channel_counts = (size_t *)calloc(
+		2, sizeof(*iodev->supported_channel_counts));
+	iodev->supported_formats = (snd_pcm_format_t *)calloc(
+		ARRAY_SIZE(resampler_formats) + 1,
+		sizeof(*iodev->supported_formats));
+	if (!iodev->supported_rates || !iodev->supported_channel_counts ||
+	    !iodev->supported_formats)
+		return -ENOMEM;
+
+	n = 0;
+	for (rate = agg->members[0].dev->supported_rates; rate && *rate;
+	     rate++) {
+		for (i = 1; i < agg->num_members; i++)
+			if (!size_listed(agg->members[i].dev->supported_rates,
+					 *rate))
+				break;
+		if (i == agg->num_members)
+			iodev->supported_rates[n++] = *rate;
+	}
+
+	iodev->supported_channel_counts[0] = channels;
+
+	n = 0;
+	for (j = 0; j < ARRAY_SIZE(resampler_formats); j++) {
+		for (i = 0; i < agg->num_members; i++) {
+			m = &agg->members[i];
+			if (!format_listed(m->dev->supported_formats,
+					   resampler_formats[j]))
+				break;
+		}
+		if (i == agg->num_members)
+			iodev->supported_formats[n++] = resampler_formats[j];
+	}
+
+	if (!iodev->supported_rates[0] || !iodev->supported_formats[0]) {
+		syslog(LOG_ERR, "Members of %s have no common format",
+		       iodev->info.name);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+/* Hands the format of the aggregate device, with its own channel count, to
+ * a member and configures it. */
+static int configure_member(struct aggregate_member *m,
+			    const struct cras_audio_format *fmt)
+{
+	struct cras_iodev *dev = m->dev;
+	int rc;
+
+	cras_iodev_free_format(dev);
+	dev->format = (struct cras_audio_format *)malloc(sizeof(*dev->format));
+	if (!dev->format)
+		return -ENOMEM;
+	*dev->format = *fmt;
+	dev->format->num_channels = m->num_channels;
+	cras_audio_format_set_default_channel_layout(dev->format);
+
+	rc = dev->configure_dev(dev);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to configure member %s: %d",
+		       dev->info.name, rc);
+		return rc;
+	}
+
+	if (!dev->rate_est)
+		dev->rate_est = rate_estimator_create(
+			fmt->frame_rate, &rate_estimation_window_sz,
+			rate_estimation_smooth_factor);
+	else
+		rate_estimator_reset_rate(dev->rate_est, fmt->frame_rate);
+	if (!dev->rate_est)
+		return -ENOMEM;
+	return 0;
+}
+
+static int configure_dev(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct aggregate_member *m;
+	size_t sample_bytes;
+	unsigned int i;
+	int rc;
+
+	if (iodev->format == NULL)
+		return -EINVAL;
+
+	iodev->buffer_size = 0;
+	iodev->min_buffer_level = 0;
+	for (i = 0; i < agg->num_members; i++) {
+		m = &agg->members[i];
+		rc = configure_member(m, iodev->format);
+		if (rc)
+			goto error;
+		if (!iodev->buffer_size ||
+		    m->dev->buffer_size < iodev->buffer_size)
+			iodev->buffer_size = m->dev->buffer_size;
+		iodev->min_buffer_level =
+			MAX(iodev->min_buffer_level, m->dev->min_buffer_level);
+	}
+
+	rc = -ENOMEM;
+	sample_bytes = snd_pcm_format_physical_width(iodev->format->format) / 8;
+	agg->buf = (uint8_t *)calloc(iodev->buffer_size,
+				     cras_get_format_bytes(iodev->format));
+	if (!agg->buf)
+		goto error;
+	for (i = 0; i < agg->num_members; i++) {
+		m = &agg->members[i];
+		m->buf = (uint8_t *)calloc(iodev->buffer_size,
+					   m->num_channels * sample_bytes);
+		if (!m->buf)
+			goto error;
+		m->coarse_rate_adjust = 0;
+		m->to_rate = iodev->format->frame_rate;
+		if (i == 0)
+			continue;
+		m->resampler = linear_resampler_create(
+			m->num_channels, m->num_channels * sample_bytes,
+			iodev->format->frame_rate, m->to_rate);
+		if (!m->resampler)
+			goto error;
+	}
+
+	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
+	return 0;
+
+error:
+	/* The members are closed as cras_iodev closes the device. */
+	free_member_buffers(agg);
+	return rc;
+}
+
+static int close_dev(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		dev->close_dev(dev);
+		cras_iodev_free_format(dev);
+	}
+	free_member_buffers(agg);
+	cras_iodev_free_format(iodev);
+	cras_iodev_free_audio_area(iodev);
+	return 0;
+}
+
+/*
+ * The level of the first member is the level of the device. The levels of
+ * the others feed their rate estimators, all updated at once after every
+ * member is sampled, and say whether they have to be fed a little faster or
+ * slower to stay with the first one.
+ */
+static int frames_queued(const struct cras_iodev *iodev,
+			 struct timespec *tstamp)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct aggregate_member *m;
+	struct cras_iodev *rate_devs[MAX_AGGREGATE_MEMBERS];
+	unsigned int rate_levels[MAX_AGGREGATE_MEMBERS];
+	struct timespec rate_tstamps[MAX_AGGREGATE_MEMBERS];
+	unsigned int i, slack, num_rates = 0;
+	int level, rc;
+
+	level = agg->members[0].dev->frames_queued(agg->members[0].dev, tstamp);
+	if (level < 0)
+		return level;
+
+	slack = iodev->min_cb_level / 2;
+	for (i = 1; i < agg->num_members; i++) {
+		m = &agg->members[i];
+		rc = m->dev->frames_queued(m->dev, &rate_tstamps[num_rates]);
+		if (rc < 0)
+			return rc;
+		if (timespec_is_nonzero(&rate_tstamps[num_rates])) {
+			rate_devs[num_rates] = m->dev;
+			rate_levels[num_rates++] = rc;
+		}
+
+		if (rc + slack < level)
+			m->coarse_rate_adjust = 1;
+		else if (rc > level + slack)
+			m->coarse_rate_adjust = -1;
+		else
+			m->coarse_rate_adjust = 0;
+	}
+	cras_iodev_update_rates(rate_devs, rate_levels, rate_tstamps,
+				num_rates);
+	return level;
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+	int delay, max_delay = 0;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		delay = dev->delay_frames(dev);
+		if (delay < 0)
+			return delay;
+		max_delay = MAX(max_delay, delay);
+	}
+	return max_delay;
+}
+
+static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
+		      unsigned *frames)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+
+	*frames = MIN(*frames, iodev->buffer_size);
+	iodev->area->frames = *frames;
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
+					    agg->buf);
+	*area = iodev->area;
+	return 0;
+}
+
+/* Copies the channels a member plays out of the mixed frames. */
+static void extract_member_channels(const struct aggregate_io *agg,
+				    struct aggregate_member *m,
+				    unsigned int frames)
+{
+	size_t sample_bytes =
+		snd_pcm_format_physical_width(agg->base.format->format) / 8;
+	size_t frame_bytes = cras_get_format_bytes(agg->base.format);
+	size_t member_bytes = m->num_channels * sample_bytes;
+	const uint8_t *src = agg->buf + m->channel_offset * sample_bytes;
+	uint8_t *dst = m->buf;
+	unsigned int i;
+
+	for (i = 0; i < frames; i++) {
+		memcpy(dst, src, member_bytes);
+		src += frame_bytes;
+		dst += member_bytes;
+	}
+}
+
+/* Sets the rate a member following the first one is resampled to, from the
+ * ratio of its estimated rate to the aggregate device's. */
+static void update_member_rate(const struct aggregate_io *agg,
+			       struct aggregate_member *m)
+{
+	double rate = agg->base.format->frame_rate;
+	double to_rate;
+
+	to_rate = rate * cras_iodev_get_est_rate_ratio(m->dev) /
+			  cras_iodev_get_est_rate_ratio(&agg->base) +
+		  coarse_rate_adjust_step * m->coarse_rate_adjust;
+	if (to_rate == m->to_rate)
+		return;
+	m->to_rate = to_rate;
+	linear_resampler_set_rates(m->resampler, rate, to_rate);
+}
+
+/* Writes the frames in the buffer of a member to its device, resampling
+ * them if it follows the first member. Frames that don't fit are dropped. */
+static int write_member(struct aggregate_member *m, unsigned int frames)
+{
+	struct cras_iodev *dev = m->dev;
+	struct cras_audio_area *area;
+	size_t frame_bytes = cras_get_format_bytes(dev->format);
+	uint8_t *src = m->buf;
+	unsigned int in, out, written;
+	int rc;
+
+	while (frames) {
+		out = m->resampler ? linear_resampler_in_frames_to_out(
+					     m->resampler, frames) :
+				     frames;
+		rc = dev->get_buffer(dev, &area, &out);
+		if (rc < 0)
+			return rc;
+		if (!out)
+			break;
+
+		if (m->resampler) {
+			in = frames;
+			written = linear_resampler_resample(
+				m->resampler, src, &in,
+				area->channels[0].buf, out);
+		} else {
+			memcpy(area->channels[0].buf, src, out * frame_bytes);
+			in = written = out;
+		}
+
+		rc = dev->put_buffer(dev, written);
+		if (rc < 0)
+			return rc;
+		rate_estimator_add_frames(dev->rate_est, written);
+		src += in * frame_bytes;
+		frames -= MIN(in, frames);
+	}
+	return 0;
+}
+
+static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct aggregate_member *m;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < agg->num_members; i++) {
+		m = &agg->members[i];
+		extract_member_channels(agg, m, nwritten);
+		if (m->resampler)
+			update_member_rate(agg, m);
+		rc = write_member(m, nwritten);
+		if (rc < 0)
+			return rc;
+	}
+	return 0;
+}
+
+static int flush_buffer(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		if (dev->flush_buffer)
+			dev->flush_buffer(dev);
+	}
+	return 0;
+}
+
+static int start(const struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+	int rc;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		if (!dev->start)
+			continue;
+		rc = dev->start(dev);
+		if (rc)
+			return rc;
+	}
+	return 0;
+}
+
+static void set_volume(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		if (dev->set_volume)
+			dev->set_volume(dev);
+	}
+}
+
+static void set_mute(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		if (dev->set_mute)
+			dev->set_mute(dev);
+	}
+}
+
+/* The aggregate device has a single node, the members keep their own
+ * active nodes. */
+static void update_active_node(struct cras_iodev *iodev, unsigned node_idx,
+			       unsigned dev_enabled)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_iodev *dev;
+	unsigned int i;
+
+	for (i = 0; i < agg->num_members; i++) {
+		dev = agg->members[i].dev;
+		if (dev->update_active_node && dev->active_node)
+			dev->update_active_node(dev, dev->active_node->idx,
+						dev_enabled);
+	}
+}
+
+struct cras_iodev *aggregate_iodev_create(const char *name,
+					  struct cras_iodev *const *members,
+					  unsigned int num_members)
+{
+	struct aggregate_io *agg;
+	struct cras_iodev *iodev;
+	struct cras_ionode *node;
+	unsigned int i;
+
+	if (!name || !num_members || num_members > MAX_AGGREGATE_MEMBERS)
+		return NULL;
+	for (i = 0; i < num_members; i++)
+		if (!members[i] || members[i]->direction != CRAS_STREAM_OUTPUT)
+			return NULL;
+
+	agg = (struct aggregate_io *)calloc(1, sizeof(*agg));
+	if (!agg)
+		return NULL;
+	iodev = &agg->base;
+	iodev->direction = CRAS_STREAM_OUTPUT;
+
+	agg->num_members = num_members;
+	for (i = 0; i < num_members; i++) {
+		agg->members[i].dev = members[i];
+		iodev->info.max_supported_channels +=
+			members[i]->info.max_supported_channels;
+	}
+
+	snprintf(iodev->info.name, sizeof(iodev->info.name), "%s", name);
+	iodev->info.name[ARRAY_SIZE(iodev->info.name) - 1] = '\0';
+	iodev->info.stable_id =
+		SuperFastHash(iodev->info.name, strlen(iodev->info.name),
+			      strlen(iodev->info.name));
+
+	iodev->open_dev = open_dev;
+	iodev->update_supported_formats = update_supported_formats;
+	iodev->configure_dev = configure_dev;
+	iodev->close_dev = close_dev;
+	iodev->frames_queued = frames_queued;
+	iodev->delay_frames = delay_frames;
+	iodev->get_buffer = get_buffer;
+	iodev->put_buffer = put_buffer;
+	iodev->flush_buffer = flush_buffer;
+	iodev->start = start;
+	iodev->set_volume = set_volume;
+	iodev->set_mute = set_mute;
+	iodev->update_active_node = update_active_node;
+	iodev->no_stream = cras_iodev_default_no_stream_playback;
+
+	node = (struct cras_ionode *)calloc(1, sizeof(*node));
+	if (!node) {
+		free(agg);
+		return NULL;
+	}
+	node->dev = iodev;
+	node->type = members[0]->active_node ? members[0]->active_node->type :
+					       CRAS_NODE_TYPE_UNKNOWN;
+	node->plugged = 1;
+	node->volume = 100;
+	gettimeofday(&node->plugged_time, NULL);
+	snprintf(node->name, sizeof(node->name), "%s", iodev->info.name);
+	node->stable_id = iodev->info.stable_id;
+	cras_iodev_add_node(iodev, node);
+	cras_iodev_set_active_node(iodev, node);
+
+	return iodev;
+}
+
+void aggregate_iodev_destroy(struct cras_iodev *iodev)
+{
+	struct aggregate_io *agg = (struct aggregate_io *)iodev;
+	struct cras_ionode *node;
+
+	node = iodev->active_node;
+	if (node) {
+		cras_iodev_rm_node(iodev, node);
+		free(node);
+	}
+
+	free(iodev->supported_channel_counts);
+	free(iodev->supported_rates);
+	free(iodev->supported_formats);
+	cras_iodev_free_resources(iodev);
+	free(agg);
+}
@@ -0,0 +1,44 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_AGGREGATE_IODEV_H_
+#define CRAS_AGGREGATE_IODEV_H_
+
+struct cras_iodev;
+
+/* The most output devices an aggregate device combines. */
+#define MAX_AGGREGATE_MEMBERS 4
+
+/*
+ * An aggregate device plays through several output devices at once, for
+ * example the woofer and tweeter amps of a speaker on different cards, as
+ * one device having the channels of all of them in turn. Streams are mixed
+ * and the DSP is run once, on the aggregate device, and each member gets
+ * its channels of the result. The first member clocks the device, the
+ * others are resampled following the ratio of their estimated rates to
+ * the first one's, so they don't drift apart.
+ *
+ * The members are opened, configured and closed by the aggregate device
+ * and must not be enabled on their own in the meantime.
+ */
+
+/* Creates an aggregate output device.
+ * Args:
+ *    name - The name of the device.
+ *    members - The output devices to combine. The first one clocks the
+ *              aggregate device.
+ *    num_members - The number of members, at least one and at most
+ *                  MAX_AGGREGATE_MEMBERS.
+ * Returns:
+ *    The created device, or NULL on failure.
+ */
+struct cras_iodev *aggregate_iodev_create(const char *name,
+					  struct cras_iodev *const *members,
+					  unsigned int num_members);
+
+/* Destroys an aggregate device. The members are left as they are. */
+void aggregate_iodev_destroy(struct cras_iodev *iodev);
+
+#endif /* CRAS_AGGREGATE_IODEV_H_ */
@@ -21,6 +21,7 @@ struct cras_alert_cb_list {
 /* A list of data args to callbacks. Variable-length structure. */
 struct cras_alert_data {
 	struct cras_alert_data *prev, *next;
+	size_t size;
 	/* This field must be the last in this structure. */
 	char buf[];
 };
@@ -31,6 +32,11 @@ struct cras_alert {
 	cras_alert_prepare prepare;
 	struct cras_alert_cb_list *callbacks;
 	struct cras_alert_data *data;
+	/* Leading bytes of the data identifying it, for MERGE_BY_KEY. */
+	size_t key_size;
+	/* Data the callbacks were last executed with, for SKIP_UNCHANGED. One
+	 * entry per key when merging by key, at most one entry otherwise. */
+	struct cras_alert_data *delivered;
 	struct cras_alert *prev, *next;
 };
 
@@ -52,6 +58,62 @@ struct cras_alert *cras_alert_create(cras_alert_prepare prepare,
 	return alert;
 }
 
+void cras_alert_set_key_size(struct cras_alert *alert, size_t key_size)
+{
+	alert->key_size = key_size;
+}
+
+/* Returns the entry of list with the same key as data, or the first entry
+ * if the alert doesn't merge by key. */
+static struct cras_alert_data *find_same_key(const struct cras_alert *alert,
+					     struct cras_alert_data *list,
+					     const void *data)
+{
+	struct cras_alert_data *d;
+
+	if (!(alert->flags & CRAS_ALERT_FLAG_MERGE_BY_KEY))
+		return list;
+
+	DL_FOREACH (list, d)
+		if (d->size >= alert->key_size &&
+		    memcmp(d->buf, data, alert->key_size) == 0)
+			return d;
+	return NULL;
+}
+
+/* Returns true if the callbacks were already executed with data. */
+static int is_unchanged(const struct cras_alert *alert,
+			const struct cras_alert_data *data)
+{
+	struct cras_alert_data *last;
+
+	if (!(alert->flags & CRAS_ALERT_FLAG_SKIP_UNCHANGED))
+		return 0;
+
+	last = find_same_key(alert, alert->delivered, data->buf);
+	return last && last->size == data->size &&
+	       memcmp(last->buf, data->buf, data->size) == 0;
+}
+
+/* Keeps data as the last one delivered for its key, taking ownership. */
+static void set_delivered(struct cras_alert *alert,
+			  struct cras_alert_data *data)
+{
+	struct cras_alert_data *last;
+
+	if (!(alert->flags & CRAS_ALERT_FLAG_SKIP_UNCHANGED)) {
+		free(data);
+		return;
+	}
+
+	last = find_same_key(alert, alert->delivered, data->buf);
+	if (last) {
+		DL_DELETE(alert->delivered, last);
+		free(last);
+	}
+	DL_APPEND(alert->delivered, data);
+}
+
 int cras_alert_add_callback(struct cras_alert *alert, cras_alert_cb cb,
 			    void *arg)
 {
@@ -108,10 +170,14 @@ static void cras_alert_process(struct cras_alert *alert)
 
 	/* Have data arguments, pass each to the callbacks. */
 	DL_FOREACH (alert->data, data) {
+		DL_DELETE(alert->data, data);
+		if (is_unchanged(alert, data)) {
+			free(data);
+			continue;
+		}
 		DL_FOREACH (alert->callbacks, cb)
 			cb->callback(cb->arg, (void *)data->buf);
-		DL_DELETE(alert->data, data);
-		free(data);
+		set_delivered(alert, data);
 	}
 }
 
@@ -124,17 +190,26 @@ void cras_alert_pending(struct cras_alert *alert)
 void cras_alert_pending_data(struct cras_alert *alert, void *data,
 			     size_t data_size)
 {
-	struct cras_alert_data *d;
+	struct cras_alert_data *d, *old;
 
 	alert->pending = 1;
 	has_alert_pending = 1;
 	d = calloc(1, offsetof(struct cras_alert_data, buf) + data_size);
+	d->size = data_size;
 	memcpy(d->buf, data, data_size);
 
-	if (!(alert->flags & CRAS_ALERT_FLAG_KEEP_ALL_DATA) && alert->data) {
-		/* There will never be more than one item in the list. */
-		free(alert->data);
-		alert->data = NULL;
+	if (!(alert->flags & CRAS_ALERT_FLAG_KEEP_ALL_DATA)) {
+		/* Without merging by key, there will never be more than one
+		 * item in the list. */
+		old = find_same_key(alert, alert->data, data);
+		if (old) {
+			/* Take the place of the old data so the callbacks
+			 * still run in the order the keys became pending. */
+			DL_INSERT(alert->data, old, d);
+			DL_DELETE(alert->data, old);
+			free(old);
+			return;
+		}
 	}
 
 	/* Even when there is only one item, it is important to use DL_APPEND
@@ -171,6 +246,11 @@ void cras_alert_destroy(struct cras_alert *alert)
 		free(data);
 	}
 
+	DL_FOREACH (alert->delivered, data) {
+		DL_DELETE(alert->delivered, data);
+		free(data);
+	}
+
 	alert->callbacks = NULL;
 	DL_DELETE(all_alerts, alert);
 	free(alert);
@@ -46,6 +46,14 @@ enum CRAS_ALERT_FLAGS {
 	 * for every value. In some cases, it is important to send the data
 	 * with every change. Use this flag to enable that behavior. */
 	CRAS_ALERT_FLAG_KEEP_ALL_DATA = 1 << 0,
+	/* Keep the last copy of the data for each key instead, the key being
+	 * the leading bytes of the data set with cras_alert_set_key_size().
+	 * The callback is executed once per key, in the order the keys were
+	 * first made pending. */
+	CRAS_ALERT_FLAG_MERGE_BY_KEY = 1 << 1,
+	/* Don't execute the callback with data equal to the data it was last
+	 * executed with, for the same key when merging by key. */
+	CRAS_ALERT_FLAG_SKIP_UNCHANGED = 1 << 2,
 };
 
 /* Creates an alert.
@@ -60,6 +68,15 @@ enum CRAS_ALERT_FLAGS {
 struct cras_alert *cras_alert_create(cras_alert_prepare prepare,
 				     unsigned int flags);
 
+/* Sets the number of leading bytes of the data passed to
+ * cras_alert_pending_data() that tell what the data is about, for alerts
+ * created with CRAS_ALERT_FLAG_MERGE_BY_KEY.
+ * Args:
+ *    alert - A pointer to the alert.
+ *    key_size - Size of the key at the start of the data.
+ */
+void cras_alert_set_key_size(struct cras_alert *alert, size_t key_size);
+
 /* Adds a callback to the alert.
  * Args:
  *    alert - A pointer to the alert.
@@ -96,7 +113,8 @@ void cras_alert_pending(struct cras_alert *alert);
  * cras_alert_process_all_pending_alerts() is called.
  * By default only the last data value supplied here is provided as an
  * argument to the callback. To have the callback executed with every
- * data value, call cras_alert_keep_all_data() (see above).
+ * data value, or the last one for each key, create the alert with
+ * CRAS_ALERT_FLAG_KEEP_ALL_DATA or CRAS_ALERT_FLAG_MERGE_BY_KEY.
  * Args:
  *    alert - A pointer to the alert.
  *    data - A pointer to data that is copied and passed to the callback.
@@ -0,0 +1,238 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_alsa_caps_cache.h"
+
+/* The most values kept for each of rates, channel counts and formats. */
+#define MAX_CACHED_VALUES 32
+/* Longest line in a cache file. */
+#define MAX_LINE_LEN 512
+
+/*
+ * A cache file is a few lines of text:
+ *    checksum <hex>
+ *    rates <rate> ...
+ *    channels <count> ...
+ *    formats <format> ...
+ */
+
+static const char *cache_dir = CRAS_ALSA_CAPS_CACHE_DIR;
+
+/* Fills path with the name of the cache file of a PCM. Characters of the
+ * card name which don't belong in a file name are replaced. */
+static int entry_path(char *path, size_t size, const char *card_name,
+		      size_t device_index, snd_pcm_stream_t stream)
+{
+	char name[NAME_MAX / 2];
+	size_t i;
+	int n;
+
+	if (!cache_dir || !card_name)
+		return -EINVAL;
+
+	for (i = 0; card_name[i] && i < sizeof(name) - 1; i++) {
+		unsigned char ch = card_name[i];
+
+		name[i] = (isalnum(ch) || ch == '-') ? ch : '_';
+	}
+	name[i] = '\0';
+
+	n = snprintf(path, size, "%s/%s.%zu.%s", cache_dir, name, device_index,
+		     stream == SND_PCM_STREAM_PLAYBACK ? "playback" :
+							 "capture");
+	if (n < 0 || (size_t)n >= size)
+		return -ENAMETOOLONG;
+	return 0;
+}
+
+/* Parses the values after the key of a line into a zero terminated array of
+ * at most MAX_CACHED_VALUES values. Returns the number of values. */
+static int parse_values(const char *line, const char *key,
+			unsigned long *values)
+{
+	size_t key_len = strlen(key);
+	const char *p;
+	char *end;
+	int n = 0;
+
+	if (strncmp(line, key, key_len) || line[key_len] != ' ')
+		return -EINVAL;
+
+	p = line + key_len;
+	while (n < MAX_CACHED_VALUES) {
+		values[n] = strtoul(p, &end, 10);
+		if (end == p)
+			break;
+		if (values[n] == 0)
+			return -EINVAL;
+		p = end;
+		n++;
+	}
+	values[n] = 0;
+	return n;
+}
+
+/* Reads the next line of the file and parses it as for parse_values(). */
+static int read_values(FILE *f, const char *key, unsigned long *values)
+{
+	char line[MAX_LINE_LEN];
+
+	if (!fgets(line, sizeof(line), f))
+		return -EINVAL;
+	return parse_values(line, key, values);
+}
+
+void cras_alsa_caps_cache_set_dir(const char *dir)
+{
+	cache_dir = dir;
+}
+
+int cras_alsa_caps_cache_get(const char *card_name, size_t device_index,
+			     snd_pcm_stream_t stream, uint32_t checksum,
+			     size_t **rates, size_t **channel_counts,
+			     snd_pcm_format_t **formats)
+{
+	char path[PATH_MAX];
+	char line[MAX_LINE_LEN];
+	unsigned long r[MAX_CACHED_VALUES + 1];
+	unsigned long c[MAX_CACHED_VALUES + 1];
+	unsigned long f[MAX_CACHED_VALUES + 1];
+	unsigned int stored;
+	int nr, nc, nf, i;
+	FILE *file;
+	int rc;
+
+	rc = entry_path(path, sizeof(path), card_name, device_index, stream);
+	if (rc)
+		return rc;
+
+	file = fopen(path, "r");
+	if (!file)
+		return -ENOENT;
+
+	rc = -ENOENT;
+	if (!fgets(line, sizeof(line), file) ||
+	    sscanf(line, "checksum %x", &stored) != 1 || stored != checksum)
+		goto done;
+
+	rc = -EINVAL;
+	nr = read_values(file, "rates", r);
+	nc = read_values(file, "channels", c);
+	nf = read_values(file, "formats", f);
+	if (nr <= 0 || nc <= 0 || nf <= 0) {
+		syslog(LOG_WARNING, "Ignoring corrupt caps cache %s", path);
+		goto done;
+	}
+
+	rc = -ENOMEM;
+	*rates = (size_t *)calloc(nr + 1, sizeof(**rates));
+	*channel_counts = (size_t *)calloc(nc + 1, sizeof(**channel_counts));
+	*formats = (snd_pcm_format_t *)calloc(nf + 1, sizeof(**formats));
+	if (!*rates || !*channel_counts || !*formats) {
+		free(*rates);
+		free(*channel_counts);
+		free(*formats);
+		*rates = NULL;
+		*channel_counts = NULL;
+		*formats = NULL;
+		goto done;
+	}
+	for (i = 0; i < nr; i++)
+		(*rates)[i] = r[i];
+	for (i = 0; i < nc; i++)
+		(*channel_counts)[i] = c[i];
+	for (i = 0; i < nf; i++)
+		(*formats)[i] = (snd_pcm_format_t)f[i];
+	rc = 0;
+
+done:
+	fclose(file);
+	return rc;
+}
+
+/* Writes a line with the key and the values of a zero terminated array. */
+static void write_values(FILE *file, const char *key, const size_t *values)
+{
+	int i;
+
+	fputs(key, file);
+	for (i = 0; values[i] && i < MAX_CACHED_VALUES; i++)
+		fprintf(file, " %zu", values[i]);
+	fputc('\n', file);
+}
+
+int cras_alsa_caps_cache_put(const char *card_name, size_t device_index,
+			     snd_pcm_stream_t stream, uint32_t checksum,
+			     const size_t *rates, const size_t *channel_counts,
+			     const snd_pcm_format_t *formats)
+{
+	char path[PATH_MAX];
+	char tmp_path[PATH_MAX + 4];
+	size_t f[MAX_CACHED_VALUES + 1];
+	FILE *file;
+	int i, rc;
+
+	if (!rates || !rates[0] || !channel_counts || !channel_counts[0] ||
+	    !formats || !formats[0])
+		return -EINVAL;
+
+	rc = entry_path(path, sizeof(path), card_name, device_index, stream);
+	if (rc)
+		return rc;
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	if (mkdir(cache_dir, 0755) && errno != EEXIST)
+		return -errno;
+
+	/* Write a temporary file and move it over the entry so a reader never
+	 * sees a partly written one. */
+	file = fopen(tmp_path, "w");
+	if (!file)
+		return -errno;
+	fprintf(file, "checksum %x\n", checksum);
+	write_values(file, "rates", rates);
+	write_values(file, "channels", channel_counts);
+	for (i = 0; formats[i] && i < MAX_CACHED_VALUES; i++)
+		f[i] = formats[i];
+	f[i] = 0;
+	write_values(file, "formats", f);
+	if (ferror(file)) {
+		fclose(file);
+		unlink(tmp_path);
+		return -EIO;
+	}
+	if (fclose(file)) {
+		rc = -errno;
+		unlink(tmp_path);
+		return rc;
+	}
+
+	if (rename(tmp_path, path)) {
+		rc = -errno;
+		unlink(tmp_path);
+		return rc;
+	}
+	return 0;
+}
+
+void cras_alsa_caps_cache_remove(const char *card_name, size_t device_index,
+				 snd_pcm_stream_t stream)
+{
+	char path[PATH_MAX];
+
+	if (entry_path(path, sizeof(path), card_name, device_index, stream))
+		return;
+	unlink(path);
+}
@@ -0,0 +1,62 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_ALSA_CAPS_CACHE_H_
+#define CRAS_ALSA_CAPS_CACHE_H_
+
+#include <alsa/asoundlib.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Keeps the rates, channel counts and formats probed from ALSA PCMs in
+ * files that outlive the server, so a device showing up again, or the next
+ * boot, doesn't have to open the PCM and test every candidate again. An
+ * entry is keyed by card name, device index and stream direction, and
+ * carries a checksum of whatever its capabilities depend on, such as the
+ * device names and the kernel. An entry stored with another checksum is a
+ * miss.
+ */
+
+/* Sets the directory holding the cache files, NULL disables the cache. */
+void cras_alsa_caps_cache_set_dir(const char *dir);
+
+/* Reads the cached capabilities of a PCM.
+ * Args:
+ *    card_name - The name of the card.
+ *    device_index - ALSA index of the device on the card.
+ *    stream - Playback or capture.
+ *    checksum - The checksum the entry must have been stored with.
+ *    rates - Set to a zero terminated array of sample rates on success.
+ *            Must be freed by the caller.
+ *    channel_counts - Set to a zero terminated array of channel counts on
+ *                     success. Must be freed by the caller.
+ *    formats - Set to a zero terminated array of PCM formats on success.
+ *              Must be freed by the caller.
+ * Returns:
+ *    0 on a hit, -ENOENT on a miss or another negative error code.
+ */
+int cras_alsa_caps_cache_get(const char *card_name, size_t device_index,
+			     snd_pcm_stream_t stream, uint32_t checksum,
+			     size_t **rates, size_t **channel_counts,
+			     snd_pcm_format_t **formats);
+
+/* Stores the capabilities of a PCM, replacing any previous entry. The
+ * arguments are as for cras_alsa_caps_cache_get(), with the arrays given
+ * in as probed by cras_alsa_fill_properties().
+ * Returns:
+ *    0 on success or a negative error code.
+ */
+int cras_alsa_caps_cache_put(const char *card_name, size_t device_index,
+			     snd_pcm_stream_t stream, uint32_t checksum,
+			     const size_t *rates, const size_t *channel_counts,
+			     const snd_pcm_format_t *formats);
+
+/* Drops the entry of a PCM, if any. Used when the cached capabilities turn
+ * out not to work with the device. */
+void cras_alsa_caps_cache_remove(const char *card_name, size_t device_index,
+				 snd_pcm_stream_t stream);
+
+#endif /* CRAS_ALSA_CAPS_CACHE_H_ */
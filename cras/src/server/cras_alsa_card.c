@@ -51,6 +51,9 @@ struct hctl_poll_fd {
  * hctl - ALSA high-level control interface.
  * hctl_poll_fds - List of fds registered with cras_system_state.
  * config - Config info for this card, can be NULL if none found.
+ * handle - Control handle of the card, open from probing until the devices
+ *     are added.
+ * card_name - The name ALSA reports for the card.
  */
 struct cras_alsa_card {
 	char name[MAX_ALSA_CARD_NAME_LENGTH];
@@ -61,6 +64,8 @@ struct cras_alsa_card {
 	snd_hctl_t *hctl;
 	struct hctl_poll_fd *hctl_poll_fds;
 	struct cras_card_config *config;
+	snd_ctl_t *handle;
+	char *card_name;
 };
 
 /* Creates an iodev for the given device.
@@ -447,12 +452,11 @@ static void configure_echo_reference_dev(struct cras_alsa_card *alsa_card)
  * Exported Interface.
  */
 
-struct cras_alsa_card *cras_alsa_card_create(
-	struct cras_alsa_card_info *info, const char *device_config_dir,
-	struct cras_device_blocklist *blocklist, const char *ucm_suffix)
+struct cras_alsa_card *cras_alsa_card_probe(
+	const struct cras_alsa_card_info *info, const char *device_config_dir,
+	const char *ucm_suffix)
 {
-	snd_ctl_t *handle = NULL;
-	int rc, n;
+	int rc;
 	snd_ctl_card_info_t *card_info;
 	const char *card_name;
 	struct cras_alsa_card *alsa_card;
@@ -472,13 +476,14 @@ struct cras_alsa_card *cras_alsa_card_create(
 	snprintf(alsa_card->name, MAX_ALSA_CARD_NAME_LENGTH, "hw:%u",
 		 info->card_index);
 
-	rc = snd_ctl_open(&handle, alsa_card->name, 0);
+	rc = snd_ctl_open(&alsa_card->handle, alsa_card->name, 0);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Fail opening control %s.", alsa_card->name);
+		alsa_card->handle = NULL;
 		goto error_bail;
 	}
 
-	rc = snd_ctl_card_info(handle, card_info);
+	rc = snd_ctl_card_info(alsa_card->handle, card_info);
 	if (rc < 0) {
 		syslog(LOG_ERR, "Error getting card info.");
 		goto error_bail;
@@ -489,6 +494,10 @@ struct cras_alsa_card *cras_alsa_card_create(
 		syslog(LOG_ERR, "Error getting card name.");
 		goto error_bail;
 	}
+	alsa_card->card_name = strdup(card_name);
+	if (alsa_card->card_name == NULL)
+		goto error_bail;
+	card_name = alsa_card->card_name;
 
 	if (info->card_type != ALSA_CARD_TYPE_INTERNAL ||
 	    cras_system_check_ignore_ucm_suffix(card_name))
@@ -548,14 +557,29 @@ struct cras_alsa_card *cras_alsa_card_create(
 		goto error_bail;
 	}
 
+	return alsa_card;
+
+error_bail:
+	cras_alsa_card_destroy(alsa_card);
+	return NULL;
+}
+
+int cras_alsa_card_add_devices(struct cras_alsa_card *alsa_card,
+			       struct cras_alsa_card_info *info,
+			       struct cras_device_blocklist *blocklist)
+{
+	int rc, n;
+
 	if (alsa_card->ucm && ucm_has_fully_specified_ucm_flag(alsa_card->ucm))
 		rc = add_controls_and_iodevs_with_ucm(info, alsa_card,
-						      card_name, handle);
+						      alsa_card->card_name,
+						      alsa_card->handle);
 	else
 		rc = add_controls_and_iodevs_by_matching(
-			info, blocklist, alsa_card, card_name, handle);
+			info, blocklist, alsa_card, alsa_card->card_name,
+			alsa_card->handle);
 	if (rc)
-		goto error_bail;
+		goto done;
 
 	configure_echo_reference_dev(alsa_card);
 
@@ -569,7 +593,7 @@ struct cras_alsa_card *cras_alsa_card_create(
 		pollfds = malloc(n * sizeof(*pollfds));
 		if (pollfds == NULL) {
 			rc = -ENOMEM;
-			goto error_bail;
+			goto done;
 		}
 
 		n = snd_hctl_poll_descriptors(alsa_card->hctl, pollfds, n);
@@ -578,7 +602,7 @@ struct cras_alsa_card *cras_alsa_card_create(
 			if (registered_fd == NULL) {
 				free(pollfds);
 				rc = -ENOMEM;
-				goto error_bail;
+				goto done;
 			}
 			registered_fd->fd = pollfds[i].fd;
 			DL_APPEND(alsa_card->hctl_poll_fds, registered_fd);
@@ -589,20 +613,34 @@ struct cras_alsa_card *cras_alsa_card_create(
 				DL_DELETE(alsa_card->hctl_poll_fds,
 					  registered_fd);
 				free(pollfds);
-				goto error_bail;
+				goto done;
 			}
 		}
 		free(pollfds);
 	}
+	rc = 0;
 
-	snd_ctl_close(handle);
-	return alsa_card;
+done:
+	snd_ctl_close(alsa_card->handle);
+	alsa_card->handle = NULL;
+	return rc;
+}
 
-error_bail:
-	if (handle != NULL)
-		snd_ctl_close(handle);
-	cras_alsa_card_destroy(alsa_card);
-	return NULL;
+struct cras_alsa_card *cras_alsa_card_create(
+	struct cras_alsa_card_info *info, const char *device_config_dir,
+	struct cras_device_blocklist *blocklist, const char *ucm_suffix)
+{
+	struct cras_alsa_card *alsa_card;
+
+	alsa_card = cras_alsa_card_probe(info, device_config_dir, ucm_suffix);
+	if (alsa_card == NULL)
+		return NULL;
+
+	if (cras_alsa_card_add_devices(alsa_card, info, blocklist)) {
+		cras_alsa_card_destroy(alsa_card);
+		return NULL;
+	}
+	return alsa_card;
 }
 
 void cras_alsa_card_destroy(struct cras_alsa_card *alsa_card)
@@ -631,6 +669,9 @@ void cras_alsa_card_destroy(struct cras_alsa_card *alsa_card)
 		cras_alsa_mixer_destroy(alsa_card->mixer);
 	if (alsa_card->config)
 		cras_card_config_destroy(alsa_card->config);
+	if (alsa_card->handle)
+		snd_ctl_close(alsa_card->handle);
+	free(alsa_card->card_name);
 	free(alsa_card);
 }
 
@@ -34,6 +34,43 @@ struct cras_alsa_card *cras_alsa_card_create(
 	struct cras_alsa_card_info *info, const char *device_config_dir,
 	struct cras_device_blocklist *blocklist, const char *ucm_suffix);
 
+/* Creating a card is split in two steps so that several cards can be
+ * probed in parallel: cras_alsa_card_probe() opens the card and sets up its
+ * config, UCM and mixer, which takes most of the time and uses nothing that
+ * belongs to the main thread. cras_alsa_card_add_devices() then creates the
+ * devices and jacks of the card and adds them to the system on the main
+ * thread. cras_alsa_card_create() does both.
+ */
+
+/* Probes a card, can be called from any thread.
+ * Args:
+ *    card_info - Contains the card index, type, and priority.
+ *    device_config_dir - The directory of device configs which contains the
+ *                        volume curves.
+ *    ucm_suffix - The ucm config name is formed as <card-name>.<suffix>
+ * Returns:
+ *    A pointer to the card, to be passed to cras_alsa_card_add_devices() or
+ *    freed with cras_alsa_card_destroy(), or NULL on error.
+ */
+struct cras_alsa_card *
+cras_alsa_card_probe(const struct cras_alsa_card_info *info,
+		     const char *device_config_dir, const char *ucm_suffix);
+
+/* Enumerates the devices of a probed card and adds them to the system as
+ * possible playback or capture endpoints. Must be called once, from the main
+ * thread.
+ * Args:
+ *    alsa_card - The card returned from cras_alsa_card_probe().
+ *    card_info - The info the card was probed with.
+ *    blocklist - List of devices that should be ignored.
+ * Returns:
+ *    0 on success, or a negative error code, the card must still be freed
+ *    with cras_alsa_card_destroy() then.
+ */
+int cras_alsa_card_add_devices(struct cras_alsa_card *alsa_card,
+			       struct cras_alsa_card_info *info,
+			       struct cras_device_blocklist *blocklist);
+
 /* Destroys a cras_alsa_card that was returned from cras_alsa_card_create.
  * Args:
  *    alsa_card - The cras_alsa_card pointer returned from
@@ -240,6 +240,21 @@ int cras_alsa_pcm_drain(snd_pcm_t *handle)
 	return snd_pcm_drain(handle);
 }
 
+int cras_alsa_pcm_pause(snd_pcm_t *handle, int enable)
+{
+	return snd_pcm_pause(handle, enable);
+}
+
+int cras_alsa_pcm_drop(snd_pcm_t *handle)
+{
+	int rc;
+
+	rc = snd_pcm_drop(handle);
+	if (rc < 0)
+		return rc;
+	return snd_pcm_prepare(handle);
+}
+
 int cras_alsa_resume_appl_ptr(snd_pcm_t *handle, snd_pcm_uframes_t ahead)
 {
 	int rc;
@@ -446,7 +461,8 @@ int cras_alsa_fill_properties(snd_pcm_t *handle, size_t **rates,
 
 int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 			   snd_pcm_uframes_t *buffer_frames, int period_wakeup,
-			   unsigned int dma_period_time)
+			   unsigned int dma_period_time,
+			   unsigned int align_frames)
 {
 	unsigned int rate, ret_rate;
 	int err;
@@ -488,6 +504,15 @@ int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 		int dir = 0;
 		unsigned int original = dma_period_time;
 
+		if (align_frames) {
+			unsigned int align_us = (uint64_t)align_frames *
+						1000000 / rate;
+
+			if (dma_period_time > align_us)
+				dma_period_time -= dma_period_time % align_us;
+			else
+				dma_period_time = align_us;
+		}
 		err = snd_pcm_hw_params_set_period_time_near(
 			handle, hwparams, &dma_period_time, &dir);
 		if (err < 0) {
@@ -527,12 +552,17 @@ int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 	}
 
 	/* Make sure buffer frames is even, or snd_pcm_hw_params will
-	 * return invalid argument error. */
+	 * return invalid argument error. Then a multiple of align_frames, kept
+	 * even. */
 	err = snd_pcm_hw_params_get_buffer_size_max(hwparams, buffer_frames);
 	if (err < 0)
 		syslog(LOG_WARNING, "get buffer max %s\n", snd_strerror(err));
 
+	if (align_frames % 2)
+		align_frames *= 2;
 	*buffer_frames &= ~0x01;
+	if (align_frames && *buffer_frames >= align_frames)
+		*buffer_frames -= *buffer_frames % align_frames;
 	err = snd_pcm_hw_params_set_buffer_size_max(handle, hwparams,
 						    buffer_frames);
 	if (err < 0) {
@@ -556,7 +586,7 @@ int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 	return 0;
 }
 
-int cras_alsa_set_swparams(snd_pcm_t *handle)
+int cras_alsa_set_swparams(snd_pcm_t *handle, int *enable_htimestamp)
 {
 	int err;
 	snd_pcm_sw_params_t *swparams;
@@ -593,6 +623,24 @@ int cras_alsa_set_swparams(snd_pcm_t *handle)
 		return err;
 	}
 
+	if (*enable_htimestamp) {
+		/* Timestamp the hardware pointer updates with the clock the
+		 * rest of the server uses. */
+		err = snd_pcm_sw_params_set_tstamp_mode(handle, swparams,
+							SND_PCM_TSTAMP_ENABLE);
+		if (err >= 0)
+			err = snd_pcm_sw_params_set_tstamp_type(
+				handle, swparams,
+				SND_PCM_TSTAMP_TYPE_MONOTONIC_RAW);
+		if (err < 0) {
+			syslog(LOG_WARNING, "Can't enable htimestamp: %s\n",
+			       snd_strerror(err));
+			snd_pcm_sw_params_set_tstamp_mode(
+				handle, swparams, SND_PCM_TSTAMP_NONE);
+			*enable_htimestamp = 0;
+		}
+	}
+
 	err = snd_pcm_sw_params(handle, swparams);
 
 	if (err < 0) {
@@ -605,6 +653,7 @@ int cras_alsa_set_swparams(snd_pcm_t *handle)
 int cras_alsa_get_avail_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
 			       snd_pcm_uframes_t severe_underrun_frames,
 			       const char *dev_name, snd_pcm_uframes_t *avail,
+			       snd_pcm_sframes_t *delay,
 			       struct timespec *tstamp)
 {
 	snd_pcm_sframes_t frames;
@@ -614,13 +663,19 @@ int cras_alsa_get_avail_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
 
 	/* Use snd_pcm_avail still to ensure that the hardware pointer is
 	 * up to date. Otherwise, we could use the deprecated snd_pcm_hwsync().
-	 * IMO this is a deficiency in the ALSA API.
+	 * IMO this is a deficiency in the ALSA API. When the delay is wanted
+	 * too, snd_pcm_avail_delay() gets both from a single sync.
 	 */
-	frames = snd_pcm_avail(handle);
-	if (frames >= 0)
+	if (delay) {
+		rc = snd_pcm_avail_delay(handle, &frames, delay);
+		if (rc < 0)
+			frames = rc;
+	} else {
+		frames = snd_pcm_avail(handle);
+	}
+	rc = frames < 0 ? frames : 0;
+	if (rc == 0 && tstamp)
 		rc = snd_pcm_htimestamp(handle, avail, tstamp);
-	else
-		rc = frames;
 	if (rc == -EPIPE || rc == -ESTRPIPE) {
 		cras_alsa_attempt_resume(handle);
 		rc = 0;
@@ -651,12 +706,20 @@ int cras_alsa_get_avail_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
 		}
 	}
 	*avail = frames;
+	if (delay && *delay > (snd_pcm_sframes_t)buf_size)
+		*delay = buf_size;
+	if (delay && *delay < 0)
+		*delay = 0;
 	return 0;
 
 error:
 	*avail = 0;
-	tstamp->tv_sec = 0;
-	tstamp->tv_nsec = 0;
+	if (delay)
+		*delay = 0;
+	if (tstamp) {
+		tstamp->tv_sec = 0;
+		tstamp->tv_nsec = 0;
+	}
 	return rc;
 }
 
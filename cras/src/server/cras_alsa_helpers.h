@@ -70,6 +70,25 @@ int cras_alsa_pcm_start(snd_pcm_t *handle);
  */
 int cras_alsa_pcm_drain(snd_pcm_t *handle);
 
+/* Pauses or resumes an alsa device, thin wrapper to snd_pcm_pause.
+ * Args:
+ *    handle - Filled with a pointer to the opened pcm.
+ *    enable - 1 to pause, 0 to resume.
+ * Returns:
+ *    See docs for snd_pcm_pause. Fails with -ENOSYS if the hardware can't
+ *    pause.
+ */
+int cras_alsa_pcm_pause(snd_pcm_t *handle, int enable);
+
+/* Stops an alsa device, dropping the frames in its buffer, and prepares it
+ * so it can be filled and started again.
+ * Args:
+ *    handle - Filled with a pointer to the opened pcm.
+ * Returns:
+ *    0 on success, otherwise a negative error code.
+ */
+int cras_alsa_pcm_drop(snd_pcm_t *handle);
+
 /* Forward/rewind appl_ptr so it becomes ahead of hw_ptr by fuzz samples.
  * After moving appl_ptr, device can play the new samples as quick as possible.
  *    avail = buffer_frames - appl_ptr + hw_ptr
@@ -125,20 +144,29 @@ int cras_alsa_fill_properties(snd_pcm_t *handle, size_t **rates,
  *                      0 - disable, 1 - enable
  *    dma_period_time - If non-zero, set the dma period time to this value
  *                      (in microseconds).
+ *    align_frames - If non-zero, the buffer size and dma period time are
+ *                   rounded down to multiples of this many frames, e.g. the
+ *                   frames in a whole number of USB packets.
  * Returns:
  *    0 on success, negative error on failure.
  */
 int cras_alsa_set_hwparams(snd_pcm_t *handle, struct cras_audio_format *format,
 			   snd_pcm_uframes_t *buffer_frames, int period_wakeup,
-			   unsigned int dma_period_time);
+			   unsigned int dma_period_time,
+			   unsigned int align_frames);
 
 /* Sets up the swparams to alsa.
  * Args:
  *    handle - The open PCM to configure.
+ *    enable_htimestamp - If non-zero on entry, the PCM is set to take a
+ *                        CLOCK_MONOTONIC_RAW timestamp each time its
+ *                        hardware pointer is updated, for
+ *                        cras_alsa_get_avail_frames() to return. Cleared if
+ *                        the PCM can't do that.
  * Returns:
  *    0 on success, negative error on failure.
  */
-int cras_alsa_set_swparams(snd_pcm_t *handle);
+int cras_alsa_set_swparams(snd_pcm_t *handle, int *enable_htimestamp);
 
 /* Get the number of used frames in the alsa buffer.
  *
@@ -152,9 +180,14 @@ int cras_alsa_set_swparams(snd_pcm_t *handle);
  *                                 underrun.
  *    dev_name[in] - Device name for logging.
  *    avail[out] - Filled with the number of frames available in the buffer.
- *    tstamp[out] - Filled with the hardware timestamp for the available frames.
- *                  This value is {0, 0} when the device hasn't actually started
- *                  reading or writing frames.
+ *    delay[out] - If not NULL, filled with the delay frames as
+ *                 cras_alsa_get_delay_frames() does, from the same update
+ *                 of the hardware pointer as avail.
+ *    tstamp[out] - If not NULL, filled with the hardware timestamp for the
+ *                  available frames. This value is {0, 0} when the device
+ *                  hasn't actually started reading or writing frames. Leave
+ *                  it NULL when not needed, reading it can take more kernel
+ *                  round trips.
  * Returns:
  *    0 on success, negative error on failure. -EPIPE if severe underrun
  *    happens.
@@ -162,6 +195,7 @@ int cras_alsa_set_swparams(snd_pcm_t *handle);
 int cras_alsa_get_avail_frames(snd_pcm_t *handle, snd_pcm_uframes_t buf_size,
 			       snd_pcm_uframes_t severe_underrun_frames,
 			       const char *dev_name, snd_pcm_uframes_t *avail,
+			       snd_pcm_sframes_t *delay,
 			       struct timespec *tstamp);
 
 /* Get the current alsa delay, make sure it's no bigger than the buffer size.
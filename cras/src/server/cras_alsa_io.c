@@ -11,16 +11,20 @@
 #include <sys/select.h>
 #include <sys/socket.h>
 #include <sys/time.h>
+#include <sys/utsname.h>
 #include <syslog.h>
 #include <time.h>
 
 #include "audio_thread.h"
+#include "cras_alsa_caps_cache.h"
 #include "cras_alsa_helpers.h"
 #include "cras_alsa_io.h"
 #include "cras_alsa_jack.h"
 #include "cras_alsa_mixer.h"
+#include "cras_alsa_sof.h"
 #include "cras_alsa_ucm.h"
 #include "cras_audio_area.h"
+#include "cras_checksum.h"
 #include "cras_config.h"
 #include "cras_utf8.h"
 #include "cras_hotword_handler.h"
@@ -67,6 +71,17 @@
  */
 #define SEVERE_UNDERRUN_MS 5000
 
+/*
+ * An output node that underruns has its minimum buffer level raised by
+ * BUFFER_LEVEL_STEP_MS, twice that for a severe underrun, up to
+ * BUFFER_LEVEL_MAX_EXTRA_MS above what the device asks for. After each
+ * BUFFER_LEVEL_STABLE_SECS of playing without underruns it's lowered by a
+ * step again. The level is kept with the node across opens of the device.
+ */
+#define BUFFER_LEVEL_STEP_MS 5
+#define BUFFER_LEVEL_MAX_EXTRA_MS 40
+#define BUFFER_LEVEL_STABLE_SECS 60
+
 /*
  * When entering no stream state, audio thread needs to fill extra zeros in
  * order to play remaining valid frames. The value indicates how many
@@ -76,6 +91,29 @@ static const struct timespec no_stream_fill_zeros_duration = {
 	0, 50 * 1000 * 1000 /* 50 msec. */
 };
 
+/*
+ * The delay read by frames_queued is given to delay_frames when it's asked
+ * for within this time, which is the case in the same audio thread wake.
+ * Later the hardware has moved enough to read it again.
+ */
+static const struct timespec delay_snapshot_max_age = {
+	0, 1000 * 1000 /* 1 msec. */
+};
+
+/*
+ * What an output without streams does with the hardware once the buffer
+ * holds only zeros.
+ * ALSA_IDLE_RUNNING - The hardware keeps playing the zeros.
+ * ALSA_IDLE_PAUSED - The hardware is paused with snd_pcm_pause.
+ * ALSA_IDLE_STOPPED - The hardware can't pause, so it's stopped and has to
+ *                     be filled again before it restarts.
+ */
+enum alsa_idle_state {
+	ALSA_IDLE_RUNNING,
+	ALSA_IDLE_PAUSED,
+	ALSA_IDLE_STOPPED,
+};
+
 /*
  * This extends cras_ionode to include alsa-specific information.
  * Members:
@@ -83,6 +121,8 @@ static const struct timespec no_stream_fill_zeros_duration = {
  *    pcm_name - PCM name for snd_pcm_open.
  *    volume_curve - Volume curve for this node.
  *    jack - The jack associated with the node.
+ *    extra_buffer_ms - How much the minimum buffer level is raised for the
+ *                      node after underruns.
  */
 struct alsa_output_node {
 	struct cras_ionode base;
@@ -90,6 +130,25 @@ struct alsa_output_node {
 	const char *pcm_name;
 	struct cras_volume_curve *volume_curve;
 	const struct cras_alsa_jack *jack;
+	unsigned int extra_buffer_ms;
+};
+
+/* The most displays an HDMI device remembers the capabilities of. */
+#define MAX_KNOWN_DISPLAYS 4
+
+/*
+ * The capabilities of an HDMI device with a display it has seen, which depend
+ * on the display as much as on the device.
+ * Members:
+ *    checksum - Of the ELD or EDID of the display, 0 if the slot is unused.
+ *    rates, channel_counts, formats - Zero terminated, as the PCM reported
+ *                                     them.
+ */
+struct known_display {
+	uint32_t checksum;
+	size_t *rates;
+	size_t *channel_counts;
+	snd_pcm_format_t *formats;
 };
 
 struct alsa_input_node {
@@ -106,6 +165,12 @@ struct alsa_input_node {
  * pcm_name - The PCM name passed to snd_pcm_open() (e.g. "hw:0,0").
  * dev_name - value from snd_pcm_info_get_name
  * dev_id - value from snd_pcm_info_get_id
+ * card_name - The name of the card, keys the capability cache.
+ * caps_checksum - Checksum of what the capabilities of the PCM depend on,
+ *                 stored with its capability cache entry.
+ * display_checksum - Of the display on the HDMI jack, 0 while none is.
+ * known_displays - Capabilities with the displays seen last, the most
+ *                  recent first.
  * device_index - ALSA index of device, Y in "hw:X:Y".
  * next_ionode_index - The index we will give to the next ionode. Each ionode
  *     have a unique index within the iodev.
@@ -132,16 +197,34 @@ struct alsa_input_node {
  *                with zeros. In this state, appl_ptr remains the same
  *                while hw_ptr keeps running ahead.
  * filled_zeros_for_draining - The number of zeros filled for draining.
+ * no_stream_ts - When the device last ran out of streams, zero while it has
+ *                streams.
+ * idle_state - Whether the hardware is paused or stopped in free run.
  * severe_underrun_frames - The threshold for severe underrun.
  * default_volume_curve - Default volume curve that converts from an index
  *                        to dBFS.
  * has_dependent_dev - true if this iodev has dependent device.
+ * delay_snapshot - The delay read along with the avail frames by the last
+ *                  frames_queued(), kept up to date by put_buffer().
+ * delay_snapshot_ts - When delay_snapshot was read.
+ * delay_snapshot_valid - true if delay_frames() can return delay_snapshot
+ *                        instead of asking the kernel again.
+ * enable_htimestamp - true if frames_queued() returns the time the kernel
+ *                     last updated the hardware pointer.
+ * base_min_buffer_level - The minimum buffer level of the device before
+ *                         the active node raises it after underruns.
+ * buffer_level_stable_ts - Since when the buffer level hasn't changed for an
+ *                          underrun or for playing without one.
  */
 struct alsa_io {
 	struct cras_iodev base;
 	char *pcm_name;
 	char *dev_name;
 	char *dev_id;
+	char *card_name;
+	uint32_t caps_checksum;
+	uint32_t display_checksum;
+	struct known_display known_displays[MAX_KNOWN_DISPLAYS];
 	uint32_t device_index;
 	uint32_t next_ionode_index;
 	enum CRAS_ALSA_CARD_TYPE card_type;
@@ -154,15 +237,24 @@ struct alsa_io {
 	const struct cras_card_config *config;
 	struct cras_alsa_jack_list *jack_list;
 	struct cras_use_case_mgr *ucm;
+	snd_hctl_t *hctl;
 	snd_pcm_uframes_t mmap_offset;
 	int poll_fd;
 	unsigned int dma_period_set_microsecs;
 	int free_running;
 	unsigned int filled_zeros_for_draining;
+	struct timespec no_stream_ts;
+	enum alsa_idle_state idle_state;
 	snd_pcm_uframes_t severe_underrun_frames;
 	struct cras_volume_curve *default_volume_curve;
 	int hwparams_set;
 	int has_dependent_dev;
+	snd_pcm_sframes_t delay_snapshot;
+	struct timespec delay_snapshot_ts;
+	int delay_snapshot_valid;
+	int enable_htimestamp;
+	unsigned int base_min_buffer_level;
+	struct timespec buffer_level_stable_ts;
 };
 
 static void init_device_settings(struct alsa_io *aio);
@@ -173,7 +265,7 @@ static int alsa_iodev_set_active_node(struct cras_iodev *iodev,
 
 static int get_fixed_rate(struct alsa_io *aio);
 
-static int update_supported_formats(struct cras_iodev *iodev);
+static int fill_supported_formats(struct alsa_io *aio, int use_cache);
 
 /*
  * Defines the default values of nodes.
@@ -285,9 +377,24 @@ static const struct {
 	},
 };
 
+/* Returns the frames in the shortest whole number of 1ms USB isochronous
+ * packets at rate, e.g. 48 at 48kHz or 441, ten packets, at 44.1kHz. */
+static unsigned int usb_packet_align_frames(unsigned int rate)
+{
+	unsigned int a = rate, b = 1000, t;
+
+	while (b) {
+		t = a % b;
+		a = b;
+		b = t;
+	}
+	return a ? rate / a : 0;
+}
+
 static int set_hwparams(struct cras_iodev *iodev)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
+	unsigned int align_frames = 0;
 	int period_wakeup;
 	int rc;
 
@@ -298,18 +405,93 @@ static int set_hwparams(struct cras_iodev *iodev)
 	/* If it's a wake on voice device, period_wakeups are required. */
 	period_wakeup = (iodev->active_node->type == CRAS_NODE_TYPE_HOTWORD);
 
+	/* The hardware pointer of a USB device moves a packet at a time. Keep
+	 * the buffer and period to whole packets, and sleeps to whole moves. */
+	if (aio->card_type == ALSA_CARD_TYPE_USB)
+		align_frames =
+			usb_packet_align_frames(iodev->format->frame_rate);
+
 	/* Sets frame rate and channel count to alsa device before
 	 * we test channel mapping. */
 	rc = cras_alsa_set_hwparams(aio->handle, iodev->format,
 				    &iodev->buffer_size, period_wakeup,
-				    aio->dma_period_set_microsecs);
+				    aio->dma_period_set_microsecs,
+				    align_frames);
 	if (rc < 0)
 		return rc;
 
+	if (align_frames) {
+		iodev->hw_ptr_granularity =
+			(iodev->format->frame_rate + 999) / 1000;
+		syslog(LOG_DEBUG, "%s: hw pointer granularity %u frames",
+		       iodev->info.name, iodev->hw_ptr_granularity);
+	}
+
 	aio->hwparams_set = 1;
 	return 0;
 }
 
+/* Returns the node whose buffer level adapts to underruns, NULL for
+ * inputs. */
+static struct alsa_output_node *buffer_level_node(const struct alsa_io *aio)
+{
+	if (aio->base.direction != CRAS_STREAM_OUTPUT)
+		return NULL;
+	return (struct alsa_output_node *)aio->base.active_node;
+}
+
+/* Sets the minimum buffer level to the one of the device plus what the
+ * active node has added after underruns, leaving at least half the buffer
+ * for the streams. */
+static void apply_buffer_level(struct alsa_io *aio)
+{
+	struct cras_iodev *iodev = &aio->base;
+	struct alsa_output_node *aout = buffer_level_node(aio);
+	unsigned int level = aio->base_min_buffer_level;
+
+	if (!aout || !iodev->format)
+		return;
+	level += aout->extra_buffer_ms * iodev->format->frame_rate / 1000;
+	if (level > iodev->buffer_size / 2)
+		level = MAX(iodev->buffer_size / 2, aio->base_min_buffer_level);
+	iodev->min_buffer_level = level;
+}
+
+/* Raises the buffer level of the active node after an underrun. */
+static void raise_buffer_level(struct alsa_io *aio, unsigned int steps)
+{
+	struct alsa_output_node *aout = buffer_level_node(aio);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &aio->buffer_level_stable_ts);
+	if (!aout || aout->extra_buffer_ms >= BUFFER_LEVEL_MAX_EXTRA_MS)
+		return;
+	aout->extra_buffer_ms = MIN(aout->extra_buffer_ms +
+					    steps * BUFFER_LEVEL_STEP_MS,
+				    BUFFER_LEVEL_MAX_EXTRA_MS);
+	apply_buffer_level(aio);
+	syslog(LOG_INFO, "%s underran, raising its buffer level to %u frames",
+	       aio->base.info.name, aio->base.min_buffer_level);
+}
+
+/* Lowers the buffer level of the active node by a step for each
+ * BUFFER_LEVEL_STABLE_SECS it plays without underruns. */
+static void lower_buffer_level_if_stable(struct alsa_io *aio,
+					 const struct timespec *now)
+{
+	struct alsa_output_node *aout = buffer_level_node(aio);
+	struct timespec stable;
+
+	if (!aout || !aout->extra_buffer_ms || aio->free_running)
+		return;
+	subtract_timespecs(now, &aio->buffer_level_stable_ts, &stable);
+	if (stable.tv_sec < BUFFER_LEVEL_STABLE_SECS)
+		return;
+	aout->extra_buffer_ms -= MIN(aout->extra_buffer_ms,
+				     BUFFER_LEVEL_STEP_MS);
+	aio->buffer_level_stable_ts = *now;
+	apply_buffer_level(aio);
+}
+
 /*
  * iodev callbacks.
  */
@@ -318,18 +500,35 @@ static int frames_queued(const struct cras_iodev *iodev,
 			 struct timespec *tstamp)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
+	struct timespec hw_tstamp;
 	int rc;
 	snd_pcm_uframes_t frames;
 
-	rc = cras_alsa_get_avail_frames(aio->handle, aio->base.buffer_size,
-					aio->severe_underrun_frames,
-					iodev->info.name, &frames, tstamp);
+	/* The delay comes with the same sync of the hardware pointer, so
+	 * delay_frames on this wake doesn't need another one. Unless it's
+	 * enabled, the hardware timestamp isn't read as it's replaced with the
+	 * time now. */
+	aio->delay_snapshot_valid = 0;
+	rc = cras_alsa_get_avail_frames(
+		aio->handle, aio->base.buffer_size, aio->severe_underrun_frames,
+		iodev->info.name, &frames, &aio->delay_snapshot,
+		aio->enable_htimestamp ? &hw_tstamp : NULL);
 	if (rc < 0) {
-		if (rc == -EPIPE)
+		if (rc == -EPIPE) {
 			aio->num_severe_underruns++;
+			raise_buffer_level(aio, 2);
+		}
 		return rc;
 	}
 	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	aio->delay_snapshot_ts = *tstamp;
+	aio->delay_snapshot_valid = 1;
+	lower_buffer_level_if_stable(aio, &aio->delay_snapshot_ts);
+	/* The kernel timestamps the level when it updates the hardware
+	 * pointer, so the time doesn't depend on when the audio thread woke
+	 * up. It's zero until the device has started. */
+	if (aio->enable_htimestamp && timespec_is_nonzero(&hw_tstamp))
+		*tstamp = hw_tstamp;
 	if (iodev->direction == CRAS_STREAM_INPUT)
 		return (int)frames;
 
@@ -341,8 +540,17 @@ static int delay_frames(const struct cras_iodev *iodev)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
 	snd_pcm_sframes_t delay;
+	struct timespec now, age;
 	int rc;
 
+	if (aio->delay_snapshot_valid) {
+		aio->delay_snapshot_valid = 0;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		subtract_timespecs(&now, &aio->delay_snapshot_ts, &age);
+		if (!timespec_after(&age, &delay_snapshot_max_age))
+			return (int)aio->delay_snapshot;
+	}
+
 	rc = cras_alsa_get_delay_frames(aio->handle, iodev->buffer_size,
 					&delay);
 	if (rc < 0)
@@ -363,14 +571,173 @@ static int close_dev(struct cras_iodev *iodev)
 		return 0;
 	cras_alsa_pcm_close(aio->handle);
 	aio->handle = NULL;
+	aio->delay_snapshot_valid = 0;
 	aio->free_running = 0;
 	aio->filled_zeros_for_draining = 0;
+	aio->no_stream_ts.tv_sec = 0;
+	aio->no_stream_ts.tv_nsec = 0;
+	aio->idle_state = ALSA_IDLE_RUNNING;
 	aio->hwparams_set = 0;
 	cras_iodev_free_format(&aio->base);
 	cras_iodev_free_audio_area(&aio->base);
 	return 0;
 }
 
+/* Returns the name of the PCM the active node plays or records through. */
+static const char *get_active_pcm_name(const struct alsa_io *aio)
+{
+	const char *pcm_name = NULL;
+
+	if (aio->base.direction == CRAS_STREAM_OUTPUT) {
+		struct alsa_output_node *aout =
+			(struct alsa_output_node *)aio->base.active_node;
+		pcm_name = aout->pcm_name;
+	} else {
+		struct alsa_input_node *ain =
+			(struct alsa_input_node *)aio->base.active_node;
+		pcm_name = ain->pcm_name;
+	}
+
+	/* For legacy UCM path which doesn't have PlaybackPCM or CapturePCM. */
+	if (pcm_name == NULL)
+		pcm_name = aio->pcm_name;
+	return pcm_name;
+}
+
+/*
+ * The capability cache is keyed by card and device, so it only stands for
+ * the PCM of the device itself, not for one UCM points a node to instead.
+ */
+static int alsa_caps_cacheable(const struct alsa_io *aio)
+{
+	if (!aio->card_name || !aio->base.active_node)
+		return 0;
+	return strcmp(get_active_pcm_name(aio), aio->pcm_name) == 0;
+}
+
+/*
+ * The checksum of the capability cache entry. The capabilities of an HDMI
+ * PCM follow the display, so a different one mustn't match the entry.
+ */
+static uint32_t alsa_caps_checksum(const struct alsa_io *aio)
+{
+	uint32_t sums[2] = { aio->caps_checksum, aio->display_checksum };
+
+	if (!aio->display_checksum)
+		return aio->caps_checksum;
+	return crc32_checksum((const unsigned char *)sums, sizeof(sums));
+}
+
+static void known_display_clear(struct known_display *display)
+{
+	free(display->rates);
+	free(display->channel_counts);
+	free(display->formats);
+	memset(display, 0, sizeof(*display));
+}
+
+/* Finds the display connected to the device among the known ones, and
+ * makes it the most recent. Returns NULL if it isn't known. */
+static struct known_display *known_display_get(struct alsa_io *aio)
+{
+	struct known_display found;
+	int i;
+
+	if (!aio->display_checksum)
+		return NULL;
+	for (i = 0; i < MAX_KNOWN_DISPLAYS; i++) {
+		if (aio->known_displays[i].checksum == aio->display_checksum)
+			break;
+	}
+	if (i == MAX_KNOWN_DISPLAYS)
+		return NULL;
+
+	found = aio->known_displays[i];
+	memmove(&aio->known_displays[1], &aio->known_displays[0],
+		i * sizeof(found));
+	aio->known_displays[0] = found;
+	return &aio->known_displays[0];
+}
+
+/* Copies zero terminated capability arrays. The copies are left NULL if one
+ * of them can't be allocated. */
+static int copy_caps(const size_t *rates, const size_t *channel_counts,
+		     const snd_pcm_format_t *formats, size_t **rates_copy,
+		     size_t **channel_counts_copy,
+		     snd_pcm_format_t **formats_copy)
+{
+	size_t nr = 0, nc = 0, nf = 0;
+
+	while (rates[nr])
+		nr++;
+	while (channel_counts[nc])
+		nc++;
+	while (formats[nf])
+		nf++;
+
+	*rates_copy = (size_t *)calloc(nr + 1, sizeof(*rates));
+	*channel_counts_copy =
+		(size_t *)calloc(nc + 1, sizeof(*channel_counts));
+	*formats_copy = (snd_pcm_format_t *)calloc(nf + 1, sizeof(*formats));
+	if (!*rates_copy || !*channel_counts_copy || !*formats_copy) {
+		free(*rates_copy);
+		free(*channel_counts_copy);
+		free(*formats_copy);
+		*rates_copy = NULL;
+		*channel_counts_copy = NULL;
+		*formats_copy = NULL;
+		return -ENOMEM;
+	}
+	memcpy(*rates_copy, rates, nr * sizeof(*rates));
+	memcpy(*channel_counts_copy, channel_counts,
+	       nc * sizeof(*channel_counts));
+	memcpy(*formats_copy, formats, nf * sizeof(*formats));
+	return 0;
+}
+
+/* Remembers the capabilities of the device with the display connected to
+ * it, in place of the least recent display if all slots are used. */
+static void known_display_put(struct alsa_io *aio)
+{
+	struct cras_iodev *iodev = &aio->base;
+	struct known_display *display;
+
+	display = known_display_get(aio);
+	if (!display) {
+		/* The least recent display makes room. */
+		display = &aio->known_displays[MAX_KNOWN_DISPLAYS - 1];
+		known_display_clear(display);
+		memmove(&aio->known_displays[1], &aio->known_displays[0],
+			(MAX_KNOWN_DISPLAYS - 1) * sizeof(*display));
+		display = &aio->known_displays[0];
+		memset(display, 0, sizeof(*display));
+	}
+	known_display_clear(display);
+	if (copy_caps(iodev->supported_rates, iodev->supported_channel_counts,
+		      iodev->supported_formats, &display->rates,
+		      &display->channel_counts, &display->formats))
+		return;
+	display->checksum = aio->display_checksum;
+}
+
+/* Returns true if the capabilities of the device are in the cache. */
+static int alsa_caps_cached(struct alsa_io *aio)
+{
+	size_t *rates, *channel_counts;
+	snd_pcm_format_t *formats;
+
+	if (known_display_get(aio))
+		return 1;
+	if (cras_alsa_caps_cache_get(aio->card_name, aio->device_index,
+				     aio->alsa_stream, alsa_caps_checksum(aio),
+				     &rates, &channel_counts, &formats))
+		return 0;
+	free(rates);
+	free(channel_counts);
+	free(formats);
+	return 1;
+}
+
 static int empty_hotword_cb(void *arg, int revents)
 {
 	/* Only need this once. */
@@ -390,24 +757,10 @@ static int open_dev(struct cras_iodev *iodev)
 	struct alsa_io *aio = (struct alsa_io *)iodev;
 	snd_pcm_t *handle;
 	int rc;
-	const char *pcm_name = NULL;
 	int enable_noise_cancellation;
 
-	if (aio->base.direction == CRAS_STREAM_OUTPUT) {
-		struct alsa_output_node *aout =
-			(struct alsa_output_node *)aio->base.active_node;
-		pcm_name = aout->pcm_name;
-	} else {
-		struct alsa_input_node *ain =
-			(struct alsa_input_node *)aio->base.active_node;
-		pcm_name = ain->pcm_name;
-	}
-
-	/* For legacy UCM path which doesn't have PlaybackPCM or CapturePCM. */
-	if (pcm_name == NULL)
-		pcm_name = aio->pcm_name;
-
-	rc = cras_alsa_pcm_open(&handle, pcm_name, aio->alsa_stream);
+	rc = cras_alsa_pcm_open(&handle, get_active_pcm_name(aio),
+				aio->alsa_stream);
 	if (rc < 0)
 		return rc;
 
@@ -441,6 +794,9 @@ static int configure_dev(struct cras_iodev *iodev)
 		return -EINVAL;
 	aio->free_running = 0;
 	aio->filled_zeros_for_draining = 0;
+	aio->no_stream_ts.tv_sec = 0;
+	aio->no_stream_ts.tv_nsec = 0;
+	aio->idle_state = ALSA_IDLE_RUNNING;
 	aio->severe_underrun_frames =
 		SEVERE_UNDERRUN_MS * iodev->format->frame_rate / 1000;
 
@@ -451,8 +807,17 @@ static int configure_dev(struct cras_iodev *iodev)
 	       iodev->format->num_channels);
 
 	rc = set_hwparams(iodev);
-	if (rc < 0)
+	if (rc < 0) {
+		/* Don't trust the cached capabilities on the next open. */
+		if (alsa_caps_cacheable(aio)) {
+			cras_alsa_caps_cache_remove(aio->card_name,
+						    aio->device_index,
+						    aio->alsa_stream);
+			if (known_display_get(aio))
+				known_display_clear(&aio->known_displays[0]);
+		}
 		return rc;
+	}
 
 	/* Set channel map to device */
 	rc = cras_alsa_set_channel_map(aio->handle, iodev->format);
@@ -460,13 +825,17 @@ static int configure_dev(struct cras_iodev *iodev)
 		return rc;
 
 	/* Configure software params. */
-	rc = cras_alsa_set_swparams(aio->handle);
+	aio->enable_htimestamp = cras_system_get_hw_timestamp_rate_est_enabled();
+	rc = cras_alsa_set_swparams(aio->handle, &aio->enable_htimestamp);
 	if (rc < 0)
 		return rc;
 
 	/* Initialize device settings. */
 	init_device_settings(aio);
 
+	apply_buffer_level(aio);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &aio->buffer_level_stable_ts);
+
 	aio->poll_fd = -1;
 	if (iodev->active_node->type == CRAS_NODE_TYPE_HOTWORD) {
 		struct pollfd *ufds;
@@ -579,6 +948,14 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
 {
 	struct alsa_io *aio = (struct alsa_io *)iodev;
+	snd_pcm_sframes_t *delay = &aio->delay_snapshot;
+
+	/* Moving appl_ptr changes the delay by as many frames. */
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		*delay = MIN(*delay + (snd_pcm_sframes_t)nwritten,
+			     (snd_pcm_sframes_t)iodev->buffer_size);
+	else
+		*delay = MAX(*delay - (snd_pcm_sframes_t)nwritten, 0);
 
 	return cras_alsa_mmap_commit(aio->handle, aio->mmap_offset, nwritten);
 }
@@ -588,6 +965,7 @@ static int flush_buffer(struct cras_iodev *iodev)
 	struct alsa_io *aio = (struct alsa_io *)iodev;
 	snd_pcm_uframes_t nframes;
 
+	aio->delay_snapshot_valid = 0;
 	if (iodev->direction == CRAS_STREAM_INPUT) {
 		nframes = snd_pcm_avail(aio->handle);
 		nframes = snd_pcm_forwardable(aio->handle);
@@ -844,6 +1222,11 @@ static int set_alsa_node_swapped(struct cras_iodev *iodev,
  */
 static void init_device_settings(struct alsa_io *aio)
 {
+	/* The UCM sequences run on open and node switch may have changed the
+	 * controls, so write all the settings out again. */
+	if (aio->mixer)
+		cras_alsa_mixer_invalidate_cache(aio->mixer);
+
 	/* Register for volume/mute callback and set initial volume/mute for
 	 * the device. */
 	if (aio->base.direction == CRAS_STREAM_OUTPUT) {
@@ -869,10 +1252,13 @@ static void free_alsa_iodev_resources(struct alsa_io *aio)
 	struct cras_ionode *node;
 	struct alsa_output_node *aout;
 	struct alsa_input_node *ain;
+	int i;
 
 	free(aio->base.supported_rates);
 	free(aio->base.supported_channel_counts);
 	free(aio->base.supported_formats);
+	for (i = 0; i < MAX_KNOWN_DISPLAYS; i++)
+		known_display_clear(&aio->known_displays[i]);
 
 	DL_FOREACH (aio->base.nodes, node) {
 		if (aio->base.direction == CRAS_STREAM_OUTPUT) {
@@ -895,6 +1281,7 @@ static void free_alsa_iodev_resources(struct alsa_io *aio)
 		free(aio->dev_id);
 	if (aio->dev_name)
 		free(aio->dev_name);
+	free(aio->card_name);
 }
 
 /*
@@ -1436,7 +1823,9 @@ static void update_max_supported_channels(struct cras_iodev *iodev)
 	unsigned int max_channels = 0;
 	size_t i;
 	bool active_node_predicted = false;
-	int rc;
+	int use_cache;
+	int pcm_opened = 0;
+	int rc = 0;
 
 	/*
 	 * max_supported_channels might be wrong in dependent PCM cases. Always
@@ -1470,13 +1859,18 @@ static void update_max_supported_channels(struct cras_iodev *iodev)
 		active_node_predicted = true;
 	}
 
-	rc = open_dev(iodev);
+	/* Capabilities cached by an earlier probe save opening the PCM. */
+	use_cache = alsa_caps_cacheable(aio);
+	if (!use_cache || !alsa_caps_cached(aio)) {
+		rc = open_dev(iodev);
+		pcm_opened = !rc;
+	}
 	if (active_node_predicted)
 		iodev->active_node = NULL; // Reset the predicted active_node.
 	if (rc)
 		goto update_info;
 
-	rc = update_supported_formats(iodev);
+	rc = fill_supported_formats(aio, use_cache);
 	if (rc)
 		goto close_iodev;
 
@@ -1486,7 +1880,8 @@ static void update_max_supported_channels(struct cras_iodev *iodev)
 	}
 
 close_iodev:
-	close_dev(iodev);
+	if (pcm_opened)
+		close_dev(iodev);
 
 update_info:
 	iodev->info.max_supported_channels = max_channels;
@@ -1543,8 +1938,15 @@ static void jack_output_plug_event(const struct cras_alsa_jack *jack,
 	syslog(LOG_DEBUG, "%s plugged: %d, %s", jack_name, plugged,
 	       cras_alsa_mixer_get_control_name(node->mixer_output));
 
+	/* Tells the capabilities of a display seen before from a new one. */
+	if (node->base.type == CRAS_NODE_TYPE_HDMI)
+		aio->display_checksum =
+			plugged ? cras_alsa_jack_display_checksum(jack) : 0;
+
 	cras_alsa_jack_update_monitor_name(jack, node->base.name,
 					   sizeof(node->base.name));
+	node->base.compressed_formats =
+		plugged ? cras_alsa_jack_compressed_formats(jack) : 0;
 
 #ifdef CRAS_DBUS
 	/* The name got from jack might be an invalid UTF8 string. */
@@ -1558,7 +1960,8 @@ static void jack_output_plug_event(const struct cras_alsa_jack *jack,
 
 	/*
 	 * For HDMI plug event cases, update max supported channels according
-	 * to the current active node.
+	 * to the current active node. That doesn't open the PCM for a display
+	 * plugged before.
 	 */
 	if (node->base.type == CRAS_NODE_TYPE_HDMI && plugged)
 		update_max_supported_channels(&aio->base);
@@ -1613,6 +2016,31 @@ static void jack_input_plug_event(const struct cras_alsa_jack *jack,
 	check_auto_unplug_input_node(aio, &node->base, plugged);
 }
 
+/*
+ * Computes the checksum stored with the cached capabilities of a device. It
+ * covers the names of the card and device and the USB ids, so a different
+ * device showing up as the same card doesn't get the capabilities of the
+ * old one, and the kernel release, which the drivers come with.
+ */
+static uint32_t caps_checksum(const char *card_name, const char *dev_name,
+			      const char *dev_id, size_t usb_vid,
+			      size_t usb_pid, const char *usb_serial_number)
+{
+	struct utsname uts;
+	char buf[1024];
+	int n;
+
+	if (uname(&uts))
+		uts.release[0] = '\0';
+	n = snprintf(buf, sizeof(buf), "%s|%s|%s|%zx:%zx|%s|%s",
+		     card_name ?: "", dev_name ?: "", dev_id ?: "", usb_vid,
+		     usb_pid, usb_serial_number ?: "", uts.release);
+	if (n < 0)
+		return 0;
+	return crc32_checksum((const unsigned char *)buf,
+			      MIN((size_t)n, sizeof(buf) - 1));
+}
+
 /*
  * Sets the name of the given iodev, using the name and index of the card
  * combined with the device index and direction.
@@ -1699,11 +2127,69 @@ static size_t get_fixed_channels(struct alsa_io *aio)
 }
 
 /*
- * Updates the supported sample rates and channel counts.
+ * Gets the sample rates, channel counts and formats of the PCM from the
+ * capability cache if use_cache is set and they are there. Otherwise probes
+ * the opened PCM, and caches what was found if use_cache is set. An HDMI
+ * device looks among the displays it knows before the cache file.
  */
-static int update_supported_formats(struct cras_iodev *iodev)
+static int fill_alsa_properties(struct alsa_io *aio, int use_cache)
 {
-	struct alsa_io *aio = (struct alsa_io *)iodev;
+	struct cras_iodev *iodev = &aio->base;
+	struct known_display *display;
+	int rc;
+
+	if (use_cache) {
+		display = known_display_get(aio);
+		if (display)
+			return copy_caps(display->rates,
+					 display->channel_counts,
+					 display->formats,
+					 &iodev->supported_rates,
+					 &iodev->supported_channel_counts,
+					 &iodev->supported_formats);
+	}
+
+	if (use_cache &&
+	    cras_alsa_caps_cache_get(aio->card_name, aio->device_index,
+				     aio->alsa_stream, alsa_caps_checksum(aio),
+				     &iodev->supported_rates,
+				     &iodev->supported_channel_counts,
+				     &iodev->supported_formats) == 0)
+		goto remember_display;
+
+	if (!aio->handle)
+		return -ENODEV;
+
+	rc = cras_alsa_fill_properties(aio->handle, &iodev->supported_rates,
+				       &iodev->supported_channel_counts,
+				       &iodev->supported_formats);
+	if (rc)
+		return rc;
+
+	if (use_cache) {
+		rc = cras_alsa_caps_cache_put(
+			aio->card_name, aio->device_index, aio->alsa_stream,
+			alsa_caps_checksum(aio), iodev->supported_rates,
+			iodev->supported_channel_counts,
+			iodev->supported_formats);
+		if (rc)
+			syslog(LOG_DEBUG, "Failed to cache caps of %s: %d",
+			       aio->pcm_name, rc);
+	}
+
+remember_display:
+	if (use_cache && aio->display_checksum)
+		known_display_put(aio);
+	return 0;
+}
+
+/*
+ * Updates the supported sample rates and channel counts, using the
+ * capability cache if use_cache is set.
+ */
+static int fill_supported_formats(struct alsa_io *aio, int use_cache)
+{
+	struct cras_iodev *iodev = &aio->base;
 	int err;
 	int fixed_rate;
 	size_t fixed_channels;
@@ -1715,9 +2201,7 @@ static int update_supported_formats(struct cras_iodev *iodev)
 	free(iodev->supported_formats);
 	iodev->supported_formats = NULL;
 
-	err = cras_alsa_fill_properties(aio->handle, &iodev->supported_rates,
-					&iodev->supported_channel_counts,
-					&iodev->supported_formats);
+	err = fill_alsa_properties(aio, use_cache);
 	if (err)
 		return err;
 
@@ -1745,6 +2229,13 @@ static int update_supported_formats(struct cras_iodev *iodev)
 	return 0;
 }
 
+static int update_supported_formats(struct cras_iodev *iodev)
+{
+	struct alsa_io *aio = (struct alsa_io *)iodev;
+
+	return fill_supported_formats(aio, alsa_caps_cacheable(aio));
+}
+
 /*
  * Builds software volume scalers for output nodes in the device.
  */
@@ -1819,6 +2310,7 @@ static int adjust_appl_ptr_for_leaving_free_run(struct cras_iodev *odev)
 	struct alsa_io *aio = (struct alsa_io *)odev;
 	snd_pcm_uframes_t ahead;
 
+	aio->delay_snapshot_valid = 0;
 	ahead = odev->min_buffer_level + odev->min_cb_level;
 	return cras_alsa_resume_appl_ptr(aio->handle, ahead);
 }
@@ -1832,6 +2324,7 @@ static int adjust_appl_ptr_for_underrun(struct cras_iodev *odev)
 	struct alsa_io *aio = (struct alsa_io *)odev;
 	snd_pcm_uframes_t ahead;
 
+	aio->delay_snapshot_valid = 0;
 	ahead = odev->min_buffer_level + odev->min_cb_level +
 		odev->min_cb_level / 2;
 	return cras_alsa_resume_appl_ptr(aio->handle, ahead);
@@ -1875,6 +2368,7 @@ static int adjust_appl_ptr_samples_remaining(struct cras_iodev *odev)
 		if (rc)
 			return rc;
 	}
+	aio->delay_snapshot_valid = 0;
 	return cras_alsa_resume_appl_ptr(aio->handle, offset);
 }
 
@@ -1882,6 +2376,9 @@ static int alsa_output_underrun(struct cras_iodev *odev)
 {
 	int rc;
 
+	/* Leave underrun with the raised level so it doesn't happen again. */
+	raise_buffer_level((struct alsa_io *)odev, 1);
+
 	/* Fill whole buffer with zeros. This avoids samples left in buffer causing
 	 * noise when device plays them. */
 	rc = fill_whole_buffer_with_zeros(odev);
@@ -1891,16 +2388,99 @@ static int alsa_output_underrun(struct cras_iodev *odev)
 	return adjust_appl_ptr_for_underrun(odev);
 }
 
+/* Returns true while an output without streams has to keep playing silence
+ * before it may be paused. */
+static int in_idle_grace_period(const struct alsa_io *aio)
+{
+	struct timespec now, idle;
+	int grace_ms = cras_system_get_idle_pause_ms();
+
+	if (grace_ms <= 0)
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &aio->no_stream_ts, &idle);
+	return timespec_to_ms(&idle) < (unsigned int)grace_ms;
+}
+
+/* Pauses the hardware of an output whose buffer holds only zeros, or stops
+ * it if it can't pause. If neither works it keeps playing the zeros. */
+static void pause_idle_output(struct alsa_io *aio)
+{
+	int rc;
+
+	rc = cras_alsa_pcm_pause(aio->handle, 1);
+	if (rc == 0) {
+		aio->idle_state = ALSA_IDLE_PAUSED;
+		return;
+	}
+	rc = cras_alsa_pcm_drop(aio->handle);
+	if (rc == 0) {
+		aio->idle_state = ALSA_IDLE_STOPPED;
+		return;
+	}
+	syslog(LOG_WARNING, "Failed to stop idle device %s: %s",
+	       aio->base.info.name, snd_strerror(rc));
+}
+
+/* Enters free run once the buffer holds only zeros. With the idle pause on,
+ * the hardware is paused too, so it stops fetching the zeros. */
+static void enter_free_run(struct alsa_io *aio)
+{
+	aio->free_running = 1;
+	if (cras_system_get_idle_pause_ms() >= 0)
+		pause_idle_output(aio);
+}
+
+/*
+ * Restarts the hardware paused or stopped in free run. The frames put ahead
+ * of hw_ptr are the same as when leaving free run with the hardware playing,
+ * so the start latency doesn't change.
+ */
+static int resume_idle_output(struct cras_iodev *odev)
+{
+	struct alsa_io *aio = (struct alsa_io *)odev;
+	enum alsa_idle_state idle_state = aio->idle_state;
+	int rc;
+
+	aio->idle_state = ALSA_IDLE_RUNNING;
+	if (idle_state == ALSA_IDLE_PAUSED) {
+		rc = cras_alsa_pcm_pause(aio->handle, 0);
+		if (rc == 0)
+			return adjust_appl_ptr_for_leaving_free_run(odev);
+
+		/* A suspend leaves the device suspended instead of paused,
+		 * start it over. */
+		syslog(LOG_INFO, "Failed to resume paused device %s: %s",
+		       odev->info.name, snd_strerror(rc));
+		rc = cras_alsa_pcm_drop(aio->handle);
+		if (rc < 0)
+			return rc;
+	}
+
+	aio->delay_snapshot_valid = 0;
+	rc = cras_iodev_fill_odev_zeros(
+		odev, odev->min_buffer_level + odev->min_cb_level);
+	if (rc)
+		return rc;
+	return cras_alsa_pcm_start(aio->handle);
+}
+
 static int possibly_enter_free_run(struct cras_iodev *odev)
 {
 	struct alsa_io *aio = (struct alsa_io *)odev;
 	int rc;
 	unsigned int real_hw_level, fr_to_write;
 	struct timespec hw_tstamp;
+	int in_grace;
 
 	if (aio->free_running)
 		return 0;
 
+	if (!timespec_is_nonzero(&aio->no_stream_ts))
+		clock_gettime(CLOCK_MONOTONIC_RAW, &aio->no_stream_ts);
+	in_grace = in_idle_grace_period(aio);
+
 	/* Check if all valid samples are played. If all valid samples are played,
 	 * fill whole buffer with zeros. The real_hw_level is the real hw_level in
 	 * device buffer. It doesn't subtract min_buffer_level.*/
@@ -1914,20 +2494,26 @@ static int possibly_enter_free_run(struct cras_iodev *odev)
 		rc = cras_iodev_output_underrun(odev, real_hw_level, 0);
 		if (rc < 0)
 			return rc;
-		aio->free_running = 1;
+		/* Within the grace period, keep filling zeros behind the ones
+		 * the underrun handling put in. */
+		if (in_grace)
+			aio->filled_zeros_for_draining = odev->buffer_size;
+		else
+			enter_free_run(aio);
 		return 0;
 	}
 
-	if (real_hw_level <= aio->filled_zeros_for_draining ||
-	    real_hw_level == 0) {
+	if (!in_grace && (real_hw_level <= aio->filled_zeros_for_draining ||
+			  real_hw_level == 0)) {
 		rc = fill_whole_buffer_with_zeros(odev);
 		if (rc < 0)
 			return rc;
-		aio->free_running = 1;
+		enter_free_run(aio);
 		return 0;
 	}
 
-	/* Fill zeros to drain valid samples. */
+	/* Fill zeros to drain valid samples, or to play silence until the
+	 * grace period ends. */
 	fr_to_write = MIN(cras_time_to_frames(&no_stream_fill_zeros_duration,
 					      odev->format->frame_rate),
 			  odev->buffer_size - real_hw_level);
@@ -1948,7 +2534,9 @@ static int leave_free_run(struct cras_iodev *odev)
 	 * be included. */
 	cras_iodev_reset_rate_estimator(odev);
 
-	if (aio->free_running)
+	if (aio->idle_state != ALSA_IDLE_RUNNING)
+		rc = resume_idle_output(odev);
+	else if (aio->free_running)
 		rc = adjust_appl_ptr_for_leaving_free_run(odev);
 	else
 		rc = adjust_appl_ptr_samples_remaining(odev);
@@ -1959,6 +2547,8 @@ static int leave_free_run(struct cras_iodev *odev)
 	}
 	aio->free_running = 0;
 	aio->filled_zeros_for_draining = 0;
+	aio->no_stream_ts.tv_sec = 0;
+	aio->no_stream_ts.tv_nsec = 0;
 
 	return 0;
 }
@@ -1968,6 +2558,9 @@ static int leave_free_run(struct cras_iodev *odev)
  * The whole buffer will be filled with zeros. Device can play these zeros
  * indefinitely. When there is new meaningful sample, appl_ptr should be
  * resumed to some distance ahead of hw_ptr.
+ * If the board sets an idle pause, the device plays silence for that long
+ * after its streams are gone and is then paused, or stopped if it can't
+ * pause, so the hardware doesn't keep fetching zeros.
  */
 static int no_stream(struct cras_iodev *odev, int enable)
 {
@@ -2046,6 +2639,16 @@ static int support_noise_cancellation(const struct cras_iodev *iodev)
 						  iodev->active_node->name);
 }
 
+static int load_dsp_firmware(struct cras_iodev *iodev,
+			     const struct plugin *plugin, int sample_rate,
+			     int bypass)
+{
+	struct alsa_io *aio = (struct alsa_io *)iodev;
+
+	return cras_alsa_sof_load_plugin(aio->hctl, plugin, sample_rate,
+					 bypass);
+}
+
 /*
  * Exported Interface.
  */
@@ -2093,6 +2696,13 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 	aio->pcm_name = strdup(pcm_name);
 	if (aio->pcm_name == NULL)
 		goto cleanup_iodev;
+	if (card_name) {
+		aio->card_name = strdup(card_name);
+		if (!aio->card_name)
+			goto cleanup_iodev;
+	}
+	aio->caps_checksum = caps_checksum(card_name, dev_name, dev_id,
+					   usb_vid, usb_pid, usb_serial_number);
 
 	if (direction == CRAS_STREAM_INPUT) {
 		aio->alsa_stream = SND_PCM_STREAM_CAPTURE;
@@ -2125,8 +2735,18 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 	iodev->set_swap_mode_for_node = cras_iodev_dsp_set_swap_mode_for_node;
 	iodev->support_noise_cancellation = support_noise_cancellation;
 
-	if (card_type == ALSA_CARD_TYPE_USB)
+	/* The DSP of internal cards may run plugins in its firmware. */
+	if (hctl && card_type == ALSA_CARD_TYPE_INTERNAL) {
+		aio->hctl = hctl;
+		iodev->load_dsp_firmware = load_dsp_firmware;
+	}
+
+	/* USB cards run on their own clock, the devices of one card are told
+	 * apart from other cards' by the card's mixer. */
+	if (card_type == ALSA_CARD_TYPE_USB) {
 		iodev->min_buffer_level = USB_EXTRA_BUFFER_FRAMES;
+		iodev->clock_domain = mixer;
+	}
 
 	iodev->ramp = cras_ramp_create();
 	if (iodev->ramp == NULL)
@@ -2158,6 +2778,7 @@ alsa_iodev_create(size_t card_index, const char *card_name, size_t device_index,
 		if (!rc && direction == CRAS_STREAM_OUTPUT)
 			iodev->min_buffer_level = level;
 	}
+	aio->base_min_buffer_level = iodev->min_buffer_level;
 
 	set_iodev_name(iodev, card_name, dev_name, card_index, device_index,
 		       card_type, usb_vid, usb_pid, usb_serial_number);
@@ -2307,6 +2928,10 @@ int alsa_iodev_ucm_add_nodes_and_jacks(struct cras_iodev *iodev,
 	if (!aio->dma_period_set_microsecs)
 		aio->dma_period_set_microsecs =
 			ucm_get_dma_period_for_dev(aio->ucm, section->name);
+	/* Same for LowLatency, any section of the PCM opts it in. */
+	if (!iodev->low_latency_ok)
+		iodev->low_latency_ok =
+			ucm_get_low_latency_for_dev(aio->ucm, section->name);
 
 	/* Create a node matching this section. If there is a matching
 	 * control use that, otherwise make a node without a control. */
@@ -11,6 +11,7 @@
 #include "cras_alsa_jack.h"
 #include "cras_alsa_mixer.h"
 #include "cras_alsa_ucm.h"
+#include "cras_checksum.h"
 #include "cras_system_state.h"
 #include "cras_gpio_jack.h"
 #include "cras_tm.h"
@@ -21,11 +22,19 @@
 static const unsigned int DISPLAY_INFO_RETRY_DELAY_MS = 200;
 static const unsigned int DISPLAY_INFO_MAX_RETRIES = 10;
 static const unsigned int DISPLAY_INFO_GPIO_MAX_RETRIES = 25;
+/* How long the jacks of a list must be quiet before their events are acted
+ * on. Inserting a headset bounces the jack and can take a few events to tell
+ * a 3 pole from a 4 pole plug. */
+static const unsigned int JACK_DEBOUNCE_MS = 100;
 
 /* Constants used to retrieve monitor name from ELD buffer. */
 static const unsigned int ELD_MNL_MASK = 31;
 static const unsigned int ELD_MNL_OFFSET = 4;
 static const unsigned int ELD_MONITOR_NAME_OFFSET = 20;
+/* The short audio descriptors follow the monitor name, their count is in the
+ * high nibble of this byte. */
+static const unsigned int ELD_SAD_COUNT_OFFSET = 5;
+static const unsigned int ELD_SAD_COUNT_SHIFT = 4;
 
 /* Keeps an fd that is registered with system settings.  A list of fds must be
  * kept so that they can be removed when the jack list is destroyed. */
@@ -74,6 +83,8 @@ struct cras_gpio_jack {
  *    edid_file - File to read the EDID from (if available, HDMI only).
  *    display_info_timer - Timer used to poll display info for HDMI jacks.
  *    display_info_retries - Number of times to retry reading display info.
+ *    reported_state - The plug state last reported, -1 before the first.
+ *    num_events - Plug events since the state was last reported.
  *
  *    mixer_output/mixer_input fields are only used to find the node for this
  *    jack. These are not used for setting volume or mute. There should be a
@@ -99,6 +110,8 @@ struct cras_alsa_jack {
 	const char *edid_file;
 	struct cras_timer *display_info_timer;
 	unsigned int display_info_retries;
+	int reported_state;
+	unsigned int num_events;
 	struct cras_alsa_jack *prev, *next;
 };
 
@@ -115,6 +128,7 @@ struct cras_alsa_jack {
  *    change_callback - function to call when the state of a jack changes.
  *    callback_data - data to pass back to the callback.
  *    jacks - list of jacks for this device.
+ *    debounce_timer - Armed while jack events wait for the jacks to settle.
  */
 struct cras_alsa_jack_list {
 	snd_hctl_t *hctl;
@@ -128,6 +142,7 @@ struct cras_alsa_jack_list {
 	jack_state_change_callback *change_callback;
 	void *callback_data;
 	struct cras_alsa_jack *jacks;
+	struct cras_timer *debounce_timer;
 };
 
 /* Used to contain information needed while looking through GPIO jacks.
@@ -180,6 +195,7 @@ static inline struct cras_alsa_jack *cras_alloc_jack(int is_gpio)
 	if (jack == NULL)
 		return NULL;
 	jack->is_gpio = is_gpio;
+	jack->reported_state = -1;
 	return jack;
 }
 
@@ -290,6 +306,27 @@ static int check_jack_eld(struct cras_alsa_jack *jack)
 
 static void display_info_delay_cb(struct cras_timer *timer, void *arg);
 
+/* Reports the state of the jack to the owner of the list, logging how long
+ * switching nodes for it took. */
+static void report_jack_state(struct cras_alsa_jack *jack)
+{
+	struct cras_alsa_jack_list *jack_list = jack->jack_list;
+	struct timespec start, end, spent;
+	int plugged = get_jack_current_state(jack);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	jack_list->change_callback(jack, plugged, jack_list->callback_data);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+	subtract_timespecs(&end, &start, &spent);
+
+	syslog(LOG_DEBUG, "Jack %s %s after %u events, handled in %ld us",
+	       cras_alsa_jack_get_name(jack), plugged ? "plugged" : "unplugged",
+	       jack->num_events,
+	       spent.tv_sec * 1000000 + spent.tv_nsec / 1000);
+	jack->reported_state = plugged;
+	jack->num_events = 0;
+}
+
 /* Callback function doing following things:
  * 1. Reset timer and update max number of retries.
  * 2. Check all conditions to see if it's okay or needed to
@@ -340,8 +377,48 @@ static inline void jack_state_change_cb(struct cras_alsa_jack *jack, int retry)
 	return;
 
 report_jack_state:
-	jack->jack_list->change_callback(jack, get_jack_current_state(jack),
-					 jack->jack_list->callback_data);
+	report_jack_state(jack);
+}
+
+/* Timer callback acting on the jack events of a list once its jacks have
+ * been quiet for JACK_DEBOUNCE_MS. A jack that bounced back to the state
+ * last reported isn't reported again. */
+static void jack_debounce_cb(struct cras_timer *timer, void *arg)
+{
+	struct cras_alsa_jack_list *jack_list = arg;
+	struct cras_alsa_jack *jack;
+
+	jack_list->debounce_timer = NULL;
+	DL_FOREACH (jack_list->jacks, jack) {
+		if (!jack->num_events)
+			continue;
+		/* A pending display info read still has to be cancelled. */
+		if (get_jack_current_state(jack) == jack->reported_state &&
+		    !jack->display_info_timer) {
+			syslog(LOG_DEBUG, "Jack %s settled after %u events",
+			       cras_alsa_jack_get_name(jack), jack->num_events);
+			jack->num_events = 0;
+			continue;
+		}
+		jack_state_change_cb(jack, 1);
+	}
+}
+
+/* Holds off acting on a plug event until the jacks of the list settle, so a
+ * burst of events becomes one state change for each jack. */
+static void queue_jack_event(struct cras_alsa_jack *jack)
+{
+	struct cras_alsa_jack_list *jack_list = jack->jack_list;
+	struct cras_tm *tm = cras_system_state_get_tm();
+
+	jack->num_events++;
+	if (jack_list->debounce_timer)
+		cras_tm_cancel_timer(tm, jack_list->debounce_timer);
+	jack_list->debounce_timer = cras_tm_create_timer(
+		tm, JACK_DEBOUNCE_MS, jack_debounce_cb, jack_list);
+	/* Act on it right away rather than losing it. */
+	if (!jack_list->debounce_timer)
+		jack_debounce_cb(NULL, jack_list);
 }
 
 /* gpio_switch_initial_state
@@ -396,7 +473,7 @@ static void gpio_switch_callback(void *arg, int events)
 		if (is_audio_switch_event(&ev[i], jack->gpio.switch_event)) {
 			jack->gpio.current_state = ev[i].value;
 
-			jack_state_change_cb(jack, 1);
+			queue_jack_event(jack);
 		}
 }
 
@@ -819,7 +896,7 @@ static int hctl_jack_cb(snd_hctl_elem_t *elem, unsigned int mask)
 	syslog(LOG_DEBUG, "Jack %s %s", name,
 	       snd_ctl_elem_value_get_boolean(elem_value, 0) ? "plugged" :
 							       "unplugged");
-	jack_state_change_cb(jack, 1);
+	queue_jack_event(jack);
 	return 0;
 }
 
@@ -1114,6 +1191,9 @@ void cras_alsa_jack_list_destroy(struct cras_alsa_jack_list *jack_list)
 
 	if (jack_list == NULL)
 		return;
+	if (jack_list->debounce_timer)
+		cras_tm_cancel_timer(cras_system_state_get_tm(),
+				     jack_list->debounce_timer);
 	DL_FOREACH (jack_list->jacks, jack) {
 		DL_DELETE(jack_list->jacks, jack);
 		cras_free_jack(jack, 1);
@@ -1159,7 +1239,7 @@ void cras_alsa_jack_list_report(const struct cras_alsa_jack_list *jack_list)
 		if (jack->is_gpio)
 			gpio_switch_initial_state(jack);
 		else
-			hctl_jack_cb(jack->elem, 0);
+			jack_state_change_cb(jack, 1);
 }
 
 const char *cras_alsa_jack_get_name(const struct cras_alsa_jack *jack)
@@ -1226,6 +1306,73 @@ fallback_jack_name:
 	return;
 }
 
+int cras_alsa_jack_compressed_formats(const struct cras_alsa_jack *jack)
+{
+	snd_ctl_elem_value_t *elem_value;
+	snd_ctl_elem_info_t *elem_info;
+	uint8_t edid[EEDID_SIZE];
+	const unsigned char *buf;
+	unsigned int count, mnl, num_sads;
+
+	if (!jack->eld_control) {
+		if (!jack->edid_file || read_jack_edid(jack, edid))
+			return 0;
+		return edid_compressed_support(edid, edid[EDID_EXT_FLAG]);
+	}
+
+	snd_ctl_elem_info_alloca(&elem_info);
+	if (snd_hctl_elem_info(jack->eld_control, elem_info) < 0)
+		return 0;
+	count = snd_ctl_elem_info_get_count(elem_info);
+	if (count <= ELD_MONITOR_NAME_OFFSET)
+		return 0;
+
+	snd_ctl_elem_value_alloca(&elem_value);
+	if (snd_hctl_elem_read(jack->eld_control, elem_value) < 0)
+		return 0;
+	buf = snd_ctl_elem_value_get_bytes(elem_value);
+	mnl = buf[ELD_MNL_OFFSET] & ELD_MNL_MASK;
+	num_sads = buf[ELD_SAD_COUNT_OFFSET] >> ELD_SAD_COUNT_SHIFT;
+	if (count < ELD_MONITOR_NAME_OFFSET + mnl + num_sads * DBCA_SIZE)
+		return 0;
+
+	return edid_sads_compressed_support(buf + ELD_MONITOR_NAME_OFFSET + mnl,
+					    num_sads);
+}
+
+uint32_t cras_alsa_jack_display_checksum(const struct cras_alsa_jack *jack)
+{
+	snd_ctl_elem_value_t *elem_value;
+	snd_ctl_elem_info_t *elem_info;
+	uint8_t edid[EEDID_SIZE];
+	const unsigned char *buf;
+	unsigned int count;
+	uint32_t checksum;
+
+	if (!jack->eld_control) {
+		memset(edid, 0, sizeof(edid));
+		if (!jack->edid_file || read_jack_edid(jack, edid))
+			return 0;
+		checksum = crc32_checksum(edid, sizeof(edid));
+		return checksum ?: 1;
+	}
+
+	snd_ctl_elem_info_alloca(&elem_info);
+	if (snd_hctl_elem_info(jack->eld_control, elem_info) < 0)
+		return 0;
+	count = snd_ctl_elem_info_get_count(elem_info);
+	if (count == 0)
+		return 0;
+
+	snd_ctl_elem_value_alloca(&elem_value);
+	if (snd_hctl_elem_read(jack->eld_control, elem_value) < 0)
+		return 0;
+	buf = snd_ctl_elem_value_get_bytes(elem_value);
+	checksum = crc32_checksum(buf, count);
+	/* 0 is kept for no display. */
+	return checksum ?: 1;
+}
+
 void cras_alsa_jack_update_node_type(const struct cras_alsa_jack *jack,
 				     enum CRAS_NODE_TYPE *type)
 {
@@ -126,6 +126,25 @@ const char *cras_alsa_jack_get_ucm_device(const struct cras_alsa_jack *jack);
 void cras_alsa_jack_update_monitor_name(const struct cras_alsa_jack *jack,
 					char *name_buf, unsigned int buf_size);
 
+/* Gets the compressed audio formats the sink on an HDMI jack decodes, read
+ * from its ELD or EDID.
+ * Args:
+ *    jack - The jack to query.
+ * Returns:
+ *    A bitmap of (1 << DBCA_FMT_*) from edid_utils.h, 0 if the jack has no
+ *    ELD or EDID or the sink only takes PCM.
+ */
+int cras_alsa_jack_compressed_formats(const struct cras_alsa_jack *jack);
+
+/* Gets a checksum of the ELD or EDID of the sink on an HDMI jack, which
+ * tells displays apart without parsing what they support.
+ * Args:
+ *    jack - The jack to query.
+ * Returns:
+ *    The checksum, 0 if the jack has no ELD or EDID to read.
+ */
+uint32_t cras_alsa_jack_display_checksum(const struct cras_alsa_jack *jack);
+
 /* Updates the node type according to override_type_name in jack.
  * Currently this method only supports updating the node type to
  * CRAS_NODE_TYPE_INTERNAL_SPEAKER when override_type_name is
@@ -55,6 +55,12 @@ struct mixer_control_element {
  * has_mute - non-zero indicates there is a mute switch.
  * max_volume_dB - Maximum volume available in the volume control.
  * min_volume_dB - Minimum volume available in the volume control.
+ * dB_cached - non-zero when set_dB was the last volume written.
+ * set_dB - The last volume written, in dB * 100.
+ * actual_dB_cached - non-zero when actual_dB was read back after set_dB.
+ * actual_dB - The volume the control took for set_dB.
+ * mute_cached - non-zero when muted was the last mute state written.
+ * muted - The last mute state written.
  */
 struct mixer_control {
 	const char *name;
@@ -64,6 +70,12 @@ struct mixer_control {
 	int has_mute;
 	long max_volume_dB;
 	long min_volume_dB;
+	int dB_cached;
+	long set_dB;
+	int actual_dB_cached;
+	long actual_dB;
+	int mute_cached;
+	int muted;
 	struct mixer_control *prev, *next;
 };
 
@@ -76,6 +88,9 @@ struct mixer_control {
  * max_volume_dB - Maximum volume available in main volume controls.  The dBFS
  *   value setting will be applied relative to this.
  * min_volume_dB - Minimum volume available in main volume controls.
+ * playback_switch_muted - Last state written to playback_switch, -1 if
+ *   unknown.
+ * capture_switch_muted - Last state written to capture_switch, -1 if unknown.
  */
 struct cras_alsa_mixer {
 	snd_mixer_t *mixer;
@@ -87,6 +102,8 @@ struct cras_alsa_mixer {
 	snd_mixer_elem_t *capture_switch;
 	long max_volume_dB;
 	long min_volume_dB;
+	int playback_switch_muted;
+	int capture_switch_muted;
 };
 
 /* Wrapper for snd_mixer_open and helpers.
@@ -355,8 +372,7 @@ static int mixer_control_create_by_name(struct mixer_control **control,
 	return 0;
 }
 
-static int mixer_control_set_dBFS(const struct mixer_control *control,
-				  long to_set)
+static int mixer_control_set_dBFS(struct mixer_control *control, long to_set)
 {
 	const struct mixer_control_element *elem = NULL;
 	int rc = -EINVAL;
@@ -439,6 +455,64 @@ static int mixer_control_set_mute(const struct mixer_control *control,
 	return rc;
 }
 
+/* Sets the volume of a control unless it is already at to_set, and reads back
+ * the volume it took into actual_dB if that isn't NULL. The value read back
+ * is kept along with the one written, so a burst of volume changes only
+ * touches the controls whose setting changes. */
+static int mixer_control_update_dBFS(struct mixer_control *control,
+				     long to_set, long *actual_dB)
+{
+	int rc;
+
+	if (!control->dB_cached || control->set_dB != to_set) {
+		control->dB_cached = 0;
+		control->actual_dB_cached = 0;
+		rc = mixer_control_set_dBFS(control, to_set);
+		if (rc)
+			return rc;
+		control->set_dB = to_set;
+		control->dB_cached = 1;
+	}
+	if (!actual_dB)
+		return 0;
+	if (!control->actual_dB_cached) {
+		rc = mixer_control_get_dBFS(control, &control->actual_dB);
+		if (rc)
+			return rc;
+		control->actual_dB_cached = 1;
+	}
+	*actual_dB = control->actual_dB;
+	return 0;
+}
+
+/* Sets the mute switches of a control unless they were last set to muted. */
+static int mixer_control_update_mute(struct mixer_control *control, int muted)
+{
+	int rc;
+
+	if (control->mute_cached && control->muted == muted)
+		return 0;
+	control->mute_cached = 0;
+	rc = mixer_control_set_mute(control, muted);
+	if (rc)
+		return rc;
+	control->muted = muted;
+	control->mute_cached = 1;
+	return 0;
+}
+
+/* Forgets the values last written to the controls of a list. */
+static void mixer_control_invalidate_list(struct mixer_control *control_list)
+{
+	struct mixer_control *c;
+
+	DL_FOREACH (control_list, c) {
+		c->dB_cached = 0;
+		c->actual_dB_cached = 0;
+		c->mute_cached = 0;
+	}
+}
+
 /* Adds the main volume control to the list and grabs the first seen playback
  * switch to use for mute. */
 static int add_main_volume_control(struct cras_alsa_mixer *cmix,
@@ -639,6 +713,8 @@ struct cras_alsa_mixer *cras_alsa_mixer_create(const char *card_name)
 	syslog(LOG_DEBUG, "Add mixer for device %s", card_name);
 
 	alsa_mixer_open(card_name, &cmix->mixer);
+	cmix->playback_switch_muted = -1;
+	cmix->capture_switch_muted = -1;
 
 	return cmix;
 }
@@ -959,13 +1035,12 @@ void cras_alsa_mixer_set_dBFS(struct cras_alsa_mixer *cras_mixer, long dBFS,
 
 		if (!c->has_volume)
 			continue;
-		if (mixer_control_set_dBFS(c, to_set) == 0 &&
-		    mixer_control_get_dBFS(c, &actual_dB) == 0)
+		if (mixer_control_update_dBFS(c, to_set, &actual_dB) == 0)
 			to_set -= actual_dB;
 	}
 	/* Apply the rest to the output-specific control. */
 	if (cras_alsa_mixer_has_volume(mixer_output))
-		mixer_control_set_dBFS(mixer_output, to_set);
+		mixer_control_update_dBFS(mixer_output, to_set, NULL);
 }
 
 long cras_alsa_mixer_get_dB_range(struct cras_alsa_mixer *cras_mixer)
@@ -1002,14 +1077,13 @@ void cras_alsa_mixer_set_capture_dBFS(struct cras_alsa_mixer *cras_mixer,
 
 		if (!c->has_volume)
 			continue;
-		if (mixer_control_set_dBFS(c, to_set) == 0 &&
-		    mixer_control_get_dBFS(c, &actual_dB) == 0)
+		if (mixer_control_update_dBFS(c, to_set, &actual_dB) == 0)
 			to_set -= actual_dB;
 	}
 
 	/* Apply the reset to input specific control */
 	if (cras_alsa_mixer_has_volume(mixer_input))
-		mixer_control_set_dBFS(mixer_input, to_set);
+		mixer_control_update_dBFS(mixer_input, to_set, NULL);
 }
 
 long cras_alsa_mixer_get_minimum_capture_gain(struct cras_alsa_mixer *cmix,
@@ -1050,12 +1124,16 @@ void cras_alsa_mixer_set_mute(struct cras_alsa_mixer *cras_mixer, int muted,
 {
 	assert(cras_mixer);
 
-	if (cras_mixer->playback_switch) {
-		snd_mixer_selem_set_playback_switch_all(
-			cras_mixer->playback_switch, !muted);
+	if (cras_mixer->playback_switch &&
+	    cras_mixer->playback_switch_muted != muted) {
+		if (snd_mixer_selem_set_playback_switch_all(
+			    cras_mixer->playback_switch, !muted) == 0)
+			cras_mixer->playback_switch_muted = muted;
+		else
+			cras_mixer->playback_switch_muted = -1;
 	}
 	if (mixer_output && mixer_output->has_mute) {
-		mixer_control_set_mute(mixer_output, muted);
+		mixer_control_update_mute(mixer_output, muted);
 	}
 }
 
@@ -1065,12 +1143,28 @@ void cras_alsa_mixer_set_capture_mute(struct cras_alsa_mixer *cras_mixer,
 {
 	assert(cras_mixer);
 	if (cras_mixer->capture_switch) {
-		snd_mixer_selem_set_capture_switch_all(
-			cras_mixer->capture_switch, !muted);
+		if (cras_mixer->capture_switch_muted == muted)
+			return;
+		if (snd_mixer_selem_set_capture_switch_all(
+			    cras_mixer->capture_switch, !muted) == 0)
+			cras_mixer->capture_switch_muted = muted;
+		else
+			cras_mixer->capture_switch_muted = -1;
 		return;
 	}
 	if (mixer_input && mixer_input->has_mute)
-		mixer_control_set_mute(mixer_input, muted);
+		mixer_control_update_mute(mixer_input, muted);
+}
+
+void cras_alsa_mixer_invalidate_cache(struct cras_alsa_mixer *cras_mixer)
+{
+	assert(cras_mixer);
+	mixer_control_invalidate_list(cras_mixer->main_volume_controls);
+	mixer_control_invalidate_list(cras_mixer->output_controls);
+	mixer_control_invalidate_list(cras_mixer->main_capture_controls);
+	mixer_control_invalidate_list(cras_mixer->input_controls);
+	cras_mixer->playback_switch_muted = -1;
+	cras_mixer->capture_switch_muted = -1;
 }
 
 void cras_alsa_mixer_list_outputs(struct cras_alsa_mixer *cras_mixer,
@@ -1170,5 +1264,5 @@ int cras_alsa_mixer_set_output_active_state(struct mixer_control *output,
 	assert(output);
 	if (!output->has_mute)
 		return -1;
-	return mixer_control_set_mute(output, !active);
+	return mixer_control_update_mute(output, !active);
 }
@@ -153,6 +153,15 @@ void cras_alsa_mixer_set_capture_mute(struct cras_alsa_mixer *cras_mixer,
 				      int muted,
 				      struct mixer_control *mixer_input);
 
+/* Forgets the volume and mute settings last written to the mixer. The mixer
+ * skips writing a setting which is already in place, so this is called when
+ * the controls may have been changed behind its back, for example by the
+ * UCM sequences run when a device is opened.
+ * Args:
+ *    cras_mixer - The mixer whose settings to forget.
+ */
+void cras_alsa_mixer_invalidate_cache(struct cras_alsa_mixer *cras_mixer);
+
 /* Invokes the provided callback once for each output (input).
  * The callback will be provided with a reference to the control
  * that can be queried to see what the control supports.
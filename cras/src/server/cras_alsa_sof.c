@@ -0,0 +1,193 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "biquad.h"
+#include "cras_alsa_sof.h"
+#include "cras_dsp_ini.h"
+
+/* 'S', 'O', 'F', '\0' */
+#define SOF_ABI_MAGIC 0x00464F53
+/* Positions in struct sof_abi_hdr. */
+#define SOF_ABI_HDR_MAGIC 0
+#define SOF_ABI_HDR_SIZE 2
+/* A TLV read from a control starts with its tag and length in bytes. */
+#define TLV_HDR_WORDS 2
+/* Largest blob read from a control. */
+#define SOF_BLOB_MAX_WORDS 1024
+
+/* Words of struct sof_eq_iir_config before its data, which starts with the
+ * response each channel is assigned. */
+#define EQ_IIR_CONFIG_WORDS 7
+/* Words of struct sof_eq_iir_header, followed by the biquads. */
+#define EQ_IIR_HEADER_WORDS 6
+/* Words of struct sof_eq_iir_biquad. */
+#define EQ_IIR_BIQUAD_WORDS 7
+/* Unity output_gain of a biquad, in Q2.14. */
+#define EQ_IIR_UNITY_GAIN 16384
+
+/* The eq2 controls, 8 per biquad after the 4 audio ports, see
+ * cras_dsp_mod_builtin.c. */
+#define EQ2_FIRST_CONTROL 4
+#define EQ2_CONTROLS_PER_BIQUAD 8
+
+/* Converts a biquad coefficient to Q2.30, returns -ERANGE if it's out of the
+ * range [-2, 2). */
+static int to_q2_30(double value, int32_t *out)
+{
+	double scaled = round(value * (1 << 30));
+
+	if (scaled < INT32_MIN || scaled > INT32_MAX)
+		return -ERANGE;
+	*out = (int32_t)scaled;
+	return 0;
+}
+
+/* Writes a struct sof_eq_iir_biquad. The firmware adds the feedback terms,
+ * so a1 and a2 are negated. */
+static int write_biquad(const struct biquad *bq, int32_t *out)
+{
+	if (to_q2_30(-bq->a2, &out[0]) || to_q2_30(-bq->a1, &out[1]) ||
+	    to_q2_30(bq->b2, &out[2]) || to_q2_30(bq->b1, &out[3]) ||
+	    to_q2_30(bq->b0, &out[4]))
+		return -ERANGE;
+	out[5] = 0;
+	out[6] = EQ_IIR_UNITY_GAIN;
+	return 0;
+}
+
+/* Gets the constant value of control port index of plugin. */
+static int get_control(const struct plugin *plugin, int index, float *value)
+{
+	const struct port *port = ARRAY_ELEMENT(&plugin->ports, index);
+
+	if (port->type != PORT_CONTROL || port->flow_id != INVALID_FLOW_ID)
+		return -EINVAL;
+	*value = port->init_value;
+	return 0;
+}
+
+/* Writes the response of one channel of an eq2, a header followed by its
+ * biquads. A channel without biquads gets a pass through one. Returns the
+ * number of words written. */
+static int write_response(const struct plugin *plugin, int channel,
+			  int sample_rate, int bypass, int32_t *data,
+			  size_t max_words)
+{
+	float nyquist = sample_rate / 2;
+	int num_ports = ARRAY_COUNT(&plugin->ports);
+	int32_t *biquads = data + EQ_IIR_HEADER_WORDS;
+	int num_sections = 0;
+	struct biquad bq;
+	float v[4];
+	int32_t *out;
+	int i, k, rc;
+
+	for (i = EQ2_FIRST_CONTROL;
+	     !bypass && i + EQ2_CONTROLS_PER_BIQUAD <= num_ports;
+	     i += EQ2_CONTROLS_PER_BIQUAD) {
+		for (k = 0; k < 4; k++) {
+			rc = get_control(plugin, i + channel * 4 + k, &v[k]);
+			if (rc)
+				return rc;
+		}
+		if ((int)v[0] == BQ_NONE)
+			continue;
+		out = biquads + num_sections * EQ_IIR_BIQUAD_WORDS;
+		if (out + EQ_IIR_BIQUAD_WORDS > data + max_words)
+			return -E2BIG;
+		biquad_set(&bq, (int)v[0], v[1] / nyquist, v[2], v[3]);
+		rc = write_biquad(&bq, out);
+		if (rc)
+			return rc;
+		num_sections++;
+	}
+
+	if (num_sections == 0) {
+		if (EQ_IIR_HEADER_WORDS + EQ_IIR_BIQUAD_WORDS > max_words)
+			return -E2BIG;
+		biquad_set(&bq, BQ_NONE, 0, 0, 0);
+		write_biquad(&bq, biquads);
+		num_sections = 1;
+	}
+
+	memset(data, 0, EQ_IIR_HEADER_WORDS * sizeof(*data));
+	data[0] = num_sections;
+	data[1] = num_sections;
+	return EQ_IIR_HEADER_WORDS + num_sections * EQ_IIR_BIQUAD_WORDS;
+}
+
+int cras_alsa_sof_eq_iir_data(const struct plugin *plugin, int sample_rate,
+			      int bypass, int32_t *data, size_t max_words)
+{
+	size_t n = EQ_IIR_CONFIG_WORDS + 2;
+	int channel, rc;
+
+	if (strcmp(plugin->label, "eq2") != 0 || sample_rate <= 0)
+		return -EINVAL;
+	if (n > max_words)
+		return -E2BIG;
+
+	/* Two channels, each assigned its own response. */
+	memset(data, 0, EQ_IIR_CONFIG_WORDS * sizeof(*data));
+	data[1] = 2;
+	data[2] = 2;
+	data[EQ_IIR_CONFIG_WORDS] = 0;
+	data[EQ_IIR_CONFIG_WORDS + 1] = 1;
+
+	for (channel = 0; channel < 2; channel++) {
+		rc = write_response(plugin, channel, sample_rate, bypass,
+				    data + n, max_words - n);
+		if (rc < 0)
+			return rc;
+		n += rc;
+	}
+
+	data[0] = n * sizeof(*data);
+	return n;
+}
+
+int cras_alsa_sof_load_plugin(snd_hctl_t *hctl, const struct plugin *plugin,
+			      int sample_rate, int bypass)
+{
+	unsigned int tlv[SOF_BLOB_MAX_WORDS];
+	unsigned int *hdr = tlv + TLV_HDR_WORDS;
+	int32_t *data = (int32_t *)(hdr + SOF_ABI_HDR_WORDS);
+	snd_ctl_elem_id_t *id;
+	snd_hctl_elem_t *elem;
+	int n, rc;
+
+	snd_ctl_elem_id_alloca(&id);
+	snd_ctl_elem_id_set_interface(id, SND_CTL_ELEM_IFACE_MIXER);
+	snd_ctl_elem_id_set_name(id, plugin->firmware_control);
+	elem = snd_hctl_find_elem(hctl, id);
+	if (!elem)
+		return -ENOENT;
+
+	/* Keep the type and ABI version the component was set up with. */
+	rc = snd_hctl_elem_tlv_read(elem, tlv, sizeof(tlv));
+	if (rc < 0)
+		return rc;
+	if (tlv[1] < SOF_ABI_HDR_WORDS * sizeof(*tlv) ||
+	    hdr[SOF_ABI_HDR_MAGIC] != SOF_ABI_MAGIC) {
+		syslog(LOG_ERR, "%s holds no SOF blob",
+		       plugin->firmware_control);
+		return -EINVAL;
+	}
+
+	n = cras_alsa_sof_eq_iir_data(plugin, sample_rate, bypass, data,
+				      SOF_EQ_IIR_MAX_WORDS);
+	if (n < 0)
+		return n;
+
+	hdr[SOF_ABI_HDR_SIZE] = n * sizeof(*tlv);
+	tlv[1] = (SOF_ABI_HDR_WORDS + n) * sizeof(*tlv);
+	rc = snd_hctl_elem_tlv_write(elem, tlv);
+	return rc < 0 ? rc : 0;
+}
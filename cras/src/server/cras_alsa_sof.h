@@ -0,0 +1,54 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Loads DSP plugins into the components of Sound Open Firmware (SOF) audio
+ * DSPs, through the bytes controls the components expose. Each control
+ * takes a blob of a struct sof_abi_hdr followed by the component data.
+ */
+
+#ifndef CRAS_ALSA_SOF_H_
+#define CRAS_ALSA_SOF_H_
+
+#include <alsa/asoundlib.h>
+#include <stdint.h>
+
+struct plugin;
+
+/* Words of a struct sof_abi_hdr. */
+#define SOF_ABI_HDR_WORDS 8
+/* Most words of component data cras_alsa_sof_eq_iir_data() writes. */
+#define SOF_EQ_IIR_MAX_WORDS 256
+
+/* Fills data with the SOF IIR EQ configuration doing what an "eq2" plugin
+ * does with the constant values of its control ports.
+ * Args:
+ *    plugin - The "eq2" plugin.
+ *    sample_rate - The rate the EQ runs at.
+ *    bypass - Pass the audio through instead.
+ *    data - Filled with the component data.
+ *    max_words - The size of data.
+ * Returns:
+ *    The number of words written, -EINVAL if a control is not constant,
+ *    -ERANGE if a coefficient can't be represented in the Q2.30 format of
+ *    the firmware, or -E2BIG if data is too small.
+ */
+int cras_alsa_sof_eq_iir_data(const struct plugin *plugin, int sample_rate,
+			      int bypass, int32_t *data, size_t max_words);
+
+/* Loads plugin into the component behind its firmware_control, keeping the
+ * ABI version and type of the blob the control holds. Only "eq2" plugins are
+ * supported, into IIR EQ components.
+ * Args:
+ *    hctl - The control of the card.
+ *    plugin - The plugin.
+ *    sample_rate - The rate of the pipeline.
+ *    bypass - Set the component to pass the audio through instead.
+ * Returns:
+ *    0 on success, -ENOENT if the card has no such control, otherwise a
+ *    negative error code.
+ */
+int cras_alsa_sof_load_plugin(snd_hctl_t *hctl, const struct plugin *plugin,
+			      int sample_rate, int bypass);
+
+#endif /* CRAS_ALSA_SOF_H_ */
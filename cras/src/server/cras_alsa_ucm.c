@@ -11,6 +11,7 @@
 
 #include "cras_alsa_ucm.h"
 #include "cras_util.h"
+#include "sfh.h"
 #include "utlist.h"
 
 static const char jack_control_var[] = "JackControl";
@@ -24,6 +25,7 @@ static const char playback_mixer_elem_var[] = "PlaybackMixerElem";
 static const char capture_mixer_elem_var[] = "CaptureMixerElem";
 static const char min_buffer_level_var[] = "MinBufferLevel";
 static const char dma_period_var[] = "DmaPeriodMicrosecs";
+static const char low_latency_var[] = "LowLatency";
 static const char disable_software_volume[] = "DisableSoftwareVolume";
 static const char playback_device_name_var[] = "PlaybackPCM";
 static const char playback_device_rate_var[] = "PlaybackRate";
@@ -69,18 +71,35 @@ static const char *use_case_verbs[] = {
 
 static const size_t max_section_name_len = 100;
 
+/* Number of hash buckets of the looked up values. */
+#define UCM_VALUE_BUCKETS 64
+
 /* Represents a list of section names found in UCM. */
 struct section_name {
 	const char *name;
 	struct section_name *prev, *next;
 };
 
+/* A value looked up in the UCM config. The config doesn't change once it
+ * is loaded, so each value is only looked up in alsa-lib once.
+ * id - The identifier passed to snd_use_case_get().
+ * value - The value, NULL if the lookup failed.
+ * rc - What snd_use_case_get() returned.
+ */
+struct ucm_value {
+	char *id;
+	char *value;
+	int rc;
+	struct ucm_value *next;
+};
+
 struct cras_use_case_mgr {
 	snd_use_case_mgr_t *mgr;
 	char *name;
 	unsigned int avail_use_cases;
 	enum CRAS_STREAM_TYPE use_case;
 	char *hotword_modifier;
+	struct ucm_value *values[UCM_VALUE_BUCKETS];
 };
 
 static inline const char *uc_verb(struct cras_use_case_mgr *mgr)
@@ -127,21 +146,72 @@ static int modifier_enabled(struct cras_use_case_mgr *mgr, const char *mod)
 	return (mod_idx < (unsigned int)num_mods);
 }
 
+static void free_values(struct cras_use_case_mgr *mgr)
+{
+	struct ucm_value *v, *next;
+	size_t i;
+
+	for (i = 0; i < UCM_VALUE_BUCKETS; i++) {
+		for (v = mgr->values[i]; v; v = next) {
+			next = v->next;
+			free(v->id);
+			free(v->value);
+			free(v);
+		}
+		mgr->values[i] = NULL;
+	}
+}
+
+/* Looks up id in the values already read, or reads it from alsa-lib and
+ * keeps it. On success value is set to a copy the caller frees. */
+static int get_value(struct cras_use_case_mgr *mgr, char *id,
+		     const char **value)
+{
+	size_t len = strlen(id);
+	size_t bucket = SuperFastHash(id, len, len) % UCM_VALUE_BUCKETS;
+	struct ucm_value *v;
+	const char *found;
+	int rc;
+
+	for (v = mgr->values[bucket]; v; v = v->next)
+		if (!strcmp(v->id, id))
+			break;
+
+	if (!v) {
+		rc = snd_use_case_get(mgr->mgr, id, &found);
+		v = (struct ucm_value *)calloc(1, sizeof(*v));
+		if (!v) {
+			free(id);
+			if (rc == 0)
+				*value = found;
+			return rc;
+		}
+		v->id = id;
+		v->rc = rc;
+		v->value = rc == 0 ? (char *)found : NULL;
+		v->next = mgr->values[bucket];
+		mgr->values[bucket] = v;
+	} else {
+		free(id);
+	}
+
+	if (v->rc)
+		return v->rc;
+	*value = strdup(v->value);
+	return *value ? 0 : -ENOMEM;
+}
+
 static int get_var(struct cras_use_case_mgr *mgr, const char *var,
 		   const char *dev, const char *verb, const char **value)
 {
 	char *id;
-	int rc;
 	size_t len = strlen(var) + strlen(dev) + strlen(verb) + 4;
 
 	id = (char *)malloc(len);
 	if (!id)
 		return -ENOMEM;
 	snprintf(id, len, "=%s/%s/%s", var, dev, verb);
-	rc = snd_use_case_get(mgr->mgr, id, value);
-
-	free((void *)id);
-	return rc;
+	return get_value(mgr, id, value);
 }
 
 static int get_int(struct cras_use_case_mgr *mgr, const char *var,
@@ -411,7 +481,7 @@ struct cras_use_case_mgr *ucm_create(const char *name)
 	if (!name)
 		return NULL;
 
-	mgr = (struct cras_use_case_mgr *)malloc(sizeof(*mgr));
+	mgr = (struct cras_use_case_mgr *)calloc(1, sizeof(*mgr));
 	if (!mgr)
 		return NULL;
 
@@ -457,6 +527,7 @@ cleanup:
 void ucm_destroy(struct cras_use_case_mgr *mgr)
 {
 	snd_use_case_mgr_close(mgr->mgr);
+	free_values(mgr);
 	free(mgr->hotword_modifier);
 	free(mgr->name);
 	free(mgr);
@@ -1235,3 +1306,13 @@ unsigned int ucm_get_dma_period_for_dev(struct cras_use_case_mgr *mgr,
 		return 0;
 	return value;
 }
+
+int ucm_get_low_latency_for_dev(struct cras_use_case_mgr *mgr, const char *dev)
+{
+	int value;
+
+	int rc = get_int(mgr, low_latency_var, dev, uc_verb(mgr), &value);
+	if (rc)
+		return 0;
+	return value;
+}
@@ -500,6 +500,16 @@ int ucm_get_jack_switch_for_dev(struct cras_use_case_mgr *mgr, const char *dev);
 unsigned int ucm_get_dma_period_for_dev(struct cras_use_case_mgr *mgr,
 					const char *dev);
 
+/* Gets the flag if a device can run at the callback level of LOW_LATENCY
+ * streams.
+ * Args:
+ *    mgr - The cras_use_case_mgr pointer returned from alsa_ucm_create.
+ *    dev - The device to check for the low latency flag.
+ * Returns:
+ *    Non-zero if the device opts in to low latency streams, otherwise zero.
+ */
+int ucm_get_low_latency_for_dev(struct cras_use_case_mgr *mgr, const char *dev);
+
 /* Gets the flag of optimization for no stream state.
  * This flag enables no_stream ops in alsa_io.
  * Args:
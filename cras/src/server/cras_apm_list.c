@@ -4,11 +4,14 @@
  */
 
 #include <inttypes.h>
+#include <pthread.h>
+#include <semaphore.h>
 #include <string.h>
 #include <syslog.h>
 
 #include <webrtc-apm/webrtc_apm.h>
 
+#include "aec_dump_writer.h"
 #include "byte_buffer.h"
 #include "cras_apm_list.h"
 #include "cras_audio_area.h"
@@ -16,8 +19,13 @@
 #include "cras_dsp_pipeline.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_mem_stats.h"
+#include "cras_rt_mem.h"
+#include "cras_system_state.h"
+#include "cras_util.h"
 #include "dsp_util.h"
 #include "dumper.h"
+#include "echo_delay.h"
 #include "float_buffer.h"
 #include "iniparser_wrapper.h"
 #include "utlist.h"
@@ -25,6 +33,72 @@
 #define AEC_CONFIG_NAME "aec.ini"
 #define APM_CONFIG_NAME "apm.ini"
 
+/* Number of 10ms blocks in flight to and from an APM worker. */
+#define APM_WORKER_BLOCKS 4
+/* Largest reverse block a worker takes, 8 channels at 96kHz. Larger ones
+ * are analyzed on the audio thread. */
+#define APM_WORKER_MAX_REVERSE_SAMPLES (8 * 960)
+/* Number of 10ms blocks an output can be ahead of the lead before it takes
+ * over. */
+#define REVERSE_RING_BLOCKS 4
+/* Most 10ms blocks the echo reference is held back to match the echo delay
+ * estimated for an APM. */
+#define ECHO_ALIGN_MAX_BLOCKS 30
+/* Part of the estimated echo delay left for the AEC to find. A reference
+ * held back past the echo would leave it nothing to cancel. */
+#define ECHO_ALIGN_MARGIN_MS 20
+/* Number of 10ms blocks in the echo reference ring of an output, enough to
+ * hand out the one written ECHO_ALIGN_MAX_BLOCKS before the last. */
+#define REVERSE_RING_SLOTS (REVERSE_RING_BLOCKS + ECHO_ALIGN_MAX_BLOCKS)
+/* Blocks an output can be ahead of the lead output before the oldest ones
+ * are dropped, to follow the drift between their clocks. */
+#define REVERSE_MAX_QUEUED 2
+/* Bytes of AEC dump records queued for the writer thread, a few seconds
+ * of stereo 48kHz audio. */
+#define AEC_DUMP_RING_BYTES (4 * 1024 * 1024)
+
+/*
+ * Runs the processing of an APM instance on its own thread, so the audio
+ * thread only copies blocks in and out. Capture and reverse blocks are
+ * passed through rings of APM_WORKER_BLOCKS slots, each with a counter of
+ * blocks submitted by the audio thread and one of blocks completed by the
+ * worker. A processed capture block is given back one block after it was
+ * submitted, which adds a fixed 10ms to the capture delay. When the worker
+ * is late the block is replaced by silence rather than waited for.
+ * Members:
+ *    tid - The worker thread.
+ *    wake - Posted when a block is submitted.
+ *    running - Cleared to stop the worker.
+ *    blocks - The capture slots, planar samples of fmt.
+ *    submitted - Capture blocks handed to the worker.
+ *    completed - Capture blocks processed by the worker.
+ *    pending - True if the block submitted last is still to be given back.
+ *    pending_seq - The number of that block.
+ *    reverse - The reverse slots.
+ *    reverse_channels, reverse_frames, reverse_rate - The layout of the
+ *        block in each reverse slot.
+ *    reverse_submitted - Reverse blocks handed to the worker.
+ *    reverse_completed - Reverse blocks analyzed by the worker.
+ *    error - The last error from the APM, or 0.
+ */
+struct apm_worker {
+	pthread_t tid;
+	sem_t wake;
+	int running;
+	float *blocks;
+	unsigned int submitted;
+	unsigned int completed;
+	bool pending;
+	unsigned int pending_seq;
+	float *reverse;
+	unsigned int reverse_channels[APM_WORKER_BLOCKS];
+	unsigned int reverse_frames[APM_WORKER_BLOCKS];
+	unsigned int reverse_rate[APM_WORKER_BLOCKS];
+	unsigned int reverse_submitted;
+	unsigned int reverse_completed;
+	int error;
+};
+
 /*
  * Structure holding a WebRTC audio processing module and necessary
  * info to process and transfer input buffer from device to stream.
@@ -39,43 +113,90 @@
  *  ________   _______     _______________________________
  *  |      |   |     |     |_____________APM ____________|
  *  |input |-> | DSP |---> ||           |    |          || -> stream 1
- *  |device|   |     | |   || float buf | -> | byte buf ||
+ *  |device|   |     | |   || float buf | -> | byte buf || -> stream 2
  *  |______|   |_____| |   ||___________|    |__________||
  *                     |   |_____________________________|
  *                     |   _______________________________
- *                     |-> |             APM 2           | -> stream 2
+ *                     |-> |             APM 2           | -> stream 3
  *                     |   |_____________________________|
  *                     |                                       ...
  *                     |
  *                     |------------------------------------> stream N
  *
+ * Streams on the same device asking for the same effects share one instance,
+ * which processes each 10ms block once for all of them. Every stream reads
+ * the processed block through its own cras_apm, and the next block is only
+ * processed after all the started ones have read it.
+ *
  * Members:
  *    apm_ptr - An APM instance from libwebrtc_audio_processing
  *    dev_ptr - Pointer to the device this APM is associated with.
- *    buffer - Stores the processed/interleaved data ready for stream to read.
+ *    effects - The effects bit map this APM is created for.
+ *    out - Stores the processed/interleaved data ready for stream to read.
+ *    produced - The number of processed frames put in out so far.
  *    fbuffer - Stores the floating pointer buffer from input device waiting
  *        for APM to process.
+ *    input - The device buffer last read from, NULL until the first read.
+ *    input_idx - Where reading from input stopped, as an index in the ring
+ *        of input, so it follows the device buffer as streams consume it.
  *    dev_fmt - The format used by the iodev this APM attaches to.
  *    fmt - The audio data format configured for this APM.
- *    area - The cras_audio_area used for copying processed data to client
- *        stream.
  *    work_queue - A task queue instance created and destroyed by
  *        libwebrtc_apm.
  *    is_aec_use_case - True if the input and output devices pair is in the
  *        typical AEC use case. This flag decides whether to use settings
  *        tuned specifically for this hardware if exists. Otherwise it uses
  *        the generic settings like run inside browser.
+ *    reverse_seq - The reverse block last given to this APM.
+ *    num_users - The number of cras_apm reading from this instance. An
+ *        instance without users is kept for the next stream of its device
+ *        while inputs are kept warm.
+ *    worker - The thread processing for this instance, NULL if processing
+ *        happens on the audio thread.
+ *    echo_delay - Estimates the delay of the echo in the input of this
+ *        APM, so the reference can be aligned to it. NULL if unavailable.
+ *    next_apm - An APM built by the main thread with reloaded configs, put
+ *        in place of apm_ptr between two blocks by the thread processing.
+ *    retired_apm - The APM replaced by next_apm, for the main thread to
+ *        destroy. No APM is swapped in while it is set.
  */
-struct cras_apm {
+struct apm_instance {
 	webrtc_apm apm_ptr;
 	void *dev_ptr;
-	struct byte_buffer *buffer;
+	uint64_t effects;
+	uint8_t *out;
+	unsigned int produced;
 	struct float_buffer *fbuffer;
+	struct float_buffer *input;
+	unsigned int input_idx;
 	struct cras_audio_format dev_fmt;
 	struct cras_audio_format fmt;
-	struct cras_audio_area *area;
 	void *work_queue;
 	bool is_aec_use_case;
+	unsigned int reverse_seq;
+	unsigned int num_users;
+	struct apm_worker *worker;
+	struct echo_delay *echo_delay;
+	webrtc_apm next_apm;
+	webrtc_apm retired_apm;
+	struct apm_instance *prev, *next;
+};
+
+/*
+ * The view of a stream on the APM instance of a device.
+ * Members:
+ *    inst - The shared APM instance.
+ *    dev_ptr - Pointer to the device this APM is associated with.
+ *    area - The cras_audio_area used for copying processed data to client
+ *        stream.
+ *    consumed - The number of processed frames of inst this stream has
+ *        read, compared against inst->produced.
+ */
+struct cras_apm {
+	struct apm_instance *inst;
+	void *dev_ptr;
+	struct cras_audio_area *area;
+	unsigned int consumed;
 	struct cras_apm *prev, *next;
 };
 
@@ -113,32 +234,79 @@ struct active_apm {
 } * active_apms;
 
 /*
- * Object used to analyze playback audio from output iodev. It is responsible
- * to get buffer containing latest output data and provide it to the APM
- * instances which want to analyze reverse stream.
+ * Object used to analyze playback audio from an output iodev. There is one
+ * for each enabled output, and the echo reference given to the APM
+ * instances is the mix of them all.
+ *
+ * Each output writes its frames once, into 10ms blocks of a ring of
+ * REVERSE_RING_SLOTS planar blocks. When a block of the lead output is
+ * complete, the oldest complete block of every other output is added to it,
+ * converted to the lead channel count and block size, and the mix is given
+ * to the APMs. An APM whose echo comes back late is given an older mix from
+ * the ring instead, so the AEC has a shorter delay to search. An output
+ * whose clock runs faster than the lead queues more blocks, the extra ones
+ * are dropped. One whose clock runs slower sometimes has no block to add.
+ * If the lead output stops, the first output to get REVERSE_RING_BLOCKS
+ * ahead takes over. All outputs run on the audio thread, so the rings need
+ * no lock.
  * Member:
  *    ext - The interface implemented to process reverse(output) stream
  *        data in various formats.
- *    fbuf - Middle buffer holding reverse data for APMs to analyze.
  *    odev - Pointer to the output iodev playing audio as the reverse
- *        stream. NULL if there's no playback stream.
+ *        stream. NULL if the module is unused.
+ *    num_odevs - The number of enabled outputs using odev as the echo
+ *        reference.
  *    dev_rate - The sample rate odev is opened for.
- *    process_reverse - Flag to indicate if there's APM has effect that
- *        needs to process reverse stream.
+ *    num_channels - The number of channels in the ring.
+ *    block_frames - The number of frames in a 10ms block.
+ *    ring - The blocks of planar samples.
+ *    fill - The number of frames in the block being written.
+ *    written - The number of complete blocks written.
+ *    read - The number of blocks mixed or dropped.
  */
 struct cras_apm_reverse_module {
 	struct ext_dsp_module ext;
-	struct float_buffer *fbuf;
 	struct cras_iodev *odev;
+	unsigned int num_odevs;
 	unsigned int dev_rate;
-	unsigned process_reverse;
+	unsigned int num_channels;
+	unsigned int block_frames;
+	float *ring;
+	unsigned int fill;
+	unsigned int written;
+	unsigned int read;
+	struct cras_apm_reverse_module *prev, *next;
 };
 
-static struct cras_apm_reverse_module *rmodule = NULL;
+static size_t reverse_ring_bytes(const struct cras_apm_reverse_module *rmod)
+{
+	return (size_t)REVERSE_RING_SLOTS * rmod->num_channels *
+	       rmod->block_frames * sizeof(float);
+}
+
+/* The reverse modules of the outputs, owned by the main thread. */
+static struct cras_apm_reverse_module *rmodules = NULL;
+/* The output whose blocks the others are mixed into. */
+static struct cras_apm_reverse_module *lead_rmodule = NULL;
+/* Whether any APM has an effect that needs to process reverse stream. */
+static bool process_reverse_enabled = false;
 static const char *aec_config_dir = NULL;
 static char ini_name[MAX_INI_NAME_LENGTH + 1];
 static dictionary *aec_ini = NULL;
 static dictionary *apm_ini = NULL;
+/* Set until the ini files are first read, which is put off until an APM
+ * needs them so it doesn't delay the daemon startup. */
+static int ini_load_pending;
+
+static void load_ini_if_pending();
+/* APM instances of all streams, owned by the main thread. */
+static struct apm_instance *instances = NULL;
+/* Counts the reverse blocks, so a shared APM analyzes each one once. */
+static unsigned int reverse_seq = 0;
+/* Whether new APM instances process on a worker thread. */
+static bool offload_enabled = false;
+/* Whether instances outlive their last stream until the device closes. */
+static bool keep_idle_instances = false;
 
 /* Update the global process reverse flag. Should be called when apms are added
  * or removed. */
@@ -146,25 +314,331 @@ static void update_process_reverse_flag()
 {
 	struct active_apm *active;
 
-	if (!rmodule)
-		return;
-	rmodule->process_reverse = 0;
+	process_reverse_enabled = false;
 	DL_FOREACH (active_apms, active) {
-		rmodule->process_reverse |=
+		process_reverse_enabled |=
 			!!(active->effects & APM_ECHO_CANCELLATION);
 	}
 }
 
+static unsigned int block_frames(const struct apm_instance *inst)
+{
+	return inst->fbuffer->buf->used_size;
+}
+
+/* Returns the bytes of the blocks handed to and from the worker of inst. */
+static size_t worker_mem_bytes(const struct apm_instance *inst)
+{
+	return ((size_t)APM_WORKER_BLOCKS * inst->fmt.num_channels *
+			block_frames(inst) +
+		(size_t)APM_WORKER_BLOCKS * APM_WORKER_MAX_REVERSE_SAMPLES) *
+	       sizeof(float);
+}
+
+/* Returns the bytes of the input and output blocks of inst. */
+static size_t instance_mem_bytes(const struct apm_instance *inst)
+{
+	unsigned int frames = block_frames(inst);
+
+	return frames * cras_get_format_bytes(&inst->fmt) +
+	       (size_t)frames * inst->fmt.num_channels * sizeof(float);
+}
+
+/* Returns the planes of the capture slot for block seq. */
+static float *const *worker_block(struct apm_instance *inst, unsigned int seq,
+				  float **planes)
+{
+	unsigned int frames = block_frames(inst);
+	unsigned int ch = inst->fmt.num_channels;
+	float *block = inst->worker->blocks +
+		       (size_t)(seq % APM_WORKER_BLOCKS) * ch * frames;
+	unsigned int i;
+
+	for (i = 0; i < ch; i++)
+		planes[i] = block + (size_t)i * frames;
+	return planes;
+}
+
+/* Returns the planes of the reverse slot for block seq. */
+static float *const *worker_reverse(struct apm_worker *w, unsigned int seq,
+				    float **planes)
+{
+	unsigned int slot = seq % APM_WORKER_BLOCKS;
+	float *block = w->reverse +
+		       (size_t)slot * APM_WORKER_MAX_REVERSE_SAMPLES;
+	unsigned int i;
+
+	for (i = 0; i < w->reverse_channels[slot]; i++)
+		planes[i] = block + (size_t)i * w->reverse_frames[slot];
+	return planes;
+}
+
+/* Puts next_apm of inst in use if one is ready. Only called between blocks
+ * by the thread running the APM of inst. */
+static void swap_in_next_apm(struct apm_instance *inst)
+{
+	webrtc_apm next;
+
+	if (!__atomic_load_n(&inst->next_apm, __ATOMIC_RELAXED) ||
+	    __atomic_load_n(&inst->retired_apm, __ATOMIC_ACQUIRE))
+		return;
+	next = __atomic_exchange_n(&inst->next_apm, NULL, __ATOMIC_ACQUIRE);
+	if (next == NULL)
+		return;
+	__atomic_store_n(&inst->retired_apm, inst->apm_ptr, __ATOMIC_RELEASE);
+	__atomic_store_n(&inst->apm_ptr, next, __ATOMIC_RELEASE);
+}
+
+/* Destroys the APM the processing thread of inst stopped using, if any. */
+static void destroy_retired_apm(struct apm_instance *inst)
+{
+	webrtc_apm retired;
+
+	retired = __atomic_exchange_n(&inst->retired_apm, NULL,
+				      __ATOMIC_ACQUIRE);
+	if (retired)
+		webrtc_apm_destroy(retired);
+}
+
+static void destroy_retired_apms()
+{
+	struct apm_instance *inst;
+
+	DL_FOREACH (instances, inst)
+		destroy_retired_apm(inst);
+}
+
+static void *apm_worker_thread(void *arg)
+{
+	struct apm_instance *inst = (struct apm_instance *)arg;
+	struct apm_worker *w = inst->worker;
+	float *planes[CRAS_CH_MAX];
+	unsigned int seq, end, slot;
+	int ret;
+
+	/* Same priority as the audio thread the blocks come from. */
+	if (cras_set_rt_scheduling(cras_system_get_rt_priority()) == 0)
+		cras_set_thread_priority(cras_system_get_rt_priority());
+
+	while (1) {
+		sem_wait(&w->wake);
+		if (!__atomic_load_n(&w->running, __ATOMIC_ACQUIRE))
+			break;
+		swap_in_next_apm(inst);
+
+		/* The echo reference goes first, it's what AEC needs to
+		 * cancel the capture blocks. */
+		end = __atomic_load_n(&w->reverse_submitted, __ATOMIC_ACQUIRE);
+		for (seq = w->reverse_completed; seq != end; seq++) {
+			slot = seq % APM_WORKER_BLOCKS;
+			ret = webrtc_apm_process_reverse_stream_f(
+				inst->apm_ptr, w->reverse_channels[slot],
+				w->reverse_rate[slot],
+				worker_reverse(w, seq, planes));
+			if (ret)
+				syslog(LOG_ERR, "APM process reverse err");
+			__atomic_store_n(&w->reverse_completed, seq + 1,
+					 __ATOMIC_RELEASE);
+		}
+
+		end = __atomic_load_n(&w->submitted, __ATOMIC_ACQUIRE);
+		for (seq = w->completed; seq != end; seq++) {
+			ret = webrtc_apm_process_stream_f(
+				inst->apm_ptr, inst->fmt.num_channels,
+				inst->fmt.frame_rate,
+				worker_block(inst, seq, planes));
+			if (ret)
+				__atomic_store_n(&w->error, ret,
+						 __ATOMIC_RELAXED);
+			__atomic_store_n(&w->completed, seq + 1,
+					 __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+static void apm_worker_destroy(struct apm_instance *inst)
+{
+	struct apm_worker *w = inst->worker;
+
+	if (w == NULL)
+		return;
+
+	__atomic_store_n(&w->running, 0, __ATOMIC_RELEASE);
+	sem_post(&w->wake);
+	pthread_join(w->tid, NULL);
+	sem_destroy(&w->wake);
+	free(w->blocks);
+	free(w->reverse);
+	free(w);
+	inst->worker = NULL;
+	cras_mem_stats_sub(CRAS_MEM_APM, worker_mem_bytes(inst));
+}
+
+static void apm_worker_create(struct apm_instance *inst)
+{
+	struct apm_worker *w;
+	int rc;
+
+	w = (struct apm_worker *)calloc(1, sizeof(*w));
+	if (w == NULL)
+		return;
+	w->blocks = (float *)calloc((size_t)APM_WORKER_BLOCKS *
+					    inst->fmt.num_channels *
+					    block_frames(inst),
+				    sizeof(float));
+	w->reverse = (float *)calloc((size_t)APM_WORKER_BLOCKS *
+					     APM_WORKER_MAX_REVERSE_SAMPLES,
+				     sizeof(float));
+	if (!w->blocks || !w->reverse) {
+		free(w->blocks);
+		free(w->reverse);
+		free(w);
+		return;
+	}
+	w->running = 1;
+	sem_init(&w->wake, 0, 0);
+	inst->worker = w;
+
+	rc = pthread_create(&w->tid, NULL, apm_worker_thread, inst);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to create APM worker: %d", rc);
+		sem_destroy(&w->wake);
+		free(w->blocks);
+		free(w->reverse);
+		free(w);
+		inst->worker = NULL;
+		return;
+	}
+	cras_mem_stats_add(CRAS_MEM_APM, worker_mem_bytes(inst));
+}
+
+/*
+ * Hands the full input block of inst to the worker and puts the block it
+ * processed since the last call, or silence if it isn't done, in inst->out.
+ * Returns the last error of the APM.
+ */
+static int apm_worker_exchange(struct apm_instance *inst)
+{
+	struct apm_worker *w = inst->worker;
+	unsigned int frames = block_frames(inst);
+	unsigned int completed, nread = frames;
+	float *planes[CRAS_CH_MAX];
+	float *const *rp;
+	bool submitted = false;
+	unsigned int i;
+
+	completed = __atomic_load_n(&w->completed, __ATOMIC_ACQUIRE);
+	if (w->submitted - completed < APM_WORKER_BLOCKS) {
+		rp = float_buffer_read_pointer(inst->fbuffer, 0, &nread);
+		worker_block(inst, w->submitted, planes);
+		for (i = 0; i < inst->fmt.num_channels; i++)
+			memcpy(planes[i], rp[i], frames * sizeof(float));
+		__atomic_store_n(&w->submitted, w->submitted + 1,
+				 __ATOMIC_RELEASE);
+		sem_post(&w->wake);
+		submitted = true;
+	}
+
+	if (w->pending && (int)(completed - w->pending_seq) > 0) {
+		dsp_util_interleave(worker_block(inst, w->pending_seq, planes),
+				    inst->out, inst->fmt.num_channels,
+				    inst->fmt.format, frames);
+	} else {
+		memset(inst->out, 0,
+		       frames * cras_get_format_bytes(&inst->fmt));
+	}
+
+	w->pending = submitted;
+	w->pending_seq = w->submitted - 1;
+	return __atomic_exchange_n(&w->error, 0, __ATOMIC_RELAXED);
+}
+
+/* Queues a reverse block for the worker of inst. Returns false if it
+ * doesn't fit, so it has to be analyzed here. */
+static bool apm_worker_queue_reverse(struct apm_instance *inst,
+				     float *const *rp,
+				     unsigned int num_channels,
+				     unsigned int frames,
+				     unsigned int frame_rate)
+{
+	struct apm_worker *w = inst->worker;
+	unsigned int seq = w->reverse_submitted;
+	unsigned int slot = seq % APM_WORKER_BLOCKS;
+	float *planes[CRAS_CH_MAX];
+	unsigned int i;
+
+	if (num_channels > CRAS_CH_MAX ||
+	    num_channels * frames > APM_WORKER_MAX_REVERSE_SAMPLES)
+		return false;
+
+	/* Drop the block if the worker is that far behind. */
+	if (seq - __atomic_load_n(&w->reverse_completed, __ATOMIC_ACQUIRE) >=
+	    APM_WORKER_BLOCKS)
+		return true;
+
+	w->reverse_channels[slot] = num_channels;
+	w->reverse_frames[slot] = frames;
+	w->reverse_rate[slot] = frame_rate;
+	worker_reverse(w, seq, planes);
+	for (i = 0; i < num_channels; i++)
+		memcpy(planes[i], rp[i], frames * sizeof(float));
+	__atomic_store_n(&w->reverse_submitted, seq + 1, __ATOMIC_RELEASE);
+	sem_post(&w->wake);
+	return true;
+}
+
+static void instance_free(struct apm_instance *inst)
+{
+	apm_worker_destroy(inst);
+	DL_DELETE(instances, inst);
+	cras_mem_stats_sub(CRAS_MEM_APM, instance_mem_bytes(inst));
+	cras_rt_mem_remove(inst->out);
+	cras_rt_mem_remove(inst->fbuffer->data);
+	free(inst->out);
+	float_buffer_destroy(&inst->fbuffer);
+	if (inst->echo_delay)
+		echo_delay_free(inst->echo_delay);
+
+	destroy_retired_apm(inst);
+	if (inst->next_apm)
+		webrtc_apm_destroy(inst->next_apm);
+	/* Any unfinished AEC dump handle will be closed. */
+	webrtc_apm_destroy(inst->apm_ptr);
+	free(inst);
+}
+
+static void instance_put(struct apm_instance *inst)
+{
+	if (--inst->num_users)
+		return;
+
+	if (keep_idle_instances) {
+		/* The next stream starts reading where it attaches. */
+		inst->input = NULL;
+		return;
+	}
+	instance_free(inst);
+}
+
+void cras_apm_list_release_idle(void *dev_ptr)
+{
+	struct apm_instance *inst;
+
+	DL_FOREACH (instances, inst) {
+		if (inst->num_users || (dev_ptr && inst->dev_ptr != dev_ptr))
+			continue;
+		instance_free(inst);
+	}
+	destroy_retired_apms();
+}
+
 static void apm_destroy(struct cras_apm **apm)
 {
 	if (*apm == NULL)
 		return;
-	byte_buffer_destroy(&(*apm)->buffer);
-	float_buffer_destroy(&(*apm)->fbuffer);
 	cras_audio_area_destroy((*apm)->area);
-
-	/* Any unfinished AEC dump handle will be closed. */
-	webrtc_apm_destroy((*apm)->apm_ptr);
+	instance_put((*apm)->inst);
 	free(*apm);
 	*apm = NULL;
 }
@@ -264,67 +738,143 @@ static void get_best_channels(struct cras_audio_format *apm_fmt)
 		apm_fmt->channel_layout[ch] = layout[ch];
 }
 
-struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
-				       void *dev_ptr,
-				       const struct cras_audio_format *dev_fmt,
-				       bool is_aec_use_case)
+static bool formats_equal(const struct cras_audio_format *a,
+			  const struct cras_audio_format *b)
 {
-	struct cras_apm *apm;
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
 
-	DL_FOREACH (list->apms, apm)
-		if (apm->dev_ptr == dev_ptr)
-			return apm;
+/* Finds the APM instance another stream uses on the device for the same
+ * effects and format, so the audio is processed once for all of them. */
+static struct apm_instance *
+find_instance(void *dev_ptr, uint64_t effects,
+	      const struct cras_audio_format *dev_fmt, bool is_aec_use_case)
+{
+	struct apm_instance *inst;
 
-	// TODO(hychao): Remove the check when we enable more effects.
-	if (!(list->effects & APM_ECHO_CANCELLATION))
-		return NULL;
+	DL_FOREACH (instances, inst) {
+		if (inst->dev_ptr == dev_ptr && inst->effects == effects &&
+		    inst->is_aec_use_case == is_aec_use_case &&
+		    formats_equal(&inst->dev_fmt, dev_fmt))
+			return inst;
+	}
+	return NULL;
+}
 
-	apm = (struct cras_apm *)calloc(1, sizeof(*apm));
+static struct apm_instance *
+instance_create(void *dev_ptr, uint64_t effects,
+		const struct cras_audio_format *dev_fmt, bool is_aec_use_case)
+{
+	struct apm_instance *inst;
+	unsigned int frames;
+
+	inst = (struct apm_instance *)calloc(1, sizeof(*inst));
+	if (inst == NULL)
+		return NULL;
 
 	/* Configures APM to the format used by input device. If the channel
 	 * count is larger than stereo, use the standard channel count/layout
 	 * in APM. */
-	apm->dev_fmt = *dev_fmt;
-	apm->fmt = *dev_fmt;
-	get_best_channels(&apm->fmt);
-
-	/* Use tuned settings only when the forward dev(capture) and reverse
-	 * dev(playback) both are in typical AEC use case. */
-	apm->is_aec_use_case = is_aec_use_case;
-	if (rmodule->odev) {
-		apm->is_aec_use_case &=
-			cras_iodev_is_aec_use_case(rmodule->odev->active_node);
-	}
+	inst->dev_fmt = *dev_fmt;
+	inst->fmt = *dev_fmt;
+	get_best_channels(&inst->fmt);
+	inst->is_aec_use_case = is_aec_use_case;
+	if (inst->is_aec_use_case)
+		load_ini_if_pending();
 
 	/* Use the configs tuned specifically for internal device. Otherwise
 	 * just pass NULL so every other settings will be default. */
-	apm->apm_ptr =
-		apm->is_aec_use_case ?
-			webrtc_apm_create(apm->fmt.num_channels,
-					  apm->fmt.frame_rate, aec_ini,
+	inst->apm_ptr =
+		inst->is_aec_use_case ?
+			webrtc_apm_create(inst->fmt.num_channels,
+					  inst->fmt.frame_rate, aec_ini,
 					  apm_ini) :
-			webrtc_apm_create(apm->fmt.num_channels,
-					  apm->fmt.frame_rate, NULL, NULL);
-	if (apm->apm_ptr == NULL) {
+			webrtc_apm_create(inst->fmt.num_channels,
+					  inst->fmt.frame_rate, NULL, NULL);
+	if (inst->apm_ptr == NULL) {
 		syslog(LOG_ERR,
 		       "Fail to create webrtc apm for ch %zu"
 		       " rate %zu effect %" PRIu64,
-		       dev_fmt->num_channels, dev_fmt->frame_rate,
-		       list->effects);
-		free(apm);
+		       dev_fmt->num_channels, dev_fmt->frame_rate, effects);
+		free(inst);
 		return NULL;
 	}
 
-	apm->dev_ptr = dev_ptr;
-	apm->work_queue = NULL;
+	inst->dev_ptr = dev_ptr;
+	inst->effects = effects;
+	inst->work_queue = NULL;
 
 	/* WebRTC APM wants 10 ms equivalence of data to process. */
-	apm->buffer = byte_buffer_create(10 * apm->fmt.frame_rate / 1000 *
-					 cras_get_format_bytes(&apm->fmt));
-	apm->fbuffer = float_buffer_create(10 * apm->fmt.frame_rate / 1000,
-					   apm->fmt.num_channels);
-	apm->area = cras_audio_area_create(apm->fmt.num_channels);
-	cras_audio_area_config_channels(apm->area, &apm->fmt);
+	frames = 10 * inst->fmt.frame_rate / 1000;
+	inst->out = (uint8_t *)calloc(frames,
+				      cras_get_format_bytes(&inst->fmt));
+	inst->fbuffer = float_buffer_create(frames, inst->fmt.num_channels);
+	cras_mem_stats_add(CRAS_MEM_APM, instance_mem_bytes(inst));
+	cras_rt_mem_add(inst->out, frames * cras_get_format_bytes(&inst->fmt));
+	cras_rt_mem_add(inst->fbuffer->data, sizeof(float) *
+						     inst->fbuffer->stride *
+						     inst->fbuffer->num_channels);
+
+	inst->echo_delay = echo_delay_new();
+
+	if (offload_enabled)
+		apm_worker_create(inst);
+
+	DL_APPEND(instances, inst);
+	return inst;
+}
+
+struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
+				       void *dev_ptr,
+				       const struct cras_audio_format *dev_fmt,
+				       bool is_aec_use_case,
+				       uint64_t dsp_effects)
+{
+	struct apm_instance *inst;
+	struct cras_apm *apm;
+	struct cras_apm_reverse_module *rmod;
+	uint64_t effects;
+
+	DL_FOREACH (list->apms, apm)
+		if (apm->dev_ptr == dev_ptr)
+			return apm;
+
+	/* Leave to the device the effects its DSP already applies. */
+	effects = list->effects & ~dsp_effects;
+
+	// TODO(hychao): Remove the check when we enable more effects.
+	if (!(effects & APM_ECHO_CANCELLATION))
+		return NULL;
+
+	destroy_retired_apms();
+
+	/* Use tuned settings only when the forward dev(capture) and all the
+	 * reverse devs(playback) are in typical AEC use case. */
+	DL_FOREACH (rmodules, rmod) {
+		if (rmod->odev)
+			is_aec_use_case &= cras_iodev_is_aec_use_case(
+				rmod->odev->active_node);
+	}
+
+	inst = find_instance(dev_ptr, effects, dev_fmt, is_aec_use_case);
+	if (inst == NULL)
+		inst = instance_create(dev_ptr, effects, dev_fmt,
+				       is_aec_use_case);
+	if (inst == NULL)
+		return NULL;
+
+	apm = (struct cras_apm *)calloc(1, sizeof(*apm));
+	apm->inst = inst;
+	apm->dev_ptr = dev_ptr;
+	/* Start with the next block, the current one is half read by the
+	 * other streams. */
+	apm->consumed = inst->produced;
+	apm->area = cras_audio_area_create(inst->fmt.num_channels);
+	cras_audio_area_config_channels(apm->area, &inst->fmt);
+	inst->num_users++;
 
 	DL_APPEND(list->apms, apm);
 
@@ -355,7 +905,7 @@ void cras_apm_list_start_apm(struct cras_apm_list *list, void *dev_ptr)
 	}
 	active->apm = apm;
 	active->stream_ptr = list->stream_ptr;
-	active->effects = list->effects;
+	active->effects = apm->inst->effects;
 	DL_APPEND(active_apms, active);
 
 	update_process_reverse_flag();
@@ -400,116 +950,173 @@ static struct cras_iodev *get_echo_reference_target(struct cras_iodev *iodev)
 	return iodev->echo_reference_dev ? iodev->echo_reference_dev : iodev;
 }
 
-/*
- * Updates the first enabled output iodev in the list, determine the echo
- * reference target base on this output iodev, and register rmodule as ext dsp
- * module to this echo reference target.
- * When this echo reference iodev is opened and audio data flows through its
- * dsp pipeline, APMs will anaylize the reverse stream. This is expected to be
- * called in main thread when output devices enable/dsiable state changes.
- */
-static void update_first_output_dev_to_process()
-{
-	struct cras_iodev *echo_ref;
-	struct cras_iodev *iodev =
-		cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
-
-	if (iodev == NULL)
-		return;
-
-	echo_ref = get_echo_reference_target(iodev);
-
-	/* If rmodule is already tracking echo_ref, do nothing. */
-	if (rmodule->odev == echo_ref)
-		return;
-
-	/* Detach from the old iodev that rmodule was tracking. */
-	if (rmodule->odev) {
-		cras_iodev_set_ext_dsp_module(rmodule->odev, NULL);
-		rmodule->odev = NULL;
-	}
-
-	rmodule->odev = echo_ref;
-	cras_iodev_set_ext_dsp_module(echo_ref, &rmodule->ext);
-}
-
-static void handle_device_enabled(struct cras_iodev *iodev, void *cb_data)
+/* Returns the planes of block seq in the ring of rmod. */
+static float *const *reverse_block(struct cras_apm_reverse_module *rmod,
+				   unsigned int seq, float **planes)
 {
-	if (iodev->direction != CRAS_STREAM_OUTPUT)
-		return;
-
-	/* Register to the first enabled output device. */
-	update_first_output_dev_to_process();
+	float *block = rmod->ring + (size_t)(seq % REVERSE_RING_SLOTS) *
+					    rmod->num_channels *
+					    rmod->block_frames;
+	unsigned int i;
+
+	for (i = 0; i < rmod->num_channels; i++)
+		planes[i] = block + (size_t)i * rmod->block_frames;
+	return planes;
 }
 
-static void handle_device_disabled(struct cras_iodev *iodev, void *cb_data)
+/* Returns how many blocks before the last one of rmod the reference given
+ * to inst is, to make up for the echo delay estimated for it. */
+static unsigned int reverse_align_blocks(struct apm_instance *inst,
+					 struct cras_apm_reverse_module *rmod)
 {
-	struct cras_iodev *echo_ref;
+	unsigned int blocks;
+	int ms;
 
-	if (iodev->direction != CRAS_STREAM_OUTPUT)
-		return;
-
-	echo_ref = get_echo_reference_target(iodev);
-
-	if (rmodule->odev == echo_ref) {
-		cras_iodev_set_ext_dsp_module(echo_ref, NULL);
-		rmodule->odev = NULL;
-	}
-
-	/* Register to the first enabled output device. */
-	update_first_output_dev_to_process();
+	if (inst->echo_delay == NULL)
+		return 0;
+	ms = echo_delay_get_ms(inst->echo_delay) - ECHO_ALIGN_MARGIN_MS;
+	if (ms < 10)
+		return 0;
+	blocks = MIN(ms / 10, ECHO_ALIGN_MAX_BLOCKS);
+	/* Blocks from before the output started aren't there. */
+	return MIN(blocks, rmod->written - 1);
 }
 
-static int process_reverse(struct float_buffer *fbuf, unsigned int frame_rate)
+/* Gives the last complete block of the lead output rmod, or an older one
+ * for APMs with a late echo, to the APMs doing AEC. */
+static int process_reverse(struct cras_apm_reverse_module *rmod)
 {
 	struct active_apm *active;
+	struct apm_instance *inst;
+	float *last[CRAS_CH_MAX], *planes[CRAS_CH_MAX];
+	unsigned int num_channels = rmod->num_channels;
+	unsigned int frames = rmod->block_frames;
+	unsigned int frame_rate = rmod->dev_rate;
 	int ret;
-	float *const *wp;
 
-	if (float_buffer_writable(fbuf))
-		return 0;
-
-	wp = float_buffer_write_pointer(fbuf);
+	reverse_seq++;
+	reverse_block(rmod, rmod->written - 1, last);
 
 	DL_FOREACH (active_apms, active) {
 		if (!(active->effects & APM_ECHO_CANCELLATION))
 			continue;
+		/* An APM shared by several streams analyzes it once. */
+		inst = active->apm->inst;
+		if (inst->reverse_seq == reverse_seq)
+			continue;
+		inst->reverse_seq = reverse_seq;
+
+		/* The estimate is always made against the newest block. */
+		if (inst->echo_delay)
+			echo_delay_add_reference(inst->echo_delay, last[0],
+						 frames, frame_rate);
+		reverse_block(rmod,
+			      rmod->written - 1 -
+				      reverse_align_blocks(inst, rmod),
+			      planes);
+
+		if (inst->worker &&
+		    apm_worker_queue_reverse(inst, planes, num_channels, frames,
+					     frame_rate))
+			continue;
 
-		ret = webrtc_apm_process_reverse_stream_f(active->apm->apm_ptr,
-							  fbuf->num_channels,
-							  frame_rate, wp);
+		/* With a worker, its thread may swap apm_ptr. */
+		ret = webrtc_apm_process_reverse_stream_f(
+			__atomic_load_n(&inst->apm_ptr, __ATOMIC_ACQUIRE),
+			num_channels, frame_rate, planes);
 		if (ret) {
 			syslog(LOG_ERR, "APM process reverse err");
 			return ret;
 		}
 	}
-	float_buffer_reset(fbuf);
 	return 0;
 }
 
+/* Adds block seq of src to the frames of dst, folding the channels src has
+ * in excess and picking the nearest frames when the block sizes differ. */
+static void mix_reverse_block(float *const *dst, unsigned int num_channels,
+			      unsigned int frames,
+			      struct cras_apm_reverse_module *src,
+			      unsigned int seq)
+{
+	float *planes[CRAS_CH_MAX];
+	unsigned int ch, i;
+	float *d;
+	const float *p;
+
+	reverse_block(src, seq, planes);
+	for (ch = 0; ch < src->num_channels; ch++) {
+		d = dst[ch % num_channels];
+		p = planes[ch];
+		if (src->block_frames == frames) {
+			for (i = 0; i < frames; i++)
+				d[i] += p[i];
+		} else {
+			for (i = 0; i < frames; i++)
+				d[i] += p[(size_t)i * src->block_frames /
+					  frames];
+		}
+	}
+}
+
+/* Called when rmod has completed a block. If rmod leads, mixes the other
+ * outputs into its block and gives the mix to the APMs. */
+static int reverse_block_done(struct cras_apm_reverse_module *rmod)
+{
+	struct cras_apm_reverse_module *other;
+	float *planes[CRAS_CH_MAX];
+	unsigned int queued;
+
+	rmod->written++;
+	if (lead_rmodule == NULL ||
+	    rmod->written - rmod->read >= REVERSE_RING_BLOCKS)
+		lead_rmodule = rmod;
+	if (lead_rmodule != rmod)
+		return 0;
+
+	reverse_block(rmod, rmod->written - 1, planes);
+	rmod->read = rmod->written;
+
+	DL_FOREACH (rmodules, other) {
+		if (other == rmod || other->odev == NULL || other->ring == NULL)
+			continue;
+		queued = other->written - other->read;
+		if (queued == 0)
+			continue;
+		if (queued > REVERSE_MAX_QUEUED)
+			other->read = other->written - REVERSE_MAX_QUEUED;
+		mix_reverse_block(planes, rmod->num_channels,
+				  rmod->block_frames, other, other->read++);
+	}
+
+	return process_reverse(rmod);
+}
+
 void reverse_data_run(struct ext_dsp_module *ext, unsigned int nframes)
 {
 	struct cras_apm_reverse_module *rmod =
 		(struct cras_apm_reverse_module *)ext;
+	float *planes[CRAS_CH_MAX];
 	unsigned int writable;
 	int i, offset = 0;
-	float *const *wp;
 
-	if (!rmod->process_reverse)
+	if (!process_reverse_enabled || rmod->ring == NULL)
 		return;
 
 	while (nframes) {
-		process_reverse(rmod->fbuf, rmod->dev_rate);
-		writable = float_buffer_writable(rmod->fbuf);
-		writable = MIN(nframes, writable);
-		wp = float_buffer_write_pointer(rmod->fbuf);
-		for (i = 0; i < rmod->fbuf->num_channels; i++)
-			memcpy(wp[i], ext->ports[i] + offset,
+		writable = MIN(nframes, rmod->block_frames - rmod->fill);
+		reverse_block(rmod, rmod->written, planes);
+		for (i = 0; i < rmod->num_channels; i++)
+			memcpy(planes[i] + rmod->fill, ext->ports[i] + offset,
 			       writable * sizeof(float));
 
 		offset += writable;
-		float_buffer_written(rmod->fbuf, writable);
+		rmod->fill += writable;
 		nframes -= writable;
+		if (rmod->fill == rmod->block_frames) {
+			rmod->fill = 0;
+			reverse_block_done(rmod);
+		}
 	}
 }
 
@@ -519,10 +1126,106 @@ void reverse_data_configure(struct ext_dsp_module *ext,
 {
 	struct cras_apm_reverse_module *rmod =
 		(struct cras_apm_reverse_module *)ext;
-	if (rmod->fbuf)
-		float_buffer_destroy(&rmod->fbuf);
-	rmod->fbuf = float_buffer_create(rate / 100, num_channels);
+
+	if (rmod->ring) {
+		cras_mem_stats_sub(CRAS_MEM_APM, reverse_ring_bytes(rmod));
+		cras_rt_mem_remove(rmod->ring);
+	}
+	free(rmod->ring);
+	rmod->ring = NULL;
+	rmod->fill = 0;
+	rmod->written = 0;
+	rmod->read = 0;
+	if (num_channels > CRAS_CH_MAX || rate < 100)
+		return;
+
+	rmod->num_channels = num_channels;
+	rmod->block_frames = rate / 100;
 	rmod->dev_rate = rate;
+	rmod->ring = (float *)calloc((size_t)REVERSE_RING_SLOTS *
+					     num_channels * rmod->block_frames,
+				     sizeof(float));
+	if (!rmod->ring)
+		return;
+	cras_mem_stats_add(CRAS_MEM_APM, reverse_ring_bytes(rmod));
+	cras_rt_mem_add(rmod->ring, reverse_ring_bytes(rmod));
+}
+
+static struct cras_apm_reverse_module *
+find_reverse_module(const struct cras_iodev *echo_ref)
+{
+	struct cras_apm_reverse_module *rmod;
+
+	DL_FOREACH (rmodules, rmod)
+		if (rmod->odev == echo_ref)
+			return rmod;
+	return NULL;
+}
+
+/*
+ * Registers a reverse module as ext dsp module to the echo reference target
+ * of an enabled output iodev. When this echo reference iodev is opened and
+ * audio data flows through its dsp pipeline, APMs will analyze the reverse
+ * stream. Unused modules are kept for reuse rather than freed, as the audio
+ * thread may still be running one when its output is disabled. This is
+ * expected to be called in main thread when output devices are enabled.
+ */
+static void attach_reverse_module(struct cras_iodev *iodev)
+{
+	struct cras_iodev *echo_ref = get_echo_reference_target(iodev);
+	struct cras_apm_reverse_module *rmod;
+
+	rmod = find_reverse_module(echo_ref);
+	if (rmod) {
+		rmod->num_odevs++;
+		return;
+	}
+
+	rmod = find_reverse_module(NULL);
+	if (rmod == NULL) {
+		rmod = (struct cras_apm_reverse_module *)calloc(
+			1, sizeof(*rmod));
+		if (rmod == NULL)
+			return;
+		rmod->ext.run = reverse_data_run;
+		rmod->ext.configure = reverse_data_configure;
+		DL_APPEND(rmodules, rmod);
+	}
+	rmod->odev = echo_ref;
+	rmod->num_odevs = 1;
+	cras_iodev_set_ext_dsp_module(echo_ref, &rmod->ext);
+}
+
+/* Unregisters the reverse module of a disabled output iodev. */
+static void detach_reverse_module(struct cras_iodev *iodev)
+{
+	struct cras_iodev *echo_ref = get_echo_reference_target(iodev);
+	struct cras_apm_reverse_module *rmod;
+
+	rmod = find_reverse_module(echo_ref);
+	if (rmod == NULL || --rmod->num_odevs)
+		return;
+
+	cras_iodev_set_ext_dsp_module(echo_ref, NULL);
+	rmod->odev = NULL;
+	if (lead_rmodule == rmod)
+		lead_rmodule = NULL;
+}
+
+static void handle_device_enabled(struct cras_iodev *iodev, void *cb_data)
+{
+	if (iodev->direction != CRAS_STREAM_OUTPUT)
+		return;
+
+	attach_reverse_module(iodev);
+}
+
+static void handle_device_disabled(struct cras_iodev *iodev, void *cb_data)
+{
+	if (iodev->direction != CRAS_STREAM_OUTPUT)
+		return;
+
+	detach_reverse_module(iodev);
 }
 
 static void get_aec_ini(const char *config_dir)
@@ -557,31 +1260,83 @@ static void get_apm_ini(const char *config_dir)
 
 int cras_apm_list_init(const char *device_config_dir)
 {
-	if (rmodule == NULL) {
-		rmodule = (struct cras_apm_reverse_module *)calloc(
-			1, sizeof(*rmodule));
-		rmodule->ext.run = reverse_data_run;
-		rmodule->ext.configure = reverse_data_configure;
-	}
+	struct cras_iodev *iodev;
 
+	offload_enabled = cras_system_get_apm_offload_enabled();
+	keep_idle_instances = cras_system_get_mic_keep_warm_ms() > 0;
 	aec_config_dir = device_config_dir;
-	get_aec_ini(aec_config_dir);
-	get_apm_ini(aec_config_dir);
+	ini_load_pending = 1;
 
-	update_first_output_dev_to_process();
+	iodev = cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
+	if (iodev && !find_reverse_module(get_echo_reference_target(iodev)))
+		attach_reverse_module(iodev);
 	cras_iodev_list_set_device_enabled_callback(
-		handle_device_enabled, handle_device_disabled, rmodule);
+		handle_device_enabled, handle_device_disabled, NULL);
 
 	return 0;
 }
 
+static void load_ini_if_pending()
+{
+	if (!ini_load_pending)
+		return;
+
+	ini_load_pending = 0;
+	get_aec_ini(aec_config_dir);
+	get_apm_ini(aec_config_dir);
+}
+
+/*
+ * Builds an APM with the current configs for an instance in use, to replace
+ * its APM at the next block. The webrtc_apm API has no way to change the
+ * settings of an APM, so even a small tuning change takes a new one. Any
+ * replacement not yet swapped in is dropped.
+ */
+static void rebuild_instance_apm(struct apm_instance *inst)
+{
+	webrtc_apm apm;
+
+	if (!inst->is_aec_use_case)
+		return;
+	/* The dump is bound to the APM, it would stop silently. */
+	if (inst->work_queue) {
+		syslog(LOG_WARNING,
+		       "AEC dump running, reloaded config waits for restart");
+		return;
+	}
+
+	destroy_retired_apm(inst);
+	apm = __atomic_exchange_n(&inst->next_apm, NULL, __ATOMIC_ACQUIRE);
+	if (apm)
+		webrtc_apm_destroy(apm);
+
+	apm = webrtc_apm_create(inst->fmt.num_channels, inst->fmt.frame_rate,
+				aec_ini, apm_ini);
+	if (apm == NULL) {
+		syslog(LOG_ERR,
+		       "Fail to rebuild webrtc apm for ch %zu rate %zu",
+		       inst->fmt.num_channels, inst->fmt.frame_rate);
+		return;
+	}
+	__atomic_store_n(&inst->next_apm, apm, __ATOMIC_RELEASE);
+}
+
 void cras_apm_list_reload_aec_config()
 {
+	struct apm_instance *inst;
+
 	if (NULL == aec_config_dir)
 		return;
 
+	ini_load_pending = 0;
 	get_aec_ini(aec_config_dir);
 	get_apm_ini(aec_config_dir);
+	/* Don't hand out instances created with the old config. */
+	cras_apm_list_release_idle(NULL);
+	/* Streams keep running, the instances they read from change APM
+	 * between two blocks. */
+	DL_FOREACH (instances, inst)
+		rebuild_instance_apm(inst);
 
 	/* Dump the config content at reload only, for debug. */
 	webrtc_apm_dump_configs(apm_ini, aec_ini);
@@ -589,19 +1344,67 @@ void cras_apm_list_reload_aec_config()
 
 int cras_apm_list_deinit()
 {
-	if (rmodule) {
-		if (rmodule->fbuf)
-			float_buffer_destroy(&rmodule->fbuf);
-		free(rmodule);
-		rmodule = NULL;
+	struct cras_apm_reverse_module *rmod;
+
+	DL_FOREACH (rmodules, rmod) {
+		DL_DELETE(rmodules, rmod);
+		if (rmod->ring) {
+			cras_mem_stats_sub(CRAS_MEM_APM,
+					   reverse_ring_bytes(rmod));
+			cras_rt_mem_remove(rmod->ring);
+		}
+		free(rmod->ring);
+		free(rmod);
 	}
+	lead_rmodule = NULL;
+	cras_apm_list_release_idle(NULL);
 	return 0;
 }
 
+/*
+ * Returns where the instance stopped reading input, as an offset from the
+ * read pointer of input. The streams of a device consume its buffer at the
+ * pace of the slowest one, so the read pointer may have moved since. If
+ * input is new or was reset, the caller's offset is used.
+ */
+static unsigned int input_offset(struct apm_instance *inst,
+				 struct float_buffer *input,
+				 unsigned int offset)
+{
+	struct byte_buffer *b = input->buf;
+	unsigned int pos;
+
+	if (inst->input != input)
+		return offset;
+
+	pos = (inst->input_idx + b->used_size - b->read_idx) % b->used_size;
+	/* A full buffer read to the end wraps to zero. */
+	if (pos == 0 && buf_queued(b) == b->used_size)
+		pos = offset;
+	return pos > buf_queued(b) ? offset : pos;
+}
+
+/* Returns true when every started stream of inst has read the processed
+ * block, so the next one can be written. */
+static bool all_consumed(struct cras_apm *apm)
+{
+	struct active_apm *active;
+
+	if (apm->consumed != apm->inst->produced)
+		return false;
+	DL_FOREACH (active_apms, active) {
+		if (active->apm->inst == apm->inst &&
+		    active->apm->consumed != apm->inst->produced)
+			return false;
+	}
+	return true;
+}
+
 int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
 			  unsigned int offset)
 {
-	unsigned int writable, nframes, nread;
+	struct apm_instance *inst = apm->inst;
+	unsigned int writable, nframes, nread, pos, advance;
 	int ch, i, j, ret;
 	float *const *wp;
 	float *const *rp;
@@ -612,26 +1415,29 @@ int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
 		return -EINVAL;
 	}
 
-	writable = float_buffer_writable(apm->fbuffer);
-	writable = MIN(nread - offset, writable);
+	/* Another stream sharing inst may have already read this. */
+	pos = input_offset(inst, input, offset);
+
+	writable = float_buffer_writable(inst->fbuffer);
+	writable = MIN(nread - pos, writable);
 
 	nframes = writable;
 	while (nframes) {
 		nread = nframes;
-		wp = float_buffer_write_pointer(apm->fbuffer);
-		rp = float_buffer_read_pointer(input, offset, &nread);
+		wp = float_buffer_write_pointer(inst->fbuffer);
+		rp = float_buffer_read_pointer(input, pos, &nread);
 
-		for (i = 0; i < apm->fbuffer->num_channels; i++) {
+		for (i = 0; i < inst->fbuffer->num_channels; i++) {
 			/* Look up the channel position and copy from
 			 * the correct index of |input| buffer.
 			 */
 			for (ch = 0; ch < CRAS_CH_MAX; ch++)
-				if (apm->fmt.channel_layout[ch] == i)
+				if (inst->fmt.channel_layout[ch] == i)
 					break;
 			if (ch == CRAS_CH_MAX)
 				continue;
 
-			j = apm->dev_fmt.channel_layout[ch];
+			j = inst->dev_fmt.channel_layout[ch];
 			if (j == -1)
 				continue;
 
@@ -639,61 +1445,92 @@ int cras_apm_list_process(struct cras_apm *apm, struct float_buffer *input,
 		}
 
 		nframes -= nread;
-		offset += nread;
+		pos += nread;
 
-		float_buffer_written(apm->fbuffer, nread);
+		float_buffer_written(inst->fbuffer, nread);
+	}
+	inst->input = input;
+	inst->input_idx = (input->buf->read_idx + pos) % input->buf->used_size;
+	advance = pos > offset ? pos - offset : 0;
+
+	if ((float_buffer_writable(inst->fbuffer) != 0) || !all_consumed(apm))
+		return advance;
+
+	if (inst->echo_delay) {
+		nread = float_buffer_level(inst->fbuffer);
+		rp = float_buffer_read_pointer(inst->fbuffer, 0, &nread);
+		echo_delay_add_capture(inst->echo_delay, rp[0], nread,
+				       inst->fmt.frame_rate);
+		echo_delay_update(inst->echo_delay);
 	}
 
-	/* process and move to int buffer */
-	if ((float_buffer_writable(apm->fbuffer) == 0) &&
-	    (buf_queued(apm->buffer) == 0)) {
-		nread = float_buffer_level(apm->fbuffer);
-		rp = float_buffer_read_pointer(apm->fbuffer, 0, &nread);
-		ret = webrtc_apm_process_stream_f(apm->apm_ptr,
-						  apm->fmt.num_channels,
-						  apm->fmt.frame_rate, rp);
+	if (inst->worker) {
+		/* Only copy the blocks in and out, the worker runs the APM. */
+		ret = apm_worker_exchange(inst);
+		inst->produced += block_frames(inst);
+		float_buffer_reset(inst->fbuffer);
 		if (ret) {
 			syslog(LOG_ERR, "APM process stream f err");
 			return ret;
 		}
+		return advance;
+	}
 
-		dsp_util_interleave(rp, buf_write_pointer(apm->buffer),
-				    apm->fbuffer->num_channels, apm->fmt.format,
-				    nread);
-		buf_increment_write(apm->buffer,
-				    nread * cras_get_format_bytes(&apm->fmt));
-		float_buffer_reset(apm->fbuffer);
+	/* process and move to int buffer */
+	swap_in_next_apm(inst);
+	nread = float_buffer_level(inst->fbuffer);
+	rp = float_buffer_read_pointer(inst->fbuffer, 0, &nread);
+	ret = webrtc_apm_process_stream_f(inst->apm_ptr, inst->fmt.num_channels,
+					  inst->fmt.frame_rate, rp);
+	if (ret) {
+		syslog(LOG_ERR, "APM process stream f err");
+		return ret;
 	}
 
-	return writable;
+	dsp_util_interleave(rp, inst->out, inst->fbuffer->num_channels,
+			    inst->fmt.format, nread);
+	inst->produced += nread;
+	float_buffer_reset(inst->fbuffer);
+
+	return advance;
 }
 
 struct cras_audio_area *cras_apm_list_get_processed(struct cras_apm *apm)
 {
-	uint8_t *buf_ptr;
-
-	buf_ptr = buf_read_pointer_size(apm->buffer, &apm->area->frames);
-	apm->area->frames /= cras_get_format_bytes(&apm->fmt);
-	cras_audio_area_config_buf_pointers(apm->area, &apm->fmt, buf_ptr);
+	struct apm_instance *inst = apm->inst;
+	unsigned int block = block_frames(inst);
+	unsigned int pending = inst->produced - apm->consumed;
+
+	/* A block is always processed whole into an empty out, so the
+	 * pending frames are its last ones. */
+	apm->area->frames = pending;
+	cras_audio_area_config_buf_pointers(
+		apm->area, &inst->fmt,
+		inst->out + (block - pending) *
+				    cras_get_format_bytes(&inst->fmt));
 	return apm->area;
 }
 
 void cras_apm_list_put_processed(struct cras_apm *apm, unsigned int frames)
 {
-	buf_increment_read(apm->buffer,
-			   frames * cras_get_format_bytes(&apm->fmt));
+	apm->consumed += MIN(frames, apm->inst->produced - apm->consumed);
+}
+
+unsigned int cras_apm_list_get_delay(struct cras_apm *apm)
+{
+	return apm->inst->worker ? block_frames(apm->inst) : 0;
 }
 
 struct cras_audio_format *cras_apm_list_get_format(struct cras_apm *apm)
 {
-	return &apm->fmt;
+	return &apm->inst->fmt;
 }
 
 bool cras_apm_list_get_use_tuned_settings(struct cras_apm *apm)
 {
 	/* If input and output devices in AEC use case, plus that a
 	 * tuned setting is provided. */
-	return apm->is_aec_use_case && (aec_ini || apm_ini);
+	return apm->inst->is_aec_use_case && (aec_ini || apm_ini);
 }
 
 void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
@@ -709,20 +1546,23 @@ void cras_apm_list_set_aec_dump(struct cras_apm_list *list, void *dev_ptr,
 		return;
 
 	if (start) {
-		handle = fdopen(fd, "w");
+		/* Records are written to fd from a background thread, so
+		 * file system latency doesn't reach the audio thread. */
+		handle = aec_dump_writer_open(fd, AEC_DUMP_RING_BYTES);
 		if (handle == NULL) {
-			syslog(LOG_ERR, "Create dump handle fail, errno %d",
-			       errno);
+			syslog(LOG_ERR, "Create dump handle fail");
 			return;
 		}
 		/* webrtc apm will own the FILE handle and close it. */
-		rc = webrtc_apm_aec_dump(apm->apm_ptr, &apm->work_queue, start,
+		rc = webrtc_apm_aec_dump(apm->inst->apm_ptr,
+					 &apm->inst->work_queue, start,
 					 handle);
 		if (rc)
 			syslog(LOG_ERR, "Fail to dump debug file %s, rc %d",
 			       file_name, rc);
 	} else {
-		rc = webrtc_apm_aec_dump(apm->apm_ptr, &apm->work_queue, 0,
+		rc = webrtc_apm_aec_dump(apm->inst->apm_ptr,
+					 &apm->inst->work_queue, 0,
 					 NULL);
 		if (rc)
 			syslog(LOG_ERR, "Failed to stop apm debug, rc %d", rc);
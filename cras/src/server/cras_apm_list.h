@@ -19,7 +19,9 @@ struct float_buffer;
 /* Initialize the apm list for analyzing output data. */
 int cras_apm_list_init(const char *device_config_dir);
 
-/* Reloads the aec config. Used for debug and tuning. */
+/* Reloads the aec config. Used for debug and tuning. Instances in use by
+ * streams get a new APM with the reloaded config, built here and swapped in
+ * by the thread processing them at the next 10ms block. */
 void cras_apm_list_reload_aec_config();
 
 /* Deinitialize apm list to free all allocated resources. */
@@ -55,18 +57,26 @@ struct cras_apm_list *cras_apm_list_create(void *stream_ptr, uint64_t effects);
 /*
  * Creates a cras_apm associated to given dev_ptr and adds it to the list.
  * If there already exists an APM instance linked to dev_ptr, we assume
- * the open format is unchanged so just return it. This should be called
- * in main thread.
+ * the open format is unchanged so just return it. If another stream has
+ * an APM on dev_ptr with the same effects and format, the new cras_apm
+ * shares its WebRTC APM so the audio is processed once for both. This
+ * should be called in main thread.
  * Args:
  *    list - The list holding APM instances.
  *    dev_ptr - Pointer to the iodev to add new APM for.
  *    fmt - Format of the audio data used for this cras_apm.
  *    is_aec_use_case - If the dev_ptr is for typical AEC use case.
+ *    dsp_effects - Bit map of the effects the device already applies in
+ *        its own DSP. These are not run again in APM, and no APM is
+ *        created when none of the effects of the list are left.
+ * Returns:
+ *    The cras_apm, or NULL if the stream needs no APM on this device.
  */
 struct cras_apm *cras_apm_list_add_apm(struct cras_apm_list *list,
 				       void *dev_ptr,
 				       const struct cras_audio_format *fmt,
-				       bool is_aec_use_case);
+				       bool is_aec_use_case,
+				       uint64_t dsp_effects);
 
 /*
  * Gets the active APM instance that is associated to given stream and dev pair.
@@ -109,6 +119,17 @@ int cras_apm_list_destroy(struct cras_apm_list *list);
  */
 void cras_apm_list_remove_apm(struct cras_apm_list *list, void *dev_ptr);
 
+/*
+ * Frees the APM instances of a device that no stream uses anymore. While
+ * inputs are kept warm the instances stay around after their last stream
+ * is removed, so the next stream skips creating them. Call when the device
+ * closes, in main thread.
+ * Args:
+ *    dev_ptr - Device pointer whose idle instances to free, NULL for all
+ *        devices.
+ */
+void cras_apm_list_release_idle(void *dev_ptr);
+
 /* Passes audio data from hardware for cras_apm to process.
  * Args:
  *    apm - The cras_apm instance.
@@ -143,6 +164,12 @@ void cras_apm_list_put_processed(struct cras_apm *apm, unsigned int frames);
  */
 struct cras_audio_format *cras_apm_list_get_format(struct cras_apm *apm);
 
+/* Gets the delay in frames |apm| adds to the captured audio on top of the
+ * device delay. That is one 10ms block when the board runs APMs on worker
+ * threads, otherwise 0.
+ */
+unsigned int cras_apm_list_get_delay(struct cras_apm *apm);
+
 /*
  * Gets if this apm instance is using tuned settings.
  */
@@ -179,7 +206,8 @@ static inline struct cras_apm_list *cras_apm_list_create(void *stream_ptr,
 }
 static inline struct cras_apm *
 cras_apm_list_add_apm(struct cras_apm_list *list, void *dev_ptr,
-		      const struct cras_audio_format *fmt, bool is_aec_use_case)
+		      const struct cras_audio_format *fmt, bool is_aec_use_case,
+		      uint64_t dsp_effects)
 {
 	return NULL;
 }
@@ -200,6 +228,9 @@ static inline void cras_apm_list_remove_apm(struct cras_apm_list *list,
 					    void *dev_ptr)
 {
 }
+static inline void cras_apm_list_release_idle(void *dev_ptr)
+{
+}
 
 static inline int cras_apm_list_process(struct cras_apm *apm,
 					struct float_buffer *input,
@@ -233,6 +264,11 @@ cras_apm_list_get_format(struct cras_apm *apm)
 	return NULL;
 }
 
+static inline unsigned int cras_apm_list_get_delay(struct cras_apm *apm)
+{
+	return 0;
+}
+
 static inline bool cras_apm_list_get_use_tuned_settings(struct cras_apm *apm)
 {
 	return 0;
@@ -4,8 +4,13 @@
  */
 
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
 #include <syslog.h>
 #include "audio_thread.h"
+#include "audio_thread_log.h"
+#include "cras_flight_recorder.h"
 #include "cras_iodev_list.h"
 #include "cras_main_message.h"
 #include "cras_system_state.h"
@@ -19,18 +24,95 @@ struct cras_audio_thread_event_message {
 	enum CRAS_AUDIO_THREAD_EVENT_TYPE event_type;
 };
 
+/* Times the audio thread is asked for its state when devices or streams keep
+ * being added while the arrays for them are grown. */
+#define MAX_DUMP_TRIES 3
+
+/* Log position of the last snapshot, the next one only holds the events
+ * logged since. */
+static uint64_t last_log_write_pos;
+
+/* Asks the audio thread for its devices, streams and the events logged since
+ * the last snapshot, and packs them into a new snapshot. */
+static struct cras_audio_thread_snapshot *
+dump_snapshot(enum CRAS_AUDIO_THREAD_EVENT_TYPE event_type,
+	      const struct timespec *now)
+{
+	struct audio_thread_snapshot_dump dump;
+	struct cras_audio_thread_snapshot *snapshot = NULL;
+	size_t devs_bytes, streams_bytes, events_bytes;
+	uint8_t *p;
+	int tries;
+
+	memset(&dump, 0, sizeof(dump));
+	dump.max_devs = MAX_DEBUG_DEVS;
+	dump.max_streams = MAX_DEBUG_STREAMS;
+	dump.max_events = AUDIO_THREAD_EVENT_LOG_SIZE;
+	dump.log_from = last_log_write_pos;
+	dump.events = (struct audio_thread_event *)calloc(
+		dump.max_events, sizeof(*dump.events));
+	if (!dump.events)
+		return NULL;
+
+	for (tries = 0; tries < MAX_DUMP_TRIES; tries++) {
+		free(dump.devs);
+		free(dump.streams);
+		dump.devs = (struct audio_dev_debug_info *)calloc(
+			dump.max_devs, sizeof(*dump.devs));
+		dump.streams = (struct audio_stream_debug_info *)calloc(
+			dump.max_streams, sizeof(*dump.streams));
+		if (!dump.devs || !dump.streams)
+			goto out;
+		memset(&dump.hdr, 0, sizeof(dump.hdr));
+		if (audio_thread_dump_snapshot(
+			    cras_iodev_list_get_audio_thread(), &dump))
+			goto out;
+		if (dump.hdr.num_devs <= dump.max_devs &&
+		    dump.hdr.num_streams <= dump.max_streams)
+			break;
+		dump.max_devs = MAX(dump.max_devs, dump.hdr.num_devs);
+		dump.max_streams = MAX(dump.max_streams, dump.hdr.num_streams);
+	}
+	dump.hdr.num_devs = MIN(dump.hdr.num_devs, dump.max_devs);
+	dump.hdr.num_streams = MIN(dump.hdr.num_streams, dump.max_streams);
+
+	devs_bytes = dump.hdr.num_devs * sizeof(*dump.devs);
+	streams_bytes = dump.hdr.num_streams * sizeof(*dump.streams);
+	events_bytes = dump.hdr.num_events * sizeof(*dump.events);
+	snapshot = (struct cras_audio_thread_snapshot *)malloc(
+		sizeof(*snapshot) + devs_bytes + streams_bytes + events_bytes);
+	if (!snapshot)
+		goto out;
+	*snapshot = dump.hdr;
+	snapshot->timestamp = *now;
+	snapshot->event_type = event_type;
+	snapshot->size =
+		sizeof(*snapshot) + devs_bytes + streams_bytes + events_bytes;
+	p = (uint8_t *)(snapshot + 1);
+	memcpy(p, dump.devs, devs_bytes);
+	memcpy(p + devs_bytes, dump.streams, streams_bytes);
+	memcpy(p + devs_bytes + streams_bytes, dump.events, events_bytes);
+	last_log_write_pos = dump.hdr.log_write_pos;
+
+out:
+	free(dump.devs);
+	free(dump.streams);
+	free(dump.events);
+	return snapshot;
+}
+
 static void take_snapshot(enum CRAS_AUDIO_THREAD_EVENT_TYPE event_type)
 {
 	struct cras_audio_thread_snapshot *snapshot;
-
-	snapshot = (struct cras_audio_thread_snapshot *)calloc(
-		1, sizeof(struct cras_audio_thread_snapshot));
 	struct timespec now_time;
+
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now_time);
-	snapshot->timestamp = now_time;
-	snapshot->event_type = event_type;
-	audio_thread_dump_thread_info(cras_iodev_list_get_audio_thread(),
-				      &snapshot->audio_debug_info);
+	snapshot = dump_snapshot(event_type, &now_time);
+	if (!snapshot) {
+		syslog(LOG_ERR, "Failed to take audio thread snapshot");
+		return;
+	}
+	cras_flight_recorder_record(snapshot, atlog);
 	cras_system_state_add_snapshot(snapshot);
 }
 
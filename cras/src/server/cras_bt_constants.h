@@ -43,6 +43,10 @@
 
 #define GENERIC_AUDIO_UUID "00001203-0000-1000-8000-00805f9b34fb"
 
+/* Published Audio Capabilities of LE Audio, per the BAP specification. */
+#define PAC_SINK_UUID "00002bc9-0000-1000-8000-00805f9b34fb"
+#define PAC_SOURCE_UUID "00002bcb-0000-1000-8000-00805f9b34fb"
+
 /* Constants for CRAS BT player */
 #define CRAS_DEFAULT_PLAYER "/org/chromium/Cras/Bluetooth/DefaultPlayer"
 /* The longest possible player playback status is "forward-seek" */
@@ -17,6 +17,7 @@
 #include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "bluetooth.h"
 #include "cras_a2dp_endpoint.h"
@@ -34,6 +35,7 @@
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
 #include "cras_tm.h"
+#include "cras_util.h"
 #include "sfh.h"
 #include "utlist.h"
 
@@ -89,6 +91,7 @@ static const unsigned int CRAS_SUPPORTED_PROFILES =
  *    suspend_timer - The timer used to suspend device.
  *    switch_profile_timer - The timer used to delay enabling iodev after
  *        profile switch.
+ *    switch_profile_begin - When the running profile switch started.
  *    sco_fd - The file descriptor of the SCO connection.
  *    sco_ref_count - The reference counts of the SCO connection.
  *    suspend_reason - The reason code for why suspend is scheduled.
@@ -114,6 +117,7 @@ struct cras_bt_device {
 	struct cras_timer *conn_watch_timer;
 	struct cras_timer *suspend_timer;
 	struct cras_timer *switch_profile_timer;
+	struct timespec switch_profile_begin;
 	int sco_fd;
 	size_t sco_ref_count;
 	enum cras_bt_device_suspend_reason suspend_reason;
@@ -158,6 +162,9 @@ enum cras_bt_device_profile cras_bt_device_profile_from_uuid(const char *uuid)
 		return CRAS_BT_DEVICE_PROFILE_AVRCP_REMOTE;
 	else if (strcmp(uuid, AVRCP_TARGET_UUID) == 0)
 		return CRAS_BT_DEVICE_PROFILE_AVRCP_TARGET;
+	else if (strcmp(uuid, PAC_SINK_UUID) == 0 ||
+		 strcmp(uuid, PAC_SOURCE_UUID) == 0)
+		return CRAS_BT_DEVICE_PROFILE_LE_AUDIO;
 	else
 		return 0;
 }
@@ -492,6 +499,10 @@ int cras_bt_device_can_switch_to_a2dp(struct cras_bt_device *device)
 {
 	struct cras_iodev *idev = device->bt_iodevs[CRAS_STREAM_INPUT];
 
+	/* LE Audio carries both directions at once, keep using it. */
+	if (device->active_profile & CRAS_BT_DEVICE_PROFILE_LE_AUDIO)
+		return 0;
+
 	return cras_bt_device_has_a2dp(device) &&
 	       (!idev || !cras_iodev_is_open(idev));
 }
@@ -582,6 +593,10 @@ static void cras_bt_device_log_profile(const struct cras_bt_device *device,
 		syslog(LOG_DEBUG, "Bluetooth Device: %s is HSP audio gateway",
 		       device->address);
 		break;
+	case CRAS_BT_DEVICE_PROFILE_LE_AUDIO:
+		syslog(LOG_DEBUG, "Bluetooth Device: %s is LE Audio",
+		       device->address);
+		break;
 	}
 }
 
@@ -1193,6 +1208,27 @@ int cras_bt_device_switch_profile(struct cras_bt_device *device,
 	return rc;
 }
 
+/* Logs how long it took from the profile switch to audio running again on
+ * the new profile. Nothing is logged if the iodevs weren't reopened. */
+static void bt_device_log_switch_time(struct cras_bt_device *device)
+{
+	struct timespec now, elapsed;
+	int dir, open = 0;
+
+	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++)
+		if (device->bt_iodevs[dir] &&
+		    cras_iodev_is_open(device->bt_iodevs[dir]))
+			open = 1;
+	if (!open)
+		return;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &device->switch_profile_begin, &elapsed);
+	cras_server_metrics_bt_profile_switch_time(
+		&elapsed,
+		device->active_profile & CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE);
+}
+
 static void profile_switch_delay_cb(struct cras_timer *timer, void *arg)
 {
 	struct cras_bt_device *device = (struct cras_bt_device *)arg;
@@ -1213,6 +1249,7 @@ static void profile_switch_delay_cb(struct cras_timer *timer, void *arg)
 	 */
 	iodev->update_active_node(iodev, 0, 1);
 	cras_iodev_list_resume_dev(iodev->info.idx);
+	bt_device_log_switch_time(device);
 }
 
 static void bt_device_switch_profile_with_delay(struct cras_bt_device *device,
@@ -1230,7 +1267,9 @@ static void bt_device_switch_profile_with_delay(struct cras_bt_device *device,
 
 /* Switches associated bt iodevs to use the active profile. This is
  * achieved by close the iodevs, update their active nodes, and then
- * finally reopen them. */
+ * finally reopen them. The input is reopened first, so when switching to
+ * HFP/HSP the SCO connection it sets up is ready for the output to join
+ * right away. */
 static void bt_device_switch_profile(struct cras_bt_device *device,
 				     struct cras_iodev *bt_iodev,
 				     int enable_dev)
@@ -1238,6 +1277,8 @@ static void bt_device_switch_profile(struct cras_bt_device *device,
 	struct cras_iodev *iodev;
 	int dir;
 
+	clock_gettime(CLOCK_MONOTONIC_RAW, &device->switch_profile_begin);
+
 	/* If a bt iodev is active, temporarily force close it.
 	 * Note that we need to check all bt_iodevs for the situation that both
 	 * input and output are active while switches from HFP/HSP to A2DP.
@@ -1249,26 +1290,42 @@ static void bt_device_switch_profile(struct cras_bt_device *device,
 		cras_iodev_list_suspend_dev(iodev->info.idx);
 	}
 
-	for (dir = 0; dir < CRAS_NUM_DIRECTIONS; dir++) {
-		iodev = device->bt_iodevs[dir];
-		if (!iodev)
-			continue;
+	/* If the iodev was active or this profile switching is triggered at
+	 * opening iodev, add it to active dev list. */
+	iodev = device->bt_iodevs[CRAS_STREAM_INPUT];
+	if (iodev) {
+		iodev->update_active_node(iodev, 0, 1);
+		cras_iodev_list_resume_dev(iodev->info.idx);
+	}
 
-		/* If the iodev was active or this profile switching is
-		 * triggered at opening iodev, add it to active dev list.
-		 * However for the output iodev, adding it back to active dev
-		 * list could cause immediate switching from HFP to A2DP if
-		 * there exists an output stream. Certain headset/speaker
-		 * would fail to playback afterwards when the switching happens
-		 * too soon, so put this task in a delayed callback.
-		 */
-		if (dir == CRAS_STREAM_INPUT) {
-			iodev->update_active_node(iodev, 0, 1);
-			cras_iodev_list_resume_dev(iodev->info.idx);
-		} else {
-			bt_device_switch_profile_with_delay(
-				device, PROFILE_SWITCH_DELAY_MS);
+	iodev = device->bt_iodevs[CRAS_STREAM_OUTPUT];
+	if (!iodev) {
+		bt_device_log_switch_time(device);
+		return;
+	}
+
+	/* An output on HFP/HSP shares the SCO connection of the open input,
+	 * resume it together so a call doesn't start with silence.
+	 * Otherwise adding the output iodev back to active dev list could
+	 * cause immediate switching from HFP to A2DP if there exists an
+	 * output stream. Certain headset/speaker would fail to playback
+	 * afterwards when the switching happens too soon, so put this task in
+	 * a delayed callback.
+	 */
+	if (!(device->active_profile & CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE) &&
+	    device->bt_iodevs[CRAS_STREAM_INPUT] &&
+	    cras_iodev_is_open(device->bt_iodevs[CRAS_STREAM_INPUT])) {
+		if (device->switch_profile_timer) {
+			cras_tm_cancel_timer(cras_system_state_get_tm(),
+					     device->switch_profile_timer);
+			device->switch_profile_timer = NULL;
 		}
+		iodev->update_active_node(iodev, 0, 1);
+		cras_iodev_list_resume_dev(iodev->info.idx);
+		bt_device_log_switch_time(device);
+	} else {
+		bt_device_switch_profile_with_delay(device,
+						    PROFILE_SWITCH_DELAY_MS);
 	}
 }
 
@@ -31,7 +31,8 @@ enum cras_bt_device_profile {
 	CRAS_BT_DEVICE_PROFILE_HFP_HANDSFREE = (1 << 4),
 	CRAS_BT_DEVICE_PROFILE_HFP_AUDIOGATEWAY = (1 << 5),
 	CRAS_BT_DEVICE_PROFILE_HSP_HEADSET = (1 << 6),
-	CRAS_BT_DEVICE_PROFILE_HSP_AUDIOGATEWAY = (1 << 7)
+	CRAS_BT_DEVICE_PROFILE_HSP_AUDIOGATEWAY = (1 << 7),
+	CRAS_BT_DEVICE_PROFILE_LE_AUDIO = (1 << 8)
 };
 
 enum cras_bt_device_profile cras_bt_device_profile_from_uuid(const char *uuid);
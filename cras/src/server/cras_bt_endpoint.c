@@ -133,9 +133,9 @@ cras_bt_endpoint_select_configuration(DBusConnection *conn,
 	DBusError dbus_error;
 	const char *endpoint_path;
 	struct cras_bt_endpoint *endpoint;
-	char buf[4];
+	char buf[MAX_CAPABILITIES_LEN];
 	void *capabilities, *configuration = buf;
-	int len;
+	int len, rc;
 	DBusMessage *reply;
 
 	syslog(LOG_DEBUG, "SelectConfiguration: %s",
@@ -157,9 +157,12 @@ cras_bt_endpoint_select_configuration(DBusConnection *conn,
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 	}
 
-	if (len > sizeof(configuration) ||
-	    endpoint->select_configuration(endpoint, capabilities, len,
-					   configuration) < 0) {
+	if (len > sizeof(buf))
+		rc = -EINVAL;
+	else
+		rc = endpoint->select_configuration(endpoint, capabilities, len,
+						    configuration);
+	if (rc < 0) {
 		reply = dbus_message_new_error(
 			message,
 			"org.chromium.Cras.Error.UnsupportedConfiguration",
@@ -171,6 +174,8 @@ cras_bt_endpoint_select_configuration(DBusConnection *conn,
 		dbus_message_unref(reply);
 		return DBUS_HANDLER_RESULT_HANDLED;
 	}
+	if (rc > 0)
+		len = rc;
 
 	reply = dbus_message_new_method_return(message);
 	if (!reply)
@@ -338,7 +343,7 @@ int cras_bt_register_endpoint(DBusConnection *conn,
 	DBusMessageIter properties_array_iter, properties_dict_iter;
 	DBusMessageIter variant_iter, bytes_iter;
 	DBusPendingCall *pending_call;
-	char buf[4];
+	char buf[MAX_CAPABILITIES_LEN];
 	void *capabilities = buf;
 	int len = sizeof(buf);
 	int error;
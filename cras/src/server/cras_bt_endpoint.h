@@ -13,6 +13,18 @@
 
 struct cras_bt_transport;
 
+/* Room for the capabilities or configuration of any codec. */
+#define MAX_CAPABILITIES_LEN 32
+
+/* A media endpoint registered to BlueZ.
+ * Members:
+ *    get_capabilities - Fills the capabilities of the codec, sets len to
+ *        their length.
+ *    select_configuration - Fills configuration, of MAX_CAPABILITIES_LEN
+ *        bytes, from the remote capabilities. Returns the length of the
+ *        configuration, 0 for the same length as the capabilities, or
+ *        negative error code.
+ */
 struct cras_bt_endpoint {
 	const char *object_path;
 	const char *uuid;
@@ -12,6 +12,7 @@
 #include "cras_utf8.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_ramp.h"
 #include "sfh.h"
 #include "utlist.h"
 
@@ -100,6 +101,10 @@ static void bt_switch_to_profile(struct cras_bt_device *device,
 		cras_bt_device_set_active_profile(
 			device, CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE);
 		break;
+	case CRAS_BT_DEVICE_PROFILE_LE_AUDIO:
+		cras_bt_device_set_active_profile(
+			device, CRAS_BT_DEVICE_PROFILE_LE_AUDIO);
+		break;
 	default:
 		syslog(LOG_ERR, "Unexpect profile %u", profile);
 		break;
@@ -516,6 +521,12 @@ struct cras_iodev *cras_bt_io_create(struct cras_bt_device *device,
 		iodev->software_volume_needed =
 			!cras_bt_device_get_use_hardware_volume(device);
 		iodev->set_volume = set_bt_volume;
+
+		/* Fade in as playback starts, which also smooths over the
+		 * gap of a profile switch. */
+		iodev->ramp = cras_ramp_create();
+		iodev->initial_ramp_request =
+			CRAS_IODEV_RAMP_REQUEST_UP_START_PLAYBACK;
 	}
 
 	/* Create the fake node so it's the only node exposed to UI, and
@@ -552,8 +563,9 @@ struct cras_iodev *cras_bt_io_create(struct cras_bt_device *device,
 	if (node == NULL)
 		goto error;
 
-	/* Default active profile to a2dp whenever it's allowed. */
+	/* Default active profile to LE Audio, or a2dp whenever it's allowed. */
 	if (!cras_bt_device_get_active_profile(device) ||
+	    profile == CRAS_BT_DEVICE_PROFILE_LE_AUDIO ||
 	    (profile == CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE &&
 	     cras_bt_device_can_switch_to_a2dp(device)))
 		bt_switch_to_profile(device, profile);
@@ -639,6 +651,11 @@ int cras_bt_io_append(struct cras_iodev *bt_iodev, struct cras_iodev *dev,
 				     CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE);
 		cras_bt_device_switch_profile(btio->device, bt_iodev);
 		syslog(LOG_ERR, "Switch to A2DP on append");
+	} else if (profile == CRAS_BT_DEVICE_PROFILE_LE_AUDIO) {
+		bt_switch_to_profile(btio->device,
+				     CRAS_BT_DEVICE_PROFILE_LE_AUDIO);
+		cras_bt_device_switch_profile(btio->device, bt_iodev);
+		syslog(LOG_INFO, "Switch to LE Audio on append");
 	}
 	return 0;
 }
@@ -658,6 +675,9 @@ cras_bt_io_profile_to_log(struct cras_iodev *bt_iodev)
 	if (btnode->profile & CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE)
 		return CRAS_BT_DEVICE_PROFILE_A2DP_SOURCE;
 
+	if (btnode->profile & CRAS_BT_DEVICE_PROFILE_LE_AUDIO)
+		return CRAS_BT_DEVICE_PROFILE_LE_AUDIO;
+
 	if (hfp_iodev_is_hsp(btnode->profile_dev))
 		return CRAS_BT_DEVICE_PROFILE_HSP_AUDIOGATEWAY;
 	else
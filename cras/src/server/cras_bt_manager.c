@@ -9,6 +9,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "cras_bt_constants.h"
 #include "cras_bt_manager.h"
@@ -18,12 +19,25 @@
 #include "cras_bt_log.h"
 #include "cras_bt_player.h"
 #include "cras_bt_profile.h"
+#include "cras_bt_prop_batch.h"
 #include "cras_bt_transport.h"
 #include "cras_bt_battery_provider.h"
+#include "cras_system_state.h"
+#include "cras_util.h"
 #include "utlist.h"
 
 struct cras_bt_event_log *btlog;
 
+/* Returns the microseconds since start, for the event log. */
+static uint32_t usec_since(const struct timespec *start)
+{
+	struct timespec now, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, start, &elapsed);
+	return elapsed.tv_sec * 1000000 + elapsed.tv_nsec / 1000;
+}
+
 static void cras_bt_interface_added(DBusConnection *conn,
 				    const char *object_path,
 				    const char *interface_name,
@@ -231,12 +245,27 @@ static void cras_bt_update_properties(DBusConnection *conn,
 	}
 }
 
+/* Applies the property changes queued since the last main loop pass. */
+static void cras_bt_flush_properties(void *arg)
+{
+	struct timespec start;
+	unsigned int num_signals;
+
+	if (!cras_bt_prop_batch_num_signals())
+		return;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	num_signals = cras_bt_prop_batch_flush((DBusConnection *)arg,
+					       cras_bt_update_properties);
+	BTLOG(btlog, BT_PROPERTIES_BATCH, num_signals, usec_since(&start));
+}
+
 /* Destroys all bt related stuff. The reset functions must be called in
  * reverse order of the adapter -> device -> profile(s) hierarchy.
  */
 static void cras_bt_reset()
 {
 	BTLOG(btlog, BT_RESET, 0, 0);
+	cras_bt_prop_batch_reset();
 	cras_bt_endpoint_reset();
 	cras_bt_transport_reset();
 	cras_bt_profile_reset();
@@ -250,7 +279,10 @@ static void cras_bt_on_get_managed_objects(DBusPendingCall *pending_call,
 	DBusConnection *conn = (DBusConnection *)data;
 	DBusMessage *reply;
 	DBusMessageIter message_iter, object_array_iter;
+	struct timespec start;
+	unsigned int num_objects = 0;
 
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
 	reply = dbus_pending_call_steal_reply(pending_call);
 	dbus_pending_call_unref(pending_call);
 
@@ -267,6 +299,10 @@ static void cras_bt_on_get_managed_objects(DBusPendingCall *pending_call,
 		return;
 	}
 
+	/* The objects are added with all their properties, older changes
+	 * must not be applied after them. */
+	cras_bt_flush_properties(conn);
+
 	dbus_message_iter_init(reply, &message_iter);
 	dbus_message_iter_recurse(&message_iter, &object_array_iter);
 
@@ -308,9 +344,11 @@ static void cras_bt_on_get_managed_objects(DBusPendingCall *pending_call,
 		}
 
 		dbus_message_iter_next(&object_array_iter);
+		num_objects++;
 	}
 
 	dbus_message_unref(reply);
+	BTLOG(btlog, BT_MANAGED_OBJECTS, num_objects, usec_since(&start));
 }
 
 static int cras_bt_get_managed_objects(DBusConnection *conn)
@@ -383,6 +421,8 @@ static DBusHandlerResult cras_bt_handle_interfaces_added(DBusConnection *conn,
 {
 	DBusMessageIter message_iter, interface_array_iter;
 	const char *object_path;
+	struct timespec start;
+	unsigned int num_interfaces = 0;
 
 	if (!dbus_message_is_signal(message, DBUS_INTERFACE_OBJECT_MANAGER,
 				    "InterfacesAdded"))
@@ -393,6 +433,8 @@ static DBusHandlerResult cras_bt_handle_interfaces_added(DBusConnection *conn,
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	cras_bt_flush_properties(conn);
 	dbus_message_iter_init(message, &message_iter);
 
 	dbus_message_iter_get_basic(&message_iter, &object_path);
@@ -419,8 +461,10 @@ static DBusHandlerResult cras_bt_handle_interfaces_added(DBusConnection *conn,
 					&properties_array_iter);
 
 		dbus_message_iter_next(&interface_array_iter);
+		num_interfaces++;
 	}
 
+	BTLOG(btlog, BT_INTERFACES_ADDED, num_interfaces, usec_since(&start));
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
@@ -430,6 +474,8 @@ static DBusHandlerResult cras_bt_handle_interfaces_removed(DBusConnection *conn,
 {
 	DBusMessageIter message_iter, interface_array_iter;
 	const char *object_path;
+	struct timespec start;
+	unsigned int num_interfaces = 0;
 
 	if (!dbus_message_is_signal(message, DBUS_INTERFACE_OBJECT_MANAGER,
 				    "InterfacesRemoved"))
@@ -440,6 +486,9 @@ static DBusHandlerResult cras_bt_handle_interfaces_removed(DBusConnection *conn,
 		return DBUS_HANDLER_RESULT_NOT_YET_HANDLED;
 	}
 
+	clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+	cras_bt_flush_properties(conn);
+
 	dbus_message_iter_init(message, &message_iter);
 
 	dbus_message_iter_get_basic(&message_iter, &object_path);
@@ -457,8 +506,11 @@ static DBusHandlerResult cras_bt_handle_interfaces_removed(DBusConnection *conn,
 		cras_bt_interface_removed(conn, object_path, interface_name);
 
 		dbus_message_iter_next(&interface_array_iter);
+		num_interfaces++;
 	}
 
+	BTLOG(btlog, BT_INTERFACES_REMOVED, num_interfaces,
+	      usec_since(&start));
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
 
@@ -469,6 +521,7 @@ static DBusHandlerResult cras_bt_handle_properties_changed(DBusConnection *conn,
 	DBusMessageIter message_iter, properties_array_iter;
 	DBusMessageIter invalidated_array_iter;
 	const char *object_path, *interface_name;
+	unsigned int queued;
 
 	if (!dbus_message_is_signal(message, DBUS_INTERFACE_PROPERTIES,
 				    "PropertiesChanged"))
@@ -491,9 +544,26 @@ static DBusHandlerResult cras_bt_handle_properties_changed(DBusConnection *conn,
 
 	dbus_message_iter_recurse(&message_iter, &invalidated_array_iter);
 
-	cras_bt_update_properties(conn, object_path, interface_name,
-				  &properties_array_iter,
-				  &invalidated_array_iter);
+	/* Changes are applied once per main loop pass, the first one queued
+	 * schedules it. Apply them now if they can't be queued. */
+	queued = cras_bt_prop_batch_num_signals();
+	if (cras_bt_prop_batch_add(message, object_path, interface_name,
+				   &properties_array_iter,
+				   &invalidated_array_iter)) {
+		cras_bt_flush_properties(conn);
+		dbus_message_iter_init(message, &message_iter);
+		dbus_message_iter_next(&message_iter);
+		dbus_message_iter_recurse(&message_iter,
+					  &properties_array_iter);
+		dbus_message_iter_next(&message_iter);
+		dbus_message_iter_recurse(&message_iter,
+					  &invalidated_array_iter);
+		cras_bt_update_properties(conn, object_path, interface_name,
+					  &properties_array_iter,
+					  &invalidated_array_iter);
+	} else if (!queued) {
+		cras_system_add_task(cras_bt_flush_properties, conn);
+	}
 
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
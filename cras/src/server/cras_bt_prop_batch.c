@@ -0,0 +1,305 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <dbus/dbus.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "cras_bt_prop_batch.h"
+#include "utlist.h"
+
+/* The last change of a property.
+ *    key - The name of the property.
+ *    message - The signal holding the value, NULL if invalidated.
+ *    value - On the variant holding the value in message.
+ */
+struct bt_prop {
+	char *key;
+	DBusMessage *message;
+	DBusMessageIter value;
+	struct bt_prop *prev, *next;
+};
+
+/* The properties changed on an interface of an object. */
+struct bt_prop_object {
+	char *object_path;
+	char *interface_name;
+	struct bt_prop *props;
+	struct bt_prop_object *prev, *next;
+};
+
+static struct bt_prop_object *objects;
+static unsigned int num_signals;
+
+static void prop_set(struct bt_prop *prop, DBusMessage *message,
+		     const DBusMessageIter *value)
+{
+	if (message) {
+		dbus_message_ref(message);
+		prop->value = *value;
+	}
+	if (prop->message)
+		dbus_message_unref(prop->message);
+	prop->message = message;
+}
+
+static void object_free(struct bt_prop_object *object)
+{
+	struct bt_prop *prop;
+
+	DL_FOREACH (object->props, prop) {
+		DL_DELETE(object->props, prop);
+		prop_set(prop, NULL, NULL);
+		free(prop->key);
+		free(prop);
+	}
+	free(object->object_path);
+	free(object->interface_name);
+	free(object);
+}
+
+static struct bt_prop_object *object_get(const char *object_path,
+					 const char *interface_name)
+{
+	struct bt_prop_object *object;
+
+	DL_FOREACH (objects, object) {
+		if (strcmp(object->object_path, object_path) == 0 &&
+		    strcmp(object->interface_name, interface_name) == 0)
+			return object;
+	}
+
+	object = (struct bt_prop_object *)calloc(1, sizeof(*object));
+	if (!object)
+		return NULL;
+	object->object_path = strdup(object_path);
+	object->interface_name = strdup(interface_name);
+	if (!object->object_path || !object->interface_name) {
+		object_free(object);
+		return NULL;
+	}
+	DL_APPEND(objects, object);
+	return object;
+}
+
+static struct bt_prop *prop_get(struct bt_prop_object *object,
+				const char *key)
+{
+	struct bt_prop *prop;
+
+	DL_FOREACH (object->props, prop) {
+		if (strcmp(prop->key, key) == 0)
+			return prop;
+	}
+
+	prop = (struct bt_prop *)calloc(1, sizeof(*prop));
+	if (!prop)
+		return NULL;
+	prop->key = strdup(key);
+	if (!prop->key) {
+		free(prop);
+		return NULL;
+	}
+	DL_APPEND(object->props, prop);
+	return prop;
+}
+
+int cras_bt_prop_batch_add(DBusMessage *message, const char *object_path,
+			   const char *interface_name,
+			   DBusMessageIter *properties_array_iter,
+			   DBusMessageIter *invalidated_array_iter)
+{
+	struct bt_prop_object *object;
+	struct bt_prop *prop;
+	const char *key;
+
+	object = object_get(object_path, interface_name);
+	if (!object)
+		return -ENOMEM;
+	/* Counted even if only part of its changes get queued. */
+	num_signals++;
+
+	while (dbus_message_iter_get_arg_type(properties_array_iter) !=
+	       DBUS_TYPE_INVALID) {
+		DBusMessageIter properties_dict_iter;
+
+		dbus_message_iter_recurse(properties_array_iter,
+					  &properties_dict_iter);
+		dbus_message_iter_get_basic(&properties_dict_iter, &key);
+		dbus_message_iter_next(&properties_dict_iter);
+
+		prop = prop_get(object, key);
+		if (!prop)
+			return -ENOMEM;
+		prop_set(prop, message, &properties_dict_iter);
+
+		dbus_message_iter_next(properties_array_iter);
+	}
+
+	while (dbus_message_iter_get_arg_type(invalidated_array_iter) !=
+	       DBUS_TYPE_INVALID) {
+		dbus_message_iter_get_basic(invalidated_array_iter, &key);
+		prop = prop_get(object, key);
+		if (!prop)
+			return -ENOMEM;
+		prop_set(prop, NULL, NULL);
+
+		dbus_message_iter_next(invalidated_array_iter);
+	}
+	return 0;
+}
+
+unsigned int cras_bt_prop_batch_num_signals()
+{
+	return num_signals;
+}
+
+/* Appends the values from the one at src to the end of its container. */
+static int copy_values(DBusMessageIter *src, DBusMessageIter *dst)
+{
+	int type, rc;
+
+	while ((type = dbus_message_iter_get_arg_type(src)) !=
+	       DBUS_TYPE_INVALID) {
+		DBusMessageIter src_sub, dst_sub;
+		char *signature = NULL;
+
+		if (dbus_type_is_basic(type)) {
+			DBusBasicValue value;
+
+			dbus_message_iter_get_basic(src, &value);
+			if (!dbus_message_iter_append_basic(dst, type, &value))
+				return -ENOMEM;
+			dbus_message_iter_next(src);
+			continue;
+		}
+
+		dbus_message_iter_recurse(src, &src_sub);
+		/* Only arrays and variants name what they hold. */
+		if (type == DBUS_TYPE_ARRAY)
+			signature = dbus_message_iter_get_signature(src);
+		else if (type == DBUS_TYPE_VARIANT)
+			signature = dbus_message_iter_get_signature(&src_sub);
+		if (!dbus_message_iter_open_container(
+			    dst, type,
+			    type == DBUS_TYPE_ARRAY ? signature + 1 : signature,
+			    &dst_sub)) {
+			dbus_free(signature);
+			return -ENOMEM;
+		}
+		dbus_free(signature);
+
+		rc = copy_values(&src_sub, &dst_sub);
+		if (rc < 0) {
+			dbus_message_iter_abandon_container(dst, &dst_sub);
+			return rc;
+		}
+		if (!dbus_message_iter_close_container(dst, &dst_sub))
+			return -ENOMEM;
+		dbus_message_iter_next(src);
+	}
+	return 0;
+}
+
+/* Builds a message holding the a{sv} and as of a PropertiesChanged signal
+ * with the last changes of object. */
+static DBusMessage *object_merge(struct bt_prop_object *object)
+{
+	DBusMessage *merged;
+	DBusMessageIter iter, array_iter, dict_iter;
+	struct bt_prop *prop;
+
+	merged = dbus_message_new(DBUS_MESSAGE_TYPE_SIGNAL);
+	if (!merged)
+		return NULL;
+	dbus_message_iter_init_append(merged, &iter);
+
+	if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "{sv}",
+					      &array_iter))
+		goto error;
+	DL_FOREACH (object->props, prop) {
+		DBusMessageIter value = prop->value;
+
+		if (!prop->message)
+			continue;
+		if (!dbus_message_iter_open_container(&array_iter,
+						      DBUS_TYPE_DICT_ENTRY,
+						      NULL, &dict_iter) ||
+		    !dbus_message_iter_append_basic(
+			    &dict_iter, DBUS_TYPE_STRING, &prop->key) ||
+		    copy_values(&value, &dict_iter) ||
+		    !dbus_message_iter_close_container(&array_iter,
+						       &dict_iter))
+			goto error;
+	}
+	if (!dbus_message_iter_close_container(&iter, &array_iter))
+		goto error;
+
+	if (!dbus_message_iter_open_container(&iter, DBUS_TYPE_ARRAY, "s",
+					      &array_iter))
+		goto error;
+	DL_FOREACH (object->props, prop) {
+		if (prop->message)
+			continue;
+		if (!dbus_message_iter_append_basic(
+			    &array_iter, DBUS_TYPE_STRING, &prop->key))
+			goto error;
+	}
+	if (!dbus_message_iter_close_container(&iter, &array_iter))
+		goto error;
+	return merged;
+
+error:
+	dbus_message_unref(merged);
+	return NULL;
+}
+
+unsigned int cras_bt_prop_batch_flush(DBusConnection *conn,
+				      cras_bt_prop_batch_apply_t apply)
+{
+	struct bt_prop_object *pending = objects, *object;
+	unsigned int flushed = num_signals;
+	DBusMessageIter iter, properties_array_iter, invalidated_array_iter;
+	DBusMessage *merged;
+
+	/* What apply causes to change goes in the next batch. */
+	objects = NULL;
+	num_signals = 0;
+
+	DL_FOREACH (pending, object) {
+		DL_DELETE(pending, object);
+		merged = object_merge(object);
+		if (!merged) {
+			syslog(LOG_ERR, "Dropped property changes of %s",
+			       object->object_path);
+			object_free(object);
+			continue;
+		}
+
+		dbus_message_iter_init(merged, &iter);
+		dbus_message_iter_recurse(&iter, &properties_array_iter);
+		dbus_message_iter_next(&iter);
+		dbus_message_iter_recurse(&iter, &invalidated_array_iter);
+		apply(conn, object->object_path, object->interface_name,
+		      &properties_array_iter, &invalidated_array_iter);
+
+		dbus_message_unref(merged);
+		object_free(object);
+	}
+	return flushed;
+}
+
+void cras_bt_prop_batch_reset()
+{
+	struct bt_prop_object *object;
+
+	DL_FOREACH (objects, object) {
+		DL_DELETE(objects, object);
+		object_free(object);
+	}
+	num_signals = 0;
+}
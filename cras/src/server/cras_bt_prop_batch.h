@@ -0,0 +1,55 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Coalesces the PropertiesChanged signals BlueZ sends for its objects.
+ * Only the last value of each property is kept per object, and the changes
+ * of an object are applied once as if they came in a single signal. A storm
+ * of signals, as when many paired devices connect at boot, then runs the
+ * profile and iodev logic once per object rather than once per signal.
+ */
+
+#ifndef CRAS_BT_PROP_BATCH_H_
+#define CRAS_BT_PROP_BATCH_H_
+
+#include <dbus/dbus.h>
+
+/* Applies the merged changes of an object. The iterators are positioned
+ * like those of a PropertiesChanged signal, on the a{sv} of changed
+ * properties and on the as of invalidated ones. */
+typedef void (*cras_bt_prop_batch_apply_t)(
+	DBusConnection *conn, const char *object_path,
+	const char *interface_name, DBusMessageIter *properties_array_iter,
+	DBusMessageIter *invalidated_array_iter);
+
+/* Queues the changes of a PropertiesChanged signal.
+ * Args:
+ *    message - The signal, referenced until the changes are applied.
+ *    object_path - The object the properties belong to.
+ *    interface_name - The interface of the properties.
+ *    properties_array_iter - On the a{sv} of changed properties.
+ *    invalidated_array_iter - On the as of invalidated properties.
+ * Returns:
+ *    0 on success, negative error code when the changes weren't queued.
+ */
+int cras_bt_prop_batch_add(DBusMessage *message, const char *object_path,
+			   const char *interface_name,
+			   DBusMessageIter *properties_array_iter,
+			   DBusMessageIter *invalidated_array_iter);
+
+/* Returns the number of signals queued since the last flush. */
+unsigned int cras_bt_prop_batch_num_signals();
+
+/* Applies the queued changes, one call of apply per object and interface,
+ * in the order the objects first changed. Changes queued by apply wait for
+ * the next flush.
+ * Returns:
+ *    The number of signals the changes came in.
+ */
+unsigned int cras_bt_prop_batch_flush(DBusConnection *conn,
+				      cras_bt_prop_batch_apply_t apply);
+
+/* Drops the queued changes. */
+void cras_bt_prop_batch_reset();
+
+#endif /* CRAS_BT_PROP_BATCH_H_ */
@@ -172,6 +172,11 @@ cras_bt_transport_profile(const struct cras_bt_transport *transport)
 	return transport->profile;
 }
 
+int cras_bt_transport_codec(const struct cras_bt_transport *transport)
+{
+	return transport->codec;
+}
+
 int cras_bt_transport_configuration(const struct cras_bt_transport *transport,
 				    void *configuration, int len)
 {
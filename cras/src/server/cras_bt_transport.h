@@ -50,6 +50,8 @@ struct cras_bt_device *
 cras_bt_transport_device(const struct cras_bt_transport *transport);
 enum cras_bt_device_profile
 cras_bt_transport_profile(const struct cras_bt_transport *transport);
+/* Gets the A2DP_CODEC_* of the codec configured on the transport. */
+int cras_bt_transport_codec(const struct cras_bt_transport *transport);
 int cras_bt_transport_configuration(const struct cras_bt_transport *transport,
 				    void *configuration, int len);
 enum cras_bt_transport_state
@@ -0,0 +1,116 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <syslog.h>
+#include <time.h>
+#include <linux/errqueue.h>
+#include <linux/net_tstamp.h>
+
+#include "bluetooth.h"
+#include "cras_bt_tx_delay.h"
+
+/* From the kernel headers with completion timestamps, Linux 6.14 on. The
+ * kernel reports one when the controller tells a packet is done with. */
+#define TIMESTAMPING_TX_COMPLETION (1 << 18)
+#define TSTAMP_COMPLETION 3
+
+int cras_bt_tx_delay_init(struct cras_bt_tx_delay *delay, int fd)
+{
+	int flags = TIMESTAMPING_TX_COMPLETION | SOF_TIMESTAMPING_SOFTWARE |
+		    SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+
+	memset(delay, 0, sizeof(*delay));
+	if (setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPING, &flags,
+		       sizeof(flags)) < 0)
+		return -errno;
+
+	delay->enabled = 1;
+	return 0;
+}
+
+void cras_bt_tx_delay_sent(struct cras_bt_tx_delay *delay,
+			   unsigned int frames)
+{
+	unsigned int i;
+
+	if (!delay->enabled)
+		return;
+
+	if (delay->sent - delay->completed == CRAS_BT_TX_DELAY_MAX_PACKETS) {
+		/* A socket that takes the option but never reports is as
+		 * good as one not taking it. */
+		if (delay->completed == 0) {
+			syslog(LOG_WARNING, "No TX completions on BT socket");
+			delay->enabled = 0;
+			delay->in_flight = 0;
+			return;
+		}
+		/* Otherwise a report got lost, count the oldest as done. */
+		i = delay->completed++ % CRAS_BT_TX_DELAY_MAX_PACKETS;
+		delay->in_flight -= delay->frames[i];
+	}
+
+	delay->frames[delay->sent++ % CRAS_BT_TX_DELAY_MAX_PACKETS] = frames;
+	delay->in_flight += frames;
+}
+
+void cras_bt_tx_delay_completed(struct cras_bt_tx_delay *delay, uint32_t id)
+{
+	unsigned int i;
+
+	/* Ignore the reports of packets already accounted for. */
+	if (id - delay->completed >= delay->sent - delay->completed)
+		return;
+
+	while (delay->completed != id + 1) {
+		i = delay->completed++ % CRAS_BT_TX_DELAY_MAX_PACKETS;
+		delay->in_flight -= delay->frames[i];
+	}
+}
+
+int cras_bt_tx_delay_poll(struct cras_bt_tx_delay *delay, int fd)
+{
+	char control[CMSG_SPACE(sizeof(struct scm_timestamping)) +
+		     CMSG_SPACE(sizeof(struct sock_extended_err))];
+	struct sock_extended_err *serr;
+	struct cmsghdr *cmsg;
+	struct msghdr msg;
+	int count = 0;
+
+	if (!delay->enabled)
+		return 0;
+
+	while (1) {
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_control = control;
+		msg.msg_controllen = sizeof(control);
+
+		if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return count;
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+
+		for (cmsg = CMSG_FIRSTHDR(&msg); cmsg;
+		     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+			if (cmsg->cmsg_level != SOL_BLUETOOTH ||
+			    cmsg->cmsg_type != BT_SCM_ERROR)
+				continue;
+			serr = (struct sock_extended_err *)CMSG_DATA(cmsg);
+			if (serr->ee_errno != ENOMSG ||
+			    serr->ee_origin != SO_EE_ORIGIN_TIMESTAMPING ||
+			    serr->ee_info != TSTAMP_COMPLETION)
+				continue;
+			cras_bt_tx_delay_completed(delay, serr->ee_data);
+			count++;
+		}
+	}
+}
@@ -0,0 +1,83 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_BT_TX_DELAY_H_
+#define CRAS_BT_TX_DELAY_H_
+
+#include <stdint.h>
+
+/* The most packets tracked between being sent and completed. */
+#define CRAS_BT_TX_DELAY_MAX_PACKETS 64
+
+/*
+ * Tracks the audio sent to a Bluetooth socket that the controller hasn't
+ * transmitted yet. The socket is asked for a completion timestamp of every
+ * packet, which the kernel reports once the controller is done with it, so
+ * what's in flight is known however deep the kernel and controller queues
+ * are. Where the kernel doesn't report completions, nothing is tracked and
+ * the caller falls back to its own estimate.
+ * Members:
+ *    enabled - Whether the socket reports completions.
+ *    sent - The number of packets sent, the id of the next one.
+ *    completed - The number of packets completed.
+ *    frames - The frames in each packet in flight, by id.
+ *    in_flight - The frames sent and not completed.
+ */
+struct cras_bt_tx_delay {
+	int enabled;
+	uint32_t sent;
+	uint32_t completed;
+	unsigned int frames[CRAS_BT_TX_DELAY_MAX_PACKETS];
+	unsigned int in_flight;
+};
+
+/*
+ * Resets the tracking and asks the socket for completion timestamps.
+ * Args:
+ *    delay - The tracking to reset.
+ *    fd - The socket, before any packet is sent on it.
+ * Returns:
+ *    0 if completions are reported, otherwise negative error code, and the
+ *    tracking is disabled.
+ */
+int cras_bt_tx_delay_init(struct cras_bt_tx_delay *delay, int fd);
+
+/*
+ * Accounts a packet just sent.
+ * Args:
+ *    delay - The tracking.
+ *    frames - The frames of audio in the packet.
+ */
+void cras_bt_tx_delay_sent(struct cras_bt_tx_delay *delay,
+			   unsigned int frames);
+
+/*
+ * Accounts the completion of a packet, and all sent before it.
+ * Args:
+ *    delay - The tracking.
+ *    id - The id of the packet, counting from 0 for the first one sent.
+ */
+void cras_bt_tx_delay_completed(struct cras_bt_tx_delay *delay, uint32_t id);
+
+/*
+ * Reads the completions queued on the error queue of the socket.
+ * Args:
+ *    delay - The tracking.
+ *    fd - The socket.
+ * Returns:
+ *    The number of completions read, or negative error code.
+ */
+int cras_bt_tx_delay_poll(struct cras_bt_tx_delay *delay, int fd);
+
+/*
+ * Returns the frames sent and not completed, 0 if the tracking is disabled.
+ */
+static inline unsigned int
+cras_bt_tx_delay_frames(const struct cras_bt_tx_delay *delay)
+{
+	return delay->in_flight;
+}
+
+#endif /* CRAS_BT_TX_DELAY_H_ */
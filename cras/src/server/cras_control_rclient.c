@@ -16,15 +16,22 @@
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
 #include "cras_hfp_ag_profile.h"
+#include "cras_loopback_tap.h"
+#include "cras_main_loop_stats.h"
 #include "cras_main_thread_log.h"
 #include "cras_messages.h"
 #include "cras_observer.h"
+#include "cras_observer_ring.h"
 #include "cras_rclient.h"
 #include "cras_rclient_util.h"
 #include "cras_rstream.h"
+#include "cras_rt_guard.h"
+#include "cras_sample_cache.h"
+#include "cras_server.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
+#include "server_stream.h"
 #include "utlist.h"
 
 /* Handles dumping audio thread debug info back to the client. */
@@ -37,6 +44,7 @@ static void dump_audio_thread_info(struct cras_rclient *client)
 	state = cras_system_state_get_no_lock();
 	audio_thread_dump_thread_info(cras_iodev_list_get_audio_thread(),
 				      &state->audio_debug_info);
+	cras_rt_guard_log_sites();
 	client->ops->send_message_to_client(client, &msg.header, NULL, 0);
 }
 
@@ -51,6 +59,19 @@ static void get_atlog_fd(struct cras_rclient *client)
 	client->ops->send_message_to_client(client, &msg.header, &atlog_fd, 1);
 }
 
+/* Sends the eventfd signaled for new observer ring events to the client. */
+static void get_observer_event_fd(struct cras_rclient *client)
+{
+	struct cras_client_observer_event_fd_ready msg;
+	int event_fd;
+
+	event_fd = cras_observer_ring_event_fd();
+	if (event_fd < 0)
+		return;
+	cras_fill_client_observer_event_fd_ready(&msg);
+	client->ops->send_message_to_client(client, &msg.header, &event_fd, 1);
+}
+
 /* Handles dumping audio snapshots to shared memory for the client. */
 static void dump_audio_thread_snapshots(struct cras_rclient *client)
 {
@@ -271,6 +292,80 @@ static int direction_valid(enum CRAS_STREAM_DIRECTION direction)
 	       direction != CRAS_STREAM_UNDEFINED;
 }
 
+static int ccr_handle_message_from_client(struct cras_rclient *client,
+					  const struct cras_server_message *msg,
+					  int *fds, unsigned int num_fds);
+
+/* Returns the number of fds attached for the stream connect m, or -EINVAL if
+ * m is too short to tell. */
+static int connect_message_num_fds(const struct cras_server_message *m)
+{
+	const struct cras_connect_message *c =
+		(const struct cras_connect_message *)m;
+
+	if (m->length < CRAS_CONNECT_MESSAGE_MIN_LEN)
+		return -EINVAL;
+	return c->client_shm_size ? 2 : 1;
+}
+
+/* Handles each message packed in a batch, in order. All of them are handled
+ * before the main loop runs again, so observers get one notification for the
+ * state changes of the whole batch, and the streams it connects and
+ * disconnects are routed together. The fds of the batch are handed to its
+ * stream connects and sample uploads in order, and must all be used. */
+static int handle_batch(struct cras_rclient *client,
+			const struct cras_server_batch *batch, int *fds,
+			unsigned int num_fds)
+{
+	const uint8_t *pos = batch->messages;
+	const uint8_t *end = (const uint8_t *)batch + batch->header.length;
+	const struct cras_server_message *m;
+	unsigned int used = 0;
+	int n, rc = 0;
+
+	cras_iodev_list_begin_stream_batch();
+	while (pos < end) {
+		m = (const struct cras_server_message *)pos;
+		if ((size_t)(end - pos) < sizeof(*m) ||
+		    m->length < sizeof(*m) || m->length > (size_t)(end - pos)) {
+			rc = -EINVAL;
+			break;
+		}
+		if (m->id == CRAS_SERVER_BATCH) {
+			syslog(LOG_ERR, "Batches can't be nested.");
+			rc = -EINVAL;
+			break;
+		}
+		n = 0;
+		if (m->id == CRAS_SERVER_CONNECT_STREAM)
+			n = connect_message_num_fds(m);
+		else if (m->id == CRAS_SERVER_UPLOAD_SAMPLE)
+			n = 1;
+		if (n < 0 || used + n > num_fds) {
+			syslog(LOG_ERR, "Batch lacks fds for message %d.",
+			       m->id);
+			rc = -EINVAL;
+			break;
+		}
+		rc = ccr_handle_message_from_client(client, m,
+						    n ? fds + used : NULL, n);
+		used += n;
+		if (rc < 0)
+			break;
+		pos += m->length;
+	}
+	if (rc == 0 && used < num_fds) {
+		syslog(LOG_ERR, "Batch has %u fds not used.", num_fds - used);
+		rc = -EINVAL;
+	}
+	cras_iodev_list_end_stream_batch();
+
+	for (; used < num_fds; used++)
+		if (fds[used] >= 0)
+			close(fds[used]);
+	return rc;
+}
+
 /* Entry point for handling a message from the client.  Called from the main
  * server context.
  *
@@ -287,7 +382,10 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	int rc = 0;
 	assert(client && msg);
 
-	rc = rclient_validate_message_fds(msg, fds, num_fds);
+	/* A batch carries the fds of its messages, handle_batch() checks
+	 * them. */
+	if (msg->id != CRAS_SERVER_BATCH)
+		rc = rclient_validate_message_fds(msg, fds, num_fds);
 	if (rc < 0) {
 		for (int i = 0; i < (int)num_fds; i++)
 			if (fds[i] >= 0)
@@ -299,12 +397,15 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	switch (msg->id) {
 	case CRAS_SERVER_CONNECT_STREAM: {
 		int client_shm_fd = num_fds > 1 ? fds[1] : -1;
-		if (MSG_LEN_VALID(msg, struct cras_connect_message)) {
+		if (msg->length >= CRAS_CONNECT_MESSAGE_MIN_LEN) {
 			rclient_handle_client_stream_connect(
 				client,
 				(const struct cras_connect_message *)msg, fd,
 				client_shm_fd);
 		} else {
+			for (int i = 0; i < (int)num_fds; i++)
+				if (fds[i] >= 0)
+					close(fds[i]);
 			return -EINVAL;
 		}
 		break;
@@ -316,6 +417,12 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 			client,
 			(const struct cras_disconnect_stream_message *)msg);
 		break;
+	case CRAS_SERVER_DRAIN_STREAM:
+		if (!MSG_LEN_VALID(msg, struct cras_drain_stream_message))
+			return -EINVAL;
+		rclient_handle_client_stream_drain(
+			client, (const struct cras_drain_stream_message *)msg);
+		break;
 	case CRAS_SERVER_SET_SYSTEM_VOLUME:
 		if (!MSG_LEN_VALID(msg, struct cras_set_system_volume))
 			return -EINVAL;
@@ -399,6 +506,9 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	case CRAS_SERVER_GET_ATLOG_FD:
 		get_atlog_fd(client);
 		break;
+	case CRAS_SERVER_GET_OBSERVER_EVENT_FD:
+		get_observer_event_fd(client);
+		break;
 	case CRAS_SERVER_DUMP_MAIN: {
 		struct cras_client_audio_debug_info_ready msg;
 		struct cras_server_state *state;
@@ -406,6 +516,7 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		state = cras_system_state_get_no_lock();
 		memcpy(&state->main_thread_debug_info.main_log, main_log,
 		       sizeof(struct main_thread_event_log));
+		cras_main_loop_stats_fill(&state->main_thread_debug_info);
 
 		cras_fill_client_audio_debug_info_ready(&msg);
 		client->ops->send_message_to_client(client, &msg.header, NULL,
@@ -423,11 +534,16 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		memcpy(&state->bt_debug_info.wbs_logger,
 		       cras_hfp_ag_get_wbs_logger(),
 		       sizeof(struct packet_status_logger));
+		memcpy(&state->bt_debug_info.hfp_link_stats,
+		       cras_hfp_ag_get_link_stats(),
+		       sizeof(struct hfp_link_stats));
 #else
 		memset(&state->bt_debug_info.bt_log, 0,
 		       sizeof(struct cras_bt_debug_info));
 		memset(&state->bt_debug_info.wbs_logger, 0,
 		       sizeof(struct packet_status_logger));
+		memset(&state->bt_debug_info.hfp_link_stats, 0,
+		       sizeof(struct hfp_link_stats));
 #endif
 
 		cras_fill_client_audio_debug_info_ready(&msg);
@@ -443,6 +559,101 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 		cras_system_set_bt_wbs_enabled(m->enabled);
 		break;
 	}
+	case CRAS_SERVER_SET_LOOPBACK_TARGET: {
+		const struct cras_set_loopback_target *m =
+			(const struct cras_set_loopback_target *)msg;
+		struct loopback_target target;
+
+		if (!MSG_LEN_VALID(msg, struct cras_set_loopback_target))
+			return -EINVAL;
+		if (m->mode >= LOOPBACK_NUM_TARGET_MODES ||
+		    (m->stream_id &&
+		     !cras_valid_stream_id(m->stream_id, m->client_id)))
+			return -EINVAL;
+		target.mode = (enum CRAS_LOOPBACK_TARGET_MODE)m->mode;
+		target.client_id = m->client_id;
+		target.stream_id = m->stream_id;
+		cras_iodev_list_set_loopback_target(&target);
+		break;
+	}
+	case CRAS_SERVER_UPLOAD_SAMPLE: {
+		const struct cras_upload_sample *m =
+			(const struct cras_upload_sample *)msg;
+		struct cras_audio_format format;
+
+		if (!MSG_LEN_VALID(msg, struct cras_upload_sample)) {
+			if (fd >= 0)
+				close(fd);
+			return -EINVAL;
+		}
+		if (fd < 0) {
+			syslog(LOG_ERR, "Sample %u uploaded without samples.",
+			       m->sample_id);
+			break;
+		}
+		format = unpack_cras_audio_format(&m->format);
+		cras_sample_cache_add(m->sample_id, &format, fd, m->frames);
+		close(fd);
+		break;
+	}
+	case CRAS_SERVER_PLAY_SAMPLE: {
+		const struct cras_play_sample *m =
+			(const struct cras_play_sample *)msg;
+		if (!MSG_LEN_VALID(msg, struct cras_play_sample))
+			return -EINVAL;
+		if (cras_sample_cache_play(cras_iodev_list_get_stream_list(),
+					   m->sample_id, m->dev_idx))
+			syslog(LOG_ERR, "Failed to play sample %u.",
+			       m->sample_id);
+		break;
+	}
+	case CRAS_SERVER_REMOVE_SAMPLE:
+		if (!MSG_LEN_VALID(msg, struct cras_remove_sample))
+			return -EINVAL;
+		cras_sample_cache_remove(
+			((const struct cras_remove_sample *)msg)->sample_id);
+		break;
+	case CRAS_SERVER_ADD_MONITOR_ROUTE: {
+		const struct cras_add_monitor_route *m =
+			(const struct cras_add_monitor_route *)msg;
+		struct cras_audio_format format;
+
+		if (!MSG_LEN_VALID(msg, struct cras_add_monitor_route))
+			return -EINVAL;
+		format = unpack_cras_audio_format(&m->format);
+		server_stream_add_monitor(cras_iodev_list_get_stream_list(),
+					  m->input_dev_idx, m->output_dev_idx,
+					  &format, m->effects, m->gain);
+		break;
+	}
+	case CRAS_SERVER_RM_MONITOR_ROUTE: {
+		const struct cras_rm_monitor_route *m =
+			(const struct cras_rm_monitor_route *)msg;
+
+		if (!MSG_LEN_VALID(msg, struct cras_rm_monitor_route))
+			return -EINVAL;
+		if (server_stream_rm_monitor(cras_iodev_list_get_stream_list(),
+					     m->input_dev_idx,
+					     m->output_dev_idx))
+			syslog(LOG_ERR, "No monitor route %u to %u.",
+			       m->input_dev_idx, m->output_dev_idx);
+		break;
+	}
+	case CRAS_SERVER_RESUME_CLIENT: {
+		const struct cras_resume_client *m =
+			(const struct cras_resume_client *)msg;
+		struct cras_client_resumed resumed;
+
+		if (!MSG_LEN_VALID(msg, struct cras_resume_client))
+			return -EINVAL;
+		if (cras_server_resume_client(client, m->client_id))
+			syslog(LOG_INFO, "Client %zu can't resume as %u.",
+			       client->id, m->client_id);
+		cras_fill_client_resumed(&resumed, client->id);
+		client->ops->send_message_to_client(client, &resumed.header,
+						    NULL, 0);
+		break;
+	}
 	case CRAS_SERVER_DUMP_SNAPSHOTS:
 		dump_audio_thread_snapshots(client);
 		break;
@@ -531,8 +742,11 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	case CRAS_SERVER_SET_AEC_DUMP: {
 		const struct cras_set_aec_dump *m =
 			(const struct cras_set_aec_dump *)msg;
-		if (!MSG_LEN_VALID(msg, struct cras_set_aec_dump))
+		if (!MSG_LEN_VALID(msg, struct cras_set_aec_dump)) {
+			if (fd >= 0)
+				close(fd);
 			return -EINVAL;
+		}
 		audio_thread_set_aec_dump(cras_iodev_list_get_audio_thread(),
 					  m->stream_id, m->start, fd);
 		break;
@@ -540,6 +754,17 @@ static int ccr_handle_message_from_client(struct cras_rclient *client,
 	case CRAS_SERVER_RELOAD_AEC_CONFIG:
 		cras_apm_list_reload_aec_config();
 		break;
+	case CRAS_SERVER_BATCH:
+		if (!MSG_LEN_VALID(msg, struct cras_server_batch) ||
+		    num_fds > CRAS_SERV_MAX_MSG_FDS) {
+			for (int i = 0; i < (int)num_fds; i++)
+				if (fds[i] >= 0)
+					close(fds[i]);
+			return -EINVAL;
+		}
+		return handle_batch(client,
+				    (const struct cras_server_batch *)msg, fds,
+				    num_fds);
 	default:
 		break;
 	}
@@ -12,6 +12,7 @@
 #include <sys/select.h>
 #include <unistd.h>
 
+#include "cras_main_loop_stats.h"
 #include "cras_system_state.h"
 #include "cras_tm.h"
 
@@ -47,6 +48,8 @@ static dbus_bool_t dbus_watch_add(DBusWatch *watch, void *data)
 	 * TODO(hychao): select on write watch when we have a use case.
 	 */
 	if ((flags & DBUS_WATCH_READABLE) && dbus_watch_get_enabled(watch)) {
+		cras_main_loop_stats_tag_fd(dbus_watch_get_unix_fd(watch),
+					    CRAS_MAIN_HANDLER_DBUS);
 		r = cras_system_add_select_fd(dbus_watch_get_unix_fd(watch),
 					      dbus_watch_callback, watch,
 					      POLLIN);
@@ -19,6 +19,7 @@
 #include "cras_iodev_list.h"
 #include "cras_main_thread_log.h"
 #include "cras_observer.h"
+#include "cras_server.h"
 #include "cras_system_state.h"
 #include "cras_utf8.h"
 #include "cras_util.h"
@@ -111,6 +112,9 @@
 	"    <method name=\"GetNumberOfInputStreamsWithPermission\">\n"         \
 	"      <arg name=\"num\" type=\"a{sv}\" direction=\"out\"/>\n"          \
 	"    </method>\n"                                                       \
+	"    <method name=\"GetClientUsage\">\n"                                \
+	"      <arg name=\"usage\" type=\"a{sv}\" direction=\"out\"/>\n"        \
+	"    </method>\n"                                                       \
 	"    <method name=\"SetGlobalOutputChannelRemix\">\n"                   \
 	"      <arg name=\"num_channels\" type=\"i\" direction=\"in\"/>\n"      \
 	"      <arg name=\"coefficient\" type=\"ad\" direction=\"in\"/>\n"      \
@@ -148,9 +152,18 @@
 	"  </interface>\n"                                                      \
 	"</node>\n"
 
+/* Members:
+ *    conn - The D-Bus connection of the control interface.
+ *    observer - Observer forwarding state changes as D-Bus signals.
+ *    nodes_reply - A sent GetNodes reply, copied to answer later calls until
+ *        the devices or nodes change.
+ *    nodes_update_count - Server state update count nodes_reply reflects.
+ */
 struct cras_dbus_control {
 	DBusConnection *conn;
 	struct cras_observer_client *observer;
+	DBusMessage *nodes_reply;
+	uint32_t nodes_update_count;
 };
 static struct cras_dbus_control dbus_control;
 
@@ -616,21 +629,69 @@ static dbus_bool_t append_nodes(enum CRAS_STREAM_DIRECTION direction,
 	return TRUE;
 }
 
+static void drop_nodes_reply()
+{
+	if (!dbus_control.nodes_reply)
+		return;
+	dbus_message_unref(dbus_control.nodes_reply);
+	dbus_control.nodes_reply = NULL;
+}
+
+/* Copies the cached GetNodes reply to answer message. Returns NULL if not
+ * enough memory. */
+static DBusMessage *copy_nodes_reply(DBusMessage *message)
+{
+	DBusMessage *reply;
+
+	reply = dbus_message_copy(dbus_control.nodes_reply);
+	if (!reply)
+		return NULL;
+	if (!dbus_message_set_reply_serial(reply,
+					   dbus_message_get_serial(message)) ||
+	    !dbus_message_set_destination(reply,
+					  dbus_message_get_sender(message))) {
+		dbus_message_unref(reply);
+		return NULL;
+	}
+	return reply;
+}
+
 static DBusHandlerResult handle_get_nodes(DBusConnection *conn,
 					  DBusMessage *message, void *arg)
 {
 	DBusMessage *reply;
 	DBusMessageIter array;
 	dbus_uint32_t serial = 0;
+	uint32_t changes;
+
+	/* Serializing every node is the costly part and clients poll this,
+	 * reuse the last reply until the node list in the state changes. */
+	changes = cras_system_state_get_changes(
+		&dbus_control.nodes_update_count);
+	if (changes & (CRAS_STATE_CHANGE_DEVICES | CRAS_STATE_CHANGE_NODES))
+		drop_nodes_reply();
+
+	if (dbus_control.nodes_reply) {
+		reply = copy_nodes_reply(message);
+		if (!reply)
+			return DBUS_HANDLER_RESULT_NEED_MEMORY;
+		dbus_connection_send(conn, reply, &serial);
+		dbus_message_unref(reply);
+		return DBUS_HANDLER_RESULT_HANDLED;
+	}
 
 	reply = dbus_message_new_method_return(message);
-	dbus_message_iter_init_append(reply, &array);
-	if (!append_nodes(CRAS_STREAM_OUTPUT, &array))
+	if (!reply)
 		return DBUS_HANDLER_RESULT_NEED_MEMORY;
-	if (!append_nodes(CRAS_STREAM_INPUT, &array))
+	dbus_message_iter_init_append(reply, &array);
+	if (!append_nodes(CRAS_STREAM_OUTPUT, &array) ||
+	    !append_nodes(CRAS_STREAM_INPUT, &array)) {
+		dbus_message_unref(reply);
 		return DBUS_HANDLER_RESULT_NEED_MEMORY;
+	}
 	dbus_connection_send(conn, reply, &serial);
-	dbus_message_unref(reply);
+	/* Keep the reference as the cache. */
+	dbus_control.nodes_reply = reply;
 
 	return DBUS_HANDLER_RESULT_HANDLED;
 }
@@ -871,6 +932,71 @@ error:
 	return DBUS_HANDLER_RESULT_NEED_MEMORY;
 }
 
+static bool append_client_usage(DBusMessage *message,
+				struct cras_client_usage_info *infos,
+				unsigned int num)
+{
+	DBusMessageIter array;
+	DBusMessageIter dict;
+	unsigned int i;
+
+	dbus_message_iter_init_append(message, &array);
+	for (i = 0; i < num; i++) {
+		dbus_uint32_t id = infos[i].id;
+		dbus_int32_t pid = infos[i].pid;
+		dbus_uint64_t cpu_ns = infos[i].usage.cpu_ns;
+
+		if (!dbus_message_iter_open_container(&array, DBUS_TYPE_ARRAY,
+						      "{sv}", &dict))
+			return false;
+		if (!append_key_value(&dict, "ClientId", DBUS_TYPE_UINT32,
+				      DBUS_TYPE_UINT32_AS_STRING, &id))
+			return false;
+		if (!append_key_value(&dict, "Pid", DBUS_TYPE_INT32,
+				      DBUS_TYPE_INT32_AS_STRING, &pid))
+			return false;
+		if (!append_key_value(&dict, "CpuNs", DBUS_TYPE_UINT64,
+				      DBUS_TYPE_UINT64_AS_STRING, &cpu_ns))
+			return false;
+		if (!append_key_value(&dict, "NumFetches", DBUS_TYPE_UINT32,
+				      DBUS_TYPE_UINT32_AS_STRING,
+				      &infos[i].usage.num_fetches))
+			return false;
+		if (!append_key_value(&dict, "NumMissedCallbacks",
+				      DBUS_TYPE_UINT32,
+				      DBUS_TYPE_UINT32_AS_STRING,
+				      &infos[i].usage.num_missed_cb))
+			return false;
+		if (!dbus_message_iter_close_container(&array, &dict))
+			return false;
+	}
+	return true;
+}
+
+static DBusHandlerResult handle_get_client_usage(DBusConnection *conn,
+						 DBusMessage *message,
+						 void *arg)
+{
+	DBusMessage *reply;
+	dbus_uint32_t serial = 0;
+	struct cras_client_usage_info infos[CRAS_MAX_ATTACHED_CLIENTS];
+	unsigned int num;
+
+	reply = dbus_message_new_method_return(message);
+
+	num = cras_server_get_client_usage(infos, CRAS_MAX_ATTACHED_CLIENTS);
+	if (!append_client_usage(reply, infos, num))
+		goto error;
+
+	dbus_connection_send(conn, reply, &serial);
+	dbus_message_unref(reply);
+	return DBUS_HANDLER_RESULT_HANDLED;
+
+error:
+	dbus_message_unref(reply);
+	return DBUS_HANDLER_RESULT_NEED_MEMORY;
+}
+
 static DBusHandlerResult
 handle_set_global_output_channel_remix(DBusConnection *conn,
 				       DBusMessage *message, void *arg)
@@ -1188,6 +1314,9 @@ static DBusHandlerResult handle_control_message(DBusConnection *conn,
 			   "GetNumberOfInputStreamsWithPermission")) {
 		return handle_get_num_input_streams_with_permission(
 			conn, message, arg);
+	} else if (dbus_message_is_method_call(message, CRAS_CONTROL_INTERFACE,
+					       "GetClientUsage")) {
+		return handle_get_client_usage(conn, message, arg);
 	} else if (dbus_message_is_method_call(
 			   message, CRAS_CONTROL_INTERFACE,
 			   "GetNumberOfActiveOutputStreams")) {
@@ -1316,6 +1445,8 @@ static void signal_nodes_changed(void *context)
 	dbus_uint32_t serial = 0;
 	DBusMessage *msg;
 
+	drop_nodes_reply();
+
 	msg = create_dbus_message("NodesChanged");
 	if (!msg)
 		return;
@@ -1527,6 +1658,7 @@ void cras_dbus_control_stop()
 
 	dbus_connection_unref(dbus_control.conn);
 	dbus_control.conn = NULL;
+	drop_nodes_reply();
 	cras_observer_remove(dbus_control.observer);
 	dbus_control.observer = NULL;
 }
@@ -3,10 +3,14 @@
  * found in the LICENSE file.
  */
 
-#include <pthread.h>
+#include <errno.h>
+#include <string.h>
 #include <syslog.h>
+#include <time.h>
+#include "cras_audio_format.h"
 #include "dumper.h"
 #include "cras_expr.h"
+#include "cras_dsp.h"
 #include "cras_dsp_ini.h"
 #include "cras_dsp_pipeline.h"
 #include "dsp_util.h"
@@ -20,23 +24,48 @@
  * (1) The client asks to (re-)load it with cras_load_pipeline().
  * (2) The client asks to reload the ini with cras_reload_ini().
  *
- * The pipeline is (re-)loaded asynchronously in an internal thread,
- * so the client needs to use cras_dsp_get_pipeline() and
- * cras_dsp_put_pipeline() to safely access the pipeline.
+ * In case (1) the pipeline is kept if the variables changed since it was
+ * built leave the same plugins enabled. Only the plugins the ini records
+ * as depending on the changed variables are evaluated again for that.
+ * Otherwise the new pipeline takes over the modules of the old one whose
+ * plugins didn't change, so their filters carry on where they were.
+ *
+ * The new pipeline is created and instantiated by the caller, then
+ * published with a single pointer exchange. The audio thread never
+ * blocks on a (re-)load: cras_dsp_get_pipeline() only bumps a reader
+ * count, which the loader waits to drain before freeing the pipeline it
+ * replaced. The pipeline the audio thread last ran is kept in in_use so
+ * cras_dsp_apply() can crossfade from it, and the loader also waits for
+ * the audio thread to move off it, for at most RETIRE_TIMEOUT_MS.
  */
 struct cras_dsp_context {
-	pthread_mutex_t mutex;
 	struct pipeline *pipeline;
+	int readers;
+	int exclusive;
+	struct pipeline *in_use;
+	unsigned int fade_pos;
 
 	struct cras_expr_env env;
+	/* The variables changed since the pipeline was built, and whether
+	 * each plugin of its ini was disabled then. */
+	string_array changed;
+	char *disabled;
 	int sample_rate;
 	const char *purpose;
 	struct cras_dsp_context *prev, *next;
 };
 
+/* Length of the crossfade between an old and a new pipeline. */
+#define CROSSFADE_MS 10
+/* How long the loader lets the audio thread finish a crossfade. */
+#define RETIRE_TIMEOUT_MS 50
+
 static struct dumper *syslog_dumper;
 static const char *ini_filename;
 static struct ini *global_ini;
+/* Set until ini_filename is first parsed, which is put off until a pipeline
+ * is needed so it doesn't delay the daemon startup. */
+static int ini_load_pending;
 static struct cras_dsp_context *context_list;
 
 static void initialize_environment(struct cras_expr_env *env)
@@ -64,12 +93,17 @@ static void destroy_pipeline(struct pipeline *pipeline)
 		cras_dsp_ini_free(private_ini);
 }
 
+/* Creates and instantiates a pipeline from target_ini. The modules of from
+ * which can be kept are left to be taken over, their number is returned in
+ * reused. */
 static struct pipeline *prepare_pipeline(struct cras_dsp_context *ctx,
-					 struct ini *target_ini)
+					 struct ini *target_ini,
+					 struct pipeline *from, int *reused)
 {
 	struct pipeline *pipeline;
 	const char *purpose = ctx->purpose;
 
+	*reused = 0;
 	pipeline = cras_dsp_pipeline_create(target_ini, &ctx->env, purpose);
 
 	if (pipeline) {
@@ -79,6 +113,9 @@ static struct pipeline *prepare_pipeline(struct cras_dsp_context *ctx,
 		goto bail;
 	}
 
+	*reused = cras_dsp_pipeline_reuse_modules(pipeline, from,
+						  ctx->sample_rate);
+
 	if (cras_dsp_pipeline_load(pipeline) != 0) {
 		syslog(LOG_ERR, "cannot load pipeline");
 		goto bail;
@@ -99,26 +136,146 @@ static struct pipeline *prepare_pipeline(struct cras_dsp_context *ctx,
 	return pipeline;
 
 bail:
+	*reused = 0;
 	if (pipeline)
 		destroy_pipeline(pipeline);
 	return NULL;
 }
 
-static void cmd_load_pipeline(struct cras_dsp_context *ctx,
-			      struct ini *target_ini)
+static void sleep_1ms()
+{
+	struct timespec ts = { 0, 1000000 };
+
+	nanosleep(&ts, NULL);
+}
+
+static void wait_for_readers(struct cras_dsp_context *ctx)
+{
+	while (__atomic_load_n(&ctx->readers, __ATOMIC_SEQ_CST))
+		sleep_1ms();
+}
+
+/* Frees a pipeline which has been replaced in ctx, once the audio thread
+ * is done with it. */
+static void retire_pipeline(struct cras_dsp_context *ctx,
+			    struct pipeline *old)
+{
+	struct pipeline *expected;
+	int ms;
+
+	for (;;) {
+		/* Give a crossfade from old the time to complete. */
+		for (ms = 0; ms < RETIRE_TIMEOUT_MS; ms++) {
+			if (__atomic_load_n(&ctx->in_use, __ATOMIC_SEQ_CST) !=
+			    old)
+				break;
+			sleep_1ms();
+		}
+		/* Otherwise take it away, the audio thread then switches
+		 * to the new pipeline without fading. */
+		expected = old;
+		__atomic_compare_exchange_n(&ctx->in_use, &expected, NULL, 0,
+					    __ATOMIC_SEQ_CST,
+					    __ATOMIC_SEQ_CST);
+		wait_for_readers(ctx);
+		/* A reader which got old before the exchange may have
+		 * published it as in use before it left. */
+		if (__atomic_load_n(&ctx->in_use, __ATOMIC_SEQ_CST) != old)
+			break;
+	}
+	destroy_pipeline(old);
+}
+
+static void clear_changed_variables(struct cras_dsp_context *ctx)
+{
+	const char **name;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&ctx->changed, i, name) {
+		free((char *)*name);
+	}
+	ctx->changed.count = 0;
+}
+
+static void set_variable_changed(struct cras_dsp_context *ctx,
+				 const char *name)
+{
+	const char **changed;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&ctx->changed, i, changed) {
+		if (strcmp(*changed, name) == 0)
+			return;
+	}
+	ARRAY_APPEND(&ctx->changed, strdup(name));
+}
+
+static void record_plugin_states(struct cras_dsp_context *ctx,
+				 struct ini *ini)
 {
-	struct pipeline *pipeline, *old_pipeline;
+	struct plugin *plugin;
+	int i;
+
+	clear_changed_variables(ctx);
+	free(ctx->disabled);
+	ctx->disabled = malloc(ARRAY_COUNT(&ini->plugins));
+	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, plugin) {
+		ctx->disabled[i] =
+			cras_dsp_pipeline_plugin_disabled(plugin, &ctx->env);
+	}
+}
 
-	pipeline = target_ini ? prepare_pipeline(ctx, target_ini) : NULL;
+/* Returns true if a variable changed since the pipeline was built from ini
+ * enables or disables one of its plugins. */
+static int plugin_states_changed(struct cras_dsp_context *ctx,
+				 struct ini *ini)
+{
+	const plugin_index_array *dependents;
+	const char **name;
+	int i, j, *index;
+
+	ARRAY_ELEMENT_FOREACH (&ctx->changed, i, name) {
+		dependents = cras_dsp_ini_get_dependents(ini, *name);
+		if (!dependents)
+			continue;
+		ARRAY_ELEMENT_FOREACH (dependents, j, index) {
+			if (cras_dsp_pipeline_plugin_disabled(
+				    ARRAY_ELEMENT(&ini->plugins, *index),
+				    &ctx->env) != ctx->disabled[*index])
+				return 1;
+		}
+	}
+	return 0;
+}
 
-	/* This locking is short to avoild blocking audio thread. */
-	pthread_mutex_lock(&ctx->mutex);
-	old_pipeline = ctx->pipeline;
-	ctx->pipeline = pipeline;
-	pthread_mutex_unlock(&ctx->mutex);
+static void cmd_load_pipeline(struct cras_dsp_context *ctx,
+			      struct ini *target_ini)
+{
+	struct pipeline *pipeline = NULL, *old_pipeline;
+	int reused = 0;
+
+	old_pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (target_ini) {
+		pipeline = prepare_pipeline(ctx, target_ini, old_pipeline,
+					    &reused);
+		record_plugin_states(ctx, target_ini);
+	}
 
+	if (reused) {
+		/* The old pipeline can't run without the modules it hands
+		 * over, so the audio thread switches without a crossfade. */
+		cras_dsp_lock_pipeline(ctx);
+		cras_dsp_pipeline_take_modules(pipeline);
+		__atomic_store_n(&ctx->pipeline, pipeline, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&ctx->in_use, pipeline, __ATOMIC_SEQ_CST);
+		ctx->fade_pos = 0;
+		cras_dsp_unlock_pipeline(ctx);
+	} else {
+		old_pipeline = __atomic_exchange_n(&ctx->pipeline, pipeline,
+						   __ATOMIC_SEQ_CST);
+	}
 	if (old_pipeline)
-		destroy_pipeline(old_pipeline);
+		retire_pipeline(ctx, old_pipeline);
 }
 
 static void cmd_reload_ini()
@@ -127,6 +284,8 @@ static void cmd_reload_ini()
 	struct cras_dsp_context *ctx;
 
 	struct ini *new_ini = cras_dsp_ini_create(ini_filename);
+
+	ini_load_pending = 0;
 	if (!new_ini) {
 		syslog(LOG_DEBUG, "cannot create dsp ini");
 		return;
@@ -149,12 +308,20 @@ void cras_dsp_init(const char *filename)
 	dsp_enable_flush_denormal_to_zero();
 	ini_filename = strdup(filename);
 	syslog_dumper = syslog_dumper_create(LOG_ERR);
-	cmd_reload_ini();
+	ini_load_pending = 1;
+}
+
+/* Parses the ini file if that was put off since cras_dsp_init. */
+static void load_ini_if_pending()
+{
+	if (ini_load_pending)
+		cmd_reload_ini();
 }
 
 void cras_dsp_stop()
 {
 	syslog_dumper_free(syslog_dumper);
+	ini_load_pending = 0;
 	if (ini_filename)
 		free((char *)ini_filename);
 	if (global_ini) {
@@ -168,7 +335,6 @@ struct cras_dsp_context *cras_dsp_context_new(int sample_rate,
 {
 	struct cras_dsp_context *ctx = calloc(1, sizeof(*ctx));
 
-	pthread_mutex_init(&ctx->mutex, NULL);
 	initialize_environment(&ctx->env);
 	ctx->sample_rate = sample_rate;
 	ctx->purpose = strdup(purpose);
@@ -181,12 +347,14 @@ void cras_dsp_context_free(struct cras_dsp_context *ctx)
 {
 	DL_DELETE(context_list, ctx);
 
-	pthread_mutex_destroy(&ctx->mutex);
 	if (ctx->pipeline) {
 		destroy_pipeline(ctx->pipeline);
 		ctx->pipeline = NULL;
 	}
 	cras_expr_env_free(&ctx->env);
+	clear_changed_variables(ctx);
+	ARRAY_FREE(&ctx->changed);
+	free(ctx->disabled);
 	free((char *)ctx->purpose);
 	free(ctx);
 }
@@ -194,20 +362,76 @@ void cras_dsp_context_free(struct cras_dsp_context *ctx)
 void cras_dsp_set_variable_string(struct cras_dsp_context *ctx, const char *key,
 				  const char *value)
 {
-	cras_expr_env_set_variable_string(&ctx->env, key, value);
+	if (cras_expr_env_set_variable_string(&ctx->env, key, value))
+		set_variable_changed(ctx, key);
 }
 
 void cras_dsp_set_variable_boolean(struct cras_dsp_context *ctx,
 				   const char *key, char value)
 {
-	cras_expr_env_set_variable_boolean(&ctx->env, key, value);
+	if (cras_expr_env_set_variable_boolean(&ctx->env, key, value))
+		set_variable_changed(ctx, key);
 }
 
 void cras_dsp_load_pipeline(struct cras_dsp_context *ctx)
 {
+	struct pipeline *pipeline;
+
+	load_ini_if_pending();
+
+	pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (pipeline && global_ini &&
+	    cras_dsp_pipeline_get_ini(pipeline) == global_ini &&
+	    !plugin_states_changed(ctx, global_ini)) {
+		clear_changed_variables(ctx);
+		return;
+	}
 	cmd_load_pipeline(ctx, global_ini);
 }
 
+void cras_dsp_load_firmware(struct cras_dsp_context *ctx,
+			    cras_dsp_firmware_load_t load, void *arg)
+{
+	struct pipeline *pipeline;
+	struct plugin *plugin;
+	int i, rc;
+
+	load_ini_if_pending();
+	if (!global_ini)
+		return;
+
+	/* Find the plugins the pipeline runs with all of them on the host. */
+	ARRAY_ELEMENT_FOREACH (&global_ini->plugins, i, plugin) {
+		if (plugin->firmware_var)
+			cras_dsp_set_variable_boolean(ctx, plugin->firmware_var,
+						      0);
+	}
+	if (!load)
+		return;
+	pipeline = cras_dsp_pipeline_create(global_ini, &ctx->env,
+					    ctx->purpose);
+	if (!pipeline)
+		return;
+
+	ARRAY_ELEMENT_FOREACH (&global_ini->plugins, i, plugin) {
+		if (!plugin->firmware_control ||
+		    !cras_dsp_pipeline_has_plugin(pipeline, plugin))
+			continue;
+		rc = load(plugin, ctx->sample_rate, 0, arg);
+		if (rc == 0) {
+			cras_dsp_set_variable_boolean(ctx, plugin->firmware_var,
+						      1);
+			continue;
+		}
+		/* The host runs it, keep the firmware from running it too. */
+		if (rc != -ENOENT)
+			syslog(LOG_WARNING, "Failed to load %s to %s: %d",
+			       plugin->title, plugin->firmware_control, rc);
+		load(plugin, ctx->sample_rate, 1, arg);
+	}
+	cras_dsp_pipeline_free(pipeline);
+}
+
 void cras_dsp_load_mock_pipeline(struct cras_dsp_context *ctx,
 				 unsigned int num_channels)
 {
@@ -221,17 +445,151 @@ void cras_dsp_load_mock_pipeline(struct cras_dsp_context *ctx,
 
 struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx)
 {
-	pthread_mutex_lock(&ctx->mutex);
-	if (!ctx->pipeline) {
-		pthread_mutex_unlock(&ctx->mutex);
-		return NULL;
-	}
-	return ctx->pipeline;
+	struct pipeline *pipeline;
+
+	__atomic_add_fetch(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+	pipeline = __atomic_load_n(&ctx->exclusive, __ATOMIC_SEQ_CST) ?
+			   NULL :
+			   __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+	if (!pipeline)
+		__atomic_sub_fetch(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+	return pipeline;
 }
 
 void cras_dsp_put_pipeline(struct cras_dsp_context *ctx)
 {
-	pthread_mutex_unlock(&ctx->mutex);
+	__atomic_sub_fetch(&ctx->readers, 1, __ATOMIC_SEQ_CST);
+}
+
+int cras_dsp_set_control(struct cras_dsp_context *ctx, const char *title,
+			 int port, float value)
+{
+	struct pipeline *pipeline;
+	int rc;
+
+	pipeline = cras_dsp_get_pipeline(ctx);
+	if (!pipeline)
+		return -ENOENT;
+	rc = cras_dsp_pipeline_set_control(pipeline, title, port, value);
+	cras_dsp_put_pipeline(ctx);
+	return rc;
+}
+
+struct pipeline *cras_dsp_lock_pipeline(struct cras_dsp_context *ctx)
+{
+	__atomic_store_n(&ctx->exclusive, 1, __ATOMIC_SEQ_CST);
+	wait_for_readers(ctx);
+	return __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
+}
+
+void cras_dsp_unlock_pipeline(struct cras_dsp_context *ctx)
+{
+	__atomic_store_n(&ctx->exclusive, 0, __ATOMIC_SEQ_CST);
+}
+
+/* Runs the pipeline of ctx, fading from the one used last if it has just
+ * been replaced. Called on the audio thread only. */
+static int apply_pipeline(struct cras_dsp_context *ctx,
+			  struct pipeline *pipeline, float *const *planes,
+			  uint8_t *buf, snd_pcm_format_t format,
+			  unsigned int frames)
+{
+	struct pipeline *last;
+	unsigned int fade_frames = ctx->sample_rate * CROSSFADE_MS / 1000;
+	int rc;
+
+	last = __atomic_load_n(&ctx->in_use, __ATOMIC_SEQ_CST);
+	if (last == pipeline)
+		return planes ? cras_dsp_pipeline_apply_planar(
+					pipeline, planes, buf, format, frames) :
+				cras_dsp_pipeline_apply(pipeline, buf, format,
+							frames);
+
+	if (!last)
+		ctx->fade_pos = fade_frames;
+	rc = cras_dsp_pipeline_apply_crossfade(pipeline, last, planes, buf,
+					       format, frames, &ctx->fade_pos,
+					       fade_frames);
+	if (ctx->fade_pos >= fade_frames) {
+		/* Fails if the loader took last away, then the next call
+		 * publishes pipeline from NULL. */
+		if (__atomic_compare_exchange_n(&ctx->in_use, &last, pipeline,
+						0, __ATOMIC_SEQ_CST,
+						__ATOMIC_SEQ_CST))
+			ctx->fade_pos = 0;
+	}
+	return rc;
+}
+
+/* A capture device keeps the channels its pipeline takes, but the fewer
+ * channels the pipeline gives back, as from a beamformer, are packed at the
+ * start of buf. Spreads them back over the frames of the device, repeating
+ * them in the channels past them so every channel carries the output. */
+static void spread_capture_channels(struct pipeline *pipeline, uint8_t *buf,
+				    snd_pcm_format_t format,
+				    unsigned int frames)
+{
+	unsigned int in = cras_dsp_pipeline_get_num_input_channels(pipeline);
+	unsigned int out = cras_dsp_pipeline_get_num_output_channels(pipeline);
+	size_t width = PCM_FORMAT_WIDTH(format) / 8;
+	uint8_t frame[out * width];
+	unsigned int i, c;
+
+	/* Backwards, as a frame spread only covers the packed ones at or
+	 * after it, which are done by then. */
+	for (i = frames; i-- > 0;) {
+		memcpy(frame, buf + i * out * width, out * width);
+		for (c = 0; c < in; c++)
+			memcpy(buf + (i * in + c) * width,
+			       frame + (c % out) * width, width);
+	}
+}
+
+int cras_dsp_apply(struct cras_dsp_context *ctx, uint8_t *buf,
+		   snd_pcm_format_t format, unsigned int frames)
+{
+	struct pipeline *pipeline;
+	int rc;
+
+	pipeline = cras_dsp_get_pipeline(ctx);
+	if (!pipeline)
+		return 0;
+
+	rc = apply_pipeline(ctx, pipeline, NULL, buf, format, frames);
+	if (!rc && strcmp(ctx->purpose, "capture") == 0 &&
+	    cras_dsp_pipeline_get_num_output_channels(pipeline) <
+		    cras_dsp_pipeline_get_num_input_channels(pipeline))
+		spread_capture_channels(pipeline, buf, format, frames);
+
+	cras_dsp_put_pipeline(ctx);
+	return rc;
+}
+
+int cras_dsp_apply_planar(struct cras_dsp_context *ctx, float *const *planes,
+			  unsigned int num_planes, uint8_t *buf,
+			  snd_pcm_format_t format, unsigned int frames)
+{
+	struct pipeline *pipeline;
+	int rc;
+
+	pipeline = cras_dsp_get_pipeline(ctx);
+	if (pipeline &&
+	    (unsigned int)cras_dsp_pipeline_get_num_input_channels(pipeline) ==
+		    num_planes) {
+		rc = apply_pipeline(ctx, pipeline, planes, buf, format,
+				    frames);
+		cras_dsp_put_pipeline(ctx);
+		return rc;
+	}
+
+	/* The pipeline doesn't take the planes as they are, so run it on
+	 * the interleaved samples. */
+	rc = dsp_util_interleave(planes, buf, num_planes, format, frames);
+	if (!rc && pipeline)
+		rc = apply_pipeline(ctx, pipeline, NULL, buf, format, frames);
+	if (pipeline)
+		cras_dsp_put_pipeline(ctx);
+	return rc;
 }
 
 void cras_dsp_reload_ini()
@@ -244,11 +602,12 @@ void cras_dsp_dump_info()
 	struct pipeline *pipeline;
 	struct cras_dsp_context *ctx;
 
+	load_ini_if_pending();
 	if (global_ini)
 		cras_dsp_ini_dump(syslog_dumper, global_ini);
 	DL_FOREACH (context_list, ctx) {
 		cras_expr_env_dump(syslog_dumper, &ctx->env);
-		pipeline = ctx->pipeline;
+		pipeline = __atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST);
 		if (pipeline)
 			cras_dsp_pipeline_dump(syslog_dumper, pipeline);
 	}
@@ -256,10 +615,12 @@ void cras_dsp_dump_info()
 
 unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context *ctx)
 {
-	return cras_dsp_pipeline_get_num_output_channels(ctx->pipeline);
+	return cras_dsp_pipeline_get_num_output_channels(
+		__atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST));
 }
 
 unsigned int cras_dsp_num_input_channels(const struct cras_dsp_context *ctx)
 {
-	return cras_dsp_pipeline_get_num_input_channels(ctx->pipeline);
+	return cras_dsp_pipeline_get_num_input_channels(
+		__atomic_load_n(&ctx->pipeline, __ATOMIC_SEQ_CST));
 }
@@ -27,7 +27,7 @@ void cras_dsp_stop();
 /* Creates a dsp context. The context holds a pipeline and its
  * parameters.  To use the pipeline in the context, first use
  * cras_dsp_load_pipeline() to load it and then use
- * cras_dsp_get_pipeline() to lock it for access.
+ * cras_dsp_get_pipeline() to access it.
  * Args:
  *    sample_rate - The sampling rate of the pipeline.
  *    purpose - The purpose of the pipeline, "playback" or "capture".
@@ -51,17 +51,41 @@ void cras_dsp_set_variable_boolean(struct cras_dsp_context *ctx,
 /* Loads the pipeline to the context. This should be called again when
  * new values of configuration variables may change the plugin
  * graph. The actual loading happens in another thread to avoid
- * blocking the audio thread. */
+ * blocking the audio thread. A loaded pipeline is kept if the variables
+ * set since leave the same plugins enabled. */
 void cras_dsp_load_pipeline(struct cras_dsp_context *ctx);
 
+/* Loads a plugin into the firmware component named by its firmware_control.
+ * Args:
+ *    plugin - The plugin, whose control ports give the parameters.
+ *    sample_rate - The sampling rate of the pipeline.
+ *    bypass - Set the component to pass the audio through instead.
+ *    arg - As passed to cras_dsp_load_firmware().
+ * Returns:
+ *    0 if the firmware runs the plugin, -ENOENT if the device has no such
+ *    component, or another negative error code.
+ */
+typedef int (*cras_dsp_firmware_load_t)(const struct plugin *plugin,
+					int sample_rate, int bypass,
+					void *arg);
+
+/* Offers the plugins in the pipeline of the context that have a
+ * firmware_control to load, those loaded are left out of the pipeline the
+ * next time it's loaded with cras_dsp_load_pipeline(). The components of
+ * the others are bypassed. With load NULL all plugins run on the host. */
+void cras_dsp_load_firmware(struct cras_dsp_context *ctx,
+			    cras_dsp_firmware_load_t load, void *arg);
+
 /* Loads a mock pipeline of source directly connects to sink, of given
  * number of channels.
  */
 void cras_dsp_load_mock_pipeline(struct cras_dsp_context *ctx,
 				 unsigned int num_channels);
 
-/* Locks the pipeline in the context for access. Returns NULL if the
- * pipeline is still being loaded or cannot be loaded. */
+/* Gets the pipeline in the context for access, without blocking. The
+ * pipeline is not freed by a reload until it's released. Returns NULL if
+ * the pipeline is still being loaded, cannot be loaded or is locked by
+ * cras_dsp_lock_pipeline(). */
 struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx);
 
 /* Releases the pipeline in the context. This must be called in pair
@@ -70,6 +94,43 @@ struct pipeline *cras_dsp_get_pipeline(struct cras_dsp_context *ctx);
  * cras_dsp_get_pipeline() was called. */
 void cras_dsp_put_pipeline(struct cras_dsp_context *ctx);
 
+/* Changes a control of a plugin in the pipeline of the context, see
+ * cras_dsp_pipeline_set_control(). The value is lost when the pipeline is
+ * reloaded. Returns 0 on success, -ENOENT if there is no pipeline or no such
+ * control. */
+int cras_dsp_set_control(struct cras_dsp_context *ctx, const char *title,
+			 int port, float value);
+
+/* Waits until nobody uses the pipeline in the context and keeps others
+ * from getting it, so its modules can be changed. Meanwhile
+ * cras_dsp_get_pipeline() returns NULL and the audio is not processed.
+ * Must be called from the main thread, in pair with
+ * cras_dsp_unlock_pipeline(). Returns the pipeline, or NULL if there is
+ * none. */
+struct pipeline *cras_dsp_lock_pipeline(struct cras_dsp_context *ctx);
+
+/* Releases the lock taken with cras_dsp_lock_pipeline(). */
+void cras_dsp_unlock_pipeline(struct cras_dsp_context *ctx);
+
+/* Runs the pipeline in the context on an interleaved buffer in place, see
+ * cras_dsp_pipeline_apply(). Right after a (re-)load the output of the
+ * previous pipeline is crossfaded into the new one over a few
+ * milliseconds. Does nothing if there is no pipeline. This must only be
+ * called from the audio thread.
+ * Returns:
+ *    Negative code if error, otherwise 0.
+ */
+int cras_dsp_apply(struct cras_dsp_context *ctx, uint8_t *buf,
+		   snd_pcm_format_t format, unsigned int frames);
+
+/* Like cras_dsp_apply() for the non-interleaved samples of a float mix
+ * bus, which are written interleaved to buf. If the pipeline doesn't take
+ * num_planes channels, it runs on the interleaved samples instead, and if
+ * there is no pipeline the samples are only interleaved. */
+int cras_dsp_apply_planar(struct cras_dsp_context *ctx, float *const *planes,
+			  unsigned int num_planes, uint8_t *buf,
+			  snd_pcm_format_t format, unsigned int frames);
+
 /* Re-reads the ini file and reloads all pipelines in the system. */
 void cras_dsp_reload_ini();
 
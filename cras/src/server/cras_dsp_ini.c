@@ -3,7 +3,12 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for asprintf */
+#endif
+
 #include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <syslog.h>
 #include "cras_dsp_ini.h"
@@ -31,6 +36,11 @@
 - Each plugin can have an optional "disable expression", which defines
   under which conditions the plugin is disabled.
 
+- Each plugin can have an optional "firmware_control", the name of the
+  bytes control of a DSP firmware component doing the same processing.
+  When the audio device can load the plugin into that component, see
+  cras_dsp_load_firmware(), the plugin is left out of the pipeline.
+
 - Each plugin have some ports which specify the parameters for the
   plugin or to specify connections to other plugins. The ports in each
   plugin are numbered from 0. Each port is either an input port or an
@@ -144,12 +154,27 @@ static int parse_ports(struct ini *ini, const char *sec_name,
 static int parse_plugin_section(struct ini *ini, const char *sec_name,
 				struct plugin *p)
 {
+	const char *str;
+
 	p->title = sec_name;
 	p->library = getstring(ini, sec_name, "library");
 	p->label = getstring(ini, sec_name, "label");
 	p->purpose = getstring(ini, sec_name, "purpose");
+	p->impulse_response = getstring(ini, sec_name, "impulse_response");
+	str = getstring(ini, sec_name, "block_size");
+	p->block_size = str ? atoi(str) : 0;
+	if (p->block_size < 0) {
+		syslog(LOG_ERR, "Invalid block_size '%s' in %s", str, sec_name);
+		return -1;
+	}
 	p->disable_expr =
 		cras_expr_expression_parse(getstring(ini, sec_name, "disable"));
+	p->firmware_control = getstring(ini, sec_name, "firmware_control");
+	if (p->firmware_control &&
+	    asprintf(&p->firmware_var, "firmware:%s", sec_name) < 0) {
+		p->firmware_var = NULL;
+		return -1;
+	}
 
 	if (p->library == NULL || p->label == NULL) {
 		syslog(LOG_ERR, "A plugin must have library and label: %s",
@@ -194,6 +219,46 @@ static void fill_flow_info(struct ini *ini)
 	}
 }
 
+static void add_dependency(struct ini *ini, const char *variable,
+			   int plugin_index)
+{
+	struct dependency *dep;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&ini->dependencies, i, dep) {
+		if (strcmp(dep->variable, variable) == 0)
+			break;
+	}
+	if (i == ARRAY_COUNT(&ini->dependencies)) {
+		dep = ARRAY_APPEND_ZERO(&ini->dependencies);
+		dep->variable = strdup(variable);
+	}
+	ARRAY_APPEND(&dep->plugins, plugin_index);
+}
+
+/* Compiles the disable expressions and records the variables each plugin's
+ * disabled state depends on, so a change of a variable can be checked
+ * against the plugins it affects. */
+static void fill_dependencies(struct ini *ini)
+{
+	struct cras_expr_program *prog;
+	struct plugin *plugin;
+	int i, j, num_variables;
+
+	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, plugin) {
+		prog = cras_expr_program_compile(plugin->disable_expr);
+		plugin->disable_prog = prog;
+		num_variables =
+			prog ? cras_expr_program_get_num_variables(prog) : 0;
+		for (j = 0; j < num_variables; j++)
+			add_dependency(ini,
+				       cras_expr_program_get_variable(prog, j),
+				       i);
+		if (plugin->firmware_var)
+			add_dependency(ini, plugin->firmware_var, i);
+	}
+}
+
 /* Adds a port to a plugin with specified flow id and direction. */
 static void add_audio_port(struct ini *ini, struct plugin *plugin, int flow_id,
 			   enum port_direction port_direction)
@@ -352,6 +417,7 @@ struct ini *create_mock_ini(const char *purpose, unsigned int num_channels)
 		add_audio_port(ini, sink, tmp_flow_ids[i], PORT_INPUT);
 
 	fill_flow_info(ini);
+	fill_dependencies(ini);
 
 	return ini;
 }
@@ -396,6 +462,7 @@ struct ini *cras_dsp_ini_create(const char *ini_filename)
 
 	/* Fill flow info now because now the plugin array won't change */
 	fill_flow_info(ini);
+	fill_dependencies(ini);
 
 	return ini;
 bail:
@@ -406,16 +473,25 @@ bail:
 void cras_dsp_ini_free(struct ini *ini)
 {
 	struct plugin *p;
+	struct dependency *dep;
 	int i;
 
 	/* free plugins */
 	ARRAY_ELEMENT_FOREACH (&ini->plugins, i, p) {
 		cras_expr_expression_free(p->disable_expr);
+		cras_expr_program_free(p->disable_prog);
+		free(p->firmware_var);
 		ARRAY_FREE(&p->ports);
 	}
 	ARRAY_FREE(&ini->plugins);
 	ARRAY_FREE(&ini->flows);
 
+	ARRAY_ELEMENT_FOREACH (&ini->dependencies, i, dep) {
+		free((char *)dep->variable);
+		ARRAY_FREE(&dep->plugins);
+	}
+	ARRAY_FREE(&ini->dependencies);
+
 	if (ini->dict) {
 		iniparser_freedict(ini->dict);
 		ini->dict = NULL;
@@ -424,6 +500,19 @@ void cras_dsp_ini_free(struct ini *ini)
 	free(ini);
 }
 
+const plugin_index_array *cras_dsp_ini_get_dependents(struct ini *ini,
+						      const char *name)
+{
+	struct dependency *dep;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&ini->dependencies, i, dep) {
+		if (strcmp(dep->variable, name) == 0)
+			return &dep->plugins;
+	}
+	return NULL;
+}
+
 static const char *port_direction_str(enum port_direction port_direction)
 {
 	switch (port_direction) {
@@ -461,6 +550,8 @@ void cras_dsp_ini_dump(struct dumper *d, struct ini *ini)
 	struct plugin *plugin;
 	struct port *port;
 	const struct flow *flow;
+	struct dependency *dep;
+	int *index;
 
 	dumpf(d, "---- ini dump begin ---\n");
 	dumpf(d, "ini->dict = %p\n", ini->dict);
@@ -472,6 +563,14 @@ void cras_dsp_ini_dump(struct dumper *d, struct ini *ini)
 		dumpf(d, "label=%s\n", plugin->label);
 		dumpf(d, "purpose=%s\n", plugin->purpose);
 		dumpf(d, "disable=%p\n", plugin->disable_expr);
+		if (plugin->impulse_response)
+			dumpf(d, "impulse_response=%s\n",
+			      plugin->impulse_response);
+		if (plugin->block_size)
+			dumpf(d, "block_size=%d\n", plugin->block_size);
+		if (plugin->firmware_control)
+			dumpf(d, "firmware_control=%s\n",
+			      plugin->firmware_control);
 		ARRAY_ELEMENT_FOREACH (&plugin->ports, j, port) {
 			dumpf(d,
 			      "  [%s port %d] type=%s, flow_id=%d, value=%g\n",
@@ -488,5 +587,14 @@ void cras_dsp_ini_dump(struct dumper *d, struct ini *ini)
 		      flow->from_port, plugin_title(flow->to), flow->to_port);
 	}
 
+	ARRAY_ELEMENT_FOREACH (&ini->dependencies, i, dep) {
+		dumpf(d, "  [dependency %s]", dep->variable);
+		ARRAY_ELEMENT_FOREACH (&dep->plugins, j, index) {
+			dumpf(d, " %s",
+			      ARRAY_ELEMENT(&ini->plugins, *index)->title);
+		}
+		dumpf(d, "\n");
+	}
+
 	dumpf(d, "---- ini dump end ----\n");
 }
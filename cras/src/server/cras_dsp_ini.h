@@ -49,6 +49,14 @@ struct plugin {
 	const char *purpose; /* like "playback" or "capture" */
 	struct cras_expr_expression *disable_expr; /* the disable expression of
 					     this plugin */
+	struct cras_expr_program *disable_prog; /* disable_expr compiled */
+	const char *impulse_response; /* file read by the "fir" builtin */
+	/* The number of frames a LADSPA plugin must be run with, 0 for any. */
+	int block_size;
+	/* Bytes control of a firmware component the plugin can run on instead,
+	 * and the dsp variable set true while it does. */
+	const char *firmware_control;
+	char *firmware_var;
 	port_array ports;
 };
 
@@ -61,13 +69,23 @@ struct flow {
 	int to_port;
 };
 
+DECLARE_ARRAY_TYPE(int, plugin_index_array)
+
+/* A dsp variable and the plugins whose disabled state depends on it. */
+struct dependency {
+	const char *variable;
+	plugin_index_array plugins;
+};
+
 DECLARE_ARRAY_TYPE(struct plugin, plugin_array)
 DECLARE_ARRAY_TYPE(struct flow, flow_array)
+DECLARE_ARRAY_TYPE(struct dependency, dependency_array)
 
 struct ini {
 	dictionary *dict;
 	plugin_array plugins;
 	flow_array flows;
+	dependency_array dependencies;
 };
 
 /*
@@ -92,6 +110,10 @@ struct ini *create_mock_ini(const char *purpose, unsigned int num_channels);
 struct ini *cras_dsp_ini_create(const char *ini_filename);
 /* Frees the dsp structure. */
 void cras_dsp_ini_free(struct ini *ini);
+/* Gets the indices of the plugins whose disabled state depends on the dsp
+ * variable name, or NULL if there is none. */
+const plugin_index_array *cras_dsp_ini_get_dependents(struct ini *ini,
+						      const char *name);
 /* Dumps the information in the ini structure to syslog. */
 void cras_dsp_ini_dump(struct dumper *d, struct ini *ini);
 
@@ -3,13 +3,18 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <syslog.h>
+#include "beamform.h"
 #include "cras_dsp_module.h"
 #include "drc.h"
 #include "dsp_util.h"
 #include "dcblock.h"
 #include "eq.h"
 #include "eq2.h"
+#include "fir.h"
 
 /*
  *  empty module functions (for source and sink)
@@ -65,6 +70,21 @@ static void empty_init_module(struct dsp_module *module)
 	module->dump = &empty_dump;
 }
 
+/* Copies the values of n control ports to values. Returns 1 if any of them
+ * changed. Used by the modules that follow their controls while running. */
+static int update_controls(float *const *ports, float *values, int n)
+{
+	int i, changed = 0;
+
+	for (i = 0; i < n; i++) {
+		if (ports[i] && *ports[i] != values[i]) {
+			values[i] = *ports[i];
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
 /*
  *  swap_lr module functions
  */
@@ -85,17 +105,13 @@ static void swap_lr_connect_port(struct dsp_module *module, unsigned long port,
 
 static void swap_lr_run(struct dsp_module *module, unsigned long sample_count)
 {
-	size_t i;
 	float **ports = (float **)module->data;
 
 	/* This module runs dsp in-place, so ports[0] == ports[2],
 	 * ports[1] == ports[3]. Here we swap data on two channels.
 	 */
-	for (i = 0; i < sample_count; i++) {
-		float temp = ports[0][i];
-		ports[2][i] = ports[1][i];
-		ports[3][i] = temp;
-	}
+	dsp_util_swap_stereo(ports[0], ports[1], ports[2], ports[3],
+			     (int)sample_count);
 }
 
 static void swap_lr_deinstantiate(struct dsp_module *module)
@@ -134,13 +150,10 @@ static void invert_lr_connect_port(struct dsp_module *module,
 
 static void invert_lr_run(struct dsp_module *module, unsigned long sample_count)
 {
-	size_t i;
 	float **ports = (float **)module->data;
 
-	for (i = 0; i < sample_count; i++) {
-		ports[2][i] = -ports[0][i];
-		ports[3][i] = ports[1][i];
-	}
+	dsp_util_invert_left(ports[0], ports[1], ports[2], ports[3],
+			     (int)sample_count);
 }
 
 static void invert_lr_deinstantiate(struct dsp_module *module)
@@ -180,15 +193,10 @@ static void mix_stereo_connect_port(struct dsp_module *module,
 static void mix_stereo_run(struct dsp_module *module,
 			   unsigned long sample_count)
 {
-	size_t i;
-	float tmp;
 	float **ports = (float **)module->data;
 
-	for (i = 0; i < sample_count; i++) {
-		tmp = ports[0][i] + ports[1][i];
-		ports[2][i] = tmp;
-		ports[3][i] = tmp;
-	}
+	dsp_util_mix_stereo(ports[0], ports[1], ports[2], ports[3],
+			    (int)sample_count);
 }
 
 static void mix_stereo_deinstantiate(struct dsp_module *module)
@@ -216,10 +224,18 @@ struct dcblock_data {
 	struct dcblock *dcblockr;
 	unsigned long sample_rate;
 
-	/* One port for input, one for output, and 1 parameter */
+	/* Two ports for input, two for output, and 1 parameter */
 	float *ports[5];
+
+	/* The downstream eq2 merged into this module, see
+	 * cras_dsp_module_merge(). It runs on the output of each block. */
+	struct dsp_module *eq2;
 };
 
+struct eq2_data;
+static void eq2_process_data(struct eq2_data *data, float *data0,
+			     float *data1, int count);
+
 static int dcblock_instantiate(struct dsp_module *module,
 			       unsigned long sample_rate)
 {
@@ -255,8 +271,11 @@ static void dcblock_run(struct dsp_module *module, unsigned long sample_count)
 		memcpy(data->ports[3], data->ports[1],
 		       sizeof(float) * sample_count);
 
-	dcblock_process(data->dcblockl, data->ports[2], (int)sample_count);
-	dcblock_process(data->dcblockr, data->ports[3], (int)sample_count);
+	dcblock_process_stereo(data->dcblockl, data->dcblockr, data->ports[2],
+			       data->ports[3], (int)sample_count);
+	if (data->eq2)
+		eq2_process_data(data->eq2->data, data->ports[2],
+				 data->ports[3], (int)sample_count);
 }
 
 static void dcblock_deinstantiate(struct dsp_module *module)
@@ -290,6 +309,13 @@ struct eq_data {
 
 	/* One port for input, one for output, and 4 parameters per eq */
 	float *ports[2 + MAX_BIQUADS_PER_EQ * 4];
+
+	/* The control values the eq is set to */
+	float values[2 + MAX_BIQUADS_PER_EQ * 4];
+
+	/* The downstream eq merged into this one, see
+	 * cras_dsp_module_merge(). Its biquads are appended after ours. */
+	struct eq_data *next;
 };
 
 static int eq_instantiate(struct dsp_module *module, unsigned long sample_rate)
@@ -309,24 +335,41 @@ static void eq_connect_port(struct dsp_module *module, unsigned long port,
 	data->ports[port] = data_location;
 }
 
+/* Appends the biquads set by the control ports of data, and of the eq merged
+ * into it, to data->eq. Once they are appended, changes only the biquads
+ * whose controls changed. */
+static void eq_set_biquads(struct eq_data *data, int append)
+{
+	float nyquist = data->sample_rate / 2;
+	struct eq_data *d;
+	float *v;
+	int i, index = 0, changed;
+
+	for (d = data; d; d = d->next) {
+		for (i = 2; i < 2 + MAX_BIQUADS_PER_EQ * 4; i += 4, index++) {
+			if (!d->ports[i])
+				break;
+			changed = update_controls(&d->ports[i], &d->values[i],
+						  4);
+			v = &d->values[i];
+			if (append)
+				eq_append_biquad(data->eq, (int)v[0],
+						 v[1] / nyquist, v[2], v[3]);
+			else if (changed)
+				eq_set_biquad(data->eq, index, (int)v[0],
+					      v[1] / nyquist, v[2], v[3]);
+		}
+	}
+}
+
 static void eq_run(struct dsp_module *module, unsigned long sample_count)
 {
 	struct eq_data *data = (struct eq_data *)module->data;
 	if (!data->eq) {
-		float nyquist = data->sample_rate / 2;
-		int i;
-
 		data->eq = eq_new();
-		for (i = 2; i < 2 + MAX_BIQUADS_PER_EQ * 4; i += 4) {
-			if (!data->ports[i])
-				break;
-			int type = (int)*data->ports[i];
-			float freq = *data->ports[i + 1];
-			float Q = *data->ports[i + 2];
-			float gain = *data->ports[i + 3];
-			eq_append_biquad(data->eq, type, freq / nyquist, Q,
-					 gain);
-		}
+		eq_set_biquads(data, 1);
+	} else {
+		eq_set_biquads(data, 0);
 	}
 	if (data->ports[0] != data->ports[1])
 		memcpy(data->ports[1], data->ports[0],
@@ -363,6 +406,13 @@ struct eq2_data {
 
 	/* Two ports for input, two for output, and 8 parameters per eq pair */
 	float *ports[4 + MAX_BIQUADS_PER_EQ2 * 8];
+
+	/* The control values the eq2 is set to */
+	float values[4 + MAX_BIQUADS_PER_EQ2 * 8];
+
+	/* The downstream eq2 merged into this one, see
+	 * cras_dsp_module_merge(). Its biquads are appended after ours. */
+	struct eq2_data *next;
 };
 
 static int eq2_instantiate(struct dsp_module *module, unsigned long sample_rate)
@@ -382,28 +432,54 @@ static void eq2_connect_port(struct dsp_module *module, unsigned long port,
 	data->ports[port] = data_location;
 }
 
-static void eq2_run(struct dsp_module *module, unsigned long sample_count)
+/* Same as eq_set_biquads(), for the two channels of an eq2. */
+static void eq2_set_biquads(struct eq2_data *data, int append)
 {
-	struct eq2_data *data = (struct eq2_data *)module->data;
-	if (!data->eq2) {
-		float nyquist = data->sample_rate / 2;
-		int i, channel;
-
-		data->eq2 = eq2_new();
-		for (i = 4; i < 4 + MAX_BIQUADS_PER_EQ2 * 8; i += 8) {
-			if (!data->ports[i])
+	float nyquist = data->sample_rate / 2;
+	struct eq2_data *d;
+	float *v;
+	int i, k, channel, index = 0, changed;
+
+	for (d = data; d; d = d->next) {
+		for (i = 4; i < 4 + MAX_BIQUADS_PER_EQ2 * 8; i += 8, index++) {
+			if (!d->ports[i])
 				break;
 			for (channel = 0; channel < 2; channel++) {
-				int k = i + channel * 4;
-				int type = (int)*data->ports[k];
-				float freq = *data->ports[k + 1];
-				float Q = *data->ports[k + 2];
-				float gain = *data->ports[k + 3];
-				eq2_append_biquad(data->eq2, channel, type,
-						  freq / nyquist, Q, gain);
+				k = i + channel * 4;
+				changed = update_controls(&d->ports[k],
+							  &d->values[k], 4);
+				v = &d->values[k];
+				if (append)
+					eq2_append_biquad(data->eq2, channel,
+							  (int)v[0],
+							  v[1] / nyquist, v[2],
+							  v[3]);
+				else if (changed)
+					eq2_set_biquad(data->eq2, channel,
+						       index, (int)v[0],
+						       v[1] / nyquist, v[2],
+						       v[3]);
 			}
 		}
 	}
+}
+
+/* Runs the biquads of data, and of the eq2s merged into it, in place. */
+static void eq2_process_data(struct eq2_data *data, float *data0,
+			     float *data1, int count)
+{
+	if (!data->eq2) {
+		data->eq2 = eq2_new();
+		eq2_set_biquads(data, 1);
+	} else {
+		eq2_set_biquads(data, 0);
+	}
+	eq2_process(data->eq2, data0, data1, count);
+}
+
+static void eq2_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct eq2_data *data = (struct eq2_data *)module->data;
 
 	if (data->ports[0] != data->ports[2])
 		memcpy(data->ports[2], data->ports[0],
@@ -412,8 +488,8 @@ static void eq2_run(struct dsp_module *module, unsigned long sample_count)
 		memcpy(data->ports[3], data->ports[1],
 		       sizeof(float) * sample_count);
 
-	eq2_process(data->eq2, data->ports[2], data->ports[3],
-		    (int)sample_count);
+	eq2_process_data(data, data->ports[2], data->ports[3],
+			 (int)sample_count);
 }
 
 static void eq2_deinstantiate(struct dsp_module *module)
@@ -439,21 +515,33 @@ static void eq2_init_module(struct dsp_module *module)
 /*
  *  drc module functions
  */
+/* The ports of a drc of N channels, N being the number of input audio ports
+ * of the plugin. With two channels this is the original stereo layout. */
+#define DRC_PORT_CONTROLS(n) (2 * (n))
+#define DRC_NUM_CONTROLS (1 + 8 * 3)
+
 struct drc_data {
 	int sample_rate;
+	int num_channels;
 	struct drc *drc; /* Initialized in the first call of drc_run() */
 
-	/* Two ports for input, two for output, one for disable_emphasis,
+	/* N ports for input, N for output, one for disable_emphasis,
 	 * and 8 parameters each band */
-	float *ports[4 + 1 + 8 * 3];
+	float *ports[2 * DRC_MAX_CHANNELS + DRC_NUM_CONTROLS];
+
+	/* The control values the drc is set to */
+	float values[2 * DRC_MAX_CHANNELS + DRC_NUM_CONTROLS];
 };
 
 static int drc_instantiate(struct dsp_module *module, unsigned long sample_rate)
 {
-	struct drc_data *data;
+	struct drc_data *data = (struct drc_data *)module->data;
 
-	module->data = calloc(1, sizeof(struct drc_data));
-	data = (struct drc_data *)module->data;
+	if (data->num_channels < 1 || data->num_channels > DRC_MAX_CHANNELS) {
+		syslog(LOG_ERR, "drc module with %d channels",
+		       data->num_channels);
+		return -1;
+	}
 	data->sample_rate = (int)sample_rate;
 	return 0;
 }
@@ -471,46 +559,62 @@ static int drc_get_delay(struct dsp_module *module)
 	return DRC_DEFAULT_PRE_DELAY * data->sample_rate;
 }
 
+/* Sets the parameters of the three bands of the drc from the control
+ * values. */
+static void drc_set_band_params(struct drc_data *data)
+{
+	struct drc *drc = data->drc;
+	float nyquist = data->sample_rate / 2;
+	int c = DRC_PORT_CONTROLS(data->num_channels);
+	int i;
+
+	for (i = 0; i < 3; i++) {
+		int k = c + 1 + i * 8;
+		float f = data->values[k];
+		float enable = data->values[k + 1];
+		float threshold = data->values[k + 2];
+		float knee = data->values[k + 3];
+		float ratio = data->values[k + 4];
+		float attack = data->values[k + 5];
+		float release = data->values[k + 6];
+		float boost = data->values[k + 7];
+		drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ, f / nyquist);
+		drc_set_param(drc, i, PARAM_ENABLED, enable);
+		drc_set_param(drc, i, PARAM_THRESHOLD, threshold);
+		drc_set_param(drc, i, PARAM_KNEE, knee);
+		drc_set_param(drc, i, PARAM_RATIO, ratio);
+		drc_set_param(drc, i, PARAM_ATTACK, attack);
+		drc_set_param(drc, i, PARAM_RELEASE, release);
+		drc_set_param(drc, i, PARAM_POST_GAIN, boost);
+	}
+}
+
 static void drc_run(struct dsp_module *module, unsigned long sample_count)
 {
 	struct drc_data *data = (struct drc_data *)module->data;
+	int n = data->num_channels;
+	int c = DRC_PORT_CONTROLS(n);
+	int changed = update_controls(&data->ports[c], &data->values[c],
+				      DRC_NUM_CONTROLS);
+	int i;
+
 	if (!data->drc) {
-		int i;
-		float nyquist = data->sample_rate / 2;
-		struct drc *drc = drc_new(data->sample_rate);
-
-		data->drc = drc;
-		drc->emphasis_disabled = (int)*data->ports[4];
-		for (i = 0; i < 3; i++) {
-			int k = 5 + i * 8;
-			float f = *data->ports[k];
-			float enable = *data->ports[k + 1];
-			float threshold = *data->ports[k + 2];
-			float knee = *data->ports[k + 3];
-			float ratio = *data->ports[k + 4];
-			float attack = *data->ports[k + 5];
-			float release = *data->ports[k + 6];
-			float boost = *data->ports[k + 7];
-			drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ,
-				      f / nyquist);
-			drc_set_param(drc, i, PARAM_ENABLED, enable);
-			drc_set_param(drc, i, PARAM_THRESHOLD, threshold);
-			drc_set_param(drc, i, PARAM_KNEE, knee);
-			drc_set_param(drc, i, PARAM_RATIO, ratio);
-			drc_set_param(drc, i, PARAM_ATTACK, attack);
-			drc_set_param(drc, i, PARAM_RELEASE, release);
-			drc_set_param(drc, i, PARAM_POST_GAIN, boost);
-		}
-		drc_init(drc);
+		data->drc = drc_new(data->sample_rate, n);
+		data->drc->emphasis_disabled = (int)data->values[c];
+		drc_set_band_params(data);
+		drc_init(data->drc);
+	} else if (changed) {
+		/* The crossover and emphasis stay as they were set by
+		 * drc_init(). */
+		drc_set_band_params(data);
+		drc_update(data->drc);
 	}
-	if (data->ports[0] != data->ports[2])
-		memcpy(data->ports[2], data->ports[0],
-		       sizeof(float) * sample_count);
-	if (data->ports[1] != data->ports[3])
-		memcpy(data->ports[3], data->ports[1],
-		       sizeof(float) * sample_count);
+	for (i = 0; i < n; i++)
+		if (data->ports[i] != data->ports[n + i])
+			memcpy(data->ports[n + i], data->ports[i],
+			       sizeof(float) * sample_count);
 
-	drc_process(data->drc, &data->ports[2], (int)sample_count);
+	drc_process(data->drc, &data->ports[n], (int)sample_count);
 }
 
 static void drc_deinstantiate(struct dsp_module *module)
@@ -518,21 +622,280 @@ static void drc_deinstantiate(struct dsp_module *module)
 	struct drc_data *data = (struct drc_data *)module->data;
 	if (data->drc)
 		drc_free(data->drc);
-	free(data);
+	data->drc = NULL;
+}
+
+static void drc_free_module(struct dsp_module *module)
+{
+	free(module->data);
+	free(module);
 }
 
-static void drc_init_module(struct dsp_module *module)
+static void drc_init_module(struct dsp_module *module, struct plugin *plugin)
 {
+	struct drc_data *data = calloc(1, sizeof(struct drc_data));
+	struct port *port;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&plugin->ports, i, port) {
+		if (port->direction == PORT_INPUT && port->type == PORT_AUDIO)
+			data->num_channels++;
+	}
+	module->data = data;
 	module->instantiate = &drc_instantiate;
 	module->connect_port = &drc_connect_port;
 	module->get_delay = &drc_get_delay;
 	module->run = &drc_run;
 	module->deinstantiate = &drc_deinstantiate;
-	module->free_module = &empty_free_module;
+	module->free_module = &drc_free_module;
 	module->get_properties = &empty_get_properties;
 	module->dump = &empty_dump;
 }
 
+/*
+ *  fir module functions
+ */
+
+/* The partition size of the convolution, which is also its latency. */
+#define FIR_BLOCK_SIZE 256
+/* The longest impulse response accepted, about 1.4s at 48kHz. */
+#define FIR_MAX_TAPS 65536
+
+struct fir_data {
+	/* The impulse response file, raw native endian 32 bit floats. */
+	const char *impulse_response;
+	struct fir *fir;
+
+	/* One port for input, one for output */
+	float *ports[2];
+};
+
+static float *fir_read_impulse_response(const char *path, int *taps)
+{
+	FILE *f;
+	long size;
+	float *ir = NULL;
+
+	f = fopen(path, "rb");
+	if (!f) {
+		syslog(LOG_ERR, "Cannot open impulse response %s", path);
+		return NULL;
+	}
+	if (fseek(f, 0, SEEK_END) || (size = ftell(f)) < 0 ||
+	    fseek(f, 0, SEEK_SET))
+		goto done;
+	size /= sizeof(float);
+	if (size == 0 || size > FIR_MAX_TAPS) {
+		syslog(LOG_ERR, "Impulse response %s has %ld taps", path,
+		       size);
+		goto done;
+	}
+	ir = (float *)malloc(size * sizeof(float));
+	if (ir && fread(ir, sizeof(float), size, f) != (size_t)size) {
+		free(ir);
+		ir = NULL;
+	}
+	*taps = (int)size;
+done:
+	fclose(f);
+	return ir;
+}
+
+/* The impulse response is read and transformed here, off the audio
+ * thread, as it may be thousands of taps. */
+static int fir_instantiate(struct dsp_module *module,
+			   unsigned long sample_rate)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	float *ir;
+	int taps;
+
+	if (!data->impulse_response) {
+		syslog(LOG_ERR, "fir module without impulse_response");
+		return -1;
+	}
+	ir = fir_read_impulse_response(data->impulse_response, &taps);
+	if (!ir)
+		return -1;
+	data->fir = fir_new(ir, taps, FIR_BLOCK_SIZE);
+	free(ir);
+	return data->fir ? 0 : -1;
+}
+
+static void fir_connect_port(struct dsp_module *module, unsigned long port,
+			     float *data_location)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	data->ports[port] = data_location;
+}
+
+/* The pipeline runs the filter a partition at a time and buffers for it,
+ * so it adds no delay of its own. */
+static int fir_get_delay_frames(struct dsp_module *module)
+{
+	return 0;
+}
+
+static int fir_get_block_size(struct dsp_module *module)
+{
+	return FIR_BLOCK_SIZE;
+}
+
+static void fir_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+
+	if (data->ports[0] != data->ports[1])
+		memcpy(data->ports[1], data->ports[0],
+		       sizeof(float) * sample_count);
+	fir_process_block(data->fir, data->ports[1]);
+}
+
+static void fir_deinstantiate(struct dsp_module *module)
+{
+	struct fir_data *data = (struct fir_data *)module->data;
+	fir_free(data->fir);
+	data->fir = NULL;
+}
+
+static void fir_free_module(struct dsp_module *module)
+{
+	free(module->data);
+	free(module);
+}
+
+static void fir_init_module(struct dsp_module *module, struct plugin *plugin)
+{
+	struct fir_data *data = calloc(1, sizeof(struct fir_data));
+
+	data->impulse_response = plugin->impulse_response;
+	module->data = data;
+	module->instantiate = &fir_instantiate;
+	module->connect_port = &fir_connect_port;
+	module->get_delay = &fir_get_delay_frames;
+	module->run = &fir_run;
+	module->deinstantiate = &fir_deinstantiate;
+	module->free_module = &fir_free_module;
+	module->get_properties = &empty_get_properties;
+	module->get_block_size = &fir_get_block_size;
+	module->dump = &empty_dump;
+}
+
+/*
+ *  beamform module functions
+ */
+
+#define BEAMFORM_MAX_INPUTS 8
+#define BEAMFORM_MAX_BEAMS 2
+#define BEAMFORM_MAX_CONTROLS (BEAMFORM_MAX_INPUTS * BEAMFORM_MAX_BEAMS)
+
+struct beamform_data {
+	int num_inputs;
+	int num_beams;
+	int num_controls;
+	struct beamform *bf;
+
+	/* N ports for input, M for output, then the delay in samples of
+	 * each input in each beam, the N inputs of beam 0 first. */
+	float *ports[BEAMFORM_MAX_INPUTS + BEAMFORM_MAX_BEAMS +
+		     BEAMFORM_MAX_CONTROLS];
+
+	/* The delays the beamformer is set to */
+	float values[BEAMFORM_MAX_CONTROLS];
+};
+
+static int beamform_instantiate(struct dsp_module *module,
+				unsigned long sample_rate)
+{
+	struct beamform_data *data = (struct beamform_data *)module->data;
+	int n = data->num_inputs, m = data->num_beams;
+
+	if (n < 2 || n > BEAMFORM_MAX_INPUTS || m < 1 ||
+	    m > BEAMFORM_MAX_BEAMS || m > n || data->num_controls != n * m) {
+		syslog(LOG_ERR,
+		       "beamform module with %d inputs, %d beams, %d delays",
+		       n, m, data->num_controls);
+		return -1;
+	}
+	data->bf = beamform_new(n, m);
+	return data->bf ? 0 : -1;
+}
+
+static void beamform_connect_port(struct dsp_module *module,
+				  unsigned long port, float *data_location)
+{
+	struct beamform_data *data = (struct beamform_data *)module->data;
+	data->ports[port] = data_location;
+}
+
+static int beamform_get_delay_frames(struct dsp_module *module)
+{
+	struct beamform_data *data = (struct beamform_data *)module->data;
+	return beamform_get_delay(data->bf);
+}
+
+static void beamform_run(struct dsp_module *module, unsigned long sample_count)
+{
+	struct beamform_data *data = (struct beamform_data *)module->data;
+	int n = data->num_inputs, m = data->num_beams;
+	int i;
+
+	if (update_controls(&data->ports[n + m], data->values,
+			    data->num_controls))
+		for (i = 0; i < data->num_controls; i++)
+			beamform_set_delay(data->bf, i / n, i % n,
+					   (int)(data->values[i] + 0.5f));
+	beamform_process(data->bf, &data->ports[0], &data->ports[n],
+			 (int)sample_count);
+}
+
+static void beamform_deinstantiate(struct dsp_module *module)
+{
+	struct beamform_data *data = (struct beamform_data *)module->data;
+	if (data->bf)
+		beamform_free(data->bf);
+	data->bf = NULL;
+}
+
+static void beamform_free_module(struct dsp_module *module)
+{
+	free(module->data);
+	free(module);
+}
+
+/* The beams are summed up from every input, so none can be written in the
+ * buffer of an input. */
+static int beamform_get_properties(struct dsp_module *module)
+{
+	return MODULE_INPLACE_BROKEN;
+}
+
+static void beamform_init_module(struct dsp_module *module,
+				 struct plugin *plugin)
+{
+	struct beamform_data *data = calloc(1, sizeof(struct beamform_data));
+	struct port *port;
+	int i;
+
+	ARRAY_ELEMENT_FOREACH (&plugin->ports, i, port) {
+		if (port->type == PORT_CONTROL)
+			data->num_controls++;
+		else if (port->direction == PORT_INPUT)
+			data->num_inputs++;
+		else
+			data->num_beams++;
+	}
+	module->data = data;
+	module->instantiate = &beamform_instantiate;
+	module->connect_port = &beamform_connect_port;
+	module->get_delay = &beamform_get_delay_frames;
+	module->run = &beamform_run;
+	module->deinstantiate = &beamform_deinstantiate;
+	module->free_module = &beamform_free_module;
+	module->get_properties = &beamform_get_properties;
+	module->dump = &empty_dump;
+}
+
 /*
  * sink module functions
  */
@@ -559,6 +922,9 @@ static void sink_connect_port(struct dsp_module *module, unsigned long port,
 {
 	struct sink_data *data = (struct sink_data *)module->data;
 	data->ports[port] = data_location;
+	/* The pipeline moves its buffers when it runs on another thread. */
+	if (data->ext_module)
+		data->ext_module->ports[port] = data_location;
 }
 
 static void sink_run(struct dsp_module *module, unsigned long sample_count)
@@ -596,6 +962,115 @@ void cras_dsp_module_set_sink_ext_module(struct dsp_module *module,
 		ext_module->ports[i] = data->ports[i];
 }
 
+/*
+ *  identity detection and merging of eq modules
+ */
+
+/* Returns 1 if the biquad set from the type, freq, Q and gain ports
+ * starting at p passes its input unchanged. */
+static int biquad_ports_identity(float **p)
+{
+	switch ((int)*p[0]) {
+	case BQ_NONE:
+		return 1;
+	case BQ_LOWSHELF:
+	case BQ_HIGHSHELF:
+	case BQ_PEAKING:
+		return *p[3] == 0;
+	default:
+		return 0;
+	}
+}
+
+/* Counts the biquads per channel of an eq or eq2 and the ones merged into
+ * it. Returns -1 if any of them is not an identity when identity is set. */
+static int eq_count_biquads(struct eq_data *data, int identity)
+{
+	int i, n = 0;
+
+	for (; data; data = data->next)
+		for (i = 2; i < 2 + MAX_BIQUADS_PER_EQ * 4; i += 4, n++) {
+			if (!data->ports[i])
+				break;
+			if (identity && !biquad_ports_identity(&data->ports[i]))
+				return -1;
+		}
+	return n;
+}
+
+static int eq2_count_biquads(struct eq2_data *data, int identity)
+{
+	int i, n = 0;
+
+	for (; data; data = data->next)
+		for (i = 4; i < 4 + MAX_BIQUADS_PER_EQ2 * 8; i += 8, n++) {
+			if (!data->ports[i])
+				break;
+			if (identity &&
+			    (!biquad_ports_identity(&data->ports[i]) ||
+			     !biquad_ports_identity(&data->ports[i + 4])))
+				return -1;
+		}
+	return n;
+}
+
+int cras_dsp_module_is_identity(struct dsp_module *module)
+{
+	if (module->run == &eq_run)
+		return eq_count_biquads(module->data, 1) >= 0;
+	if (module->run == &eq2_run)
+		return eq2_count_biquads(module->data, 1) >= 0;
+	return 0;
+}
+
+int cras_dsp_module_merge(struct dsp_module *module, struct dsp_module *next)
+{
+	if (module == next)
+		return -EINVAL;
+
+	/* A dcblock takes the eq2 after it, which then filters each block
+	 * while it's still in cache. Later eq2s go into that one. */
+	if (module->run == &dcblock_run && next->run == &eq2_run) {
+		struct dcblock_data *data = (struct dcblock_data *)module->data;
+
+		if (data->eq2)
+			return cras_dsp_module_merge(data->eq2, next);
+		data->eq2 = next;
+		return 0;
+	}
+	if (module->run != next->run)
+		return -EINVAL;
+
+	if (module->run == &eq_run) {
+		struct eq_data *data = (struct eq_data *)module->data;
+		struct eq_data *next_data = (struct eq_data *)next->data;
+
+		if (data->eq || next_data->eq || next_data->next ||
+		    eq_count_biquads(data, 0) + eq_count_biquads(next_data, 0) >
+			    MAX_BIQUADS_PER_EQ)
+			return -EINVAL;
+		while (data->next)
+			data = data->next;
+		data->next = next_data;
+		return 0;
+	}
+	if (module->run == &eq2_run) {
+		struct eq2_data *data = (struct eq2_data *)module->data;
+		struct eq2_data *next_data = (struct eq2_data *)next->data;
+
+		if (data->eq2 || next_data->eq2 || next_data->next ||
+		    eq2_count_biquads(data, 0) +
+				    eq2_count_biquads(next_data, 0) >
+			    MAX_BIQUADS_PER_EQ2)
+			return -EINVAL;
+		while (data->next)
+			data = data->next;
+		data->next = next_data;
+		return 0;
+	}
+	return -EINVAL;
+}
+
 /*
  *  builtin module dispatcher
  */
@@ -618,7 +1093,11 @@ struct dsp_module *cras_dsp_module_load_builtin(struct plugin *plugin)
 	} else if (strcmp(plugin->label, "eq2") == 0) {
 		eq2_init_module(module);
 	} else if (strcmp(plugin->label, "drc") == 0) {
-		drc_init_module(module);
+		drc_init_module(module, plugin);
+	} else if (strcmp(plugin->label, "fir") == 0) {
+		fir_init_module(module, plugin);
+	} else if (strcmp(plugin->label, "beamform") == 0) {
+		beamform_init_module(module, plugin);
 	} else if (strcmp(plugin->label, "swap_lr") == 0) {
 		swap_lr_init_module(module);
 	} else if (strcmp(plugin->label, "sink") == 0) {
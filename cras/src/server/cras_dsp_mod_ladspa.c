@@ -17,6 +17,7 @@ struct ladspa_data {
 	const LADSPA_Descriptor *descriptor;
 	LADSPA_Handle *handle; /* returned by instantiate() */
 	int activated;
+	int block_size; /* from the plugin section of the ini */
 };
 
 static void activate(struct dsp_module *module)
@@ -109,6 +110,12 @@ static int get_properties(struct dsp_module *module)
 	return properties;
 }
 
+static int get_block_size(struct dsp_module *module)
+{
+	struct ladspa_data *data = module->data;
+	return data->block_size;
+}
+
 static void dump(struct dsp_module *module, struct dumper *d)
 {
 	struct ladspa_data *data = module->data;
@@ -194,6 +201,7 @@ struct dsp_module *cras_dsp_module_load_ladspa(struct plugin *plugin)
 			if (verify_plugin_descriptor(plugin, desc) != 0)
 				goto bail;
 			data->descriptor = desc;
+			data->block_size = plugin->block_size;
 			break;
 		}
 	}
@@ -206,6 +214,7 @@ struct dsp_module *cras_dsp_module_load_ladspa(struct plugin *plugin)
 	module->run = &run;
 	module->deinstantiate = &deinstantiate;
 	module->get_properties = &get_properties;
+	module->get_block_size = &get_block_size;
 	module->free_module = &free_module;
 	module->dump = &dump;
 	return module;
@@ -33,6 +33,7 @@ struct dsp_module {
 	 * Args:
 	 *    port - The index of the port.
 	 *    data_location - The memory address of the data for this port.
+	 *        Audio ports are given buffers aligned to 64 bytes.
 	 */
 	void (*connect_port)(struct dsp_module *mod, unsigned long port,
 			     float *data_location);
@@ -68,6 +69,12 @@ struct dsp_module {
 	 * below for details */
 	int (*get_properties)(struct dsp_module *mod);
 
+	/* Returns the number of samples run() must always be called with,
+	 * or 0 if any count up to DSP_BUFFER_SIZE will do. The pipeline
+	 * then buffers the audio to run in blocks of that size. Optional,
+	 * modules that leave it NULL take any count. */
+	int (*get_block_size)(struct dsp_module *mod);
+
 	/* Dumps the information about current state of this module */
 	void (*dump)(struct dsp_module *mod, struct dumper *d);
 };
@@ -108,6 +115,20 @@ enum { MODULE_INPLACE_BROKEN = 1 }; /* See ladspa.h for explanation */
 void cras_dsp_module_set_sink_ext_module(struct dsp_module *module,
 					 struct ext_dsp_module *ext_module);
 
+/* Returns 1 if the module, with the values now on its control ports, copies
+ * its input audio ports to its output audio ports unchanged, so it doesn't
+ * need to run. The ports must have been connected. */
+int cras_dsp_module_is_identity(struct dsp_module *module);
+
+/* Makes module also do the processing of next, a module of the same kind
+ * whose input audio ports are fed by the output audio ports of module only.
+ * After that next doesn't need to run. Both must have their ports connected
+ * and not have run yet.
+ * Returns:
+ *    0 if next was merged into module, negative error code otherwise.
+ */
+int cras_dsp_module_merge(struct dsp_module *module, struct dsp_module *next);
+
 struct dsp_module *cras_dsp_module_load_ladspa(struct plugin *plugin);
 struct dsp_module *cras_dsp_module_load_builtin(struct plugin *plugin);
 
@@ -0,0 +1,322 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#define _GNU_SOURCE /* For sem_clockwait */
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "cras_dsp.h"
+#include "cras_dsp_offload.h"
+#include "cras_dsp_pipeline.h"
+#include "cras_system_state.h"
+#include "cras_util.h"
+
+/* The longest the audio thread waits for the worker by default, in
+ * microseconds. */
+#define MAX_WAIT_US 1000
+/* Extra room in the ring, in blocks, so a worker that is a few periods late
+ * doesn't process frames the audio thread is already reusing. */
+#define SLACK_BLOCKS 4
+
+/*
+ * The ring holds frames at positions counted by free running 64 bit frame
+ * counters, so they never wrap, and a position p lives at p % capacity. The
+ * audio thread writes new frames at write and takes processed frames back
+ * from read, which is always latency_frames behind write when it returns.
+ * The worker processes the frames in [done, write) in place and moves done
+ * forward.
+ * Members:
+ *    ctx - The dsp context run by the worker.
+ *    format - The sample format.
+ *    frame_bytes - The size of a frame.
+ *    latency - The delay through the ring, in frames.
+ *    max_frames - The largest block handed over at once.
+ *    capacity - The size of the ring, in frames.
+ *    ring - The frames.
+ *    write - Where the audio thread writes next. Read by the worker.
+ *    read - Where the audio thread reads next. Read by the worker to skip
+ *        frames which were given up on.
+ *    done - The end of the frames processed by the worker.
+ *    error - The last error from cras_dsp_apply(), or 0.
+ *    late_frames - The number of frames replaced by silence.
+ *    running - Cleared to stop the worker.
+ *    wake - Posted when there are new frames for the worker.
+ *    processed - Posted when the worker has moved done.
+ *    tid - The worker thread.
+ */
+struct cras_dsp_offload {
+	struct cras_dsp_context *ctx;
+	snd_pcm_format_t format;
+	size_t frame_bytes;
+	unsigned int latency;
+	unsigned int max_frames;
+	unsigned int capacity;
+	uint8_t *ring;
+	uint64_t write;
+	uint64_t read;
+	uint64_t done;
+	int error;
+	unsigned int late_frames;
+	int running;
+	sem_t wake;
+	sem_t processed;
+	pthread_t tid;
+};
+
+static unsigned int max_wait_us = MAX_WAIT_US;
+
+static inline uint8_t *ring_at(const struct cras_dsp_offload *offload,
+			       uint64_t pos)
+{
+	return offload->ring + (size_t)(pos % offload->capacity) *
+				       offload->frame_bytes;
+}
+
+/* Copies frames between buf and the ring at pos, in whichever direction
+ * to_ring says, handling the wrap around. */
+static void ring_copy(struct cras_dsp_offload *offload, uint64_t pos,
+		      uint8_t *buf, unsigned int frames, int to_ring)
+{
+	unsigned int first;
+
+	while (frames) {
+		first = offload->capacity - pos % offload->capacity;
+		first = MIN(first, frames);
+		if (to_ring)
+			memcpy(ring_at(offload, pos), buf,
+			       first * offload->frame_bytes);
+		else
+			memcpy(buf, ring_at(offload, pos),
+			       first * offload->frame_bytes);
+		buf += first * offload->frame_bytes;
+		pos += first;
+		frames -= first;
+	}
+}
+
+/* Returns the number of frames from a to b on the free running counters. */
+static inline int64_t distance(uint64_t a, uint64_t b)
+{
+	return (int64_t)(b - a);
+}
+
+/* Processes the queued frames, one contiguous run of at most max_frames at
+ * a time, skipping the ones the audio thread gave up on. */
+static void process_queued(struct cras_dsp_offload *offload)
+{
+	uint64_t write, read, done;
+	unsigned int frames;
+	int rc;
+
+	write = __atomic_load_n(&offload->write, __ATOMIC_ACQUIRE);
+	done = offload->done;
+	while (done != write) {
+		read = __atomic_load_n(&offload->read, __ATOMIC_ACQUIRE);
+		if (distance(done, read) > 0)
+			done = read;
+		if (distance(done, write) <= 0)
+			break;
+		frames = MIN(distance(done, write), offload->max_frames);
+		frames = MIN(frames,
+			     offload->capacity - done % offload->capacity);
+		rc = cras_dsp_apply(offload->ctx, ring_at(offload, done),
+				    offload->format, frames);
+		if (rc)
+			__atomic_store_n(&offload->error, rc, __ATOMIC_RELAXED);
+		done += frames;
+		__atomic_store_n(&offload->done, done, __ATOMIC_RELEASE);
+		sem_post(&offload->processed);
+	}
+}
+
+static void *worker_thread(void *arg)
+{
+	struct cras_dsp_offload *offload = (struct cras_dsp_offload *)arg;
+	uint32_t cpu_mask;
+
+	/* Same priority as the audio thread, which waits on us. */
+	if (cras_set_rt_scheduling(cras_system_get_rt_priority()) == 0)
+		cras_set_thread_priority(cras_system_get_rt_priority());
+
+	/* Pinned with the audio thread when the board asks for it. */
+	cpu_mask = cras_system_get_audio_thread_cpu_mask();
+	if (cpu_mask)
+		cras_set_thread_affinity(cpu_mask);
+
+	while (1) {
+		sem_wait(&offload->wake);
+		if (!__atomic_load_n(&offload->running, __ATOMIC_ACQUIRE))
+			break;
+		process_queued(offload);
+	}
+	cras_dsp_pipeline_release_scratch();
+	return NULL;
+}
+
+/* Waits until the worker has processed up to end or the deadline passes.
+ * Returns where the processed frames end. */
+static uint64_t wait_processed(struct cras_dsp_offload *offload,
+			       uint64_t end)
+{
+	struct timespec deadline, max_wait;
+	uint64_t done;
+	int rc;
+
+	done = __atomic_load_n(&offload->done, __ATOMIC_ACQUIRE);
+	if (distance(done, end) <= 0)
+		return done;
+
+	max_wait.tv_sec = max_wait_us / 1000000;
+	max_wait.tv_nsec = (max_wait_us % 1000000) * 1000;
+#ifdef HAVE_SEM_CLOCKWAIT
+	/* Unlike the realtime clock, doesn't jump when the time is set. */
+	clock_gettime(CLOCK_MONOTONIC, &deadline);
+#else
+	clock_gettime(CLOCK_REALTIME, &deadline);
+#endif
+	add_timespecs(&deadline, &max_wait);
+	while (1) {
+#ifdef HAVE_SEM_CLOCKWAIT
+		rc = sem_clockwait(&offload->processed, CLOCK_MONOTONIC,
+				   &deadline);
+#else
+		rc = sem_timedwait(&offload->processed, &deadline);
+#endif
+		if (rc && errno == ETIMEDOUT)
+			break;
+		done = __atomic_load_n(&offload->done, __ATOMIC_ACQUIRE);
+		if (distance(done, end) <= 0)
+			break;
+	}
+	return __atomic_load_n(&offload->done, __ATOMIC_ACQUIRE);
+}
+
+/* Hands over one block of at most max_frames frames. */
+static void apply_block(struct cras_dsp_offload *offload, uint8_t *buf,
+			unsigned int frames)
+{
+	uint64_t read = offload->read;
+	uint64_t done;
+	int64_t ahead;
+	unsigned int ready;
+
+	ring_copy(offload, offload->write, buf, frames, 1);
+	__atomic_store_n(&offload->write, offload->write + frames,
+			 __ATOMIC_RELEASE);
+	sem_post(&offload->wake);
+
+	done = wait_processed(offload, read + frames);
+	ahead = distance(read, done);
+	ready = ahead > 0 ? MIN(ahead, (int64_t)frames) : 0;
+
+	ring_copy(offload, read, buf, ready, 0);
+	if (ready < frames) {
+		memset(buf + ready * offload->frame_bytes, 0,
+		       (frames - ready) * offload->frame_bytes);
+		offload->late_frames += frames - ready;
+	}
+	__atomic_store_n(&offload->read, read + frames, __ATOMIC_RELEASE);
+}
+
+struct cras_dsp_offload *
+cras_dsp_offload_create(struct cras_dsp_context *ctx,
+			const struct cras_audio_format *fmt,
+			unsigned int latency_frames, unsigned int max_frames)
+{
+	struct cras_dsp_offload *offload;
+	int rc;
+
+	if (!latency_frames || !max_frames)
+		return NULL;
+
+	offload = (struct cras_dsp_offload *)calloc(1, sizeof(*offload));
+	if (!offload)
+		return NULL;
+
+	offload->ctx = ctx;
+	offload->format = fmt->format;
+	offload->frame_bytes = cras_get_format_bytes(fmt);
+	offload->latency = latency_frames;
+	offload->max_frames = max_frames;
+	offload->capacity = latency_frames + SLACK_BLOCKS * max_frames;
+	offload->ring = (uint8_t *)calloc(offload->capacity,
+					  offload->frame_bytes);
+	if (!offload->ring) {
+		free(offload);
+		return NULL;
+	}
+
+	/* The first latency_frames frames out are the zeros the ring starts
+	 * with, which need no processing. */
+	offload->write = latency_frames;
+	offload->done = latency_frames;
+	offload->read = 0;
+	offload->running = 1;
+	sem_init(&offload->wake, 0, 0);
+	sem_init(&offload->processed, 0, 0);
+
+	rc = pthread_create(&offload->tid, NULL, worker_thread, offload);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to create dsp offload thread: %d", rc);
+		sem_destroy(&offload->wake);
+		sem_destroy(&offload->processed);
+		free(offload->ring);
+		free(offload);
+		return NULL;
+	}
+	return offload;
+}
+
+void cras_dsp_offload_destroy(struct cras_dsp_offload *offload)
+{
+	if (!offload)
+		return;
+
+	__atomic_store_n(&offload->running, 0, __ATOMIC_RELEASE);
+	sem_post(&offload->wake);
+	pthread_join(offload->tid, NULL);
+
+	sem_destroy(&offload->wake);
+	sem_destroy(&offload->processed);
+	free(offload->ring);
+	free(offload);
+}
+
+int cras_dsp_offload_apply(struct cras_dsp_offload *offload, uint8_t *buf,
+			   unsigned int frames)
+{
+	unsigned int chunk;
+
+	while (frames) {
+		chunk = MIN(frames, offload->max_frames);
+		apply_block(offload, buf, chunk);
+		buf += chunk * offload->frame_bytes;
+		frames -= chunk;
+	}
+	return __atomic_exchange_n(&offload->error, 0, __ATOMIC_RELAXED);
+}
+
+void cras_dsp_offload_set_max_wait_us(unsigned int us)
+{
+	max_wait_us = us;
+}
+
+unsigned int
+cras_dsp_offload_get_latency(const struct cras_dsp_offload *offload)
+{
+	return offload->latency;
+}
+
+unsigned int
+cras_dsp_offload_get_late_frames(const struct cras_dsp_offload *offload)
+{
+	return offload->late_frames;
+}
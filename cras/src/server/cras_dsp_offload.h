@@ -0,0 +1,79 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_DSP_OFFLOAD_H_
+#define CRAS_DSP_OFFLOAD_H_
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+
+#include "cras_audio_format.h"
+
+struct cras_dsp_context;
+
+/*
+ * Runs the DSP pipeline of an output device on a worker thread, so a heavy
+ * pipeline doesn't eat into the audio thread's budget. The audio thread hands
+ * each block of frames to the worker through a ring and takes back the frames
+ * the worker processed one period earlier. The output is therefore delayed by
+ * a fixed number of frames, which stays the same whatever the block sizes.
+ * If the worker falls behind the audio thread waits a bounded time for it,
+ * then plays silence for the missing frames instead of missing its deadline.
+ */
+struct cras_dsp_offload;
+
+/* Creates a DSP offload and starts its worker thread.
+ * Args:
+ *    ctx - The dsp context whose pipeline is run. Only the worker thread
+ *        calls cras_dsp_apply() on it while the offload exists.
+ *    fmt - The format of the samples handed to cras_dsp_offload_apply().
+ *    latency_frames - The delay added to the output, in frames.
+ *    max_frames - The largest block cras_dsp_offload_apply() processes at
+ *        once, larger ones are split.
+ * Returns:
+ *    The offload, or NULL if the sizes are zero or on failure.
+ */
+struct cras_dsp_offload *
+cras_dsp_offload_create(struct cras_dsp_context *ctx,
+			const struct cras_audio_format *fmt,
+			unsigned int latency_frames, unsigned int max_frames);
+
+/* Stops the worker thread and frees the offload. */
+void cras_dsp_offload_destroy(struct cras_dsp_offload *offload);
+
+/* Queues frames of interleaved samples for the worker and replaces them in
+ * place with the processed frames from latency_frames earlier. Must be
+ * called from the audio thread.
+ * Returns:
+ *    0 on success, or the negative error of the last failed
+ *    cras_dsp_apply() call on the worker.
+ */
+int cras_dsp_offload_apply(struct cras_dsp_offload *offload, uint8_t *buf,
+			   unsigned int frames);
+
+/* Sets how long cras_dsp_offload_apply() waits for the worker before
+ * playing silence, for the offloads of all devices. The default is 1ms.
+ * Args:
+ *    us - The longest wait, in microseconds.
+ */
+void cras_dsp_offload_set_max_wait_us(unsigned int us);
+
+/* Returns the delay the offload adds to the output, in frames. */
+unsigned int
+cras_dsp_offload_get_latency(const struct cras_dsp_offload *offload);
+
+/* Returns the number of frames played as silence because the worker
+ * hadn't processed them in time. */
+unsigned int
+cras_dsp_offload_get_late_frames(const struct cras_dsp_offload *offload);
+
+#ifdef __cplusplus
+} /* extern "C" */
+#endif
+
+#endif /* CRAS_DSP_OFFLOAD_H_ */
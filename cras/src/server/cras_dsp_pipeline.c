@@ -3,10 +3,16 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <inttypes.h>
+#include <stdlib.h>
+#include <string.h>
 #include <sys/param.h>
 #include <syslog.h>
 
+#include "cras_latency_hist.h"
+#include "cras_mem_stats.h"
+#include "cras_rt_mem.h"
 #include "cras_util.h"
 #include "cras_dsp_module.h"
 #include "cras_dsp_pipeline.h"
@@ -86,16 +92,53 @@ struct instance {
 	/* Whether this module's instantiate() function has been called */
 	int instantiated;
 
+	/* The instance of another pipeline whose instantiated module this one
+	 * takes over, see cras_dsp_pipeline_reuse_modules(). */
+	struct instance *reuse;
+
 	/* This caches the value returned from get_properties() of a module */
 	int properties;
 
 	/* This is the total buffering delay from source to this instance. It is
 	 * in number of frames. */
 	int total_delay;
+
+	/* Set if the module doesn't need to run, because it passes the audio
+	 * unchanged with the current control values, or because it was merged
+	 * into merged_into. Its inputs are copied to its outputs instead. */
+	int bypass;
+	struct instance *merged_into;
+
+	/* The CPU time spent in run() of the module, in nanoseconds, and the
+	 * number of blocks and sample frames it processed. */
+	int64_t total_time;
+	int64_t total_blocks;
+	int64_t total_samples;
+
+	/* The min time per frame of a block, in picoseconds. The histogram
+	 * of the time per frame, also in picoseconds, holds the max. */
+	uint32_t min_frame_time;
+	struct cras_latency_hist frame_time_hist;
 };
 
 DECLARE_ARRAY_TYPE(struct instance, instance_array)
 
+/* Alignment of the scratch, the buffers in it stay aligned as they are a
+ * multiple of this long. */
+#define DSP_SCRATCH_ALIGN 64
+
+/* The audio buffers of the pipelines running on a thread. Pipelines on a
+ * thread run one after the other, so they share one set of buffers sized
+ * for the largest. Only the modules keep state from one run to the next.
+ * gen changes each time the buffers move, pipelines bound to an older gen
+ * connect their ports again. */
+static __thread struct {
+	float *bufs;
+	int num_bufs;
+	unsigned int gen;
+} scratch;
+static unsigned int scratch_gen;
+
 /* An pipeline is a dynamic representation of a dsp ini file. */
 struct pipeline {
 	/* The purpose of the pipeline. "playback" or "capture" */
@@ -113,9 +156,15 @@ struct pipeline {
 	 * the same time for this pipeline */
 	int peak_buf;
 
-	/* The audio data buffers */
+	/* The audio data buffers, peak_buf consecutive buffers of the scratch
+	 * of the thread the pipeline last ran on. */
 	float **buffers;
 
+	/* The scratch generation and the first scratch buffer the audio ports
+	 * are connected to, bound_gen is 0 while they aren't connected. */
+	unsigned int bound_gen;
+	int bound_offset;
+
 	/* The instance where the audio data flow in */
 	struct instance *source_instance;
 
@@ -126,10 +175,27 @@ struct pipeline {
 	int input_channels;
 	int output_channels;
 
+	/* The external module set on the sink instance, if any. */
+	struct ext_dsp_module *sink_ext_module;
+
+	/* The number of frames every run takes, when a module needs a fixed
+	 * count, otherwise 0. The input is then gathered block_fill frames
+	 * into block_in while the output of the previous block is played from
+	 * block_out, one plane of block_stride floats per channel. */
+	int block_size;
+	int block_stride;
+	int block_fill;
+	float *block_in;
+	float *block_out;
+
 	/* The audio sampling rate for this pipleine. It is zero if
 	 * cras_dsp_pipeline_instantiate() has not been called. */
 	int sample_rate;
 
+	/* The number of instances waiting for cras_dsp_pipeline_take_modules()
+	 * to take over the module of an instance of another pipeline. */
+	int num_reused;
+
 	/* The total time it takes to run the pipeline, in nanoseconds. */
 	int64_t total_time;
 
@@ -266,12 +332,20 @@ static struct control_port *find_output_control_port(instance_array *instances,
 	return NULL;
 }
 
+/* A plugin is left out if its disable expression is true, or if it runs on
+ * the firmware of the device instead. */
 static char is_disabled(struct plugin *plugin, struct cras_expr_env *env)
 {
 	char disabled;
-	return (plugin->disable_expr &&
-		cras_expr_expression_eval_boolean(plugin->disable_expr, env,
-						  &disabled) == 0 &&
+
+	if (plugin->firmware_var &&
+	    cras_expr_env_get_variable_boolean(env, plugin->firmware_var,
+					       &disabled) == 0 &&
+	    disabled == 1)
+		return 1;
+	return (plugin->disable_prog &&
+		cras_expr_program_eval_boolean(plugin->disable_prog, env,
+					       &disabled) == 0 &&
 		disabled == 1);
 }
 
@@ -546,16 +620,6 @@ static int allocate_buffers(struct pipeline *pipeline)
 		return -1;
 	}
 
-	for (i = 0; i < peak_buf; i++) {
-		size_t size = DSP_BUFFER_SIZE * sizeof(float);
-		float *buf = calloc(1, size);
-		if (!buf) {
-			syslog(LOG_ERR, "failed to allocate buf");
-			return -1;
-		}
-		pipeline->buffers[i] = buf;
-	}
-
 	/* Now assign buffer index for each instance's input/output ports */
 	busy = calloc(peak_buf, sizeof(*busy));
 	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
@@ -607,6 +671,54 @@ static int allocate_buffers(struct pipeline *pipeline)
 	return 0;
 }
 
+/* Picks the block size of the modules that need one, they must all agree
+ * on it, and sets aside the planes the pipeline gathers the blocks in. */
+static int negotiate_block_size(struct pipeline *pipeline)
+{
+	struct instance *instance;
+	struct dsp_module *module;
+	size_t bytes;
+	void *planes;
+	int i, size, align;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		module = instance->reuse ? instance->reuse->module :
+					   instance->module;
+		size = module->get_block_size ? module->get_block_size(module) :
+						0;
+		if (!size)
+			continue;
+		if (size > DSP_BUFFER_SIZE ||
+		    (pipeline->block_size && size != pipeline->block_size)) {
+			syslog(LOG_ERR, "%s needs blocks of %d, not %d",
+			       instance->plugin->title, size,
+			       pipeline->block_size);
+			return -1;
+		}
+		pipeline->block_size = size;
+	}
+	if (!pipeline->block_size)
+		return 0;
+
+	/* Keeps each plane aligned like the buffers the modules are given. */
+	align = DSP_SCRATCH_ALIGN / sizeof(float);
+	pipeline->block_stride = (pipeline->block_size + align - 1) / align *
+				 align;
+	bytes = (size_t)(pipeline->input_channels +
+			 pipeline->output_channels) *
+		pipeline->block_stride * sizeof(float);
+	if (posix_memalign(&planes, DSP_SCRATCH_ALIGN, bytes))
+		return -1;
+	memset(planes, 0, bytes);
+	pipeline->block_in = (float *)planes;
+	pipeline->block_out = pipeline->block_in +
+			      (size_t)pipeline->block_stride *
+				      pipeline->input_channels;
+	cras_mem_stats_add(CRAS_MEM_DSP, bytes);
+	cras_rt_mem_add(planes, bytes);
+	return 0;
+}
+
 int cras_dsp_pipeline_load(struct pipeline *pipeline)
 {
 	int i;
@@ -614,6 +726,8 @@ int cras_dsp_pipeline_load(struct pipeline *pipeline)
 
 	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
 		struct plugin *plugin = instance->plugin;
+		if (instance->reuse)
+			continue;
 		if (load_module(plugin, instance) != 0)
 			return -1;
 	}
@@ -621,7 +735,7 @@ int cras_dsp_pipeline_load(struct pipeline *pipeline)
 	if (allocate_buffers(pipeline) != 0)
 		return -1;
 
-	return 0;
+	return negotiate_block_size(pipeline);
 }
 
 /* Calculates the total buffering delay of each instance from the source */
@@ -649,49 +763,95 @@ static void calculate_audio_delay(struct pipeline *pipeline)
 	}
 }
 
-int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
+/* Returns the instance feeding all the input audio ports of instance, if its
+ * output audio ports go to instance only and in the same order. */
+static struct instance *sole_upstream(struct pipeline *pipeline,
+				      struct instance *instance)
+{
+	audio_port_array *audio_in = &instance->input_audio_ports;
+	struct instance *upstream, *other;
+	struct audio_port *audio_port;
+	int i, j;
+
+	if (ARRAY_COUNT(audio_in) == 0)
+		return NULL;
+	upstream = find_instance_by_plugin(&pipeline->instances,
+					   ARRAY_ELEMENT(audio_in, 0)->peer->plugin);
+	if (!upstream ||
+	    ARRAY_COUNT(&upstream->output_audio_ports) != ARRAY_COUNT(audio_in))
+		return NULL;
+	ARRAY_ELEMENT_FOREACH (audio_in, i, audio_port) {
+		if (audio_port->peer !=
+		    ARRAY_ELEMENT(&upstream->output_audio_ports, i))
+			return NULL;
+	}
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, other) {
+		if (other == instance)
+			continue;
+		ARRAY_ELEMENT_FOREACH (&other->input_audio_ports, j,
+				       audio_port) {
+			if (audio_port->peer->plugin == upstream->plugin)
+				return NULL;
+		}
+	}
+	return upstream;
+}
+
+/* Finds the instances which don't need to run: the ones that pass the audio
+ * unchanged with the values on their control ports, and the ones that can be
+ * merged into the instance upstream, like consecutive eq2 stages which become
+ * one biquad cascade. */
+static void find_bypassed_instances(struct pipeline *pipeline)
 {
 	int i;
-	struct instance *instance;
+	struct instance *instance, *upstream, *head;
 
 	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
-		struct dsp_module *module = instance->module;
-		if (module->instantiate(module, sample_rate) != 0)
-			return -1;
-		instance->instantiated = 1;
-		syslog(LOG_DEBUG, "instantiate %s", instance->plugin->label);
+		instance->bypass = 0;
+		instance->merged_into = NULL;
+
+		if (instance == pipeline->source_instance ||
+		    instance == pipeline->sink_instance ||
+		    ARRAY_COUNT(&instance->input_audio_ports) == 0 ||
+		    ARRAY_COUNT(&instance->input_audio_ports) !=
+			    ARRAY_COUNT(&instance->output_audio_ports))
+			continue;
+
+		if (cras_dsp_module_is_identity(instance->module)) {
+			instance->bypass = 1;
+			syslog(LOG_DEBUG, "bypass %s", instance->plugin->title);
+			continue;
+		}
+
+		upstream = sole_upstream(pipeline, instance);
+		if (!upstream || (upstream->bypass && !upstream->merged_into))
+			continue;
+		head = upstream->merged_into ? upstream->merged_into : upstream;
+		if (cras_dsp_module_merge(head->module, instance->module))
+			continue;
+		instance->bypass = 1;
+		instance->merged_into = head;
+		syslog(LOG_DEBUG, "merge %s into %s", instance->plugin->title,
+		       head->plugin->title);
 	}
-	pipeline->sample_rate = sample_rate;
+}
+
+/* Connects the control ports of the modules, and finds out what they do
+ * with the values on them. */
+static void connect_control_ports(struct pipeline *pipeline)
+{
+	int i;
+	struct instance *instance;
 
 	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
-		audio_port_array *audio_in = &instance->input_audio_ports;
-		audio_port_array *audio_out = &instance->output_audio_ports;
 		control_port_array *control_in = &instance->input_control_ports;
 		control_port_array *control_out =
 			&instance->output_control_ports;
 		int j;
-		struct audio_port *audio_port;
 		struct control_port *control_port;
 		struct dsp_module *module = instance->module;
 
-		/* connect audio ports */
-		ARRAY_ELEMENT_FOREACH (audio_in, j, audio_port) {
-			float *buf = pipeline->buffers[audio_port->buf_index];
-			module->connect_port(module, audio_port->original_index,
-					     buf);
-			syslog(LOG_DEBUG, "connect audio buf %d to %s:%d (in)",
-			       audio_port->buf_index, instance->plugin->title,
-			       audio_port->original_index);
-		}
-		ARRAY_ELEMENT_FOREACH (audio_out, j, audio_port) {
-			float *buf = pipeline->buffers[audio_port->buf_index];
-			module->connect_port(module, audio_port->original_index,
-					     buf);
-			syslog(LOG_DEBUG, "connect audio buf %d to %s:%d (out)",
-			       audio_port->buf_index, instance->plugin->title,
-			       audio_port->original_index);
-		}
-
 		/* connect control ports */
 		ARRAY_ELEMENT_FOREACH (control_in, j, control_port) {
 			/* Note for input control ports which has a
@@ -719,10 +879,232 @@ int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
 		}
 	}
 
+	find_bypassed_instances(pipeline);
 	calculate_audio_delay(pipeline);
+}
+
+int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate)
+{
+	int i;
+	struct instance *instance;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		struct dsp_module *module = instance->module;
+		if (instance->reuse)
+			continue;
+		if (module->instantiate(module, sample_rate) != 0)
+			return -1;
+		instance->instantiated = 1;
+		syslog(LOG_DEBUG, "instantiate %s", instance->plugin->label);
+	}
+	pipeline->sample_rate = sample_rate;
+
+	/* The audio ports are connected when the pipeline first runs. */
+	pipeline->bound_gen = 0;
+
+	/* Modules still to be taken over get connected when they are. */
+	if (!pipeline->num_reused)
+		connect_control_ports(pipeline);
+	return 0;
+}
+
+static int str_equal(const char *a, const char *b)
+{
+	if (!a || !b)
+		return a == b;
+	return strcmp(a, b) == 0;
+}
+
+/* Returns true if the plugins are the same section with the same
+ * parameters, possibly from different inis. Which ports flows connect may
+ * differ, the ports are connected anew. */
+static int plugin_config_equal(const struct plugin *a, const struct plugin *b)
+{
+	const struct port *pa, *pb;
+	int i;
+
+	if (a == b)
+		return 1;
+	if (!str_equal(a->title, b->title) ||
+	    !str_equal(a->library, b->library) ||
+	    !str_equal(a->label, b->label) ||
+	    !str_equal(a->impulse_response, b->impulse_response) ||
+	    a->block_size != b->block_size ||
+	    ARRAY_COUNT(&a->ports) != ARRAY_COUNT(&b->ports))
+		return 0;
+	ARRAY_ELEMENT_FOREACH (&a->ports, i, pa) {
+		pb = ARRAY_ELEMENT(&b->ports, i);
+		if (pa->direction != pb->direction || pa->type != pb->type ||
+		    (pa->flow_id == INVALID_FLOW_ID) !=
+			    (pb->flow_id == INVALID_FLOW_ID))
+			return 0;
+		if (pa->type == PORT_CONTROL &&
+		    pa->flow_id == INVALID_FLOW_ID &&
+		    pa->init_value != pb->init_value)
+			return 0;
+	}
+	return 1;
+}
+
+/* Returns true if instance was merged into another or had one merged into it,
+ * then its module holds state of the other. */
+static int is_merged(struct pipeline *pipeline, struct instance *instance)
+{
+	int i;
+	struct instance *other;
+
+	if (instance->merged_into)
+		return 1;
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, other) {
+		if (other->merged_into == instance)
+			return 1;
+	}
+	return 0;
+}
+
+int cras_dsp_pipeline_reuse_modules(struct pipeline *pipeline,
+				    struct pipeline *from, int sample_rate)
+{
+	int i, j;
+	struct instance *instance, *old;
+
+	if (!from || from->sample_rate != sample_rate)
+		return 0;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		/* The sink may hold an external module, and neither the
+		 * source nor the sink keeps any state. */
+		if (instance == pipeline->source_instance ||
+		    instance == pipeline->sink_instance)
+			continue;
+		ARRAY_ELEMENT_FOREACH (&from->instances, j, old) {
+			if (old == from->source_instance ||
+			    old == from->sink_instance || !old->instantiated ||
+			    is_merged(from, old) ||
+			    !plugin_config_equal(instance->plugin, old->plugin))
+				continue;
+			instance->reuse = old;
+			instance->properties = old->properties;
+			pipeline->num_reused++;
+			syslog(LOG_DEBUG, "reuse %s", instance->plugin->title);
+			break;
+		}
+	}
+	return pipeline->num_reused;
+}
+
+void cras_dsp_pipeline_take_modules(struct pipeline *pipeline)
+{
+	int i;
+	struct instance *instance, *old;
+
+	if (!pipeline->num_reused)
+		return;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		old = instance->reuse;
+		if (!old)
+			continue;
+		instance->module = old->module;
+		instance->instantiated = 1;
+		instance->reuse = NULL;
+		old->module = NULL;
+		old->instantiated = 0;
+	}
+	pipeline->num_reused = 0;
+	connect_control_ports(pipeline);
+}
+
+/* Connects the audio ports of the instantiated modules to the buffers. */
+static void connect_audio_ports(struct pipeline *pipeline)
+{
+	int i, j;
+	struct instance *instance;
+	struct audio_port *audio_port;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		struct dsp_module *module = instance->module;
+
+		if (!instance->instantiated)
+			continue;
+		ARRAY_ELEMENT_FOREACH (&instance->input_audio_ports, j,
+				       audio_port) {
+			module->connect_port(
+				module, audio_port->original_index,
+				pipeline->buffers[audio_port->buf_index]);
+		}
+		ARRAY_ELEMENT_FOREACH (&instance->output_audio_ports, j,
+				       audio_port) {
+			module->connect_port(
+				module, audio_port->original_index,
+				pipeline->buffers[audio_port->buf_index]);
+		}
+	}
+}
+
+/* Grows the scratch of this thread to num_bufs buffers. The content isn't
+ * kept, pipelines only hold audio in their buffers within one run. */
+static int reserve_scratch(int num_bufs)
+{
+	size_t bytes = (size_t)num_bufs * DSP_BUFFER_SIZE * sizeof(float);
+	void *bufs;
+
+	if (num_bufs <= scratch.num_bufs)
+		return 0;
+	if (posix_memalign(&bufs, DSP_SCRATCH_ALIGN, bytes))
+		return -ENOMEM;
+	memset(bufs, 0, bytes);
+	cras_dsp_pipeline_release_scratch();
+	scratch.bufs = (float *)bufs;
+	scratch.num_bufs = num_bufs;
+	scratch.gen = __atomic_add_fetch(&scratch_gen, 1, __ATOMIC_RELAXED);
+	cras_mem_stats_add(CRAS_MEM_DSP, bytes);
+	cras_rt_mem_add(bufs, bytes);
+	return 0;
+}
+
+/* Points the audio ports of pipeline to the scratch buffers of this thread
+ * from offset on, unless they already are. */
+static int bind_buffers(struct pipeline *pipeline, int offset)
+{
+	int i;
+
+	if (pipeline->bound_gen && pipeline->bound_gen == scratch.gen &&
+	    pipeline->bound_offset == offset)
+		return 0;
+	if (reserve_scratch(offset + pipeline->peak_buf))
+		return -ENOMEM;
+	for (i = 0; i < pipeline->peak_buf; i++)
+		pipeline->buffers[i] =
+			scratch.bufs + (size_t)(offset + i) * DSP_BUFFER_SIZE;
+	connect_audio_ports(pipeline);
+	pipeline->bound_gen = scratch.gen;
+	pipeline->bound_offset = offset;
 	return 0;
 }
 
+/* Binds pipeline if it isn't bound to the scratch of this thread. */
+static int ensure_bound(struct pipeline *pipeline)
+{
+	if (pipeline->bound_gen && pipeline->bound_gen == scratch.gen)
+		return 0;
+	return bind_buffers(pipeline, 0);
+}
+
+void cras_dsp_pipeline_release_scratch()
+{
+	if (!scratch.bufs)
+		return;
+	cras_mem_stats_sub(CRAS_MEM_DSP, (size_t)scratch.num_bufs *
+						 DSP_BUFFER_SIZE *
+						 sizeof(float));
+	cras_rt_mem_remove(scratch.bufs);
+	free(scratch.bufs);
+	scratch.bufs = NULL;
+	scratch.num_bufs = 0;
+	scratch.gen = 0;
+}
+
 void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline)
 {
 	int i;
@@ -740,7 +1122,13 @@ void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline)
 
 int cras_dsp_pipeline_get_delay(struct pipeline *pipeline)
 {
-	return pipeline->sink_instance->total_delay;
+	/* The output of a block comes out while the next is gathered. */
+	return pipeline->sink_instance->total_delay + pipeline->block_size;
+}
+
+int cras_dsp_pipeline_get_block_size(struct pipeline *pipeline)
+{
+	return pipeline->block_size;
 }
 
 int cras_dsp_pipeline_get_sample_rate(struct pipeline *pipeline)
@@ -769,6 +1157,8 @@ static float *find_buffer(struct pipeline *pipeline,
 	int i;
 	struct audio_port *audio_port;
 
+	if (ensure_bound(pipeline))
+		return NULL;
 	ARRAY_ELEMENT_FOREACH (audio_ports, i, audio_port) {
 		if (audio_port->original_index == index)
 			return pipeline->buffers[audio_port->buf_index];
@@ -794,6 +1184,13 @@ void cras_dsp_pipeline_set_sink_ext_module(struct pipeline *pipeline,
 {
 	cras_dsp_module_set_sink_ext_module(pipeline->sink_instance->module,
 					    ext_module);
+	pipeline->sink_ext_module = ext_module;
+}
+
+char cras_dsp_pipeline_plugin_disabled(struct plugin *plugin,
+				       struct cras_expr_env *env)
+{
+	return is_disabled(plugin, env);
 }
 
 struct ini *cras_dsp_pipeline_get_ini(struct pipeline *pipeline)
@@ -801,14 +1198,96 @@ struct ini *cras_dsp_pipeline_get_ini(struct pipeline *pipeline)
 	return pipeline->ini;
 }
 
+int cras_dsp_pipeline_has_plugin(struct pipeline *pipeline,
+				 const struct plugin *plugin)
+{
+	return find_instance_by_plugin(&pipeline->instances, plugin) != NULL;
+}
+
+int cras_dsp_pipeline_set_control(struct pipeline *pipeline, const char *title,
+				  int port, float value)
+{
+	int i, j;
+	struct instance *instance;
+	struct control_port *control_port;
+
+	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
+		if (strcasecmp(instance->plugin->title, title))
+			continue;
+		ARRAY_ELEMENT_FOREACH (&instance->input_control_ports, j,
+				       control_port) {
+			if (control_port->original_index != port ||
+			    control_port->peer)
+				continue;
+			__atomic_store(&control_port->value, &value,
+				       __ATOMIC_RELEASE);
+			/* A module bypassed because it did nothing may be
+			 * needed again. One merged upstream picks the new
+			 * value up from its port. */
+			if (instance->bypass && !instance->merged_into &&
+			    !cras_dsp_module_is_identity(instance->module))
+				__atomic_store_n(&instance->bypass, 0,
+						 __ATOMIC_RELEASE);
+			return 0;
+		}
+	}
+	return -ENOENT;
+}
+
+/* Copies the input audio of a bypassed instance to its outputs, unless they
+ * share buffers. */
+static void copy_through(struct pipeline *pipeline, struct instance *instance,
+			 int sample_count)
+{
+	int i;
+	struct audio_port *in, *out;
+	float *src, *dst;
+
+	ARRAY_ELEMENT_FOREACH (&instance->input_audio_ports, i, in) {
+		out = ARRAY_ELEMENT(&instance->output_audio_ports, i);
+		src = pipeline->buffers[in->buf_index];
+		dst = pipeline->buffers[out->buf_index];
+		if (src != dst)
+			memcpy(dst, src, sample_count * sizeof(float));
+	}
+}
+
 void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count)
 {
 	int i;
 	struct instance *instance;
+	struct timespec begin, end;
+	int64_t t;
+	uint32_t frame_time;
+
+	if (sample_count <= 0)
+		return;
+	if (ensure_bound(pipeline))
+		return;
 
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
 	ARRAY_ELEMENT_FOREACH (&pipeline->instances, i, instance) {
 		struct dsp_module *module = instance->module;
-		module->run(module, sample_count);
+
+		if (__atomic_load_n(&instance->bypass, __ATOMIC_ACQUIRE))
+			copy_through(pipeline, instance, sample_count);
+		else
+			module->run(module, sample_count);
+
+		clock_gettime(CLOCK_THREAD_CPUTIME_ID, &end);
+		t = (end.tv_sec - begin.tv_sec) * 1000000000LL + end.tv_nsec -
+		    begin.tv_nsec;
+		begin = end;
+
+		frame_time = MIN(t * 1000 / sample_count, (int64_t)UINT32_MAX);
+		if (instance->total_blocks == 0 ||
+		    frame_time < instance->min_frame_time)
+			instance->min_frame_time = frame_time;
+		cras_latency_hist_add_usec(&instance->frame_time_hist,
+					   frame_time);
+		instance->total_blocks++;
+		instance->total_samples += sample_count;
+		instance->total_time += t;
 	}
 }
 
@@ -835,45 +1314,192 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 	pipeline->total_time += t;
 }
 
-int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
-			    snd_pcm_format_t format, unsigned int frames)
+/* Fills the source buffers of the pipeline with chunk frames, taken from
+ * planes at offset done if given, otherwise deinterleaved from buf. */
+static int fill_source(struct pipeline *pipeline, float **source,
+		       float *const *planes, size_t done, uint8_t *buf,
+		       snd_pcm_format_t format, size_t chunk)
+{
+	int i;
+
+	if (!planes)
+		return dsp_util_deinterleave(buf, source,
+					     pipeline->input_channels, format,
+					     chunk);
+	for (i = 0; i < pipeline->input_channels; i++)
+		memcpy(source[i], planes[i] + done, chunk * sizeof(float));
+	return 0;
+}
+
+/* Returns non-zero if the output of from can be faded into the output of
+ * pipeline. Running an external module twice per block would feed it the
+ * same samples twice, so a pipeline with one attached is never faded. */
+static int can_crossfade(const struct pipeline *pipeline,
+			 const struct pipeline *from)
+{
+	return from && from != pipeline &&
+	       from->input_channels == pipeline->input_channels &&
+	       from->output_channels == pipeline->output_channels &&
+	       !from->sink_ext_module && !pipeline->sink_ext_module &&
+	       !from->block_size && !pipeline->block_size;
+}
+
+/* Runs pipeline, whose modules take blocks of block_size frames, over
+ * frames frames read from planes or buf. The input is gathered until a
+ * block is whole, the output played meanwhile is that of the block before.
+ */
+static int process_blocks(struct pipeline *pipeline, float *const *source,
+			  float *const *sink, float *const *planes,
+			  uint8_t *buf, snd_pcm_format_t format,
+			  unsigned int frames)
+{
+	int input_channels = pipeline->input_channels;
+	int output_channels = pipeline->output_channels;
+	size_t stride = pipeline->block_stride;
+	size_t bytes = pipeline->block_size * sizeof(float);
+	float *block_in[input_channels];
+	float *block_out[output_channels];
+	size_t left, done, chunk;
+	int i, rc;
+
+	for (done = 0; done < frames; done += chunk) {
+		left = pipeline->block_size - pipeline->block_fill;
+		chunk = MIN(frames - done, left);
+		for (i = 0; i < input_channels; i++)
+			block_in[i] = pipeline->block_in + i * stride +
+				      pipeline->block_fill;
+		for (i = 0; i < output_channels; i++)
+			block_out[i] = pipeline->block_out + i * stride +
+				       pipeline->block_fill;
+
+		rc = fill_source(pipeline, block_in, planes, done, buf, format,
+				 chunk);
+		if (rc)
+			return rc;
+		rc = dsp_util_interleave(block_out, buf, output_channels,
+					 format, chunk);
+		if (rc)
+			return rc;
+		buf += chunk * output_channels * PCM_FORMAT_WIDTH(format) / 8;
+
+		pipeline->block_fill += chunk;
+		if (pipeline->block_fill < pipeline->block_size)
+			continue;
+		pipeline->block_fill = 0;
+		for (i = 0; i < input_channels; i++)
+			memcpy(source[i], pipeline->block_in + i * stride,
+			       bytes);
+		cras_dsp_pipeline_run(pipeline, pipeline->block_size);
+		for (i = 0; i < output_channels; i++)
+			memcpy(pipeline->block_out + i * stride, sink[i],
+			       bytes);
+	}
+	return 0;
+}
+
+/* Runs pipeline over frames frames read from planes, or in place from buf
+ * when planes is NULL. While *fade_pos is below fade_frames the output of
+ * from is mixed in with a gain ramping down to zero. */
+static int process(struct pipeline *pipeline, struct pipeline *from,
+		   float *const *planes, uint8_t *buf, snd_pcm_format_t format,
+		   unsigned int frames, unsigned int *fade_pos,
+		   unsigned int fade_frames)
 {
 	size_t remaining;
 	size_t chunk;
-	size_t i;
+	size_t done = 0;
+	size_t i, j;
 	unsigned int input_channels = pipeline->input_channels;
 	unsigned int output_channels = pipeline->output_channels;
 	float *source[input_channels];
 	float *sink[output_channels];
+	float *from_source[input_channels];
+	float *from_sink[output_channels];
 	struct timespec begin, end, delta;
+	float gain, step;
 	int rc;
 
-	if (!pipeline || frames == 0)
+	if (frames == 0)
 		return 0;
 
 	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &begin);
 
+	if (fade_pos && !can_crossfade(pipeline, from))
+		*fade_pos = fade_frames;
+	if (!fade_pos || *fade_pos >= fade_frames)
+		from = NULL;
+
+	/* The faded out pipeline takes the scratch buffers after the ones of
+	 * pipeline, reserved first so binding from doesn't move them. */
+	if (reserve_scratch(pipeline->peak_buf + (from ? from->peak_buf : 0)) ||
+	    bind_buffers(pipeline, 0) ||
+	    (from && bind_buffers(from, pipeline->peak_buf)))
+		return -ENOMEM;
+
 	/* get pointers to source and sink buffers */
 	for (i = 0; i < input_channels; i++)
 		source[i] = cras_dsp_pipeline_get_source_buffer(pipeline, i);
 	for (i = 0; i < output_channels; i++)
 		sink[i] = cras_dsp_pipeline_get_sink_buffer(pipeline, i);
 
+	if (from) {
+		for (i = 0; i < input_channels; i++)
+			from_source[i] =
+				cras_dsp_pipeline_get_source_buffer(from, i);
+		for (i = 0; i < output_channels; i++)
+			from_sink[i] =
+				cras_dsp_pipeline_get_sink_buffer(from, i);
+	}
+
 	remaining = frames;
+	if (pipeline->block_size) {
+		rc = process_blocks(pipeline, source, sink, planes, buf, format,
+				    frames);
+		if (rc)
+			return rc;
+		remaining = 0;
+	}
 
 	/* process at most DSP_BUFFER_SIZE frames each loop */
 	while (remaining > 0) {
 		chunk = MIN(remaining, (size_t)DSP_BUFFER_SIZE);
+		if (from)
+			chunk = MIN(chunk, (size_t)(fade_frames - *fade_pos));
 
 		/* deinterleave and convert to float */
-		rc = dsp_util_deinterleave(buf, source, input_channels, format,
-					   chunk);
+		rc = fill_source(pipeline, source, planes, done, buf, format,
+				 chunk);
 		if (rc)
 			return rc;
 
+		/* Copy the input before it's processed in place. */
+		if (from)
+			for (i = 0; i < input_channels; i++)
+				memcpy(from_source[i], source[i],
+				       chunk * sizeof(float));
+
 		/* Run the pipeline */
 		cras_dsp_pipeline_run(pipeline, chunk);
 
+		if (from) {
+			cras_dsp_pipeline_run(from, chunk);
+
+			step = 1.0f / fade_frames;
+			for (i = 0; i < output_channels; i++) {
+				gain = *fade_pos * step;
+				for (j = 0; j < chunk; j++) {
+					sink[i][j] = from_sink[i][j] +
+						     (sink[i][j] -
+						      from_sink[i][j]) *
+							     gain;
+					gain += step;
+				}
+			}
+			*fade_pos += chunk;
+			if (*fade_pos >= fade_frames)
+				from = NULL;
+		}
+
 		/* interleave and convert back to int16_t */
 		rc = dsp_util_interleave(sink, buf, output_channels, format,
 					 chunk);
@@ -881,6 +1507,7 @@ int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 			return rc;
 
 		buf += chunk * output_channels * PCM_FORMAT_WIDTH(format) / 8;
+		done += chunk;
 		remaining -= chunk;
 	}
 
@@ -890,6 +1517,38 @@ int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 	return 0;
 }
 
+int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
+			    snd_pcm_format_t format, unsigned int frames)
+{
+	if (!pipeline)
+		return 0;
+	return process(pipeline, NULL, NULL, buf, format, frames, NULL, 0);
+}
+
+int cras_dsp_pipeline_apply_planar(struct pipeline *pipeline,
+				   float *const *planes, uint8_t *buf,
+				   snd_pcm_format_t format,
+				   unsigned int frames)
+{
+	if (!pipeline)
+		return 0;
+	return process(pipeline, NULL, planes, buf, format, frames, NULL, 0);
+}
+
+int cras_dsp_pipeline_apply_crossfade(struct pipeline *pipeline,
+				      struct pipeline *from,
+				      float *const *planes, uint8_t *buf,
+				      snd_pcm_format_t format,
+				      unsigned int frames,
+				      unsigned int *fade_pos,
+				      unsigned int fade_frames)
+{
+	if (!pipeline)
+		return 0;
+	return process(pipeline, from, planes, buf, format, frames, fade_pos,
+		       fade_frames);
+}
+
 void cras_dsp_pipeline_free(struct pipeline *pipeline)
 {
 	int i;
@@ -916,8 +1575,15 @@ void cras_dsp_pipeline_free(struct pipeline *pipeline)
 	pipeline->ini = NULL;
 	ARRAY_FREE(&pipeline->instances);
 
-	for (i = 0; i < pipeline->peak_buf; i++)
-		free(pipeline->buffers[i]);
+	if (pipeline->block_in) {
+		cras_mem_stats_sub(CRAS_MEM_DSP,
+				   (size_t)(pipeline->input_channels +
+					    pipeline->output_channels) *
+					   pipeline->block_stride *
+					   sizeof(float));
+		cras_rt_mem_remove(pipeline->block_in);
+		free(pipeline->block_in);
+	}
 	free(pipeline->buffers);
 	free(pipeline);
 }
@@ -958,6 +1624,20 @@ static void dump_control_ports(struct dumper *d, const char *name,
 	}
 }
 
+static void dump_instance_cpu(struct dumper *d, struct instance *instance)
+{
+	struct cras_latency_hist *hist = &instance->frame_time_hist;
+
+	dumpf(d,
+	      "   cpu per frame: min %.3fns, avg %.3fns, max %.3fns,"
+	      " p99 %.3fns, blocks %" PRId64 "\n",
+	      instance->min_frame_time / 1000.0,
+	      (double)instance->total_time / instance->total_samples,
+	      hist->max_usec / 1000.0,
+	      cras_latency_hist_percentile(hist, 99) / 1000.0,
+	      instance->total_blocks);
+}
+
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 {
 	int i;
@@ -991,6 +1671,13 @@ void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline)
 		struct dsp_module *module = instance->module;
 		dumpf(d, "  [%d]%s mod=%p, total delay=%d\n", i,
 		      instance->plugin->title, module, instance->total_delay);
+		if (instance->merged_into)
+			dumpf(d, "   merged into %s\n",
+			      instance->merged_into->plugin->title);
+		else if (instance->bypass)
+			dumpf(d, "   bypassed\n");
+		if (instance->total_samples)
+			dump_instance_cpu(d, instance);
 		if (module)
 			module->dump(module, d);
 		dump_audio_ports(d, "input_audio_ports",
@@ -24,6 +24,10 @@ extern "C" {
  * pipeline by giving an audio sampling rate. Then we get the pointers
  * to the input buffers, fill the input data, run the pipeline, and
  * obtain the processed data from the output buffers.
+ *
+ * The audio buffers belong to the thread running the pipeline and are
+ * shared by all the pipelines run on it, they only hold audio from
+ * cras_dsp_pipeline_get_source_buffer() to the end of the run.
  */
 
 /* The maximum number of samples that cras_dsp_pipeline_run() can
@@ -70,13 +74,40 @@ int cras_dsp_pipeline_instantiate(struct pipeline *pipeline, int sample_rate);
  * cras_dsp_pipeline_instantiate(). */
 void cras_dsp_pipeline_deinstantiate(struct pipeline *pipeline);
 
+/* Marks the instances of a new pipeline that can take over the module of an
+ * instance of from, keeping the state of the module, like the history of
+ * its filters. That's when both come from plugins with the same title and
+ * parameters, and from runs at sample_rate. The ports of the module are
+ * connected anew, so the flows around it may change. Must be called before
+ * cras_dsp_pipeline_load(), which then loads only the other modules.
+ * Args:
+ *    pipeline - The new pipeline.
+ *    from - The pipeline being replaced, may be NULL.
+ *    sample_rate - The rate pipeline will be instantiated at.
+ * Returns:
+ *    The number of modules to be taken over.
+ */
+int cras_dsp_pipeline_reuse_modules(struct pipeline *pipeline,
+				    struct pipeline *from, int sample_rate);
+
+/* Moves the modules marked by cras_dsp_pipeline_reuse_modules() from the
+ * pipeline being replaced into pipeline, after it has been instantiated.
+ * The old pipeline can't run anymore, it may only be freed. Neither
+ * pipeline may run while this is called. */
+void cras_dsp_pipeline_take_modules(struct pipeline *pipeline);
+
 /* Returns the buffering delay of the pipeline. This should only be called
- * after a pipeline has been instantiated.
+ * after a pipeline has been instantiated. It includes the block the pipeline
+ * holds back when its modules need a fixed block size.
  * Returns:
  *    The buffering delay in frames.
  */
 int cras_dsp_pipeline_get_delay(struct pipeline *pipeline);
 
+/* Returns the number of frames each run of a loaded pipeline takes, or 0 if
+ * its modules run on any count. */
+int cras_dsp_pipeline_get_block_size(struct pipeline *pipeline);
+
 /* Returns the number of input/output audio channels this pipeline expects */
 int cras_dsp_pipeline_get_num_input_channels(struct pipeline *pipeline);
 int cras_dsp_pipeline_get_num_output_channels(struct pipeline *pipeline);
@@ -111,19 +142,49 @@ float *cras_dsp_pipeline_get_sink_buffer(struct pipeline *pipeline, int index);
 void cras_dsp_pipeline_set_sink_ext_module(struct pipeline *pipeline,
 					   struct ext_dsp_module *ext_module);
 
-/* Returns the number of internal audio buffers allocated by the
- * pipeline. This is used by the unit test only */
+/* Frees the audio buffers the pipelines of the calling thread share, call
+ * when the thread stops running pipelines. Pipelines run on the thread
+ * later allocate them again. */
+void cras_dsp_pipeline_release_scratch();
+
+/* Returns the number of audio buffers the pipeline uses. This is used by
+ * the unit test only */
 int cras_dsp_pipeline_get_peak_audio_buffers(struct pipeline *pipeline);
 
 /* Returns the sampling rate passed by cras_dsp_pipeline_instantiate(),
  * or 0 if is has not been called */
 int cras_dsp_pipeline_get_sample_rate(struct pipeline *pipeline);
 
+/* Sets the value of an input control port which isn't connected to another
+ * plugin. The builtin eq, eq2 and drc follow the new value while running,
+ * without being instantiated again. Safe to call while the pipeline runs in
+ * another thread.
+ * Args:
+ *    pipeline - The pipeline to change.
+ *    title - The title of the plugin in the ini file.
+ *    port - The index of the port in the plugin.
+ *    value - The new value of the port.
+ * Returns:
+ *    0 on success, -ENOENT if there is no such port.
+ */
+int cras_dsp_pipeline_set_control(struct pipeline *pipeline, const char *title,
+				  int port, float value);
+
+/* Returns true if plugin runs in the pipeline, i.e. it is connected to the
+ * source and sink and not disabled. */
+int cras_dsp_pipeline_has_plugin(struct pipeline *pipeline,
+				 const struct plugin *plugin);
+
+/* Returns true if plugin is left out of the pipelines created in env. */
+char cras_dsp_pipeline_plugin_disabled(struct plugin *plugin,
+				       struct cras_expr_env *env);
+
 /* Gets the dsp ini that corresponds to the pipeline. */
 struct ini *cras_dsp_pipeline_get_ini(struct pipeline *pipeline);
 
 /* Processes a block of audio samples. sample_count should be no more
- * than DSP_BUFFER_SIZE */
+ * than DSP_BUFFER_SIZE. The CPU time each module takes is recorded and
+ * shown by cras_dsp_pipeline_dump(). */
 void cras_dsp_pipeline_run(struct pipeline *pipeline, int sample_count);
 
 /* Add a statistic of running time for the pipeline.
@@ -149,6 +210,52 @@ void cras_dsp_pipeline_add_statistic(struct pipeline *pipeline,
 int cras_dsp_pipeline_apply(struct pipeline *pipeline, uint8_t *buf,
 			    snd_pcm_format_t format, unsigned int frames);
 
+/* Runs the specified pipeline on non-interleaved float samples, like the
+ * ones of a float mix bus, and writes the result interleaved to buf. The
+ * samples are fed to the pipeline as they are, so the only conversion is
+ * the final interleave into buf.
+ * Args:
+ *    pipeline - The pipeline to run.
+ *    planes - The samples to be processed, one buffer for each of the input
+ *        channels of the pipeline.
+ *    buf - The interleaved buffer the output is written to.
+ *    format - Sample format of buf.
+ *    frames - the number of frames to process.
+ * Returns:
+ *    Negative code if error, otherwise 0.
+ */
+int cras_dsp_pipeline_apply_planar(struct pipeline *pipeline,
+				   float *const *planes, uint8_t *buf,
+				   snd_pcm_format_t format,
+				   unsigned int frames);
+
+/* Runs pipeline like cras_dsp_pipeline_apply(), or like
+ * cras_dsp_pipeline_apply_planar() when planes is not NULL, while fading
+ * out the output of the pipeline it replaces. Both pipelines are fed the
+ * same input and the output is pipeline's scaled by a gain ramping up
+ * linearly from *fade_pos / fade_frames, plus from's scaled by one minus
+ * that gain. from is only run until the ramp completes. If the output of
+ * from can't be mixed with the one of pipeline, the fade is skipped.
+ * Args:
+ *    pipeline - The pipeline to run.
+ *    from - The pipeline being faded out, may be NULL.
+ *    planes - Non-interleaved input samples, or NULL to process buf in place.
+ *    buf - The interleaved buffer the output is written to.
+ *    format - Sample format of buf.
+ *    frames - the number of frames to process.
+ *    fade_pos - In and out, the number of frames of the fade done.
+ *    fade_frames - The length of the fade in frames.
+ * Returns:
+ *    Negative code if error, otherwise 0.
+ */
+int cras_dsp_pipeline_apply_crossfade(struct pipeline *pipeline,
+				      struct pipeline *from,
+				      float *const *planes, uint8_t *buf,
+				      snd_pcm_format_t format,
+				      unsigned int frames,
+				      unsigned int *fade_pos,
+				      unsigned int fade_frames);
+
 /* Dumps the current state of the pipeline. For debugging only */
 void cras_dsp_pipeline_dump(struct dumper *d, struct pipeline *pipeline);
 
@@ -283,25 +283,51 @@ void cras_expr_env_install_builtins(struct cras_expr_env *env)
 	cras_expr_value_free(&value);
 }
 
-void cras_expr_env_set_variable_boolean(struct cras_expr_env *env,
-					const char *name, char boolean)
+int cras_expr_env_set_variable_boolean(struct cras_expr_env *env,
+				       const char *name, char boolean)
 {
 	struct cras_expr_value *value = find_or_insert_value(env, name);
+
+	if (value->type == CRAS_EXPR_VALUE_TYPE_BOOLEAN &&
+	    value->u.boolean == !!boolean)
+		return 0;
 	value_set_boolean(value, boolean);
+	return 1;
+}
+
+int cras_expr_env_get_variable_boolean(struct cras_expr_env *env,
+				       const char *name, char *boolean)
+{
+	struct cras_expr_value *value = find_value(env, name);
+
+	if (!value || value->type != CRAS_EXPR_VALUE_TYPE_BOOLEAN)
+		return -1;
+	*boolean = value->u.boolean;
+	return 0;
 }
 
-void cras_expr_env_set_variable_integer(struct cras_expr_env *env,
-					const char *name, int integer)
+int cras_expr_env_set_variable_integer(struct cras_expr_env *env,
+				       const char *name, int integer)
 {
 	struct cras_expr_value *value = find_or_insert_value(env, name);
+
+	if (value->type == CRAS_EXPR_VALUE_TYPE_INT &&
+	    value->u.integer == integer)
+		return 0;
 	value_set_integer(value, integer);
+	return 1;
 }
 
-void cras_expr_env_set_variable_string(struct cras_expr_env *env,
-				       const char *name, const char *str)
+int cras_expr_env_set_variable_string(struct cras_expr_env *env,
+				      const char *name, const char *str)
 {
 	struct cras_expr_value *value = find_or_insert_value(env, name);
+
+	if (value->type == CRAS_EXPR_VALUE_TYPE_STRING &&
+	    strcmp(value->u.string, str) == 0)
+		return 0;
 	value_set_string(value, str);
+	return 1;
 }
 
 void cras_expr_env_free(struct cras_expr_env *env)
@@ -651,3 +677,267 @@ int cras_expr_expression_eval_boolean(struct cras_expr_expression *expr,
 	cras_expr_value_free(&value);
 	return rc;
 }
+
+/* Program */
+
+enum program_op {
+	/* Push literals[arg]. */
+	OP_PUSH_LITERAL,
+	/* Push the value of variables[arg]. */
+	OP_LOAD_VARIABLE,
+	/* Pop arg values and push the result of calling the first of them
+	 * with all of them as operands, as a compound expression does. */
+	OP_CALL,
+};
+
+struct program_instruction {
+	enum program_op op;
+	int arg;
+};
+
+struct program_variable {
+	const char *name;
+	/* Where the variable was last found in an environment. */
+	int slot;
+};
+
+DECLARE_ARRAY_TYPE(struct program_instruction, instruction_array);
+DECLARE_ARRAY_TYPE(struct program_variable, variable_array);
+
+struct cras_expr_program {
+	instruction_array code;
+	cras_expr_value_array literals;
+	variable_array variables;
+	/* The most values on the stack while the program runs. */
+	int max_depth;
+};
+
+/* Stack entries a program runs with before it allocates them. */
+#define PROGRAM_STACK_SIZE 16
+
+static void emit(struct cras_expr_program *prog, enum program_op op, int arg,
+		 int depth)
+{
+	struct program_instruction *inst = ARRAY_APPEND_ZERO(&prog->code);
+
+	inst->op = op;
+	inst->arg = arg;
+	if (depth > prog->max_depth)
+		prog->max_depth = depth;
+}
+
+static int add_variable(struct cras_expr_program *prog, const char *name)
+{
+	int i;
+	struct program_variable *var;
+
+	ARRAY_ELEMENT_FOREACH (&prog->variables, i, var) {
+		if (strcmp(var->name, name) == 0)
+			return i;
+	}
+	var = ARRAY_APPEND_ZERO(&prog->variables);
+	var->name = strdup(name);
+	return i;
+}
+
+/* Appends the instructions evaluating expr with depth values already on
+ * the stack, which leave its value on top. */
+static void compile_expression(struct cras_expr_program *prog,
+			       const struct cras_expr_expression *expr,
+			       int depth)
+{
+	struct cras_expr_value *literal;
+	struct cras_expr_expression **psub;
+	int i;
+
+	switch (expr->type) {
+	case EXPR_TYPE_NONE:
+	case EXPR_TYPE_LITERAL:
+		literal = ARRAY_APPEND_ZERO(&prog->literals);
+		if (expr->type == EXPR_TYPE_LITERAL)
+			copy_value(literal,
+				   (struct cras_expr_value *)&expr->u.literal);
+		emit(prog, OP_PUSH_LITERAL, ARRAY_COUNT(&prog->literals) - 1,
+		     depth + 1);
+		break;
+	case EXPR_TYPE_VARIABLE:
+		emit(prog, OP_LOAD_VARIABLE,
+		     add_variable(prog, expr->u.variable), depth + 1);
+		break;
+	case EXPR_TYPE_COMPOUND:
+		ARRAY_ELEMENT_FOREACH (&expr->u.children, i, psub) {
+			compile_expression(prog, *psub, depth + i);
+		}
+		emit(prog, OP_CALL, ARRAY_COUNT(&expr->u.children), depth + 1);
+		break;
+	}
+}
+
+struct cras_expr_program *
+cras_expr_program_compile(const struct cras_expr_expression *expr)
+{
+	struct cras_expr_program *prog;
+
+	if (!expr)
+		return NULL;
+	prog = calloc(1, sizeof(*prog));
+	compile_expression(prog, expr, 0);
+	return prog;
+}
+
+/* Finds the value of var in env, looking where it was found last first. */
+static struct cras_expr_value *find_variable(struct cras_expr_env *env,
+					     struct program_variable *var)
+{
+	int i;
+	const char **key;
+
+	if (var->slot < ARRAY_COUNT(&env->keys) &&
+	    strcmp(*ARRAY_ELEMENT(&env->keys, var->slot), var->name) == 0)
+		return ARRAY_ELEMENT(&env->values, var->slot);
+
+	ARRAY_ELEMENT_FOREACH (&env->keys, i, key) {
+		if (strcmp(*key, var->name) == 0) {
+			var->slot = i;
+			return ARRAY_ELEMENT(&env->values, i);
+		}
+	}
+	return NULL;
+}
+
+/* Calls the function on the stack below its n - 1 operands, and replaces
+ * them all with its result. */
+static void call_function(struct cras_expr_value *stack, char *owned, int n,
+			  struct cras_expr_value *result)
+{
+	cras_expr_value_array operands = {
+		.count = n,
+		.size = n,
+		.element = stack,
+	};
+	int i;
+
+	if (n == 0) {
+		syslog(LOG_ERR, "empty compound expression?");
+		return;
+	}
+	if (stack[0].type == CRAS_EXPR_VALUE_TYPE_FUNCTION)
+		stack[0].u.function(&operands, result);
+	else
+		syslog(LOG_ERR, "first element is not a function");
+
+	for (i = 0; i < n; i++) {
+		if (owned[i])
+			cras_expr_value_free(&stack[i]);
+	}
+}
+
+void cras_expr_program_eval(struct cras_expr_program *prog,
+			    struct cras_expr_env *env,
+			    struct cras_expr_value *result)
+{
+	struct cras_expr_value small_stack[PROGRAM_STACK_SIZE];
+	char small_owned[PROGRAM_STACK_SIZE];
+	struct cras_expr_value *stack = small_stack;
+	char *owned = small_owned;
+	struct cras_expr_value *value, call_result;
+	struct program_instruction *inst;
+	struct program_variable *var;
+	int i, sp = 0;
+
+	cras_expr_value_free(result);
+	if (prog->max_depth > PROGRAM_STACK_SIZE) {
+		stack = calloc(prog->max_depth, sizeof(*stack));
+		owned = calloc(prog->max_depth, sizeof(*owned));
+	}
+
+	/* Literals and variables are pushed without copying them, only the
+	 * results of functions are owned by the stack. */
+	ARRAY_ELEMENT_FOREACH (&prog->code, i, inst) {
+		switch (inst->op) {
+		case OP_PUSH_LITERAL:
+			stack[sp] = *ARRAY_ELEMENT(&prog->literals, inst->arg);
+			owned[sp++] = 0;
+			break;
+		case OP_LOAD_VARIABLE:
+			var = ARRAY_ELEMENT(&prog->variables, inst->arg);
+			value = find_variable(env, var);
+			if (value == NULL) {
+				syslog(LOG_ERR, "cannot find value for %s",
+				       var->name);
+				stack[sp].type = CRAS_EXPR_VALUE_TYPE_NONE;
+			} else {
+				stack[sp] = *value;
+			}
+			owned[sp++] = 0;
+			break;
+		case OP_CALL:
+			sp -= inst->arg;
+			call_result.type = CRAS_EXPR_VALUE_TYPE_NONE;
+			call_function(stack + sp, owned + sp, inst->arg,
+				      &call_result);
+			stack[sp] = call_result;
+			owned[sp++] = 1;
+			break;
+		}
+	}
+
+	if (owned[0])
+		*result = stack[0];
+	else
+		copy_value(result, &stack[0]);
+
+	if (stack != small_stack) {
+		free(stack);
+		free(owned);
+	}
+}
+
+int cras_expr_program_eval_boolean(struct cras_expr_program *prog,
+				   struct cras_expr_env *env, char *boolean)
+{
+	int rc = 0;
+	struct cras_expr_value value = CRAS_EXPR_VALUE_INIT;
+
+	cras_expr_program_eval(prog, env, &value);
+	if (value.type == CRAS_EXPR_VALUE_TYPE_BOOLEAN) {
+		*boolean = value.u.boolean;
+	} else {
+		syslog(LOG_ERR, "value type is not boolean (%d)", value.type);
+		rc = -1;
+	}
+	cras_expr_value_free(&value);
+	return rc;
+}
+
+int cras_expr_program_get_num_variables(const struct cras_expr_program *prog)
+{
+	return ARRAY_COUNT(&prog->variables);
+}
+
+const char *cras_expr_program_get_variable(const struct cras_expr_program *prog,
+					   int i)
+{
+	return ARRAY_ELEMENT(&prog->variables, i)->name;
+}
+
+void cras_expr_program_free(struct cras_expr_program *prog)
+{
+	int i;
+	struct cras_expr_value *literal;
+	struct program_variable *var;
+
+	if (!prog)
+		return;
+
+	ARRAY_ELEMENT_FOREACH (&prog->literals, i, literal) {
+		cras_expr_value_free(literal);
+	}
+	ARRAY_ELEMENT_FOREACH (&prog->variables, i, var) {
+		free((char *)var->name);
+	}
+	ARRAY_FREE(&prog->code);
+	ARRAY_FREE(&prog->literals);
+	ARRAY_FREE(&prog->variables);
+	free(prog);
+}
@@ -77,12 +77,18 @@ struct cras_expr_env {
 // clang-format on
 
 void cras_expr_env_install_builtins(struct cras_expr_env *env);
-void cras_expr_env_set_variable_boolean(struct cras_expr_env *env,
-					const char *name, char boolean);
-void cras_expr_env_set_variable_integer(struct cras_expr_env *env,
-					const char *name, int integer);
-void cras_expr_env_set_variable_string(struct cras_expr_env *env,
-				       const char *name, const char *str);
+/* The setters return 1 if the variable was unset or had another value, 0 if
+ * it is unchanged. */
+int cras_expr_env_set_variable_boolean(struct cras_expr_env *env,
+				       const char *name, char boolean);
+/* Gets the value of a boolean variable, returns -1 if there is no such
+ * variable or it is not a boolean. */
+int cras_expr_env_get_variable_boolean(struct cras_expr_env *env,
+				       const char *name, char *boolean);
+int cras_expr_env_set_variable_integer(struct cras_expr_env *env,
+				       const char *name, int integer);
+int cras_expr_env_set_variable_string(struct cras_expr_env *env,
+				      const char *name, const char *str);
 void cras_expr_env_free(struct cras_expr_env *env);
 void cras_expr_env_dump(struct dumper *d, const struct cras_expr_env *env);
 
@@ -97,6 +103,33 @@ int cras_expr_expression_eval_int(struct cras_expr_expression *expr,
 void cras_expr_expression_free(struct cras_expr_expression *expr);
 void cras_expr_expression_dump(struct dumper *d,
 			       const struct cras_expr_expression *expr);
+
+/* Program
+ *
+ * An expression compiled to a sequence of instructions run on a value
+ * stack. The variables it reads are listed once and their slots in the
+ * environment are remembered between runs, so evaluating it neither walks
+ * the expression tree nor searches the environment for each variable.
+ */
+
+struct cras_expr_program;
+
+/* Compiles expr, returns NULL if expr is NULL. */
+struct cras_expr_program *
+cras_expr_program_compile(const struct cras_expr_expression *expr);
+/* Evaluates the program, with the same result as evaluating the expression
+ * it was compiled from. */
+void cras_expr_program_eval(struct cras_expr_program *prog,
+			    struct cras_expr_env *env,
+			    struct cras_expr_value *value);
+int cras_expr_program_eval_boolean(struct cras_expr_program *prog,
+				   struct cras_expr_env *env, char *boolean);
+/* Gets the number and names of the variables the program reads. */
+int cras_expr_program_get_num_variables(const struct cras_expr_program *prog);
+const char *
+cras_expr_program_get_variable(const struct cras_expr_program *prog, int i);
+void cras_expr_program_free(struct cras_expr_program *prog);
+
 void cras_expr_value_free(struct cras_expr_value *value);
 void cras_expr_value_dump(struct dumper *d,
 			  const struct cras_expr_value *value);
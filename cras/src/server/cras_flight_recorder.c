@@ -0,0 +1,173 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_flight_recorder.h"
+#include "cras_util.h"
+
+/* The event log keeps the low 24 bits of the seconds. */
+#define EVENT_SEC_MASK 0x00ffffff
+
+static struct {
+	char *dir;
+	unsigned int next_file;
+	struct timespec last_record;
+	int has_recorded;
+} recorder;
+
+void cras_flight_recorder_init(const char *dir)
+{
+	cras_flight_recorder_deinit();
+	if (dir)
+		recorder.dir = strdup(dir);
+}
+
+void cras_flight_recorder_deinit()
+{
+	free(recorder.dir);
+	memset(&recorder, 0, sizeof(recorder));
+}
+
+/* Copies the events of the last CRAS_FLIGHT_RECORDER_WINDOW_SEC seconds out of
+ * the live log, oldest first. The audio thread keeps logging meanwhile, so
+ * the copy is bounded by the write position read on entry. Returns the
+ * number of events copied into events, which holds log->len of them. */
+static unsigned int copy_window(const struct audio_thread_event_log *log,
+				const struct timespec *now,
+				struct audio_thread_event *events)
+{
+	uint64_t end = __atomic_load_n(&log->write_pos, __ATOMIC_RELAXED);
+	uint64_t start = end > log->len ? end - log->len : 0;
+	uint64_t pos;
+	uint32_t now_sec = now->tv_sec & EVENT_SEC_MASK;
+	uint32_t age;
+
+	for (pos = end; pos > start; pos--) {
+		const struct audio_thread_event *ev =
+			&log->log[(pos - 1) % log->len];
+
+		age = (now_sec - (ev->tag_sec & EVENT_SEC_MASK)) &
+		      EVENT_SEC_MASK;
+		if (age > CRAS_FLIGHT_RECORDER_WINDOW_SEC)
+			break;
+	}
+	for (start = pos; pos < end; pos++)
+		events[pos - start] = log->log[pos % log->len];
+	return end - start;
+}
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, p, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Writes the record to a temporary file and renames it into place, so a
+ * collector never reads a partial record. */
+static int write_record(const struct cras_flight_record_header *hdr,
+			const struct cras_audio_thread_snapshot *snapshot,
+			const struct audio_thread_event *events)
+{
+	char tmp_path[PATH_MAX];
+	char path[PATH_MAX];
+	int fd;
+	int rc;
+
+	snprintf(tmp_path, sizeof(tmp_path), "%s/.cras_flight_record.tmp",
+		 recorder.dir);
+	snprintf(path, sizeof(path), "%s/cras_flight_record.%u", recorder.dir,
+		 recorder.next_file);
+
+	fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0640);
+	if (fd < 0)
+		return -errno;
+	rc = write_all(fd, hdr, sizeof(*hdr));
+	if (!rc)
+		rc = write_all(fd, cras_audio_thread_snapshot_devs(snapshot),
+			       hdr->num_devs *
+				       sizeof(struct audio_dev_debug_info));
+	if (!rc)
+		rc = write_all(fd, cras_audio_thread_snapshot_streams(snapshot),
+			       hdr->num_streams *
+				       sizeof(struct audio_stream_debug_info));
+	if (!rc)
+		rc = write_all(fd, events, hdr->num_events * sizeof(events[0]));
+	if (close(fd) && !rc)
+		rc = -errno;
+	if (!rc && rename(tmp_path, path))
+		rc = -errno;
+	if (rc)
+		unlink(tmp_path);
+	return rc;
+}
+
+int cras_flight_recorder_record(
+	const struct cras_audio_thread_snapshot *snapshot,
+	const struct audio_thread_event_log *log)
+{
+	/* Copied out, the snapshot is packed. */
+	struct timespec now = snapshot->timestamp;
+	struct cras_flight_record_header hdr;
+	struct audio_thread_event *events;
+	struct timespec diff;
+	int rc;
+
+	if (!recorder.dir || !log)
+		return 0;
+
+	if (recorder.has_recorded) {
+		subtract_timespecs(&now, &recorder.last_record, &diff);
+		if (diff.tv_sec < CRAS_FLIGHT_RECORDER_MIN_INTERVAL_SEC)
+			return -EAGAIN;
+	}
+
+	events = (struct audio_thread_event *)calloc(log->len,
+						     sizeof(*events));
+	if (!events)
+		return -ENOMEM;
+
+	hdr.magic = CRAS_FLIGHT_RECORD_MAGIC;
+	hdr.version = CRAS_FLIGHT_RECORD_VERSION;
+	hdr.event_type = snapshot->event_type;
+	hdr.sec = now.tv_sec;
+	hdr.nsec = now.tv_nsec;
+	hdr.num_devs = snapshot->num_devs;
+	hdr.num_streams = snapshot->num_streams;
+	hdr.num_events = copy_window(log, &now, events);
+
+	rc = write_record(&hdr, snapshot, events);
+	free(events);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to write flight record to %s: %d",
+		       recorder.dir, rc);
+		return rc;
+	}
+
+	recorder.last_record = now;
+	recorder.has_recorded = 1;
+	recorder.next_file =
+		(recorder.next_file + 1) % CRAS_FLIGHT_RECORDER_MAX_FILES;
+	return 0;
+}
@@ -0,0 +1,75 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Flight recorder for audio thread glitches. The live audio thread event log
+ * already holds the wakes, hw levels and stream buffer levels leading up to a
+ * glitch. When the audio thread monitor reports one, the recorder freezes the
+ * last CRAS_FLIGHT_RECORDER_WINDOW_SEC seconds of that log together with the
+ * device and stream state at the time, and writes them to a file so the
+ * history survives until a feedback report collects it.
+ *
+ * A record is a cras_flight_record_header followed by num_devs
+ * audio_dev_debug_info, num_streams audio_stream_debug_info and num_events
+ * audio_thread_event, oldest event first.
+ */
+
+#ifndef CRAS_FLIGHT_RECORDER_H_
+#define CRAS_FLIGHT_RECORDER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "cras_types.h"
+
+#define CRAS_FLIGHT_RECORD_MAGIC 0x46524143 /* "CARF" */
+#define CRAS_FLIGHT_RECORD_VERSION 1
+
+/* Seconds of event log history kept in a record. How much of it is actually
+ * available depends on audio_thread:event_log_size in the board config. */
+#define CRAS_FLIGHT_RECORDER_WINDOW_SEC 10
+/* Minimum time between two records, whatever the event type. */
+#define CRAS_FLIGHT_RECORDER_MIN_INTERVAL_SEC 60
+/* Records are written to this many files in turn, bounding disk usage. */
+#define CRAS_FLIGHT_RECORDER_MAX_FILES 5
+
+/* Header of a record file.
+ *    magic - CRAS_FLIGHT_RECORD_MAGIC.
+ *    version - CRAS_FLIGHT_RECORD_VERSION.
+ *    event_type - The CRAS_AUDIO_THREAD_EVENT_TYPE that triggered it.
+ *    sec, nsec - CLOCK_MONOTONIC_RAW time of the trigger.
+ *    num_devs, num_streams, num_events - Number of each entry following.
+ */
+struct __attribute__((__packed__)) cras_flight_record_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t event_type;
+	uint64_t sec;
+	uint32_t nsec;
+	uint32_t num_devs;
+	uint32_t num_streams;
+	uint32_t num_events;
+};
+
+/* Enables recording to files in dir, which must exist. Passing NULL disables
+ * the recorder, which is the default. */
+void cras_flight_recorder_init(const char *dir);
+
+/* Disables the recorder and forgets its rate limiting state. */
+void cras_flight_recorder_deinit();
+
+/* Writes a record of a glitch. Must be called from the main thread.
+ * Args:
+ *    snapshot - The snapshot taken for the glitch, its event type, time and
+ *        devices and streams are recorded. Its events are not used.
+ *    log - The live audio thread event log.
+ * Returns:
+ *    0 if a record was written or the recorder is disabled, -EAGAIN if the
+ *    last record is more recent than CRAS_FLIGHT_RECORDER_MIN_INTERVAL_SEC,
+ *    negative error code otherwise.
+ */
+int cras_flight_recorder_record(
+	const struct cras_audio_thread_snapshot *snapshot,
+	const struct audio_thread_event_log *log);
+
+#endif /* CRAS_FLIGHT_RECORDER_H_ */
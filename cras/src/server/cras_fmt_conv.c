@@ -3,7 +3,7 @@
  * found in the LICENSE file.
  */
 
-/* For now just use speex, can add more resamplers later. */
+#include <errno.h>
 #include <speex/speex_resampler.h>
 #include <sys/param.h>
 #include <syslog.h>
@@ -14,14 +14,24 @@
 #include "cras_fmt_conv.h"
 #include "cras_fmt_conv_ops.h"
 #include "cras_audio_format.h"
+#include "cras_mem_stats.h"
+#include "cras_mix.h"
 #include "cras_util.h"
 #include "linear_resampler.h"
+#include "int_ratio_resampler.h"
+#include "polyphase_resampler.h"
 
 /* The quality level is a value between 0 and 10. This is a tradeoff between
  * performance, latency, and quality. */
 #define SPEEX_QUALITY_LEVEL 4
 /* Max number of converters, src, down/up mix, 2xformat, and linear resample. */
 #define MAX_NUM_CONVERTERS 5
+/* Input frames run through the whole conversion chain at a time when more
+ * than one stage is used, so intermediate data stays in cache. */
+#define FUSED_BLOCK_FRAMES 256
+/* Frames the speex resampler converts to and from float at a time when it
+ * runs on S32_LE samples. */
+#define SPEEX_FLOAT_BLOCK_FRAMES 256
 /* Channel index for stereo. */
 #define STEREO_L 0
 #define STEREO_R 1
@@ -32,22 +42,281 @@ typedef size_t (*channel_converter_t)(struct cras_fmt_conv *conv,
 				      const uint8_t *in, size_t in_frames,
 				      uint8_t *out);
 
+/* Sample rate conversion backend, run on interleaved frames of the working
+ * format of the converter.
+ * Members:
+ *    process - Converts up to *in_frames frames from in into at most
+ *        out_frames frames in out. Sets *in_frames to the number consumed
+ *        and returns the number produced.
+ *    latency - Returns the delay of the filter, in input frames.
+ *    destroy - Frees the backend state.
+ */
+struct fmt_conv_src_ops {
+	unsigned int (*process)(void *state, const uint8_t *in,
+				unsigned int *in_frames, uint8_t *out,
+				unsigned int out_frames);
+	unsigned int (*latency)(void *state);
+	void (*destroy)(void *state);
+};
+
+static unsigned int speex_process(void *state, const uint8_t *in,
+				  unsigned int *in_frames, uint8_t *out,
+				  unsigned int out_frames)
+{
+	speex_resampler_process_interleaved_int(
+		(SpeexResamplerState *)state, (const int16_t *)in, in_frames,
+		(int16_t *)out, &out_frames);
+	return out_frames;
+}
+
+static unsigned int speex_latency(void *state)
+{
+	return speex_resampler_get_input_latency((SpeexResamplerState *)state);
+}
+
+static void speex_destroy(void *state)
+{
+	speex_resampler_destroy((SpeexResamplerState *)state);
+}
+
+static const struct fmt_conv_src_ops speex_src_ops = {
+	.process = speex_process,
+	.latency = speex_latency,
+	.destroy = speex_destroy,
+};
+
+/* Speex only takes 16 bit integers, so S32_LE samples go through its float
+ * interface in blocks of SPEEX_FLOAT_BLOCK_FRAMES.
+ * Members:
+ *    st - The speex resampler.
+ *    num_channels - Channels in each frame.
+ *    in, out - Float copies of one block of input and output.
+ */
+struct speex_float_src {
+	SpeexResamplerState *st;
+	unsigned int num_channels;
+	float *in;
+	float *out;
+};
+
+static inline int32_t float_to_s32(float sample)
+{
+	sample *= 2147483648.0f;
+	if (sample >= 2147483648.0f)
+		return INT32_MAX;
+	if (sample <= -2147483648.0f)
+		return INT32_MIN;
+	return (int32_t)sample;
+}
+
+static unsigned int speex_float_process(void *state, const uint8_t *in,
+					unsigned int *in_frames, uint8_t *out,
+					unsigned int out_frames)
+{
+	struct speex_float_src *sf = (struct speex_float_src *)state;
+	const int32_t *src = (const int32_t *)in;
+	int32_t *dst = (int32_t *)out;
+	unsigned int in_done = 0, out_done = 0, i;
+	spx_uint32_t in_len, out_len;
+
+	while (in_done < *in_frames && out_done < out_frames) {
+		in_len = MIN(SPEEX_FLOAT_BLOCK_FRAMES, *in_frames - in_done);
+		out_len = MIN(SPEEX_FLOAT_BLOCK_FRAMES, out_frames - out_done);
+		for (i = 0; i < in_len * sf->num_channels; i++)
+			sf->in[i] = src[in_done * sf->num_channels + i] /
+				    2147483648.0f;
+		speex_resampler_process_interleaved_float(
+			sf->st, sf->in, &in_len, sf->out, &out_len);
+		for (i = 0; i < out_len * sf->num_channels; i++)
+			dst[out_done * sf->num_channels + i] =
+				float_to_s32(sf->out[i]);
+		in_done += in_len;
+		out_done += out_len;
+		if (in_len == 0 && out_len == 0)
+			break;
+	}
+	*in_frames = in_done;
+	return out_done;
+}
+
+static void speex_float_destroy(void *state)
+{
+	struct speex_float_src *sf = (struct speex_float_src *)state;
+
+	if (sf->st)
+		speex_resampler_destroy(sf->st);
+	free(sf->in);
+	free(sf->out);
+	free(sf);
+}
+
+static unsigned int speex_float_latency(void *state)
+{
+	struct speex_float_src *sf = (struct speex_float_src *)state;
+
+	return speex_resampler_get_input_latency(sf->st);
+}
+
+static const struct fmt_conv_src_ops speex_float_src_ops = {
+	.process = speex_float_process,
+	.latency = speex_float_latency,
+	.destroy = speex_float_destroy,
+};
+
+static unsigned int polyphase_process(void *state, const uint8_t *in,
+				      unsigned int *in_frames, uint8_t *out,
+				      unsigned int out_frames)
+{
+	return polyphase_resampler_process_s16(
+		(struct polyphase_resampler *)state, (const int16_t *)in,
+		in_frames, (int16_t *)out, out_frames);
+}
+
+static unsigned int polyphase_s32_process(void *state, const uint8_t *in,
+					  unsigned int *in_frames, uint8_t *out,
+					  unsigned int out_frames)
+{
+	return polyphase_resampler_process_s32(
+		(struct polyphase_resampler *)state, (const int32_t *)in,
+		in_frames, (int32_t *)out, out_frames);
+}
+
+static unsigned int polyphase_latency(void *state)
+{
+	return polyphase_resampler_latency(
+		(const struct polyphase_resampler *)state);
+}
+
+static void polyphase_destroy(void *state)
+{
+	polyphase_resampler_destroy((struct polyphase_resampler *)state);
+}
+
+static const struct fmt_conv_src_ops polyphase_src_ops = {
+	.process = polyphase_process,
+	.latency = polyphase_latency,
+	.destroy = polyphase_destroy,
+};
+
+static const struct fmt_conv_src_ops polyphase_s32_src_ops = {
+	.process = polyphase_s32_process,
+	.latency = polyphase_latency,
+	.destroy = polyphase_destroy,
+};
+
+static unsigned int int_ratio_process(void *state, const uint8_t *in,
+				      unsigned int *in_frames, uint8_t *out,
+				      unsigned int out_frames)
+{
+	return int_ratio_resampler_process_s16(
+		(struct int_ratio_resampler *)state, (const int16_t *)in,
+		in_frames, (int16_t *)out, out_frames);
+}
+
+static unsigned int int_ratio_s32_process(void *state, const uint8_t *in,
+					  unsigned int *in_frames, uint8_t *out,
+					  unsigned int out_frames)
+{
+	return int_ratio_resampler_process_s32(
+		(struct int_ratio_resampler *)state, (const int32_t *)in,
+		in_frames, (int32_t *)out, out_frames);
+}
+
+static unsigned int int_ratio_latency(void *state)
+{
+	return int_ratio_resampler_latency(
+		(const struct int_ratio_resampler *)state);
+}
+
+static void int_ratio_destroy(void *state)
+{
+	int_ratio_resampler_destroy((struct int_ratio_resampler *)state);
+}
+
+static const struct fmt_conv_src_ops int_ratio_src_ops = {
+	.process = int_ratio_process,
+	.latency = int_ratio_latency,
+	.destroy = int_ratio_destroy,
+};
+
+static const struct fmt_conv_src_ops int_ratio_s32_src_ops = {
+	.process = int_ratio_s32_process,
+	.latency = int_ratio_latency,
+	.destroy = int_ratio_destroy,
+};
+
 /* Member data for the resampler. */
 struct cras_fmt_conv {
-	SpeexResamplerState *speex_state;
+	const struct fmt_conv_src_ops *src_ops;
+	void *src_state; /* Non-NULL when sample rate conversion is needed. */
 	channel_converter_t channel_converter;
 	float **ch_conv_mtx; /* Coefficient matrix for mixing channels. */
+	/* ch_conv_mtx before gain was applied to it, kept from the first time
+	 * a gain is set. */
+	float **unscaled_mtx;
+	float gain; /* Applied through ch_conv_mtx. */
+	/* Applies ch_conv_mtx, picked for the channel counts. */
+	convert_channels_t matrix_converter;
 	sample_format_converter_t in_format_converter;
 	sample_format_converter_t out_format_converter;
 	struct linear_resampler *resampler;
 	struct cras_audio_format in_fmt;
 	struct cras_audio_format out_fmt;
-	uint8_t *tmp_bufs[MAX_NUM_CONVERTERS - 1];
+	/* Channel and sample rate conversion run on this format, S16_LE or
+	 * S32_LE, between the input and output format converters. */
+	snd_pcm_format_t work_format;
+	size_t tmp_buf_bytes; /* Scratch needed between each two stages. */
 	size_t tmp_buf_frames;
 	size_t pre_linear_resample;
 	size_t num_converters; /* Incremented once for SRC, channel, format. */
+	float *remix_coef; /* The matrix of a channel remix converter. */
+	enum CRAS_MIX_REMIX remix_kind;
 };
 
+/*
+ * Scratch buffers between conversion stages, shared by all the converters
+ * run on a thread. They only hold data within one conversion call, so a
+ * thread needs one set as large as its largest converter, however many
+ * streams and devices it converts for. Grown by the first conversion that
+ * needs more.
+ */
+static __thread uint8_t *scratch_bufs[MAX_NUM_CONVERTERS - 1];
+static __thread size_t scratch_bytes[MAX_NUM_CONVERTERS - 1];
+
+/* Grows the first num_bufs scratch buffers of this thread to hold bytes.
+ * Returns 0 on success or -ENOMEM. */
+static int reserve_scratch(unsigned int num_bufs, size_t bytes)
+{
+	unsigned int i;
+	uint8_t *buf;
+
+	for (i = 0; i < num_bufs; i++) {
+		if (scratch_bytes[i] >= bytes)
+			continue;
+		buf = malloc(bytes);
+		if (!buf)
+			return -ENOMEM;
+		free(scratch_bufs[i]);
+		cras_mem_stats_sub(CRAS_MEM_FMT_CONV, scratch_bytes[i]);
+		cras_mem_stats_add(CRAS_MEM_FMT_CONV, bytes);
+		scratch_bufs[i] = buf;
+		scratch_bytes[i] = bytes;
+	}
+	return 0;
+}
+
+void cras_fmt_conv_release_scratch()
+{
+	unsigned int i;
+
+	for (i = 0; i < MAX_NUM_CONVERTERS - 1; i++) {
+		cras_mem_stats_sub(CRAS_MEM_FMT_CONV, scratch_bytes[i]);
+		free(scratch_bufs[i]);
+		scratch_bufs[i] = NULL;
+		scratch_bytes[i] = 0;
+	}
+}
+
 static int is_channel_layout_equal(const struct cras_audio_format *a,
 				   const struct cras_audio_format *b)
 {
@@ -163,6 +432,113 @@ static void surround51_to_quad_downmix_mtx(float **mtx,
 	normalize(mtx, 4, 6, normalize_factor(mtx[CRAS_CH_FL], 6));
 }
 
+/* Where a channel position missing in the output layout is folded into, as
+ * up to two output positions and their coefficients. The folds of a position
+ * are tried in order, the first one with all its positions in the output
+ * layout is used. */
+struct channel_fold {
+	int8_t ch[2];
+	float coef[2];
+};
+
+#define FOLD1(a, ca) { { a, -1 }, { ca, 0 } }
+#define FOLD2(a, ca, b, cb) { { a, b }, { ca, cb } }
+#define MAX_CHANNEL_FOLDS 3
+
+static const struct channel_fold
+	channel_folds[CRAS_CH_MAX][MAX_CHANNEL_FOLDS] = {
+	[CRAS_CH_FL] = { FOLD1(CRAS_CH_FC, 0.707) },
+	[CRAS_CH_FR] = { FOLD1(CRAS_CH_FC, 0.707) },
+	[CRAS_CH_RL] = { FOLD1(CRAS_CH_SL, 1.0),
+			 FOLD2(CRAS_CH_FL, 0.866, CRAS_CH_FR, 0.5) },
+	[CRAS_CH_RR] = { FOLD1(CRAS_CH_SR, 1.0),
+			 FOLD2(CRAS_CH_FR, 0.866, CRAS_CH_FL, 0.5) },
+	[CRAS_CH_FC] = { FOLD2(CRAS_CH_FL, 0.707, CRAS_CH_FR, 0.707) },
+	[CRAS_CH_LFE] = { FOLD2(CRAS_CH_FL, 0.707, CRAS_CH_FR, 0.707),
+			  FOLD1(CRAS_CH_FC, 0.707) },
+	[CRAS_CH_SL] = { FOLD1(CRAS_CH_RL, 1.0), FOLD1(CRAS_CH_FL, 1.0) },
+	[CRAS_CH_SR] = { FOLD1(CRAS_CH_RR, 1.0), FOLD1(CRAS_CH_FR, 1.0) },
+	[CRAS_CH_RC] = { FOLD2(CRAS_CH_RL, 0.707, CRAS_CH_RR, 0.707),
+			 FOLD2(CRAS_CH_SL, 0.707, CRAS_CH_SR, 0.707),
+			 FOLD2(CRAS_CH_FL, 0.707, CRAS_CH_FR, 0.707) },
+	[CRAS_CH_FLC] = { FOLD1(CRAS_CH_FL, 1.0) },
+	[CRAS_CH_FRC] = { FOLD1(CRAS_CH_FR, 1.0) },
+};
+
+/* Populates the matrix mixing between any two layouts of up to 8 channels,
+ * like 7.1 to stereo or stereo to 7.1, by rules:
+ * 1. A channel position in both layouts maps to itself at full scale.
+ * 2. Any other input position is folded into the output by channel_folds,
+ *    side and rear into each other first, then into the front.
+ * 3. A single input channel is taken as the center, everything mixes into
+ *    a single output channel.
+ * 4. Output positions missing in the input are left silent.
+ * The matrix is scaled down when an output channel would sum more than full
+ * scale, keeping the energy ratio between the channels.
+ * Returns:
+ *    0 on success, -EINVAL if a layout is invalid, or an input channel has
+ *    no position in the input layout or can't be folded into the output.
+ */
+static int layout_mix_mtx(float **mtx, const struct cras_audio_format *in,
+			  const struct cras_audio_format *out)
+{
+	const int8_t *ol = out->channel_layout;
+	unsigned int mapped = 0;
+	float max_sum = 0;
+	int pos, f, k, i, j;
+
+	for (i = 0; i < CRAS_CH_MAX; i++)
+		if (in->channel_layout[i] >= (int)in->num_channels ||
+		    ol[i] >= (int)out->num_channels)
+			return -EINVAL;
+
+	for (i = 0; i < CRAS_CH_MAX; i++) {
+		int ich = in->channel_layout[i];
+
+		if (ich < 0 || (mapped & (1 << ich)))
+			continue;
+		mapped |= 1 << ich;
+		pos = in->num_channels == 1 ? CRAS_CH_FC : i;
+
+		if (out->num_channels == 1) {
+			mtx[0][ich] = 1.0;
+			continue;
+		}
+		if (ol[pos] != -1) {
+			mtx[ol[pos]][ich] = 1.0;
+			continue;
+		}
+		for (f = 0; f < MAX_CHANNEL_FOLDS; f++) {
+			const struct channel_fold *fold;
+
+			fold = &channel_folds[pos][f];
+			if (fold->coef[0] == 0 || ol[fold->ch[0]] == -1)
+				continue;
+			if (fold->ch[1] != -1 && ol[fold->ch[1]] == -1)
+				continue;
+			for (k = 0; k < 2 && fold->ch[k] != -1; k++)
+				mtx[ol[fold->ch[k]]][ich] = fold->coef[k];
+			break;
+		}
+		if (f == MAX_CHANNEL_FOLDS)
+			return -EINVAL;
+	}
+	if (mapped != (1u << in->num_channels) - 1)
+		return -EINVAL;
+
+	for (i = 0; i < out->num_channels; i++) {
+		float sum = 0;
+
+		for (j = 0; j < in->num_channels; j++)
+			sum += fabs(mtx[i][j]);
+		max_sum = MAX(max_sum, sum);
+	}
+	if (max_sum > 1.0)
+		normalize(mtx, out->num_channels, in->num_channels,
+			  1.0 / max_sum);
+	return 0;
+}
+
 static int is_supported_format(const struct cras_audio_format *fmt)
 {
 	if (!fmt)
@@ -174,21 +550,45 @@ static int is_supported_format(const struct cras_audio_format *fmt)
 	case SND_PCM_FORMAT_S24_3LE:
 	case SND_PCM_FORMAT_S24_LE:
 	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_FLOAT_LE:
 		return 1;
 	default:
 		return 0;
 	}
 }
 
+/* Returns the sample format channel and rate conversion should run on. Formats
+ * wider than 16 bits stay in S32_LE all the way through, so a 24 bit stream
+ * going to a 24 bit device isn't narrowed to S16_LE on the way. Float samples
+ * take the S32_LE path as well, which keeps their 24 bit mantissa. */
+static snd_pcm_format_t
+choose_work_format(const struct cras_audio_format *in,
+		   const struct cras_audio_format *out)
+{
+	if (snd_pcm_format_width(in->format) > 16 ||
+	    snd_pcm_format_width(out->format) > 16)
+		return SND_PCM_FORMAT_S32_LE;
+	return SND_PCM_FORMAT_S16_LE;
+}
+
+static inline int is_s32(const struct cras_fmt_conv *conv)
+{
+	return conv->work_format == SND_PCM_FORMAT_S32_LE;
+}
+
 static size_t mono_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 			     size_t in_frames, uint8_t *out)
 {
+	if (is_s32(conv))
+		return s32_mono_to_stereo(in, in_frames, out);
 	return s16_mono_to_stereo(in, in_frames, out);
 }
 
 static size_t stereo_to_mono(struct cras_fmt_conv *conv, const uint8_t *in,
 			     size_t in_frames, uint8_t *out)
 {
+	if (is_s32(conv))
+		return s32_stereo_to_mono(in, in_frames, out);
 	return s16_stereo_to_mono(in, in_frames, out);
 }
 
@@ -201,6 +601,8 @@ static size_t mono_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	right = conv->out_fmt.channel_layout[CRAS_CH_FR];
 	center = conv->out_fmt.channel_layout[CRAS_CH_FC];
 
+	if (is_s32(conv))
+		return s32_mono_to_51(left, right, center, in, in_frames, out);
 	return s16_mono_to_51(left, right, center, in, in_frames, out);
 }
 
@@ -213,6 +615,9 @@ static size_t stereo_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	right = conv->out_fmt.channel_layout[CRAS_CH_FR];
 	center = conv->out_fmt.channel_layout[CRAS_CH_FC];
 
+	if (is_s32(conv))
+		return s32_stereo_to_51(left, right, center, in, in_frames,
+					out);
 	return s16_stereo_to_51(left, right, center, in, in_frames, out);
 }
 
@@ -226,18 +631,24 @@ static size_t quad_to_51(struct cras_fmt_conv *conv, const uint8_t *in,
 	rl = conv->out_fmt.channel_layout[CRAS_CH_RL];
 	rr = conv->out_fmt.channel_layout[CRAS_CH_RR];
 
+	if (is_s32(conv))
+		return s32_quad_to_51(fl, fr, rl, rr, in, in_frames, out);
 	return s16_quad_to_51(fl, fr, rl, rr, in, in_frames, out);
 }
 
 static size_t _51_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 			    size_t in_frames, uint8_t *out)
 {
+	if (is_s32(conv))
+		return s32_51_to_stereo(in, in_frames, out);
 	return s16_51_to_stereo(in, in_frames, out);
 }
 
 static size_t _51_to_quad(struct cras_fmt_conv *conv, const uint8_t *in,
 			  size_t in_frames, uint8_t *out)
 {
+	if (is_s32(conv))
+		return s32_51_to_quad(in, in_frames, out);
 	return s16_51_to_quad(in, in_frames, out);
 }
 
@@ -251,6 +662,9 @@ static size_t stereo_to_quad(struct cras_fmt_conv *conv, const uint8_t *in,
 	rear_left = conv->out_fmt.channel_layout[CRAS_CH_RL];
 	rear_right = conv->out_fmt.channel_layout[CRAS_CH_RR];
 
+	if (is_s32(conv))
+		return s32_stereo_to_quad(front_left, front_right, rear_left,
+					  rear_right, in, in_frames, out);
 	return s16_stereo_to_quad(front_left, front_right, rear_left,
 				  rear_right, in, in_frames, out);
 }
@@ -265,6 +679,9 @@ static size_t quad_to_stereo(struct cras_fmt_conv *conv, const uint8_t *in,
 	rear_left = conv->in_fmt.channel_layout[CRAS_CH_RL];
 	rear_right = conv->in_fmt.channel_layout[CRAS_CH_RR];
 
+	if (is_s32(conv))
+		return s32_quad_to_stereo(front_left, front_right, rear_left,
+					  rear_right, in, in_frames, out);
 	return s16_quad_to_stereo(front_left, front_right, rear_left,
 				  rear_right, in, in_frames, out);
 }
@@ -277,6 +694,9 @@ static size_t default_all_to_all(struct cras_fmt_conv *conv, const uint8_t *in,
 	num_in_ch = conv->in_fmt.num_channels;
 	num_out_ch = conv->out_fmt.num_channels;
 
+	if (is_s32(conv))
+		return s32_default_all_to_all(&conv->out_fmt, num_in_ch,
+					      num_out_ch, in, in_frames, out);
 	return s16_default_all_to_all(&conv->out_fmt, num_in_ch, num_out_ch, in,
 				      in_frames, out);
 }
@@ -292,6 +712,9 @@ static size_t default_some_to_some(struct cras_fmt_conv *conv,
 	num_in_ch = conv->in_fmt.num_channels;
 	num_out_ch = conv->out_fmt.num_channels;
 
+	if (is_s32(conv))
+		return s32_some_to_some(&conv->out_fmt, num_in_ch, num_out_ch,
+					in, in_frames, out);
 	return s16_some_to_some(&conv->out_fmt, num_in_ch, num_out_ch, in,
 				in_frames, out);
 }
@@ -299,28 +722,181 @@ static size_t default_some_to_some(struct cras_fmt_conv *conv,
 static size_t convert_channels(struct cras_fmt_conv *conv, const uint8_t *in,
 			       size_t in_frames, uint8_t *out)
 {
-	float **ch_conv_mtx;
-	size_t num_in_ch, num_out_ch;
+	return conv->matrix_converter(conv->ch_conv_mtx,
+				      conv->in_fmt.num_channels,
+				      conv->out_fmt.num_channels, in, in_frames,
+				      out);
+}
 
-	ch_conv_mtx = conv->ch_conv_mtx;
-	num_in_ch = conv->in_fmt.num_channels;
-	num_out_ch = conv->out_fmt.num_channels;
+/* Returns the converter from fmt to work, NULL if they're the same. */
+static sample_format_converter_t in_format_converter(snd_pcm_format_t fmt,
+						     snd_pcm_format_t work)
+{
+	if (fmt == work)
+		return NULL;
+	if (work == SND_PCM_FORMAT_S32_LE) {
+		switch (fmt) {
+		case SND_PCM_FORMAT_U8:
+			return convert_u8_to_s32le;
+		case SND_PCM_FORMAT_S16_LE:
+			return convert_s16le_to_s32le;
+		case SND_PCM_FORMAT_S24_LE:
+			return convert_s24le_to_s32le;
+		case SND_PCM_FORMAT_S24_3LE:
+			return convert_s243le_to_s32le;
+		case SND_PCM_FORMAT_FLOAT_LE:
+			return convert_f32le_to_s32le;
+		default:
+			break;
+		}
+	} else {
+		switch (fmt) {
+		case SND_PCM_FORMAT_U8:
+			return convert_u8_to_s16le;
+		case SND_PCM_FORMAT_S24_LE:
+			return convert_s24le_to_s16le;
+		case SND_PCM_FORMAT_S32_LE:
+			return convert_s32le_to_s16le;
+		case SND_PCM_FORMAT_S24_3LE:
+			return convert_s243le_to_s16le;
+		default:
+			break;
+		}
+	}
+	syslog(LOG_ERR, "Should never reachable");
+	return NULL;
+}
 
-	return s16_convert_channels(ch_conv_mtx, num_in_ch, num_out_ch, in,
-				    in_frames, out);
+/* Returns the converter from work to fmt, NULL if they're the same. */
+static sample_format_converter_t out_format_converter(snd_pcm_format_t fmt,
+						      snd_pcm_format_t work)
+{
+	if (fmt == work)
+		return NULL;
+	if (work == SND_PCM_FORMAT_S32_LE) {
+		switch (fmt) {
+		case SND_PCM_FORMAT_U8:
+			return convert_s32le_to_u8;
+		case SND_PCM_FORMAT_S16_LE:
+			return convert_s32le_to_s16le;
+		case SND_PCM_FORMAT_S24_LE:
+			return convert_s32le_to_s24le;
+		case SND_PCM_FORMAT_S24_3LE:
+			return convert_s32le_to_s243le;
+		case SND_PCM_FORMAT_FLOAT_LE:
+			return convert_s32le_to_f32le;
+		default:
+			break;
+		}
+	} else {
+		switch (fmt) {
+		case SND_PCM_FORMAT_U8:
+			return convert_s16le_to_u8;
+		case SND_PCM_FORMAT_S24_LE:
+			return convert_s16le_to_s24le;
+		case SND_PCM_FORMAT_S32_LE:
+			return convert_s16le_to_s32le;
+		case SND_PCM_FORMAT_S24_3LE:
+			return convert_s16le_to_s243le;
+		default:
+			break;
+		}
+	}
+	syslog(LOG_ERR, "Should never reachable");
+	return NULL;
 }
 
 /*
  * Exported interface
  */
 
+/* Creates the sample rate converter for the given quality, falling back to
+ * speex when the polyphase bank can't serve the rate pair. The default
+ * quality takes the integer ratio resampler for rates like 48000 to 16000,
+ * which skips the work on the filter's zero taps. */
+static int create_src(struct cras_fmt_conv *conv,
+		      enum CRAS_RESAMPLER_QUALITY quality)
+{
+	const struct cras_audio_format *in = &conv->in_fmt;
+	const struct cras_audio_format *out = &conv->out_fmt;
+	struct speex_float_src *sf;
+	SpeexResamplerState *st;
+	int rc;
+
+	if (quality != CRAS_RESAMPLER_QUALITY_DEFAULT) {
+		conv->src_state = polyphase_resampler_create(
+			out->num_channels, in->frame_rate, out->frame_rate,
+			(enum POLYPHASE_QUALITY)(quality - 1));
+		if (conv->src_state) {
+			conv->src_ops = is_s32(conv) ? &polyphase_s32_src_ops :
+						       &polyphase_src_ops;
+			return 0;
+		}
+		syslog(LOG_DEBUG, "No polyphase bank for %zu to %zu Hz.",
+		       in->frame_rate, out->frame_rate);
+	}
+
+	if (quality == CRAS_RESAMPLER_QUALITY_DEFAULT) {
+		conv->src_state = int_ratio_resampler_create(
+			out->num_channels, in->frame_rate, out->frame_rate);
+		if (conv->src_state) {
+			conv->src_ops = is_s32(conv) ? &int_ratio_s32_src_ops :
+						       &int_ratio_src_ops;
+			return 0;
+		}
+	}
+
+	st = speex_resampler_init(out->num_channels, in->frame_rate,
+				  out->frame_rate, SPEEX_QUALITY_LEVEL, &rc);
+	if (st == NULL) {
+		syslog(LOG_ERR, "Fail to create speex:%zu %zu %zu %d",
+		       out->num_channels, in->frame_rate, out->frame_rate, rc);
+		return -ENOMEM;
+	}
+	if (!is_s32(conv)) {
+		conv->src_state = st;
+		conv->src_ops = &speex_src_ops;
+		return 0;
+	}
+
+	sf = calloc(1, sizeof(*sf));
+	if (sf == NULL) {
+		speex_resampler_destroy(st);
+		return -ENOMEM;
+	}
+	sf->st = st;
+	sf->num_channels = out->num_channels;
+	sf->in = calloc(SPEEX_FLOAT_BLOCK_FRAMES * out->num_channels,
+			sizeof(*sf->in));
+	sf->out = calloc(SPEEX_FLOAT_BLOCK_FRAMES * out->num_channels,
+			 sizeof(*sf->out));
+	if (sf->in == NULL || sf->out == NULL) {
+		speex_float_destroy(sf);
+		return -ENOMEM;
+	}
+	conv->src_state = sf;
+	conv->src_ops = &speex_float_src_ops;
+	return 0;
+}
+
 struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 					   const struct cras_audio_format *out,
 					   size_t max_frames,
 					   size_t pre_linear_resample)
+{
+	return cras_fmt_conv_create_with_quality(
+		in, out, max_frames, pre_linear_resample,
+		CRAS_RESAMPLER_QUALITY_DEFAULT);
+}
+
+struct cras_fmt_conv *
+cras_fmt_conv_create_with_quality(const struct cras_audio_format *in,
+				  const struct cras_audio_format *out,
+				  size_t max_frames, size_t pre_linear_resample,
+				  enum CRAS_RESAMPLER_QUALITY quality)
 {
 	struct cras_fmt_conv *conv;
-	int rc;
+	size_t lr_channels;
 	unsigned i;
 
 	conv = calloc(1, sizeof(*conv));
@@ -330,6 +906,7 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 	conv->out_fmt = *out;
 	conv->tmp_buf_frames = max_frames;
 	conv->pre_linear_resample = pre_linear_resample;
+	conv->gain = 1.0f;
 
 	if (!is_supported_format(in)) {
 		syslog(LOG_ERR, "Invalid input format %d", in->format);
@@ -343,52 +920,21 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 		return NULL;
 	}
 
-	/* Set up sample format conversion. */
-	/* TODO(dgreid) - modify channel and sample rate conversion so
-	 * converting to s16 isnt necessary. */
-	if (in->format != SND_PCM_FORMAT_S16_LE) {
+	/* Set up sample format conversion to and from the working format. */
+	conv->work_format = choose_work_format(in, out);
+	conv->in_format_converter =
+		in_format_converter(in->format, conv->work_format);
+	if (conv->in_format_converter) {
 		conv->num_converters++;
 		syslog(LOG_DEBUG, "Convert from format %d to %d.", in->format,
-		       out->format);
-		switch (in->format) {
-		case SND_PCM_FORMAT_U8:
-			conv->in_format_converter = convert_u8_to_s16le;
-			break;
-		case SND_PCM_FORMAT_S24_LE:
-			conv->in_format_converter = convert_s24le_to_s16le;
-			break;
-		case SND_PCM_FORMAT_S32_LE:
-			conv->in_format_converter = convert_s32le_to_s16le;
-			break;
-		case SND_PCM_FORMAT_S24_3LE:
-			conv->in_format_converter = convert_s243le_to_s16le;
-			break;
-		default:
-			syslog(LOG_ERR, "Should never reachable");
-			break;
-		}
+		       conv->work_format);
 	}
-	if (out->format != SND_PCM_FORMAT_S16_LE) {
+	conv->out_format_converter =
+		out_format_converter(out->format, conv->work_format);
+	if (conv->out_format_converter) {
 		conv->num_converters++;
-		syslog(LOG_DEBUG, "Convert from format %d to %d.", in->format,
-		       out->format);
-		switch (out->format) {
-		case SND_PCM_FORMAT_U8:
-			conv->out_format_converter = convert_s16le_to_u8;
-			break;
-		case SND_PCM_FORMAT_S24_LE:
-			conv->out_format_converter = convert_s16le_to_s24le;
-			break;
-		case SND_PCM_FORMAT_S32_LE:
-			conv->out_format_converter = convert_s16le_to_s32le;
-			break;
-		case SND_PCM_FORMAT_S24_3LE:
-			conv->out_format_converter = convert_s16le_to_s243le;
-			break;
-		default:
-			syslog(LOG_ERR, "Should never reachable");
-			break;
-		}
+		syslog(LOG_DEBUG, "Convert from format %d to %d.",
+		       conv->work_format, out->format);
 	}
 
 	/* Set up channel number conversion. */
@@ -451,11 +997,24 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 					conv->channel_converter = _51_to_stereo;
 			}
 		} else if (in->num_channels <= 8 && out->num_channels <= 8) {
-			// For average channel counts mix from all to all.
-			syslog(LOG_WARNING,
-			       "Using all_to_all map for %zu to %zu",
-			       in->num_channels, out->num_channels);
-			conv->channel_converter = default_all_to_all;
+			conv->ch_conv_mtx = cras_channel_conv_matrix_alloc(
+				in->num_channels, out->num_channels);
+			if (conv->ch_conv_mtx == NULL) {
+				cras_fmt_conv_destroy(&conv);
+				return NULL;
+			}
+			if (layout_mix_mtx(conv->ch_conv_mtx, in, out) == 0) {
+				conv->channel_converter = convert_channels;
+			} else {
+				// Without usable layouts mix from all to all.
+				syslog(LOG_WARNING,
+				       "Using all_to_all map for %zu to %zu",
+				       in->num_channels, out->num_channels);
+				cras_channel_conv_matrix_destroy(
+					conv->ch_conv_mtx, out->num_channels);
+				conv->ch_conv_mtx = NULL;
+				conv->channel_converter = default_all_to_all;
+			}
 		} else {
 			syslog(LOG_WARNING,
 			       "Using some_to_some channel map for %zu to %zu",
@@ -474,19 +1033,21 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 			conv->channel_converter = convert_channels;
 		}
 	}
+	if (conv->channel_converter == convert_channels) {
+		if (is_s32(conv))
+			conv->matrix_converter = s32_convert_channels_func(
+				in->num_channels, out->num_channels);
+		else
+			conv->matrix_converter = s16_convert_channels_func(
+				in->num_channels, out->num_channels);
+	}
+
 	/* Set up sample rate conversion. */
 	if (in->frame_rate != out->frame_rate) {
 		conv->num_converters++;
 		syslog(LOG_DEBUG, "Convert from %zu to %zu Hz.", in->frame_rate,
 		       out->frame_rate);
-		conv->speex_state =
-			speex_resampler_init(out->num_channels, in->frame_rate,
-					     out->frame_rate,
-					     SPEEX_QUALITY_LEVEL, &rc);
-		if (conv->speex_state == NULL) {
-			syslog(LOG_ERR, "Fail to create speex:%zu %zu %zu %d",
-			       out->num_channels, in->frame_rate,
-			       out->frame_rate, rc);
+		if (create_src(conv, quality)) {
 			cras_fmt_conv_destroy(&conv);
 			return NULL;
 		}
@@ -498,30 +1059,28 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 	 * Note: intended to give both src_rate and dst_rate the same value
 	 * (i.e. out->frame_rate).  They will be updated in runtime in
 	 * update_estimated_rate() when the audio thread wants to adjust the
-	 * rate for inaccurate device consumption rate.
+	 * rate for inaccurate device consumption rate. It runs on the
+	 * working format, right after the input format conversion when
+	 * resampling before channel conversion.
 	 */
 	conv->num_converters++;
-	conv->resampler =
-		linear_resampler_create(out->num_channels,
-					cras_get_format_bytes(out),
-					out->frame_rate, out->frame_rate);
+	lr_channels = pre_linear_resample ? in->num_channels :
+					    out->num_channels;
+	conv->resampler = linear_resampler_create(
+		lr_channels,
+		lr_channels * snd_pcm_format_physical_width(conv->work_format) /
+			8,
+		out->frame_rate, out->frame_rate);
 	if (conv->resampler == NULL) {
 		syslog(LOG_ERR, "Fail to create linear resampler");
 		cras_fmt_conv_destroy(&conv);
 		return NULL;
 	}
 
-	/* Need num_converters-1 temp buffers, the final converter renders
+	/* Need num_converters-1 scratch buffers, the final converter renders
 	 * directly into the output. */
-	for (i = 0; i < conv->num_converters - 1; i++) {
-		conv->tmp_bufs[i] = malloc(
-			max_frames * 4 * /* width in bytes largest format. */
-			MAX(in->num_channels, out->num_channels));
-		if (conv->tmp_bufs[i] == NULL) {
-			cras_fmt_conv_destroy(&conv);
-			return NULL;
-		}
-	}
+	conv->tmp_buf_bytes = max_frames * 4 * /* width in bytes largest. */
+			      MAX(in->num_channels, out->num_channels);
 
 	assert(conv->num_converters <= MAX_NUM_CONVERTERS);
 
@@ -530,18 +1089,19 @@ struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 
 void cras_fmt_conv_destroy(struct cras_fmt_conv **convp)
 {
-	unsigned i;
 	struct cras_fmt_conv *conv = *convp;
 
 	if (conv->ch_conv_mtx)
 		cras_channel_conv_matrix_destroy(conv->ch_conv_mtx,
 						 conv->out_fmt.num_channels);
-	if (conv->speex_state)
-		speex_resampler_destroy(conv->speex_state);
+	if (conv->unscaled_mtx)
+		cras_channel_conv_matrix_destroy(conv->unscaled_mtx,
+						 conv->out_fmt.num_channels);
+	if (conv->src_state)
+		conv->src_ops->destroy(conv->src_state);
 	if (conv->resampler)
 		linear_resampler_destroy(conv->resampler);
-	for (i = 0; i < MAX_NUM_CONVERTERS - 1; i++)
-		free(conv->tmp_bufs[i]);
+	free(conv->remix_coef);
 	free(conv);
 	*convp = NULL;
 }
@@ -550,7 +1110,7 @@ struct cras_fmt_conv *cras_channel_remix_conv_create(unsigned int num_channels,
 						     const float *coefficient)
 {
 	struct cras_fmt_conv *conv;
-	unsigned out_ch, in_ch;
+	size_t coef_bytes = num_channels * num_channels * sizeof(float);
 
 	conv = calloc(1, sizeof(*conv));
 	if (conv == NULL)
@@ -558,17 +1118,16 @@ struct cras_fmt_conv *cras_channel_remix_conv_create(unsigned int num_channels,
 	conv->in_fmt.num_channels = num_channels;
 	conv->out_fmt.num_channels = num_channels;
 
-	conv->ch_conv_mtx =
-		cras_channel_conv_matrix_alloc(num_channels, num_channels);
-	/* Convert the coeffiencnt array to conversion matrix. */
-	for (out_ch = 0; out_ch < num_channels; out_ch++)
-		for (in_ch = 0; in_ch < num_channels; in_ch++)
-			conv->ch_conv_mtx[out_ch][in_ch] =
-				coefficient[in_ch + out_ch * num_channels];
+	conv->remix_coef = malloc(coef_bytes);
+	if (conv->remix_coef == NULL) {
+		free(conv);
+		return NULL;
+	}
+	memcpy(conv->remix_coef, coefficient, coef_bytes);
+	/* Swapped or mono speakers take a plain copy or a single mix. */
+	conv->remix_kind = cras_mix_remix_kind(coefficient, num_channels);
 
 	conv->num_converters = 1;
-	conv->tmp_bufs[0] = malloc(4 * /* width in bytes largest format. */
-				   num_channels);
 	return conv;
 }
 
@@ -576,30 +1135,25 @@ void cras_channel_remix_convert(struct cras_fmt_conv *conv,
 				const struct cras_audio_format *fmt,
 				uint8_t *in_buf, size_t nframes)
 {
-	unsigned ch, fr;
-	int16_t *tmp = (int16_t *)conv->tmp_bufs[0];
-	int16_t *buf = (int16_t *)in_buf;
-
-	/*
-	 * Skip remix for non S16_LE format.
-	 * TODO(tzungbi): support 24 bits remix convert.
-	 */
-	if (fmt->format != SND_PCM_FORMAT_S16_LE)
-		return;
-
-	/* Do remix only when input buffer has the same number of channels. */
+	/* Do remix only when input buffer has the same number of channels.
+	 * Formats the mixer doesn't remix are left as they are. */
 	if (fmt->num_channels != conv->in_fmt.num_channels)
 		return;
 
-	for (fr = 0; fr < nframes; fr++) {
-		for (ch = 0; ch < conv->in_fmt.num_channels; ch++)
-			tmp[ch] = s16_multiply_buf_with_coef(
-				conv->ch_conv_mtx[ch], buf,
-				conv->in_fmt.num_channels);
-		for (ch = 0; ch < conv->in_fmt.num_channels; ch++)
-			buf[ch] = tmp[ch];
-		buf += conv->in_fmt.num_channels;
-	}
+	cras_mix_remix(fmt->format, in_buf, nframes, fmt->num_channels,
+		       conv->remix_coef, conv->remix_kind);
+}
+
+int cras_channel_remix_convert_planar(struct cras_fmt_conv *conv,
+				      float *const *planes,
+				      unsigned int num_planes, size_t nframes)
+{
+	if (num_planes != conv->in_fmt.num_channels)
+		return 0;
+
+	cras_mix_remix_planar(planes, nframes, num_planes, conv->remix_coef,
+			      conv->remix_kind);
+	return 1;
 }
 
 const struct cras_audio_format *
@@ -647,12 +1201,107 @@ size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 	return out_frames;
 }
 
+size_t cras_fmt_conv_delay_frames(const struct cras_fmt_conv *conv)
+{
+	if (!conv || !conv->src_state)
+		return 0;
+	return conv->src_ops->latency(conv->src_state);
+}
+
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv *conv,
 					     float from, float to)
 {
 	linear_resampler_set_rates(conv->resampler, from, to);
 }
 
+/* Runs format, channel and sample rate conversion over at most
+ * FUSED_BLOCK_FRAMES input frames at a time. Each block goes through every
+ * stage before the next one starts, reusing the head of the temp buffers,
+ * instead of each stage sweeping the whole period through its own buffer.
+ * Only used when the linear resampler is idle.
+ * Args:
+ *    conv - The format converter.
+ *    in_buf - Input frames.
+ *    out_buf - Output buffer.
+ *    in_frames - Frames available in in_buf, set to the number consumed.
+ *    out_frames - Frames out_buf can hold.
+ *    num_stages - The number of conversion stages in use.
+ * Returns:
+ *    The number of frames written to out_buf.
+ */
+static size_t convert_frames_blocked(struct cras_fmt_conv *conv,
+				     const uint8_t *in_buf, uint8_t *out_buf,
+				     unsigned int *in_frames,
+				     size_t out_frames,
+				     unsigned int num_stages)
+{
+	const size_t in_frame_bytes = cras_get_format_bytes(&conv->in_fmt);
+	const size_t out_frame_bytes = cras_get_format_bytes(&conv->out_fmt);
+	unsigned int in_done = 0, out_done = 0;
+	unsigned int total_in = *in_frames;
+	uint8_t *buffers[MAX_NUM_CONVERTERS + 1];
+	unsigned int fr_in, fr_out, i;
+	size_t buf_idx;
+
+	/* Without SRC every input frame makes one output frame. */
+	if (conv->src_state == NULL)
+		total_in = MIN(total_in, out_frames);
+
+	while (in_done < total_in && out_done < out_frames) {
+		fr_in = MIN(FUSED_BLOCK_FRAMES, total_in - in_done);
+		fr_out = fr_in;
+
+		buffers[0] = (uint8_t *)in_buf + in_done * in_frame_bytes;
+		for (i = 1; i < num_stages; i++)
+			buffers[i] = scratch_bufs[i - 1];
+		buffers[num_stages] = out_buf + out_done * out_frame_bytes;
+		buf_idx = 0;
+
+		if (conv->in_format_converter) {
+			conv->in_format_converter(
+				buffers[buf_idx],
+				fr_in * conv->in_fmt.num_channels,
+				buffers[buf_idx + 1]);
+			buf_idx++;
+		}
+
+		if (conv->channel_converter != NULL) {
+			conv->channel_converter(conv, buffers[buf_idx], fr_in,
+						buffers[buf_idx + 1]);
+			buf_idx++;
+		}
+
+		if (conv->src_state != NULL) {
+			fr_out = cras_frames_at_rate(conv->in_fmt.frame_rate,
+						     fr_in,
+						     conv->out_fmt.frame_rate);
+			fr_out = MIN(fr_out, out_frames - out_done);
+			fr_out = conv->src_ops->process(
+				conv->src_state, buffers[buf_idx], &fr_in,
+				buffers[buf_idx + 1], fr_out);
+			buf_idx++;
+		}
+
+		if (conv->out_format_converter) {
+			conv->out_format_converter(
+				buffers[buf_idx],
+				fr_out * conv->out_fmt.num_channels,
+				buffers[buf_idx + 1]);
+			buf_idx++;
+		}
+
+		in_done += fr_in;
+		out_done += fr_out;
+
+		/* The resampler stopped short, the output is full. */
+		if (fr_in == 0)
+			break;
+	}
+
+	*in_frames = in_done;
+	return out_done;
+}
+
 size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 				    const uint8_t *in_buf, uint8_t *out_buf,
 				    unsigned int *in_frames, size_t out_frames)
@@ -669,13 +1318,22 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	assert(conv);
 	assert(*in_frames <= conv->tmp_buf_frames);
 
+	if (reserve_scratch(conv->num_converters - 1, conv->tmp_buf_bytes)) {
+		*in_frames = 0;
+		return 0;
+	}
+
 	if (linear_resampler_needed(conv->resampler)) {
 		post_linear_resample = !conv->pre_linear_resample;
 		pre_linear_resample = conv->pre_linear_resample;
+	} else if (used_converters > 2 && *in_frames > FUSED_BLOCK_FRAMES) {
+		/* The linear resampler isn't counted as a stage here. */
+		return convert_frames_blocked(conv, in_buf, out_buf, in_frames,
+					      out_frames, used_converters - 1);
 	}
 
 	/* If no SRC, then in_frames should = out_frames. */
-	if (conv->speex_state == NULL) {
+	if (conv->src_state == NULL) {
 		fr_in = MIN(*in_frames, out_frames);
 		if (out_frames < *in_frames && !logged_frames_dont_fit) {
 			syslog(LOG_INFO, "fmt_conv: %u to %zu no SRC.",
@@ -693,13 +1351,21 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	if (!linear_resampler_needed(conv->resampler))
 		used_converters--;
 
-	buffers[4] = (uint8_t *)conv->tmp_bufs[3];
-	buffers[3] = (uint8_t *)conv->tmp_bufs[2];
-	buffers[2] = (uint8_t *)conv->tmp_bufs[1];
-	buffers[1] = (uint8_t *)conv->tmp_bufs[0];
+	buffers[4] = scratch_bufs[3];
+	buffers[3] = scratch_bufs[2];
+	buffers[2] = scratch_bufs[1];
+	buffers[1] = scratch_bufs[0];
 	buffers[0] = (uint8_t *)in_buf;
 	buffers[used_converters] = out_buf;
 
+	/* Convert the input format to the working format. */
+	if (conv->in_format_converter) {
+		conv->in_format_converter(buffers[buf_idx],
+					  fr_in * conv->in_fmt.num_channels,
+					  (uint8_t *)buffers[buf_idx + 1]);
+		buf_idx++;
+	}
+
 	if (pre_linear_resample) {
 		linear_resample_fr = fr_in;
 		unsigned resample_limit = out_frames;
@@ -708,7 +1374,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		 * resample limit and round it to the lower bound in order
 		 * not to convert too many frames in the pre linear resampler.
 		 */
-		if (conv->speex_state != NULL) {
+		if (conv->src_state != NULL) {
 			resample_limit = resample_limit *
 					 conv->in_fmt.frame_rate /
 					 conv->out_fmt.frame_rate;
@@ -729,14 +1395,6 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		buf_idx++;
 	}
 
-	/* If the input format isn't S16_LE convert to it. */
-	if (conv->in_fmt.format != SND_PCM_FORMAT_S16_LE) {
-		conv->in_format_converter(buffers[buf_idx],
-					  fr_in * conv->in_fmt.num_channels,
-					  (uint8_t *)buffers[buf_idx + 1]);
-		buf_idx++;
-	}
-
 	/* Then channel conversion. */
 	if (conv->channel_converter != NULL) {
 		conv->channel_converter(conv, buffers[buf_idx], fr_in,
@@ -745,7 +1403,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	}
 
 	/* Then SRC. */
-	if (conv->speex_state != NULL) {
+	if (conv->src_state != NULL) {
 		unsigned int out_limit = out_frames;
 
 		if (post_linear_resample)
@@ -761,9 +1419,9 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		}
 		/* limit frames to the output size. */
 		fr_out = MIN(fr_out, out_limit);
-		speex_resampler_process_interleaved_int(
-			conv->speex_state, (int16_t *)buffers[buf_idx], &fr_in,
-			(int16_t *)buffers[buf_idx + 1], &fr_out);
+		fr_out = conv->src_ops->process(conv->src_state,
+						buffers[buf_idx], &fr_in,
+						buffers[buf_idx + 1], fr_out);
 		buf_idx++;
 	}
 
@@ -776,8 +1434,8 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		buf_idx++;
 	}
 
-	/* If the output format isn't S16_LE convert to it. */
-	if (conv->out_fmt.format != SND_PCM_FORMAT_S16_LE) {
+	/* Convert from the working format to the output format. */
+	if (conv->out_format_converter) {
 		conv->out_format_converter(buffers[buf_idx],
 					   fr_out * conv->out_fmt.num_channels,
 					   (uint8_t *)buffers[buf_idx + 1]);
@@ -796,7 +1454,7 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 		 * leak and, if accumulated, causes delay in multiple devices
 		 * use case.
 		 */
-		if (conv->speex_state && (fr_in == 0))
+		if (conv->src_state && (fr_in == 0))
 			*in_frames = 0;
 	} else {
 		*in_frames = fr_in;
@@ -804,12 +1462,50 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
 	return fr_out;
 }
 
+float cras_fmt_conv_set_gain(struct cras_fmt_conv *conv, float gain)
+{
+	size_t num_in_ch = conv->in_fmt.num_channels;
+	size_t num_out_ch = conv->out_fmt.num_channels;
+	size_t i, j;
+
+	if (conv->channel_converter != convert_channels)
+		return gain;
+	if (gain == conv->gain)
+		return 1.0f;
+
+	if (!conv->unscaled_mtx) {
+		conv->unscaled_mtx =
+			cras_channel_conv_matrix_alloc(num_in_ch, num_out_ch);
+		if (!conv->unscaled_mtx)
+			return gain;
+		for (i = 0; i < num_out_ch; i++)
+			memcpy(conv->unscaled_mtx[i], conv->ch_conv_mtx[i],
+			       num_in_ch * sizeof(float));
+	}
+	for (i = 0; i < num_out_ch; i++)
+		for (j = 0; j < num_in_ch; j++)
+			conv->ch_conv_mtx[i][j] =
+				conv->unscaled_mtx[i][j] * gain;
+	conv->gain = gain;
+	return 1.0f;
+}
+
 int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv)
 {
 	return linear_resampler_needed(conv->resampler) ||
 	       (conv->num_converters > 1);
 }
 
+int cras_fmt_conv_resampling(const struct cras_fmt_conv *conv)
+{
+	return conv->src_state || linear_resampler_needed(conv->resampler);
+}
+
+int cras_fmt_conv_format_only(const struct cras_fmt_conv *conv)
+{
+	return !conv->channel_converter && !cras_fmt_conv_resampling(conv);
+}
+
 /* If the server cannot provide the requested format, configures an audio format
  * converter that handles transforming the input format to the format used by
  * the server. */
@@ -817,7 +1513,8 @@ int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
 			    const struct cras_audio_format *from,
 			    const struct cras_audio_format *to,
-			    unsigned int frames)
+			    unsigned int frames,
+			    enum CRAS_RESAMPLER_QUALITY quality)
 {
 	struct cras_audio_format target;
 
@@ -836,8 +1533,8 @@ int config_format_converter(struct cras_fmt_conv **conv,
 	       "frames = %u",
 	       from->format, from->frame_rate, from->num_channels,
 	       target.format, target.frame_rate, target.num_channels, frames);
-	*conv = cras_fmt_conv_create(from, &target, frames,
-				     (dir == CRAS_STREAM_INPUT));
+	*conv = cras_fmt_conv_create_with_quality(
+		from, &target, frames, (dir == CRAS_STREAM_INPUT), quality);
 	if (!*conv) {
 		syslog(LOG_ERR, "Failed to create format converter");
 		return -ENOMEM;
@@ -4,8 +4,8 @@
  */
 
 /*
- * Used to convert from one audio format to another.  Currently only supports
- * sample rate conversion with the speex backend.
+ * Used to convert from one audio format to another.  Sample rate conversion
+ * uses either the speex backend or the polyphase resampler.
  */
 #ifndef CRAS_FMT_CONV_H_
 #define CRAS_FMT_CONV_H_
@@ -18,11 +18,26 @@
 struct cras_audio_format;
 struct cras_fmt_conv;
 
+/* Sample rate conversion quality. DEFAULT uses speex, the other tiers use the
+ * polyphase resampler when it supports the rate pair and fall back to speex
+ * otherwise. */
+enum CRAS_RESAMPLER_QUALITY {
+	CRAS_RESAMPLER_QUALITY_DEFAULT,
+	CRAS_RESAMPLER_QUALITY_LOW,
+	CRAS_RESAMPLER_QUALITY_MEDIUM,
+	CRAS_RESAMPLER_QUALITY_HIGH,
+};
+
 /* Create and destroy format converters. */
 struct cras_fmt_conv *cras_fmt_conv_create(const struct cras_audio_format *in,
 					   const struct cras_audio_format *out,
 					   size_t max_frames,
 					   size_t pre_linear_resample);
+struct cras_fmt_conv *
+cras_fmt_conv_create_with_quality(const struct cras_audio_format *in,
+				  const struct cras_audio_format *out,
+				  size_t max_frames, size_t pre_linear_resample,
+				  enum CRAS_RESAMPLER_QUALITY quality);
 void cras_fmt_conv_destroy(struct cras_fmt_conv **conv);
 
 /* Creates the format converter for channel remixing. The conversion takes
@@ -46,6 +61,20 @@ void cras_channel_remix_convert(struct cras_fmt_conv *conv,
 				const struct cras_audio_format *fmt,
 				uint8_t *in_buf, size_t nframes);
 
+/* Like cras_channel_remix_convert() on the float planes of a mix bus.
+ * Args:
+ *    conv - The format converter.
+ *    planes - The planes to remix, one per channel.
+ *    num_planes - The number of planes.
+ *    nframes - The number of frames to convert.
+ * Returns:
+ *    1 if the planes were remixed, 0 if the number of channels doesn't
+ *    match the converter.
+ */
+int cras_channel_remix_convert_planar(struct cras_fmt_conv *conv,
+				      float *const *planes,
+				      unsigned int num_planes, size_t nframes);
+
 /* Get the input format of the converter. */
 const struct cras_audio_format *
 cras_fmt_conv_in_format(const struct cras_fmt_conv *conv);
@@ -54,15 +83,37 @@ cras_fmt_conv_in_format(const struct cras_fmt_conv *conv);
 const struct cras_audio_format *
 cras_fmt_conv_out_format(const struct cras_fmt_conv *conv);
 
+/*
+ * Frees the scratch buffers used between conversion stages by the calling
+ * thread. Converters run on a thread share one set, grown as needed by the
+ * first conversion, a thread converting audio calls this before it exits.
+ */
+void cras_fmt_conv_release_scratch();
+
 /* Get the number of output frames that will result from converting in_frames */
 size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv *conv,
 				      size_t in_frames);
 /* Get the number of input frames that will result from converting out_frames */
 size_t cras_fmt_conv_out_frames_to_in(struct cras_fmt_conv *conv,
 				      size_t out_frames);
+/* Returns the delay the sample rate converter adds to the audio, in frames
+ * at the input rate, 0 if there is none. The linear resampler tracking
+ * the device rate doesn't delay a whole frame and isn't counted. */
+size_t cras_fmt_conv_delay_frames(const struct cras_fmt_conv *conv);
 /* Sets the input and output rate to the linear resampler. */
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv *conv,
 					     float from, float to);
+/* Sets a gain for the converter to apply to the frames it converts from now
+ * on. It costs nothing when the channels are mixed through a matrix, which
+ * takes the gain in its coefficients.
+ * Args:
+ *    conv - The format converter returned from cras_fmt_conv_create().
+ *    gain - The gain to apply.
+ * Returns:
+ *    The part of gain left for the caller to apply to the converted frames,
+ *    1.0 when the converter takes all of it.
+ */
+float cras_fmt_conv_set_gain(struct cras_fmt_conv *conv, float gain);
 /* Converts in_frames samples from in_buf, storing the results in out_buf.
  * Args:
  *    conv - The format converter returned from cras_fmt_conv_create().
@@ -86,6 +137,25 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv *conv,
  */
 int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv);
 
+/* Checks if a fmt converter changes the sample rate. A resampler keeps
+ * history and a fractional position across calls, so every input frame
+ * must go through it even when the samples can be dropped afterwards.
+ * Args:
+ *    conv - The format convert to check.
+ *  Returns:
+ *    Non-zero if the sample rate is converted.
+ */
+int cras_fmt_conv_resampling(const struct cras_fmt_conv *conv);
+
+/* Checks if a fmt converter only changes the sample format, with the same
+ * rate and channels on both sides.
+ * Args:
+ *    conv - The format convert to check.
+ *  Returns:
+ *    Non-zero if only the sample format is converted.
+ */
+int cras_fmt_conv_format_only(const struct cras_fmt_conv *conv);
+
 /* If the server cannot provide the requested format, configures an audio format
  * converter that handles transforming the input format to the format used by
  * the server.
@@ -95,11 +165,13 @@ int cras_fmt_conversion_needed(const struct cras_fmt_conv *conv);
  *    from - Format to convert from.
  *    to - Format to convert to.
  *    frames - size of buffer.
+ *    quality - sample rate conversion quality.
  */
 int config_format_converter(struct cras_fmt_conv **conv,
 			    enum CRAS_STREAM_DIRECTION dir,
 			    const struct cras_audio_format *from,
 			    const struct cras_audio_format *to,
-			    unsigned int frames);
+			    unsigned int frames,
+			    enum CRAS_RESAMPLER_QUALITY quality);
 
 #endif /* CRAS_FMT_CONV_H_ */
@@ -7,6 +7,7 @@
 #include <string.h>
 
 #include "cras_fmt_conv_ops.h"
+#include "cras_util.h"
 
 #define MAX(a, b)                                                              \
 	({                                                                     \
@@ -36,6 +37,18 @@ static int16_t s16_add_and_clip(int16_t a, int16_t b)
 	return (int16_t)le16toh(sum);
 }
 
+static int32_t s32_add_and_clip(int32_t a, int32_t b)
+{
+	int64_t sum;
+
+	a = htole32(a);
+	b = htole32(b);
+	sum = (int64_t)a + (int64_t)b;
+	sum = MAX(sum, INT32_MIN);
+	sum = MIN(sum, INT32_MAX);
+	return (int32_t)le32toh(sum);
+}
+
 /*
  * Format converter.
  */
@@ -122,6 +135,93 @@ void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
 		*_out = ((uint32_t)(int32_t)*_in << 16);
 }
 
+void convert_u8_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	uint32_t *_out = (uint32_t *)out;
+
+	for (i = 0; i < in_samples; i++, in++, _out++)
+		*_out = (uint32_t)((int32_t)*in - 0x80) << 24;
+}
+
+void convert_s243le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	uint8_t *_out = (uint8_t *)out;
+
+	for (i = 0; i < in_samples; i++, in += 3, _out += 4) {
+		*_out = 0;
+		memcpy(_out + 1, in, 3);
+	}
+}
+
+void convert_s24le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	uint32_t *_in = (uint32_t *)in;
+	uint32_t *_out = (uint32_t *)out;
+
+	for (i = 0; i < in_samples; i++, _in++, _out++)
+		*_out = *_in << 8;
+}
+
+void convert_s32le_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	int32_t *_in = (int32_t *)in;
+
+	for (i = 0; i < in_samples; i++, _in++, out++)
+		*out = (uint8_t)(*_in >> 24) + 128;
+}
+
+void convert_s32le_to_s243le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const uint8_t *_in = (const uint8_t *)in;
+
+	for (i = 0; i < in_samples; i++, _in += 4, out += 3)
+		memcpy(out, _in + 1, 3);
+}
+
+void convert_s32le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	int32_t *_in = (int32_t *)in;
+	uint32_t *_out = (uint32_t *)out;
+
+	for (i = 0; i < in_samples; i++, _in++, _out++)
+		*_out = (uint32_t)(*_in >> 8);
+}
+
+/* Float samples beyond [-1.0, 1.0) are clipped. */
+void convert_f32le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const float *_in = (const float *)in;
+	int32_t *_out = (int32_t *)out;
+	float f;
+
+	for (i = 0; i < in_samples; i++, _in++, _out++) {
+		f = *_in * 2147483648.0f;
+		if (f >= 2147483647.0f)
+			*_out = INT32_MAX;
+		else if (f <= -2147483648.0f)
+			*_out = INT32_MIN;
+		else
+			*_out = (int32_t)f;
+	}
+}
+
+void convert_s32le_to_f32le(const uint8_t *in, size_t in_samples, uint8_t *out)
+{
+	size_t i;
+	const int32_t *_in = (const int32_t *)in;
+	float *_out = (float *)out;
+
+	for (i = 0; i < in_samples; i++, _in++, _out++)
+		*_out = *_in / 2147483648.0f;
+}
+
 /*
  * Channel converter: mono to stereo.
  */
@@ -453,7 +553,7 @@ size_t s16_some_to_some(const struct cras_audio_format *out_fmt,
 	int16_t *out = (int16_t *)_out;
 	const size_t num_copy_ch = MIN(num_in_ch, num_out_ch);
 
-	memset(out, 0, frame_count * cras_get_format_bytes(out_fmt));
+	memset(out, 0, frame_count * num_out_ch * sizeof(*out));
 	for (i = 0; i < frame_count; i++, out += num_out_ch, in += num_in_ch) {
 		memcpy(out, in, num_copy_ch * sizeof(int16_t));
 	}
@@ -464,7 +564,8 @@ size_t s16_some_to_some(const struct cras_audio_format *out_fmt,
 /*
  * Multiplies buffer vector with coefficient vector.
  */
-int16_t s16_multiply_buf_with_coef(float *coef, const int16_t *buf, size_t size)
+static inline __attribute__((always_inline)) int16_t
+s16_dot(const float *coef, const int16_t *buf, size_t size)
 {
 	int32_t sum = 0;
 	int i;
@@ -476,14 +577,19 @@ int16_t s16_multiply_buf_with_coef(float *coef, const int16_t *buf, size_t size)
 	return (int16_t)sum;
 }
 
+int16_t s16_multiply_buf_with_coef(float *coef, const int16_t *buf, size_t size)
+{
+	return s16_dot(coef, buf, size);
+}
+
 /*
  * Channel layout converter.
  *
  * Converts channels based on the channel conversion coefficient matrix.
  */
-size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
-			    size_t num_out_ch, const uint8_t *_in,
-			    size_t in_frames, uint8_t *_out)
+static inline __attribute__((always_inline)) size_t
+s16_matrix(float **ch_conv_mtx, size_t num_in_ch, size_t num_out_ch,
+	   const uint8_t *_in, size_t in_frames, uint8_t *_out)
 {
 	unsigned i, fr;
 	unsigned in_idx = 0;
@@ -493,11 +599,395 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 
 	for (fr = 0; fr < in_frames; fr++) {
 		for (i = 0; i < num_out_ch; i++)
-			out[out_idx + i] = s16_multiply_buf_with_coef(
-				ch_conv_mtx[i], &in[in_idx], num_in_ch);
+			out[out_idx + i] = s16_dot(ch_conv_mtx[i], &in[in_idx],
+						   num_in_ch);
 		in_idx += num_in_ch;
 		out_idx += num_out_ch;
 	}
 
 	return in_frames;
 }
+
+size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
+			    size_t num_out_ch, const uint8_t *in,
+			    size_t in_frames, uint8_t *out)
+{
+	return s16_matrix(ch_conv_mtx, num_in_ch, num_out_ch, in, in_frames,
+			  out);
+}
+
+/*
+ * S32_LE channel converters. See the S16_LE versions above.
+ */
+size_t s32_mono_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	for (i = 0; i < in_frames; i++) {
+		out[2 * i] = in[i];
+		out[2 * i + 1] = in[i];
+	}
+	return in_frames;
+}
+
+size_t s32_stereo_to_mono(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	for (i = 0; i < in_frames; i++)
+		out[i] = s32_add_and_clip(in[2 * i], in[2 * i + 1]);
+	return in_frames;
+}
+
+size_t s32_mono_to_51(size_t left, size_t right, size_t center,
+		      const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (center != -1)
+		for (i = 0; i < in_frames; i++)
+			out[6 * i + center] = in[i];
+	else if (left != -1 && right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + right] = in[i] / 2;
+			out[6 * i + left] = in[i] / 2;
+		}
+	else
+		for (i = 0; i < in_frames; i++)
+			out[6 * i] = in[i];
+
+	return in_frames;
+}
+
+size_t s32_stereo_to_51(size_t left, size_t right, size_t center,
+			const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (left != -1 && right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + left] = in[2 * i];
+			out[6 * i + right] = in[2 * i + 1];
+		}
+	else if (center != -1)
+		for (i = 0; i < in_frames; i++)
+			out[6 * i + center] =
+				s32_add_and_clip(in[2 * i], in[2 * i + 1]);
+	else
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i] = in[2 * i];
+			out[6 * i + 1] = in[2 * i + 1];
+		}
+
+	return in_frames;
+}
+
+size_t s32_quad_to_51(size_t font_left, size_t front_right, size_t rear_left,
+		      size_t rear_right, const uint8_t *_in, size_t in_frames,
+		      uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	memset(out, 0, sizeof(*out) * 6 * in_frames);
+
+	if (font_left != -1 && front_right != -1 && rear_left != -1 &&
+	    rear_right != -1)
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i + font_left] = in[4 * i];
+			out[6 * i + front_right] = in[4 * i + 1];
+			out[6 * i + rear_left] = in[4 * i + 2];
+			out[6 * i + rear_right] = in[4 * i + 3];
+		}
+	else
+		for (i = 0; i < in_frames; i++) {
+			out[6 * i] = in[4 * i];
+			out[6 * i + 1] = in[4 * i + 1];
+			out[6 * i + 4] = in[4 * i + 2];
+			out[6 * i + 5] = in[4 * i + 3];
+		}
+
+	return in_frames;
+}
+
+size_t s32_51_to_stereo(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+	static const unsigned int left_idx = 0;
+	static const unsigned int right_idx = 1;
+	static const unsigned int center_idx = 2;
+	/* Same factor as s16_51_to_stereo(), in double so no bits of the
+	 * 32 bit samples are lost. */
+	const double normalized_factor = 0.585;
+	double half_center;
+	size_t i;
+
+	for (i = 0; i < in_frames; i++) {
+		half_center =
+			in[6 * i + center_idx] * 0.707 * normalized_factor;
+		out[2 * i + left_idx] =
+			in[6 * i + left_idx] * normalized_factor + half_center;
+		out[2 * i + right_idx] =
+			in[6 * i + right_idx] * normalized_factor + half_center;
+	}
+	return in_frames;
+}
+
+size_t s32_51_to_quad(const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+	static const unsigned int l_quad = 0;
+	static const unsigned int r_quad = 1;
+	static const unsigned int rl_quad = 2;
+	static const unsigned int rr_quad = 3;
+
+	static const unsigned int l_51 = 0;
+	static const unsigned int r_51 = 1;
+	static const unsigned int center_51 = 2;
+	static const unsigned int lfe_51 = 3;
+	static const unsigned int rl_51 = 4;
+	static const unsigned int rr_51 = 5;
+
+	const double normalized_factor = 0.453;
+	double half_center, lfe;
+	size_t i;
+
+	for (i = 0; i < in_frames; i++) {
+		half_center = in[6 * i + center_51] * 0.707 * normalized_factor;
+		lfe = in[6 * i + lfe_51] * 0.5 * normalized_factor;
+		out[4 * i + l_quad] = normalized_factor * in[6 * i + l_51] +
+				      half_center + lfe;
+		out[4 * i + r_quad] = normalized_factor * in[6 * i + r_51] +
+				      half_center + lfe;
+		out[4 * i + rl_quad] =
+			normalized_factor * in[6 * i + rl_51] + lfe;
+		out[4 * i + rr_quad] =
+			normalized_factor * in[6 * i + rr_51] + lfe;
+	}
+	return in_frames;
+}
+
+size_t s32_stereo_to_quad(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1) {
+		front_left = 0;
+		front_right = 1;
+		rear_left = 2;
+		rear_right = 3;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[4 * i + front_left] = in[2 * i];
+		out[4 * i + front_right] = in[2 * i + 1];
+		out[4 * i + rear_left] = in[2 * i];
+		out[4 * i + rear_right] = in[2 * i + 1];
+	}
+	return in_frames;
+}
+
+size_t s32_quad_to_stereo(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	size_t i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	if (front_left == -1 || front_right == -1 || rear_left == -1 ||
+	    rear_right == -1) {
+		front_left = 0;
+		front_right = 1;
+		rear_left = 2;
+		rear_right = 3;
+	}
+
+	for (i = 0; i < in_frames; i++) {
+		out[2 * i] = s32_add_and_clip(in[4 * i + front_left],
+					      in[4 * i + rear_left] / 4);
+		out[2 * i + 1] = s32_add_and_clip(in[4 * i + front_right],
+						  in[4 * i + rear_right] / 4);
+	}
+	return in_frames;
+}
+
+size_t s32_default_all_to_all(struct cras_audio_format *out_fmt,
+			      size_t num_in_ch, size_t num_out_ch,
+			      const uint8_t *_in, size_t in_frames,
+			      uint8_t *_out)
+{
+	unsigned int in_ch, out_ch, i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+	int64_t sum;
+
+	for (i = 0; i < in_frames; i++) {
+		sum = 0;
+		for (in_ch = 0; in_ch < num_in_ch; in_ch++)
+			sum += (int64_t)in[in_ch + i * num_in_ch];
+		sum /= (int64_t)num_in_ch;
+		for (out_ch = 0; out_ch < num_out_ch; out_ch++)
+			out[out_ch + i * num_out_ch] = (int32_t)sum;
+	}
+	return in_frames;
+}
+
+size_t s32_some_to_some(const struct cras_audio_format *out_fmt,
+			const size_t num_in_ch, const size_t num_out_ch,
+			const uint8_t *_in, const size_t frame_count,
+			uint8_t *_out)
+{
+	unsigned int i;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+	const size_t num_copy_ch = MIN(num_in_ch, num_out_ch);
+
+	memset(out, 0, frame_count * num_out_ch * sizeof(*out));
+	for (i = 0; i < frame_count; i++, out += num_out_ch, in += num_in_ch)
+		memcpy(out, in, num_copy_ch * sizeof(int32_t));
+
+	return frame_count;
+}
+
+static inline __attribute__((always_inline)) int32_t
+s32_dot(const float *coef, const int32_t *buf, size_t size)
+{
+	double sum = 0;
+	int i;
+
+	for (i = 0; i < size; i++)
+		sum += coef[i] * (double)buf[i];
+	sum = MAX(sum, (double)INT32_MIN);
+	sum = MIN(sum, (double)INT32_MAX);
+	return (int32_t)sum;
+}
+
+int32_t s32_multiply_buf_with_coef(float *coef, const int32_t *buf, size_t size)
+{
+	return s32_dot(coef, buf, size);
+}
+
+static inline __attribute__((always_inline)) size_t
+s32_matrix(float **ch_conv_mtx, size_t num_in_ch, size_t num_out_ch,
+	   const uint8_t *_in, size_t in_frames, uint8_t *_out)
+{
+	unsigned i, fr;
+	unsigned in_idx = 0;
+	unsigned out_idx = 0;
+	const int32_t *in = (const int32_t *)_in;
+	int32_t *out = (int32_t *)_out;
+
+	for (fr = 0; fr < in_frames; fr++) {
+		for (i = 0; i < num_out_ch; i++)
+			out[out_idx + i] = s32_dot(ch_conv_mtx[i], &in[in_idx],
+						   num_in_ch);
+		in_idx += num_in_ch;
+		out_idx += num_out_ch;
+	}
+
+	return in_frames;
+}
+
+size_t s32_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
+			    size_t num_out_ch, const uint8_t *in,
+			    size_t in_frames, uint8_t *out)
+{
+	return s32_matrix(ch_conv_mtx, num_in_ch, num_out_ch, in, in_frames,
+			  out);
+}
+
+/*
+ * Channel layout converters for fixed channel counts, the 5.1 and 7.1 up and
+ * downmixes and the layout remaps of 4 to 8 channels. With the counts
+ * constant the loops over the channels are unrolled, and the compiler can
+ * vectorize over the frames.
+ */
+#define FIXED_CONVERT_CHANNELS(fmt, in_ch, out_ch)                             \
+	static size_t fmt##_convert_channels_##in_ch##_##out_ch(              \
+		float **ch_conv_mtx, size_t num_in_ch, size_t num_out_ch,      \
+		const uint8_t *in, size_t in_frames, uint8_t *out)             \
+	{                                                                      \
+		return fmt##_matrix(ch_conv_mtx, in_ch, out_ch, in, in_frames, \
+				    out);                                      \
+	}
+
+FIXED_CONVERT_CHANNELS(s16, 6, 2)
+FIXED_CONVERT_CHANNELS(s16, 6, 4)
+FIXED_CONVERT_CHANNELS(s16, 4, 4)
+FIXED_CONVERT_CHANNELS(s16, 6, 6)
+FIXED_CONVERT_CHANNELS(s16, 8, 8)
+FIXED_CONVERT_CHANNELS(s16, 8, 2)
+FIXED_CONVERT_CHANNELS(s16, 8, 6)
+FIXED_CONVERT_CHANNELS(s16, 2, 8)
+FIXED_CONVERT_CHANNELS(s16, 6, 8)
+FIXED_CONVERT_CHANNELS(s32, 6, 2)
+FIXED_CONVERT_CHANNELS(s32, 6, 4)
+FIXED_CONVERT_CHANNELS(s32, 4, 4)
+FIXED_CONVERT_CHANNELS(s32, 6, 6)
+FIXED_CONVERT_CHANNELS(s32, 8, 8)
+FIXED_CONVERT_CHANNELS(s32, 8, 2)
+FIXED_CONVERT_CHANNELS(s32, 8, 6)
+FIXED_CONVERT_CHANNELS(s32, 2, 8)
+FIXED_CONVERT_CHANNELS(s32, 6, 8)
+
+static const struct {
+	size_t num_in_ch;
+	size_t num_out_ch;
+	convert_channels_t s16;
+	convert_channels_t s32;
+} fixed_convert_channels[] = {
+	{ 6, 2, s16_convert_channels_6_2, s32_convert_channels_6_2 },
+	{ 6, 4, s16_convert_channels_6_4, s32_convert_channels_6_4 },
+	{ 4, 4, s16_convert_channels_4_4, s32_convert_channels_4_4 },
+	{ 6, 6, s16_convert_channels_6_6, s32_convert_channels_6_6 },
+	{ 8, 8, s16_convert_channels_8_8, s32_convert_channels_8_8 },
+	{ 8, 2, s16_convert_channels_8_2, s32_convert_channels_8_2 },
+	{ 8, 6, s16_convert_channels_8_6, s32_convert_channels_8_6 },
+	{ 2, 8, s16_convert_channels_2_8, s32_convert_channels_2_8 },
+	{ 6, 8, s16_convert_channels_6_8, s32_convert_channels_6_8 },
+};
+
+convert_channels_t s16_convert_channels_func(size_t num_in_ch,
+					     size_t num_out_ch)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(fixed_convert_channels); i++)
+		if (fixed_convert_channels[i].num_in_ch == num_in_ch &&
+		    fixed_convert_channels[i].num_out_ch == num_out_ch)
+			return fixed_convert_channels[i].s16;
+	return s16_convert_channels;
+}
+
+convert_channels_t s32_convert_channels_func(size_t num_in_ch,
+					     size_t num_out_ch)
+{
+	size_t i;
+
+	for (i = 0; i < ARRAY_SIZE(fixed_convert_channels); i++)
+		if (fixed_convert_channels[i].num_in_ch == num_in_ch &&
+		    fixed_convert_channels[i].num_out_ch == num_out_ch)
+			return fixed_convert_channels[i].s32;
+	return s32_convert_channels;
+}
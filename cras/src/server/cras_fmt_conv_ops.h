@@ -22,6 +22,16 @@ void convert_s16le_to_s243le(const uint8_t *in, size_t in_samples,
 			     uint8_t *out);
 void convert_s16le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out);
 void convert_s16le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_u8_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s243le_to_s32le(const uint8_t *in, size_t in_samples,
+			     uint8_t *out);
+void convert_s24le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s32le_to_u8(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s32le_to_s243le(const uint8_t *in, size_t in_samples,
+			     uint8_t *out);
+void convert_s32le_to_s24le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_f32le_to_s32le(const uint8_t *in, size_t in_samples, uint8_t *out);
+void convert_s32le_to_f32le(const uint8_t *in, size_t in_samples, uint8_t *out);
 
 /*
  * Channel converter: mono to stereo.
@@ -106,4 +116,57 @@ size_t s16_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
 			    size_t num_out_ch, const uint8_t *in,
 			    size_t in_frames, uint8_t *out);
 
+/*
+ * Channel converters for S32_LE samples. They behave like the S16_LE
+ * converters of the same name, so formats wider than 16 bits can be converted
+ * without dropping to S16_LE first.
+ */
+size_t s32_mono_to_stereo(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_stereo_to_mono(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_mono_to_51(size_t left, size_t right, size_t center,
+		      const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_stereo_to_51(size_t left, size_t right, size_t center,
+			const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_quad_to_51(size_t font_left, size_t front_right, size_t rear_left,
+		      size_t rear_right, const uint8_t *in, size_t in_frames,
+		      uint8_t *out);
+size_t s32_51_to_stereo(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_51_to_quad(const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_stereo_to_quad(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_quad_to_stereo(size_t front_left, size_t front_right,
+			  size_t rear_left, size_t rear_right,
+			  const uint8_t *in, size_t in_frames, uint8_t *out);
+size_t s32_default_all_to_all(struct cras_audio_format *out_fmt,
+			      size_t num_in_ch, size_t num_out_ch,
+			      const uint8_t *in, size_t in_frames,
+			      uint8_t *out);
+size_t s32_some_to_some(const struct cras_audio_format *out_fmt,
+			const size_t num_in_ch, const size_t num_out_ch,
+			const uint8_t *_in, const size_t frame_count,
+			uint8_t *_out);
+int32_t s32_multiply_buf_with_coef(float *coef, const int32_t *buf,
+				   size_t size);
+size_t s32_convert_channels(float **ch_conv_mtx, size_t num_in_ch,
+			    size_t num_out_ch, const uint8_t *in,
+			    size_t in_frames, uint8_t *out);
+
+/*
+ * A channel layout converter, s16_convert_channels() or
+ * s32_convert_channels() or one of their versions for fixed channel counts.
+ */
+typedef size_t (*convert_channels_t)(float **ch_conv_mtx, size_t num_in_ch,
+				     size_t num_out_ch, const uint8_t *in,
+				     size_t in_frames, uint8_t *out);
+
+/*
+ * Returns the channel layout converter for num_in_ch to num_out_ch channels,
+ * one built for these counts if there is one.
+ */
+convert_channels_t s16_convert_channels_func(size_t num_in_ch,
+					     size_t num_out_ch);
+convert_channels_t s32_convert_channels_func(size_t num_in_ch,
+					     size_t num_out_ch);
+
 #endif /* CRAS_FMT_CONV_OPS_H_ */
@@ -22,6 +22,7 @@
 #include "cras_iodev_list.h"
 #include "utlist.h"
 #include "packet_status_logger.h"
+#include "hfp_link_stats.h"
 
 #define HFP_AG_PROFILE_NAME "Hands-Free Voice gateway"
 #define HFP_AG_PROFILE_PATH "/org/chromium/Cras/Bluetooth/HFPAG"
@@ -104,6 +105,7 @@ struct audio_gateway {
 
 static struct audio_gateway *connected_ags;
 static struct packet_status_logger wbs_logger;
+static struct hfp_link_stats link_stats;
 
 static int need_go_sco_pcm(struct cras_bt_device *device)
 {
@@ -413,6 +415,7 @@ int cras_hfp_ag_start(struct cras_bt_device *device)
 	} else {
 		ag->info = hfp_info_create();
 		hfp_info_set_wbs_logger(ag->info, &wbs_logger);
+		hfp_info_set_link_stats(ag->info, &link_stats);
 		ag->idev =
 			hfp_iodev_create(CRAS_STREAM_INPUT, ag->device,
 					 ag->slc_handle, ag->profile, ag->info);
@@ -460,6 +463,11 @@ struct packet_status_logger *cras_hfp_ag_get_wbs_logger()
 	return &wbs_logger;
 }
 
+struct hfp_link_stats *cras_hfp_ag_get_link_stats()
+{
+	return &link_stats;
+}
+
 int cras_hsp_ag_profile_create(DBusConnection *conn)
 {
 	return cras_bt_add_profile(conn, &cras_hsp_ag_profile);
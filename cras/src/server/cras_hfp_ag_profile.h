@@ -56,4 +56,7 @@ struct hfp_slc_handle *cras_hfp_ag_get_slc(struct cras_bt_device *device);
 /* Gets the logger for WBS packet status. */
 struct packet_status_logger *cras_hfp_ag_get_wbs_logger();
 
+/* Gets the statistics of the link quality of the last SCO connection. */
+struct hfp_link_stats *cras_hfp_ag_get_link_stats();
+
 #endif /* CRAS_HFP_AG_PROFILE_H_ */
@@ -3,21 +3,30 @@
  * found in the LICENSE file.
  */
 
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE /* for recvmmsg and sendmmsg */
+#endif
+
 #include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 #include <sys/socket.h>
 #include <syslog.h>
+#include <time.h>
 
 #include "audio_thread.h"
 #include "bluetooth.h"
 #include "byte_buffer.h"
+#include "cras_bt_tx_delay.h"
 #include "cras_hfp_info.h"
 #include "cras_hfp_slc.h"
 #include "cras_iodev_list.h"
+#include "cras_mem_stats.h"
 #include "cras_plc.h"
 #include "cras_sbc_codec.h"
 #include "cras_server_metrics.h"
+#include "cras_util.h"
+#include "hfp_link_stats.h"
 #include "utlist.h"
 #include "packet_status_logger.h"
 
@@ -38,18 +47,31 @@
 #define MSBC_CODE_SIZE 240
 #define MSBC_SYNC_WORD 0xAD
 
+/* The most SCO packets read or written in one wake of the audio thread. */
+#define MAX_SCO_BATCH 8
+
 /* For one mSBC 1 compressed wideband audio channel the HCI packets will
  * be 3 octets of HCI header + 60 octets of data. */
 #define MSBC_PKT_SIZE 60
 
 #define H2_HEADER_0 0x01
 
+/* An mSBC frame plays 7.5 ms, whatever the size of the packets carrying it. */
+#define MSBC_FRAME_USEC 7500
+
+/* The longest capture waits for late SCO packets before concealing them,
+ * and the most mSBC frames concealed ahead of packets not read yet. */
+#define MAX_RX_TARGET_USEC 30000
+#define MAX_CONCEALED_AHEAD 8
+
 /* Supported HCI SCO packet sizes. The wideband speech mSBC frame parsing
  * code ties to limited packet size values. Specifically list them out
  * to check against when setting packet size.
  *
  * Temp buffer size should be set to least common multiple of HCI SCO packet
- * size and MSBC_PKT_SIZE for optimizing buffer copy.
+ * size and MSBC_PKT_SIZE for optimizing buffer copy. The temp buffers are
+ * MAX_SCO_BATCH times that, for a batch of packets to be read and written in
+ * place.
  * To add a new supported packet size value, add corresponding entry to the
  * lists, test the read/write msbc code, and fix the code if needed.
  */
@@ -95,6 +117,15 @@ static const uint8_t h2_header_frames_count[] = { 0x08, 0x38, 0xc8, 0xf8 };
  *     msbc_read_current_corrupted - Flag to mark if the current mSBC frame
  *         read is corrupted.
  *     wbs_logger - The logger for packet status in WBS.
+ *     read_packets - The number of SCO packets read in this wake, as many
+ *         are written back.
+ *     tx_delay - The frames written the controller hasn't transmitted yet.
+ *     link_stats - The statistics of the link quality through the call.
+ *     last_read_ts - When packets were last read from the SCO socket.
+ *     rx_audio_usec - How long the audio in the packets last read plays.
+ *     rx_jitter_usec - The smoothed interarrival jitter of the packets read.
+ *     concealed_ahead - The mSBC frames concealed on time for packets not
+ *         read yet, those packets are dropped when they come.
  */
 struct hfp_info {
 	int fd;
@@ -122,6 +153,13 @@ struct hfp_info {
 	int (*read_align_cb)(uint8_t *buf);
 	bool msbc_read_current_corrupted;
 	struct packet_status_logger *wbs_logger;
+	unsigned int read_packets;
+	struct cras_bt_tx_delay tx_delay;
+	struct hfp_link_stats *link_stats;
+	struct timespec last_read_ts;
+	unsigned int rx_audio_usec;
+	unsigned int rx_jitter_usec;
+	unsigned int concealed_ahead;
 };
 
 int hfp_info_add_iodev(struct hfp_info *info,
@@ -226,6 +264,26 @@ int hfp_buf_queued(struct hfp_info *info, enum CRAS_STREAM_DIRECTION direction)
 		return 0;
 }
 
+unsigned int hfp_tx_delay_frames(struct hfp_info *info)
+{
+	return cras_bt_tx_delay_frames(&info->tx_delay);
+}
+
+/* Returns how long to wait for late SCO packets before concealing them,
+ * twice the jitter seen so the usual lateness never causes concealment. */
+static unsigned int rx_target_usec(struct hfp_info *info)
+{
+	return MIN(2 * info->rx_jitter_usec, MAX_RX_TARGET_USEC);
+}
+
+unsigned int hfp_rx_delay_frames(struct hfp_info *info)
+{
+	/* Only wideband speech has PLC to conceal late packets with. */
+	if (!info->msbc_read)
+		return 0;
+	return (uint64_t)rx_target_usec(info) * 16000 / 1000000;
+}
+
 int hfp_fill_output_with_zeros(struct hfp_info *info, unsigned int nframes)
 {
 	unsigned int buf_avail;
@@ -261,18 +319,84 @@ void hfp_force_output_level(struct hfp_info *info, unsigned int level)
 	}
 }
 
-int hfp_write_msbc(struct hfp_info *info)
+/* Returns how many SCO packets to write in this wake. The SCO link takes
+ * as much as it gives, so it's one for each packet read, and at least one
+ * for the device to start sending. */
+static unsigned int packets_to_write(struct hfp_info *info)
+{
+	return MAX(1, info->read_packets);
+}
+
+/* Returns the number of PCM frames in a SCO packet written, both codecs
+ * take 16 bit mono samples. */
+static unsigned int packet_frames(struct hfp_info *info)
+{
+	if (info->msbc_write)
+		return info->packet_size * MSBC_CODE_SIZE / MSBC_PKT_SIZE / 2;
+	return info->packet_size / 2;
+}
+
+/*
+ * Writes SCO packets with one call.
+ * Args:
+ *    info - The hfp_info holding the SCO socket.
+ *    buf - The packets, one every packet_size bytes.
+ *    count - The number of packets, at most MAX_SCO_BATCH.
+ * Returns:
+ *    The number of bytes written, or negative error code.
+ */
+static int send_sco_packets(struct hfp_info *info, uint8_t *buf,
+			    unsigned int count)
+{
+	struct mmsghdr msgs[MAX_SCO_BATCH];
+	struct iovec iovs[MAX_SCO_BATCH];
+	unsigned int i, sent = 0;
+	int n;
+
+	memset(msgs, 0, sizeof(msgs));
+	for (i = 0; i < count; i++) {
+		iovs[i].iov_base = buf + i * info->packet_size;
+		iovs[i].iov_len = info->packet_size;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	while (sent < count) {
+		n = sendmmsg(info->fd, msgs + sent, count - sent, 0);
+		if (n < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		for (i = sent; i < sent + n; i++) {
+			if (msgs[i].msg_len != info->packet_size) {
+				syslog(LOG_ERR,
+				       "Partially write %u bytes for SCO packet "
+				       "size %u",
+				       msgs[i].msg_len, info->packet_size);
+				return -1;
+			}
+		}
+		sent += n;
+	}
+
+	for (i = 0; i < count; i++)
+		cras_bt_tx_delay_sent(&info->tx_delay, packet_frames(info));
+	return count * info->packet_size;
+}
+
+/* Encodes the next mSBC frame into write_buf.
+ * Returns:
+ *    0 on success, otherwise negative error code.
+ */
+static int encode_msbc_frame(struct hfp_info *info)
 {
 	size_t encoded;
-	int err;
 	int pcm_encoded;
 	unsigned int pcm_avail, to_write;
 	uint8_t *samples;
 	uint8_t *wp;
 
-	if (info->write_rp + info->packet_size <= info->write_wp)
-		goto msbc_send_again;
-
 	/* Make sure there are MSBC_CODE_SIZE bytes to encode. */
 	samples = buf_read_pointer_size(info->playback_buf, &pcm_avail);
 	if (pcm_avail < MSBC_CODE_SIZE) {
@@ -306,61 +430,133 @@ int hfp_write_msbc(struct hfp_info *info)
 	info->write_wp += MSBC_PKT_SIZE;
 	info->msbc_num_out_frames++;
 
-	if (info->write_rp + info->packet_size > info->write_wp)
-		return 0;
+	return 0;
+}
 
-msbc_send_again:
-	err = send(info->fd, info->write_buf + info->write_rp,
-		   info->packet_size, 0);
-	if (err < 0) {
-		if (errno == EINTR)
-			goto msbc_send_again;
-		return err;
-	}
-	if (err != (int)info->packet_size) {
-		syslog(LOG_ERR, "Partially write %d bytes for mSBC", err);
-		return -1;
-	}
-	info->write_rp += info->packet_size;
-	if (info->write_rp == info->write_wp) {
-		info->write_rp = 0;
-		info->write_wp = 0;
+/* Moves the bytes left between rp and wp to the start of buf, so the next
+ * batch of packets is read or written in one contiguous region. It's less
+ * than one mSBC frame, and nothing unless packets and frames differ in size.
+ */
+static void compact_sco_buf(uint8_t *buf, size_t *rp, size_t *wp)
+{
+	if (*rp != *wp)
+		memmove(buf, buf + *rp, *wp - *rp);
+	*wp -= *rp;
+	*rp = 0;
+}
+
+int hfp_write_msbc(struct hfp_info *info)
+{
+	unsigned int packets = packets_to_write(info);
+	size_t to_send = packets * info->packet_size;
+	int err;
+
+	/* Encode frames in place after the bytes left over, until there are
+	 * enough for the packets to write. */
+	while (info->write_wp - info->write_rp < to_send) {
+		err = encode_msbc_frame(info);
+		if (err < 0)
+			return err;
 	}
 
+	err = send_sco_packets(info, info->write_buf + info->write_rp,
+			       packets);
+	if (err < 0)
+		return err;
+
+	info->write_rp += err;
+	compact_sco_buf(info->write_buf, &info->write_rp, &info->write_wp);
 	return err;
 }
 
 int hfp_write(struct hfp_info *info)
 {
-	int err = 0;
-	unsigned to_send;
+	int err, written = 0;
+	unsigned int to_send, count, packets = packets_to_write(info);
 	uint8_t *samples;
 
-	/* Write something */
-	samples = buf_read_pointer_size(info->playback_buf, &to_send);
-	if (to_send < info->packet_size)
-		return 0;
-	to_send = info->packet_size;
+	/* Write the packets in one go, or two when they wrap around the end of
+	 * playback_buf. */
+	while (packets) {
+		samples = buf_read_pointer_size(info->playback_buf, &to_send);
+		count = MIN(packets, to_send / info->packet_size);
+		if (count == 0)
+			break;
 
-send_sample:
-	err = send(info->fd, samples, to_send, 0);
-	if (err < 0) {
-		if (errno == EINTR)
-			goto send_sample;
+		err = send_sco_packets(info, samples, count);
+		if (err < 0)
+			return err;
 
-		return err;
+		buf_increment_read(info->playback_buf, err);
+		written += err;
+		packets -= count;
 	}
 
-	if (err != (int)info->packet_size) {
-		syslog(LOG_ERR,
-		       "Partially write %d bytes for SCO packet size %u", err,
-		       info->packet_size);
-		return -1;
+	return written;
+}
+
+/*
+ * Reads the SCO packets already queued, up to max, with one call.
+ * Args:
+ *    info - The hfp_info holding the SCO socket.
+ *    buf - Where to read the packets to, one every stride bytes.
+ *    stride - The room for each packet.
+ *    max - The most packets to read, at most MAX_SCO_BATCH.
+ *    lens - Filled with the length of each packet read.
+ *    pkt_status - Filled with the HCI packet status flag of each packet
+ *        read, or NULL if not needed.
+ * Returns:
+ *    The number of packets read, 0 if there's none, or negative error code.
+ */
+static int recv_sco_packets(struct hfp_info *info, uint8_t *buf,
+			    size_t stride, unsigned int max, unsigned int *lens,
+			    uint8_t *pkt_status)
+{
+	struct mmsghdr msgs[MAX_SCO_BATCH];
+	struct iovec iovs[MAX_SCO_BATCH];
+	char control[MAX_SCO_BATCH][CMSG_SPACE(sizeof(int))];
+	struct cmsghdr *cmsg;
+	int i, n;
+
+	memset(msgs, 0, sizeof(msgs));
+	memset(control, 0, sizeof(control));
+	for (i = 0; i < (int)max; i++) {
+		iovs[i].iov_base = buf + i * stride;
+		iovs[i].iov_len = stride;
+		msgs[i].msg_hdr.msg_iov = &iovs[i];
+		msgs[i].msg_hdr.msg_iovlen = 1;
+		if (pkt_status) {
+			msgs[i].msg_hdr.msg_control = control[i];
+			msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+		}
 	}
 
-	buf_increment_read(info->playback_buf, to_send);
+recv_again:
+	n = recvmmsg(info->fd, msgs, max, MSG_DONTWAIT, NULL);
+	if (n < 0) {
+		if (errno == EINTR)
+			goto recv_again;
+		if (errno == EAGAIN || errno == EWOULDBLOCK)
+			return 0;
+		syslog(LOG_ERR, "HCI SCO packet read err %s", strerror(errno));
+		return -errno;
+	}
 
-	return err;
+	for (i = 0; i < n; i++) {
+		lens[i] = msgs[i].msg_len;
+		if (!pkt_status)
+			continue;
+
+		pkt_status[i] = 0;
+		for (cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr); cmsg != NULL;
+		     cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr, cmsg)) {
+			if (cmsg->cmsg_level == SOL_BLUETOOTH &&
+			    cmsg->cmsg_type == BT_SCM_PKT_STATUS)
+				memcpy(&pkt_status[i], CMSG_DATA(cmsg),
+				       sizeof(pkt_status[i]));
+		}
+	}
+	return n;
 }
 
 static int h2_header_get_seq(const uint8_t *p)
@@ -411,6 +607,8 @@ static void log_wbs_packet_received(struct hfp_info *info)
 {
 	if (info->wbs_logger)
 		packet_status_logger_update(info->wbs_logger, 0);
+	if (info->link_stats)
+		hfp_link_stats_packet(info->link_stats, false);
 }
 
 /* Log value 1 when packet is lost. */
@@ -418,40 +616,69 @@ static void log_wbs_packet_lost(struct hfp_info *info)
 {
 	if (info->wbs_logger)
 		packet_status_logger_update(info->wbs_logger, 1);
+	if (info->link_stats)
+		hfp_link_stats_packet(info->link_stats, true);
 }
 
-/*
- * Handle the case when mSBC frame is considered lost.
- * Args:
- *    info - The hfp_info instance holding mSBC codec and PLC objects.
- */
-static int handle_packet_loss(struct hfp_info *info)
+/* Conceals an mSBC frame into capture_buf. Returns the bytes of PCM added,
+ * or negative error code. */
+static int conceal_frame(struct hfp_info *info)
 {
 	int decoded;
 	unsigned int pcm_avail;
 	uint8_t *in_bytes;
-
-	/* It's possible client doesn't consume data causing overrun. In that
-	 * case we treat it as one mSBC frame read but dropped. */
-	info->msbc_num_in_frames++;
-	info->msbc_num_lost_frames++;
-
-	log_wbs_packet_lost(info);
+	struct timespec begin, end;
 
 	in_bytes = buf_write_pointer_size(info->capture_buf, &pcm_avail);
 	if (pcm_avail < MSBC_CODE_SIZE)
 		return 0;
 
+	clock_gettime(CLOCK_MONOTONIC_RAW, &begin);
 	decoded = cras_msbc_plc_handle_bad_frames(info->msbc_plc,
 						  info->msbc_read, in_bytes);
 	if (decoded < 0)
 		return decoded;
+	if (info->link_stats) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+		subtract_timespecs(&end, &begin, &end);
+		hfp_link_stats_plc(info->link_stats,
+				   end.tv_sec * 1000000 + end.tv_nsec / 1000);
+	}
 
 	buf_increment_write(info->capture_buf, decoded);
 
 	return decoded;
 }
 
+/* Takes one of the frames concealed ahead for the frame just read, if any.
+ * Returns true when the frame read is to be dropped. */
+static bool take_concealed_ahead(struct hfp_info *info)
+{
+	if (!info->concealed_ahead)
+		return false;
+	info->concealed_ahead--;
+	return true;
+}
+
+/*
+ * Handle the case when mSBC frame is considered lost.
+ * Args:
+ *    info - The hfp_info instance holding mSBC codec and PLC objects.
+ */
+static int handle_packet_loss(struct hfp_info *info)
+{
+	/* It's possible client doesn't consume data causing overrun. In that
+	 * case we treat it as one mSBC frame read but dropped. */
+	info->msbc_num_in_frames++;
+	info->msbc_num_lost_frames++;
+
+	log_wbs_packet_lost(info);
+
+	if (take_concealed_ahead(info))
+		return 0;
+	return conceal_frame(info);
+}
+
 /* Checks if mSBC frame header aligns with the beginning of buffer. */
 static int msbc_frame_align(uint8_t *buf)
 {
@@ -462,7 +689,18 @@ static int msbc_frame_align(uint8_t *buf)
 	return 1;
 }
 
-int hfp_read_msbc(struct hfp_info *info)
+/*
+ * Handles one mSBC SCO packet of packet_size bytes, decoding the mSBC frame
+ * it completes into capture_buf.
+ * Args:
+ *    info - The hfp_info the packet is read for.
+ *    pkt - The SCO packet.
+ *    pkt_status - The HCI packet status flag the packet came with.
+ * Returns:
+ *    The bytes of PCM added to capture_buf, or negative error code.
+ */
+static int handle_msbc_packet(struct hfp_info *info, const uint8_t *pkt,
+			      uint8_t pkt_status)
 {
 	int err = 0;
 	unsigned int pcm_avail = 0;
@@ -473,37 +711,10 @@ int hfp_read_msbc(struct hfp_info *info)
 	const uint8_t *frame_head = NULL;
 	unsigned int seq;
 
-	struct msghdr msg = { 0 };
-	struct iovec iov;
-	struct cmsghdr *cmsg;
-	const unsigned int control_size = CMSG_SPACE(sizeof(int));
-	char control[control_size];
-	uint8_t pkt_status;
-
-	memset(control, 0, sizeof(control));
-recv_msbc_bytes:
-	msg.msg_iov = &iov;
-	msg.msg_iovlen = 1;
-	iov.iov_base = info->read_buf + info->read_wp;
-	iov.iov_len = info->packet_size;
-	msg.msg_control = control;
-	msg.msg_controllen = control_size;
-
-	err = recvmsg(info->fd, &msg, 0);
-	if (err < 0) {
-		syslog(LOG_ERR, "HCI SCO packet read err %s", strerror(errno));
-		if (errno == EINTR)
-			goto recv_msbc_bytes;
-		return err;
-	}
-	/*
-	 * Treat return code 0 (socket shutdown) as error here. BT stack
-	 * shall send signal to main thread for device disconnection.
-	 */
-	if (err != (int)info->packet_size) {
-		syslog(LOG_ERR, "Partially read %d bytes for mSBC packet", err);
-		return -1;
-	}
+	/* Packets are read right after the bytes not parsed yet, so this only
+	 * moves ones that come after a packet discarded. */
+	if (pkt != info->read_buf + info->read_wp)
+		memmove(info->read_buf + info->read_wp, pkt, info->packet_size);
 
 	/* Offset in input data breaks mSBC frame parsing. Discard this packet
 	 * until read alignment succeed. */
@@ -513,17 +724,7 @@ recv_msbc_bytes:
 		else
 			info->read_align_cb = NULL;
 	}
-	info->read_wp += err;
-
-	pkt_status = 0;
-	for (cmsg = CMSG_FIRSTHDR(&msg); cmsg != NULL;
-	     cmsg = CMSG_NXTHDR(&msg, cmsg)) {
-		if (cmsg->cmsg_level == SOL_BLUETOOTH &&
-		    cmsg->cmsg_type == BT_SCM_PKT_STATUS) {
-			size_t len = cmsg->cmsg_len - sizeof(*cmsg);
-			memcpy(&pkt_status, CMSG_DATA(cmsg), len);
-		}
-	}
+	info->read_wp += info->packet_size;
 
 	/*
 	 * HCI SCO packet status flag:
@@ -560,10 +761,6 @@ recv_msbc_bytes:
 	 * found, we shall handle it as packet loss.
 	 */
 	info->read_rp += MSBC_PKT_SIZE;
-	if (info->read_rp == info->read_wp) {
-		info->read_rp = 0;
-		info->read_wp = 0;
-	}
 	if (!frame_head)
 		return handle_packet_loss(info);
 
@@ -578,6 +775,13 @@ recv_msbc_bytes:
 		pcm_read += err;
 	}
 
+	/* Its time has been concealed already, the frame is too late. */
+	if (take_concealed_ahead(info)) {
+		log_wbs_packet_received(info);
+		info->msbc_num_in_frames++;
+		return pcm_read;
+	}
+
 	/* Check if there's room for more PCM. */
 	capture_buf = buf_write_pointer_size(info->capture_buf, &pcm_avail);
 	if (pcm_avail < MSBC_CODE_SIZE)
@@ -609,47 +813,222 @@ recv_msbc_bytes:
 	return pcm_read;
 }
 
-int hfp_read(struct hfp_info *info)
+/*
+ * Decodes the good mSBC packets at the start of a batch with one codec call,
+ * when each packet carries one whole frame in order. Anything else, a lost
+ * or corrupted packet or a frame split across packets, stops the batch and
+ * is left to handle_msbc_packet().
+ * Args:
+ *    info - The hfp_info the packets are read for.
+ *    pkts - The packets, at read_wp of read_buf.
+ *    n - The number of packets.
+ *    lens - The bytes read for each packet.
+ *    pkt_status - The HCI packet status flag of each packet.
+ * Returns:
+ *    The number of packets decoded.
+ */
+static int decode_msbc_batch(struct hfp_info *info, const uint8_t *pkts,
+			     int n, const unsigned int *lens,
+			     const uint8_t *pkt_status)
 {
-	int err = 0;
-	unsigned to_read;
+	unsigned int pcm_avail;
 	uint8_t *capture_buf;
+	int i, frames;
 
-	capture_buf = buf_write_pointer_size(info->capture_buf, &to_read);
+	if (info->packet_size != MSBC_PKT_SIZE || info->read_align_cb ||
+	    info->read_rp != info->read_wp ||
+	    info->msbc_read_current_corrupted || info->concealed_ahead)
+		return 0;
 
-	if (to_read < info->packet_size)
+	capture_buf = buf_write_pointer_size(info->capture_buf, &pcm_avail);
+	n = MIN(n, (int)(pcm_avail / MSBC_CODE_SIZE));
+	for (i = 0; i < n; i++) {
+		const uint8_t *pkt = pkts + i * MSBC_PKT_SIZE;
+
+		if (lens[i] != MSBC_PKT_SIZE || pkt_status[i] ||
+		    pkt[0] != H2_HEADER_0 || pkt[2] != MSBC_SYNC_WORD ||
+		    h2_header_get_seq(pkt + 1) !=
+			    (info->msbc_num_in_frames + i) % 4)
+			break;
+	}
+	/* A single packet gains nothing from the batch. */
+	if (i < 2)
 		return 0;
-	to_read = info->packet_size;
 
-recv_sample:
-	err = recv(info->fd, capture_buf, to_read, 0);
-	if (err < 0) {
-		syslog(LOG_ERR, "Read error %s", strerror(errno));
-		if (errno == EINTR)
-			goto recv_sample;
+	frames = cras_msbc_decode_frames(info->msbc_read,
+					 pkts + MSBC_H2_HEADER_LEN,
+					 MSBC_PKT_SIZE, i, capture_buf,
+					 pcm_avail);
+	for (i = 0; i < frames; i++) {
+		uint8_t *pcm = capture_buf + i * MSBC_CODE_SIZE;
 
-		return err;
+		log_wbs_packet_received(info);
+		cras_msbc_plc_handle_good_frames(info->msbc_plc, pcm, pcm);
+		info->msbc_num_in_frames++;
 	}
+	buf_increment_write(info->capture_buf, frames * MSBC_CODE_SIZE);
+	info->read_wp += frames * MSBC_PKT_SIZE;
+	info->read_rp = info->read_wp;
+	return frames;
+}
 
-	if (err != (int)info->packet_size) {
-		/* Allow the SCO packet size be modified from the default MTU
-		 * value to the size of SCO data we first read. This is for
-		 * some adapters who prefers a different value than MTU for
-		 * transmitting SCO packet.
+int hfp_read_msbc(struct hfp_info *info)
+{
+	uint8_t *pkts = info->read_buf + info->read_wp;
+	unsigned int lens[MAX_SCO_BATCH];
+	uint8_t pkt_status[MAX_SCO_BATCH];
+	int i, n, err, pcm_read = 0;
+
+	n = recv_sco_packets(info, pkts, info->packet_size, MAX_SCO_BATCH,
+			     lens, pkt_status);
+	if (n <= 0)
+		return n;
+	info->read_packets = n;
+
+	i = decode_msbc_batch(info, pkts, n, lens, pkt_status);
+	pcm_read = i * MSBC_CODE_SIZE;
+	for (; i < n; i++) {
+		/*
+		 * Treat return code 0 (socket shutdown) as error here. BT stack
+		 * shall send signal to main thread for device disconnection.
 		 */
-		if (err && (info->packet_size == info->mtu)) {
-			info->packet_size = err;
-		} else {
+		if (lens[i] != info->packet_size) {
 			syslog(LOG_ERR,
-			       "Partially read %d bytes for %u size SCO packet",
-			       err, info->packet_size);
+			       "Partially read %u bytes for mSBC packet",
+			       lens[i]);
 			return -1;
 		}
+
+		err = handle_msbc_packet(info, pkts + i * info->packet_size,
+					 pkt_status[i]);
+		if (err < 0)
+			return err;
+		pcm_read += err;
 	}
 
-	buf_increment_write(info->capture_buf, err);
+	compact_sco_buf(info->read_buf, &info->read_rp, &info->read_wp);
+	return pcm_read;
+}
 
-	return err;
+int hfp_read(struct hfp_info *info)
+{
+	unsigned int lens[MAX_SCO_BATCH];
+	unsigned int to_read, stride, read = 0;
+	uint8_t *capture_buf;
+	int i, n;
+
+	capture_buf = buf_write_pointer_size(info->capture_buf, &to_read);
+
+	stride = info->packet_size;
+	n = MIN(to_read / stride, MAX_SCO_BATCH);
+	if (n == 0)
+		return 0;
+
+	n = recv_sco_packets(info, capture_buf, stride, n, lens, NULL);
+	if (n <= 0)
+		return n;
+	info->read_packets = n;
+
+	for (i = 0; i < n; i++) {
+		if (lens[i] != info->packet_size) {
+			/* Allow the SCO packet size be modified from the
+			 * default MTU value to the size of SCO data we first
+			 * read. This is for some adapters who prefers a
+			 * different value than MTU for transmitting SCO packet.
+			 */
+			if (lens[i] && (info->packet_size == info->mtu)) {
+				info->packet_size = lens[i];
+			} else {
+				syslog(LOG_ERR,
+				       "Partially read %u bytes for %u size "
+				       "SCO packet",
+				       lens[i], info->packet_size);
+				return -1;
+			}
+		}
+
+		/* Packets are read stride apart, close the gaps shorter ones
+		 * leave. */
+		if (read != i * stride)
+			memmove(capture_buf + read, capture_buf + i * stride,
+				lens[i]);
+		read += lens[i];
+	}
+
+	buf_increment_write(info->capture_buf, read);
+
+	return read;
+}
+
+/* Accounts the time since the last read against the audio the packets just
+ * read bring, for the jitter of the link. */
+static void log_sco_read(struct hfp_info *info)
+{
+	struct timespec now, interval;
+	unsigned int rate = info->msbc_read ? 16000 : 8000;
+	unsigned int interval_usec, d;
+	bool first = !info->last_read_ts.tv_sec && !info->last_read_ts.tv_nsec;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &info->last_read_ts, &interval);
+	info->last_read_ts = now;
+	interval_usec = interval.tv_sec * 1000000 + interval.tv_nsec / 1000;
+	info->rx_audio_usec = (uint64_t)info->read_packets *
+			      packet_frames(info) * 1000000 / rate;
+
+	/* The same jitter as the link statistics, kept apart since those are
+	 * optional. It sets how long capture waits on late packets. */
+	if (!first) {
+		d = interval_usec > info->rx_audio_usec ?
+			    interval_usec - info->rx_audio_usec :
+			    info->rx_audio_usec - interval_usec;
+		if (d > info->rx_jitter_usec)
+			info->rx_jitter_usec += (d - info->rx_jitter_usec) / 16;
+		else
+			info->rx_jitter_usec -= (info->rx_jitter_usec - d) / 16;
+	}
+
+	if (!info->link_stats)
+		return;
+	hfp_link_stats_wake(info->link_stats, interval_usec,
+			    info->rx_audio_usec);
+}
+
+int hfp_conceal_late_input(struct hfp_info *info)
+{
+	struct timespec now, since;
+	uint64_t since_usec, deadline;
+	unsigned int due;
+	int rc, concealed = 0;
+
+	if (!info->started || !info->msbc_read || !info->input_format_bytes ||
+	    (!info->last_read_ts.tv_sec && !info->last_read_ts.tv_nsec))
+		return 0;
+
+	/* The next packets are due when the audio last read has played, and
+	 * late once the wait for jitter has passed too. */
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &info->last_read_ts, &since);
+	since_usec = (uint64_t)since.tv_sec * 1000000 + since.tv_nsec / 1000;
+	deadline = info->rx_audio_usec + rx_target_usec(info);
+	if (since_usec < deadline)
+		return 0;
+	due = MIN((since_usec - deadline) / MSBC_FRAME_USEC + 1,
+		  MAX_CONCEALED_AHEAD);
+
+	/* Only what capture is short of, late packets may still come before
+	 * the rest is read. */
+	while (info->concealed_ahead < due &&
+	       buf_queued(info->capture_buf) < MSBC_CODE_SIZE) {
+		rc = conceal_frame(info);
+		if (rc < 0)
+			return rc;
+		if (rc == 0)
+			break;
+		info->concealed_ahead++;
+		concealed += rc;
+	}
+	return concealed / info->input_format_bytes;
 }
 
 /* Callback function to handle sample read and write.
@@ -657,9 +1036,9 @@ recv_sample:
  * there is actual some sample to read while the socket always reports
  * writable even when device buffer is full.
  * The strategy is to synchronize read & write operations:
- * 1. Read one chunk of MTU bytes of data.
+ * 1. Read all the SCO packets queued, up to MAX_SCO_BATCH, in one call.
  * 2. When input device not attached, ignore the data just read.
- * 3. When output device attached, write one chunk of MTU bytes of data.
+ * 3. Write as many SCO packets as were read, also in one call.
  */
 static int hfp_info_callback(void *arg, int revents)
 {
@@ -669,6 +1048,8 @@ static int hfp_info_callback(void *arg, int revents)
 	if (!info->started)
 		return 0;
 
+	info->read_packets = 0;
+
 	/* Allow last read before handling error or hang-up events. */
 	if (revents & POLLIN) {
 		err = info->read_cb(info);
@@ -681,6 +1062,14 @@ static int hfp_info_callback(void *arg, int revents)
 	if (!info->input_format_bytes)
 		buf_increment_read(info->capture_buf, err);
 
+	if (info->read_packets)
+		log_sco_read(info);
+
+	/* Reports of packets transmitted come on the error queue, and raise
+	 * POLLERR too. */
+	if (cras_bt_tx_delay_poll(&info->tx_delay, info->fd) > 0)
+		revents &= ~POLLERR;
+
 	if (revents & (POLLERR | POLLHUP)) {
 		syslog(LOG_ERR, "Error polling SCO socket, revent %d", revents);
 		goto read_write_error;
@@ -692,7 +1081,10 @@ static int hfp_info_callback(void *arg, int revents)
 	 */
 	if (!info->output_format_bytes)
 		buf_increment_write(info->playback_buf,
-				    info->msbc_write ? err : info->packet_size);
+				    info->msbc_write ?
+					    err :
+					    packets_to_write(info) *
+						    info->packet_size);
 
 	err = info->write_cb(info);
 	if (err < 0) {
@@ -700,6 +1092,12 @@ static int hfp_info_callback(void *arg, int revents)
 		goto read_write_error;
 	}
 
+	if (info->link_stats && info->tx_delay.enabled)
+		hfp_link_stats_queue_depth(
+			info->link_stats,
+			cras_bt_tx_delay_frames(&info->tx_delay) /
+				packet_frames(info));
+
 	return 0;
 
 read_write_error:
@@ -722,14 +1120,18 @@ struct hfp_info *hfp_info_create()
 	if (!info)
 		goto error;
 
-	info->capture_buf = byte_buffer_create(MAX_HFP_BUF_SIZE_BYTES);
+	/* Mirrored, the SCO packets and codec frames are never split at the
+	 * wrap. */
+	info->capture_buf = byte_buffer_create_mirrored(MAX_HFP_BUF_SIZE_BYTES);
 	if (!info->capture_buf)
 		goto error;
 
-	info->playback_buf = byte_buffer_create(MAX_HFP_BUF_SIZE_BYTES);
+	info->playback_buf =
+		byte_buffer_create_mirrored(MAX_HFP_BUF_SIZE_BYTES);
 	if (!info->playback_buf)
 		goto error;
 
+	cras_mem_stats_add(CRAS_MEM_BT, 2 * MAX_HFP_BUF_SIZE_BYTES);
 	return info;
 
 error:
@@ -749,6 +1151,12 @@ void hfp_info_set_wbs_logger(struct hfp_info *info,
 	info->wbs_logger = wbs_logger;
 }
 
+void hfp_info_set_link_stats(struct hfp_info *info,
+			     struct hfp_link_stats *link_stats)
+{
+	info->link_stats = link_stats;
+}
+
 int hfp_info_running(struct hfp_info *info)
 {
 	return info->started;
@@ -778,8 +1186,10 @@ int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info)
 			i = 0;
 		}
 		info->packet_size = wbs_supported_packet_size[i];
-		info->write_buf = (uint8_t *)malloc(wbs_hci_sco_buffer_size[i]);
-		info->read_buf = (uint8_t *)malloc(wbs_hci_sco_buffer_size[i]);
+		info->write_buf = (uint8_t *)malloc(
+			MAX_SCO_BATCH * wbs_hci_sco_buffer_size[i]);
+		info->read_buf = (uint8_t *)malloc(
+			MAX_SCO_BATCH * wbs_hci_sco_buffer_size[i]);
 
 		info->write_cb = hfp_write_msbc;
 		info->read_cb = hfp_read_msbc;
@@ -793,6 +1203,9 @@ int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info)
 		info->read_cb = hfp_read;
 	}
 
+	cras_bt_tx_delay_init(&info->tx_delay, info->fd);
+	if (info->link_stats)
+		hfp_link_stats_init(info->link_stats);
 	audio_thread_add_events_callback(info->fd, hfp_info_callback, info,
 					 POLLIN | POLLERR | POLLHUP);
 
@@ -809,6 +1222,10 @@ int hfp_info_start(int fd, unsigned int mtu, int codec, struct hfp_info *info)
 	info->read_align_cb =
 		(info->packet_size == MSBC_PKT_SIZE) ? NULL : msbc_frame_align;
 	info->msbc_read_current_corrupted = 0;
+	info->last_read_ts.tv_sec = 0;
+	info->last_read_ts.tv_nsec = 0;
+	info->rx_jitter_usec = 0;
+	info->concealed_ahead = 0;
 
 	return 0;
 }
@@ -852,12 +1269,15 @@ int hfp_info_stop(struct hfp_info *info)
 			(float)info->msbc_num_lost_frames /
 			info->msbc_num_in_frames);
 	}
+	if (info->link_stats)
+		cras_server_metrics_hfp_link_stats(info->link_stats);
 
 	return 0;
 }
 
 void hfp_info_destroy(struct hfp_info *info)
 {
+	cras_mem_stats_sub(CRAS_MEM_BT, 2 * MAX_HFP_BUF_SIZE_BYTES);
 	if (info->capture_buf)
 		byte_buffer_destroy(&info->capture_buf);
 
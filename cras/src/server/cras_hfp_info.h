@@ -22,6 +22,7 @@ struct hfp_packet_size_changed_callback {
  * socket acquired from bluez.
  */
 struct hfp_info;
+struct hfp_link_stats;
 
 /* Creates an hfp_info instance.
  */
@@ -34,6 +35,11 @@ void hfp_info_destroy(struct hfp_info *info);
 void hfp_info_set_wbs_logger(struct hfp_info *info,
 			     struct packet_status_logger *wbs_logger);
 
+/* Sets the statistics of the link quality to hfp_info instance, they are
+ * reset when it starts. */
+void hfp_info_set_link_stats(struct hfp_info *info,
+			     struct hfp_link_stats *link_stats);
+
 /* Checks if given hfp_info is running. */
 int hfp_info_running(struct hfp_info *info);
 
@@ -57,6 +63,32 @@ int hfp_info_stop(struct hfp_info *info);
  */
 int hfp_buf_queued(struct hfp_info *info, enum CRAS_STREAM_DIRECTION direction);
 
+/* Queries how many frames written to the SCO socket are not transmitted
+ * yet, 0 when the socket doesn't report transmitted packets.
+ * Args:
+ *    info - The hfp_info holding the SCO socket.
+ */
+unsigned int hfp_tx_delay_frames(struct hfp_info *info);
+
+/* Queries how many frames capture waits for late SCO packets before
+ * concealing them, adapted to the jitter the packets come with. 0 when the
+ * codec has no packet loss concealment.
+ * Args:
+ *    info - The hfp_info reading the SCO socket.
+ */
+unsigned int hfp_rx_delay_frames(struct hfp_info *info);
+
+/* Conceals the mSBC frames of SCO packets late beyond the jitter expected,
+ * when the capture buffer runs short of them. The packets are dropped if
+ * they come later, so capture is neither starved while waiting nor flooded
+ * when they arrive in a burst.
+ * Args:
+ *    info - The hfp_info holding the capture buffer.
+ * Returns:
+ *    The number of frames concealed, or negative error code.
+ */
+int hfp_conceal_late_input(struct hfp_info *info);
+
 /* Fill output buffer with zero frames.
  * Args:
  *    info - The hfp_info holding the output buffer.
@@ -119,6 +119,8 @@ static int frames_queued(const struct cras_iodev *iodev,
 	/* Do not enable timestamp mechanism on HFP device because last time
 	 * stamp might be a long time ago and it is not really useful. */
 	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		hfp_conceal_late_input(hfpio->info);
 	return hfp_buf_queued(hfpio->info, iodev->direction);
 }
 
@@ -206,9 +208,19 @@ static void set_hfp_volume(struct cras_iodev *iodev)
 
 static int delay_frames(const struct cras_iodev *iodev)
 {
+	struct hfp_io *hfpio = (struct hfp_io *)iodev;
 	struct timespec tstamp;
+	int queued;
+
+	queued = frames_queued(iodev, &tstamp);
+	if (queued < 0)
+		return queued;
 
-	return frames_queued(iodev, &tstamp);
+	/* Captured audio also waits on late packets, played audio on the
+	 * frames that left the buffer and aren't transmitted yet. */
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		return queued + hfp_rx_delay_frames(hfpio->info);
+	return queued + hfp_tx_delay_frames(hfpio->info);
 }
 
 static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
@@ -297,6 +309,7 @@ struct cras_iodev *hfp_iodev_create(enum CRAS_STREAM_DIRECTION dir,
 
 	iodev = &hfpio->base;
 	iodev->direction = dir;
+	iodev->clock_domain = device;
 
 	hfpio->device = device;
 	hfpio->slc = slc;
@@ -18,19 +18,25 @@
 #include "cras_audio_thread_monitor.h"
 #include "cras_device_monitor.h"
 #include "cras_dsp.h"
+#include "cras_dsp_offload.h"
 #include "cras_dsp_pipeline.h"
 #include "cras_fmt_conv.h"
+#include "cras_id_map.h"
 #include "cras_iodev.h"
 #include "cras_main_thread_log.h"
 #include "cras_iodev_list.h"
+#include "cras_level_meter.h"
 #include "cras_mix.h"
 #include "cras_ramp.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
+#include "cras_trace.h"
 #include "cras_util.h"
 #include "dev_stream.h"
+#include "dsp_util.h"
 #include "input_data.h"
+#include "mix_bus.h"
 #include "utlist.h"
 #include "rate_estimator.h"
 #include "softvol_curve.h"
@@ -41,6 +47,9 @@ static const float RAMP_MUTE_DURATION_SECS = 0.1;
 static const float RAMP_RESUME_MUTE_DURATION_SECS = 1;
 static const float RAMP_SWITCH_MUTE_DURATION_SECS = 0.5;
 static const float RAMP_VOLUME_CHANGE_DURATION_SECS = 0.1;
+/* How long the DSP keeps running on silent output, for the tails of its
+ * filters and compressors to die out, before it is skipped. */
+static const float DSP_SILENCE_HOLD_SECS = 0.5;
 
 /*
  * It is the lastest time for the device to wake up when it is in the normal
@@ -66,6 +75,13 @@ static const struct timespec rate_estimation_window_sz = {
 	5, 0 /* 5 sec. */
 };
 static const double rate_estimation_smooth_factor = 0.3f;
+/* Devices cras_iodev_update_rates() passes to the rate estimators at once. */
+#define RATE_UPDATE_BATCH 8
+/* Frames of a volume ramp whose gains are computed at a time. */
+#define RAMP_GAIN_FRAMES 256
+/* Frames run through all the post mix stages at a time when the device has
+ * no DSP, 8KB of 8 channels of 32 bit samples, which stay in the L1 cache. */
+#define POST_MIX_BLOCK_FRAMES 256
 
 static void cras_iodev_alloc_dsp(struct cras_iodev *iodev);
 
@@ -299,17 +315,23 @@ static int cras_iodev_output_event_sample_ready(struct cras_iodev *odev)
 
 /* Finds the supported sample rate that best suits the requested rate, "rrate".
  * Exact matches have highest priority, then integer multiples, then the default
- * rate for the device. */
+ * rate for the device. Low rates are only matched exactly by outputs running
+ * at the native rate of their streams. */
 static size_t get_best_rate(struct cras_iodev *iodev, size_t rrate)
 {
 	size_t i;
 	size_t best;
+	size_t min_exact = 44100;
 
 	if (iodev->supported_rates[0] == 0) /* No rates supported */
 		return 0;
 
+	if (iodev->direction == CRAS_STREAM_OUTPUT &&
+	    cras_system_get_native_rate_enabled())
+		min_exact = 0;
+
 	for (i = 0, best = 0; iodev->supported_rates[i] != 0; i++) {
-		if (rrate == iodev->supported_rates[i] && rrate >= 44100)
+		if (rrate == iodev->supported_rates[i] && rrate >= min_exact)
 			return rrate;
 		if (best == 0 && (rrate % iodev->supported_rates[i] == 0 ||
 				  iodev->supported_rates[i] % rrate == 0))
@@ -370,26 +392,49 @@ static snd_pcm_format_t get_best_pcm_format(struct cras_iodev *iodev,
 static int apply_dsp(struct cras_iodev *iodev, uint8_t *buf, size_t frames)
 {
 	struct cras_dsp_context *ctx;
-	struct pipeline *pipeline;
+
 	int rc;
 
 	ctx = iodev->dsp_context;
 	if (!ctx)
 		return 0;
 
-	pipeline = cras_dsp_get_pipeline(ctx);
-	if (!pipeline)
-		return 0;
+	CRAS_TRACE2(apply_dsp_begin, iodev->info.idx, frames);
+	if (iodev->dsp_offload)
+		rc = cras_dsp_offload_apply(iodev->dsp_offload, buf, frames);
+	else
+		rc = cras_dsp_apply(ctx, buf, iodev->format->format, frames);
+	CRAS_TRACE1(apply_dsp_end, rc);
+	return rc;
+}
 
-	rc = cras_dsp_pipeline_apply(pipeline, buf, iodev->format->format,
-				     frames);
+/* Starts running the DSP of an open output device on a worker thread, if
+ * the board asks for it. */
+static void alloc_dsp_offload(struct cras_iodev *iodev)
+{
+	if (iodev->direction != CRAS_STREAM_OUTPUT || !iodev->dsp_context ||
+	    !cras_system_get_dsp_offload_enabled())
+		return;
 
-	cras_dsp_put_pipeline(ctx);
-	return rc;
+	iodev->dsp_offload = cras_dsp_offload_create(iodev->dsp_context,
+						     iodev->format,
+						     iodev->min_cb_level,
+						     iodev->buffer_size);
+	if (!iodev->dsp_offload)
+		syslog(LOG_ERR, "Failed to offload dsp for %s",
+		       iodev->info.name);
+}
+
+static void free_dsp_offload(struct cras_iodev *iodev)
+{
+	cras_dsp_offload_destroy(iodev->dsp_offload);
+	iodev->dsp_offload = NULL;
 }
 
 static void cras_iodev_free_dsp(struct cras_iodev *iodev)
 {
+	/* The offload worker runs the context, stop it first. */
+	free_dsp_offload(iodev);
 	if (iodev->dsp_context) {
 		cras_dsp_context_free(iodev->dsp_context);
 		iodev->dsp_context = NULL;
@@ -498,11 +543,13 @@ int cras_iodev_set_format(struct cras_iodev *iodev,
 
 		update_channel_layout(iodev);
 
-		if (!iodev->rate_est)
+		if (!iodev->rate_est) {
 			iodev->rate_est = rate_estimator_create(
 				actual_rate, &rate_estimation_window_sz,
 				rate_estimation_smooth_factor);
-		else
+			rate_estimator_set_outlier_rejection(iodev->rate_est,
+							     1);
+		} else
 			rate_estimator_reset_rate(iodev->rate_est, actual_rate);
 	}
 
@@ -522,17 +569,19 @@ static void add_ext_dsp_module_to_pipeline(struct cras_iodev *iodev)
 	struct pipeline *pipeline;
 
 	pipeline = iodev->dsp_context ?
-			   cras_dsp_get_pipeline(iodev->dsp_context) :
+			   cras_dsp_lock_pipeline(iodev->dsp_context) :
 			   NULL;
 
 	if (!pipeline) {
+		if (iodev->dsp_context)
+			cras_dsp_unlock_pipeline(iodev->dsp_context);
 		cras_iodev_alloc_dsp(iodev);
 		cras_dsp_load_mock_pipeline(iodev->dsp_context,
 					    iodev->format->num_channels);
-		pipeline = cras_dsp_get_pipeline(iodev->dsp_context);
+		pipeline = cras_dsp_lock_pipeline(iodev->dsp_context);
 	}
-	/* dsp_context mutex locked. Now it's safe to modify dsp
-	 * pipeline resources. */
+	/* The audio thread is off the pipeline. Now it's safe to modify
+	 * dsp pipeline resources. */
 
 	if (iodev->ext_dsp_module)
 		iodev->ext_dsp_module->configure(iodev->ext_dsp_module,
@@ -542,8 +591,7 @@ static void add_ext_dsp_module_to_pipeline(struct cras_iodev *iodev)
 
 	cras_dsp_pipeline_set_sink_ext_module(pipeline, iodev->ext_dsp_module);
 
-	/* Unlock dsp_context mutex. */
-	cras_dsp_put_pipeline(iodev->dsp_context);
+	cras_dsp_unlock_pipeline(iodev->dsp_context);
 }
 
 /*
@@ -556,15 +604,11 @@ static void release_ext_dsp_module_from_pipeline(struct cras_iodev *iodev)
 	if (iodev->dsp_context == NULL)
 		return;
 
-	pipeline = cras_dsp_get_pipeline(iodev->dsp_context);
-	if (pipeline == NULL)
-		return;
-	/* dsp_context mutex locked. */
-
-	cras_dsp_pipeline_set_sink_ext_module(pipeline, NULL);
+	pipeline = cras_dsp_lock_pipeline(iodev->dsp_context);
+	if (pipeline)
+		cras_dsp_pipeline_set_sink_ext_module(pipeline, NULL);
 
-	/* Unlock dsp_context mutex. */
-	cras_dsp_put_pipeline(iodev->dsp_context);
+	cras_dsp_unlock_pipeline(iodev->dsp_context);
 }
 
 void cras_iodev_set_ext_dsp_module(struct cras_iodev *iodev,
@@ -581,6 +625,15 @@ void cras_iodev_set_ext_dsp_module(struct cras_iodev *iodev,
 		release_ext_dsp_module_from_pipeline(iodev);
 }
 
+/* Passes the plugins cras_dsp_load_firmware() offers to the iodev. */
+static int load_dsp_firmware(const struct plugin *plugin, int sample_rate,
+			     int bypass, void *arg)
+{
+	struct cras_iodev *iodev = (struct cras_iodev *)arg;
+
+	return iodev->load_dsp_firmware(iodev, plugin, sample_rate, bypass);
+}
+
 void cras_iodev_update_dsp(struct cras_iodev *iodev)
 {
 	char swap_lr_disabled = 1;
@@ -597,6 +650,10 @@ void cras_iodev_update_dsp(struct cras_iodev *iodev)
 	cras_dsp_set_variable_boolean(iodev->dsp_context, "swap_lr_disabled",
 				      swap_lr_disabled);
 
+	if (iodev->load_dsp_firmware)
+		cras_dsp_load_firmware(iodev->dsp_context, load_dsp_firmware,
+				       iodev);
+
 	cras_dsp_load_pipeline(iodev->dsp_context);
 }
 
@@ -624,6 +681,48 @@ void cras_iodev_free_format(struct cras_iodev *iodev)
 	iodev->format = NULL;
 }
 
+void cras_iodev_save_resume_format(struct cras_iodev *iodev)
+{
+	cras_iodev_drop_resume_format(iodev);
+	if (!cras_iodev_is_open(iodev) || !iodev->format || !iodev->active_node)
+		return;
+
+	iodev->resume_format = malloc(sizeof(*iodev->resume_format));
+	if (!iodev->resume_format)
+		return;
+	*iodev->resume_format = *iodev->format;
+	iodev->resume_node_idx = iodev->active_node->idx;
+}
+
+void cras_iodev_drop_resume_format(struct cras_iodev *iodev)
+{
+	free(iodev->resume_format);
+	iodev->resume_format = NULL;
+}
+
+/* Restores the format saved at suspend if the iodev is reopened on the same
+ * node. The DSP context was kept open across the close, so it already matches
+ * this format. Returns 0 if the format was restored. */
+static int restore_resume_format(struct cras_iodev *iodev)
+{
+	struct cras_audio_format *fmt = iodev->resume_format;
+
+	if (!fmt)
+		return -ENOENT;
+	iodev->resume_format = NULL;
+
+	if (!iodev->active_node ||
+	    iodev->active_node->idx != iodev->resume_node_idx) {
+		free(fmt);
+		return -ENOENT;
+	}
+
+	iodev->format = fmt;
+	if (iodev->rate_est)
+		rate_estimator_reset_rate(iodev->rate_est, fmt->frame_rate);
+	return 0;
+}
+
 void cras_iodev_init_audio_area(struct cras_iodev *iodev, int num_channels)
 {
 	if (iodev->area)
@@ -644,6 +743,7 @@ void cras_iodev_free_audio_area(struct cras_iodev *iodev)
 
 void cras_iodev_free_resources(struct cras_iodev *iodev)
 {
+	cras_iodev_drop_resume_format(iodev);
 	cras_iodev_free_dsp(iodev);
 	rate_estimator_destroy(iodev->rate_est);
 	if (iodev->ramp)
@@ -662,6 +762,8 @@ static void cras_iodev_alloc_dsp(struct cras_iodev *iodev)
 	cras_iodev_free_dsp(iodev);
 	iodev->dsp_context =
 		cras_dsp_context_new(iodev->format->frame_rate, purpose);
+	if (cras_iodev_is_open(iodev))
+		alloc_dsp_offload(iodev);
 }
 
 void cras_iodev_fill_time_from_frames(size_t frames, size_t frame_rate,
@@ -743,6 +845,16 @@ bool cras_iodev_is_on_internal_card(const struct cras_ionode *node)
 	return false;
 }
 
+/* Returns the software volume scaler of volume, from the table precomputed
+ * for the curve of the active node or the default one. */
+static float softvol_scaler(const struct cras_iodev *iodev,
+			    unsigned int volume)
+{
+	if (iodev->active_node && iodev->active_node->softvol_scalers)
+		return iodev->active_node->softvol_scalers[volume];
+	return softvol_get_scaler(volume);
+}
+
 float cras_iodev_get_software_volume_scaler(struct cras_iodev *iodev)
 {
 	unsigned int volume;
@@ -750,9 +862,7 @@ float cras_iodev_get_software_volume_scaler(struct cras_iodev *iodev)
 	volume = cras_iodev_adjust_active_node_volume(iodev,
 						      cras_system_get_volume());
 
-	if (iodev->active_node && iodev->active_node->softvol_scalers)
-		return iodev->active_node->softvol_scalers[volume];
-	return softvol_get_scaler(volume);
+	return softvol_scaler(iodev, volume);
 }
 
 float cras_iodev_get_software_gain_scaler(const struct cras_iodev *iodev)
@@ -785,6 +895,40 @@ int cras_iodev_get_valid_frames(struct cras_iodev *odev,
 	}
 }
 
+/* Picks the stream the output plays untouched, the first PASSTHROUGH one
+ * the device runs at the format of, if its sink decodes compressed audio.
+ * While there is one every other stream is held. So is a PASSTHROUGH stream
+ * the device can't play, its bitstream must never be played as PCM. */
+static void update_passthrough(struct cras_iodev *iodev)
+{
+	const struct cras_audio_format *fmt;
+	struct dev_stream *out;
+
+	if (iodev->direction != CRAS_STREAM_OUTPUT)
+		return;
+
+	iodev->passthrough = NULL;
+	DL_FOREACH (iodev->streams, out) {
+		fmt = &out->stream->format;
+		if (!(out->stream->flags & PASSTHROUGH) || iodev->passthrough)
+			continue;
+		if (iodev->active_node &&
+		    iodev->active_node->compressed_formats &&
+		    fmt->format == iodev->format->format &&
+		    fmt->frame_rate == iodev->format->frame_rate &&
+		    fmt->num_channels == iodev->format->num_channels)
+			iodev->passthrough = out;
+		else
+			syslog(LOG_WARNING,
+			       "%s can't play passthrough stream %x as is",
+			       iodev->info.name, out->stream->stream_id);
+	}
+	DL_FOREACH (iodev->streams, out)
+		out->held = out != iodev->passthrough &&
+			    (iodev->passthrough ||
+			     (out->stream->flags & PASSTHROUGH));
+}
+
 int cras_iodev_add_stream(struct cras_iodev *iodev, struct dev_stream *stream)
 {
 	/*
@@ -792,18 +936,101 @@ int cras_iodev_add_stream(struct cras_iodev *iodev, struct dev_stream *stream)
 	 * For output stream, start stream after its first fetch such that it does not
 	 * block other existing streams.
 	 */
-	DL_APPEND(iodev->streams, stream);
+	int rc;
+
+	if (!iodev->stream_index) {
+		iodev->stream_index = cras_id_map_create();
+		if (!iodev->stream_index)
+			return -ENOMEM;
+	}
+	rc = cras_id_map_insert(iodev->stream_index, stream->stream->stream_id,
+				stream);
+	if (rc < 0) {
+		if (!iodev->streams) {
+			cras_id_map_destroy(iodev->stream_index);
+			iodev->stream_index = NULL;
+		}
+		return rc;
+	}
+	/* Fetch and mix serve LOW_LATENCY output streams first. */
+	if (stream->stream->direction == CRAS_STREAM_OUTPUT &&
+	    (stream->stream->flags & LOW_LATENCY))
+		DL_PREPEND(iodev->streams, stream);
+	else
+		DL_APPEND(iodev->streams, stream);
 	if (!iodev->buf_state)
 		iodev->buf_state = buffer_share_create(iodev->buffer_size);
 	if (stream->stream->direction == CRAS_STREAM_INPUT)
 		cras_iodev_start_stream(iodev, stream);
+	update_passthrough(iodev);
 	return 0;
 }
 
+/* Recomputes the callback levels from the running streams. */
+static void update_cb_levels(struct cras_iodev *iodev)
+{
+	struct dev_stream *stream;
+	unsigned int cb_threshold;
+
+	iodev->min_cb_level = iodev->buffer_size / 2;
+	iodev->max_cb_level = 0;
+	DL_FOREACH (iodev->streams, stream) {
+		if (!dev_stream_is_running(stream))
+			continue;
+		cb_threshold = dev_stream_cb_threshold(stream);
+		iodev->min_cb_level = MIN(iodev->min_cb_level, cb_threshold);
+		iodev->max_cb_level = MAX(iodev->max_cb_level, cb_threshold);
+	}
+	iodev->largest_cb_level =
+		MAX(iodev->largest_cb_level, iodev->max_cb_level);
+}
+
+/* Resizes the callbacks of the ADAPTIVE_CB streams to the smallest callback
+ * level of the other running streams, which the device wakes at anyway.
+ * Returns true if a callback size changed. */
+static bool adapt_stream_cb_thresholds(struct cras_iodev *iodev)
+{
+	struct dev_stream *stream;
+	struct cras_rstream *rstream;
+	unsigned int period = 0, cb_threshold;
+	size_t old_threshold;
+	bool changed = false;
+
+	if (!iodev->format)
+		return false;
+
+	DL_FOREACH (iodev->streams, stream) {
+		if (!dev_stream_is_running(stream) ||
+		    (stream->stream->flags & ADAPTIVE_CB))
+			continue;
+		cb_threshold = dev_stream_cb_threshold(stream);
+		if (!period || cb_threshold < period)
+			period = cb_threshold;
+	}
+	if (!period)
+		return false;
+
+	DL_FOREACH (iodev->streams, stream) {
+		rstream = stream->stream;
+		/* A stream on several devices keeps its size. */
+		if (!(rstream->flags & ADAPTIVE_CB) ||
+		    rstream->num_attached_devs > 1)
+			continue;
+		old_threshold = rstream->cb_threshold;
+		cb_threshold = cras_frames_at_rate(iodev->format->frame_rate,
+						   period,
+						   rstream->format.frame_rate);
+		if (cras_rstream_set_cb_threshold(rstream, cb_threshold) !=
+		    old_threshold)
+			changed = true;
+	}
+	return changed;
+}
+
 void cras_iodev_start_stream(struct cras_iodev *iodev,
 			     struct dev_stream *stream)
 {
-	unsigned int cb_threshold = dev_stream_cb_threshold(stream);
+	unsigned int cb_threshold;
 
 	if (dev_stream_is_running(stream))
 		return;
@@ -814,10 +1041,15 @@ void cras_iodev_start_stream(struct cras_iodev *iodev,
 	if (!(stream->stream->flags & TRIGGER_ONLY))
 		buffer_share_add_id(iodev->buf_state, stream->stream->stream_id,
 				    NULL);
+	dev_stream_set_running(stream);
+	if (adapt_stream_cb_thresholds(iodev)) {
+		update_cb_levels(iodev);
+		return;
+	}
+	cb_threshold = dev_stream_cb_threshold(stream);
 	iodev->min_cb_level = MIN(iodev->min_cb_level, cb_threshold);
 	iodev->max_cb_level = MAX(iodev->max_cb_level, cb_threshold);
 	iodev->largest_cb_level = MAX(iodev->largest_cb_level, cb_threshold);
-	dev_stream_set_running(stream);
 }
 
 struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
@@ -835,6 +1067,8 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 		if (out->stream == rstream) {
 			buffer_share_rm_id(iodev->buf_state,
 					   rstream->stream_id);
+			cras_id_map_remove(iodev->stream_index,
+					   rstream->stream_id);
 			ret = out;
 			DL_DELETE(iodev->streams, out);
 			continue;
@@ -852,10 +1086,16 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 				   &out->stream->next_cb_ts))
 			earliest_next_cb_ts = out->stream->next_cb_ts;
 	}
+	if (adapt_stream_cb_thresholds(iodev))
+		update_cb_levels(iodev);
+	if (ret)
+		update_passthrough(iodev);
 
 	if (!iodev->streams) {
 		buffer_share_destroy(iodev->buf_state);
 		iodev->buf_state = NULL;
+		cras_id_map_destroy(iodev->stream_index);
+		iodev->stream_index = NULL;
 		iodev->min_cb_level = iodev->buffer_size / 2;
 		/* Let output device transit into no stream state if it's
 		 * in normal run state now. Leave input device in normal
@@ -876,6 +1116,12 @@ struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 	return ret;
 }
 
+struct dev_stream *cras_iodev_find_stream(const struct cras_iodev *iodev,
+					  cras_stream_id_t stream_id)
+{
+	return cras_id_map_find(iodev->stream_index, stream_id);
+}
+
 unsigned int cras_iodev_stream_offset(struct cras_iodev *iodev,
 				      struct dev_stream *stream)
 {
@@ -914,6 +1160,30 @@ unsigned int cras_iodev_max_stream_offset(const struct cras_iodev *iodev)
 	return max;
 }
 
+/* Creates the float mix bus of an output device, for the sample formats the
+ * DSP can interleave to. Without a bus streams are mixed in the device
+ * buffer as usual. */
+static void alloc_mix_bus(struct cras_iodev *iodev)
+{
+	switch (iodev->format->format) {
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_FLOAT_LE:
+		break;
+	default:
+		return;
+	}
+
+	mix_bus_destroy(&iodev->mix_bus);
+	iodev->mix_bus = mix_bus_create(iodev->format->num_channels,
+					iodev->buffer_size);
+	if (!iodev->mix_bus)
+		syslog(LOG_ERR, "Failed to create mix bus for %s",
+		       iodev->info.name);
+}
+
 int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 		    const struct cras_audio_format *fmt)
 {
@@ -934,7 +1204,7 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 			return rc;
 	}
 
-	if (iodev->format == NULL) {
+	if (iodev->format == NULL && restore_resume_format(iodev)) {
 		rc = cras_iodev_set_format(iodev, fmt);
 		if (rc) {
 			iodev->close_dev(iodev);
@@ -964,7 +1234,18 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 	iodev->highest_hw_level = 0;
 	iodev->input_dsp_offset = 0;
 
-	ewma_power_init(&iodev->ewma, iodev->format->frame_rate);
+	ewma_power_init(&iodev->ewma, iodev->format->format,
+			iodev->format->frame_rate);
+	iodev->level_meter =
+		cras_level_meter_add(CRAS_LEVEL_METER_DEVICE, iodev->info.idx);
+	iodev->silent_output_frames = 0;
+	silence_gate_init(&iodev->silence_gate, iodev->format->frame_rate);
+	if (iodev->format->format != SND_PCM_FORMAT_S16_LE)
+		silence_gate_disable(&iodev->silence_gate);
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT &&
+	    cras_system_get_float_mix_bus_enabled())
+		alloc_mix_bus(iodev);
 
 	if (iodev->direction == CRAS_STREAM_OUTPUT) {
 		/* If device supports start ops, device can be in open state.
@@ -1001,6 +1282,9 @@ int cras_iodev_open(struct cras_iodev *iodev, unsigned int cb_level,
 	}
 
 	add_ext_dsp_module_to_pipeline(iodev);
+	/* After the call above, which may replace the dsp context. */
+	if (!iodev->dsp_offload)
+		alloc_dsp_offload(iodev);
 	clock_gettime(CLOCK_MONOTONIC_RAW, &iodev->open_ts);
 
 	return 0;
@@ -1030,6 +1314,11 @@ int cras_iodev_close(struct cras_iodev *iodev)
 		input_data_destroy(&iodev->input_data);
 	}
 
+	mix_bus_destroy(&iodev->mix_bus);
+	free_dsp_offload(iodev);
+	cras_level_meter_rm(iodev->level_meter);
+	iodev->level_meter = -1;
+
 	rc = iodev->close_dev(iodev);
 	if (rc)
 		syslog(LOG_ERR, "Error closing dev %s, rc %d", iodev->info.name,
@@ -1073,50 +1362,55 @@ int cras_iodev_put_input_buffer(struct cras_iodev *iodev)
 	return min_frames;
 }
 
-int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
-				 unsigned int nframes, int *is_non_empty,
-				 struct cras_fmt_conv *remix_converter)
+static bool has_loopback(const struct cras_iodev *iodev,
+			 enum CRAS_LOOPBACK_TYPE type)
+{
+	const struct cras_loopback *loopback;
+
+	DL_FOREACH (iodev->loopbacks, loopback)
+		if (loopback->type == type)
+			return true;
+	return false;
+}
+
+/* Scales nframes of frames by the volume ramp of action times scale,
+ * computing the gain of a block of RAMP_GAIN_FRAMES frames at a time. The
+ * frames start offset frames into the ramp action. */
+static void apply_ramp(const struct cras_audio_format *fmt, uint8_t *frames,
+		       unsigned int offset, unsigned int nframes,
+		       const struct cras_ramp_action *action, float scale)
+{
+	const unsigned int frame_bytes = cras_get_format_bytes(fmt);
+	float gains[RAMP_GAIN_FRAMES];
+	unsigned int done, n;
+
+	for (done = 0; done < nframes; done += n) {
+		n = MIN(nframes - done, RAMP_GAIN_FRAMES);
+		cras_ramp_action_gains(action, offset + done, scale, gains, n);
+		cras_scale_buffer_gains(fmt->format, frames, n, gains,
+					fmt->num_channels);
+		frames += n * frame_bytes;
+	}
+}
+
+/* The part of putting an output buffer after the DSP has run: post DSP
+ * loopbacks, volume, ramping and the remix. */
+static int put_output_post_dsp(struct cras_iodev *iodev, uint8_t *frames,
+			       unsigned int nframes, int silent,
+			       struct cras_fmt_conv *remix_converter)
 {
 	const struct cras_audio_format *fmt = iodev->format;
 	struct cras_ramp_action ramp_action = {
 		.type = CRAS_RAMP_ACTION_NONE,
 		.scaler = 0.0f,
 		.increment = 0.0f,
+		.ratio = 1.0f,
 		.target = 1.0f,
 	};
 	float software_volume_scaler = 1.0;
 	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
-	int rc;
 	struct cras_loopback *loopback;
 
-	/* Calculate whether the final output was non-empty, if requested. */
-	if (is_non_empty) {
-		const size_t bytes = nframes * cras_get_format_bytes(fmt);
-
-		/*
-		 * Speed up checking frames are all zeros using memcmp.
-		 * frames contains all zeros if both conditions are met:
-		 *  - frames[0] is 0.
-		 *  - frames[i] == frames[i+1] for i in [0, 1, ..., bytes - 2].
-		 */
-		*is_non_empty = bytes ? (*frames || memcmp(frames, frames + 1,
-							   bytes - 1)) :
-					0;
-	}
-
-	DL_FOREACH (iodev->loopbacks, loopback) {
-		if (loopback->type == LOOPBACK_POST_MIX_PRE_DSP)
-			loopback->hook_data(frames, nframes, iodev->format,
-					    loopback->cb_data);
-	}
-
-	ewma_power_calculate(&iodev->ewma, (int16_t *)frames,
-			     iodev->format->num_channels, nframes);
-
-	rc = apply_dsp(iodev, frames, nframes);
-	if (rc)
-		return rc;
-
 	DL_FOREACH (iodev->loopbacks, loopback) {
 		if (loopback->type == LOOPBACK_POST_DSP)
 			loopback->hook_data(frames, nframes, iodev->format,
@@ -1128,8 +1422,9 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 	}
 
 	/* Mute samples if adjusted volume is 0 or system is muted, plus
-	 * that this device is not ramping. */
-	if (output_should_mute(iodev) &&
+	 * that this device is not ramping. Silence is left as is by muting,
+	 * scaling and remixing, only the ramp has to count it. */
+	if (!silent && output_should_mute(iodev) &&
 	    ramp_action.type != CRAS_RAMP_ACTION_PARTIAL) {
 		const unsigned int frame_bytes = cras_get_format_bytes(fmt);
 		cras_mix_mute_buffer(frames, frame_bytes, nframes);
@@ -1142,23 +1437,13 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 	}
 
 	if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL) {
-		/* Scale with increment for ramp and possibly
-		 * software volume using cras_scale_buffer_increment.*/
-		float starting_scaler = ramp_action.scaler;
-		float increment = ramp_action.increment;
-		float target = ramp_action.target;
-
-		if (software_volume_needed) {
-			starting_scaler *= software_volume_scaler;
-			increment *= software_volume_scaler;
-			target *= software_volume_scaler;
-		}
-
-		cras_scale_buffer_increment(fmt->format, frames, nframes,
-					    starting_scaler, increment, target,
-					    fmt->num_channels);
+		/* Scale for ramp and possibly software volume. */
+		if (!silent)
+			apply_ramp(fmt, frames, 0, nframes, &ramp_action,
+				   software_volume_scaler);
 		cras_ramp_update_ramped_frames(iodev->ramp, nframes);
-	} else if (!output_should_mute(iodev) && software_volume_needed) {
+	} else if (!silent && !output_should_mute(iodev) &&
+		   software_volume_needed) {
 		/* Just scale for software volume using
 		 * cras_scale_buffer. */
 		unsigned int nsamples = nframes * fmt->num_channels;
@@ -1166,7 +1451,7 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				  software_volume_scaler);
 	}
 
-	if (remix_converter)
+	if (remix_converter && !silent)
 		cras_channel_remix_convert(remix_converter, iodev->format,
 					   frames, nframes);
 	if (iodev->rate_est)
@@ -1175,6 +1460,245 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 	return iodev->put_buffer(iodev, nframes);
 }
 
+/* Puts the frames of a PASSTHROUGH stream to the device as they are. They
+ * aren't PCM, so loopbacks, DSP, volume and remix are all skipped, only
+ * muting clears them. A ramp in progress is counted through to its end. */
+static int put_passthrough(struct cras_iodev *iodev, uint8_t *frames,
+			   unsigned int nframes, int *is_non_empty)
+{
+	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
+	struct cras_ramp_action ramp_action;
+
+	if (is_non_empty)
+		*is_non_empty = 1;
+	if (output_should_mute(iodev))
+		cras_mix_mute_buffer(frames, frame_bytes, nframes);
+	if (iodev->ramp) {
+		ramp_action = cras_ramp_get_current_action(iodev->ramp);
+		if (ramp_action.type == CRAS_RAMP_ACTION_PARTIAL)
+			cras_ramp_update_ramped_frames(iodev->ramp, nframes);
+	}
+	if (iodev->rate_est)
+		rate_estimator_add_frames(iodev->rate_est, nframes);
+
+	return iodev->put_buffer(iodev, nframes);
+}
+
+/* Counts the silent frames put to an output device and returns true if the
+ * DSP can be skipped for these ones. The DSP runs on silence for a while
+ * before, and an offloaded DSP always runs as it delays what it is given. */
+static bool skip_output_dsp(struct cras_iodev *iodev, int silent,
+			    unsigned int nframes)
+{
+	if (!silent) {
+		iodev->silent_output_frames = 0;
+		return false;
+	}
+	if (!iodev->dsp_context)
+		return true;
+	if (iodev->dsp_offload)
+		return false;
+	if (iodev->silent_output_frames >=
+	    DSP_SILENCE_HOLD_SECS * iodev->format->frame_rate)
+		return true;
+	iodev->silent_output_frames += nframes;
+	return false;
+}
+
+/* Puts an output buffer of a device without DSP. The loopbacks, volume,
+ * ramping and remix run on a block of POST_MIX_BLOCK_FRAMES frames after the
+ * other, so each block is read from memory once for all of them. Silent
+ * blocks are only passed to the loopbacks. */
+static int put_output_blocks(struct cras_iodev *iodev, uint8_t *frames,
+			     unsigned int nframes, int *is_non_empty,
+			     struct cras_fmt_conv *remix_converter)
+{
+	const struct cras_audio_format *fmt = iodev->format;
+	const unsigned int frame_bytes = cras_get_format_bytes(fmt);
+	struct cras_ramp_action ramp_action = {
+		.type = CRAS_RAMP_ACTION_NONE,
+		.scaler = 0.0f,
+		.increment = 0.0f,
+		.ratio = 1.0f,
+		.target = 1.0f,
+	};
+	float software_volume_scaler = 1.0;
+	int software_volume_needed = cras_iodev_software_volume_needed(iodev);
+	struct cras_loopback *loopback;
+	unsigned int done, n;
+	uint8_t *block;
+	int non_empty = 0;
+	int ramping, mute;
+
+	if (iodev->ramp)
+		ramp_action = cras_ramp_get_current_action(iodev->ramp);
+	ramping = ramp_action.type == CRAS_RAMP_ACTION_PARTIAL;
+	mute = output_should_mute(iodev);
+	if (software_volume_needed)
+		software_volume_scaler =
+			cras_iodev_get_software_volume_scaler(iodev);
+
+	/* Only reads a frame every few milliseconds. */
+	ewma_power_calculate(&iodev->ewma, frames, fmt->num_channels, nframes);
+	cras_level_meter_update(iodev->level_meter, &iodev->ewma);
+
+	for (done = 0; done < nframes; done += n) {
+		n = MIN(nframes - done, POST_MIX_BLOCK_FRAMES);
+		block = frames + (size_t)done * frame_bytes;
+
+		/* Without DSP the mix reaches both kinds of loopback as is. */
+		DL_FOREACH (iodev->loopbacks, loopback)
+			loopback->hook_data(block, n, fmt, loopback->cb_data);
+
+		if (cras_mix_buffer_is_zero(block, (size_t)n * frame_bytes))
+			continue;
+		non_empty = 1;
+
+		if (ramping)
+			apply_ramp(fmt, block, done, n, &ramp_action,
+				   software_volume_scaler);
+		else if (mute)
+			cras_mix_mute_buffer(block, frame_bytes, n);
+		else if (software_volume_needed)
+			cras_scale_buffer(fmt->format, block,
+					  n * fmt->num_channels,
+					  software_volume_scaler);
+
+		if (remix_converter && (ramping || !mute))
+			cras_channel_remix_convert(remix_converter, fmt, block,
+						   n);
+	}
+
+	if (is_non_empty)
+		*is_non_empty = non_empty;
+	if (non_empty)
+		iodev->silent_output_frames = 0;
+	if (ramping)
+		cras_ramp_update_ramped_frames(iodev->ramp, nframes);
+	if (iodev->rate_est)
+		rate_estimator_add_frames(iodev->rate_est, nframes);
+
+	return iodev->put_buffer(iodev, nframes);
+}
+
+int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
+				 unsigned int nframes, int *is_non_empty,
+				 struct cras_fmt_conv *remix_converter)
+{
+	const size_t bytes = nframes * cras_get_format_bytes(iodev->format);
+	int silent;
+	int rc;
+	struct cras_loopback *loopback;
+
+	if (iodev->passthrough)
+		return put_passthrough(iodev, frames, nframes, is_non_empty);
+	if (!iodev->dsp_context)
+		return put_output_blocks(iodev, frames, nframes, is_non_empty,
+					 remix_converter);
+
+	silent = cras_mix_buffer_is_zero(frames, bytes);
+	if (is_non_empty)
+		*is_non_empty = !silent;
+
+	DL_FOREACH (iodev->loopbacks, loopback) {
+		if (loopback->type == LOOPBACK_POST_MIX_PRE_DSP)
+			loopback->hook_data(frames, nframes, iodev->format,
+					    loopback->cb_data);
+	}
+
+	ewma_power_calculate(&iodev->ewma, frames, iodev->format->num_channels,
+			     nframes);
+	cras_level_meter_update(iodev->level_meter, &iodev->ewma);
+
+	if (!skip_output_dsp(iodev, silent, nframes)) {
+		rc = apply_dsp(iodev, frames, nframes);
+		if (rc)
+			return rc;
+		if (iodev->dsp_context)
+			silent = cras_mix_buffer_is_zero(frames, bytes);
+	}
+
+	return put_output_post_dsp(iodev, frames, nframes, silent,
+				   remix_converter);
+}
+
+int cras_iodev_put_output_bus(struct cras_iodev *iodev, uint8_t *frames,
+			      unsigned int nframes, int *is_non_empty,
+			      struct cras_fmt_conv *remix_converter)
+{
+	const struct cras_audio_format *fmt = iodev->format;
+	struct mix_bus *bus = iodev->mix_bus;
+	struct cras_dsp_context *ctx = iodev->dsp_context;
+	struct cras_loopback *loopback;
+	int interleaved = 0;
+	int silent;
+	int rc = 0;
+
+	silent = !mix_bus_non_empty(bus, nframes);
+	if (is_non_empty)
+		*is_non_empty = !silent;
+
+	/* Only pay for the integer copy of the mix when a loopback asks
+	 * for it. */
+	DL_FOREACH (iodev->loopbacks, loopback) {
+		if (loopback->type != LOOPBACK_POST_MIX_PRE_DSP)
+			continue;
+		if (!interleaved) {
+			rc = dsp_util_interleave(bus->planes, frames,
+						 bus->num_channels, fmt->format,
+						 nframes);
+			if (rc)
+				return rc;
+			interleaved = 1;
+		}
+		loopback->hook_data(frames, nframes, iodev->format,
+				    loopback->cb_data);
+	}
+
+	ewma_power_calculate_planar(&iodev->ewma, bus->planes,
+				    bus->num_channels, nframes);
+	cras_level_meter_update(iodev->level_meter, &iodev->ewma);
+
+	/* The pipeline reads the bus as is when it takes as many channels as
+	 * were mixed, otherwise it runs on the interleaved mix. */
+	if (skip_output_dsp(iodev, silent, nframes)) {
+		if (!interleaved)
+			cras_mix_mute_buffer(frames, cras_get_format_bytes(fmt),
+					     nframes);
+	} else if (interleaved || iodev->dsp_offload) {
+		/* The offload worker takes interleaved samples. */
+		if (!interleaved)
+			rc = dsp_util_interleave(bus->planes, frames,
+						 bus->num_channels, fmt->format,
+						 nframes);
+		if (!rc)
+			rc = apply_dsp(iodev, frames, nframes);
+	} else if (ctx) {
+		rc = cras_dsp_apply_planar(ctx, bus->planes, bus->num_channels,
+					   frames, fmt->format, nframes);
+	} else {
+		/* Without a pipeline the remix runs on the float mix, unless
+		 * a post DSP loopback takes the mix as it is. */
+		if (remix_converter && !has_loopback(iodev, LOOPBACK_POST_DSP) &&
+		    cras_channel_remix_convert_planar(remix_converter,
+						      bus->planes,
+						      bus->num_channels,
+						      nframes))
+			remix_converter = NULL;
+		rc = dsp_util_interleave(bus->planes, frames,
+					 bus->num_channels, fmt->format,
+					 nframes);
+	}
+	if (rc)
+		return rc;
+	if (ctx)
+		silent = cras_mix_buffer_is_zero(
+			frames, nframes * cras_get_format_bytes(fmt));
+
+	return put_output_post_dsp(iodev, frames, nframes, silent,
+				   remix_converter);
+}
+
 int cras_iodev_get_input_buffer(struct cras_iodev *iodev, unsigned int *frames)
 {
 	const unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
@@ -1218,6 +1742,11 @@ int cras_iodev_get_input_buffer(struct cras_iodev *iodev, unsigned int *frames)
 			return rc;
 		ewma_power_calculate_area(
 			&iodev->ewma,
+			hw_buffer + iodev->input_dsp_offset * frame_bytes,
+			data->area, *frames - iodev->input_dsp_offset);
+		cras_level_meter_update(iodev->level_meter, &iodev->ewma);
+		data->silent = silence_gate_process_area(
+			&iodev->silence_gate,
 			(int16_t *)(hw_buffer +
 				    iodev->input_dsp_offset * frame_bytes),
 			data->area, *frames - iodev->input_dsp_offset);
@@ -1247,17 +1776,44 @@ int cras_iodev_get_output_buffer(struct cras_iodev *iodev,
 	return rc;
 }
 
-int cras_iodev_update_rate(struct cras_iodev *iodev, unsigned int level,
-			   struct timespec *level_tstamp)
+/* If output underruns, reset to avoid incorrect estimated rate. */
+static void reset_rate_on_underrun(struct cras_iodev *iodev,
+				   unsigned int level)
 {
-	/* If output underruns, reset to avoid incorrect estimated rate. */
 	if ((iodev->direction == CRAS_STREAM_OUTPUT) && !level)
 		rate_estimator_reset_rate(iodev->rate_est,
 					  iodev->format->frame_rate);
+}
 
+int cras_iodev_update_rate(struct cras_iodev *iodev, unsigned int level,
+			   struct timespec *level_tstamp)
+{
+	reset_rate_on_underrun(iodev, level);
 	return rate_estimator_check(iodev->rate_est, level, level_tstamp);
 }
 
+int cras_iodev_update_rates(struct cras_iodev *const *iodevs,
+			    const unsigned int *levels,
+			    const struct timespec *tstamps, unsigned int num)
+{
+	struct rate_estimator_sample samples[RATE_UPDATE_BATCH];
+	unsigned int i, n, done;
+	int updated = 0;
+
+	for (done = 0; done < num; done += n) {
+		n = MIN(num - done, RATE_UPDATE_BATCH);
+		for (i = 0; i < n; i++) {
+			reset_rate_on_underrun(iodevs[done + i],
+					       levels[done + i]);
+			samples[i].re = iodevs[done + i]->rate_est;
+			samples[i].level = levels[done + i];
+			samples[i].now = tstamps[done + i];
+		}
+		updated += rate_estimator_check_batch(samples, n);
+	}
+	return updated;
+}
+
 int cras_iodev_reset_rate_estimator(const struct cras_iodev *iodev)
 {
 	rate_estimator_reset_rate(iodev->rate_est, iodev->format->frame_rate);
@@ -1270,6 +1826,11 @@ double cras_iodev_get_est_rate_ratio(const struct cras_iodev *iodev)
 	       iodev->format->frame_rate;
 }
 
+double cras_iodev_get_est_rate_confidence(const struct cras_iodev *iodev)
+{
+	return rate_estimator_get_confidence(iodev->rate_est);
+}
+
 int cras_iodev_get_dsp_delay(const struct cras_iodev *iodev)
 {
 	struct cras_dsp_context *ctx;
@@ -1280,11 +1841,16 @@ int cras_iodev_get_dsp_delay(const struct cras_iodev *iodev)
 	if (!ctx)
 		return 0;
 
+	/* The offload delays the output whether or not there's a pipeline. */
+	delay = iodev->dsp_offload ?
+			cras_dsp_offload_get_latency(iodev->dsp_offload) :
+			0;
+
 	pipeline = cras_dsp_get_pipeline(ctx);
 	if (!pipeline)
-		return 0;
+		return delay;
 
-	delay = cras_dsp_pipeline_get_delay(pipeline);
+	delay += cras_dsp_pipeline_get_delay(pipeline);
 
 	cras_dsp_put_pipeline(ctx);
 	return delay;
@@ -1426,17 +1992,37 @@ cras_iodev_default_frames_to_play_in_sleep(struct cras_iodev *odev,
 		return 0;
 }
 
+/* Shortens a sleep of frames for a hardware pointer moving in steps of
+ * hw_ptr_granularity. The level read lags the playback by up to a step, so
+ * wake up a step early, and on a whole number of steps. */
+static unsigned int align_to_hw_ptr(const struct cras_iodev *odev,
+				    unsigned int frames)
+{
+	unsigned int step = odev->hw_ptr_granularity;
+
+	if (step <= 1 || frames <= step)
+		return frames;
+	frames -= step;
+	if (frames > step)
+		frames -= frames % step;
+	return frames;
+}
+
 unsigned int cras_iodev_frames_to_play_in_sleep(struct cras_iodev *odev,
 						unsigned int *hw_level,
 						struct timespec *hw_tstamp)
 {
+	unsigned int frames;
+
 	/* Use odev's own implementation, if not supported then fall back
 	 * to default behavior below. */
 	if (odev->frames_to_play_in_sleep)
-		return odev->frames_to_play_in_sleep(odev, hw_level, hw_tstamp);
+		frames = odev->frames_to_play_in_sleep(odev, hw_level,
+						       hw_tstamp);
 	else
-		return cras_iodev_default_frames_to_play_in_sleep(
+		frames = cras_iodev_default_frames_to_play_in_sleep(
 			odev, hw_level, hw_tstamp);
+	return align_to_hw_ptr(odev, frames);
 }
 
 int cras_iodev_default_no_stream_playback(struct cras_iodev *odev, int enable)
@@ -1585,13 +2171,8 @@ int cras_iodev_start_volume_ramp(struct cras_iodev *odev,
 		return 0;
 	if (!odev->format)
 		return -EINVAL;
-	if (odev->active_node && odev->active_node->softvol_scalers) {
-		old_scaler = odev->active_node->softvol_scalers[old_volume];
-		new_scaler = odev->active_node->softvol_scalers[new_volume];
-	} else {
-		old_scaler = softvol_get_scaler(old_volume);
-		new_scaler = softvol_get_scaler(new_volume);
-	}
+	old_scaler = softvol_scaler(odev, old_volume);
+	new_scaler = softvol_scaler(odev, new_volume);
 	if (new_scaler == 0.0) {
 		return -EINVAL;
 	}
@@ -1716,3 +2297,46 @@ bool cras_iodev_support_noise_cancellation(const struct cras_iodev *iodev)
 		return !!iodev->support_noise_cancellation(iodev);
 	return false;
 }
+
+uint64_t cras_iodev_get_dsp_effects(const struct cras_iodev *iodev)
+{
+	uint64_t effects = 0;
+
+	if (iodev->direction != CRAS_STREAM_INPUT)
+		return 0;
+
+	/* The noise cancellation of the node is only turned on when it's
+	 * enabled in the system. */
+	if (cras_system_get_noise_cancellation_enabled() &&
+	    cras_iodev_support_noise_cancellation(iodev))
+		effects |= APM_NOISE_SUPRESSION;
+
+	return effects;
+}
+
+void cras_iodev_get_dsp_format(const struct cras_iodev *iodev,
+			       struct cras_audio_format *fmt)
+{
+	struct cras_dsp_context *ctx = iodev->dsp_context;
+	unsigned int channels;
+	int ch;
+
+	*fmt = *iodev->format;
+	if (iodev->direction != CRAS_STREAM_INPUT || !ctx ||
+	    !cras_dsp_get_pipeline(ctx))
+		return;
+	channels = cras_dsp_num_output_channels(ctx);
+	cras_dsp_put_pipeline(ctx);
+	if (channels >= fmt->num_channels)
+		return;
+
+	for (ch = 0; ch < CRAS_CH_MAX; ch++)
+		if (fmt->channel_layout[ch] >= (int)channels)
+			fmt->channel_layout[ch] = -1;
+	/* The first channel is always written, have it picked up when none
+	 * of the front ones remain. */
+	if (fmt->channel_layout[CRAS_CH_FL] == -1 &&
+	    fmt->channel_layout[CRAS_CH_FR] == -1 &&
+	    fmt->channel_layout[CRAS_CH_FC] == -1)
+		fmt->channel_layout[CRAS_CH_FL] = 0;
+}
@@ -20,6 +20,7 @@
 #include "cras_iodev_info.h"
 #include "cras_messages.h"
 #include "ewma_power.h"
+#include "silence_gate.h"
 
 struct buffer_share;
 struct cras_fmt_conv;
@@ -30,6 +31,9 @@ struct cras_audio_format;
 struct audio_thread;
 struct cras_iodev;
 struct rate_estimator;
+struct mix_bus;
+struct cras_dsp_offload;
+struct plugin;
 
 /*
  * Type of callback function to execute when loopback sender transfers audio
@@ -115,6 +119,9 @@ enum CRAS_IODEV_STATE {
  *    specified in the ucm config.
  *    stable_id - id for node that doesn't change after unplug/plug.
  *    is_sco_pcm - Bool to indicate whether the ionode is for SCO over PCM.
+ *    compressed_formats - For HDMI outputs, a bitmap of the compressed audio
+ *      formats, (1 << DBCA_FMT_*), the plugged sink decodes. A PASSTHROUGH
+ *      stream only plays on nodes with one.
  */
 struct cras_ionode {
 	struct cras_iodev *dev;
@@ -135,6 +142,7 @@ struct cras_ionode {
 	long intrinsic_sensitivity;
 	unsigned int stable_id;
 	int is_sco_pcm;
+	int compressed_formats;
 	struct cras_ionode *prev, *next;
 };
 
@@ -186,7 +194,13 @@ struct cras_ionode {
  *        cras_iodev_default_frames_to_play_in_sleep().
  * support_noise_cancellation - (Optional) Checks if the device supports noise
  *                              cancellation.
+ * load_dsp_firmware - (Optional) Loads a DSP plugin that has a
+ *     firmware_control into the firmware of the device, see
+ *     cras_dsp_firmware_load_t.
  * format - The audio format being rendered or captured to hardware.
+ * resume_format - Format the iodev ran with when it was closed for suspend,
+ *     reused by the next open to skip format negotiation and DSP setup.
+ * resume_node_idx - Index of the active node resume_format was saved for.
  * rate_est - Rate estimator to estimate the actual device rate.
  * area - Information about how the samples are stored.
  * info - Unique identifier for this device (index and name).
@@ -198,17 +212,27 @@ struct cras_ionode {
  * supported_formats - List of audio formats (s16le, s32le) supported by device.
  * buffer_size - Size of the audio buffer in frames.
  * min_buffer_level - Extra frames to keep queued in addition to requested.
+ * hw_ptr_granularity - Frames the hardware pointer moves by at once, like a
+ *     USB packet, 0 if it moves smoothly. Sleeps are cut to whole steps.
+ * low_latency_ok - Non-zero if the device can run at the callback level of a
+ *     LOW_LATENCY stream, below CRAS_MIN_BUFFER_TIME_IN_US.
  * dsp_context - The context used for dsp processing on the audio data.
  * dsp_name - The "dsp_name" dsp variable specified in the ucm config.
  * echo_reference_dev - Used only for playback iodev. Pointer to the input
  *        iodev, which can be used to record what is playing out from this
  *        iodev. This will be used as the echo reference for echo cancellation.
  * is_enabled - True if this iodev is enabled, false otherwise.
+ * clock_domain - Identifies the hardware, e.g. a card or a Bluetooth device,
+ *     whose iodevs share a clock and must run on the same audio thread. NULL
+ *     keeps the iodev on the main audio thread.
+ * thread - The audio thread serving this iodev while it is open.
  * software_volume_needed - True if volume control is not supported by hardware.
  * software_gain_scaler - Scaler value to apply to captured data. This can
  *     be different when active node changes. Configured when there's no
  *     hardware gain control.
  * streams - List of audio streams serviced by dev.
+ * stream_index - Maps the stream id of each entry in streams to it. Exists
+ *     while streams isn't empty.
  * state - Device is in one of close, open, normal, or no_stream state defined
  *         in enum CRAS_IODEV_STATE.
  * min_cb_level - min callback level of any stream attached.
@@ -241,6 +265,18 @@ struct cras_ionode {
  * initial_ramp_request - The value indicates which type of ramp the device
  * should perform when some samples are ready for playback.
  * ewma - The ewma instance to calculate iodev volume.
+ * level_meter - The meter the level from ewma is published to while open.
+ * silence_gate - For capture only. Tells input_data when the captured frames
+ *     are silence.
+ * mix_bus - For output only. Float buffer streams are mixed into when the
+ *     board enables the float mix bus, NULL otherwise.
+ * dsp_offload - For output only. Runs the DSP on a worker thread one
+ *     min_cb_level later when the board enables it, NULL otherwise.
+ * silent_output_frames - For output only. Frames of silence put in a row,
+ *     counted up to when the DSP is no longer run on them.
+ * passthrough - For output only. The PASSTHROUGH stream written to the
+ *     device untouched, skipping the mix bus and everything done to the
+ *     mix. NULL if there is none.
  */
 struct cras_iodev {
 	void (*set_volume)(struct cras_iodev *iodev);
@@ -277,7 +313,12 @@ struct cras_iodev {
 						unsigned int *hw_level,
 						struct timespec *hw_tstamp);
 	int (*support_noise_cancellation)(const struct cras_iodev *iodev);
+	int (*load_dsp_firmware)(struct cras_iodev *iodev,
+				 const struct plugin *plugin, int sample_rate,
+				 int bypass);
 	struct cras_audio_format *format;
+	struct cras_audio_format *resume_format;
+	unsigned int resume_node_idx;
 	struct rate_estimator *rate_est;
 	struct cras_audio_area *area;
 	struct cras_iodev_info info;
@@ -289,13 +330,18 @@ struct cras_iodev {
 	snd_pcm_format_t *supported_formats;
 	snd_pcm_uframes_t buffer_size;
 	unsigned int min_buffer_level;
+	unsigned int hw_ptr_granularity;
+	int low_latency_ok;
 	struct cras_dsp_context *dsp_context;
 	const char *dsp_name;
 	struct cras_iodev *echo_reference_dev;
 	int is_enabled;
+	const void *clock_domain;
+	struct audio_thread *thread;
 	int software_volume_needed;
 	float software_gain_scaler;
 	struct dev_stream *streams;
+	struct cras_id_map *stream_index;
 	enum CRAS_IODEV_STATE state;
 	unsigned int min_cb_level;
 	unsigned int max_cb_level;
@@ -317,6 +363,12 @@ struct cras_iodev {
 	unsigned int initial_ramp_request;
 	struct input_data *input_data;
 	struct ewma_power ewma;
+	int level_meter;
+	struct silence_gate silence_gate;
+	struct mix_bus *mix_bus;
+	struct cras_dsp_offload *dsp_offload;
+	unsigned int silent_output_frames;
+	struct dev_stream *passthrough;
 	struct cras_iodev *prev, *next;
 };
 
@@ -385,6 +437,22 @@ int cras_iodev_set_format(struct cras_iodev *iodev,
  */
 void cras_iodev_free_format(struct cras_iodev *iodev);
 
+/* Saves the format of an open iodev before it is closed for suspend. The
+ * next cras_iodev_open on the same node reuses it and the DSP context as is,
+ * instead of negotiating a format and rebuilding the DSP pipeline.
+ *
+ * Args:
+ *    iodev - the iodev about to be closed.
+ */
+void cras_iodev_save_resume_format(struct cras_iodev *iodev);
+
+/* Drops the format saved by cras_iodev_save_resume_format, if still unused.
+ *
+ * Args:
+ *    iodev - the iodev to drop the saved format for.
+ */
+void cras_iodev_drop_resume_format(struct cras_iodev *iodev);
+
 /* Initializes the audio area for this iodev.
  * Args:
  *    iodev - the iodev to init audio area
@@ -538,6 +606,11 @@ void cras_iodev_start_stream(struct cras_iodev *iodev,
 struct dev_stream *cras_iodev_rm_stream(struct cras_iodev *iodev,
 					const struct cras_rstream *stream);
 
+/* Returns the dev_stream of the stream with id stream_id on iodev, or NULL
+ * if there isn't one. */
+struct dev_stream *cras_iodev_find_stream(const struct cras_iodev *iodev,
+					  cras_stream_id_t stream_id);
+
 /* Get the offset of this stream into the dev's buffer. */
 unsigned int cras_iodev_stream_offset(struct cras_iodev *iodev,
 				      struct dev_stream *stream);
@@ -582,6 +655,23 @@ int cras_iodev_put_output_buffer(struct cras_iodev *iodev, uint8_t *frames,
 				 unsigned int nframes, int *is_non_empty,
 				 struct cras_fmt_conv *remix_converter);
 
+/* Like cras_iodev_put_output_buffer(), but takes the first nframes frames
+ * of the mix bus of the device as the mixed samples. The DSP pipeline runs
+ * straight on the bus, and frames is only written once they're processed.
+ * Args:
+ *    iodev - The output device, with a mix bus.
+ *    frames - The buffer returned by get_buffer, to write the samples to.
+ *    nframes - The number of frames to write.
+ *    is_non_empty - If not NULL, set to whether the mixed samples are
+ *        non-zero.
+ *    remix_converter - Optional channel remix converter.
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int cras_iodev_put_output_bus(struct cras_iodev *iodev, uint8_t *frames,
+			      unsigned int nframes, int *is_non_empty,
+			      struct cras_fmt_conv *remix_converter);
+
 /* Returns a buffer to read from.
  * Args:
  *    iodev - The device.
@@ -603,6 +693,20 @@ int cras_iodev_get_output_buffer(struct cras_iodev *iodev,
 int cras_iodev_update_rate(struct cras_iodev *iodev, unsigned int level,
 			   struct timespec *level_tstamp);
 
+/* Updates the estimated sample rates of several devices sampled on the same
+ * wake, in one pass over their rate estimators.
+ * Args:
+ *    iodevs - The devices.
+ *    levels - The hardware level of each device.
+ *    tstamps - The time each level was sampled at.
+ *    num - The number of devices.
+ * Returns:
+ *    The number of devices whose estimated rate was updated.
+ */
+int cras_iodev_update_rates(struct cras_iodev *const *iodevs,
+			    const unsigned int *levels,
+			    const struct timespec *tstamps, unsigned int num);
+
 /* Resets the rate estimator of the device. */
 int cras_iodev_reset_rate_estimator(const struct cras_iodev *iodev);
 
@@ -610,6 +714,11 @@ int cras_iodev_reset_rate_estimator(const struct cras_iodev *iodev);
  * the device. */
 double cras_iodev_get_est_rate_ratio(const struct cras_iodev *iodev);
 
+/* Returns how much the latest rate estimation window backs the estimated
+ * rate, from 0.0 to 1.0. Callers following the rate of the device can hold
+ * on to a previous rate while it is low. */
+double cras_iodev_get_est_rate_confidence(const struct cras_iodev *iodev);
+
 /* Get the delay from DSP processing in frames. */
 int cras_iodev_get_dsp_delay(const struct cras_iodev *iodev);
 
@@ -847,4 +956,24 @@ int cras_iodev_drop_frames_by_time(struct cras_iodev *iodev,
  */
 bool cras_iodev_support_noise_cancellation(const struct cras_iodev *iodev);
 
+/* Gets the stream effects an input device applies in its own DSP, so they
+ * don't need to be run again in software.
+ * Args:
+ *    iodev - The device.
+ * Returns:
+ *    Bit map of CRAS_STREAM_EFFECT, 0 for output devices.
+ */
+uint64_t cras_iodev_get_dsp_effects(const struct cras_iodev *iodev);
+
+/* Gets the format of the audio an input device leaves after its DSP, for
+ * the effects run on it. When the DSP reduces the channels, as a beamformer
+ * does, the channels past the ones it writes repeat them and are left out
+ * of the layout.
+ * Args:
+ *    iodev - The device, open.
+ *    fmt - Filled with the format.
+ */
+void cras_iodev_get_dsp_format(const struct cras_iodev *iodev,
+			       struct cras_audio_format *fmt);
+
 #endif /* CRAS_IODEV_H_ */
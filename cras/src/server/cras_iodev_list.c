@@ -6,13 +6,16 @@
 #include <syslog.h>
 
 #include "audio_thread.h"
+#include "cras_config.h"
 #include "cras_empty_iodev.h"
+#include "cras_id_map.h"
 #include "cras_iodev.h"
 #include "cras_iodev_info.h"
 #include "cras_iodev_list.h"
 #include "cras_loopback_iodev.h"
 #include "cras_main_thread_log.h"
 #include "cras_observer.h"
+#include "cras_rclient.h"
 #include "cras_rstream.h"
 #include "cras_server.h"
 #include "cras_tm.h"
@@ -26,6 +29,9 @@
 
 const struct timespec idle_timeout_interval = { .tv_sec = 10, .tv_nsec = 0 };
 
+/* The most audio threads open devices are spread across. */
+#define MAX_AUDIO_THREADS 8
+
 /* Linked list of available devices. */
 struct iodev_list {
 	struct cras_iodev *iodevs;
@@ -62,6 +68,9 @@ static struct iodev_list devs[CRAS_NUM_DIRECTIONS];
 static struct cras_observer_client *list_observer;
 /* Keep a list of enabled inputs and outputs. */
 static struct enabled_dev *enabled_devs[CRAS_NUM_DIRECTIONS];
+/* Outputs kept open without streams, so switching to them only has to attach
+ * streams. Each is closed at its idle_timeout unless it gets enabled. */
+static struct enabled_dev *standby_devs;
 /* Keep an empty device per direction. */
 static struct cras_iodev *fallback_devs[CRAS_NUM_DIRECTIONS];
 /* Special empty device for hotword streams. */
@@ -79,10 +88,22 @@ static uint32_t next_iodev_idx = MAX_SPECIAL_DEVICE_IDX;
 /* Call when a device is enabled or disabled. */
 struct device_enabled_cb *device_enable_cbs;
 
-/* Thread that handles audio input and output. */
-static struct audio_thread *audio_thread;
+/* Threads that handle audio input and output. The first one is the main
+ * audio thread, serving every enabled device and devices of the default
+ * clock domain. The others each serve the open devices of some other clock
+ * domains while none of their devices is enabled. */
+static struct audio_thread *audio_threads[MAX_AUDIO_THREADS];
+static unsigned int num_audio_threads;
+/* The audio thread of the device being opened or closed, if any. */
+static struct audio_thread *dev_op_thread;
 /* List of all streams. */
 static struct stream_list *stream_list;
+/* Nesting depth of cras_iodev_list_begin_stream_batch(), and the audio
+ * threads that were queued stream adds during the batch. */
+static unsigned int stream_batch_depth;
+static bool stream_batch_queued[MAX_AUDIO_THREADS];
+/* The devices of both lists by index, created with the first device. */
+static struct cras_id_map *devs_by_idx;
 /* Idle device timer. */
 static struct cras_timer *idle_timer;
 /* Flag to indicate that the stream list is disconnected from audio thread. */
@@ -96,22 +117,148 @@ static int hotword_suspended = 0;
 static int hotword_auto_resume = 0;
 
 static void idle_dev_check(struct cras_timer *timer, void *data);
+static void update_domain_threads(const void *domain, struct cras_iodev *skip);
 
 static struct cras_iodev *find_dev(size_t dev_index)
+{
+	return cras_id_map_find(devs_by_idx, dev_index);
+}
+
+/* Returns the audio thread serving a device, the main audio thread if the
+ * device is not open. */
+static struct audio_thread *dev_thread(const struct cras_iodev *dev)
+{
+	return dev->thread ? dev->thread : audio_threads[0];
+}
+
+static bool is_standby(const struct cras_iodev *dev)
+{
+	struct enabled_dev *sdev;
+
+	DL_SEARCH_SCALAR(standby_devs, sdev, dev, dev);
+	return sdev != NULL;
+}
+
+static void add_standby(struct cras_iodev *dev)
+{
+	struct enabled_dev *sdev;
+
+	if (is_standby(dev))
+		return;
+	sdev = calloc(1, sizeof(*sdev));
+	if (!sdev)
+		return;
+	sdev->dev = dev;
+	DL_APPEND(standby_devs, sdev);
+}
+
+static void rm_standby(struct cras_iodev *dev)
+{
+	struct enabled_dev *sdev;
+
+	DL_SEARCH_SCALAR(standby_devs, sdev, dev, dev);
+	if (!sdev)
+		return;
+	DL_DELETE(standby_devs, sdev);
+	free(sdev);
+}
+
+/* Directs callbacks the device registers from main thread, while opening or
+ * closing it, to the audio thread it runs on. */
+static void set_dev_op_thread(struct audio_thread *thread)
+{
+	dev_op_thread = thread;
+	audio_thread_set_main_callback_thread(thread ? thread :
+						       audio_threads[0]);
+}
+
+/* Returns the output device using dev as its echo reference, if any. */
+static struct cras_iodev *find_echo_reference_owner(struct cras_iodev *dev)
+{
+	struct cras_iodev *odev;
+
+	DL_FOREACH (devs[CRAS_STREAM_OUTPUT].iodevs, odev)
+		if (odev->echo_reference_dev == dev)
+			return odev;
+	return NULL;
+}
+
+/* Returns true if the devices of a clock domain have to run on the main audio
+ * thread. An enabled device shares its streams with the other enabled
+ * devices, and an output with loopbacks feeds the loopback devices there.
+ * A standby output is about to be enabled, it waits there so it doesn't have
+ * to move then. */
+static bool domain_needs_main_thread(const void *domain)
 {
 	struct cras_iodev *dev;
 
-	DL_FOREACH (devs[CRAS_STREAM_OUTPUT].iodevs, dev)
-		if (dev->info.idx == dev_index)
-			return dev;
+	if (!domain || num_audio_threads < 2)
+		return true;
 
+	DL_FOREACH (devs[CRAS_STREAM_OUTPUT].iodevs, dev)
+		if (dev->clock_domain == domain &&
+		    (dev->is_enabled || dev->loopbacks || is_standby(dev)))
+			return true;
 	DL_FOREACH (devs[CRAS_STREAM_INPUT].iodevs, dev)
-		if (dev->info.idx == dev_index)
-			return dev;
+		if (dev->clock_domain == domain && dev->is_enabled)
+			return true;
+	return false;
+}
+
+/* Counts the open devices on each audio thread, and returns the thread an
+ * open device of the given clock domain runs on if there is one off the main
+ * audio thread. */
+static struct audio_thread *count_thread_devs(const struct cras_iodev *dev,
+					      const struct cras_iodev *list,
+					      unsigned int *num_devs)
+{
+	const struct cras_iodev *other;
+	unsigned int i;
 
+	DL_FOREACH (list, other) {
+		if (other == dev || !other->thread)
+			continue;
+		if (other->clock_domain == dev->clock_domain &&
+		    other->thread != audio_threads[0])
+			return other->thread;
+		for (i = 0; i < num_audio_threads; i++)
+			if (other->thread == audio_threads[i])
+				num_devs[i]++;
+	}
 	return NULL;
 }
 
+/* Picks the audio thread to open a device on. Devices sharing a clock domain
+ * run together, a new domain goes to the least busy of the extra threads. */
+static struct audio_thread *pick_audio_thread(struct cras_iodev *dev)
+{
+	unsigned int num_devs[MAX_AUDIO_THREADS] = { 0 };
+	struct audio_thread *thread;
+	struct cras_iodev *owner;
+	unsigned int i, best = 1;
+
+	/* The echo reference is read along with the output it records. */
+	owner = find_echo_reference_owner(dev);
+	if (owner && owner->thread)
+		return owner->thread;
+
+	if (domain_needs_main_thread(dev->clock_domain))
+		return audio_threads[0];
+
+	thread = count_thread_devs(dev, devs[CRAS_STREAM_OUTPUT].iodevs,
+				   num_devs);
+	if (!thread)
+		thread = count_thread_devs(dev, devs[CRAS_STREAM_INPUT].iodevs,
+					   num_devs);
+	if (thread)
+		return thread;
+
+	for (i = 2; i < num_audio_threads; i++)
+		if (num_devs[i] < num_devs[best])
+			best = i;
+	return audio_threads[best];
+}
+
 static struct cras_ionode *find_node(struct cras_iodev *iodev,
 				     unsigned int node_idx)
 {
@@ -126,25 +273,35 @@ static int add_dev_to_list(struct cras_iodev *dev)
 	struct cras_iodev *tmp;
 	uint32_t new_idx;
 	struct iodev_list *list = &devs[dev->direction];
+	int rc;
 
 	DL_FOREACH (list->iodevs, tmp)
 		if (tmp == dev)
 			return -EEXIST;
 
+	if (!devs_by_idx) {
+		devs_by_idx = cras_id_map_create();
+		if (!devs_by_idx)
+			return -ENOMEM;
+	}
+
 	dev->format = NULL;
 	dev->format = NULL;
 	dev->prev = dev->next = NULL;
 
-	/* Move to the next index and make sure it isn't taken. */
+	/* Move to the next index and make sure it isn't taken by a device of
+	 * either direction. */
 	new_idx = next_iodev_idx;
 	while (1) {
 		if (new_idx < MAX_SPECIAL_DEVICE_IDX)
 			new_idx = MAX_SPECIAL_DEVICE_IDX;
-		DL_SEARCH_SCALAR(list->iodevs, tmp, info.idx, new_idx);
-		if (tmp == NULL)
+		if (!find_dev(new_idx))
 			break;
 		new_idx++;
 	}
+	rc = cras_id_map_insert(devs_by_idx, new_idx, dev);
+	if (rc)
+		return rc;
 	dev->info.idx = new_idx;
 	next_iodev_idx = new_idx + 1;
 	list->size++;
@@ -169,6 +326,11 @@ static int rm_dev_from_list(struct cras_iodev *dev)
 				return -EBUSY;
 			DL_DELETE(devs[dev->direction].iodevs, dev);
 			devs[dev->direction].size--;
+			cras_id_map_remove(devs_by_idx, dev->info.idx);
+			if (!cras_id_map_size(devs_by_idx)) {
+				cras_id_map_destroy(devs_by_idx);
+				devs_by_idx = NULL;
+			}
 			return 0;
 		}
 
@@ -237,6 +399,8 @@ static const char *node_type_to_str(struct cras_ionode *node)
 		return "ECHO_REFERENCE";
 	case CRAS_NODE_TYPE_ALSA_LOOPBACK:
 		return "ALSA_LOOPBACK";
+	case CRAS_NODE_TYPE_NETWORK:
+		return "NETWORK";
 	case CRAS_NODE_TYPE_UNKNOWN:
 	default:
 		return "UNKNOWN";
@@ -331,7 +495,7 @@ static void sys_mute_change(void *context, int muted, int user_muted,
 			cras_iodev_set_mute(dev);
 		} else {
 			audio_thread_dev_start_ramp(
-				audio_thread, dev->info.idx,
+				dev_thread(dev), dev->info.idx,
 				(should_mute ?
 					 CRAS_IODEV_RAMP_REQUEST_DOWN_MUTE :
 					 CRAS_IODEV_RAMP_REQUEST_UP_UNMUTE));
@@ -343,7 +507,8 @@ static void remove_all_streams_from_dev(struct cras_iodev *dev)
 {
 	struct cras_rstream *rstream;
 
-	audio_thread_rm_open_dev(audio_thread, dev->direction, dev->info.idx);
+	audio_thread_rm_open_dev(dev_thread(dev), dev->direction,
+				 dev->info.idx);
 
 	DL_FOREACH (stream_list_get(stream_list), rstream) {
 		if (rstream->apm_list == NULL)
@@ -389,11 +554,26 @@ static void close_dev(struct cras_iodev *dev)
 		return;
 
 	MAINLOG(main_log, MAIN_THREAD_DEV_CLOSE, dev->info.idx, 0, 0);
+	rm_standby(dev);
 	remove_all_streams_from_dev(dev);
 	dev->idle_timeout.tv_sec = 0;
 	/* close echo ref first to avoid underrun in hardware */
 	possibly_disable_echo_reference(dev);
+	set_dev_op_thread(dev->thread);
 	cras_iodev_close(dev);
+	set_dev_op_thread(NULL);
+	dev->thread = NULL;
+	if (dev->direction == CRAS_STREAM_INPUT)
+		cras_apm_list_release_idle(dev);
+}
+
+/* Closes a standby output and turns off its active node. Its clock domain
+ * may not need the main audio thread anymore. */
+static void close_standby(struct cras_iodev *dev)
+{
+	close_dev(dev);
+	dev->update_active_node(dev, dev->active_node->idx, 0);
+	update_domain_threads(dev->clock_domain, NULL);
 }
 
 static void idle_dev_check(struct cras_timer *timer, void *data)
@@ -403,16 +583,30 @@ static void idle_dev_check(struct cras_timer *timer, void *data)
 	struct timespec min_idle_expiration;
 	unsigned int num_idle_devs = 0;
 	unsigned int min_idle_timeout_ms;
+	int dir;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 	min_idle_expiration.tv_sec = 0;
 	min_idle_expiration.tv_nsec = 0;
 
-	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev) {
-		if (edev->dev->idle_timeout.tv_sec == 0)
-			continue;
+	for (dir = CRAS_STREAM_OUTPUT; dir <= CRAS_STREAM_INPUT; dir++) {
+		DL_FOREACH (enabled_devs[dir], edev) {
+			if (edev->dev->idle_timeout.tv_sec == 0)
+				continue;
+			if (timespec_after(&now, &edev->dev->idle_timeout)) {
+				close_dev(edev->dev);
+				continue;
+			}
+			num_idle_devs++;
+			if (min_idle_expiration.tv_sec == 0 ||
+			    timespec_after(&min_idle_expiration,
+					   &edev->dev->idle_timeout))
+				min_idle_expiration = edev->dev->idle_timeout;
+		}
+	}
+	DL_FOREACH (standby_devs, edev) {
 		if (timespec_after(&now, &edev->dev->idle_timeout)) {
-			close_dev(edev->dev);
+			close_standby(edev->dev);
 			continue;
 		}
 		num_idle_devs++;
@@ -457,9 +651,59 @@ static void cancel_pending_init_retries(unsigned int dev_idx)
 	}
 }
 
+/* Gets the callback level to open dev with for rstream. A LOW_LATENCY stream
+ * only takes dev below the normal minimum buffer if dev opted in. */
+static unsigned int open_cb_level(const struct cras_iodev *dev,
+				  const struct cras_rstream *rstream)
+{
+	size_t min_level;
+
+	if (dev->low_latency_ok || !(rstream->flags & LOW_LATENCY))
+		return rstream->cb_threshold;
+
+	min_level =
+		CRAS_MIN_BUFFER_TIME_IN_US * rstream->format.frame_rate / 1000000;
+	return MAX(rstream->cb_threshold, min_level + 1);
+}
+
+/* Returns the PASSTHROUGH stream other than rstream, NULL if there is none. */
+static struct cras_rstream *
+other_passthrough_stream(const struct cras_rstream *rstream)
+{
+	struct cras_rstream *s;
+
+	DL_FOREACH (stream_list_get(stream_list), s) {
+		if (s != rstream && (s->flags & PASSTHROUGH))
+			return s;
+	}
+	return NULL;
+}
+
+/* Returns true if the sink on the active node of dev decodes a compressed
+ * format, so PASSTHROUGH streams can play on it. */
+static bool dev_plays_passthrough(const struct cras_iodev *dev)
+{
+	return dev->active_node && dev->active_node->compressed_formats;
+}
+
+/* Returns the stream whose format dev opens with for rstream. An output that
+ * plays passthrough opens at the format of the PASSTHROUGH stream, the only
+ * one it can't convert. */
+static struct cras_rstream *format_stream(const struct cras_iodev *dev,
+					  struct cras_rstream *rstream)
+{
+	struct cras_rstream *passthrough;
+
+	if (!dev_plays_passthrough(dev) || (rstream->flags & PASSTHROUGH))
+		return rstream;
+	passthrough = other_passthrough_stream(rstream);
+	return passthrough ? passthrough : rstream;
+}
+
 /* Open the device potentially filling the output with a pre buffer. */
 static int init_device(struct cras_iodev *dev, struct cras_rstream *rstream)
 {
+	const struct cras_rstream *fmt_stream;
 	int rc;
 
 	cras_iodev_exit_idle(dev);
@@ -467,22 +711,41 @@ static int init_device(struct cras_iodev *dev, struct cras_rstream *rstream)
 	if (cras_iodev_is_open(dev))
 		return 0;
 	cancel_pending_init_retries(dev->info.idx);
+	fmt_stream = format_stream(dev, rstream);
 	MAINLOG(main_log, MAIN_THREAD_DEV_INIT, dev->info.idx,
-		rstream->format.num_channels, rstream->format.frame_rate);
-
-	rc = cras_iodev_open(dev, rstream->cb_threshold, &rstream->format);
-	if (rc)
+		fmt_stream->format.num_channels, fmt_stream->format.frame_rate);
+
+	/* Pick the thread first, devices register their audio thread
+	 * callbacks while being opened. */
+	dev->thread = pick_audio_thread(dev);
+	set_dev_op_thread(dev->thread);
+	rc = cras_iodev_open(dev, open_cb_level(dev, rstream),
+			     &fmt_stream->format);
+	if (rc == 0) {
+		rc = audio_thread_add_open_dev(dev->thread, dev);
+		if (rc)
+			cras_iodev_close(dev);
+	}
+	set_dev_op_thread(NULL);
+	if (rc) {
+		dev->thread = NULL;
 		return rc;
-
-	rc = audio_thread_add_open_dev(audio_thread, dev);
-	if (rc)
-		cras_iodev_close(dev);
+	}
 
 	possibly_enable_echo_reference(dev);
 
 	return rc;
 }
 
+/* Disconnects a stream from all the devices it's attached to. */
+static void disconnect_stream_from_all_threads(struct cras_rstream *rstream)
+{
+	unsigned int i;
+
+	for (i = 0; i < num_audio_threads; i++)
+		audio_thread_disconnect_stream(audio_threads[i], rstream, NULL);
+}
+
 static void suspend_devs()
 {
 	struct enabled_dev *edev;
@@ -504,24 +767,29 @@ static void suspend_devs()
 
 			dev = find_dev(rstream->pinned_dev_idx);
 			if (dev) {
-				audio_thread_disconnect_stream(audio_thread,
+				audio_thread_disconnect_stream(dev_thread(dev),
 							       rstream, dev);
 				if (!cras_iodev_list_dev_is_enabled(dev))
 					close_dev(dev);
 			}
 		} else {
-			audio_thread_disconnect_stream(audio_thread, rstream,
-						       NULL);
+			disconnect_stream_from_all_threads(rstream);
 		}
 	}
 	stream_list_suspended = 1;
 
+	/* Enabled devices get reopened at resume, keep their formats so that
+	 * doesn't renegotiate formats or rebuild DSP pipelines. */
 	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev) {
+		cras_iodev_save_resume_format(edev->dev);
 		close_dev(edev->dev);
 	}
 	DL_FOREACH (enabled_devs[CRAS_STREAM_INPUT], edev) {
+		cras_iodev_save_resume_format(edev->dev);
 		close_dev(edev->dev);
 	}
+	DL_FOREACH (standby_devs, edev)
+		close_standby(edev->dev);
 
 	/* Doing this check after all the other enabled iodevs are closed to
 	 * ensure preempted hotword streams obey the pause_at_suspend flag.
@@ -573,6 +841,14 @@ static void resume_devs()
 			continue;
 		stream_added_cb(rstream);
 	}
+
+	/* Devices without streams to reopen them negotiate again later. */
+	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev) {
+		cras_iodev_drop_resume_format(edev->dev);
+	}
+	DL_FOREACH (enabled_devs[CRAS_STREAM_INPUT], edev) {
+		cras_iodev_drop_resume_format(edev->dev);
+	}
 }
 
 /* Called when the system audio is suspended or resumed. */
@@ -598,6 +874,7 @@ static void sys_cap_mute_change(void *context, int muted, int mute_locked)
 
 static int disable_device(struct enabled_dev *edev, bool force);
 static int enable_device(struct cras_iodev *dev);
+static void open_standby_outputs();
 
 static void possibly_disable_fallback(enum CRAS_STREAM_DIRECTION dir)
 {
@@ -641,22 +918,38 @@ static void possibly_enable_fallback(enum CRAS_STREAM_DIRECTION dir, bool error)
 /*
  * Adds stream to one or more open iodevs. If the stream has processing effect
  * turned on, create new APM instance and add to the list. This makes sure the
- * time consuming APM creation happens in main thread.
+ * time consuming APM creation happens in main thread. The effects a device
+ * already applies in its DSP are left to it.
  */
 static int add_stream_to_open_devs(struct cras_rstream *stream,
 				   struct cras_iodev **iodevs,
 				   unsigned int num_iodevs)
 {
+	struct audio_thread *thread;
+	struct cras_audio_format fmt;
 	int i;
+
 	if (stream->apm_list) {
-		for (i = 0; i < num_iodevs; i++)
-			cras_apm_list_add_apm(stream->apm_list, iodevs[i],
-					      iodevs[i]->format,
-					      cras_iodev_is_aec_use_case(
-						      iodevs[i]->active_node));
+		for (i = 0; i < num_iodevs; i++) {
+			cras_iodev_get_dsp_format(iodevs[i], &fmt);
+			cras_apm_list_add_apm(
+				stream->apm_list, iodevs[i], &fmt,
+				cras_iodev_is_aec_use_case(
+					iodevs[i]->active_node),
+				cras_iodev_get_dsp_effects(iodevs[i]));
+		}
+	}
+	thread = dev_thread(iodevs[0]);
+
+	/* In a batch, the adds are queued and waited for all at once. */
+	if (stream_batch_depth && num_iodevs <= MAX_ASYNC_STREAM_DEVS) {
+		for (i = 0; i < num_audio_threads; i++)
+			if (audio_threads[i] == thread)
+				stream_batch_queued[i] = true;
+		return audio_thread_add_stream_async(thread, stream, iodevs,
+						     num_iodevs);
 	}
-	return audio_thread_add_stream(audio_thread, stream, iodevs,
-				       num_iodevs);
+	return audio_thread_add_stream(thread, stream, iodevs, num_iodevs);
 }
 
 static int init_and_attach_streams(struct cras_iodev *dev)
@@ -764,7 +1057,14 @@ static int init_pinned_device(struct cras_iodev *dev,
 
 	cras_iodev_exit_idle(dev);
 
-	if (audio_thread_is_dev_open(audio_thread, dev))
+	/* The pinned stream keeps the device open from now on. */
+	rm_standby(dev);
+
+	/* A device already running on its audio thread only needs the stream
+	 * attached, skip asking the thread whether it's open. */
+	if (cras_iodev_is_open(dev) && dev->thread)
+		return 0;
+	if (audio_thread_is_dev_open(dev_thread(dev), dev))
 		return 0;
 
 	/* Make sure the active node is configured properly, it could be
@@ -830,6 +1130,73 @@ static int pinned_stream_added(struct cras_rstream *rstream)
 	return add_stream_to_open_devs(rstream, &dev, 1);
 }
 
+/* Returns true if dev supports exactly the rate and sample format in fmt. */
+static bool dev_supports_rate_format(const struct cras_iodev *dev,
+				     const struct cras_audio_format *fmt)
+{
+	bool rate_ok = false, format_ok = false;
+	unsigned int i;
+
+	for (i = 0; dev->supported_rates && dev->supported_rates[i]; i++)
+		if (dev->supported_rates[i] == fmt->frame_rate)
+			rate_ok = true;
+	for (i = 0; dev->supported_formats && dev->supported_formats[i]; i++)
+		if (dev->supported_formats[i] == fmt->format)
+			format_ok = true;
+	return rate_ok && format_ok;
+}
+
+/* Returns true if the open output dev should be reopened at the rate and
+ * format of rstream, so no stream attached to it is resampled or converted.
+ * That is when all the output streams share them and dev supports them. */
+static bool needs_native_rate(const struct cras_iodev *dev,
+			      const struct cras_rstream *rstream)
+{
+	const struct cras_rstream *s;
+
+	if (rstream->direction != CRAS_STREAM_OUTPUT ||
+	    !cras_system_get_native_rate_enabled())
+		return false;
+	if (dev->format->frame_rate == rstream->format.frame_rate &&
+	    dev->format->format == rstream->format.format)
+		return false;
+	if (!dev_supports_rate_format(dev, &rstream->format))
+		return false;
+
+	DL_FOREACH (stream_list_get(stream_list), s) {
+		if (s->direction != CRAS_STREAM_OUTPUT)
+			continue;
+		if (s->format.frame_rate != rstream->format.frame_rate ||
+		    s->format.format != rstream->format.format)
+			return false;
+	}
+	return true;
+}
+
+/* Returns true if the open output dev should be reopened at the format of
+ * the PASSTHROUGH stream rstream, to play it untouched. */
+static bool needs_passthrough_format(const struct cras_iodev *dev,
+				     const struct cras_rstream *rstream)
+{
+	if (!(rstream->flags & PASSTHROUGH))
+		return false;
+	if (dev->format->frame_rate == rstream->format.frame_rate &&
+	    dev->format->format == rstream->format.format &&
+	    dev->format->num_channels == rstream->format.num_channels)
+		return false;
+	return dev_supports_rate_format(dev, &rstream->format);
+}
+
+/* Closes the enabled dev and opens it again with the streams it should have,
+ * the fallback device plays them meanwhile. */
+static void reopen_enabled_dev(struct cras_iodev *dev)
+{
+	possibly_enable_fallback(dev->direction, false);
+	cras_iodev_list_suspend_dev(dev->info.idx);
+	cras_iodev_list_resume_dev(dev->info.idx);
+	possibly_disable_fallback(dev->direction);
+}
+
 static int stream_added_cb(struct cras_rstream *rstream)
 {
 	struct enabled_dev *edev;
@@ -844,6 +1211,10 @@ static int stream_added_cb(struct cras_rstream *rstream)
 	MAINLOG(main_log, MAIN_THREAD_STREAM_ADDED, rstream->stream_id,
 		rstream->direction, rstream->buffer_frames);
 
+	/* A passthrough stream has the output to itself. */
+	if ((rstream->flags & PASSTHROUGH) && other_passthrough_stream(rstream))
+		return -EBUSY;
+
 	if (rstream->is_pinned)
 		return pinned_stream_added(rstream);
 
@@ -857,11 +1228,32 @@ static int stream_added_cb(struct cras_rstream *rstream)
 			break;
 		}
 
+		/* A sink that can't decode the bitstream doesn't get it,
+		 * the stream plays on the fallback device if no other
+		 * output takes it. */
+		if ((rstream->flags & PASSTHROUGH) &&
+		    !dev_plays_passthrough(edev->dev)) {
+			syslog(LOG_INFO, "%s can't play passthrough",
+			       edev->dev->info.name);
+			continue;
+		}
+
 		if (cras_iodev_is_open(edev->dev) &&
-		    (rstream->format.num_channels >
-		     edev->dev->format->num_channels) &&
-		    (rstream->format.num_channels <=
-		     edev->dev->info.max_supported_channels)) {
+		    needs_passthrough_format(edev->dev, rstream)) {
+			MAINLOG(main_log, MAIN_THREAD_DEV_REOPEN,
+				rstream->format.num_channels,
+				edev->dev->format->num_channels,
+				edev->dev->format->frame_rate);
+			syslog(LOG_INFO, "re-open %s for passthrough",
+			       edev->dev->info.name);
+			reopen_enabled_dev(edev->dev);
+			iodev_reopened = true;
+		} else if (cras_iodev_is_open(edev->dev) &&
+			   (rstream->format.num_channels >
+			    edev->dev->format->num_channels) &&
+			   (rstream->format.num_channels <=
+			    edev->dev->info.max_supported_channels) &&
+			   format_stream(edev->dev, rstream) == rstream) {
 			/* Re-open the device with the format of the attached
 			 * stream if it has higher channel count than the
 			 * current format of the device, and doesn't exceed the
@@ -875,10 +1267,22 @@ static int stream_added_cb(struct cras_rstream *rstream)
 				edev->dev->format->frame_rate);
 			syslog(LOG_INFO, "re-open %s for higher channel count",
 			       edev->dev->info.name);
-			possibly_enable_fallback(rstream->direction, false);
-			cras_iodev_list_suspend_dev(edev->dev->info.idx);
-			cras_iodev_list_resume_dev(edev->dev->info.idx);
-			possibly_disable_fallback(rstream->direction);
+			reopen_enabled_dev(edev->dev);
+			iodev_reopened = true;
+		} else if (cras_iodev_is_open(edev->dev) &&
+			   needs_native_rate(edev->dev, rstream)) {
+			/* Ramp the streams in again, like at the start of
+			 * playback, so the switch doesn't pop. */
+			MAINLOG(main_log, MAIN_THREAD_DEV_REOPEN,
+				rstream->format.num_channels,
+				edev->dev->format->num_channels,
+				edev->dev->format->frame_rate);
+			syslog(LOG_INFO, "re-open %s at native rate %zu",
+			       edev->dev->info.name,
+			       rstream->format.frame_rate);
+			edev->dev->initial_ramp_request =
+				CRAS_IODEV_RAMP_REQUEST_UP_START_PLAYBACK;
+			reopen_enabled_dev(edev->dev);
 			iodev_reopened = true;
 		} else {
 			rc = init_device(edev->dev, rstream);
@@ -901,6 +1305,8 @@ static int stream_added_cb(struct cras_rstream *rstream)
 			syslog(LOG_ERR, "adding stream to thread fail");
 			return rc;
 		}
+		if (rstream->direction == CRAS_STREAM_OUTPUT)
+			open_standby_outputs();
 	} else if (!iodev_reopened) {
 		/* Enable fallback device if no other iodevs can be initialized
 		 * or re-opened successfully.
@@ -921,6 +1327,7 @@ static int possibly_close_enabled_devs(enum CRAS_STREAM_DIRECTION dir)
 {
 	struct enabled_dev *edev;
 	const struct cras_rstream *s;
+	struct timespec idle_interval = idle_timeout_interval;
 
 	/* Check if there are still default streams attached. */
 	DL_FOREACH (stream_list_get(stream_list), s) {
@@ -934,29 +1341,37 @@ static int possibly_close_enabled_devs(enum CRAS_STREAM_DIRECTION dir)
 		if (stream_list_has_pinned_stream(stream_list,
 						  edev->dev->info.idx))
 			continue;
+		/* Allow output devs to drain before closing. Inputs may be
+		 * kept warm, so the next capture stream gets its first samples
+		 * without opening the device again. */
 		if (dir == CRAS_STREAM_INPUT) {
-			close_dev(edev->dev);
-			continue;
+			if (!cras_system_get_mic_keep_warm_ms() ||
+			    !cras_iodev_is_open(edev->dev)) {
+				close_dev(edev->dev);
+				continue;
+			}
+			ms_to_timespec(cras_system_get_mic_keep_warm_ms(),
+				       &idle_interval);
 		}
-		/* Allow output devs to drain before closing. */
 		clock_gettime(CLOCK_MONOTONIC_RAW, &edev->dev->idle_timeout);
-		add_timespecs(&edev->dev->idle_timeout, &idle_timeout_interval);
+		add_timespecs(&edev->dev->idle_timeout, &idle_interval);
 		idle_dev_check(NULL, NULL);
 	}
 
 	return 0;
 }
 
-static void pinned_stream_removed(struct cras_rstream *rstream)
+/* Returns true if the enabled devices may have to be closed because the
+ * pinned stream is gone. */
+static bool pinned_stream_removed(struct cras_iodev *dev)
 {
-	struct cras_iodev *dev;
-
-	dev = find_pinned_device(rstream);
 	if (!dev)
-		return;
-	if (!cras_iodev_list_dev_is_enabled(dev) &&
-	    !stream_list_has_pinned_stream(stream_list, dev->info.idx))
+		return true;
+	if (cras_iodev_list_dev_is_enabled(dev))
+		return true;
+	if (!stream_list_has_pinned_stream(stream_list, dev->info.idx))
 		close_pinned_device(dev);
+	return false;
 }
 
 /* Returns the number of milliseconds left to drain this stream.  This is passed
@@ -964,22 +1379,74 @@ static void pinned_stream_removed(struct cras_rstream *rstream)
 static int stream_removed_cb(struct cras_rstream *rstream)
 {
 	enum CRAS_STREAM_DIRECTION direction = rstream->direction;
+	struct cras_iodev *pinned_dev = find_pinned_device(rstream);
+	unsigned int i;
 	int rc;
 
-	rc = audio_thread_drain_stream(audio_thread, rstream);
-	if (rc)
-		return rc;
+	/* Only the thread the stream is attached to has anything to drain,
+	 * a pinned stream can only be on the one of its device. */
+	if (pinned_dev && pinned_dev->thread) {
+		rc = audio_thread_drain_stream(pinned_dev->thread, rstream);
+		if (rc)
+			return rc;
+	} else {
+		for (i = 0; i < num_audio_threads; i++) {
+			rc = audio_thread_drain_stream(audio_threads[i],
+						       rstream);
+			if (rc)
+				return rc;
+		}
+	}
 
 	MAINLOG(main_log, MAIN_THREAD_STREAM_REMOVED, rstream->stream_id, 0, 0);
 
-	if (rstream->is_pinned)
-		pinned_stream_removed(rstream);
+	/* The client asked to hear when the stream played out. */
+	if (rstream->notify_drained && rstream->client) {
+		struct cras_client_stream_drained msg;
+
+		cras_fill_client_stream_drained(&msg, rstream->stream_id);
+		cras_rclient_send_message(rstream->client, &msg.header, NULL,
+					  0);
+	}
+
+	if (rstream->is_pinned && !pinned_stream_removed(pinned_dev))
+		return 0;
 
 	possibly_close_enabled_devs(direction);
 
 	return 0;
 }
 
+/* Moves the open devices of a clock domain that are not on the audio thread
+ * they should run on, by closing them and opening them again there.
+ * Args:
+ *    domain - The clock domain to check.
+ *    skip - A device the caller is about to attach streams to. It's closed
+ *        here if it has to move, but left for the caller to open.
+ */
+static void update_domain_threads(const void *domain, struct cras_iodev *skip)
+{
+	struct cras_iodev *dev;
+	int dir;
+
+	if (!domain || num_audio_threads < 2)
+		return;
+
+	for (dir = CRAS_STREAM_OUTPUT; dir <= CRAS_STREAM_INPUT; dir++) {
+		DL_FOREACH (devs[dir].iodevs, dev) {
+			if (dev->clock_domain != domain || !dev->thread)
+				continue;
+			if (dev->thread == pick_audio_thread(dev))
+				continue;
+			syslog(LOG_INFO, "Move %s to another audio thread",
+			       dev->info.name);
+			close_dev(dev);
+			if (dev != skip)
+				init_and_attach_streams(dev);
+		}
+	}
+}
+
 static int enable_device(struct cras_iodev *dev)
 {
 	int rc;
@@ -996,6 +1463,12 @@ static int enable_device(struct cras_iodev *dev)
 	edev->dev = dev;
 	DL_APPEND(enabled_devs[dir], edev);
 	dev->is_enabled = 1;
+	/* A standby device is open already, streams just attach to it. */
+	rm_standby(dev);
+
+	/* Enabled devices run on the main audio thread, along with the other
+	 * devices of their clock domain. */
+	update_domain_threads(dev->clock_domain, dev);
 
 	rc = init_and_attach_streams(dev);
 	if (rc < 0) {
@@ -1037,9 +1510,10 @@ static int disable_device(struct enabled_dev *edev, bool force)
 				continue;
 			if (stream->is_pinned)
 				continue;
-			audio_thread_disconnect_stream(audio_thread, stream,
+			audio_thread_disconnect_stream(dev_thread(dev), stream,
 						       dev);
 		}
+		update_domain_threads(dev->clock_domain, NULL);
 		return 0;
 	}
 
@@ -1047,10 +1521,117 @@ static int disable_device(struct enabled_dev *edev, bool force)
 		callback->disabled_cb(dev, callback->cb_data);
 	close_dev(dev);
 	dev->update_active_node(dev, dev->active_node->idx, 0);
+	update_domain_threads(dev->clock_domain, NULL);
+
+	return 0;
+}
+
+/* Starts the standby time of an output kept open without streams. */
+static void start_standby(struct cras_iodev *dev)
+{
+	struct timespec standby = { 0, 0 };
+	int standby_ms = cras_system_get_warm_standby_ms();
+
+	MAINLOG(main_log, MAIN_THREAD_DEV_STANDBY, dev->info.idx, standby_ms,
+		0);
+	add_standby(dev);
+	ms_to_timespec(standby_ms, &standby);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &dev->idle_timeout);
+	add_timespecs(&dev->idle_timeout, &standby);
+	idle_dev_check(NULL, NULL);
+}
+
+/* Disables an output being switched away from like disable_device(), but
+ * keeps it open for a while in case it's switched back to.
+ * Returns:
+ *    0 if the device is kept open, negative error code if it should be
+ *    disabled the usual way.
+ */
+static int disable_to_standby(struct enabled_dev *edev)
+{
+	struct cras_iodev *dev = edev->dev;
+	struct cras_rstream *stream;
+	struct device_enabled_cb *callback;
+
+	if (cras_system_get_warm_standby_ms() <= 0 ||
+	    dev->direction != CRAS_STREAM_OUTPUT ||
+	    dev == fallback_devs[CRAS_STREAM_OUTPUT] ||
+	    !cras_iodev_is_open(dev) ||
+	    stream_list_has_pinned_stream(stream_list, dev->info.idx))
+		return -EINVAL;
 
+	MAINLOG(main_log, MAIN_THREAD_DEV_DISABLE, dev->info.idx, 0, 0);
+	DL_DELETE(enabled_devs[CRAS_STREAM_OUTPUT], edev);
+	free(edev);
+	dev->is_enabled = 0;
+
+	DL_FOREACH (stream_list_get(stream_list), stream) {
+		if (stream->direction != CRAS_STREAM_OUTPUT)
+			continue;
+		audio_thread_disconnect_stream(dev_thread(dev), stream, dev);
+	}
+	DL_FOREACH (device_enable_cbs, callback)
+		callback->disabled_cb(dev, callback->cb_data);
+	start_standby(dev);
 	return 0;
 }
 
+/* Returns true if an output is worth keeping open while an other one plays:
+ * HDMI once connected, or the outputs sharing the hardware of an enabled
+ * one, like the headphone jack of the card playing to the speaker. */
+static bool is_standby_candidate(struct cras_iodev *dev)
+{
+	struct enabled_dev *edev;
+
+	if (dev->is_enabled || cras_iodev_is_open(dev) ||
+	    dev == fallback_devs[CRAS_STREAM_OUTPUT] || !dev->active_node ||
+	    !dev->active_node->plugged)
+		return false;
+	if (dev->active_node->type == CRAS_NODE_TYPE_HDMI)
+		return true;
+	if (!dev->clock_domain)
+		return false;
+	DL_FOREACH (enabled_devs[CRAS_STREAM_OUTPUT], edev)
+		if (edev->dev->clock_domain == dev->clock_domain)
+			return true;
+	return false;
+}
+
+/* Opens the outputs likely to be switched to next with the format of the
+ * playing streams, so a switch doesn't have to open them. */
+static void open_standby_outputs()
+{
+	struct cras_rstream *rstream;
+	struct cras_iodev *dev;
+
+	if (cras_system_get_warm_standby_ms() <= 0 || stream_list_suspended)
+		return;
+
+	/* The stream list is ordered by channel count, the first normal
+	 * output stream is the one devices get opened with. */
+	DL_FOREACH (stream_list_get(stream_list), rstream) {
+		if (rstream->direction == CRAS_STREAM_OUTPUT &&
+		    !rstream->is_pinned)
+			break;
+	}
+	if (!rstream)
+		return;
+
+	DL_FOREACH (devs[CRAS_STREAM_OUTPUT].iodevs, dev) {
+		if (!is_standby_candidate(dev))
+			continue;
+		dev->update_active_node(dev, dev->active_node->idx, 1);
+		/* Listed first so it's opened on the main audio thread. */
+		add_standby(dev);
+		if (init_device(dev, rstream)) {
+			rm_standby(dev);
+			dev->update_active_node(dev, dev->active_node->idx, 0);
+			continue;
+		}
+		start_standby(dev);
+	}
+}
+
 /*
  * Exported Interface.
  */
@@ -1058,6 +1639,7 @@ static int disable_device(struct enabled_dev *edev, bool force)
 void cras_iodev_list_init()
 {
 	struct cras_observer_ops observer_ops;
+	unsigned int i;
 
 	memset(&observer_ops, 0, sizeof(observer_ops));
 	observer_ops.output_volume_changed = sys_vol_change;
@@ -1091,19 +1673,29 @@ void cras_iodev_list_init()
 	loopdev_post_mix = loopback_iodev_create(LOOPBACK_POST_MIX_PRE_DSP);
 	loopdev_post_dsp = loopback_iodev_create(LOOPBACK_POST_DSP);
 
-	audio_thread = audio_thread_create();
-	if (!audio_thread) {
-		syslog(LOG_ERR, "Fatal: audio thread init");
-		exit(-ENOMEM);
+	num_audio_threads = MIN(cras_system_get_max_audio_threads(),
+				MAX_AUDIO_THREADS);
+	for (i = 0; i < num_audio_threads; i++) {
+		audio_threads[i] = audio_thread_create();
+		if (!audio_threads[i]) {
+			syslog(LOG_ERR, "Fatal: audio thread init");
+			exit(-ENOMEM);
+		}
+		audio_thread_start(audio_threads[i]);
 	}
-	audio_thread_start(audio_thread);
 
 	cras_iodev_list_update_device_list();
 }
 
 void cras_iodev_list_deinit()
 {
-	audio_thread_destroy(audio_thread);
+	unsigned int i;
+
+	for (i = 0; i < num_audio_threads; i++) {
+		audio_thread_destroy(audio_threads[i]);
+		audio_threads[i] = NULL;
+	}
+	num_audio_threads = 0;
 	loopback_iodev_destroy(loopdev_post_dsp);
 	loopback_iodev_destroy(loopdev_post_mix);
 	empty_iodev_destroy(empty_hotword_dev);
@@ -1375,6 +1967,8 @@ void cras_iodev_list_update_device_list()
 	if (!state)
 		return;
 
+	cras_system_state_journal_change(CRAS_STATE_CHANGE_DEVICES |
+					 CRAS_STATE_CHANGE_NODES);
 	state->num_output_devs = devs[CRAS_STREAM_OUTPUT].size;
 	state->num_input_devs = devs[CRAS_STREAM_INPUT].size;
 	fill_dev_list(&devs[CRAS_STREAM_OUTPUT], &state->output_devs[0],
@@ -1441,10 +2035,10 @@ int cras_iodev_list_suspend_hotword_streams()
 			continue;
 		}
 
-		audio_thread_disconnect_stream(audio_thread, stream,
+		audio_thread_disconnect_stream(dev_thread(hotword_dev), stream,
 					       hotword_dev);
-		audio_thread_add_stream(audio_thread, stream,
-					&empty_hotword_dev, 1);
+		audio_thread_add_stream_async(dev_thread(empty_hotword_dev),
+					      stream, &empty_hotword_dev, 1);
 	}
 	close_pinned_device(hotword_dev);
 	hotword_suspended = 1;
@@ -1477,9 +2071,10 @@ int cras_iodev_list_resume_hotword_stream()
 			continue;
 		}
 
-		audio_thread_disconnect_stream(audio_thread, stream,
-					       empty_hotword_dev);
-		audio_thread_add_stream(audio_thread, stream, &hotword_dev, 1);
+		audio_thread_disconnect_stream(dev_thread(empty_hotword_dev),
+					       stream, empty_hotword_dev);
+		audio_thread_add_stream_async(dev_thread(hotword_dev), stream,
+					      &hotword_dev, 1);
 	}
 	close_pinned_device(empty_hotword_dev);
 	hotword_suspended = 0;
@@ -1532,6 +2127,7 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 	struct cras_iodev *new_dev = NULL;
 	struct enabled_dev *edev;
 	int new_node_already_enabled = 0;
+	bool new_node_standby = false;
 	struct cras_rstream *rstream;
 	int has_output_stream = 0;
 	int rc;
@@ -1560,12 +2156,22 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 		}
 	}
 
+	/* A standby device is open with its old node, if that's not the one
+	 * selected it has to open again. */
+	if (new_dev && is_standby(new_dev)) {
+		if (new_dev->active_node->idx == node_index_of(node_id))
+			new_node_standby = true;
+		else
+			close_standby(new_dev);
+	}
+
 	/* Enable fallback device during the transition so client will not be
 	 * blocked in this duration, which is as long as 300 ms on some boards
 	 * before new device is opened.
 	 * Note that the fallback node is not needed if the new node is already
-	 * enabled - the new node will remain enabled. */
-	if (!new_node_already_enabled)
+	 * enabled - the new node will remain enabled - or on standby, which
+	 * only takes attaching the streams. */
+	if (!new_node_already_enabled && !new_node_standby)
 		possibly_enable_fallback(direction, false);
 
 	DL_FOREACH (enabled_devs[direction], edev) {
@@ -1578,7 +2184,8 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 		 * it.
 		 */
 		if (edev->dev != new_dev) {
-			disable_device(edev, false);
+			if (disable_to_standby(edev))
+				disable_device(edev, false);
 		}
 		/*
 		 * Otherwise if this happens to be the new device but about to
@@ -1601,9 +2208,14 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 			if (rstream->direction == CRAS_STREAM_OUTPUT)
 				has_output_stream++;
 		}
+		/* A standby device has its pipeline running already, ramp
+		 * the streams in as they attach. */
 		if (direction == CRAS_STREAM_OUTPUT && has_output_stream) {
 			new_dev->initial_ramp_request =
 				CRAS_IODEV_RAMP_REQUEST_SWITCH_MUTE;
+			if (new_node_standby)
+				new_dev->initial_ramp_request =
+					CRAS_IODEV_RAMP_REQUEST_UP_START_PLAYBACK;
 		}
 
 		rc = enable_device(new_dev);
@@ -1615,6 +2227,9 @@ void cras_iodev_list_select_node(enum CRAS_STREAM_DIRECTION direction,
 		}
 	}
 
+	if (direction == CRAS_STREAM_OUTPUT)
+		open_standby_outputs();
+
 	cras_iodev_list_notify_active_node_changed(direction);
 }
 
@@ -1782,7 +2397,7 @@ void cras_iodev_list_test_dev_command(unsigned int iodev_idx,
 
 struct audio_thread *cras_iodev_list_get_audio_thread()
 {
-	return audio_thread;
+	return dev_op_thread ? dev_op_thread : audio_threads[0];
 }
 
 struct stream_list *cras_iodev_list_get_stream_list()
@@ -1790,6 +2405,32 @@ struct stream_list *cras_iodev_list_get_stream_list()
 	return stream_list;
 }
 
+void cras_iodev_list_begin_stream_batch()
+{
+	if (stream_batch_depth++ == 0)
+		stream_list_begin_batch(stream_list);
+}
+
+void cras_iodev_list_end_stream_batch()
+{
+	unsigned int i;
+	int rc;
+
+	if (!stream_batch_depth || --stream_batch_depth)
+		return;
+
+	for (i = 0; i < num_audio_threads; i++) {
+		if (!stream_batch_queued[i])
+			continue;
+		stream_batch_queued[i] = false;
+		rc = audio_thread_sync(audio_threads[i]);
+		if (rc < 0)
+			syslog(LOG_ERR, "Batched stream add failed: %d", rc);
+	}
+	/* The adds are in place before the batch's removals drain. */
+	stream_list_end_batch(stream_list);
+}
+
 int cras_iodev_list_set_device_enabled_callback(
 	device_enabled_callback_t enabled_cb,
 	device_disabled_callback_t disabled_cb, void *cb_data)
@@ -1820,10 +2461,9 @@ void cras_iodev_list_register_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
 				       unsigned int output_dev_idx,
 				       loopback_hook_data_t hook_data,
 				       loopback_hook_control_t hook_control,
-				       unsigned int loopback_dev_idx)
+				       void *cb_data)
 {
 	struct cras_iodev *iodev = find_dev(output_dev_idx);
-	struct cras_iodev *loopback_dev;
 	struct cras_loopback *loopback;
 	bool dev_open;
 
@@ -1833,12 +2473,6 @@ void cras_iodev_list_register_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
 		return;
 	}
 
-	loopback_dev = find_dev(loopback_dev_idx);
-	if (loopback_dev == NULL) {
-		syslog(LOG_ERR, "Loopback dev %u not found", loopback_dev_idx);
-		return;
-	}
-
 	dev_open = cras_iodev_is_open(iodev);
 
 	loopback = (struct cras_loopback *)calloc(1, sizeof(*loopback));
@@ -1850,35 +2484,39 @@ void cras_iodev_list_register_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
 	loopback->type = loopback_type;
 	loopback->hook_data = hook_data;
 	loopback->hook_control = hook_control;
-	loopback->cb_data = loopback_dev;
+	loopback->cb_data = cb_data;
 	if (loopback->hook_control && dev_open)
 		loopback->hook_control(true, loopback->cb_data);
 
 	DL_APPEND(iodev->loopbacks, loopback);
+
+	/* Loopback devices are read on the main audio thread. */
+	update_domain_threads(iodev->clock_domain, NULL);
 }
 
 void cras_iodev_list_unregister_loopback(enum CRAS_LOOPBACK_TYPE type,
 					 unsigned int output_dev_idx,
-					 unsigned int loopback_dev_idx)
+					 void *cb_data)
 {
 	struct cras_iodev *iodev = find_dev(output_dev_idx);
-	struct cras_iodev *loopback_dev;
 	struct cras_loopback *loopback;
 
 	if (iodev == NULL)
 		return;
 
-	loopback_dev = find_dev(loopback_dev_idx);
-	if (loopback_dev == NULL)
-		return;
-
 	DL_FOREACH (iodev->loopbacks, loopback) {
-		if ((loopback->cb_data == loopback_dev) &&
+		if ((loopback->cb_data == cb_data) &&
 		    (loopback->type == type)) {
 			DL_DELETE(iodev->loopbacks, loopback);
 			free(loopback);
 		}
 	}
+	update_domain_threads(iodev->clock_domain, NULL);
+}
+
+void cras_iodev_list_set_loopback_target(const struct loopback_target *target)
+{
+	loopback_iodev_set_target(loopdev_post_mix, target);
 }
 
 void cras_iodev_list_reset_for_noise_cancellation()
@@ -1913,6 +2551,11 @@ void cras_iodev_list_reset()
 		free(edev);
 	}
 	enabled_devs[CRAS_STREAM_INPUT] = NULL;
+	DL_FOREACH (standby_devs, edev) {
+		DL_DELETE(standby_devs, edev);
+		free(edev);
+	}
+	standby_devs = NULL;
 	devs[CRAS_STREAM_OUTPUT].iodevs = NULL;
 	devs[CRAS_STREAM_INPUT].iodevs = NULL;
 	devs[CRAS_STREAM_OUTPUT].size = 0;
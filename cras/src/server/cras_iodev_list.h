@@ -16,6 +16,7 @@
 #include "cras_types.h"
 
 struct cras_rclient;
+struct loopback_target;
 struct stream_list;
 
 /* Device enabled/disabled callback. */
@@ -230,12 +231,23 @@ void cras_iodev_list_test_dev_command(unsigned int iodev_idx,
 				      unsigned int data_len,
 				      const uint8_t *data);
 
-/* Gets the audio thread used by the devices. */
+/* Gets the audio thread used by the devices. While the iodev list opens or
+ * closes a device this is the thread the device runs on, otherwise it's the
+ * main audio thread. */
 struct audio_thread *cras_iodev_list_get_audio_thread();
 
 /* Gets the list of all active audio streams attached to devices. */
 struct stream_list *cras_iodev_list_get_stream_list();
 
+/* Starts a batch of stream changes. Until the matching
+ * cras_iodev_list_end_stream_batch(), streams added are queued to their audio
+ * thread without waiting for each, and the streams removed are held. Ending
+ * the batch waits for the threads once and then drains the removed streams
+ * together. A stream whose add fails in the thread is only logged, it stays
+ * in the stream list without being attached. Batches may nest. */
+void cras_iodev_list_begin_stream_batch();
+void cras_iodev_list_end_stream_batch();
+
 /* Sets the function to call when a device is enabled or disabled. */
 int cras_iodev_list_set_device_enabled_callback(
 	device_enabled_callback_t enabled_cb,
@@ -247,26 +259,28 @@ int cras_iodev_list_set_device_enabled_callback(
  *    output_dev_idx - Index of the target output device.
  *    hook_data - Callback function to process loopback data.
  *    hook_start - Callback for starting or stopping loopback.
- *    loopback_dev_idx - Index of the loopback device that
- *        listens for output data.
+ *    cb_data - Passed to the hooks, the loopback tap that listens for
+ *        output data.
  */
 void cras_iodev_list_register_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
 				       unsigned int output_dev_idx,
 				       loopback_hook_data_t hook_data,
 				       loopback_hook_control_t hook_start,
-				       unsigned int loopback_dev_idx);
+				       void *cb_data);
 
 /* Unregisters loopback from an output device by matching
- * loopback type and loopback device index.
+ * loopback type and callback data.
  * Args:
  *    loopback_type - Pre or post software DSP.
  *    output_dev_idx - Index of the target output device.
- *    loopback_dev_idx - Index of the loopback device that
- *        listens for output data.
+ *    cb_data - The callback data the loopback was registered with.
  */
 void cras_iodev_list_unregister_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
 					 unsigned int output_dev_idx,
-					 unsigned int loopback_dev_idx);
+					 void *cb_data);
+
+/* Selects the output streams the post mix loopback device captures. */
+void cras_iodev_list_set_loopback_target(const struct loopback_target *target);
 
 /* Suspends all hotwording streams. */
 int cras_iodev_list_suspend_hotword_streams();
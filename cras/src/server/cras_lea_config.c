@@ -0,0 +1,220 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <sys/param.h>
+
+#include "cras_lea_config.h"
+#include "cras_util.h"
+
+/* Types of the codec specific capabilities LTV structures. */
+#define LEA_CAP_FREQ 0x01
+#define LEA_CAP_DURATION 0x02
+#define LEA_CAP_CHANNELS 0x03
+#define LEA_CAP_FRAME_LEN 0x04
+#define LEA_CAP_FRAMES_PER_SDU 0x05
+
+/* Types of the codec specific configuration LTV structures. */
+#define LEA_CONFIG_FREQ 0x01
+#define LEA_CONFIG_DURATION 0x02
+#define LEA_CONFIG_ALLOCATION 0x03
+#define LEA_CONFIG_FRAME_LEN 0x04
+
+/* Bits of the frame durations capability. */
+#define LEA_CAP_DURATION_7_5 (1 << 0)
+#define LEA_CAP_DURATION_10 (1 << 1)
+
+/* Codes of the frame duration configuration. */
+#define LEA_CONFIG_DURATION_7_5 0x00
+#define LEA_CONFIG_DURATION_10 0x01
+
+/* The front left audio location, for the one channel sent. */
+#define LEA_LOCATION_FRONT_LEFT 0x00000001
+
+/* The frame lengths CRAS can encode and decode. */
+#define LEA_MIN_FRAME_LEN 30
+#define LEA_MAX_FRAME_LEN 155
+
+/* The sample rates CRAS supports, from the highest, with how each is
+ * signaled in the capabilities and configuration, and the frame lengths of
+ * the BAP presets for the rate with 7.5ms and 10ms frames.
+ */
+static const struct {
+	unsigned int rate;
+	uint16_t cap_bit;
+	uint8_t config_code;
+	uint16_t frame_len_7_5;
+	uint16_t frame_len_10;
+} lea_rates[] = {
+	{ 48000, 1 << 7, 0x08, 75, 100 },
+	{ 32000, 1 << 5, 0x06, 60, 80 },
+	{ 24000, 1 << 4, 0x05, 45, 60 },
+	{ 16000, 1 << 2, 0x03, 30, 40 },
+};
+
+/* Finds the value of type in LTV structures.
+ * Returns:
+ *    The length of the value, or -ENOENT if type isn't found.
+ */
+static int find_ltv(const uint8_t *ltv, int len, uint8_t type,
+		    const uint8_t **value)
+{
+	int i = 0;
+
+	while (i < len) {
+		int l = ltv[i];
+
+		if (l == 0 || i + 1 + l > len)
+			break;
+		if (ltv[i + 1] == type) {
+			*value = &ltv[i + 2];
+			return l - 1;
+		}
+		i += 1 + l;
+	}
+	return -ENOENT;
+}
+
+static int put_ltv(uint8_t *ltv, int len, int offset, uint8_t type,
+		   uint32_t value, int value_len)
+{
+	int i;
+
+	if (offset + 2 + value_len > len)
+		return -ENOSPC;
+
+	ltv[offset++] = value_len + 1;
+	ltv[offset++] = type;
+	for (i = 0; i < value_len; i++)
+		ltv[offset++] = (value >> (8 * i)) & 0xff;
+	return offset;
+}
+
+static uint32_t get_le(const uint8_t *value, int value_len)
+{
+	uint32_t v = 0;
+	int i;
+
+	for (i = value_len - 1; i >= 0; i--)
+		v = (v << 8) | value[i];
+	return v;
+}
+
+int cras_lea_get_capabilities(uint8_t *caps, int len)
+{
+	uint16_t freqs = 0;
+	int i, offset = 0;
+
+	for (i = 0; i < ARRAY_SIZE(lea_rates); i++)
+		freqs |= lea_rates[i].cap_bit;
+
+	offset = put_ltv(caps, len, offset, LEA_CAP_FREQ, freqs, 2);
+	if (offset < 0)
+		return offset;
+	offset = put_ltv(caps, len, offset, LEA_CAP_DURATION,
+			 LEA_CAP_DURATION_7_5 | LEA_CAP_DURATION_10, 1);
+	if (offset < 0)
+		return offset;
+	/* One channel. */
+	offset = put_ltv(caps, len, offset, LEA_CAP_CHANNELS, 0x01, 1);
+	if (offset < 0)
+		return offset;
+	offset = put_ltv(caps, len, offset, LEA_CAP_FRAME_LEN,
+			 LEA_MIN_FRAME_LEN | (LEA_MAX_FRAME_LEN << 16), 4);
+	if (offset < 0)
+		return offset;
+	return put_ltv(caps, len, offset, LEA_CAP_FRAMES_PER_SDU, 1, 1);
+}
+
+int cras_lea_select_configuration(const uint8_t *caps, int caps_len,
+				  uint8_t *config, int len)
+{
+	const uint8_t *value;
+	unsigned int durations = LEA_CAP_DURATION_10;
+	unsigned int min_len = LEA_MIN_FRAME_LEN;
+	unsigned int max_len = LEA_MAX_FRAME_LEN;
+	unsigned int freqs, frame_len;
+	uint8_t duration_code;
+	int i, offset = 0;
+
+	if (find_ltv(caps, caps_len, LEA_CAP_FREQ, &value) != 2)
+		return -EINVAL;
+	freqs = get_le(value, 2);
+
+	if (find_ltv(caps, caps_len, LEA_CAP_DURATION, &value) == 1)
+		durations = value[0];
+	if (find_ltv(caps, caps_len, LEA_CAP_FRAME_LEN, &value) == 4) {
+		min_len = MAX(min_len, get_le(value, 2));
+		max_len = MIN(max_len, get_le(value + 2, 2));
+	}
+	if (min_len > max_len)
+		return -EINVAL;
+
+	for (i = 0; i < ARRAY_SIZE(lea_rates); i++)
+		if (freqs & lea_rates[i].cap_bit)
+			break;
+	if (i == ARRAY_SIZE(lea_rates))
+		return -EINVAL;
+
+	if (durations & LEA_CAP_DURATION_10) {
+		duration_code = LEA_CONFIG_DURATION_10;
+		frame_len = lea_rates[i].frame_len_10;
+	} else if (durations & LEA_CAP_DURATION_7_5) {
+		duration_code = LEA_CONFIG_DURATION_7_5;
+		frame_len = lea_rates[i].frame_len_7_5;
+	} else {
+		return -EINVAL;
+	}
+	frame_len = MIN(MAX(frame_len, min_len), max_len);
+
+	offset = put_ltv(config, len, offset, LEA_CONFIG_FREQ,
+			 lea_rates[i].config_code, 1);
+	if (offset < 0)
+		return offset;
+	offset = put_ltv(config, len, offset, LEA_CONFIG_DURATION,
+			 duration_code, 1);
+	if (offset < 0)
+		return offset;
+	offset = put_ltv(config, len, offset, LEA_CONFIG_ALLOCATION,
+			 LEA_LOCATION_FRONT_LEFT, 4);
+	if (offset < 0)
+		return offset;
+	return put_ltv(config, len, offset, LEA_CONFIG_FRAME_LEN, frame_len,
+		       2);
+}
+
+int cras_lea_parse_configuration(const uint8_t *config, int len,
+				 struct cras_lea_config *cfg)
+{
+	const uint8_t *value;
+	int i;
+
+	if (find_ltv(config, len, LEA_CONFIG_FREQ, &value) != 1)
+		return -EINVAL;
+	for (i = 0; i < ARRAY_SIZE(lea_rates); i++)
+		if (value[0] == lea_rates[i].config_code)
+			break;
+	if (i == ARRAY_SIZE(lea_rates))
+		return -EINVAL;
+	cfg->rate = lea_rates[i].rate;
+
+	if (find_ltv(config, len, LEA_CONFIG_DURATION, &value) != 1)
+		return -EINVAL;
+	if (value[0] == LEA_CONFIG_DURATION_10)
+		cfg->frame_us = 10000;
+	else if (value[0] == LEA_CONFIG_DURATION_7_5)
+		cfg->frame_us = 7500;
+	else
+		return -EINVAL;
+
+	if (find_ltv(config, len, LEA_CONFIG_FRAME_LEN, &value) != 2)
+		return -EINVAL;
+	cfg->frame_bytes = get_le(value, 2);
+	if (cfg->frame_bytes < LEA_MIN_FRAME_LEN ||
+	    cfg->frame_bytes > LEA_MAX_FRAME_LEN)
+		return -EINVAL;
+
+	return 0;
+}
@@ -0,0 +1,64 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_LEA_CONFIG_H_
+#define CRAS_LEA_CONFIG_H_
+
+#include <stdint.h>
+
+/* The codec id of LC3 in the BAP endpoint capabilities. */
+#define LEA_CODEC_LC3 0x06
+
+/*
+ * An LC3 configuration of an LE Audio stream, parsed from the codec
+ * specific configuration of BAP.
+ * Members:
+ *    rate - The sample rate.
+ *    frame_us - The frame duration in us, 7500 or 10000.
+ *    frame_bytes - The size of one LC3 frame, sent as one SDU.
+ */
+struct cras_lea_config {
+	unsigned int rate;
+	unsigned int frame_us;
+	unsigned int frame_bytes;
+};
+
+/*
+ * Fills the codec specific capabilities CRAS supports, as LTV structures.
+ * Args:
+ *    caps - The buffer to fill.
+ *    len - The size of caps.
+ * Returns:
+ *    The length of the capabilities, or negative error code.
+ */
+int cras_lea_get_capabilities(uint8_t *caps, int len);
+
+/*
+ * Picks a configuration of the remote capabilities, the highest common
+ * sample rate with 10ms frames preferred, sized as the BAP presets.
+ * Args:
+ *    caps - The codec specific capabilities of the remote.
+ *    caps_len - The length of caps.
+ *    config - The buffer to fill with the codec specific configuration.
+ *    len - The size of config.
+ * Returns:
+ *    The length of the configuration, or negative error code.
+ */
+int cras_lea_select_configuration(const uint8_t *caps, int caps_len,
+				  uint8_t *config, int len);
+
+/*
+ * Parses a codec specific configuration.
+ * Args:
+ *    config - The codec specific configuration, as LTV structures.
+ *    len - The length of config.
+ *    cfg - Filled with the parsed configuration.
+ * Returns:
+ *    0 on success, or negative error code if config isn't supported.
+ */
+int cras_lea_parse_configuration(const uint8_t *config, int len,
+				 struct cras_lea_config *cfg);
+
+#endif /* CRAS_LEA_CONFIG_H_ */
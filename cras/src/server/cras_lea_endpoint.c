@@ -0,0 +1,122 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <syslog.h>
+
+#include "cras_bt_constants.h"
+#include "cras_bt_endpoint.h"
+#include "cras_bt_transport.h"
+#include "cras_iodev.h"
+#include "cras_lea_config.h"
+#include "cras_lea_endpoint.h"
+#include "cras_lea_iodev.h"
+#include "cras_util.h"
+
+#define PAC_SINK_ENDPOINT_PATH "/org/chromium/Cras/Bluetooth/PACSink"
+#define PAC_SOURCE_ENDPOINT_PATH "/org/chromium/Cras/Bluetooth/PACSource"
+
+/* Each endpoint carries one direction, on its own isochronous channel. The
+ * PAC sink receives the audio the remote captures, and the PAC source sends
+ * the audio the remote plays.
+ */
+static struct lea_endpoint {
+	struct cras_bt_endpoint base;
+	enum CRAS_STREAM_DIRECTION dir;
+	struct cras_iodev *iodev;
+} endpoints[] = {
+	{
+		.base = {
+			.object_path = PAC_SOURCE_ENDPOINT_PATH,
+			.uuid = PAC_SOURCE_UUID,
+			.codec = LEA_CODEC_LC3,
+		},
+		.dir = CRAS_STREAM_OUTPUT,
+	},
+	{
+		.base = {
+			.object_path = PAC_SINK_ENDPOINT_PATH,
+			.uuid = PAC_SINK_UUID,
+			.codec = LEA_CODEC_LC3,
+		},
+		.dir = CRAS_STREAM_INPUT,
+	},
+};
+
+static int cras_lea_get_endpoint_capabilities(struct cras_bt_endpoint *endpoint,
+					      void *capabilities, int *len)
+{
+	int rc;
+
+	rc = cras_lea_get_capabilities(capabilities, *len);
+	if (rc < 0)
+		return rc;
+
+	*len = rc;
+	return 0;
+}
+
+static int
+cras_lea_select_endpoint_configuration(struct cras_bt_endpoint *endpoint,
+				       void *capabilities, int len,
+				       void *configuration)
+{
+	return cras_lea_select_configuration(capabilities, len, configuration,
+					     MAX_CAPABILITIES_LEN);
+}
+
+static void cras_lea_set_configuration(struct cras_bt_endpoint *endpoint,
+				       struct cras_bt_transport *transport)
+{
+	struct lea_endpoint *lea = (struct lea_endpoint *)endpoint;
+
+	if (lea->iodev) {
+		syslog(LOG_WARNING,
+		       "Replacing existing LE Audio endpoint configuration");
+		lea_iodev_destroy(lea->iodev);
+	}
+
+	lea->iodev = lea_iodev_create(transport, lea->dir);
+	if (!lea->iodev)
+		syslog(LOG_WARNING, "Failed to create LE Audio iodev");
+}
+
+static void cras_lea_suspend(struct cras_bt_endpoint *endpoint,
+			     struct cras_bt_transport *transport)
+{
+	struct lea_endpoint *lea = (struct lea_endpoint *)endpoint;
+
+	if (!lea->iodev)
+		return;
+
+	syslog(LOG_INFO, "Destroying iodev for LE Audio device");
+	lea_iodev_destroy(lea->iodev);
+	lea->iodev = NULL;
+}
+
+int cras_lea_endpoint_create(DBusConnection *conn)
+{
+	struct cras_bt_endpoint *endpoint;
+	unsigned int i;
+	int rc, ret = 0;
+
+	for (i = 0; i < ARRAY_SIZE(endpoints); i++) {
+		endpoint = &endpoints[i].base;
+		endpoint->get_capabilities = cras_lea_get_endpoint_capabilities;
+		endpoint->select_configuration =
+			cras_lea_select_endpoint_configuration;
+		endpoint->set_configuration = cras_lea_set_configuration;
+		endpoint->suspend = cras_lea_suspend;
+
+		rc = cras_bt_endpoint_add(conn, endpoint);
+		if (rc) {
+			syslog(LOG_ERR, "Failed to add %s endpoint: %d",
+			       endpoint->object_path, rc);
+			ret = rc;
+		}
+	}
+	return ret;
+}
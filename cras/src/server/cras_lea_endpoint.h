@@ -0,0 +1,15 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_LEA_ENDPOINT_H_
+#define CRAS_LEA_ENDPOINT_H_
+
+#include <dbus/dbus.h>
+
+/* Adds the BAP endpoints of LE Audio, a PAC sink for input streams and a PAC
+ * source for output streams, both with LC3. */
+int cras_lea_endpoint_create(DBusConnection *conn);
+
+#endif /* CRAS_LEA_ENDPOINT_H_ */
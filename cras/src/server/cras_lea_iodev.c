@@ -0,0 +1,529 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <syslog.h>
+#include <time.h>
+
+#include "audio_thread.h"
+#include "byte_buffer.h"
+#include "cras_audio_area.h"
+#include "cras_bt_device.h"
+#include "cras_bt_transport.h"
+#include "cras_iodev.h"
+#include "cras_iodev_list.h"
+#include "cras_lc3_codec.h"
+#include "cras_lea_config.h"
+#include "cras_lea_iodev.h"
+#include "cras_mem_stats.h"
+#include "cras_util.h"
+#include "utlist.h"
+
+/* Room for the codec specific configuration of the transport. */
+#define LEA_CONFIG_MAX_LEN 32
+
+/* The most samples of one LC3 frame, 10ms at 48kHz. */
+#define LEA_MAX_FRAME_SAMPLES 480
+
+/* The most bytes of one SDU, which carries one LC3 frame. */
+#define LEA_MAX_SDU_LEN 155
+
+/* How many LC3 frames of PCM the buffer holds. */
+#define LEA_PCM_BUF_FRAMES 16
+
+/* Falling this many SDUs behind restarts the schedule of writes. */
+#define LEA_MAX_LATE_SDUS 4
+
+/* Child of cras_iodev to stream LC3 over an LE Audio transport.
+ * Members:
+ *    base - The cras_iodev structure "base class".
+ *    transport - The transport object for bluez media API.
+ *    config - The LC3 configuration of the transport.
+ *    codec - Encodes or decodes the LC3 frames.
+ *    pcm_buf - Buffer to hold pcm samples before encode or after decode.
+ *    codesize - The size in bytes of the PCM of one LC3 frame.
+ *    next_sdu_time - The time the next SDU is due, for output.
+ *    sdu_period - The time between two SDUs.
+ *    destroyed - Flag to note if this lea_io is about to destroy.
+ *    frame - Holds the PCM of one LC3 frame when it wraps in pcm_buf.
+ *    sdu - Holds one SDU.
+ */
+struct lea_io {
+	struct cras_iodev base;
+	struct cras_bt_transport *transport;
+	struct cras_lea_config config;
+	struct cras_audio_codec *codec;
+	struct byte_buffer *pcm_buf;
+	unsigned int codesize;
+	struct timespec next_sdu_time;
+	struct timespec sdu_period;
+	int destroyed;
+	int16_t frame[LEA_MAX_FRAME_SAMPLES];
+	uint8_t sdu[LEA_MAX_SDU_LEN];
+};
+
+static int update_supported_formats(struct cras_iodev *iodev)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+
+	free(iodev->supported_rates);
+	iodev->supported_rates = (size_t *)malloc(2 * sizeof(size_t));
+	iodev->supported_rates[0] = leaio->config.rate;
+	iodev->supported_rates[1] = 0;
+
+	/* 16 bit, mono, one LC3 channel per transport. */
+	free(iodev->supported_channel_counts);
+	iodev->supported_channel_counts = (size_t *)malloc(2 * sizeof(size_t));
+	iodev->supported_channel_counts[0] = 1;
+	iodev->supported_channel_counts[1] = 0;
+
+	free(iodev->supported_formats);
+	iodev->supported_formats =
+		(snd_pcm_format_t *)malloc(2 * sizeof(snd_pcm_format_t));
+	iodev->supported_formats[0] = SND_PCM_FORMAT_S16_LE;
+	iodev->supported_formats[1] = 0;
+
+	return 0;
+}
+
+/* Encodes the due LC3 frames and writes them to the socket, one SDU each.
+ * The isochronous channel takes one SDU per interval, so the writes follow
+ * that schedule rather than filling the socket.
+ * Returns:
+ *    0 on success, or negative error code.
+ */
+static int flush_sdus(struct lea_io *leaio)
+{
+	int fd = cras_bt_transport_fd(leaio->transport);
+	struct timespec now;
+	const void *pcm;
+	size_t count;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+
+	while (buf_queued(leaio->pcm_buf) >= leaio->codesize &&
+	       !timespec_after(&leaio->next_sdu_time, &now)) {
+		pcm = buf_read_pointer(leaio->pcm_buf);
+		if (buf_readable(leaio->pcm_buf) < leaio->codesize) {
+			/* The frame wraps in pcm_buf. */
+			unsigned int n = buf_readable(leaio->pcm_buf);
+
+			memcpy(leaio->frame, pcm, n);
+			buf_increment_read(leaio->pcm_buf, n);
+			memcpy((uint8_t *)leaio->frame + n,
+			       buf_read_pointer(leaio->pcm_buf),
+			       leaio->codesize - n);
+			buf_increment_read(leaio->pcm_buf,
+					   leaio->codesize - n);
+			pcm = leaio->frame;
+		} else {
+			buf_increment_read(leaio->pcm_buf, leaio->codesize);
+		}
+
+		err = leaio->codec->encode(leaio->codec, pcm, leaio->codesize,
+					   leaio->sdu, sizeof(leaio->sdu),
+					   &count);
+		if (err < 0) {
+			syslog(LOG_ERR, "LC3 encode failed: %d", err);
+			return err;
+		}
+
+		if (send(fd, leaio->sdu, count, MSG_DONTWAIT) < 0) {
+			/* A full socket drops the frame to stay on time. */
+			if (errno != EAGAIN && errno != EWOULDBLOCK) {
+				syslog(LOG_ERR, "LE Audio write error: %d",
+				       errno);
+				return -errno;
+			}
+		}
+		add_timespecs(&leaio->next_sdu_time, &leaio->sdu_period);
+	}
+
+	/* Restart the schedule after an underrun, rather than sending a
+	 * burst of SDUs to catch up later on. */
+	if (cras_frames_since_time(&leaio->next_sdu_time, leaio->config.rate) >
+	    LEA_MAX_LATE_SDUS * leaio->codesize / sizeof(int16_t))
+		leaio->next_sdu_time = now;
+
+	return 0;
+}
+
+/* Decodes the SDUs received into pcm_buf. A SDU without data means the
+ * frame was lost, and the codec conceals it. */
+static int lea_socket_read_cb(void *arg, int revents)
+{
+	struct lea_io *leaio = (struct lea_io *)arg;
+	int fd = cras_bt_transport_fd(leaio->transport);
+	uint8_t *dst;
+	size_t count;
+	ssize_t len;
+	int err;
+
+	if (revents & (POLLERR | POLLHUP)) {
+		syslog(LOG_ERR, "LE Audio socket error, revents %d", revents);
+		audio_thread_rm_callback(fd);
+		return -EPIPE;
+	}
+
+	while (1) {
+		len = recv(fd, leaio->sdu, sizeof(leaio->sdu), MSG_DONTWAIT);
+		if (len < 0) {
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return 0;
+			syslog(LOG_ERR, "LE Audio read error: %d", errno);
+			return -errno;
+		}
+
+		/* Drop the frame when the stream doesn't keep up. */
+		if (buf_available(leaio->pcm_buf) < leaio->codesize)
+			continue;
+
+		dst = buf_write_pointer(leaio->pcm_buf);
+		if (buf_writable(leaio->pcm_buf) < leaio->codesize)
+			dst = (uint8_t *)leaio->frame;
+
+		err = leaio->codec->decode(leaio->codec, leaio->sdu, len, dst,
+					   leaio->codesize, &count);
+		if (err < 0) {
+			syslog(LOG_ERR, "LC3 decode failed: %d", err);
+			continue;
+		}
+
+		if (dst == (uint8_t *)leaio->frame) {
+			/* The frame wraps in pcm_buf. */
+			unsigned int n = buf_writable(leaio->pcm_buf);
+
+			memcpy(buf_write_pointer(leaio->pcm_buf), dst, n);
+			buf_increment_write(leaio->pcm_buf, n);
+			memcpy(buf_write_pointer(leaio->pcm_buf), dst + n,
+			       count - n);
+			buf_increment_write(leaio->pcm_buf, count - n);
+		} else {
+			buf_increment_write(leaio->pcm_buf, count);
+		}
+	}
+}
+
+static int frames_queued(const struct cras_iodev *iodev,
+			 struct timespec *tstamp)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	int err;
+
+	if (!leaio->pcm_buf)
+		return -EINVAL;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		err = flush_sdus(leaio);
+		if (err < 0)
+			return err;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	return buf_queued(leaio->pcm_buf) /
+	       cras_get_format_bytes(iodev->format);
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	struct timespec tstamp;
+
+	return frames_queued(iodev, &tstamp);
+}
+
+static int configure_dev(struct cras_iodev *iodev)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	int err;
+
+	/* Assert format is set before opening device. */
+	if (iodev->format == NULL)
+		return -EINVAL;
+	iodev->format->format = SND_PCM_FORMAT_S16_LE;
+
+	err = cras_bt_transport_acquire(leaio->transport);
+	if (err < 0) {
+		syslog(LOG_ERR, "LE Audio transport_acquire failed");
+		return err;
+	}
+
+	leaio->codec = cras_lc3_codec_create(leaio->config.rate,
+					     leaio->config.frame_us,
+					     leaio->config.frame_bytes);
+	if (!leaio->codec) {
+		err = -ENOMEM;
+		goto release;
+	}
+	leaio->codesize = cras_lc3_get_codesize(leaio->codec);
+
+	leaio->pcm_buf =
+		byte_buffer_create(LEA_PCM_BUF_FRAMES * leaio->codesize);
+	if (!leaio->pcm_buf) {
+		err = -ENOMEM;
+		goto destroy_codec;
+	}
+	cras_mem_stats_add(CRAS_MEM_BT, leaio->pcm_buf->max_size);
+
+	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
+	iodev->buffer_size = LEA_PCM_BUF_FRAMES * leaio->codesize /
+			     cras_get_format_bytes(iodev->format);
+	iodev->min_buffer_level = 0;
+	leaio->sdu_period.tv_sec = 0;
+	leaio->sdu_period.tv_nsec = leaio->config.frame_us * 1000;
+
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		audio_thread_add_events_callback(
+			cras_bt_transport_fd(leaio->transport),
+			lea_socket_read_cb, leaio, POLLIN | POLLERR | POLLHUP);
+	return 0;
+
+destroy_codec:
+	cras_lc3_codec_destroy(leaio->codec);
+	leaio->codec = NULL;
+release:
+	cras_bt_transport_release(leaio->transport, 1);
+	return err;
+}
+
+static int start(const struct cras_iodev *iodev)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+
+	/* Initialize the schedule of SDUs when output samples are ready. */
+	clock_gettime(CLOCK_MONOTONIC_RAW, &leaio->next_sdu_time);
+	return 0;
+}
+
+static unsigned int frames_to_play_in_sleep(struct cras_iodev *iodev,
+					    unsigned int *hw_level,
+					    struct timespec *hw_tstamp)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	int frames_until;
+
+	*hw_level = frames_queued(iodev, hw_tstamp);
+
+	/* Wake up for the next SDU, the socket doesn't pull samples by
+	 * itself. */
+	frames_until = cras_frames_until_time(&leaio->next_sdu_time,
+					      iodev->format->frame_rate);
+	if (frames_until > 0)
+		return frames_until;
+	return leaio->codesize / cras_get_format_bytes(iodev->format);
+}
+
+static int close_dev(struct cras_iodev *iodev)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	int err;
+
+	if (!leaio->pcm_buf)
+		return 0;
+
+	/* Remove audio thread callback and sync before releasing
+	 * the transport. */
+	if (iodev->direction == CRAS_STREAM_INPUT)
+		audio_thread_rm_callback_sync(
+			cras_iodev_list_get_audio_thread(),
+			cras_bt_transport_fd(leaio->transport));
+
+	err = cras_bt_transport_release(leaio->transport, !leaio->destroyed);
+	if (err < 0)
+		syslog(LOG_ERR, "LE Audio transport_release failed");
+
+	cras_lc3_codec_destroy(leaio->codec);
+	leaio->codec = NULL;
+	if (leaio->pcm_buf)
+		cras_mem_stats_sub(CRAS_MEM_BT, leaio->pcm_buf->max_size);
+	byte_buffer_destroy(&leaio->pcm_buf);
+	cras_iodev_free_format(iodev);
+	cras_iodev_free_audio_area(iodev);
+	return 0;
+}
+
+static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
+		      unsigned *frames)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	size_t format_bytes = cras_get_format_bytes(iodev->format);
+	uint8_t *buf;
+
+	if (!leaio->pcm_buf)
+		return -EINVAL;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		*frames = MIN(*frames,
+			      buf_writable(leaio->pcm_buf) / format_bytes);
+		buf = buf_write_pointer(leaio->pcm_buf);
+	} else {
+		*frames = MIN(*frames,
+			      buf_readable(leaio->pcm_buf) / format_bytes);
+		buf = buf_read_pointer(leaio->pcm_buf);
+	}
+
+	iodev->area->frames = *frames;
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format, buf);
+	*area = iodev->area;
+	return 0;
+}
+
+static int put_buffer(struct cras_iodev *iodev, unsigned nwritten)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	size_t nbytes = nwritten * cras_get_format_bytes(iodev->format);
+
+	if (!leaio->pcm_buf)
+		return -EINVAL;
+
+	if (iodev->direction == CRAS_STREAM_INPUT) {
+		if (nbytes > buf_readable(leaio->pcm_buf))
+			return -EINVAL;
+		buf_increment_read(leaio->pcm_buf, nbytes);
+		return 0;
+	}
+
+	if (nbytes > buf_writable(leaio->pcm_buf))
+		return -EINVAL;
+	buf_increment_write(leaio->pcm_buf, nbytes);
+	return flush_sdus(leaio);
+}
+
+static int flush_buffer(struct cras_iodev *iodev)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_INPUT && leaio->pcm_buf)
+		buf_reset(leaio->pcm_buf);
+	return 0;
+}
+
+static int no_stream(struct cras_iodev *iodev, int enable)
+{
+	if (iodev->direction != CRAS_STREAM_OUTPUT)
+		return 0;
+	return cras_iodev_default_no_stream_playback(iodev, enable);
+}
+
+static void update_active_node(struct cras_iodev *iodev, unsigned node_idx,
+			       unsigned dev_enabled)
+{
+}
+
+static void free_resources(struct lea_io *leaio)
+{
+	struct cras_ionode *node;
+
+	node = leaio->base.active_node;
+	if (node) {
+		cras_iodev_rm_node(&leaio->base, node);
+		free(node);
+	}
+	free(leaio->base.supported_channel_counts);
+	free(leaio->base.supported_rates);
+	free(leaio->base.supported_formats);
+}
+
+struct cras_iodev *lea_iodev_create(struct cras_bt_transport *transport,
+				    enum CRAS_STREAM_DIRECTION dir)
+{
+	struct lea_io *leaio;
+	struct cras_iodev *iodev;
+	struct cras_ionode *node;
+	uint8_t config[LEA_CONFIG_MAX_LEN] = { 0 };
+	struct cras_bt_device *device;
+	const char *name;
+	int err;
+
+	leaio = (struct lea_io *)calloc(1, sizeof(*leaio));
+	if (!leaio)
+		return NULL;
+
+	leaio->transport = transport;
+	err = cras_bt_transport_configuration(transport, config,
+					      sizeof(config));
+	if (!err)
+		err = cras_lea_parse_configuration(config, sizeof(config),
+						   &leaio->config);
+	if (err) {
+		syslog(LOG_ERR, "Unsupported LE Audio configuration");
+		free(leaio);
+		return NULL;
+	}
+
+	iodev = &leaio->base;
+	iodev->direction = dir;
+
+	/* Set iodev's name by bluetooth device's readable name, if
+	 * the readable name is not available, use address instead.
+	 */
+	device = cras_bt_transport_device(transport);
+	iodev->clock_domain = device;
+	name = cras_bt_device_name(device);
+	if (!name)
+		name = cras_bt_transport_object_path(transport);
+
+	snprintf(iodev->info.name, sizeof(iodev->info.name), "%s", name);
+	iodev->info.name[ARRAY_SIZE(iodev->info.name) - 1] = '\0';
+	iodev->info.stable_id = cras_bt_device_get_stable_id(device);
+
+	iodev->configure_dev = configure_dev;
+	iodev->frames_queued = frames_queued;
+	iodev->delay_frames = delay_frames;
+	iodev->get_buffer = get_buffer;
+	iodev->put_buffer = put_buffer;
+	iodev->flush_buffer = flush_buffer;
+	iodev->no_stream = no_stream;
+	iodev->close_dev = close_dev;
+	iodev->update_supported_formats = update_supported_formats;
+	iodev->update_active_node = update_active_node;
+	if (dir == CRAS_STREAM_OUTPUT) {
+		iodev->start = start;
+		iodev->frames_to_play_in_sleep = frames_to_play_in_sleep;
+	}
+
+	/* Create an empty ionode */
+	node = (struct cras_ionode *)calloc(1, sizeof(*node));
+	node->dev = iodev;
+	strcpy(node->name, iodev->info.name);
+	node->plugged = 1;
+	node->type = CRAS_NODE_TYPE_BLUETOOTH;
+	node->volume = 100;
+	gettimeofday(&node->plugged_time, NULL);
+
+	/* Prepare active node before append, so bt_io can extract correct
+	 * info from LE Audio iodev and node. */
+	cras_iodev_add_node(iodev, node);
+	cras_iodev_set_active_node(iodev, node);
+	cras_bt_device_append_iodev(device, iodev,
+				    CRAS_BT_DEVICE_PROFILE_LE_AUDIO);
+
+	iodev->info.max_supported_channels = 1;
+
+	ewma_power_disable(&iodev->ewma);
+
+	return iodev;
+}
+
+void lea_iodev_destroy(struct cras_iodev *iodev)
+{
+	struct lea_io *leaio = (struct lea_io *)iodev;
+	struct cras_bt_device *device;
+
+	leaio->destroyed = 1;
+	device = cras_bt_transport_device(leaio->transport);
+	cras_bt_device_rm_iodev(device, iodev);
+
+	/* Free resources when device successfully removed. */
+	free_resources(leaio);
+	cras_iodev_free_resources(iodev);
+	free(leaio);
+}
@@ -0,0 +1,30 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_LEA_IODEV_H_
+#define CRAS_LEA_IODEV_H_
+
+#include "cras_types.h"
+
+struct cras_bt_transport;
+struct cras_iodev;
+
+/*
+ * Creates an LE Audio iodev, which streams LC3 frames over the isochronous
+ * channel of transport, one frame per SDU.
+ * Args:
+ *    transport - The transport of the configured BAP endpoint.
+ *    dir - CRAS_STREAM_OUTPUT for a sink on the remote, CRAS_STREAM_INPUT
+ *        for a source on it.
+ */
+struct cras_iodev *lea_iodev_create(struct cras_bt_transport *transport,
+				    enum CRAS_STREAM_DIRECTION dir);
+
+/*
+ * Destroys an LE Audio iodev.
+ */
+void lea_iodev_destroy(struct cras_iodev *iodev);
+
+#endif /* CRAS_LEA_IODEV_H_ */
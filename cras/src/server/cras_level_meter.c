@@ -0,0 +1,82 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <math.h>
+
+#include "cras_level_meter.h"
+#include "ewma_power.h"
+
+/* The meters are kept here too, so they survive the server state being
+ * mapped after the first devices open. */
+static struct cras_level_meter meters[CRAS_MAX_LEVEL_METERS];
+static struct cras_level_meter *shared_meters;
+
+/* Copies meter i to the server state under its seq. */
+static void publish(unsigned int i)
+{
+	struct cras_level_meter *shared =
+		__atomic_load_n(&shared_meters, __ATOMIC_ACQUIRE);
+	struct cras_level_meter *m;
+	uint32_t seq;
+
+	if (!shared)
+		return;
+	m = &shared[i];
+	seq = __atomic_load_n(&m->seq, __ATOMIC_RELAXED);
+	__atomic_store_n(&m->seq, seq + 1, __ATOMIC_RELAXED);
+	__atomic_thread_fence(__ATOMIC_RELEASE);
+	m->type = meters[i].type;
+	m->id = meters[i].id;
+	m->peak = meters[i].peak;
+	m->rms = meters[i].rms;
+	__atomic_store_n(&m->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+void cras_level_meter_share(struct cras_level_meter *shared)
+{
+	unsigned int i;
+
+	__atomic_store_n(&shared_meters, shared, __ATOMIC_RELEASE);
+	for (i = 0; i < CRAS_MAX_LEVEL_METERS; i++)
+		publish(i);
+}
+
+int cras_level_meter_add(enum CRAS_LEVEL_METER_TYPE type, uint32_t id)
+{
+	unsigned int i;
+
+	for (i = 0; i < CRAS_MAX_LEVEL_METERS; i++) {
+		if (meters[i].type != CRAS_LEVEL_METER_NONE)
+			continue;
+		meters[i].type = type;
+		meters[i].id = id;
+		meters[i].peak = 0.0f;
+		meters[i].rms = 0.0f;
+		publish(i);
+		return i;
+	}
+	return -ENOSPC;
+}
+
+void cras_level_meter_rm(int meter)
+{
+	if (meter < 0 || meter >= CRAS_MAX_LEVEL_METERS)
+		return;
+	meters[meter].type = CRAS_LEVEL_METER_NONE;
+	meters[meter].id = 0;
+	meters[meter].peak = 0.0f;
+	meters[meter].rms = 0.0f;
+	publish(meter);
+}
+
+void cras_level_meter_update(int meter, const struct ewma_power *ewma)
+{
+	if (meter < 0 || meter >= CRAS_MAX_LEVEL_METERS)
+		return;
+	meters[meter].peak = ewma->peak;
+	meters[meter].rms = sqrtf(ewma->power);
+	publish(meter);
+}
@@ -0,0 +1,44 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Publishes the levels of the open devices and the playback streams in the
+ * server state, so a UI can show a meter by reading shared memory at its own
+ * rate rather than capturing a stream. The levels come from the frames
+ * ewma_power already samples for the power of each device and stream.
+ * Meters are added and removed by the main thread and updated by the audio
+ * threads.
+ */
+
+#ifndef CRAS_LEVEL_METER_H_
+#define CRAS_LEVEL_METER_H_
+
+#include <stdint.h>
+
+#include "cras_types.h"
+
+struct ewma_power;
+
+/* Publishes the meters in shared, an array of CRAS_MAX_LEVEL_METERS, from
+ * now on. Called once the server state is mapped and with NULL before it is
+ * unmapped. */
+void cras_level_meter_share(struct cras_level_meter *shared);
+
+/* Adds a meter for a device or a stream.
+ * Args:
+ *    type - CRAS_LEVEL_METER_DEVICE or CRAS_LEVEL_METER_STREAM.
+ *    id - The index of the device or the id of the stream.
+ * Returns:
+ *    The meter to update, or -ENOSPC if all the meters are in use.
+ */
+int cras_level_meter_add(enum CRAS_LEVEL_METER_TYPE type, uint32_t id);
+
+/* Removes a meter from cras_level_meter_add(), does nothing for a negative
+ * one. */
+void cras_level_meter_rm(int meter);
+
+/* Publishes the level ewma has measured to meter, does nothing for a
+ * negative one. */
+void cras_level_meter_update(int meter, const struct ewma_power *ewma);
+
+#endif /* CRAS_LEVEL_METER_H_ */
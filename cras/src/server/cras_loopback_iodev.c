@@ -8,11 +8,11 @@
 #include <syslog.h>
 
 #include "audio_thread_log.h"
-#include "byte_buffer.h"
 #include "cras_audio_area.h"
 #include "cras_config.h"
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
+#include "cras_loopback_tap.h"
 #include "cras_types.h"
 #include "cras_util.h"
 #include "sfh.h"
@@ -36,19 +36,25 @@ static snd_pcm_format_t loopback_supported_formats[] = {
 
 /* loopack iodev.  Keep state of a loopback device.
  *    loopback_type - Pre-dsp or post-dsp.
+ *    target - The output streams captured.
  *    read_frames - Frames of audio data read since last dev start.
  *    started - True to indicate the target device is running, otherwise false.
  *    dev_start_time - The timestamp of the last call to configure_dev.
- *    sample_buffer - Pointer to sample buffer.
+ *    reader - Reads the tap on the output device, NULL without one.
+ *    silence - Zeros read while the output device isn't running.
+ *    reading_tap - True if the last get_buffer was from the tap.
  *    sender_idx - Index of the output device to read loopback audio.
  */
 struct loopback_iodev {
 	struct cras_iodev base;
 	enum CRAS_LOOPBACK_TYPE loopback_type;
+	struct loopback_target target;
 	uint64_t read_frames;
 	bool started;
 	struct timespec dev_start_time;
-	struct byte_buffer *sample_buffer;
+	struct loopback_tap_reader *reader;
+	uint8_t *silence;
+	bool reading_tap;
 	unsigned int sender_idx;
 };
 
@@ -59,51 +65,29 @@ static int sample_hook_start(bool start, void *cb_data)
 	return 0;
 }
 
-/*
- * Called in the put buffer function of the sender that hooked to.
- *
- * Returns:
- *   Number of frames copied to the sample buffer in the hook.
- */
-static int sample_hook(const uint8_t *frames, unsigned int nframes,
-		       const struct cras_audio_format *fmt, void *cb_data)
+static void detach_from_output(struct loopback_iodev *loopdev)
 {
-	struct loopback_iodev *loopdev = (struct loopback_iodev *)cb_data;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
-	unsigned int frame_bytes = cras_get_format_bytes(fmt);
-	unsigned int frames_to_copy, bytes_to_copy, frames_copied = 0;
-	int i;
-
-	for (i = 0; i < 2; i++) {
-		frames_to_copy = MIN(buf_writable(sbuf) / frame_bytes, nframes);
-		if (!frames_to_copy)
-			break;
-
-		bytes_to_copy = frames_to_copy * frame_bytes;
-		memcpy(buf_write_pointer(sbuf), frames, bytes_to_copy);
-		buf_increment_write(sbuf, bytes_to_copy);
-		frames += bytes_to_copy;
-		nframes -= frames_to_copy;
-		frames_copied += frames_to_copy;
-	}
-
-	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK, nframes + frames_copied,
-	      frames_copied, 0);
-
-	return frames_copied;
+	loopback_tap_detach(loopdev->reader);
+	loopdev->reader = NULL;
+	loopdev->started = false;
 }
 
 static void update_first_output_to_loopback(struct loopback_iodev *loopdev)
 {
 	struct cras_iodev *edev;
 
-	/* Register loopback hook onto first enabled iodev. */
+	/* Read the tap on the first enabled iodev. */
 	edev = cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
+	if (loopdev->reader) {
+		if (edev && edev->info.idx == loopdev->sender_idx)
+			return;
+		detach_from_output(loopdev);
+	}
 	if (edev) {
 		loopdev->sender_idx = edev->info.idx;
-		cras_iodev_list_register_loopback(
-			loopdev->loopback_type, loopdev->sender_idx,
-			sample_hook, sample_hook_start, loopdev->base.info.idx);
+		loopdev->reader = loopback_tap_attach(
+			loopdev->loopback_type, &loopdev->target,
+			loopdev->sender_idx, sample_hook_start, loopdev);
 	}
 }
 
@@ -124,10 +108,8 @@ static void device_disabled_hook(struct cras_iodev *iodev, void *cb_data)
 	if (loopdev->sender_idx != iodev->info.idx)
 		return;
 
-	/* Unregister loopback hook from disabled iodev. */
-	cras_iodev_list_unregister_loopback(loopdev->loopback_type,
-					    loopdev->sender_idx,
-					    loopdev->base.info.idx);
+	/* Stop reading the disabled iodev. */
+	detach_from_output(loopdev);
 	update_first_output_to_loopback(loopdev);
 }
 
@@ -139,28 +121,19 @@ static int frames_queued(const struct cras_iodev *iodev,
 			 struct timespec *hw_tstamp)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
-	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
-
-	if (!loopdev->started) {
-		unsigned int frames_since_start, frames_to_fill, bytes_to_fill;
-
-		frames_since_start = cras_frames_since_time(
-			&loopdev->dev_start_time, iodev->format->frame_rate);
-		frames_to_fill =
-			frames_since_start > loopdev->read_frames ?
-				frames_since_start - loopdev->read_frames :
-				0;
-		frames_to_fill =
-			MIN(buf_writable(sbuf) / frame_bytes, frames_to_fill);
-		if (frames_to_fill > 0) {
-			bytes_to_fill = frames_to_fill * frame_bytes;
-			memset(buf_write_pointer(sbuf), 0, bytes_to_fill);
-			buf_increment_write(sbuf, bytes_to_fill);
-		}
-	}
+	unsigned int frames_since_start;
+
 	clock_gettime(CLOCK_MONOTONIC_RAW, hw_tstamp);
-	return buf_queued(sbuf) / frame_bytes;
+	if (loopdev->started && loopdev->reader)
+		return loopback_tap_reader_queued(loopdev->reader);
+
+	/* Without output, silence is read at the rate of the device. */
+	frames_since_start = cras_frames_since_time(&loopdev->dev_start_time,
+						    iodev->format->frame_rate);
+	if (frames_since_start <= loopdev->read_frames)
+		return 0;
+	return MIN(frames_since_start - loopdev->read_frames,
+		   LOOPBACK_TAP_FRAMES);
 }
 
 static int delay_frames(const struct cras_iodev *iodev)
@@ -173,15 +146,11 @@ static int delay_frames(const struct cras_iodev *iodev)
 static int close_record_dev(struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
 
 	cras_iodev_free_format(iodev);
 	cras_iodev_free_audio_area(iodev);
-	buf_reset(sbuf);
 
-	cras_iodev_list_unregister_loopback(loopdev->loopback_type,
-					    loopdev->sender_idx,
-					    loopdev->base.info.idx);
+	detach_from_output(loopdev);
 	loopdev->sender_idx = NO_DEVICE;
 	cras_iodev_list_set_device_enabled_callback(NULL, NULL, (void *)iodev);
 
@@ -191,20 +160,13 @@ static int close_record_dev(struct cras_iodev *iodev)
 static int configure_record_dev(struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct cras_iodev *edev;
 
 	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
 	clock_gettime(CLOCK_MONOTONIC_RAW, &loopdev->dev_start_time);
 	loopdev->read_frames = 0;
 	loopdev->started = 0;
 
-	edev = cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT);
-	if (edev) {
-		loopdev->sender_idx = edev->info.idx;
-		cras_iodev_list_register_loopback(
-			loopdev->loopback_type, loopdev->sender_idx,
-			sample_hook, sample_hook_start, iodev->info.idx);
-	}
+	update_first_output_to_loopback(loopdev);
 	cras_iodev_list_set_device_enabled_callback(
 		device_enabled_hook, device_disabled_hook, (void *)iodev);
 
@@ -215,16 +177,28 @@ static int get_record_buffer(struct cras_iodev *iodev,
 			     struct cras_audio_area **area, unsigned *frames)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
-	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
-	unsigned int avail_frames = buf_readable(sbuf) / frame_bytes;
+	struct timespec tstamp;
+	unsigned int avail_frames = frames_queued(iodev, &tstamp);
+	unsigned int requested = *frames;
+	uint64_t overruns = 0;
+	const uint8_t *buf;
+
+	/* Frames are read in place from the ring of the tap. */
+	loopdev->reading_tap = loopdev->started && loopdev->reader;
+	if (loopdev->reading_tap) {
+		buf = loopback_tap_reader_get(loopdev->reader, frames);
+		overruns = loopback_tap_reader_overruns(loopdev->reader);
+	} else {
+		*frames = MIN(avail_frames, *frames);
+		buf = loopdev->silence;
+	}
 
-	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_GET, *frames, avail_frames, 0);
+	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_GET, requested, avail_frames,
+	      overruns);
 
-	*frames = MIN(avail_frames, *frames);
 	iodev->area->frames = *frames;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
-					    buf_read_pointer(sbuf));
+					    (uint8_t *)buf);
 	*area = iodev->area;
 
 	return 0;
@@ -233,10 +207,9 @@ static int get_record_buffer(struct cras_iodev *iodev,
 static int put_record_buffer(struct cras_iodev *iodev, unsigned nframes)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
-	unsigned int frame_bytes = cras_get_format_bytes(iodev->format);
 
-	buf_increment_read(sbuf, (size_t)nframes * (size_t)frame_bytes);
+	if (loopdev->reading_tap)
+		loopback_tap_reader_put(loopdev->reader, nframes);
 	loopdev->read_frames += nframes;
 	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_PUT, nframes, 0, 0);
 	return 0;
@@ -245,9 +218,9 @@ static int put_record_buffer(struct cras_iodev *iodev, unsigned nframes)
 static int flush_record_buffer(struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
-	unsigned int queued_bytes = buf_queued(sbuf);
-	buf_increment_read(sbuf, queued_bytes);
+
+	if (loopdev->reader)
+		loopback_tap_reader_flush(loopdev->reader);
 	loopdev->read_frames = 0;
 	return 0;
 }
@@ -266,8 +239,10 @@ static struct cras_iodev *create_loopback_iodev(enum CRAS_LOOPBACK_TYPE type)
 	if (loopback_iodev == NULL)
 		return NULL;
 
-	loopback_iodev->sample_buffer = byte_buffer_create(1024 * 16 * 4);
-	if (loopback_iodev->sample_buffer == NULL) {
+	/* Loopback devices are 16 bit stereo. */
+	loopback_iodev->silence =
+		calloc(LOOPBACK_TAP_FRAMES, 2 * sizeof(int16_t));
+	if (loopback_iodev->silence == NULL) {
 		free(loopback_iodev);
 		return NULL;
 	}
@@ -349,14 +324,27 @@ struct cras_iodev *loopback_iodev_create(enum CRAS_LOOPBACK_TYPE type)
 	return iodev;
 }
 
+void loopback_iodev_set_target(struct cras_iodev *iodev,
+			       const struct loopback_target *target)
+{
+	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
+
+	loopdev->target = *target;
+	if (!loopdev->reader)
+		return;
+
+	/* Switch to the tap of the new target. */
+	detach_from_output(loopdev);
+	update_first_output_to_loopback(loopdev);
+}
+
 void loopback_iodev_destroy(struct cras_iodev *iodev)
 {
 	struct loopback_iodev *loopdev = (struct loopback_iodev *)iodev;
-	struct byte_buffer *sbuf = loopdev->sample_buffer;
 
 	cras_iodev_list_rm_input(iodev);
 	free(iodev->nodes);
 
-	byte_buffer_destroy(&sbuf);
+	free(loopdev->silence);
 	free(loopdev);
 }
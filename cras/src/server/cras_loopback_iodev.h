@@ -9,6 +9,7 @@
 #include "cras_types.h"
 
 struct cras_iodev;
+struct loopback_target;
 
 /* Initializes loopback iodevs.  loopback iodevs provide the ability to
  * capture exactly what is being output by the system.
@@ -18,4 +19,9 @@ struct cras_iodev *loopback_iodev_create(enum CRAS_LOOPBACK_TYPE type);
 /* Destroys loopback_iodevs created with loopback_iodev_create. */
 void loopback_iodev_destroy(struct cras_iodev *loopdev);
 
+/* Selects the output streams a post mix loopback iodev captures, takes
+ * effect right away if it is open. */
+void loopback_iodev_set_target(struct cras_iodev *loopdev,
+			       const struct loopback_target *target);
+
 #endif /* CRAS_LOOPBACK_IO_H_ */
@@ -0,0 +1,480 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <syslog.h>
+
+#include "audio_thread_log.h"
+#include "cras_audio_format.h"
+#include "cras_iodev_list.h"
+#include "cras_loopback_tap.h"
+#include "cras_mirror.h"
+#include "cras_mix.h"
+#include "cras_rstream.h"
+#include "cras_rt_mem.h"
+#include "utlist.h"
+
+/* A stream mixed into the tap of a target.
+ *    id - The stream.
+ *    pos - Frame of the ring the stream mixes at next.
+ */
+struct tap_stream {
+	cras_stream_id_t id;
+	uint64_t pos;
+};
+
+/* The ring shared by the readers of one output device.
+ *    type - Pre or post DSP audio of the device.
+ *    target - The streams kept.
+ *    dev_idx - Index of the output device.
+ *    started - True while the device is playing.
+ *    ring - LOOPBACK_TAP_FRAMES frames of the device format, allocated on
+ *        the first write.
+ *    mirrored - The ring is mapped twice in a row, so no span of it wraps.
+ *    frame_bytes - Bytes of a frame in ring.
+ *    write_frames - Frames written since the ring was allocated, the
+ *        position of the next write is this modulo the ring size.
+ *    mixed_frames - With a target, the frame up to which streams were
+ *        mixed into the ring, the frames after it are stale.
+ *    streams - With a target, the streams mixed into the ring.
+ *    num_streams - Number of streams.
+ *    readers - The readers, the tap lives as long as there is one.
+ */
+struct loopback_tap {
+	enum CRAS_LOOPBACK_TYPE type;
+	struct loopback_target target;
+	unsigned int dev_idx;
+	bool started;
+	uint8_t *ring;
+	bool mirrored;
+	unsigned int frame_bytes;
+	uint64_t write_frames;
+	uint64_t mixed_frames;
+	struct tap_stream streams[LOOPBACK_TAP_MAX_STREAMS];
+	unsigned int num_streams;
+	struct loopback_tap_reader *readers;
+	struct loopback_tap *prev, *next;
+};
+
+/* A reader of a tap.
+ *    tap - The tap read.
+ *    read_frames - Frames read, compared with write_frames of the tap.
+ *    overrun_frames - Frames overwritten before this reader read them.
+ *    start - Called when the output device starts or stops.
+ *    cb_data - Passed to start.
+ */
+struct loopback_tap_reader {
+	struct loopback_tap *tap;
+	uint64_t read_frames;
+	uint64_t overrun_frames;
+	loopback_hook_control_t start;
+	void *cb_data;
+	struct loopback_tap_reader *prev, *next;
+};
+
+static struct loopback_tap *taps;
+/* Taps of targets, for the audio thread to skip looking for them. */
+static unsigned int num_target_taps;
+
+/* Returns the frames of the ring contiguous from frame idx on. */
+static unsigned int ring_span(const struct loopback_tap *tap, unsigned int idx)
+{
+	return tap->mirrored ? LOOPBACK_TAP_FRAMES : LOOPBACK_TAP_FRAMES - idx;
+}
+
+static void tap_free_ring(struct loopback_tap *tap)
+{
+	size_t size = (size_t)LOOPBACK_TAP_FRAMES * tap->frame_bytes;
+
+	cras_rt_mem_remove(tap->ring);
+	if (tap->mirrored)
+		cras_mirror_unmap(tap->ring, size, 1);
+	else
+		free(tap->ring);
+	tap->ring = NULL;
+	tap->mirrored = false;
+}
+
+/* Allocates the ring for frames of fmt, readers start over when the format
+ * of the device changes. The ring is mirrored when it can be, so the mixes
+ * and copies into it and the reads out of it aren't split at its end. */
+static int tap_alloc_ring(struct loopback_tap *tap,
+			  const struct cras_audio_format *fmt)
+{
+	struct loopback_tap_reader *reader;
+	unsigned int frame_bytes = cras_get_format_bytes(fmt);
+	size_t size;
+
+	if (frame_bytes == tap->frame_bytes)
+		return 0;
+
+	tap_free_ring(tap);
+	size = (size_t)LOOPBACK_TAP_FRAMES * frame_bytes;
+	if (size == cras_mirror_size(size))
+		tap->ring = (uint8_t *)cras_mirror_map(size, 1);
+	tap->mirrored = tap->ring != NULL;
+	if (!tap->ring)
+		tap->ring = malloc(size);
+	if (!tap->ring) {
+		syslog(LOG_ERR, "Failed to allocate loopback ring");
+		tap->frame_bytes = 0;
+		return -ENOMEM;
+	}
+	cras_rt_mem_add(tap->ring, tap->mirrored ? 2 * size : size);
+	tap->frame_bytes = frame_bytes;
+	tap->write_frames = 0;
+	tap->mixed_frames = 0;
+	tap->num_streams = 0;
+	DL_FOREACH (tap->readers, reader)
+		reader->read_frames = 0;
+	return 0;
+}
+
+/* Mixes nframes of src into the ring from frame pos on, overwriting what
+ * is there unless add is set. */
+static void ring_mix(struct loopback_tap *tap, uint64_t pos, uint8_t *src,
+		     unsigned int nframes, const struct cras_audio_format *fmt,
+		     unsigned int add, int mute, float mix_vol)
+{
+	unsigned int idx, count;
+
+	while (nframes) {
+		idx = pos % LOOPBACK_TAP_FRAMES;
+		count = MIN(nframes, ring_span(tap, idx));
+		cras_mix_add(fmt->format,
+			     tap->ring + (size_t)idx * tap->frame_bytes, src,
+			     count * fmt->num_channels, add, mute, mix_vol);
+		src += (size_t)count * tap->frame_bytes;
+		pos += count;
+		nframes -= count;
+	}
+}
+
+/* Zeros nframes of the ring from frame pos on. */
+static void ring_zero(struct loopback_tap *tap, uint64_t pos,
+		      unsigned int nframes)
+{
+	unsigned int idx, count;
+
+	while (nframes) {
+		idx = pos % LOOPBACK_TAP_FRAMES;
+		count = MIN(nframes, ring_span(tap, idx));
+		memset(tap->ring + (size_t)idx * tap->frame_bytes, 0,
+		       (size_t)count * tap->frame_bytes);
+		pos += count;
+		nframes -= count;
+	}
+}
+
+static bool target_keeps(const struct loopback_target *target,
+			 cras_stream_id_t stream_id)
+{
+	bool match = target->stream_id ?
+			     stream_id == target->stream_id :
+			     cras_valid_stream_id(stream_id, target->client_id);
+
+	return target->mode == LOOPBACK_TARGET_INCLUDE ? match : !match;
+}
+
+bool loopback_tap_keeps_stream(unsigned int dev_idx,
+			       const struct cras_rstream *stream)
+{
+	struct loopback_tap *tap;
+
+	if (!num_target_taps)
+		return false;
+	DL_FOREACH (taps, tap) {
+		if (tap->target.mode != LOOPBACK_TARGET_ALL &&
+		    tap->dev_idx == dev_idx &&
+		    target_keeps(&tap->target, stream->stream_id))
+			return true;
+	}
+	return false;
+}
+
+/* Called for the audio of the output device, copies it to the ring once
+ * for all the readers. */
+static int tap_write(const uint8_t *frames, unsigned int nframes,
+		     const struct cras_audio_format *fmt, void *cb_data)
+{
+	struct loopback_tap *tap = (struct loopback_tap *)cb_data;
+	unsigned int frame_bytes = cras_get_format_bytes(fmt);
+	unsigned int received = nframes, pos, count;
+
+	if (tap_alloc_ring(tap, fmt))
+		return 0;
+
+	/* Only the last ring full of a longer write can be read. */
+	if (nframes > LOOPBACK_TAP_FRAMES) {
+		count = nframes - LOOPBACK_TAP_FRAMES;
+		frames += (size_t)count * frame_bytes;
+		tap->write_frames += count;
+		nframes = LOOPBACK_TAP_FRAMES;
+	}
+
+	pos = tap->write_frames % LOOPBACK_TAP_FRAMES;
+	count = MIN(nframes, ring_span(tap, pos));
+	memcpy(tap->ring + (size_t)pos * frame_bytes, frames,
+	       (size_t)count * frame_bytes);
+	memcpy(tap->ring, frames + (size_t)count * frame_bytes,
+	       (size_t)(nframes - count) * frame_bytes);
+	tap->write_frames += nframes;
+
+	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK, received, nframes, 0);
+
+	return nframes;
+}
+
+/* Called for the audio of the output device with a target. The streams
+ * kept were mixed into the ring as they were rendered, the frames the
+ * device plays now are made readable. */
+static int tap_commit(const uint8_t *frames, unsigned int nframes,
+		      const struct cras_audio_format *fmt, void *cb_data)
+{
+	struct loopback_tap *tap = (struct loopback_tap *)cb_data;
+	uint64_t end;
+	unsigned int i;
+
+	if (tap_alloc_ring(tap, fmt))
+		return 0;
+
+	nframes = MIN(nframes, LOOPBACK_TAP_FRAMES);
+	end = tap->write_frames + nframes;
+
+	/* Silence where no stream kept was mixed. */
+	if (tap->mixed_frames < end) {
+		ring_zero(tap, MAX(tap->mixed_frames, tap->write_frames),
+			  end - MAX(tap->mixed_frames, tap->write_frames));
+		tap->mixed_frames = end;
+	}
+
+	/* Streams that didn't keep up with the device are dropped, they
+	 * join again at the next frame to play when they are mixed. */
+	for (i = 0; i < tap->num_streams;) {
+		if (tap->streams[i].pos < end)
+			tap->streams[i] = tap->streams[--tap->num_streams];
+		else
+			i++;
+	}
+
+	tap->write_frames = end;
+
+	ATLOG(atlog, AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK, nframes, nframes,
+	      tap->num_streams);
+
+	return nframes;
+}
+
+void loopback_tap_mix_stream(unsigned int dev_idx,
+			     const struct cras_rstream *stream,
+			     const struct cras_audio_format *fmt,
+			     uint8_t *frames, unsigned int nframes, int mute,
+			     float mix_vol)
+{
+	struct loopback_tap *tap;
+	struct tap_stream *ts;
+	cras_stream_id_t stream_id;
+	unsigned int i, n, count;
+
+	if (!num_target_taps)
+		return;
+	stream_id = stream->stream_id;
+
+	DL_FOREACH (taps, tap) {
+		if (tap->target.mode == LOOPBACK_TARGET_ALL ||
+		    tap->dev_idx != dev_idx ||
+		    !target_keeps(&tap->target, stream_id))
+			continue;
+		if (tap_alloc_ring(tap, fmt))
+			continue;
+
+		for (i = 0; i < tap->num_streams; i++)
+			if (tap->streams[i].id == stream_id)
+				break;
+		if (i == tap->num_streams) {
+			if (i == LOOPBACK_TAP_MAX_STREAMS)
+				continue;
+			tap->streams[i].id = stream_id;
+			tap->streams[i].pos = tap->write_frames;
+			tap->num_streams++;
+		}
+		ts = &tap->streams[i];
+
+		/* The ring holds what readers haven't been given yet. */
+		n = MIN(nframes,
+			tap->write_frames + LOOPBACK_TAP_FRAMES - ts->pos);
+
+		/* Added to the streams mixed before, written over stale
+		 * frames. */
+		count = MIN(n, tap->mixed_frames > ts->pos ?
+				       tap->mixed_frames - ts->pos :
+				       0);
+		ring_mix(tap, ts->pos, frames, count, fmt, 1, mute, mix_vol);
+		ring_mix(tap, ts->pos + count,
+			 frames + (size_t)count * tap->frame_bytes,
+			 n - count, fmt, 0, mute, mix_vol);
+		ts->pos += n;
+		tap->mixed_frames = MAX(tap->mixed_frames, ts->pos);
+	}
+}
+
+/* Readers start from what the device plays after it starts. */
+static int tap_control(bool start, void *cb_data)
+{
+	struct loopback_tap *tap = (struct loopback_tap *)cb_data;
+	struct loopback_tap_reader *reader;
+
+	tap->started = start;
+	DL_FOREACH (tap->readers, reader) {
+		if (start)
+			reader->read_frames = tap->write_frames;
+		reader->start(start, reader->cb_data);
+	}
+	return 0;
+}
+
+static bool same_target(const struct loopback_target *a,
+			const struct loopback_target *b)
+{
+	if (a->mode != b->mode)
+		return false;
+	return a->mode == LOOPBACK_TARGET_ALL ||
+	       (a->client_id == b->client_id && a->stream_id == b->stream_id);
+}
+
+struct loopback_tap_reader *
+loopback_tap_attach(enum CRAS_LOOPBACK_TYPE type,
+		    const struct loopback_target *target,
+		    unsigned int output_dev_idx,
+		    loopback_hook_control_t start, void *cb_data)
+{
+	static const struct loopback_target whole_mix = {
+		.mode = LOOPBACK_TARGET_ALL,
+	};
+	struct loopback_tap *tap;
+	struct loopback_tap_reader *reader;
+
+	if (!target)
+		target = &whole_mix;
+	if (target->mode != LOOPBACK_TARGET_ALL &&
+	    type != LOOPBACK_POST_MIX_PRE_DSP)
+		return NULL;
+
+	reader = calloc(1, sizeof(*reader));
+	if (!reader)
+		return NULL;
+	reader->start = start;
+	reader->cb_data = cb_data;
+
+	DL_FOREACH (taps, tap) {
+		if (tap->type == type && tap->dev_idx == output_dev_idx &&
+		    same_target(&tap->target, target))
+			break;
+	}
+	if (tap) {
+		reader->tap = tap;
+		reader->read_frames = tap->write_frames;
+		DL_APPEND(tap->readers, reader);
+		if (tap->started)
+			start(true, cb_data);
+		return reader;
+	}
+
+	tap = calloc(1, sizeof(*tap));
+	if (!tap) {
+		free(reader);
+		return NULL;
+	}
+	tap->type = type;
+	tap->target = *target;
+	tap->dev_idx = output_dev_idx;
+	reader->tap = tap;
+	DL_APPEND(tap->readers, reader);
+	DL_APPEND(taps, tap);
+	if (target->mode != LOOPBACK_TARGET_ALL)
+		num_target_taps++;
+
+	/* Starts the reader if the device is playing already. */
+	cras_iodev_list_register_loopback(
+		type, output_dev_idx,
+		target->mode == LOOPBACK_TARGET_ALL ? tap_write : tap_commit,
+		tap_control, tap);
+	return reader;
+}
+
+void loopback_tap_detach(struct loopback_tap_reader *reader)
+{
+	struct loopback_tap *tap;
+
+	if (!reader)
+		return;
+
+	tap = reader->tap;
+	DL_DELETE(tap->readers, reader);
+	free(reader);
+	if (tap->readers)
+		return;
+
+	cras_iodev_list_unregister_loopback(tap->type, tap->dev_idx, tap);
+	DL_DELETE(taps, tap);
+	if (tap->target.mode != LOOPBACK_TARGET_ALL)
+		num_target_taps--;
+	tap_free_ring(tap);
+	free(tap);
+}
+
+unsigned int
+loopback_tap_reader_queued(const struct loopback_tap_reader *reader)
+{
+	const struct loopback_tap *tap = reader->tap;
+
+	if (!tap->ring)
+		return 0;
+	return MIN(tap->write_frames - reader->read_frames,
+		   LOOPBACK_TAP_FRAMES);
+}
+
+const uint8_t *loopback_tap_reader_get(struct loopback_tap_reader *reader,
+				       unsigned int *frames)
+{
+	const struct loopback_tap *tap = reader->tap;
+	unsigned int pos;
+
+	if (!tap->ring) {
+		*frames = 0;
+		return NULL;
+	}
+
+	if (tap->write_frames - reader->read_frames > LOOPBACK_TAP_FRAMES) {
+		uint64_t oldest = tap->write_frames - LOOPBACK_TAP_FRAMES;
+
+		reader->overrun_frames += oldest - reader->read_frames;
+		reader->read_frames = oldest;
+	}
+
+	pos = reader->read_frames % LOOPBACK_TAP_FRAMES;
+	*frames = MIN(*frames, tap->write_frames - reader->read_frames);
+	*frames = MIN(*frames, ring_span(tap, pos));
+	return tap->ring + (size_t)pos * tap->frame_bytes;
+}
+
+void loopback_tap_reader_put(struct loopback_tap_reader *reader,
+			     unsigned int frames)
+{
+	reader->read_frames += MIN(frames, loopback_tap_reader_queued(reader));
+}
+
+void loopback_tap_reader_flush(struct loopback_tap_reader *reader)
+{
+	reader->read_frames = reader->tap->write_frames;
+}
+
+uint64_t loopback_tap_reader_overruns(const struct loopback_tap_reader *reader)
+{
+	return reader->overrun_frames;
+}
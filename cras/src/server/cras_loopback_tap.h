@@ -0,0 +1,114 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * A loopback tap keeps the audio an output device plays, post mix or post
+ * DSP, in one ring shared by every loopback reader of that device. The
+ * output device writes each period into the ring once, and readers consume
+ * it from their own read positions. A reader that falls more than a ring
+ * behind loses the oldest frames, which are counted as its overruns, the
+ * output device and the other readers are not held back by it.
+ *
+ * A tap can also keep only some of the streams played, mixed from the
+ * stream samples as they are rendered for the device, to loop back the
+ * audio of one client or all but one client.
+ */
+
+#ifndef CRAS_LOOPBACK_TAP_H_
+#define CRAS_LOOPBACK_TAP_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cras_iodev.h"
+#include "cras_types.h"
+
+/* Frames the ring of a tap holds. */
+#define LOOPBACK_TAP_FRAMES 16384
+/* Streams a tap of a target mixes at once. */
+#define LOOPBACK_TAP_MAX_STREAMS 8
+
+struct cras_rstream;
+struct loopback_tap_reader;
+
+/* Selects the output streams a tap keeps.
+ *    mode - LOOPBACK_TARGET_ALL keeps the whole mix of the device.
+ *    client_id - The client whose streams are included or excluded.
+ *    stream_id - Only this stream of the client when non-zero.
+ */
+struct loopback_target {
+	enum CRAS_LOOPBACK_TARGET_MODE mode;
+	uint32_t client_id;
+	cras_stream_id_t stream_id;
+};
+
+/* Attaches a reader to the tap of an output device, creating the tap and
+ * registering it with the device for the first reader.
+ * Args:
+ *    type - Pre or post DSP audio of the device.
+ *    target - The streams kept, NULL for the whole mix. Only post mix taps
+ *        can select streams.
+ *    output_dev_idx - Index of the output device.
+ *    start - Called with true when the device starts playing and with false
+ *        when it stops, and right away if it is playing already.
+ *    cb_data - Passed to start.
+ * Returns:
+ *    The reader, or NULL on failure.
+ */
+struct loopback_tap_reader *
+loopback_tap_attach(enum CRAS_LOOPBACK_TYPE type,
+		    const struct loopback_target *target,
+		    unsigned int output_dev_idx,
+		    loopback_hook_control_t start, void *cb_data);
+
+/* Mixes frames a stream renders for an output device into the taps of
+ * targets that keep the stream. Called from the audio thread as the
+ * stream is mixed for the device.
+ * Args:
+ *    dev_idx - Index of the output device.
+ *    stream - The stream rendered.
+ *    fmt - Format of the device.
+ *    frames - Samples of the stream converted to the device format.
+ *    nframes - Number of frames.
+ *    mute - True if the stream is muted.
+ *    mix_vol - Volume scaler of the stream.
+ */
+void loopback_tap_mix_stream(unsigned int dev_idx,
+			     const struct cras_rstream *stream,
+			     const struct cras_audio_format *fmt,
+			     uint8_t *frames, unsigned int nframes, int mute,
+			     float mix_vol);
+
+/* Returns true if a tap of a target on output device dev_idx keeps stream,
+ * which then has to be passed to loopback_tap_mix_stream() on its own. */
+bool loopback_tap_keeps_stream(unsigned int dev_idx,
+			       const struct cras_rstream *stream);
+
+/* Detaches reader, the tap is unregistered and freed with its last reader. */
+void loopback_tap_detach(struct loopback_tap_reader *reader);
+
+/* Gets the frames reader has left to read, at most the ring size. */
+unsigned int
+loopback_tap_reader_queued(const struct loopback_tap_reader *reader);
+
+/* Gets a pointer to the oldest frames reader has left to read, skipping
+ * those already overwritten.
+ * Args:
+ *    reader - The reader.
+ *    frames - Frames wanted, set to those readable from the returned
+ *        pointer before the ring wraps.
+ */
+const uint8_t *loopback_tap_reader_get(struct loopback_tap_reader *reader,
+				       unsigned int *frames);
+
+/* Marks frames as read by reader. */
+void loopback_tap_reader_put(struct loopback_tap_reader *reader,
+			     unsigned int frames);
+
+/* Drops all the frames reader has left to read. */
+void loopback_tap_reader_flush(struct loopback_tap_reader *reader);
+
+/* Gets the frames reader lost to being overwritten before it read them. */
+uint64_t loopback_tap_reader_overruns(const struct loopback_tap_reader *reader);
+
+#endif /* CRAS_LOOPBACK_TAP_H_ */
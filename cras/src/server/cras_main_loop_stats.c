@@ -0,0 +1,130 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <string.h>
+
+#include "cras_latency_hist.h"
+#include "cras_main_loop_stats.h"
+
+/* Only a few fds belong to a named handler: the udev monitor, the main
+ * message pipe and the D-Bus watches. */
+#define MAX_TAGGED_FDS 16
+
+struct fd_tag {
+	int fd;
+	enum CRAS_MAIN_HANDLER handler;
+};
+
+static struct {
+	struct fd_tag tags[MAX_TAGGED_FDS];
+	unsigned int num_tags;
+	struct cras_latency_hist handler_hist[CRAS_NUM_MAIN_HANDLERS];
+	struct cras_latency_hist loop_hist;
+	uint32_t num_stalls;
+	/* The pass being timed. */
+	struct timespec pass_start;
+	enum CRAS_MAIN_HANDLER longest_handler;
+	uint32_t longest_usec;
+} stats;
+
+static uint32_t elapsed_usec(const struct timespec *start,
+			     const struct timespec *end)
+{
+	int64_t nsec = (int64_t)(end->tv_sec - start->tv_sec) * 1000000000LL +
+		       end->tv_nsec - start->tv_nsec;
+
+	if (nsec < 0)
+		return 0;
+	if (nsec > (int64_t)UINT32_MAX * 1000)
+		return UINT32_MAX;
+	return nsec / 1000;
+}
+
+static struct fd_tag *find_tag(int fd)
+{
+	unsigned int i;
+
+	for (i = 0; i < stats.num_tags; i++)
+		if (stats.tags[i].fd == fd)
+			return &stats.tags[i];
+	return NULL;
+}
+
+void cras_main_loop_stats_tag_fd(int fd, enum CRAS_MAIN_HANDLER handler)
+{
+	struct fd_tag *tag = find_tag(fd);
+
+	if (!tag) {
+		if (stats.num_tags == MAX_TAGGED_FDS)
+			return;
+		tag = &stats.tags[stats.num_tags++];
+		tag->fd = fd;
+	}
+	tag->handler = handler;
+}
+
+void cras_main_loop_stats_untag_fd(int fd)
+{
+	struct fd_tag *tag = find_tag(fd);
+
+	if (tag)
+		*tag = stats.tags[--stats.num_tags];
+}
+
+enum CRAS_MAIN_HANDLER cras_main_loop_stats_fd_handler(int fd)
+{
+	struct fd_tag *tag = find_tag(fd);
+
+	return tag ? tag->handler : CRAS_MAIN_HANDLER_FD;
+}
+
+void cras_main_loop_stats_pass_begin(const struct timespec *now)
+{
+	stats.pass_start = *now;
+	stats.longest_handler = CRAS_MAIN_HANDLER_FD;
+	stats.longest_usec = 0;
+}
+
+void cras_main_loop_stats_add(enum CRAS_MAIN_HANDLER handler,
+			      const struct timespec *start,
+			      const struct timespec *end)
+{
+	uint32_t usec = elapsed_usec(start, end);
+
+	cras_latency_hist_add_usec(&stats.handler_hist[handler], usec);
+	if (usec >= stats.longest_usec) {
+		stats.longest_handler = handler;
+		stats.longest_usec = usec;
+	}
+}
+
+int cras_main_loop_stats_pass_end(const struct timespec *now,
+				  struct cras_main_loop_stall *stall)
+{
+	uint32_t usec = elapsed_usec(&stats.pass_start, now);
+
+	cras_latency_hist_add_usec(&stats.loop_hist, usec);
+	if (usec <= CRAS_MAIN_LOOP_STALL_USEC)
+		return 0;
+
+	stats.num_stalls++;
+	stall->handler = stats.longest_handler;
+	stall->handler_usec = stats.longest_usec;
+	stall->pass_usec = usec;
+	return 1;
+}
+
+void cras_main_loop_stats_fill(struct main_thread_debug_info *info)
+{
+	memcpy(info->handler_hist, stats.handler_hist,
+	       sizeof(stats.handler_hist));
+	memcpy(&info->loop_hist, &stats.loop_hist, sizeof(stats.loop_hist));
+	info->num_stalls = stats.num_stalls;
+}
+
+void cras_main_loop_stats_reset()
+{
+	memset(&stats, 0, sizeof(stats));
+}
@@ -0,0 +1,67 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Times what the main loop dispatches, per handler, and detects passes of
+ * the loop that ran long enough to delay everything queued behind them.
+ * Slow control operations usually trace back to one handler blocking the
+ * loop, the histograms and the stall events tell which one.
+ */
+
+#ifndef CRAS_MAIN_LOOP_STATS_H_
+#define CRAS_MAIN_LOOP_STATS_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include "cras_types.h"
+
+/* A main loop pass longer than this is a stall. */
+#define CRAS_MAIN_LOOP_STALL_USEC 100000
+
+/* What made a pass stall.
+ *    handler - The handler that ran the longest in the pass.
+ *    handler_usec - How long that handler ran.
+ *    pass_usec - How long the whole pass ran.
+ */
+struct cras_main_loop_stall {
+	enum CRAS_MAIN_HANDLER handler;
+	uint32_t handler_usec;
+	uint32_t pass_usec;
+};
+
+/* Marks fd as belonging to handler. Call before adding the fd to the main
+ * loop, fds not marked count as CRAS_MAIN_HANDLER_FD. */
+void cras_main_loop_stats_tag_fd(int fd, enum CRAS_MAIN_HANDLER handler);
+
+/* Forgets the handler of fd, called when it is removed from the loop. */
+void cras_main_loop_stats_untag_fd(int fd);
+
+/* Returns the handler fd was marked with. */
+enum CRAS_MAIN_HANDLER cras_main_loop_stats_fd_handler(int fd);
+
+/* Starts timing a main loop pass at now, after the loop woke up. */
+void cras_main_loop_stats_pass_begin(const struct timespec *now);
+
+/* Records that handler ran from start to end in the current pass. */
+void cras_main_loop_stats_add(enum CRAS_MAIN_HANDLER handler,
+			      const struct timespec *start,
+			      const struct timespec *end);
+
+/* Ends the current pass at now.
+ * Args:
+ *    now - When the pass ended.
+ *    stall - Filled with the culprit if the pass stalled.
+ * Returns:
+ *    1 if the pass ran longer than CRAS_MAIN_LOOP_STALL_USEC, 0 otherwise.
+ */
+int cras_main_loop_stats_pass_end(const struct timespec *now,
+				  struct cras_main_loop_stall *stall);
+
+/* Copies the histograms and stall count to info, leaving its log alone. */
+void cras_main_loop_stats_fill(struct main_thread_debug_info *info);
+
+/* Clears the histograms, stall count and fd marks. */
+void cras_main_loop_stats_reset();
+
+#endif /* CRAS_MAIN_LOOP_STATS_H_ */
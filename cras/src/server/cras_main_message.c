@@ -8,6 +8,7 @@
 #include <stdlib.h>
 #include <syslog.h>
 
+#include "cras_main_loop_stats.h"
 #include "cras_main_message.h"
 #include "cras_system_state.h"
 #include "cras_util.h"
@@ -79,7 +80,7 @@ static int read_main_message(int msg_fd, uint8_t *buf, size_t max_len)
 
 static void handle_main_messages(void *arg, int revents)
 {
-	uint8_t buf[256];
+	uint8_t buf[CRAS_MAIN_MESSAGE_MAX_LENGTH];
 	int rc;
 	struct cras_main_msg_callback *main_msg_cb;
 	struct cras_main_message *msg = (struct cras_main_message *)buf;
@@ -112,6 +113,7 @@ void cras_main_message_init()
 	cras_make_fd_nonblocking(main_msg_fds[0]);
 	cras_make_fd_nonblocking(main_msg_fds[1]);
 
+	cras_main_loop_stats_tag_fd(main_msg_fds[0], CRAS_MAIN_HANDLER_MAIN_MSG);
 	cras_system_add_select_fd(main_msg_fds[0], handle_main_messages, NULL,
 				  POLLIN);
 }
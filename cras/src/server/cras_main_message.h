@@ -10,6 +10,10 @@
 
 #include "utlist.h"
 
+/* Longest message the main thread reads. Keep it under PIPE_BUF so writes of
+ * a whole message stay atomic. */
+#define CRAS_MAIN_MESSAGE_MAX_LENGTH 1024
+
 /* The types of message main thread can handle. */
 enum CRAS_MAIN_MESSAGE_TYPE {
 	/* Audio thread -> main thread */
@@ -20,6 +24,7 @@ enum CRAS_MAIN_MESSAGE_TYPE {
 	CRAS_MAIN_MONITOR_DEVICE,
 	CRAS_MAIN_HOTWORD_TRIGGERED,
 	CRAS_MAIN_NON_EMPTY_AUDIO_STATE,
+	CRAS_MAIN_STREAM_DRAINED,
 };
 
 /* Structure of the header of the message handled by main thread.
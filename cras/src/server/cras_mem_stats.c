@@ -0,0 +1,73 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cras_mem_stats.h"
+
+/* The counters are kept aligned here for the atomics, the packed copy in the
+ * server state is written after each update. Of two concurrent updates the
+ * copy may keep the older value until the next update of that subsystem. */
+static uint64_t cur_bytes[CRAS_NUM_MEM_SUBSYS];
+static uint64_t max_bytes[CRAS_NUM_MEM_SUBSYS];
+static struct cras_mem_usage *shared_usage;
+
+static void publish(enum CRAS_MEM_SUBSYS subsys)
+{
+	struct cras_mem_usage *shared =
+		__atomic_load_n(&shared_usage, __ATOMIC_ACQUIRE);
+
+	if (!shared)
+		return;
+	shared->bytes[subsys] = __atomic_load_n(&cur_bytes[subsys],
+						__ATOMIC_RELAXED);
+	shared->peak_bytes[subsys] = __atomic_load_n(&max_bytes[subsys],
+						     __ATOMIC_RELAXED);
+}
+
+void cras_mem_stats_add(enum CRAS_MEM_SUBSYS subsys, size_t bytes)
+{
+	uint64_t now, peak;
+
+	if (!bytes)
+		return;
+	now = __atomic_add_fetch(&cur_bytes[subsys], bytes, __ATOMIC_RELAXED);
+	peak = __atomic_load_n(&max_bytes[subsys], __ATOMIC_RELAXED);
+	while (now > peak &&
+	       !__atomic_compare_exchange_n(&max_bytes[subsys], &peak, now,
+					    true, __ATOMIC_RELAXED,
+					    __ATOMIC_RELAXED))
+		;
+	publish(subsys);
+}
+
+void cras_mem_stats_sub(enum CRAS_MEM_SUBSYS subsys, size_t bytes)
+{
+	if (!bytes)
+		return;
+	__atomic_sub_fetch(&cur_bytes[subsys], bytes, __ATOMIC_RELAXED);
+	publish(subsys);
+}
+
+void cras_mem_stats_share(struct cras_mem_usage *shared)
+{
+	unsigned int i;
+
+	__atomic_store_n(&shared_usage, shared, __ATOMIC_RELEASE);
+	for (i = 0; i < CRAS_NUM_MEM_SUBSYS; i++)
+		publish(i);
+}
+
+void cras_mem_stats_get(struct cras_mem_usage *usage)
+{
+	unsigned int i;
+
+	for (i = 0; i < CRAS_NUM_MEM_SUBSYS; i++) {
+		usage->bytes[i] = __atomic_load_n(&cur_bytes[i], __ATOMIC_RELAXED);
+		usage->peak_bytes[i] =
+			__atomic_load_n(&max_bytes[i], __ATOMIC_RELAXED);
+	}
+}
@@ -0,0 +1,31 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Counts the bytes allocated for audio by each subsystem of the server, so
+ * low memory boards can budget audio memory and long running sessions can
+ * be checked for leaks. The counters are updated from the main and audio
+ * threads and published in the server state for clients to read.
+ */
+
+#ifndef CRAS_MEM_STATS_H_
+#define CRAS_MEM_STATS_H_
+
+#include <stddef.h>
+
+#include "cras_types.h"
+
+/* Counts bytes allocated by subsys. */
+void cras_mem_stats_add(enum CRAS_MEM_SUBSYS subsys, size_t bytes);
+
+/* Counts bytes freed by subsys. */
+void cras_mem_stats_sub(enum CRAS_MEM_SUBSYS subsys, size_t bytes);
+
+/* Publishes the counters in shared from now on, called once the server
+ * state is mapped and with NULL before it is unmapped. */
+void cras_mem_stats_share(struct cras_mem_usage *shared);
+
+/* Copies the current counters to usage. */
+void cras_mem_stats_get(struct cras_mem_usage *usage);
+
+#endif /* CRAS_MEM_STATS_H_ */
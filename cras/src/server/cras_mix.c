@@ -3,7 +3,10 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
 
 #include "cras_system_state.h"
 #include "cras_mix.h"
@@ -29,6 +32,10 @@ static const struct cras_mix_ops *get_mixer_ops(unsigned int cpu_flags)
 	if (cpu_flags & CPU_X86_SSE4_2)
 		return &mixer_ops_sse42;
 #endif
+#if defined HAVE_NEON
+	if (cpu_flags & CPU_ARM_NEON)
+		return &mixer_ops_neon;
+#endif
 
 	/* default C implementation */
 	return &mixer_ops;
@@ -51,6 +58,13 @@ void cras_scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 				    increment, target, channel);
 }
 
+void cras_scale_buffer_gains(snd_pcm_format_t fmt, uint8_t *buff,
+			     unsigned int frame, const float *gains,
+			     int channel)
+{
+	ops->scale_buffer_gains(fmt, buff, frame * channel, gains, channel);
+}
+
 void cras_scale_buffer(snd_pcm_format_t fmt, uint8_t *buff, unsigned int count,
 		       float scaler)
 {
@@ -64,6 +78,11 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 	ops->add(fmt, dst, src, count, index, mute, mix_vol);
 }
 
+cras_mix_add_func cras_mix_get_add(snd_pcm_format_t fmt)
+{
+	return ops->get_add(fmt);
+}
+
 void cras_mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 			       unsigned int count, unsigned int dst_stride,
 			       unsigned int src_stride, float scaler)
@@ -72,6 +91,195 @@ void cras_mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 			      scaler);
 }
 
+/* Reads sample i of an interleaved buffer as a float in [-1.0, 1.0], with
+ * the same scaling as dsp_util_deinterleave. */
+static inline float planar_sample(snd_pcm_format_t fmt, const uint8_t *src,
+				  unsigned int i)
+{
+	int32_t s;
+
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return ((const int16_t *)src)[i] / 32768.0f;
+	case SND_PCM_FORMAT_S24_LE:
+		return (((const int32_t *)src)[i] << 8) / 2147483648.0f;
+	case SND_PCM_FORMAT_S24_3LE:
+		s = 0;
+		memcpy((uint8_t *)&s + 1, src + 3 * i, 3);
+		return s / 2147483648.0f;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return ((const float *)src)[i];
+	default:
+		return ((const int32_t *)src)[i] / 2147483648.0f;
+	}
+}
+
+/* Called with a constant fmt so the sample conversion is resolved outside of
+ * the loops. */
+static inline __attribute__((always_inline)) void
+add_planar(snd_pcm_format_t fmt, float *const *dst, const uint8_t *src,
+	   unsigned int num_channels, unsigned int frames, unsigned int index,
+	   float mix_vol)
+{
+	unsigned int ch, i;
+	float *out;
+
+	for (ch = 0; ch < num_channels; ch++) {
+		out = dst[ch];
+		if (index == 0)
+			for (i = 0; i < frames; i++)
+				out[i] = planar_sample(fmt, src,
+						       i * num_channels + ch) *
+					 mix_vol;
+		else
+			for (i = 0; i < frames; i++)
+				out[i] += planar_sample(fmt, src,
+							i * num_channels + ch) *
+					  mix_vol;
+	}
+}
+
+/* Runs add_planar with the common channel counts as constants, so the
+ * stride through src is known and the loops over the frames vectorize. */
+static inline __attribute__((always_inline)) void
+add_planar_channels(snd_pcm_format_t fmt, float *const *dst,
+		    const uint8_t *src, unsigned int num_channels,
+		    unsigned int frames, unsigned int index, float mix_vol)
+{
+	switch (num_channels) {
+	case 1:
+		add_planar(fmt, dst, src, 1, frames, index, mix_vol);
+		break;
+	case 2:
+		add_planar(fmt, dst, src, 2, frames, index, mix_vol);
+		break;
+	case 4:
+		add_planar(fmt, dst, src, 4, frames, index, mix_vol);
+		break;
+	case 6:
+		add_planar(fmt, dst, src, 6, frames, index, mix_vol);
+		break;
+	case 8:
+		add_planar(fmt, dst, src, 8, frames, index, mix_vol);
+		break;
+	default:
+		add_planar(fmt, dst, src, num_channels, frames, index,
+			   mix_vol);
+		break;
+	}
+}
+
+int cras_mix_add_planar(snd_pcm_format_t fmt, float *const *dst,
+			const uint8_t *src, unsigned int num_channels,
+			unsigned int frames, unsigned int index, int mute,
+			float mix_vol)
+{
+	unsigned int ch;
+
+	if (mute) {
+		if (index == 0)
+			for (ch = 0; ch < num_channels; ch++)
+				memset(dst[ch], 0, frames * sizeof(float));
+		return 0;
+	}
+
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		add_planar_channels(SND_PCM_FORMAT_S16_LE, dst, src,
+				    num_channels, frames, index, mix_vol);
+		break;
+	case SND_PCM_FORMAT_S24_LE:
+		add_planar_channels(SND_PCM_FORMAT_S24_LE, dst, src,
+				    num_channels, frames, index, mix_vol);
+		break;
+	case SND_PCM_FORMAT_S24_3LE:
+		add_planar_channels(SND_PCM_FORMAT_S24_3LE, dst, src,
+				    num_channels, frames, index, mix_vol);
+		break;
+	case SND_PCM_FORMAT_S32_LE:
+		add_planar_channels(SND_PCM_FORMAT_S32_LE, dst, src,
+				    num_channels, frames, index, mix_vol);
+		break;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		add_planar_channels(SND_PCM_FORMAT_FLOAT_LE, dst, src,
+				    num_channels, frames, index, mix_vol);
+		break;
+	default:
+		return -EINVAL;
+	}
+	return 0;
+}
+
+enum CRAS_MIX_REMIX cras_mix_remix_kind(const float *coef,
+					unsigned int num_channels)
+{
+	const unsigned int n = num_channels;
+	int select = 1, mono = 1;
+	unsigned int out, in, ones;
+
+	for (out = 0; out < n; out++) {
+		ones = 0;
+		for (in = 0; in < n; in++) {
+			if (coef[out * n + in] == 1.0f)
+				ones++;
+			else if (coef[out * n + in] != 0.0f)
+				select = 0;
+		}
+		if (ones > 1)
+			select = 0;
+		if (memcmp(&coef[out * n], coef, n * sizeof(*coef)))
+			mono = 0;
+	}
+	if (select)
+		return CRAS_MIX_REMIX_SELECT;
+	return mono ? CRAS_MIX_REMIX_MONO : CRAS_MIX_REMIX_MATRIX;
+}
+
+int cras_mix_remix(snd_pcm_format_t fmt, uint8_t *buf, unsigned int frames,
+		   unsigned int num_channels, const float *coef,
+		   enum CRAS_MIX_REMIX kind)
+{
+	if (num_channels == 0 || num_channels > CRAS_CH_MAX)
+		return -EINVAL;
+	return ops->remix(fmt, buf, frames, num_channels, coef, kind);
+}
+
+/* Frames of each plane remixed at once. */
+#define REMIX_PLANAR_FRAMES 256
+
+void cras_mix_remix_planar(float *const *planes, unsigned int frames,
+			   unsigned int num_channels, const float *coef,
+			   enum CRAS_MIX_REMIX kind)
+{
+	const unsigned int n = num_channels;
+	float out[CRAS_CH_MAX][REMIX_PLANAR_FRAMES];
+	unsigned int ch, in, i, done, block;
+	unsigned int num_out = kind == CRAS_MIX_REMIX_MONO ? 1 : n;
+
+	if (n == 0 || n > CRAS_CH_MAX)
+		return;
+
+	for (done = 0; done < frames; done += block) {
+		block = MIN(frames - done, REMIX_PLANAR_FRAMES);
+		/* A mono remix mixes one plane copied to all of them. */
+		for (ch = 0; ch < num_out; ch++) {
+			memset(out[ch], 0, block * sizeof(float));
+			for (in = 0; in < n; in++) {
+				const float c = coef[ch * n + in];
+				const float *src = planes[in] + done;
+
+				if (c == 0.0f)
+					continue;
+				for (i = 0; i < block; i++)
+					out[ch][i] += c * src[i];
+			}
+		}
+		for (ch = 0; ch < n; ch++)
+			memcpy(planes[ch] + done, out[num_out > 1 ? ch : 0],
+			       block * sizeof(float));
+	}
+}
+
 size_t cras_mix_mute_buffer(uint8_t *dst, size_t frame_bytes, size_t count)
 {
 	return ops->mute_buffer(dst, frame_bytes, count);
@@ -6,15 +6,34 @@
 #ifndef _CRAS_MIX_H
 #define _CRAS_MIX_H
 
+#include <string.h>
+
 #include "cras_types.h"
 
 struct cras_audio_shm;
 
+/* Stream volume scalers below this mix as silence. */
+#define CRAS_MIX_MIN_VOLUME 0.0000001
+
+/* How cras_mix_remix() applies a channel remix matrix.
+ *    CRAS_MIX_REMIX_SELECT - Every output channel copies one input channel
+ *        or is silent, like swapped speakers or stereo fanned out to four.
+ *    CRAS_MIX_REMIX_MONO - Every output channel gets the same mix of the
+ *        inputs, like a mono speaker pair.
+ *    CRAS_MIX_REMIX_MATRIX - Any other matrix.
+ */
+enum CRAS_MIX_REMIX {
+	CRAS_MIX_REMIX_SELECT,
+	CRAS_MIX_REMIX_MONO,
+	CRAS_MIX_REMIX_MATRIX,
+};
+
 /* SIMD optimisation flags */
 #define CPU_X86_SSE4_2 1
 #define CPU_X86_AVX 2
 #define CPU_X86_AVX2 4
 #define CPU_X86_FMA 8
+#define CPU_ARM_NEON 16
 
 void cras_mix_init(unsigned int flags);
 
@@ -33,6 +52,20 @@ void cras_scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 				 unsigned int frame, float scaler,
 				 float increment, float target, int channel);
 
+/* Scale the given buffer with a gain for each frame, like the gains of a
+ * volume ramp from cras_ramp_action_gains().
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*)
+ *    buff - Buffer of samples to scale.
+ *    frame - The number of frames to render.
+ *    gains - The scaler of each frame, below CRAS_MIX_MIN_VOLUME silences
+ *            the frame.
+ *    channel - Number of samples in a frame.
+ */
+void cras_scale_buffer_gains(snd_pcm_format_t fmt, uint8_t *buff,
+			     unsigned int frame, const float *gains,
+			     int channel);
+
 /* Scale the given buffer with the provided scaler.
  * Args:
  *    fmt - The format (SND_PCM_FORMAT_*)
@@ -58,6 +91,17 @@ void cras_mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		  unsigned int count, unsigned int index, int mute,
 		  float mix_vol);
 
+/* cras_mix_add() for one format, without the format argument. */
+typedef void (*cras_mix_add_func)(uint8_t *dst, uint8_t *src,
+				  unsigned int count, unsigned int index,
+				  int mute, float mix_vol);
+
+/* Returns the kernel of the mixer in use that cras_mix_add() runs for fmt,
+ * so callers mixing many blocks in one format pick it once. The kernel of an
+ * unsupported format does nothing, like cras_mix_add().
+ */
+cras_mix_add_func cras_mix_get_add(snd_pcm_format_t fmt);
+
 /* Add src buffer to dst with independent channel strides.
  * Args:
  *    fmt - The format (SND_PCM_FORMAT_*)
@@ -72,6 +116,58 @@ void cras_mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 			       unsigned int count, unsigned int dst_stride,
 			       unsigned int src_stride, float scaler);
 
+/* Add interleaved src frames to non-interleaved float planes, scaling and
+ * setting mute. Samples are converted to the [-1.0, 1.0] range used by the
+ * DSP, so a device mixing in float doesn't deinterleave again before DSP.
+ * FLOAT_LE samples are already in that range and are added as they are.
+ * Args:
+ *    fmt - The format of src (SND_PCM_FORMAT_*)
+ *    dst - Pointers to the planes to mix to, one per channel.
+ *    src - Buffer of interleaved frames to mix from.
+ *    num_channels - Number of channels in src and dst.
+ *    frames - The number of frames to mix.
+ *    index - If zero this is the first buffer written to dst.
+ *    mute - Is the stream providing the buffer muted.
+ *    mix_vol - Scaler for the buffer to be mixed.
+ * Returns:
+ *    0 on success, -EINVAL if fmt isn't supported.
+ */
+int cras_mix_add_planar(snd_pcm_format_t fmt, float *const *dst,
+			const uint8_t *src, unsigned int num_channels,
+			unsigned int frames, unsigned int index, int mute,
+			float mix_vol);
+
+/* Picks how to apply a remix matrix.
+ * Args:
+ *    coef - The num_channels by num_channels matrix, coef[i * num_channels +
+ *        j] scales input channel j into output channel i.
+ *    num_channels - Number of channels remixed.
+ */
+enum CRAS_MIX_REMIX cras_mix_remix_kind(const float *coef,
+					unsigned int num_channels);
+
+/* Remixes the channels of interleaved frames in place.
+ * Args:
+ *    fmt - The format (SND_PCM_FORMAT_*)
+ *    buf - Buffer of frames to remix.
+ *    frames - The number of frames to remix.
+ *    num_channels - Number of channels in a frame.
+ *    coef - The remix matrix, see cras_mix_remix_kind().
+ *    kind - The kind cras_mix_remix_kind() returned for coef.
+ * Returns:
+ *    0 on success, -EINVAL if fmt or num_channels isn't supported. Only
+ *    CRAS_MIX_REMIX_SELECT takes S24_3LE.
+ */
+int cras_mix_remix(snd_pcm_format_t fmt, uint8_t *buf, unsigned int frames,
+		   unsigned int num_channels, const float *coef,
+		   enum CRAS_MIX_REMIX kind);
+
+/* Like cras_mix_remix() on the non-interleaved float planes of a mix bus,
+ * before they are written to the device format. */
+void cras_mix_remix_planar(float *const *planes, unsigned int frames,
+			   unsigned int num_channels, const float *coef,
+			   enum CRAS_MIX_REMIX kind);
+
 /* Mutes the given buffer.
  * Args:
  *    num_channel - Number of channels in data.
@@ -80,4 +176,12 @@ void cras_mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
  */
 size_t cras_mix_mute_buffer(uint8_t *dst, size_t frame_bytes, size_t count);
 
+/* Returns non-zero if the bytes of buf are all zero, i.e. digital silence
+ * in any of the signed formats. The buffer is all zeros if its first byte is
+ * zero and every byte equals the next one, which memcmp checks quickly. */
+static inline int cras_mix_buffer_is_zero(const uint8_t *buf, size_t bytes)
+{
+	return !bytes || (!*buf && !memcmp(buf, buf + 1, bytes - 1));
+}
+
 #endif /* _CRAS_MIX_H */
@@ -3,7 +3,9 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
 #include <stdint.h>
+#include <sys/param.h>
 
 #include "cras_system_state.h"
 #include "cras_mix_ops.h"
@@ -20,6 +22,8 @@
 #define OPS(a) a##_avx2
 #elif OPS_FMA
 #define OPS(a) a##_fma
+#elif OPS_NEON
+#define OPS(a) a##_neon
 #else
 #define OPS(a) a
 #endif
@@ -33,6 +37,898 @@ static inline int need_to_scale(float scaler)
 	return (scaler < 0.99 || scaler > 1.01);
 }
 
+/*
+ * Vector kernels.
+ *
+ * Only the SIMD variants of this file (built with OPS_* and the matching
+ * -m flags) get the intrinsics below, so the plain mixer_ops table stays the
+ * scalar reference implementation. Each simd_* helper processes as many
+ * samples as fit in whole vectors and returns that count; the caller's scalar
+ * loop finishes the remainder. Results match the scalar code: float to int
+ * conversions truncate and sums saturate exactly where the C code clips.
+ */
+#if (defined(OPS_AVX2) || defined(OPS_FMA)) && defined(__AVX2__)
+#define MIX_SIMD_AVX2
+#elif (defined(OPS_SSE42) || defined(OPS_AVX)) && defined(__SSE4_1__)
+#define MIX_SIMD_SSE41
+#elif defined(OPS_NEON) && defined(__ARM_NEON)
+#define MIX_SIMD_NEON
+#endif
+
+#if defined(MIX_SIMD_AVX2) || defined(MIX_SIMD_SSE41) || \
+	defined(MIX_SIMD_NEON)
+#define MIX_SIMD
+#endif
+
+#if defined(MIX_SIMD_AVX2)
+#include <immintrin.h>
+
+#define VLEN 8
+typedef __m256i vi32;
+typedef __m256 vf32;
+typedef __m256 vmask;
+
+static inline vi32 v_load_i32(const int32_t *p)
+{
+	return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline void v_store_i32(int32_t *p, vi32 v)
+{
+	_mm256_storeu_si256((__m256i *)p, v);
+}
+
+static inline vi32 v_load_s16(const int16_t *p)
+{
+	return _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i *)p));
+}
+
+/* Stores 2 * VLEN samples, saturated to s16. */
+static inline void v_store_s16_sat(int16_t *p, vi32 lo, vi32 hi)
+{
+	__m256i packed = _mm256_packs_epi32(lo, hi);
+
+	packed = _mm256_permute4x64_epi64(packed, 0xd8);
+	_mm256_storeu_si256((__m256i *)p, packed);
+}
+
+static inline vf32 v_load_f32(const float *p)
+{
+	return _mm256_loadu_ps(p);
+}
+
+static inline void v_store_f32(float *p, vf32 v)
+{
+	_mm256_storeu_ps(p, v);
+}
+
+static inline vf32 v_set1_f32(float f)
+{
+	return _mm256_set1_ps(f);
+}
+
+static inline vi32 v_set1_i32(int32_t i)
+{
+	return _mm256_set1_epi32(i);
+}
+
+static inline vf32 v_i2f(vi32 v)
+{
+	return _mm256_cvtepi32_ps(v);
+}
+
+/* Truncating conversion, positive overflow saturates like the C clip. */
+static inline vi32 v_f2i(vf32 f)
+{
+	__m256 over = _mm256_cmp_ps(f, _mm256_set1_ps(2147483648.0f),
+				    _CMP_GE_OQ);
+
+	return _mm256_xor_si256(_mm256_cvttps_epi32(f),
+				_mm256_castps_si256(over));
+}
+
+static inline vf32 v_mul_f32(vf32 a, vf32 b)
+{
+	return _mm256_mul_ps(a, b);
+}
+
+static inline vf32 v_add_f32(vf32 a, vf32 b)
+{
+	return _mm256_add_ps(a, b);
+}
+
+static inline vi32 v_add_i32(vi32 a, vi32 b)
+{
+	return _mm256_add_epi32(a, b);
+}
+
+static inline vi32 v_adds_i32(vi32 a, vi32 b)
+{
+	__m256i sum = _mm256_add_epi32(a, b);
+	__m256i ovf = _mm256_and_si256(_mm256_xor_si256(sum, a),
+				       _mm256_xor_si256(sum, b));
+	__m256i sat = _mm256_xor_si256(_mm256_srai_epi32(a, 31),
+				       _mm256_set1_epi32(INT32_MAX));
+
+	return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(sum),
+						    _mm256_castsi256_ps(sat),
+						    _mm256_castsi256_ps(ovf)));
+}
+
+static inline vi32 v_clamp_i32(vi32 v, vi32 lo, vi32 hi)
+{
+	return _mm256_min_epi32(_mm256_max_epi32(v, lo), hi);
+}
+
+static inline vi32 v_shl8_i32(vi32 v)
+{
+	return _mm256_slli_epi32(v, 8);
+}
+
+static inline vi32 v_shr8_u32(vi32 v)
+{
+	return _mm256_srli_epi32(v, 8);
+}
+
+static inline vmask v_gt_f32(vf32 a, vf32 b)
+{
+	return _mm256_cmp_ps(a, b, _CMP_GT_OQ);
+}
+
+/* Picks a where mask is set, b elsewhere. */
+static inline vi32 v_select_i32(vmask mask, vi32 a, vi32 b)
+{
+	return _mm256_castps_si256(_mm256_blendv_ps(
+		_mm256_castsi256_ps(b), _mm256_castsi256_ps(a), mask));
+}
+
+#define V16LEN 16
+typedef __m256i vi16;
+
+static inline vi16 v16_load(const int16_t *p)
+{
+	return _mm256_loadu_si256((const __m256i *)p);
+}
+
+static inline void v16_store(int16_t *p, vi16 v)
+{
+	_mm256_storeu_si256((__m256i *)p, v);
+}
+
+static inline vi16 v16_adds(vi16 a, vi16 b)
+{
+	return _mm256_adds_epi16(a, b);
+}
+
+#elif defined(MIX_SIMD_SSE41)
+#include <smmintrin.h>
+
+#define VLEN 4
+typedef __m128i vi32;
+typedef __m128 vf32;
+typedef __m128 vmask;
+
+static inline vi32 v_load_i32(const int32_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void v_store_i32(int32_t *p, vi32 v)
+{
+	_mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline vi32 v_load_s16(const int16_t *p)
+{
+	return _mm_cvtepi16_epi32(_mm_loadl_epi64((const __m128i *)p));
+}
+
+/* Stores 2 * VLEN samples, saturated to s16. */
+static inline void v_store_s16_sat(int16_t *p, vi32 lo, vi32 hi)
+{
+	_mm_storeu_si128((__m128i *)p, _mm_packs_epi32(lo, hi));
+}
+
+static inline vf32 v_load_f32(const float *p)
+{
+	return _mm_loadu_ps(p);
+}
+
+static inline void v_store_f32(float *p, vf32 v)
+{
+	_mm_storeu_ps(p, v);
+}
+
+static inline vf32 v_set1_f32(float f)
+{
+	return _mm_set1_ps(f);
+}
+
+static inline vi32 v_set1_i32(int32_t i)
+{
+	return _mm_set1_epi32(i);
+}
+
+static inline vf32 v_i2f(vi32 v)
+{
+	return _mm_cvtepi32_ps(v);
+}
+
+/* Truncating conversion, positive overflow saturates like the C clip. */
+static inline vi32 v_f2i(vf32 f)
+{
+	__m128 over = _mm_cmpge_ps(f, _mm_set1_ps(2147483648.0f));
+
+	return _mm_xor_si128(_mm_cvttps_epi32(f), _mm_castps_si128(over));
+}
+
+static inline vf32 v_mul_f32(vf32 a, vf32 b)
+{
+	return _mm_mul_ps(a, b);
+}
+
+static inline vf32 v_add_f32(vf32 a, vf32 b)
+{
+	return _mm_add_ps(a, b);
+}
+
+static inline vi32 v_add_i32(vi32 a, vi32 b)
+{
+	return _mm_add_epi32(a, b);
+}
+
+static inline vi32 v_adds_i32(vi32 a, vi32 b)
+{
+	__m128i sum = _mm_add_epi32(a, b);
+	__m128i ovf =
+		_mm_and_si128(_mm_xor_si128(sum, a), _mm_xor_si128(sum, b));
+	__m128i sat = _mm_xor_si128(_mm_srai_epi32(a, 31),
+				    _mm_set1_epi32(INT32_MAX));
+
+	return _mm_castps_si128(_mm_blendv_ps(_mm_castsi128_ps(sum),
+					      _mm_castsi128_ps(sat),
+					      _mm_castsi128_ps(ovf)));
+}
+
+static inline vi32 v_clamp_i32(vi32 v, vi32 lo, vi32 hi)
+{
+	return _mm_min_epi32(_mm_max_epi32(v, lo), hi);
+}
+
+static inline vi32 v_shl8_i32(vi32 v)
+{
+	return _mm_slli_epi32(v, 8);
+}
+
+static inline vi32 v_shr8_u32(vi32 v)
+{
+	return _mm_srli_epi32(v, 8);
+}
+
+static inline vmask v_gt_f32(vf32 a, vf32 b)
+{
+	return _mm_cmpgt_ps(a, b);
+}
+
+/* Picks a where mask is set, b elsewhere. */
+static inline vi32 v_select_i32(vmask mask, vi32 a, vi32 b)
+{
+	return _mm_castps_si128(
+		_mm_blendv_ps(_mm_castsi128_ps(b), _mm_castsi128_ps(a), mask));
+}
+
+#define V16LEN 8
+typedef __m128i vi16;
+
+static inline vi16 v16_load(const int16_t *p)
+{
+	return _mm_loadu_si128((const __m128i *)p);
+}
+
+static inline void v16_store(int16_t *p, vi16 v)
+{
+	_mm_storeu_si128((__m128i *)p, v);
+}
+
+static inline vi16 v16_adds(vi16 a, vi16 b)
+{
+	return _mm_adds_epi16(a, b);
+}
+
+#elif defined(MIX_SIMD_NEON)
+#include <arm_neon.h>
+
+#define VLEN 4
+typedef int32x4_t vi32;
+typedef float32x4_t vf32;
+typedef uint32x4_t vmask;
+
+static inline vi32 v_load_i32(const int32_t *p)
+{
+	return vld1q_s32(p);
+}
+
+static inline void v_store_i32(int32_t *p, vi32 v)
+{
+	vst1q_s32(p, v);
+}
+
+static inline vi32 v_load_s16(const int16_t *p)
+{
+	return vmovl_s16(vld1_s16(p));
+}
+
+/* Stores 2 * VLEN samples, saturated to s16. */
+static inline void v_store_s16_sat(int16_t *p, vi32 lo, vi32 hi)
+{
+	vst1q_s16(p, vcombine_s16(vqmovn_s32(lo), vqmovn_s32(hi)));
+}
+
+static inline vf32 v_load_f32(const float *p)
+{
+	return vld1q_f32(p);
+}
+
+static inline void v_store_f32(float *p, vf32 v)
+{
+	vst1q_f32(p, v);
+}
+
+static inline vf32 v_set1_f32(float f)
+{
+	return vdupq_n_f32(f);
+}
+
+static inline vi32 v_set1_i32(int32_t i)
+{
+	return vdupq_n_s32(i);
+}
+
+static inline vf32 v_i2f(vi32 v)
+{
+	return vcvtq_f32_s32(v);
+}
+
+/* NEON conversion already truncates and saturates. */
+static inline vi32 v_f2i(vf32 f)
+{
+	return vcvtq_s32_f32(f);
+}
+
+static inline vf32 v_mul_f32(vf32 a, vf32 b)
+{
+	return vmulq_f32(a, b);
+}
+
+static inline vf32 v_add_f32(vf32 a, vf32 b)
+{
+	return vaddq_f32(a, b);
+}
+
+static inline vi32 v_add_i32(vi32 a, vi32 b)
+{
+	return vaddq_s32(a, b);
+}
+
+static inline vi32 v_adds_i32(vi32 a, vi32 b)
+{
+	return vqaddq_s32(a, b);
+}
+
+static inline vi32 v_clamp_i32(vi32 v, vi32 lo, vi32 hi)
+{
+	return vminq_s32(vmaxq_s32(v, lo), hi);
+}
+
+static inline vi32 v_shl8_i32(vi32 v)
+{
+	return vshlq_n_s32(v, 8);
+}
+
+static inline vi32 v_shr8_u32(vi32 v)
+{
+	return vreinterpretq_s32_u32(vshrq_n_u32(vreinterpretq_u32_s32(v), 8));
+}
+
+static inline vmask v_gt_f32(vf32 a, vf32 b)
+{
+	return vcgtq_f32(a, b);
+}
+
+/* Picks a where mask is set, b elsewhere. */
+static inline vi32 v_select_i32(vmask mask, vi32 a, vi32 b)
+{
+	return vbslq_s32(mask, a, b);
+}
+
+#define V16LEN 8
+typedef int16x8_t vi16;
+
+static inline vi16 v16_load(const int16_t *p)
+{
+	return vld1q_s16(p);
+}
+
+static inline void v16_store(int16_t *p, vi16 v)
+{
+	vst1q_s16(p, v);
+}
+
+static inline vi16 v16_adds(vi16 a, vi16 b)
+{
+	return vqaddq_s16(a, b);
+}
+#endif
+
+#ifdef MIX_SIMD
+
+#define S24_MAX 0x007fffff
+#define S24_MIN ((int32_t)0xff800000)
+
+/* dst = sat(dst + src) */
+static size_t simd_add_clip_s16(int16_t *dst, const int16_t *src, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + V16LEN <= count; i += V16LEN)
+		v16_store(dst + i, v16_adds(v16_load(dst + i),
+					    v16_load(src + i)));
+	return i;
+}
+
+/* dst = sat(dst + trunc(src * vol)) */
+static size_t simd_scale_add_clip_s16(int16_t *dst, const int16_t *src,
+				      size_t count, float vol)
+{
+	vf32 v = v_set1_f32(vol);
+	size_t i;
+
+	for (i = 0; i + 2 * VLEN <= count; i += 2 * VLEN) {
+		vi32 lo = v_f2i(v_mul_f32(v_i2f(v_load_s16(src + i)), v));
+		vi32 hi = v_f2i(
+			v_mul_f32(v_i2f(v_load_s16(src + i + VLEN)), v));
+
+		lo = v_add_i32(lo, v_load_s16(dst + i));
+		hi = v_add_i32(hi, v_load_s16(dst + i + VLEN));
+		v_store_s16_sat(dst + i, lo, hi);
+	}
+	return i;
+}
+
+/* dst = trunc(src * vol), dst may alias src. */
+static size_t simd_scale_s16(int16_t *dst, const int16_t *src, size_t count,
+			     float vol)
+{
+	vf32 v = v_set1_f32(vol);
+	size_t i;
+
+	for (i = 0; i + 2 * VLEN <= count; i += 2 * VLEN) {
+		vi32 lo = v_f2i(v_mul_f32(v_i2f(v_load_s16(src + i)), v));
+		vi32 hi = v_f2i(
+			v_mul_f32(v_i2f(v_load_s16(src + i + VLEN)), v));
+
+		v_store_s16_sat(dst + i, lo, hi);
+	}
+	return i;
+}
+
+/* buf[i] = trunc(buf[i] * gains[i]), untouched where gains[i] is above
+ * MAX_VOLUME_TO_SCALE. */
+static size_t simd_scale_gains_s16(int16_t *buf, const float *gains,
+				   size_t count)
+{
+	vf32 max = v_set1_f32(MAX_VOLUME_TO_SCALE);
+	size_t i;
+
+	for (i = 0; i + 2 * VLEN <= count; i += 2 * VLEN) {
+		vf32 g_lo = v_load_f32(gains + i);
+		vf32 g_hi = v_load_f32(gains + i + VLEN);
+		vi32 lo = v_load_s16(buf + i);
+		vi32 hi = v_load_s16(buf + i + VLEN);
+
+		lo = v_select_i32(v_gt_f32(g_lo, max), lo,
+				  v_f2i(v_mul_f32(v_i2f(lo), g_lo)));
+		hi = v_select_i32(v_gt_f32(g_hi, max), hi,
+				  v_f2i(v_mul_f32(v_i2f(hi), g_hi)));
+		v_store_s16_sat(buf + i, lo, hi);
+	}
+	return i;
+}
+
+/* dst = sat(trunc(dst + src * scaler)) for contiguous samples. */
+static size_t simd_add_scale_stride_s16(int16_t *dst, const int16_t *src,
+					size_t count, float scaler)
+{
+	size_t i;
+
+	if (!need_to_scale(scaler))
+		return simd_add_clip_s16(dst, src, count);
+
+	vf32 v = v_set1_f32(scaler);
+	for (i = 0; i + 2 * VLEN <= count; i += 2 * VLEN) {
+		vf32 lo = v_mul_f32(v_i2f(v_load_s16(src + i)), v);
+		vf32 hi = v_mul_f32(v_i2f(v_load_s16(src + i + VLEN)), v);
+
+		lo = v_add_f32(v_i2f(v_load_s16(dst + i)), lo);
+		hi = v_add_f32(v_i2f(v_load_s16(dst + i + VLEN)), hi);
+		v_store_s16_sat(dst + i, v_f2i(lo), v_f2i(hi));
+	}
+	return i;
+}
+
+/* Same as scale_s24_le() below on a whole vector. */
+static inline vi32 v_scale_s24(vi32 x, vf32 scaler)
+{
+	return v_shr8_u32(v_f2i(v_mul_f32(v_i2f(v_shl8_i32(x)), scaler)));
+}
+
+/* dst = clamp24(dst + src) */
+static size_t simd_add_clip_s24(int32_t *dst, const int32_t *src, size_t count)
+{
+	vi32 lo = v_set1_i32(S24_MIN);
+	vi32 hi = v_set1_i32(S24_MAX);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vi32 sum = v_add_i32(v_load_i32(dst + i), v_load_i32(src + i));
+
+		v_store_i32(dst + i, v_clamp_i32(sum, lo, hi));
+	}
+	return i;
+}
+
+/* dst = clamp24(dst + trunc(src * vol)) */
+static size_t simd_scale_add_clip_s24(int32_t *dst, const int32_t *src,
+				      size_t count, float vol)
+{
+	vi32 lo = v_set1_i32(S24_MIN);
+	vi32 hi = v_set1_i32(S24_MAX);
+	vf32 v = v_set1_f32(vol);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vi32 s = v_f2i(v_mul_f32(v_i2f(v_load_i32(src + i)), v));
+		vi32 sum = v_add_i32(v_load_i32(dst + i), s);
+
+		v_store_i32(dst + i, v_clamp_i32(sum, lo, hi));
+	}
+	return i;
+}
+
+/* dst = scale_s24_le(src, vol), dst may alias src. */
+static size_t simd_scale_s24(int32_t *dst, const int32_t *src, size_t count,
+			     float vol)
+{
+	vf32 v = v_set1_f32(vol);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN)
+		v_store_i32(dst + i, v_scale_s24(v_load_i32(src + i), v));
+	return i;
+}
+
+static size_t simd_scale_gains_s24(int32_t *buf, const float *gains,
+				   size_t count)
+{
+	vf32 max = v_set1_f32(MAX_VOLUME_TO_SCALE);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vf32 g = v_load_f32(gains + i);
+		vi32 x = v_load_i32(buf + i);
+
+		v_store_i32(buf + i, v_select_i32(v_gt_f32(g, max), x,
+						  v_scale_s24(x, g)));
+	}
+	return i;
+}
+
+static size_t simd_add_scale_stride_s24(int32_t *dst, const int32_t *src,
+					size_t count, float scaler)
+{
+	vi32 lo = v_set1_i32(S24_MIN);
+	vi32 hi = v_set1_i32(S24_MAX);
+	vf32 v = v_set1_f32(scaler);
+	int scale = need_to_scale(scaler);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vi32 s = v_load_i32(src + i);
+
+		if (scale)
+			s = v_scale_s24(s, v);
+		s = v_add_i32(v_load_i32(dst + i), s);
+		v_store_i32(dst + i, v_clamp_i32(s, lo, hi));
+	}
+	return i;
+}
+
+/* dst = sat32(dst + src) */
+static size_t simd_add_clip_s32(int32_t *dst, const int32_t *src, size_t count)
+{
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN)
+		v_store_i32(dst + i, v_adds_i32(v_load_i32(dst + i),
+						v_load_i32(src + i)));
+	return i;
+}
+
+/* dst = sat32(dst + trunc(src * vol)) */
+static size_t simd_scale_add_clip_s32(int32_t *dst, const int32_t *src,
+				      size_t count, float vol)
+{
+	vf32 v = v_set1_f32(vol);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vi32 s = v_f2i(v_mul_f32(v_i2f(v_load_i32(src + i)), v));
+
+		v_store_i32(dst + i, v_adds_i32(v_load_i32(dst + i), s));
+	}
+	return i;
+}
+
+/* dst = trunc(src * vol), dst may alias src. */
+static size_t simd_scale_s32(int32_t *dst, const int32_t *src, size_t count,
+			     float vol)
+{
+	vf32 v = v_set1_f32(vol);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN)
+		v_store_i32(dst + i,
+			    v_f2i(v_mul_f32(v_i2f(v_load_i32(src + i)), v)));
+	return i;
+}
+
+static size_t simd_scale_gains_s32(int32_t *buf, const float *gains,
+				   size_t count)
+{
+	vf32 max = v_set1_f32(MAX_VOLUME_TO_SCALE);
+	size_t i;
+
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vf32 g = v_load_f32(gains + i);
+		vi32 x = v_load_i32(buf + i);
+
+		v_store_i32(buf + i,
+			    v_select_i32(v_gt_f32(g, max), x,
+					 v_f2i(v_mul_f32(v_i2f(x), g))));
+	}
+	return i;
+}
+
+/* dst = sat32(trunc(dst + src * scaler)) for contiguous samples. */
+static size_t simd_add_scale_stride_s32(int32_t *dst, const int32_t *src,
+					size_t count, float scaler)
+{
+	size_t i;
+
+	if (!need_to_scale(scaler))
+		return simd_add_clip_s32(dst, src, count);
+
+	vf32 v = v_set1_f32(scaler);
+	for (i = 0; i + VLEN <= count; i += VLEN) {
+		vf32 s = v_mul_f32(v_i2f(v_load_i32(src + i)), v);
+
+		s = v_add_f32(v_i2f(v_load_i32(dst + i)), s);
+		v_store_i32(dst + i, v_f2i(s));
+	}
+	return i;
+}
+
+/* The remix matrices done with SIMD have a number of channels dividing
+ * REMIX_PERIOD, which is a multiple of 2 * VLEN. */
+#define REMIX_PERIOD 16
+#define REMIX_MAX_CHANNELS 8
+/* Samples converted to float at a time. */
+#define REMIX_BLOCK_SAMPLES 256
+
+/* Output sample p of a remix is the sum over d of diag[d][p] * in[p + d],
+ * for d from 1 - n to n - 1, where diag[d][p] is the coefficient of input
+ * channel ch + d into output channel ch = p % n, or zero when ch + d isn't
+ * a channel. The coefficients repeat every n samples, so each term is a
+ * vector multiply of contiguous samples. Terms are added in the order of
+ * the input channels, and S16_LE truncates after each like
+ * s16_multiply_buf_with_coef() does. */
+static inline vf32 remix_vector(const float *x,
+				const float (*diag)[REMIX_PERIOD],
+				unsigned int n, size_t s, int trunc)
+{
+	vf32 acc = v_set1_f32(0.0f);
+	unsigned int k;
+
+	for (k = 0; k < 2 * n - 1; k++) {
+		acc = v_add_f32(acc, v_mul_f32(v_load_f32(diag[k] +
+							 s % REMIX_PERIOD),
+					       v_load_f32(x + s + k + 1 - n)));
+		if (trunc)
+			acc = v_i2f(v_f2i(acc));
+	}
+	return acc;
+}
+
+/* Remixes whole frames of buf in place, returns the number done. */
+static size_t simd_remix(snd_pcm_format_t fmt, uint8_t *buf, size_t frames,
+			 unsigned int n, const float *coef)
+{
+	float diag[2 * REMIX_MAX_CHANNELS - 1][REMIX_PERIOD];
+	/* Padded with zeros for the terms reaching past the block. */
+	float in[REMIX_MAX_CHANNELS + REMIX_BLOCK_SAMPLES + REMIX_MAX_CHANNELS];
+	float *x = in + REMIX_MAX_CHANNELS;
+	int16_t *s16 = (int16_t *)buf;
+	int32_t *s32 = (int32_t *)buf;
+	size_t total, done, count, s;
+	unsigned int k, l;
+	int ch;
+
+	if (n > REMIX_MAX_CHANNELS || REMIX_PERIOD % n)
+		return 0;
+
+	for (k = 0; k < 2 * n - 1; k++) {
+		for (l = 0; l < REMIX_PERIOD; l++) {
+			ch = (int)(l % n + k + 1) - (int)n;
+			diag[k][l] = (ch >= 0 && ch < (int)n) ?
+					     coef[(l % n) * n + ch] :
+					     0.0f;
+		}
+	}
+	memset(in, 0, sizeof(in));
+
+	total = frames * n / REMIX_PERIOD * REMIX_PERIOD;
+	for (done = 0; done < total; done += count) {
+		count = MIN(total - done, REMIX_BLOCK_SAMPLES);
+		memset(x + count, 0, REMIX_MAX_CHANNELS * sizeof(float));
+		for (s = 0; s < count; s += VLEN) {
+			vi32 v;
+
+			if (fmt == SND_PCM_FORMAT_S16_LE)
+				v = v_load_s16(s16 + done + s);
+			else if (fmt == SND_PCM_FORMAT_S24_LE)
+				v = v_shl8_i32(v_load_i32(s32 + done + s));
+			else
+				v = v_load_i32(s32 + done + s);
+			v_store_f32(x + s, v_i2f(v));
+		}
+
+		if (fmt == SND_PCM_FORMAT_S16_LE) {
+			for (s = 0; s < count; s += 2 * VLEN)
+				v_store_s16_sat(
+					s16 + done + s,
+					v_f2i(remix_vector(x, diag, n, s, 1)),
+					v_f2i(remix_vector(x, diag, n,
+							   s + VLEN, 1)));
+			continue;
+		}
+		for (s = 0; s < count; s += VLEN) {
+			vi32 v = v_f2i(remix_vector(x, diag, n, s, 0));
+
+			if (fmt == SND_PCM_FORMAT_S24_LE)
+				v = v_shr8_u32(v);
+			v_store_i32(s32 + done + s, v);
+		}
+	}
+	return total / n;
+}
+
+#else /* MIX_SIMD */
+
+/* Scalar build, the C loops below handle every sample. */
+#define simd_add_clip_s16(dst, src, count) 0
+#define simd_scale_add_clip_s16(dst, src, count, vol) 0
+#define simd_scale_s16(dst, src, count, vol) 0
+#define simd_add_scale_stride_s16(dst, src, count, scaler) 0
+#define simd_add_clip_s24(dst, src, count) 0
+#define simd_scale_add_clip_s24(dst, src, count, vol) 0
+#define simd_scale_s24(dst, src, count, vol) 0
+#define simd_add_scale_stride_s24(dst, src, count, scaler) 0
+#define simd_add_clip_s32(dst, src, count) 0
+#define simd_scale_add_clip_s32(dst, src, count, vol) 0
+#define simd_scale_s32(dst, src, count, vol) 0
+#define simd_add_scale_stride_s32(dst, src, count, scaler) 0
+#define simd_remix(fmt, buf, frames, n, coef) 0
+#define simd_scale_gains_s16(buf, gains, count) 0
+#define simd_scale_gains_s24(buf, gains, count) 0
+#define simd_scale_gains_s32(buf, gains, count) 0
+
+#endif /* MIX_SIMD */
+
+/* Samples of per-sample gain computed at a time for volume ramps. */
+#define RAMP_BLOCK_SAMPLES 256
+
+#ifdef MIX_SIMD
+/* Applies a volume ramp in blocks. The per-frame scaler is stepped exactly as
+ * the scalar loops do, expanded into a per-sample gain block, and handed to
+ * a vector kernel.
+ * Args:
+ *    buffer - Samples to scale in place.
+ *    sample_bytes - Bytes in one sample.
+ *    count, scaler, increment, target, step - See scale_buffer_increment.
+ *    apply - Scales count samples of buffer by gains. Samples whose gain is
+ *        above MAX_VOLUME_TO_SCALE are left untouched.
+ */
+static void scale_buffer_ramp(uint8_t *buffer, size_t sample_bytes,
+			      unsigned int count, float scaler,
+			      float increment, float target, int step,
+			      void (*apply)(uint8_t *buf, const float *gains,
+					    size_t count))
+{
+	float gains[RAMP_BLOCK_SAMPLES];
+	unsigned int frames = count / step;
+	unsigned int block_frames = RAMP_BLOCK_SAMPLES / step;
+
+	while (frames) {
+		unsigned int nframes =
+			frames < block_frames ? frames : block_frames;
+		unsigned int f, n = 0;
+		int j;
+
+		for (f = 0; f < nframes; f++) {
+			float applied_scaler = scaler;
+
+			if ((applied_scaler > target && increment > 0) ||
+			    (applied_scaler < target && increment < 0))
+				applied_scaler = target;
+			if (applied_scaler < MIN_VOLUME_TO_SCALE)
+				applied_scaler = 0;
+			for (j = 0; j < step; j++)
+				gains[n++] = applied_scaler;
+			scaler += increment;
+		}
+
+		apply(buffer, gains, n);
+		buffer += n * sample_bytes;
+		frames -= nframes;
+	}
+}
+#endif
+
+/* Scales count samples of buffer by a gain for each frame of step samples.
+ * The gains are expanded to one for each sample a block at a time, frames
+ * with a gain below MIN_VOLUME_TO_SCALE are silenced.
+ * Args:
+ *    buffer - Samples to scale in place.
+ *    sample_bytes - Bytes in one sample.
+ *    count - The number of samples to scale.
+ *    frame_gains - One gain for each frame.
+ *    step - Samples in a frame, at most RAMP_BLOCK_SAMPLES.
+ *    apply - Scales count samples of buffer by gains. Samples whose gain is
+ *        above MAX_VOLUME_TO_SCALE are left untouched.
+ */
+static void scale_buffer_frame_gains(uint8_t *buffer, size_t sample_bytes,
+				     unsigned int count,
+				     const float *frame_gains, int step,
+				     void (*apply)(uint8_t *buf,
+						   const float *gains,
+						   size_t count))
+{
+	float gains[RAMP_BLOCK_SAMPLES];
+	unsigned int frames = count / step;
+	unsigned int block_frames = RAMP_BLOCK_SAMPLES / step;
+
+	while (frames) {
+		unsigned int nframes =
+			frames < block_frames ? frames : block_frames;
+		unsigned int f, n = 0;
+		int j;
+
+		for (f = 0; f < nframes; f++) {
+			float gain = frame_gains[f];
+
+			if (gain < MIN_VOLUME_TO_SCALE)
+				gain = 0;
+			for (j = 0; j < step; j++)
+				gains[n++] = gain;
+		}
+
+		apply(buffer, gains, n);
+		buffer += n * sample_bytes;
+		frame_gains += nframes;
+		frames -= nframes;
+	}
+}
+
 /*
  * Signed 16 bit little endian functions.
  */
@@ -43,7 +939,7 @@ static void cras_mix_add_clip_s16_le(int16_t *dst, const int16_t *src,
 	int32_t sum;
 	size_t i;
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_add_clip_s16(dst, src, count); i < count; i++) {
 		sum = dst[i] + src[i];
 		if (sum > INT16_MAX)
 			sum = INT16_MAX;
@@ -64,7 +960,8 @@ static void scale_add_clip_s16_le(int16_t *dst, const int16_t *src,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s16_le(dst, src, count);
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_scale_add_clip_s16(dst, src, count, vol); i < count;
+	     i++) {
 		sum = dst[i] + (int16_t)(src[i] * vol);
 		if (sum > INT16_MAX)
 			sum = INT16_MAX;
@@ -79,17 +976,28 @@ static void scale_add_clip_s16_le(int16_t *dst, const int16_t *src,
 static void copy_scaled_s16_le(int16_t *dst, const int16_t *src, size_t count,
 			       float volume_scaler)
 {
-	int i;
+	size_t i;
 
 	if (volume_scaler > MAX_VOLUME_TO_SCALE) {
 		memcpy(dst, src, count * sizeof(*src));
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_scale_s16(dst, src, count, volume_scaler); i < count; i++)
 		dst[i] = src[i] * volume_scaler;
 }
 
+static void scale_gains_s16_le(uint8_t *buffer, const float *gains,
+			       size_t count)
+{
+	int16_t *out = (int16_t *)buffer;
+	size_t i;
+
+	for (i = simd_scale_gains_s16(out, gains, count); i < count; i++)
+		if (gains[i] <= MAX_VOLUME_TO_SCALE)
+			out[i] *= gains[i];
+}
+
 static void cras_scale_buffer_inc_s16_le(uint8_t *buffer, unsigned int count,
 					 float scaler, float increment,
 					 float target, int step)
@@ -102,6 +1010,13 @@ static void cras_scale_buffer_inc_s16_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#ifdef MIX_SIMD
+	if (step > 0 && step <= RAMP_BLOCK_SAMPLES)
+		return scale_buffer_ramp(buffer, sizeof(*out), count, scaler,
+					 increment, target, step,
+					 scale_gains_s16_le);
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			float applied_scaler = scaler;
@@ -125,7 +1040,7 @@ static void cras_scale_buffer_inc_s16_le(uint8_t *buffer, unsigned int count,
 static void cras_scale_buffer_s16_le(uint8_t *buffer, unsigned int count,
 				     float scaler)
 {
-	int i;
+	unsigned int i;
 	int16_t *out = (int16_t *)buffer;
 
 	if (scaler > MAX_VOLUME_TO_SCALE)
@@ -136,7 +1051,7 @@ static void cras_scale_buffer_s16_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_scale_s16(out, out, count, scaler); i < count; i++)
 		out[i] *= scaler;
 }
 
@@ -167,7 +1082,12 @@ static void cras_mix_add_scale_stride_s16_le(uint8_t *dst, uint8_t *src,
 
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 2) {
-		for (i = 0; i < count; i++) {
+		i = simd_add_scale_stride_s16((int16_t *)dst,
+					      (const int16_t *)src, count,
+					      scaler);
+		dst += 2 * i;
+		src += 2 * i;
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int16_t *)dst +
@@ -234,7 +1154,7 @@ static void cras_mix_add_clip_s24_le(int32_t *dst, const int32_t *src,
 	int32_t sum;
 	size_t i;
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_add_clip_s24(dst, src, count); i < count; i++) {
 		sum = dst[i] + src[i];
 		if (sum > 0x007fffff)
 			sum = 0x007fffff;
@@ -255,7 +1175,8 @@ static void scale_add_clip_s24_le(int32_t *dst, const int32_t *src,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s24_le(dst, src, count);
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_scale_add_clip_s24(dst, src, count, vol); i < count;
+	     i++) {
 		sum = dst[i] + (int32_t)(src[i] * vol);
 		if (sum > 0x007fffff)
 			sum = 0x007fffff;
@@ -270,17 +1191,28 @@ static void scale_add_clip_s24_le(int32_t *dst, const int32_t *src,
 static void copy_scaled_s24_le(int32_t *dst, const int32_t *src, size_t count,
 			       float volume_scaler)
 {
-	int i;
+	size_t i;
 
 	if (volume_scaler > MAX_VOLUME_TO_SCALE) {
 		memcpy(dst, src, count * sizeof(*src));
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_scale_s24(dst, src, count, volume_scaler); i < count; i++)
 		dst[i] = scale_s24_le(src[i], volume_scaler);
 }
 
+static void scale_gains_s24_le(uint8_t *buffer, const float *gains,
+			       size_t count)
+{
+	int32_t *out = (int32_t *)buffer;
+	size_t i;
+
+	for (i = simd_scale_gains_s24(out, gains, count); i < count; i++)
+		if (gains[i] <= MAX_VOLUME_TO_SCALE)
+			out[i] = scale_s24_le(out[i], gains[i]);
+}
+
 static void cras_scale_buffer_inc_s24_le(uint8_t *buffer, unsigned int count,
 					 float scaler, float increment,
 					 float target, int step)
@@ -293,6 +1225,13 @@ static void cras_scale_buffer_inc_s24_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#ifdef MIX_SIMD
+	if (step > 0 && step <= RAMP_BLOCK_SAMPLES)
+		return scale_buffer_ramp(buffer, sizeof(*out), count, scaler,
+					 increment, target, step,
+					 scale_gains_s24_le);
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			float applied_scaler = scaler;
@@ -316,7 +1255,7 @@ static void cras_scale_buffer_inc_s24_le(uint8_t *buffer, unsigned int count,
 static void cras_scale_buffer_s24_le(uint8_t *buffer, unsigned int count,
 				     float scaler)
 {
-	int i;
+	unsigned int i;
 	int32_t *out = (int32_t *)buffer;
 
 	if (scaler > MAX_VOLUME_TO_SCALE)
@@ -327,7 +1266,7 @@ static void cras_scale_buffer_s24_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_scale_s24(out, out, count, scaler); i < count; i++)
 		out[i] = scale_s24_le(out[i], scaler);
 }
 
@@ -358,7 +1297,12 @@ static void cras_mix_add_scale_stride_s24_le(uint8_t *dst, uint8_t *src,
 
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 4) {
-		for (i = 0; i < count; i++) {
+		i = simd_add_scale_stride_s24((int32_t *)dst,
+					      (const int32_t *)src, count,
+					      scaler);
+		dst += 4 * i;
+		src += 4 * i;
+		for (; i < count; i++) {
 			int32_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int32_t *)dst +
@@ -402,7 +1346,7 @@ static void cras_mix_add_clip_s32_le(int32_t *dst, const int32_t *src,
 	int64_t sum;
 	size_t i;
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_add_clip_s32(dst, src, count); i < count; i++) {
 		sum = (int64_t)dst[i] + (int64_t)src[i];
 		if (sum > INT32_MAX)
 			sum = INT32_MAX;
@@ -423,7 +1367,8 @@ static void scale_add_clip_s32_le(int32_t *dst, const int32_t *src,
 	if (vol > MAX_VOLUME_TO_SCALE)
 		return cras_mix_add_clip_s32_le(dst, src, count);
 
-	for (i = 0; i < count; i++) {
+	for (i = simd_scale_add_clip_s32(dst, src, count, vol); i < count;
+	     i++) {
 		sum = (int64_t)dst[i] + (int64_t)(src[i] * vol);
 		if (sum > INT32_MAX)
 			sum = INT32_MAX;
@@ -438,17 +1383,28 @@ static void scale_add_clip_s32_le(int32_t *dst, const int32_t *src,
 static void copy_scaled_s32_le(int32_t *dst, const int32_t *src, size_t count,
 			       float volume_scaler)
 {
-	int i;
+	size_t i;
 
 	if (volume_scaler > MAX_VOLUME_TO_SCALE) {
 		memcpy(dst, src, count * sizeof(*src));
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_scale_s32(dst, src, count, volume_scaler); i < count; i++)
 		dst[i] = src[i] * volume_scaler;
 }
 
+static void scale_gains_s32_le(uint8_t *buffer, const float *gains,
+			       size_t count)
+{
+	int32_t *out = (int32_t *)buffer;
+	size_t i;
+
+	for (i = simd_scale_gains_s32(out, gains, count); i < count; i++)
+		if (gains[i] <= MAX_VOLUME_TO_SCALE)
+			out[i] *= gains[i];
+}
+
 static void cras_scale_buffer_inc_s32_le(uint8_t *buffer, unsigned int count,
 					 float scaler, float increment,
 					 float target, int step)
@@ -461,6 +1417,13 @@ static void cras_scale_buffer_inc_s32_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
+#ifdef MIX_SIMD
+	if (step > 0 && step <= RAMP_BLOCK_SAMPLES)
+		return scale_buffer_ramp(buffer, sizeof(*out), count, scaler,
+					 increment, target, step,
+					 scale_gains_s32_le);
+#endif
+
 	while (i + step <= count) {
 		for (j = 0; j < step; j++) {
 			float applied_scaler = scaler;
@@ -484,7 +1447,7 @@ static void cras_scale_buffer_inc_s32_le(uint8_t *buffer, unsigned int count,
 static void cras_scale_buffer_s32_le(uint8_t *buffer, unsigned int count,
 				     float scaler)
 {
-	int i;
+	unsigned int i;
 	int32_t *out = (int32_t *)buffer;
 
 	if (scaler > MAX_VOLUME_TO_SCALE)
@@ -495,7 +1458,7 @@ static void cras_scale_buffer_s32_le(uint8_t *buffer, unsigned int count,
 		return;
 	}
 
-	for (i = 0; i < count; i++)
+	for (i = simd_scale_s32(out, out, count, scaler); i < count; i++)
 		out[i] *= scaler;
 }
 
@@ -526,13 +1489,19 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 
 	/* optimise the loops for vectorization */
 	if (dst_stride == src_stride && dst_stride == 4) {
-		for (i = 0; i < count; i++) {
+		i = simd_add_scale_stride_s32((int32_t *)dst,
+					      (const int32_t *)src, count,
+					      scaler);
+		dst += 4 * i;
+		src += 4 * i;
+		for (; i < count; i++) {
 			int64_t sum;
 			if (need_to_scale(scaler))
 				sum = *(int32_t *)dst +
 				      *(int32_t *)src * scaler;
 			else
-				sum = *(int32_t *)dst + *(int32_t *)src;
+				sum = (int64_t)(*(int32_t *)dst) +
+				      *(int32_t *)src;
 			if (sum > INT32_MAX)
 				sum = INT32_MAX;
 			else if (sum < INT32_MIN)
@@ -548,7 +1517,8 @@ static void cras_mix_add_scale_stride_s32_le(uint8_t *dst, uint8_t *src,
 				sum = *(int32_t *)dst +
 				      *(int32_t *)src * scaler;
 			else
-				sum = *(int32_t *)dst + *(int32_t *)src;
+				sum = (int64_t)(*(int32_t *)dst) +
+				      *(int32_t *)src;
 			if (sum > INT32_MAX)
 				sum = INT32_MAX;
 			else if (sum < INT32_MIN)
@@ -646,6 +1616,21 @@ static void copy_scaled_s24_3le(uint8_t *dst, const uint8_t *src, size_t count,
 	}
 }
 
+static void scale_gains_s24_3le(uint8_t *buffer, const float *gains,
+				size_t count)
+{
+	int32_t frame;
+	size_t i;
+
+	for (i = 0; i < count; i++, buffer += 3) {
+		if (gains[i] > MAX_VOLUME_TO_SCALE)
+			continue;
+		convert_single_s243le_to_s32le(&frame, buffer);
+		frame *= gains[i];
+		convert_single_s32le_to_s243le(buffer, &frame);
+	}
+}
+
 static void cras_scale_buffer_inc_s24_3le(uint8_t *buffer, unsigned int count,
 					  float scaler, float increment,
 					  float target, int step)
@@ -751,6 +1736,233 @@ static void cras_mix_add_scale_stride_s24_3le(uint8_t *dst, uint8_t *src,
 	}
 }
 
+/*
+ * 32 bit float little endian functions. Floats keep their headroom, sums
+ * aren't clipped until they are converted to an integer format.
+ */
+
+static void scale_gains_float_le(uint8_t *buffer, const float *gains,
+				 size_t count)
+{
+	float *out = (float *)buffer;
+	size_t i;
+
+	for (i = 0; i < count; i++)
+		if (gains[i] <= MAX_VOLUME_TO_SCALE)
+			out[i] *= gains[i];
+}
+
+static void cras_scale_buffer_inc_float_le(uint8_t *buffer,
+					   unsigned int count, float scaler,
+					   float increment, float target,
+					   int step)
+{
+	int i = 0, j;
+	float *out = (float *)buffer;
+
+	if (scaler < MIN_VOLUME_TO_SCALE && increment < 0) {
+		memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	while (i + step <= count) {
+		for (j = 0; j < step; j++) {
+			float applied_scaler = scaler;
+
+			if ((applied_scaler > target && increment > 0) ||
+			    (applied_scaler < target && increment < 0))
+				applied_scaler = target;
+
+			if (applied_scaler > MAX_VOLUME_TO_SCALE) {
+			} else if (applied_scaler < MIN_VOLUME_TO_SCALE) {
+				out[i] = 0;
+			} else {
+				out[i] *= applied_scaler;
+			}
+			i++;
+		}
+		scaler += increment;
+	}
+}
+
+static void cras_scale_buffer_float_le(uint8_t *buffer, unsigned int count,
+				       float scaler)
+{
+	unsigned int i;
+	float *out = (float *)buffer;
+
+	if (scaler > MAX_VOLUME_TO_SCALE)
+		return;
+
+	if (scaler < MIN_VOLUME_TO_SCALE) {
+		memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	for (i = 0; i < count; i++)
+		out[i] *= scaler;
+}
+
+static void cras_mix_add_float_le(uint8_t *dst, uint8_t *src,
+				  unsigned int count, unsigned int index,
+				  int mute, float mix_vol)
+{
+	float *out = (float *)dst;
+	const float *in = (const float *)src;
+	unsigned int i;
+
+	if (mute || (mix_vol < MIN_VOLUME_TO_SCALE)) {
+		if (index == 0)
+			memset(out, 0, count * sizeof(*out));
+		return;
+	}
+
+	if (mix_vol > MAX_VOLUME_TO_SCALE) {
+		if (index == 0)
+			memcpy(out, in, count * sizeof(*out));
+		else
+			for (i = 0; i < count; i++)
+				out[i] += in[i];
+		return;
+	}
+
+	if (index == 0)
+		for (i = 0; i < count; i++)
+			out[i] = in[i] * mix_vol;
+	else
+		for (i = 0; i < count; i++)
+			out[i] += in[i] * mix_vol;
+}
+
+static void cras_mix_add_scale_stride_float_le(uint8_t *dst, uint8_t *src,
+					       unsigned int dst_stride,
+					       unsigned int src_stride,
+					       unsigned int count, float scaler)
+{
+	unsigned int i;
+
+	if (!need_to_scale(scaler))
+		scaler = 1.0f;
+
+	for (i = 0; i < count; i++) {
+		*(float *)dst += *(float *)src * scaler;
+		dst += dst_stride;
+		src += src_stride;
+	}
+}
+
+/*
+ * Channel remix.
+ */
+
+/* Copies the input channel picked for each output channel, bytes at a time
+ * so that one loop takes every sample width. */
+static inline __attribute__((always_inline)) void
+remix_select(uint8_t *buf, size_t sample_bytes, unsigned int frames,
+	     unsigned int n, const float *coef)
+{
+	const size_t frame_bytes = n * sample_bytes;
+	uint8_t tmp[CRAS_CH_MAX * 4];
+	int src[CRAS_CH_MAX];
+	unsigned int out, in, fr;
+
+	for (out = 0; out < n; out++) {
+		src[out] = -1;
+		for (in = 0; in < n; in++)
+			if (coef[out * n + in] != 0.0f)
+				src[out] = in;
+	}
+
+	for (fr = 0; fr < frames; fr++, buf += frame_bytes) {
+		memcpy(tmp, buf, frame_bytes);
+		for (out = 0; out < n; out++) {
+			if (src[out] < 0)
+				memset(buf + out * sample_bytes, 0,
+				       sample_bytes);
+			else
+				memcpy(buf + out * sample_bytes,
+				       tmp + src[out] * sample_bytes,
+				       sample_bytes);
+		}
+	}
+}
+
+/* Reads sample i of a frame, S24_LE is moved to the top of 32 bits like
+ * scale_s24_le() does. */
+static inline float remix_sample(snd_pcm_format_t fmt, const uint8_t *frame,
+				 unsigned int i)
+{
+	const int32_t *s32 = (const int32_t *)frame;
+
+	if (fmt == SND_PCM_FORMAT_S16_LE)
+		return ((const int16_t *)frame)[i];
+	if (fmt == SND_PCM_FORMAT_S24_LE)
+		return (int32_t)((uint32_t)(s32[i] & 0x00ffffff) << 8);
+	return s32[i];
+}
+
+/* Mixes the n samples of frame with the coefficients of one output
+ * channel. S16_LE matches s16_multiply_buf_with_coef(). */
+static inline int32_t remix_dot(snd_pcm_format_t fmt, const float *coef,
+				const uint8_t *frame, unsigned int n)
+{
+	unsigned int i;
+	int32_t sum = 0;
+	float acc = 0.0f;
+
+	if (fmt == SND_PCM_FORMAT_S16_LE) {
+		for (i = 0; i < n; i++)
+			sum += coef[i] * remix_sample(fmt, frame, i);
+		return MIN(MAX(sum, -0x8000), 0x7fff);
+	}
+
+	for (i = 0; i < n; i++)
+		acc += coef[i] * remix_sample(fmt, frame, i);
+	if (acc >= 2147483648.0f)
+		return INT32_MAX;
+	if (acc < -2147483648.0f)
+		return INT32_MIN;
+	return acc;
+}
+
+static inline void remix_store(snd_pcm_format_t fmt, uint8_t *frame,
+			       unsigned int i, int32_t value)
+{
+	if (fmt == SND_PCM_FORMAT_S16_LE)
+		((int16_t *)frame)[i] = value;
+	else if (fmt == SND_PCM_FORMAT_S24_LE)
+		((int32_t *)frame)[i] = (int32_t)((uint32_t)value >> 8);
+	else
+		((int32_t *)frame)[i] = value;
+}
+
+/* A mono remix mixes each frame once for all channels. */
+static inline __attribute__((always_inline)) void
+remix_frames(snd_pcm_format_t fmt, uint8_t *buf, unsigned int frames,
+	     unsigned int n, const float *coef, enum CRAS_MIX_REMIX kind)
+{
+	const size_t frame_bytes =
+		n * (fmt == SND_PCM_FORMAT_S16_LE ? 2 : 4);
+	int32_t mixed[CRAS_CH_MAX];
+	unsigned int out, fr = 0;
+
+	if (kind == CRAS_MIX_REMIX_MATRIX)
+		fr = simd_remix(fmt, buf, frames, n, coef);
+
+	for (buf += fr * frame_bytes; fr < frames; fr++, buf += frame_bytes) {
+		if (kind == CRAS_MIX_REMIX_MONO) {
+			mixed[0] = remix_dot(fmt, coef, buf, n);
+			for (out = 0; out < n; out++)
+				remix_store(fmt, buf, out, mixed[0]);
+			continue;
+		}
+		for (out = 0; out < n; out++)
+			mixed[out] = remix_dot(fmt, &coef[out * n], buf, n);
+		for (out = 0; out < n; out++)
+			remix_store(fmt, buf, out, mixed[out]);
+	}
+}
+
 static void scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 				   unsigned int count, float scaler,
 				   float increment, float target, int step)
@@ -768,6 +1980,33 @@ static void scale_buffer_increment(snd_pcm_format_t fmt, uint8_t *buff,
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_scale_buffer_inc_s24_3le(buff, count, scaler,
 						     increment, target, step);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_scale_buffer_inc_float_le(buff, count, scaler,
+						      increment, target, step);
+	default:
+		break;
+	}
+}
+
+static void scale_buffer_gains(snd_pcm_format_t fmt, uint8_t *buff,
+			       unsigned int count, const float *gains, int step)
+{
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		return scale_buffer_frame_gains(buff, 2, count, gains, step,
+						scale_gains_s16_le);
+	case SND_PCM_FORMAT_S24_LE:
+		return scale_buffer_frame_gains(buff, 4, count, gains, step,
+						scale_gains_s24_le);
+	case SND_PCM_FORMAT_S32_LE:
+		return scale_buffer_frame_gains(buff, 4, count, gains, step,
+						scale_gains_s32_le);
+	case SND_PCM_FORMAT_S24_3LE:
+		return scale_buffer_frame_gains(buff, 3, count, gains, step,
+						scale_gains_s24_3le);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return scale_buffer_frame_gains(buff, 4, count, gains, step,
+						scale_gains_float_le);
 	default:
 		break;
 	}
@@ -785,33 +2024,44 @@ static void scale_buffer(snd_pcm_format_t fmt, uint8_t *buff,
 		return cras_scale_buffer_s32_le(buff, count, scaler);
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_scale_buffer_s24_3le(buff, count, scaler);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_scale_buffer_float_le(buff, count, scaler);
 	default:
 		break;
 	}
 }
 
-static void mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
-		    unsigned int count, unsigned int index, int mute,
-		    float mix_vol)
+static void mix_add_unsupported(uint8_t *dst, uint8_t *src,
+				unsigned int count, unsigned int index,
+				int mute, float mix_vol)
+{
+}
+
+static cras_mix_add_func mix_get_add(snd_pcm_format_t fmt)
 {
 	switch (fmt) {
 	case SND_PCM_FORMAT_S16_LE:
-		return cras_mix_add_s16_le(dst, src, count, index, mute,
-					   mix_vol);
+		return cras_mix_add_s16_le;
 	case SND_PCM_FORMAT_S24_LE:
-		return cras_mix_add_s24_le(dst, src, count, index, mute,
-					   mix_vol);
+		return cras_mix_add_s24_le;
 	case SND_PCM_FORMAT_S32_LE:
-		return cras_mix_add_s32_le(dst, src, count, index, mute,
-					   mix_vol);
+		return cras_mix_add_s32_le;
 	case SND_PCM_FORMAT_S24_3LE:
-		return cras_mix_add_s24_3le(dst, src, count, index, mute,
-					    mix_vol);
+		return cras_mix_add_s24_3le;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_mix_add_float_le;
 	default:
-		break;
+		return mix_add_unsupported;
 	}
 }
 
+static void mix_add(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
+		    unsigned int count, unsigned int index, int mute,
+		    float mix_vol)
+{
+	mix_get_add(fmt)(dst, src, count, index, mute, mix_vol);
+}
+
 static void mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst,
 				 uint8_t *src, unsigned int count,
 				 unsigned int dst_stride,
@@ -830,6 +2080,9 @@ static void mix_add_scale_stride(snd_pcm_format_t fmt, uint8_t *dst,
 	case SND_PCM_FORMAT_S24_3LE:
 		return cras_mix_add_scale_stride_s24_3le(
 			dst, src, dst_stride, src_stride, count, scaler);
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return cras_mix_add_scale_stride_float_le(
+			dst, src, dst_stride, src_stride, count, scaler);
 	default:
 		break;
 	}
@@ -841,10 +2094,53 @@ static size_t mix_mute_buffer(uint8_t *dst, size_t frame_bytes, size_t count)
 	return count;
 }
 
+static int mix_remix(snd_pcm_format_t fmt, uint8_t *buf, unsigned int frames,
+		     unsigned int num_channels, const float *coef,
+		     enum CRAS_MIX_REMIX kind)
+{
+	if (kind == CRAS_MIX_REMIX_SELECT) {
+		switch (fmt) {
+		case SND_PCM_FORMAT_S16_LE:
+			remix_select(buf, 2, frames, num_channels, coef);
+			return 0;
+		case SND_PCM_FORMAT_S24_3LE:
+			remix_select(buf, 3, frames, num_channels, coef);
+			return 0;
+		case SND_PCM_FORMAT_S24_LE:
+		case SND_PCM_FORMAT_S32_LE:
+		case SND_PCM_FORMAT_FLOAT_LE:
+			remix_select(buf, 4, frames, num_channels, coef);
+			return 0;
+		default:
+			return -EINVAL;
+		}
+	}
+
+	switch (fmt) {
+	case SND_PCM_FORMAT_S16_LE:
+		remix_frames(SND_PCM_FORMAT_S16_LE, buf, frames, num_channels,
+			     coef, kind);
+		return 0;
+	case SND_PCM_FORMAT_S24_LE:
+		remix_frames(SND_PCM_FORMAT_S24_LE, buf, frames, num_channels,
+			     coef, kind);
+		return 0;
+	case SND_PCM_FORMAT_S32_LE:
+		remix_frames(SND_PCM_FORMAT_S32_LE, buf, frames, num_channels,
+			     coef, kind);
+		return 0;
+	default:
+		return -EINVAL;
+	}
+}
+
 const struct cras_mix_ops OPS(mixer_ops) = {
 	.scale_buffer = scale_buffer,
 	.scale_buffer_increment = scale_buffer_increment,
+	.scale_buffer_gains = scale_buffer_gains,
 	.add = mix_add,
+	.get_add = mix_get_add,
 	.add_scale_stride = mix_add_scale_stride,
 	.mute_buffer = mix_mute_buffer,
+	.remix = mix_remix,
 };
@@ -8,6 +8,7 @@
 
 #include <stdint.h>
 
+#include "cras_mix.h"
 #include "cras_system_state.h"
 
 extern const struct cras_mix_ops mixer_ops;
@@ -15,6 +16,7 @@ extern const struct cras_mix_ops mixer_ops_sse42;
 extern const struct cras_mix_ops mixer_ops_avx;
 extern const struct cras_mix_ops mixer_ops_avx2;
 extern const struct cras_mix_ops mixer_ops_fma;
+extern const struct cras_mix_ops mixer_ops_neon;
 
 /* Struct containing ops to implement mix/scale on a buffer of samples.
  * Different architecture can provide different implementations and wraps
@@ -24,24 +26,34 @@ extern const struct cras_mix_ops mixer_ops_fma;
  *
  * Members:
  *   scale_buffer_increment: See cras_scale_buffer_increment.
+ *   scale_buffer_gains: See cras_scale_buffer_gains.
  *   scale_buffer: See cras_scale_buffer.
  *   add: See cras_mix_add.
+ *   get_add: See cras_mix_get_add.
  *   add_scale_stride: See cras_mix_add_scale_stride.
  *   mute_buffer: cras_mix_mute_buffer.
+ *   remix: See cras_mix_remix.
  */
 struct cras_mix_ops {
 	void (*scale_buffer_increment)(snd_pcm_format_t fmt, uint8_t *buff,
 				       unsigned int count, float scaler,
 				       float increment, float target, int step);
+	void (*scale_buffer_gains)(snd_pcm_format_t fmt, uint8_t *buff,
+				   unsigned int count, const float *gains,
+				   int step);
 	void (*scale_buffer)(snd_pcm_format_t fmt, uint8_t *buff,
 			     unsigned int count, float scaler);
 	void (*add)(snd_pcm_format_t fmt, uint8_t *dst, uint8_t *src,
 		    unsigned int count, unsigned int index, int mute,
 		    float mix_vol);
+	cras_mix_add_func (*get_add)(snd_pcm_format_t fmt);
 	void (*add_scale_stride)(snd_pcm_format_t fmt, uint8_t *dst,
 				 uint8_t *src, unsigned int count,
 				 unsigned int dst_stride,
 				 unsigned int src_stride, float scaler);
 	size_t (*mute_buffer)(uint8_t *dst, size_t frame_bytes, size_t count);
+	int (*remix)(snd_pcm_format_t fmt, uint8_t *buf, unsigned int frames,
+		     unsigned int num_channels, const float *coef,
+		     enum CRAS_MIX_REMIX kind);
 };
 #endif
@@ -3,6 +3,8 @@
  * found in the LICENSE file.
  */
 
+#include <stddef.h>
+
 #include "cras_observer.h"
 
 #include "cras_alert.h"
@@ -319,19 +321,25 @@ static void bt_battery_changed_alert(void *arg, void *data)
 static int cras_observer_server_set_alert(struct cras_alert **alert,
 					  cras_alert_cb cb,
 					  cras_alert_prepare prepare,
-					  unsigned int flags)
+					  unsigned int flags, size_t key_size)
 {
 	*alert = cras_alert_create(prepare, flags);
 	if (!*alert)
 		return -ENOMEM;
+	cras_alert_set_key_size(*alert, key_size);
 	return cras_alert_add_callback(*alert, cb, NULL);
 }
 
 #define CRAS_OBSERVER_SET_ALERT(alert, prepare, flags)                         \
+	CRAS_OBSERVER_SET_KEYED_ALERT(alert, prepare, flags, 0)
+
+/* Sets an alert whose data is coalesced per key, the key being the leading
+ * key_size bytes of the alert data. */
+#define CRAS_OBSERVER_SET_KEYED_ALERT(alert, prepare, flags, key_size)         \
 	do {                                                                   \
 		rc = cras_observer_server_set_alert(&g_observer->alerts.alert, \
 						    alert##_alert, prepare,    \
-						    flags);                    \
+						    flags, key_size);          \
 		if (rc)                                                        \
 			goto error;                                            \
 	} while (0)
@@ -340,7 +348,7 @@ static int cras_observer_server_set_alert(struct cras_alert **alert,
 	do {                                                                   \
 		rc = cras_observer_server_set_alert(                           \
 			&g_observer->alerts.alert[direction], alert##_alert,   \
-			NULL, 0);                                              \
+			NULL, CRAS_ALERT_FLAG_SKIP_UNCHANGED, 0);              \
 		if (rc)                                                        \
 			goto error;                                            \
 	} while (0)
@@ -364,14 +372,29 @@ int cras_observer_server_init()
 	CRAS_OBSERVER_SET_ALERT(capture_gain, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(capture_mute, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(nodes, nodes_prepare, 0);
-	CRAS_OBSERVER_SET_ALERT(active_node, nodes_prepare,
-				CRAS_ALERT_FLAG_KEEP_ALL_DATA);
-	CRAS_OBSERVER_SET_ALERT(output_node_volume, NULL, 0);
-	CRAS_OBSERVER_SET_ALERT(node_left_right_swapped, NULL, 0);
-	CRAS_OBSERVER_SET_ALERT(input_node_gain, NULL, 0);
-	CRAS_OBSERVER_SET_ALERT(suspend_changed, NULL, 0);
+	/* Node alerts keep the last value per direction or node, and are
+	 * dropped when a rescan ends up where it started. */
+	CRAS_OBSERVER_SET_KEYED_ALERT(
+		active_node, nodes_prepare,
+		CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED,
+		offsetof(struct cras_observer_alert_data_active_node, node_id));
+	CRAS_OBSERVER_SET_KEYED_ALERT(
+		output_node_volume, NULL,
+		CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED,
+		sizeof(cras_node_id_t));
+	CRAS_OBSERVER_SET_KEYED_ALERT(
+		node_left_right_swapped, NULL,
+		CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED,
+		sizeof(cras_node_id_t));
+	CRAS_OBSERVER_SET_KEYED_ALERT(
+		input_node_gain, NULL,
+		CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED,
+		sizeof(cras_node_id_t));
+	CRAS_OBSERVER_SET_ALERT(suspend_changed, NULL,
+				CRAS_ALERT_FLAG_SKIP_UNCHANGED);
 	CRAS_OBSERVER_SET_ALERT(hotword_triggered, NULL, 0);
-	CRAS_OBSERVER_SET_ALERT(non_empty_audio_state_changed, NULL, 0);
+	CRAS_OBSERVER_SET_ALERT(non_empty_audio_state_changed, NULL,
+				CRAS_ALERT_FLAG_SKIP_UNCHANGED);
 	CRAS_OBSERVER_SET_ALERT(bt_battery_changed, NULL, 0);
 	CRAS_OBSERVER_SET_ALERT(num_input_streams_with_permission, NULL, 0);
 
@@ -523,6 +546,7 @@ void cras_observer_notify_active_node(enum CRAS_STREAM_DIRECTION dir,
 {
 	struct cras_observer_alert_data_active_node data;
 
+	memset(&data, 0, sizeof(data));
 	data.direction = dir;
 	data.node_id = node_id;
 	cras_alert_pending_data(g_observer->alerts.active_node, &data,
@@ -534,6 +558,7 @@ void cras_observer_notify_output_node_volume(cras_node_id_t node_id,
 {
 	struct cras_observer_alert_data_node_volume data;
 
+	memset(&data, 0, sizeof(data));
 	data.node_id = node_id;
 	data.volume = volume;
 	cras_alert_pending_data(g_observer->alerts.output_node_volume, &data,
@@ -545,6 +570,7 @@ void cras_observer_notify_node_left_right_swapped(cras_node_id_t node_id,
 {
 	struct cras_observer_alert_data_node_lr_swapped data;
 
+	memset(&data, 0, sizeof(data));
 	data.node_id = node_id;
 	data.swapped = swapped;
 	cras_alert_pending_data(g_observer->alerts.node_left_right_swapped,
@@ -555,6 +581,7 @@ void cras_observer_notify_input_node_gain(cras_node_id_t node_id, int32_t gain)
 {
 	struct cras_observer_alert_data_node_volume data;
 
+	memset(&data, 0, sizeof(data));
 	data.node_id = node_id;
 	data.volume = gain;
 	cras_alert_pending_data(g_observer->alerts.input_node_gain, &data,
@@ -0,0 +1,170 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/eventfd.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_messages.h"
+#include "cras_observer.h"
+#include "cras_observer_ring.h"
+#include "cras_system_state.h"
+#include "cras_types.h"
+
+/* The observer client recording to the ring. */
+static struct cras_observer_client *ring_observer;
+/* The eventfd signaled after events are added. */
+static int event_fd = -1;
+/* Events were added since the eventfd was last signaled. */
+static int pending;
+
+static void add_event(uint32_t id, uint32_t direction, uint64_t node_id,
+		      int32_t v0, int32_t v1, int32_t v2)
+{
+	struct cras_observer_event_ring *ring =
+		&cras_system_state_get_no_lock()->observer_events;
+	struct cras_observer_event *event;
+
+	event = &ring->events[ring->write_pos % CRAS_OBSERVER_EVENT_RING_SIZE];
+	event->id = id;
+	event->direction = direction;
+	event->node_id = node_id;
+	event->values[0] = v0;
+	event->values[1] = v1;
+	event->values[2] = v2;
+	/* Publish the event only once it is complete. */
+	__sync_synchronize();
+	ring->write_pos++;
+	pending = 1;
+}
+
+static void output_volume_changed(void *context, int32_t volume)
+{
+	add_event(CRAS_CLIENT_OUTPUT_VOLUME_CHANGED, 0, 0, volume, 0, 0);
+}
+
+static void output_mute_changed(void *context, int muted, int user_muted,
+				int mute_locked)
+{
+	add_event(CRAS_CLIENT_OUTPUT_MUTE_CHANGED, 0, 0, muted, user_muted,
+		  mute_locked);
+}
+
+static void capture_gain_changed(void *context, int32_t gain)
+{
+	add_event(CRAS_CLIENT_CAPTURE_GAIN_CHANGED, 0, 0, gain, 0, 0);
+}
+
+static void capture_mute_changed(void *context, int muted, int mute_locked)
+{
+	add_event(CRAS_CLIENT_CAPTURE_MUTE_CHANGED, 0, 0, muted, mute_locked,
+		  0);
+}
+
+static void nodes_changed(void *context)
+{
+	add_event(CRAS_CLIENT_NODES_CHANGED, 0, 0, 0, 0, 0);
+}
+
+static void active_node_changed(void *context, enum CRAS_STREAM_DIRECTION dir,
+				cras_node_id_t node_id)
+{
+	add_event(CRAS_CLIENT_ACTIVE_NODE_CHANGED, dir, node_id, 0, 0, 0);
+}
+
+static void output_node_volume_changed(void *context, cras_node_id_t node_id,
+				       int32_t volume)
+{
+	add_event(CRAS_CLIENT_OUTPUT_NODE_VOLUME_CHANGED, 0, node_id, volume,
+		  0, 0);
+}
+
+static void node_left_right_swapped_changed(void *context,
+					    cras_node_id_t node_id,
+					    int swapped)
+{
+	add_event(CRAS_CLIENT_NODE_LEFT_RIGHT_SWAPPED_CHANGED, 0, node_id,
+		  swapped, 0, 0);
+}
+
+static void input_node_gain_changed(void *context, cras_node_id_t node_id,
+				    int32_t gain)
+{
+	add_event(CRAS_CLIENT_INPUT_NODE_GAIN_CHANGED, 0, node_id, gain, 0, 0);
+}
+
+static void num_active_streams_changed(void *context,
+				       enum CRAS_STREAM_DIRECTION dir,
+				       uint32_t num_active_streams)
+{
+	add_event(CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED, dir, 0,
+		  num_active_streams, 0, 0);
+}
+
+static const struct cras_observer_ops ring_ops = {
+	.output_volume_changed = output_volume_changed,
+	.output_mute_changed = output_mute_changed,
+	.capture_gain_changed = capture_gain_changed,
+	.capture_mute_changed = capture_mute_changed,
+	.nodes_changed = nodes_changed,
+	.active_node_changed = active_node_changed,
+	.output_node_volume_changed = output_node_volume_changed,
+	.node_left_right_swapped_changed = node_left_right_swapped_changed,
+	.input_node_gain_changed = input_node_gain_changed,
+	.num_active_streams_changed = num_active_streams_changed,
+};
+
+int cras_observer_ring_init()
+{
+	event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (event_fd < 0) {
+		syslog(LOG_ERR, "Failed to create observer ring eventfd");
+		return -errno;
+	}
+
+	ring_observer = cras_observer_add(&ring_ops, NULL);
+	if (!ring_observer) {
+		close(event_fd);
+		event_fd = -1;
+		return -ENOMEM;
+	}
+	pending = 0;
+	return 0;
+}
+
+void cras_observer_ring_deinit()
+{
+	if (ring_observer)
+		cras_observer_remove(ring_observer);
+	ring_observer = NULL;
+	if (event_fd >= 0)
+		close(event_fd);
+	event_fd = -1;
+}
+
+int cras_observer_ring_event_fd()
+{
+	return event_fd;
+}
+
+void cras_observer_ring_flush()
+{
+	uint64_t count = 1;
+	int rc;
+
+	if (!pending || event_fd < 0)
+		return;
+	pending = 0;
+
+	/* Reset the count so edge-triggered waiters see a new event. */
+	rc = read(event_fd, &count, sizeof(count));
+	count = 1;
+	rc = write(event_fd, &count, sizeof(count));
+	if (rc != sizeof(count))
+		syslog(LOG_ERR, "Failed to signal observer ring: %d", errno);
+}
@@ -0,0 +1,34 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Broadcasts observer notifications through the event ring in the server
+ * state shm. Clients that read the ring at their own pace don't need to
+ * register for notification messages. After each main loop pass that added
+ * events the server signals one shared eventfd, instead of writing a message
+ * to every client for every event.
+ */
+
+#ifndef CRAS_OBSERVER_RING_H_
+#define CRAS_OBSERVER_RING_H_
+
+/* Creates the eventfd and starts recording observer notifications to the
+ * ring. Must be called after cras_observer_server_init().
+ * Returns:
+ *    0 on success, negative error code on failure.
+ */
+int cras_observer_ring_init();
+
+/* Stops recording notifications and closes the eventfd. */
+void cras_observer_ring_deinit();
+
+/* Returns the eventfd signaled after events are added, or -1 if the ring
+ * isn't initialized. Clients must wait for it edge-triggered and never read
+ * it, the server resets the count before signaling again. */
+int cras_observer_ring_event_fd();
+
+/* Signals the eventfd once if any events were added since the last call.
+ * Called from the main loop after pending alerts are processed. */
+void cras_observer_ring_flush();
+
+#endif /* CRAS_OBSERVER_RING_H_ */
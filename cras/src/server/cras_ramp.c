@@ -3,6 +3,7 @@
  * found in the LICENSE file.
  */
 
+#include <math.h>
 #include <syslog.h>
 
 #include "cras_ramp.h"
@@ -15,6 +16,7 @@
  *   duration_frames: The targeted number of frames for whole ramping duration.
  *   increment: The scaler increment that should be added to scaler for
  *              every frame.
+ *   ratio: The factor the scaler should be multiplied by for every frame.
  *   start_scaler: The initial scaler.
  *   cb: Callback function to call after ramping is done.
  *   cb_data: Data passed to cb.
@@ -24,6 +26,7 @@ struct cras_ramp {
 	int ramped_frames;
 	int duration_frames;
 	float increment;
+	float ratio;
 	float start_scaler;
 	float target;
 	void (*cb)(void *data);
@@ -52,6 +55,7 @@ int cras_ramp_reset(struct cras_ramp *ramp)
 	ramp->ramped_frames = 0;
 	ramp->duration_frames = 0;
 	ramp->increment = 0;
+	ramp->ratio = 1.0;
 	ramp->start_scaler = 1.0;
 	ramp->target = 1.0;
 	return 0;
@@ -88,7 +92,14 @@ int cras_ramp_start(struct cras_ramp *ramp, int mute_ramp, float from, float to,
 		if (!mute_ramp)
 			ramp->start_scaler *= from;
 	}
-	ramp->increment = (to - ramp->start_scaler) / duration_frames;
+	if (!mute_ramp && ramp->start_scaler > 0 && to > 0) {
+		ramp->increment = 0;
+		ramp->ratio = powf(to / ramp->start_scaler,
+				   1.0f / duration_frames);
+	} else {
+		ramp->increment = (to - ramp->start_scaler) / duration_frames;
+		ramp->ratio = 1.0;
+	}
 	ramp->target = to;
 	ramp->ramped_frames = 0;
 	ramp->duration_frames = duration_frames;
@@ -106,22 +117,49 @@ cras_ramp_get_current_action(const struct cras_ramp *ramp)
 		action.type = CRAS_RAMP_ACTION_INVALID;
 		action.scaler = 1.0;
 		action.increment = 0.0;
+		action.ratio = 1.0;
 		action.target = 1.0;
 	} else if (ramp->active) {
 		action.type = CRAS_RAMP_ACTION_PARTIAL;
 		action.scaler = ramp->start_scaler +
 				ramp->ramped_frames * ramp->increment;
+		if (ramp->ratio != 1.0f)
+			action.scaler *= powf(ramp->ratio, ramp->ramped_frames);
 		action.increment = ramp->increment;
+		action.ratio = ramp->ratio;
 		action.target = ramp->target;
 	} else {
 		action.type = CRAS_RAMP_ACTION_NONE;
 		action.scaler = 1.0;
 		action.increment = 0.0;
+		action.ratio = 1.0;
 		action.target = 1.0;
 	}
 	return action;
 }
 
+void cras_ramp_action_gains(const struct cras_ramp_action *action,
+			    unsigned int offset, float scale, float *gains,
+			    unsigned int frames)
+{
+	int rising = action->increment > 0 || action->ratio > 1.0f;
+	double scaler;
+	unsigned int i;
+
+	if (action->ratio != 1.0f)
+		scaler = action->scaler * pow(action->ratio, offset);
+	else
+		scaler = action->scaler + (double)offset * action->increment;
+
+	for (i = 0; i < frames; i++) {
+		if (rising ? scaler > action->target : scaler < action->target)
+			gains[i] = action->target * scale;
+		else
+			gains[i] = scaler * scale;
+		scaler = scaler * action->ratio + action->increment;
+	}
+}
+
 int cras_ramp_update_ramped_frames(struct cras_ramp *ramp, int num_frames)
 {
 	if (!ramp->active)
@@ -30,11 +30,15 @@ enum CRAS_RAMP_ACTION_TYPE {
  *   scaler: The initial scaler to be applied.
  *   increment: The scaler increment that should be added to scaler for every
  *              frame.
+ *   ratio: The factor scaler should be multiplied by for every frame, 1 for
+ *          a linear ramp.
+ *   target: The scaler the ramp stops at.
  */
 struct cras_ramp_action {
 	enum CRAS_RAMP_ACTION_TYPE type;
 	float scaler;
 	float increment;
+	float ratio;
 	float target;
 };
 
@@ -46,7 +50,10 @@ struct cras_ramp *cras_ramp_create();
 /* Destroys a ramp. */
 void cras_ramp_destroy(struct cras_ramp *ramp);
 
-/* Ramps the scaler between from and to for duration_frames frames.
+/* Ramps the scaler between from and to for duration_frames frames. Mute
+ * ramps change the scaler linearly. Volume ramps change it by the same
+ * number of dB every frame, like the steps of the volume curves, unless
+ * they start or end at 0.
  * Args:
  *   ramp[in]: The ramp struct to start.
  *   mute_ramp[in]: Is this ramp a mute->unmute or unmute->mute ramp.
@@ -85,6 +92,18 @@ int cras_ramp_reset(struct cras_ramp *ramp);
 struct cras_ramp_action
 cras_ramp_get_current_action(const struct cras_ramp *ramp);
 
+/* Fills gains with the scaler of each frame of a ramp, multiplied by scale.
+ * Args:
+ *   action[in]: The current action, of type CRAS_RAMP_ACTION_PARTIAL.
+ *   offset[in]: The number of frames since action was taken.
+ *   scale[in]: The volume to apply on top of the ramp.
+ *   gains[out]: Receives one gain for each frame.
+ *   frames[in]: The number of frames to fill gains for.
+ */
+void cras_ramp_action_gains(const struct cras_ramp_action *action,
+			    unsigned int offset, float scale, float *gains,
+			    unsigned int frames);
+
 /* Updates number of samples that went through ramping. */
 int cras_ramp_update_ramped_frames(struct cras_ramp *ramp, int num_frames);
 
@@ -20,6 +20,7 @@
 #include "cras_observer.h"
 #include "cras_playback_rclient.h"
 #include "cras_rclient.h"
+#include "cras_rclient_util.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
@@ -51,6 +52,21 @@ int cras_rclient_buffer_from_client(struct cras_rclient *client,
 						       num_fds);
 }
 
+void cras_rclient_hold_replies(struct cras_rclient *client,
+			       struct cras_rclient_replies *replies)
+{
+	replies->num = 0;
+	client->held_replies = replies;
+}
+
+int cras_rclient_release_replies(struct cras_rclient *client)
+{
+	int rc = rclient_send_held_replies(client);
+
+	client->held_replies = NULL;
+	return rc;
+}
+
 /* Sends a message to the client. */
 int cras_rclient_send_message(const struct cras_rclient *client,
 			      const struct cras_client_message *msg, int *fds,
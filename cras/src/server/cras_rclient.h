@@ -9,12 +9,38 @@
 #ifndef CRAS_RCLIENT_H_
 #define CRAS_RCLIENT_H_
 
+#include "cras_messages.h"
 #include "cras_types.h"
 
+/* Most replies held for one batch of messages from a client. */
+#define CRAS_RCLIENT_MAX_HELD_REPLIES 16
+
 struct cras_client_message;
 struct cras_message;
 struct cras_server_message;
 
+/* Audio thread cost of the streams of a client.
+ *  cpu_ns - Audio thread time spent on the streams, in nanoseconds.
+ *  num_fetches - Number of times the client was asked for samples.
+ *  num_missed_cb - Number of callbacks the streams missed.
+ */
+struct cras_client_usage {
+	uint64_t cpu_ns;
+	uint32_t num_fetches;
+	uint32_t num_missed_cb;
+};
+
+/* Replies to a client held to be sent together.
+ *  num - Number of replies held.
+ *  lens - Length of each reply.
+ *  bufs - The replies.
+ */
+struct cras_rclient_replies {
+	unsigned int num;
+	size_t lens[CRAS_RCLIENT_MAX_HELD_REPLIES];
+	uint8_t bufs[CRAS_RCLIENT_MAX_HELD_REPLIES][CRAS_CLIENT_MAX_MSG_SIZE];
+};
+
 /* An attached client.
  *  id - The id of the client.
  *  fd - Connection for client communication.
@@ -23,6 +49,9 @@ struct cras_server_message;
  *  client_type - Client type of this rclient. If this is set to value other
  *                than CRAS_CLIENT_TYPE_UNKNOWN, rclient will overwrite incoming
  *                messages' client type.
+ *  ended_usage - Usage of the streams of the client that were removed.
+ *  held_replies - While set, replies without fds are kept here instead of
+ *                 being sent one by one.
  */
 struct cras_rclient {
 	struct cras_observer_client *observer;
@@ -31,6 +60,8 @@ struct cras_rclient {
 	const struct cras_rclient_ops *ops;
 	int supported_directions;
 	enum CRAS_CLIENT_TYPE client_type;
+	struct cras_client_usage ended_usage;
+	struct cras_rclient_replies *held_replies;
 };
 
 /* Operations for cras_rclient.
@@ -82,6 +113,25 @@ int cras_rclient_buffer_from_client(struct cras_rclient *client,
 				    const uint8_t *buf, size_t buf_len,
 				    int *fds, int num_fds);
 
+/* Holds the replies to the client in replies until
+ * cras_rclient_release_replies() is called. Used while handling a batch of
+ * messages from the client so the replies go out in one call too.
+ * Args:
+ *    client - The client whose replies to hold.
+ *    replies - Where the replies are kept.
+ */
+void cras_rclient_hold_replies(struct cras_rclient *client,
+			       struct cras_rclient_replies *replies);
+
+/* Sends the replies held since cras_rclient_hold_replies() and stops holding
+ * them.
+ * Args:
+ *    client - The client whose replies are held.
+ * Returns:
+ *    0 on success, otherwise a negative error code.
+ */
+int cras_rclient_release_replies(struct cras_rclient *client);
+
 /* Sends a message to the client.
  * Args:
  *    client - The client to send the message to.
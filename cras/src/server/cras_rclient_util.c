@@ -3,6 +3,7 @@
  * found in the LICENSE file.
  */
 
+#include <string.h>
 #include <syslog.h>
 
 #include "cras_iodev_list.h"
@@ -18,10 +19,43 @@
 #include "cras_util.h"
 #include "stream_list.h"
 
+int rclient_send_held_replies(const struct cras_rclient *client)
+{
+	struct cras_rclient_replies *held = client->held_replies;
+	const void *bufs[CRAS_RCLIENT_MAX_HELD_REPLIES];
+	unsigned int i, num;
+	int rc;
+
+	if (!held || !held->num)
+		return 0;
+
+	num = held->num;
+	held->num = 0;
+	for (i = 0; i < num; i++)
+		bufs[i] = held->bufs[i];
+	rc = cras_send_batch(client->fd, bufs, held->lens, num);
+	if (rc < 0)
+		return rc;
+	return rc == num ? 0 : -EIO;
+}
+
 int rclient_send_message_to_client(const struct cras_rclient *client,
 				   const struct cras_client_message *msg,
 				   int *fds, unsigned int num_fds)
 {
+	struct cras_rclient_replies *held = client->held_replies;
+
+	if (held && !num_fds && msg->length <= CRAS_CLIENT_MAX_MSG_SIZE) {
+		if (held->num == CRAS_RCLIENT_MAX_HELD_REPLIES)
+			rclient_send_held_replies(client);
+		memcpy(held->bufs[held->num], msg, msg->length);
+		held->lens[held->num++] = msg->length;
+		return msg->length;
+	}
+
+	/* Keeps the replies in order. The fds are only valid during the call
+	 * so a reply carrying them can't wait. */
+	rclient_send_held_replies(client);
 	return cras_send_with_fds(client->fd, (const void *)msg, msg->length,
 				  fds, num_fds);
 }
@@ -43,6 +77,7 @@ int rclient_validate_message_fds(const struct cras_server_message *msg,
 			goto error;
 		break;
 	case CRAS_SERVER_SET_AEC_DUMP:
+	case CRAS_SERVER_UPLOAD_SAMPLE:
 		if (num_fds > 1)
 			goto error;
 		break;
@@ -139,10 +174,18 @@ int rclient_handle_client_stream_connect(struct cras_rclient *client,
 	struct cras_client_message *reply;
 	struct cras_audio_format remote_fmt;
 	struct cras_rstream_config stream_config;
+	struct cras_connect_message full_msg;
 	int rc, header_fd, samples_fd;
 	size_t samples_size;
 	int stream_fds[2];
 
+	/* Fields older clients don't send are zero. */
+	if (msg->header.length < sizeof(full_msg)) {
+		memset(&full_msg, 0, sizeof(full_msg));
+		memcpy(&full_msg, msg, msg->header.length);
+		msg = &full_msg;
+	}
+
 	rc = rclient_validate_stream_connect_params(client, msg, aud_fd,
 						    client_shm_fd);
 	remote_fmt = unpack_cras_audio_format(&msg->format);
@@ -244,6 +287,29 @@ int rclient_handle_client_stream_disconnect(
 			      msg->stream_id);
 }
 
+/* Handles messages from the client requesting that a stream be removed from the
+ * server once its samples are played. */
+int rclient_handle_client_stream_drain(
+	struct cras_rclient *client,
+	const struct cras_drain_stream_message *msg)
+{
+	struct stream_list *stream_list = cras_iodev_list_get_stream_list();
+	struct cras_rstream *stream;
+
+	if (!cras_valid_stream_id(msg->stream_id, client->id)) {
+		syslog(LOG_ERR,
+		       "stream_drain: invalid stream_id: %x for "
+		       "client: %zx.\n",
+		       msg->stream_id, client->id);
+		return -EINVAL;
+	}
+	stream = stream_list_find(stream_list, msg->stream_id);
+	if (!stream)
+		return -EINVAL;
+	stream->notify_drained = 1;
+	return stream_list_rm(stream_list, msg->stream_id);
+}
+
 /* Creates a client structure and sends a message back informing the client that
  * the connection has succeeded. */
 struct cras_rclient *rclient_generic_create(int fd, size_t id,
@@ -291,12 +357,15 @@ int rclient_handle_message_from_client(struct cras_rclient *client,
 	switch (msg->id) {
 	case CRAS_SERVER_CONNECT_STREAM: {
 		int client_shm_fd = num_fds > 1 ? fds[1] : -1;
-		if (MSG_LEN_VALID(msg, struct cras_connect_message)) {
+		if (msg->length >= CRAS_CONNECT_MESSAGE_MIN_LEN) {
 			rclient_handle_client_stream_connect(
 				client,
 				(const struct cras_connect_message *)msg, fd,
 				client_shm_fd);
 		} else {
+			for (int i = 0; i < (int)num_fds; i++)
+				if (fds[i] >= 0)
+					close(fds[i]);
 			return -EINVAL;
 		}
 		break;
@@ -308,6 +377,12 @@ int rclient_handle_message_from_client(struct cras_rclient *client,
 			client,
 			(const struct cras_disconnect_stream_message *)msg);
 		break;
+	case CRAS_SERVER_DRAIN_STREAM:
+		if (!MSG_LEN_VALID(msg, struct cras_drain_stream_message))
+			return -EINVAL;
+		rclient_handle_client_stream_drain(
+			client, (const struct cras_drain_stream_message *)msg);
+		break;
 	default:
 		break;
 	}
@@ -17,7 +17,12 @@ struct cras_rclient_message;
 struct cras_rstream_config;
 struct cras_server_message;
 
-/* Sends a message to the client. */
+/* Sends the replies held for the client, if any. */
+int rclient_send_held_replies(const struct cras_rclient *client);
+
+/* Sends a message to the client. While the client's replies are held, one
+ * without fds is kept to go out with the others; one with fds is sent right
+ * away after those held before it. */
 int rclient_send_message_to_client(const struct cras_rclient *client,
 				   const struct cras_client_message *msg,
 				   int *fds, unsigned int num_fds);
@@ -86,6 +91,20 @@ int rclient_handle_client_stream_disconnect(
 	struct cras_rclient *client,
 	const struct cras_disconnect_stream_message *msg);
 
+/* Handles messages from the client requesting that a stream be removed from the
+ * server once drained. The client is told when the stream is gone.
+ *
+ * Args:
+ *   client - The cras_rclient which gets the message.
+ *   msg - The cras_drain_stream_message from client.
+ *
+ * Returns:
+ *   0 on success, negative error on failure.
+ */
+int rclient_handle_client_stream_drain(
+	struct cras_rclient *client,
+	const struct cras_drain_stream_message *msg);
+
 /* Generic rclient create function for different types of rclients.
  * Creates a client structure and sends a message back informing the client
  * that the connection has succeeded.
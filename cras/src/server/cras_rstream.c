@@ -11,14 +11,23 @@
 
 #include "cras_audio_area.h"
 #include "cras_config.h"
+#include "cras_level_meter.h"
+#include "cras_mem_stats.h"
 #include "cras_messages.h"
 #include "cras_rclient.h"
 #include "cras_rstream.h"
+#include "cras_rt_mem.h"
+#include "cras_sample_cache.h"
 #include "cras_server_metrics.h"
 #include "cras_shm.h"
+#include "cras_shm_pool.h"
 #include "cras_types.h"
 #include "cras_system_state.h"
 
+/* The power of a stream only goes to the debug info, so sample it less
+ * often than the device power. */
+#define STREAM_EWMA_INTERVAL_MS 5
+
 static bool cras_rstream_config_is_client_shm_stream(
 	const struct cras_rstream_config *config)
 {
@@ -26,6 +35,28 @@ static bool cras_rstream_config_is_client_shm_stream(
 	       config->client_shm_size > 0;
 }
 
+/* The protection the samples area of the stream is mapped with in the
+ * server. Server streams playing a cached sample or a monitor route write
+ * it themselves. */
+static int samples_prot(const struct cras_rstream *stream)
+{
+	if (stream->direction == CRAS_STREAM_OUTPUT && !stream->sample &&
+	    !stream->is_monitor)
+		return PROT_READ;
+	return PROT_WRITE;
+}
+
+/* Whether the samples area is made a ring for a SHM_RING stream, only
+ * when its client writes the samples into a pooled or new area. */
+static bool stream_uses_ring(const struct cras_rstream *stream,
+			     const struct cras_rstream_config *config)
+{
+	return (stream->flags & SHM_RING) &&
+	       samples_prot(stream) == PROT_READ &&
+	       !stream_is_server_only(stream) &&
+	       !cras_rstream_config_is_client_shm_stream(config);
+}
+
 /* Setup the shared memory area used for audio samples. config->client_shm_fd
  * must be closed after calling this function.
  */
@@ -36,7 +67,9 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 	char header_name[NAME_MAX];
 	char samples_name[NAME_MAX];
 	struct cras_shm_info header_info, samples_info;
-	uint32_t frame_bytes, used_size;
+	uint32_t frame_bytes, used_size, samples_size;
+	uint16_t client_id = stream->stream_id >> 16;
+	int prot = samples_prot(stream);
 	int rc;
 	bool client_shm_stream =
 		cras_rstream_config_is_client_shm_stream(config);
@@ -46,6 +79,20 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 		return -EEXIST;
 	}
 
+	frame_bytes = snd_pcm_format_physical_width(fmt->format) / 8 *
+		      fmt->num_channels;
+	used_size = stream->buffer_frames * frame_bytes;
+	samples_size = stream_uses_ring(stream, config) ?
+			       cras_shm_calculate_ring_size(used_size) :
+			       cras_shm_calculate_samples_size(used_size);
+
+	if (!client_shm_stream) {
+		stream->pooled_samples_size = samples_size;
+		stream->shm = cras_shm_pool_get(client_id, samples_size, prot);
+		if (stream->shm)
+			goto shm_ready;
+	}
+
 	snprintf(header_name, sizeof(header_name),
 		 "/cras-%d-stream-%08x-header", getpid(), stream->stream_id);
 
@@ -54,10 +101,6 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 	if (rc)
 		return rc;
 
-	frame_bytes = snd_pcm_format_physical_width(fmt->format) / 8 *
-		      fmt->num_channels;
-	used_size = stream->buffer_frames * frame_bytes;
-
 	if (client_shm_stream) {
 		rc = cras_shm_info_init_with_fd(config->client_shm_fd,
 						config->client_shm_size,
@@ -66,29 +109,28 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 		snprintf(samples_name, sizeof(samples_name),
 			 "/cras-%d-stream-%08x-samples", getpid(),
 			 stream->stream_id);
-		rc = cras_shm_info_init(
-			samples_name,
-			cras_shm_calculate_samples_size(used_size),
-			&samples_info);
+		rc = cras_shm_info_init_samples(samples_name, samples_size,
+						&samples_info);
 	}
 	if (rc) {
 		cras_shm_info_cleanup(&header_info);
 		return rc;
 	}
 
-	int samples_prot = 0;
-	if (stream->direction == CRAS_STREAM_OUTPUT)
-		samples_prot = PROT_READ;
-	else
-		samples_prot = PROT_WRITE;
-
-	rc = cras_audio_shm_create(&header_info, &samples_info, samples_prot,
+	rc = cras_audio_shm_create(&header_info, &samples_info, prot,
 				   &stream->shm);
 	if (rc)
 		return rc;
+	/* Areas handed back by the pool are still counted. */
+	cras_mem_stats_add(CRAS_MEM_SHM, cras_shm_mapped_bytes(stream->shm));
+	cras_rt_mem_add(stream->shm->header, stream->shm->header_info.length);
+	cras_rt_mem_add(stream->shm->samples, stream->shm->samples_info.length);
 
+shm_ready:
 	cras_shm_set_frame_bytes(stream->shm, frame_bytes);
 	cras_shm_set_used_size(stream->shm, used_size);
+	if (stream_uses_ring(stream, config))
+		cras_shm_set_ring(stream->shm, samples_size);
 	if (client_shm_stream) {
 		for (int i = 0; i < 2; i++)
 			cras_shm_set_buffer_offset(stream->shm, i,
@@ -102,10 +144,21 @@ static inline int setup_shm_area(struct cras_rstream *stream,
 	return 0;
 }
 
-static inline int buffer_meets_size_limit(size_t buffer_size, size_t rate)
+/* Gets the smallest buffer or callback size allowed for a stream. */
+static inline size_t min_buffer_frames(size_t rate, uint32_t flags)
+{
+	size_t min_us = (flags & LOW_LATENCY) ?
+				CRAS_MIN_LOW_LATENCY_BUFFER_TIME_IN_US :
+				CRAS_MIN_BUFFER_TIME_IN_US;
+
+	return (min_us * rate) / 1000000 + 1;
+}
+
+static inline int buffer_meets_size_limit(size_t buffer_size, size_t rate,
+					  uint32_t flags)
 {
 	return (buffer_size < (CRAS_MAX_BUFFER_TIME_IN_S * rate)) &&
-	       (buffer_size > (CRAS_MIN_BUFFER_TIME_IN_US * rate) / 1000000);
+	       (buffer_size >= min_buffer_frames(rate, flags));
 }
 
 /* Verifies that the given stream parameters are valid. */
@@ -130,15 +183,16 @@ static int verify_rstream_parameters(const struct cras_rstream_config *config,
 	/*
 	 * Valid buffer settings:
 	 *   Frames in 1ms <= cb_threshold <= buffer_frames <= Frames in 10s.
+	 * LOW_LATENCY streams can go down to 0.25ms.
 	 */
-	if (!buffer_meets_size_limit(config->buffer_frames,
-				     format->frame_rate)) {
+	if (!buffer_meets_size_limit(config->buffer_frames, format->frame_rate,
+				     config->flags)) {
 		syslog(LOG_ERR, "rstream: invalid buffer_frames %zu\n",
 		       config->buffer_frames);
 		return -EINVAL;
 	}
-	if (!buffer_meets_size_limit(config->cb_threshold,
-				     format->frame_rate) ||
+	if (!buffer_meets_size_limit(config->cb_threshold, format->frame_rate,
+				     config->flags) ||
 	    config->cb_threshold > config->buffer_frames) {
 		syslog(LOG_ERR, "rstream: invalid cb_threshold %zu\n",
 		       config->cb_threshold);
@@ -152,7 +206,8 @@ static int verify_rstream_parameters(const struct cras_rstream_config *config,
 	if ((format->format != SND_PCM_FORMAT_S16_LE) &&
 	    (format->format != SND_PCM_FORMAT_S32_LE) &&
 	    (format->format != SND_PCM_FORMAT_U8) &&
-	    (format->format != SND_PCM_FORMAT_S24_LE)) {
+	    (format->format != SND_PCM_FORMAT_S24_LE) &&
+	    (format->format != SND_PCM_FORMAT_FLOAT_LE)) {
 		syslog(LOG_ERR, "rstream: format %d not supported\n",
 		       format->format);
 		return -EINVAL;
@@ -162,6 +217,14 @@ static int verify_rstream_parameters(const struct cras_rstream_config *config,
 		syslog(LOG_ERR, "rstream: Invalid direction.\n");
 		return -EINVAL;
 	}
+	/* IEC61937 packs bursts into 16 bit words of 2 or 8 channels. */
+	if ((config->flags & PASSTHROUGH) &&
+	    (config->direction != CRAS_STREAM_OUTPUT ||
+	     format->format != SND_PCM_FORMAT_S16_LE ||
+	     (format->num_channels != 2 && format->num_channels != 8))) {
+		syslog(LOG_ERR, "rstream: invalid passthrough stream.\n");
+		return -EINVAL;
+	}
 	if (config->stream_type < CRAS_STREAM_TYPE_DEFAULT ||
 	    config->stream_type >= CRAS_STREAM_NUM_TYPES) {
 		syslog(LOG_ERR, "rstream: Invalid stream type.\n");
@@ -297,15 +360,42 @@ int cras_rstream_create(struct cras_rstream_config *config,
 	stream->num_missed_cb = 0;
 	stream->is_pinned = (config->dev_idx != NO_DEVICE);
 	stream->pinned_dev_idx = config->dev_idx;
-	ewma_power_init(&stream->ewma, stream->format.frame_rate);
+	ewma_power_init(&stream->ewma, stream->format.format,
+			stream->format.frame_rate);
+	ewma_power_set_interval(&stream->ewma, STREAM_EWMA_INTERVAL_MS);
+	stream->level_meter =
+		stream->direction == CRAS_STREAM_OUTPUT ?
+			cras_level_meter_add(CRAS_LEVEL_METER_STREAM,
+					     stream->stream_id) :
+			-1;
+
+	if (config->sample)
+		stream->sample = cras_sample_get(config->sample);
+	stream->monitor = config->monitor;
+	stream->is_monitor = config->is_monitor;
 
 	rc = setup_shm_area(stream, config);
 	if (rc < 0) {
 		syslog(LOG_ERR, "failed to setup shm %d\n", rc);
+		if (stream->sample)
+			cras_sample_put(stream->sample);
+		cras_level_meter_rm(stream->level_meter);
 		free(stream);
 		return rc;
 	}
 
+	/* The preroll is the first samples the stream plays. */
+	if (stream->direction == CRAS_STREAM_OUTPUT && config->preroll_frames &&
+	    cras_rstream_config_is_client_shm_stream(config))
+		cras_shm_buffer_written_start(
+			stream->shm, MIN(config->preroll_frames,
+					 cras_shm_used_frames(stream->shm)));
+
+	/* Streams woken by their client's reply keep the socket for it. */
+	if ((stream->flags & SHM_DOORBELL) &&
+	    !(stream->flags & USE_DEV_TIMING) && !stream_is_server_only(stream))
+		cras_shm_set_doorbell(stream->shm, 1);
+
 	stream->fd = config->audio_fd;
 	config->audio_fd = -1;
 	stream->buf_state = buffer_share_create(stream->buffer_frames);
@@ -329,15 +419,35 @@ int cras_rstream_create(struct cras_rstream_config *config,
 
 void cras_rstream_destroy(struct cras_rstream *stream)
 {
+	if (stream->client) {
+		struct cras_client_usage *usage = &stream->client->ended_usage;
+
+		usage->cpu_ns += stream->cpu_ns;
+		usage->num_fetches += stream->num_fetches;
+		usage->num_missed_cb += stream->num_missed_cb;
+	}
 	cras_server_metrics_stream_destroy(stream);
 	cras_system_state_stream_removed(stream->direction,
 					 stream->client_type);
 	close(stream->fd);
-	cras_audio_shm_destroy(stream->shm);
+	if (stream->pooled_samples_size)
+		cras_shm_pool_put(stream->stream_id >> 16,
+				  stream->pooled_samples_size,
+				  samples_prot(stream), stream->shm);
+	else if (stream->shm) {
+		cras_mem_stats_sub(CRAS_MEM_SHM,
+				   cras_shm_mapped_bytes(stream->shm));
+		cras_rt_mem_remove(stream->shm->header);
+		cras_rt_mem_remove(stream->shm->samples);
+		cras_audio_shm_destroy(stream->shm);
+	}
 	cras_audio_area_destroy(stream->audio_area);
 	buffer_share_destroy(stream->buf_state);
 	if (stream->apm_list)
 		cras_apm_list_destroy(stream->apm_list);
+	if (stream->sample)
+		cras_sample_put(stream->sample);
+	cras_level_meter_rm(stream->level_meter);
 	free(stream);
 }
 
@@ -371,6 +481,71 @@ void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 	}
 }
 
+/* The fetch lead is updated every REPLY_LEAD_UPDATE_COUNT replies. Once
+ * REPLY_LATENESS_DECAY_COUNT replies are recorded their counts are halved,
+ * so the lead follows a client that got faster. */
+#define REPLY_LEAD_UPDATE_COUNT 16
+#define REPLY_LATENESS_DECAY_COUNT 1024
+
+static void update_fetch_lead(struct cras_rstream *rstream)
+{
+	struct cras_latency_hist *hist = &rstream->reply_lateness;
+	uint64_t lead_us, max_lead_us;
+	unsigned int i;
+
+	if (cras_latency_hist_count(hist) >= REPLY_LATENESS_DECAY_COUNT) {
+		for (i = 0; i < CRAS_LATENCY_HIST_BUCKETS; i++)
+			hist->counts[i] /= 2;
+	}
+
+	lead_us = cras_latency_hist_percentile(hist, 99);
+	max_lead_us = ((uint64_t)rstream->sleep_interval_ts.tv_sec * 1000000 +
+		       rstream->sleep_interval_ts.tv_nsec / 1000) /
+		      2;
+	lead_us = MIN(lead_us, max_lead_us);
+	rstream->fetch_lead_ts.tv_sec = lead_us / 1000000;
+	rstream->fetch_lead_ts.tv_nsec = (lead_us % 1000000) * 1000;
+}
+
+void cras_rstream_record_reply(struct cras_rstream *rstream,
+			       const struct timespec *now)
+{
+	struct timespec due;
+
+	if (!rstream->awaiting_reply || cras_rstream_is_pending_reply(rstream))
+		return;
+	rstream->awaiting_reply = 0;
+
+	/* The reply is late if it comes after the stream is due again. */
+	due = rstream->last_fetch_ts;
+	add_timespecs(&due, &rstream->sleep_interval_ts);
+	if (timespec_after(now, &due))
+		cras_latency_hist_add(&rstream->reply_lateness, &due, now);
+	else
+		cras_latency_hist_add_usec(&rstream->reply_lateness, 0);
+
+	if (cras_latency_hist_count(&rstream->reply_lateness) %
+		    REPLY_LEAD_UPDATE_COUNT == 0)
+		update_fetch_lead(rstream);
+}
+
+size_t cras_rstream_set_cb_threshold(struct cras_rstream *stream,
+				     size_t cb_threshold)
+{
+	size_t rate = stream->format.frame_rate;
+
+	cb_threshold = MAX(cb_threshold, min_buffer_frames(rate, stream->flags));
+	cb_threshold = MIN(cb_threshold, stream->buffer_frames);
+	if (cb_threshold == stream->cb_threshold)
+		return cb_threshold;
+
+	syslog(LOG_DEBUG, "stream %x cb_threshold %zu -> %zu",
+	       stream->stream_id, stream->cb_threshold, cb_threshold);
+	stream->cb_threshold = cb_threshold;
+	cras_frames_to_time(cb_threshold, rate, &stream->sleep_interval_ts);
+	return cb_threshold;
+}
+
 static void init_audio_message(struct audio_message *msg,
 			       enum CRAS_AUDIO_MESSAGE_ID id, uint32_t frames)
 {
@@ -379,6 +554,65 @@ static void init_audio_message(struct audio_message *msg,
 	msg->frames = frames;
 }
 
+/* Writes the next block of the sample a server stream plays, like a client
+ * replying to a request for audio. The stream drains after the last one. */
+static void fill_from_sample(struct cras_rstream *stream)
+{
+	const struct cras_sample *sample = stream->sample;
+	struct cras_audio_shm *shm = stream->shm;
+	size_t frame_bytes = cras_get_format_bytes(&sample->format);
+	size_t frames;
+
+	frames = MIN(stream->cb_threshold, sample->frames - stream->sample_pos);
+	memcpy(cras_shm_get_write_buffer_base(shm),
+	       sample->samples + stream->sample_pos * frame_bytes,
+	       frames * frame_bytes);
+	cras_shm_buffer_written_start(shm, frames);
+	stream->sample_pos += frames;
+	if (stream->sample_pos == sample->frames)
+		cras_rstream_set_is_draining(stream, 1);
+}
+
+/* Fetching the playback stream of a monitor route asks no one, its capture
+ * stream writes it. If that stopped, a block of silence keeps the stream
+ * from holding back the others mixed to the device. */
+static void fill_monitor_silence(struct cras_rstream *stream)
+{
+	struct cras_audio_shm *shm = stream->shm;
+	size_t frames = MIN(stream->cb_threshold, cras_shm_used_frames(shm));
+
+	if (!stream->monitor_written && cras_shm_get_frames(shm) == 0 &&
+	    cras_shm_is_buffer_available(shm)) {
+		memset(cras_shm_get_write_buffer_base(shm), 0,
+		       frames * shm->config.frame_bytes);
+		cras_shm_buffer_written_start(shm, frames);
+	}
+	stream->monitor_written = 0;
+}
+
+/* Writes the frames a capture stream of a monitor route has ready to its
+ * playback stream, which mixes them in the same wake. They are dropped if
+ * the playback side still has both its buffers queued. */
+static void write_monitor(struct cras_rstream *stream, size_t count)
+{
+	struct cras_audio_shm *shm = stream->monitor->shm;
+	uint8_t *src;
+	size_t frames;
+
+	stream->monitor->monitor_written = 1;
+	if (!cras_shm_is_buffer_available(shm)) {
+		shm->header->num_overruns++;
+		return;
+	}
+	src = cras_shm_get_readable_frames(stream->shm, 0, &frames);
+	frames = MIN(MIN(frames, count), cras_shm_used_frames(shm));
+	if (!src || !frames)
+		return;
+	memcpy(cras_shm_get_write_buffer_base(shm), src,
+	       frames * shm->config.frame_bytes);
+	cras_shm_buffer_written_start(shm, frames);
+}
+
 int cras_rstream_request_audio(struct cras_rstream *stream,
 			       const struct timespec *now)
 {
@@ -391,6 +625,23 @@ int cras_rstream_request_audio(struct cras_rstream *stream,
 
 	stream->last_fetch_ts = *now;
 
+	if (stream->sample) {
+		fill_from_sample(stream);
+		return 0;
+	}
+	if (stream->is_monitor) {
+		fill_monitor_silence(stream);
+		return 0;
+	}
+	stream->awaiting_reply = 1;
+
+	if (cras_shm_doorbell(stream->shm)) {
+		set_pending_reply(stream);
+		cras_shm_ring_doorbell(stream->shm, AUDIO_MESSAGE_REQUEST_DATA,
+				       stream->cb_threshold);
+		return 0;
+	}
+
 	init_audio_message(&msg, AUDIO_MESSAGE_REQUEST_DATA,
 			   stream->cb_threshold);
 	rc = write(stream->fd, &msg, sizeof(msg));
@@ -411,10 +662,19 @@ int cras_rstream_audio_ready(struct cras_rstream *stream, size_t count)
 
 	/* Mark shm as used. */
 	if (stream_is_server_only(stream)) {
+		if (stream->monitor)
+			write_monitor(stream, count);
 		cras_shm_buffer_read_current(stream->shm, count);
 		return 0;
 	}
 
+	if (cras_shm_doorbell(stream->shm)) {
+		set_pending_reply(stream);
+		cras_shm_ring_doorbell(stream->shm, AUDIO_MESSAGE_DATA_READY,
+				       count);
+		return 0;
+	}
+
 	init_audio_message(&msg, AUDIO_MESSAGE_DATA_READY, count);
 	rc = write(stream->fd, &msg, sizeof(msg));
 	if (rc < 0)
@@ -446,19 +706,15 @@ void cras_rstream_dev_detach(struct cras_rstream *rstream, unsigned int dev_id)
 		rstream->num_attached_devs--;
 
 	if (rstream->main_dev.dev_id == dev_id) {
-		int i;
 		struct id_offset *o;
 
 		/* Choose the first device id as a main device. */
 		rstream->main_dev.dev_id = NO_DEVICE;
 		rstream->main_dev.dev_ptr = NULL;
-		for (i = 0; i < rstream->buf_state->id_sz; i++) {
-			o = &rstream->buf_state->wr_idx[i];
-			if (o->used) {
-				rstream->main_dev.dev_id = o->id;
-				rstream->main_dev.dev_ptr = o->data;
-				break;
-			}
+		if (rstream->buf_state->num_ids) {
+			o = &rstream->buf_state->wr_idx[0];
+			rstream->main_dev.dev_id = o->id;
+			rstream->main_dev.dev_ptr = o->data;
 		}
 	}
 }
@@ -487,8 +743,14 @@ void cras_rstream_update_output_read_pointer(struct cras_rstream *rstream)
 	/* Retrieve the read pointer |src| start from which to calculate
 	 * the EWMA power. */
 	src = cras_shm_get_readable_frames(rstream->shm, 0, &nfr);
-	ewma_power_calculate(&rstream->ewma, (int16_t *)src,
-			     rstream->format.num_channels, nwritten);
+	/* A buffer split in segments or wrapping in a ring is only
+	 * contiguous up to nfr. */
+	ewma_power_calculate(&rstream->ewma, src, rstream->format.num_channels,
+			     cras_shm_read_buffer_segmented(rstream->shm) ||
+					     cras_shm_is_ring(rstream->shm) ?
+				     MIN(nwritten, nfr) :
+				     nwritten);
+	cras_level_meter_update(rstream->level_meter, &rstream->ewma);
 	cras_shm_buffer_read(rstream->shm, nwritten);
 }
 
@@ -532,6 +794,21 @@ int cras_rstream_is_pending_reply(const struct cras_rstream *stream)
 	return cras_shm_callback_pending(stream->shm);
 }
 
+int cras_rstream_wake_for_reply(struct cras_rstream *stream)
+{
+	struct timespec now;
+
+	if (!cras_shm_doorbell(stream->shm))
+		return 0;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	if (!timespec_after(&now, &stream->next_cb_ts))
+		return 1;
+
+	/* The reply is late, have it wake the thread through the socket. */
+	return !cras_shm_want_reply(stream->shm);
+}
+
 int cras_rstream_flush_old_audio_messages(struct cras_rstream *stream)
 {
 	struct pollfd pollfd;
@@ -11,6 +11,7 @@
 
 #include "buffer_share.h"
 #include "cras_apm_list.h"
+#include "cras_latency_hist.h"
 #include "cras_shm.h"
 #include "cras_types.h"
 #include "cras_rstream_config.h"
@@ -18,6 +19,7 @@
 
 struct cras_connect_message;
 struct cras_rclient;
+struct cras_sample;
 struct dev_mix;
 
 /* Holds informations about the main active device.
@@ -45,24 +47,48 @@ struct main_dev_info {
  *    main_dev_info - The info of the main device this stream attaches to.
  *    is_draining - The stream is draining and waiting to be removed.
  *    client - The client who uses this stream.
+ *    notify_drained - Send client cras_client_stream_drained once the stream
+ *        is removed and off the audio threads.
  *    shm - shared memory
+ *    pooled_samples_size - Samples size the shm is returned to the shm pool
+ *        with on destroy, 0 if the client provided the samples area.
  *    audio_area - space for playback/capture audio
  *    format - format of the stream
  *    next_cb_ts - Next callback time for this stream.
  *    sleep_interval_ts - Time between audio callbacks.
  *    last_fetch_ts - The time of the last stream fetch.
  *    longest_fetch_interval_ts - Longest interval between two fetches.
+ *    awaiting_reply - Non-zero from a request for audio until its reply is
+ *        seen.
+ *    reply_lateness - How late the client replied to requests for audio,
+ *        past the time the stream was next due to be fetched.
+ *    fetch_lead_ts - How early to fetch the stream, the 99th percentile of
+ *        reply_lateness kept under half the callback period.
  *    start_ts - The time when the stream started.
  *    first_missed_cb_ts - The time when the first missed callback happens.
  *    buf_state - State of the buffer from all devices for this stream.
  *    apm_list - List of audio processing module instances.
  *    ewma - The ewma instance to calculate stream volume.
+ *    level_meter - The meter the level from ewma is published to, -1 for
+ *        capture streams.
  *    num_attached_devs - Number of iodevs this stream has attached to.
  *    num_missed_cb - Number of callback schedules have been missed.
  *    queued_frames - Cached value of the number of queued frames in shm.
  *    is_pinned - True if the stream is a pinned stream, false otherwise.
  *    pinned_dev_idx - device the stream is pinned, 0 if none.
  *    triggered - True if already notified TRIGGER_ONLY stream, false otherwise.
+ *    cpu_ns - Audio thread time spent fetching, mixing and capturing for the
+ *        stream, in nanoseconds.
+ *    num_fetches - Number of times the client was asked for samples.
+ *    sample - The cached sample a server stream plays, filled into shm when
+ *        the stream is fetched instead of asking a client.
+ *    sample_pos - Frames of sample played so far.
+ *    monitor - For the capture stream of a monitor route, the playback stream
+ *        its captured frames are written to as they become ready.
+ *    is_monitor - Non-zero for the playback stream of a monitor route, which
+ *        is filled by its capture stream rather than fetched.
+ *    monitor_written - The capture stream wrote to this playback stream since
+ *        it was last fetched.
  */
 struct cras_rstream {
 	cras_stream_id_t stream_id;
@@ -76,24 +102,37 @@ struct cras_rstream {
 	int is_draining;
 	struct main_dev_info main_dev;
 	struct cras_rclient *client;
+	int notify_drained;
 	struct cras_audio_shm *shm;
+	size_t pooled_samples_size;
 	struct cras_audio_area *audio_area;
 	struct cras_audio_format format;
 	struct timespec next_cb_ts;
 	struct timespec sleep_interval_ts;
 	struct timespec last_fetch_ts;
 	struct timespec longest_fetch_interval;
+	int awaiting_reply;
+	struct cras_latency_hist reply_lateness;
+	struct timespec fetch_lead_ts;
 	struct timespec start_ts;
 	struct timespec first_missed_cb_ts;
 	struct buffer_share *buf_state;
 	struct cras_apm_list *apm_list;
 	struct ewma_power ewma;
+	int level_meter;
 	int num_attached_devs;
 	int num_missed_cb;
 	int queued_frames;
 	int is_pinned;
 	uint32_t pinned_dev_idx;
 	int triggered;
+	uint64_t cpu_ns;
+	uint32_t num_fetches;
+	struct cras_sample *sample;
+	size_t sample_pos;
+	struct cras_rstream *monitor;
+	int is_monitor;
+	int monitor_written;
 	struct cras_rstream *prev, *next;
 };
 
@@ -133,6 +172,12 @@ cras_rstream_get_cb_threshold(const struct cras_rstream *stream)
 	return stream->cb_threshold;
 }
 
+/* Resizes the callbacks of an ADAPTIVE_CB stream, kept between the smallest
+ * callback its flags allow and its buffer size. The sleep interval follows.
+ * Returns the callback threshold in effect. */
+size_t cras_rstream_set_cb_threshold(struct cras_rstream *stream,
+				     size_t cb_threshold);
+
 /* Gets the max write size for the stream. */
 static inline size_t
 cras_rstream_get_max_write_frames(const struct cras_rstream *stream)
@@ -149,6 +194,47 @@ cras_rstream_get_type(const struct cras_rstream *stream)
 	return stream->stream_type;
 }
 
+/* Priority classes of streams, most important first. When the audio thread
+ * runs short of CPU it degrades the streams of the least important classes
+ * first. */
+enum CRAS_STREAM_PRIORITY {
+	CRAS_STREAM_PRIORITY_CRITICAL,
+	CRAS_STREAM_PRIORITY_MEDIA,
+	CRAS_STREAM_PRIORITY_NOTIFICATION,
+	CRAS_STREAM_PRIORITY_BACKGROUND,
+	CRAS_NUM_STREAM_PRIORITIES,
+};
+
+/* Gets the priority class of the stream. Calls and pro audio are critical,
+ * and other typed streams are media. Untyped streams are taken for UI sounds
+ * and notifications, or for background audio when they come from test,
+ * ALSA plugin or unknown clients. */
+static inline enum CRAS_STREAM_PRIORITY
+cras_rstream_get_priority(const struct cras_rstream *stream)
+{
+	switch (stream->stream_type) {
+	case CRAS_STREAM_TYPE_VOICE_COMMUNICATION:
+	case CRAS_STREAM_TYPE_PRO_AUDIO:
+		return CRAS_STREAM_PRIORITY_CRITICAL;
+	case CRAS_STREAM_TYPE_DEFAULT:
+		break;
+	default:
+		return CRAS_STREAM_PRIORITY_MEDIA;
+	}
+
+	switch (stream->client_type) {
+	case CRAS_CLIENT_TYPE_UNKNOWN:
+	case CRAS_CLIENT_TYPE_LEGACY:
+	case CRAS_CLIENT_TYPE_TEST:
+	case CRAS_CLIENT_TYPE_PCM:
+		return CRAS_STREAM_PRIORITY_BACKGROUND;
+	case CRAS_CLIENT_TYPE_SERVER_STREAM:
+		return CRAS_STREAM_PRIORITY_MEDIA;
+	default:
+		return CRAS_STREAM_PRIORITY_NOTIFICATION;
+	}
+}
+
 /* Gets the direction (input/output/loopback) of the stream. */
 static inline enum CRAS_STREAM_DIRECTION
 cras_rstream_get_direction(const struct cras_rstream *stream)
@@ -248,6 +334,19 @@ cras_rstream_post_processing_format(const struct cras_rstream *stream,
 void cras_rstream_record_fetch_interval(struct cras_rstream *rstream,
 					const struct timespec *now);
 
+/* Records how late the client replied to the last request for audio, once
+ * the reply is seen, and updates the stream's fetch lead from it. */
+void cras_rstream_record_reply(struct cras_rstream *rstream,
+			       const struct timespec *now);
+
+/* Gets how early the stream should be fetched before its callback time so
+ * that its client's late replies still come in time. */
+static inline const struct timespec *
+cras_rstream_fetch_lead(const struct cras_rstream *rstream)
+{
+	return &rstream->fetch_lead_ts;
+}
+
 /* Requests min_req frames from the client. */
 int cras_rstream_request_audio(struct cras_rstream *stream,
 			       const struct timespec *now);
@@ -317,6 +416,13 @@ int cras_rstream_get_mute(const struct cras_rstream *rstream);
  */
 int cras_rstream_is_pending_reply(const struct cras_rstream *stream);
 
+/*
+ * For a stream pending a reply, returns non-zero if the audio thread should
+ * wake at the next callback time to look for the reply in shm. Returns 0 if
+ * the reply will come through the socket.
+ */
+int cras_rstream_wake_for_reply(struct cras_rstream *stream);
+
 /*
  * Reads any pending audio message from the socket.
  */
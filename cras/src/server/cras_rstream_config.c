@@ -47,7 +47,11 @@ void cras_rstream_config_init(
 	stream_config->client_shm_size = client_shm_size;
 	stream_config->buffer_offsets[0] = buffer_offsets[0];
 	stream_config->buffer_offsets[1] = buffer_offsets[1];
+	stream_config->preroll_frames = 0;
 	stream_config->client = client;
+	stream_config->sample = NULL;
+	stream_config->monitor = NULL;
+	stream_config->is_monitor = 0;
 }
 
 struct cras_rstream_config cras_rstream_config_init_with_message(
@@ -65,6 +69,7 @@ struct cras_rstream_config cras_rstream_config_init_with_message(
 				 msg->buffer_frames, msg->cb_threshold, aud_fd,
 				 client_shm_fd, msg->client_shm_size,
 				 buffer_offsets, &stream_config);
+	stream_config.preroll_frames = msg->preroll_frames;
 	return stream_config;
 }
 
@@ -14,6 +14,8 @@
 #include "cras_types.h"
 
 struct cras_connect_message;
+struct cras_rstream;
+struct cras_sample;
 struct dev_mix;
 
 /* Config for creating an rstream.
@@ -33,7 +35,13 @@ struct dev_mix;
  *                    Some functions may dup this fd while borrowing the config.
  *    client_shm_size - The size of shm area backed by client_shm_fd.
  *    buffer_offsets - Initial values for buffer_offset for a client shm stream.
+ *    preroll_frames - Frames the client wrote to the first buffer of its shm
+ *                     before connecting.
  *    client - The client that owns this stream.
+ *    sample - The cached sample a server stream plays, or NULL.
+ *    monitor - For the capture stream of a monitor route, the playback stream
+ *              its frames are written to, or NULL.
+ *    is_monitor - Non-zero for the playback stream of a monitor route.
  */
 struct cras_rstream_config {
 	cras_stream_id_t stream_id;
@@ -50,7 +58,11 @@ struct cras_rstream_config {
 	int client_shm_fd;
 	size_t client_shm_size;
 	uint32_t buffer_offsets[2];
+	uint32_t preroll_frames;
 	struct cras_rclient *client;
+	struct cras_sample *sample;
+	struct cras_rstream *monitor;
+	int is_monitor;
 };
 
 /* Fills cras_rstream_config with given parameters.
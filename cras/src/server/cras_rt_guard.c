@@ -0,0 +1,244 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifdef HAVE_RT_GUARD
+
+#define _GNU_SOURCE /* For RTLD_NEXT */
+#include <dlfcn.h>
+#include <errno.h>
+#include <execinfo.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <sys/param.h>
+#include <syslog.h>
+
+#include "cras_rt_guard.h"
+
+/* The glibc allocator, under the names it exports for interposers. */
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void __libc_free(void *ptr);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __vsyslog_chk(int priority, int flag, const char *format,
+			  va_list ap);
+
+#define MAX_SITES 32
+#define MAX_FRAMES 12
+
+enum rt_guard_call {
+	RT_GUARD_HEAP,
+	RT_GUARD_SYSLOG,
+	RT_GUARD_LOCK,
+};
+
+static const char *const call_names[] = {
+	[RT_GUARD_HEAP] = "heap call",
+	[RT_GUARD_SYSLOG] = "syslog",
+	[RT_GUARD_LOCK] = "contended lock",
+};
+
+/* A place an audio thread made an unsafe call from.
+ *    call - What was called.
+ *    caller - The return address of the call.
+ *    frames, num_frames - The backtrace of the first call.
+ *    ready - Set once the site is filled.
+ */
+struct rt_guard_site {
+	enum rt_guard_call call;
+	void *caller;
+	void *frames[MAX_FRAMES];
+	int num_frames;
+	int ready;
+};
+
+/* Set on audio threads. */
+static __thread int guarded;
+/* Set while a site is recorded or syslog runs, what they call isn't counted
+ * on its own. */
+static __thread int nested;
+
+static uint32_t num_allocs;
+static uint32_t num_blocking_calls;
+static struct rt_guard_site sites[MAX_SITES];
+/* Sites claimed by the audio threads and logged by the main thread. */
+static unsigned int num_sites;
+static unsigned int num_sites_logged;
+
+static int (*real_mutex_lock)(pthread_mutex_t *mutex);
+
+static void record_site(enum rt_guard_call call, void *caller)
+{
+	struct rt_guard_site *site;
+	unsigned int i, n;
+
+	n = MIN(__atomic_load_n(&num_sites, __ATOMIC_ACQUIRE), MAX_SITES);
+	for (i = 0; i < n; i++) {
+		if (sites[i].caller == caller && sites[i].call == call)
+			return;
+	}
+	if (n == MAX_SITES)
+		return;
+
+	i = __atomic_fetch_add(&num_sites, 1, __ATOMIC_ACQ_REL);
+	if (i >= MAX_SITES)
+		return;
+	site = &sites[i];
+	site->call = call;
+	site->caller = caller;
+	nested++;
+	site->num_frames = backtrace(site->frames, MAX_FRAMES);
+	nested--;
+	__atomic_store_n(&site->ready, 1, __ATOMIC_RELEASE);
+}
+
+/* Counts a call made by caller if the calling thread is guarded. */
+static void guard_call(enum rt_guard_call call, void *caller)
+{
+	if (!guarded || nested)
+		return;
+	if (call == RT_GUARD_HEAP)
+		__atomic_fetch_add(&num_allocs, 1, __ATOMIC_RELAXED);
+	else
+		__atomic_fetch_add(&num_blocking_calls, 1, __ATOMIC_RELAXED);
+	record_site(call, caller);
+}
+
+void cras_rt_guard_enter()
+{
+	void *frame;
+
+	/* The first backtrace() loads the unwinder, which allocates. */
+	backtrace(&frame, 1);
+	guarded = 1;
+}
+
+void cras_rt_guard_get(uint32_t *allocs, uint32_t *blocking_calls)
+{
+	*allocs = __atomic_load_n(&num_allocs, __ATOMIC_RELAXED);
+	*blocking_calls =
+		__atomic_load_n(&num_blocking_calls, __ATOMIC_RELAXED);
+}
+
+void cras_rt_guard_log_sites()
+{
+	struct rt_guard_site *site;
+	unsigned int n;
+	char **symbols;
+	int i;
+
+	n = MIN(__atomic_load_n(&num_sites, __ATOMIC_ACQUIRE), MAX_SITES);
+	while (num_sites_logged < n) {
+		site = &sites[num_sites_logged];
+		/* Still being recorded, logged by the next call. */
+		if (!__atomic_load_n(&site->ready, __ATOMIC_ACQUIRE))
+			return;
+
+		syslog(LOG_WARNING, "RT guard: %s on an audio thread at:",
+		       call_names[site->call]);
+		symbols = backtrace_symbols(site->frames, site->num_frames);
+		/* The first frame is the guard's own. */
+		for (i = 1; i < site->num_frames; i++)
+			syslog(LOG_WARNING, "    %s",
+			       symbols ? symbols[i] : "?");
+		free(symbols);
+		num_sites_logged++;
+	}
+}
+
+/*
+ * Interposed functions.
+ */
+
+void *malloc(size_t size)
+{
+	guard_call(RT_GUARD_HEAP, __builtin_return_address(0));
+	return __libc_malloc(size);
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+	guard_call(RT_GUARD_HEAP, __builtin_return_address(0));
+	return __libc_calloc(nmemb, size);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+	guard_call(RT_GUARD_HEAP, __builtin_return_address(0));
+	return __libc_realloc(ptr, size);
+}
+
+void free(void *ptr)
+{
+	if (ptr)
+		guard_call(RT_GUARD_HEAP, __builtin_return_address(0));
+	__libc_free(ptr);
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+	guard_call(RT_GUARD_HEAP, __builtin_return_address(0));
+	return __libc_memalign(alignment, size);
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	void *ptr;
+
+	if (alignment % sizeof(void *) || (alignment & (alignment - 1)))
+		return EINVAL;
+	guard_call(RT_GUARD_HEAP, __builtin_return_address(0));
+	ptr = __libc_memalign(alignment, size);
+	if (!ptr)
+		return ENOMEM;
+	*memptr = ptr;
+	return 0;
+}
+
+void syslog(int priority, const char *format, ...)
+{
+	va_list ap;
+
+	guard_call(RT_GUARD_SYSLOG, __builtin_return_address(0));
+	nested++;
+	va_start(ap, format);
+	vsyslog(priority, format, ap);
+	va_end(ap);
+	nested--;
+}
+
+/* What syslog() becomes with _FORTIFY_SOURCE. */
+void __syslog_chk(int priority, int flag, const char *format, ...)
+{
+	va_list ap;
+
+	guard_call(RT_GUARD_SYSLOG, __builtin_return_address(0));
+	nested++;
+	va_start(ap, format);
+	__vsyslog_chk(priority, flag, format, ap);
+	va_end(ap);
+	nested--;
+}
+
+int pthread_mutex_lock(pthread_mutex_t *mutex)
+{
+	int rc;
+
+	/* Resolved on first use, other libraries may lock before main(). */
+	if (!real_mutex_lock)
+		real_mutex_lock = dlsym(RTLD_NEXT, "pthread_mutex_lock");
+
+	/* Only a lock held by another thread makes the caller wait. */
+	if (guarded && !nested) {
+		rc = pthread_mutex_trylock(mutex);
+		if (rc != EBUSY)
+			return rc;
+		guard_call(RT_GUARD_LOCK, __builtin_return_address(0));
+	}
+	return real_mutex_lock(mutex);
+}
+
+#endif /* HAVE_RT_GUARD */
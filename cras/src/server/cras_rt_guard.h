@@ -0,0 +1,53 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Catches work that isn't real time safe creeping onto the audio threads.
+ * With --enable-rt-guard the server interposes the heap functions, syslog and
+ * pthread_mutex_lock. Heap calls, syslog calls and locks that had to wait
+ * for another thread are counted when an audio thread makes them. The counts
+ * show in the audio thread dump, and the first call from each site is logged
+ * with its backtrace. Otherwise the guard compiles away and counts nothing.
+ */
+
+#ifndef CRAS_RT_GUARD_H_
+#define CRAS_RT_GUARD_H_
+
+#include <stdint.h>
+
+#ifdef HAVE_RT_GUARD
+
+/* Starts guarding the calling thread, once it is done setting up. */
+void cras_rt_guard_enter();
+
+/* Gets the calls counted over all the audio threads.
+ * Args:
+ *    allocs - Filled with the heap allocations and frees.
+ *    blocking_calls - Filled with the syslog calls and contended locks.
+ */
+void cras_rt_guard_get(uint32_t *allocs, uint32_t *blocking_calls);
+
+/* Logs the backtraces of the sites caught since the last call. Must not run
+ * on an audio thread, symbolizing allocates. */
+void cras_rt_guard_log_sites();
+
+#else
+
+static inline void cras_rt_guard_enter()
+{
+}
+
+static inline void cras_rt_guard_get(uint32_t *allocs,
+				     uint32_t *blocking_calls)
+{
+	*allocs = 0;
+	*blocking_calls = 0;
+}
+
+static inline void cras_rt_guard_log_sites()
+{
+}
+
+#endif /* HAVE_RT_GUARD */
+
+#endif /* CRAS_RT_GUARD_H_ */
@@ -0,0 +1,154 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/param.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_rt_mem.h"
+#include "utlist.h"
+
+/* A registered region, kept with the whole pages it spans.
+ *    addr - The address it was registered with.
+ *    start - First page of the region.
+ *    len - Bytes of the pages spanned.
+ *    locked - Non-zero if the pages are locked.
+ */
+struct rt_region {
+	const void *addr;
+	uintptr_t start;
+	size_t len;
+	int locked;
+	struct rt_region *prev, *next;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct rt_region *regions;
+static size_t budget;
+static size_t locked_bytes;
+static size_t unlocked_bytes;
+/* Set once mlock failed, to log it only once. */
+static int lock_failed;
+
+/* Reads a byte of every page to fault it in. Pages never written are only
+ * mapped to the zero page this way, the kernel is asked to map them
+ * writable first where it can. */
+static void prefault(struct rt_region *region)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	volatile const uint8_t *p;
+
+#ifdef MADV_POPULATE_WRITE
+	if (madvise((void *)region->start, region->len, MADV_POPULATE_WRITE) ==
+	    0)
+		return;
+#endif
+	for (p = (const uint8_t *)region->start;
+	     p < (const uint8_t *)(region->start + region->len); p += page)
+		(void)*p;
+}
+
+/* Locking faults the pages in as well. */
+static int lock_region(struct rt_region *region)
+{
+	if (locked_bytes + region->len > budget)
+		return -ENOMEM;
+	if (mlock((void *)region->start, region->len)) {
+		if (!lock_failed)
+			syslog(LOG_WARNING, "Failed to lock audio memory: %d",
+			       errno);
+		lock_failed = 1;
+		return -errno;
+	}
+	region->locked = 1;
+	locked_bytes += region->len;
+	return 0;
+}
+
+static void unlock_region(struct rt_region *region)
+{
+	struct rt_region *other;
+	uintptr_t start, end;
+
+	munlock((void *)region->start, region->len);
+	region->locked = 0;
+	locked_bytes -= region->len;
+
+	/* Locks aren't counted, pages shared with other locked regions were
+	 * just unlocked too. */
+	DL_FOREACH (regions, other) {
+		if (!other->locked || other == region)
+			continue;
+		start = MAX(other->start, region->start);
+		end = MIN(other->start + other->len,
+			  region->start + region->len);
+		if (start < end)
+			mlock((void *)start, end - start);
+	}
+}
+
+void cras_rt_mem_set_budget(size_t bytes)
+{
+	pthread_mutex_lock(&lock);
+	budget = bytes;
+	pthread_mutex_unlock(&lock);
+}
+
+void cras_rt_mem_add(const void *addr, size_t bytes)
+{
+	size_t page = sysconf(_SC_PAGESIZE);
+	struct rt_region *region;
+
+	if (!addr || !bytes)
+		return;
+
+	region = calloc(1, sizeof(*region));
+	if (!region)
+		return;
+	region->addr = addr;
+	region->start = (uintptr_t)addr & ~(page - 1);
+	region->len = ((uintptr_t)addr + bytes - region->start + page - 1) &
+		      ~(page - 1);
+
+	pthread_mutex_lock(&lock);
+	if (lock_region(region)) {
+		prefault(region);
+		unlocked_bytes += region->len;
+	}
+	DL_APPEND(regions, region);
+	pthread_mutex_unlock(&lock);
+}
+
+void cras_rt_mem_remove(const void *addr)
+{
+	struct rt_region *region;
+
+	if (!addr)
+		return;
+
+	pthread_mutex_lock(&lock);
+	DL_SEARCH_SCALAR(regions, region, addr, addr);
+	if (region) {
+		DL_DELETE(regions, region);
+		if (region->locked)
+			unlock_region(region);
+		else
+			unlocked_bytes -= region->len;
+		free(region);
+	}
+	pthread_mutex_unlock(&lock);
+}
+
+void cras_rt_mem_get(uint32_t *locked, uint32_t *unlocked)
+{
+	pthread_mutex_lock(&lock);
+	*locked = MIN(locked_bytes, UINT32_MAX);
+	*unlocked = MIN(unlocked_bytes, UINT32_MAX);
+	pthread_mutex_unlock(&lock);
+}
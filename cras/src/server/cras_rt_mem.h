@@ -0,0 +1,39 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Keeps the memory the audio thread works on resident. Buffers are
+ * allocated lazily by the allocator and the kernel, the first period after
+ * a device opens, or after the pages were reclaimed under memory pressure,
+ * would otherwise take page faults on the real time path. Registered
+ * regions are faulted in right away and locked in RAM while the locked
+ * total stays within the budget set by the board.
+ */
+
+#ifndef CRAS_RT_MEM_H_
+#define CRAS_RT_MEM_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/* Sets how many bytes of registered memory may be locked, 0 locks none.
+ * Regions already locked stay locked. */
+void cras_rt_mem_set_budget(size_t bytes);
+
+/* Registers a region the audio thread reads or writes. The region is
+ * prefaulted, and locked if it fits in the budget.
+ * Args:
+ *    addr - Start of the region.
+ *    bytes - Size of the region.
+ */
+void cras_rt_mem_add(const void *addr, size_t bytes);
+
+/* Unregisters the region starting at addr, call before freeing it. Does
+ * nothing if addr was not registered. */
+void cras_rt_mem_remove(const void *addr);
+
+/* Gets the registered bytes that are locked and those left unlocked, in
+ * whole pages. */
+void cras_rt_mem_get(uint32_t *locked_bytes, uint32_t *unlocked_bytes);
+
+#endif /* CRAS_RT_MEM_H_ */
@@ -0,0 +1,146 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+#include <syslog.h>
+
+#include "cras_rtp_io.h"
+#include "cras_rtp_iodev.h"
+#include "iniparser_wrapper.h"
+
+#define RTP_INI "rtp.ini"
+#define RTP_KEY_DIR "dir"
+#define RTP_KEY_ADDRESS "address"
+#define RTP_KEY_PORT "port"
+#define RTP_KEY_RATE "rate"
+#define RTP_KEY_CHANNELS "channels"
+#define RTP_KEY_PACKET_MS "packet_ms"
+#define RTP_KEY_JITTER_MS "jitter_ms"
+#define RTP_KEY_PAYLOAD_TYPE "payload_type"
+#define RTP_KEY_CLOCK "clock"
+
+static const int RTP_PORT_DEFAULT = 5004;
+static const int RTP_RATE_DEFAULT = 48000;
+static const int RTP_CHANNELS_DEFAULT = 2;
+static const int RTP_PACKET_MS_DEFAULT = 5;
+static const int RTP_JITTER_MS_DEFAULT = 40;
+/* The first dynamic payload type, L16 has static ones for 44100 only. */
+static const int RTP_PAYLOAD_TYPE_DEFAULT = 96;
+
+static dictionary *rtp_ini;
+
+static const char *get_string(const char *sec_name, const char *key,
+			      const char *def)
+{
+	char key_name[MAX_INI_KEY_LENGTH + 1];
+
+	snprintf(key_name, MAX_INI_KEY_LENGTH, "%s:%s", sec_name, key);
+	key_name[MAX_INI_KEY_LENGTH] = '\0';
+	return iniparser_getstring(rtp_ini, key_name, def);
+}
+
+static int get_int(const char *sec_name, const char *key, int def)
+{
+	char key_name[MAX_INI_KEY_LENGTH + 1];
+
+	snprintf(key_name, MAX_INI_KEY_LENGTH, "%s:%s", sec_name, key);
+	key_name[MAX_INI_KEY_LENGTH] = '\0';
+	return iniparser_getint(rtp_ini, key_name, def);
+}
+
+/* Fills the address of config from a numeric host and port. */
+static int parse_address(const char *host, int port,
+			 struct rtp_iodev_config *config)
+{
+	struct addrinfo hints, *res;
+	char port_str[8];
+	int rc;
+
+	memset(&hints, 0, sizeof(hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_DGRAM;
+	hints.ai_flags = AI_NUMERICHOST | AI_NUMERICSERV;
+	snprintf(port_str, sizeof(port_str), "%d", port);
+	rc = getaddrinfo(host, port_str, &hints, &res);
+	if (rc)
+		return -EINVAL;
+	memcpy(&config->addr, res->ai_addr, res->ai_addrlen);
+	config->addr_len = res->ai_addrlen;
+	freeaddrinfo(res);
+	return 0;
+}
+
+static void create_rtp_iodev(const char *sec_name)
+{
+	struct rtp_iodev_config config;
+	const char *dir, *address;
+	int port;
+
+	memset(&config, 0, sizeof(config));
+	config.name = sec_name;
+
+	dir = get_string(sec_name, RTP_KEY_DIR, "");
+	if (strcmp(dir, "output") == 0)
+		config.direction = CRAS_STREAM_OUTPUT;
+	else if (strcmp(dir, "input") == 0)
+		config.direction = CRAS_STREAM_INPUT;
+	else
+		goto invalid;
+
+	/* An output must have somewhere to send to. */
+	address = get_string(sec_name, RTP_KEY_ADDRESS,
+			     config.direction == CRAS_STREAM_INPUT ? "0.0.0.0" :
+								     NULL);
+	port = get_int(sec_name, RTP_KEY_PORT, RTP_PORT_DEFAULT);
+	if (!address || port <= 0 || port > 65535 ||
+	    parse_address(address, port, &config))
+		goto invalid;
+
+	config.frame_rate = get_int(sec_name, RTP_KEY_RATE, RTP_RATE_DEFAULT);
+	config.num_channels =
+		get_int(sec_name, RTP_KEY_CHANNELS, RTP_CHANNELS_DEFAULT);
+	config.packet_frames =
+		config.frame_rate *
+		get_int(sec_name, RTP_KEY_PACKET_MS, RTP_PACKET_MS_DEFAULT) /
+		1000;
+	config.jitter_frames =
+		config.frame_rate *
+		get_int(sec_name, RTP_KEY_JITTER_MS, RTP_JITTER_MS_DEFAULT) /
+		1000;
+	config.payload_type = get_int(sec_name, RTP_KEY_PAYLOAD_TYPE,
+				      RTP_PAYLOAD_TYPE_DEFAULT);
+	config.clock = get_string(sec_name, RTP_KEY_CLOCK, NULL);
+
+	syslog(LOG_DEBUG, "Creating RTP %s %s, %s port %d", dir, sec_name,
+	       address, port);
+	if (rtp_iodev_create(&config))
+		return;
+
+invalid:
+	syslog(LOG_ERR, "Invalid RTP device %s in %s", sec_name, RTP_INI);
+}
+
+void cras_rtp_io_init(const char *device_config_dir)
+{
+	char ini_name[MAX_INI_NAME_LENGTH + 1];
+	int nsec, i;
+
+	snprintf(ini_name, MAX_INI_NAME_LENGTH, "%s/%s", device_config_dir,
+		 RTP_INI);
+	ini_name[MAX_INI_NAME_LENGTH] = '\0';
+
+	rtp_ini = iniparser_load_wrapper(ini_name);
+	if (!rtp_ini)
+		return;
+
+	nsec = iniparser_getnsec(rtp_ini);
+	for (i = 0; i < nsec; i++)
+		create_rtp_iodev(iniparser_getsecname(rtp_ini, i));
+
+	iniparser_freedict(rtp_ini);
+	rtp_ini = NULL;
+}
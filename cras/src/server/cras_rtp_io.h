@@ -0,0 +1,28 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef CRAS_RTP_IO_H_
+#define CRAS_RTP_IO_H_
+
+/* Creates the RTP iodevs listed in rtp.ini in device_config_dir, one per
+ * section, like:
+ *
+ *   [Living Room]
+ *   dir=output            ; or input
+ *   address=239.255.0.1   ; input: the group to join, or omitted for any
+ *   port=5004
+ *   rate=48000
+ *   channels=2
+ *   packet_ms=5           ; output only
+ *   jitter_ms=40          ; input only
+ *   payload_type=96
+ *   clock=/dev/ptp0       ; omitted for CLOCK_REALTIME
+ *
+ * The section name is the name of the node. Sections that don't parse are
+ * logged and skipped.
+ */
+void cras_rtp_io_init(const char *device_config_dir);
+
+#endif /* CRAS_RTP_IO_H_ */
@@ -0,0 +1,684 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/time.h>
+#include <syslog.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "cras_iodev_list.h"
+#include "cras_rtp_iodev.h"
+#include "cras_util.h"
+#include "rtp.h"
+#include "sfh.h"
+
+/* Frames the ring buffer of a device holds, both ways. */
+#define RTP_BUFFER_FRAMES 8192
+/* Most packets sent or received with one system call. */
+#define RTP_BATCH 16
+/* Payloads are kept within an ethernet frame. */
+#define RTP_MAX_PAYLOAD 1400
+#define RTP_HEADER_SIZE sizeof(struct rtp_header)
+#define RTP_MAX_PACKET (RTP_HEADER_SIZE + RTP_MAX_PAYLOAD)
+#define RTP_VERSION 2
+
+/* Turns the fd of an open PTP clock device into a clock id, see
+ * Documentation/driver-api/ptp.rst in the kernel. */
+#define CLOCKFD 3
+#define FD_TO_CLOCKID(fd) ((~(clockid_t)(fd) << 3) | CLOCKFD)
+
+/* An RTP device. Frame n of the stream is at (n % RTP_BUFFER_FRAMES) in
+ * ring, the counts below never wrap.
+ *    config - The settings it was created with, name excluded.
+ *    rates, channel_counts, formats - The one format it supports.
+ *    fd - The UDP socket while open, -1 otherwise.
+ *    clock_fd - The open PTP clock device, -1 for CLOCK_REALTIME.
+ *    clock_id - The reference clock.
+ *    ring - The audio, in the native byte order.
+ *    start - On the reference clock, when frame start_frame is due.
+ *    start_frame - The frame due at start.
+ *    written - For output, the frames put by the audio thread.
+ *    sent - For output, the frames sent.
+ *    seq, ssrc, ts_base - For output, the sequence number of the next
+ *        packet, the source id and the RTP timestamp of frame 0.
+ *    read - For input, the frames taken by the audio thread.
+ *    end - For input, the end of the latest packet received.
+ *    locked - For input, set once a packet sets the sender, its ssrc and
+ *        the RTP timestamp of frame 0, ts_base.
+ *    started - For input, set once jitter_frames are buffered, the frames
+ *        are then due at the rate of the reference clock.
+ *    packets - Room for a batch of packets.
+ *    msgs, iovs - The batch passed to sendmmsg or recvmmsg.
+ */
+struct rtp_io {
+	struct cras_iodev base;
+	struct rtp_iodev_config config;
+	size_t rates[2];
+	size_t channel_counts[2];
+	snd_pcm_format_t formats[2];
+	int fd;
+	int clock_fd;
+	clockid_t clock_id;
+	uint8_t *ring;
+	struct timespec start;
+	uint64_t start_frame;
+	uint64_t written;
+	uint64_t sent;
+	uint16_t seq;
+	uint32_t ssrc;
+	uint32_t ts_base;
+	uint64_t read;
+	uint64_t end;
+	int locked;
+	int started;
+	uint8_t *packets;
+	struct mmsghdr msgs[RTP_BATCH];
+	struct iovec iovs[RTP_BATCH];
+};
+
+static unsigned int frame_bytes(const struct rtp_io *rtpio)
+{
+	return rtpio->config.num_channels * 2;
+}
+
+static uint8_t *ring_frame(const struct rtp_io *rtpio, uint64_t frame)
+{
+	return rtpio->ring + (frame % RTP_BUFFER_FRAMES) * frame_bytes(rtpio);
+}
+
+/* Frames due since start on the reference clock. */
+static uint64_t due_frames(const struct rtp_io *rtpio)
+{
+	struct timespec now, diff;
+
+	clock_gettime(rtpio->clock_id, &now);
+	if (!timespec_after(&now, &rtpio->start))
+		return rtpio->start_frame;
+	subtract_timespecs(&now, &rtpio->start, &diff);
+	return rtpio->start_frame +
+	       cras_time_to_frames(&diff, rtpio->config.frame_rate);
+}
+
+/* Copies frames from ring to a packet payload or back, swapping to or from
+ * the network byte order. */
+static void copy_swapped(uint16_t *dst, const uint16_t *src, size_t samples)
+{
+	size_t i;
+
+	for (i = 0; i < samples; i++)
+		dst[i] = htons(src[i]);
+}
+
+static void ring_to_payload(const struct rtp_io *rtpio, uint8_t *payload,
+			    uint64_t frame, unsigned int frames)
+{
+	unsigned int fb = frame_bytes(rtpio);
+	unsigned int n;
+
+	while (frames) {
+		n = MIN(frames, RTP_BUFFER_FRAMES - frame % RTP_BUFFER_FRAMES);
+		copy_swapped((uint16_t *)payload,
+			     (const uint16_t *)ring_frame(rtpio, frame),
+			     n * fb / 2);
+		payload += n * fb;
+		frame += n;
+		frames -= n;
+	}
+}
+
+static void payload_to_ring(struct rtp_io *rtpio, const uint8_t *payload,
+			    uint64_t frame, unsigned int frames)
+{
+	unsigned int fb = frame_bytes(rtpio);
+	unsigned int n;
+
+	while (frames) {
+		n = MIN(frames, RTP_BUFFER_FRAMES - frame % RTP_BUFFER_FRAMES);
+		copy_swapped((uint16_t *)ring_frame(rtpio, frame),
+			     (const uint16_t *)payload, n * fb / 2);
+		payload += n * fb;
+		frame += n;
+		frames -= n;
+	}
+}
+
+static void zero_ring(struct rtp_io *rtpio, uint64_t frame, uint64_t frames)
+{
+	unsigned int n;
+
+	frames = MIN(frames, RTP_BUFFER_FRAMES);
+	while (frames) {
+		n = MIN(frames, RTP_BUFFER_FRAMES - frame % RTP_BUFFER_FRAMES);
+		memset(ring_frame(rtpio, frame), 0, n * frame_bytes(rtpio));
+		frame += n;
+		frames -= n;
+	}
+}
+
+/*
+ * Output.
+ */
+
+static void fill_header(struct rtp_io *rtpio, struct rtp_header *header,
+			uint64_t frame)
+{
+	memset(header, 0, sizeof(*header));
+	header->v = RTP_VERSION;
+	header->pt = rtpio->config.payload_type;
+	/* Marks the first packet, and the first after a gap. */
+	header->m = frame == rtpio->start_frame;
+	header->sequence_number = htons(rtpio->seq++);
+	header->timestamp = htonl(rtpio->ts_base + (uint32_t)frame);
+	header->ssrc = htonl(rtpio->ssrc);
+}
+
+/* Sends the packets due on the reference clock, in batches. Frames the
+ * audio thread didn't put in time go out as silence, the receivers keep
+ * time by the RTP timestamps. Send errors only lose the packets, like a
+ * sink that isn't there. */
+static void send_due(struct rtp_io *rtpio)
+{
+	unsigned int pf = rtpio->config.packet_frames;
+	unsigned int packet_bytes = RTP_HEADER_SIZE + pf * frame_bytes(rtpio);
+	uint64_t due = due_frames(rtpio);
+	unsigned int n;
+	uint8_t *packet;
+	int rc;
+
+	/* After a stall, like a suspend, skip to the present rather than
+	 * flood the network with what is late anyway. */
+	if (due - rtpio->sent > RTP_BUFFER_FRAMES) {
+		rtpio->start_frame = due - (due - rtpio->sent) % pf;
+		clock_gettime(rtpio->clock_id, &rtpio->start);
+		rtpio->sent = rtpio->start_frame;
+		rtpio->written = MAX(rtpio->written, rtpio->sent);
+		due = rtpio->sent;
+	}
+
+	while (rtpio->sent + pf <= due) {
+		for (n = 0; n < RTP_BATCH && rtpio->sent + pf <= due; n++) {
+			if (rtpio->written < rtpio->sent + pf) {
+				zero_ring(rtpio, rtpio->written,
+					  rtpio->sent + pf - rtpio->written);
+				rtpio->written = rtpio->sent + pf;
+			}
+			packet = rtpio->packets + n * RTP_MAX_PACKET;
+			fill_header(rtpio, (struct rtp_header *)packet,
+				    rtpio->sent);
+			ring_to_payload(rtpio, packet + RTP_HEADER_SIZE,
+					rtpio->sent, pf);
+			rtpio->iovs[n].iov_len = packet_bytes;
+			rtpio->sent += pf;
+		}
+		rc = sendmmsg(rtpio->fd, rtpio->msgs, n, MSG_DONTWAIT);
+		if (rc < 0 && errno != EAGAIN && errno != ENOBUFS &&
+		    errno != ECONNREFUSED)
+			syslog(LOG_WARNING, "%s: send failed: %d",
+			       rtpio->base.info.name, errno);
+	}
+}
+
+/*
+ * Input.
+ */
+
+/* Starts over from the packet with the given ssrc and timestamp, dropping
+ * what was buffered. */
+static void lock_to_sender(struct rtp_io *rtpio, uint32_t ssrc, uint32_t ts)
+{
+	zero_ring(rtpio, rtpio->read, RTP_BUFFER_FRAMES);
+	rtpio->ssrc = ssrc;
+	rtpio->ts_base = ts - (uint32_t)rtpio->read;
+	rtpio->end = rtpio->read;
+	rtpio->locked = 1;
+	rtpio->started = 0;
+}
+
+/* Puts a received packet in the jitter buffer at the place of its
+ * timestamp. Late packets are dropped, what was lost stays silent. */
+static void receive_packet(struct rtp_io *rtpio, const uint8_t *packet,
+			   size_t len)
+{
+	const struct rtp_header *header = (const struct rtp_header *)packet;
+	unsigned int fb = frame_bytes(rtpio);
+	size_t offset = RTP_HEADER_SIZE;
+	uint32_t ssrc, ts;
+	int32_t rel;
+	unsigned int frames;
+
+	if (len < RTP_HEADER_SIZE || header->v != RTP_VERSION ||
+	    header->pt != rtpio->config.payload_type)
+		return;
+	offset += header->cc * 4;
+	if (header->x) {
+		if (len < offset + 4)
+			return;
+		offset += 4 + 4 * ((packet[offset + 2] << 8) |
+				   packet[offset + 3]);
+	}
+	if (len <= offset)
+		return;
+	if (header->p) {
+		if (packet[len - 1] >= len - offset)
+			return;
+		len -= packet[len - 1];
+	}
+	if ((len - offset) % fb)
+		return;
+	frames = (len - offset) / fb;
+
+	ssrc = ntohl(header->ssrc);
+	ts = ntohl(header->timestamp);
+	if (!rtpio->locked || ssrc != rtpio->ssrc)
+		lock_to_sender(rtpio, ssrc, ts);
+
+	rel = (int32_t)(ts - (rtpio->ts_base + (uint32_t)rtpio->read));
+	if (rel < 0)
+		return;
+	/* The sender jumped ahead, or restarted with the same ssrc. */
+	if (rel + frames > RTP_BUFFER_FRAMES) {
+		lock_to_sender(rtpio, ssrc, ts);
+		rel = 0;
+	}
+	payload_to_ring(rtpio, packet + offset, rtpio->read + rel, frames);
+	rtpio->end = MAX(rtpio->end, rtpio->read + rel + frames);
+}
+
+static void receive_packets(struct rtp_io *rtpio)
+{
+	int i, rc;
+
+	do {
+		for (i = 0; i < RTP_BATCH; i++)
+			rtpio->iovs[i].iov_len = RTP_MAX_PACKET;
+		rc = recvmmsg(rtpio->fd, rtpio->msgs, RTP_BATCH, MSG_DONTWAIT,
+			      NULL);
+		for (i = 0; i < rc; i++)
+			receive_packet(rtpio,
+				       rtpio->packets + i * RTP_MAX_PACKET,
+				       rtpio->msgs[i].msg_len);
+	} while (rc == RTP_BATCH);
+
+	if (!rtpio->started && rtpio->locked &&
+	    rtpio->end - rtpio->read >= rtpio->config.jitter_frames) {
+		clock_gettime(rtpio->clock_id, &rtpio->start);
+		rtpio->start_frame = rtpio->read;
+		rtpio->started = 1;
+	}
+}
+
+/* The frames due that the audio thread hasn't read yet. Once started the
+ * buffer is played out whether packets arrived or not. */
+static unsigned int input_level(const struct rtp_io *rtpio)
+{
+	if (!rtpio->started)
+		return 0;
+	return MIN(due_frames(rtpio) - rtpio->read, RTP_BUFFER_FRAMES);
+}
+
+static int open_input_socket(struct rtp_io *rtpio)
+{
+	const struct sockaddr_storage *addr = &rtpio->config.addr;
+	struct sockaddr_storage bind_addr = *addr;
+	int on = 1;
+	int fd;
+
+	fd = socket(addr->ss_family, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+	if (fd < 0)
+		return -errno;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	if (addr->ss_family == AF_INET) {
+		const struct sockaddr_in *in = (const struct sockaddr_in *)addr;
+		struct ip_mreq mreq;
+
+		if (IN_MULTICAST(ntohl(in->sin_addr.s_addr))) {
+			((struct sockaddr_in *)&bind_addr)->sin_addr.s_addr =
+				htonl(INADDR_ANY);
+			memset(&mreq, 0, sizeof(mreq));
+			mreq.imr_multiaddr = in->sin_addr;
+			mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+			if (setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq,
+				       sizeof(mreq)) < 0)
+				goto error;
+		}
+	} else if (addr->ss_family == AF_INET6) {
+		const struct sockaddr_in6 *in6 =
+			(const struct sockaddr_in6 *)addr;
+		struct ipv6_mreq mreq6;
+
+		if (IN6_IS_ADDR_MULTICAST(&in6->sin6_addr)) {
+			((struct sockaddr_in6 *)&bind_addr)->sin6_addr =
+				in6addr_any;
+			memset(&mreq6, 0, sizeof(mreq6));
+			mreq6.ipv6mr_multiaddr = in6->sin6_addr;
+			if (setsockopt(fd, IPPROTO_IPV6, IPV6_JOIN_GROUP,
+				       &mreq6, sizeof(mreq6)) < 0)
+				goto error;
+		}
+	}
+
+	if (bind(fd, (struct sockaddr *)&bind_addr, rtpio->config.addr_len) <
+	    0)
+		goto error;
+	return fd;
+
+error:
+	close(fd);
+	return -errno;
+}
+
+/*
+ * iodev callbacks.
+ */
+
+static int frames_queued(const struct cras_iodev *iodev,
+			 struct timespec *tstamp)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+	uint64_t due;
+	unsigned int level;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		send_due(rtpio);
+		due = due_frames(rtpio);
+		level = rtpio->written > due ? rtpio->written - due : 0;
+	} else {
+		receive_packets(rtpio);
+		level = input_level(rtpio);
+	}
+	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	return level;
+}
+
+static int delay_frames(const struct cras_iodev *iodev)
+{
+	struct timespec tstamp;
+
+	return frames_queued(iodev, &tstamp);
+}
+
+static int close_dev(struct cras_iodev *iodev)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+
+	if (rtpio->fd >= 0)
+		close(rtpio->fd);
+	rtpio->fd = -1;
+	free(rtpio->ring);
+	rtpio->ring = NULL;
+	free(rtpio->packets);
+	rtpio->packets = NULL;
+	cras_iodev_free_audio_area(iodev);
+	return 0;
+}
+
+static int configure_dev(struct cras_iodev *iodev)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+	unsigned int i;
+	int rc;
+
+	if (iodev->format == NULL)
+		return -EINVAL;
+
+	rtpio->ring = (uint8_t *)calloc(RTP_BUFFER_FRAMES, frame_bytes(rtpio));
+	rtpio->packets = (uint8_t *)calloc(RTP_BATCH, RTP_MAX_PACKET);
+	if (!rtpio->ring || !rtpio->packets) {
+		rc = -ENOMEM;
+		goto error;
+	}
+	memset(rtpio->msgs, 0, sizeof(rtpio->msgs));
+	for (i = 0; i < RTP_BATCH; i++) {
+		rtpio->iovs[i].iov_base = rtpio->packets + i * RTP_MAX_PACKET;
+		rtpio->msgs[i].msg_hdr.msg_iov = &rtpio->iovs[i];
+		rtpio->msgs[i].msg_hdr.msg_iovlen = 1;
+	}
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		rtpio->fd = socket(rtpio->config.addr.ss_family,
+				   SOCK_DGRAM | SOCK_CLOEXEC, 0);
+		if (rtpio->fd < 0 ||
+		    connect(rtpio->fd, (struct sockaddr *)&rtpio->config.addr,
+			    rtpio->config.addr_len) < 0) {
+			rc = -errno;
+			goto error;
+		}
+		rtpio->ssrc = random();
+		rtpio->seq = random();
+		rtpio->ts_base = random();
+	} else {
+		rc = open_input_socket(rtpio);
+		if (rc < 0)
+			goto error;
+		rtpio->fd = rc;
+	}
+
+	cras_iodev_init_audio_area(iodev, iodev->format->num_channels);
+	clock_gettime(rtpio->clock_id, &rtpio->start);
+	rtpio->start_frame = 0;
+	rtpio->written = 0;
+	rtpio->sent = 0;
+	rtpio->read = 0;
+	rtpio->end = 0;
+	rtpio->locked = 0;
+	rtpio->started = 0;
+	return 0;
+
+error:
+	syslog(LOG_ERR, "%s: failed to open: %d", iodev->info.name, rc);
+	close_dev(iodev);
+	return rc;
+}
+
+static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
+		      unsigned *frames)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+	uint64_t pos;
+	unsigned int avail;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		pos = rtpio->written;
+		avail = RTP_BUFFER_FRAMES - (rtpio->written - rtpio->sent);
+	} else {
+		pos = rtpio->read;
+		avail = input_level(rtpio);
+	}
+	avail = MIN(avail, RTP_BUFFER_FRAMES - pos % RTP_BUFFER_FRAMES);
+	*frames = MIN(*frames, avail);
+
+	iodev->area->frames = *frames;
+	cras_audio_area_config_buf_pointers(iodev->area, iodev->format,
+					    ring_frame(rtpio, pos));
+	*area = iodev->area;
+	return 0;
+}
+
+static int put_buffer(struct cras_iodev *iodev, unsigned frames)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT) {
+		if (rtpio->written + frames - rtpio->sent > RTP_BUFFER_FRAMES)
+			return -EPIPE;
+		rtpio->written += frames;
+		return 0;
+	}
+
+	if (input_level(rtpio) < frames)
+		return -EPIPE;
+	/* What is read is cleared, so frames that never arrive play as
+	 * silence the next time around. */
+	zero_ring(rtpio, rtpio->read, frames);
+	rtpio->read += frames;
+	return 0;
+}
+
+static int flush_buffer(struct cras_iodev *iodev)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		rtpio->written = MAX(rtpio->sent, due_frames(rtpio));
+	else
+		rtpio->locked = 0;
+	return 0;
+}
+
+static void update_active_node(struct cras_iodev *iodev, unsigned node_idx,
+			       unsigned dev_enabled)
+{
+}
+
+static int open_clock(struct rtp_io *rtpio)
+{
+	const char *clock = rtpio->config.clock;
+
+	rtpio->clock_fd = -1;
+	rtpio->clock_id = CLOCK_REALTIME;
+	if (!clock || !strcmp(clock, "realtime"))
+		return 0;
+
+	rtpio->clock_fd = open(clock, O_RDONLY | O_CLOEXEC);
+	if (rtpio->clock_fd < 0) {
+		syslog(LOG_ERR, "Failed to open clock %s: %d", clock, errno);
+		return -errno;
+	}
+	rtpio->clock_id = FD_TO_CLOCKID(rtpio->clock_fd);
+	return 0;
+}
+
+/*
+ * Exported Interface.
+ */
+
+struct cras_iodev *rtp_iodev_create(const struct rtp_iodev_config *config)
+{
+	struct rtp_io *rtpio;
+	struct cras_iodev *iodev;
+	struct cras_ionode *node;
+	unsigned int max_frames;
+
+	if (config->direction != CRAS_STREAM_INPUT &&
+	    config->direction != CRAS_STREAM_OUTPUT)
+		return NULL;
+	if (!config->name || config->frame_rate == 0 ||
+	    config->num_channels < 1 || config->num_channels > 2 ||
+	    config->payload_type > 127)
+		return NULL;
+	max_frames = RTP_MAX_PAYLOAD / (config->num_channels * 2);
+	if (config->direction == CRAS_STREAM_OUTPUT &&
+	    (config->packet_frames == 0 || config->packet_frames > max_frames))
+		return NULL;
+	if (config->direction == CRAS_STREAM_INPUT &&
+	    config->jitter_frames > RTP_BUFFER_FRAMES / 2)
+		return NULL;
+
+	rtpio = (struct rtp_io *)calloc(1, sizeof(*rtpio));
+	if (!rtpio)
+		return NULL;
+	rtpio->config = *config;
+	rtpio->config.name = NULL;
+	rtpio->config.clock = NULL;
+	if (config->clock) {
+		rtpio->config.clock = strdup(config->clock);
+		if (!rtpio->config.clock) {
+			free(rtpio);
+			return NULL;
+		}
+	}
+	if (open_clock(rtpio)) {
+		free((char *)rtpio->config.clock);
+		free(rtpio);
+		return NULL;
+	}
+	rtpio->fd = -1;
+
+	iodev = &rtpio->base;
+	iodev->direction = config->direction;
+
+	rtpio->rates[0] = config->frame_rate;
+	rtpio->channel_counts[0] = config->num_channels;
+	rtpio->formats[0] = SND_PCM_FORMAT_S16_LE;
+	iodev->supported_rates = rtpio->rates;
+	iodev->supported_channel_counts = rtpio->channel_counts;
+	iodev->supported_formats = rtpio->formats;
+	iodev->buffer_size = RTP_BUFFER_FRAMES;
+	iodev->info.max_supported_channels = config->num_channels;
+
+	iodev->configure_dev = configure_dev;
+	iodev->close_dev = close_dev;
+	iodev->frames_queued = frames_queued;
+	iodev->delay_frames = delay_frames;
+	iodev->get_buffer = get_buffer;
+	iodev->put_buffer = put_buffer;
+	iodev->flush_buffer = flush_buffer;
+	iodev->update_active_node = update_active_node;
+	if (config->direction == CRAS_STREAM_OUTPUT) {
+		iodev->no_stream = cras_iodev_default_no_stream_playback;
+		/* The receivers play what they get at full scale. */
+		iodev->software_volume_needed = 1;
+	}
+
+	snprintf(iodev->info.name, sizeof(iodev->info.name), "%s",
+		 config->name);
+	iodev->info.name[ARRAY_SIZE(iodev->info.name) - 1] = '\0';
+	iodev->info.stable_id =
+		SuperFastHash(iodev->info.name, strlen(iodev->info.name),
+			      strlen(iodev->info.name));
+
+	node = (struct cras_ionode *)calloc(1, sizeof(*node));
+	if (!node) {
+		rtp_iodev_destroy(iodev);
+		return NULL;
+	}
+	node->dev = iodev;
+	node->type = CRAS_NODE_TYPE_NETWORK;
+	node->plugged = 1;
+	node->volume = 100;
+	node->ui_gain_scaler = 1.0f;
+	gettimeofday(&node->plugged_time, NULL);
+	snprintf(node->name, sizeof(node->name), "%s", iodev->info.name);
+	node->stable_id = iodev->info.stable_id;
+	cras_iodev_add_node(iodev, node);
+	cras_iodev_set_active_node(iodev, node);
+
+	if (config->direction == CRAS_STREAM_OUTPUT)
+		cras_iodev_list_add_output(iodev);
+	else
+		cras_iodev_list_add_input(iodev);
+
+	return iodev;
+}
+
+void rtp_iodev_destroy(struct cras_iodev *iodev)
+{
+	struct rtp_io *rtpio = (struct rtp_io *)iodev;
+	struct cras_ionode *node = iodev->active_node;
+
+	if (node) {
+		if (iodev->direction == CRAS_STREAM_OUTPUT)
+			cras_iodev_list_rm_output(iodev);
+		else
+			cras_iodev_list_rm_input(iodev);
+		cras_iodev_rm_node(iodev, node);
+		free(node);
+	}
+	if (rtpio->clock_fd >= 0)
+		close(rtpio->clock_fd);
+	free((char *)rtpio->config.clock);
+	cras_iodev_free_resources(iodev);
+	free(rtpio);
+}
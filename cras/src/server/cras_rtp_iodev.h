@@ -0,0 +1,62 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * RTP iodevs stream L16 audio (RFC 3551) over UDP, so a network sink or
+ * source shows up as a normal node. Both directions are paced by a
+ * reference clock, CLOCK_REALTIME kept in step by NTP or a PTP hardware
+ * clock, rather than by the network: an output sends the packets that are
+ * due on that clock, an input plays its jitter buffer out at that rate.
+ * The levels are timestamped on CLOCK_MONOTONIC_RAW like those of any
+ * other device, so the rate estimator follows the reference clock and
+ * the streams are resampled to it.
+ */
+
+#ifndef CRAS_RTP_IODEV_H_
+#define CRAS_RTP_IODEV_H_
+
+#include <sys/socket.h>
+
+#include "cras_types.h"
+
+struct cras_iodev;
+
+/* The settings of an RTP iodev.
+ *    name - The name of the device and its node.
+ *    direction - Output to send, input to receive.
+ *    addr, addr_len - For output, where to send, a unicast or multicast
+ *        address. For input, the port to listen on, and the multicast group
+ *        to join or the local address to bind, or the any address.
+ *    frame_rate - The rate of the stream on the network.
+ *    num_channels - The number of channels on the network, 1 or 2.
+ *    packet_frames - For output, the frames sent per packet.
+ *    jitter_frames - For input, the frames buffered before playing out.
+ *    payload_type - The RTP payload type sent, or checked on receive.
+ *    clock - The reference clock, NULL or "realtime" for CLOCK_REALTIME,
+ *        or the path of a PTP clock device, like "/dev/ptp0".
+ */
+struct rtp_iodev_config {
+	const char *name;
+	enum CRAS_STREAM_DIRECTION direction;
+	struct sockaddr_storage addr;
+	socklen_t addr_len;
+	size_t frame_rate;
+	size_t num_channels;
+	unsigned int packet_frames;
+	unsigned int jitter_frames;
+	unsigned int payload_type;
+	const char *clock;
+};
+
+/* Creates an RTP iodev and adds it to the iodev list.
+ * Args:
+ *    config - The settings, copied.
+ * Returns:
+ *    The iodev, or NULL if the settings are invalid or on error.
+ */
+struct cras_iodev *rtp_iodev_create(const struct rtp_iodev_config *config);
+
+/* Removes an RTP iodev from the iodev list and frees it. */
+void rtp_iodev_destroy(struct cras_iodev *iodev);
+
+#endif /* CRAS_RTP_IODEV_H_ */
@@ -0,0 +1,151 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include "cras_sample_cache.h"
+#include "cras_types.h"
+#include "server_stream.h"
+#include "utlist.h"
+
+static struct cras_sample *samples;
+/* Bytes of audio of all the samples in the cache. */
+static size_t cached_bytes;
+
+static size_t sample_bytes(const struct cras_sample *sample)
+{
+	return sample->frames * cras_get_format_bytes(&sample->format);
+}
+
+/* Samples are played by server streams, so take what a stream takes. */
+static int format_valid(const struct cras_audio_format *format)
+{
+	if (format->frame_rate < 4000 || format->frame_rate > 192000)
+		return 0;
+	if (format->num_channels < 1 || format->num_channels > CRAS_CH_MAX)
+		return 0;
+	return format->format == SND_PCM_FORMAT_S16_LE ||
+	       format->format == SND_PCM_FORMAT_S32_LE ||
+	       format->format == SND_PCM_FORMAT_U8 ||
+	       format->format == SND_PCM_FORMAT_S24_LE ||
+	       format->format == SND_PCM_FORMAT_FLOAT_LE;
+}
+
+static struct cras_sample *find_sample(uint32_t id)
+{
+	struct cras_sample *sample;
+
+	DL_FOREACH (samples, sample)
+		if (sample->id == id)
+			return sample;
+	return NULL;
+}
+
+static void remove_sample(struct cras_sample *sample)
+{
+	DL_DELETE(samples, sample);
+	cached_bytes -= sample_bytes(sample);
+	cras_sample_put(sample);
+}
+
+/* Reads bytes from the start of fd, which must hold that many. */
+static int read_samples(int fd, uint8_t *buf, size_t bytes)
+{
+	size_t done = 0;
+	ssize_t rc;
+
+	while (done < bytes) {
+		rc = pread(fd, buf + done, bytes - done, done);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		if (rc == 0)
+			return -EINVAL;
+		done += rc;
+	}
+	return 0;
+}
+
+int cras_sample_cache_add(uint32_t id, const struct cras_audio_format *format,
+			  int fd, size_t frames)
+{
+	struct cras_sample *sample, *old;
+	size_t frame_bytes, bytes, freed;
+	int rc;
+
+	if (!format_valid(format) || frames == 0)
+		return -EINVAL;
+	frame_bytes = cras_get_format_bytes(format);
+	if (frames > CRAS_SAMPLE_MAX_BYTES / frame_bytes)
+		return -EINVAL;
+	bytes = frames * frame_bytes;
+
+	old = find_sample(id);
+	freed = old ? sample_bytes(old) : 0;
+	if (cached_bytes - freed + bytes > CRAS_SAMPLE_CACHE_MAX_BYTES) {
+		syslog(LOG_ERR, "No room to cache sample %u, %zu bytes", id,
+		       bytes);
+		return -ENOSPC;
+	}
+
+	sample = (struct cras_sample *)calloc(1, sizeof(*sample));
+	if (!sample)
+		return -ENOMEM;
+	sample->samples = (uint8_t *)malloc(bytes);
+	if (!sample->samples) {
+		free(sample);
+		return -ENOMEM;
+	}
+	rc = read_samples(fd, sample->samples, bytes);
+	if (rc < 0) {
+		syslog(LOG_ERR, "Failed to read sample %u: %d", id, rc);
+		free(sample->samples);
+		free(sample);
+		return rc;
+	}
+	sample->id = id;
+	sample->format = *format;
+	sample->frames = frames;
+	sample->refs = 1;
+
+	if (old)
+		remove_sample(old);
+	DL_APPEND(samples, sample);
+	cached_bytes += bytes;
+	return 0;
+}
+
+int cras_sample_cache_remove(uint32_t id)
+{
+	struct cras_sample *sample = find_sample(id);
+
+	if (!sample)
+		return -ENOENT;
+	remove_sample(sample);
+	return 0;
+}
+
+int cras_sample_cache_play(struct stream_list *stream_list, uint32_t id,
+			   uint32_t dev_idx)
+{
+	struct cras_sample *sample = find_sample(id);
+
+	if (!sample)
+		return -ENOENT;
+	return server_stream_play_sample(stream_list, dev_idx, sample);
+}
+
+void cras_sample_cache_clear()
+{
+	struct cras_sample *sample;
+
+	DL_FOREACH (samples, sample)
+		remove_sample(sample);
+}
@@ -0,0 +1,93 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The sample cache keeps short clips, like UI and notification sounds,
+ * uploaded once by clients. A client then plays a clip by its id with a
+ * single message, and the server plays it as a server stream fed straight
+ * from the cache, with no client callbacks or stream setup by the client.
+ */
+
+#ifndef CRAS_SAMPLE_CACHE_H_
+#define CRAS_SAMPLE_CACHE_H_
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "cras_audio_format.h"
+
+/* Most bytes of audio one sample can hold. */
+#define CRAS_SAMPLE_MAX_BYTES (2 * 1024 * 1024)
+/* Most bytes of audio the cache holds in all. */
+#define CRAS_SAMPLE_CACHE_MAX_BYTES (8 * 1024 * 1024)
+
+struct stream_list;
+
+/* A cached clip. The samples don't change once uploaded, so a stream
+ * playing it reads them without locking, and keeps its own reference in
+ * case the clip is replaced or removed while it plays. References are only
+ * taken and dropped in the main thread.
+ *    id - The id the client uploaded the clip with.
+ *    format - The format of the samples.
+ *    samples - The interleaved audio.
+ *    frames - The number of frames in samples.
+ *    refs - The cache and each stream playing the clip hold one.
+ */
+struct cras_sample {
+	uint32_t id;
+	struct cras_audio_format format;
+	uint8_t *samples;
+	size_t frames;
+	unsigned int refs;
+	struct cras_sample *prev, *next;
+};
+
+static inline struct cras_sample *cras_sample_get(struct cras_sample *sample)
+{
+	sample->refs++;
+	return sample;
+}
+
+static inline void cras_sample_put(struct cras_sample *sample)
+{
+	if (--sample->refs)
+		return;
+	free(sample->samples);
+	free(sample);
+}
+
+/* Adds a clip to the cache, replacing the one with the same id. Streams
+ * playing the old clip play it to the end.
+ * Args:
+ *    id - The id of the clip.
+ *    format - The format of the samples.
+ *    fd - A file holding the samples from its start, read and not kept.
+ *    frames - The number of frames to read from fd.
+ * Returns:
+ *    0 on success, -EINVAL if the format or size are invalid, -ENOSPC if
+ *    the cache is full, or a negative error reading fd.
+ */
+int cras_sample_cache_add(uint32_t id, const struct cras_audio_format *format,
+			  int fd, size_t frames);
+
+/* Removes the clip with id from the cache. Returns 0 on success or -ENOENT
+ * if there is no such clip. */
+int cras_sample_cache_remove(uint32_t id);
+
+/* Plays the clip with id once.
+ * Args:
+ *    stream_list - The list to add the stream playing it to.
+ *    id - The id of the clip.
+ *    dev_idx - The device to play it on, NO_DEVICE to follow the routing of
+ *        other output streams.
+ * Returns:
+ *    0 on success, -ENOENT if there is no such clip, or a negative error
+ *    from adding the stream.
+ */
+int cras_sample_cache_play(struct stream_list *stream_list, uint32_t id,
+			   uint32_t dev_idx);
+
+/* Removes all the clips. */
+void cras_sample_cache_clear();
+
+#endif /* CRAS_SAMPLE_CACHE_H_ */
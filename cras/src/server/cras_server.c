@@ -9,13 +9,18 @@
 #include <dbus/dbus.h>
 #endif
 #include <errno.h>
-#include <poll.h>
+#include <fcntl.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/epoll.h>
 #include <sys/param.h>
 #include <sys/select.h>
+#if defined(__arm__)
+#include <asm/hwcap.h>
+#include <sys/auxv.h>
+#endif
 #include <sys/socket.h>
 #include <sys/stat.h>
 #include <sys/types.h>
@@ -31,6 +36,9 @@
 #include "cras_dbus.h"
 #include "cras_dbus_control.h"
 #include "cras_hfp_ag_profile.h"
+#ifdef HAVE_LC3
+#include "cras_lea_endpoint.h"
+#endif
 #include "cras_telephony.h"
 #endif
 #include "cras_alert.h"
@@ -39,36 +47,74 @@
 #include "cras_device_monitor.h"
 #include "cras_hotword_handler.h"
 #include "cras_iodev_list.h"
+#include "cras_main_loop_stats.h"
 #include "cras_main_message.h"
+#include "cras_main_thread_log.h"
 #include "cras_messages.h"
 #include "cras_metrics.h"
 #include "cras_non_empty_audio_handler.h"
 #include "cras_observer.h"
+#include "cras_observer_ring.h"
 #include "cras_rclient.h"
+#include "cras_rstream.h"
+#include "cras_sample_cache.h"
 #include "cras_server.h"
 #include "cras_server_metrics.h"
+#include "cras_shm_pool.h"
+#include "cras_stream_drain_handler.h"
 #include "cras_system_state.h"
 #include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_udev.h"
 #include "cras_util.h"
 #include "cras_mix.h"
+#include "stream_list.h"
 #include "utlist.h"
 
+/* Maximum number of ready fds handled per main loop pass. More stay ready
+ * and are returned by the next epoll_wait. */
+#define MAX_READY_EVENTS 64
+
+/* Messages read from a client socket in one call. */
+#define MAX_MSGS_PER_READ 8
+
+/* File in the socket dir keeping the client ids handed out, so that a
+ * restarted server neither reuses them nor refuses them to resuming clients.
+ * Ids are reserved CLIENT_ID_BLOCK at a time to write it rarely. */
+#define CLIENT_ID_FILE "client_ids"
+#define CLIENT_ID_BLOCK 64
+
+/* Connections a server socket queues until the main loop accepts them. The
+ * clients of a whole boot can connect before the server first runs it. */
+#define SERVER_SOCKET_BACKLOG 64
+
+/* The first fd of the sockets passed by a service manager, as for
+ * sd_listen_fds(). */
+#define LISTEN_FDS_START 3
+
+/* What an fd registered with the main loop epoll belongs to. It is the first
+ * member of each of the structs below and epoll hands a pointer to it back
+ * with the fd's events. */
+enum POLL_SOURCE_TYPE {
+	POLL_SOURCE_SERVER_SOCKET,
+	POLL_SOURCE_CLIENT,
+	POLL_SOURCE_CALLBACK,
+};
+
 /* Store a list of clients that are attached to the server.
  * Members:
+ *    source_type - POLL_SOURCE_CLIENT.
  *    id - Unique identifier for this client.
  *    fd - socket file descriptor used to communicate with client.
  *    ucred - Process, user, and group ID of the client.
  *    client - rclient to handle messages from this client.
- *    pollfd - Pointer to struct pollfd for this callback.
  */
 struct attached_client {
+	enum POLL_SOURCE_TYPE source_type;
 	size_t id;
 	int fd;
 	struct ucred ucred;
 	struct cras_rclient *client;
-	struct pollfd *pollfd;
 	struct attached_client *next, *prev;
 };
 
@@ -78,19 +124,22 @@ struct attached_client {
  * it.  This allows the use of the main server loop instead of spawning a thread
  * to watch file descriptors.  The client can then read or write the fd.
  * Members:
+ *    source_type - POLL_SOURCE_CALLBACK.
  *    fd - The file descriptor passed to select.
  *    callback - The funciton to call when fd is ready.
  *    callback_data - Pointer passed to the callback.
- *    pollfd - Pointer to struct pollfd for this callback.
+ *    deleted - Removed, freed once the current ready list is handled.
  *    events - The events to poll for.
+ *    handler - What the callback is timed as.
  */
 struct client_callback {
+	enum POLL_SOURCE_TYPE source_type;
 	int select_fd;
 	void (*callback)(void *data, int revents);
 	void *callback_data;
-	struct pollfd *pollfd;
 	int deleted;
 	int events;
+	enum CRAS_MAIN_HANDLER handler;
 	struct client_callback *prev, *next;
 };
 
@@ -103,9 +152,11 @@ struct system_task {
 
 /* A structure wraps data related to server socket. */
 struct server_socket {
+	enum POLL_SOURCE_TYPE source_type;
 	struct sockaddr_un addr;
 	int fd;
 	enum CRAS_CONNECTION_TYPE type;
+	int inherited;
 };
 
 /* Local server data. */
@@ -114,18 +165,52 @@ struct server_data {
 	size_t num_clients;
 	struct client_callback *client_callbacks;
 	struct system_task *system_tasks;
-	size_t num_client_callbacks;
 	size_t next_client_id;
+	size_t client_id_mark;
 	struct server_socket server_sockets[CRAS_NUM_CONN_TYPE];
+	int epoll_fd;
+	/* When cras_server_init was called, startup stages are timed from it. */
+	struct timespec startup_ts;
+	/* Set until the subsystems deferred to after the first main loop pass
+	 * are started. */
+	int deferred_init_pending;
+	unsigned int profile_disable_mask;
+#ifdef CRAS_DBUS
+	DBusConnection *dbus_conn;
+#endif
 } server_instance;
 
+/* Registers fd with the main loop. It stays registered until poll_fd_del,
+ * source is returned with its events. */
+static int poll_fd_add(int fd, uint32_t events, enum POLL_SOURCE_TYPE *source)
+{
+	struct epoll_event ev;
+
+	memset(&ev, 0, sizeof(ev));
+	ev.events = events;
+	ev.data.ptr = source;
+	if (epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_ADD, fd, &ev) < 0)
+		return -errno;
+	return 0;
+}
+
+/* Unregisters fd. Closing an fd removes it too unless it was duplicated, so
+ * errors for already closed fds are ignored. */
+static void poll_fd_del(int fd)
+{
+	epoll_ctl(server_instance.epoll_fd, EPOLL_CTL_DEL, fd, NULL);
+}
+
 /* Cleanup a given server_socket */
 static void server_socket_cleanup(struct server_socket *socket)
 {
 	if (socket && socket->fd >= 0) {
+		poll_fd_del(socket->fd);
 		close(socket->fd);
 		socket->fd = -1;
-		unlink(socket->addr.sun_path);
+		/* The service manager owns the path of an inherited one. */
+		if (!socket->inherited)
+			unlink(socket->addr.sun_path);
 	}
 }
 
@@ -133,43 +218,69 @@ static void server_socket_cleanup(struct server_socket *socket)
  * also free all the streams owned by the client */
 static void remove_client(struct attached_client *client)
 {
+	poll_fd_del(client->fd);
 	close(client->fd);
 	DL_DELETE(server_instance.clients_head, client);
 	server_instance.num_clients--;
 	cras_rclient_destroy(client->client);
+	cras_shm_pool_release_client(client->id);
 	free(client);
 }
 
 /* This is called when "select" indicates that the client has written data to
- * the socket.  Read out one message and pass it to the client message handler.
+ * the socket.  Read out the messages queued, up to MAX_MSGS_PER_READ, and pass
+ * them to the client message handler. The replies to them are held and sent
+ * together once all are handled.
  */
 static void handle_message_from_client(struct attached_client *client)
 {
-	uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
-	int nread;
-	unsigned int num_fds = 2;
-	int fds[num_fds];
+	uint8_t bufs[MAX_MSGS_PER_READ][CRAS_SERV_MAX_MSG_SIZE];
+	int fds[MAX_MSGS_PER_READ][CRAS_SERV_MAX_MSG_FDS];
+	struct cras_recv_msg msgs[MAX_MSGS_PER_READ];
+	struct cras_rclient_replies replies;
+	int i, j, num_msgs, rc = 0;
+
+	for (i = 0; i < MAX_MSGS_PER_READ; i++) {
+		msgs[i].buf = bufs[i];
+		msgs[i].len = sizeof(bufs[i]);
+		msgs[i].fds = fds[i];
+		msgs[i].num_fds = CRAS_SERV_MAX_MSG_FDS;
+	}
 
-	nread = cras_recv_with_fds(client->fd, buf, sizeof(buf), fds, &num_fds);
-	if (nread < 0)
-		goto read_error;
-	if (cras_rclient_buffer_from_client(client->client, buf, nread, fds,
-					    num_fds) < 0)
+	num_msgs = cras_recv_batch_with_fds(client->fd, msgs,
+					    MAX_MSGS_PER_READ);
+	if (num_msgs < 0) {
+		rc = num_msgs;
+		num_msgs = 0;
 		goto read_error;
-	return;
+	}
+
+	cras_rclient_hold_replies(client->client, &replies);
+	for (i = 0; i < num_msgs; i++) {
+		/* The client closed the socket. */
+		if (msgs[i].len == 0)
+			break;
+		rc = cras_rclient_buffer_from_client(client->client,
+						     msgs[i].buf, msgs[i].len,
+						     msgs[i].fds,
+						     msgs[i].num_fds);
+		if (rc < 0)
+			break;
+	}
+	cras_rclient_release_replies(client->client);
+	if (i == num_msgs)
+		return;
 
 read_error:
-	for (int i = 0; i < num_fds; i++)
-		if (fds[i] >= 0)
-			close(fds[i]);
-	switch (nread) {
-	case 0:
-		break;
-	default:
+	/* Message i carries no fds if the client closed the socket, or its
+	 * handler already closed or took them if handling it failed. */
+	for (i++; i < num_msgs; i++)
+		for (j = 0; j < msgs[i].num_fds; j++)
+			if (msgs[i].fds[j] >= 0)
+				close(msgs[i].fds[j]);
+	if (rc < 0)
 		syslog(LOG_DEBUG, "read err [%d] '%s', removing client %zu",
-		       -nread, strerror(-nread), client->id);
-		break;
-	}
+		       -rc, strerror(-rc), client->id);
 	remove_client(client);
 }
 
@@ -196,6 +307,7 @@ static void send_client_list_to_clients(struct server_data *serv)
 	if (!state)
 		return;
 
+	cras_system_state_journal_change(CRAS_STATE_CHANGE_CLIENTS);
 	state->num_attached_clients =
 		MIN(CRAS_MAX_ATTACHED_CLIENTS, serv->num_clients);
 
@@ -214,6 +326,58 @@ static void send_client_list_to_clients(struct server_data *serv)
 	cras_system_state_update_complete();
 }
 
+static void client_id_file_path(char *path, size_t len)
+{
+	snprintf(path, len, "%s/%s", cras_config_get_system_socket_file_dir(),
+		 CLIENT_ID_FILE);
+}
+
+/* Starts the client ids after the ones a previous server instance could have
+ * handed out. The stream ids hold 16 bits of the client id, start over from
+ * the reserved ids when they run out. */
+static void load_client_id_mark()
+{
+	char path[CRAS_MAX_SOCKET_PATH_SIZE];
+	unsigned long mark;
+	FILE *f;
+
+	server_instance.next_client_id = RESERVED_CLIENT_IDS;
+	server_instance.client_id_mark = RESERVED_CLIENT_IDS;
+
+	client_id_file_path(path, sizeof(path));
+	f = fopen(path, "r");
+	if (!f)
+		return;
+	if (fscanf(f, "%lu", &mark) == 1 && mark > RESERVED_CLIENT_IDS &&
+	    mark < UINT16_MAX - CLIENT_ID_BLOCK) {
+		server_instance.next_client_id = mark;
+		server_instance.client_id_mark = mark;
+	}
+	fclose(f);
+}
+
+/* Records a new block of client ids once next_client_id reaches the mark. */
+static void reserve_client_ids()
+{
+	char path[CRAS_MAX_SOCKET_PATH_SIZE];
+	FILE *f;
+
+	if (server_instance.next_client_id < server_instance.client_id_mark)
+		return;
+	server_instance.client_id_mark =
+		server_instance.next_client_id + CLIENT_ID_BLOCK;
+
+	client_id_file_path(path, sizeof(path));
+	f = fopen(path, "w");
+	if (!f) {
+		syslog(LOG_WARNING, "Failed to save client ids: %s",
+		       strerror(errno));
+		return;
+	}
+	fprintf(f, "%zu\n", server_instance.client_id_mark);
+	fclose(f);
+}
+
 /* Handles requests from a client to attach to the server.  Create a local
  * structure to track the client, assign it a unique id and let it attach */
 static void handle_new_connection(struct server_socket *server_socket)
@@ -248,13 +412,14 @@ static void handle_new_connection(struct server_socket *server_socket)
 		if (out == NULL)
 			break;
 	}
+	reserve_client_ids();
 
 	/* When full, getting an error is preferable to blocking. */
 	cras_make_fd_nonblocking(connection_fd);
 
+	poll_client->source_type = POLL_SOURCE_CLIENT;
 	poll_client->fd = connection_fd;
 	poll_client->next = NULL;
-	poll_client->pollfd = NULL;
 	fill_client_info(poll_client);
 
 	poll_client->client = cras_rclient_create(
@@ -264,6 +429,12 @@ static void handle_new_connection(struct server_socket *server_socket)
 		goto error;
 	}
 
+	if (poll_fd_add(connection_fd, EPOLLIN, &poll_client->source_type)) {
+		syslog(LOG_ERR, "failed to watch client %zu", poll_client->id);
+		cras_rclient_destroy(poll_client->client);
+		goto error;
+	}
+
 	DL_APPEND(server_instance.clients_head, poll_client);
 	server_instance.num_clients++;
 	/* Send a current list of available inputs and outputs. */
@@ -285,6 +456,7 @@ static int add_select_fd(int fd, void (*cb)(void *data, int events),
 	struct client_callback *new_cb;
 	struct client_callback *client_cb;
 	struct server_data *serv;
+	int rc;
 
 	serv = (struct server_data *)server_data;
 	if (serv == NULL)
@@ -299,15 +471,23 @@ static int add_select_fd(int fd, void (*cb)(void *data, int events),
 	if (new_cb == NULL)
 		return -ENOMEM;
 
+	new_cb->source_type = POLL_SOURCE_CALLBACK;
 	new_cb->select_fd = fd;
 	new_cb->callback = cb;
 	new_cb->callback_data = callback_data;
 	new_cb->deleted = 0;
 	new_cb->events = events;
-	new_cb->pollfd = NULL;
+	new_cb->handler = cras_main_loop_stats_fd_handler(fd);
+
+	/* poll and epoll event bits are the same. */
+	rc = poll_fd_add(fd, events, &new_cb->source_type);
+	if (rc) {
+		syslog(LOG_ERR, "failed to watch fd %d: %s", fd, strerror(-rc));
+		free(new_cb);
+		return rc;
+	}
 
 	DL_APPEND(serv->client_callbacks, new_cb);
-	server_instance.num_client_callbacks++;
 	return 0;
 }
 
@@ -324,8 +504,11 @@ static void rm_select_fd(int fd, void *server_data)
 		return;
 
 	DL_FOREACH (serv->client_callbacks, client_cb)
-		if (client_cb->select_fd == fd)
+		if (client_cb->select_fd == fd && !client_cb->deleted) {
 			client_cb->deleted = 1;
+			poll_fd_del(fd);
+		}
+	cras_main_loop_stats_untag_fd(fd);
 }
 
 /* Creates a new task entry and append to system_tasks list, which will be
@@ -366,7 +549,6 @@ static void cleanup_select_fds(void *server_data)
 	DL_FOREACH (serv->client_callbacks, client_cb)
 		if (client_cb->deleted) {
 			DL_DELETE(serv->client_callbacks, client_cb);
-			server_instance.num_client_callbacks--;
 			free(client_cb);
 		}
 }
@@ -427,44 +609,25 @@ static unsigned int cpu_x86_flags(void)
 }
 #endif
 
-int cpu_get_flags(void)
+#if defined(__arm__) || defined(__aarch64__)
+static unsigned int cpu_arm_flags(void)
 {
-#if defined(__amd64__)
-	return cpu_x86_flags();
+#if defined(__aarch64__)
+	/* Advanced SIMD is mandatory on ARMv8-A. */
+	return CPU_ARM_NEON;
+#else
+	return (getauxval(AT_HWCAP) & HWCAP_NEON) ? CPU_ARM_NEON : 0;
 #endif
-	return 0;
 }
+#endif
 
-/*
- * Exported Interface.
- */
-
-int cras_server_init()
+int cpu_get_flags(void)
 {
-	/* Log to syslog. */
-	openlog("cras_server", LOG_PID, LOG_USER);
-
-	server_instance.next_client_id = RESERVED_CLIENT_IDS;
-
-	/* Initialize global observer. */
-	cras_observer_server_init();
-
-	/* init mixer with CPU capabilities */
-	cras_mix_init(cpu_get_flags());
-
-	/* Allow clients to register callbacks for file descriptors.
-	 * add_select_fd and rm_select_fd will add and remove file descriptors
-	 * from the list that are passed to select in the main loop below. */
-	cras_system_set_select_handler(add_select_fd, rm_select_fd,
-				       &server_instance);
-	cras_system_set_add_task_handler(add_task, &server_instance);
-	cras_main_message_init();
-
-	/* Initializes all server_sockets */
-	for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE; conn_type++) {
-		server_instance.server_sockets[conn_type].fd = -1;
-	}
-
+#if defined(__amd64__)
+	return cpu_x86_flags();
+#elif defined(__arm__) || defined(__aarch64__)
+	return cpu_arm_flags();
+#endif
 	return 0;
 }
 
@@ -472,7 +635,7 @@ int cras_server_init()
  * Creates a server socket with given connection type and listens on it.
  * The socket_file will be created under cras_config_get_system_socket_file_dir
  * with permission=0770. The socket_fd will be listened with parameter
- * backlog=5.
+ * backlog=SERVER_SOCKET_BACKLOG.
  *
  * Returns 0 on success and leaves the created fd and the address information
  * in server_socket.
@@ -520,7 +683,7 @@ static int create_and_listen_server_socket(enum CRAS_CONNECTION_TYPE conn_type,
 	if (rc < 0)
 		goto error;
 
-	if (listen(socket_fd, 5) != 0) {
+	if (listen(socket_fd, SERVER_SOCKET_BACKLOG) != 0) {
 		syslog(LOG_ERR, "Listen on server socket failed.");
 		rc = -errno;
 		goto error;
@@ -537,6 +700,205 @@ error:
 	return rc;
 }
 
+/* Returns the number of listening sockets a service manager passed to this
+ * process, from LISTEN_FDS_START on. */
+static int num_inherited_sockets()
+{
+	const char *pid = getenv("LISTEN_PID");
+	const char *fds = getenv("LISTEN_FDS");
+	int num = 0;
+
+	if (pid && fds && atoi(pid) == getpid())
+		num = atoi(fds);
+	/* Not for the processes the server starts. */
+	unsetenv("LISTEN_PID");
+	unsetenv("LISTEN_FDS");
+	unsetenv("LISTEN_FDNAMES");
+	return MAX(num, 0);
+}
+
+/* Returns the connection type an inherited socket listens for, found by its
+ * path, or -1 if it isn't one of the server sockets. */
+static int inherited_socket_type(int fd, struct sockaddr_un *addr)
+{
+	char path[CRAS_MAX_SOCKET_PATH_SIZE];
+	socklen_t len = sizeof(*addr);
+	socklen_t opt_len = sizeof(int);
+	int type, listening, conn_type;
+
+	memset(addr, 0, sizeof(*addr));
+	if (getsockname(fd, (struct sockaddr *)addr, &len) ||
+	    addr->sun_family != AF_UNIX ||
+	    getsockopt(fd, SOL_SOCKET, SO_TYPE, &type, &opt_len) ||
+	    type != SOCK_SEQPACKET ||
+	    getsockopt(fd, SOL_SOCKET, SO_ACCEPTCONN, &listening, &opt_len) ||
+	    !listening)
+		return -1;
+
+	for (conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE; conn_type++) {
+		if (cras_fill_socket_path(conn_type, path) == 0 &&
+		    strncmp(path, addr->sun_path, sizeof(addr->sun_path)) == 0)
+			return conn_type;
+	}
+	return -1;
+}
+
+/* Takes the sockets passed by a service manager, then creates the ones it
+ * didn't pass. Clients connecting from here on are queued in the backlogs
+ * and served once the main loop runs, rather than waiting for the socket
+ * files to appear. Sockets that fail are retried by cras_server_run(). */
+static void open_server_sockets()
+{
+	struct server_socket *server_socket;
+	struct sockaddr_un addr;
+	int num_fds = num_inherited_sockets();
+	int fd, conn_type;
+
+	for (fd = LISTEN_FDS_START; fd < LISTEN_FDS_START + num_fds; fd++) {
+		conn_type = inherited_socket_type(fd, &addr);
+		if (conn_type < 0 ||
+		    server_instance.server_sockets[conn_type].fd >= 0) {
+			syslog(LOG_WARNING, "Closing unknown inherited fd %d",
+			       fd);
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		server_socket = &server_instance.server_sockets[conn_type];
+		server_socket->fd = fd;
+		server_socket->type = conn_type;
+		server_socket->addr = addr;
+		server_socket->inherited = 1;
+	}
+
+	for (conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE; conn_type++) {
+		server_socket = &server_instance.server_sockets[conn_type];
+		if (server_socket->fd < 0)
+			create_and_listen_server_socket(conn_type,
+							server_socket);
+	}
+}
+
+/*
+ * Exported Interface.
+ */
+
+int cras_server_init()
+{
+	/* Log to syslog. */
+	openlog("cras_server", LOG_PID, LOG_USER);
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &server_instance.startup_ts);
+	load_client_id_mark();
+
+	/* Clients and fds stay registered with the main loop epoll while they
+	 * exist, the loop doesn't rebuild a poll set every pass. */
+	server_instance.epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (server_instance.epoll_fd < 0) {
+		syslog(LOG_ERR, "Main loop epoll failed: %s", strerror(errno));
+		return -errno;
+	}
+
+	/* Initialize global observer. */
+	cras_observer_server_init();
+	cras_observer_ring_init();
+
+	/* init mixer with CPU capabilities */
+	cras_mix_init(cpu_get_flags());
+
+	/* Allow clients to register callbacks for file descriptors.
+	 * add_select_fd and rm_select_fd will add and remove file descriptors
+	 * from the list that are passed to select in the main loop below. */
+	cras_system_set_select_handler(add_select_fd, rm_select_fd,
+				       &server_instance);
+	cras_system_set_add_task_handler(add_task, &server_instance);
+	cras_main_message_init();
+
+	/* Initializes all server_sockets */
+	for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE; conn_type++) {
+		server_instance.server_sockets[conn_type].source_type =
+			POLL_SOURCE_SERVER_SOCKET;
+		server_instance.server_sockets[conn_type].fd = -1;
+	}
+	open_server_sockets();
+
+	return 0;
+}
+
+/* Logs that a startup stage is done with the ms since cras_server_init, so
+ * the time to first sound can be read along the stream events. */
+static void log_startup_stage(enum CRAS_STARTUP_STAGE stage)
+{
+	struct timespec now, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	subtract_timespecs(&now, &server_instance.startup_ts, &elapsed);
+	MAINLOG(main_log, MAIN_THREAD_STARTUP_STAGE, stage,
+		timespec_to_ms(&elapsed), 0);
+	syslog(LOG_INFO, "Startup stage %d done after %u ms", stage,
+	       timespec_to_ms(&elapsed));
+}
+
+/* Starts what clients don't need to connect and play to the default output.
+ * Run once after the first main loop pass so early clients are served
+ * without waiting on the D-Bus round trips of the Bluetooth stack. */
+static void run_deferred_init()
+{
+	server_instance.deferred_init_pending = 0;
+
+#ifdef CRAS_DBUS
+	unsigned int profile_disable_mask = server_instance.profile_disable_mask;
+	DBusConnection *dbus_conn;
+
+	dbus_threads_init_default();
+	dbus_conn = cras_dbus_connect_system_bus();
+	if (dbus_conn) {
+		cras_bt_start(dbus_conn);
+		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_HFP))
+			cras_hfp_ag_profile_create(dbus_conn);
+		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_HSP))
+			cras_hsp_ag_profile_create(dbus_conn);
+		cras_telephony_start(dbus_conn);
+		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_A2DP))
+			cras_a2dp_endpoint_create(dbus_conn);
+#ifdef HAVE_LC3
+		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_LEA))
+			cras_lea_endpoint_create(dbus_conn);
+#endif
+		cras_bt_player_create(dbus_conn);
+		cras_dbus_control_start(dbus_conn);
+	}
+	server_instance.dbus_conn = dbus_conn;
+#endif
+
+	log_startup_stage(CRAS_STARTUP_COMPLETE);
+}
+
+/* Records that handler ran from start until now and moves start to now, for
+ * the next handler to be timed from there. */
+static void handler_done(enum CRAS_MAIN_HANDLER handler, struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_main_loop_stats_add(handler, start, &now);
+	*start = now;
+}
+
+/* Ends timing a main loop pass, logs the handler to blame if it stalled. */
+static void main_loop_pass_end(const struct timespec *now)
+{
+	struct cras_main_loop_stall stall;
+
+	if (!cras_main_loop_stats_pass_end(now, &stall))
+		return;
+	MAINLOG(main_log, MAIN_THREAD_LOOP_STALL, stall.handler,
+		stall.handler_usec, stall.pass_usec);
+	syslog(LOG_WARNING, "Main loop stalled for %u us, %s ran %u us",
+	       stall.pass_usec, cras_main_handler_str(stall.handler),
+	       stall.handler_usec);
+}
+
 /* Cleans up all server_socket in server_instance */
 static void cleanup_server_sockets()
 {
@@ -549,22 +911,17 @@ static void cleanup_server_sockets()
 int cras_server_run(unsigned int profile_disable_mask)
 {
 	static const unsigned int OUTPUT_CHECK_MS = 5 * 1000;
-#ifdef CRAS_DBUS
-	DBusConnection *dbus_conn;
-#endif
 	int rc = 0;
 	struct attached_client *elm;
 	struct client_callback *client_cb;
+	struct server_socket *server_socket;
 	struct system_task *tasks;
 	struct system_task *system_task;
 	struct cras_tm *tm;
-	struct timespec ts, *poll_timeout;
-	int timers_active;
-	struct pollfd *pollfds;
-	unsigned int pollfds_size = 32;
-	unsigned int num_pollfds, poll_size_needed;
-
-	pollfds = malloc(sizeof(*pollfds) * pollfds_size);
+	struct timespec ts, handler_ts;
+	int timers_active, pass_timed = 0;
+	struct epoll_event events[MAX_READY_EVENTS];
+	int num_events, poll_timeout_ms;
 
 	cras_udev_start_sound_subsystem_monitor();
 #ifdef CRAS_DBUS
@@ -579,28 +936,23 @@ int cras_server_run(unsigned int profile_disable_mask)
 
 	cras_non_empty_audio_handler_init();
 
+	cras_stream_drain_handler_init();
+
 	cras_audio_thread_monitor_init();
 
-#ifdef CRAS_DBUS
-	dbus_threads_init_default();
-	dbus_conn = cras_dbus_connect_system_bus();
-	if (dbus_conn) {
-		cras_bt_start(dbus_conn);
-		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_HFP))
-			cras_hfp_ag_profile_create(dbus_conn);
-		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_HSP))
-			cras_hsp_ag_profile_create(dbus_conn);
-		cras_telephony_start(dbus_conn);
-		if (!(profile_disable_mask & CRAS_SERVER_PROFILE_MASK_A2DP))
-			cras_a2dp_endpoint_create(dbus_conn);
-		cras_bt_player_create(dbus_conn);
-		cras_dbus_control_start(dbus_conn);
-	}
-#endif
+	server_instance.profile_disable_mask = profile_disable_mask;
+	server_instance.deferred_init_pending = 1;
 
 	for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE; conn_type++) {
-		rc = create_and_listen_server_socket(
-			conn_type, &server_instance.server_sockets[conn_type]);
+		server_socket = &server_instance.server_sockets[conn_type];
+		if (server_socket->fd < 0) {
+			rc = create_and_listen_server_socket(conn_type,
+							     server_socket);
+			if (rc < 0)
+				goto bail;
+		}
+		rc = poll_fd_add(server_socket->fd, EPOLLIN,
+				 &server_socket->source_type);
 		if (rc < 0)
 			goto bail;
 	}
@@ -615,99 +967,118 @@ int cras_server_run(unsigned int profile_disable_mask)
 	/* After a delay, make sure there is at least one real output device. */
 	cras_tm_create_timer(tm, OUTPUT_CHECK_MS, check_output_exists, 0);
 
-	/* Main server loop - client callbacks are run from this context. */
-	while (1) {
-		poll_size_needed = CRAS_NUM_CONN_TYPE +
-				   server_instance.num_clients +
-				   server_instance.num_client_callbacks;
-		if (poll_size_needed > pollfds_size) {
-			pollfds_size = 2 * poll_size_needed;
-			pollfds = realloc(pollfds,
-					  sizeof(*pollfds) * pollfds_size);
-		}
-
-		for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE;
-		     conn_type++) {
-			pollfds[conn_type].fd =
-				server_instance.server_sockets[conn_type].fd;
-			pollfds[conn_type].events = POLLIN;
-		}
-		num_pollfds = CRAS_NUM_CONN_TYPE;
-
-		DL_FOREACH (server_instance.clients_head, elm) {
-			pollfds[num_pollfds].fd = elm->fd;
-			pollfds[num_pollfds].events = POLLIN;
-			elm->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
-		DL_FOREACH (server_instance.client_callbacks, client_cb) {
-			if (client_cb->deleted)
-				continue;
-			pollfds[num_pollfds].fd = client_cb->select_fd;
-			pollfds[num_pollfds].events = client_cb->events;
-			client_cb->pollfd = &pollfds[num_pollfds];
-			num_pollfds++;
-		}
+	log_startup_stage(CRAS_STARTUP_SERVING);
 
+	/* Main server loop - client callbacks are run from this context.
+	 * A pass is timed from the wake up to the next wait, each handler
+	 * from where the previous one ended. */
+	clock_gettime(CLOCK_MONOTONIC_RAW, &handler_ts);
+	while (1) {
 		tasks = server_instance.system_tasks;
 		server_instance.system_tasks = NULL;
 		DL_FOREACH (tasks, system_task) {
 			system_task->callback(system_task->callback_data);
 			DL_DELETE(tasks, system_task);
 			free(system_task);
+			handler_done(CRAS_MAIN_HANDLER_TASK, &handler_ts);
 		}
+		if (pass_timed)
+			main_loop_pass_end(&handler_ts);
 
 		timers_active = cras_tm_get_next_timeout(tm, &ts);
 
 		/*
-		 * If new client task has been scheduled, no need to wait
-		 * for timeout, just do another loop to execute them.
+		 * If new client task has been scheduled, or the deferred
+		 * startup is pending, no need to wait for timeout, just do
+		 * another loop to execute them.
+		 * Timeouts are rounded up to the next ms so timers are never
+		 * checked before they expire.
 		 */
-		if (server_instance.system_tasks)
-			poll_timeout = NULL;
+		if (server_instance.system_tasks ||
+		    server_instance.deferred_init_pending)
+			poll_timeout_ms = 0;
+		else if (!timers_active)
+			poll_timeout_ms = -1;
 		else
-			poll_timeout = timers_active ? &ts : NULL;
-
-		rc = ppoll(pollfds, num_pollfds, poll_timeout, NULL);
-		if (rc < 0)
+			poll_timeout_ms = ts.tv_sec * 1000 +
+					  (ts.tv_nsec + 999999) / 1000000;
+
+		num_events = epoll_wait(server_instance.epoll_fd, events,
+					MAX_READY_EVENTS, poll_timeout_ms);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &handler_ts);
+		cras_main_loop_stats_pass_begin(&handler_ts);
+		pass_timed = 1;
+		if (num_events < 0)
 			continue;
 
 		cras_tm_call_callbacks(tm);
-
-		/* Check for new connections. */
-		for (int conn_type = 0; conn_type < CRAS_NUM_CONN_TYPE;
-		     conn_type++) {
-			if (pollfds[conn_type].revents & POLLIN)
-				handle_new_connection(
-					&server_instance
-						 .server_sockets[conn_type]);
+		handler_done(CRAS_MAIN_HANDLER_TIMER, &handler_ts);
+
+		/* Only the fds that are ready are handled, however many
+		 * clients and callbacks are registered. */
+		for (int i = 0; i < num_events; i++) {
+			enum POLL_SOURCE_TYPE *source = events[i].data.ptr;
+
+			switch (*source) {
+			case POLL_SOURCE_SERVER_SOCKET:
+				if (events[i].events & EPOLLIN)
+					handle_new_connection(
+						(struct server_socket *)source);
+				handler_done(CRAS_MAIN_HANDLER_CLIENT,
+					     &handler_ts);
+				break;
+			case POLL_SOURCE_CLIENT:
+				elm = (struct attached_client *)source;
+				/* A hung up client reads 0 and is removed. */
+				if (events[i].events &
+				    (EPOLLIN | EPOLLHUP | EPOLLERR))
+					handle_message_from_client(elm);
+				handler_done(CRAS_MAIN_HANDLER_CLIENT,
+					     &handler_ts);
+				break;
+			case POLL_SOURCE_CALLBACK:
+				client_cb = (struct client_callback *)source;
+				/* Removed earlier in this pass. */
+				if (client_cb->deleted)
+					break;
+				if (events[i].events & client_cb->events)
+					client_cb->callback(
+						client_cb->callback_data,
+						events[i].events);
+				handler_done(client_cb->handler, &handler_ts);
+				break;
+			}
 		}
 
-		/* Check if there are messages pending for any clients. */
-		DL_FOREACH (server_instance.clients_head, elm)
-			if (elm->pollfd && elm->pollfd->revents & POLLIN)
-				handle_message_from_client(elm);
-		/* Check any client-registered fd/callback pairs. */
-		DL_FOREACH (server_instance.client_callbacks, client_cb)
-			if (!client_cb->deleted && client_cb->pollfd &&
-			    (client_cb->pollfd->revents & client_cb->events))
-				client_cb->callback(client_cb->callback_data,
-						    client_cb->pollfd->revents);
-
 		cleanup_select_fds(&server_instance);
 
 #ifdef CRAS_DBUS
-		if (dbus_conn)
-			cras_dbus_dispatch(dbus_conn);
+		if (server_instance.dbus_conn) {
+			cras_dbus_dispatch(server_instance.dbus_conn);
+			handler_done(CRAS_MAIN_HANDLER_DBUS, &handler_ts);
+		}
 #endif
 
 		cras_alert_process_all_pending_alerts();
+		cras_observer_ring_flush();
+		handler_done(CRAS_MAIN_HANDLER_ALERT, &handler_ts);
+
+		/* The deferred startup is logged by stage, not as a stall. */
+		if (server_instance.deferred_init_pending) {
+			run_deferred_init();
+			pass_timed = 0;
+			clock_gettime(CLOCK_MONOTONIC_RAW, &handler_ts);
+		}
 	}
 
 bail:
 	cleanup_server_sockets();
-	free(pollfds);
+	close(server_instance.epoll_fd);
+	server_instance.epoll_fd = -1;
+	cras_observer_ring_deinit();
 	cras_observer_server_free();
+	cras_sample_cache_clear();
+	cras_shm_pool_deinit();
 	return rc;
 }
 
@@ -718,3 +1089,65 @@ void cras_server_send_to_all_clients(const struct cras_client_message *msg)
 	DL_FOREACH (server_instance.clients_head, client)
 		cras_rclient_send_message(client->client, msg, NULL, 0);
 }
+
+unsigned int cras_server_get_client_usage(struct cras_client_usage_info *infos,
+					  unsigned int max)
+{
+	struct attached_client *client;
+	struct cras_rstream *stream;
+	struct cras_client_usage *usage;
+	unsigned int num = 0;
+
+	DL_FOREACH (server_instance.clients_head, client) {
+		if (num == max)
+			break;
+		infos[num].id = client->id;
+		infos[num].pid = client->ucred.pid;
+		usage = &infos[num].usage;
+		*usage = client->client->ended_usage;
+
+		/* Counters of running streams are updated by the audio
+		 * thread, a read may miss the latest wake. */
+		DL_FOREACH (stream_list_get(cras_iodev_list_get_stream_list()),
+			    stream) {
+			if (stream->client != client->client)
+				continue;
+			usage->cpu_ns += stream->cpu_ns;
+			usage->num_fetches += stream->num_fetches;
+			usage->num_missed_cb += stream->num_missed_cb;
+		}
+		num++;
+	}
+	return num;
+}
+
+int cras_server_resume_client(struct cras_rclient *rclient, size_t old_id)
+{
+	struct attached_client *client, *out;
+	struct cras_rstream *stream;
+
+	/* Only ids handed out before, by this or an earlier instance. */
+	if (old_id < RESERVED_CLIENT_IDS ||
+	    old_id >= server_instance.next_client_id)
+		return -EINVAL;
+	DL_SEARCH_SCALAR(server_instance.clients_head, out, id, old_id);
+	if (out)
+		return -EBUSY;
+	DL_SEARCH_SCALAR(server_instance.clients_head, client, client,
+			 rclient);
+	if (!client)
+		return -ENOENT;
+
+	/* The ids of the streams and their shm follow the client id. */
+	DL_FOREACH (stream_list_get(cras_iodev_list_get_stream_list()),
+		    stream) {
+		if (stream->client == rclient)
+			return -EBUSY;
+	}
+	cras_shm_pool_release_client(client->id);
+
+	client->id = old_id;
+	rclient->id = old_id;
+	send_client_list_to_clients(&server_instance);
+	return 0;
+}
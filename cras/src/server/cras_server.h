@@ -9,12 +9,17 @@
 #ifndef CRAS_SERVER_H_
 #define CRAS_SERVER_H_
 
+#include <sys/types.h>
+
+#include "cras_rclient.h"
+
 /*
  * Bitmask for cras_server_run() argument profile_disable_mask
  */
 #define CRAS_SERVER_PROFILE_MASK_HFP (1 << 0)
 #define CRAS_SERVER_PROFILE_MASK_HSP (1 << 1)
 #define CRAS_SERVER_PROFILE_MASK_A2DP (1 << 2)
+#define CRAS_SERVER_PROFILE_MASK_LEA (1 << 3)
 
 /* Reserver client id 0-15 for internal server usage. */
 #define RESERVED_CLIENT_IDS 16
@@ -22,17 +27,48 @@
 
 struct cras_client_message;
 
+/* Audio thread cost of the streams of an attached client.
+ *    id - The id of the client.
+ *    pid - The pid of the client process.
+ *    usage - Usage of the current and removed streams of the client.
+ */
+struct cras_client_usage_info {
+	size_t id;
+	pid_t pid;
+	struct cras_client_usage usage;
+};
+
 /* Initialize some server setup. Mainly to add the select handler first
  * so that client callbacks can be registered before server start running.
+ * The server sockets are opened here, or taken from the LISTEN_FDS passed by
+ * a service manager, so clients can connect while the server starts.
  */
 int cras_server_init();
 
-/* Runs the CRAS server.  Open the main socket and begin listening for
- * connections and for messages from clients that have connected.
+/* Runs the CRAS server.  Begin accepting connections, the ones queued since
+ * cras_server_init() first, and handling messages from connected clients.
  */
 int cras_server_run(unsigned int profile_disable_mask);
 
 /* Send a message to all attached clients. */
 void cras_server_send_to_all_clients(const struct cras_client_message *msg);
 
+/* Fills infos with the usage of up to max attached clients.
+ * Returns:
+ *    The number of infos filled.
+ */
+unsigned int cras_server_get_client_usage(struct cras_client_usage_info *infos,
+					  unsigned int max);
+
+/* Gives a client back the id it had before it lost its connection, most
+ * likely to a restart of the server.
+ * Args:
+ *    rclient - The client asking, which must have no streams yet.
+ *    old_id - The id it had. It must have been handed out by this or an
+ *       earlier server instance and not be in use.
+ * Returns:
+ *    0 on success, negative error code when old_id can't be given.
+ */
+int cras_server_resume_client(struct cras_rclient *rclient, size_t old_id);
+
 #endif /* CRAS_SERVER_H_ */
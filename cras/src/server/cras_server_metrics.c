@@ -18,9 +18,13 @@
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
 #include "cras_system_state.h"
+#include "hfp_link_stats.h"
 
 #define METRICS_NAME_BUFFER_SIZE 100
+#define METRICS_BATCH_SIZE 16
 
+const char kBtProfileSwitchTimeToA2dp[] = "Cras.BtProfileSwitchTimeToA2dp";
+const char kBtProfileSwitchTimeToHfp[] = "Cras.BtProfileSwitchTimeToHfp";
 const char kBusyloop[] = "Cras.Busyloop";
 const char kBusyloopLength[] = "Cras.BusyloopLength";
 const char kDeviceTypeInput[] = "Cras.DeviceTypeInput";
@@ -58,6 +62,10 @@ const char kStreamSamplingFormat[] = "Cras.StreamSamplingFormat";
 const char kStreamSamplingRate[] = "Cras.StreamSamplingRate";
 const char kUnderrunsPerDevice[] = "Cras.UnderrunsPerDevice";
 const char kHfpScoConnectionError[] = "Cras.HfpScoConnectionError";
+const char kHfpScoJitter[] = "Cras.HfpScoJitter";
+const char kHfpScoMaxLossBurst[] = "Cras.HfpScoMaxLossBurst";
+const char kHfpScoPlcCost[] = "Cras.HfpScoPlcCost";
+const char kHfpScoQueueDepth[] = "Cras.HfpScoQueueDepth";
 const char kHfpBatteryIndicatorSupported[] =
 	"Cras.HfpBatteryIndicatorSupported";
 const char kHfpBatteryReport[] = "Cras.HfpBatteryReport";
@@ -75,6 +83,9 @@ const double MISSED_CB_FREQUENCY_SECONDS_MIN = 10.0;
 const time_t CRAS_METRICS_SHORT_PERIOD_THRESHOLD_SECONDS = 600;
 const time_t CRAS_METRICS_LONG_PERIOD_THRESHOLD_SECONDS = 3600;
 
+/* How long a batching thread holds its oldest metrics before sending them. */
+const time_t CRAS_METRICS_BATCH_MAX_AGE_SECONDS = 10;
+
 static const char *get_timespec_period_str(struct timespec ts)
 {
 	if (ts.tv_sec < CRAS_METRICS_SHORT_PERIOD_THRESHOLD_SECONDS)
@@ -87,8 +98,14 @@ static const char *get_timespec_period_str(struct timespec ts)
 /* Type of metrics to log. */
 enum CRAS_SERVER_METRICS_TYPE {
 	BT_BATTERY_INDICATOR_SUPPORTED,
+	BT_PROFILE_SWITCH_TIME_TO_A2DP,
+	BT_PROFILE_SWITCH_TIME_TO_HFP,
 	BT_BATTERY_REPORT,
 	BT_SCO_CONNECTION_ERROR,
+	BT_SCO_JITTER,
+	BT_SCO_MAX_LOSS_BURST,
+	BT_SCO_PLC_COST,
+	BT_SCO_QUEUE_DEPTH,
 	BT_WIDEBAND_PACKET_LOSS,
 	BT_WIDEBAND_SUPPORTED,
 	BT_WIDEBAND_SELECTED_CODEC,
@@ -101,6 +118,7 @@ enum CRAS_SERVER_METRICS_TYPE {
 	HIGHEST_INPUT_HW_LEVEL,
 	HIGHEST_OUTPUT_HW_LEVEL,
 	LONGEST_FETCH_DELAY,
+	METRICS_BATCH,
 	MISSED_CB_FIRST_TIME_INPUT,
 	MISSED_CB_FIRST_TIME_OUTPUT,
 	MISSED_CB_FREQUENCY_INPUT,
@@ -144,6 +162,7 @@ enum CRAS_METRICS_DEVICE_TYPE {
 	CRAS_METRICS_DEVICE_UNKNOWN,
 	CRAS_METRICS_DEVICE_BLUETOOTH_WB_MIC,
 	CRAS_METRICS_DEVICE_ALSA_LOOPBACK,
+	CRAS_METRICS_DEVICE_NETWORK,
 };
 
 struct cras_server_metrics_stream_config {
@@ -196,6 +215,36 @@ struct cras_server_metrics_message {
 	union cras_server_metrics_data data;
 };
 
+/*
+ * Metrics of one type and value logged count times by a batching thread.
+ */
+struct cras_server_metrics_record {
+	enum CRAS_SERVER_METRICS_TYPE metrics_type;
+	unsigned count;
+	union cras_server_metrics_data data;
+};
+
+/*
+ * The metrics a batching thread sends to the main thread at once. Starts like
+ * cras_server_metrics_message, with metrics_type set to METRICS_BATCH.
+ */
+struct cras_server_metrics_batch_message {
+	struct cras_main_message header;
+	enum CRAS_SERVER_METRICS_TYPE metrics_type;
+	unsigned num_records;
+	struct cras_server_metrics_record records[METRICS_BATCH_SIZE];
+};
+
+static_assert(sizeof(struct cras_server_metrics_batch_message) <=
+		      CRAS_MAIN_MESSAGE_MAX_LENGTH,
+	      "The metrics batch is too large.");
+
+/* Set for threads which called cras_server_metrics_start_batching(). */
+static __thread bool batching;
+/* Metrics held by the calling thread, and when the first of them came. */
+static __thread struct cras_server_metrics_batch_message batch;
+static __thread struct timespec batch_start_ts;
+
 static void init_server_metrics_msg(struct cras_server_metrics_message *msg,
 				    enum CRAS_SERVER_METRICS_TYPE type,
 				    union cras_server_metrics_data data)
@@ -209,6 +258,55 @@ static void init_server_metrics_msg(struct cras_server_metrics_message *msg,
 
 static void handle_metrics_message(struct cras_main_message *msg, void *arg);
 
+static int send_batch()
+{
+	int err;
+
+	if (!batch.num_records)
+		return 0;
+
+	batch.header.type = CRAS_MAIN_METRICS;
+	batch.header.length =
+		sizeof(batch) - (METRICS_BATCH_SIZE - batch.num_records) *
+					sizeof(batch.records[0]);
+	batch.metrics_type = METRICS_BATCH;
+	err = cras_main_message_send(&batch.header);
+	batch.num_records = 0;
+	if (err < 0) {
+		syslog(LOG_ERR, "Failed to send metrics message: METRICS_BATCH");
+		return err;
+	}
+	return 0;
+}
+
+/* Adds a metrics message to the calling thread's batch. A value already in
+ * the batch only has its count increased. */
+static int batch_add(const struct cras_server_metrics_message *msg)
+{
+	struct cras_server_metrics_record *record;
+	unsigned i;
+
+	for (i = 0; i < batch.num_records; i++) {
+		record = &batch.records[i];
+		if (record->metrics_type == msg->metrics_type &&
+		    !memcmp(&record->data, &msg->data, sizeof(msg->data))) {
+			record->count++;
+			return 0;
+		}
+	}
+
+	if (!batch.num_records)
+		clock_gettime(CLOCK_MONOTONIC_RAW, &batch_start_ts);
+	record = &batch.records[batch.num_records++];
+	record->metrics_type = msg->metrics_type;
+	record->count = 1;
+	record->data = msg->data;
+
+	if (batch.num_records == METRICS_BATCH_SIZE)
+		return send_batch();
+	return 0;
+}
+
 /* The wrapper function of cras_main_message_send. */
 static int cras_server_metrics_message_send(struct cras_main_message *msg)
 {
@@ -217,6 +315,8 @@ static int cras_server_metrics_message_send(struct cras_main_message *msg)
 		handle_metrics_message(msg, NULL);
 		return 0;
 	}
+	if (batching)
+		return batch_add((struct cras_server_metrics_message *)msg);
 	return cras_main_message_send(msg);
 }
 
@@ -270,6 +370,8 @@ metrics_device_type_str(enum CRAS_METRICS_DEVICE_TYPE device_type)
 		return "NoDevice";
 	case CRAS_METRICS_DEVICE_ALSA_LOOPBACK:
 		return "AlsaLoopback";
+	case CRAS_METRICS_DEVICE_NETWORK:
+		return "Network";
 	/* Other fallback devices. */
 	case CRAS_METRICS_DEVICE_NORMAL_FALLBACK:
 		return "NormalFallback";
@@ -415,6 +517,8 @@ get_metrics_device_type(struct cras_iodev *iodev)
 		return CRAS_METRICS_DEVICE_BLUETOOTH_NB_MIC;
 	case CRAS_NODE_TYPE_ALSA_LOOPBACK:
 		return CRAS_METRICS_DEVICE_ALSA_LOOPBACK;
+	case CRAS_NODE_TYPE_NETWORK:
+		return CRAS_METRICS_DEVICE_NETWORK;
 	case CRAS_NODE_TYPE_UNKNOWN:
 	default:
 		return CRAS_METRICS_DEVICE_UNKNOWN;
@@ -488,7 +592,7 @@ int cras_server_metrics_hfp_sco_connection_error(
 	enum CRAS_METRICS_BT_SCO_ERROR_TYPE type)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = type;
@@ -507,7 +611,7 @@ int cras_server_metrics_hfp_sco_connection_error(
 int cras_server_metrics_hfp_battery_indicator(int battery_indicator_support)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = battery_indicator_support;
@@ -526,7 +630,7 @@ int cras_server_metrics_hfp_battery_indicator(int battery_indicator_support)
 int cras_server_metrics_hfp_battery_report(int battery_report)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = battery_report;
@@ -545,7 +649,7 @@ int cras_server_metrics_hfp_battery_report(int battery_report)
 int cras_server_metrics_hfp_packet_loss(float packet_loss_ratio)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	/* Percentage is too coarse for packet loss, so we use number of bad
@@ -563,10 +667,60 @@ int cras_server_metrics_hfp_packet_loss(float packet_loss_ratio)
 	return 0;
 }
 
+static int send_hfp_link_stat(enum CRAS_SERVER_METRICS_TYPE type,
+			      unsigned int value)
+{
+	struct cras_server_metrics_message msg;
+	union cras_server_metrics_data data = {};
+	int err;
+
+	data.value = value;
+	init_server_metrics_msg(&msg, type, data);
+
+	err = cras_server_metrics_message_send(
+		(struct cras_main_message *)&msg);
+	if (err < 0) {
+		syslog(LOG_ERR,
+		       "Failed to send metrics message: HFP link stats %d",
+		       type);
+		return err;
+	}
+	return 0;
+}
+
+int cras_server_metrics_hfp_link_stats(const struct hfp_link_stats *stats)
+{
+	int err;
+
+	/* Each only when the call had what it measures. */
+	if (stats->packets) {
+		err = send_hfp_link_stat(BT_SCO_MAX_LOSS_BURST,
+					 stats->max_burst);
+		if (err < 0)
+			return err;
+	}
+	if (stats->plc_calls) {
+		err = send_hfp_link_stat(BT_SCO_PLC_COST,
+					 stats->plc_usec / stats->plc_calls);
+		if (err < 0)
+			return err;
+	}
+	if (stats->wakes > 1) {
+		err = send_hfp_link_stat(BT_SCO_JITTER,
+					 stats->max_jitter_usec);
+		if (err < 0)
+			return err;
+	}
+	if (stats->max_queue_depth)
+		return send_hfp_link_stat(BT_SCO_QUEUE_DEPTH,
+					  stats->max_queue_depth);
+	return 0;
+}
+
 int cras_server_metrics_hfp_wideband_support(bool supported)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = supported;
@@ -585,7 +739,7 @@ int cras_server_metrics_hfp_wideband_support(bool supported)
 int cras_server_metrics_hfp_wideband_selected_codec(int codec)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = codec;
@@ -601,10 +755,33 @@ int cras_server_metrics_hfp_wideband_selected_codec(int codec)
 	return 0;
 }
 
+int cras_server_metrics_bt_profile_switch_time(const struct timespec *time,
+					       bool to_a2dp)
+{
+	struct cras_server_metrics_message msg;
+	union cras_server_metrics_data data = {};
+	int err;
+
+	data.value = time->tv_sec * 1000 + time->tv_nsec / 1000000;
+	init_server_metrics_msg(&msg,
+				to_a2dp ? BT_PROFILE_SWITCH_TIME_TO_A2DP :
+					  BT_PROFILE_SWITCH_TIME_TO_HFP,
+				data);
+
+	err = cras_server_metrics_message_send(
+		(struct cras_main_message *)&msg);
+	if (err < 0) {
+		syslog(LOG_ERR,
+		       "Failed to send metrics message: BT_PROFILE_SWITCH_TIME");
+		return err;
+	}
+	return 0;
+}
+
 int cras_server_metrics_device_runtime(struct cras_iodev *iodev)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	struct timespec now;
 	int err;
 
@@ -629,7 +806,7 @@ int cras_server_metrics_device_runtime(struct cras_iodev *iodev)
 int cras_server_metrics_device_volume(struct cras_iodev *iodev)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	if (iodev->direction == CRAS_STREAM_INPUT)
@@ -656,7 +833,7 @@ int cras_server_metrics_highest_device_delay(
 	enum CRAS_STREAM_DIRECTION direction)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	if (largest_cb_level == 0) {
@@ -703,7 +880,7 @@ int cras_server_metrics_highest_hw_level(unsigned hw_level,
 					 enum CRAS_STREAM_DIRECTION direction)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = hw_level;
@@ -734,7 +911,7 @@ int cras_server_metrics_highest_hw_level(unsigned hw_level,
 int cras_server_metrics_longest_fetch_delay(const struct cras_rstream *stream)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.stream_data.client_type = stream->client_type;
@@ -770,7 +947,7 @@ int cras_server_metrics_longest_fetch_delay(const struct cras_rstream *stream)
 int cras_server_metrics_num_underruns(unsigned num_underruns)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = num_underruns;
@@ -791,7 +968,7 @@ static int
 cras_server_metrics_missed_cb_frequency(const struct cras_rstream *stream)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	struct timespec now, time_since;
 	double seconds, frequency;
 	int err;
@@ -864,7 +1041,7 @@ static int
 cras_server_metrics_missed_cb_first_time(const struct cras_rstream *stream)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	struct timespec time_since;
 	int err;
 
@@ -894,7 +1071,7 @@ static int
 cras_server_metrics_missed_cb_second_time(const struct cras_rstream *stream)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	struct timespec now, time_since;
 	int err;
 
@@ -946,7 +1123,7 @@ static int
 cras_server_metrics_stream_config(const struct cras_rstream_config *config)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.stream_config.direction = config->direction;
@@ -973,7 +1150,7 @@ cras_server_metrics_stream_config(const struct cras_rstream_config *config)
 int cras_server_metrics_stream_runtime(const struct cras_rstream *stream)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	struct timespec now;
 	int err;
 
@@ -1016,7 +1193,7 @@ int cras_server_metrics_stream_destroy(const struct cras_rstream *stream)
 int cras_server_metrics_busyloop(struct timespec *ts, unsigned count)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.timespec_data.runtime = *ts;
@@ -1036,7 +1213,7 @@ int cras_server_metrics_busyloop(struct timespec *ts, unsigned count)
 int cras_server_metrics_busyloop_length(unsigned length)
 {
 	struct cras_server_metrics_message msg;
-	union cras_server_metrics_data data;
+	union cras_server_metrics_data data = {};
 	int err;
 
 	data.value = length;
@@ -1154,134 +1331,187 @@ metrics_stream_config(struct cras_server_metrics_stream_config config)
 						  config.client_type);
 }
 
-static void handle_metrics_message(struct cras_main_message *msg, void *arg)
+static void log_metrics(enum CRAS_SERVER_METRICS_TYPE type,
+			const union cras_server_metrics_data *data)
 {
-	struct cras_server_metrics_message *metrics_msg =
-		(struct cras_server_metrics_message *)msg;
-	switch (metrics_msg->metrics_type) {
+	switch (type) {
 	case BT_SCO_CONNECTION_ERROR:
 		cras_metrics_log_sparse_histogram(kHfpScoConnectionError,
-						  metrics_msg->data.value);
+						  data->value);
 		break;
 	case BT_BATTERY_INDICATOR_SUPPORTED:
 		cras_metrics_log_sparse_histogram(kHfpBatteryIndicatorSupported,
-						  metrics_msg->data.value);
+						  data->value);
+		break;
+	case BT_PROFILE_SWITCH_TIME_TO_A2DP:
+		cras_metrics_log_histogram(kBtProfileSwitchTimeToA2dp,
+					   data->value, 0, 10000, 50);
+		break;
+	case BT_PROFILE_SWITCH_TIME_TO_HFP:
+		cras_metrics_log_histogram(kBtProfileSwitchTimeToHfp,
+					   data->value, 0, 10000, 50);
 		break;
 	case BT_BATTERY_REPORT:
 		cras_metrics_log_sparse_histogram(kHfpBatteryReport,
-						  metrics_msg->data.value);
+						  data->value);
+		break;
+	case BT_SCO_JITTER:
+		cras_metrics_log_histogram(kHfpScoJitter, data->value, 0, 50000,
+					   50);
+		break;
+	case BT_SCO_MAX_LOSS_BURST:
+		cras_metrics_log_histogram(kHfpScoMaxLossBurst, data->value, 0,
+					   100, 20);
+		break;
+	case BT_SCO_PLC_COST:
+		cras_metrics_log_histogram(kHfpScoPlcCost, data->value, 0, 5000,
+					   50);
+		break;
+	case BT_SCO_QUEUE_DEPTH:
+		cras_metrics_log_histogram(kHfpScoQueueDepth, data->value, 0,
+					   64, 16);
 		break;
 	case BT_WIDEBAND_PACKET_LOSS:
 		cras_metrics_log_histogram(kHfpWidebandSpeechPacketLoss,
-					   metrics_msg->data.value, 0, 1000,
-					   20);
+					   data->value, 0, 1000, 20);
 		break;
 	case BT_WIDEBAND_SUPPORTED:
 		cras_metrics_log_sparse_histogram(kHfpWidebandSpeechSupported,
-						  metrics_msg->data.value);
+						  data->value);
 		break;
 	case BT_WIDEBAND_SELECTED_CODEC:
 		cras_metrics_log_sparse_histogram(
-			kHfpWidebandSpeechSelectedCodec,
-			metrics_msg->data.value);
+			kHfpWidebandSpeechSelectedCodec, data->value);
 		break;
 	case DEVICE_RUNTIME:
-		metrics_device_runtime(metrics_msg->data.device_data);
+		metrics_device_runtime(data->device_data);
 		break;
 	case DEVICE_VOLUME:
-		metrics_device_volume(metrics_msg->data.device_data);
+		metrics_device_volume(data->device_data);
 		break;
 	case HIGHEST_DEVICE_DELAY_INPUT:
 		cras_metrics_log_histogram(kHighestDeviceDelayInput,
-					   metrics_msg->data.value, 1, 10000,
-					   20);
+					   data->value, 1, 10000, 20);
 		break;
 	case HIGHEST_DEVICE_DELAY_OUTPUT:
 		cras_metrics_log_histogram(kHighestDeviceDelayOutput,
-					   metrics_msg->data.value, 1, 10000,
-					   20);
+					   data->value, 1, 10000, 20);
 		break;
 	case HIGHEST_INPUT_HW_LEVEL:
 		cras_metrics_log_histogram(kHighestInputHardwareLevel,
-					   metrics_msg->data.value, 1, 10000,
-					   20);
+					   data->value, 1, 10000, 20);
 		break;
 	case HIGHEST_OUTPUT_HW_LEVEL:
 		cras_metrics_log_histogram(kHighestOutputHardwareLevel,
-					   metrics_msg->data.value, 1, 10000,
-					   20);
+					   data->value, 1, 10000, 20);
 		break;
 	case LONGEST_FETCH_DELAY:
-		metrics_longest_fetch_delay(metrics_msg->data.stream_data);
+		metrics_longest_fetch_delay(data->stream_data);
 		break;
 	case MISSED_CB_FIRST_TIME_INPUT:
 		cras_metrics_log_histogram(kMissedCallbackFirstTimeInput,
-					   metrics_msg->data.value, 0, 90000,
-					   20);
+					   data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_FIRST_TIME_OUTPUT:
 		cras_metrics_log_histogram(kMissedCallbackFirstTimeOutput,
-					   metrics_msg->data.value, 0, 90000,
-					   20);
+					   data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_FREQUENCY_INPUT:
 		cras_metrics_log_histogram(kMissedCallbackFrequencyInput,
-					   metrics_msg->data.value, 0, 90000,
-					   20);
+					   data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_FREQUENCY_OUTPUT:
 		cras_metrics_log_histogram(kMissedCallbackFrequencyOutput,
-					   metrics_msg->data.value, 0, 90000,
-					   20);
+					   data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_FREQUENCY_AFTER_RESCHEDULING_INPUT:
 		cras_metrics_log_histogram(
 			kMissedCallbackFrequencyAfterReschedulingInput,
-			metrics_msg->data.value, 0, 90000, 20);
+			data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_FREQUENCY_AFTER_RESCHEDULING_OUTPUT:
 		cras_metrics_log_histogram(
 			kMissedCallbackFrequencyAfterReschedulingOutput,
-			metrics_msg->data.value, 0, 90000, 20);
+			data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_SECOND_TIME_INPUT:
 		cras_metrics_log_histogram(kMissedCallbackSecondTimeInput,
-					   metrics_msg->data.value, 0, 90000,
-					   20);
+					   data->value, 0, 90000, 20);
 		break;
 	case MISSED_CB_SECOND_TIME_OUTPUT:
 		cras_metrics_log_histogram(kMissedCallbackSecondTimeOutput,
-					   metrics_msg->data.value, 0, 90000,
-					   20);
+					   data->value, 0, 90000, 20);
 		break;
 	case NUM_UNDERRUNS:
-		cras_metrics_log_histogram(kUnderrunsPerDevice,
-					   metrics_msg->data.value, 0, 1000,
-					   10);
+		cras_metrics_log_histogram(kUnderrunsPerDevice, data->value, 0,
+					   1000, 10);
 		break;
 	case STREAM_CONFIG:
-		metrics_stream_config(metrics_msg->data.stream_config);
+		metrics_stream_config(data->stream_config);
 		break;
 	case STREAM_RUNTIME:
-		metrics_stream_runtime(metrics_msg->data.stream_data);
+		metrics_stream_runtime(data->stream_data);
 		break;
 	case BUSYLOOP:
-		metrics_busyloop(metrics_msg->data.timespec_data);
+		metrics_busyloop(data->timespec_data);
 		break;
 	case BUSYLOOP_LENGTH:
-		cras_metrics_log_histogram(
-			kBusyloopLength, metrics_msg->data.value, 0, 1000, 50);
+		cras_metrics_log_histogram(kBusyloopLength, data->value, 0,
+					   1000, 50);
 		break;
 	default:
-		syslog(LOG_ERR, "Unknown metrics type %u",
-		       metrics_msg->metrics_type);
+		syslog(LOG_ERR, "Unknown metrics type %u", type);
 		break;
 	}
 }
 
+static void handle_metrics_message(struct cras_main_message *msg, void *arg)
+{
+	struct cras_server_metrics_message *metrics_msg =
+		(struct cras_server_metrics_message *)msg;
+	struct cras_server_metrics_batch_message *batch_msg;
+	struct cras_server_metrics_record *record;
+	unsigned i, j;
+
+	cras_metrics_begin_batch();
+	if (metrics_msg->metrics_type == METRICS_BATCH) {
+		batch_msg = (struct cras_server_metrics_batch_message *)msg;
+		for (i = 0; i < MIN(batch_msg->num_records, METRICS_BATCH_SIZE);
+		     i++) {
+			record = &batch_msg->records[i];
+			for (j = 0; j < record->count; j++)
+				log_metrics(record->metrics_type,
+					    &record->data);
+		}
+	} else {
+		log_metrics(metrics_msg->metrics_type, &metrics_msg->data);
+	}
+	cras_metrics_end_batch();
+}
+
 int cras_server_metrics_init()
 {
 	cras_main_message_add_handler(CRAS_MAIN_METRICS, handle_metrics_message,
 				      NULL);
 	return 0;
 }
+
+void cras_server_metrics_start_batching()
+{
+	batching = true;
+}
+
+int cras_server_metrics_flush_batch(bool force)
+{
+	struct timespec now, age;
+
+	if (!batch.num_records)
+		return 0;
+	if (!force) {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		subtract_timespecs(&now, &batch_start_ts, &age);
+		if (age.tv_sec < CRAS_METRICS_BATCH_MAX_AGE_SECONDS)
+			return 0;
+	}
+	return send_batch();
+}
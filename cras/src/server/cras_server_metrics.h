@@ -11,6 +11,8 @@
 #include "cras_iodev.h"
 #include "cras_rstream.h"
 
+struct hfp_link_stats;
+
 extern const char kNoCodecsFoundMetric[];
 
 enum CRAS_METRICS_BT_SCO_ERROR_TYPE {
@@ -46,6 +48,16 @@ int cras_server_metrics_hfp_wideband_selected_codec(int codec);
 /* Logs the number of packet loss per 1000 packets under HFP capture. */
 int cras_server_metrics_hfp_packet_loss(float packet_loss_ratio);
 
+/* Logs the link quality of an HFP call: the longest loss burst, the average
+ * time to conceal a lost packet, the highest jitter of the SCO packets and
+ * the most packets queued to the controller. */
+int cras_server_metrics_hfp_link_stats(const struct hfp_link_stats *stats);
+
+/* Logs the time from a bluetooth profile switch to audio running again on
+ * the new profile, A2DP or HFP/HSP. */
+int cras_server_metrics_bt_profile_switch_time(const struct timespec *time,
+					       bool to_a2dp);
+
 /* Logs runtime of a device. */
 int cras_server_metrics_device_runtime(struct cras_iodev *iodev);
 
@@ -79,6 +91,17 @@ int cras_server_metrics_busyloop(struct timespec *ts, unsigned count);
 /* Logs the length of busyloops. */
 int cras_server_metrics_busyloop_length(unsigned length);
 
+/* Makes the calling thread hold the metrics it logs and send them to the
+ * main thread together, when enough of them are held or on
+ * cras_server_metrics_flush_batch(). For threads that log often, like the
+ * audio thread. */
+void cras_server_metrics_start_batching();
+
+/* Sends the metrics held by the calling thread to the main thread. Unless
+ * force is set, only does so once the oldest of them has been held for a
+ * while. */
+int cras_server_metrics_flush_batch(bool force);
+
 /* Initialize metrics logging stuff. */
 int cras_server_metrics_init();
 
@@ -0,0 +1,115 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <stdlib.h>
+
+#include "cras_mem_stats.h"
+#include "cras_rt_mem.h"
+#include "cras_shm.h"
+#include "cras_shm_pool.h"
+#include "utlist.h"
+
+/* An area kept for reuse.
+ *    client_id - The client allowed to reuse it.
+ *    samples_size - Size the samples area was requested with, the mapped
+ *        length can be larger when it was rounded to hugepages.
+ *    samples_prot - Protection of the samples mapping.
+ *    shm - The area.
+ */
+struct pool_entry {
+	uint16_t client_id;
+	size_t samples_size;
+	int samples_prot;
+	struct cras_audio_shm *shm;
+	struct pool_entry *prev, *next;
+};
+
+/* Kept areas, oldest first. */
+static struct pool_entry *entries;
+static unsigned int num_entries;
+
+static void destroy_shm(struct cras_audio_shm *shm)
+{
+	cras_mem_stats_sub(CRAS_MEM_SHM, cras_shm_mapped_bytes(shm));
+	cras_rt_mem_remove(shm->header);
+	cras_rt_mem_remove(shm->samples);
+	cras_audio_shm_destroy(shm);
+}
+
+static void destroy_entry(struct pool_entry *entry)
+{
+	DL_DELETE(entries, entry);
+	num_entries--;
+	destroy_shm(entry->shm);
+	free(entry);
+}
+
+struct cras_audio_shm *cras_shm_pool_get(uint16_t client_id,
+					 size_t samples_size, int samples_prot)
+{
+	struct pool_entry *entry;
+	struct cras_audio_shm *shm;
+
+	DL_FOREACH (entries, entry) {
+		if (entry->client_id != client_id ||
+		    entry->samples_size != samples_size ||
+		    entry->samples_prot != samples_prot)
+			continue;
+		DL_DELETE(entries, entry);
+		num_entries--;
+		shm = entry->shm;
+		free(entry);
+		cras_audio_shm_reset(shm);
+		return shm;
+	}
+	return NULL;
+}
+
+void cras_shm_pool_put(uint16_t client_id, size_t samples_size,
+		       int samples_prot, struct cras_audio_shm *shm)
+{
+	struct pool_entry *entry;
+
+	if (!shm)
+		return;
+
+	entry = calloc(1, sizeof(*entry));
+	if (!entry) {
+		destroy_shm(shm);
+		return;
+	}
+	entry->client_id = client_id;
+	entry->samples_size = samples_size;
+	entry->samples_prot = samples_prot;
+	entry->shm = shm;
+	DL_APPEND(entries, entry);
+	num_entries++;
+
+	if (num_entries > CRAS_SHM_POOL_MAX_ENTRIES)
+		destroy_entry(entries);
+}
+
+void cras_shm_pool_release_client(uint16_t client_id)
+{
+	struct pool_entry *entry;
+
+	DL_FOREACH (entries, entry) {
+		if (entry->client_id == client_id)
+			destroy_entry(entry);
+	}
+}
+
+void cras_shm_pool_deinit()
+{
+	struct pool_entry *entry;
+
+	DL_FOREACH (entries, entry)
+		destroy_entry(entry);
+}
+
+unsigned int cras_shm_pool_num_entries()
+{
+	return num_entries;
+}
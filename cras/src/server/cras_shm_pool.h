@@ -0,0 +1,53 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Keeps the shm of destroyed streams for the next stream of the same client
+ * with the same samples size. Clients like browsers open and close streams
+ * all the time, reusing the mapped areas saves creating, sizing, sealing
+ * and mapping two memfds for every stream. An area is only handed back to
+ * the client that already had it, it never leaks audio between clients.
+ */
+
+#ifndef CRAS_SHM_POOL_H_
+#define CRAS_SHM_POOL_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+struct cras_audio_shm;
+
+/* Maximum number of areas kept, the oldest is destroyed past it. */
+#define CRAS_SHM_POOL_MAX_ENTRIES 16
+
+/* Takes an area previously given to cras_shm_pool_put.
+ * Args:
+ *    client_id - The client the new stream belongs to.
+ *    samples_size - Requested size of the samples area.
+ *    samples_prot - PROT_READ or PROT_WRITE, as for cras_audio_shm_create.
+ * Returns:
+ *    The area with its header reset, or NULL if none matches.
+ */
+struct cras_audio_shm *cras_shm_pool_get(uint16_t client_id,
+					 size_t samples_size, int samples_prot);
+
+/* Keeps the area of a destroyed stream for reuse.
+ * Args:
+ *    client_id - The client the stream belonged to.
+ *    samples_size - Size the samples area was requested with.
+ *    samples_prot - The protection the samples area is mapped with.
+ *    shm - The area, owned by the pool after the call.
+ */
+void cras_shm_pool_put(uint16_t client_id, size_t samples_size,
+		       int samples_prot, struct cras_audio_shm *shm);
+
+/* Destroys the areas kept for a client, called when it disconnects. */
+void cras_shm_pool_release_client(uint16_t client_id);
+
+/* Destroys all kept areas. */
+void cras_shm_pool_deinit();
+
+/* Returns the number of areas kept. */
+unsigned int cras_shm_pool_num_entries();
+
+#endif /* CRAS_SHM_POOL_H_ */
@@ -0,0 +1,60 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <string.h>
+#include <syslog.h>
+
+#include "cras_iodev_list.h"
+#include "cras_main_message.h"
+#include "cras_stream_drain_handler.h"
+#include "stream_list.h"
+
+struct stream_drained_msg {
+	struct cras_main_message header;
+	cras_stream_id_t stream_id;
+};
+
+/* The following functions are called from audio thread. */
+
+static void init_stream_drained_msg(struct stream_drained_msg *msg)
+{
+	memset(msg, 0, sizeof(*msg));
+	msg->header.type = CRAS_MAIN_STREAM_DRAINED;
+	msg->header.length = sizeof(*msg);
+}
+
+int cras_stream_drain_send_msg(cras_stream_id_t stream_id)
+{
+	struct stream_drained_msg msg;
+	int rc;
+
+	init_stream_drained_msg(&msg);
+	msg.stream_id = stream_id;
+
+	rc = cras_main_message_send((struct cras_main_message *)&msg);
+	if (rc < 0)
+		syslog(LOG_ERR, "Failed to send stream drained message!");
+
+	return rc;
+}
+
+/* The following functions are called from main thread. */
+
+static void handle_stream_drained_message(struct cras_main_message *msg,
+					  void *arg)
+{
+	struct stream_drained_msg *drained_msg =
+		(struct stream_drained_msg *)msg;
+
+	stream_list_stream_drained(cras_iodev_list_get_stream_list(),
+				   drained_msg->stream_id);
+}
+
+int cras_stream_drain_handler_init()
+{
+	cras_main_message_add_handler(CRAS_MAIN_STREAM_DRAINED,
+				      handle_stream_drained_message, NULL);
+	return 0;
+}
@@ -0,0 +1,26 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * The stream drain handler lets the main thread destroy a removed stream as
+ * soon as its last samples are played, rather than polling the audio thread.
+ *
+ * cras_stream_drain_send_msg() is called from audio thread when a draining
+ * stream runs out of samples and is taken off its devices.
+ *
+ * cras_stream_drain_handler_init() is used to setup the message handler in
+ * the main thread, which destroys the stream and tells its client.
+ */
+
+#ifndef CRAS_STREAM_DRAIN_HANDLER_H_
+#define CRAS_STREAM_DRAIN_HANDLER_H_
+
+#include "cras_types.h"
+
+/* Send stream drained message. */
+int cras_stream_drain_send_msg(cras_stream_id_t stream_id);
+
+/* Initialize stream drain handler. */
+int cras_stream_drain_handler_init();
+
+#endif /* CRAS_STREAM_DRAIN_HANDLER_H_ */
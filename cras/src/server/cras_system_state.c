@@ -19,19 +19,40 @@
 #include "cras_config.h"
 #include "cras_device_blocklist.h"
 #include "cras_iodev_list.h"
+#include "cras_level_meter.h"
+#include "cras_mem_stats.h"
 #include "cras_observer.h"
+#include "cras_rt_mem.h"
 #include "cras_shm.h"
 #include "cras_system_state.h"
 #include "cras_tm.h"
 #include "cras_types.h"
 #include "cras_util.h"
+#include "dev_io.h"
+#include "dev_stream.h"
 #include "utlist.h"
 
+/* The most threads probing cards at the same time. */
+#define MAX_CARD_PROBE_THREADS 4
+
 struct card_list {
 	struct cras_alsa_card *card;
 	struct card_list *prev, *next;
 };
 
+/* Cards being probed by a pool of threads.
+ * infos - The cards to probe.
+ * cards - Filled with the probed cards, NULL for those that failed.
+ * num_cards - The number of cards.
+ * next - The index of the next card to probe, taken by the threads.
+ */
+struct card_probe_work {
+	const struct cras_alsa_card_info *infos;
+	struct cras_alsa_card **cards;
+	size_t num_cards;
+	size_t next;
+};
+
 struct name_list {
 	char name[NAME_MAX];
 	struct name_list *prev, *next;
@@ -58,6 +79,35 @@ struct name_list {
  *    main_thread_tid - The thread id of the main thread.
  *    bt_fix_a2dp_packet_size - The flag to override A2DP packet size set by
  *      Blueetoh peer devices to a smaller default value.
+ *    max_audio_threads - The number of audio threads devices can be spread
+ *      across.
+ *    audio_thread_log_size - The number of entries in the audio thread event
+ *      log.
+ *    float_mix_bus_enabled - Whether output devices mix streams in float.
+ *    dsp_offload_enabled - Whether output devices run their DSP on a worker
+ *      thread.
+ *    apm_offload_enabled - Whether the APMs of capture streams run on a
+ *      worker thread.
+ *    idle_pause_ms - How long an output without streams plays silence
+ *      before it is paused, negative to never pause it.
+ *    hw_timestamp_rate_est_enabled - Whether ALSA devices time their levels
+ *      for rate estimation with the timestamps of the kernel.
+ *    a2dp_encode_offload_enabled - Whether A2DP devices encode on a worker
+ *      thread.
+ *    sched_deadline_enabled - Whether audio threads try SCHED_DEADLINE
+ *      before SCHED_RR.
+ *    audio_thread_cpu_mask - CPUs audio threads and their workers are pinned
+ *      to, 0 to leave them unpinned.
+ *    audio_thread_uclamp_min - Minimum utilization clamp of audio threads
+ *      while they have open devices, 0 for none.
+ *    warm_standby_ms - How long an output kept open for a quick switch
+ *      waits for streams before it is closed, 0 to not keep any open.
+ *    mic_keep_warm_ms - How long an input stays open after its last capture
+ *      stream is removed, 0 to close it right away.
+ *    native_rate_enabled - Whether outputs are reopened at the rate of their
+ *      streams when all of them share one the output supports.
+ *    rt_priority - SCHED_RR priority of audio threads and their workers.
+ *    journal_changes - Parts of the state changed by the update in progress.
  */
 static struct {
 	struct cras_server_state *exp_state;
@@ -80,11 +130,40 @@ static struct {
 	int (*add_task)(void (*callback)(void *data), void *callback_data,
 			void *task_data);
 	void *task_data;
-	struct cras_audio_thread_snapshot_buffer snapshot_buffer;
+	struct cras_audio_thread_snapshot
+		*snapshots[CRAS_MAX_AUDIO_THREAD_SNAPSHOTS];
+	unsigned int num_snapshots;
+	size_t snapshots_size;
 	pthread_t main_thread_tid;
 	bool bt_fix_a2dp_packet_size;
+	unsigned int max_audio_threads;
+	unsigned int audio_thread_log_size;
+	bool float_mix_bus_enabled;
+	bool dsp_offload_enabled;
+	bool apm_offload_enabled;
+	int idle_pause_ms;
+	bool hw_timestamp_rate_est_enabled;
+	bool a2dp_encode_offload_enabled;
+	bool sched_deadline_enabled;
+	uint32_t audio_thread_cpu_mask;
+	uint32_t audio_thread_uclamp_min;
+	int warm_standby_ms;
+	int mic_keep_warm_ms;
+	bool native_rate_enabled;
+	int rt_priority;
+	uint32_t journal_changes;
 } state;
 
+/* The volume, mute and suspend state as an audio thread last read it. While
+ * valid, the getters return these so all the checks of one wake agree. */
+static __thread struct {
+	int valid;
+	size_t volume;
+	int mute;
+	int capture_mute;
+	int suspended;
+} volume_snapshot;
+
 /* The string format is CARD1,CARD2,CARD3. Divide it into a list. */
 void init_ignore_suffix_cards(char *str)
 {
@@ -118,6 +197,26 @@ void deinit_ignore_suffix_cards()
 	}
 }
 
+/* Shows clients the performance profile the server ended up with, after
+ * the limits applied to the board config. */
+static void share_perf_profile(struct cras_server_state *exp_state,
+			       const struct cras_board_config *board_config)
+{
+	struct cras_perf_profile *profile = &exp_state->perf_profile;
+
+	profile->rt_priority = state.rt_priority;
+	profile->playback_wake_fuzz_us = board_config->playback_wake_fuzz_us;
+	profile->capture_wake_fuzz_us = board_config->capture_wake_fuzz_us;
+	profile->resampler_quality = board_config->resampler_quality;
+	profile->max_audio_threads = state.max_audio_threads;
+	profile->audio_thread_cpu_mask = state.audio_thread_cpu_mask;
+	profile->audio_thread_uclamp_min = state.audio_thread_uclamp_min;
+	profile->sched_deadline = state.sched_deadline_enabled;
+	profile->audio_thread_log_size = state.audio_thread_log_size;
+	profile->default_output_buffer_size =
+		exp_state->default_output_buffer_size;
+}
+
 /*
  * Exported Interface.
  */
@@ -163,6 +262,8 @@ void cras_system_state_init(const char *device_config_dir, const char *shm_name,
 	exp_state->noise_cancellation_enabled = 0;
 	exp_state->hotword_pause_at_suspend =
 		board_config.hotword_pause_at_suspend;
+	cras_mem_stats_share(&exp_state->mem_usage);
+	cras_level_meter_share(exp_state->level_meters);
 
 	if ((rc = pthread_mutex_init(&state.update_lock, 0) != 0)) {
 		syslog(LOG_ERR, "Fatal: system state mutex init");
@@ -170,6 +271,33 @@ void cras_system_state_init(const char *device_config_dir, const char *shm_name,
 	}
 
 	state.exp_state = exp_state;
+	state.max_audio_threads = MAX(board_config.max_audio_threads, 1);
+	state.audio_thread_log_size =
+		MIN(MAX(board_config.audio_thread_log_size,
+			AUDIO_THREAD_EVENT_LOG_SIZE),
+		    AUDIO_THREAD_EVENT_LOG_MAX_SIZE);
+	state.float_mix_bus_enabled = !!board_config.float_mix_bus;
+	state.dsp_offload_enabled = !!board_config.dsp_offload;
+	state.apm_offload_enabled = !!board_config.apm_offload;
+	state.idle_pause_ms = board_config.idle_pause_ms;
+	state.hw_timestamp_rate_est_enabled =
+		!!board_config.hw_timestamp_rate_est;
+	state.a2dp_encode_offload_enabled = !!board_config.a2dp_encode_offload;
+	state.sched_deadline_enabled = !!board_config.sched_deadline;
+	state.audio_thread_cpu_mask = board_config.cpu_affinity;
+	state.audio_thread_uclamp_min =
+		MIN(MAX(board_config.uclamp_min, 0), CRAS_UCLAMP_MAX);
+	state.warm_standby_ms = MAX(board_config.warm_standby_ms, 0);
+	state.mic_keep_warm_ms = MAX(board_config.mic_keep_warm_ms, 0);
+	state.native_rate_enabled = !!board_config.native_rate;
+	cras_rt_mem_set_budget((size_t)MAX(board_config.mlock_budget_kb, 0) *
+			       1024);
+	state.rt_priority = board_config.rt_priority;
+	dev_io_set_playback_wake_fuzz_us(board_config.playback_wake_fuzz_us);
+	dev_stream_set_capture_wake_fuzz_us(board_config.capture_wake_fuzz_us);
+	dev_stream_set_default_resampler_quality(
+		(enum CRAS_RESAMPLER_QUALITY)board_config.resampler_quality);
+	share_perf_profile(exp_state, &board_config);
 
 	/* Directory for volume curve configs.
 	 * Note that device_config_dir does not affect device blocklist.
@@ -190,9 +318,9 @@ void cras_system_state_init(const char *device_config_dir, const char *shm_name,
 	state.device_blocklist =
 		cras_device_blocklist_create(CRAS_CONFIG_FILE_DIR);
 
-	/* Initialize snapshot buffer memory */
-	memset(&state.snapshot_buffer, 0,
-	       sizeof(struct cras_audio_thread_snapshot_buffer));
+	memset(state.snapshots, 0, sizeof(state.snapshots));
+	state.num_snapshots = 0;
+	state.snapshots_size = 0;
 
 	/* Save thread id of the main thread. */
 	state.main_thread_tid = pthread_self();
@@ -205,6 +333,16 @@ void cras_system_state_set_internal_ucm_suffix(const char *internal_ucm_suffix)
 	state.internal_ucm_suffix = internal_ucm_suffix;
 }
 
+/* Frees the oldest snapshot kept. */
+static void drop_oldest_snapshot()
+{
+	state.snapshots_size -= state.snapshots[0]->size;
+	free(state.snapshots[0]);
+	state.num_snapshots--;
+	memmove(state.snapshots, state.snapshots + 1,
+		state.num_snapshots * sizeof(state.snapshots[0]));
+}
+
 void cras_system_state_deinit()
 {
 	/* Free any resources used.  This prevents unit tests from leaking. */
@@ -213,7 +351,12 @@ void cras_system_state_deinit()
 
 	cras_tm_deinit(state.tm);
 
+	while (state.num_snapshots)
+		drop_oldest_snapshot();
+
 	if (state.exp_state) {
+		cras_mem_stats_share(NULL);
+		cras_level_meter_share(NULL);
 		munmap(state.exp_state, state.shm_size);
 		cras_shm_close_unlink(state.shm_name, state.shm_fd);
 		if (state.shm_fd_ro != state.shm_fd)
@@ -224,17 +367,42 @@ void cras_system_state_deinit()
 	pthread_mutex_destroy(&state.update_lock);
 }
 
+/* Starts an update of the volume, mute or suspend state. These are written
+ * under the update count like the rest of the state so that audio threads
+ * and clients read them consistently. */
+static struct cras_server_state *volume_update_begin()
+{
+	struct cras_server_state *s;
+
+	s = cras_system_state_update_begin();
+	if (s)
+		cras_system_state_journal_change(CRAS_STATE_CHANGE_VOLUME);
+	return s;
+}
+
+static void volume_update_complete(struct cras_server_state *s)
+{
+	if (s)
+		cras_system_state_update_complete();
+}
+
 void cras_system_set_volume(size_t volume)
 {
+	struct cras_server_state *s;
+
 	if (volume > CRAS_MAX_SYSTEM_VOLUME)
 		syslog(LOG_DEBUG, "system volume set out of range %zu", volume);
 
+	s = volume_update_begin();
 	state.exp_state->volume = MIN(volume, CRAS_MAX_SYSTEM_VOLUME);
+	volume_update_complete(s);
 	cras_observer_notify_output_volume(state.exp_state->volume);
 }
 
 size_t cras_system_get_volume()
 {
+	if (volume_snapshot.valid)
+		return volume_snapshot.volume;
 	return state.exp_state->volume;
 }
 
@@ -248,11 +416,14 @@ void cras_system_notify_mute(void)
 void cras_system_set_user_mute(int mute)
 {
 	int current_mute = cras_system_get_mute();
+	struct cras_server_state *s;
 
 	if (state.exp_state->user_mute == !!mute)
 		return;
 
+	s = volume_update_begin();
 	state.exp_state->user_mute = !!mute;
+	volume_update_complete(s);
 
 	if (current_mute == (mute || state.exp_state->mute))
 		return;
@@ -263,6 +434,7 @@ void cras_system_set_user_mute(int mute)
 void cras_system_set_mute(int mute)
 {
 	int current_mute = cras_system_get_mute();
+	struct cras_server_state *s;
 
 	if (state.exp_state->mute_locked)
 		return;
@@ -270,7 +442,9 @@ void cras_system_set_mute(int mute)
 	if (state.exp_state->mute == !!mute)
 		return;
 
+	s = volume_update_begin();
 	state.exp_state->mute = !!mute;
+	volume_update_complete(s);
 
 	if (current_mute == (mute || state.exp_state->user_mute))
 		return;
@@ -280,14 +454,20 @@ void cras_system_set_mute(int mute)
 
 void cras_system_set_mute_locked(int locked)
 {
+	struct cras_server_state *s;
+
 	if (state.exp_state->mute_locked == !!locked)
 		return;
 
+	s = volume_update_begin();
 	state.exp_state->mute_locked = !!locked;
+	volume_update_complete(s);
 }
 
 int cras_system_get_mute()
 {
+	if (volume_snapshot.valid)
+		return volume_snapshot.mute;
 	return state.exp_state->mute || state.exp_state->user_mute;
 }
 
@@ -314,21 +494,31 @@ void cras_system_notify_capture_mute(void)
 
 void cras_system_set_capture_mute(int mute)
 {
+	struct cras_server_state *s;
+
 	if (state.exp_state->capture_mute_locked)
 		return;
 
+	s = volume_update_begin();
 	state.exp_state->capture_mute = !!mute;
+	volume_update_complete(s);
 	cras_system_notify_capture_mute();
 }
 
 void cras_system_set_capture_mute_locked(int locked)
 {
+	struct cras_server_state *s;
+
+	s = volume_update_begin();
 	state.exp_state->capture_mute_locked = !!locked;
+	volume_update_complete(s);
 	cras_system_notify_capture_mute();
 }
 
 int cras_system_get_capture_mute()
 {
+	if (volume_snapshot.valid)
+		return volume_snapshot.capture_mute;
 	return state.exp_state->capture_mute;
 }
 
@@ -339,12 +529,18 @@ int cras_system_get_capture_mute_locked()
 
 int cras_system_get_suspended()
 {
+	if (volume_snapshot.valid)
+		return volume_snapshot.suspended;
 	return state.exp_state->suspended;
 }
 
 void cras_system_set_suspended(int suspended)
 {
+	struct cras_server_state *s;
+
+	s = volume_update_begin();
 	state.exp_state->suspended = suspended;
+	volume_update_complete(s);
 	cras_observer_notify_suspend_changed(suspended);
 	cras_alert_process_all_pending_alerts();
 }
@@ -444,6 +640,81 @@ void cras_system_set_hotword_pause_at_suspend(bool pause)
 	state.exp_state->hotword_pause_at_suspend = pause;
 }
 
+unsigned int cras_system_get_max_audio_threads()
+{
+	return state.max_audio_threads;
+}
+
+unsigned int cras_system_get_audio_thread_log_size()
+{
+	return state.audio_thread_log_size;
+}
+
+bool cras_system_get_float_mix_bus_enabled()
+{
+	return state.float_mix_bus_enabled;
+}
+
+bool cras_system_get_dsp_offload_enabled()
+{
+	return state.dsp_offload_enabled;
+}
+
+bool cras_system_get_apm_offload_enabled()
+{
+	return state.apm_offload_enabled;
+}
+
+int cras_system_get_idle_pause_ms()
+{
+	return state.idle_pause_ms;
+}
+
+bool cras_system_get_hw_timestamp_rate_est_enabled()
+{
+	return state.hw_timestamp_rate_est_enabled;
+}
+
+bool cras_system_get_a2dp_encode_offload_enabled()
+{
+	return state.a2dp_encode_offload_enabled;
+}
+
+bool cras_system_get_sched_deadline_enabled()
+{
+	return state.sched_deadline_enabled;
+}
+
+uint32_t cras_system_get_audio_thread_cpu_mask()
+{
+	return state.audio_thread_cpu_mask;
+}
+
+uint32_t cras_system_get_audio_thread_uclamp_min()
+{
+	return state.audio_thread_uclamp_min;
+}
+
+int cras_system_get_warm_standby_ms()
+{
+	return state.warm_standby_ms;
+}
+
+int cras_system_get_mic_keep_warm_ms()
+{
+	return state.mic_keep_warm_ms;
+}
+
+bool cras_system_get_native_rate_enabled()
+{
+	return state.native_rate_enabled;
+}
+
+int cras_system_get_rt_priority()
+{
+	return state.rt_priority;
+}
+
 int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info)
 {
 	struct card_list *card;
@@ -473,6 +744,91 @@ int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info)
 	return 0;
 }
 
+static void *card_probe_thread(void *arg)
+{
+	struct card_probe_work *work = (struct card_probe_work *)arg;
+	size_t i;
+
+	while (1) {
+		i = __atomic_fetch_add(&work->next, 1, __ATOMIC_RELAXED);
+		if (i >= work->num_cards)
+			break;
+		work->cards[i] = cras_alsa_card_probe(&work->infos[i],
+						      state.device_config_dir,
+						      state.internal_ucm_suffix);
+	}
+	return NULL;
+}
+
+int cras_system_add_alsa_cards(struct cras_alsa_card_info *alsa_card_infos,
+			       size_t num_cards)
+{
+	struct card_probe_work work;
+	pthread_t tids[MAX_CARD_PROBE_THREADS - 1];
+	size_t num_threads = 0;
+	struct card_list *card;
+	size_t i;
+	int rc = 0;
+
+	if (num_cards == 0)
+		return 0;
+	if (alsa_card_infos == NULL)
+		return -EINVAL;
+
+	work.infos = alsa_card_infos;
+	work.num_cards = num_cards;
+	work.next = 0;
+	work.cards = (struct cras_alsa_card **)calloc(num_cards,
+						      sizeof(*work.cards));
+	if (work.cards == NULL)
+		return -ENOMEM;
+
+	/* The main thread probes too, so all the cards are probed even if no
+	 * thread could be started. */
+	while (num_threads < MIN(num_cards - 1, ARRAY_SIZE(tids))) {
+		if (pthread_create(&tids[num_threads], NULL, card_probe_thread,
+				   &work))
+			break;
+		num_threads++;
+	}
+	card_probe_thread(&work);
+	for (i = 0; i < num_threads; i++)
+		pthread_join(tids[i], NULL);
+
+	/* Devices are added in the order of the cards, as when adding them one
+	 * by one. */
+	for (i = 0; i < num_cards; i++) {
+		const struct cras_alsa_card_info *info = &alsa_card_infos[i];
+
+		if (work.cards[i] == NULL) {
+			rc = -ENOMEM;
+			continue;
+		}
+		if (cras_system_alsa_card_exists(info->card_index)) {
+			cras_alsa_card_destroy(work.cards[i]);
+			rc = -EEXIST;
+			continue;
+		}
+		if (cras_alsa_card_add_devices(work.cards[i],
+					       &alsa_card_infos[i],
+					       state.device_blocklist)) {
+			cras_alsa_card_destroy(work.cards[i]);
+			rc = -ENOMEM;
+			continue;
+		}
+		card = calloc(1, sizeof(*card));
+		if (card == NULL) {
+			cras_alsa_card_destroy(work.cards[i]);
+			rc = -ENOMEM;
+			continue;
+		}
+		card->card = work.cards[i];
+		DL_APPEND(state.cards, card);
+	}
+	free(work.cards);
+	return rc;
+}
+
 int cras_system_remove_alsa_card(size_t alsa_card_index)
 {
 	struct card_list *card;
@@ -557,6 +913,7 @@ void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction,
 	if (!s)
 		return;
 
+	cras_system_state_journal_change(CRAS_STATE_CHANGE_STREAMS);
 	s->num_active_streams[direction]++;
 	s->num_streams_attached++;
 	if (direction == CRAS_STREAM_INPUT) {
@@ -580,6 +937,7 @@ void cras_system_state_stream_removed(enum CRAS_STREAM_DIRECTION direction,
 	if (!s)
 		return;
 
+	cras_system_state_journal_change(CRAS_STATE_CHANGE_STREAMS);
 	sum = 0;
 	for (i = 0; i < CRAS_NUM_DIRECTIONS; i++)
 		sum += s->num_active_streams[i];
@@ -676,10 +1034,76 @@ struct cras_server_state *cras_system_state_update_begin()
 
 void cras_system_state_update_complete()
 {
-	__sync_fetch_and_add(&state.exp_state->update_count, 1);
+	struct cras_server_state *s = state.exp_state;
+	struct cras_state_change *entry;
+
+	/* Journal the update with the count readers will see once it's done. */
+	if (state.journal_changes) {
+		entry = &s->journal[s->journal_head % CRAS_STATE_JOURNAL_SIZE];
+		entry->update_count = s->update_count + 1;
+		entry->changes = state.journal_changes;
+		s->journal_head++;
+		state.journal_changes = 0;
+	}
+	__sync_fetch_and_add(&s->update_count, 1);
 	pthread_mutex_unlock(&state.update_lock);
 }
 
+void cras_system_state_journal_change(uint32_t changes)
+{
+	state.journal_changes |= changes;
+}
+
+uint32_t cras_system_state_get_changes(uint32_t *since)
+{
+	const struct cras_server_state *s = state.exp_state;
+	const struct cras_state_change *entry;
+	uint32_t changes = 0;
+	unsigned int i;
+
+	pthread_mutex_lock(&state.update_lock);
+	if (*since == 0) {
+		changes = CRAS_STATE_CHANGE_ALL;
+	} else if (*since != s->update_count) {
+		/* Walk back to the first update already seen. */
+		for (i = 0; i < s->journal_head && i < CRAS_STATE_JOURNAL_SIZE;
+		     i++) {
+			entry = &s->journal[(s->journal_head - 1 - i) %
+					    CRAS_STATE_JOURNAL_SIZE];
+			if ((int32_t)(entry->update_count - *since) <= 0)
+				break;
+			changes |= entry->changes;
+		}
+		if (i == CRAS_STATE_JOURNAL_SIZE)
+			changes = CRAS_STATE_CHANGE_ALL;
+	}
+	*since = s->update_count;
+	pthread_mutex_unlock(&state.update_lock);
+
+	return changes;
+}
+
+void cras_system_state_snapshot_volume()
+{
+	struct cras_server_state *s = state.exp_state;
+	unsigned count;
+
+	/* Seqlock read: retry while an update is in progress or one completed
+	 * while the fields were copied. */
+	do {
+		while ((count = *(volatile unsigned *)&s->update_count) & 1)
+			;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+		volume_snapshot.volume = s->volume;
+		volume_snapshot.mute = s->mute || s->user_mute;
+		volume_snapshot.capture_mute = s->capture_mute;
+		volume_snapshot.suspended = s->suspended;
+		__atomic_thread_fence(__ATOMIC_ACQUIRE);
+	} while (count != *(volatile unsigned *)&s->update_count);
+
+	volume_snapshot.valid = 1;
+}
+
 struct cras_server_state *cras_system_state_get_no_lock()
 {
 	return state.exp_state;
@@ -697,15 +1121,31 @@ struct cras_tm *cras_system_state_get_tm()
 
 void cras_system_state_dump_snapshots()
 {
-	memcpy(&state.exp_state->snapshot_buffer, &state.snapshot_buffer,
-	       sizeof(struct cras_audio_thread_snapshot_buffer));
+	struct cras_audio_thread_snapshot_buffer *buf =
+		&state.exp_state->snapshot_buffer;
+	unsigned int i;
+
+	buf->size = 0;
+	for (i = 0; i < state.num_snapshots; i++) {
+		memcpy(buf->data + buf->size, state.snapshots[i],
+		       state.snapshots[i]->size);
+		buf->size += state.snapshots[i]->size;
+	}
+	buf->num_snapshots = state.num_snapshots;
 }
 
 void cras_system_state_add_snapshot(struct cras_audio_thread_snapshot *snapshot)
 {
-	state.snapshot_buffer.snapshots[state.snapshot_buffer.pos++] =
-		(*snapshot);
-	state.snapshot_buffer.pos %= CRAS_MAX_AUDIO_THREAD_SNAPSHOTS;
+	if (snapshot->size > CRAS_AUDIO_THREAD_SNAPSHOT_BUFFER_SIZE) {
+		free(snapshot);
+		return;
+	}
+	while (state.num_snapshots == CRAS_MAX_AUDIO_THREAD_SNAPSHOTS ||
+	       state.snapshots_size + snapshot->size >
+		       CRAS_AUDIO_THREAD_SNAPSHOT_BUFFER_SIZE)
+		drop_oldest_snapshot();
+	state.snapshots[state.num_snapshots++] = snapshot;
+	state.snapshots_size += snapshot->size;
 }
 
 int cras_system_state_in_main_thread()
@@ -149,6 +149,66 @@ bool cras_system_get_hotword_pause_at_suspend();
 /* Sets whether to pause hotword detection at system suspend. */
 void cras_system_set_hotword_pause_at_suspend(bool pause);
 
+/* Returns the number of audio threads open devices can be spread across. */
+unsigned int cras_system_get_max_audio_threads();
+
+/* Returns the number of entries in the audio thread event log. */
+unsigned int cras_system_get_audio_thread_log_size();
+
+/* Returns true if output devices mix their streams in a float mix bus. */
+bool cras_system_get_float_mix_bus_enabled();
+
+/* Returns true if output devices run their DSP on a worker thread, one
+ * period behind the audio thread. */
+bool cras_system_get_dsp_offload_enabled();
+
+/* Returns true if the APMs of capture streams run on worker threads,
+ * 10ms behind the audio thread. */
+bool cras_system_get_apm_offload_enabled();
+
+/* Returns how long, in milliseconds, an output device without streams plays
+ * silence before it is paused. Negative if idle outputs are never paused. */
+int cras_system_get_idle_pause_ms();
+
+/* Returns true if ALSA devices report the time the kernel last updated their
+ * hardware pointers along with their levels, rather than the time they were
+ * read, so the rate estimators don't pick up the audio thread's wake up
+ * jitter. */
+bool cras_system_get_hw_timestamp_rate_est_enabled();
+
+/* Returns true if A2DP devices encode on a worker thread rather than on the
+ * audio thread. */
+bool cras_system_get_a2dp_encode_offload_enabled();
+
+/* Returns true if audio threads run with SCHED_DEADLINE, sized from their open
+ * devices, when the kernel admits them. */
+bool cras_system_get_sched_deadline_enabled();
+
+/* Returns the mask of CPUs audio threads and their worker threads are pinned
+ * to, 0 if they aren't pinned. */
+uint32_t cras_system_get_audio_thread_cpu_mask();
+
+/* Returns the minimum utilization clamp, up to CRAS_UCLAMP_MAX, audio threads
+ * request while they have open devices, 0 if they don't. */
+uint32_t cras_system_get_audio_thread_uclamp_min();
+
+/* Returns how long, in milliseconds, an output device that is likely to be
+ * switched to is kept open without streams, 0 if none are kept open. */
+int cras_system_get_warm_standby_ms();
+
+/* Returns how long, in milliseconds, an input device keeps capturing after
+ * its last stream is removed, so the next stream starts without opening it
+ * again. 0 if inputs close right away. */
+int cras_system_get_mic_keep_warm_ms();
+
+/* Returns whether outputs run at the rate and format their streams share,
+ * when the hardware supports it, instead of converting them. */
+bool cras_system_get_native_rate_enabled();
+
+/* Returns the SCHED_RR priority audio threads and the worker threads they
+ * hand blocks to run at. */
+int cras_system_get_rt_priority();
+
 /* Adds a card at the given index to the system.  When a new card is found
  * (through a udev event notification) this will add the card to the system,
  * causing its devices to become available for playback/capture.
@@ -160,6 +220,19 @@ void cras_system_set_hotword_pause_at_suspend(bool pause);
  */
 int cras_system_add_alsa_card(struct cras_alsa_card_info *alsa_card_info);
 
+/* Adds several cards to the system, as found when enumerating the cards at
+ * startup. The cards are probed on a few threads in parallel, then their
+ * devices are added in order on the calling thread.
+ * Args:
+ *    alsa_card_infos - Info about each alsa card.
+ *    num_cards - The number of cards.
+ * Returns:
+ *    0 on success, negative error if any card couldn't be added, the others
+ *    are added all the same.
+ */
+int cras_system_add_alsa_cards(struct cras_alsa_card_info *alsa_card_infos,
+			       size_t num_cards);
+
 /* Removes a card.  When a device is removed this will do the cleanup.  Device
  * at index must have been added using cras_system_add_alsa_card().
  * Args:
@@ -337,6 +410,34 @@ struct cras_server_state *cras_system_state_update_begin();
  */
 void cras_system_state_update_complete();
 
+/* Records in the state change journal that the update in progress changes the
+ * given parts of the state.  Call between cras_system_state_update_begin and
+ * cras_system_state_update_complete.
+ * Args:
+ *    changes - Bitmask of enum CRAS_STATE_CHANGE.
+ */
+void cras_system_state_journal_change(uint32_t changes);
+
+/* Gets the parts of the state changed since an update count, from the state
+ * change journal.  Lets main thread users cache what they derive from the
+ * state.
+ * Args:
+ *    since - The update count the caller last saw, 0 if none.  Set to the
+ *        current update count.
+ * Returns:
+ *    Bitmask of enum CRAS_STATE_CHANGE, CRAS_STATE_CHANGE_ALL if since is 0
+ *    or older than the journal.
+ */
+uint32_t cras_system_state_get_changes(uint32_t *since);
+
+/* Takes a consistent copy of the volume, mute and suspend state for the
+ * calling thread, which cras_system_get_volume, cras_system_get_mute,
+ * cras_system_get_capture_mute and cras_system_get_suspended return from
+ * then on.  Audio threads call this once per wake instead of reading the
+ * shared state at every check.  Must not be called from the main thread,
+ * which writes the state. */
+void cras_system_state_snapshot_volume();
+
 /* Gets a pointer to the system state without locking it.  Only used for debug
  * log.  Don't add calls to this function. */
 struct cras_server_state *cras_system_state_get_no_lock();
@@ -348,7 +449,8 @@ key_t cras_sys_state_shm_fd();
 struct cras_tm *cras_system_state_get_tm();
 
 /*
- * Add snapshot to snapshot buffer in system state
+ * Add snapshot to snapshot buffer in system state, which takes ownership of
+ * it. The oldest snapshots are dropped to make room.
  */
 void cras_system_state_add_snapshot(struct cras_audio_thread_snapshot *);
 
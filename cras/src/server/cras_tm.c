@@ -5,26 +5,49 @@
 
 #include "cras_types.h"
 #include "cras_util.h"
-#include "utlist.h"
 
+#include <stdint.h>
+#include <stdlib.h>
 #include <time.h>
 
 /* Represents an armed timer.
  * Members:
  *    ts - timespec at which the timer should fire.
+ *    seq - Creation order, timers due at the same time fire in this order.
+ *    heap_idx - Position of the timer in the manager's heap.
  *    cb - Callback to call when the timer expires.
  *    cb_data - Data passed to the callback.
+ *    next - Next free timer while the timer is in the pool.
  */
 struct cras_timer {
 	struct timespec ts;
+	uint64_t seq;
+	size_t heap_idx;
 	void (*cb)(struct cras_timer *t, void *data);
 	void *cb_data;
-	struct cras_timer *next, *prev;
+	struct cras_timer *next;
 };
 
-/* Timer Manager, keeps a list of active timers. */
+/* Freed timers kept for reuse, enough for the timers armed at once. */
+#define MAX_FREE_TIMERS 32
+
+/* Timer Manager, keeps the active timers in a min-heap ordered by expiry, so
+ * the next timeout is at the top and adding or cancelling is O(log n).
+ * Members:
+ *    heap - Active timers, heap[0] expires first.
+ *    num_timers - Number of active timers.
+ *    heap_size - Allocated length of heap.
+ *    next_seq - seq of the next timer created.
+ *    free_timers - Pool of freed timers.
+ *    num_free - Number of timers in the pool.
+ */
 struct cras_tm {
-	struct cras_timer *timers;
+	struct cras_timer **heap;
+	size_t num_timers;
+	size_t heap_size;
+	uint64_t next_seq;
+	struct cras_timer *free_timers;
+	unsigned int num_free;
 };
 
 /* Local Functions. */
@@ -51,6 +74,71 @@ static inline int timespec_sooner(const struct timespec *a,
 		(a->tv_sec == b->tv_sec && a->tv_nsec <= b->tv_nsec));
 }
 
+/* Checks if timer a expires before timer b. */
+static inline int timer_before(const struct cras_timer *a,
+			       const struct cras_timer *b)
+{
+	if (a->ts.tv_sec != b->ts.tv_sec || a->ts.tv_nsec != b->ts.tv_nsec)
+		return timespec_sooner(&a->ts, &b->ts);
+	return a->seq < b->seq;
+}
+
+static inline void heap_set(struct cras_tm *tm, size_t idx,
+			    struct cras_timer *t)
+{
+	tm->heap[idx] = t;
+	t->heap_idx = idx;
+}
+
+/* Moves the timer at idx up or down until the heap is ordered again. */
+static void heap_fix(struct cras_tm *tm, size_t idx)
+{
+	struct cras_timer *t = tm->heap[idx];
+	size_t parent, child;
+
+	while (idx > 0) {
+		parent = (idx - 1) / 2;
+		if (!timer_before(t, tm->heap[parent]))
+			break;
+		heap_set(tm, idx, tm->heap[parent]);
+		idx = parent;
+	}
+
+	while ((child = 2 * idx + 1) < tm->num_timers) {
+		if (child + 1 < tm->num_timers &&
+		    timer_before(tm->heap[child + 1], tm->heap[child]))
+			child++;
+		if (!timer_before(tm->heap[child], t))
+			break;
+		heap_set(tm, idx, tm->heap[child]);
+		idx = child;
+	}
+
+	heap_set(tm, idx, t);
+}
+
+static void heap_remove(struct cras_tm *tm, struct cras_timer *t)
+{
+	size_t idx = t->heap_idx;
+
+	tm->num_timers--;
+	if (idx == tm->num_timers)
+		return;
+	heap_set(tm, idx, tm->heap[tm->num_timers]);
+	heap_fix(tm, idx);
+}
+
+static void free_timer(struct cras_tm *tm, struct cras_timer *t)
+{
+	if (tm->num_free >= MAX_FREE_TIMERS) {
+		free(t);
+		return;
+	}
+	t->next = tm->free_timers;
+	tm->free_timers = t;
+	tm->num_free++;
+}
+
 /* Exported Interface. */
 
 struct cras_timer *cras_tm_create_timer(struct cras_tm *tm, unsigned int ms,
@@ -59,26 +147,46 @@ struct cras_timer *cras_tm_create_timer(struct cras_tm *tm, unsigned int ms,
 					void *cb_data)
 {
 	struct cras_timer *t;
+	struct cras_timer **heap;
+	size_t heap_size;
+
+	if (tm->num_timers == tm->heap_size) {
+		heap_size = tm->heap_size ? tm->heap_size * 2 : MAX_FREE_TIMERS;
+		heap = realloc(tm->heap, heap_size * sizeof(*heap));
+		if (!heap)
+			return NULL;
+		tm->heap = heap;
+		tm->heap_size = heap_size;
+	}
 
-	t = calloc(1, sizeof(*t));
-	if (!t)
-		return NULL;
+	if (tm->free_timers) {
+		t = tm->free_timers;
+		tm->free_timers = t->next;
+		tm->num_free--;
+	} else {
+		t = malloc(sizeof(*t));
+		if (!t)
+			return NULL;
+	}
 
 	t->cb = cb;
 	t->cb_data = cb_data;
+	t->seq = tm->next_seq++;
+	t->next = NULL;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &t->ts);
 	add_ms_ts(&t->ts, ms);
 
-	DL_APPEND(tm->timers, t);
+	heap_set(tm, tm->num_timers++, t);
+	heap_fix(tm, t->heap_idx);
 
 	return t;
 }
 
 void cras_tm_cancel_timer(struct cras_tm *tm, struct cras_timer *t)
 {
-	DL_DELETE(tm->timers, t);
-	free(t);
+	heap_remove(tm, t);
+	free_timer(tm, t);
 }
 
 struct cras_tm *cras_tm_init()
@@ -90,8 +198,12 @@ void cras_tm_deinit(struct cras_tm *tm)
 {
 	struct cras_timer *t;
 
-	DL_FOREACH (tm->timers, t) {
-		DL_DELETE(tm->timers, t);
+	while (tm->num_timers)
+		free(tm->heap[--tm->num_timers]);
+	free(tm->heap);
+	while (tm->free_timers) {
+		t = tm->free_timers;
+		tm->free_timers = t->next;
 		free(t);
 	}
 	free(tm);
@@ -99,17 +211,13 @@ void cras_tm_deinit(struct cras_tm *tm)
 
 int cras_tm_get_next_timeout(const struct cras_tm *tm, struct timespec *ts)
 {
-	struct cras_timer *t;
 	struct timespec now;
 	struct timespec *min;
 
-	if (!tm->timers)
+	if (!tm->num_timers)
 		return 0;
 
-	min = &tm->timers->ts;
-	DL_FOREACH (tm->timers, t)
-		if (timespec_sooner(&t->ts, min))
-			min = &t->ts;
+	min = &tm->heap[0]->ts;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
@@ -126,24 +234,16 @@ int cras_tm_get_next_timeout(const struct cras_tm *tm, struct timespec *ts)
 void cras_tm_call_callbacks(struct cras_tm *tm)
 {
 	struct timespec now;
-	struct cras_timer *t, *next;
+	struct cras_timer *t;
 
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
-	/* Don't use DL_FOREACH to iterate timers because in each loop the
-	 * next timer pointer is stored for later access but it could be
-	 * cancelled and freed in current timer's callback causing invalid
-	 * memory access. */
-	t = tm->timers;
-	while (t) {
-		next = t->next;
-		if (timespec_sooner(&t->ts, &now)) {
-			t->cb(t, t->cb_data);
-			/* Update next timer because it could have been modified
-			 * in t->cb(). */
-			next = t->next;
-			cras_tm_cancel_timer(tm, t);
-		}
-		t = next;
+	/* Take each expired timer out of the heap before its callback, the
+	 * callback may create or cancel other timers. */
+	while (tm->num_timers && timespec_sooner(&tm->heap[0]->ts, &now)) {
+		t = tm->heap[0];
+		heap_remove(tm, t);
+		t->cb(t, t->cb_data);
+		free_timer(tm, t);
 	}
 }
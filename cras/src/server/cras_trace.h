@@ -0,0 +1,32 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Static probes on the audio hot path, so perf, bpftrace or Perfetto can line
+ * up CRAS work with kernel scheduling and ALSA interrupts. With
+ * --enable-usdt each probe is a USDT probe of the "cras" provider, a nop
+ * until a tracer attaches to it, e.g.
+ *    bpftrace -e 'usdt:/usr/bin/cras:cras:fetch_streams_begin { ... }'
+ * Otherwise probes compile away. Probes timing a section come in pairs named
+ * <section>_begin and <section>_end, taking the device index and the result
+ * respectively.
+ */
+
+#ifndef CRAS_TRACE_H_
+#define CRAS_TRACE_H_
+
+#ifdef HAVE_USDT
+#include <sys/sdt.h>
+
+#define CRAS_TRACE(name) DTRACE_PROBE(cras, name)
+#define CRAS_TRACE1(name, arg1) DTRACE_PROBE1(cras, name, arg1)
+#define CRAS_TRACE2(name, arg1, arg2) DTRACE_PROBE2(cras, name, arg1, arg2)
+#else
+#define CRAS_TRACE(name)                                                       \
+	do {                                                                   \
+	} while (0)
+#define CRAS_TRACE1(name, arg1) ((void)(arg1))
+#define CRAS_TRACE2(name, arg1, arg2) ((void)(arg1), (void)(arg2))
+#endif
+
+#endif /* CRAS_TRACE_H_ */
@@ -14,6 +14,7 @@
 #include <regex.h>
 #include <syslog.h>
 
+#include "cras_main_loop_stats.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
 #include "cras_util.h"
@@ -79,6 +80,8 @@ static regex_t card_regex;
 
 static char const *const subsystem = "sound";
 static const unsigned int MAX_DESC_NAME_LEN = 256;
+/* Alsa limit on number of cards. */
+#define MAX_ENUMERATED_CARDS 32
 
 static unsigned is_action(const char *desired, const char *actual)
 {
@@ -278,21 +281,27 @@ static void fill_usb_card_info(struct cras_alsa_card_info *card_info,
 	       card_info->usb_serial_number, card_info->usb_desc_checksum);
 }
 
+static void fill_card_info(struct cras_alsa_card_info *card_info,
+			   struct udev_device *dev, unsigned card,
+			   unsigned internal)
+{
+	memset(card_info, 0, sizeof(*card_info));
+	card_info->card_index = card;
+	if (internal) {
+		card_info->card_type = ALSA_CARD_TYPE_INTERNAL;
+	} else {
+		card_info->card_type = ALSA_CARD_TYPE_USB;
+		fill_usb_card_info(card_info, dev);
+	}
+}
+
 static void device_add_alsa(struct udev_device *dev, const char *sysname,
 			    unsigned card, unsigned internal)
 {
 	struct cras_alsa_card_info card_info;
-	memset(&card_info, 0, sizeof(card_info));
 
 	udev_delay_for_alsa();
-	card_info.card_index = card;
-	if (internal) {
-		card_info.card_type = ALSA_CARD_TYPE_INTERNAL;
-	} else {
-		card_info.card_type = ALSA_CARD_TYPE_USB;
-		fill_usb_card_info(&card_info, dev);
-	}
-
+	fill_card_info(&card_info, dev, card, internal);
 	cras_system_add_alsa_card(&card_info);
 }
 
@@ -317,6 +326,16 @@ static int udev_sound_initialized(struct udev_device *dev)
 	return 0;
 }
 
+/* Returns true if dev is the main node of an initialized card which isn't
+ * in the system yet, filling in the details as is_card_device() does. */
+static int is_new_card_device(struct udev_device *dev, unsigned *internal,
+			      unsigned *card_number, const char **sysname)
+{
+	return is_card_device(dev, internal, card_number, sysname) &&
+	       udev_sound_initialized(dev) &&
+	       !cras_system_alsa_card_exists(*card_number);
+}
+
 static void change_udev_device_if_alsa_device(struct udev_device *dev)
 {
 	/* If the device, 'dev' is an alsa device, add it to the set of
@@ -326,9 +345,7 @@ static void change_udev_device_if_alsa_device(struct udev_device *dev)
 	unsigned card_number;
 	const char *sysname;
 
-	if (is_card_device(dev, &internal, &card_number, &sysname) &&
-	    udev_sound_initialized(dev) &&
-	    !cras_system_alsa_card_exists(card_number)) {
+	if (is_new_card_device(dev, &internal, &card_number, &sysname)) {
 		if (internal)
 			set_factory_default(card_number);
 		device_add_alsa(dev, sysname, card_number, internal);
@@ -345,11 +362,27 @@ static void remove_device_if_card(struct udev_device *dev)
 		device_remove_alsa(sysname, card_number);
 }
 
+/* Returns true if the card is already in the first num_cards of infos. */
+static int card_listed(const struct cras_alsa_card_info *infos,
+		       size_t num_cards, unsigned card_number)
+{
+	size_t i;
+
+	for (i = 0; i < num_cards; i++)
+		if (infos[i].card_index == card_number)
+			return 1;
+	return 0;
+}
+
+/* Adds all the cards found at startup at once, so they are probed in
+ * parallel and wait for ALSA only once. */
 static void enumerate_devices(struct udev_callback_data *data)
 {
 	struct udev_enumerate *enumerate = udev_enumerate_new(data->udev);
 	struct udev_list_entry *dl;
 	struct udev_list_entry *dev_list_entry;
+	struct cras_alsa_card_info infos[MAX_ENUMERATED_CARDS];
+	size_t num_cards = 0;
 
 	udev_enumerate_add_match_subsystem(enumerate, subsystem);
 	udev_enumerate_scan_devices(enumerate);
@@ -360,11 +393,27 @@ static void enumerate_devices(struct udev_callback_data *data)
 		const char *path = udev_list_entry_get_name(dev_list_entry);
 		struct udev_device *dev =
 			udev_device_new_from_syspath(data->udev, path);
-
-		change_udev_device_if_alsa_device(dev);
+		unsigned internal;
+		unsigned card_number;
+		const char *sysname;
+
+		if (num_cards < MAX_ENUMERATED_CARDS &&
+		    is_new_card_device(dev, &internal, &card_number,
+				       &sysname) &&
+		    !card_listed(infos, num_cards, card_number)) {
+			if (internal)
+				set_factory_default(card_number);
+			fill_card_info(&infos[num_cards++], dev, card_number,
+				       internal);
+		}
 		udev_device_unref(dev);
 	}
 	udev_enumerate_unref(enumerate);
+
+	if (num_cards) {
+		udev_delay_for_alsa();
+		cras_system_add_alsa_cards(infos, num_cards);
+	}
 }
 
 static void udev_sound_subsystem_callback(void *arg, int revents)
@@ -408,6 +457,7 @@ void cras_udev_start_sound_subsystem_monitor()
 	udev_monitor_enable_receiving(udev_data.mon);
 	udev_data.fd = udev_monitor_get_fd(udev_data.mon);
 
+	cras_main_loop_stats_tag_fd(udev_data.fd, CRAS_MAIN_HANDLER_UDEV);
 	r = cras_system_add_select_fd(udev_data.fd,
 				      udev_sound_subsystem_callback, &udev_data,
 				      POLLIN);
@@ -15,18 +15,36 @@
 #include "cras_non_empty_audio_handler.h"
 #include "cras_rstream.h"
 #include "cras_server_metrics.h"
+#include "cras_stream_drain_handler.h"
+#include "cras_trace.h"
 #include "dev_stream.h"
 #include "input_data.h"
+#include "mix_bus.h"
 #include "polled_interval_checker.h"
 #include "rate_estimator.h"
 #include "utlist.h"
 
 #include "dev_io.h"
 
-static const struct timespec playback_wake_fuzz_ts = {
+/* How early a playback stream may be fetched, set by the board. */
+static struct timespec playback_wake_fuzz_ts = {
 	0, 500 * 1000 /* 500 usec. */
 };
 
+/*
+ * A playback stream may be fetched up to an eighth of its callback period
+ * before its next callback time, but no more than max_fetch_slack_ts. The
+ * thread wakes at the earliest deadline, and every stream whose window
+ * overlaps is fetched in the same wake instead of waking again for it.
+ */
+#define FETCH_SLACK_PERIOD_DIV 8
+static const struct timespec max_fetch_slack_ts = {
+	0, 1000 * 1000 /* 1 ms. */
+};
+/* A stream shed under CPU pressure may be fetched up to a quarter of its
+ * period early, with no cap, so it rarely needs a wake of its own. */
+#define SHED_FETCH_SLACK_PERIOD_DIV 4
+
 /* The maximum time to wait before checking the device's non-empty status. */
 static const int NON_EMPTY_UPDATE_INTERVAL_SEC = 5;
 
@@ -45,11 +63,15 @@ static const int MIN_EMPTY_PERIOD_SEC = 30;
  */
 static const int DROP_FRAMES_THRESHOLD_MS = 50;
 
-/* The number of devices playing/capturing non-empty stream(s). */
-static int non_empty_device_count = 0;
+/* The number of devices playing/capturing non-empty stream(s), counted by
+ * each audio thread for its own devices. */
+static __thread int non_empty_device_count = 0;
+
+/* The number of audio threads with non-empty devices. */
+static int non_empty_thread_count = 0;
 
 /* The timestamp of last EIO error time. */
-static struct timespec last_io_err_time = { 0, 0 };
+static __thread struct timespec last_io_err_time = { 0, 0 };
 
 /* The gap time to avoid repeated error close request to main thread. */
 static const int ERROR_CLOSE_GAP_TIME_SECS = 10;
@@ -60,6 +82,65 @@ static inline struct cras_iodev *get_main_dev(const struct dev_stream *stream)
 	return (struct cras_iodev *)stream->stream->main_dev.dev_ptr;
 }
 
+/* Checks if any stream on the device was paired by detect_rtc_stream_pair. */
+static bool dev_has_voice_stream(const struct cras_iodev *dev)
+{
+	struct dev_stream *dev_stream;
+
+	DL_FOREACH (dev->streams, dev_stream) {
+		if (dev_stream->stream->stream_type ==
+		    CRAS_STREAM_TYPE_VOICE_COMMUNICATION)
+			return true;
+	}
+	return false;
+}
+
+/*
+ * Finds the output device whose clock an input device follows. Devices on the
+ * internal card running at the same rate share one clock, the input then only
+ * takes the better settled rate estimate of the output. An input serving a
+ * voice communication stream otherwise follows the output playing the other
+ * half of the pair, so the echo canceller sees both directions on one clock.
+ * Args:
+ *    dev - The input device.
+ *    odev_list - The open output devices.
+ *    same_domain - Set to true if the master shares the clock of dev.
+ * Returns:
+ *    The master output device, or NULL if dev runs on its own clock.
+ */
+static struct cras_iodev *find_clock_master(struct cras_iodev *dev,
+					    struct open_dev *odev_list,
+					    bool *same_domain)
+{
+	struct open_dev *odev;
+
+	if (dev->direction != CRAS_STREAM_INPUT)
+		return NULL;
+
+	*same_domain = true;
+	if (cras_iodev_is_on_internal_card(dev->active_node)) {
+		DL_FOREACH (odev_list, odev) {
+			if (!cras_iodev_is_on_internal_card(
+				    odev->dev->active_node))
+				continue;
+			if (odev->dev->format->frame_rate !=
+			    dev->format->frame_rate)
+				continue;
+			return odev->dev;
+		}
+	}
+
+	if (!dev_has_voice_stream(dev))
+		return NULL;
+
+	*same_domain = false;
+	DL_FOREACH (odev_list, odev) {
+		if (dev_has_voice_stream(odev->dev))
+			return odev->dev;
+	}
+	return NULL;
+}
+
 /* Updates the estimated sample rate of open device to all attached
  * streams.
  */
@@ -69,35 +150,19 @@ static void update_estimated_rate(struct open_dev *adev,
 {
 	struct cras_iodev *main_dev;
 	struct cras_iodev *dev = adev->dev;
-	struct cras_iodev *tracked_dev = NULL;
+	struct cras_iodev *master_dev;
 	struct dev_stream *dev_stream;
+	bool same_domain = true;
 	double dev_rate_ratio;
 	double main_dev_rate_ratio;
 
-	/*
-	 * If there is an output device on the same sound card running with the same
-	 * sampling rate, use the rate of that output device for this device.
-	 */
-	if (dev->direction == CRAS_STREAM_INPUT &&
-	    cras_iodev_is_on_internal_card(dev->active_node)) {
-		struct open_dev *odev;
-		DL_FOREACH (odev_list, odev) {
-			if (!cras_iodev_is_on_internal_card(
-				    odev->dev->active_node))
-				continue;
-			if (odev->dev->format->frame_rate !=
-			    dev->format->frame_rate)
-				continue;
-			tracked_dev = odev->dev;
-			break;
-		}
-	}
+	master_dev = find_clock_master(dev, odev_list, &same_domain);
 
 	/*
-	 * Self-owned rate esimator does not need to udpate rate. There is no tracked
-	 * output device. So there is no need to update.
+	 * Self-owned rate esimator does not need to udpate rate. There is no
+	 * master output device. So there is no need to update.
 	 */
-	if (!self_rate_need_update && !tracked_dev)
+	if (!self_rate_need_update && !master_dev)
 		return;
 
 	DL_FOREACH (dev->streams, dev_stream) {
@@ -107,9 +172,20 @@ static void update_estimated_rate(struct open_dev *adev,
 			continue;
 		}
 
-		if (tracked_dev) {
+		if (master_dev && !same_domain && main_dev == dev) {
+			/* Devices following the main device of the stream
+			 * reach the master through it. */
+			dev_stream_set_master_rate(
+				dev_stream, dev->format->frame_rate,
+				cras_iodev_get_est_rate_ratio(dev),
+				cras_iodev_get_est_rate_ratio(master_dev),
+				adev->coarse_rate_adjust);
+			continue;
+		}
+
+		if (master_dev && same_domain) {
 			dev_rate_ratio =
-				cras_iodev_get_est_rate_ratio(tracked_dev);
+				cras_iodev_get_est_rate_ratio(master_dev);
 			main_dev_rate_ratio = dev_rate_ratio;
 		} else {
 			dev_rate_ratio = cras_iodev_get_est_rate_ratio(dev);
@@ -141,33 +217,106 @@ static inline int count_non_empty_dev(struct open_dev *adevs)
 int dev_io_check_non_empty_state_transition(struct open_dev *adevs)
 {
 	int new_non_empty_dev_count = count_non_empty_dev(adevs);
-
-	// If we have transitioned to or from a state with 0 non-empty devices,
-	// notify the main thread to update system state.
-	if ((non_empty_device_count == 0) != (new_non_empty_dev_count == 0))
-		cras_non_empty_audio_send_msg(new_non_empty_dev_count > 0 ? 1 :
-									    0);
+	int threads;
+
+	// If we have transitioned to or from a state with 0 non-empty devices
+	// in all audio threads, notify the main thread to update system state.
+	if ((non_empty_device_count == 0) != (new_non_empty_dev_count == 0)) {
+		if (new_non_empty_dev_count)
+			threads = __atomic_add_fetch(&non_empty_thread_count,
+						     1, __ATOMIC_RELAXED);
+		else
+			threads = __atomic_sub_fetch(&non_empty_thread_count,
+						     1, __ATOMIC_RELAXED);
+		if (threads == !!new_non_empty_dev_count)
+			cras_non_empty_audio_send_msg(
+				new_non_empty_dev_count > 0 ? 1 : 0);
+	}
 
 	non_empty_device_count = new_non_empty_dev_count;
 	return non_empty_device_count > 0;
 }
 
-/* Checks whether it is time to fetch. */
-static bool is_time_to_fetch(const struct dev_stream *dev_stream,
-			     struct timespec now)
+/* Gets how early a stream may be fetched, see FETCH_SLACK_PERIOD_DIV. */
+static void get_fetch_slack(const struct dev_stream *dev_stream,
+			    struct timespec *slack)
+{
+	const struct timespec *period = &dev_stream->stream->sleep_interval_ts;
+	uint64_t slack_ns;
+
+	slack_ns = ((uint64_t)period->tv_sec * 1000000000ULL +
+		    period->tv_nsec) /
+		   (dev_stream->shed ? SHED_FETCH_SLACK_PERIOD_DIV :
+				       FETCH_SLACK_PERIOD_DIV);
+	slack->tv_sec = slack_ns / 1000000000ULL;
+	slack->tv_nsec = slack_ns % 1000000000ULL;
+
+	if (!dev_stream->shed && timespec_after(slack, &max_fetch_slack_ts))
+		*slack = max_fetch_slack_ts;
+	else if (timespec_after(&playback_wake_fuzz_ts, slack))
+		*slack = playback_wake_fuzz_ts;
+}
+
+/* Gets the time a playback stream is due to be fetched: its callback time,
+ * moved earlier by the stream's fetch lead when its client replies late and
+ * there is room in shm for the early fetch. Returns NULL if the stream has
+ * no callback time. */
+static const struct timespec *get_fetch_ts(const struct dev_stream *dev_stream,
+					   struct timespec *fetch_ts)
 {
-	const struct timespec *next_cb_ts;
+	const struct cras_rstream *rstream = dev_stream->stream;
+	const struct timespec *next_cb_ts, *lead;
+
 	next_cb_ts = dev_stream_next_cb_ts(dev_stream);
 	if (!next_cb_ts)
+		return NULL;
+
+	lead = cras_rstream_fetch_lead(rstream);
+	if (!timespec_is_nonzero(lead) ||
+	    !cras_shm_is_buffer_available(rstream->shm) ||
+	    !timespec_after(next_cb_ts, lead))
+		return next_cb_ts;
+
+	subtract_timespecs(next_cb_ts, lead, fetch_ts);
+	return fetch_ts;
+}
+
+/* Checks whether it is time to fetch. Sets ahead when the fetch is only due
+ * because this wake falls in the stream's slack. */
+static bool is_time_to_fetch(const struct dev_stream *dev_stream,
+			     struct timespec now, bool *ahead)
+{
+	const struct timespec *due_ts;
+	struct timespec slack, fuzz_ts, fetch_ts;
+
+	*ahead = false;
+	due_ts = get_fetch_ts(dev_stream, &fetch_ts);
+	if (!due_ts)
 		return 0;
 
+	/* A running ring is topped up a callback at a time whenever a buffer
+	 * fits, so the client runs ahead of the schedule. */
+	if (dev_stream_is_running(dev_stream) &&
+	    cras_shm_is_ring(dev_stream->stream->shm) &&
+	    cras_shm_is_buffer_available(dev_stream->stream->shm))
+		return 1;
+
 	/*
 	 * Check if it's time to get more data from this stream.
 	 * Allow for waking up a little early.
 	 */
-	add_timespecs(&now, &playback_wake_fuzz_ts);
-	if (timespec_after(&now, next_cb_ts))
+	fuzz_ts = now;
+	add_timespecs(&fuzz_ts, &playback_wake_fuzz_ts);
+	if (timespec_after(&fuzz_ts, due_ts))
+		return 1;
+
+	/* Coalesce it with the wake already due for another stream. */
+	get_fetch_slack(dev_stream, &slack);
+	add_timespecs(&now, &slack);
+	if (timespec_after(&now, due_ts)) {
+		*ahead = true;
 		return 1;
+	}
 
 	return 0;
 }
@@ -185,6 +334,48 @@ static uint32_t get_ewma_power_as_int(struct ewma_power *ewma)
 	return pow_as_int;
 }
 
+/* Records the time since start in a stage histogram. */
+static inline void stage_done(struct cras_latency_hist *hist,
+			      const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_latency_hist_add(hist, start, &now);
+}
+
+/* Records the time since start in a stage histogram of dev_stream, and
+ * charges it to the stream. */
+static inline void stream_stage_done(struct dev_stream *dev_stream,
+				     unsigned int stage,
+				     const struct timespec *start)
+{
+	struct timespec now, elapsed;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	cras_latency_hist_add(&dev_stream->stage_hist[stage], start, &now);
+	subtract_timespecs(&now, start, &elapsed);
+	dev_stream->stream->cpu_ns +=
+		(uint64_t)elapsed.tv_sec * 1000000000ULL + elapsed.tv_nsec;
+}
+
+/* Fills delay with the delays of dev, its buffer and its DSP, leaving the
+ * ones of the streams 0.
+ * Returns 0 on success, negative error on failure. */
+static int get_dev_delay(const struct cras_iodev *dev,
+			 struct dev_stream_delay *delay)
+{
+	int rc;
+
+	rc = dev->delay_frames(dev);
+	if (rc < 0)
+		return rc;
+	memset(delay, 0, sizeof(*delay));
+	delay->device = rc;
+	delay->dsp = cras_iodev_get_dsp_delay(dev);
+	return 0;
+}
+
 /* Asks any stream with room for more data. Sets the time stamp for all streams.
  * Args:
  *    adev - The output device streams are attached to.
@@ -196,17 +387,18 @@ static int fetch_streams(struct open_dev *adev)
 {
 	struct dev_stream *dev_stream;
 	struct cras_iodev *odev = adev->dev;
+	struct dev_stream_delay delay;
 	int rc;
-	int delay;
 
-	delay = cras_iodev_delay_frames(odev);
-	if (delay < 0)
-		return delay;
+	rc = get_dev_delay(odev, &delay);
+	if (rc < 0)
+		return rc;
 
 	DL_FOREACH (adev->dev->streams, dev_stream) {
 		struct cras_rstream *rstream = dev_stream->stream;
 		struct cras_audio_shm *shm = cras_rstream_shm(rstream);
 		struct timespec now;
+		bool ahead;
 
 		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
@@ -215,11 +407,12 @@ static int fetch_streams(struct open_dev *adev)
 			cras_rstream_record_fetch_interval(dev_stream->stream,
 							   &now);
 		}
+		cras_rstream_record_reply(rstream, &now);
 
 		if (!dev_stream_is_running(dev_stream))
 			continue;
 
-		if (!is_time_to_fetch(dev_stream, now))
+		if (!is_time_to_fetch(dev_stream, now, &ahead))
 			continue;
 
 		if (cras_shm_get_frames(shm) < 0)
@@ -239,8 +432,17 @@ static int fetch_streams(struct open_dev *adev)
 
 		/*
 		 * Skip fetching if there are enough frames in shared memory.
+		 * Ahead of its callback time that isn't a missed callback yet,
+		 * the stream waits for its own deadline instead.
 		 */
 		if (!cras_shm_is_buffer_available(shm)) {
+			if (ahead)
+				continue;
+			/* A full ring is a client ahead, not a late one. */
+			if (cras_shm_is_ring(shm)) {
+				dev_stream_update_next_wake_time(dev_stream);
+				continue;
+			}
 			ATLOG(atlog, AUDIO_THREAD_STREAM_SKIP_CB,
 			      cras_rstream_id(rstream),
 			      shm->header->write_offset[0],
@@ -250,59 +452,71 @@ static int fetch_streams(struct open_dev *adev)
 			continue;
 		}
 
-		dev_stream_set_delay(dev_stream, delay);
+		dev_stream_set_delay(dev_stream, &delay, NULL);
 
 		ATLOG(atlog, AUDIO_THREAD_FETCH_STREAM, rstream->stream_id,
 		      cras_rstream_get_cb_threshold(rstream),
 		      get_ewma_power_as_int(&rstream->ewma));
 
 		rc = dev_stream_request_playback_samples(dev_stream, &now);
+		rstream->num_fetches++;
 		if (rc < 0) {
 			syslog(LOG_ERR, "fetch err: %d for %x", rc,
 			       cras_rstream_id(rstream));
 			cras_rstream_set_is_draining(rstream, 1);
+		} else if (ahead) {
+			adev->num_coalesced_fetches++;
 		}
+		stream_stage_done(dev_stream, DEV_IO_STAGE_FETCH, &now);
 	}
 
 	return 0;
 }
 
-/* Gets the max delay frames of open input devices. */
-static int input_delay_frames(struct open_dev *adevs)
+/* Gets the delays of the open input device with the longest one.
+ * Returns 0 on success, negative error on failure. */
+static int input_delay(struct open_dev *adevs, struct dev_stream_delay *delay)
 {
 	struct open_dev *adev;
-	int delay;
-	int max_delay = 0;
+	struct dev_stream_delay dev_delay;
+	int rc;
 
+	memset(delay, 0, sizeof(*delay));
 	DL_FOREACH (adevs, adev) {
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
-		delay = cras_iodev_delay_frames(adev->dev);
-		if (delay < 0)
-			return delay;
-		if (delay > max_delay)
-			max_delay = delay;
+		rc = get_dev_delay(adev->dev, &dev_delay);
+		if (rc < 0)
+			return rc;
+		if (dev_delay.device + dev_delay.dsp >
+		    delay->device + delay->dsp)
+			*delay = dev_delay;
 	}
-	return max_delay;
+	return 0;
 }
 
 /* Sets the stream delay.
  * Args:
  *    adev[in] - The device to capture from.
+ *    level_ts[in] - When the level of the device was read.
  */
-static unsigned int set_stream_delay(struct open_dev *adev)
+static unsigned int set_stream_delay(struct open_dev *adev,
+				     const struct timespec *level_ts)
 {
 	struct dev_stream *stream;
-	int delay;
+	struct dev_stream_delay delay;
 
 	/* TODO(dgreid) - Setting delay from last dev only. */
-	delay = input_delay_frames(adev);
+	if (input_delay(adev, &delay) < 0)
+		memset(&delay, 0, sizeof(delay));
 
 	DL_FOREACH (adev->dev->streams, stream) {
 		if (stream->stream->flags & TRIGGER_ONLY)
 			continue;
 
-		dev_stream_set_delay(stream, delay);
+		delay.processing = input_data_get_processing_delay(
+			adev->dev->input_data, stream->stream);
+		dev_stream_set_delay(stream, &delay, level_ts);
 	}
 
 	return 0;
@@ -396,6 +610,14 @@ static int get_input_dev_max_wake_ts(struct open_dev *adev,
 	return 0;
 }
 
+/*
+ * Wakes asked for by the streams of an input device which are this close
+ * after the earliest one are done together with it.
+ */
+static const struct timespec wake_coalesce_ts = {
+	0, 300 * 1000 /* 300 us. */
+};
+
 /* Returns whether a device can drop samples. */
 static bool input_devices_can_drop_samples(struct cras_iodev *iodev)
 {
@@ -426,7 +648,9 @@ static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop)
 {
 	int rc;
 	struct timespec level_tstamp, wake_time_out, min_ts, now, dev_wake_ts;
+	struct timespec latest_ts, coalesced_ts;
 	unsigned int curr_level, cap_limit;
+	double dev_rate_ratio;
 	struct dev_stream *stream;
 	struct dev_stream *cap_limit_stream;
 
@@ -459,15 +683,19 @@ static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop)
 		*need_to_drop = true;
 
 	cap_limit = get_stream_limit(adev, UINT_MAX, &cap_limit_stream);
+	dev_rate_ratio = cras_iodev_get_est_rate_ratio(adev->dev);
 
 	/*
 	 * Loop through streams to find the earliest time audio thread
 	 * should wake up.
 	 */
 	DL_FOREACH (adev->dev->streams, stream) {
+		stream->wake_ts.tv_sec = 0;
+		stream->wake_ts.tv_nsec = 0;
 		wake_time_out = min_ts;
 		rc = dev_stream_wake_time(stream, curr_level, &level_tstamp,
-					  cap_limit, cap_limit_stream == stream,
+					  dev_rate_ratio, cap_limit,
+					  cap_limit_stream == stream,
 					  &wake_time_out);
 
 		/*
@@ -480,11 +708,30 @@ static int set_input_dev_wake_ts(struct open_dev *adev, bool *need_to_drop)
 		if (rc < 0)
 			return rc;
 
+		stream->wake_ts = wake_time_out;
 		if (timespec_after(&min_ts, &wake_time_out)) {
 			min_ts = wake_time_out;
 		}
 	}
 
+	/*
+	 * Streams wanting to wake shortly after the earliest one are served
+	 * in the same wake instead of one of their own, by waking at the
+	 * latest of them.
+	 */
+	latest_ts = min_ts;
+	add_timespecs(&latest_ts, &wake_coalesce_ts);
+	coalesced_ts = min_ts;
+	DL_FOREACH (adev->dev->streams, stream) {
+		if (!timespec_is_nonzero(&stream->wake_ts))
+			continue;
+		if (timespec_after(&stream->wake_ts, &latest_ts))
+			continue;
+		if (timespec_after(&stream->wake_ts, &coalesced_ts))
+			coalesced_ts = stream->wake_ts;
+	}
+	min_ts = coalesced_ts;
+
 	/* If there's no room in streams, don't bother schedule wake for more
 	 * input data. */
 	if (adev->dev->active_node &&
@@ -552,13 +799,13 @@ static int capture_to_streams(struct open_dev *adev, struct open_dev *odev_list)
 		 * Always calls update_estimated_rate so that new output rate
 		 * has a chance to propagate to input. In update_estimated_rate,
 		 * it will decide whether the new rate is from self rate estimator
-		 * or from the tracked output device.
+		 * or from the master output device.
 		 */
 		update_estimated_rate(adev, odev_list, self_rate_need_update);
 	}
 
 	cap_limit = get_stream_limit(adev, hw_level, &cap_limit_stream);
-	set_stream_delay(adev);
+	set_stream_delay(adev, &hw_tstamp);
 
 	remainder = MIN(hw_level, cap_limit);
 
@@ -568,9 +815,21 @@ static int capture_to_streams(struct open_dev *adev, struct open_dev *odev_list)
 	if (cras_iodev_state(idev) != CRAS_IODEV_STATE_NORMAL_RUN)
 		return 0;
 
+	/* A device kept warm without streams only has to keep its buffer
+	 * from overrunning, nothing reads the samples so they skip the DSP. */
+	if (!idev->streams) {
+		struct timespec drop_ts;
+
+		cras_frames_to_time(remainder, idev->format->frame_rate,
+				    &drop_ts);
+		rc = cras_iodev_drop_frames_by_time(idev, drop_ts);
+		return rc < 0 ? rc : 0;
+	}
+
 	while (remainder > 0) {
 		struct cras_audio_area *area = NULL;
 		unsigned int nread, total_read;
+		struct timespec start;
 
 		nread = remainder;
 
@@ -605,9 +864,17 @@ static int capture_to_streams(struct open_dev *adev, struct open_dev *odev_list)
 					idev->software_gain_scaler,
 					stream->stream);
 
-			this_read =
-				dev_stream_capture(stream, area, area_offset,
-						   software_gain_scaler);
+			clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+			if (input_data_silence_gated(idev->input_data,
+						     stream->stream))
+				this_read = dev_stream_capture_silence(
+					stream, area->frames - area_offset,
+					software_gain_scaler);
+			else
+				this_read = dev_stream_capture(
+					stream, area, area_offset,
+					software_gain_scaler);
+			stream_stage_done(stream, DEV_IO_STAGE_CAPTURE, &start);
 
 			input_data_put_for_stream(idev->input_data,
 						  stream->stream,
@@ -631,6 +898,67 @@ static int capture_to_streams(struct open_dev *adev, struct open_dev *odev_list)
 	return 0;
 }
 
+/* Mixes curr together with the streams of its mix group that are ready at
+ * the same offset of the device, summing them before the conversion.
+ * Returns the frames written for curr, 0 if it has to be mixed alone. */
+static int write_submix(struct cras_iodev *odev, struct dev_stream *curr,
+			uint8_t *dst, unsigned int offset,
+			unsigned int write_limit)
+{
+	struct dev_stream *const *group;
+	unsigned int num_streams, num_ready = 0, i;
+	int rc;
+
+	group = dev_stream_mix_group(curr, &num_streams);
+	if (num_streams < 2 || !dev_stream_can_submix(curr) ||
+	    cras_rstream_get_is_draining(curr->stream))
+		return 0;
+
+	struct dev_stream *ready[num_streams];
+
+	ready[num_ready++] = curr;
+	for (i = 0; i < num_streams; i++) {
+		if (group[i] == curr || !dev_stream_is_running(group[i]) ||
+		    cras_rstream_get_is_draining(group[i]->stream) ||
+		    cras_iodev_stream_offset(odev, group[i]) != offset ||
+		    !dev_stream_can_submix(group[i]))
+			continue;
+		ready[num_ready++] = group[i];
+	}
+	if (num_ready < 2)
+		return 0;
+
+	if (!odev->mix_bus)
+		dst += cras_get_format_bytes(odev->format) * offset;
+	rc = dev_stream_mix_submix(ready, num_ready, odev->format, dst,
+				   odev->mix_bus, offset, write_limit - offset,
+				   1);
+	curr->submix_frames = 0;
+	return rc;
+}
+
+/* Writes curr to dst, or to the mix bus of odev, from its offset on. Returns
+ * the frames written. */
+static int write_stream(struct cras_iodev *odev, struct dev_stream *curr,
+			uint8_t *dst, unsigned int offset,
+			unsigned int write_limit, int copy_only)
+{
+	const unsigned int frame_bytes = cras_get_format_bytes(odev->format);
+	int nwritten;
+
+	nwritten = write_submix(odev, curr, dst, offset, write_limit);
+	if (nwritten)
+		return nwritten;
+	if (odev->mix_bus)
+		return dev_stream_mix_bus(curr, odev->format, odev->mix_bus,
+					  offset, write_limit - offset,
+					  !copy_only);
+	if (copy_only)
+		return dev_stream_copy(curr, odev->format, dst, write_limit);
+	return dev_stream_mix(curr, odev->format, dst + frame_bytes * offset,
+			      write_limit - offset);
+}
+
 /* Fill the buffer with samples from the attached streams.
  * Args:
  *    odevs - The list of open output devices, provided so streams can be
@@ -649,11 +977,14 @@ static unsigned int write_streams(struct open_dev **odevs,
 				  size_t write_limit)
 {
 	struct cras_iodev *odev = adev->dev;
+	struct mix_bus *bus = odev->passthrough ? NULL : odev->mix_bus;
 	struct dev_stream *curr;
 	unsigned int max_offset = 0;
 	unsigned int frame_bytes = cras_get_format_bytes(odev->format);
 	unsigned int num_playing = 0;
+	unsigned int num_running = 0;
 	unsigned int drain_limit = write_limit;
+	int copy_only;
 
 	/* Mix as much as we can, the minimum fill level of any stream. */
 	max_offset = cras_iodev_max_stream_offset(odev);
@@ -679,10 +1010,14 @@ static unsigned int write_streams(struct open_dev **odevs,
 		ATLOG(atlog, AUDIO_THREAD_WRITE_STREAMS_STREAM,
 		      curr->stream->stream_id, dev_frames,
 		      dev_stream_is_pending_reply(curr));
+		num_running++;
 		if (cras_rstream_get_is_draining(curr->stream)) {
 			drain_limit = MIN((size_t)dev_frames, drain_limit);
-			if (!dev_frames)
+			if (!dev_frames) {
+				cras_stream_drain_send_msg(
+					curr->stream->stream_id);
 				dev_io_remove_stream(odevs, curr->stream, NULL);
+			}
 		} else {
 			write_limit = MIN((size_t)dev_frames, write_limit);
 			num_playing++;
@@ -692,7 +1027,15 @@ static unsigned int write_streams(struct open_dev **odevs,
 	if (!num_playing)
 		write_limit = drain_limit;
 
-	if (write_limit > max_offset)
+	/* A lone stream with nothing mixed yet can be copied straight into
+	 * dst, there is nothing to add it to. Otherwise clear the part no
+	 * stream has written so the streams can be summed into it. With a
+	 * mix bus the same is done in the bus and dst is left for
+	 * cras_iodev_put_output_bus(). */
+	copy_only = num_running == 1 && max_offset == 0;
+	if (!copy_only && bus)
+		mix_bus_clear(bus, max_offset, write_limit);
+	else if (!copy_only && write_limit > max_offset)
 		memset(dst + max_offset * frame_bytes, 0,
 		       (write_limit - max_offset) * frame_bytes);
 
@@ -702,6 +1045,7 @@ static unsigned int write_streams(struct open_dev **odevs,
 	DL_FOREACH (adev->dev->streams, curr) {
 		unsigned int offset;
 		int nwritten;
+		struct timespec start;
 
 		if (!dev_stream_is_running(curr))
 			continue;
@@ -709,9 +1053,33 @@ static unsigned int write_streams(struct open_dev **odevs,
 		offset = cras_iodev_stream_offset(odev, curr);
 		if (offset >= write_limit)
 			continue;
-		nwritten = dev_stream_mix(curr, odev->format,
-					  dst + frame_bytes * offset,
-					  write_limit - offset);
+
+		/* Already mixed with an earlier stream of its group. */
+		if (curr->submix_frames) {
+			cras_iodev_stream_written(odev, curr,
+						  curr->submix_frames);
+			curr->submix_frames = 0;
+			continue;
+		}
+
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		if (curr == odev->passthrough)
+			nwritten = dev_stream_passthrough(
+				curr, dst + frame_bytes * offset,
+				write_limit - offset);
+		else if (odev->passthrough && copy_only)
+			/* Held streams move along without mixing anything
+			 * into the bitstream. */
+			nwritten = dev_stream_copy(curr, odev->format, dst,
+						   write_limit);
+		else if (odev->passthrough)
+			nwritten = dev_stream_mix(curr, odev->format,
+						  dst + frame_bytes * offset,
+						  write_limit - offset);
+		else
+			nwritten = write_stream(odev, curr, dst, offset,
+						write_limit, copy_only);
+		stream_stage_done(curr, DEV_IO_STAGE_WRITE, &start);
 
 		if (nwritten < 0) {
 			dev_io_remove_stream(odevs, curr->stream, NULL);
@@ -851,8 +1219,19 @@ int write_output_samples(struct open_dev **odevs, struct open_dev *adev,
 			pic_interval_reset(adev->non_empty_check_pi);
 		}
 
-		rc = cras_iodev_put_output_buffer(
-			odev, dst, written, non_empty_ptr, output_converter);
+		if (odev->mix_bus && !odev->passthrough) {
+			rc = cras_iodev_put_output_bus(odev, dst, written,
+						       non_empty_ptr,
+						       output_converter);
+			/* Keep what streams mixed past the written frames
+			 * at the start of the bus for the next write. */
+			mix_bus_consume(odev->mix_bus, written,
+					cras_iodev_max_stream_offset(odev));
+		} else {
+			rc = cras_iodev_put_output_buffer(odev, dst, written,
+							  non_empty_ptr,
+							  output_converter);
+		}
 
 		if (rc < 0)
 			return rc;
@@ -969,17 +1348,25 @@ int dev_io_send_captured_samples(struct open_dev *idev_list)
 	// TODO(dgreid) - once per rstream, not once per dev_stream.
 	DL_FOREACH (idev_list, adev) {
 		struct dev_stream *stream;
+		struct timespec dev_start, start;
 
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
 
+		clock_gettime(CLOCK_MONOTONIC_RAW, &dev_start);
+		CRAS_TRACE1(send_captured_samples_begin, adev->dev->info.idx);
+
 		/* Post samples to rstream if there are enough samples. */
 		DL_FOREACH (adev->dev->streams, stream) {
+			clock_gettime(CLOCK_MONOTONIC_RAW, &start);
 			dev_stream_capture_update_rstream(stream);
+			stream_stage_done(stream, DEV_IO_STAGE_SEND, &start);
 		}
 
 		/* Set wake_ts for this device. */
 		rc = set_input_dev_wake_ts(adev, &need_to_drop);
+		CRAS_TRACE1(send_captured_samples_end, rc);
+		stage_done(&adev->stage_hist[DEV_IO_STAGE_SEND], &dev_start);
 		if (rc < 0)
 			return rc;
 	}
@@ -1030,9 +1417,15 @@ int dev_io_capture(struct open_dev **list, struct open_dev **olist)
 	int rc;
 
 	DL_FOREACH (idev_list, adev) {
+		struct timespec start;
+
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		CRAS_TRACE1(capture_to_streams_begin, adev->dev->info.idx);
 		rc = capture_to_streams(adev, odev_list);
+		CRAS_TRACE1(capture_to_streams_end, rc);
+		stage_done(&adev->stage_hist[DEV_IO_STAGE_CAPTURE], &start);
 		if (rc < 0)
 			handle_dev_err(rc, list, adev);
 	}
@@ -1045,10 +1438,11 @@ static void dev_io_check_dev_stream_start(struct open_dev *adev)
 {
 	struct dev_stream *dev_stream;
 	struct timespec now;
+	bool ahead;
 	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
 
 	DL_FOREACH (adev->dev->streams, dev_stream) {
-		if (!is_time_to_fetch(dev_stream, now))
+		if (!is_time_to_fetch(dev_stream, now, &ahead))
 			continue;
 		if (!dev_stream_is_running(dev_stream))
 			cras_iodev_start_stream(adev->dev, dev_stream);
@@ -1058,6 +1452,7 @@ static void dev_io_check_dev_stream_start(struct open_dev *adev)
 void dev_io_playback_fetch(struct open_dev *odev_list)
 {
 	struct open_dev *adev;
+	int rc;
 
 	/* Check whether it is the time to start dev_stream before fetching. */
 	DL_FOREACH (odev_list, adev) {
@@ -1067,9 +1462,15 @@ void dev_io_playback_fetch(struct open_dev *odev_list)
 	}
 
 	DL_FOREACH (odev_list, adev) {
+		struct timespec start;
+
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
-		fetch_streams(adev);
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		CRAS_TRACE1(fetch_streams_begin, adev->dev->info.idx);
+		rc = fetch_streams(adev);
+		CRAS_TRACE1(fetch_streams_end, rc);
+		stage_done(&adev->stage_hist[DEV_IO_STAGE_FETCH], &start);
 	}
 }
 
@@ -1092,10 +1493,16 @@ int dev_io_playback_write(struct open_dev **odevs,
 	}
 
 	DL_FOREACH (*odevs, adev) {
+		struct timespec start;
+
 		if (!cras_iodev_is_open(adev->dev))
 			continue;
 
+		clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+		CRAS_TRACE1(write_output_samples_begin, adev->dev->info.idx);
 		rc = write_output_samples(odevs, adev, output_converter);
+		CRAS_TRACE1(write_output_samples_end, rc);
+		stage_done(&adev->stage_hist[DEV_IO_STAGE_WRITE], &start);
 		if (rc < 0) {
 			handle_dev_err(rc, odevs, adev);
 		} else {
@@ -1182,10 +1589,12 @@ void dev_io_run(struct open_dev **odevs, struct open_dev **idevs,
 	update_longest_wake(*odevs, &now);
 	update_longest_wake(*idevs, &now);
 
+	CRAS_TRACE(dev_io_run_begin);
 	dev_io_playback_fetch(*odevs);
 	dev_io_capture(idevs, odevs);
 	dev_io_send_captured_samples(*idevs);
 	dev_io_playback_write(odevs, output_converter);
+	CRAS_TRACE(dev_io_run_end);
 }
 
 static int input_adev_ignore_wake(const struct open_dev *adev)
@@ -1222,6 +1631,22 @@ int dev_io_next_input_wake(struct open_dev **idevs, struct timespec *min_ts)
 }
 
 /* Fills the time that the next stream needs to be serviced. */
+/* Returns the time the audio thread should wake to fetch the stream, NULL if
+ * the stream doesn't need a wake. */
+static const struct timespec *
+get_stream_wake_ts(const struct dev_stream *dev_stream,
+		   struct timespec *fetch_ts)
+{
+	if (cras_rstream_get_is_draining(dev_stream->stream))
+		return NULL;
+
+	if (cras_rstream_is_pending_reply(dev_stream->stream) &&
+	    !cras_rstream_wake_for_reply(dev_stream->stream))
+		return NULL;
+
+	return get_fetch_ts(dev_stream, fetch_ts);
+}
+
 static int get_next_stream_wake_from_list(struct dev_stream *streams,
 					  struct timespec *min_ts)
 {
@@ -1230,14 +1655,9 @@ static int get_next_stream_wake_from_list(struct dev_stream *streams,
 
 	DL_FOREACH (streams, dev_stream) {
 		const struct timespec *next_cb_ts;
+		struct timespec fetch_ts;
 
-		if (cras_rstream_get_is_draining(dev_stream->stream))
-			continue;
-
-		if (cras_rstream_is_pending_reply(dev_stream->stream))
-			continue;
-
-		next_cb_ts = dev_stream_next_cb_ts(dev_stream);
+		next_cb_ts = get_stream_wake_ts(dev_stream, &fetch_ts);
 		if (!next_cb_ts)
 			continue;
 
@@ -1273,6 +1693,48 @@ int dev_io_next_output_wake(struct open_dev **odevs, struct timespec *min_ts)
 	return ret;
 }
 
+int dev_io_mitigate_busyloop(struct open_dev **odevs, struct open_dev **idevs,
+			     const struct timespec *now)
+{
+	struct open_dev *adev;
+	struct dev_stream *dev_stream;
+	const struct timespec *wake_ts;
+	struct timespec fetch_ts;
+	int found = 0;
+
+	DL_FOREACH (*odevs, adev) {
+		DL_FOREACH (adev->dev->streams, dev_stream) {
+			wake_ts = get_stream_wake_ts(dev_stream, &fetch_ts);
+			if (!wake_ts || timespec_after(wake_ts, now))
+				continue;
+			syslog(LOG_WARNING, "Busyloop on stream %x of device %u",
+			       dev_stream->stream->stream_id,
+			       adev->dev->info.idx);
+			found++;
+		}
+
+		if (!cras_iodev_odev_should_wake(adev->dev) ||
+		    timespec_after(&adev->wake_ts, now))
+			continue;
+		syslog(LOG_WARNING, "Busyloop on output device %u, resetting it",
+		       adev->dev->info.idx);
+		cras_iodev_reset_request(adev->dev);
+		found++;
+	}
+
+	DL_FOREACH (*idevs, adev) {
+		if (input_adev_ignore_wake(adev) ||
+		    timespec_after(&adev->wake_ts, now))
+			continue;
+		syslog(LOG_WARNING, "Busyloop on input device %u, resetting it",
+		       adev->dev->info.idx);
+		cras_iodev_reset_request(adev->dev);
+		found++;
+	}
+
+	return found;
+}
+
 struct open_dev *dev_io_find_open_dev(struct open_dev *odev_list,
 				      unsigned int dev_idx)
 {
@@ -1382,9 +1844,34 @@ find_matched_input_stream_next_cb_ts(const struct cras_rstream *stream,
 	return false;
 }
 
+/* Pads an output device that hasn't started, like thread_add_open_dev() does
+ * for the others, as its first stream attaches. The samples a FAST_START
+ * stream holds already count as padding, they are played first. */
+static void pad_unstarted_odev(struct cras_iodev *dev,
+			       struct cras_rstream *stream)
+{
+	struct timespec ts;
+	int level, frames;
+
+	level = cras_iodev_get_valid_frames(dev, &ts);
+	if (level < 0)
+		return;
+	if (stream->flags & FAST_START) {
+		frames = cras_shm_get_frames(cras_rstream_shm(stream));
+		if (frames > 0)
+			level += cras_frames_at_rate(stream->format.frame_rate,
+						     frames,
+						     dev->format->frame_rate);
+	}
+	if (level < (int)dev->min_buffer_level)
+		cras_iodev_fill_odev_zeros(dev, dev->min_buffer_level - level);
+}
+
 int dev_io_append_stream(struct open_dev **odevs, struct open_dev **idevs,
 			 struct cras_rstream *stream,
-			 struct cras_iodev **iodevs, unsigned int num_iodevs)
+			 struct cras_iodev **iodevs, unsigned int num_iodevs,
+			 struct dev_stream **prepared,
+			 unsigned int num_prepared)
 {
 	struct open_dev **dev_list;
 	struct open_dev *open_dev;
@@ -1455,6 +1942,11 @@ int dev_io_append_stream(struct open_dev **odevs, struct open_dev **idevs,
 			const struct timespec *in_stream_ts;
 			const struct timespec *in_stream_sleep_interval_ts;
 			bool found_matched_input;
+
+			if (!dev->streams &&
+			    cras_iodev_state(dev) == CRAS_IODEV_STATE_OPEN)
+				pad_unstarted_odev(dev, stream);
+
 			found_matched_input =
 				find_matched_input_stream_next_cb_ts(
 					stream, *idevs, &in_stream_ts,
@@ -1463,6 +1955,10 @@ int dev_io_append_stream(struct open_dev **odevs, struct open_dev **idevs,
 				init_cb_ts = *in_stream_ts;
 				init_sleep_interval_ts =
 					in_stream_sleep_interval_ts;
+			} else if (stream->flags & FAST_START) {
+				/* Ask for samples right away. */
+				clock_gettime(CLOCK_MONOTONIC_RAW,
+					      &init_cb_ts);
 			} else {
 				DL_FOREACH (dev->streams, out) {
 					stream_ts = dev_stream_next_cb_ts(out);
@@ -1514,8 +2010,18 @@ int dev_io_append_stream(struct open_dev **odevs, struct open_dev **idevs,
 			init_cb_ts.tv_nsec = 0;
 		}
 
-		out = dev_stream_create(stream, dev->info.idx, dev->format, dev,
-					&init_cb_ts, init_sleep_interval_ts);
+		out = NULL;
+		if (i < num_prepared && prepared[i] &&
+		    dev_stream_attach(prepared[i], dev->info.idx, dev->format,
+				      dev, &init_cb_ts,
+				      init_sleep_interval_ts) == 0) {
+			out = prepared[i];
+			prepared[i] = NULL;
+		}
+		if (!out)
+			out = dev_stream_create(stream, dev->info.idx,
+						dev->format, dev, &init_cb_ts,
+						init_sleep_interval_ts);
 		if (!out) {
 			rc = -EINVAL;
 			break;
@@ -1581,3 +2087,9 @@ int dev_io_remove_stream(struct open_dev **dev_list,
 
 	return 0;
 }
+
+void dev_io_set_playback_wake_fuzz_us(unsigned int us)
+{
+	playback_wake_fuzz_ts.tv_sec = us / 1000000;
+	playback_wake_fuzz_ts.tv_nsec = (us % 1000000) * 1000;
+}
@@ -13,6 +13,15 @@
 #include "cras_types.h"
 #include "polled_interval_checker.h"
 
+/* Index of each timed stage in the stage_hist arrays. Output devices use
+ * FETCH and WRITE, input devices CAPTURE and SEND. */
+enum DEV_IO_STAGE {
+	DEV_IO_STAGE_FETCH = 0,
+	DEV_IO_STAGE_WRITE = 1,
+	DEV_IO_STAGE_CAPTURE = 0,
+	DEV_IO_STAGE_SEND = 1,
+};
+
 /*
  * Open input/output devices.
  *    dev - The device.
@@ -24,6 +33,9 @@
  *    last_non_empty_ts - The last time we know the device played/captured
  *        non-empty (zero) audio.
  *    coarse_rate_adjust - Hack for when the sample rate needs heavy correction.
+ *    stage_hist - Time spent on this device in each DEV_IO_STAGE of a wake.
+ *    num_coalesced_fetches - Stream fetches done ahead of their callback time
+ *        in a wake due anyway, each one a wake saved.
  */
 struct open_dev {
 	struct cras_iodev *dev;
@@ -33,6 +45,8 @@ struct open_dev {
 	struct polled_interval *non_empty_check_pi;
 	struct polled_interval *empty_pi;
 	int coarse_rate_adjust;
+	struct cras_latency_hist stage_hist[CRAS_NUM_DEV_IO_STAGES];
+	unsigned int num_coalesced_fetches;
 	struct open_dev *prev, *next;
 };
 
@@ -89,6 +103,14 @@ int dev_io_next_input_wake(struct open_dev **idevs, struct timespec *min_ts);
  */
 int dev_io_next_output_wake(struct open_dev **odevs, struct timespec *min_ts);
 
+/*
+ * Logs the devices and streams due to be serviced at or before now, which
+ * keep the audio thread from sleeping, and requests a reset of such devices.
+ * Returns the number of devices and streams found.
+ */
+int dev_io_mitigate_busyloop(struct open_dev **odevs, struct open_dev **idevs,
+			     const struct timespec *now);
+
 /*
  * Removes a device from a list of devices.
  *    odev_list - A pointer to the list to modify.
@@ -101,13 +123,24 @@ void dev_io_rm_open_dev(struct open_dev **odev_list,
 struct open_dev *dev_io_find_open_dev(struct open_dev *odev_list,
 				      unsigned int dev_idx);
 
-/* Append a new stream to a specified set of iodevs. */
+/*
+ * Append a new stream to a specified set of iodevs. prepared holds a
+ * dev_stream from dev_stream_prepare, or NULL, for each of the first
+ * num_prepared iodevs. Those attached are set to NULL, the caller discards
+ * the rest.
+ */
 int dev_io_append_stream(struct open_dev **odevs, struct open_dev **idevs,
 			 struct cras_rstream *stream,
-			 struct cras_iodev **iodevs, unsigned int num_iodevs);
+			 struct cras_iodev **iodevs, unsigned int num_iodevs,
+			 struct dev_stream **prepared,
+			 unsigned int num_prepared);
 
 /* Remove a stream from the provided list of devices. */
 int dev_io_remove_stream(struct open_dev **dev_list,
 			 struct cras_rstream *stream, struct cras_iodev *dev);
 
+/* Sets how early, in microseconds, a playback stream may be fetched ahead of
+ * its callback time. Called before audio threads start. */
+void dev_io_set_playback_wake_fuzz_us(unsigned int us);
+
 #endif /* DEV_IO_H_ */
@@ -3,6 +3,10 @@
  * found in the LICENSE file.
  */
 
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <syslog.h>
 
 #include "audio_thread_log.h"
@@ -10,9 +14,14 @@
 #include "cras_fmt_conv.h"
 #include "dev_stream.h"
 #include "cras_audio_area.h"
+#include "cras_loopback_tap.h"
+#include "cras_mem_stats.h"
 #include "cras_mix.h"
+#include "cras_rt_mem.h"
 #include "cras_server_metrics.h"
 #include "cras_shm.h"
+#include "mix_bus.h"
+#include "utlist.h"
 
 /* Adjust device's sample rate by this step faster or slower. Used
  * to make sure multiple active device has stable buffer level.
@@ -23,11 +32,15 @@ static const int coarse_rate_adjust_step = 3;
  * Allow capture callback to fire this much earlier than the scheduled
  * next_cb_ts to avoid an extra wake of audio thread.
  */
-static const struct timespec capture_callback_fuzz_ts = {
+static struct timespec capture_callback_fuzz_ts = {
 	.tv_sec = 0,
 	.tv_nsec = 1000000, /* 1 ms. */
 };
 
+/* The resampler quality of streams whose type doesn't pick one. */
+static enum CRAS_RESAMPLER_QUALITY default_resampler_quality =
+	CRAS_RESAMPLER_QUALITY_DEFAULT;
+
 /*
  * Returns the size in frames that a format converter must allocate for its
  * temporary buffers to be able to convert the specified number of stream
@@ -60,75 +73,981 @@ unsigned int max_frames_for_conversion(unsigned int stream_frames,
 	       + 1;
 }
 
-struct dev_stream *dev_stream_create(struct cras_rstream *stream,
-				     unsigned int dev_id,
-				     const struct cras_audio_format *dev_fmt,
-				     void *dev_ptr, struct timespec *cb_ts,
-				     const struct timespec *sleep_interval_ts)
+/*
+ * Picks the sample rate conversion quality for a stream. Pro audio gets the
+ * longest polyphase filter, while voice streams can live with a short one
+ * and benefit from its lower latency. Others get the board's default.
+ */
+static enum CRAS_RESAMPLER_QUALITY
+resampler_quality_for_stream(const struct cras_rstream *stream)
 {
-	struct dev_stream *out;
+	switch (stream->stream_type) {
+	case CRAS_STREAM_TYPE_PRO_AUDIO:
+		return CRAS_RESAMPLER_QUALITY_HIGH;
+	case CRAS_STREAM_TYPE_VOICE_COMMUNICATION:
+	case CRAS_STREAM_TYPE_SPEECH_RECOGNITION:
+		return CRAS_RESAMPLER_QUALITY_LOW;
+	default:
+		return default_resampler_quality;
+	}
+}
+
+void dev_stream_set_capture_wake_fuzz_us(unsigned int us)
+{
+	capture_callback_fuzz_ts.tv_sec = us / 1000000;
+	capture_callback_fuzz_ts.tv_nsec = (us % 1000000) * 1000;
+}
+
+void dev_stream_set_default_resampler_quality(
+	enum CRAS_RESAMPLER_QUALITY quality)
+{
+	default_resampler_quality = quality;
+}
+
+/*
+ * A format converter shared by the capture streams of a device which convert
+ * the device frames to the same format, e.g. several 16kHz mono streams on a
+ * 48kHz stereo microphone. The device frames are converted once into a ring,
+ * which every stream then copies from at its own pace. The ring holds frames
+ * at positions counted by free running counters, position p at
+ * p % capacity.
+ * Members:
+ *    dev_ptr - The device the streams capture from.
+ *    dev_fmt - The format of the device frames.
+ *    stream_fmt - The format the streams asked for.
+ *    quality - The resampler quality of conv.
+ *    conv - The format converter.
+ *    max_frames - The largest number of frames conv takes at once.
+ *    frame_bytes - The size of a converted frame.
+ *    ring - The converted frames.
+ *    capacity - The size of ring in frames.
+ *    written - The number of frames converted into ring.
+ *    in_offset - Where conversion stopped in the device frames being read.
+ *        Every stream which captured before is at this offset too.
+ *    streams - The dev_streams reading from ring.
+ *    num_streams - The number of entries in streams.
+ */
+struct capture_conv {
+	void *dev_ptr;
+	struct cras_audio_format dev_fmt;
+	struct cras_audio_format stream_fmt;
+	enum CRAS_RESAMPLER_QUALITY quality;
+	struct cras_fmt_conv *conv;
+	unsigned int max_frames;
+	size_t frame_bytes;
+	uint8_t *ring;
+	unsigned int capacity;
+	uint64_t written;
+	unsigned int in_offset;
+	struct dev_stream **streams;
+	unsigned int num_streams;
+	struct capture_conv *prev, *next;
+};
+
+/* The shared capture converters of the devices of this audio thread. Each
+ * audio thread joins and leaves them for its own devices only. */
+static __thread struct capture_conv *capture_convs;
+
+static bool formats_equal(const struct cras_audio_format *a,
+			  const struct cras_audio_format *b)
+{
+	return a->format == b->format && a->frame_rate == b->frame_rate &&
+	       a->num_channels == b->num_channels &&
+	       !memcmp(a->channel_layout, b->channel_layout,
+		       sizeof(a->channel_layout));
+}
+
+static inline uint8_t *capture_conv_ring_at(const struct capture_conv *cc,
+					    uint64_t pos)
+{
+	return cc->ring + (size_t)(pos % cc->capacity) * cc->frame_bytes;
+}
+
+/* Returns the oldest frame in the ring still to be read by a stream. */
+static uint64_t capture_conv_min_read(const struct capture_conv *cc)
+{
+	uint64_t min_read = cc->written;
+	unsigned int i;
+
+	for (i = 0; i < cc->num_streams; i++)
+		min_read = MIN(min_read, cc->streams[i]->shared_read);
+	return min_read;
+}
+
+/* Grows the ring of cc to capacity frames, keeping the unread frames at
+ * the same positions. */
+static int capture_conv_grow(struct capture_conv *cc, unsigned int capacity)
+{
+	uint8_t *ring, *old = cc->ring;
+	unsigned int old_capacity = cc->capacity;
+	uint64_t pos;
+	unsigned int frames;
+
+	ring = (uint8_t *)calloc(capacity, cc->frame_bytes);
+	if (!ring)
+		return -ENOMEM;
+
+	pos = capture_conv_min_read(cc);
+	for (; pos < cc->written; pos += frames) {
+		frames = MIN(old_capacity - pos % old_capacity,
+			     capacity - pos % capacity);
+		frames = MIN(frames, cc->written - pos);
+		memcpy(ring + (size_t)(pos % capacity) * cc->frame_bytes,
+		       old + (size_t)(pos % old_capacity) * cc->frame_bytes,
+		       frames * cc->frame_bytes);
+	}
+	cras_rt_mem_remove(old);
+	free(old);
+	cras_mem_stats_add(CRAS_MEM_FMT_CONV,
+			   (size_t)(capacity - old_capacity) * cc->frame_bytes);
+	cras_rt_mem_add(ring, (size_t)capacity * cc->frame_bytes);
+	cc->ring = ring;
+	cc->capacity = capacity;
+	return 0;
+}
+
+static struct capture_conv *
+capture_conv_create(void *dev_ptr, const struct cras_audio_format *dev_fmt,
+		    const struct cras_audio_format *stream_fmt,
+		    enum CRAS_RESAMPLER_QUALITY quality,
+		    unsigned int max_frames, unsigned int capacity)
+{
+	struct capture_conv *cc;
+
+	cc = (struct capture_conv *)calloc(1, sizeof(*cc));
+	if (!cc)
+		return NULL;
+	if (config_format_converter(&cc->conv, CRAS_STREAM_INPUT, dev_fmt,
+				    stream_fmt, max_frames, quality)) {
+		free(cc);
+		return NULL;
+	}
+	cc->frame_bytes =
+		cras_get_format_bytes(cras_fmt_conv_out_format(cc->conv));
+	cc->ring = (uint8_t *)calloc(capacity, cc->frame_bytes);
+	if (!cc->ring) {
+		cras_fmt_conv_destroy(&cc->conv);
+		free(cc);
+		return NULL;
+	}
+	cras_mem_stats_add(CRAS_MEM_FMT_CONV, (size_t)capacity * cc->frame_bytes);
+	cras_rt_mem_add(cc->ring, (size_t)capacity * cc->frame_bytes);
+	cc->dev_ptr = dev_ptr;
+	cc->dev_fmt = *dev_fmt;
+	cc->stream_fmt = *stream_fmt;
+	cc->quality = quality;
+	cc->max_frames = max_frames;
+	cc->capacity = capacity;
+	DL_APPEND(capture_convs, cc);
+	return cc;
+}
+
+static void capture_conv_destroy(struct capture_conv *cc)
+{
+	DL_DELETE(capture_convs, cc);
+	cras_fmt_conv_destroy(&cc->conv);
+	cras_mem_stats_sub(CRAS_MEM_FMT_CONV,
+			   (size_t)cc->capacity * cc->frame_bytes);
+	cras_rt_mem_remove(cc->ring);
+	free(cc->streams);
+	free(cc->ring);
+	free(cc);
+}
+
+/* Lets dev_stream capture through the converter of the device for its
+ * format, creating it if no other stream uses one yet. On failure the
+ * stream just keeps using its own converter. */
+static void capture_conv_join(struct dev_stream *dev_stream, void *dev_ptr,
+			      const struct cras_audio_format *dev_fmt,
+			      enum CRAS_RESAMPLER_QUALITY quality,
+			      unsigned int max_frames)
+{
+	const struct cras_audio_format *stream_fmt =
+		&dev_stream->stream->format;
+	unsigned int capacity = dev_stream->conv_buffer_size_frames;
+	struct dev_stream **streams;
+	struct capture_conv *cc;
+
+	DL_FOREACH (capture_convs, cc) {
+		if (cc->dev_ptr == dev_ptr && cc->quality == quality &&
+		    formats_equal(&cc->dev_fmt, dev_fmt) &&
+		    formats_equal(&cc->stream_fmt, stream_fmt))
+			break;
+	}
+	if (!cc) {
+		cc = capture_conv_create(dev_ptr, dev_fmt, stream_fmt, quality,
+					 max_frames, capacity);
+		if (!cc)
+			return;
+	} else if (capacity > cc->capacity &&
+		   capture_conv_grow(cc, capacity)) {
+		return;
+	}
+
+	streams = (struct dev_stream **)realloc(
+		cc->streams, (cc->num_streams + 1) * sizeof(*streams));
+	if (!streams) {
+		if (!cc->num_streams)
+			capture_conv_destroy(cc);
+		return;
+	}
+	cc->streams = streams;
+	cc->streams[cc->num_streams++] = dev_stream;
+	dev_stream->shared_conv = cc;
+	dev_stream->shared_read = cc->written;
+	dev_stream->shared_synced = 0;
+}
+
+/* Stops dev_stream from using its shared converter, which goes away with
+ * its last stream. */
+static void capture_conv_leave(struct dev_stream *dev_stream)
+{
+	struct capture_conv *cc = dev_stream->shared_conv;
+	unsigned int i;
+
+	if (!cc)
+		return;
+	dev_stream->shared_conv = NULL;
+
+	for (i = 0; i < cc->num_streams; i++) {
+		if (cc->streams[i] == dev_stream) {
+			memmove(&cc->streams[i], &cc->streams[i + 1],
+				(cc->num_streams - i - 1) *
+					sizeof(cc->streams[0]));
+			cc->num_streams--;
+			break;
+		}
+	}
+	if (!cc->num_streams)
+		capture_conv_destroy(cc);
+}
+
+/* Converts up to frames of the device frames in area from in_offset into
+ * the ring, as far as the ring has room. */
+static void capture_conv_convert(struct capture_conv *cc,
+				 const struct cras_audio_area *area,
+				 unsigned int frames)
+{
+	size_t in_frame_bytes =
+		cras_get_format_bytes(cras_fmt_conv_in_format(cc->conv));
+	const uint8_t *src =
+		area->channels[0].buf + cc->in_offset * in_frame_bytes;
+	uint64_t min_read = capture_conv_min_read(cc);
+	unsigned int read_frames, write_frames;
+
+	while (frames) {
+		write_frames = cc->capacity - (cc->written - min_read);
+		write_frames = MIN(write_frames,
+				   cc->capacity - cc->written % cc->capacity);
+		write_frames = MIN(write_frames, cc->max_frames);
+		if (write_frames == 0)
+			break;
+
+		read_frames = MIN(frames, cc->max_frames);
+		write_frames = cras_fmt_conv_convert_frames(
+			cc->conv, src, capture_conv_ring_at(cc, cc->written),
+			&read_frames, write_frames);
+		if (read_frames == 0 && write_frames == 0)
+			break;
+		src += read_frames * in_frame_bytes;
+		frames -= read_frames;
+		cc->in_offset += read_frames;
+		cc->written += write_frames;
+	}
+}
+
+/*
+ * A format converter shared by the dev_streams of one output stream on
+ * devices of the same format, e.g. a stream played on the internal speaker
+ * and HDMI at once. The stream frames are converted once into a ring, which
+ * every device then mixes from at its own pace. Each conversion is kept as a
+ * block of stream frames in and converted frames out, and a device is
+ * counted as having read the stream frames of a block once it read all its
+ * converted frames. Positions are free running counters, the ring holds
+ * converted frame p at p % capacity and block b at b % PLAYBACK_CONV_BLOCKS.
+ * The converter is only created when a second stream joins, a single one
+ * keeps converting through its own.
+ * Members:
+ *    stream - The rstream converted.
+ *    dev_fmt - The format of the devices.
+ *    quality - The resampler quality of conv.
+ *    max_frames - The largest number of frames conv takes at once.
+ *    capacity - The size of ring in frames.
+ *    conv - The format converter, NULL while there is a single stream.
+ *    in_frame_bytes, frame_bytes - The size of a stream and of a converted
+ *        frame.
+ *    ring - The converted frames.
+ *    written - The number of frames converted into ring.
+ *    in_pos - The number of stream frames converted.
+ *    blocks - The conversions not yet read by every stream.
+ *    num_blocks - The number of conversions done.
+ *    streams - The dev_streams sharing the converter.
+ *    num_streams - The number of entries in streams.
+ */
+#define PLAYBACK_CONV_BLOCKS 64
+
+struct playback_conv_block {
+	uint64_t out_start;
+	uint64_t out_end;
+	uint64_t in_start;
+	uint64_t in_end;
+};
+
+struct playback_conv {
+	struct cras_rstream *stream;
+	struct cras_audio_format dev_fmt;
+	enum CRAS_RESAMPLER_QUALITY quality;
+	unsigned int max_frames;
+	unsigned int capacity;
+	struct cras_fmt_conv *conv;
+	size_t in_frame_bytes;
+	size_t frame_bytes;
+	uint8_t *ring;
+	uint64_t written;
+	uint64_t in_pos;
+	struct playback_conv_block blocks[PLAYBACK_CONV_BLOCKS];
+	uint64_t num_blocks;
+	struct dev_stream **streams;
+	unsigned int num_streams;
+	struct playback_conv *prev, *next;
+};
+
+/* The shared playback converters of the streams of this audio thread. A
+ * stream playing on devices of two threads gets a converter on each. */
+static __thread struct playback_conv *playback_convs;
+
+static inline bool playback_conv_active(const struct dev_stream *dev_stream)
+{
+	return dev_stream->play_conv && dev_stream->play_conv->conv;
+}
+
+static inline uint8_t *playback_conv_ring_at(const struct playback_conv *pc,
+					     uint64_t pos)
+{
+	return pc->ring + (size_t)(pos % pc->capacity) * pc->frame_bytes;
+}
+
+/* Returns the offset of the next stream frame to convert, relative to the
+ * device offset of a stream sharing pc. */
+static inline unsigned int
+playback_conv_in_offset(const struct playback_conv *pc,
+			const struct dev_stream *dev_stream)
+{
+	return cras_rstream_dev_offset(pc->stream, dev_stream->dev_id) +
+	       (pc->in_pos - dev_stream->play_in);
+}
+
+/* Moves dev_stream to the end of what pc converted. Its device skips the
+ * stream frames the others already played, to stay in step with them. */
+static void playback_conv_sync(struct playback_conv *pc,
+			       struct dev_stream *dev_stream,
+			       unsigned int in_offset)
+{
+	unsigned int offset =
+		cras_rstream_dev_offset(pc->stream, dev_stream->dev_id);
+
+	if (in_offset > offset)
+		cras_rstream_dev_offset_update(pc->stream, in_offset - offset,
+					       dev_stream->dev_id);
+	dev_stream->play_read = pc->written;
+	dev_stream->play_in = pc->in_pos;
+	dev_stream->play_block = pc->num_blocks;
+}
+
+/* Counts the stream frames of the block dev_stream is part way through as
+ * read by its device, in proportion to the converted frames it read. */
+static void playback_conv_settle(struct playback_conv *pc,
+				 struct dev_stream *dev_stream)
+{
+	const struct playback_conv_block *block;
+	size_t in_frames;
+
+	if (dev_stream->play_block == pc->num_blocks)
+		return;
+	block = &pc->blocks[dev_stream->play_block % PLAYBACK_CONV_BLOCKS];
+	if (dev_stream->play_read <= block->out_start)
+		return;
+	in_frames = cras_fmt_conv_out_frames_to_in(
+		pc->conv, dev_stream->play_read - block->out_start);
+	in_frames = MIN(in_frames, block->in_end - block->in_start);
+	cras_rstream_dev_offset_update(pc->stream, in_frames,
+				       dev_stream->dev_id);
+}
+
+/* Creates the converter and ring once pc has two streams, and lines them
+ * up on the stream frame the furthest one is at. */
+static int playback_conv_start(struct playback_conv *pc)
+{
+	unsigned int in_offset = 0;
+	unsigned int i;
+
+	if (config_format_converter(&pc->conv, CRAS_STREAM_OUTPUT,
+				    &pc->stream->format, &pc->dev_fmt,
+				    pc->max_frames, pc->quality))
+		return -ENOMEM;
+	pc->in_frame_bytes = cras_get_format_bytes(&pc->stream->format);
+	pc->frame_bytes = cras_get_format_bytes(&pc->dev_fmt);
+	pc->ring = (uint8_t *)calloc(pc->capacity, pc->frame_bytes);
+	if (!pc->ring) {
+		cras_fmt_conv_destroy(&pc->conv);
+		return -ENOMEM;
+	}
+	cras_mem_stats_add(CRAS_MEM_FMT_CONV,
+			   (size_t)pc->capacity * pc->frame_bytes);
+	cras_rt_mem_add(pc->ring, (size_t)pc->capacity * pc->frame_bytes);
+	pc->written = 0;
+	pc->in_pos = 0;
+	pc->num_blocks = 0;
+
+	for (i = 0; i < pc->num_streams; i++)
+		in_offset = MAX(in_offset,
+				cras_rstream_dev_offset(
+					pc->stream, pc->streams[i]->dev_id));
+	for (i = 0; i < pc->num_streams; i++)
+		playback_conv_sync(pc, pc->streams[i], in_offset);
+	return 0;
+}
+
+/* Frees the converter and ring, the stream left goes back to its own. */
+static void playback_conv_stop(struct playback_conv *pc)
+{
+	cras_mem_stats_sub(CRAS_MEM_FMT_CONV,
+			   (size_t)pc->capacity * pc->frame_bytes);
+	cras_rt_mem_remove(pc->ring);
+	free(pc->ring);
+	pc->ring = NULL;
+	cras_fmt_conv_destroy(&pc->conv);
+}
+
+/* Stops dev_stream from using its shared converter. Unless settle is false
+ * because the stream is gone from its device, the device offset is brought
+ * up to the frames it played. */
+static void playback_conv_leave(struct dev_stream *dev_stream, bool settle)
+{
+	struct playback_conv *pc = dev_stream->play_conv;
+	unsigned int i;
+
+	if (!pc)
+		return;
+	dev_stream->play_conv = NULL;
+
+	if (pc->conv && settle)
+		playback_conv_settle(pc, dev_stream);
+	for (i = 0; i < pc->num_streams; i++) {
+		if (pc->streams[i] == dev_stream) {
+			memmove(&pc->streams[i], &pc->streams[i + 1],
+				(pc->num_streams - i - 1) *
+					sizeof(pc->streams[0]));
+			pc->num_streams--;
+			break;
+		}
+	}
+	if (pc->num_streams == 1 && pc->conv) {
+		playback_conv_settle(pc, pc->streams[0]);
+		playback_conv_stop(pc);
+	}
+	if (!pc->num_streams) {
+		DL_DELETE(playback_convs, pc);
+		free(pc->streams);
+		free(pc);
+	}
+}
+
+/* Lets dev_stream play through the converter its rstream has for devices of
+ * its format, creating it for the first stream. On failure the stream just
+ * keeps using its own converter. */
+static void playback_conv_join(struct dev_stream *dev_stream,
+			       const struct cras_audio_format *dev_fmt,
+			       enum CRAS_RESAMPLER_QUALITY quality,
+			       unsigned int max_frames)
+{
+	struct cras_rstream *stream = dev_stream->stream;
+	struct dev_stream **streams;
+	struct playback_conv *pc;
+
+	DL_FOREACH (playback_convs, pc) {
+		if (pc->stream == stream && pc->quality == quality &&
+		    formats_equal(&pc->dev_fmt, dev_fmt))
+			break;
+	}
+	if (!pc) {
+		pc = (struct playback_conv *)calloc(1, sizeof(*pc));
+		if (!pc)
+			return;
+		pc->stream = stream;
+		pc->dev_fmt = *dev_fmt;
+		pc->quality = quality;
+		pc->max_frames = max_frames;
+		pc->capacity = dev_stream->conv_buffer_size_frames;
+		DL_APPEND(playback_convs, pc);
+	}
+
+	streams = (struct dev_stream **)realloc(
+		pc->streams, (pc->num_streams + 1) * sizeof(*streams));
+	if (!streams) {
+		if (!pc->num_streams) {
+			DL_DELETE(playback_convs, pc);
+			free(pc);
+		}
+		return;
+	}
+	pc->streams = streams;
+	pc->streams[pc->num_streams++] = dev_stream;
+	dev_stream->play_conv = pc;
+
+	if (pc->conv)
+		playback_conv_sync(pc, dev_stream,
+				   playback_conv_in_offset(pc, pc->streams[0]));
+	else if (pc->num_streams > 1 && playback_conv_start(pc))
+		playback_conv_leave(dev_stream, false);
+}
+
+/* Records a conversion of in_frames stream frames into out_frames. */
+static void playback_conv_add_block(struct playback_conv *pc,
+				    unsigned int in_frames,
+				    unsigned int out_frames)
+{
+	struct playback_conv_block *block =
+		&pc->blocks[pc->num_blocks++ % PLAYBACK_CONV_BLOCKS];
+
+	block->out_start = pc->written;
+	block->in_start = pc->in_pos;
+	pc->written += out_frames;
+	pc->in_pos += in_frames;
+	block->out_end = pc->written;
+	block->in_end = pc->in_pos;
+}
+
+/* Converts stream frames from in_offset into the ring until it holds
+ * frames more, as far as the ring and the block records have room. Blocks
+ * of a muted stream, or of silence, are written as zeros unless resampled. */
+static void playback_conv_convert(struct playback_conv *pc,
+				  unsigned int in_offset, unsigned int frames,
+				  int mute)
+{
+	int resampling = cras_fmt_conv_resampling(pc->conv);
+	uint64_t min_read = pc->written;
+	uint64_t min_block = pc->num_blocks;
+	unsigned int read_frames, write_frames, i;
+	size_t readable;
+	uint8_t *src;
+
+	for (i = 0; i < pc->num_streams; i++) {
+		min_read = MIN(min_read, pc->streams[i]->play_read);
+		min_block = MIN(min_block, pc->streams[i]->play_block);
+	}
+
+	while (frames) {
+		if (pc->num_blocks - min_block == PLAYBACK_CONV_BLOCKS)
+			break;
+		write_frames = pc->capacity - (pc->written - min_read);
+		write_frames = MIN(write_frames,
+				   pc->capacity - pc->written % pc->capacity);
+		write_frames = MIN(write_frames, pc->max_frames);
+		if (write_frames == 0)
+			break;
+		src = cras_rstream_get_readable_frames(pc->stream, in_offset,
+						       &readable);
+		if (readable == 0)
+			break;
+
+		read_frames = MIN(readable, pc->max_frames);
+		if (!resampling &&
+		    (mute || cras_mix_buffer_is_zero(
+				     src, MIN(read_frames, write_frames) *
+						  pc->in_frame_bytes))) {
+			read_frames = MIN(read_frames, write_frames);
+			write_frames = read_frames;
+			memset(playback_conv_ring_at(pc, pc->written), 0,
+			       (size_t)write_frames * pc->frame_bytes);
+		} else {
+			write_frames = cras_fmt_conv_convert_frames(
+				pc->conv, src,
+				playback_conv_ring_at(pc, pc->written),
+				&read_frames, write_frames);
+		}
+		if (read_frames == 0 && write_frames == 0)
+			break;
+		playback_conv_add_block(pc, read_frames, write_frames);
+		in_offset += read_frames;
+		frames -= MIN(frames, write_frames);
+	}
+}
+
+/* Gets up to frames converted frames for dev_stream, converting more if
+ * it read all there are. in_offset is the current offset of its device.
+ * Returns the frames, with their number in out_frames. */
+static uint8_t *playback_conv_get(struct dev_stream *dev_stream,
+				  unsigned int in_offset, unsigned int frames,
+				  int mute, unsigned int *out_frames)
+{
+	struct playback_conv *pc = dev_stream->play_conv;
+	uint64_t avail = pc->written - dev_stream->play_read;
+
+	if (avail < frames)
+		playback_conv_convert(pc,
+				      in_offset +
+					      (pc->in_pos - dev_stream->play_in),
+				      frames - avail, mute);
+
+	avail = pc->written - dev_stream->play_read;
+	*out_frames = MIN(MIN(avail, frames),
+			  pc->capacity - dev_stream->play_read % pc->capacity);
+	return playback_conv_ring_at(pc, dev_stream->play_read);
+}
+
+/* Marks frames of the converted frames as read by dev_stream. Returns the
+ * stream frames of the blocks it finished, now read by its device. */
+static unsigned int playback_conv_put(struct dev_stream *dev_stream,
+				      unsigned int frames)
+{
+	struct playback_conv *pc = dev_stream->play_conv;
+	const struct playback_conv_block *block;
+	uint64_t in_start = dev_stream->play_in;
+
+	dev_stream->play_read += frames;
+	while (dev_stream->play_block < pc->num_blocks) {
+		block = &pc->blocks[dev_stream->play_block %
+				    PLAYBACK_CONV_BLOCKS];
+		if (block->out_end > dev_stream->play_read)
+			break;
+		dev_stream->play_in = block->in_end;
+		dev_stream->play_block++;
+	}
+	return dev_stream->play_in - in_start;
+}
+
+/*
+ * A format converter shared by the output streams of a device playing the
+ * same format, e.g. the many 44.1kHz stereo streams of a game on a 48kHz
+ * device. The streams ready at the same device offset are summed into a
+ * submix at the stream rate, each with its own volume, and the submix is
+ * converted once and mixed into the device like a single stream. The
+ * converter is only created once a second stream joins. A stream that isn't
+ * ready with the others, or whose rate follows another device, is mixed
+ * through its own converter instead.
+ * Members:
+ *    dev_id - The device the streams play on.
+ *    stream_fmt - The format of the streams.
+ *    dev_fmt - The format of the device.
+ *    quality - The resampler quality of conv.
+ *    max_frames - The largest number of frames conv takes at once.
+ *    conv - The format converter, NULL while there is a single stream.
+ *    submix_add - The mixer kernel summing the streams into submix.
+ *    submix - The summed stream frames, max_frames of them.
+ *    out - The converted submix, max_frames of them.
+ *    streams - The dev_streams in the group.
+ *    num_streams - The number of entries in streams.
+ */
+struct mix_group {
+	unsigned int dev_id;
+	struct cras_audio_format stream_fmt;
+	struct cras_audio_format dev_fmt;
+	enum CRAS_RESAMPLER_QUALITY quality;
+	unsigned int max_frames;
+	struct cras_fmt_conv *conv;
+	cras_mix_add_func submix_add;
+	uint8_t *submix;
+	uint8_t *out;
+	struct dev_stream **streams;
+	unsigned int num_streams;
+	struct mix_group *prev, *next;
+};
+
+/* The mix groups of the devices of this audio thread. */
+static __thread struct mix_group *mix_groups;
+
+static inline size_t mix_group_bytes(const struct mix_group *mg)
+{
+	return (size_t)mg->max_frames *
+	       (cras_get_format_bytes(&mg->stream_fmt) +
+		cras_get_format_bytes(&mg->dev_fmt));
+}
+
+/* Creates the converter and buffers once mg has two streams. */
+static int mix_group_start(struct mix_group *mg)
+{
+	size_t in_bytes = (size_t)mg->max_frames *
+			  cras_get_format_bytes(&mg->stream_fmt);
+
+	if (config_format_converter(&mg->conv, CRAS_STREAM_OUTPUT,
+				    &mg->stream_fmt, &mg->dev_fmt,
+				    mg->max_frames, mg->quality))
+		return -ENOMEM;
+	mg->submix = (uint8_t *)malloc(mix_group_bytes(mg));
+	if (!mg->submix) {
+		cras_fmt_conv_destroy(&mg->conv);
+		return -ENOMEM;
+	}
+	mg->out = mg->submix + in_bytes;
+	cras_mem_stats_add(CRAS_MEM_FMT_CONV, mix_group_bytes(mg));
+	cras_rt_mem_add(mg->submix, mix_group_bytes(mg));
+	return 0;
+}
+
+static void mix_group_stop(struct mix_group *mg)
+{
+	cras_mem_stats_sub(CRAS_MEM_FMT_CONV, mix_group_bytes(mg));
+	cras_rt_mem_remove(mg->submix);
+	free(mg->submix);
+	mg->submix = NULL;
+	mg->out = NULL;
+	cras_fmt_conv_destroy(&mg->conv);
+}
+
+/* Takes dev_stream out of its mix group, which goes away with its last
+ * stream. */
+static void mix_group_leave(struct dev_stream *dev_stream)
+{
+	struct mix_group *mg = dev_stream->mix_group;
+	unsigned int i;
+
+	if (!mg)
+		return;
+	dev_stream->mix_group = NULL;
+
+	for (i = 0; i < mg->num_streams; i++) {
+		if (mg->streams[i] == dev_stream) {
+			memmove(&mg->streams[i], &mg->streams[i + 1],
+				(mg->num_streams - i - 1) *
+					sizeof(mg->streams[0]));
+			mg->num_streams--;
+			break;
+		}
+	}
+	if (mg->num_streams == 1 && mg->conv)
+		mix_group_stop(mg);
+	if (!mg->num_streams) {
+		DL_DELETE(mix_groups, mg);
+		free(mg->streams);
+		free(mg);
+	}
+}
+
+/* Adds dev_stream to the mix group of its device for its format, creating
+ * it for the first stream. On failure the stream is just mixed alone. */
+static void mix_group_join(struct dev_stream *dev_stream,
+			   const struct cras_audio_format *dev_fmt,
+			   enum CRAS_RESAMPLER_QUALITY quality,
+			   unsigned int max_frames)
+{
+	const struct cras_audio_format *stream_fmt =
+		&dev_stream->stream->format;
+	struct dev_stream **streams;
+	struct mix_group *mg;
+
+	/* The submix is summed by the mixer in the stream format. */
+	switch (stream_fmt->format) {
+	case SND_PCM_FORMAT_S16_LE:
+	case SND_PCM_FORMAT_S24_LE:
+	case SND_PCM_FORMAT_S32_LE:
+	case SND_PCM_FORMAT_S24_3LE:
+		break;
+	default:
+		return;
+	}
+
+	DL_FOREACH (mix_groups, mg) {
+		if (mg->dev_id == dev_stream->dev_id &&
+		    mg->quality == quality &&
+		    formats_equal(&mg->stream_fmt, stream_fmt) &&
+		    formats_equal(&mg->dev_fmt, dev_fmt))
+			break;
+	}
+	if (!mg) {
+		mg = (struct mix_group *)calloc(1, sizeof(*mg));
+		if (!mg)
+			return;
+		mg->dev_id = dev_stream->dev_id;
+		mg->stream_fmt = *stream_fmt;
+		mg->dev_fmt = *dev_fmt;
+		mg->quality = quality;
+		mg->max_frames = max_frames;
+		mg->submix_add = cras_mix_get_add(stream_fmt->format);
+		DL_APPEND(mix_groups, mg);
+	}
+
+	streams = (struct dev_stream **)realloc(
+		mg->streams, (mg->num_streams + 1) * sizeof(*streams));
+	if (!streams) {
+		if (!mg->num_streams) {
+			DL_DELETE(mix_groups, mg);
+			free(mg);
+		}
+		return;
+	}
+	mg->streams = streams;
+	mg->streams[mg->num_streams++] = dev_stream;
+	dev_stream->mix_group = mg;
+
+	if (!mg->conv && mg->num_streams > 1 && mix_group_start(mg))
+		mix_group_leave(dev_stream);
+}
+
+/*
+ * Destroyed dev_streams of this audio thread, kept with their conversion
+ * buffer and area for the next dev_stream needing the same sizes. Streams
+ * come and go with browser and WebRTC calls, reusing them keeps most stream
+ * setup on the audio thread from reaching malloc.
+ */
+#define MAX_KEPT_DEV_STREAMS 8
+static __thread struct dev_stream *kept_dev_streams;
+static __thread unsigned int num_kept_dev_streams;
+
+static void free_dev_stream(struct dev_stream *dev_stream)
+{
+	cras_mem_stats_sub(CRAS_MEM_FMT_CONV, dev_stream->conv_buffer->max_size);
+	cras_rt_mem_remove(dev_stream->conv_buffer->bytes);
+	cras_audio_area_destroy(dev_stream->conv_area);
+	byte_buffer_destroy(&dev_stream->conv_buffer);
+	free(dev_stream);
+}
+
+/* Returns a kept dev_stream with a conversion buffer of buf_bytes and an area
+ * of num_channels, cleared but for those two. NULL if none matches. */
+static struct dev_stream *take_kept_dev_stream(unsigned int buf_bytes,
+					       unsigned int num_channels)
+{
+	struct dev_stream *dev_stream;
+	struct byte_buffer *buf;
+	struct cras_audio_area *area;
+
+	DL_FOREACH (kept_dev_streams, dev_stream) {
+		if (dev_stream->conv_buffer->max_size == buf_bytes &&
+		    dev_stream->conv_area->num_channels == num_channels)
+			break;
+	}
+	if (!dev_stream)
+		return NULL;
+
+	DL_DELETE(kept_dev_streams, dev_stream);
+	num_kept_dev_streams--;
+
+	buf = dev_stream->conv_buffer;
+	area = dev_stream->conv_area;
+	memset(dev_stream, 0, sizeof(*dev_stream));
+	buf_reset(buf);
+	buf->used_size = buf->max_size;
+	area->frames = 0;
+	dev_stream->conv_buffer = buf;
+	dev_stream->conv_area = area;
+	return dev_stream;
+}
+
+/* Keeps a destroyed dev_stream, dropping the oldest kept one when full. */
+static void keep_dev_stream(struct dev_stream *dev_stream)
+{
+	struct dev_stream *oldest = kept_dev_streams;
+
+	if (num_kept_dev_streams == MAX_KEPT_DEV_STREAMS) {
+		DL_DELETE(kept_dev_streams, oldest);
+		free_dev_stream(oldest);
+		num_kept_dev_streams--;
+	}
+	DL_APPEND(kept_dev_streams, dev_stream);
+	num_kept_dev_streams++;
+}
+
+/*
+ * Allocates a dev_stream with its format converter and conversion buffer,
+ * converting between the stream and conv_fmt, the device format or for
+ * input the format after stream processing. Only a dev_stream kept by this
+ * thread is reused when use_kept is set.
+ */
+static struct dev_stream *
+build_dev_stream(struct cras_rstream *stream,
+		 const struct cras_audio_format *dev_fmt,
+		 const struct cras_audio_format *conv_fmt, bool use_kept)
+{
+	struct dev_stream *out = NULL;
+	struct cras_fmt_conv *conv;
 	struct cras_audio_format *stream_fmt = &stream->format;
 	int rc = 0;
-	unsigned int max_frames, dev_frames, buf_bytes;
+	unsigned int max_frames, dev_frames, buf_frames, buf_bytes;
 	const struct cras_audio_format *ofmt;
-
-	out = calloc(1, sizeof(*out));
-	out->dev_id = dev_id;
-	out->stream = stream;
-	out->dev_rate = dev_fmt->frame_rate;
-	out->is_running = 0;
+	enum CRAS_RESAMPLER_QUALITY quality;
 
 	max_frames = max_frames_for_conversion(stream->buffer_frames,
 					       stream_fmt->frame_rate,
 					       dev_fmt->frame_rate);
+	quality = resampler_quality_for_stream(stream);
 
-	if (stream->direction == CRAS_STREAM_OUTPUT) {
-		rc = config_format_converter(&out->conv, stream->direction,
-					     stream_fmt, dev_fmt, max_frames);
-	} else {
-		/*
-		 * For input, take into account the stream specific processing
-		 * like AEC. APM exists only in input path, and has no dependency
-		 * to dev_stream. Starts APM in dev_stream's constructor just to
-		 * align with its life cycle, and then gets the post processing
-		 * format to configure format converter.
-		 */
-		cras_apm_list_start_apm(stream->apm_list, dev_ptr);
-		ofmt = cras_rstream_post_processing_format(stream, dev_ptr) ?:
-			       dev_fmt,
-		rc = config_format_converter(&out->conv, stream->direction,
-					     ofmt, stream_fmt, max_frames);
-	}
-	if (rc) {
-		free(out);
+	if (stream->direction == CRAS_STREAM_OUTPUT)
+		rc = config_format_converter(&conv, stream->direction,
+					     stream_fmt, conv_fmt, max_frames,
+					     quality);
+	else
+		rc = config_format_converter(&conv, stream->direction,
+					     conv_fmt, stream_fmt, max_frames,
+					     quality);
+	if (rc)
 		return NULL;
-	}
 
-	ofmt = cras_fmt_conv_out_format(out->conv);
+	ofmt = cras_fmt_conv_out_format(conv);
 
 	dev_frames =
 		(stream->direction == CRAS_STREAM_OUTPUT) ?
-			cras_fmt_conv_in_frames_to_out(out->conv,
+			cras_fmt_conv_in_frames_to_out(conv,
 						       stream->buffer_frames) :
-			cras_fmt_conv_out_frames_to_in(out->conv,
+			cras_fmt_conv_out_frames_to_in(conv,
 						       stream->buffer_frames);
 
-	out->conv_buffer_size_frames =
-		2 * MAX(dev_frames, stream->buffer_frames);
+	/* The conversion buffer and area use the output format of the format
+	 * converter. Note that this format might not be identical to
+	 * stream_fmt for capture. */
+	buf_frames = 2 * MAX(dev_frames, stream->buffer_frames);
+	buf_bytes = buf_frames * cras_get_format_bytes(ofmt);
+	if (use_kept)
+		out = take_kept_dev_stream(buf_bytes, ofmt->num_channels);
+	if (!out) {
+		out = calloc(1, sizeof(*out));
+		out->conv_buffer = byte_buffer_create(buf_bytes);
+		out->conv_area = cras_audio_area_create(ofmt->num_channels);
+		cras_mem_stats_add(CRAS_MEM_FMT_CONV, buf_bytes);
+		cras_rt_mem_add(out->conv_buffer->bytes, buf_bytes);
+	}
+	out->stream = stream;
+	out->conv = conv;
+	out->conv_buffer_size_frames = buf_frames;
+	out->dev_rate = dev_fmt->frame_rate;
+	out->is_running = 0;
+	return out;
+}
 
-	/* Create conversion buffer and area using the output format
-	 * of the format converter. Note that this format might not be
-	 * identical to stream_fmt for capture. */
-	buf_bytes = out->conv_buffer_size_frames * cras_get_format_bytes(ofmt);
-	out->conv_buffer = byte_buffer_create(buf_bytes);
-	out->conv_area = cras_audio_area_create(ofmt->num_channels);
+/* Attaches a built dev_stream to its device, the cheap part of creating it. */
+static void attach_dev_stream(struct dev_stream *out, unsigned int dev_id,
+			      const struct cras_audio_format *dev_fmt,
+			      void *dev_ptr, struct timespec *cb_ts,
+			      const struct timespec *sleep_interval_ts)
+{
+	struct cras_rstream *stream = out->stream;
+
+	out->dev_id = dev_id;
+
+	/*
+	 * Capture streams converting the device frames the same way share one
+	 * converter, unless the frames go through stream specific processing
+	 * first. TRIGGER_ONLY streams don't read the device at all, and
+	 * SILENCE_GATE_OK streams skip the converter while the input is
+	 * silence.
+	 */
+	if (stream->direction == CRAS_STREAM_INPUT &&
+	    !(stream->flags & (TRIGGER_ONLY | SILENCE_GATE_OK)) &&
+	    cras_fmt_conversion_needed(out->conv) &&
+	    !cras_rstream_post_processing_format(stream, dev_ptr))
+		capture_conv_join(out, dev_ptr, dev_fmt,
+				  resampler_quality_for_stream(stream),
+				  max_frames_for_conversion(
+					  stream->buffer_frames,
+					  stream->format.frame_rate,
+					  dev_fmt->frame_rate));
 
 	/* Use sleep interval hint from argument if it is provided */
 	if (sleep_interval_ts) {
 		stream->sleep_interval_ts = *sleep_interval_ts;
 	} else {
 		cras_frames_to_time(cras_rstream_get_cb_threshold(stream),
-				    stream_fmt->frame_rate,
+				    stream->format.frame_rate,
 				    &stream->sleep_interval_ts);
 	}
 
@@ -137,9 +1056,95 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 	/* Sets up the stream & dev pair. */
 	cras_rstream_dev_attach(stream, dev_id, dev_ptr);
 
+	/* Playback converted the same way for several devices, like the
+	 * internal speaker and HDMI, is converted once for all of them. */
+	if (stream->direction == CRAS_STREAM_OUTPUT &&
+	    cras_fmt_conversion_needed(out->conv))
+		playback_conv_join(out, dev_fmt,
+				   resampler_quality_for_stream(stream),
+				   max_frames_for_conversion(
+					   stream->buffer_frames,
+					   stream->format.frame_rate,
+					   dev_fmt->frame_rate));
+
+	/* Streams of the device in one format can be converted together. */
+	if (stream->direction == CRAS_STREAM_OUTPUT &&
+	    cras_fmt_conversion_needed(out->conv))
+		mix_group_join(out, dev_fmt,
+			       resampler_quality_for_stream(stream),
+			       max_frames_for_conversion(
+				       stream->buffer_frames,
+				       stream->format.frame_rate,
+				       dev_fmt->frame_rate));
+}
+
+struct dev_stream *dev_stream_create(struct cras_rstream *stream,
+				     unsigned int dev_id,
+				     const struct cras_audio_format *dev_fmt,
+				     void *dev_ptr, struct timespec *cb_ts,
+				     const struct timespec *sleep_interval_ts)
+{
+	struct dev_stream *out;
+	const struct cras_audio_format *conv_fmt = dev_fmt;
+
+	if (stream->direction == CRAS_STREAM_INPUT) {
+		/*
+		 * For input, take into account the stream specific processing
+		 * like AEC. APM exists only in input path, and has no
+		 * dependency to dev_stream. Starts APM in dev_stream's
+		 * constructor just to align with its life cycle, and then gets
+		 * the post processing format to configure format converter.
+		 */
+		cras_apm_list_start_apm(stream->apm_list, dev_ptr);
+		conv_fmt = cras_rstream_post_processing_format(stream,
+							       dev_ptr) ?:
+				   dev_fmt;
+	}
+
+	out = build_dev_stream(stream, dev_fmt, conv_fmt, true);
+	if (!out)
+		return NULL;
+	attach_dev_stream(out, dev_id, dev_fmt, dev_ptr, cb_ts,
+			  sleep_interval_ts);
 	return out;
 }
 
+struct dev_stream *dev_stream_prepare(struct cras_rstream *stream,
+				      const struct cras_audio_format *dev_fmt)
+{
+	/* The converter of a processed input stream depends on the APM the
+	 * audio thread starts for the device. */
+	if (stream->direction == CRAS_STREAM_INPUT && stream->apm_list)
+		return NULL;
+	return build_dev_stream(stream, dev_fmt, dev_fmt, false);
+}
+
+int dev_stream_attach(struct dev_stream *dev_stream, unsigned int dev_id,
+		      const struct cras_audio_format *dev_fmt, void *dev_ptr,
+		      struct timespec *cb_ts,
+		      const struct timespec *sleep_interval_ts)
+{
+	const struct cras_audio_format *conv_fmt =
+		(dev_stream->stream->direction == CRAS_STREAM_OUTPUT) ?
+			cras_fmt_conv_out_format(dev_stream->conv) :
+			cras_fmt_conv_in_format(dev_stream->conv);
+
+	/* The device may have been reopened since the preparation. */
+	if (!formats_equal(conv_fmt, dev_fmt))
+		return -EINVAL;
+
+	attach_dev_stream(dev_stream, dev_id, dev_fmt, dev_ptr, cb_ts,
+			  sleep_interval_ts);
+	return 0;
+}
+
+void dev_stream_discard(struct dev_stream *dev_stream)
+{
+	if (dev_stream->conv)
+		cras_fmt_conv_destroy(&dev_stream->conv);
+	free_dev_stream(dev_stream);
+}
+
 void dev_stream_destroy(struct dev_stream *dev_stream)
 {
 	void *dev_ptr =
@@ -147,12 +1152,42 @@ void dev_stream_destroy(struct dev_stream *dev_stream)
 	/* Stops the APM and then unlink the dev stream pair. */
 	cras_apm_list_stop_apm(dev_stream->stream->apm_list, dev_ptr);
 	cras_rstream_dev_detach(dev_stream->stream, dev_stream->dev_id);
-	if (dev_stream->conv) {
-		cras_audio_area_destroy(dev_stream->conv_area);
+	capture_conv_leave(dev_stream);
+	playback_conv_leave(dev_stream, false);
+	mix_group_leave(dev_stream);
+	if (dev_stream->conv)
 		cras_fmt_conv_destroy(&dev_stream->conv);
-		byte_buffer_destroy(&dev_stream->conv_buffer);
+	keep_dev_stream(dev_stream);
+}
+
+void dev_stream_release_kept()
+{
+	struct dev_stream *dev_stream;
+
+	DL_FOREACH (kept_dev_streams, dev_stream) {
+		DL_DELETE(kept_dev_streams, dev_stream);
+		free_dev_stream(dev_stream);
 	}
-	free(dev_stream);
+	num_kept_dev_streams = 0;
+}
+
+/* Resamples the stream so its frames follow the clock of a device with
+ * estimated rate ratio follow_rate_ratio. */
+static void follow_rate(struct dev_stream *dev_stream, unsigned int dev_rate,
+			double dev_rate_ratio, double follow_rate_ratio,
+			int coarse_rate_adjust)
+{
+	double new_rate = dev_rate * dev_rate_ratio / follow_rate_ratio +
+			  coarse_rate_adjust_step * coarse_rate_adjust;
+	/* The rate follows another device, which the other streams
+	 * sharing the converter may not. */
+	capture_conv_leave(dev_stream);
+	/* Playback stays on the shared converter until the estimated rate
+	 * moves by the linear resampler's step, a hundredth of a hertz. */
+	if ((unsigned int)(new_rate * 100) != dev_rate * 100)
+		playback_conv_leave(dev_stream, true);
+	cras_fmt_conv_set_linear_resample_rates(dev_stream->conv, dev_rate,
+						new_rate);
 }
 
 void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
@@ -162,32 +1197,108 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 	if (dev_stream->dev_id == dev_stream->stream->main_dev.dev_id) {
 		cras_fmt_conv_set_linear_resample_rates(dev_stream->conv,
 							dev_rate, dev_rate);
+		if (dev_stream->shared_conv)
+			cras_fmt_conv_set_linear_resample_rates(
+				dev_stream->shared_conv->conv, dev_rate,
+				dev_rate);
+		if (playback_conv_active(dev_stream))
+			cras_fmt_conv_set_linear_resample_rates(
+				dev_stream->play_conv->conv, dev_rate,
+				dev_rate);
+		if (dev_stream->mix_group && dev_stream->mix_group->conv)
+			cras_fmt_conv_set_linear_resample_rates(
+				dev_stream->mix_group->conv, dev_rate,
+				dev_rate);
 		cras_frames_to_time_precise(
 			cras_rstream_get_cb_threshold(dev_stream->stream),
 			dev_stream->stream->format.frame_rate * dev_rate_ratio,
 			&dev_stream->stream->sleep_interval_ts);
 	} else {
-		double new_rate = dev_rate * dev_rate_ratio / main_rate_ratio +
-				  coarse_rate_adjust_step * coarse_rate_adjust;
-		cras_fmt_conv_set_linear_resample_rates(dev_stream->conv,
-							dev_rate, new_rate);
+		follow_rate(dev_stream, dev_rate, dev_rate_ratio,
+			    main_rate_ratio, coarse_rate_adjust);
 	}
 }
 
-int dev_stream_mix(struct dev_stream *dev_stream,
-		   const struct cras_audio_format *fmt, uint8_t *dst,
-		   unsigned int num_to_write)
+void dev_stream_set_master_rate(struct dev_stream *dev_stream,
+				unsigned int dev_rate, double dev_rate_ratio,
+				double master_rate_ratio,
+				int coarse_rate_adjust)
+{
+	follow_rate(dev_stream, dev_rate, dev_rate_ratio, master_rate_ratio,
+		    coarse_rate_adjust);
+	/* Resampled frames arrive at the pace of the master clock. */
+	cras_frames_to_time_precise(
+		cras_rstream_get_cb_threshold(dev_stream->stream),
+		dev_stream->stream->format.frame_rate * master_rate_ratio,
+		&dev_stream->stream->sleep_interval_ts);
+}
+
+void dev_stream_set_shed(struct dev_stream *dev_stream, int shed)
+{
+	struct cras_rstream *stream = dev_stream->stream;
+	enum CRAS_RESAMPLER_QUALITY quality =
+		resampler_quality_for_stream(stream);
+	struct cras_fmt_conv *conv;
+
+	shed = !!shed;
+	if (dev_stream->shed == shed)
+		return;
+	dev_stream->shed = shed;
+
+	/* Only the stream's own converter is rebuilt, a shared one costs
+	 * the same however many streams use it. */
+	if (!dev_stream->conv || !cras_fmt_conv_resampling(dev_stream->conv) ||
+	    quality == CRAS_RESAMPLER_QUALITY_LOW)
+		return;
+	if (config_format_converter(
+		    &conv, stream->direction,
+		    cras_fmt_conv_in_format(dev_stream->conv),
+		    cras_fmt_conv_out_format(dev_stream->conv),
+		    max_frames_for_conversion(stream->buffer_frames,
+					      stream->format.frame_rate,
+					      dev_stream->dev_rate),
+		    shed ? CRAS_RESAMPLER_QUALITY_LOW : quality))
+		return;
+	cras_fmt_conv_destroy(&dev_stream->conv);
+	dev_stream->conv = conv;
+}
+
+/* Returns non-zero if the float stream of dev_stream can be added to the
+ * float mix bus of its device as it is. Its converter would only take the
+ * samples through the integer format of the device. */
+static int mixes_float_direct(const struct dev_stream *dev_stream)
+{
+	const struct cras_rstream *rstream = dev_stream->stream;
+
+	return rstream->format.format == SND_PCM_FORMAT_FLOAT_LE &&
+	       dev_stream->conv &&
+	       cras_fmt_conv_format_only(dev_stream->conv) &&
+	       !playback_conv_active(dev_stream) &&
+	       !loopback_tap_keeps_stream(dev_stream->dev_id, rstream);
+}
+
+/* Renders frames from the stream into dst, or into bus starting at frame
+ * bus_offset when bus is given. With index 0 the destination is overwritten,
+ * otherwise the stream is added to what is already there. */
+static int render_frames(struct dev_stream *dev_stream,
+			 const struct cras_audio_format *fmt, uint8_t *dst,
+			 struct mix_bus *bus, unsigned int bus_offset,
+			 unsigned int num_to_write, unsigned int index)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	uint8_t *src;
 	uint8_t *target = dst;
-	unsigned int fr_written, fr_read;
+	unsigned int fr_written, fr_read, fr_silent;
 	unsigned int buffer_offset;
 	int fr_in_buf;
 	unsigned int num_samples;
 	size_t frames = 0;
 	unsigned int dev_frames;
+	unsigned int in_frame_bytes, out_frame_bytes;
 	float mix_vol;
+	int conv_needed, resampling, mute, shared;
+	const struct cras_audio_format *src_fmt = fmt;
+	cras_mix_add_func mix_add;
 
 	fr_in_buf = dev_stream_playback_frames(dev_stream);
 	if (fr_in_buf <= 0)
@@ -200,35 +1311,284 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 	/* Stream volume scaler. */
 	mix_vol = cras_rstream_get_volume_scaler(dev_stream->stream);
 
+	/* Blocks of a muted stream, or of digital silence, are mixed as
+	 * silence without being converted. Only a resampler has to see them,
+	 * to keep its history and position in step with the stream. */
+	mute = dev_stream->held || cras_rstream_get_mute(rstream) ||
+	       mix_vol < CRAS_MIX_MIN_VOLUME;
+	conv_needed = cras_fmt_conversion_needed(dev_stream->conv);
+	if (bus && conv_needed && mixes_float_direct(dev_stream)) {
+		src_fmt = &rstream->format;
+		conv_needed = 0;
+	}
+	resampling = conv_needed && cras_fmt_conv_resampling(dev_stream->conv);
+	in_frame_bytes = cras_get_format_bytes(
+		conv_needed ? cras_fmt_conv_in_format(dev_stream->conv) :
+			      src_fmt);
+	out_frame_bytes = cras_get_format_bytes(fmt);
+	shared = playback_conv_active(dev_stream);
+	mix_add = bus ? NULL : cras_mix_get_add(fmt->format);
+
 	fr_written = 0;
 	fr_read = 0;
+	fr_silent = 0;
 	while (fr_written < num_to_write) {
+		unsigned int left = num_to_write - fr_written;
 		unsigned int read_frames;
+		int silent = mute;
+
+		if (shared) {
+			src = playback_conv_get(dev_stream,
+						buffer_offset + fr_read, left,
+						mute, &dev_frames);
+			if (dev_frames == 0)
+				break;
+			if (!silent)
+				silent = cras_mix_buffer_is_zero(
+					src, dev_frames * out_frame_bytes);
+		} else {
+			src = cras_rstream_get_readable_frames(
+				rstream, buffer_offset + fr_read, &frames);
+			if (frames == 0)
+				break;
+			if (!silent && !resampling)
+				silent = cras_mix_buffer_is_zero(
+					src, MIN(frames, left) * in_frame_bytes);
+			if (conv_needed && (resampling || !silent)) {
+				read_frames = frames;
+				dev_frames = cras_fmt_conv_convert_frames(
+					dev_stream->conv, src,
+					dev_stream->conv_buffer->bytes,
+					&read_frames, left);
+				src = dev_stream->conv_buffer->bytes;
+				if (!silent && resampling)
+					silent = cras_mix_buffer_is_zero(
+						src,
+						dev_frames * out_frame_bytes);
+			} else {
+				dev_frames = MIN(frames, left);
+				read_frames = dev_frames;
+			}
+		}
+		/* The mixers don't read src for a muted block, they only
+		 * clear the destination if it is written first. */
+		loopback_tap_mix_stream(dev_stream->dev_id, rstream, fmt, src,
+					dev_frames, silent, mix_vol);
+		if (bus) {
+			float *fp[bus->num_channels];
+
+			cras_mix_add_planar(
+				src_fmt->format,
+				mix_bus_planes_at(bus, bus_offset + fr_written,
+						  fp),
+				src, fmt->num_channels, dev_frames, index,
+				silent, mix_vol);
+		} else {
+			num_samples = dev_frames * fmt->num_channels;
+			mix_add(target, src, num_samples, index, silent,
+				mix_vol);
+			target += dev_frames * out_frame_bytes;
+		}
+		if (shared)
+			read_frames = playback_conv_put(dev_stream, dev_frames);
+		if (silent)
+			fr_silent += dev_frames;
+		fr_written += dev_frames;
+		fr_read += read_frames;
+	}
+
+	cras_rstream_dev_offset_update(rstream, fr_read, dev_stream->dev_id);
+	ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, fr_written, fr_read,
+	      fr_silent);
+
+	return fr_written;
+}
+
+int dev_stream_mix(struct dev_stream *dev_stream,
+		   const struct cras_audio_format *fmt, uint8_t *dst,
+		   unsigned int num_to_write)
+{
+	return render_frames(dev_stream, fmt, dst, NULL, 0, num_to_write, 1);
+}
+
+int dev_stream_copy(struct dev_stream *dev_stream,
+		    const struct cras_audio_format *fmt, uint8_t *dst,
+		    unsigned int num_to_write)
+{
+	return render_frames(dev_stream, fmt, dst, NULL, 0, num_to_write, 0);
+}
+
+int dev_stream_mix_bus(struct dev_stream *dev_stream,
+		       const struct cras_audio_format *fmt,
+		       struct mix_bus *bus, unsigned int offset,
+		       unsigned int num_to_write, unsigned int index)
+{
+	return render_frames(dev_stream, fmt, NULL, bus, offset, num_to_write,
+			     index);
+}
+
+int dev_stream_passthrough(struct dev_stream *dev_stream, uint8_t *dst,
+			   unsigned int num_to_write)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	unsigned int frame_bytes = cras_get_format_bytes(&rstream->format);
+	unsigned int buffer_offset, fr_written = 0;
+	size_t frames;
+	uint8_t *src;
+	int fr_in_buf;
+
+	fr_in_buf = dev_stream_playback_frames(dev_stream);
+	if (fr_in_buf <= 0)
+		return fr_in_buf;
+	if (fr_in_buf < num_to_write)
+		num_to_write = fr_in_buf;
+
+	buffer_offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+	while (fr_written < num_to_write) {
 		src = cras_rstream_get_readable_frames(
-			rstream, buffer_offset + fr_read, &frames);
+			rstream, buffer_offset + fr_written, &frames);
 		if (frames == 0)
 			break;
-		if (cras_fmt_conversion_needed(dev_stream->conv)) {
-			read_frames = frames;
+		frames = MIN(frames, num_to_write - fr_written);
+		memcpy(dst + fr_written * frame_bytes, src,
+		       frames * frame_bytes);
+		fr_written += frames;
+	}
+
+	cras_rstream_dev_offset_update(rstream, fr_written, dev_stream->dev_id);
+	ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, fr_written, fr_written, 0);
+
+	return fr_written;
+}
+
+int dev_stream_can_submix(const struct dev_stream *dev_stream)
+{
+	const struct cras_rstream *stream = dev_stream->stream;
+
+	return dev_stream->mix_group && dev_stream->mix_group->conv &&
+	       !dev_stream->held &&
+	       !playback_conv_active(dev_stream) &&
+	       dev_stream->dev_id == stream->main_dev.dev_id &&
+	       !loopback_tap_keeps_stream(dev_stream->dev_id, stream);
+}
+
+struct dev_stream *const *
+dev_stream_mix_group(const struct dev_stream *dev_stream,
+		     unsigned int *num_streams)
+{
+	*num_streams = dev_stream->mix_group ?
+			       dev_stream->mix_group->num_streams :
+			       0;
+	return *num_streams ? dev_stream->mix_group->streams : NULL;
+}
+
+int dev_stream_mix_submix(struct dev_stream *const *streams,
+			  unsigned int num_streams,
+			  const struct cras_audio_format *fmt, uint8_t *dst,
+			  struct mix_bus *bus, unsigned int bus_offset,
+			  unsigned int num_to_write, unsigned int index)
+{
+	struct mix_group *mg = streams[0]->mix_group;
+	const struct cras_audio_format *in_fmt = &mg->stream_fmt;
+	size_t in_frame_bytes = cras_get_format_bytes(in_fmt);
+	size_t out_frame_bytes = cras_get_format_bytes(fmt);
+	int resampling = cras_fmt_conv_resampling(mg->conv);
+	cras_mix_add_func mix_add = bus ? NULL : cras_mix_get_add(fmt->format);
+	unsigned int offsets[num_streams];
+	uint8_t *srcs[num_streams];
+	float vols[num_streams];
+	int mutes[num_streams];
+	unsigned int fr_written = 0, fr_read = 0, fr_silent = 0;
+	unsigned int i;
+	int fr_in_buf;
+
+	for (i = 0; i < num_streams; i++) {
+		struct cras_rstream *rstream = streams[i]->stream;
+
+		fr_in_buf = dev_stream_playback_frames(streams[i]);
+		if (fr_in_buf <= 0)
+			return fr_in_buf;
+		num_to_write = MIN(num_to_write, fr_in_buf);
+		offsets[i] = cras_rstream_dev_offset(rstream,
+						     streams[i]->dev_id);
+		vols[i] = cras_rstream_get_volume_scaler(rstream);
+		mutes[i] = cras_rstream_get_mute(rstream) ||
+			   vols[i] < CRAS_MIX_MIN_VOLUME;
+	}
+
+	while (fr_written < num_to_write) {
+		unsigned int left = num_to_write - fr_written;
+		unsigned int in_frames, read_frames, dev_frames;
+		int silent = 1, mute;
+		uint8_t *src;
+		size_t frames;
+
+		/* Sum as many stream frames as the conversion takes. */
+		in_frames = MIN(mg->max_frames,
+				cras_fmt_conv_out_frames_to_in(mg->conv, left));
+		for (i = 0; i < num_streams; i++) {
+			srcs[i] = cras_rstream_get_readable_frames(
+				streams[i]->stream, offsets[i] + fr_read,
+				&frames);
+			in_frames = MIN(in_frames, frames);
+		}
+		if (in_frames == 0)
+			break;
+		for (i = 0; i < num_streams; i++) {
+			mute = mutes[i] ||
+			       cras_mix_buffer_is_zero(
+				       srcs[i], in_frames * in_frame_bytes);
+			mg->submix_add(mg->submix, srcs[i],
+				       in_frames * in_fmt->num_channels, i,
+				       mute, vols[i]);
+			silent = silent && mute;
+		}
+
+		/* Like for a single stream, only a resampler has to see a
+		 * silent submix. */
+		src = mg->out;
+		if (resampling || !silent) {
+			read_frames = in_frames;
 			dev_frames = cras_fmt_conv_convert_frames(
-				dev_stream->conv, src,
-				dev_stream->conv_buffer->bytes, &read_frames,
-				num_to_write - fr_written);
-			src = dev_stream->conv_buffer->bytes;
+				mg->conv, mg->submix, mg->out, &read_frames,
+				MIN(left, mg->max_frames));
+			if (!silent && resampling)
+				silent = cras_mix_buffer_is_zero(
+					src, dev_frames * out_frame_bytes);
 		} else {
-			dev_frames = MIN(frames, num_to_write - fr_written);
+			dev_frames = MIN(in_frames, left);
 			read_frames = dev_frames;
 		}
-		num_samples = dev_frames * fmt->num_channels;
-		cras_mix_add(fmt->format, target, src, num_samples, 1,
-			     cras_rstream_get_mute(rstream), mix_vol);
-		target += dev_frames * cras_get_format_bytes(fmt);
+		if (read_frames == 0 && dev_frames == 0)
+			break;
+
+		if (bus) {
+			float *fp[bus->num_channels];
+
+			cras_mix_add_planar(
+				fmt->format,
+				mix_bus_planes_at(bus, bus_offset + fr_written,
+						  fp),
+				src, fmt->num_channels, dev_frames, index,
+				silent, 1.0f);
+		} else {
+			mix_add(dst + fr_written * out_frame_bytes, src,
+				dev_frames * fmt->num_channels, index, silent,
+				1.0f);
+		}
+		if (silent)
+			fr_silent += dev_frames;
 		fr_written += dev_frames;
 		fr_read += read_frames;
 	}
 
-	cras_rstream_dev_offset_update(rstream, fr_read, dev_stream->dev_id);
-	ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, fr_written, fr_read, 0);
+	for (i = 0; i < num_streams; i++) {
+		cras_rstream_dev_offset_update(streams[i]->stream, fr_read,
+					       streams[i]->dev_id);
+		streams[i]->submix_frames = fr_written;
+	}
+	ATLOG(atlog, AUDIO_THREAD_DEV_STREAM_MIX, fr_written, fr_read,
+	      fr_silent);
 
 	return fr_written;
 }
@@ -275,6 +1635,32 @@ static unsigned int capture_with_fmt_conv(struct dev_stream *dev_stream,
 	return total_read;
 }
 
+/* Copies frames of converted samples to the stream shm at the stream's
+ * offset for this device, and moves that offset forward. */
+static void capture_copy_frames(struct dev_stream *dev_stream,
+				struct cras_rstream *rstream,
+				const struct cras_audio_format *fmt,
+				uint8_t *stream_samples,
+				uint8_t *converted_samples, unsigned int frames,
+				float software_gain_scaler)
+{
+	unsigned int offset =
+		cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+
+	cras_audio_area_config_buf_pointers(dev_stream->conv_area, fmt,
+					    converted_samples);
+	cras_audio_area_config_channels(dev_stream->conv_area, fmt);
+	dev_stream->conv_area->frames = frames;
+
+	cras_audio_area_config_buf_pointers(rstream->audio_area,
+					    &rstream->format, stream_samples);
+
+	cras_audio_area_copy(rstream->audio_area, offset, &rstream->format,
+			     dev_stream->conv_area, 0, software_gain_scaler);
+
+	cras_rstream_dev_offset_update(rstream, frames, dev_stream->dev_id);
+}
+
 /* Copy from the converted buffer to the stream shm.  These have the same format
  * at this point. */
 static unsigned int
@@ -314,24 +1700,13 @@ capture_copy_converted_to_stream(struct dev_stream *dev_stream,
 		write_frames /= frame_bytes;
 		write_frames = MIN(write_frames, num_frames - total_written);
 
-		cras_audio_area_config_buf_pointers(dev_stream->conv_area, fmt,
-						    converted_samples);
-		cras_audio_area_config_channels(dev_stream->conv_area, fmt);
-		dev_stream->conv_area->frames = write_frames;
-
-		cras_audio_area_config_buf_pointers(
-			rstream->audio_area, &rstream->format, stream_samples);
-
-		cras_audio_area_copy(rstream->audio_area, offset,
-				     &rstream->format, dev_stream->conv_area, 0,
-				     software_gain_scaler);
+		capture_copy_frames(dev_stream, rstream, fmt, stream_samples,
+				    converted_samples, write_frames,
+				    software_gain_scaler);
 
 		buf_increment_read(dev_stream->conv_buffer,
 				   (size_t)write_frames * (size_t)frame_bytes);
 		total_written += write_frames;
-		cras_rstream_dev_offset_update(rstream, write_frames,
-					       dev_stream->dev_id);
-		offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
 	}
 
 	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id,
@@ -339,6 +1714,96 @@ capture_copy_converted_to_stream(struct dev_stream *dev_stream,
 	return total_written;
 }
 
+/* Copy the frames this stream hasn't read yet from the ring of its shared
+ * converter to the stream shm. */
+static unsigned int capture_copy_shared_to_stream(struct dev_stream *dev_stream,
+						  struct cras_rstream *rstream,
+						  float software_gain_scaler)
+{
+	struct capture_conv *cc = dev_stream->shared_conv;
+	const struct cras_audio_format *fmt =
+		cras_fmt_conv_out_format(cc->conv);
+	struct cras_audio_shm *shm;
+	uint8_t *stream_samples;
+	unsigned int num_frames;
+	unsigned int total_written = 0;
+	unsigned int write_frames;
+	unsigned int offset;
+
+	shm = cras_rstream_shm(rstream);
+	offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+
+	stream_samples = cras_shm_get_writeable_frames(
+		shm, cras_rstream_get_cb_threshold(rstream),
+		&rstream->audio_area->frames);
+	num_frames = MIN(rstream->audio_area->frames - offset,
+			 cc->written - dev_stream->shared_read);
+
+	ATLOG(atlog, AUDIO_THREAD_CONV_COPY, shm->header->write_buf_idx,
+	      rstream->audio_area->frames, offset);
+
+	while (total_written < num_frames) {
+		write_frames = cc->capacity -
+			       dev_stream->shared_read % cc->capacity;
+		write_frames = MIN(write_frames, num_frames - total_written);
+
+		capture_copy_frames(
+			dev_stream, rstream, fmt, stream_samples,
+			capture_conv_ring_at(cc, dev_stream->shared_read),
+			write_frames, software_gain_scaler);
+
+		dev_stream->shared_read += write_frames;
+		total_written += write_frames;
+	}
+
+	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id,
+	      total_written, cras_shm_frames_written(shm));
+	return total_written;
+}
+
+/*
+ * Captures through the converter shared with other streams. The first stream
+ * of the converter which captured before leads: when it captures it converts
+ * as many device frames as the most any stream can take. Being first in the
+ * device's stream list too, it does so before the others copy. Returns the
+ * number of device frames the stream is done with, which keeps the offsets
+ * of all the streams where conversion stopped.
+ */
+static unsigned int capture_shared(struct dev_stream *dev_stream,
+				   const struct cras_audio_area *area,
+				   unsigned int area_offset,
+				   float software_gain_scaler)
+{
+	struct capture_conv *cc = dev_stream->shared_conv;
+	struct dev_stream *leader = dev_stream;
+	unsigned int i, fr_to_capture = 0;
+
+	for (i = 0; i < cc->num_streams; i++) {
+		if (cc->streams[i]->shared_synced) {
+			leader = cc->streams[i];
+			break;
+		}
+	}
+	dev_stream->shared_synced = 1;
+
+	if (leader == dev_stream) {
+		cc->in_offset = area_offset;
+		for (i = 0; i < cc->num_streams; i++)
+			fr_to_capture =
+				MAX(fr_to_capture,
+				    dev_stream_capture_avail(cc->streams[i]));
+		if (area_offset < area->frames)
+			capture_conv_convert(
+				cc, area,
+				MIN(fr_to_capture, area->frames - area_offset));
+	}
+
+	capture_copy_shared_to_stream(dev_stream, dev_stream->stream,
+				      software_gain_scaler);
+
+	return cc->in_offset > area_offset ? cc->in_offset - area_offset : 0;
+}
+
 unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 				const struct cras_audio_area *area,
 				unsigned int area_offset,
@@ -349,10 +1814,19 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 	uint8_t *stream_samples;
 	unsigned int nread;
 
+	if (dev_stream->shared_conv)
+		return capture_shared(dev_stream, area, area_offset,
+				      software_gain_scaler);
+
 	/* Check if format conversion is needed. */
 	if (cras_fmt_conversion_needed(dev_stream->conv)) {
 		unsigned int format_bytes, fr_to_capture;
 
+		/* The converter takes what it can of the gain while mixing
+		 * channels, the copy to the shm applies the rest. */
+		software_gain_scaler = cras_fmt_conv_set_gain(
+			dev_stream->conv, software_gain_scaler);
+
 		fr_to_capture = dev_stream_capture_avail(dev_stream);
 		fr_to_capture = MIN(fr_to_capture, area->frames - area_offset);
 
@@ -390,6 +1864,67 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 	return nread;
 }
 
+/* Writes up to frames of zeros to the stream shm at the stream's offset for
+ * this device, and moves that offset forward. */
+static unsigned int capture_zeros_to_stream(struct dev_stream *dev_stream,
+					    struct cras_rstream *rstream,
+					    unsigned int frames)
+{
+	struct cras_audio_shm *shm = cras_rstream_shm(rstream);
+	unsigned int frame_bytes = cras_get_format_bytes(&rstream->format);
+	unsigned int offset =
+		cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+	uint8_t *stream_samples;
+
+	stream_samples = cras_shm_get_writeable_frames(
+		shm, cras_rstream_get_cb_threshold(rstream),
+		&rstream->audio_area->frames);
+	if (rstream->audio_area->frames <= offset)
+		return 0;
+	frames = MIN(frames, rstream->audio_area->frames - offset);
+
+	memset(stream_samples + offset * frame_bytes, 0, frames * frame_bytes);
+
+	ATLOG(atlog, AUDIO_THREAD_CAPTURE_WRITE, rstream->stream_id, frames,
+	      cras_shm_frames_written(shm));
+	cras_rstream_dev_offset_update(rstream, frames, dev_stream->dev_id);
+	return frames;
+}
+
+unsigned int dev_stream_capture_silence(struct dev_stream *dev_stream,
+					unsigned int frames,
+					float software_gain_scaler)
+{
+	struct cras_rstream *rstream = dev_stream->stream;
+	unsigned int offset, written;
+
+	if (!cras_fmt_conversion_needed(dev_stream->conv))
+		return capture_zeros_to_stream(dev_stream, rstream, frames);
+
+	/* Frames converted before the input went silent go out first. */
+	software_gain_scaler =
+		cras_fmt_conv_set_gain(dev_stream->conv, software_gain_scaler);
+	capture_copy_converted_to_stream(dev_stream, rstream,
+					 software_gain_scaler);
+	if (buf_queued(dev_stream->conv_buffer))
+		return 0;
+
+	offset = cras_rstream_dev_offset(rstream, dev_stream->dev_id);
+	cras_shm_get_writeable_frames(cras_rstream_shm(rstream),
+				      cras_rstream_get_cb_threshold(rstream),
+				      &rstream->audio_area->frames);
+	if (rstream->audio_area->frames <= offset)
+		return 0;
+
+	frames = MIN(frames, cras_fmt_conv_out_frames_to_in(
+				     dev_stream->conv,
+				     rstream->audio_area->frames - offset));
+	written = capture_zeros_to_stream(
+		dev_stream, rstream,
+		cras_fmt_conv_in_frames_to_out(dev_stream->conv, frames));
+	return written ? frames : 0;
+}
+
 int dev_stream_attached_devs(const struct dev_stream *dev_stream)
 {
 	return dev_stream->stream->num_attached_devs;
@@ -412,9 +1947,25 @@ int dev_stream_playback_frames(const struct dev_stream *dev_stream)
 	if (!dev_stream->conv)
 		return frames;
 
+	/* The frames converted for the shared converter and not yet read by
+	 * this device, and the stream frames after them. */
+	if (playback_conv_active(dev_stream)) {
+		const struct playback_conv *pc = dev_stream->play_conv;
+		uint64_t converted = pc->in_pos - dev_stream->play_in;
+
+		frames -= MIN((uint64_t)frames, converted);
+		return pc->written - dev_stream->play_read +
+		       cras_fmt_conv_in_frames_to_out(pc->conv, frames);
+	}
+
 	return cras_fmt_conv_in_frames_to_out(dev_stream->conv, frames);
 }
 
+size_t dev_stream_mem_bytes(const struct dev_stream *dev_stream)
+{
+	return dev_stream->conv_buffer->max_size;
+}
+
 unsigned int dev_stream_cb_threshold(const struct dev_stream *dev_stream)
 {
 	const struct cras_rstream *rstream = dev_stream->stream;
@@ -434,8 +1985,10 @@ unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream)
 	struct cras_rstream *rstream = dev_stream->stream;
 	unsigned int frames_avail;
 	unsigned int conv_buf_level;
+	unsigned int conv_buf_avail;
 	unsigned int format_bytes;
 	unsigned int wlimit;
+	struct capture_conv *cc;
 	unsigned int dev_offset =
 		cras_rstream_dev_offset(rstream, dev_stream->dev_id);
 
@@ -453,15 +2006,23 @@ unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream)
 
 	/* Sample rate conversion may cause some sample left in conv_buffer
 	 * take this buffer into account. */
-	conv_buf_level = buf_queued(dev_stream->conv_buffer) / format_bytes;
+	if (dev_stream->shared_conv) {
+		cc = dev_stream->shared_conv;
+		conv_buf_level = cc->written - dev_stream->shared_read;
+		conv_buf_avail = cc->capacity -
+				 (cc->written - capture_conv_min_read(cc));
+	} else {
+		conv_buf_level =
+			buf_queued(dev_stream->conv_buffer) / format_bytes;
+		conv_buf_avail =
+			buf_available(dev_stream->conv_buffer) / format_bytes;
+	}
 	if (frames_avail <= conv_buf_level)
 		return 0;
 	else
 		frames_avail -= conv_buf_level;
 
-	frames_avail =
-		MIN(frames_avail,
-		    buf_available(dev_stream->conv_buffer) / format_bytes);
+	frames_avail = MIN(frames_avail, conv_buf_avail);
 
 	return cras_fmt_conv_out_frames_to_in(dev_stream->conv, frames_avail);
 }
@@ -577,36 +2138,54 @@ void cras_set_playback_timestamp(size_t frame_rate, size_t frames,
 	}
 }
 
-void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
-				struct cras_timespec *ts)
+/* Fills ts with the time frames before level_ts, or before now if the
+ * device didn't tell when it measured its level. The interval is computed
+ * exactly, so the time of a long backlog, like the audio a hotword device
+ * buffered before the trigger, doesn't drift with its length. */
+static void set_capture_timestamp_at(const struct timespec *level_ts,
+				     size_t frame_rate, size_t frames,
+				     struct cras_timespec *ts)
 {
-	long tmp;
+	struct timespec when, delay, captured;
 
-	cras_clock_gettime(CLOCK_MONOTONIC_RAW, ts);
+	if (level_ts && timespec_is_nonzero(level_ts))
+		when = *level_ts;
+	else
+		clock_gettime(CLOCK_MONOTONIC_RAW, &when);
 
-	/* For capture, now - samples left to be read.
+	/* For capture, time of the level - samples left to be read.
 	 * ts = time next sample to be read was captured at ADC.
 	 */
-	tmp = frames * (1000000000L / frame_rate);
-	while (tmp > 1000000000L) {
-		tmp -= 1000000000L;
-		ts->tv_sec--;
-	}
-	if (ts->tv_nsec >= tmp)
-		ts->tv_nsec -= tmp;
-	else {
-		tmp -= ts->tv_nsec;
-		ts->tv_nsec = 1000000000L - tmp;
-		ts->tv_sec--;
-	}
+	cras_frames_to_time(frames, frame_rate, &delay);
+	subtract_timespecs(&when, &delay, &captured);
+	ts->tv_sec = captured.tv_sec;
+	ts->tv_nsec = captured.tv_nsec;
+}
+
+void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
+				struct cras_timespec *ts)
+{
+	set_capture_timestamp_at(NULL, frame_rate, frames, ts);
 }
 
-void dev_stream_set_delay(const struct dev_stream *dev_stream,
-			  unsigned int delay_frames)
+void dev_stream_set_delay(struct dev_stream *dev_stream,
+			  const struct dev_stream_delay *delay,
+			  const struct timespec *level_ts)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
 	struct cras_audio_shm *shm;
-	unsigned int stream_frames;
+	unsigned int stream_frames, delay_frames;
+	size_t conv_frames;
+
+	/* The converter counts its delay at its input, the stream rate for
+	 * playback and the device rate for capture. */
+	conv_frames = cras_fmt_conv_delay_frames(dev_stream->conv);
+	if (conv_frames && rstream->direction == CRAS_STREAM_OUTPUT)
+		conv_frames = cras_fmt_conv_in_frames_to_out(dev_stream->conv,
+							     conv_frames);
+	dev_stream->delay = *delay;
+	dev_stream->delay.conv = conv_frames;
+	delay_frames = dev_stream_delay_frames(dev_stream);
 
 	if (rstream->direction == CRAS_STREAM_OUTPUT) {
 		shm = cras_rstream_shm(rstream);
@@ -621,9 +2200,10 @@ void dev_stream_set_delay(const struct dev_stream *dev_stream,
 		stream_frames = cras_fmt_conv_in_frames_to_out(dev_stream->conv,
 							       delay_frames);
 		if (cras_shm_frames_written(shm) == 0)
-			cras_set_capture_timestamp(rstream->format.frame_rate,
-						   stream_frames,
-						   &shm->header->ts);
+			set_capture_timestamp_at(level_ts,
+						 rstream->format.frame_rate,
+						 stream_frames,
+						 &shm->header->ts);
 	}
 }
 
@@ -659,6 +2239,17 @@ int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream)
 	return stream->fd;
 }
 
+int dev_stream_wake_stream_fd(const struct dev_stream *dev_stream)
+{
+	const struct cras_rstream *stream = dev_stream->stream;
+
+	if (stream_uses_input(stream) && (stream->flags & USE_DEV_TIMING))
+		return stream->fd;
+	if (stream_uses_output(stream))
+		return stream->fd;
+	return -1;
+}
+
 /*
  * Gets proper wake up time for an input stream. It considers both
  * time for samples to reach one callback level, and the time for next callback.
@@ -669,7 +2260,8 @@ int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream)
 static int get_input_wake_time(struct dev_stream *dev_stream,
 			       unsigned int curr_level,
 			       struct timespec *level_tstamp,
-			       unsigned int cap_limit, int is_cap_limit_stream,
+			       double dev_rate_ratio, unsigned int cap_limit,
+			       int is_cap_limit_stream,
 			       struct timespec *wake_time_out)
 {
 	struct cras_rstream *rstream = dev_stream->stream;
@@ -732,8 +2324,9 @@ static int get_input_wake_time(struct dev_stream *dev_stream,
 	else
 		needed_frames_from_device -= curr_level;
 
-	cras_frames_to_time(needed_frames_from_device, dev_stream->dev_rate,
-			    &time_for_sample);
+	cras_frames_to_time_precise(needed_frames_from_device,
+				    dev_stream->dev_rate * dev_rate_ratio,
+				    &time_for_sample);
 
 	add_timespecs(&time_for_sample, level_tstamp);
 
@@ -753,8 +2346,8 @@ static int get_input_wake_time(struct dev_stream *dev_stream,
 }
 
 int dev_stream_wake_time(struct dev_stream *dev_stream, unsigned int curr_level,
-			 struct timespec *level_tstamp, unsigned int cap_limit,
-			 int is_cap_limit_stream,
+			 struct timespec *level_tstamp, double dev_rate_ratio,
+			 unsigned int cap_limit, int is_cap_limit_stream,
 			 struct timespec *wake_time_out)
 {
 	if (dev_stream->stream->direction == CRAS_STREAM_OUTPUT) {
@@ -767,8 +2360,8 @@ int dev_stream_wake_time(struct dev_stream *dev_stream, unsigned int curr_level,
 	}
 
 	return get_input_wake_time(dev_stream, curr_level, level_tstamp,
-				   cap_limit, is_cap_limit_stream,
-				   wake_time_out);
+				   dev_rate_ratio, cap_limit,
+				   is_cap_limit_stream, wake_time_out);
 }
 
 int dev_stream_is_pending_reply(const struct dev_stream *dev_stream)
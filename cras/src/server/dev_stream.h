@@ -12,12 +12,35 @@
 #include <stdint.h>
 #include <sys/time.h>
 
+#include "cras_fmt_conv.h"
 #include "cras_types.h"
 #include "cras_rstream.h"
 
+struct capture_conv;
+struct playback_conv;
 struct cras_audio_area;
 struct cras_fmt_conv;
 struct cras_iodev;
+struct mix_bus;
+struct mix_group;
+
+/*
+ * The delays the audio of a stream goes through outside its own buffer, in
+ * frames at the device rate. Each stage reports its part, the sum times the
+ * shm timestamp and the parts are shown in the stream's debug info.
+ *    device - Queued in or past the device, like the frames in the hardware
+ *             buffer or sent to a Bluetooth controller.
+ *    dsp - Added by the DSP pipeline and offload of the device.
+ *    conv - Added by the sample rate converter of the stream, filled in by
+ *           dev_stream_set_delay().
+ *    processing - Added by the input processing of the stream, like the APM.
+ */
+struct dev_stream_delay {
+	unsigned int device;
+	unsigned int dsp;
+	unsigned int conv;
+	unsigned int processing;
+};
 
 /*
  * Linked list of streams of audio from/to a client.
@@ -33,6 +56,37 @@ struct cras_iodev;
  *                 into device. For output stream, it should be set to true
  *                 just before its first fetch to avoid affecting other existing
  *                 streams.
+ *    stage_hist - Time spent on this stream in each DEV_IO_STAGE of the
+ *                 wakes it took part in.
+ *    shared_conv - For input, the converter this stream shares with the other
+ *                  streams of the device converting to the same format, used
+ *                  instead of conv and conv_buffer. NULL if not shared.
+ *    shared_read - The number of frames this stream has read from the output
+ *                  of shared_conv.
+ *    shared_synced - Set once the stream has captured through shared_conv,
+ *                    its device offset then follows the shared one.
+ *    play_conv - For output, the converter this stream shares with the
+ *                streams of the same rstream on other devices of the same
+ *                format. Used instead of conv and conv_buffer once a second
+ *                stream joins it. NULL if no conversion is needed.
+ *    play_read - The number of frames this stream has read from the output
+ *                of play_conv.
+ *    play_in - The number of rstream frames converted by play_conv that
+ *              were counted as read by this stream's device.
+ *    play_block - The first block of play_conv output not fully read.
+ *    mix_group - For output, the group of streams on the device in the same
+ *                format, converted together as one submix. NULL if no
+ *                conversion is needed.
+ *    submix_frames - The frames its mix group mixed for this stream in the
+ *                    current write, 0 if it still has to be mixed.
+ *    shed - Non-zero while the stream is degraded to save CPU, see
+ *           dev_stream_set_shed().
+ *    wake_ts - For input, the wake time last asked for by the stream, zero
+ *              if it didn't need one. Used to coalesce the wakes of the
+ *              streams on a device.
+ *    delay - The delays last passed to dev_stream_set_delay().
+ *    held - For output, non-zero while the stream is played as silence
+ *           because of a PASSTHROUGH stream, see cras_iodev.passthrough.
  */
 struct dev_stream {
 	unsigned int dev_id;
@@ -44,6 +98,20 @@ struct dev_stream {
 	size_t dev_rate;
 	struct dev_stream *prev, *next;
 	int is_running;
+	struct cras_latency_hist stage_hist[CRAS_NUM_DEV_IO_STAGES];
+	struct capture_conv *shared_conv;
+	unsigned int shared_read;
+	int shared_synced;
+	struct playback_conv *play_conv;
+	uint64_t play_read;
+	uint64_t play_in;
+	uint64_t play_block;
+	struct mix_group *mix_group;
+	unsigned int submix_frames;
+	int shed;
+	struct timespec wake_ts;
+	struct dev_stream_delay delay;
+	int held;
 };
 
 /*
@@ -69,6 +137,41 @@ struct dev_stream *dev_stream_create(struct cras_rstream *stream,
 				     const struct timespec *sleep_interval_ts);
 void dev_stream_destroy(struct dev_stream *dev_stream);
 
+/*
+ * Builds the format converter and conversion buffer of a dev_stream ahead
+ * of attaching it, so the audio thread only has to link it to the device.
+ * Safe to call off the audio thread.
+ *
+ * Args:
+ *    stream - The associated rstream.
+ *    dev_fmt - The format of the device.
+ * Returns the unattached dev_stream, or NULL if it can't be prepared, like
+ * for input streams with APM, which dev_stream_create has to handle.
+ */
+struct dev_stream *dev_stream_prepare(struct cras_rstream *stream,
+				      const struct cras_audio_format *dev_fmt);
+
+/*
+ * Attaches a dev_stream from dev_stream_prepare to its device. Args as in
+ * dev_stream_create.
+ * Returns 0 on success, -EINVAL if the device format changed since the
+ * preparation. The dev_stream is then left for dev_stream_discard.
+ */
+int dev_stream_attach(struct dev_stream *dev_stream, unsigned int dev_id,
+		      const struct cras_audio_format *dev_fmt, void *dev_ptr,
+		      struct timespec *cb_ts,
+		      const struct timespec *sleep_interval_ts);
+
+/* Frees a prepared dev_stream that was never attached. */
+void dev_stream_discard(struct dev_stream *dev_stream);
+
+/*
+ * Frees the dev_streams kept for reuse by the calling thread. Destroyed
+ * dev_streams are kept per thread, an audio thread calls this before it
+ * exits.
+ */
+void dev_stream_release_kept();
+
 /*
  * Update the estimated sample rate of the device. For multiple active
  * devices case, the linear resampler will be configured by the estimated
@@ -88,6 +191,36 @@ void dev_stream_set_dev_rate(struct dev_stream *dev_stream,
 			     unsigned int dev_rate, double dev_rate_ratio,
 			     double main_rate_ratio, int coarse_rate_adjust);
 
+/*
+ * Resamples a capture stream on its main device to the clock of a device in
+ * another clock domain, the master. Used when the client pairs the capture
+ * with playback on the master, as echo cancellation needs both on one clock.
+ *
+ * Args:
+ *    dev_stream - The structure holding the stream.
+ *    dev_rate - The sample rate device is using.
+ *    dev_rate_ratio - The ratio of estimated rate and used rate.
+ *    master_rate_ratio - The ratio of estimated rate and used rate of
+ *        master device.
+ *    coarse_rate_adjust - The flag to indicate the direction device
+ *        sample rate should adjust to.
+ */
+void dev_stream_set_master_rate(struct dev_stream *dev_stream,
+				unsigned int dev_rate, double dev_rate_ratio,
+				double master_rate_ratio,
+				int coarse_rate_adjust);
+
+/*
+ * Degrades or restores the stream when the audio thread runs short of CPU.
+ * A shed stream resamples through its own converter at low quality, and a
+ * playback stream is fetched further ahead of its callback time, to ride
+ * along with the wakes of other streams.
+ * Args:
+ *    dev_stream - The structure holding the stream.
+ *    shed - Non-zero to degrade the stream, zero to restore it.
+ */
+void dev_stream_set_shed(struct dev_stream *dev_stream, int shed);
+
 /*
  * Renders count frames from shm into dst.  Updates count if anything is
  * written. If it's muted and the only stream zero memory.
@@ -101,6 +234,91 @@ int dev_stream_mix(struct dev_stream *dev_stream,
 		   const struct cras_audio_format *fmt, uint8_t *dst,
 		   unsigned int num_to_write);
 
+/*
+ * Like dev_stream_mix(), but overwrites dst instead of adding to it. Used
+ * when this is the only stream feeding dst, so the stream's frames go from
+ * shm into the device buffer in a single copy, without clearing dst first.
+ * Args:
+ *    dev_stream - The struct holding the stream to copy.
+ *    format - The format of the audio device.
+ *    dst - The destination buffer.
+ *    num_to_write - The number of frames to write.
+ */
+int dev_stream_copy(struct dev_stream *dev_stream,
+		    const struct cras_audio_format *fmt, uint8_t *dst,
+		    unsigned int num_to_write);
+
+/*
+ * Like dev_stream_mix(), but renders into the float mix bus of the device
+ * instead of the device buffer.
+ * Args:
+ *    dev_stream - The struct holding the stream to mix.
+ *    format - The format of the audio device.
+ *    bus - The mix bus to render to.
+ *    offset - The frame of the bus to start writing at.
+ *    num_to_write - The number of frames to write.
+ *    index - If zero the bus is overwritten, like dev_stream_copy().
+ */
+int dev_stream_mix_bus(struct dev_stream *dev_stream,
+		       const struct cras_audio_format *fmt,
+		       struct mix_bus *bus, unsigned int offset,
+		       unsigned int num_to_write, unsigned int index);
+
+/*
+ * Copies the frames of a PASSTHROUGH stream to dst as they are, ignoring
+ * its volume and mute. The device must run at the format of the stream.
+ * Args:
+ *    dev_stream - The stream to copy from.
+ *    dst - The device buffer, at the offset of the stream.
+ *    num_to_write - The number of frames to copy.
+ * Returns:
+ *    The number of frames copied, or a negative error.
+ */
+int dev_stream_passthrough(struct dev_stream *dev_stream, uint8_t *dst,
+			   unsigned int num_to_write);
+
+/*
+ * Returns non-zero if dev_stream can be mixed through the submix of its mix
+ * group, which converts for two streams or more. Streams sharing a
+ * converter with other devices, following the rate of another device, or
+ * looped back on their own are always mixed alone.
+ */
+int dev_stream_can_submix(const struct dev_stream *dev_stream);
+
+/*
+ * Gets the streams of the mix group of dev_stream, dev_stream included.
+ * Returns the array of them, with its size in num_streams, or NULL if the
+ * stream isn't in a group.
+ */
+struct dev_stream *const *
+dev_stream_mix_group(const struct dev_stream *dev_stream,
+		     unsigned int *num_streams);
+
+/*
+ * Mixes streams of one mix group through its submix. The stream frames are
+ * summed with the volume of each stream, then converted once to the device
+ * format and mixed into dst or bus like dev_stream_mix() or
+ * dev_stream_mix_bus(). All the streams move forward by the same frames,
+ * which are set in their submix_frames.
+ * Args:
+ *    streams - The streams to mix, for which dev_stream_can_submix() is true
+ *        and which are at the same offset of the device.
+ *    num_streams - The number of streams.
+ *    format - The format of the audio device.
+ *    dst - The destination buffer, used when bus is NULL.
+ *    bus - The mix bus to render to, or NULL.
+ *    bus_offset - The frame of the bus to start writing at.
+ *    num_to_write - The number of frames to write.
+ *    index - If zero the destination is overwritten.
+ * Returns:
+ *    The number of frames written for each stream, negative on error.
+ */
+int dev_stream_mix_submix(struct dev_stream *const *streams,
+			  unsigned int num_streams,
+			  const struct cras_audio_format *fmt, uint8_t *dst,
+			  struct mix_bus *bus, unsigned int bus_offset,
+			  unsigned int num_to_write, unsigned int index);
+
 /*
  * Reads froms from the source into the dev_stream.
  * Args:
@@ -114,6 +332,21 @@ unsigned int dev_stream_capture(struct dev_stream *dev_stream,
 				unsigned int area_offset,
 				float software_gain_scaler);
 
+/*
+ * Writes zeros to the dev_stream in place of device frames that are
+ * silence, skipping the format conversion.
+ * Args:
+ *    dev_stream - The struct holding the stream to write to.
+ *    frames - The number of device frames available.
+ *    software_gain_scaler - The software gain scaler, for the frames
+ *        converted earlier which are written first.
+ * Returns:
+ *    The number of device frames consumed.
+ */
+unsigned int dev_stream_capture_silence(struct dev_stream *dev_stream,
+					unsigned int frames,
+					float software_gain_scaler);
+
 /* Returns the number of iodevs this stream has attached to. */
 int dev_stream_attached_devs(const struct dev_stream *dev_stream);
 
@@ -133,6 +366,13 @@ int dev_stream_playback_frames(const struct dev_stream *dev_stream);
  */
 unsigned int dev_stream_capture_avail(const struct dev_stream *dev_stream);
 
+/*
+ * Returns the bytes of the conversion buffer of the stream. Scratch space of
+ * the format converter is shared by the thread and a capture converter
+ * shared with other streams isn't counted.
+ */
+size_t dev_stream_mem_bytes(const struct dev_stream *dev_stream);
+
 /*
  * Returns the callback threshold, if necesary converted from a stream frame
  * count to a device frame count.
@@ -162,11 +402,24 @@ void cras_set_capture_timestamp(size_t frame_rate, size_t frames,
 /* Fill shm ts with the time the playback sample will be played or the capture
  * sample was captured depending on the direction of the stream.
  * Args:
- *    delay_frames - The delay reproted by the device, in frames at the device's
- *      sample rate.
+ *    delay - The delays reported by the device and the processing of the
+ *      stream, the delay of the converter of dev_stream is added to them.
+ *    level_ts - When the device measured the delay, used for capture. NULL
+ *      or zero for now.
  */
-void dev_stream_set_delay(const struct dev_stream *dev_stream,
-			  unsigned int delay_frames);
+void dev_stream_set_delay(struct dev_stream *dev_stream,
+			  const struct dev_stream_delay *delay,
+			  const struct timespec *level_ts);
+
+/* Returns the sum of the delays last set on dev_stream, in frames at the
+ * device rate. */
+static inline unsigned int
+dev_stream_delay_frames(const struct dev_stream *dev_stream)
+{
+	const struct dev_stream_delay *d = &dev_stream->delay;
+
+	return d->device + d->dsp + d->conv + d->processing;
+}
 
 /* Ask the client for cb_threshold samples of audio to play. */
 int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
@@ -180,6 +433,9 @@ int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
  *   dev_stream[in]: The dev_stream to check wake up time.
  *   curr_level[in]: The current level of device.
  *   level_tstamp[in]: The time stamp when getting current level of device.
+ *   dev_rate_ratio[in]: The ratio of the estimated rate of the device to its
+ *                       nominal rate, so the wake comes just after the device
+ *                       has really captured the needed frames.
  *   cap_limit[in]: The number of frames that can be captured across all
  *                  streams.
  *   is_cap_limit_stream[in]: 1 if this stream is causing cap_limit.
@@ -189,8 +445,8 @@ int dev_stream_request_playback_samples(struct dev_stream *dev_stream,
  *   A positive value if there is no need to set wake up time for this stream.
  */
 int dev_stream_wake_time(struct dev_stream *dev_stream, unsigned int curr_level,
-			 struct timespec *level_tstamp, unsigned int cap_limit,
-			 int is_cap_limit_stream,
+			 struct timespec *level_tstamp, double dev_rate_ratio,
+			 unsigned int cap_limit, int is_cap_limit_stream,
 			 struct timespec *wake_time_out);
 
 /*
@@ -199,7 +455,14 @@ int dev_stream_wake_time(struct dev_stream *dev_stream, unsigned int curr_level,
  */
 int dev_stream_poll_stream_fd(const struct dev_stream *dev_stream);
 
-static inline int dev_stream_is_running(struct dev_stream *dev_stream)
+/*
+ * Returns a non-negative fd if the stream's replies may need to wake the audio
+ * thread at some point, independent of whether a reply is pending now. Used to
+ * register the fd once, edge triggered, for the life of the stream.
+ */
+int dev_stream_wake_stream_fd(const struct dev_stream *dev_stream);
+
+static inline int dev_stream_is_running(const struct dev_stream *dev_stream)
 {
 	return dev_stream->is_running;
 }
@@ -226,6 +489,19 @@ dev_stream_sleep_interval_ts(struct dev_stream *dev_stream)
 
 int dev_stream_is_pending_reply(const struct dev_stream *dev_stream);
 
+/*
+ * Sets how early, in microseconds, a capture callback may fire ahead of its
+ * time. Called before audio threads start.
+ */
+void dev_stream_set_capture_wake_fuzz_us(unsigned int us);
+
+/*
+ * Sets the resampler quality of streams whose type doesn't pick one. Called
+ * before audio threads start.
+ */
+void dev_stream_set_default_resampler_quality(
+	enum CRAS_RESAMPLER_QUALITY quality);
+
 /*
  * Reads any pending audio message from the socket.
  */
@@ -3,79 +3,154 @@
  * found in the LICENSE file.
  */
 
+#include <math.h>
+#include <sys/param.h>
+
 #include "ewma_power.h"
-#include "math.h"
 
-/* One sample per 1ms. */
-#define EWMA_SAMPLE_RATE 1000
+/* One sample per 1ms by default. */
+#define EWMA_INTERVAL_MS 1
 
-/* Smooth factor for EWMA, 1 - expf(-1.0/(rate * 0.01))
- * where the 0.01 corresponds to 10ms interval that is chosen and
- * being used in Chrome for a long time.
- * Here the |rate| is set to the down sampled EWMA_SAMPLE_RATE and
- * whenever it changes the calculated |smooth_factor| should be updated
- * accordingly.
- */
-const static float smooth_factor = 0.095;
+/* The smoothing time constant. It's 10ms interval that is chosen and
+ * being used in Chrome for a long time. */
+#define EWMA_SMOOTH_MS 10.0f
+
+/* The time the peak takes to fall back by a factor of e, slow enough for a
+ * meter to show it. */
+#define PEAK_RELEASE_MS 300.0f
 
 void ewma_power_disable(struct ewma_power *ewma)
 {
 	ewma->enabled = 0;
 }
 
-void ewma_power_init(struct ewma_power *ewma, unsigned int rate)
+void ewma_power_init(struct ewma_power *ewma, snd_pcm_format_t format,
+		     unsigned int rate)
 {
 	ewma->enabled = 1;
 	ewma->power_set = 0;
-	ewma->step_fr = rate / EWMA_SAMPLE_RATE;
+	ewma->peak = 0.0f;
+	ewma->format = format;
+	ewma->rate = rate;
+	ewma_power_set_interval(ewma, EWMA_INTERVAL_MS);
+}
+
+void ewma_power_set_interval(struct ewma_power *ewma,
+			     unsigned int interval_ms)
+{
+	ewma->step_fr = ewma->rate * interval_ms / 1000;
+	if (ewma->step_fr == 0)
+		ewma->step_fr = 1;
+	/* Smooth factor for EWMA, 1 - expf(-1.0/(rate * 0.01)) where |rate|
+	 * is the down sampled rate of one frame per step_fr. */
+	ewma->smooth_factor =
+		1.0f - expf(-(float)ewma->step_fr * 1000.0f /
+			    ((float)MAX(ewma->rate, 1) * EWMA_SMOOTH_MS));
+	ewma->peak_release =
+		expf(-(float)ewma->step_fr * 1000.0f /
+		     ((float)MAX(ewma->rate, 1) * PEAK_RELEASE_MS));
+}
+
+/* Returns sample i of interleaved buf, in the range [-1.0, 1.0]. */
+static inline float sample_at(const void *buf, snd_pcm_format_t format,
+			      unsigned int i)
+{
+	const uint8_t *p;
+
+	switch (format) {
+	case SND_PCM_FORMAT_U8:
+		return (((const uint8_t *)buf)[i] - 128) / 128.0f;
+	case SND_PCM_FORMAT_S16_LE:
+		return ((const int16_t *)buf)[i] / 32768.0f;
+	case SND_PCM_FORMAT_S24_LE:
+		return (int32_t)(((const uint32_t *)buf)[i] << 8) /
+		       2147483648.0f;
+	case SND_PCM_FORMAT_S24_3LE:
+		p = (const uint8_t *)buf + 3 * i;
+		return (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 |
+				 (uint32_t)p[2] << 24) /
+		       2147483648.0f;
+	case SND_PCM_FORMAT_S32_LE:
+		return ((const int32_t *)buf)[i] / 2147483648.0f;
+	case SND_PCM_FORMAT_FLOAT_LE:
+		return ((const float *)buf)[i];
+	default:
+		return 0.0f;
+	}
+}
+
+static inline void update_power(struct ewma_power *ewma, float power,
+				float peak)
+{
+	ewma->peak = MAX(peak, ewma->peak * ewma->peak_release);
+	if (!ewma->power_set) {
+		ewma->power = power;
+		ewma->power_set = 1;
+	} else {
+		ewma->power = ewma->smooth_factor * power +
+			      (1 - ewma->smooth_factor) * ewma->power;
+	}
 }
 
-void ewma_power_calculate(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate(struct ewma_power *ewma, const void *buf,
 			  unsigned int channels, unsigned int size)
 {
-	int i, ch;
-	float power, f;
+	unsigned int i, ch;
+	float power, peak, f;
 
 	if (!ewma->enabled)
 		return;
-	for (i = 0; i < size; i += ewma->step_fr * channels) {
+	for (i = 0; i < size; i += ewma->step_fr) {
 		power = 0.0f;
+		peak = 0.0f;
 		for (ch = 0; ch < channels; ch++) {
-			f = buf[i + ch] / 32768.0f;
+			f = sample_at(buf, ewma->format, i * channels + ch);
 			power += f * f / channels;
+			peak = MAX(peak, fabsf(f));
 		}
-		if (!ewma->power_set) {
-			ewma->power = power;
-			ewma->power_set = 1;
-		} else {
-			ewma->power = smooth_factor * power +
-				      (1 - smooth_factor) * ewma->power;
-		}
+		update_power(ewma, power, peak);
 	}
 }
 
-void ewma_power_calculate_area(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate_area(struct ewma_power *ewma, const void *buf,
 			       struct cras_audio_area *area, unsigned int size)
 {
-	int i, ch;
-	float power, f;
+	unsigned int i, ch;
+	float power, peak, f;
 
 	if (!ewma->enabled)
 		return;
-	for (i = 0; i < size; i += ewma->step_fr * area->num_channels) {
+	for (i = 0; i < size; i += ewma->step_fr) {
 		power = 0.0f;
+		peak = 0.0f;
 		for (ch = 0; ch < area->num_channels; ch++) {
 			if (area->channels[ch].ch_set == 0)
 				continue;
-			f = buf[i + ch] / 32768.0f;
+			f = sample_at(buf, ewma->format,
+				      i * area->num_channels + ch);
 			power += f * f / area->num_channels;
+			peak = MAX(peak, fabsf(f));
 		}
-		if (!ewma->power_set) {
-			ewma->power = power;
-			ewma->power_set = 1;
-		} else {
-			ewma->power = smooth_factor * power +
-				      (1 - smooth_factor) * ewma->power;
+		update_power(ewma, power, peak);
+	}
+}
+
+void ewma_power_calculate_planar(struct ewma_power *ewma, float *const *planes,
+				 unsigned int channels, unsigned int size)
+{
+	unsigned int i, ch;
+	float power, peak, f;
+
+	if (!ewma->enabled)
+		return;
+	for (i = 0; i < size; i += ewma->step_fr) {
+		power = 0.0f;
+		peak = 0.0f;
+		for (ch = 0; ch < channels; ch++) {
+			f = planes[ch][i];
+			power += f * f / channels;
+			peak = MAX(peak, fabsf(f));
 		}
+		update_power(ewma, power, peak);
 	}
 }
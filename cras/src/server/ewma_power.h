@@ -10,6 +10,7 @@
 #include <stdint.h>
 
 #include "cras_audio_area.h"
+#include "cras_audio_format.h"
 
 /*
  * The exponentially weighted moving average power module used to
@@ -19,13 +20,24 @@
  *    enabled - Flag to enable ewma calculation. Set to false to
  *        make all calculations no-ops.
  *    power - The power value.
+ *    format - The sample format of interleaved audio data.
+ *    rate - The sample rate of the audio data.
  *    step_fr - How many frames to sample one for EWMA calculation.
+ *    smooth_factor - The weight of each new sample, which keeps the
+ *        smoothing time the same whatever step_fr is.
+ *    peak - The largest sample magnitude seen, released over time.
+ *    peak_release - How much of peak is kept at each sampled frame.
  */
 struct ewma_power {
 	bool power_set;
 	bool enabled;
 	float power;
+	snd_pcm_format_t format;
+	unsigned int rate;
 	unsigned int step_fr;
+	float smooth_factor;
+	float peak;
+	float peak_release;
 };
 
 /*
@@ -34,32 +46,59 @@ struct ewma_power {
 void ewma_power_disable(struct ewma_power *ewma);
 
 /*
- * Initializes the ewma_power object.
+ * Initializes the ewma_power object to sample one frame per 1ms.
  * Args:
  *    ewma - The ewma_power object to initialize.
+ *    format - The sample format of the interleaved audio data the ewma
+ *        object will calculate power from.
  *    rate - The sample rate of the audio data that the ewma object
  *        will calculate power from.
  */
-void ewma_power_init(struct ewma_power *ewma, unsigned int rate);
+void ewma_power_init(struct ewma_power *ewma, snd_pcm_format_t format,
+		     unsigned int rate);
+
+/*
+ * Sets how often the ewma_power object samples a frame. A longer interval
+ * makes the calculation cheaper and the power coarser, the smoothing time
+ * stays the same.
+ * Args:
+ *    ewma - The ewma_power object to configure.
+ *    interval_ms - The time between two sampled frames, in milliseconds.
+ */
+void ewma_power_set_interval(struct ewma_power *ewma,
+			     unsigned int interval_ms);
 
 /*
  * Feeds an audio buffer to ewma_power object to calculate the
  * latest power value.
  * Args:
  *    ewma - The ewma_power object to calculate power.
- *    buf - Pointer to the audio data.
+ *    buf - Pointer to the interleaved audio data, in the format given
+ *        to ewma_power_init().
  *    channels - Number of channels of the audio data.
  *    size - Length in frames of the audio data.
  */
-void ewma_power_calculate(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate(struct ewma_power *ewma, const void *buf,
 			  unsigned int channels, unsigned int size);
 
 /*
- * Feeds non-interleaved audio data to ewma_power to calculate the
- * latest power value. This is similar to ewma_power_calculate but
- * accepts cras_audio_area.
+ * Feeds interleaved audio data to ewma_power to calculate the latest
+ * power value, counting only the channels set in area. This is similar
+ * to ewma_power_calculate but accepts cras_audio_area.
  */
-void ewma_power_calculate_area(struct ewma_power *ewma, const int16_t *buf,
+void ewma_power_calculate_area(struct ewma_power *ewma, const void *buf,
 			       struct cras_audio_area *area, unsigned int size);
 
+/*
+ * Feeds non-interleaved float audio data, in the range [-1.0, 1.0], to
+ * ewma_power to calculate the latest power value.
+ * Args:
+ *    ewma - The ewma_power object to calculate power.
+ *    planes - Pointers to the audio data of each channel.
+ *    channels - Number of channels of the audio data.
+ *    size - Length in frames of the audio data.
+ */
+void ewma_power_calculate_planar(struct ewma_power *ewma, float *const *planes,
+				 unsigned int channels, unsigned int size);
+
 #endif /* EWMA_POWER_H_ */
@@ -6,16 +6,30 @@
 #ifndef FLOAT_BUFFER_H_
 #define FLOAT_BUFFER_H_
 
+#include <string.h>
+
 #include "byte_buffer.h"
 
+/* Alignment of the channel planes, enough for any SIMD loads on them. */
+#define FLOAT_BUFFER_ALIGN 64
+
 /*
- * Circular buffer storing deinterleaved floating point data.
+ * Circular buffer storing deinterleaved floating point data. Each channel
+ * is a plane of its own starting on a FLOAT_BUFFER_ALIGN boundary. The
+ * byte_buffer only keeps the positions, counted in frames.
  * Members:
+ *    buf - The read and write positions of the buffer.
+ *    data - The planes, stride floats apart.
+ *    stride - The distance between the starts of two planes, max_size
+ *        rounded up so each plane stays aligned. Twice the plane for a
+ *        mirrored buffer.
  *    fp - Pointer to be filled wtih read/write position of the buffer.
  *    num_channels - Number of channels.
  */
 struct float_buffer {
 	struct byte_buffer *buf;
+	float *data;
+	unsigned int stride;
 	float **fp;
 	unsigned int num_channels;
 };
@@ -29,27 +43,75 @@ struct float_buffer {
 static inline struct float_buffer *
 float_buffer_create(unsigned int max_size, unsigned int num_channels)
 {
+	const unsigned int align_frames = FLOAT_BUFFER_ALIGN / sizeof(float);
 	struct float_buffer *b;
+	void *data;
 
 	b = (struct float_buffer *)calloc(1, sizeof(*b));
 
 	b->num_channels = num_channels;
+	b->stride = (max_size + align_frames - 1) / align_frames * align_frames;
 	b->fp = (float **)malloc(num_channels * sizeof(float *));
-	b->buf = (struct byte_buffer *)calloc(
-		1, sizeof(struct byte_buffer) +
-			   sizeof(float) * max_size * num_channels);
+	if (posix_memalign(&data, FLOAT_BUFFER_ALIGN,
+			   sizeof(float) * b->stride * num_channels))
+		data = NULL;
+	else
+		memset(data, 0, sizeof(float) * b->stride * num_channels);
+	b->data = (float *)data;
+	b->buf = (struct byte_buffer *)calloc(1, sizeof(struct byte_buffer));
 	b->buf->max_size = max_size;
 	b->buf->used_size = max_size;
 	return b;
 }
 
+/*
+ * Creates a float_buffer whose planes are each followed by a mirror of
+ * themselves, see cras_mirror_map(), so what is queued or free is never
+ * split at the wrap. The planes are whole pages, max_size is rounded up.
+ * Falls back to a plain float_buffer when the planes can't be mirrored.
+ */
+static inline struct float_buffer *
+float_buffer_create_mirrored(unsigned int max_size, unsigned int num_channels)
+{
+	size_t plane = cras_mirror_size(sizeof(float) * max_size);
+	struct float_buffer *b;
+
+	b = (struct float_buffer *)calloc(1, sizeof(*b));
+	if (!b)
+		return NULL;
+
+	b->num_channels = num_channels;
+	b->stride = 2 * plane / sizeof(float);
+	b->fp = (float **)malloc(num_channels * sizeof(float *));
+	b->buf = (struct byte_buffer *)calloc(1, sizeof(struct byte_buffer));
+	b->data = (float *)cras_mirror_map(plane, num_channels);
+	if (!b->fp || !b->buf || !b->data) {
+		if (b->data)
+			cras_mirror_unmap(b->data, plane, num_channels);
+		free(b->fp);
+		free(b->buf);
+		free(b);
+		return float_buffer_create(max_size, num_channels);
+	}
+	b->buf->max_size = plane / sizeof(float);
+	b->buf->used_size = b->buf->max_size;
+	b->buf->mirrored = 1;
+	return b;
+}
+
 /* Destroys the float buffer. */
 static inline void float_buffer_destroy(struct float_buffer **b)
 {
 	if (*b == NULL)
 		return;
 
-	byte_buffer_destroy(&(*b)->buf);
+	if ((*b)->buf && (*b)->buf->mirrored)
+		cras_mirror_unmap((*b)->data, sizeof(float) * (*b)->stride / 2,
+				  (*b)->num_channels);
+	else
+		free((*b)->data);
+	/* The positions only, there are no bytes to free. */
+	free((*b)->buf);
 	free((*b)->fp);
 	free(*b);
 	*b = NULL;
@@ -59,9 +121,9 @@ static inline void float_buffer_destroy(struct float_buffer **b)
 static inline float *const *float_buffer_write_pointer(struct float_buffer *b)
 {
 	unsigned int i;
-	float *data = (float *)b->buf->bytes;
+	float *data = b->data;
 
-	for (i = 0; i < b->num_channels; i++, data += b->buf->max_size)
+	for (i = 0; i < b->num_channels; i++, data += b->stride)
 		b->fp[i] = data + b->buf->write_idx;
 	return b->fp;
 }
@@ -85,7 +147,7 @@ static inline float *const *float_buffer_read_pointer(struct float_buffer *b,
 						      unsigned int *readable)
 {
 	unsigned int i;
-	float *data = (float *)b->buf->bytes;
+	float *data = b->data;
 	unsigned int nread = buf_readable(b->buf);
 
 	if (offset >= buf_queued(b->buf)) {
@@ -100,7 +162,7 @@ static inline float *const *float_buffer_read_pointer(struct float_buffer *b,
 		offset += b->buf->read_idx;
 	}
 
-	for (i = 0; i < b->num_channels; i++, data += b->buf->max_size)
+	for (i = 0; i < b->num_channels; i++, data += b->stride)
 		b->fp[i] = data + offset;
 	return b->fp;
 }
@@ -11,6 +11,7 @@
 #include "cras_mix.h"
 #include "cras_rstream.h"
 #include "cras_system_state.h"
+#include "cras_trace.h"
 #include "dsp_util.h"
 #include "input_data.h"
 #include "utlist.h"
@@ -49,7 +50,8 @@ void input_data_configure(struct ext_dsp_module *ext, unsigned int buffer_size,
 
 	if (data->fbuffer)
 		float_buffer_destroy(&data->fbuffer);
-	data->fbuffer = float_buffer_create(buffer_size, num_channels);
+	/* Mirrored, the APM reads it without splitting at the wrap. */
+	data->fbuffer = float_buffer_create_mirrored(buffer_size, num_channels);
 }
 
 struct input_data *input_data_create(void *dev_ptr)
@@ -140,6 +142,12 @@ void input_data_set_all_streams_read(struct input_data *data,
  * float buffer. We shall let APM process the float buffer from offset 300.
  * Don't bother clip read offset in this case, because fbuffer contains
  * the deepest deinterleaved audio data ever read from idev.
+ *
+ * Case 4:
+ * A stream gated by silence, which is given zeros. Like case 1 and 2 it
+ * moves along the audio area from idev, even if it has an APM. The
+ * frames its APM already processed are dropped, so that the other streams
+ * sharing the APM can go on.
  */
 int input_data_get_for_stream(struct input_data *data,
 			      struct cras_rstream *stream,
@@ -152,9 +160,13 @@ int input_data_get_for_stream(struct input_data *data,
 	int stream_offset = buffer_share_id_offset(offsets, stream->stream_id);
 
 	apm = cras_apm_list_get_active_apm(stream, data->dev_ptr);
-	if (apm == NULL) {
+	if (apm && input_data_silence_gated(data, stream))
+		cras_apm_list_put_processed(
+			apm, cras_apm_list_get_processed(apm)->frames);
+
+	if (apm == NULL || input_data_silence_gated(data, stream)) {
 		/*
-		 * Case 1 and 2 from above example.
+		 * Case 1, 2 and 4 from above example.
 		 */
 		*area = data->area;
 		*offset = MIN(stream_offset, data->area->frames);
@@ -162,8 +174,11 @@ int input_data_get_for_stream(struct input_data *data,
 		/*
 		 * Case 3 from above example.
 		 */
+		CRAS_TRACE2(apm_process_begin, stream->stream_id,
+			    stream_offset);
 		apm_processed = cras_apm_list_process(apm, data->fbuffer,
 						      stream_offset);
+		CRAS_TRACE1(apm_process_end, apm_processed);
 		if (apm_processed < 0) {
 			cras_apm_list_remove_apm(stream->apm_list, apm);
 			return 0;
@@ -177,6 +192,12 @@ int input_data_get_for_stream(struct input_data *data,
 	return 0;
 }
 
+bool input_data_silence_gated(struct input_data *data,
+			      struct cras_rstream *stream)
+{
+	return data->silent && (stream->flags & SILENCE_GATE_OK);
+}
+
 int input_data_put_for_stream(struct input_data *data,
 			      struct cras_rstream *stream,
 			      struct buffer_share *offsets, unsigned int frames)
@@ -184,7 +205,7 @@ int input_data_put_for_stream(struct input_data *data,
 	struct cras_apm *apm =
 		cras_apm_list_get_active_apm(stream, data->dev_ptr);
 
-	if (apm)
+	if (apm && !input_data_silence_gated(data, stream))
 		cras_apm_list_put_processed(apm, frames);
 	else
 		buffer_share_offset_update(offsets, stream->stream_id, frames);
@@ -208,3 +229,12 @@ float input_data_get_software_gain_scaler(struct input_data *data,
 
 	return idev_sw_gain_scaler * cras_rstream_get_volume_scaler(stream);
 }
+
+unsigned int input_data_get_processing_delay(struct input_data *data,
+					     struct cras_rstream *stream)
+{
+	struct cras_apm *apm =
+		cras_apm_list_get_active_apm(stream, data->dev_ptr);
+
+	return apm ? cras_apm_list_get_delay(apm) : 0;
+}
@@ -6,6 +6,8 @@
 #ifndef INPUT_DATA_H_
 #define INPUT_DATA_H_
 
+#include <stdbool.h>
+
 #include "cras_dsp_pipeline.h"
 #include "float_buffer.h"
 
@@ -17,13 +19,17 @@
  *    ext - Provides interface to read and process buffer in dsp pipeline.
  *    dev_ptr - Pointer to the associated input iodev.
  *    area - The audio area used for deinterleaved data copy.
- *    fbuffer - Floating point buffer from input device.
+ *    fbuffer - Floating point buffer from input device, with aligned planes.
+ *        All the APMs of the device read it in place and never change it.
+ *    silent - Set by the input iodev while its silence gate says the frames
+ *        in area are silence.
  */
 struct input_data {
 	struct ext_dsp_module ext;
 	void *dev_ptr;
 	struct cras_audio_area *area;
 	struct float_buffer *fbuffer;
+	bool silent;
 };
 
 /*
@@ -61,6 +67,17 @@ int input_data_get_for_stream(struct input_data *data,
 			      struct cras_audio_area **area,
 			      unsigned int *offset);
 
+/*
+ * Checks if |stream| should be given zeros instead of the frames in |data|,
+ * because the input is silence and |stream| set SILENCE_GATE_OK. Such a
+ * stream reads the audio area of the device, bypassing any processing.
+ * Args:
+ *    data - The input data to check.
+ *    stream - The stream that reads data.
+ */
+bool input_data_silence_gated(struct input_data *data,
+			      struct cras_rstream *stream);
+
 /*
  * Marks |frames| of audio data as read by |stream|.
  * Args:
@@ -92,4 +109,16 @@ float input_data_get_software_gain_scaler(struct input_data *data,
 					  float idev_sw_gain_scaler,
 					  struct cras_rstream *stream);
 
+/*
+ * Gets the delay the stream specific processing adds to the audio |stream|
+ * reads from this input.
+ * Args:
+ *    data - The input data that holds pointer to APM instance.
+ *    stream - The stream to get the delay for.
+ * Returns:
+ *    The delay in frames at the device rate.
+ */
+unsigned int input_data_get_processing_delay(struct input_data *data,
+					     struct cras_rstream *stream);
+
 #endif /* INPUT_DATA_H_ */
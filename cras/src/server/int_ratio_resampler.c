@@ -0,0 +1,525 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "int_ratio_resampler.h"
+
+/* Taps on each side of the center, counted in frames at the lower rate. The
+ * group delay is this many frames of the lower rate. */
+#define HALF_TAPS 8
+/* Kaiser window shape, about 60dB of stop band attenuation. */
+#define KAISER_BETA 6.0
+/* Frames at the lower rate filtered per block. */
+#define BLOCK_FRAMES 64
+
+/* An integer ratio resampler.
+ * Members:
+ *    num_channels - The number of channels in one frame.
+ *    factor - The ratio between the higher and the lower rate.
+ *    up - Non-zero when interpolating, zero when decimating.
+ *    coef - The taps that aren't zero or the center, 2 * HALF_TAPS per
+ *        branch for the factor - 1 branches. When decimating branch r holds
+ *        the taps applied to the input frames r past a multiple of factor,
+ *        when interpolating branch p holds the taps of the outputs p past
+ *        a multiple of factor.
+ *    center - The center tap when decimating.
+ *    window - Planar input per channel.
+ *    window_frames - Capacity of each channel of window, enough for the
+ *        span of BLOCK_FRAMES frames at the lower rate.
+ *    avail - Frames held in each channel of window.
+ *    pos - Index in window of the first frame of the next block's span.
+ *    branch - Scratch for the input split into factor branches when
+ *        decimating, each BLOCK_FRAMES + 2 * HALF_TAPS long.
+ *    acc - Scratch for one channel of one branch, BLOCK_FRAMES long.
+ *    block - Interleaved output filtered but not emitted yet.
+ *    staged - Frames in block.
+ *    staged_pos - Frames of block already emitted.
+ */
+struct int_ratio_resampler {
+	unsigned int num_channels;
+	unsigned int factor;
+	int up;
+	float *coef;
+	float center;
+	float **window;
+	unsigned int window_frames;
+	unsigned int avail;
+	unsigned int pos;
+	float *branch;
+	float *acc;
+	float *block;
+	unsigned int staged;
+	unsigned int staged_pos;
+};
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 50; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+/* Designs a Kaiser windowed sinc cutting off at the lower rate's Nyquist
+ * frequency, 2 * HALF_TAPS * factor + 1 taps long at the higher rate, and
+ * splits it into branches. Every factor-th tap from the center falls on a
+ * zero of the sinc, so only the center is kept of those. */
+static int design_coef(struct int_ratio_resampler *ir)
+{
+	unsigned int half = HALF_TAPS * ir->factor;
+	unsigned int len = 2 * half + 1;
+	double fc = 0.5 / ir->factor;
+	double i0_beta = bessel_i0(KAISER_BETA);
+	double *h, sum = 0;
+	unsigned int n, r, j;
+
+	h = (double *)calloc(len, sizeof(*h));
+	if (!h)
+		return -ENOMEM;
+
+	for (n = 0; n < len; n++) {
+		double t = (double)n - half;
+		double x = t / half;
+		double sinc = t == 0 ? 1.0 : sin(2 * M_PI * fc * t) /
+						    (2 * M_PI * fc * t);
+		double w = bessel_i0(KAISER_BETA * sqrt(1.0 - x * x)) / i0_beta;
+
+		h[n] = 2 * fc * sinc * w;
+		if (n % ir->factor == 0 && n != half)
+			h[n] = 0;
+		sum += h[n];
+	}
+
+	if (ir->up) {
+		/* Scaled by factor for the zeros stuffed between the input
+		 * frames, each branch then normalized for unity DC gain. The
+		 * center tap is then exactly one and the outputs on it copy
+		 * the input. */
+		for (r = 1; r < ir->factor; r++) {
+			float *c = ir->coef + (r - 1) * 2 * HALF_TAPS;
+			double branch_sum = 0;
+
+			for (j = 0; j < 2 * HALF_TAPS; j++)
+				branch_sum += h[j * ir->factor + r];
+			for (j = 0; j < 2 * HALF_TAPS; j++)
+				c[j] = h[j * ir->factor + r] / branch_sum;
+		}
+	} else {
+		for (r = 1; r < ir->factor; r++) {
+			float *c = ir->coef + (r - 1) * 2 * HALF_TAPS;
+
+			for (j = 0; j < 2 * HALF_TAPS; j++)
+				c[j] = h[j * ir->factor + r] / sum;
+		}
+		ir->center = h[half] / sum;
+	}
+
+	free(h);
+	return 0;
+}
+
+/* Adds c * x to acc, the filter's inner loop. */
+static inline void axpy(float *acc, const float *x, float c, unsigned int n)
+{
+	unsigned int i = 0;
+#if defined(__SSE__)
+	__m128 vc = _mm_set1_ps(c);
+
+	for (; i + 4 <= n; i += 4)
+		_mm_storeu_ps(acc + i,
+			      _mm_add_ps(_mm_loadu_ps(acc + i),
+					 _mm_mul_ps(vc, _mm_loadu_ps(x + i))));
+#elif defined(__ARM_NEON)
+	float32x4_t vc = vdupq_n_f32(c);
+
+	for (; i + 4 <= n; i += 4)
+		vst1q_f32(acc + i,
+			  vmlaq_f32(vld1q_f32(acc + i), vld1q_f32(x + i), vc));
+#endif
+	for (; i < n; i++)
+		acc[i] += c * x[i];
+}
+
+struct int_ratio_resampler *
+int_ratio_resampler_create(unsigned int num_channels, unsigned int src_rate,
+			   unsigned int dst_rate)
+{
+	struct int_ratio_resampler *ir;
+	unsigned int factor, ch;
+	int up;
+
+	if (!num_channels || !src_rate || !dst_rate)
+		return NULL;
+
+	up = dst_rate > src_rate;
+	if (up && dst_rate % src_rate == 0)
+		factor = dst_rate / src_rate;
+	else if (!up && src_rate % dst_rate == 0)
+		factor = src_rate / dst_rate;
+	else
+		return NULL;
+	if (factor < 2 || factor > INT_RATIO_MAX_FACTOR)
+		return NULL;
+
+	ir = (struct int_ratio_resampler *)calloc(1, sizeof(*ir));
+	if (!ir)
+		return NULL;
+
+	ir->num_channels = num_channels;
+	ir->factor = factor;
+	ir->up = up;
+	if (up)
+		ir->window_frames = 2 * HALF_TAPS - 1 + BLOCK_FRAMES;
+	else
+		ir->window_frames =
+			(2 * HALF_TAPS + BLOCK_FRAMES - 1) * factor + 1;
+
+	ir->coef = (float *)calloc((factor - 1) * 2 * HALF_TAPS,
+				   sizeof(*ir->coef));
+	ir->window = (float **)calloc(num_channels, sizeof(*ir->window));
+	ir->acc = (float *)calloc(BLOCK_FRAMES, sizeof(*ir->acc));
+	ir->block = (float *)calloc(BLOCK_FRAMES * (up ? factor : 1) *
+					    num_channels,
+				    sizeof(*ir->block));
+	if (!up)
+		ir->branch = (float *)calloc((BLOCK_FRAMES + 2 * HALF_TAPS) *
+						     factor,
+					     sizeof(*ir->branch));
+	if (!ir->coef || !ir->window || !ir->acc || !ir->block ||
+	    (!up && !ir->branch))
+		goto fail;
+	for (ch = 0; ch < num_channels; ch++) {
+		ir->window[ch] = (float *)calloc(ir->window_frames,
+						 sizeof(*ir->window[ch]));
+		if (!ir->window[ch])
+			goto fail;
+	}
+
+	if (design_coef(ir))
+		goto fail;
+	int_ratio_resampler_reset(ir);
+	return ir;
+
+fail:
+	int_ratio_resampler_destroy(ir);
+	return NULL;
+}
+
+void int_ratio_resampler_destroy(struct int_ratio_resampler *ir)
+{
+	unsigned int ch;
+
+	if (!ir)
+		return;
+	if (ir->window)
+		for (ch = 0; ch < ir->num_channels; ch++)
+			free(ir->window[ch]);
+	free(ir->window);
+	free(ir->coef);
+	free(ir->branch);
+	free(ir->acc);
+	free(ir->block);
+	free(ir);
+}
+
+unsigned int int_ratio_resampler_latency(const struct int_ratio_resampler *ir)
+{
+	return ir->up ? HALF_TAPS : HALF_TAPS * ir->factor;
+}
+
+/* Returns the frames at the lower rate to filter in the next block for want
+ * more output frames, ignoring what the window holds. */
+static unsigned int block_frames(const struct int_ratio_resampler *ir,
+				 unsigned int want)
+{
+	if (ir->up)
+		want = (want + ir->factor - 1) / ir->factor;
+	return MIN(want, BLOCK_FRAMES);
+}
+
+/* Returns the window frames the span of frames at the lower rate covers. */
+static unsigned int span_frames(const struct int_ratio_resampler *ir,
+				unsigned int frames)
+{
+	if (ir->up)
+		return 2 * HALF_TAPS - 1 + frames;
+	return (2 * HALF_TAPS + frames - 1) * ir->factor + 1;
+}
+
+void int_ratio_resampler_reset(struct int_ratio_resampler *ir)
+{
+	unsigned int ch;
+
+	/* Start with a span of silence less one frame so the first output
+	 * only needs the first input frame, like the other resamplers. */
+	for (ch = 0; ch < ir->num_channels; ch++)
+		memset(ir->window[ch], 0,
+		       ir->window_frames * sizeof(*ir->window[ch]));
+	ir->avail = span_frames(ir, 1) - 1;
+	ir->pos = 0;
+	ir->staged = 0;
+	ir->staged_pos = 0;
+}
+
+/* Drops frames no future output needs from the front of the window. */
+static void compact_window(struct int_ratio_resampler *ir)
+{
+	unsigned int ch, keep;
+
+	if (ir->pos == 0)
+		return;
+	if (ir->pos >= ir->avail) {
+		ir->pos -= ir->avail;
+		ir->avail = 0;
+		return;
+	}
+	keep = ir->avail - ir->pos;
+	for (ch = 0; ch < ir->num_channels; ch++)
+		memmove(ir->window[ch], ir->window[ch] + ir->pos,
+			keep * sizeof(float));
+	ir->avail = keep;
+	ir->pos = 0;
+}
+
+/* Filters frames output frames into block. Each branch of the input is
+ * gathered contiguous so the taps run as vector multiply-adds. */
+static void decimate(struct int_ratio_resampler *ir, unsigned int frames)
+{
+	unsigned int stride = BLOCK_FRAMES + 2 * HALF_TAPS;
+	unsigned int ch, r, j, i;
+
+	for (ch = 0; ch < ir->num_channels; ch++) {
+		const float *w = ir->window[ch] + ir->pos;
+
+		for (r = 0; r < ir->factor; r++) {
+			float *b = ir->branch + r * stride;
+			unsigned int len = frames + 2 * HALF_TAPS - 1;
+
+			/* Only the center tap is used of branch zero. */
+			if (r == 0)
+				len = frames + HALF_TAPS;
+			for (i = 0; i < len; i++)
+				b[i] = w[i * ir->factor + r];
+		}
+
+		for (i = 0; i < frames; i++)
+			ir->acc[i] = ir->center * ir->branch[i + HALF_TAPS];
+		for (r = 1; r < ir->factor; r++) {
+			const float *b = ir->branch + r * stride;
+			const float *c = ir->coef + (r - 1) * 2 * HALF_TAPS;
+
+			for (j = 0; j < 2 * HALF_TAPS; j++)
+				axpy(ir->acc, b + j, c[j], frames);
+		}
+
+		for (i = 0; i < frames; i++)
+			ir->block[i * ir->num_channels + ch] = ir->acc[i];
+	}
+	ir->pos += frames * ir->factor;
+}
+
+/* Filters frames input frames into frames * factor output frames in block.
+ * The input frames themselves are the outputs on the center tap. */
+static void interpolate(struct int_ratio_resampler *ir, unsigned int frames)
+{
+	unsigned int nc = ir->num_channels;
+	unsigned int ch, p, j, i;
+
+	for (ch = 0; ch < nc; ch++) {
+		const float *w = ir->window[ch] + ir->pos;
+
+		for (i = 0; i < frames; i++)
+			ir->block[i * ir->factor * nc + ch] =
+				w[HALF_TAPS - 1 + i];
+
+		for (p = 1; p < ir->factor; p++) {
+			const float *c = ir->coef + (p - 1) * 2 * HALF_TAPS;
+
+			memset(ir->acc, 0, frames * sizeof(*ir->acc));
+			for (j = 0; j < 2 * HALF_TAPS; j++)
+				axpy(ir->acc, w + 2 * HALF_TAPS - 1 - j, c[j],
+				     frames);
+			for (i = 0; i < frames; i++)
+				ir->block[(i * ir->factor + p) * nc + ch] =
+					ir->acc[i];
+		}
+	}
+	ir->pos += frames;
+}
+
+/* Filters the next block into block if the window holds its span. Returns
+ * the number of output frames staged. */
+static unsigned int filter_window(struct int_ratio_resampler *ir,
+				  unsigned int want)
+{
+	unsigned int frames = block_frames(ir, want);
+
+	while (frames && ir->pos + span_frames(ir, frames) > ir->avail)
+		frames--;
+	if (!frames)
+		return 0;
+
+	if (ir->up) {
+		interpolate(ir, frames);
+		return frames * ir->factor;
+	}
+	decimate(ir, frames);
+	return frames;
+}
+
+/* Converts frames input frames, starting offset frames into src, to float
+ * and appends them to the window. */
+typedef void (*deinterleave_t)(struct int_ratio_resampler *ir,
+			       const void *src, unsigned int offset,
+			       unsigned int frames);
+
+static void deinterleave_s16(struct int_ratio_resampler *ir, const void *src,
+			     unsigned int offset, unsigned int frames)
+{
+	const int16_t *in = (const int16_t *)src + offset * ir->num_channels;
+	unsigned int ch, i;
+
+	for (ch = 0; ch < ir->num_channels; ch++) {
+		float *w = ir->window[ch] + ir->avail;
+		for (i = 0; i < frames; i++)
+			w[i] = in[i * ir->num_channels + ch];
+	}
+}
+
+static void deinterleave_s32(struct int_ratio_resampler *ir, const void *src,
+			     unsigned int offset, unsigned int frames)
+{
+	const int32_t *in = (const int32_t *)src + offset * ir->num_channels;
+	unsigned int ch, i;
+
+	for (ch = 0; ch < ir->num_channels; ch++) {
+		float *w = ir->window[ch] + ir->avail;
+		for (i = 0; i < frames; i++)
+			w[i] = in[i * ir->num_channels + ch];
+	}
+}
+
+/* Converts samples of the staged block, starting at offset in dst, to the
+ * output format. */
+typedef void (*emit_t)(const float *block, unsigned int samples, void *dst,
+		       unsigned int offset);
+
+static void emit_s16(const float *block, unsigned int samples, void *dst,
+		     unsigned int offset)
+{
+	int16_t *out = (int16_t *)dst + offset;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		float s = lrintf(block[i]);
+		if (s > INT16_MAX)
+			s = INT16_MAX;
+		else if (s < INT16_MIN)
+			s = INT16_MIN;
+		out[i] = s;
+	}
+}
+
+static void emit_s32(const float *block, unsigned int samples, void *dst,
+		     unsigned int offset)
+{
+	int32_t *out = (int32_t *)dst + offset;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		float s = block[i];
+		/* The largest float below 2^31. */
+		if (s > 2147483520.0f)
+			out[i] = INT32_MAX;
+		else if (s < -2147483648.0f)
+			out[i] = INT32_MIN;
+		else
+			out[i] = lrintf(s);
+	}
+}
+
+static unsigned int process(struct int_ratio_resampler *ir, const void *src,
+			    unsigned int *src_frames, void *dst,
+			    unsigned int dst_frames, deinterleave_t in,
+			    emit_t emit)
+{
+	unsigned int nc = ir->num_channels;
+	unsigned int consumed = 0, produced = 0;
+
+	while (produced < dst_frames) {
+		unsigned int n, span;
+
+		/* Interpolated blocks can hold more than dst has room for,
+		 * the rest is emitted on the next call. */
+		if (ir->staged_pos < ir->staged) {
+			n = MIN(dst_frames - produced,
+				ir->staged - ir->staged_pos);
+			emit(ir->block + ir->staged_pos * nc, n * nc, dst,
+			     produced * nc);
+			ir->staged_pos += n;
+			produced += n;
+			continue;
+		}
+
+		n = filter_window(ir, dst_frames - produced);
+		if (n) {
+			ir->staged = n;
+			ir->staged_pos = 0;
+			continue;
+		}
+
+		/* The window ran dry, top it up with just enough input. */
+		if (consumed == *src_frames)
+			break;
+		compact_window(ir);
+		span = ir->pos +
+		       span_frames(ir, block_frames(ir, dst_frames - produced));
+		n = MIN(*src_frames - consumed, span - ir->avail);
+		in(ir, src, consumed, n);
+		ir->avail += n;
+		consumed += n;
+	}
+
+	*src_frames = consumed;
+	return produced;
+}
+
+unsigned int int_ratio_resampler_process_s16(struct int_ratio_resampler *ir,
+					     const int16_t *src,
+					     unsigned int *src_frames,
+					     int16_t *dst,
+					     unsigned int dst_frames)
+{
+	return process(ir, src, src_frames, dst, dst_frames, deinterleave_s16,
+		       emit_s16);
+}
+
+unsigned int int_ratio_resampler_process_s32(struct int_ratio_resampler *ir,
+					     const int32_t *src,
+					     unsigned int *src_frames,
+					     int32_t *dst,
+					     unsigned int dst_frames)
+{
+	return process(ir, src, src_frames, dst, dst_frames, deinterleave_s32,
+		       emit_s32);
+}
@@ -0,0 +1,67 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef INT_RATIO_RESAMPLER_H_
+#define INT_RATIO_RESAMPLER_H_
+
+#include <stdint.h>
+
+/* The largest ratio between the two rates handled. */
+#define INT_RATIO_MAX_FACTOR 8
+
+struct int_ratio_resampler;
+
+/* Creates a resampler for rates that are a small integer multiple of each
+ * other, like 48000 to 16000 or 16000 to 48000. It runs a Nyquist filter,
+ * a half-band filter for a factor of two and a third-band filter for three,
+ * whose taps on every factor-th frame from the center are zero. Those taps
+ * are never computed: decimating skips the branch of input frames they
+ * fall on but for the center, interpolating copies the input frames to
+ * every factor-th output. The filters are short to keep the group delay low.
+ * Args:
+ *    num_channels - The number of channels in each frame.
+ *    src_rate - The source rate to resample from.
+ *    dst_rate - The destination rate to resample to.
+ * Returns:
+ *    The resampler or NULL if the rates aren't an integer ratio from 2 to
+ *    INT_RATIO_MAX_FACTOR of each other, or on allocation failure.
+ */
+struct int_ratio_resampler *
+int_ratio_resampler_create(unsigned int num_channels, unsigned int src_rate,
+			   unsigned int dst_rate);
+
+/* Destroys an integer ratio resampler. */
+void int_ratio_resampler_destroy(struct int_ratio_resampler *ir);
+
+/* Returns the delay added by the filter, in input frames. */
+unsigned int int_ratio_resampler_latency(const struct int_ratio_resampler *ir);
+
+/* Clears the filter history, as if the resampler was just created. */
+void int_ratio_resampler_reset(struct int_ratio_resampler *ir);
+
+/* Resamples interleaved frames. Input is only consumed as far as needed to
+ * fill the output.
+ * Args:
+ *    ir - The integer ratio resampler.
+ *    src - The input buffer.
+ *    src_frames - The number of frames in src, on return holds the number of
+ *        frames consumed.
+ *    dst - The output buffer.
+ *    dst_frames - The number of frames dst can hold.
+ * Returns:
+ *    The number of frames written to dst.
+ */
+unsigned int int_ratio_resampler_process_s16(struct int_ratio_resampler *ir,
+					     const int16_t *src,
+					     unsigned int *src_frames,
+					     int16_t *dst,
+					     unsigned int dst_frames);
+unsigned int int_ratio_resampler_process_s32(struct int_ratio_resampler *ir,
+					     const int32_t *src,
+					     unsigned int *src_frames,
+					     int32_t *dst,
+					     unsigned int dst_frames);
+
+#endif /* INT_RATIO_RESAMPLER_H_ */
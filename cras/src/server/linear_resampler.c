@@ -11,20 +11,24 @@
  * Members:
  *    num_channels - The number of channles in once frames.
  *    format_bytes - The size of one frame in bytes.
+ *    s32 - Set when samples are 32 bits wide rather than 16.
  *    src_offset - The accumulated offset for resampled src data.
  *    dst_offset - The accumulated offset for resampled dst data.
  *    to_times_100 - The numerator of the rate factor used for SRC.
  *    from_times_100 - The denominator of the rate factor used for SRC.
  *    f - The rate factor used for linear resample.
+ *    inv_f - 1 / f, so resampling needs no divide per frame.
  */
 struct linear_resampler {
 	unsigned int num_channels;
 	unsigned int format_bytes;
+	int s32;
 	unsigned int src_offset;
 	unsigned int dst_offset;
 	unsigned int to_times_100;
 	unsigned int from_times_100;
 	float f;
+	float inv_f;
 };
 
 struct linear_resampler *linear_resampler_create(unsigned int num_channels,
@@ -38,6 +42,7 @@ struct linear_resampler *linear_resampler_create(unsigned int num_channels,
 		return NULL;
 	lr->num_channels = num_channels;
 	lr->format_bytes = format_bytes;
+	lr->s32 = format_bytes == 4 * num_channels;
 
 	linear_resampler_set_rates(lr, src_rate, dst_rate);
 
@@ -54,6 +59,7 @@ void linear_resampler_set_rates(struct linear_resampler *lr, float from,
 				float to)
 {
 	lr->f = (float)to / from;
+	lr->inv_f = (float)from / to;
 	lr->to_times_100 = to * 100;
 	lr->from_times_100 = from * 100;
 	lr->src_offset = 0;
@@ -106,15 +112,55 @@ int linear_resampler_needed(struct linear_resampler *lr)
 	return lr->from_times_100 != lr->to_times_100;
 }
 
+/* Interpolates one output frame at frac past the input frame in. Set last
+ * when in is the last input frame, so there's nothing to interpolate with. */
+static inline void interpolate_s16(const struct linear_resampler *lr,
+				   const uint8_t *src, uint8_t *dst, float frac,
+				   int last)
+{
+	const int16_t *in = (const int16_t *)src;
+	int16_t *out = (int16_t *)dst;
+	int ch;
+
+	if (last) {
+		for (ch = 0; ch < lr->num_channels; ch++)
+			out[ch] = in[ch];
+		return;
+	}
+	for (ch = 0; ch < lr->num_channels; ch++)
+		out[ch] = in[ch] + frac * (in[lr->num_channels + ch] - in[ch]);
+}
+
+static inline void interpolate_s32(const struct linear_resampler *lr,
+				   const uint8_t *src, uint8_t *dst, float frac,
+				   int last)
+{
+	const int32_t *in = (const int32_t *)src;
+	int32_t *out = (int32_t *)dst;
+	int ch;
+
+	if (last) {
+		for (ch = 0; ch < lr->num_channels; ch++)
+			out[ch] = in[ch];
+		return;
+	}
+	/* Interpolate in double, float can't hold a 32 bit sample and the
+	 * difference of two samples can need 33 bits. */
+	for (ch = 0; ch < lr->num_channels; ch++)
+		out[ch] = in[ch] +
+			  (int32_t)((double)frac *
+				    ((int64_t)in[lr->num_channels + ch] -
+				     in[ch]));
+}
+
 unsigned int linear_resampler_resample(struct linear_resampler *lr,
 				       uint8_t *src, unsigned int *src_frames,
 				       uint8_t *dst, unsigned dst_frames)
 {
-	int ch;
 	unsigned int src_idx = 0;
 	unsigned int dst_idx = 0;
 	float src_pos;
-	int16_t *in, *out;
+	uint8_t *in, *out;
 
 	/* Check for corner cases so that we can assume both src_idx and
 	 * dst_idx are valid with value 0 in the loop below. */
@@ -124,7 +170,7 @@ unsigned int linear_resampler_resample(struct linear_resampler *lr,
 	}
 
 	for (dst_idx = 0; dst_idx <= dst_frames; dst_idx++) {
-		src_pos = (float)(lr->dst_offset + dst_idx) / lr->f;
+		src_pos = (float)(lr->dst_offset + dst_idx) * lr->inv_f;
 		if (src_pos > lr->src_offset)
 			src_pos -= lr->src_offset;
 		else
@@ -139,22 +185,17 @@ unsigned int linear_resampler_resample(struct linear_resampler *lr,
 			break;
 		}
 
-		in = (int16_t *)(src + src_idx * lr->format_bytes);
-		out = (int16_t *)(dst + dst_idx * lr->format_bytes);
+		in = src + src_idx * lr->format_bytes;
+		out = dst + dst_idx * lr->format_bytes;
 
 		/* Don't do linear interpolcation if src_pos falls on the
 		 * last index. */
-		if (src_idx == *src_frames - 1) {
-			for (ch = 0; ch < lr->num_channels; ch++)
-				out[ch] = in[ch];
-		} else {
-			for (ch = 0; ch < lr->num_channels; ch++) {
-				out[ch] = in[ch] +
-					  (src_pos - src_idx) *
-						  (in[lr->num_channels + ch] -
-						   in[ch]);
-			}
-		}
+		if (lr->s32)
+			interpolate_s32(lr, in, out, src_pos - src_idx,
+					src_idx == *src_frames - 1);
+		else
+			interpolate_s16(lr, in, out, src_pos - src_idx,
+					src_idx == *src_frames - 1);
 	}
 
 	*src_frames = src_idx + 1;
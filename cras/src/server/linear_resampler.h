@@ -11,7 +11,8 @@ struct linear_resampler;
 /* Creates a linear resampler.
  * Args:
  *    num_channels - The number of channels in each frames.
- *    format_bytes - The length of one frame in bytes.
+ *    format_bytes - The length of one frame in bytes. Samples are S16_LE,
+ *        or S32_LE when that's four bytes per channel.
  *    src_rate - The source rate to resample from.
  *    dst_rate - The destination rate to resample to.
  */
@@ -0,0 +1,138 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef MIX_BUS_H_
+#define MIX_BUS_H_
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Non-interleaved float buffer an output device mixes its streams into, when
+ * the float mix bus is enabled. Frame 0 of every plane lines up with the
+ * first frame of the area returned by cras_iodev_get_output_buffer, the same
+ * way the integer mix is done in place in the device buffer.
+ * Members:
+ *    planes - One buffer of max_frames samples per channel.
+ *    num_channels - Number of channels.
+ *    max_frames - The number of frames each plane can hold.
+ */
+struct mix_bus {
+	float **planes;
+	unsigned int num_channels;
+	unsigned int max_frames;
+};
+
+/*
+ * Creates a mix_bus.
+ * Args:
+ *    num_channels - Number of channels of the bus.
+ *    max_frames - The max number of frames the bus may hold.
+ * Returns:
+ *    The mix_bus or NULL if either size is zero or on allocation failure.
+ */
+static inline struct mix_bus *mix_bus_create(unsigned int num_channels,
+					     unsigned int max_frames)
+{
+	struct mix_bus *bus;
+	float *data;
+	unsigned int i;
+
+	if (!num_channels || !max_frames)
+		return NULL;
+	bus = (struct mix_bus *)calloc(1, sizeof(*bus));
+	if (!bus)
+		return NULL;
+	bus->planes = (float **)calloc(num_channels, sizeof(float *));
+	data = (float *)calloc((size_t)num_channels * max_frames,
+			       sizeof(float));
+	if (!bus->planes || !data) {
+		free(bus->planes);
+		free(data);
+		free(bus);
+		return NULL;
+	}
+	for (i = 0; i < num_channels; i++)
+		bus->planes[i] = data + (size_t)i * max_frames;
+	bus->num_channels = num_channels;
+	bus->max_frames = max_frames;
+	return bus;
+}
+
+/* Destroys the mix_bus. */
+static inline void mix_bus_destroy(struct mix_bus **bus)
+{
+	if (*bus == NULL)
+		return;
+
+	free((*bus)->planes[0]);
+	free((*bus)->planes);
+	free(*bus);
+	*bus = NULL;
+}
+
+/* Zeros the frames in [from, to) of every plane. */
+static inline void mix_bus_clear(struct mix_bus *bus, unsigned int from,
+				 unsigned int to)
+{
+	unsigned int i;
+
+	if (to > bus->max_frames)
+		to = bus->max_frames;
+	if (from >= to)
+		return;
+	for (i = 0; i < bus->num_channels; i++)
+		memset(bus->planes[i] + from, 0, (to - from) * sizeof(float));
+}
+
+/* Returns the planes offset by the given number of frames. The array holds
+ * num_channels pointers and is only valid until the next call. */
+static inline float *const *mix_bus_planes_at(struct mix_bus *bus,
+					      unsigned int offset, float **fp)
+{
+	unsigned int i;
+
+	for (i = 0; i < bus->num_channels; i++)
+		fp[i] = bus->planes[i] + offset;
+	return fp;
+}
+
+/* Returns 1 if any of the first nframes frames is not zero. */
+static inline int mix_bus_non_empty(const struct mix_bus *bus,
+				    unsigned int nframes)
+{
+	unsigned int i, j;
+
+	for (i = 0; i < bus->num_channels; i++)
+		for (j = 0; j < nframes; j++)
+			if (bus->planes[i][j] != 0.0f)
+				return 1;
+	return 0;
+}
+
+/*
+ * Drops the first nframes frames, which have been written to the device, and
+ * moves the frames mixed past them to the start of the bus.
+ * Args:
+ *    bus - The mix_bus.
+ *    nframes - Number of frames consumed.
+ *    remaining - Number of frames mixed after the consumed ones which are
+ *        kept for the next write.
+ */
+static inline void mix_bus_consume(struct mix_bus *bus, unsigned int nframes,
+				   unsigned int remaining)
+{
+	unsigned int i;
+
+	if (!nframes || nframes >= bus->max_frames || !remaining)
+		return;
+	if (remaining > bus->max_frames - nframes)
+		remaining = bus->max_frames - nframes;
+	for (i = 0; i < bus->num_channels; i++)
+		memmove(bus->planes[i], bus->planes[i] + nframes,
+			remaining * sizeof(float));
+}
+
+#endif /* MIX_BUS_H_ */
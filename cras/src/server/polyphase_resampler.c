@@ -0,0 +1,466 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+
+#if defined(__SSE__)
+#include <xmmintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "polyphase_resampler.h"
+
+/* Largest number of phases in a filter bank. Rate pairs whose reduced ratio
+ * needs more, e.g 44100 to 48001, are left to the other resamplers. */
+#define MAX_PHASES 1024
+/* Number of input frames converted into the planar window per step. */
+#define BLOCK_FRAMES 256
+
+/* Filter design for one quality tier.
+ * Members:
+ *    taps - Filter taps per phase, a multiple of 8 for the dot product.
+ *    beta - Kaiser window shape.
+ *    rolloff - Cutoff as a fraction of the lower Nyquist frequency.
+ */
+struct polyphase_tier {
+	unsigned int taps;
+	double beta;
+	double rolloff;
+};
+
+static const struct polyphase_tier tiers[] = {
+	[POLYPHASE_QUALITY_LOW] = { 16, 5.0, 0.85 },
+	[POLYPHASE_QUALITY_MEDIUM] = { 32, 7.0, 0.90 },
+	[POLYPHASE_QUALITY_HIGH] = { 64, 9.0, 0.94 },
+};
+
+/* A polyphase resampler.
+ * Members:
+ *    num_channels - The number of channels in one frame.
+ *    up - Interpolation factor, dst_rate over the rates' gcd.
+ *    down - Decimation factor, src_rate over the rates' gcd.
+ *    step_int - Whole input frames to advance per output frame.
+ *    step_frac - Phases to advance per output frame, down % up.
+ *    taps - Taps per phase.
+ *    bank - up * taps coefficients. Each phase is stored time reversed so
+ *        the filter is a forward dot product over the input window.
+ *    window - Planar input per channel.
+ *    window_frames - Capacity of each channel of window, taps - 1 +
+ *        BLOCK_FRAMES.
+ *    avail - Frames held in each channel of window.
+ *    pos - Index in window of the first frame of the next output's span.
+ *    phase - Phase of the next output frame.
+ */
+struct polyphase_resampler {
+	unsigned int num_channels;
+	unsigned int up;
+	unsigned int down;
+	unsigned int step_int;
+	unsigned int step_frac;
+	unsigned int taps;
+	float *bank;
+	float **window;
+	unsigned int window_frames;
+	unsigned int avail;
+	unsigned int pos;
+	unsigned int phase;
+};
+
+static unsigned int gcd(unsigned int a, unsigned int b)
+{
+	while (b) {
+		unsigned int t = a % b;
+		a = b;
+		b = t;
+	}
+	return a;
+}
+
+/* Zeroth order modified Bessel function of the first kind. */
+static double bessel_i0(double x)
+{
+	double sum = 1.0, term = 1.0;
+	int k;
+
+	for (k = 1; k < 50; k++) {
+		term *= (x / (2 * k)) * (x / (2 * k));
+		sum += term;
+		if (term < sum * 1e-12)
+			break;
+	}
+	return sum;
+}
+
+/* Fills the bank with a Kaiser windowed sinc of length up * taps, designed
+ * at the upsampled rate, and split into phases. */
+static void design_bank(struct polyphase_resampler *pr,
+			const struct polyphase_tier *tier)
+{
+	unsigned int len = pr->up * pr->taps;
+	double center = (len - 1) / 2.0;
+	double fc = tier->rolloff * 0.5 /
+		    (pr->up > pr->down ? pr->up : pr->down);
+	double i0_beta = bessel_i0(tier->beta);
+	unsigned int n;
+
+	for (n = 0; n < len; n++) {
+		double t = n - center;
+		double r = t / (center + 0.5);
+		double sinc = t == 0 ? 1.0 : sin(2 * M_PI * fc * t) /
+						    (2 * M_PI * fc * t);
+		double w = bessel_i0(tier->beta * sqrt(1.0 - r * r)) / i0_beta;
+		unsigned int phase = n % pr->up;
+		unsigned int k = n / pr->up;
+
+		/* The gain of up compensates for the zeros stuffed in. */
+		pr->bank[phase * pr->taps + (pr->taps - 1 - k)] =
+			pr->up * 2 * fc * sinc * w;
+	}
+}
+
+/* The filter's inner loop. n is a multiple of 8. */
+static inline float dot(const float *a, const float *b, unsigned int n)
+{
+	unsigned int i;
+#if defined(__SSE__)
+	__m128 acc0 = _mm_setzero_ps();
+	__m128 acc1 = _mm_setzero_ps();
+	float out[4];
+
+	for (i = 0; i < n; i += 8) {
+		acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i),
+						   _mm_loadu_ps(b + i)));
+		acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4),
+						   _mm_loadu_ps(b + i + 4)));
+	}
+	_mm_storeu_ps(out, _mm_add_ps(acc0, acc1));
+	return out[0] + out[1] + out[2] + out[3];
+#elif defined(__ARM_NEON)
+	float32x4_t acc0 = vdupq_n_f32(0);
+	float32x4_t acc1 = vdupq_n_f32(0);
+	float out[4];
+
+	for (i = 0; i < n; i += 8) {
+		acc0 = vmlaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+		acc1 = vmlaq_f32(acc1, vld1q_f32(a + i + 4),
+				 vld1q_f32(b + i + 4));
+	}
+	vst1q_f32(out, vaddq_f32(acc0, acc1));
+	return out[0] + out[1] + out[2] + out[3];
+#else
+	float acc[8] = { 0 };
+	unsigned int j;
+
+	for (i = 0; i < n; i += 8)
+		for (j = 0; j < 8; j++)
+			acc[j] += a[i + j] * b[i + j];
+	return acc[0] + acc[1] + acc[2] + acc[3] + acc[4] + acc[5] + acc[6] +
+	       acc[7];
+#endif
+}
+
+struct polyphase_resampler *
+polyphase_resampler_create(unsigned int num_channels, unsigned int src_rate,
+			   unsigned int dst_rate,
+			   enum POLYPHASE_QUALITY quality)
+{
+	struct polyphase_resampler *pr;
+	unsigned int g, ch;
+
+	if (!num_channels || !src_rate || !dst_rate ||
+	    quality > POLYPHASE_QUALITY_HIGH)
+		return NULL;
+
+	g = gcd(src_rate, dst_rate);
+	if (dst_rate / g > MAX_PHASES)
+		return NULL;
+	/* The window must hold the span of one output past the skipped
+	 * frames when decimating. */
+	if (src_rate / dst_rate >= BLOCK_FRAMES / 2)
+		return NULL;
+
+	pr = (struct polyphase_resampler *)calloc(1, sizeof(*pr));
+	if (!pr)
+		return NULL;
+
+	pr->num_channels = num_channels;
+	pr->up = dst_rate / g;
+	pr->down = src_rate / g;
+	pr->step_int = pr->down / pr->up;
+	pr->step_frac = pr->down % pr->up;
+	pr->taps = tiers[quality].taps;
+	pr->window_frames = pr->taps - 1 + BLOCK_FRAMES;
+
+	pr->bank = (float *)calloc(pr->up * pr->taps, sizeof(*pr->bank));
+	pr->window = (float **)calloc(num_channels, sizeof(*pr->window));
+	if (!pr->bank || !pr->window)
+		goto fail;
+	for (ch = 0; ch < num_channels; ch++) {
+		pr->window[ch] = (float *)calloc(pr->window_frames,
+						 sizeof(*pr->window[ch]));
+		if (!pr->window[ch])
+			goto fail;
+	}
+
+	design_bank(pr, &tiers[quality]);
+	polyphase_resampler_reset(pr);
+	return pr;
+
+fail:
+	polyphase_resampler_destroy(pr);
+	return NULL;
+}
+
+void polyphase_resampler_destroy(struct polyphase_resampler *pr)
+{
+	unsigned int ch;
+
+	if (!pr)
+		return;
+	if (pr->window)
+		for (ch = 0; ch < pr->num_channels; ch++)
+			free(pr->window[ch]);
+	free(pr->window);
+	free(pr->bank);
+	free(pr);
+}
+
+unsigned int polyphase_resampler_latency(const struct polyphase_resampler *pr)
+{
+	return pr->taps / 2;
+}
+
+void polyphase_resampler_reset(struct polyphase_resampler *pr)
+{
+	unsigned int ch;
+
+	/* Start with taps - 1 frames of silence so the first output only
+	 * needs the first input frame. */
+	for (ch = 0; ch < pr->num_channels; ch++)
+		memset(pr->window[ch], 0,
+		       pr->window_frames * sizeof(*pr->window[ch]));
+	pr->avail = pr->taps - 1;
+	pr->pos = 0;
+	pr->phase = 0;
+}
+
+/* Drops frames no future output needs from the front of the window. */
+static void compact_window(struct polyphase_resampler *pr)
+{
+	unsigned int ch, keep;
+
+	if (pr->pos == 0)
+		return;
+	if (pr->pos >= pr->avail) {
+		pr->pos -= pr->avail;
+		pr->avail = 0;
+		return;
+	}
+	keep = pr->avail - pr->pos;
+	for (ch = 0; ch < pr->num_channels; ch++)
+		memmove(pr->window[ch], pr->window[ch] + pr->pos,
+			keep * sizeof(float));
+	pr->avail = keep;
+	pr->pos = 0;
+}
+
+/* Produces output frames from the window while it holds each output's whole
+ * span. Returns the number of frames produced. */
+static unsigned int filter_window(struct polyphase_resampler *pr, float *out,
+				  unsigned int out_frames)
+{
+	unsigned int produced = 0;
+	unsigned int ch;
+
+	while (produced < out_frames && pr->pos + pr->taps <= pr->avail) {
+		const float *coef = pr->bank + pr->phase * pr->taps;
+
+		for (ch = 0; ch < pr->num_channels; ch++)
+			*out++ = dot(coef, pr->window[ch] + pr->pos, pr->taps);
+		produced++;
+
+		pr->pos += pr->step_int;
+		pr->phase += pr->step_frac;
+		if (pr->phase >= pr->up) {
+			pr->phase -= pr->up;
+			pr->pos++;
+		}
+	}
+	return produced;
+}
+
+/* Converts frames input frames, starting offset frames into src, to float
+ * and appends them to the window. */
+typedef void (*deinterleave_t)(struct polyphase_resampler *pr,
+			       const void *src, unsigned int offset,
+			       unsigned int frames);
+
+static void deinterleave_s16(struct polyphase_resampler *pr, const void *src,
+			     unsigned int offset, unsigned int frames)
+{
+	const int16_t *in = (const int16_t *)src + offset * pr->num_channels;
+	unsigned int ch, i;
+
+	for (ch = 0; ch < pr->num_channels; ch++) {
+		float *w = pr->window[ch] + pr->avail;
+		for (i = 0; i < frames; i++)
+			w[i] = in[i * pr->num_channels + ch];
+	}
+}
+
+static void deinterleave_s32(struct polyphase_resampler *pr, const void *src,
+			     unsigned int offset, unsigned int frames)
+{
+	const int32_t *in = (const int32_t *)src + offset * pr->num_channels;
+	unsigned int ch, i;
+
+	for (ch = 0; ch < pr->num_channels; ch++) {
+		float *w = pr->window[ch] + pr->avail;
+		for (i = 0; i < frames; i++)
+			w[i] = in[i * pr->num_channels + ch];
+	}
+}
+
+static void deinterleave_float(struct polyphase_resampler *pr,
+			       const void *src, unsigned int offset,
+			       unsigned int frames)
+{
+	const float *in = (const float *)src + offset * pr->num_channels;
+	unsigned int ch, i;
+
+	for (ch = 0; ch < pr->num_channels; ch++) {
+		float *w = pr->window[ch] + pr->avail;
+		for (i = 0; i < frames; i++)
+			w[i] = in[i * pr->num_channels + ch];
+	}
+}
+
+/* Runs the resampler into a float scratch block with the format specific
+ * deinterleave, calling emit for each block of output. */
+typedef void (*emit_t)(const float *block, unsigned int samples, void *dst,
+		       unsigned int offset);
+
+static unsigned int process(struct polyphase_resampler *pr, const void *src,
+			    unsigned int *src_frames, void *dst,
+			    unsigned int dst_frames, deinterleave_t in,
+			    emit_t emit)
+{
+	float block[BLOCK_FRAMES];
+	unsigned int block_frames = BLOCK_FRAMES / pr->num_channels;
+	unsigned int consumed = 0, produced = 0;
+
+	if (block_frames == 0) {
+		*src_frames = 0;
+		return 0;
+	}
+
+	while (produced < dst_frames) {
+		unsigned int n;
+
+		n = filter_window(pr, block,
+				  MIN(dst_frames - produced,
+					     block_frames));
+		if (n) {
+			emit(block, n * pr->num_channels, dst,
+			     produced * pr->num_channels);
+			produced += n;
+			continue;
+		}
+
+		/* The window ran dry, top it up with just enough input. */
+		if (consumed == *src_frames)
+			break;
+		compact_window(pr);
+		n = MIN(*src_frames - consumed,
+			       pr->window_frames - pr->avail);
+		/* Frames the remaining output needs, the span of the last
+		 * one included. */
+		n = MIN(n, pr->pos + pr->taps - pr->avail +
+					  (unsigned int)(((uint64_t)(dst_frames -
+								     produced) *
+							  pr->down) /
+							 pr->up));
+		in(pr, src, consumed, n);
+		pr->avail += n;
+		consumed += n;
+	}
+
+	*src_frames = consumed;
+	return produced;
+}
+
+static void emit_s16(const float *block, unsigned int samples, void *dst,
+		     unsigned int offset)
+{
+	int16_t *out = (int16_t *)dst + offset;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		float s = lrintf(block[i]);
+		if (s > INT16_MAX)
+			s = INT16_MAX;
+		else if (s < INT16_MIN)
+			s = INT16_MIN;
+		out[i] = s;
+	}
+}
+
+static void emit_s32(const float *block, unsigned int samples, void *dst,
+		     unsigned int offset)
+{
+	int32_t *out = (int32_t *)dst + offset;
+	unsigned int i;
+
+	for (i = 0; i < samples; i++) {
+		float s = block[i];
+		/* The largest float below 2^31. */
+		if (s > 2147483520.0f)
+			out[i] = INT32_MAX;
+		else if (s < -2147483648.0f)
+			out[i] = INT32_MIN;
+		else
+			out[i] = lrintf(s);
+	}
+}
+
+static void emit_float(const float *block, unsigned int samples, void *dst,
+		       unsigned int offset)
+{
+	memcpy((float *)dst + offset, block, samples * sizeof(float));
+}
+
+unsigned int polyphase_resampler_process_s16(struct polyphase_resampler *pr,
+					     const int16_t *src,
+					     unsigned int *src_frames,
+					     int16_t *dst,
+					     unsigned int dst_frames)
+{
+	return process(pr, src, src_frames, dst, dst_frames, deinterleave_s16,
+		       emit_s16);
+}
+
+unsigned int polyphase_resampler_process_s32(struct polyphase_resampler *pr,
+					     const int32_t *src,
+					     unsigned int *src_frames,
+					     int32_t *dst,
+					     unsigned int dst_frames)
+{
+	return process(pr, src, src_frames, dst, dst_frames, deinterleave_s32,
+		       emit_s32);
+}
+
+unsigned int polyphase_resampler_process_float(struct polyphase_resampler *pr,
+					       const float *src,
+					       unsigned int *src_frames,
+					       float *dst,
+					       unsigned int dst_frames)
+{
+	return process(pr, src, src_frames, dst, dst_frames,
+		       deinterleave_float, emit_float);
+}
@@ -0,0 +1,75 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef POLYPHASE_RESAMPLER_H_
+#define POLYPHASE_RESAMPLER_H_
+
+#include <stdint.h>
+
+struct polyphase_resampler;
+
+/* Quality tiers of the polyphase resampler. Higher tiers use longer filters,
+ * costing more CPU and latency for a sharper cutoff and lower aliasing. */
+enum POLYPHASE_QUALITY {
+	POLYPHASE_QUALITY_LOW,
+	POLYPHASE_QUALITY_MEDIUM,
+	POLYPHASE_QUALITY_HIGH,
+};
+
+/* Creates a windowed-sinc polyphase resampler. The filter bank for the
+ * rational ratio dst_rate / src_rate is computed once here, so converting
+ * does not divide or evaluate the window per frame.
+ * Args:
+ *    num_channels - The number of channels in each frame.
+ *    src_rate - The source rate to resample from.
+ *    dst_rate - The destination rate to resample to.
+ *    quality - The filter length and cutoff tier to use.
+ * Returns:
+ *    The resampler or NULL if the rate pair reduces to a ratio with more
+ *    phases than supported, or on allocation failure.
+ */
+struct polyphase_resampler *
+polyphase_resampler_create(unsigned int num_channels, unsigned int src_rate,
+			   unsigned int dst_rate,
+			   enum POLYPHASE_QUALITY quality);
+
+/* Destroys a polyphase resampler. */
+void polyphase_resampler_destroy(struct polyphase_resampler *pr);
+
+/* Returns the delay added by the filter, in input frames. */
+unsigned int polyphase_resampler_latency(const struct polyphase_resampler *pr);
+
+/* Clears the filter history, as if the resampler was just created. */
+void polyphase_resampler_reset(struct polyphase_resampler *pr);
+
+/* Resamples interleaved frames. Input is only consumed as far as needed to
+ * fill the output.
+ * Args:
+ *    pr - The polyphase resampler.
+ *    src - The input buffer.
+ *    src_frames - The number of frames in src, on return holds the number of
+ *        frames consumed.
+ *    dst - The output buffer.
+ *    dst_frames - The number of frames dst can hold.
+ * Returns:
+ *    The number of frames written to dst.
+ */
+unsigned int polyphase_resampler_process_s16(struct polyphase_resampler *pr,
+					     const int16_t *src,
+					     unsigned int *src_frames,
+					     int16_t *dst,
+					     unsigned int dst_frames);
+unsigned int polyphase_resampler_process_s32(struct polyphase_resampler *pr,
+					     const int32_t *src,
+					     unsigned int *src_frames,
+					     int32_t *dst,
+					     unsigned int dst_frames);
+unsigned int polyphase_resampler_process_float(struct polyphase_resampler *pr,
+					       const float *src,
+					       unsigned int *src_frames,
+					       float *dst,
+					       unsigned int dst_frames);
+
+#endif /* POLYPHASE_RESAMPLER_H_ */
@@ -15,11 +15,13 @@ fn main() {
     Builder::new()
         .with_src("../src/rate_estimator.rs")
         .rename_item("RateEstimator", "rate_estimator")
+        .rename_item("RateEstimatorSample", "rate_estimator_sample")
         .rename_item("timespec", "struct timespec")
         .with_no_includes()
         .with_sys_include("time.h")
         .with_include_guard("RATE_ESTIMATOR_H_")
         .with_language(cbindgen::Language::C)
+        .with_style(cbindgen::Style::Both)
         .with_header(HEADER)
         .generate()
         .expect("Unable to generate bindings")
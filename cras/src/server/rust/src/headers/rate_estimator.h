@@ -20,16 +20,37 @@
  *                     change plus the difference of buffer level to derive the
  *                     number of frames audio device has actually processed.
  *    * `window_start` - The start time of the current window.
+ *    * `last_check` - The time of the last sample taken.
  *    * `window_size` - The size of the window.
  *    * `window_frames` - The number of frames accumulated in current window.
- *    * `lsq` - The helper used to estimate sample rate.
+ *    * `samples` - The samples of the current window the rate is fitted to.
  *    * `smooth_factor` - A scaling factor used to average the previous and new
  *                        rate estimates to ensure that estimates do not change
  *                        too quickly.
+ *    * `reject_outliers` - Whether samples far off the rate of their window,
+ *                          such as levels read late after a delayed wake,
+ *                          are left out of the estimate.
  *    * `estimated_rate` - The estimated rate at which samples are consumed.
+ *    * `confidence` - How much the last window backs `estimated_rate`.
  */
 typedef struct rate_estimator rate_estimator;
 
+/**
+ * A sample for one rate estimator in `rate_estimator_check_batch`.
+ *
+ * # Members
+ *    * `re` - The rate estimator, or null to skip the sample.
+ *    * `level` - The current buffer level of the audio device.
+ *    * `now` - The time `level` was sampled at.
+ *    * `updated` - Set to 1 if the estimated rate was updated, 0 otherwise.
+ */
+typedef struct rate_estimator_sample {
+	rate_estimator *re;
+	int level;
+	struct timespec now;
+	int updated;
+} rate_estimator_sample;
+
 /**
  * # Safety
  *
@@ -48,6 +69,20 @@ void rate_estimator_add_frames(rate_estimator *re, int frames);
 int32_t rate_estimator_check(rate_estimator *re, int level,
 			     const struct timespec *now);
 
+/**
+ * Checks the samples of several rate estimators at once, as
+ * rate_estimator_check does for each of them, for a caller that samples all
+ * its devices on each wake. Returns the number of estimated rates updated.
+ *
+ * # Safety
+ *
+ * To use this function safely, `samples` must point to `num` samples, or be
+ * null if `num` is 0, and `re` of each sample must be a pointer returned
+ * from rate_estimator_create, or null.
+ */
+int rate_estimator_check_batch(rate_estimator_sample *samples,
+			       unsigned int num);
+
 /**
  * # Safety
  *
@@ -66,6 +101,14 @@ rate_estimator *rate_estimator_create(unsigned int rate,
  */
 void rate_estimator_destroy(rate_estimator *re);
 
+/**
+ * # Safety
+ *
+ * To use this function safely, `re` must be a pointer returned from
+ * rate_estimator_create, or null.
+ */
+double rate_estimator_get_confidence(const rate_estimator *re);
+
 /**
  * # Safety
  *
@@ -82,4 +125,12 @@ double rate_estimator_get_rate(const rate_estimator *re);
  */
 void rate_estimator_reset_rate(rate_estimator *re, unsigned int rate);
 
+/**
+ * # Safety
+ *
+ * To use this function safely, `re` must be a pointer returned from
+ * rate_estimator_create, or null.
+ */
+void rate_estimator_set_outlier_rejection(rate_estimator *re, int enable);
+
 #endif /* RATE_ESTIMATOR_H_ */
@@ -4,6 +4,7 @@
 
 pub mod rate_estimator_bindings;
 
+use std::cmp::Ordering;
 use std::error;
 use std::fmt;
 use std::time::Duration;
@@ -27,6 +28,19 @@ impl fmt::Display for Error {
 type Result<T> = std::result::Result<T, Error>;
 
 const MAX_RATE_SKEW: f64 = 100.0;
+/// The number of samples a window holds. Once it is full every other sample
+/// is dropped and only every other new one is kept from then on, so a window
+/// of any length is fit from samples spread evenly over it without
+/// allocating.
+const WINDOW_CAPACITY: usize = 64;
+/// Samples further from the fitted line than this many standard deviations,
+/// estimated from the median absolute deviation, are rejected as outliers.
+const OUTLIER_THRESHOLD: f64 = 3.0;
+/// Scales a median absolute deviation to a standard deviation.
+const MAD_TO_STD_DEV: f64 = 1.4826;
+/// Samples within this many frames of the fitted line are never outliers,
+/// hardware pointers move in small periods.
+const MIN_OUTLIER_FRAMES: f64 = 4.0;
 
 /// Hold information to calculate linear least square from
 /// several (x, y) samples.
@@ -36,6 +50,7 @@ struct LeastSquares {
     sum_y: f64,
     sum_xy: f64,
     sum_x2: f64,
+    sum_y2: f64,
     num_samples: u32,
 }
 
@@ -49,6 +64,7 @@ impl LeastSquares {
         self.sum_y += y;
         self.sum_xy += x * y;
         self.sum_x2 += x * x;
+        self.sum_y2 += y * y;
         self.num_samples += 1;
     }
 
@@ -57,6 +73,132 @@ impl LeastSquares {
         let den = self.num_samples as f64 * self.sum_x2 - self.sum_x * self.sum_x;
         num / den
     }
+
+    fn best_fit_intercept(&self, slope: f64) -> f64 {
+        (self.sum_y - slope * self.sum_x) / self.num_samples as f64
+    }
+
+    // Gets the standard error of `slope`, infinite with too few samples.
+    fn std_error(&self, slope: f64) -> f64 {
+        let n = self.num_samples as f64;
+        let sxx = self.sum_x2 - self.sum_x * self.sum_x / n;
+        if self.num_samples < 3 || sxx <= 0.0 {
+            return f64::INFINITY;
+        }
+        let sxy = self.sum_xy - self.sum_x * self.sum_y / n;
+        let syy = self.sum_y2 - self.sum_y * self.sum_y / n;
+        let residuals = (syy - slope * sxy).max(0.0);
+        (residuals / (n - 2.0) / sxx).sqrt()
+    }
+}
+
+/// The line fitted to the samples of a window.
+///
+/// # Members
+///    * `slope` - The estimated rate.
+///    * `std_error` - The standard error of `slope`, infinite if there were
+///                    too few samples to tell.
+///    * `inliers` - The fraction of the samples the line was fitted to.
+struct Fit {
+    slope: f64,
+    std_error: f64,
+    inliers: f64,
+}
+
+/// The (time, frames) samples taken in the current window.
+///
+/// # Members
+///    * `x`, `y` - The samples kept.
+///    * `len` - The number of samples kept.
+///    * `stride` - One sample of every `stride` is kept.
+///    * `skipped` - The number of samples skipped since the last one kept.
+struct SampleWindow {
+    x: [f64; WINDOW_CAPACITY],
+    y: [f64; WINDOW_CAPACITY],
+    len: usize,
+    stride: u32,
+    skipped: u32,
+}
+
+impl SampleWindow {
+    fn new() -> Self {
+        SampleWindow {
+            x: [0.0; WINDOW_CAPACITY],
+            y: [0.0; WINDOW_CAPACITY],
+            len: 0,
+            stride: 1,
+            skipped: 0,
+        }
+    }
+
+    fn clear(&mut self) {
+        self.len = 0;
+        self.stride = 1;
+        self.skipped = 0;
+    }
+
+    fn add_sample(&mut self, x: f64, y: f64) {
+        if self.skipped + 1 < self.stride {
+            self.skipped += 1;
+            return;
+        }
+        self.skipped = 0;
+
+        if self.len == WINDOW_CAPACITY {
+            for i in 0..WINDOW_CAPACITY / 2 {
+                self.x[i] = self.x[2 * i];
+                self.y[i] = self.y[2 * i];
+            }
+            self.len = WINDOW_CAPACITY / 2;
+            self.stride *= 2;
+        }
+        self.x[self.len] = x;
+        self.y[self.len] = y;
+        self.len += 1;
+    }
+
+    // Sums the samples for which `keep` returns true.
+    fn least_squares<F: Fn(f64, f64) -> bool>(&self, keep: F) -> LeastSquares {
+        let mut lsq = LeastSquares::new();
+        for i in 0..self.len {
+            if keep(self.x[i], self.y[i]) {
+                lsq.add_sample(self.x[i], self.y[i]);
+            }
+        }
+        lsq
+    }
+
+    // Fits a line to the samples. With `reject_outliers`, the line is fitted
+    // again without the samples too far from the first one.
+    fn fit(&self, reject_outliers: bool) -> Fit {
+        let mut lsq = self.least_squares(|_, _| true);
+        let mut slope = lsq.best_fit_slope();
+
+        if reject_outliers && self.len > 2 {
+            let intercept = lsq.best_fit_intercept(slope);
+            let mut residuals = [0.0; WINDOW_CAPACITY];
+            for i in 0..self.len {
+                residuals[i] = (self.y[i] - slope * self.x[i] - intercept).abs();
+            }
+            let residuals = &mut residuals[..self.len];
+            residuals.sort_unstable_by(|a, b| a.partial_cmp(b).unwrap_or(Ordering::Equal));
+            let max_residual = (residuals[self.len / 2] * MAD_TO_STD_DEV * OUTLIER_THRESHOLD)
+                .max(MIN_OUTLIER_FRAMES);
+
+            let inliers =
+                self.least_squares(|x, y| (y - slope * x - intercept).abs() <= max_residual);
+            if inliers.num_samples > 1 {
+                lsq = inliers;
+                slope = lsq.best_fit_slope();
+            }
+        }
+
+        Fit {
+            slope,
+            std_error: lsq.std_error(slope),
+            inliers: lsq.num_samples as f64 / self.len as f64,
+        }
+    }
 }
 
 /// An estimator holding the required information to determine the actual frame
@@ -69,22 +211,30 @@ impl LeastSquares {
 ///                     change plus the difference of buffer level to derive the
 ///                     number of frames audio device has actually processed.
 ///    * `window_start` - The start time of the current window.
+///    * `last_check` - The time of the last sample taken.
 ///    * `window_size` - The size of the window.
 ///    * `window_frames` - The number of frames accumulated in current window.
-///    * `lsq` - The helper used to estimate sample rate.
+///    * `samples` - The samples of the current window the rate is fitted to.
 ///    * `smooth_factor` - A scaling factor used to average the previous and new
 ///                        rate estimates to ensure that estimates do not change
 ///                        too quickly.
+///    * `reject_outliers` - Whether samples far off the rate of their window,
+///                          such as levels read late after a delayed wake,
+///                          are left out of the estimate.
 ///    * `estimated_rate` - The estimated rate at which samples are consumed.
+///    * `confidence` - How much the last window backs `estimated_rate`.
 pub struct RateEstimator {
     last_level: i32,
     level_diff: i32,
     window_start: Option<Duration>,
+    last_check: Option<Duration>,
     window_size: Duration,
     window_frames: u32,
-    lsq: LeastSquares,
+    samples: SampleWindow,
     smooth_factor: f64,
+    reject_outliers: bool,
     estimated_rate: f64,
+    confidence: f64,
 }
 
 impl RateEstimator {
@@ -108,11 +258,14 @@ impl RateEstimator {
             last_level: 0,
             level_diff: 0,
             window_start: None,
+            last_check: None,
             window_size,
             window_frames: 0,
-            lsq: LeastSquares::new(),
+            samples: SampleWindow::new(),
             smooth_factor,
+            reject_outliers: false,
             estimated_rate: rate as f64,
+            confidence: 0.0,
         })
     }
 
@@ -123,9 +276,17 @@ impl RateEstimator {
         self.last_level = 0;
         self.level_diff = 0;
         self.window_start = None;
+        self.last_check = None;
         self.window_frames = 0;
-        self.lsq = LeastSquares::new();
+        self.samples.clear();
         self.estimated_rate = rate as f64;
+        self.confidence = 0.0;
+    }
+
+    /// Sets whether samples far off the rate of the rest of their window are
+    /// left out of the estimate. Off by default.
+    pub fn set_outlier_rejection(&mut self, enable: bool) {
+        self.reject_outliers = enable;
     }
 
     /// Adds additional frames transmitted to/from audio device.
@@ -143,17 +304,38 @@ impl RateEstimator {
         self.estimated_rate
     }
 
+    /// Gets how much the last window backs the estimated rate, from 0.0 to
+    /// 1.0. It falls with the standard error of the rate fitted to the
+    /// window, reaching 0.0 at `MAX_RATE_SKEW`, and with the fraction of its
+    /// samples rejected as outliers. It is 0.0 after a reset and when the
+    /// last window was too far off to be used.
+    pub fn get_confidence(&self) -> f64 {
+        self.confidence
+    }
+
     /// Check the timestamp and buffer level difference since last check time,
     /// and use them as a new sample to update the estimated rate.
     ///
     /// # Arguments
     ///    * `level` - The current buffer level of audio device.
-    ///    * `now` - The time at which this function is called.
+    ///    * `now` - The time at which this function is called, or at which
+    ///              `level` was sampled by the hardware. Samples not later
+    ///              than the last one are ignored, a hardware timestamp
+    ///              doesn't advance until the hardware pointer moves. The
+    ///              frames added in the meantime count toward the next
+    ///              sample.
     ///
     /// # Returns
     ///    True if the estimated rate is updated and window is reset,
     ///    otherwise false.
     pub fn update_estimated_rate(&mut self, level: i32, now: Duration) -> bool {
+        if let Some(last) = self.last_check {
+            if now <= last {
+                return false;
+            }
+        }
+        self.last_check = Some(now);
+
         let start = match self.window_start {
             None => {
                 self.window_start = Some(now);
@@ -171,14 +353,17 @@ impl RateEstimator {
         self.last_level = level;
 
         let secs = (delta.as_secs() as f64) + delta.subsec_nanos() as f64 / 1_000_000_000.0;
-        self.lsq.add_sample(secs, self.window_frames as f64);
-        if delta > self.window_size && self.lsq.num_samples > 1 {
-            let rate = self.lsq.best_fit_slope();
-            if (self.estimated_rate - rate).abs() < MAX_RATE_SKEW {
-                self.estimated_rate =
-                    rate * (1.0 - self.smooth_factor) + self.estimated_rate * self.smooth_factor;
+        self.samples.add_sample(secs, self.window_frames as f64);
+        if delta > self.window_size && self.samples.len > 1 {
+            let fit = self.samples.fit(self.reject_outliers);
+            if (self.estimated_rate - fit.slope).abs() < MAX_RATE_SKEW {
+                self.estimated_rate = fit.slope * (1.0 - self.smooth_factor)
+                    + self.estimated_rate * self.smooth_factor;
+                self.confidence = (1.0 - fit.std_error / MAX_RATE_SKEW).max(0.0) * fit.inliers;
+            } else {
+                self.confidence = 0.0;
             }
-            self.lsq = LeastSquares::new();
+            self.samples.clear();
             self.window_start = Some(now);
             self.window_frames = 0;
             return true;
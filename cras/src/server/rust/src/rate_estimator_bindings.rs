@@ -8,6 +8,15 @@ use libc;
 
 use crate::RateEstimator;
 
+fn timespec_to_duration(ts: &libc::timespec) -> Option<Duration> {
+    if ts.tv_sec < 0 || ts.tv_nsec < 0 {
+        return None;
+    }
+    let secs = ts.tv_sec as u64 + (ts.tv_nsec / 1_000_000_000) as u64;
+    let nsecs = (ts.tv_nsec % 1_000_000_000) as u32;
+    Some(Duration::new(secs, nsecs))
+}
+
 /// # Safety
 ///
 /// To use this function safely, `window_size` must be a valid pointer to a
@@ -72,15 +81,59 @@ pub unsafe extern "C" fn rate_estimator_check(
         return 0;
     }
 
-    let ts = &*now;
-    if ts.tv_sec < 0 || ts.tv_nsec < 0 {
+    match timespec_to_duration(&*now) {
+        Some(now) => (*re).update_estimated_rate(level, now) as i32,
+        None => 0,
+    }
+}
+
+/// A sample for one rate estimator in `rate_estimator_check_batch`.
+///
+/// # Members
+///    * `re` - The rate estimator, or null to skip the sample.
+///    * `level` - The current buffer level of the audio device.
+///    * `now` - The time `level` was sampled at.
+///    * `updated` - Set to 1 if the estimated rate was updated, 0 otherwise.
+#[repr(C)]
+pub struct RateEstimatorSample {
+    pub re: *mut RateEstimator,
+    pub level: libc::c_int,
+    pub now: libc::timespec,
+    pub updated: libc::c_int,
+}
+
+/// Checks the samples of several rate estimators at once, as
+/// rate_estimator_check does for each of them, for a caller that samples all
+/// its devices on each wake. Returns the number of estimated rates updated.
+///
+/// # Safety
+///
+/// To use this function safely, `samples` must point to `num` samples, or be
+/// null if `num` is 0, and `re` of each sample must be a pointer returned
+/// from rate_estimator_create, or null.
+#[no_mangle]
+pub unsafe extern "C" fn rate_estimator_check_batch(
+    samples: *mut RateEstimatorSample,
+    num: libc::c_uint,
+) -> libc::c_int {
+    if samples.is_null() {
         return 0;
     }
-    let secs = ts.tv_sec as u64 + (ts.tv_nsec / 1_000_000_000) as u64;
-    let nsecs = (ts.tv_nsec % 1_000_000_000) as u32;
-    let now = Duration::new(secs, nsecs);
 
-    (*re).update_estimated_rate(level, now) as i32
+    let mut num_updated = 0;
+    for sample in std::slice::from_raw_parts_mut(samples, num as usize) {
+        sample.updated = 0;
+        if sample.re.is_null() {
+            continue;
+        }
+        if let Some(now) = timespec_to_duration(&sample.now) {
+            if (*sample.re).update_estimated_rate(sample.level, now) {
+                sample.updated = 1;
+                num_updated += 1;
+            }
+        }
+    }
+    num_updated
 }
 
 /// # Safety
@@ -96,6 +149,35 @@ pub unsafe extern "C" fn rate_estimator_get_rate(re: *const RateEstimator) -> li
     (*re).get_estimated_rate()
 }
 
+/// # Safety
+///
+/// To use this function safely, `re` must be a pointer returned from
+/// rate_estimator_create, or null.
+#[no_mangle]
+pub unsafe extern "C" fn rate_estimator_get_confidence(re: *const RateEstimator) -> libc::c_double {
+    if re.is_null() {
+        return 0.0;
+    }
+
+    (*re).get_confidence()
+}
+
+/// # Safety
+///
+/// To use this function safely, `re` must be a pointer returned from
+/// rate_estimator_create, or null.
+#[no_mangle]
+pub unsafe extern "C" fn rate_estimator_set_outlier_rejection(
+    re: *mut RateEstimator,
+    enable: libc::c_int,
+) {
+    if re.is_null() {
+        return;
+    }
+
+    (*re).set_outlier_rejection(enable != 0)
+}
+
 /// # Safety
 ///
 /// To use this function safely, `re` must be a pointer returned from
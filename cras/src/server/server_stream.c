@@ -6,9 +6,12 @@
 #include <syslog.h>
 
 #include "cras_rstream.h"
+#include "cras_sample_cache.h"
 #include "cras_server.h"
 #include "cras_system_state.h"
+#include "cras_tm.h"
 #include "cras_types.h"
+#include "cras_util.h"
 #include "server_stream.h"
 #include "stream_list.h"
 
@@ -16,11 +19,55 @@
 static unsigned int server_stream_block_size = 480;
 
 /*
- * Information of a stream created by server. Currently only
- * one server stream is allowed, for echo reference use.
+ * Information of the stream created by server for echo reference use.
+ * Only one is allowed, it takes index 0 of the server stream ids.
  */
 static struct cras_rstream_config *stream_config;
 
+/* A stream playing a cached sample, removed by a timer once the sample
+ * has played.
+ *    stream_id - The id of the stream.
+ *    stream_list - The list the stream was added to.
+ */
+struct sample_stream {
+	cras_stream_id_t stream_id;
+	struct stream_list *stream_list;
+};
+
+/* A monitor route, a capture stream pinned to the input device that writes
+ * its frames to a playback stream pinned to the output device.
+ *    input_dev_idx, output_dev_idx - The devices connected.
+ *    input_id, output_id - The ids of the two streams.
+ */
+struct monitor_route {
+	unsigned int input_dev_idx;
+	unsigned int output_dev_idx;
+	cras_stream_id_t input_id;
+	cras_stream_id_t output_id;
+	struct monitor_route *prev, *next;
+};
+
+static struct monitor_route *monitor_routes;
+
+/* Frames the streams of a monitor route move at a time. Smaller than the
+ * block of the other server streams, the route adds up to two of them to
+ * the latency of the devices. */
+static unsigned int monitor_block_size = 240;
+
+/* Index of the next server stream id used to play a sample or for a
+ * monitor route. */
+static uint16_t next_sample_stream_idx = 1;
+
+static cras_stream_id_t next_server_stream_id(void)
+{
+	cras_stream_id_t id = cras_get_stream_id(SERVER_STREAM_CLIENT_ID,
+						 next_sample_stream_idx);
+
+	if (++next_sample_stream_idx == 0)
+		next_sample_stream_idx = 1;
+	return id;
+}
+
 /* Actually create the server stream and add to stream list. */
 static void server_stream_add_cb(void *data)
 {
@@ -85,3 +132,153 @@ void server_stream_destroy(struct stream_list *stream_list,
 	}
 	server_stream_rm_cb(stream_list);
 }
+
+static void sample_stream_done(struct cras_timer *timer, void *data)
+{
+	struct sample_stream *ss = (struct sample_stream *)data;
+
+	/* The removal drains what the device hasn't played yet. */
+	stream_list_rm(ss->stream_list, ss->stream_id);
+	free(ss);
+}
+
+int server_stream_play_sample(struct stream_list *stream_list,
+			      unsigned int dev_idx, struct cras_sample *sample)
+{
+	struct cras_rstream_config config;
+	struct cras_rstream *stream;
+	struct sample_stream *ss;
+	int audio_fd = -1;
+	int client_shm_fd = -1;
+	uint64_t buffer_offsets[2] = { 0, 0 };
+	unsigned int ms;
+	int rc;
+
+	ss = (struct sample_stream *)calloc(1, sizeof(*ss));
+	if (!ss)
+		return -ENOMEM;
+	ss->stream_list = stream_list;
+	ss->stream_id = next_server_stream_id();
+
+	cras_rstream_config_init(
+		/*client=*/NULL, ss->stream_id, CRAS_STREAM_TYPE_DEFAULT,
+		CRAS_CLIENT_TYPE_SERVER_STREAM, CRAS_STREAM_OUTPUT, dev_idx,
+		/*flags=*/SERVER_ONLY,
+		/*effects=*/0, &sample->format, server_stream_block_size,
+		server_stream_block_size, &audio_fd, &client_shm_fd,
+		/*client_shm_size=*/0, buffer_offsets, &config);
+	config.sample = sample;
+
+	rc = stream_list_add(stream_list, &config, &stream);
+	if (rc) {
+		syslog(LOG_ERR, "Failed to play sample %u: %d", sample->id,
+		       rc);
+		free(ss);
+		return rc;
+	}
+
+	ms = cras_frames_to_ms(sample->frames, sample->format.frame_rate) + 1;
+	if (!cras_tm_create_timer(cras_system_state_get_tm(), ms,
+				  sample_stream_done, ss)) {
+		sample_stream_done(NULL, ss);
+		return -ENOMEM;
+	}
+	return 0;
+}
+
+static struct monitor_route *find_monitor_route(unsigned int input_dev_idx,
+					       unsigned int output_dev_idx)
+{
+	struct monitor_route *route;
+
+	DL_FOREACH (monitor_routes, route) {
+		if (route->input_dev_idx == input_dev_idx &&
+		    route->output_dev_idx == output_dev_idx)
+			return route;
+	}
+	return NULL;
+}
+
+int server_stream_add_monitor(struct stream_list *stream_list,
+			      unsigned int input_dev_idx,
+			      unsigned int output_dev_idx,
+			      const struct cras_audio_format *format,
+			      uint32_t effects, float gain)
+{
+	struct cras_rstream_config config;
+	struct cras_rstream *output, *input;
+	struct monitor_route *route;
+	int audio_fd = -1;
+	int client_shm_fd = -1;
+	uint64_t buffer_offsets[2] = { 0, 0 };
+	int rc;
+
+	if (input_dev_idx == NO_DEVICE || output_dev_idx == NO_DEVICE ||
+	    gain < 0.0f)
+		return -EINVAL;
+	if (find_monitor_route(input_dev_idx, output_dev_idx))
+		return -EEXIST;
+
+	route = (struct monitor_route *)calloc(1, sizeof(*route));
+	if (!route)
+		return -ENOMEM;
+	route->input_dev_idx = input_dev_idx;
+	route->output_dev_idx = output_dev_idx;
+	route->output_id = next_server_stream_id();
+	route->input_id = next_server_stream_id();
+
+	/* The playback side goes first, so the capture side always has
+	 * somewhere to write. */
+	cras_rstream_config_init(
+		/*client=*/NULL, route->output_id, CRAS_STREAM_TYPE_DEFAULT,
+		CRAS_CLIENT_TYPE_SERVER_STREAM, CRAS_STREAM_OUTPUT,
+		output_dev_idx, /*flags=*/SERVER_ONLY,
+		/*effects=*/0, format, monitor_block_size, monitor_block_size,
+		&audio_fd, &client_shm_fd,
+		/*client_shm_size=*/0, buffer_offsets, &config);
+	config.is_monitor = 1;
+	rc = stream_list_add(stream_list, &config, &output);
+	if (rc)
+		goto free_route;
+	cras_shm_set_volume_scaler(cras_rstream_shm(output), gain);
+
+	cras_rstream_config_init(
+		/*client=*/NULL, route->input_id, CRAS_STREAM_TYPE_DEFAULT,
+		CRAS_CLIENT_TYPE_SERVER_STREAM, CRAS_STREAM_INPUT,
+		input_dev_idx, /*flags=*/SERVER_ONLY, effects, format,
+		monitor_block_size, monitor_block_size, &audio_fd,
+		&client_shm_fd, /*client_shm_size=*/0, buffer_offsets, &config);
+	config.monitor = output;
+	rc = stream_list_add(stream_list, &config, &input);
+	if (rc)
+		goto rm_output;
+
+	DL_APPEND(monitor_routes, route);
+	return 0;
+
+rm_output:
+	stream_list_rm(stream_list, route->output_id);
+free_route:
+	syslog(LOG_ERR, "Failed to add monitor route %u to %u: %d",
+	       input_dev_idx, output_dev_idx, rc);
+	free(route);
+	return rc;
+}
+
+int server_stream_rm_monitor(struct stream_list *stream_list,
+			     unsigned int input_dev_idx,
+			     unsigned int output_dev_idx)
+{
+	struct monitor_route *route;
+
+	route = find_monitor_route(input_dev_idx, output_dev_idx);
+	if (!route)
+		return -ENOENT;
+
+	/* The capture side goes first, it writes to the playback side. */
+	stream_list_rm(stream_list, route->input_id);
+	stream_list_rm(stream_list, route->output_id);
+	DL_DELETE(monitor_routes, route);
+	free(route);
+	return 0;
+}
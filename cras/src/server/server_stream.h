@@ -6,6 +6,7 @@
 #ifndef SERVER_STREAM_H_
 #define SERVER_STREAM_H_
 
+struct cras_sample;
 struct stream_list;
 
 /*
@@ -26,4 +27,53 @@ void server_stream_create(struct stream_list *stream_list, unsigned int dev_idx,
 void server_stream_destroy(struct stream_list *stream_list,
 			   unsigned int dev_idx);
 
+/*
+ * Plays a sample from the sample cache once, in a server stream that reads
+ * it directly. The stream is removed once the sample has played.
+ * Args:
+ *    stream_list - List of stream to add the new server stream to.
+ *    dev_idx - The device to pin the stream to, NO_DEVICE to not pin it.
+ *    sample - The sample to play, the stream keeps a reference to it.
+ * Returns:
+ *    0 on success, or a negative error from adding the stream.
+ */
+int server_stream_play_sample(struct stream_list *stream_list,
+			      unsigned int dev_idx, struct cras_sample *sample);
+
+/*
+ * Adds a monitor route that plays what an input device captures on an
+ * output device, like a client capturing and playing it back would, without
+ * the round trips through a client. The captured frames are converted to
+ * format on the input and from it on the output, and are mixed to the
+ * output in the same audio thread wake they are captured in when the two
+ * devices share the thread. The DSP of both devices applies.
+ * Args:
+ *    stream_list - List of stream to add the two streams of the route to.
+ *    input_dev_idx - The device to capture from.
+ *    output_dev_idx - The device to play to.
+ *    format - The format the frames are moved in.
+ *    effects - The APM effects to apply to the captured frames.
+ *    gain - The scaler applied to the frames played.
+ * Returns:
+ *    0 on success, -EEXIST if the devices are already routed, or a negative
+ *    error from adding the streams.
+ */
+int server_stream_add_monitor(struct stream_list *stream_list,
+			      unsigned int input_dev_idx,
+			      unsigned int output_dev_idx,
+			      const struct cras_audio_format *format,
+			      uint32_t effects, float gain);
+
+/*
+ * Removes the monitor route between two devices.
+ * Args:
+ *    stream_list - List of stream the route was added to.
+ *    input_dev_idx, output_dev_idx - The devices of the route.
+ * Returns:
+ *    0 on success, -ENOENT if there is no such route.
+ */
+int server_stream_rm_monitor(struct stream_list *stream_list,
+			     unsigned int input_dev_idx,
+			     unsigned int output_dev_idx);
+
 #endif /* SERVER_STREAM_H_ */
@@ -0,0 +1,65 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#include <sys/param.h>
+
+#include "silence_gate.h"
+
+/* The gate opens above about -60 dBFS and closes below about -66 dBFS. */
+#define SILENCE_GATE_OPEN_LEVEL 33
+#define SILENCE_GATE_CLOSE_LEVEL 16
+/* How long the audio must stay quiet before the gate closes. */
+#define SILENCE_GATE_HOLD_MS 300
+
+void silence_gate_disable(struct silence_gate *gate)
+{
+	gate->enabled = 0;
+	gate->silent = 0;
+}
+
+void silence_gate_init(struct silence_gate *gate, unsigned int rate)
+{
+	gate->enabled = 1;
+	gate->silent = 0;
+	gate->hold_frames = rate * SILENCE_GATE_HOLD_MS / 1000;
+	gate->quiet_frames = 0;
+}
+
+bool silence_gate_process_area(struct silence_gate *gate, const int16_t *buf,
+			       const struct cras_audio_area *area,
+			       unsigned int size)
+{
+	unsigned int i, ch;
+	int32_t s, peak = 0;
+
+	if (!gate->enabled)
+		return false;
+	if (size == 0)
+		return gate->silent;
+
+	/* Check every frame, a subsampled tone could look silent. */
+	for (i = 0; i < size; i++) {
+		for (ch = 0; ch < area->num_channels; ch++) {
+			if (area->channels[ch].ch_set == 0)
+				continue;
+			s = buf[i * area->num_channels + ch];
+			peak = MAX(peak, s * s);
+		}
+	}
+
+	if (peak > SILENCE_GATE_OPEN_LEVEL * SILENCE_GATE_OPEN_LEVEL) {
+		gate->quiet_frames = 0;
+		gate->silent = 0;
+	} else if (peak < SILENCE_GATE_CLOSE_LEVEL * SILENCE_GATE_CLOSE_LEVEL) {
+		gate->quiet_frames =
+			MIN(gate->quiet_frames + size, gate->hold_frames);
+		if (gate->quiet_frames >= gate->hold_frames)
+			gate->silent = 1;
+	} else if (!gate->silent) {
+		/* Between the levels the gate stays as it is. */
+		gate->quiet_frames = 0;
+	}
+	return gate->silent;
+}
@@ -0,0 +1,63 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ */
+
+#ifndef SILENCE_GATE_H_
+#define SILENCE_GATE_H_
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "cras_audio_area.h"
+
+/*
+ * The silence gate tells when the captured audio is silence, so that streams
+ * which don't mind can skip converting and processing it. The peak of each
+ * block is checked against two levels: the gate closes once the audio has
+ * stayed below the lower level for the hold time, and opens again as soon
+ * as a block goes above the higher one, so the onset of speech is never
+ * taken for silence.
+ * Members:
+ *    enabled - Flag to enable the gate. Set to false to never report
+ *        silence.
+ *    silent - Set while the gate is closed.
+ *    hold_frames - How many frames the audio must stay quiet before the
+ *        gate closes.
+ *    quiet_frames - How many frames the audio has been quiet for.
+ */
+struct silence_gate {
+	bool enabled;
+	bool silent;
+	unsigned int hold_frames;
+	unsigned int quiet_frames;
+};
+
+/*
+ * Disables the silence gate.
+ */
+void silence_gate_disable(struct silence_gate *gate);
+
+/*
+ * Initializes the silence gate, open.
+ * Args:
+ *    gate - The silence_gate object to initialize.
+ *    rate - The sample rate of the audio data the gate will check.
+ */
+void silence_gate_init(struct silence_gate *gate, unsigned int rate);
+
+/*
+ * Feeds interleaved S16 audio data described by area to the silence gate.
+ * Args:
+ *    gate - The silence_gate object to update.
+ *    buf - Pointer to the audio data.
+ *    area - The area describing the channels of the audio data.
+ *    size - Length in frames of the audio data.
+ * Returns:
+ *    True if the gate is closed after this audio data.
+ */
+bool silence_gate_process_area(struct silence_gate *gate, const int16_t *buf,
+			       const struct cras_audio_area *area,
+			       unsigned int size);
+
+#endif /* SILENCE_GATE_H_ */
@@ -4,6 +4,7 @@
  */
 
 #include <syslog.h>
+#include "cras_id_map.h"
 #include "cras_rstream.h"
 #include "cras_tm.h"
 #include "cras_types.h"
@@ -18,6 +19,7 @@ static const struct timespec RTC_STREAM_THRESHOLD = { 10, 0 };
 
 struct stream_list {
 	struct cras_rstream *streams;
+	struct cras_id_map *stream_index;
 	struct cras_rstream *streams_to_delete;
 	stream_callback *stream_added_cb;
 	stream_callback *stream_removed_cb;
@@ -25,8 +27,28 @@ struct stream_list {
 	stream_destroy_func *stream_destroy_cb;
 	struct cras_tm *timer_manager;
 	struct cras_timer *drain_timer;
+	bool batched;
 };
 
+/* How long after the time a stream was said to take to drain it's checked
+ * again, in case the audio thread never reports it played out. */
+#define DRAIN_FALLBACK_SLACK_MS 100
+
+/* Destroys a stream to delete once the audio threads are done with it.
+ * Returns the number of milliseconds left to drain it, 0 if destroyed. */
+static int try_delete_stream(struct stream_list *list,
+			     struct cras_rstream *to_delete)
+{
+	int drain_delay;
+
+	drain_delay = list->stream_removed_cb(to_delete);
+	if (drain_delay)
+		return drain_delay;
+	DL_DELETE(list->streams_to_delete, to_delete);
+	list->stream_destroy_cb(to_delete);
+	return 0;
+}
+
 static void delete_streams(struct cras_timer *timer, void *data)
 {
 	struct cras_rstream *to_delete;
@@ -34,23 +56,31 @@ static void delete_streams(struct cras_timer *timer, void *data)
 	int max_drain_delay = 0;
 
 	DL_FOREACH (list->streams_to_delete, to_delete) {
-		int drain_delay;
+		int drain_delay = try_delete_stream(list, to_delete);
 
-		drain_delay = list->stream_removed_cb(to_delete);
-		if (drain_delay) {
-			max_drain_delay = MAX(max_drain_delay, drain_delay);
-			continue;
-		}
-		DL_DELETE(list->streams_to_delete, to_delete);
-		list->stream_destroy_cb(to_delete);
+		max_drain_delay = MAX(max_drain_delay, drain_delay);
 	}
 
+	/* Draining streams are finished by stream_list_stream_drained(), the
+	 * timer is only a fallback for a device that stopped playing. */
 	list->drain_timer = NULL;
 	if (max_drain_delay)
-		list->drain_timer =
-			cras_tm_create_timer(list->timer_manager,
-					     MAX(max_drain_delay, 10),
-					     delete_streams, list);
+		list->drain_timer = cras_tm_create_timer(
+			list->timer_manager,
+			max_drain_delay + DRAIN_FALLBACK_SLACK_MS,
+			delete_streams, list);
+}
+
+/* Starts draining the streams to delete, unless a batch defers it. */
+static void flush_streams_to_delete(struct stream_list *list)
+{
+	if (list->batched)
+		return;
+	if (list->drain_timer) {
+		cras_tm_cancel_timer(list->timer_manager, list->drain_timer);
+		list->drain_timer = NULL;
+	}
+	delete_streams(NULL, list);
 }
 
 /*
@@ -65,6 +95,9 @@ struct stream_list *stream_list_create(stream_callback *add_cb,
 {
 	struct stream_list *list = calloc(1, sizeof(struct stream_list));
 
+	/* Streams are looked up by id, with hundreds of them a list walk for
+	 * every removal adds up. */
+	list->stream_index = cras_id_map_create();
 	list->stream_added_cb = add_cb;
 	list->stream_removed_cb = rm_cb;
 	list->stream_create_cb = create_cb;
@@ -75,6 +108,7 @@ struct stream_list *stream_list_create(stream_callback *add_cb,
 
 void stream_list_destroy(struct stream_list *list)
 {
+	cras_id_map_destroy(list->stream_index);
 	free(list);
 }
 
@@ -94,6 +128,13 @@ int stream_list_add(struct stream_list *list,
 	if (rc)
 		return rc;
 
+	rc = cras_id_map_insert(list->stream_index, (*stream)->stream_id,
+				*stream);
+	if (rc) {
+		list->stream_destroy_cb(*stream);
+		return rc;
+	}
+
 	/* Keep stream list in descending order by channel count. */
 	DL_FOREACH (list->streams, next_stream) {
 		if ((*stream)->format.num_channels >=
@@ -104,26 +145,29 @@ int stream_list_add(struct stream_list *list,
 	rc = list->stream_added_cb(*stream);
 	if (rc) {
 		DL_DELETE(list->streams, *stream);
+		cras_id_map_remove(list->stream_index, (*stream)->stream_id);
 		list->stream_destroy_cb(*stream);
 	}
 
 	return rc;
 }
 
+struct cras_rstream *stream_list_find(struct stream_list *list,
+				      cras_stream_id_t id)
+{
+	return (struct cras_rstream *)cras_id_map_find(list->stream_index, id);
+}
+
 int stream_list_rm(struct stream_list *list, cras_stream_id_t id)
 {
 	struct cras_rstream *to_remove;
 
-	DL_SEARCH_SCALAR(list->streams, to_remove, stream_id, id);
+	to_remove = cras_id_map_remove(list->stream_index, id);
 	if (!to_remove)
 		return -EINVAL;
 	DL_DELETE(list->streams, to_remove);
 	DL_APPEND(list->streams_to_delete, to_remove);
-	if (list->drain_timer) {
-		cras_tm_cancel_timer(list->timer_manager, list->drain_timer);
-		list->drain_timer = NULL;
-	}
-	delete_streams(NULL, list);
+	flush_streams_to_delete(list);
 
 	return 0;
 }
@@ -136,17 +180,49 @@ int stream_list_rm_all_client_streams(struct stream_list *list,
 
 	DL_FOREACH (list->streams, to_remove) {
 		if (to_remove->client == rclient) {
+			cras_id_map_remove(list->stream_index,
+					   to_remove->stream_id);
 			DL_DELETE(list->streams, to_remove);
 			DL_APPEND(list->streams_to_delete, to_remove);
 		}
 	}
-	if (list->drain_timer) {
+	flush_streams_to_delete(list);
+
+	/* The client is freed next, the streams still draining outlive it. */
+	DL_FOREACH (list->streams_to_delete, to_remove) {
+		if (to_remove->client == rclient)
+			to_remove->client = NULL;
+	}
+
+	return rc;
+}
+
+void stream_list_stream_drained(struct stream_list *list, cras_stream_id_t id)
+{
+	struct cras_rstream *to_delete;
+
+	/* The batch end drains all the streams held. */
+	if (list->batched)
+		return;
+	DL_SEARCH_SCALAR(list->streams_to_delete, to_delete, stream_id, id);
+	if (!to_delete || try_delete_stream(list, to_delete))
+		return;
+	if (!list->streams_to_delete && list->drain_timer) {
 		cras_tm_cancel_timer(list->timer_manager, list->drain_timer);
 		list->drain_timer = NULL;
 	}
-	delete_streams(NULL, list);
+}
 
-	return rc;
+void stream_list_begin_batch(struct stream_list *list)
+{
+	list->batched = true;
+}
+
+void stream_list_end_batch(struct stream_list *list)
+{
+	list->batched = false;
+	if (list->streams_to_delete)
+		flush_streams_to_delete(list);
 }
 
 bool stream_list_has_pinned_stream(struct stream_list *list,
@@ -12,6 +12,7 @@ struct cras_rclient;
 struct cras_rstream;
 struct cras_rstream_config;
 struct cras_audio_format;
+struct cras_tm;
 struct stream_list;
 
 typedef int(stream_callback)(struct cras_rstream *rstream);
@@ -45,11 +46,28 @@ int stream_list_add(struct stream_list *list,
 		    struct cras_rstream_config *stream_config,
 		    struct cras_rstream **stream);
 
+/* Returns the stream with the given id, NULL if there is none. */
+struct cras_rstream *stream_list_find(struct stream_list *list,
+				      cras_stream_id_t id);
+
 int stream_list_rm(struct stream_list *list, cras_stream_id_t id);
 
 int stream_list_rm_all_client_streams(struct stream_list *list,
 				      struct cras_rclient *rclient);
 
+/* Destroys a removed stream that was left draining, now that the audio
+ * thread reports it played out. Ids of other streams are ignored.
+ * Args:
+ *   list - stream_list the stream was removed from.
+ *   id - The id of the drained stream.
+ */
+void stream_list_stream_drained(struct stream_list *list, cras_stream_id_t id);
+
+/* Holds the streams removed until stream_list_end_batch(), which drains and
+ * destroys all of them in one pass. */
+void stream_list_begin_batch(struct stream_list *list);
+void stream_list_end_batch(struct stream_list *list);
+
 /*
  * Checks if there is a stream pinned to the given device.
  */
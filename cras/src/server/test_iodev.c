@@ -27,11 +27,24 @@ static size_t test_supported_channel_counts[] = { 1, 0 };
 
 static snd_pcm_format_t test_supported_formats[] = { SND_PCM_FORMAT_S16_LE, 0 };
 
+static size_t offline_supported_rates[] = { 48000, 44100, 16000, 0 };
+
+static size_t offline_supported_channel_counts[] = { 2, 1, 0 };
+
+/*
+ * Members:
+ *    start_ts - When an offline device was configured, its clock runs from
+ *        here at the device rate.
+ *    frames_moved - Frames an offline device has played to or captured from
+ *        fd since start_ts.
+ */
 struct test_iodev {
 	struct cras_iodev base;
 	int fd;
 	struct byte_buffer *audbuff;
 	unsigned int fmt_bytes;
+	struct timespec start_ts;
+	uint64_t frames_moved;
 };
 
 /*
@@ -51,6 +64,73 @@ static int frames_queued(const struct cras_iodev *iodev,
 	return available / testio->fmt_bytes;
 }
 
+/* Plays the frames due by now from the buffer to the file. Time spent with
+ * nothing queued is lost, as it is on a real device that underruns. */
+static void offline_play(struct test_iodev *testio, uint64_t due)
+{
+	unsigned int readable, frames;
+	uint8_t *buff;
+
+	while (testio->frames_moved < due) {
+		buff = buf_read_pointer_size(testio->audbuff, &readable);
+		frames = MIN(readable / testio->fmt_bytes,
+			     due - testio->frames_moved);
+		if (frames == 0)
+			break;
+		if (testio->fd >= 0 &&
+		    write(testio->fd, buff, frames * testio->fmt_bytes) < 0) {
+			syslog(LOG_ERR, "Offline dev write failed: %d", errno);
+			testio->fd = -1;
+		}
+		buf_increment_read(testio->audbuff,
+				   (size_t)frames * testio->fmt_bytes);
+		testio->frames_moved += frames;
+	}
+	testio->frames_moved = due;
+}
+
+/* Captures the frames due by now from the file into the buffer, silence
+ * once the file ends. Frames that don't fit are dropped like an overrun. */
+static void offline_capture(struct test_iodev *testio, uint64_t due)
+{
+	unsigned int writable, frames;
+	uint8_t *buff;
+	ssize_t nread = 0;
+
+	while (testio->frames_moved < due) {
+		buff = buf_write_pointer_size(testio->audbuff, &writable);
+		frames = MIN(writable / testio->fmt_bytes,
+			     due - testio->frames_moved);
+		if (frames == 0)
+			break;
+		if (testio->fd >= 0)
+			nread = read(testio->fd, buff,
+				     frames * testio->fmt_bytes);
+		if (nread < 0)
+			nread = 0;
+		memset(buff + nread, 0, frames * testio->fmt_bytes - nread);
+		buf_increment_write(testio->audbuff,
+				    (size_t)frames * testio->fmt_bytes);
+		testio->frames_moved += frames;
+	}
+	testio->frames_moved = due;
+}
+
+static int offline_frames_queued(const struct cras_iodev *iodev,
+				 struct timespec *tstamp)
+{
+	struct test_iodev *testio = (struct test_iodev *)iodev;
+	uint64_t due = cras_frames_since_time(&testio->start_ts,
+					      iodev->format->frame_rate);
+
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		offline_play(testio, due);
+	else
+		offline_capture(testio, due);
+	clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+	return buf_queued(testio->audbuff) / testio->fmt_bytes;
+}
+
 static int delay_frames(const struct cras_iodev *iodev)
 {
 	return 0;
@@ -77,19 +157,35 @@ static int configure_dev(struct cras_iodev *iodev)
 	testio->fmt_bytes = cras_get_format_bytes(iodev->format);
 	testio->audbuff =
 		byte_buffer_create(TEST_BUFFER_SIZE * testio->fmt_bytes);
+	clock_gettime(CLOCK_MONOTONIC_RAW, &testio->start_ts);
+	testio->frames_moved = 0;
+
+	return 0;
+}
+
+static int put_buffer(struct cras_iodev *iodev, unsigned frames)
+{
+	struct test_iodev *testio = (struct test_iodev *)iodev;
+
+	/* Input */
+	buf_increment_read(testio->audbuff,
+			   (size_t)frames * (size_t)testio->fmt_bytes);
 
 	return 0;
 }
 
-static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
-		      unsigned *frames)
+static int offline_get_buffer(struct cras_iodev *iodev,
+			      struct cras_audio_area **area, unsigned *frames)
 {
 	struct test_iodev *testio = (struct test_iodev *)iodev;
-	unsigned int readable;
+	unsigned int avail;
 	uint8_t *buff;
 
-	buff = buf_read_pointer_size(testio->audbuff, &readable);
-	*frames = MIN(*frames, readable);
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		buff = buf_write_pointer_size(testio->audbuff, &avail);
+	else
+		buff = buf_read_pointer_size(testio->audbuff, &avail);
+	*frames = MIN(*frames, avail / testio->fmt_bytes);
 
 	iodev->area->frames = *frames;
 	cras_audio_area_config_buf_pointers(iodev->area, iodev->format, buff);
@@ -97,17 +193,27 @@ static int get_buffer(struct cras_iodev *iodev, struct cras_audio_area **area,
 	return 0;
 }
 
-static int put_buffer(struct cras_iodev *iodev, unsigned frames)
+static int offline_put_buffer(struct cras_iodev *iodev, unsigned frames)
 {
 	struct test_iodev *testio = (struct test_iodev *)iodev;
+	size_t bytes = (size_t)frames * (size_t)testio->fmt_bytes;
 
-	/* Input */
-	buf_increment_read(testio->audbuff,
-			   (size_t)frames * (size_t)testio->fmt_bytes);
-
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		buf_increment_write(testio->audbuff, bytes);
+	else
+		buf_increment_read(testio->audbuff, bytes);
 	return 0;
 }
 
+static int offline_flush_buffer(struct cras_iodev *iodev)
+{
+	struct test_iodev *testio = (struct test_iodev *)iodev;
+	unsigned int queued = buf_queued(testio->audbuff);
+
+	buf_increment_read(testio->audbuff, queued);
+	return queued / testio->fmt_bytes;
+}
+
 static int get_buffer_fd_read(struct cras_iodev *iodev,
 			      struct cras_audio_area **area, unsigned *frames)
 {
@@ -169,7 +275,7 @@ struct cras_iodev *test_iodev_create(enum CRAS_STREAM_DIRECTION direction,
 	struct cras_iodev *iodev;
 	struct cras_ionode *node;
 
-	if (direction != CRAS_STREAM_INPUT || type != TEST_IODEV_HOTWORD)
+	if (type == TEST_IODEV_HOTWORD && direction != CRAS_STREAM_INPUT)
 		return NULL;
 
 	testio = calloc(1, sizeof(*testio));
@@ -179,27 +285,36 @@ struct cras_iodev *test_iodev_create(enum CRAS_STREAM_DIRECTION direction,
 	iodev->direction = direction;
 	testio->fd = -1;
 
-	iodev->supported_rates = test_supported_rates;
-	iodev->supported_channel_counts = test_supported_channel_counts;
 	iodev->supported_formats = test_supported_formats;
 	iodev->buffer_size = TEST_BUFFER_SIZE;
 
 	iodev->configure_dev = configure_dev;
 	iodev->close_dev = close_dev;
-	iodev->frames_queued = frames_queued;
 	iodev->delay_frames = delay_frames;
-	if (type == TEST_IODEV_HOTWORD)
-		iodev->get_buffer = get_buffer_fd_read;
-	else
-		iodev->get_buffer = get_buffer;
-	iodev->put_buffer = put_buffer;
 	iodev->update_active_node = update_active_node;
-
-	/*
-	 * Record max supported channels into cras_iodev_info.
-	 * The value is the max of test_supported_channel_counts.
-	 */
-	iodev->info.max_supported_channels = 1;
+	if (type == TEST_IODEV_OFFLINE) {
+		iodev->supported_rates = offline_supported_rates;
+		iodev->supported_channel_counts =
+			offline_supported_channel_counts;
+		iodev->frames_queued = offline_frames_queued;
+		iodev->get_buffer = offline_get_buffer;
+		iodev->put_buffer = offline_put_buffer;
+		iodev->flush_buffer = offline_flush_buffer;
+		iodev->no_stream = cras_iodev_default_no_stream_playback;
+		iodev->info.max_supported_channels = 2;
+	} else {
+		iodev->supported_rates = test_supported_rates;
+		iodev->supported_channel_counts =
+			test_supported_channel_counts;
+		iodev->frames_queued = frames_queued;
+		iodev->get_buffer = get_buffer_fd_read;
+		iodev->put_buffer = put_buffer;
+		/*
+		 * Record max supported channels into cras_iodev_info.
+		 * The value is the max of test_supported_channel_counts.
+		 */
+		iodev->info.max_supported_channels = 1;
+	}
 
 	/* Create an empty ionode */
 	node = (struct cras_ionode *)calloc(1, sizeof(*node));
@@ -219,7 +334,10 @@ struct cras_iodev *test_iodev_create(enum CRAS_STREAM_DIRECTION direction,
 	/* Finally add it to the appropriate iodev list. */
 	snprintf(iodev->info.name, ARRAY_SIZE(iodev->info.name), "Tester");
 	iodev->info.name[ARRAY_SIZE(iodev->info.name) - 1] = '\0';
-	cras_iodev_list_add_input(iodev);
+	if (direction == CRAS_STREAM_OUTPUT)
+		cras_iodev_list_add_output(iodev);
+	else
+		cras_iodev_list_add_input(iodev);
 
 	return iodev;
 }
@@ -228,7 +346,10 @@ void test_iodev_destroy(struct cras_iodev *iodev)
 {
 	struct test_iodev *testio = (struct test_iodev *)iodev;
 
-	cras_iodev_list_rm_input(iodev);
+	if (iodev->direction == CRAS_STREAM_OUTPUT)
+		cras_iodev_list_rm_output(iodev);
+	else
+		cras_iodev_list_rm_input(iodev);
 	free(iodev->active_node);
 	cras_iodev_free_resources(iodev);
 	free(testio);
@@ -248,6 +369,13 @@ unsigned int test_iodev_add_samples(struct test_iodev *testio, uint8_t *samples,
 	return count;
 }
 
+void test_iodev_set_fd(struct cras_iodev *iodev, int fd)
+{
+	struct test_iodev *testio = (struct test_iodev *)iodev;
+
+	testio->fd = fd;
+}
+
 void test_iodev_command(struct cras_iodev *iodev,
 			enum CRAS_TEST_IODEV_CMD command, unsigned int data_len,
 			const uint8_t *data)
@@ -24,6 +24,12 @@ struct cras_iodev *test_iodev_create(enum CRAS_STREAM_DIRECTION direction,
 /* Destroys an test_iodev created with test_iodev_create. */
 void test_iodev_destroy(struct cras_iodev *iodev);
 
+/* Sets the file an offline test iodev plays to or captures from. The device
+ * moves frames at its rate by CLOCK_MONOTONIC_RAW, so a caller controlling
+ * that clock can run it faster than real time. The caller keeps ownership
+ * of fd, -1 plays to nowhere or captures silence. */
+void test_iodev_set_fd(struct cras_iodev *iodev, int fd);
+
 /* Handle a test commdn to the given iodev. */
 void test_iodev_command(struct cras_iodev *iodev,
 			enum CRAS_TEST_IODEV_CMD command, unsigned int data_len,
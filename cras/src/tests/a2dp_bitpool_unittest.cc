@@ -0,0 +1,96 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <time.h>
+
+extern "C" {
+#include "cras_a2dp_bitpool.h"
+}
+
+#define SNDBUF 4000
+
+namespace {
+
+class A2dpBitpoolTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    now_.tv_sec = 100;
+    now_.tv_nsec = 0;
+    on_time_.tv_sec = 0;
+    on_time_.tv_nsec = 0;
+    cras_a2dp_bitpool_init(&bp_, 10, 53, &now_);
+  }
+
+  // Advances the time by ms milliseconds.
+  void Advance(long ms) {
+    now_.tv_nsec += ms * 1000000;
+    now_.tv_sec += now_.tv_nsec / 1000000000;
+    now_.tv_nsec %= 1000000000;
+  }
+
+  unsigned int Update(unsigned int queued) {
+    return cras_a2dp_bitpool_update(&bp_, queued, SNDBUF, &on_time_, &now_);
+  }
+
+  struct cras_a2dp_bitpool bp_;
+  struct timespec now_;
+  struct timespec on_time_;
+};
+
+TEST_F(A2dpBitpoolTestSuite, StaysHighOnClearLink) {
+  for (int i = 0; i < 100; i++) {
+    EXPECT_EQ(53, Update(0));
+    Advance(20);
+  }
+}
+
+TEST_F(A2dpBitpoolTestSuite, BacklogLowersOncePerInterval) {
+  EXPECT_EQ(48, Update(SNDBUF));
+  // The socket gets time to drain before it's lowered again.
+  Advance(50);
+  EXPECT_EQ(48, Update(SNDBUF));
+  Advance(60);
+  EXPECT_EQ(43, Update(SNDBUF));
+
+  // Not below the lowest.
+  for (int i = 0; i < 10; i++) {
+    Advance(110);
+    Update(SNDBUF);
+  }
+  EXPECT_EQ(10, Update(SNDBUF));
+}
+
+TEST_F(A2dpBitpoolTestSuite, LateWriteLowers) {
+  struct timespec late = {0, 30000000};
+
+  EXPECT_EQ(48, cras_a2dp_bitpool_update(&bp_, 0, SNDBUF, &late, &now_));
+}
+
+TEST_F(A2dpBitpoolTestSuite, RaisesAfterKeepingUp) {
+  EXPECT_EQ(48, Update(SNDBUF));
+
+  // Some backlog holds the bitpool.
+  Advance(900);
+  EXPECT_EQ(48, Update(SNDBUF / 3));
+  Advance(900);
+  EXPECT_EQ(48, Update(0));
+
+  // A second clear after the backlog.
+  Advance(200);
+  EXPECT_EQ(50, Update(0));
+  Advance(500);
+  EXPECT_EQ(50, Update(0));
+  Advance(600);
+  EXPECT_EQ(52, Update(0));
+  Advance(1100);
+  EXPECT_EQ(53, Update(0));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,93 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <string.h>
+
+extern "C" {
+#include "a2dp-codecs.h"
+#include "cras_a2dp_codec.h"
+#include "sbc_codec_stub.h"
+}
+
+namespace {
+
+TEST(A2dpCodec, PreferAacOverSbc) {
+  EXPECT_EQ(A2DP_CODEC_MPEG24, cras_a2dp_codec_get_nth(0)->id);
+  EXPECT_EQ(A2DP_CODEC_SBC, cras_a2dp_codec_get_nth(1)->id);
+  EXPECT_EQ(NULL, cras_a2dp_codec_get_nth(2));
+  EXPECT_EQ(NULL, cras_a2dp_codec_get(0x33));
+}
+
+TEST(A2dpCodec, OnlySbcHasEncoder) {
+  EXPECT_NE((void*)NULL, cras_a2dp_codec_get(A2DP_CODEC_SBC)->impl);
+  EXPECT_EQ(NULL, cras_a2dp_codec_get(A2DP_CODEC_MPEG24)->impl);
+  EXPECT_EQ(-EINVAL, cras_a2dp_codec_set_impl(0x33, NULL));
+}
+
+TEST(A2dpCodec, SbcSelectHighest) {
+  const struct cras_a2dp_codec* codec = cras_a2dp_codec_get(A2DP_CODEC_SBC);
+  a2dp_sbc_t caps, config;
+  size_t rate, channels;
+
+  codec->get_capabilities(&caps);
+  caps.frequency &= ~SBC_SAMPLING_FREQ_48000;
+  caps.max_bitpool = 200;
+  ASSERT_EQ(0, codec->select_configuration(&caps, &config));
+  EXPECT_EQ(SBC_CHANNEL_MODE_JOINT_STEREO, config.channel_mode);
+  EXPECT_EQ(SBC_SAMPLING_FREQ_44100, config.frequency);
+  EXPECT_EQ(SBC_BLOCK_LENGTH_16, config.block_length);
+  EXPECT_EQ(MAX_BITPOOL, config.max_bitpool);
+
+  ASSERT_EQ(0, codec->get_format(&config, &rate, &channels));
+  EXPECT_EQ(44100, rate);
+  EXPECT_EQ(2, channels);
+
+  caps.subbands = 0;
+  EXPECT_EQ(-ENOSYS, codec->select_configuration(&caps, &config));
+}
+
+TEST(A2dpCodec, AacSelectConfiguration) {
+  const struct cras_a2dp_codec* codec = cras_a2dp_codec_get(A2DP_CODEC_MPEG24);
+  a2dp_aac_t caps, config;
+  size_t rate, channels;
+
+  ASSERT_EQ(sizeof(a2dp_aac_t), codec->caps_size);
+  EXPECT_EQ(0, codec->payload_header);
+  EXPECT_EQ(1, codec->max_frames_per_packet);
+
+  memset(&caps, 0, sizeof(caps));
+  caps.object_type = AAC_OBJECT_TYPE_MPEG4_AAC_LC;
+  AAC_SET_FREQUENCY(caps, AAC_SAMPLING_FREQ_44100 | AAC_SAMPLING_FREQ_96000);
+  caps.channels = AAC_CHANNELS_1;
+  caps.vbr = 1;
+  AAC_SET_BITRATE(caps, 0);
+  ASSERT_EQ(0, codec->select_configuration(&caps, &config));
+  EXPECT_EQ(AAC_OBJECT_TYPE_MPEG4_AAC_LC, config.object_type);
+  EXPECT_EQ(AAC_SAMPLING_FREQ_44100, AAC_GET_FREQUENCY(config));
+  EXPECT_EQ(AAC_CHANNELS_1, config.channels);
+  EXPECT_EQ(1, config.vbr);
+  // No bit rate given means any, so the most we ask for.
+  EXPECT_EQ(320000, AAC_GET_BITRATE(config));
+
+  ASSERT_EQ(0, codec->get_format(&config, &rate, &channels));
+  EXPECT_EQ(44100, rate);
+  EXPECT_EQ(1, channels);
+
+  AAC_SET_BITRATE(caps, 128000);
+  ASSERT_EQ(0, codec->select_configuration(&caps, &config));
+  EXPECT_EQ(128000, AAC_GET_BITRATE(config));
+
+  // 96kHz only isn't supported.
+  AAC_SET_FREQUENCY(caps, AAC_SAMPLING_FREQ_96000);
+  EXPECT_EQ(-ENOSYS, codec->select_configuration(&caps, &config));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
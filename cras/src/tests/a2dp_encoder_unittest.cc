@@ -0,0 +1,294 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <sys/param.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_a2dp_encoder.h"
+#include "cras_a2dp_info.h"
+}
+
+/* Fake the codec to take blocks of 128 stereo S16 frames, two to a packet. */
+#define FAKE_BLOCK_FRAMES 128
+#define FAKE_BLOCKS_PER_PACKET 2
+#define FRAME_BYTES 4
+
+static struct a2dp_info* const kA2dp =
+    reinterpret_cast<struct a2dp_info*>(0x123);
+static unsigned int blocks_in_packet;
+static int16_t packet_firsts[FAKE_BLOCKS_PER_PACKET];
+static int a2dp_encode_return_val;
+static unsigned int a2dp_set_bitpool_val;
+static unsigned int a2dp_set_bitpool_blocks;
+
+namespace {
+
+class A2dpEncoderTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    blocks_in_packet = 0;
+    a2dp_encode_return_val = 0;
+    a2dp_set_bitpool_val = 0;
+    a2dp_set_bitpool_blocks = 0;
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds_));
+  }
+
+  virtual void TearDown() {
+    close(fds_[0]);
+    close(fds_[1]);
+  }
+
+  // Writes frames numbered from first, returns the number written.
+  unsigned int Put(struct cras_a2dp_encoder* enc,
+                   unsigned int frames,
+                   int first) {
+    unsigned int written = 0;
+
+    while (written < frames) {
+      unsigned int n = frames - written;
+      int16_t* buf = (int16_t*)cras_a2dp_encoder_get_buffer(enc, &n);
+
+      if (n == 0)
+        break;
+      for (unsigned int i = 0; i < n; i++) {
+        buf[2 * i] = first + written + i;
+        buf[2 * i + 1] = 0;
+      }
+      cras_a2dp_encoder_put_buffer(enc, n);
+      written += n;
+    }
+    return written;
+  }
+
+  // Waits for the worker to have a packet ready and sends it.
+  int Write(struct cras_a2dp_encoder* enc) {
+    int rc = 0;
+
+    for (int i = 0; i < 1000; i++) {
+      rc = cras_a2dp_encoder_write(enc, fds_[0]);
+      if (rc)
+        break;
+      usleep(1000);
+    }
+    return rc;
+  }
+
+  // Waits for the worker to leave room for frames in the ring.
+  bool WaitWritable(struct cras_a2dp_encoder* enc, unsigned int frames) {
+    for (int i = 0; i < 1000; i++) {
+      if (cras_a2dp_encoder_writable_frames(enc) == frames)
+        return true;
+      usleep(1000);
+    }
+    return false;
+  }
+
+  // Receives a packet and checks it holds the blocks starting at first.
+  void CheckPacket(int first) {
+    int16_t firsts[FAKE_BLOCKS_PER_PACKET];
+
+    ASSERT_EQ(sizeof(firsts), recv(fds_[1], firsts, sizeof(firsts), 0));
+    for (int i = 0; i < FAKE_BLOCKS_PER_PACKET; i++)
+      EXPECT_EQ(first + i * FAKE_BLOCK_FRAMES, firsts[i]);
+  }
+
+  int fds_[2];
+};
+
+TEST_F(A2dpEncoderTestSuite, CreateInvalid) {
+  EXPECT_EQ(NULL, cras_a2dp_encoder_create(kA2dp, 0, 950, 1000));
+  EXPECT_EQ(NULL, cras_a2dp_encoder_create(kA2dp, FRAME_BYTES, 950, 100));
+}
+
+TEST_F(A2dpEncoderTestSuite, SendsPacketsInOrder) {
+  struct cras_a2dp_encoder* enc;
+
+  enc = cras_a2dp_encoder_create(kA2dp, FRAME_BYTES, 950, 4096);
+  ASSERT_NE((void*)NULL, enc);
+
+  // Nothing to send before there are frames for a full packet.
+  EXPECT_EQ(0, cras_a2dp_encoder_write(enc, fds_[0]));
+  EXPECT_EQ(200, Put(enc, 200, 0));
+  usleep(10000);
+  EXPECT_EQ(0, cras_a2dp_encoder_write(enc, fds_[0]));
+  EXPECT_EQ(200, cras_a2dp_encoder_queued_frames(enc));
+
+  EXPECT_EQ(800, Put(enc, 800, 200));
+  EXPECT_EQ(1000, cras_a2dp_encoder_queued_frames(enc));
+  for (int i = 0; i < 3; i++) {
+    EXPECT_EQ(FAKE_BLOCK_FRAMES * FAKE_BLOCKS_PER_PACKET, Write(enc));
+    CheckPacket(i * FAKE_BLOCK_FRAMES * FAKE_BLOCKS_PER_PACKET);
+  }
+  // Frames stay queued until the packet holding them is sent.
+  EXPECT_EQ(1000 - 768, cras_a2dp_encoder_queued_frames(enc));
+
+  cras_a2dp_encoder_destroy(enc);
+}
+
+TEST_F(A2dpEncoderTestSuite, RingWrapsAround) {
+  struct cras_a2dp_encoder* enc;
+  int pos = 0;
+
+  // Rounded down to 7 blocks.
+  enc = cras_a2dp_encoder_create(kA2dp, FRAME_BYTES, 950, 1000);
+  ASSERT_NE((void*)NULL, enc);
+  EXPECT_EQ(7 * FAKE_BLOCK_FRAMES, cras_a2dp_encoder_writable_frames(enc));
+
+  for (int i = 0; i < 20; i++) {
+    EXPECT_EQ(300, Put(enc, 300, pos));
+    pos += 300;
+    while ((int)cras_a2dp_encoder_queued_frames(enc) >=
+           FAKE_BLOCK_FRAMES * FAKE_BLOCKS_PER_PACKET) {
+      int first = pos - cras_a2dp_encoder_queued_frames(enc);
+
+      ASSERT_EQ(FAKE_BLOCK_FRAMES * FAKE_BLOCKS_PER_PACKET, Write(enc));
+      CheckPacket(first);
+    }
+  }
+
+  cras_a2dp_encoder_destroy(enc);
+}
+
+TEST_F(A2dpEncoderTestSuite, FullRingTakesNoMore) {
+  struct cras_a2dp_encoder* enc;
+
+  enc = cras_a2dp_encoder_create(kA2dp, FRAME_BYTES, 950, 1024);
+  ASSERT_NE((void*)NULL, enc);
+
+  // The worker encodes the first 1024 frames into all its packets, then
+  // stops until one is sent, leaving the next 1024 in the ring.
+  EXPECT_EQ(1024, Put(enc, 1024, 0));
+  ASSERT_TRUE(WaitWritable(enc, 1024));
+  EXPECT_EQ(1024, Put(enc, 2048, 1024));
+  usleep(10000);
+  EXPECT_EQ(0, cras_a2dp_encoder_writable_frames(enc));
+  EXPECT_EQ(2048, cras_a2dp_encoder_queued_frames(enc));
+
+  EXPECT_EQ(256, Write(enc));
+  CheckPacket(0);
+  ASSERT_TRUE(WaitWritable(enc, 256));
+  EXPECT_EQ(2048 - 256, cras_a2dp_encoder_queued_frames(enc));
+
+  cras_a2dp_encoder_destroy(enc);
+}
+
+TEST_F(A2dpEncoderTestSuite, EncodeErrorReturned) {
+  struct cras_a2dp_encoder* enc;
+
+  enc = cras_a2dp_encoder_create(kA2dp, FRAME_BYTES, 950, 4096);
+  ASSERT_NE((void*)NULL, enc);
+
+  a2dp_encode_return_val = -EIO;
+  Put(enc, 512, 0);
+  EXPECT_EQ(-EIO, Write(enc));
+
+  cras_a2dp_encoder_destroy(enc);
+}
+
+TEST_F(A2dpEncoderTestSuite, BitpoolChangesBetweenPackets) {
+  struct cras_a2dp_encoder* enc;
+
+  enc = cras_a2dp_encoder_create(kA2dp, FRAME_BYTES, 950, 4096);
+  ASSERT_NE((void*)NULL, enc);
+
+  // Leave a block in the packet being encoded.
+  EXPECT_EQ(384, Put(enc, 384, 0));
+  EXPECT_EQ(256, Write(enc));
+  CheckPacket(0);
+
+  cras_a2dp_encoder_set_bitpool(enc, 30);
+  EXPECT_EQ(128, Put(enc, 128, 384));
+  EXPECT_EQ(256, Write(enc));
+  CheckPacket(256);
+  for (int i = 0; i < 1000 && !__atomic_load_n(&a2dp_set_bitpool_val,
+                                                __ATOMIC_ACQUIRE);
+       i++)
+    usleep(1000);
+  EXPECT_EQ(30, a2dp_set_bitpool_val);
+  EXPECT_EQ(0, a2dp_set_bitpool_blocks);
+
+  cras_a2dp_encoder_destroy(enc);
+}
+
+}  // namespace
+
+extern "C" {
+
+int a2dp_codesize(struct a2dp_info* a2dp) {
+  return FAKE_BLOCK_FRAMES * FRAME_BYTES;
+}
+
+int a2dp_encode(struct a2dp_info* a2dp,
+                const void* pcm_buf,
+                int pcm_buf_size,
+                int format_bytes,
+                size_t link_mtu) {
+  const int block_bytes = FAKE_BLOCK_FRAMES * FRAME_BYTES;
+  int blocks;
+
+  if (a2dp_encode_return_val)
+    return a2dp_encode_return_val;
+
+  blocks = MIN(pcm_buf_size / block_bytes,
+               FAKE_BLOCKS_PER_PACKET - (int)blocks_in_packet);
+  for (int i = 0; i < blocks; i++)
+    packet_firsts[blocks_in_packet++] =
+        *(const int16_t*)((const uint8_t*)pcm_buf + i * block_bytes);
+  return blocks * block_bytes;
+}
+
+int a2dp_take_packet(struct a2dp_info* a2dp,
+                     size_t link_mtu,
+                     uint8_t* buf,
+                     size_t* len) {
+  if (blocks_in_packet < FAKE_BLOCKS_PER_PACKET)
+    return 0;
+  memcpy(buf, packet_firsts, sizeof(packet_firsts));
+  *len = sizeof(packet_firsts);
+  blocks_in_packet = 0;
+  return FAKE_BLOCK_FRAMES * FAKE_BLOCKS_PER_PACKET;
+}
+
+int a2dp_queued_frames(const struct a2dp_info* a2dp) {
+  return blocks_in_packet * FAKE_BLOCK_FRAMES;
+}
+
+int a2dp_set_bitpool(struct a2dp_info* a2dp, unsigned int bitpool) {
+  a2dp_set_bitpool_blocks = blocks_in_packet;
+  __atomic_store_n(&a2dp_set_bitpool_val, bitpool, __ATOMIC_RELEASE);
+  return 0;
+}
+
+int cras_set_rt_scheduling(int rt_lim) {
+  return 0;
+}
+
+int cras_set_thread_priority(int priority) {
+  return 0;
+}
+
+int cras_set_thread_affinity(uint32_t cpu_mask) {
+  return 0;
+}
+
+uint32_t cras_system_get_audio_thread_cpu_mask() {
+  return 0;
+}
+
+int cras_system_get_rt_priority() {
+  return 12;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
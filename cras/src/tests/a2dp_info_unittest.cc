@@ -2,26 +2,56 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <errno.h>
 #include <gtest/gtest.h>
+#include <netinet/in.h>
 #include <stdint.h>
 #include <stdio.h>
+#include <string.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
 extern "C" {
 #include <sbc/sbc.h>
 
+#include "a2dp-codecs.h"
+#include "cras_a2dp_codec.h"
 #include "cras_a2dp_info.h"
 #include "cras_sbc_codec.h"
+#include "rtp.h"
 #include "sbc_codec_stub.h"
 }
 
 static size_t a2dp_write_link_mtu_val;
 static struct a2dp_info a2dp;
 static a2dp_sbc_t sbc;
+static const struct cras_a2dp_codec* sbc_codec;
+
+/* Fakes an AAC encoder with the SBC stub, 1024 stereo S16 frames per frame. */
+#define FAKE_AAC_CODESIZE (1024 * 4)
+
+static struct cras_audio_codec* fake_aac_create(const void* config) {
+  return cras_sbc_codec_create(0, 0, 0, 0, 0, 0);
+}
+
+static int fake_aac_get_codesize(struct cras_audio_codec* codec) {
+  return FAKE_AAC_CODESIZE;
+}
+
+static int fake_aac_get_frame_length(struct cras_audio_codec* codec) {
+  return 800;
+}
+
+static const struct cras_a2dp_codec_impl fake_aac_impl = {
+    .create = fake_aac_create,
+    .destroy = cras_sbc_codec_destroy,
+    .get_codesize = fake_aac_get_codesize,
+    .get_frame_length = fake_aac_get_frame_length,
+};
 
 void ResetStubData() {
   sbc_codec_stub_reset();
+  sbc_codec = cras_a2dp_codec_get(A2DP_CODEC_SBC);
 
   a2dp_write_link_mtu_val = 40;
 
@@ -30,6 +60,7 @@ void ResetStubData() {
   sbc.allocation_method = SBC_ALLOCATION_LOUDNESS;
   sbc.subbands = SBC_SUBBANDS_8;
   sbc.block_length = SBC_BLOCK_LENGTH_16;
+  sbc.min_bitpool = 20;
   sbc.max_bitpool = 50;
 
   a2dp.a2dp_buf_used = 0;
@@ -42,7 +73,7 @@ namespace {
 
 TEST(A2dpInfoInit, InitA2dp) {
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, sbc_codec, &sbc);
 
   ASSERT_EQ(1, get_sbc_codec_create_called());
   ASSERT_EQ(SBC_FREQ_48000, get_sbc_codec_create_freq_val());
@@ -65,16 +96,42 @@ TEST(A2dpInfoInit, InitA2dpFail) {
   ResetStubData();
   int err;
   set_sbc_codec_create_fail(1);
-  err = init_a2dp(&a2dp, &sbc);
+  err = init_a2dp(&a2dp, sbc_codec, &sbc);
 
   ASSERT_EQ(1, get_sbc_codec_create_called());
   ASSERT_NE(0, err);
   ASSERT_EQ(a2dp.codec, (void*)NULL);
 }
 
+TEST(A2dpInfoInit, SetBitpoolInRange) {
+  ResetStubData();
+  init_a2dp(&a2dp, sbc_codec, &sbc);
+  EXPECT_EQ(50, a2dp.bitpool);
+
+  EXPECT_EQ(0, a2dp_set_bitpool(&a2dp, 30));
+  EXPECT_EQ(30, get_sbc_codec_set_bitpool_val());
+  EXPECT_EQ(30, a2dp.frame_length);
+
+  EXPECT_EQ(0, a2dp_set_bitpool(&a2dp, 10));
+  EXPECT_EQ(20, a2dp.bitpool);
+  EXPECT_EQ(0, a2dp_set_bitpool(&a2dp, 60));
+  EXPECT_EQ(50, a2dp.bitpool);
+
+  destroy_a2dp(&a2dp);
+}
+
+TEST(A2dpInfoInit, InitA2dpNoEncoder) {
+  a2dp_aac_t aac;
+
+  ResetStubData();
+  memset(&aac, 0, sizeof(aac));
+  EXPECT_NE(0, init_a2dp(&a2dp, cras_a2dp_codec_get(A2DP_CODEC_MPEG24), &aac));
+  EXPECT_EQ(0, get_sbc_codec_create_called());
+}
+
 TEST(A2dpInfoInit, DestroyA2dp) {
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, sbc_codec, &sbc);
   destroy_a2dp(&a2dp);
 
   ASSERT_EQ(1, get_sbc_codec_destroy_called());
@@ -82,7 +139,7 @@ TEST(A2dpInfoInit, DestroyA2dp) {
 
 TEST(A2dpInfoInit, ResetA2dp) {
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, sbc_codec, &sbc);
   a2dp.a2dp_buf_used = 99;
   a2dp.samples = 10;
   a2dp.seq_num = 11;
@@ -102,7 +159,7 @@ TEST(A2dpEncode, WriteA2dp) {
   unsigned int processed;
 
   ResetStubData();
-  init_a2dp(&a2dp, &sbc);
+  init_a2dp(&a2dp, sbc_codec, &sbc);
 
   set_sbc_codec_encoded_out(4);
   processed = a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
@@ -125,6 +182,72 @@ TEST(A2dpEncode, WriteA2dp) {
   ASSERT_EQ(0, a2dp.seq_num);
 }
 
+TEST(A2dpEncode, TakeFullPacket) {
+  uint8_t buf[A2DP_BUF_SIZE_BYTES];
+  struct rtp_header* header = (struct rtp_header*)buf;
+  struct rtp_payload* payload =
+      (struct rtp_payload*)(buf + sizeof(struct rtp_header));
+  size_t len = 0;
+
+  ResetStubData();
+  init_a2dp(&a2dp, sbc_codec, &sbc);
+
+  set_sbc_codec_encoded_out(4);
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+  set_sbc_codec_encoded_out(15);
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+
+  // 32 used, there's still room for one more 5 bytes frame.
+  EXPECT_EQ(0, a2dp_take_packet(&a2dp, 40, buf, &len));
+  EXPECT_EQ(0, len);
+
+  set_sbc_codec_encoded_out(4);
+  a2dp_encode(&a2dp, NULL, 20, 4, (size_t)40);
+  EXPECT_EQ(15, a2dp_take_packet(&a2dp, 40, buf, &len));
+  EXPECT_EQ(36, len);
+  EXPECT_EQ(2, header->v);
+  EXPECT_EQ(0, ntohs(header->sequence_number));
+  EXPECT_EQ(12, payload->frame_count);
+
+  // The next packet starts empty.
+  EXPECT_EQ(13, a2dp.a2dp_buf_used);
+  EXPECT_EQ(0, a2dp.samples);
+  EXPECT_EQ(1, a2dp.seq_num);
+
+  destroy_a2dp(&a2dp);
+}
+
+TEST(A2dpEncode, OneAacFramePerPacket) {
+  const struct cras_a2dp_codec* aac_codec;
+  uint8_t buf[A2DP_BUF_SIZE_BYTES];
+  struct rtp_header* header = (struct rtp_header*)buf;
+  uint8_t pcm[2 * FAKE_AAC_CODESIZE];
+  a2dp_aac_t aac;
+  size_t len = 0;
+
+  ResetStubData();
+  memset(&aac, 0, sizeof(aac));
+  ASSERT_EQ(0, cras_a2dp_codec_set_impl(A2DP_CODEC_MPEG24, &fake_aac_impl));
+  aac_codec = cras_a2dp_codec_get(A2DP_CODEC_MPEG24);
+  ASSERT_EQ(0, init_a2dp(&a2dp, aac_codec, &aac));
+
+  // No payload header, and only one frame fits however big the mtu.
+  EXPECT_EQ(12, a2dp.a2dp_buf_used);
+  EXPECT_EQ(-ENOTSUP, a2dp_set_bitpool(&a2dp, 30));
+  EXPECT_EQ(FAKE_AAC_CODESIZE, a2dp_packet_block_size(&a2dp, 895));
+
+  set_sbc_codec_encoded_out(300);
+  EXPECT_EQ(FAKE_AAC_CODESIZE, a2dp_encode(&a2dp, pcm, sizeof(pcm), 4, 895));
+  EXPECT_EQ(0, a2dp_encode(&a2dp, pcm, sizeof(pcm), 4, 895));
+
+  EXPECT_EQ(1024, a2dp_take_packet(&a2dp, 895, buf, &len));
+  EXPECT_EQ(312, len);
+  EXPECT_EQ(96, header->pt);
+
+  destroy_a2dp(&a2dp);
+  cras_a2dp_codec_set_impl(A2DP_CODEC_MPEG24, NULL);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
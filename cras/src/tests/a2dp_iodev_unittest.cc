@@ -9,11 +9,13 @@
 extern "C" {
 #include "cras_a2dp_iodev.c"
 
+#include "a2dp-codecs.h"
 #include "audio_thread.h"
 #include "audio_thread_log.h"
 #include "cras_audio_area.h"
 #include "cras_bt_transport.h"
 #include "cras_iodev.h"
+#include "rtp.h"
 }
 
 #define FAKE_OBJECT_PATH "/fake/obj/path"
@@ -55,6 +57,16 @@ static unsigned int cras_iodev_fill_odev_zeros_frames;
 static int audio_thread_config_events_callback_called;
 static enum AUDIO_THREAD_EVENTS_CB_TRIGGER
     audio_thread_config_events_callback_trigger;
+static bool cras_system_get_a2dp_encode_offload_enabled_ret;
+static struct cras_a2dp_encoder* cras_a2dp_encoder_create_ret;
+static int cras_a2dp_encoder_create_called;
+static int cras_a2dp_encoder_destroy_called;
+static uint8_t fake_encoder_buf[4096 * 4];
+static unsigned int fake_encoder_queued;
+static int cras_a2dp_encoder_write_called;
+static int cras_a2dp_encoder_write_ret;
+static int cras_bt_tx_delay_init_ret;
+static int cras_bt_tx_delay_poll_completes;
 
 void ResetStubData() {
   cras_bt_device_append_iodev_called = 0;
@@ -76,6 +88,16 @@ void ResetStubData() {
   /* Fake the MTU value. min_buffer_level will be derived from this value. */
   cras_bt_transport_write_mtu_ret = 950;
   cras_iodev_fill_odev_zeros_called = 0;
+  cras_system_get_a2dp_encode_offload_enabled_ret = false;
+  cras_a2dp_encoder_create_ret =
+      reinterpret_cast<struct cras_a2dp_encoder*>(0x456);
+  cras_a2dp_encoder_create_called = 0;
+  cras_a2dp_encoder_destroy_called = 0;
+  fake_encoder_queued = 0;
+  cras_a2dp_encoder_write_called = 0;
+  cras_a2dp_encoder_write_ret = 0;
+  cras_bt_tx_delay_init_ret = -EINVAL;
+  cras_bt_tx_delay_poll_completes = 0;
 
   fake_transport = reinterpret_cast<struct cras_bt_transport*>(0x123);
 
@@ -105,6 +127,7 @@ class A2dpIodev : public testing::Test {
     time_now.tv_sec = 0;
     time_now.tv_nsec = 0;
     atlog = (audio_thread_event_log*)calloc(1, sizeof(audio_thread_event_log));
+    atlog->len = AUDIO_THREAD_EVENT_LOG_SIZE;
   }
 
   virtual void TearDown() {
@@ -321,6 +344,41 @@ TEST_F(A2dpIodev, FramesQueued) {
   a2dp_iodev_destroy(iodev);
 }
 
+TEST_F(A2dpIodev, DelayFramesFromTxCompletions) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  struct timespec tstamp;
+  unsigned frames;
+
+  iodev = a2dp_iodev_create(fake_transport);
+
+  iodev_set_format(iodev, &format);
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  cras_bt_tx_delay_init_ret = 0;
+  iodev->configure_dev(iodev);
+  ASSERT_NE(write_callback, (void*)NULL);
+
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+
+  /* 1000 - 896 = 104 left, the packet written is in flight. */
+  a2dp_write_return_val[0] = 0;
+  frames = 1000;
+  iodev->get_buffer(iodev, &area, &frames);
+  iodev->put_buffer(iodev, 1000);
+  EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_EQ(1000, iodev->delay_frames(iodev));
+
+  /* The controller reports it transmitted. */
+  cras_bt_tx_delay_poll_completes = 1;
+  write_callback(write_callback_data, POLLERR);
+  EXPECT_EQ(104, iodev->delay_frames(iodev));
+
+  iodev->close_dev(iodev);
+  a2dp_iodev_destroy(iodev);
+}
+
 TEST_F(A2dpIodev, SleepTimeWithWriteThrottle) {
   struct cras_iodev* iodev;
   struct cras_audio_area* area;
@@ -710,6 +768,62 @@ TEST_F(A2dpIodev, EnterNoStreamStateAtHighBufferLevelDoesntFillMore) {
   iodev->close_dev(iodev);
   a2dp_iodev_destroy(iodev);
 }
+
+TEST_F(A2dpIodev, EncodeOffload) {
+  struct cras_iodev* iodev;
+  struct cras_audio_area* area;
+  struct a2dp_io* a2dpio;
+  struct timespec tstamp, flush_time;
+  unsigned frames;
+
+  cras_system_get_a2dp_encode_offload_enabled_ret = true;
+  iodev = a2dp_iodev_create(fake_transport);
+  a2dpio = (struct a2dp_io*)iodev;
+
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  EXPECT_EQ(1, cras_a2dp_encoder_create_called);
+  EXPECT_EQ((void*)NULL, a2dpio->pcm_buf);
+  iodev->start(iodev);
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+
+  frames = 1500;
+  iodev->get_buffer(iodev, &area, &frames);
+  ASSERT_EQ(1500, frames);
+  EXPECT_EQ(fake_encoder_buf, area->channels[0].buf);
+
+  /* The encoder sends one block, nothing is encoded here. */
+  cras_a2dp_encoder_write_ret = 896;
+  iodev->put_buffer(iodev, 1000);
+  EXPECT_EQ(0, a2dp_encode_called);
+  EXPECT_EQ(1, cras_a2dp_encoder_write_called);
+  EXPECT_EQ(104, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_GT(a2dpio->next_flush_time.tv_nsec, 0);
+
+  /* The worker hasn't encoded the next packet yet, try again later. */
+  flush_time = a2dpio->next_flush_time;
+  cras_a2dp_encoder_write_ret = 0;
+  time_now.tv_nsec = 25000000;
+  frames = 1000;
+  iodev->get_buffer(iodev, &area, &frames);
+  iodev->put_buffer(iodev, 1000);
+  EXPECT_EQ(2, cras_a2dp_encoder_write_called);
+  EXPECT_EQ(1104, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_EQ(flush_time.tv_nsec, a2dpio->next_flush_time.tv_nsec);
+
+  iodev->close_dev(iodev);
+  EXPECT_EQ(1, cras_a2dp_encoder_destroy_called);
+  EXPECT_EQ(1, a2dp_reset_called);
+
+  /* Encodes on the audio thread if the worker can't be created. */
+  cras_a2dp_encoder_create_ret = NULL;
+  iodev_set_format(iodev, &format);
+  iodev->configure_dev(iodev);
+  EXPECT_NE((void*)NULL, a2dpio->pcm_buf);
+  iodev->close_dev(iodev);
+
+  a2dp_iodev_destroy(iodev);
+}
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -833,9 +947,35 @@ int cras_bt_device_schedule_suspend(
   return 0;
 }
 
-int init_a2dp(struct a2dp_info* a2dp, a2dp_sbc_t* sbc) {
+static int fake_get_format(const void* config,
+                           size_t* rate,
+                           size_t* channels) {
+  *rate = 44100;
+  *channels = 2;
+  return 0;
+}
+
+static const struct cras_a2dp_codec fake_codec = {
+    .name = "fake",
+    .id = A2DP_CODEC_SBC,
+    .caps_size = 4,
+    .get_format = fake_get_format,
+};
+
+const struct cras_a2dp_codec* cras_a2dp_codec_get(uint8_t id) {
+  return &fake_codec;
+}
+
+int cras_bt_transport_codec(const struct cras_bt_transport* transport) {
+  return A2DP_CODEC_SBC;
+}
+
+int init_a2dp(struct a2dp_info* a2dp,
+              const struct cras_a2dp_codec* codec,
+              const void* config) {
   init_a2dp_called++;
   memset(a2dp, 0, sizeof(*a2dp));
+  a2dp->a2dp_codec = codec;
   a2dp->frame_length = FAKE_A2DP_FRAME_LENGTH;
   a2dp->codesize = FAKE_A2DP_CODE_SIZE;
   return init_a2dp_return_val;
@@ -853,6 +993,34 @@ int a2dp_block_size(struct a2dp_info* a2dp, int encoded_bytes) {
   return encoded_bytes / a2dp->frame_length * a2dp->codesize;
 }
 
+int a2dp_packet_block_size(struct a2dp_info* a2dp, size_t link_mtu) {
+  return a2dp_block_size(a2dp, link_mtu - sizeof(struct rtp_header) -
+                                   sizeof(struct rtp_payload));
+}
+
+int a2dp_set_bitpool(struct a2dp_info* a2dp, unsigned int bitpool) {
+  if (!a2dp->max_bitpool)
+    return -ENOTSUP;
+  a2dp->bitpool = bitpool;
+  return 0;
+}
+
+void cras_a2dp_bitpool_init(struct cras_a2dp_bitpool* bp,
+                            unsigned int min,
+                            unsigned int max,
+                            const struct timespec* now) {
+  bp->max = max;
+  bp->bitpool = max;
+}
+
+unsigned int cras_a2dp_bitpool_update(struct cras_a2dp_bitpool* bp,
+                                      unsigned int queued,
+                                      unsigned int capacity,
+                                      const struct timespec* late,
+                                      const struct timespec* now) {
+  return bp->bitpool;
+}
+
 int a2dp_queued_frames(const struct a2dp_info* a2dp) {
   return a2dp->samples;
 }
@@ -953,6 +1121,71 @@ void audio_thread_config_events_callback(
 }
 }
 
+bool cras_system_get_a2dp_encode_offload_enabled() {
+  return cras_system_get_a2dp_encode_offload_enabled_ret;
+}
+
+struct cras_a2dp_encoder* cras_a2dp_encoder_create(struct a2dp_info* a2dp,
+                                                   size_t frame_bytes,
+                                                   size_t link_mtu,
+                                                   unsigned int max_frames) {
+  cras_a2dp_encoder_create_called++;
+  return cras_a2dp_encoder_create_ret;
+}
+
+void cras_a2dp_encoder_destroy(struct cras_a2dp_encoder* enc) {
+  if (enc)
+    cras_a2dp_encoder_destroy_called++;
+}
+
+uint8_t* cras_a2dp_encoder_get_buffer(struct cras_a2dp_encoder* enc,
+                                      unsigned int* frames) {
+  *frames = MIN(*frames, sizeof(fake_encoder_buf) / 4 - fake_encoder_queued);
+  return fake_encoder_buf;
+}
+
+void cras_a2dp_encoder_put_buffer(struct cras_a2dp_encoder* enc,
+                                  unsigned int frames) {
+  fake_encoder_queued += frames;
+}
+
+unsigned int cras_a2dp_encoder_queued_frames(struct cras_a2dp_encoder* enc) {
+  return fake_encoder_queued;
+}
+
+unsigned int cras_a2dp_encoder_writable_frames(struct cras_a2dp_encoder* enc) {
+  return sizeof(fake_encoder_buf) / 4 - fake_encoder_queued;
+}
+
+void cras_a2dp_encoder_set_bitpool(struct cras_a2dp_encoder* enc,
+                                   unsigned int bitpool) {}
+
+int cras_a2dp_encoder_write(struct cras_a2dp_encoder* enc, int stream_fd) {
+  cras_a2dp_encoder_write_called++;
+  if (cras_a2dp_encoder_write_ret > 0)
+    fake_encoder_queued -= cras_a2dp_encoder_write_ret;
+  return cras_a2dp_encoder_write_ret;
+}
+
+int cras_bt_tx_delay_init(struct cras_bt_tx_delay* delay, int fd) {
+  memset(delay, 0, sizeof(*delay));
+  delay->enabled = !cras_bt_tx_delay_init_ret;
+  return cras_bt_tx_delay_init_ret;
+}
+
+void cras_bt_tx_delay_sent(struct cras_bt_tx_delay* delay,
+                           unsigned int frames) {
+  if (delay->enabled)
+    delay->in_flight += frames;
+}
+
+int cras_bt_tx_delay_poll(struct cras_bt_tx_delay* delay, int fd) {
+  if (!cras_bt_tx_delay_poll_completes)
+    return 0;
+  delay->in_flight = 0;
+  return 1;
+}
+
 int cras_audio_thread_event_a2dp_overrun() {
   return 0;
 }
@@ -0,0 +1,114 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <vector>
+
+extern "C" {
+#include "aec_dump_writer.h"
+}
+
+namespace {
+
+// Writes a record of size bytes of value the way the APM does, the size
+// field and the data in separate writes.
+static void WriteRecord(FILE* handle, uint32_t size, uint8_t value) {
+  std::vector<uint8_t> data(size, value);
+
+  ASSERT_EQ(1, fwrite(&size, sizeof(size), 1, handle));
+  if (size) {
+    ASSERT_EQ(1, fwrite(data.data(), size, 1, handle));
+  }
+}
+
+// Reads fd until the writer closes it.
+static std::vector<uint8_t> ReadAll(int fd) {
+  std::vector<uint8_t> out;
+  uint8_t buf[4096];
+  ssize_t rc;
+
+  while ((rc = read(fd, buf, sizeof(buf))) > 0)
+    out.insert(out.end(), buf, buf + rc);
+  return out;
+}
+
+// Checks out holds whole records only, and returns their values.
+static std::vector<uint8_t> ParseRecords(const std::vector<uint8_t>& out) {
+  std::vector<uint8_t> values;
+  size_t pos = 0;
+  uint32_t size;
+
+  while (pos < out.size()) {
+    EXPECT_LE(pos + sizeof(size), out.size());
+    memcpy(&size, out.data() + pos, sizeof(size));
+    pos += sizeof(size);
+    EXPECT_LE(pos + size, out.size());
+    for (uint32_t i = 0; i < size; i++)
+      EXPECT_EQ(out[pos], out[pos + i]);
+    values.push_back(out[pos]);
+    pos += size;
+  }
+  return values;
+}
+
+TEST(AecDumpWriter, WritesRecordsInOrder) {
+  int fds[2];
+  FILE* handle;
+  std::vector<uint8_t> values;
+
+  ASSERT_EQ(0, pipe(fds));
+  // Room for all the records, none is dropped.
+  handle = aec_dump_writer_open(fds[1], 100 * 104);
+  ASSERT_NE((void*)NULL, handle);
+
+  for (int i = 0; i < 100; i++)
+    WriteRecord(handle, 100, i);
+  EXPECT_EQ(0, fclose(handle));
+
+  values = ParseRecords(ReadAll(fds[0]));
+  ASSERT_EQ(100, values.size());
+  for (int i = 0; i < 100; i++)
+    EXPECT_EQ(i, values[i]);
+  close(fds[0]);
+}
+
+TEST(AecDumpWriter, DropsWholeRecordsOnOverflow) {
+  int fds[2];
+  FILE* handle;
+  std::vector<uint8_t> values;
+
+  ASSERT_EQ(0, pipe(fds));
+  handle = aec_dump_writer_open(fds[1], 1000);
+  ASSERT_NE((void*)NULL, handle);
+
+  // Nothing reads the pipe, so once it is full the ring fills up too.
+  for (int i = 0; i < 250; i++)
+    WriteRecord(handle, 600, i);
+  // A record larger than the ring never fits.
+  WriteRecord(handle, 2000, 250);
+  EXPECT_EQ(0, fclose(handle));
+
+  values = ParseRecords(ReadAll(fds[0]));
+  EXPECT_LT(0, values.size());
+  EXPECT_GT(250, values.size());
+  for (size_t i = 1; i < values.size(); i++)
+    EXPECT_LT(values[i - 1], values[i]);
+  close(fds[0]);
+}
+
+TEST(AecDumpWriter, InvalidRing) {
+  EXPECT_EQ((void*)NULL, aec_dump_writer_open(1, 0));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
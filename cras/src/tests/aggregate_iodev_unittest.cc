@@ -0,0 +1,365 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <map>
+
+extern "C" {
+#include "cras_aggregate_iodev.h"
+#include "cras_audio_area.h"
+#include "cras_audio_format.h"
+#include "cras_iodev.h"
+}
+
+namespace {
+
+#define MEMBER_BUFFER_FRAMES 4096
+#define MEMBER_MAX_CHANNELS 2
+
+struct fake_member {
+  struct cras_iodev base;
+  int16_t buf[MEMBER_BUFFER_FRAMES * MEMBER_MAX_CHANNELS];
+  unsigned int frames_written;
+  int level;
+  size_t rates[4];
+  size_t channel_counts[3];
+  snd_pcm_format_t formats[3];
+  struct cras_audio_area* area;
+  unsigned int open_called;
+  unsigned int configure_called;
+  unsigned int close_called;
+  unsigned int channels_configured;
+};
+
+static struct fake_member fake_members[2];
+static std::map<const struct cras_iodev*, double> est_rate_ratio;
+static int cras_iodev_update_rate_called;
+
+static int fake_open(struct cras_iodev* iodev) {
+  ((struct fake_member*)iodev)->open_called++;
+  return 0;
+}
+
+static int fake_update_supported_formats(struct cras_iodev* iodev) {
+  struct fake_member* m = (struct fake_member*)iodev;
+
+  iodev->supported_rates = m->rates;
+  iodev->supported_channel_counts = m->channel_counts;
+  iodev->supported_formats = m->formats;
+  return 0;
+}
+
+static int fake_configure(struct cras_iodev* iodev) {
+  struct fake_member* m = (struct fake_member*)iodev;
+
+  m->configure_called++;
+  m->channels_configured = iodev->format->num_channels;
+  iodev->buffer_size = MEMBER_BUFFER_FRAMES;
+  iodev->min_buffer_level = m == &fake_members[0] ? 0 : 240;
+  m->area = cras_audio_area_create(iodev->format->num_channels);
+  return 0;
+}
+
+static int fake_close(struct cras_iodev* iodev) {
+  struct fake_member* m = (struct fake_member*)iodev;
+
+  m->close_called++;
+  cras_audio_area_destroy(m->area);
+  m->area = NULL;
+  return 0;
+}
+
+static int fake_frames_queued(const struct cras_iodev* iodev,
+                              struct timespec* tstamp) {
+  tstamp->tv_sec = 1;
+  tstamp->tv_nsec = 0;
+  return ((struct fake_member*)iodev)->level;
+}
+
+static int fake_delay_frames(const struct cras_iodev* iodev) {
+  return ((struct fake_member*)iodev)->level + 10;
+}
+
+static int fake_get_buffer(struct cras_iodev* iodev,
+                           struct cras_audio_area** area,
+                           unsigned* frames) {
+  struct fake_member* m = (struct fake_member*)iodev;
+  unsigned int ch = iodev->format->num_channels;
+
+  *frames = std::min(*frames, MEMBER_BUFFER_FRAMES - m->frames_written);
+  m->area->frames = *frames;
+  cras_audio_area_config_buf_pointers(
+      m->area, iodev->format, (uint8_t*)(m->buf + m->frames_written * ch));
+  *area = m->area;
+  return 0;
+}
+
+static int fake_put_buffer(struct cras_iodev* iodev, unsigned nwritten) {
+  ((struct fake_member*)iodev)->frames_written += nwritten;
+  return 0;
+}
+
+static void init_member(struct fake_member* m,
+                        const char* name,
+                        const size_t* rates,
+                        const size_t* channel_counts,
+                        const snd_pcm_format_t* formats) {
+  memset(m, 0, sizeof(*m));
+  m->base.direction = CRAS_STREAM_OUTPUT;
+  snprintf(m->base.info.name, sizeof(m->base.info.name), "%s", name);
+  m->base.info.max_supported_channels = MEMBER_MAX_CHANNELS;
+  m->base.open_dev = fake_open;
+  m->base.update_supported_formats = fake_update_supported_formats;
+  m->base.configure_dev = fake_configure;
+  m->base.close_dev = fake_close;
+  m->base.frames_queued = fake_frames_queued;
+  m->base.delay_frames = fake_delay_frames;
+  m->base.get_buffer = fake_get_buffer;
+  m->base.put_buffer = fake_put_buffer;
+  memcpy(m->rates, rates, sizeof(m->rates));
+  memcpy(m->channel_counts, channel_counts, sizeof(m->channel_counts));
+  memcpy(m->formats, formats, sizeof(m->formats));
+}
+
+class AggregateIodev : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    static const size_t rates0[] = {44100, 48000, 0, 0};
+    static const size_t rates1[] = {48000, 96000, 0, 0};
+    static const size_t counts0[] = {2, 0, 0};
+    static const size_t counts1[] = {1, 2, 0};
+    static const snd_pcm_format_t formats0[] = {
+        SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, (snd_pcm_format_t)0};
+    static const snd_pcm_format_t formats1[] = {
+        SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S16_LE, (snd_pcm_format_t)0};
+    struct cras_iodev* members[2];
+
+    init_member(&fake_members[0], "Woofer", rates0, counts0, formats0);
+    init_member(&fake_members[1], "Tweeter", rates1, counts1, formats1);
+    est_rate_ratio.clear();
+    cras_iodev_update_rate_called = 0;
+
+    members[0] = &fake_members[0].base;
+    members[1] = &fake_members[1].base;
+    iodev_ = aggregate_iodev_create("Speaker", members, 2);
+    ASSERT_NE((void*)NULL, iodev_);
+  }
+
+  virtual void TearDown() {
+    // The fake members own their supported arrays.
+    fake_members[0].base.supported_rates = NULL;
+    fake_members[0].base.supported_channel_counts = NULL;
+    fake_members[0].base.supported_formats = NULL;
+    fake_members[1].base.supported_rates = NULL;
+    fake_members[1].base.supported_channel_counts = NULL;
+    fake_members[1].base.supported_formats = NULL;
+    aggregate_iodev_destroy(iodev_);
+  }
+
+  void Configure() {
+    ASSERT_EQ(0, iodev_->open_dev(iodev_));
+    ASSERT_EQ(0, iodev_->update_supported_formats(iodev_));
+    iodev_->format = (struct cras_audio_format*)malloc(sizeof(*iodev_->format));
+    iodev_->format->format = SND_PCM_FORMAT_S16_LE;
+    iodev_->format->frame_rate = 48000;
+    iodev_->format->num_channels = 4;
+    ASSERT_EQ(0, iodev_->configure_dev(iodev_));
+  }
+
+  // Mixes frames with sample n of frame i set to i * 4 + n and writes them.
+  void WriteFrames(unsigned int frames) {
+    struct cras_audio_area* area;
+    unsigned int n = frames;
+    int16_t* buf;
+
+    ASSERT_EQ(0, iodev_->get_buffer(iodev_, &area, &n));
+    ASSERT_EQ(frames, n);
+    buf = (int16_t*)area->channels[0].buf;
+    for (unsigned int i = 0; i < frames * 4; i++)
+      buf[i] = i;
+    ASSERT_EQ(0, iodev_->put_buffer(iodev_, frames));
+  }
+
+  struct cras_iodev* iodev_;
+};
+
+TEST_F(AggregateIodev, CreateHasOneNode) {
+  EXPECT_STREQ("Speaker", iodev_->info.name);
+  EXPECT_EQ(4, iodev_->info.max_supported_channels);
+  ASSERT_NE((void*)NULL, iodev_->active_node);
+  EXPECT_STREQ("Speaker", iodev_->active_node->name);
+  EXPECT_EQ(1, iodev_->active_node->plugged);
+}
+
+TEST(AggregateIodevCreate, RejectsBadMembers) {
+  struct cras_iodev input = {};
+  struct cras_iodev* members[MAX_AGGREGATE_MEMBERS + 1] = {};
+
+  EXPECT_EQ((void*)NULL, aggregate_iodev_create("A", members, 0));
+  input.direction = CRAS_STREAM_INPUT;
+  members[0] = &input;
+  EXPECT_EQ((void*)NULL, aggregate_iodev_create("A", members, 1));
+}
+
+TEST_F(AggregateIodev, SupportedFormatsAreShared) {
+  ASSERT_EQ(0, iodev_->update_supported_formats(iodev_));
+
+  EXPECT_EQ(48000, iodev_->supported_rates[0]);
+  EXPECT_EQ(0, iodev_->supported_rates[1]);
+  EXPECT_EQ(4, iodev_->supported_channel_counts[0]);
+  EXPECT_EQ(0, iodev_->supported_channel_counts[1]);
+  // S24_LE is left out as the resampler doesn't handle it.
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, iodev_->supported_formats[0]);
+  EXPECT_EQ(0, iodev_->supported_formats[1]);
+}
+
+TEST_F(AggregateIodev, ConfigureConfiguresMembers) {
+  Configure();
+
+  EXPECT_EQ(1, fake_members[0].open_called);
+  EXPECT_EQ(1, fake_members[1].open_called);
+  EXPECT_EQ(2, fake_members[0].channels_configured);
+  EXPECT_EQ(2, fake_members[1].channels_configured);
+  EXPECT_EQ(48000, fake_members[1].base.format->frame_rate);
+  EXPECT_EQ(MEMBER_BUFFER_FRAMES, iodev_->buffer_size);
+  EXPECT_EQ(240, iodev_->min_buffer_level);
+
+  fake_members[0].level = 100;
+  fake_members[1].level = 300;
+  EXPECT_EQ(310, iodev_->delay_frames(iodev_));
+
+  iodev_->close_dev(iodev_);
+  EXPECT_EQ(1, fake_members[0].close_called);
+  EXPECT_EQ(1, fake_members[1].close_called);
+  EXPECT_EQ((void*)NULL, fake_members[1].base.format);
+}
+
+TEST_F(AggregateIodev, PutBufferSplitsChannels) {
+  Configure();
+  WriteFrames(100);
+
+  ASSERT_EQ(100, fake_members[0].frames_written);
+  ASSERT_EQ(100, fake_members[1].frames_written);
+  for (unsigned int i = 0; i < 100; i++) {
+    EXPECT_EQ(i * 4, fake_members[0].buf[i * 2]);
+    EXPECT_EQ(i * 4 + 1, fake_members[0].buf[i * 2 + 1]);
+    EXPECT_EQ(i * 4 + 2, fake_members[1].buf[i * 2]);
+    EXPECT_EQ(i * 4 + 3, fake_members[1].buf[i * 2 + 1]);
+  }
+  iodev_->close_dev(iodev_);
+}
+
+TEST_F(AggregateIodev, FasterMemberIsFedMoreFrames) {
+  Configure();
+  est_rate_ratio[&fake_members[1].base] = 1.01;
+  WriteFrames(1000);
+
+  EXPECT_EQ(1000, fake_members[0].frames_written);
+  EXPECT_LE(1009, fake_members[1].frames_written);
+  EXPECT_GE(1011, fake_members[1].frames_written);
+  iodev_->close_dev(iodev_);
+}
+
+TEST_F(AggregateIodev, LaggingMemberIsNudged) {
+  struct timespec tstamp;
+
+  Configure();
+  iodev_->min_cb_level = 480;
+  fake_members[0].level = 1000;
+  fake_members[1].level = 500;
+  EXPECT_EQ(1000, iodev_->frames_queued(iodev_, &tstamp));
+  EXPECT_EQ(1, cras_iodev_update_rate_called);
+
+  // Lagging behind by more than half a callback, the member is fed a
+  // few more frames than its estimated rate asks for.
+  unsigned int total[2] = {0, 0};
+  for (int i = 0; i < 32; i++) {
+    WriteFrames(1000);
+    for (int k = 0; k < 2; k++) {
+      total[k] += fake_members[k].frames_written;
+      fake_members[k].frames_written = 0;
+    }
+  }
+  EXPECT_EQ(32000, total[0]);
+  EXPECT_LT(32000, total[1]);
+  iodev_->close_dev(iodev_);
+}
+
+}  // namespace
+
+extern "C" {
+
+void cras_iodev_free_format(struct cras_iodev* iodev) {
+  free(iodev->format);
+  iodev->format = NULL;
+}
+
+void cras_iodev_init_audio_area(struct cras_iodev* iodev, int num_channels) {
+  iodev->area = cras_audio_area_create(num_channels);
+  cras_audio_area_config_channels(iodev->area, iodev->format);
+}
+
+void cras_iodev_free_audio_area(struct cras_iodev* iodev) {
+  cras_audio_area_destroy(iodev->area);
+  iodev->area = NULL;
+}
+
+void cras_iodev_free_resources(struct cras_iodev* iodev) {}
+
+void cras_iodev_add_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = node;
+}
+
+void cras_iodev_rm_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = NULL;
+}
+
+void cras_iodev_set_active_node(struct cras_iodev* iodev,
+                                struct cras_ionode* node) {
+  iodev->active_node = node;
+}
+
+int cras_iodev_update_rates(struct cras_iodev* const* iodevs,
+                            const unsigned int* levels,
+                            const struct timespec* tstamps,
+                            unsigned int num) {
+  cras_iodev_update_rate_called += num;
+  return 0;
+}
+
+double cras_iodev_get_est_rate_ratio(const struct cras_iodev* iodev) {
+  std::map<const struct cras_iodev*, double>::iterator it =
+      est_rate_ratio.find(iodev);
+  return it == est_rate_ratio.end() ? 1.0 : it->second;
+}
+
+int cras_iodev_default_no_stream_playback(struct cras_iodev* odev,
+                                          int enable) {
+  return 0;
+}
+
+struct rate_estimator* rate_estimator_create(unsigned int rate,
+                                             const struct timespec* window_size,
+                                             double smooth_factor) {
+  return (struct rate_estimator*)0xdeadbeef;
+}
+
+void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {}
+
+void rate_estimator_add_frames(struct rate_estimator* re, int frames) {}
+
+void cras_mix_add_scale_stride(snd_pcm_format_t fmt,
+                               uint8_t* dst,
+                               uint8_t* src,
+                               unsigned int count,
+                               unsigned int dst_stride,
+                               unsigned int src_stride,
+                               float scaler) {}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -7,23 +7,32 @@
 #include <sys/types.h>
 #include <unistd.h>
 
+#include <vector>
+
 #include "cras_alert.h"
 
 namespace {
 
 void callback1(void* arg, void* data);
 void callback2(void* arg, void* data);
+void callback_keyed(void* arg, void* data);
 void prepare(struct cras_alert* alert);
 
 struct cb_data_struct {
   int data;
 };
 
+struct keyed_data_struct {
+  int key;
+  int value;
+};
+
 static int cb1_called = 0;
 static cb_data_struct cb1_data;
 static int cb2_called = 0;
 static int cb2_set_pending = 0;
 static int prepare_called = 0;
+static std::vector<keyed_data_struct> keyed_values;
 
 void ResetStub() {
   cb1_called = 0;
@@ -31,6 +40,7 @@ void ResetStub() {
   cb2_set_pending = 0;
   prepare_called = 0;
   cb1_data.data = 0;
+  keyed_values.clear();
 }
 
 class Alert : public testing::Test {
@@ -110,6 +120,78 @@ TEST_F(Alert, OneCallbackTwoDataKeepAll) {
   cras_alert_destroy(alert);
 }
 
+TEST_F(Alert, OneCallbackMergeByKey) {
+  struct cras_alert* alert =
+      cras_alert_create(NULL, CRAS_ALERT_FLAG_MERGE_BY_KEY);
+  struct keyed_data_struct data[] = {{1, 10}, {2, 20}, {1, 11}};
+  cras_alert_set_key_size(alert, sizeof(int));
+  cras_alert_add_callback(alert, &callback_keyed, NULL);
+  ResetStub();
+  // One call per key, with the last data of that key, in key order.
+  for (size_t i = 0; i < sizeof(data) / sizeof(data[0]); i++)
+    cras_alert_pending_data(alert, (void*)&data[i], sizeof(data[i]));
+  cras_alert_process_all_pending_alerts();
+  ASSERT_EQ(2, keyed_values.size());
+  EXPECT_EQ(1, keyed_values[0].key);
+  EXPECT_EQ(11, keyed_values[0].value);
+  EXPECT_EQ(2, keyed_values[1].key);
+  EXPECT_EQ(20, keyed_values[1].value);
+  cras_alert_destroy(alert);
+}
+
+TEST_F(Alert, OneCallbackSkipUnchanged) {
+  struct cras_alert* alert =
+      cras_alert_create(NULL, CRAS_ALERT_FLAG_SKIP_UNCHANGED);
+  struct cb_data_struct data = {1};
+  struct cb_data_struct data2 = {2};
+  cras_alert_add_callback(alert, &callback1, NULL);
+  ResetStub();
+  cras_alert_pending_data(alert, (void*)&data, sizeof(data));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+
+  // Same value again is dropped.
+  cras_alert_pending_data(alert, (void*)&data, sizeof(data));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+
+  // Changing and changing back in one turn is dropped too.
+  cras_alert_pending_data(alert, (void*)&data2, sizeof(data2));
+  cras_alert_pending_data(alert, (void*)&data, sizeof(data));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(1, cb1_called);
+
+  cras_alert_pending_data(alert, (void*)&data2, sizeof(data2));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(2, cb1_called);
+  EXPECT_EQ(2, cb1_data.data);
+  cras_alert_destroy(alert);
+}
+
+TEST_F(Alert, OneCallbackSkipUnchangedByKey) {
+  struct cras_alert* alert = cras_alert_create(
+      NULL, CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED);
+  struct keyed_data_struct data[] = {{1, 10}, {2, 20}};
+  struct keyed_data_struct data2[] = {{1, 10}, {2, 21}};
+  cras_alert_set_key_size(alert, sizeof(int));
+  cras_alert_add_callback(alert, &callback_keyed, NULL);
+  ResetStub();
+  for (size_t i = 0; i < 2; i++)
+    cras_alert_pending_data(alert, (void*)&data[i], sizeof(data[i]));
+  cras_alert_process_all_pending_alerts();
+  EXPECT_EQ(2, keyed_values.size());
+
+  // Only the key whose value changed is delivered.
+  keyed_values.clear();
+  for (size_t i = 0; i < 2; i++)
+    cras_alert_pending_data(alert, (void*)&data2[i], sizeof(data2[i]));
+  cras_alert_process_all_pending_alerts();
+  ASSERT_EQ(1, keyed_values.size());
+  EXPECT_EQ(2, keyed_values[0].key);
+  EXPECT_EQ(21, keyed_values[0].value);
+  cras_alert_destroy(alert);
+}
+
 TEST_F(Alert, TwoCallbacks) {
   struct cras_alert* alert = cras_alert_create(NULL, 0);
   cras_alert_add_callback(alert, &callback1, NULL);
@@ -214,6 +296,10 @@ void callback2(void* arg, void* data) {
   }
 }
 
+void callback_keyed(void* arg, void* data) {
+  keyed_values.push_back(*(struct keyed_data_struct*)data);
+}
+
 void prepare(struct cras_alert* alert) {
   prepare_called++;
   return;
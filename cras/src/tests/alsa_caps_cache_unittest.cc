@@ -0,0 +1,129 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_alsa_caps_cache.h"
+}
+
+namespace {
+
+static const size_t rates[] = {44100, 48000, 96000, 0};
+static const size_t channel_counts[] = {2, 1, 0};
+static const snd_pcm_format_t formats[] = {
+    SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S32_LE, (snd_pcm_format_t)0};
+
+class AlsaCapsCacheTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir_template[] = CRAS_UT_TMPDIR "/caps_cache_unittest.XXXXXX";
+
+    ASSERT_NE((void*)NULL, mkdtemp(dir_template));
+    dir_ = dir_template;
+    cras_alsa_caps_cache_set_dir(dir_.c_str());
+  }
+
+  virtual void TearDown() {
+    std::string cmd = "rm -rf " + dir_;
+
+    cras_alsa_caps_cache_set_dir(NULL);
+    system(cmd.c_str());
+  }
+
+  std::string dir_;
+};
+
+TEST_F(AlsaCapsCacheTestSuite, PutThenGet) {
+  size_t *r, *c;
+  snd_pcm_format_t* f;
+
+  EXPECT_EQ(-ENOENT, cras_alsa_caps_cache_get("Card 1", 0,
+                                              SND_PCM_STREAM_PLAYBACK, 0x1234,
+                                              &r, &c, &f));
+  ASSERT_EQ(0, cras_alsa_caps_cache_put("Card 1", 0, SND_PCM_STREAM_PLAYBACK,
+                                        0x1234, rates, channel_counts,
+                                        formats));
+  ASSERT_EQ(0, cras_alsa_caps_cache_get("Card 1", 0, SND_PCM_STREAM_PLAYBACK,
+                                        0x1234, &r, &c, &f));
+  for (int i = 0; i < 4; i++)
+    EXPECT_EQ(rates[i], r[i]);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(channel_counts[i], c[i]);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(formats[i], f[i]);
+  free(r);
+  free(c);
+  free(f);
+
+  // Other devices and directions of the card have their own entries.
+  EXPECT_EQ(-ENOENT, cras_alsa_caps_cache_get("Card 1", 1,
+                                              SND_PCM_STREAM_PLAYBACK, 0x1234,
+                                              &r, &c, &f));
+  EXPECT_EQ(-ENOENT, cras_alsa_caps_cache_get("Card 1", 0,
+                                              SND_PCM_STREAM_CAPTURE, 0x1234,
+                                              &r, &c, &f));
+}
+
+TEST_F(AlsaCapsCacheTestSuite, ChecksumMismatchMisses) {
+  size_t *r, *c;
+  snd_pcm_format_t* f;
+
+  ASSERT_EQ(0, cras_alsa_caps_cache_put("Card", 3, SND_PCM_STREAM_CAPTURE, 1,
+                                        rates, channel_counts, formats));
+  EXPECT_EQ(-ENOENT, cras_alsa_caps_cache_get("Card", 3,
+                                              SND_PCM_STREAM_CAPTURE, 2, &r,
+                                              &c, &f));
+
+  // Storing again with the new checksum replaces the entry.
+  ASSERT_EQ(0, cras_alsa_caps_cache_put("Card", 3, SND_PCM_STREAM_CAPTURE, 2,
+                                        rates, channel_counts, formats));
+  ASSERT_EQ(0, cras_alsa_caps_cache_get("Card", 3, SND_PCM_STREAM_CAPTURE, 2,
+                                        &r, &c, &f));
+  free(r);
+  free(c);
+  free(f);
+
+  cras_alsa_caps_cache_remove("Card", 3, SND_PCM_STREAM_CAPTURE);
+  EXPECT_EQ(-ENOENT, cras_alsa_caps_cache_get("Card", 3,
+                                              SND_PCM_STREAM_CAPTURE, 2, &r,
+                                              &c, &f));
+}
+
+TEST_F(AlsaCapsCacheTestSuite, CorruptEntryMisses) {
+  std::string path = dir_ + "/Card.0.playback";
+  size_t *r, *c;
+  snd_pcm_format_t* f;
+  FILE* fp;
+
+  fp = fopen(path.c_str(), "w");
+  ASSERT_NE((void*)NULL, fp);
+  fprintf(fp, "checksum 5\nrates 48000\nchannels\n");
+  fclose(fp);
+
+  EXPECT_EQ(-EINVAL, cras_alsa_caps_cache_get("Card", 0,
+                                              SND_PCM_STREAM_PLAYBACK, 5, &r,
+                                              &c, &f));
+}
+
+TEST(AlsaCapsCache, Disabled) {
+  size_t *r, *c;
+  snd_pcm_format_t* f;
+
+  cras_alsa_caps_cache_set_dir(NULL);
+  EXPECT_NE(0, cras_alsa_caps_cache_put("Card", 0, SND_PCM_STREAM_PLAYBACK,
+                                        0, rates, channel_counts, formats));
+  EXPECT_NE(0, cras_alsa_caps_cache_get("Card", 0, SND_PCM_STREAM_PLAYBACK, 0,
+                                        &r, &c, &f));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
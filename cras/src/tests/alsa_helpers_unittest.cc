@@ -16,6 +16,10 @@ static int snd_pcm_sw_params_set_tstamp_mode_called;
 static snd_pcm_uframes_t snd_pcm_htimestamp_avail_ret_val;
 static timespec snd_pcm_htimestamp_tstamp_ret_val;
 static std::vector<int> snd_pcm_sw_params_ret_vals;
+static snd_pcm_sframes_t snd_pcm_avail_delay_delay_ret_val;
+static int snd_pcm_avail_delay_called;
+static int snd_pcm_avail_called;
+static int snd_pcm_htimestamp_called;
 
 static void ResetStubData() {
   snd_pcm_sw_params_set_tstamp_type_called = 0;
@@ -24,6 +28,10 @@ static void ResetStubData() {
   snd_pcm_htimestamp_tstamp_ret_val.tv_sec = 0;
   snd_pcm_htimestamp_tstamp_ret_val.tv_nsec = 0;
   snd_pcm_sw_params_ret_vals.clear();
+  snd_pcm_avail_delay_delay_ret_val = 0;
+  snd_pcm_avail_delay_called = 0;
+  snd_pcm_avail_called = 0;
+  snd_pcm_htimestamp_called = 0;
 }
 
 namespace {
@@ -177,12 +185,39 @@ TEST(AlsaHelper, Htimestamp) {
   snd_pcm_htimestamp_tstamp_ret_val.tv_nsec = 10000;
 
   cras_alsa_get_avail_frames(mock_handle, 48000, severe_underrun_frames,
-                             dev_name, &used, &tstamp);
+                             dev_name, &used, NULL, &tstamp);
   EXPECT_EQ(used, snd_pcm_htimestamp_avail_ret_val);
   EXPECT_EQ(tstamp.tv_sec, snd_pcm_htimestamp_tstamp_ret_val.tv_sec);
   EXPECT_EQ(tstamp.tv_nsec, snd_pcm_htimestamp_tstamp_ret_val.tv_nsec);
 }
 
+TEST(AlsaHelper, GetAvailFramesWithDelay) {
+  snd_pcm_t* mock_handle = reinterpret_cast<snd_pcm_t*>(0x1);
+  snd_pcm_uframes_t avail;
+  snd_pcm_sframes_t delay;
+  int rc;
+
+  ResetStubData();
+  snd_pcm_htimestamp_avail_ret_val = 1000;
+  snd_pcm_avail_delay_delay_ret_val = 300;
+  rc = cras_alsa_get_avail_frames(mock_handle, 4800, 480, "dev_name", &avail,
+                                  &delay, NULL);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1000, avail);
+  EXPECT_EQ(300, delay);
+  // Both come from one sync, and the timestamp isn't read.
+  EXPECT_EQ(1, snd_pcm_avail_delay_called);
+  EXPECT_EQ(0, snd_pcm_avail_called);
+  EXPECT_EQ(0, snd_pcm_htimestamp_called);
+
+  // The delay is limited to the buffer size.
+  snd_pcm_avail_delay_delay_ret_val = 5000;
+  rc = cras_alsa_get_avail_frames(mock_handle, 4800, 480, "dev_name", &avail,
+                                  &delay, NULL);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(4800, delay);
+}
+
 TEST(AlsaHelper, GetAvailFramesSevereUnderrun) {
   snd_pcm_t* mock_handle = reinterpret_cast<snd_pcm_t*>(0x1);
   snd_pcm_uframes_t avail;
@@ -196,7 +231,7 @@ TEST(AlsaHelper, GetAvailFramesSevereUnderrun) {
   snd_pcm_htimestamp_avail_ret_val = buffer_size + severe_underrun_frames + 1;
   rc = cras_alsa_get_avail_frames(mock_handle, buffer_size,
                                   severe_underrun_frames, dev_name, &avail,
-                                  &tstamp);
+                                  NULL, &tstamp);
   // Returns -EPIPE when severe underrun happens.
   EXPECT_EQ(rc, -EPIPE);
 
@@ -204,7 +239,7 @@ TEST(AlsaHelper, GetAvailFramesSevereUnderrun) {
   snd_pcm_htimestamp_avail_ret_val = buffer_size + severe_underrun_frames;
   rc = cras_alsa_get_avail_frames(mock_handle, buffer_size,
                                   severe_underrun_frames, dev_name, &avail,
-                                  &tstamp);
+                                  NULL, &tstamp);
   // Underrun which is not severe enough will be masked.
   // avail will be adjusted to buffer_size.
   EXPECT_EQ(avail, buffer_size);
@@ -214,7 +249,7 @@ TEST(AlsaHelper, GetAvailFramesSevereUnderrun) {
   snd_pcm_htimestamp_avail_ret_val = buffer_size - 1;
   rc = cras_alsa_get_avail_frames(mock_handle, buffer_size,
                                   severe_underrun_frames, dev_name, &avail,
-                                  &tstamp);
+                                  NULL, &tstamp);
   // When avail < buffer_size, there is no underrun.
   EXPECT_EQ(avail, buffer_size - 1);
   EXPECT_EQ(rc, 0);
@@ -275,12 +310,23 @@ int snd_pcm_sw_params(snd_pcm_t* pcm, snd_pcm_sw_params_t* params) {
 }
 
 snd_pcm_sframes_t snd_pcm_avail(snd_pcm_t* pcm) {
+  snd_pcm_avail_called++;
   return snd_pcm_htimestamp_avail_ret_val;
 }
 
+int snd_pcm_avail_delay(snd_pcm_t* pcm,
+                        snd_pcm_sframes_t* availp,
+                        snd_pcm_sframes_t* delayp) {
+  snd_pcm_avail_delay_called++;
+  *availp = snd_pcm_htimestamp_avail_ret_val;
+  *delayp = snd_pcm_avail_delay_delay_ret_val;
+  return 0;
+}
+
 int snd_pcm_htimestamp(snd_pcm_t* pcm,
                        snd_pcm_uframes_t* avail,
                        snd_htimestamp_t* tstamp) {
+  snd_pcm_htimestamp_called++;
   *avail = snd_pcm_htimestamp_avail_ret_val;
   *tstamp = snd_pcm_htimestamp_tstamp_ret_val;
   return 0;
@@ -28,11 +28,19 @@ static int cras_alsa_open_called;
 static int cras_iodev_append_stream_ret;
 static int cras_alsa_get_avail_frames_ret;
 static int cras_alsa_get_avail_frames_avail;
+static int cras_alsa_get_avail_frames_delay;
+static struct timespec cras_alsa_get_avail_frames_tstamp;
+static int cras_alsa_get_delay_frames_called;
 static int cras_alsa_start_called;
+static unsigned int cras_alsa_set_hwparams_align_frames;
 static uint8_t* cras_alsa_mmap_begin_buffer;
 static size_t cras_alsa_mmap_begin_frames;
 static size_t cras_alsa_fill_properties_called;
 static bool cras_alsa_support_8_channels;
+static int cras_alsa_caps_cache_get_ret;
+static size_t cras_alsa_caps_cache_get_channels;
+static size_t cras_alsa_caps_cache_put_called;
+static size_t cras_alsa_caps_cache_remove_called;
 static size_t alsa_mixer_set_dBFS_called;
 static int alsa_mixer_set_dBFS_value;
 static const struct mixer_control* alsa_mixer_set_dBFS_output;
@@ -115,6 +123,7 @@ static int ucm_enable_swap_mode_ret_value;
 static size_t ucm_enable_swap_mode_called;
 static int is_utf8_string_ret_value;
 static const char* cras_alsa_jack_update_monitor_fake_name = 0;
+static uint32_t cras_alsa_jack_display_checksum_ret;
 static int cras_alsa_jack_get_name_called;
 static const char* cras_alsa_jack_get_name_ret_value = 0;
 static char default_jack_name[] = "Something Jack";
@@ -127,6 +136,7 @@ static int cras_alsa_attempt_resume_called;
 static snd_hctl_t* fake_hctl = (snd_hctl_t*)2;
 static size_t ucm_get_dma_period_for_dev_called;
 static unsigned int ucm_get_dma_period_for_dev_ret;
+static int ucm_get_low_latency_for_dev_ret;
 static int cras_card_config_get_volume_curve_for_control_called;
 typedef std::map<std::string, struct cras_volume_curve*> VolCurveMap;
 static VolCurveMap cras_card_config_get_volume_curve_vals;
@@ -146,15 +156,30 @@ static void* audio_thread_cb_data;
 static int hotword_send_triggered_msg_called;
 static struct timespec clock_gettime_retspec;
 static unsigned cras_iodev_reset_rate_estimator_called;
+static int cras_system_get_idle_pause_ms_ret;
+static bool cras_system_get_hw_timestamp_rate_est_enabled_ret;
+static int cras_alsa_pcm_pause_called;
+static int cras_alsa_pcm_pause_enable;
+static int cras_alsa_pcm_pause_ret;
+static int cras_alsa_pcm_drop_called;
 
 void ResetStubData() {
   cras_alsa_open_called = 0;
+  cras_alsa_set_hwparams_align_frames = 0;
   cras_iodev_append_stream_ret = 0;
   cras_alsa_get_avail_frames_ret = 0;
   cras_alsa_get_avail_frames_avail = 0;
+  cras_alsa_get_avail_frames_delay = 0;
+  cras_alsa_get_avail_frames_tstamp.tv_sec = 0;
+  cras_alsa_get_avail_frames_tstamp.tv_nsec = 0;
+  cras_alsa_get_delay_frames_called = 0;
   cras_alsa_start_called = 0;
   cras_alsa_fill_properties_called = 0;
   cras_alsa_support_8_channels = false;
+  cras_alsa_caps_cache_get_ret = -ENOENT;
+  cras_alsa_caps_cache_get_channels = 2;
+  cras_alsa_caps_cache_put_called = 0;
+  cras_alsa_caps_cache_remove_called = 0;
   sys_get_volume_called = 0;
   alsa_mixer_set_dBFS_called = 0;
   alsa_mixer_set_capture_dBFS_called = 0;
@@ -204,6 +229,7 @@ void ResetStubData() {
   cras_alsa_jack_get_name_called = 0;
   cras_alsa_jack_get_name_ret_value = default_jack_name;
   cras_alsa_jack_update_monitor_fake_name = 0;
+  cras_alsa_jack_display_checksum_ret = 0;
   cras_card_config_get_volume_curve_for_control_called = 0;
   cras_card_config_get_volume_curve_vals.clear();
   cras_alsa_mixer_get_minimum_capture_gain_ret_value = 0;
@@ -212,6 +238,7 @@ void ResetStubData() {
   cras_alsa_attempt_resume_called = 0;
   ucm_get_dma_period_for_dev_called = 0;
   ucm_get_dma_period_for_dev_ret = 0;
+  ucm_get_low_latency_for_dev_ret = 0;
   cras_alsa_mmap_get_whole_buffer_called = 0;
   cras_iodev_fill_odev_zeros_called = 0;
   cras_iodev_fill_odev_zeros_frames = 0;
@@ -224,6 +251,14 @@ void ResetStubData() {
   ucm_get_default_node_gain_values.clear();
   ucm_get_intrinsic_sensitivity_values.clear();
   cras_iodev_reset_rate_estimator_called = 0;
+  cras_system_get_idle_pause_ms_ret = -1;
+  cras_system_get_hw_timestamp_rate_est_enabled_ret = false;
+  cras_alsa_pcm_pause_called = 0;
+  cras_alsa_pcm_pause_enable = 0;
+  cras_alsa_pcm_pause_ret = 0;
+  cras_alsa_pcm_drop_called = 0;
+  clock_gettime_retspec.tv_sec = 0;
+  clock_gettime_retspec.tv_nsec = 0;
 }
 
 static long fake_get_dBFS(const struct cras_volume_curve* curve,
@@ -274,11 +309,14 @@ TEST(AlsaIoInit, InitializePlayback) {
   EXPECT_EQ(SND_PCM_STREAM_PLAYBACK, aio->alsa_stream);
   /* Call cras_alsa_fill_properties once on update_max_supported_channels. */
   EXPECT_EQ(1, cras_alsa_fill_properties_called);
+  /* The probed capabilities go to the cache. */
+  EXPECT_EQ(1, cras_alsa_caps_cache_put_called);
   EXPECT_EQ(1, cras_alsa_mixer_list_outputs_called);
   EXPECT_EQ(
       0, strncmp(test_card_name, aio->base.info.name, strlen(test_card_name)));
   EXPECT_EQ(1, cras_iodev_update_dsp_called);
   EXPECT_EQ("", cras_iodev_update_dsp_name);
+  EXPECT_NE(nullptr, aio->base.load_dsp_firmware);
   ASSERT_NE(reinterpret_cast<const char*>(NULL), aio->dev_name);
   EXPECT_EQ(0, strcmp(test_dev_name, aio->dev_name));
   ASSERT_NE(reinterpret_cast<const char*>(NULL), aio->dev_id);
@@ -352,6 +390,8 @@ TEST(AlsaIoInit, DefaultNodeUSBCard) {
   ASSERT_STREQ(DEFAULT, aio->base.active_node->name);
   ASSERT_EQ(1, aio->base.active_node->plugged);
   EXPECT_EQ(1, cras_iodev_set_node_plugged_called);
+  /* USB cards have no DSP firmware to load. */
+  EXPECT_EQ(nullptr, aio->base.load_dsp_firmware);
   alsa_iodev_destroy((struct cras_iodev*)aio);
 
   aio = (struct alsa_io*)alsa_iodev_create_with_default_parameters(
@@ -604,6 +644,30 @@ TEST(AlsaIoInit, OpenCapture) {
   free(fake_format);
 }
 
+TEST(AlsaIoInit, OpenUsbAlignsToPackets) {
+  struct cras_iodev* iodev;
+  struct cras_audio_format format;
+
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_USB, 0, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_INPUT);
+  ASSERT_EQ(0, alsa_iodev_legacy_complete_init(iodev));
+
+  // Ten 1ms packets are the shortest whole number of frames at 44.1kHz.
+  format.frame_rate = 44100;
+  format.num_channels = 2;
+  cras_iodev_set_format(iodev, &format);
+
+  ResetStubData();
+  iodev->open_dev(iodev);
+  iodev->configure_dev(iodev);
+  EXPECT_EQ(441, cras_alsa_set_hwparams_align_frames);
+  EXPECT_EQ(45, iodev->hw_ptr_granularity);
+
+  alsa_iodev_destroy(iodev);
+  free(fake_format);
+}
+
 TEST(AlsaIoInit, OpenCaptureSetCaptureGainWithDefaultNodeGain) {
   struct cras_iodev* iodev;
   struct cras_audio_format format;
@@ -935,6 +999,28 @@ TEST(AlsaIoInit, MaxSupportedChannels) {
   }
 }
 
+TEST(AlsaIoInit, MaxSupportedChannelsFromCapsCache) {
+  struct alsa_io* aio;
+  struct cras_alsa_mixer* const fake_mixer = (struct cras_alsa_mixer*)2;
+
+  ResetStubData();
+  cras_alsa_caps_cache_get_ret = 0;
+  cras_alsa_caps_cache_get_channels = 6;
+
+  aio = (struct alsa_io*)alsa_iodev_create_with_default_parameters(
+      0, test_dev_id, ALSA_CARD_TYPE_INTERNAL, 1, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_OUTPUT);
+  ASSERT_EQ(0, alsa_iodev_legacy_complete_init((struct cras_iodev*)aio));
+  /* A cache hit neither opens nor probes the PCM. */
+  EXPECT_EQ(0, cras_alsa_open_called);
+  EXPECT_EQ(0, cras_alsa_fill_properties_called);
+  EXPECT_EQ(0, cras_alsa_caps_cache_put_called);
+  EXPECT_EQ(6, aio->base.info.max_supported_channels);
+  ASSERT_NE((void*)NULL, aio->base.supported_rates);
+  EXPECT_EQ(48000, aio->base.supported_rates[0]);
+  alsa_iodev_destroy((struct cras_iodev*)aio);
+}
+
 // Test that system settins aren't touched if no streams active.
 TEST(AlsaOutputNode, SystemSettingsWhenInactive) {
   int rc;
@@ -1127,6 +1213,7 @@ TEST(AlsaOutputNode, OutputsFromUCM) {
   cras_alsa_mixer_get_control_name_values[outputs[0]] = INTERNAL_SPEAKER;
   cras_alsa_mixer_get_control_name_values[outputs[1]] = HEADPHONE;
   ucm_get_dma_period_for_dev_ret = 1000;
+  ucm_get_low_latency_for_dev_ret = 1;
 
   // Create the IO device.
   iodev = alsa_iodev_create_with_default_parameters(
@@ -1174,6 +1261,7 @@ TEST(AlsaOutputNode, OutputsFromUCM) {
   EXPECT_EQ(2, cras_alsa_mixer_get_control_for_section_called);
   EXPECT_EQ(1, ucm_get_dma_period_for_dev_called);
   EXPECT_EQ(ucm_get_dma_period_for_dev_ret, aio->dma_period_set_microsecs);
+  EXPECT_EQ(1, iodev->low_latency_ok);
   /* Call cras_alsa_fill_properties once on update_max_supported_channels. */
   EXPECT_EQ(1, cras_alsa_fill_properties_called);
   EXPECT_EQ(2, iodev->info.max_supported_channels);
@@ -1869,6 +1957,48 @@ TEST(AlsaIoInit, HDMIJackUpdateInvalidUTF8MonitorName) {
   alsa_iodev_destroy((struct cras_iodev*)aio);
 }
 
+TEST(AlsaIoInit, HDMIKnownDisplaySkipsProbe) {
+  struct alsa_io* aio;
+  struct cras_alsa_mixer* const fake_mixer = (struct cras_alsa_mixer*)2;
+  const struct cras_alsa_jack* jack = (struct cras_alsa_jack*)4;
+
+  ResetStubData();
+  aio = (struct alsa_io*)alsa_iodev_create_with_default_parameters(
+      0, test_dev_id, ALSA_CARD_TYPE_INTERNAL, 1, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_OUTPUT);
+  ASSERT_EQ(0, alsa_iodev_legacy_complete_init((struct cras_iodev*)aio));
+  cras_alsa_jack_get_name_ret_value = "HDMI Jack";
+  cras_alsa_open_called = 0;
+  cras_alsa_fill_properties_called = 0;
+
+  // The first plug of a display probes the PCM.
+  cras_alsa_support_8_channels = true;
+  cras_alsa_jack_display_checksum_ret = 0x1234;
+  cras_alsa_jack_list_create_cb(jack, 1, cras_alsa_jack_list_create_cb_data);
+  ASSERT_EQ(CRAS_NODE_TYPE_HDMI, aio->base.nodes->next->type);
+  EXPECT_EQ(1, cras_alsa_open_called);
+  EXPECT_EQ(1, cras_alsa_fill_properties_called);
+  EXPECT_EQ(8, aio->base.info.max_supported_channels);
+
+  // Plugged again, it gets the capabilities it had back.
+  cras_alsa_support_8_channels = false;
+  cras_alsa_jack_list_create_cb(jack, 0, cras_alsa_jack_list_create_cb_data);
+  cras_alsa_jack_list_create_cb(jack, 1, cras_alsa_jack_list_create_cb_data);
+  EXPECT_EQ(1, cras_alsa_open_called);
+  EXPECT_EQ(1, cras_alsa_fill_properties_called);
+  EXPECT_EQ(8, aio->base.info.max_supported_channels);
+
+  // Another display is probed.
+  cras_alsa_jack_display_checksum_ret = 0x5678;
+  cras_alsa_jack_list_create_cb(jack, 0, cras_alsa_jack_list_create_cb_data);
+  cras_alsa_jack_list_create_cb(jack, 1, cras_alsa_jack_list_create_cb_data);
+  EXPECT_EQ(2, cras_alsa_open_called);
+  EXPECT_EQ(2, cras_alsa_fill_properties_called);
+  EXPECT_EQ(2, aio->base.info.max_supported_channels);
+
+  alsa_iodev_destroy((struct cras_iodev*)aio);
+}
+
 //  Test thread add/rm stream, open_alsa, and iodev config.
 class AlsaVolumeMuteSuite : public testing::Test {
  protected:
@@ -2074,6 +2204,33 @@ class AlsaFreeRunTestSuite : public testing::Test {
   struct cras_audio_format fmt_;
 };
 
+TEST_F(AlsaFreeRunTestSuite, DelayFromFramesQueuedSnapshot) {
+  struct timespec hw_tstamp;
+
+  // The delay read along with the level is reused on the same wake.
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 200;
+  cras_alsa_get_avail_frames_delay = 210;
+  EXPECT_EQ(200, aio.base.frames_queued(&aio.base, &hw_tstamp));
+  EXPECT_EQ(210, delay_frames(&aio.base));
+  EXPECT_EQ(0, cras_alsa_get_delay_frames_called);
+
+  // Writing frames moves the delay along.
+  EXPECT_EQ(200, aio.base.frames_queued(&aio.base, &hw_tstamp));
+  put_buffer(&aio.base, 100);
+  EXPECT_EQ(310, delay_frames(&aio.base));
+  EXPECT_EQ(0, cras_alsa_get_delay_frames_called);
+
+  // It's only used once, then the kernel is asked.
+  EXPECT_EQ(0, delay_frames(&aio.base));
+  EXPECT_EQ(1, cras_alsa_get_delay_frames_called);
+
+  // Moving appl_ptr for an underrun drops it.
+  EXPECT_EQ(200, aio.base.frames_queued(&aio.base, &hw_tstamp));
+  adjust_appl_ptr_for_underrun(&aio.base);
+  EXPECT_EQ(0, delay_frames(&aio.base));
+  EXPECT_EQ(2, cras_alsa_get_delay_frames_called);
+}
+
 TEST_F(AlsaFreeRunTestSuite, FillWholeBufferWithZeros) {
   int rc;
   int16_t* zeros;
@@ -2253,6 +2410,130 @@ TEST_F(AlsaFreeRunTestSuite, LeaveFreeRunInFreeRun) {
   EXPECT_EQ(1, cras_iodev_reset_rate_estimator_called);
 }
 
+TEST_F(AlsaFreeRunTestSuite, EnterFreeRunPausesIdleOutput) {
+  int rc;
+
+  // With the idle pause on and no grace period, the drained device is
+  // paused right away.
+  cras_system_get_idle_pause_ms_ret = 0;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE;
+
+  rc = no_stream(&aio.base, 1);
+
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_alsa_mmap_get_whole_buffer_called);
+  EXPECT_EQ(1, aio.free_running);
+  EXPECT_EQ(1, cras_alsa_pcm_pause_called);
+  EXPECT_EQ(1, cras_alsa_pcm_pause_enable);
+  EXPECT_EQ(0, cras_alsa_pcm_drop_called);
+  EXPECT_EQ(ALSA_IDLE_PAUSED, aio.idle_state);
+}
+
+TEST_F(AlsaFreeRunTestSuite, EnterFreeRunStopsOutputWhichCannotPause) {
+  int rc;
+
+  cras_system_get_idle_pause_ms_ret = 0;
+  cras_alsa_pcm_pause_ret = -ENOSYS;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE;
+
+  rc = no_stream(&aio.base, 1);
+
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, aio.free_running);
+  EXPECT_EQ(1, cras_alsa_pcm_drop_called);
+  EXPECT_EQ(ALSA_IDLE_STOPPED, aio.idle_state);
+}
+
+TEST_F(AlsaFreeRunTestSuite, EnterFreeRunWaitsForIdleGracePeriod) {
+  int rc;
+
+  // The drained device keeps getting zeros until the grace period is over.
+  cras_system_get_idle_pause_ms_ret = 1000;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 100;
+  aio.filled_zeros_for_draining = 200;
+  clock_gettime_retspec.tv_sec = 10;
+
+  rc = no_stream(&aio.base, 1);
+
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, aio.free_running);
+  EXPECT_EQ(0, cras_alsa_mmap_get_whole_buffer_called);
+  EXPECT_EQ(1, cras_iodev_fill_odev_zeros_called);
+  EXPECT_EQ(0, cras_alsa_pcm_pause_called);
+
+  clock_gettime_retspec.tv_nsec = 999000000;
+  rc = no_stream(&aio.base, 1);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, aio.free_running);
+  EXPECT_EQ(2, cras_iodev_fill_odev_zeros_called);
+
+  clock_gettime_retspec.tv_sec = 11;
+  rc = no_stream(&aio.base, 1);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, aio.free_running);
+  EXPECT_EQ(1, cras_alsa_mmap_get_whole_buffer_called);
+  EXPECT_EQ(1, cras_alsa_pcm_pause_called);
+  EXPECT_EQ(ALSA_IDLE_PAUSED, aio.idle_state);
+}
+
+TEST_F(AlsaFreeRunTestSuite, LeaveFreeRunResumesPausedOutput) {
+  int rc;
+
+  aio.free_running = 1;
+  aio.idle_state = ALSA_IDLE_PAUSED;
+  aio.base.min_buffer_level = 512;
+
+  rc = no_stream(&aio.base, 0);
+
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_alsa_pcm_pause_called);
+  EXPECT_EQ(0, cras_alsa_pcm_pause_enable);
+  EXPECT_EQ(1, cras_alsa_resume_appl_ptr_called);
+  EXPECT_EQ(aio.base.min_buffer_level + aio.base.min_cb_level,
+            cras_alsa_resume_appl_ptr_ahead);
+  EXPECT_EQ(0, cras_alsa_start_called);
+  EXPECT_EQ(0, aio.free_running);
+  EXPECT_EQ(ALSA_IDLE_RUNNING, aio.idle_state);
+}
+
+TEST_F(AlsaFreeRunTestSuite, LeaveFreeRunRestartsStoppedOutput) {
+  int rc;
+
+  // A stopped device is primed with the frames leaving free run puts ahead
+  // of hw_ptr and started again.
+  aio.free_running = 1;
+  aio.idle_state = ALSA_IDLE_STOPPED;
+  aio.base.min_buffer_level = 512;
+
+  rc = no_stream(&aio.base, 0);
+
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_alsa_pcm_pause_called);
+  EXPECT_EQ(0, cras_alsa_resume_appl_ptr_called);
+  EXPECT_EQ(aio.base.min_buffer_level + aio.base.min_cb_level,
+            cras_iodev_fill_odev_zeros_frames);
+  EXPECT_EQ(1, cras_alsa_start_called);
+  EXPECT_EQ(0, aio.free_running);
+  EXPECT_EQ(ALSA_IDLE_RUNNING, aio.idle_state);
+}
+
+TEST_F(AlsaFreeRunTestSuite, LeaveFreeRunRestartsOutputFailingToResume) {
+  int rc;
+
+  aio.free_running = 1;
+  aio.idle_state = ALSA_IDLE_PAUSED;
+  cras_alsa_pcm_pause_ret = -ESTRPIPE;
+
+  rc = no_stream(&aio.base, 0);
+
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_alsa_pcm_drop_called);
+  EXPECT_EQ(aio.base.min_buffer_level + aio.base.min_cb_level,
+            cras_iodev_fill_odev_zeros_frames);
+  EXPECT_EQ(1, cras_alsa_start_called);
+  EXPECT_EQ(ALSA_IDLE_RUNNING, aio.idle_state);
+}
+
 // Reuse AlsaFreeRunTestSuite for output underrun handling because they are
 // similar.
 TEST_F(AlsaFreeRunTestSuite, OutputUnderrun) {
@@ -2278,6 +2559,69 @@ TEST_F(AlsaFreeRunTestSuite, OutputUnderrun) {
   free(zeros);
 }
 
+TEST_F(AlsaFreeRunTestSuite, UnderrunsRaiseBufferLevel) {
+  struct alsa_output_node aout;
+  struct timespec tstamp;
+
+  memset(&aout, 0, sizeof(aout));
+  aio.base.active_node = &aout.base;
+  aio.base_min_buffer_level = 100;
+  aio.base.min_buffer_level = 100;
+
+  // The underrun is left with the raised level, 5ms higher.
+  EXPECT_EQ(0, alsa_output_underrun(&aio.base));
+  EXPECT_EQ(5, aout.extra_buffer_ms);
+  EXPECT_EQ(340, aio.base.min_buffer_level);
+  EXPECT_EQ(340 + 240 + 120, cras_alsa_resume_appl_ptr_ahead);
+
+  // A severe underrun raises it twice as much.
+  cras_alsa_get_avail_frames_ret = -EPIPE;
+  EXPECT_EQ(-EPIPE, aio.base.frames_queued(&aio.base, &tstamp));
+  EXPECT_EQ(15, aout.extra_buffer_ms);
+  EXPECT_EQ(820, aio.base.min_buffer_level);
+
+  // It's capped, and leaves half the buffer to the streams.
+  for (int i = 0; i < 4; i++)
+    alsa_output_underrun(&aio.base);
+  EXPECT_EQ(35, aout.extra_buffer_ms);
+  EXPECT_EQ(1780, aio.base.min_buffer_level);
+  aio.base.buffer_size = 3000;
+  for (int i = 0; i < 2; i++)
+    alsa_output_underrun(&aio.base);
+  EXPECT_EQ(40, aout.extra_buffer_ms);
+  EXPECT_EQ(1500, aio.base.min_buffer_level);
+}
+
+TEST_F(AlsaFreeRunTestSuite, StableOutputLowersBufferLevel) {
+  struct alsa_output_node aout;
+  struct timespec tstamp;
+
+  memset(&aout, 0, sizeof(aout));
+  aio.base.active_node = &aout.base;
+  cras_alsa_get_avail_frames_avail = BUFFER_SIZE - 500;
+
+  clock_gettime_retspec.tv_sec = 10;
+  alsa_output_underrun(&aio.base);
+  alsa_output_underrun(&aio.base);
+  EXPECT_EQ(10, aout.extra_buffer_ms);
+  EXPECT_EQ(480, aio.base.min_buffer_level);
+
+  clock_gettime_retspec.tv_sec = 69;
+  aio.base.frames_queued(&aio.base, &tstamp);
+  EXPECT_EQ(10, aout.extra_buffer_ms);
+
+  // A step down for each minute without underruns.
+  clock_gettime_retspec.tv_sec = 70;
+  aio.base.frames_queued(&aio.base, &tstamp);
+  EXPECT_EQ(5, aout.extra_buffer_ms);
+  EXPECT_EQ(240, aio.base.min_buffer_level);
+
+  clock_gettime_retspec.tv_sec = 130;
+  aio.base.frames_queued(&aio.base, &tstamp);
+  EXPECT_EQ(0, aout.extra_buffer_ms);
+  EXPECT_EQ(0, aio.base.min_buffer_level);
+}
+
 TEST(AlsaHotwordNode, HotwordTriggeredSendMessage) {
   struct cras_iodev* iodev;
   struct cras_audio_format format;
@@ -2360,6 +2704,44 @@ TEST(AlsaGetValidFrames, GetValidFramesFreeRunning) {
   alsa_iodev_destroy(iodev);
 }
 
+TEST(AlsaFramesQueued, HwTimestampWhenEnabled) {
+  struct cras_iodev* iodev;
+  struct alsa_io* aio;
+  struct timespec tstamp;
+
+  ResetStubData();
+  iodev = alsa_iodev_create_with_default_parameters(
+      0, NULL, ALSA_CARD_TYPE_INTERNAL, 0, fake_mixer, fake_config, NULL,
+      CRAS_STREAM_OUTPUT);
+  aio = (struct alsa_io*)iodev;
+
+  cras_alsa_get_avail_frames_avail = iodev->buffer_size - 500;
+  cras_alsa_get_avail_frames_tstamp.tv_sec = 100;
+  cras_alsa_get_avail_frames_tstamp.tv_nsec = 200;
+  clock_gettime_retspec.tv_sec = 123;
+  clock_gettime_retspec.tv_nsec = 321;
+
+  // Without hardware timestamps the level is timed when it's read.
+  aio->enable_htimestamp = 0;
+  EXPECT_EQ(500, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_EQ(123, tstamp.tv_sec);
+  EXPECT_EQ(321, tstamp.tv_nsec);
+
+  aio->enable_htimestamp = 1;
+  EXPECT_EQ(500, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_EQ(100, tstamp.tv_sec);
+  EXPECT_EQ(200, tstamp.tv_nsec);
+
+  // Before the device starts there's no hardware timestamp.
+  cras_alsa_get_avail_frames_tstamp.tv_sec = 0;
+  cras_alsa_get_avail_frames_tstamp.tv_nsec = 0;
+  EXPECT_EQ(500, iodev->frames_queued(iodev, &tstamp));
+  EXPECT_EQ(123, tstamp.tv_sec);
+  EXPECT_EQ(321, tstamp.tv_nsec);
+
+  alsa_iodev_destroy(iodev);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -2434,6 +2816,15 @@ int cras_alsa_pcm_start(snd_pcm_t* handle) {
 int cras_alsa_pcm_drain(snd_pcm_t* handle) {
   return 0;
 }
+int cras_alsa_pcm_pause(snd_pcm_t* handle, int enable) {
+  cras_alsa_pcm_pause_called++;
+  cras_alsa_pcm_pause_enable = enable;
+  return cras_alsa_pcm_pause_ret;
+}
+int cras_alsa_pcm_drop(snd_pcm_t* handle) {
+  cras_alsa_pcm_drop_called++;
+  return 0;
+}
 int cras_alsa_fill_properties(snd_pcm_t* handle,
                               size_t** rates,
                               size_t** channel_counts,
@@ -2464,14 +2855,52 @@ int cras_alsa_fill_properties(snd_pcm_t* handle,
   cras_alsa_fill_properties_called++;
   return 0;
 }
+int cras_alsa_caps_cache_get(const char* card_name,
+                             size_t device_index,
+                             snd_pcm_stream_t stream,
+                             uint32_t checksum,
+                             size_t** rates,
+                             size_t** channel_counts,
+                             snd_pcm_format_t** formats) {
+  if (cras_alsa_caps_cache_get_ret)
+    return cras_alsa_caps_cache_get_ret;
+
+  *rates = (size_t*)calloc(2, sizeof(**rates));
+  (*rates)[0] = 48000;
+  *channel_counts = (size_t*)calloc(2, sizeof(**channel_counts));
+  (*channel_counts)[0] = cras_alsa_caps_cache_get_channels;
+  *formats = (snd_pcm_format_t*)calloc(2, sizeof(**formats));
+  (*formats)[0] = SND_PCM_FORMAT_S16_LE;
+  return 0;
+}
+int cras_alsa_caps_cache_put(const char* card_name,
+                             size_t device_index,
+                             snd_pcm_stream_t stream,
+                             uint32_t checksum,
+                             const size_t* rates,
+                             const size_t* channel_counts,
+                             const snd_pcm_format_t* formats) {
+  cras_alsa_caps_cache_put_called++;
+  return 0;
+}
+void cras_alsa_caps_cache_remove(const char* card_name,
+                                 size_t device_index,
+                                 snd_pcm_stream_t stream) {
+  cras_alsa_caps_cache_remove_called++;
+}
+uint32_t crc32_checksum(const unsigned char* input, size_t n) {
+  return 0;
+}
 int cras_alsa_set_hwparams(snd_pcm_t* handle,
                            struct cras_audio_format* format,
                            snd_pcm_uframes_t* buffer_size,
                            int period_wakeup,
-                           unsigned int dma_period_time) {
+                           unsigned int dma_period_time,
+                           unsigned int align_frames) {
+  cras_alsa_set_hwparams_align_frames = align_frames;
   return 0;
 }
-int cras_alsa_set_swparams(snd_pcm_t* handle) {
+int cras_alsa_set_swparams(snd_pcm_t* handle, int* enable_htimestamp) {
   return 0;
 }
 int cras_alsa_get_avail_frames(snd_pcm_t* handle,
@@ -2479,14 +2908,19 @@ int cras_alsa_get_avail_frames(snd_pcm_t* handle,
                                snd_pcm_uframes_t severe_underrun_frames,
                                const char* dev_name,
                                snd_pcm_uframes_t* used,
+                               snd_pcm_sframes_t* delay,
                                struct timespec* tstamp) {
   *used = cras_alsa_get_avail_frames_avail;
-  clock_gettime(CLOCK_MONOTONIC_RAW, tstamp);
+  if (delay)
+    *delay = cras_alsa_get_avail_frames_delay;
+  if (tstamp)
+    *tstamp = cras_alsa_get_avail_frames_tstamp;
   return cras_alsa_get_avail_frames_ret;
 }
 int cras_alsa_get_delay_frames(snd_pcm_t* handle,
                                snd_pcm_uframes_t buf_size,
                                snd_pcm_sframes_t* delay) {
+  cras_alsa_get_delay_frames_called++;
   *delay = 0;
   return 0;
 }
@@ -2563,6 +2997,14 @@ bool cras_system_get_noise_cancellation_enabled() {
   return false;
 }
 
+int cras_system_get_idle_pause_ms() {
+  return cras_system_get_idle_pause_ms_ret;
+}
+
+bool cras_system_get_hw_timestamp_rate_est_enabled() {
+  return cras_system_get_hw_timestamp_rate_est_enabled_ret;
+}
+
 //  From cras_alsa_mixer.
 void cras_alsa_mixer_set_dBFS(struct cras_alsa_mixer* m,
                               long dB_level,
@@ -2606,6 +3048,8 @@ void cras_alsa_mixer_set_capture_mute(struct cras_alsa_mixer* m,
   alsa_mixer_set_capture_mute_input = mixer_input;
 }
 
+void cras_alsa_mixer_invalidate_cache(struct cras_alsa_mixer* cras_mixer) {}
+
 void cras_alsa_mixer_list_outputs(struct cras_alsa_mixer* cras_mixer,
                                   cras_alsa_mixer_control_callback cb,
                                   void* callback_arg) {
@@ -2658,6 +3102,14 @@ int cras_alsa_mixer_has_volume(const struct mixer_control* mixer_control) {
   return 1;
 }
 
+// From cras_alsa_sof
+int cras_alsa_sof_load_plugin(snd_hctl_t* hctl,
+                              const struct plugin* plugin,
+                              int sample_rate,
+                              int bypass) {
+  return -ENOENT;
+}
+
 // From cras_alsa_jack
 struct cras_alsa_jack_list* cras_alsa_jack_list_create(
     unsigned int card_index,
@@ -2788,6 +3240,11 @@ unsigned int ucm_get_dma_period_for_dev(struct cras_use_case_mgr* mgr,
   return ucm_get_dma_period_for_dev_ret;
 }
 
+int ucm_get_low_latency_for_dev(struct cras_use_case_mgr* mgr,
+                                const char* dev) {
+  return ucm_get_low_latency_for_dev_ret;
+}
+
 int ucm_get_sample_rate_for_dev(struct cras_use_case_mgr* mgr,
                                 const char* dev,
                                 enum CRAS_STREAM_DIRECTION direction) {
@@ -2894,6 +3351,14 @@ void cras_alsa_jack_update_monitor_name(const struct cras_alsa_jack* jack,
     strcpy(name_buf, cras_alsa_jack_update_monitor_fake_name);
 }
 
+int cras_alsa_jack_compressed_formats(const struct cras_alsa_jack* jack) {
+  return 0;
+}
+
+uint32_t cras_alsa_jack_display_checksum(const struct cras_alsa_jack* jack) {
+  return cras_alsa_jack_display_checksum_ret;
+}
+
 void cras_alsa_jack_update_node_type(const struct cras_alsa_jack* jack,
                                      enum CRAS_NODE_TYPE* type) {
   cras_alsa_jack_update_node_type_called++;
@@ -36,6 +36,10 @@ namespace {
 static int fake_jack_cb_plugged;
 static void* fake_jack_cb_data;
 static size_t fake_jack_cb_called;
+static size_t cras_tm_create_timer_called;
+static size_t cras_tm_cancel_timer_called;
+static void (*cras_tm_create_timer_cb)(struct cras_timer* t, void* data);
+static void* cras_tm_create_timer_cb_data;
 unsigned int snd_hctl_elem_get_device_return_val;
 unsigned int snd_hctl_elem_get_device_called;
 static size_t snd_hctl_first_elem_called;
@@ -121,6 +125,10 @@ static void ResetStubData() {
   snd_ctl_elem_value_get_boolean_called = 0;
   fake_jack_cb_called = 0;
   fake_jack_cb_plugged = 0;
+  cras_tm_create_timer_called = 0;
+  cras_tm_cancel_timer_called = 0;
+  cras_tm_create_timer_cb = NULL;
+  cras_tm_create_timer_cb_data = NULL;
   fake_jack_cb_arg = reinterpret_cast<void*>(0x987);
   fake_mixer = reinterpret_cast<struct cras_alsa_mixer*>(0x789);
   cras_alsa_mixer_get_output_matching_name_called = 0;
@@ -627,6 +635,10 @@ TEST(AlsaJacks, CreateOneHpJack) {
   snd_hctl_elem_set_callback_value(
       reinterpret_cast<snd_hctl_elem_t*>(&elem_names[1]), 0);
   EXPECT_EQ(1, snd_hctl_elem_get_name_called);
+  // The event is acted on once the jacks have settled.
+  EXPECT_EQ(0, fake_jack_cb_called);
+  ASSERT_NE((void*)NULL, (void*)cras_tm_create_timer_cb);
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
   EXPECT_EQ(1, fake_jack_cb_plugged);
   EXPECT_EQ(1, fake_jack_cb_called);
   EXPECT_EQ(fake_jack_cb_arg, fake_jack_cb_data);
@@ -683,6 +695,48 @@ TEST(AlsaJacks, CreateHDMIJacksWithELD) {
   cras_alsa_jack_list_destroy(jack_list);
 }
 
+TEST(AlsaJacks, JackEventsCoalesced) {
+  std::string elem_names[] = {
+      "Headphone Jack",
+  };
+  snd_hctl_elem_t* elem = reinterpret_cast<snd_hctl_elem_t*>(&elem_names[0]);
+  struct cras_alsa_jack_list* jack_list;
+
+  ResetStubData();
+  jack_list = run_test_with_elem_list(CRAS_STREAM_OUTPUT, elem_names, 0, NULL,
+                                      ARRAY_SIZE(elem_names), 0, 1);
+  ASSERT_NE(static_cast<struct cras_alsa_jack_list*>(NULL), jack_list);
+
+  // A bouncing plug is reported once, when it settles.
+  cras_tm_create_timer_called = 0;
+  snd_ctl_elem_value_get_boolean_return_value = 1;
+  snd_hctl_elem_set_callback_value(elem, 0);
+  snd_ctl_elem_value_get_boolean_return_value = 0;
+  snd_hctl_elem_set_callback_value(elem, 0);
+  snd_ctl_elem_value_get_boolean_return_value = 1;
+  snd_hctl_elem_set_callback_value(elem, 0);
+  EXPECT_EQ(0, fake_jack_cb_called);
+  EXPECT_EQ(3, cras_tm_create_timer_called);
+  EXPECT_EQ(2, cras_tm_cancel_timer_called);
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
+  EXPECT_EQ(1, fake_jack_cb_called);
+  EXPECT_EQ(1, fake_jack_cb_plugged);
+
+  // Bouncing back to the reported state isn't reported at all.
+  snd_ctl_elem_value_get_boolean_return_value = 0;
+  snd_hctl_elem_set_callback_value(elem, 0);
+  snd_ctl_elem_value_get_boolean_return_value = 1;
+  snd_hctl_elem_set_callback_value(elem, 0);
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
+  EXPECT_EQ(1, fake_jack_cb_called);
+
+  // Pending events don't outlive the list.
+  cras_tm_cancel_timer_called = 0;
+  snd_hctl_elem_set_callback_value(elem, 0);
+  cras_alsa_jack_list_destroy(jack_list);
+  EXPECT_EQ(1, cras_tm_cancel_timer_called);
+}
+
 TEST(AlsaJacks, CreateOneHpTwoHDMIJacks) {
   std::string elem_names[] = {
       "asdf",
@@ -707,6 +761,10 @@ TEST(AlsaJacks, CreateOneHpTwoHDMIJacks) {
   snd_hctl_elem_set_callback_value(
       reinterpret_cast<snd_hctl_elem_t*>(&elem_names[2]), 0);
   EXPECT_EQ(1, snd_hctl_elem_get_name_called);
+  // The event is acted on once the jacks have settled.
+  EXPECT_EQ(0, fake_jack_cb_called);
+  ASSERT_NE((void*)NULL, (void*)cras_tm_create_timer_cb);
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
   EXPECT_EQ(1, fake_jack_cb_plugged);
   EXPECT_EQ(1, fake_jack_cb_called);
   EXPECT_EQ(fake_jack_cb_arg, fake_jack_cb_data);
@@ -745,6 +803,10 @@ TEST(AlsaJacks, CreateHCTLHeadphoneJackFromUCM) {
   snd_hctl_elem_set_callback_value(
       reinterpret_cast<snd_hctl_elem_t*>(&elem_names[1]), 0);
   EXPECT_EQ(1, snd_hctl_elem_get_name_called);
+  // The event is acted on once the jacks have settled.
+  EXPECT_EQ(0, fake_jack_cb_called);
+  ASSERT_NE((void*)NULL, (void*)cras_tm_create_timer_cb);
+  cras_tm_create_timer_cb(NULL, cras_tm_create_timer_cb_data);
   EXPECT_EQ(1, fake_jack_cb_plugged);
   EXPECT_EQ(1, fake_jack_cb_called);
   EXPECT_EQ(fake_jack_cb_arg, fake_jack_cb_data);
@@ -1064,10 +1126,15 @@ cras_timer* cras_tm_create_timer(cras_tm* tm,
                                  unsigned int ms,
                                  void (*cb)(cras_timer* t, void* data),
                                  void* cb_data) {
+  cras_tm_create_timer_called++;
+  cras_tm_create_timer_cb = cb;
+  cras_tm_create_timer_cb_data = cb_data;
   return reinterpret_cast<cras_timer*>(0x55);
 }
 
-void cras_tm_cancel_timer(cras_tm* tm, cras_timer* t) {}
+void cras_tm_cancel_timer(cras_tm* tm, cras_timer* t) {
+  cras_tm_cancel_timer_called++;
+}
 
 cras_tm* cras_system_state_get_tm() {
   return reinterpret_cast<cras_tm*>(0x66);
@@ -371,6 +371,7 @@ TEST(AlsaMixer, CreateOneUnknownElementWithVolume) {
    * If passed a mixer output then it should mute both "Playback" and that
    * mixer_output.
    */
+  cras_alsa_mixer_invalidate_cache(c);
   cras_alsa_mixer_set_mute(c, 0, mixer_output);
   EXPECT_EQ(2, snd_mixer_selem_set_playback_switch_all_called);
   cras_alsa_mixer_set_dBFS(c, 0, NULL);
@@ -457,6 +458,60 @@ TEST(AlsaMixer, CreateOneMainElement) {
   mixer_control_destroy(mixer_output);
 }
 
+TEST(AlsaMixer, RepeatedSettingsNotWrittenAgain) {
+  struct cras_alsa_mixer* c;
+  int element_playback_volume[] = {
+      1,
+  };
+  int element_playback_switches[] = {
+      1,
+  };
+  const char* element_names[] = {"Master"};
+
+  ResetStubData();
+  snd_mixer_first_elem_return_value = reinterpret_cast<snd_mixer_elem_t*>(1);
+  snd_mixer_selem_has_playback_volume_return_values = element_playback_volume;
+  snd_mixer_selem_has_playback_volume_return_values_length =
+      ARRAY_SIZE(element_playback_volume);
+  snd_mixer_selem_has_playback_switch_return_values = element_playback_switches;
+  snd_mixer_selem_has_playback_switch_return_values_length =
+      ARRAY_SIZE(element_playback_switches);
+  snd_mixer_selem_get_name_return_values = element_names;
+  snd_mixer_selem_get_name_return_values_length = ARRAY_SIZE(element_names);
+  c = create_mixer_and_add_controls_by_name_matching("hw:0", NULL, NULL);
+  ASSERT_NE(static_cast<struct cras_alsa_mixer*>(NULL), c);
+
+  cras_alsa_mixer_set_mute(c, 0, NULL);
+  cras_alsa_mixer_set_dBFS(c, -100, NULL);
+  EXPECT_EQ(1, snd_mixer_selem_set_playback_switch_all_called);
+  EXPECT_EQ(1, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(1, snd_mixer_selem_get_playback_dB_called);
+
+  /* The same settings again don't touch the controls. */
+  cras_alsa_mixer_set_mute(c, 0, NULL);
+  cras_alsa_mixer_set_dBFS(c, -100, NULL);
+  EXPECT_EQ(1, snd_mixer_selem_set_playback_switch_all_called);
+  EXPECT_EQ(1, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(1, snd_mixer_selem_get_playback_dB_called);
+
+  /* New settings do. */
+  cras_alsa_mixer_set_mute(c, 1, NULL);
+  cras_alsa_mixer_set_dBFS(c, -200, NULL);
+  EXPECT_EQ(2, snd_mixer_selem_set_playback_switch_all_called);
+  EXPECT_EQ(2, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(2, snd_mixer_selem_get_playback_dB_called);
+
+  /* And so do the old ones once the cache is dropped. */
+  cras_alsa_mixer_invalidate_cache(c);
+  cras_alsa_mixer_set_mute(c, 1, NULL);
+  cras_alsa_mixer_set_dBFS(c, -200, NULL);
+  EXPECT_EQ(3, snd_mixer_selem_set_playback_switch_all_called);
+  EXPECT_EQ(3, snd_mixer_selem_set_playback_dB_all_called);
+  EXPECT_EQ(3, snd_mixer_selem_get_playback_dB_called);
+
+  cras_alsa_mixer_destroy(c);
+}
+
 TEST(AlsaMixer, CreateTwoMainVolumeElements) {
   struct cras_alsa_mixer* c;
   snd_mixer_elem_t* elements[] = {
@@ -560,6 +615,7 @@ TEST(AlsaMixer, CreateTwoMainVolumeElements) {
   /* Set volume should be called for Main, PCM, and the mixer_output passed
    * in. If Main doesn't set to anything but zero then the entire volume
    * should be passed to the PCM control.*/
+  cras_alsa_mixer_invalidate_cache(c);
   cras_alsa_mixer_set_dBFS(c, -50, mixer_output);
   EXPECT_EQ(3, snd_mixer_selem_set_playback_dB_all_called);
   EXPECT_EQ(2, snd_mixer_selem_get_playback_dB_called);
@@ -581,6 +637,7 @@ TEST(AlsaMixer, CreateTwoMainVolumeElements) {
   mixer_output->has_volume = 0;
   mixer_output->min_volume_dB = MIXER_CONTROL_VOLUME_DB_INVALID;
   mixer_output->max_volume_dB = MIXER_CONTROL_VOLUME_DB_INVALID;
+  cras_alsa_mixer_invalidate_cache(c);
   cras_alsa_mixer_set_dBFS(c, -50, mixer_output);
   EXPECT_EQ(2, snd_mixer_selem_set_playback_dB_all_called);
   EXPECT_EQ(2, snd_mixer_selem_get_playback_dB_called);
@@ -718,6 +775,7 @@ TEST(AlsaMixer, CreateTwoMainCaptureElements) {
   EXPECT_EQ(1, snd_mixer_selem_get_capture_dB_range_called);
   EXPECT_EQ(1, mixer_input->has_volume);
 
+  cras_alsa_mixer_invalidate_cache(c);
   cras_alsa_mixer_set_capture_dBFS(c, 20, mixer_input);
 
   EXPECT_EQ(3, snd_mixer_selem_set_capture_dB_all_called);
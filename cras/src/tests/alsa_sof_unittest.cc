@@ -0,0 +1,240 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <math.h>
+#include <string.h>
+
+#include <vector>
+
+extern "C" {
+#include "biquad.h"
+#include "cras_alsa_sof.h"
+#include "cras_dsp_ini.h"
+}
+
+namespace {
+
+static const unsigned int kSofMagic = 0x00464F53;
+static const unsigned int kSofAbi = 0x03012000;
+
+static snd_hctl_elem_t* snd_hctl_find_elem_return;
+static std::string snd_ctl_elem_id_set_name_value;
+static std::vector<unsigned int> snd_hctl_elem_tlv_read_value;
+static std::vector<unsigned int> snd_hctl_elem_tlv_write_value;
+static int snd_hctl_elem_tlv_write_called;
+
+class AlsaSofTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    memset(&plugin_, 0, sizeof(plugin_));
+    plugin_.label = "eq2";
+    plugin_.firmware_control = "EQIIR1.0 eqiir_coef_1";
+    for (int i = 0; i < 4; i++)
+      AddPort(PORT_AUDIO, 0);
+
+    snd_hctl_find_elem_return = reinterpret_cast<snd_hctl_elem_t*>(0x55);
+    snd_ctl_elem_id_set_name_value.clear();
+    snd_hctl_elem_tlv_write_value.clear();
+    snd_hctl_elem_tlv_write_called = 0;
+    // The blob the topology set up: a tag, the length and a header with
+    // 4 bytes of data.
+    snd_hctl_elem_tlv_read_value = {0, 36, kSofMagic, 0, 4, kSofAbi,
+                                    0, 0,  0,         0, 0};
+  }
+
+  virtual void TearDown() { ARRAY_FREE(&plugin_.ports); }
+
+  void AddPort(enum port_type type, float value) {
+    struct port* port = ARRAY_APPEND_ZERO(&plugin_.ports);
+    port->direction = PORT_INPUT;
+    port->type = type;
+    port->flow_id = type == PORT_AUDIO ? 0 : INVALID_FLOW_ID;
+    port->init_value = value;
+  }
+
+  // Adds a biquad to each channel of the eq2.
+  void AddBiquads(enum biquad_type type0,
+                  float freq0,
+                  float q0,
+                  float gain0,
+                  enum biquad_type type1,
+                  float freq1,
+                  float q1,
+                  float gain1) {
+    AddPort(PORT_CONTROL, type0);
+    AddPort(PORT_CONTROL, freq0);
+    AddPort(PORT_CONTROL, q0);
+    AddPort(PORT_CONTROL, gain0);
+    AddPort(PORT_CONTROL, type1);
+    AddPort(PORT_CONTROL, freq1);
+    AddPort(PORT_CONTROL, q1);
+    AddPort(PORT_CONTROL, gain1);
+  }
+
+  static int32_t Q2_30(double value) {
+    return (int32_t)round(value * (1 << 30));
+  }
+
+  // Checks a struct sof_eq_iir_biquad against the coefficients of bq.
+  static void ExpectBiquad(const struct biquad& bq, const int32_t* data) {
+    EXPECT_EQ(Q2_30(-bq.a2), data[0]);
+    EXPECT_EQ(Q2_30(-bq.a1), data[1]);
+    EXPECT_EQ(Q2_30(bq.b2), data[2]);
+    EXPECT_EQ(Q2_30(bq.b1), data[3]);
+    EXPECT_EQ(Q2_30(bq.b0), data[4]);
+    EXPECT_EQ(0, data[5]);
+    EXPECT_EQ(16384, data[6]);
+  }
+
+  struct plugin plugin_;
+  int32_t data_[SOF_EQ_IIR_MAX_WORDS];
+};
+
+TEST_F(AlsaSofTestSuite, EqIirData) {
+  struct biquad peaking, lowpass0, lowpass1;
+
+  AddBiquads(BQ_PEAKING, 1000, 1, 3, BQ_NONE, 0, 0, 0);
+  AddBiquads(BQ_LOWPASS, 12000, 0.7, 0, BQ_LOWPASS, 8000, 0.7, 0);
+  biquad_set(&peaking, BQ_PEAKING, 1000.0f / 24000, 1, 3);
+  biquad_set(&lowpass0, BQ_LOWPASS, 12000.0f / 24000, 0.7f, 0);
+  biquad_set(&lowpass1, BQ_LOWPASS, 8000.0f / 24000, 0.7f, 0);
+
+  int n = cras_alsa_sof_eq_iir_data(&plugin_, 48000, 0, data_,
+                                    SOF_EQ_IIR_MAX_WORDS);
+  // The config, two responses of 2 and 1 biquads.
+  ASSERT_EQ(9 + 6 + 2 * 7 + 6 + 7, n);
+  EXPECT_EQ(n * 4, data_[0]);
+  EXPECT_EQ(2, data_[1]);
+  EXPECT_EQ(2, data_[2]);
+  EXPECT_EQ(0, data_[7]);
+  EXPECT_EQ(1, data_[8]);
+
+  // The first channel skips BQ_NONE of the first biquad of the second.
+  const int32_t* response = data_ + 9;
+  EXPECT_EQ(2, response[0]);
+  EXPECT_EQ(2, response[1]);
+  ExpectBiquad(peaking, response + 6);
+  ExpectBiquad(lowpass0, response + 13);
+  response += 6 + 2 * 7;
+  EXPECT_EQ(1, response[0]);
+  ExpectBiquad(lowpass1, response + 6);
+}
+
+TEST_F(AlsaSofTestSuite, EqIirBypass) {
+  struct biquad identity;
+
+  AddBiquads(BQ_PEAKING, 1000, 1, 3, BQ_PEAKING, 1000, 1, 3);
+  biquad_set(&identity, BQ_NONE, 0, 0, 0);
+
+  int n = cras_alsa_sof_eq_iir_data(&plugin_, 48000, 1, data_,
+                                    SOF_EQ_IIR_MAX_WORDS);
+  ASSERT_EQ(9 + 2 * (6 + 7), n);
+  EXPECT_EQ(1, data_[9]);
+  ExpectBiquad(identity, data_ + 9 + 6);
+  EXPECT_EQ(1, data_[9 + 13]);
+  ExpectBiquad(identity, data_ + 9 + 13 + 6);
+  EXPECT_EQ(1 << 30, data_[9 + 6 + 4]);
+}
+
+TEST_F(AlsaSofTestSuite, EqIirInvalid) {
+  struct biquad loud;
+
+  // Coefficients out of the Q2.30 range.
+  biquad_set(&loud, BQ_PEAKING, 0.5, 0.1, 40);
+  ASSERT_GE(fabs(loud.b0), 2);
+  AddBiquads(BQ_PEAKING, 12000, 0.1, 40, BQ_NONE, 0, 0, 0);
+  EXPECT_EQ(-ERANGE, cras_alsa_sof_eq_iir_data(&plugin_, 48000, 0, data_,
+                                               SOF_EQ_IIR_MAX_WORDS));
+
+  // Controls driven by another plugin.
+  ARRAY_ELEMENT(&plugin_.ports, 4)->init_value = BQ_LOWPASS;
+  ARRAY_ELEMENT(&plugin_.ports, 6)->flow_id = 1;
+  EXPECT_EQ(-EINVAL, cras_alsa_sof_eq_iir_data(&plugin_, 48000, 0, data_,
+                                               SOF_EQ_IIR_MAX_WORDS));
+
+  // Only eq2 is supported.
+  plugin_.label = "drc";
+  EXPECT_EQ(-EINVAL, cras_alsa_sof_eq_iir_data(&plugin_, 48000, 0, data_,
+                                               SOF_EQ_IIR_MAX_WORDS));
+
+  plugin_.label = "eq2";
+  EXPECT_EQ(-E2BIG, cras_alsa_sof_eq_iir_data(&plugin_, 48000, 1, data_, 20));
+}
+
+TEST_F(AlsaSofTestSuite, LoadPlugin) {
+  AddBiquads(BQ_PEAKING, 1000, 1, 3, BQ_PEAKING, 1000, 1, 3);
+  snd_hctl_elem_tlv_read_value[3] = 7;
+
+  EXPECT_EQ(0, cras_alsa_sof_load_plugin(NULL, &plugin_, 48000, 0));
+  EXPECT_EQ("EQIIR1.0 eqiir_coef_1", snd_ctl_elem_id_set_name_value);
+  ASSERT_EQ(1, snd_hctl_elem_tlv_write_called);
+
+  int n = cras_alsa_sof_eq_iir_data(&plugin_, 48000, 0, data_,
+                                    SOF_EQ_IIR_MAX_WORDS);
+  const std::vector<unsigned int>& tlv = snd_hctl_elem_tlv_write_value;
+  ASSERT_EQ(2 + 8 + n, tlv.size());
+  EXPECT_EQ((8 + n) * 4, tlv[1]);
+  // The type and ABI version of the topology are kept.
+  EXPECT_EQ(kSofMagic, tlv[2]);
+  EXPECT_EQ(7, tlv[3]);
+  EXPECT_EQ(n * 4, tlv[4]);
+  EXPECT_EQ(kSofAbi, tlv[5]);
+  EXPECT_EQ(0, memcmp(data_, &tlv[10], n * 4));
+}
+
+TEST_F(AlsaSofTestSuite, LoadPluginNoControl) {
+  AddBiquads(BQ_PEAKING, 1000, 1, 3, BQ_PEAKING, 1000, 1, 3);
+  snd_hctl_find_elem_return = NULL;
+
+  EXPECT_EQ(-ENOENT, cras_alsa_sof_load_plugin(NULL, &plugin_, 48000, 0));
+  EXPECT_EQ(0, snd_hctl_elem_tlv_write_called);
+}
+
+TEST_F(AlsaSofTestSuite, LoadPluginNotSof) {
+  AddBiquads(BQ_PEAKING, 1000, 1, 3, BQ_PEAKING, 1000, 1, 3);
+  snd_hctl_elem_tlv_read_value[2] = 0;
+
+  EXPECT_EQ(-EINVAL, cras_alsa_sof_load_plugin(NULL, &plugin_, 48000, 0));
+  EXPECT_EQ(0, snd_hctl_elem_tlv_write_called);
+}
+
+}  // namespace
+
+extern "C" {
+
+// From alsa-lib hcontrol.c
+snd_hctl_elem_t* snd_hctl_find_elem(snd_hctl_t* hctl,
+                                    const snd_ctl_elem_id_t* id) {
+  return snd_hctl_find_elem_return;
+}
+int snd_hctl_elem_tlv_read(snd_hctl_elem_t* elem,
+                           unsigned int* tlv,
+                           unsigned int tlv_size) {
+  size_t size = snd_hctl_elem_tlv_read_value.size() * sizeof(*tlv);
+
+  if (size > tlv_size)
+    return -ENOSPC;
+  memcpy(tlv, snd_hctl_elem_tlv_read_value.data(), size);
+  return 0;
+}
+int snd_hctl_elem_tlv_write(snd_hctl_elem_t* elem, const unsigned int* tlv) {
+  snd_hctl_elem_tlv_write_called++;
+  snd_hctl_elem_tlv_write_value.assign(tlv, tlv + 2 + tlv[1] / sizeof(*tlv));
+  return 1;
+}
+
+// From alsa-lib control.c
+void snd_ctl_elem_id_set_interface(snd_ctl_elem_id_t* obj,
+                                   snd_ctl_elem_iface_t val) {}
+void snd_ctl_elem_id_set_name(snd_ctl_elem_id_t* obj, const char* val) {
+  snd_ctl_elem_id_set_name_value = val;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
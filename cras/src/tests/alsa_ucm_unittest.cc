@@ -41,6 +41,7 @@ static struct cras_use_case_mgr cras_ucm_mgr;
 static const char* avail_verbs[] = {"HiFi", "Comment for Verb1"};
 
 static void ResetStubData() {
+  free_values(&cras_ucm_mgr);
   snd_use_case_mgr_open_called = 0;
   snd_use_case_mgr_open_return = 0;
   snd_use_case_mgr_close_called = 0;
@@ -985,17 +986,41 @@ TEST(AlsaUcm, UseFullySpecifiedUCMConfig) {
   fully_specified_flag = ucm_has_fully_specified_ucm_flag(mgr);
   ASSERT_FALSE(fully_specified_flag);
 
-  /* Flag is set to "1". */
+  /* Flag is set to "1". Values are read once, forget the previous one. */
   snd_use_case_get_value[id] = std::string("1");
+  free_values(mgr);
   fully_specified_flag = ucm_has_fully_specified_ucm_flag(mgr);
   ASSERT_TRUE(fully_specified_flag);
 
   /* Flag is set to "0". */
   snd_use_case_get_value[id] = std::string("0");
+  free_values(mgr);
   fully_specified_flag = ucm_has_fully_specified_ucm_flag(mgr);
   ASSERT_FALSE(fully_specified_flag);
 }
 
+TEST(AlsaUcm, ValuesReadOnce) {
+  struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
+  std::string id = "=DspName/Speaker/HiFi";
+  const char* dsp_name;
+
+  ResetStubData();
+  snd_use_case_get_value[id] = std::string("speaker_eq");
+
+  for (int i = 0; i < 3; i++) {
+    dsp_name = ucm_get_dsp_name_for_dev(mgr, "Speaker");
+    ASSERT_NE((void*)NULL, dsp_name);
+    EXPECT_EQ(0, strcmp(dsp_name, "speaker_eq"));
+    free((void*)dsp_name);
+  }
+  EXPECT_EQ(1, snd_use_case_get_called);
+
+  /* Missing values are remembered too. */
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(NULL, ucm_get_dsp_name_for_dev(mgr, "Headphone"));
+  EXPECT_EQ(2, snd_use_case_get_called);
+}
+
 TEST(AlsaUcm, GetMixerNameForDevice) {
   struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
   const char *mixer_name_1, *mixer_name_2;
@@ -1176,6 +1201,22 @@ TEST(AlsaUcm, GetPeriodFramesForDevice) {
   EXPECT_EQ(0, dma_period_3);
 }
 
+TEST(AlsaUcm, GetLowLatencyForDevice) {
+  struct cras_use_case_mgr* mgr = &cras_ucm_mgr;
+  const char* devices[] = {"Dev1", "Comment for Dev1", "Dev2",
+                           "Comment for Dev2"};
+
+  ResetStubData();
+
+  fake_list["_devices/HiFi"] = devices;
+  fake_list_size["_devices/HiFi"] = 4;
+  std::string id_1 = "=LowLatency/Dev1/HiFi";
+  snd_use_case_get_value[id_1] = "1";
+
+  EXPECT_EQ(1, ucm_get_low_latency_for_dev(mgr, "Dev1"));
+  EXPECT_EQ(0, ucm_get_low_latency_for_dev(mgr, "Dev2"));
+}
+
 TEST(AlsaUcm, UcmSection) {
   struct ucm_section* section_list = NULL;
   struct ucm_section* section;
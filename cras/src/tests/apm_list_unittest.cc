@@ -4,6 +4,7 @@
 
 #include <gtest/gtest.h>
 #include <stdio.h>
+#include <unistd.h>
 
 extern "C" {
 #include "cras_apm_list.h"
@@ -21,6 +22,7 @@ extern "C" {
 namespace {
 
 static void* stream_ptr = reinterpret_cast<void*>(0x123);
+static void* stream_ptr2 = reinterpret_cast<void*>(0x124);
 static void* dev_ptr = reinterpret_cast<void*>(0x345);
 static void* dev_ptr2 = reinterpret_cast<void*>(0x678);
 static struct cras_apm_list* list;
@@ -28,7 +30,10 @@ static struct cras_audio_area fake_audio_area;
 static unsigned int dsp_util_interleave_frames;
 static unsigned int webrtc_apm_process_stream_f_called;
 static unsigned int webrtc_apm_process_reverse_stream_f_called;
+static float webrtc_apm_process_reverse_stream_f_sample;
+static int webrtc_apm_process_reverse_stream_f_channels;
 static device_enabled_callback_t device_enabled_callback_val;
+static device_disabled_callback_t device_disabled_callback_val;
 static struct ext_dsp_module* ext_dsp_module_value;
 static struct cras_ionode fake_node;
 static struct cras_iodev fake_iodev;
@@ -36,6 +41,11 @@ static int webrtc_apm_create_called;
 static bool cras_iodev_is_aec_use_case_ret;
 static dictionary* webrtc_apm_create_aec_ini_val = NULL;
 static dictionary* webrtc_apm_create_apm_ini_val = NULL;
+static bool cras_system_get_apm_offload_enabled_ret;
+static int cras_system_get_mic_keep_warm_ms_ret;
+static int webrtc_apm_destroy_called;
+static webrtc_apm webrtc_apm_destroy_val;
+static webrtc_apm webrtc_apm_process_stream_f_val;
 
 TEST(ApmList, ApmListCreate) {
   list = cras_apm_list_create(stream_ptr, 0);
@@ -117,7 +127,7 @@ TEST(ApmList, AddApmInputDevUnuseFirstChannel) {
       fmt.channel_layout[ch] = test_layouts[i][ch];
 
     /* Input dev is of aec use case. */
-    apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+    apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
     EXPECT_NE((void*)NULL, apm);
 
     /* Assert that the post-processing format never has an unset
@@ -155,7 +165,7 @@ TEST(ApmList, AddRemoveApm) {
   EXPECT_NE((void*)NULL, list);
 
   /* Input dev is of aec use case. */
-  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1));
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0));
   EXPECT_NE((void*)NULL, webrtc_apm_create_aec_ini_val);
   EXPECT_NE((void*)NULL, webrtc_apm_create_apm_ini_val);
   EXPECT_EQ((void*)NULL, cras_apm_list_get_active_apm(stream_ptr, dev_ptr));
@@ -165,7 +175,7 @@ TEST(ApmList, AddRemoveApm) {
   EXPECT_EQ((void*)NULL, cras_apm_list_get_active_apm(stream_ptr, dev_ptr2));
 
   /* Input dev is not of aec use case. */
-  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr2, &fmt, 0));
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr2, &fmt, 0, 0));
   EXPECT_EQ((void*)NULL, webrtc_apm_create_aec_ini_val);
   EXPECT_EQ((void*)NULL, webrtc_apm_create_apm_ini_val);
   cras_apm_list_start_apm(list, dev_ptr2);
@@ -201,14 +211,14 @@ TEST(ApmList, OutputTypeNotAecUseCase) {
 
   /* Output device is of aec use case. */
   cras_iodev_is_aec_use_case_ret = 1;
-  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1));
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0));
   EXPECT_NE((void*)NULL, webrtc_apm_create_aec_ini_val);
   EXPECT_NE((void*)NULL, webrtc_apm_create_apm_ini_val);
   cras_apm_list_remove_apm(list, dev_ptr);
 
   /* Output device is not of aec use case. */
   cras_iodev_is_aec_use_case_ret = 0;
-  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1));
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0));
   EXPECT_EQ((void*)NULL, webrtc_apm_create_aec_ini_val);
   EXPECT_EQ((void*)NULL, webrtc_apm_create_apm_ini_val);
   cras_apm_list_remove_apm(list, dev_ptr);
@@ -237,7 +247,7 @@ TEST(ApmList, ApmProcessForwardBuffer) {
   list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
   EXPECT_NE((void*)NULL, list);
 
-  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
 
   buf = float_buffer_create(500, 2);
   float_buffer_written(buf, 300);
@@ -283,7 +293,7 @@ TEST(ApmList, ApmProcessReverseData) {
   struct float_buffer* buf;
   float* const* rp;
   unsigned int nread;
-  struct cras_iodev fake_iodev;
+  struct cras_iodev fake_iodev = {};
 
   fmt.num_channels = 2;
   fmt.frame_rate = 48000;
@@ -316,7 +326,7 @@ TEST(ApmList, ApmProcessReverseData) {
   list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
   EXPECT_NE((void*)NULL, list);
 
-  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
   cras_apm_list_start_apm(list, dev_ptr);
 
   ext_dsp_module_value->run(ext_dsp_module_value, 250);
@@ -325,6 +335,7 @@ TEST(ApmList, ApmProcessReverseData) {
   ext_dsp_module_value->run(ext_dsp_module_value, 250);
   EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
 
+  cras_apm_list_stop_apm(list, dev_ptr);
   float_buffer_destroy(&buf);
   cras_apm_list_destroy(list);
   cras_apm_list_deinit();
@@ -344,11 +355,11 @@ TEST(ApmList, StreamAddToAlreadyOpenedDev) {
   list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
   EXPECT_NE((void*)NULL, list);
 
-  apm1 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  apm1 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
   EXPECT_EQ(1, webrtc_apm_create_called);
   EXPECT_NE((void*)NULL, apm1);
 
-  apm2 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1);
+  apm2 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
   EXPECT_EQ(1, webrtc_apm_create_called);
   EXPECT_EQ(apm1, apm2);
 
@@ -356,12 +367,359 @@ TEST(ApmList, StreamAddToAlreadyOpenedDev) {
   cras_apm_list_deinit();
 }
 
+TEST(ApmList, StreamsShareApmOfSameDevAndEffects) {
+  struct cras_audio_format fmt, fmt2;
+  struct cras_apm_list* list2;
+  struct cras_apm *apm1, *apm2, *apm3;
+  struct float_buffer* buf;
+  float* const* rp;
+  unsigned int nread;
+  struct cras_iodev fake_odev = {};
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  init_channel_layout(&fmt);
+  fmt.channel_layout[CRAS_CH_FL] = 0;
+  fmt.channel_layout[CRAS_CH_FR] = 1;
+  fmt2 = fmt;
+  fmt2.frame_rate = 44100;
+
+  fake_odev.direction = CRAS_STREAM_OUTPUT;
+  cras_apm_list_init("");
+  device_enabled_callback_val(&fake_odev, NULL);
+
+  webrtc_apm_create_called = 0;
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  list2 = cras_apm_list_create(stream_ptr2, APM_ECHO_CANCELLATION);
+
+  apm1 = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
+  apm2 = cras_apm_list_add_apm(list2, dev_ptr, &fmt, 1, 0);
+  EXPECT_EQ(1, webrtc_apm_create_called);
+  ASSERT_NE((void*)NULL, apm2);
+  EXPECT_NE(apm1, apm2);
+
+  /* Another device or format needs its own APM. */
+  apm3 = cras_apm_list_add_apm(list2, dev_ptr2, &fmt2, 1, 0);
+  EXPECT_NE((void*)NULL, apm3);
+  EXPECT_EQ(2, webrtc_apm_create_called);
+  cras_apm_list_remove_apm(list2, dev_ptr2);
+
+  cras_apm_list_start_apm(list, dev_ptr);
+  cras_apm_list_start_apm(list2, dev_ptr);
+
+  /* Both streams read the block processed once. */
+  buf = float_buffer_create(1000, 2);
+  float_buffer_written(buf, 480);
+  webrtc_apm_process_stream_f_called = 0;
+  EXPECT_EQ(480, cras_apm_list_process(apm1, buf, 0));
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm1)->frames);
+  EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm2)->frames);
+
+  /* The next block waits until both streams have read this one. */
+  float_buffer_read(buf, 480);
+  float_buffer_written(buf, 480);
+  cras_apm_list_put_processed(apm1, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm1, buf, 0));
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(0, cras_apm_list_get_processed(apm1)->frames);
+  cras_apm_list_put_processed(apm2, 480);
+  EXPECT_EQ(480, cras_apm_list_process(apm2, buf, 0));
+  EXPECT_EQ(2, webrtc_apm_process_stream_f_called);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm1)->frames);
+  EXPECT_EQ(480, cras_apm_list_get_processed(apm2)->frames);
+
+  /* The shared APM analyzes each reverse block once. */
+  nread = 480;
+  rp = float_buffer_read_pointer(buf, 0, &nread);
+  for (int i = 0; i < 2; i++)
+    ext_dsp_module_value->ports[i] = rp[i];
+  ext_dsp_module_value->configure(ext_dsp_module_value, 800, 2, 48000);
+  webrtc_apm_process_reverse_stream_f_called = 0;
+  ext_dsp_module_value->run(ext_dsp_module_value, 480);
+  EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
+  ext_dsp_module_value->run(ext_dsp_module_value, 480);
+  EXPECT_EQ(2, webrtc_apm_process_reverse_stream_f_called);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_stop_apm(list2, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_destroy(list2);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, EffectsOnDeviceDspSkipApm) {
+  struct cras_audio_format fmt;
+  struct cras_apm_list* list2;
+  struct cras_apm *apm1, *apm2;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  init_channel_layout(&fmt);
+  cras_apm_list_init("");
+
+  webrtc_apm_create_called = 0;
+  list = cras_apm_list_create(stream_ptr,
+                              APM_ECHO_CANCELLATION | APM_NOISE_SUPRESSION);
+  list2 = cras_apm_list_create(stream_ptr2, APM_ECHO_CANCELLATION);
+
+  /* The device cancels the echo itself, nothing is left for APM. */
+  EXPECT_EQ((void*)NULL,
+            cras_apm_list_add_apm(list, dev_ptr, &fmt, 1,
+                                  APM_ECHO_CANCELLATION));
+  EXPECT_EQ(0, webrtc_apm_create_called);
+
+  /* With the noise suppression on the device only echo cancellation is
+   * left, which is shared with a stream asking for just that. */
+  apm1 = cras_apm_list_add_apm(list, dev_ptr2, &fmt, 1, APM_NOISE_SUPRESSION);
+  apm2 = cras_apm_list_add_apm(list2, dev_ptr2, &fmt, 1, APM_NOISE_SUPRESSION);
+  EXPECT_NE((void*)NULL, apm1);
+  EXPECT_NE((void*)NULL, apm2);
+  EXPECT_EQ(1, webrtc_apm_create_called);
+
+  /* The list still reports all the effects asked for. */
+  EXPECT_EQ(APM_ECHO_CANCELLATION | APM_NOISE_SUPRESSION,
+            cras_apm_list_get_effects(list));
+
+  cras_apm_list_destroy(list);
+  cras_apm_list_destroy(list2);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, ReverseMixesAllOutputs) {
+  struct cras_audio_format fmt;
+  struct cras_iodev odev1 = {}, odev2 = {};
+  struct ext_dsp_module *ext1, *ext2;
+  float samples1[2][480], samples2[441];
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  for (int i = 0; i < 480; i++)
+    samples1[0][i] = samples1[1][i] = 0.25f;
+  for (int i = 0; i < 441; i++)
+    samples2[i] = 0.5f;
+
+  cras_apm_list_init("");
+  odev1.direction = CRAS_STREAM_OUTPUT;
+  odev2.direction = CRAS_STREAM_OUTPUT;
+  device_enabled_callback_val(&odev1, NULL);
+  device_enabled_callback_val(&odev2, NULL);
+  ext1 = odev1.ext_dsp_module;
+  ext2 = odev2.ext_dsp_module;
+  ASSERT_NE((void*)NULL, ext1);
+  ASSERT_NE((void*)NULL, ext2);
+  EXPECT_NE(ext1, ext2);
+
+  /* A stereo output at 48kHz and a mono one at 44.1kHz. */
+  ext1->ports[0] = samples1[0];
+  ext1->ports[1] = samples1[1];
+  ext1->configure(ext1, 800, 2, 48000);
+  ext2->ports[0] = samples2;
+  ext2->configure(ext2, 800, 1, 44100);
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
+  cras_apm_list_start_apm(list, dev_ptr);
+  webrtc_apm_process_reverse_stream_f_called = 0;
+
+  /* The first output to complete a block leads, alone at first. */
+  ext1->run(ext1, 480);
+  EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_EQ(2, webrtc_apm_process_reverse_stream_f_channels);
+  EXPECT_FLOAT_EQ(0.25f, webrtc_apm_process_reverse_stream_f_sample);
+
+  /* The other output only adds its blocks to the next lead block. */
+  ext2->run(ext2, 441);
+  EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_called);
+  ext1->run(ext1, 480);
+  EXPECT_EQ(2, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_FLOAT_EQ(0.75f, webrtc_apm_process_reverse_stream_f_sample);
+
+  /* The blocks of an output running ahead are dropped. */
+  for (int i = 0; i < 3; i++)
+    ext2->run(ext2, 441);
+  ext1->run(ext1, 480);
+  EXPECT_EQ(3, webrtc_apm_process_reverse_stream_f_called);
+  ext1->run(ext1, 480);
+  ext1->run(ext1, 480);
+  EXPECT_EQ(5, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_FLOAT_EQ(0.25f, webrtc_apm_process_reverse_stream_f_sample);
+
+  /* When the lead is disabled the other output leads. */
+  device_disabled_callback_val(&odev1, NULL);
+  ext2->run(ext2, 441);
+  EXPECT_EQ(6, webrtc_apm_process_reverse_stream_f_called);
+  EXPECT_EQ(1, webrtc_apm_process_reverse_stream_f_channels);
+  EXPECT_FLOAT_EQ(0.5f, webrtc_apm_process_reverse_stream_f_sample);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+}
+
+TEST(ApmList, ApmOffloadDelaysProcessedBlock) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct cras_audio_area* area;
+  struct float_buffer* buf;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  init_channel_layout(&fmt);
+  fmt.channel_layout[CRAS_CH_FL] = 0;
+  fmt.channel_layout[CRAS_CH_FR] = 1;
+
+  cras_system_get_apm_offload_enabled_ret = true;
+  cras_apm_list_init("");
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  EXPECT_NE((void*)NULL, list);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
+  ASSERT_NE((void*)NULL, apm);
+  EXPECT_EQ(480, cras_apm_list_get_delay(apm));
+
+  /* The first block is handed to the worker and silence comes out, the
+   * audio thread doesn't interleave anything itself. */
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  webrtc_apm_process_stream_f_called = 0;
+  dsp_util_interleave_frames = 0;
+  cras_apm_list_process(apm, buf, 0);
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(480, area->frames);
+  EXPECT_EQ(0, dsp_util_interleave_frames);
+
+  /* Give the worker time to run, the next block gets the first one back. */
+  for (int i = 0; i < 100 && !webrtc_apm_process_stream_f_called; i++)
+    usleep(1000);
+  usleep(10000);
+  EXPECT_EQ(1, webrtc_apm_process_stream_f_called);
+  cras_apm_list_put_processed(apm, 480);
+  cras_apm_list_process(apm, buf, 0);
+  area = cras_apm_list_get_processed(apm);
+  EXPECT_EQ(480, area->frames);
+  EXPECT_EQ(480, dsp_util_interleave_frames);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  cras_apm_list_remove_apm(list, dev_ptr);
+
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+  cras_system_get_apm_offload_enabled_ret = false;
+}
+
+TEST(ApmList, WarmMicKeepsIdleInstanceUntilReleased) {
+  struct cras_audio_format fmt;
+  struct cras_apm_list* list2;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  init_channel_layout(&fmt);
+  fmt.channel_layout[CRAS_CH_FL] = 0;
+  fmt.channel_layout[CRAS_CH_FR] = 1;
+
+  cras_system_get_mic_keep_warm_ms_ret = 1000;
+  cras_apm_list_init("");
+  webrtc_apm_create_called = 0;
+  webrtc_apm_destroy_called = 0;
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0));
+  cras_apm_list_destroy(list);
+  EXPECT_EQ(0, webrtc_apm_destroy_called);
+
+  /* The next stream on the device takes over the idle instance. */
+  list2 = cras_apm_list_create(stream_ptr2, APM_ECHO_CANCELLATION);
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list2, dev_ptr, &fmt, 1, 0));
+  EXPECT_EQ(1, webrtc_apm_create_called);
+  cras_apm_list_remove_apm(list2, dev_ptr);
+
+  /* Other devices keep theirs, the closed one frees it. */
+  cras_apm_list_release_idle(dev_ptr2);
+  EXPECT_EQ(0, webrtc_apm_destroy_called);
+  cras_apm_list_release_idle(dev_ptr);
+  EXPECT_EQ(1, webrtc_apm_destroy_called);
+
+  EXPECT_NE((void*)NULL, cras_apm_list_add_apm(list2, dev_ptr, &fmt, 1, 0));
+  EXPECT_EQ(2, webrtc_apm_create_called);
+
+  cras_apm_list_destroy(list2);
+  cras_apm_list_deinit();
+  EXPECT_EQ(2, webrtc_apm_destroy_called);
+  cras_system_get_mic_keep_warm_ms_ret = 0;
+}
+
+TEST(ApmList, ReloadSwapsApmAtNextBlock) {
+  struct cras_apm* apm;
+  struct cras_audio_format fmt;
+  struct float_buffer* buf;
+  webrtc_apm old_apm;
+  char* dir;
+
+  fmt.num_channels = 2;
+  fmt.frame_rate = 48000;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  init_channel_layout(&fmt);
+  fmt.channel_layout[CRAS_CH_FL] = 0;
+  fmt.channel_layout[CRAS_CH_FR] = 1;
+
+  dir = prepare_tempdir();
+  cras_apm_list_init(dir);
+  cras_iodev_is_aec_use_case_ret = 1;
+  webrtc_apm_create_called = 0;
+  webrtc_apm_destroy_called = 0;
+
+  list = cras_apm_list_create(stream_ptr, APM_ECHO_CANCELLATION);
+  apm = cras_apm_list_add_apm(list, dev_ptr, &fmt, 1, 0);
+  ASSERT_NE((void*)NULL, apm);
+  cras_apm_list_start_apm(list, dev_ptr);
+
+  buf = float_buffer_create(480, 2);
+  float_buffer_written(buf, 480);
+  cras_apm_list_process(apm, buf, 0);
+  old_apm = webrtc_apm_process_stream_f_val;
+  cras_apm_list_put_processed(apm, 480);
+
+  /* The replacement is built with the new config but not used yet. */
+  cras_apm_list_reload_aec_config();
+  EXPECT_EQ(2, webrtc_apm_create_called);
+  EXPECT_NE((void*)NULL, webrtc_apm_create_aec_ini_val);
+  EXPECT_EQ(0, webrtc_apm_destroy_called);
+
+  /* The next block goes through it, the old one waits for the main
+   * thread. */
+  cras_apm_list_process(apm, buf, 0);
+  EXPECT_NE(old_apm, webrtc_apm_process_stream_f_val);
+  EXPECT_EQ(0, webrtc_apm_destroy_called);
+  cras_apm_list_release_idle(NULL);
+  EXPECT_EQ(1, webrtc_apm_destroy_called);
+  EXPECT_EQ(old_apm, webrtc_apm_destroy_val);
+
+  cras_apm_list_stop_apm(list, dev_ptr);
+  float_buffer_destroy(&buf);
+  cras_apm_list_destroy(list);
+  cras_apm_list_deinit();
+  EXPECT_EQ(2, webrtc_apm_destroy_called);
+  delete_tempdir(dir);
+  free(dir);
+}
+
 extern "C" {
 int cras_iodev_list_set_device_enabled_callback(
     device_enabled_callback_t enabled_cb,
     device_disabled_callback_t disabled_cb,
     void* cb_data) {
   device_enabled_callback_val = enabled_cb;
+  device_disabled_callback_val = disabled_cb;
   return 0;
 }
 struct cras_iodev* cras_iodev_list_get_first_enabled_iodev(
@@ -370,6 +728,7 @@ struct cras_iodev* cras_iodev_list_get_first_enabled_iodev(
 }
 void cras_iodev_set_ext_dsp_module(struct cras_iodev* iodev,
                                    struct ext_dsp_module* ext) {
+  iodev->ext_dsp_module = ext;
   ext_dsp_module_value = ext;
 }
 bool cras_iodev_is_aec_use_case(const struct cras_ionode* node) {
@@ -407,17 +766,19 @@ webrtc_apm webrtc_apm_create(unsigned int num_channels,
   webrtc_apm_create_called++;
   webrtc_apm_create_aec_ini_val = aec_ini;
   webrtc_apm_create_apm_ini_val = apm_ini;
-  return reinterpret_cast<webrtc_apm>(0x11);
+  return reinterpret_cast<webrtc_apm>(0x10 + webrtc_apm_create_called);
 }
 void webrtc_apm_dump_configs(dictionary* aec_ini, dictionary* apm_ini) {}
 void webrtc_apm_destroy(webrtc_apm apm) {
-  return;
+  webrtc_apm_destroy_called++;
+  webrtc_apm_destroy_val = apm;
 }
 int webrtc_apm_process_stream_f(webrtc_apm ptr,
                                 int num_channels,
                                 int rate,
                                 float* const* data) {
   webrtc_apm_process_stream_f_called++;
+  webrtc_apm_process_stream_f_val = ptr;
   return 0;
 }
 
@@ -426,6 +787,8 @@ int webrtc_apm_process_reverse_stream_f(webrtc_apm ptr,
                                         int rate,
                                         float* const* data) {
   webrtc_apm_process_reverse_stream_f_called++;
+  webrtc_apm_process_reverse_stream_f_channels = num_channels;
+  webrtc_apm_process_reverse_stream_f_sample = data[0][0];
   return 0;
 }
 int webrtc_apm_aec_dump(webrtc_apm ptr,
@@ -435,6 +798,26 @@ int webrtc_apm_aec_dump(webrtc_apm ptr,
   return 0;
 }
 
+FILE* aec_dump_writer_open(int fd, size_t ring_bytes) {
+  return NULL;
+}
+
+bool cras_system_get_apm_offload_enabled() {
+  return cras_system_get_apm_offload_enabled_ret;
+}
+int cras_system_get_mic_keep_warm_ms() {
+  return cras_system_get_mic_keep_warm_ms_ret;
+}
+int cras_system_get_rt_priority() {
+  return 12;
+}
+int cras_set_rt_scheduling(int rt_lim) {
+  return -1;
+}
+int cras_set_thread_priority(int priority) {
+  return 0;
+}
+
 }  // extern "C"
 }  // namespace
 
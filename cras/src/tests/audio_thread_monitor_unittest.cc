@@ -12,15 +12,25 @@ extern "C" {
 
 // Function call counters
 static int cras_system_state_add_snapshot_called;
-static int audio_thread_dump_thread_info_called;
+static int audio_thread_dump_snapshot_called;
+static int cras_flight_recorder_record_called;
 
 // Stub data
+static unsigned int dump_num_devs;
+static unsigned int dump_num_streams;
+static uint64_t dump_log_write_pos;
+static struct cras_audio_thread_snapshot* added_snapshot;
 static enum CRAS_MAIN_MESSAGE_TYPE type_set;
 struct cras_audio_thread_event_message message;
 
 void ResetStubData() {
   cras_system_state_add_snapshot_called = 0;
-  audio_thread_dump_thread_info_called = 0;
+  audio_thread_dump_snapshot_called = 0;
+  cras_flight_recorder_record_called = 0;
+  dump_num_devs = 0;
+  dump_num_streams = 0;
+  dump_log_write_pos = 0;
+  last_log_write_pos = 0;
   type_set = (enum CRAS_MAIN_MESSAGE_TYPE)999;
   message.event_type = (enum CRAS_AUDIO_THREAD_EVENT_TYPE)999;
 }
@@ -67,7 +77,41 @@ TEST_F(AudioThreadMonitorTestSuite, DropSamples) {
 TEST_F(AudioThreadMonitorTestSuite, TakeSnapshot) {
   take_snapshot(AUDIO_THREAD_EVENT_DEBUG);
   EXPECT_EQ(cras_system_state_add_snapshot_called, 1);
-  EXPECT_EQ(audio_thread_dump_thread_info_called, 1);
+  EXPECT_EQ(audio_thread_dump_snapshot_called, 1);
+  EXPECT_EQ(cras_flight_recorder_record_called, 1);
+}
+
+TEST_F(AudioThreadMonitorTestSuite, SnapshotHoldsAllStreamsAndNewEvents) {
+  const struct audio_stream_debug_info* streams;
+  const struct audio_thread_event* events;
+
+  dump_num_devs = 1;
+  dump_num_streams = MAX_DEBUG_STREAMS + 3;
+  dump_log_write_pos = 5;
+  take_snapshot(AUDIO_THREAD_EVENT_UNDERRUN);
+  ASSERT_NE((void*)NULL, added_snapshot);
+  // The first dump had no room for all streams, the second one has.
+  EXPECT_EQ(2, audio_thread_dump_snapshot_called);
+  EXPECT_EQ(AUDIO_THREAD_EVENT_UNDERRUN, added_snapshot->event_type);
+  EXPECT_EQ(MAX_DEBUG_STREAMS + 3, added_snapshot->num_streams);
+  streams = cras_audio_thread_snapshot_streams(added_snapshot);
+  EXPECT_EQ(MAX_DEBUG_STREAMS + 2, streams[MAX_DEBUG_STREAMS + 2].stream_id);
+  EXPECT_EQ(5, added_snapshot->num_events);
+  EXPECT_EQ(sizeof(*added_snapshot) + sizeof(struct audio_dev_debug_info) +
+                (MAX_DEBUG_STREAMS + 3) * sizeof(*streams) +
+                5 * sizeof(*events),
+            added_snapshot->size);
+
+  // The next snapshot only holds the events logged since.
+  dump_log_write_pos = 7;
+  take_snapshot(AUDIO_THREAD_EVENT_BUSYLOOP);
+  ASSERT_EQ(2, added_snapshot->num_events);
+  events = cras_audio_thread_snapshot_events(added_snapshot);
+  EXPECT_EQ(5, events[0].data1);
+  EXPECT_EQ(6, events[1].data1);
+
+  free(added_snapshot);
+  added_snapshot = NULL;
 }
 
 TEST_F(AudioThreadMonitorTestSuite, EventHandlerDoubleCall) {
@@ -75,12 +119,12 @@ TEST_F(AudioThreadMonitorTestSuite, EventHandlerDoubleCall) {
   msg.event_type = AUDIO_THREAD_EVENT_DEBUG;
   handle_audio_thread_event_message((struct cras_main_message*)&msg, NULL);
   EXPECT_EQ(cras_system_state_add_snapshot_called, 1);
-  EXPECT_EQ(audio_thread_dump_thread_info_called, 1);
+  EXPECT_EQ(audio_thread_dump_snapshot_called, 1);
 
   // take_snapshot shouldn't be called since the time interval is short
   handle_audio_thread_event_message((struct cras_main_message*)&msg, NULL);
   EXPECT_EQ(cras_system_state_add_snapshot_called, 1);
-  EXPECT_EQ(audio_thread_dump_thread_info_called, 1);
+  EXPECT_EQ(audio_thread_dump_snapshot_called, 1);
 }
 
 TEST_F(AudioThreadMonitorTestSuite, EventHandlerIgnoreInvalidEvent) {
@@ -88,23 +132,42 @@ TEST_F(AudioThreadMonitorTestSuite, EventHandlerIgnoreInvalidEvent) {
   msg.event_type = (enum CRAS_AUDIO_THREAD_EVENT_TYPE)999;
   handle_audio_thread_event_message((struct cras_main_message*)&msg, NULL);
   EXPECT_EQ(cras_system_state_add_snapshot_called, 0);
-  EXPECT_EQ(audio_thread_dump_thread_info_called, 0);
+  EXPECT_EQ(audio_thread_dump_snapshot_called, 0);
 }
 
 extern "C" {
 
+struct audio_thread_event_log* atlog;
+
 void cras_system_state_add_snapshot(
     struct cras_audio_thread_snapshot* snapshot) {
   cras_system_state_add_snapshot_called++;
+  free(added_snapshot);
+  added_snapshot = snapshot;
 }
 
 struct audio_thread* cras_iodev_list_get_audio_thread() {
   return reinterpret_cast<struct audio_thread*>(0xff);
 }
 
-int audio_thread_dump_thread_info(struct audio_thread* thread,
-                                  struct audio_debug_info* info) {
-  audio_thread_dump_thread_info_called++;
+int audio_thread_dump_snapshot(struct audio_thread* thread,
+                               struct audio_thread_snapshot_dump* dump) {
+  audio_thread_dump_snapshot_called++;
+  dump->hdr.num_devs = dump_num_devs;
+  dump->hdr.num_streams = dump_num_streams;
+  dump->hdr.num_events = 0;
+  for (unsigned int i = 0; i < dump->max_streams && i < dump_num_streams; i++)
+    dump->streams[i].stream_id = i;
+  for (uint64_t pos = dump->log_from; pos < dump_log_write_pos; pos++)
+    dump->events[dump->hdr.num_events++].data1 = pos;
+  dump->hdr.log_write_pos = dump_log_write_pos;
+  return 0;
+}
+
+int cras_flight_recorder_record(
+    const struct cras_audio_thread_snapshot* snapshot,
+    const struct audio_thread_event_log* log) {
+  cras_flight_recorder_record_called++;
   return 0;
 }
 
@@ -7,10 +7,14 @@ extern "C" {
 
 #include "cras_audio_area.h"
 #include "metrics_stub.h"
+#include "mix_bus.h"
 }
 
 #include <gtest/gtest.h>
 
+#include <fcntl.h>
+#include <sys/socket.h>
+
 #include <map>
 
 #define MAX_CALLS 10
@@ -37,6 +41,11 @@ static unsigned int cras_iodev_put_output_buffer_nframes;
 static unsigned int cras_iodev_fill_odev_zeros_frames;
 static int dev_stream_playback_frames_ret;
 static int dev_stream_mix_called;
+static int dev_stream_copy_called;
+static int dev_stream_mix_bus_called;
+static unsigned int dev_stream_mix_bus_index;
+static int dev_stream_passthrough_called;
+static int cras_iodev_put_output_bus_called;
 static unsigned int dev_stream_update_next_wake_time_called;
 static unsigned int dev_stream_request_playback_samples_called;
 static unsigned int cras_iodev_prepare_output_before_write_samples_called;
@@ -50,6 +59,15 @@ static struct cras_iodev* cras_iodev_reset_request_iodev;
 static int cras_iodev_get_valid_frames_ret;
 static int cras_iodev_output_underrun_called;
 static int cras_iodev_start_stream_called;
+static bool cras_system_get_sched_deadline_enabled_ret;
+static int cras_set_thread_deadline_called;
+static int cras_set_thread_deadline_ret;
+static uint64_t cras_set_thread_deadline_runtime;
+static uint64_t cras_set_thread_deadline_period;
+static int cras_set_thread_priority_called;
+static uint32_t cras_system_get_audio_thread_uclamp_min_ret;
+static int cras_set_thread_uclamp_min_called;
+static uint32_t cras_set_thread_uclamp_min_val;
 static int cras_device_monitor_reset_device_called;
 static struct cras_iodev* cras_device_monitor_reset_device_iodev;
 static struct cras_iodev* cras_iodev_start_ramp_odev;
@@ -86,6 +104,11 @@ void ResetGlobalStubData() {
   cras_iodev_frames_to_play_in_sleep_called = 0;
   dev_stream_playback_frames_ret = 0;
   dev_stream_mix_called = 0;
+  dev_stream_copy_called = 0;
+  dev_stream_mix_bus_called = 0;
+  dev_stream_mix_bus_index = 0;
+  dev_stream_passthrough_called = 0;
+  cras_iodev_put_output_bus_called = 0;
   dev_stream_request_playback_samples_called = 0;
   dev_stream_update_next_wake_time_called = 0;
   cras_iodev_prepare_output_before_write_samples_called = 0;
@@ -97,6 +120,15 @@ void ResetGlobalStubData() {
   cras_iodev_get_valid_frames_ret = 0;
   cras_iodev_output_underrun_called = 0;
   cras_iodev_start_stream_called = 0;
+  cras_system_get_sched_deadline_enabled_ret = false;
+  cras_set_thread_deadline_called = 0;
+  cras_set_thread_deadline_ret = 0;
+  cras_set_thread_deadline_runtime = 0;
+  cras_set_thread_deadline_period = 0;
+  cras_set_thread_priority_called = 0;
+  cras_system_get_audio_thread_uclamp_min_ret = 0;
+  cras_set_thread_uclamp_min_called = 0;
+  cras_set_thread_uclamp_min_val = 0;
   cras_device_monitor_reset_device_called = 0;
   cras_device_monitor_reset_device_iodev = NULL;
   cras_iodev_start_ramp_odev = NULL;
@@ -395,6 +427,140 @@ TEST_F(StreamDeviceSuite, AddRemoveMultipleOpenDevices) {
   thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev3.info.idx);
 }
 
+TEST_F(StreamDeviceSuite, SchedDeadlineFollowsOpenDevices) {
+  struct cras_iodev odev, idev;
+
+  cras_system_get_sched_deadline_enabled_ret = true;
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&idev, CRAS_STREAM_INPUT);
+  idev.min_cb_level = FIRST_CB_LEVEL / 2;
+
+  // 480 frames at 48kHz, the runtime starts at its minimum.
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(1, cras_set_thread_deadline_called);
+  EXPECT_EQ(10000000, cras_set_thread_deadline_period);
+  EXPECT_EQ(500000, cras_set_thread_deadline_runtime);
+
+  // The shortest period wins, the runtime covers twice the wake cost.
+  thread_->wake_cost_ns = 1000000;
+  thread_add_open_dev(thread_, &idev);
+  EXPECT_EQ(2, cras_set_thread_deadline_called);
+  EXPECT_EQ(5000000, cras_set_thread_deadline_period);
+  EXPECT_EQ(2000000, cras_set_thread_deadline_runtime);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, idev.info.idx);
+  EXPECT_EQ(3, cras_set_thread_deadline_called);
+  EXPECT_EQ(10000000, cras_set_thread_deadline_period);
+
+  // Back to SCHED_RR once no device is open.
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+  EXPECT_EQ(3, cras_set_thread_deadline_called);
+  EXPECT_EQ(1, cras_set_thread_priority_called);
+  EXPECT_EQ(0, thread_->deadline_period_ns);
+}
+
+TEST_F(StreamDeviceSuite, WakeSlackFollowsShortestPeriod) {
+  struct cras_iodev odev, idev;
+
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&idev, CRAS_STREAM_INPUT);
+  EXPECT_EQ(0, next_wake_slack_ns(thread_));
+
+  // A 10ms period is low latency, wakes stay exact.
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(0, next_wake_slack_ns(thread_));
+
+  // An eighth of the 100ms period, then of the longer input's capped.
+  odev.min_cb_level = 4800;
+  EXPECT_EQ(12500000, next_wake_slack_ns(thread_));
+  idev.min_cb_level = 48000;
+  thread_add_open_dev(thread_, &idev);
+  EXPECT_EQ(12500000, next_wake_slack_ns(thread_));
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+  EXPECT_EQ(MAX_WAKE_SLACK_NS, next_wake_slack_ns(thread_));
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, idev.info.idx);
+}
+
+TEST_F(StreamDeviceSuite, LoadShedDegradesLowPriorityFirst) {
+  struct cras_iodev odev;
+  struct cras_rstream rstreams[3];
+  struct dev_stream dev_streams[3];
+  int i, wakes;
+
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  thread_add_open_dev(thread_, &odev);
+  for (i = 0; i < 3; i++) {
+    memset(&rstreams[i], 0, sizeof(rstreams[i]));
+    memset(&dev_streams[i], 0, sizeof(dev_streams[i]));
+    dev_streams[i].stream = &rstreams[i];
+    DL_APPEND(odev.streams, &dev_streams[i]);
+  }
+  rstreams[0].stream_type = CRAS_STREAM_TYPE_VOICE_COMMUNICATION;
+  rstreams[1].stream_type = CRAS_STREAM_TYPE_MULTIMEDIA;
+  rstreams[2].client_type = CRAS_CLIENT_TYPE_TEST;
+
+  // A wake cost of 90% of the 10ms period sheds one class at a time.
+  thread_->wake_cost_ns = 9000000;
+  for (wakes = 1; wakes < LOAD_SHED_WAKES; wakes++)
+    update_load_shed(thread_);
+  EXPECT_EQ(0, dev_streams[2].shed);
+  update_load_shed(thread_);
+  EXPECT_EQ(0, dev_streams[1].shed);
+  EXPECT_EQ(1, dev_streams[2].shed);
+
+  for (wakes = 0; wakes < 4 * LOAD_SHED_WAKES; wakes++)
+    update_load_shed(thread_);
+  EXPECT_EQ(CRAS_STREAM_PRIORITY_MEDIA, thread_->shed_priority);
+  EXPECT_EQ(0, dev_streams[0].shed);
+  EXPECT_EQ(1, dev_streams[1].shed);
+
+  // Restored in reverse once the cost is well below the period.
+  thread_->wake_cost_ns = 1000000;
+  for (wakes = 0; wakes < LOAD_SHED_WAKES; wakes++)
+    update_load_shed(thread_);
+  EXPECT_EQ(0, dev_streams[1].shed);
+  EXPECT_EQ(1, dev_streams[2].shed);
+
+  odev.streams = NULL;
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+}
+
+TEST_F(StreamDeviceSuite, UclampFollowsOpenDevices) {
+  struct cras_iodev odev, idev;
+
+  cras_system_get_audio_thread_uclamp_min_ret = 512;
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&idev, CRAS_STREAM_INPUT);
+
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(1, cras_set_thread_uclamp_min_called);
+  EXPECT_EQ(512, cras_set_thread_uclamp_min_val);
+  thread_add_open_dev(thread_, &idev);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+  EXPECT_EQ(1, cras_set_thread_uclamp_min_called);
+
+  // Dropped with the last open device.
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, idev.info.idx);
+  EXPECT_EQ(2, cras_set_thread_uclamp_min_called);
+  EXPECT_EQ(0, cras_set_thread_uclamp_min_val);
+}
+
+TEST_F(StreamDeviceSuite, SchedDeadlineRefusedFallsBackToRR) {
+  struct cras_iodev odev;
+
+  cras_system_get_sched_deadline_enabled_ret = true;
+  cras_set_thread_deadline_ret = -EBUSY;
+  SetupDevice(&odev, CRAS_STREAM_OUTPUT);
+
+  thread_add_open_dev(thread_, &odev);
+  EXPECT_EQ(1, cras_set_thread_deadline_called);
+  EXPECT_EQ(1, cras_set_thread_priority_called);
+  EXPECT_EQ(0, thread_->deadline_period_ns);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, odev.info.idx);
+}
+
 TEST_F(StreamDeviceSuite, MultipleInputStreamsCopyFirstStreamOffset) {
   struct cras_iodev iodev;
   struct cras_iodev iodev2;
@@ -412,7 +578,7 @@ TEST_F(StreamDeviceSuite, MultipleInputStreamsCopyFirstStreamOffset) {
   thread_add_open_dev(thread_, &iodev);
   thread_add_open_dev(thread_, &iodev2);
 
-  thread_add_stream(thread_, &rstream, iodevs, 2);
+  thread_add_stream(thread_, &rstream, iodevs, 2, NULL);
   EXPECT_NE((void*)NULL, iodev.streams);
   EXPECT_NE((void*)NULL, iodev2.streams);
 
@@ -423,7 +589,7 @@ TEST_F(StreamDeviceSuite, MultipleInputStreamsCopyFirstStreamOffset) {
   cras_rstream_dev_offset_ret[0] = 30;
   cras_rstream_dev_offset_ret[1] = 0;
 
-  thread_add_stream(thread_, &rstream2, iodevs, 2);
+  thread_add_stream(thread_, &rstream2, iodevs, 2, NULL);
   EXPECT_EQ(2, cras_rstream_dev_offset_called);
   EXPECT_EQ(&rstream, cras_rstream_dev_offset_rstream_val[0]);
   EXPECT_EQ(iodev.info.idx, cras_rstream_dev_offset_dev_id_val[0]);
@@ -448,7 +614,7 @@ TEST_F(StreamDeviceSuite, InputStreamsSetInputDeviceWakeTime) {
   struct cras_iodev* iodevs[] = {&iodev};
   struct cras_rstream rstream1, rstream2;
   struct timespec ts_wake_1 = {.tv_sec = 1, .tv_nsec = 500};
-  struct timespec ts_wake_2 = {.tv_sec = 1, .tv_nsec = 1000};
+  struct timespec ts_wake_2 = {.tv_sec = 1, .tv_nsec = 1000500};
   struct open_dev* adev;
 
   SetupDevice(&iodev, CRAS_STREAM_INPUT);
@@ -456,8 +622,8 @@ TEST_F(StreamDeviceSuite, InputStreamsSetInputDeviceWakeTime) {
   SetupRstream(&rstream2, CRAS_STREAM_INPUT);
 
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream1, iodevs, 1);
-  thread_add_stream(thread_, &rstream2, iodevs, 1);
+  thread_add_stream(thread_, &rstream1, iodevs, 1, NULL);
+  thread_add_stream(thread_, &rstream2, iodevs, 1, NULL);
   EXPECT_NE((void*)NULL, iodev.streams);
 
   // Assume device is running.
@@ -485,6 +651,44 @@ TEST_F(StreamDeviceSuite, InputStreamsSetInputDeviceWakeTime) {
   TearDownRstream(&rstream2);
 }
 
+TEST_F(StreamDeviceSuite, InputStreamsCoalesceCloseWakeTimes) {
+  struct cras_iodev iodev;
+  struct cras_iodev* iodevs[] = {&iodev};
+  struct cras_rstream rstream1, rstream2, rstream3;
+  struct timespec ts_wake_1 = {.tv_sec = 1, .tv_nsec = 500};
+  struct timespec ts_wake_2 = {.tv_sec = 1, .tv_nsec = 200500};
+  struct timespec ts_wake_3 = {.tv_sec = 1, .tv_nsec = 900500};
+  struct open_dev* adev;
+
+  SetupDevice(&iodev, CRAS_STREAM_INPUT);
+  SetupRstream(&rstream1, CRAS_STREAM_INPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_INPUT);
+  SetupRstream(&rstream3, CRAS_STREAM_INPUT);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream1, iodevs, 1, NULL);
+  thread_add_stream(thread_, &rstream2, iodevs, 1, NULL);
+  thread_add_stream(thread_, &rstream3, iodevs, 1, NULL);
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+
+  dev_stream_wake_time_val[iodev.streams] = ts_wake_1;
+  dev_stream_wake_time_val[iodev.streams->next] = ts_wake_2;
+  dev_stream_wake_time_val[iodev.streams->next->next] = ts_wake_3;
+
+  dev_io_send_captured_samples(thread_->open_devs[CRAS_STREAM_INPUT]);
+
+  // The second stream wants to wake 200us after the first one so both are
+  // served by one wake at its time, the third one gets a wake of its own.
+  adev = thread_->open_devs[CRAS_STREAM_INPUT];
+  EXPECT_EQ(ts_wake_2.tv_sec, adev->wake_ts.tv_sec);
+  EXPECT_EQ(ts_wake_2.tv_nsec, adev->wake_ts.tv_nsec);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_INPUT, iodev.info.idx);
+  TearDownRstream(&rstream1);
+  TearDownRstream(&rstream2);
+  TearDownRstream(&rstream3);
+}
+
 TEST_F(StreamDeviceSuite, AddOutputStream) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct cras_rstream rstream;
@@ -498,7 +702,7 @@ TEST_F(StreamDeviceSuite, AddOutputStream) {
   shm_header = rstream.shm->header;
 
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream, &piodev, 1);
+  thread_add_stream(thread_, &rstream, &piodev, 1, NULL);
   dev_stream = iodev.streams;
   EXPECT_EQ(dev_stream->stream, &rstream);
   /*
@@ -543,7 +747,7 @@ TEST_F(StreamDeviceSuite, OutputStreamFetchTime) {
   clock_gettime_retspec.tv_nsec = 500;
   cras_iodev_get_valid_frames_ret = 0;
   expect_ts = clock_gettime_retspec;
-  thread_add_stream(thread_, &rstream1, &piodev, 1);
+  thread_add_stream(thread_, &rstream1, &piodev, 1, NULL);
   dev_stream = iodev.streams;
   EXPECT_EQ(dev_stream->stream, &rstream1);
   EXPECT_EQ(init_cb_ts_.tv_sec, expect_ts.tv_sec);
@@ -564,7 +768,7 @@ TEST_F(StreamDeviceSuite, OutputStreamFetchTime) {
   cras_iodev_get_valid_frames_ret = 960;
   rstream1.cb_threshold = 480;
   expect_ts.tv_nsec += 10 * 1000000;
-  thread_add_stream(thread_, &rstream1, &piodev, 1);
+  thread_add_stream(thread_, &rstream1, &piodev, 1, NULL);
   dev_stream = iodev.streams;
   EXPECT_EQ(dev_stream->stream, &rstream1);
   EXPECT_EQ(init_cb_ts_.tv_sec, expect_ts.tv_sec);
@@ -575,7 +779,7 @@ TEST_F(StreamDeviceSuite, OutputStreamFetchTime) {
    * be the earliest next callback time from other streams.
    */
   rstream1.next_cb_ts = expect_ts;
-  thread_add_stream(thread_, &rstream2, &piodev, 1);
+  thread_add_stream(thread_, &rstream2, &piodev, 1, NULL);
   dev_stream = iodev.streams->prev;
   EXPECT_EQ(dev_stream->stream, &rstream2);
   EXPECT_EQ(init_cb_ts_.tv_sec, expect_ts.tv_sec);
@@ -602,10 +806,10 @@ TEST_F(StreamDeviceSuite, AddRemoveMultipleStreamsOnMultipleDevices) {
 
   // Add first device as open and check 2 streams can be added.
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream, &piodev, 1);
+  thread_add_stream(thread_, &rstream, &piodev, 1, NULL);
   dev_stream = iodev.streams;
   EXPECT_EQ(dev_stream->stream, &rstream);
-  thread_add_stream(thread_, &rstream2, &piodev, 1);
+  thread_add_stream(thread_, &rstream2, &piodev, 1, NULL);
   EXPECT_EQ(dev_stream->next->stream, &rstream2);
 
   // Add second device as open and check no streams are copied over.
@@ -618,7 +822,7 @@ TEST_F(StreamDeviceSuite, AddRemoveMultipleStreamsOnMultipleDevices) {
   EXPECT_EQ(dev_stream->next->stream, &rstream2);
 
   // Add a stream to the second dev and check it isn't also added to the first.
-  thread_add_stream(thread_, &rstream3, &piodev2, 1);
+  thread_add_stream(thread_, &rstream3, &piodev2, 1, NULL);
   dev_stream = iodev.streams;
   EXPECT_EQ(dev_stream->stream, &rstream);
   EXPECT_EQ(dev_stream->next->stream, &rstream2);
@@ -656,6 +860,92 @@ TEST_F(StreamDeviceSuite, AddRemoveMultipleStreamsOnMultipleDevices) {
   TearDownRstream(&rstream3);
 }
 
+TEST_F(StreamDeviceSuite, StreamFdRegisteredOncePerStream) {
+  struct cras_iodev iodev, iodev2;
+  struct cras_iodev* iodevs[] = {&iodev, &iodev2};
+  struct cras_rstream rstream;
+  struct thread_stream_fd* sfd;
+  int fds[2];
+  int count;
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupDevice(&iodev2, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  rstream.fd = fds[0];
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_open_dev(thread_, &iodev2);
+  thread_add_stream(thread_, &rstream, iodevs, 2, NULL);
+  sync_stream_fds(thread_);
+  count = 0;
+  DL_FOREACH (thread_->stream_fds, sfd) {
+    EXPECT_EQ(fds[0], sfd->fd);
+    count++;
+  }
+  EXPECT_EQ(1, count);
+
+  // Syncing again with no change doesn't register anything new.
+  sync_stream_fds(thread_);
+  ASSERT_NE((void*)NULL, thread_->stream_fds);
+  EXPECT_EQ(NULL, thread_->stream_fds->next);
+
+  // A reply wakes the epoll set.
+  struct epoll_event ev;
+  EXPECT_EQ(0, epoll_wait(thread_->epoll_fd, &ev, 1, 0));
+  ASSERT_EQ(1, write(fds[1], "x", 1));
+  EXPECT_EQ(1, epoll_wait(thread_->epoll_fd, &ev, 1, 0));
+  EXPECT_EQ(&stream_event_tag, ev.data.ptr);
+
+  thread_disconnect_stream(thread_, &rstream, NULL);
+  sync_stream_fds(thread_);
+  EXPECT_EQ(NULL, thread_->stream_fds);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev2.info.idx);
+  TearDownRstream(&rstream);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST_F(StreamDeviceSuite, StreamFdReusedByNewStream) {
+  struct cras_iodev iodev;
+  struct cras_iodev* iodevs[] = {&iodev};
+  struct cras_rstream rstream, rstream2;
+  struct epoll_event ev;
+  int fds[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, fds));
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  rstream.fd = fds[0];
+  rstream2.fd = fds[0];
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream, iodevs, 1, NULL);
+  sync_stream_fds(thread_);
+
+  // The new stream got the fd number of the removed one, in the same sync.
+  thread_disconnect_stream(thread_, &rstream, NULL);
+  thread_add_stream(thread_, &rstream2, iodevs, 1, NULL);
+  sync_stream_fds(thread_);
+  ASSERT_NE((void*)NULL, thread_->stream_fds);
+  EXPECT_EQ(&rstream2, thread_->stream_fds->stream);
+  EXPECT_EQ(NULL, thread_->stream_fds->next);
+
+  // Its replies still wake the thread.
+  ASSERT_EQ(1, write(fds[1], "x", 1));
+  EXPECT_EQ(1, epoll_wait(thread_->epoll_fd, &ev, 1, 0));
+
+  thread_disconnect_stream(thread_, &rstream2, NULL);
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream);
+  TearDownRstream(&rstream2);
+  close(fds[0]);
+  close(fds[1]);
+}
+
 TEST_F(StreamDeviceSuite, FetchStreams) {
   struct cras_iodev iodev, *piodev = &iodev;
   struct open_dev* adev;
@@ -672,7 +962,7 @@ TEST_F(StreamDeviceSuite, FetchStreams) {
 
   /* Add the device and add the stream. */
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream, &piodev, 1);
+  thread_add_stream(thread_, &rstream, &piodev, 1, NULL);
 
   adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
 
@@ -830,7 +1120,7 @@ TEST_F(StreamDeviceSuite, MixOutputSamples) {
 
   // Add the device and add the stream.
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream1, &piodev, 1);
+  thread_add_stream(thread_, &rstream1, &piodev, 1, NULL);
   adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
 
   // Assume device is running.
@@ -850,20 +1140,23 @@ TEST_F(StreamDeviceSuite, MixOutputSamples) {
   EXPECT_EQ(1, cras_iodev_get_output_buffer_called);
   EXPECT_EQ(0, dev_stream_mix_called);
 
-  // Set rstream1 to be running. cras_iodev should mix samples from rstream1.
+  // Set rstream1 to be running. cras_iodev should copy samples from rstream1
+  // as it is the only running stream.
   dev_stream_set_running(dev_stream);
   write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
   EXPECT_EQ(2, cras_iodev_prepare_output_before_write_samples_called);
   EXPECT_EQ(2, cras_iodev_get_output_buffer_called);
-  EXPECT_EQ(1, dev_stream_mix_called);
+  EXPECT_EQ(0, dev_stream_mix_called);
+  EXPECT_EQ(1, dev_stream_copy_called);
 
-  // Add rstream2. cras_iodev should mix samples from rstream1 but not from
+  // Add rstream2. cras_iodev should copy samples from rstream1 but not from
   // rstream2.
-  thread_add_stream(thread_, &rstream2, &piodev, 1);
+  thread_add_stream(thread_, &rstream2, &piodev, 1, NULL);
   write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
   EXPECT_EQ(3, cras_iodev_prepare_output_before_write_samples_called);
   EXPECT_EQ(3, cras_iodev_get_output_buffer_called);
-  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(0, dev_stream_mix_called);
+  EXPECT_EQ(2, dev_stream_copy_called);
 
   // Set rstream2 to be running. cras_iodev should mix samples from rstream1
   // and rstream2.
@@ -872,11 +1165,106 @@ TEST_F(StreamDeviceSuite, MixOutputSamples) {
   write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
   EXPECT_EQ(4, cras_iodev_prepare_output_before_write_samples_called);
   EXPECT_EQ(4, cras_iodev_get_output_buffer_called);
-  EXPECT_EQ(4, dev_stream_mix_called);
+  EXPECT_EQ(2, dev_stream_mix_called);
+  EXPECT_EQ(2, dev_stream_copy_called);
+
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream1);
+  TearDownRstream(&rstream2);
+}
+
+TEST_F(StreamDeviceSuite, MixOutputSamplesToMixBus) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream1;
+  struct cras_rstream rstream2;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream1, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  iodev.mix_bus = mix_bus_create(2, 1024);
+
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream1, &piodev, 1, NULL);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  frames_queued_ = 0;
+  dev_stream_playback_frames_ret = 100;
+
+  // A lone stream overwrites the bus.
+  dev_stream_set_running(iodev.streams);
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(1, dev_stream_mix_bus_called);
+  EXPECT_EQ(0, dev_stream_mix_bus_index);
+  EXPECT_EQ(0, dev_stream_copy_called);
+  EXPECT_EQ(0, dev_stream_mix_called);
+  EXPECT_EQ(1, cras_iodev_put_output_bus_called);
+  EXPECT_EQ(0, cras_iodev_put_output_buffer_called);
+
+  // Two running streams are summed in the bus.
+  thread_add_stream(thread_, &rstream2, &piodev, 1, NULL);
+  dev_stream_set_running(iodev.streams->prev);
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(3, dev_stream_mix_bus_called);
+  EXPECT_EQ(1, dev_stream_mix_bus_index);
+  EXPECT_EQ(0, dev_stream_mix_called);
+  EXPECT_EQ(2, cras_iodev_put_output_bus_called);
+  EXPECT_EQ(0, cras_iodev_put_output_buffer_called);
 
   thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
   TearDownRstream(&rstream1);
   TearDownRstream(&rstream2);
+  mix_bus_destroy(&iodev.mix_bus);
+}
+
+TEST_F(StreamDeviceSuite, MixOutputSamplesPassthrough) {
+  struct cras_iodev iodev, *piodev = &iodev;
+  struct cras_rstream rstream1;
+  struct cras_rstream rstream2;
+  struct open_dev* adev;
+
+  ResetGlobalStubData();
+
+  SetupDevice(&iodev, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream1, CRAS_STREAM_OUTPUT);
+  SetupRstream(&rstream2, CRAS_STREAM_OUTPUT);
+  iodev.mix_bus = mix_bus_create(2, 1024);
+
+  cras_iodev_get_output_buffer_area = cras_audio_area_create(2);
+
+  thread_add_open_dev(thread_, &iodev);
+  thread_add_stream(thread_, &rstream1, &piodev, 1, NULL);
+  thread_add_stream(thread_, &rstream2, &piodev, 1, NULL);
+  adev = thread_->open_devs[CRAS_STREAM_OUTPUT];
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_prepare_output_before_write_samples_state =
+      CRAS_IODEV_STATE_NORMAL_RUN;
+  frames_queued_ = 0;
+  dev_stream_playback_frames_ret = 100;
+  dev_stream_set_running(iodev.streams);
+  dev_stream_set_running(iodev.streams->next);
+
+  // The bitstream is copied to the buffer as is, and the held stream is
+  // mixed in as silence without the bus.
+  iodev.passthrough = iodev.streams;
+  write_output_samples(&thread_->open_devs[CRAS_STREAM_OUTPUT], adev, nullptr);
+  EXPECT_EQ(1, dev_stream_passthrough_called);
+  EXPECT_EQ(0, dev_stream_mix_bus_called);
+  EXPECT_EQ(1, dev_stream_mix_called);
+  EXPECT_EQ(0, cras_iodev_put_output_bus_called);
+  EXPECT_EQ(1, cras_iodev_put_output_buffer_called);
+
+  iodev.passthrough = NULL;
+  thread_rm_open_dev(thread_, CRAS_STREAM_OUTPUT, iodev.info.idx);
+  TearDownRstream(&rstream1);
+  TearDownRstream(&rstream2);
+  mix_bus_destroy(&iodev.mix_bus);
 }
 
 TEST_F(StreamDeviceSuite, DoPlaybackNoStream) {
@@ -926,7 +1314,7 @@ TEST_F(StreamDeviceSuite, DoPlaybackUnderrun) {
 
   // Add the device and add the stream.
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream, &piodev, 1);
+  thread_add_stream(thread_, &rstream, &piodev, 1, NULL);
 
   // Assume device is running and there is an underrun.
   // It wrote 11 frames into device but new hw_level is only 10.
@@ -962,7 +1350,7 @@ TEST_F(StreamDeviceSuite, DoPlaybackSevereUnderrun) {
 
   // Add the device and add the stream.
   thread_add_open_dev(thread_, &iodev);
-  thread_add_stream(thread_, &rstream, &piodev, 1);
+  thread_add_stream(thread_, &rstream, &piodev, 1, NULL);
 
   // Assume device is running and there is a severe underrun.
   cras_audio_thread_event_severe_underrun_called = 0;
@@ -1007,29 +1395,154 @@ TEST(AudioThreadStreams, DrainStream) {
   TearDownRstream(&rstream);
 }
 
+TEST(AudioThreadMessages, SyncRespondsAsyncDoesNot) {
+  struct audio_thread* thread = audio_thread_create();
+  struct audio_thread_rm_callback_msg msg;
+  int rsp;
+
+  ASSERT_NE((void*)NULL, thread);
+  fcntl(thread->to_main_fds[0], F_SETFL, O_NONBLOCK);
+
+  // An async command is handled without a response.
+  EXPECT_EQ(0, audio_thread_set_aec_dump(thread, 1, 0, -1));
+  handle_audio_thread_messages(thread);
+  EXPECT_EQ(NULL, cmd_ring_front(thread->cmd_ring));
+  EXPECT_EQ(-1, read(thread->to_main_fds[0], &rsp, sizeof(rsp)));
+
+  // Queued commands are all handled in order on one wake.
+  memset(&msg, 0, sizeof(msg));
+  msg.header.id = AUDIO_THREAD_REMOVE_CALLBACK;
+  msg.header.length = sizeof(msg);
+  EXPECT_EQ(0, audio_thread_queue_message(thread, &msg.header));
+  msg.header.id = AUDIO_THREAD_AEC_DUMP;
+  msg.header.async = 1;
+  EXPECT_EQ(0, audio_thread_queue_message(thread, &msg.header));
+  msg.header.id = (enum AUDIO_THREAD_COMMAND)-1;
+  msg.header.async = 0;
+  EXPECT_EQ(0, audio_thread_queue_message(thread, &msg.header));
+  handle_audio_thread_messages(thread);
+  EXPECT_EQ(NULL, cmd_ring_front(thread->cmd_ring));
+  ASSERT_EQ(sizeof(rsp), read(thread->to_main_fds[0], &rsp, sizeof(rsp)));
+  EXPECT_EQ(0, rsp);
+  ASSERT_EQ(sizeof(rsp), read(thread->to_main_fds[0], &rsp, sizeof(rsp)));
+  EXPECT_EQ(-EINVAL, rsp);
+  EXPECT_EQ(-1, read(thread->to_main_fds[0], &rsp, sizeof(rsp)));
+
+  audio_thread_destroy(thread);
+}
+
+static int NopCallback(void* data, int revents) {
+  return 0;
+}
+
+TEST(AudioThreadCallbacks, MainThreadCallsGoToSelectedThread) {
+  struct audio_thread* thread1 = audio_thread_create();
+  struct audio_thread* thread2 = audio_thread_create();
+  int fds[2];
+
+  ASSERT_NE((void*)NULL, thread1);
+  ASSERT_NE((void*)NULL, thread2);
+  ASSERT_EQ(0, pipe(fds));
+
+  // Callbacks go to the first thread by default.
+  audio_thread_add_events_callback(fds[0], NopCallback, NULL, POLLIN);
+  ASSERT_NE((void*)NULL, thread1->iodev_callbacks);
+  EXPECT_EQ(NULL, thread2->iodev_callbacks);
+  EXPECT_EQ(1, thread1->iodev_callbacks->in_epoll);
+  audio_thread_rm_callback(fds[0]);
+  EXPECT_EQ(NULL, thread1->iodev_callbacks);
+
+  audio_thread_set_main_callback_thread(thread2);
+  audio_thread_add_events_callback(fds[0], NopCallback, NULL, POLLIN);
+  EXPECT_EQ(NULL, thread1->iodev_callbacks);
+  ASSERT_NE((void*)NULL, thread2->iodev_callbacks);
+  audio_thread_config_events_callback(fds[0], TRIGGER_NONE);
+  EXPECT_EQ(0, thread2->iodev_callbacks->in_epoll);
+  audio_thread_rm_callback(fds[0]);
+  EXPECT_EQ(NULL, thread2->iodev_callbacks);
+
+  audio_thread_set_main_callback_thread(thread1);
+  audio_thread_destroy(thread2);
+  audio_thread_destroy(thread1);
+  close(fds[0]);
+  close(fds[1]);
+}
+
+TEST(AudioThreadLog, SnapshotOfLargerLogKeepsNewestEvents) {
+  const unsigned int len = AUDIO_THREAD_EVENT_LOG_SIZE * 2 + 3;
+  const unsigned int num_events = len + 100;
+  struct audio_thread_event_log* log =
+      (struct audio_thread_event_log*)calloc(
+          1, audio_thread_event_log_bytes(len));
+  struct audio_thread_event_log* snapshot =
+      (struct audio_thread_event_log*)calloc(1, sizeof(*snapshot));
+  uint64_t pos;
+
+  log->len = len;
+  for (unsigned int i = 0; i < num_events; i++)
+    audio_thread_event_log_data(log, AUDIO_THREAD_WAKE, i, 0, 0);
+
+  audio_thread_event_log_snapshot(snapshot, log);
+  EXPECT_EQ(AUDIO_THREAD_EVENT_LOG_SIZE, snapshot->len);
+  EXPECT_EQ(num_events, snapshot->write_pos);
+  for (pos = num_events - AUDIO_THREAD_EVENT_LOG_SIZE; pos < num_events;
+       pos++)
+    EXPECT_EQ(pos, snapshot->log[pos % AUDIO_THREAD_EVENT_LOG_SIZE].data1);
+
+  free(snapshot);
+  free(log);
+}
+
 TEST(BusyloopDetectSuite, CheckerTest) {
+  struct audio_thread thread = {};
   continuous_zero_sleep_count = 0;
   cras_audio_thread_event_busyloop_called = 0;
   timespec wait_ts;
   wait_ts.tv_sec = 0;
   wait_ts.tv_nsec = 0;
 
-  check_busyloop(&wait_ts);
+  check_busyloop(&thread, &wait_ts);
   EXPECT_EQ(continuous_zero_sleep_count, 1);
   EXPECT_EQ(cras_audio_thread_event_busyloop_called, 0);
-  check_busyloop(&wait_ts);
+  check_busyloop(&thread, &wait_ts);
   EXPECT_EQ(continuous_zero_sleep_count, 2);
   EXPECT_EQ(cras_audio_thread_event_busyloop_called, 1);
-  check_busyloop(&wait_ts);
+  check_busyloop(&thread, &wait_ts);
   EXPECT_EQ(continuous_zero_sleep_count, 3);
   EXPECT_EQ(cras_audio_thread_event_busyloop_called, 1);
 
   wait_ts.tv_sec = 1;
-  check_busyloop(&wait_ts);
+  check_busyloop(&thread, &wait_ts);
   EXPECT_EQ(continuous_zero_sleep_count, 0);
   EXPECT_EQ(cras_audio_thread_event_busyloop_called, 1);
 }
 
+TEST(BusyloopDetectSuite, MitigateResetsDueDevice) {
+  struct audio_thread thread = {};
+  struct cras_iodev iodev = {};
+  struct open_dev adev = {};
+  timespec wait_ts = {0, 0};
+
+  // A zero wake time is always due.
+  adev.dev = &iodev;
+  DL_APPEND(thread.open_devs[CRAS_STREAM_OUTPUT], &adev);
+  continuous_zero_sleep_count = 0;
+  cras_iodev_reset_request_called = 0;
+
+  for (int i = 1; i < BUSYLOOP_MITIGATE_COUNT; i++)
+    check_busyloop(&thread, &wait_ts);
+  EXPECT_EQ(0, cras_iodev_reset_request_called);
+  check_busyloop(&thread, &wait_ts);
+  EXPECT_EQ(1, cras_iodev_reset_request_called);
+  EXPECT_EQ(&iodev, cras_iodev_reset_request_iodev);
+  check_busyloop(&thread, &wait_ts);
+  EXPECT_EQ(1, cras_iodev_reset_request_called);
+
+  wait_ts.tv_sec = 1;
+  check_busyloop(&thread, &wait_ts);
+  EXPECT_EQ(0, continuous_zero_sleep_count);
+}
+
 extern "C" {
 
 int cras_iodev_add_stream(struct cras_iodev* iodev, struct dev_stream* stream) {
@@ -1085,6 +1598,16 @@ struct dev_stream* cras_iodev_rm_stream(struct cras_iodev* iodev,
   return NULL;
 }
 
+struct dev_stream* cras_iodev_find_stream(const struct cras_iodev* iodev,
+                                          cras_stream_id_t stream_id) {
+  struct dev_stream* out;
+  DL_FOREACH (iodev->streams, out) {
+    if (out->stream->stream_id == stream_id)
+      return out;
+  }
+  return NULL;
+}
+
 int cras_iodev_set_format(struct cras_iodev* iodev,
                           const struct cras_audio_format* fmt) {
   return 0;
@@ -1127,6 +1650,15 @@ int cras_iodev_put_output_buffer(struct cras_iodev* iodev,
   return 0;
 }
 
+int cras_iodev_put_output_bus(struct cras_iodev* iodev,
+                              uint8_t* frames,
+                              unsigned int nframes,
+                              int* non_empty,
+                              struct cras_fmt_conv* output_converter) {
+  cras_iodev_put_output_bus_called++;
+  return 0;
+}
+
 int cras_iodev_get_input_buffer(struct cras_iodev* iodev, unsigned* frames) {
   return 0;
 }
@@ -1186,10 +1718,17 @@ unsigned int cras_rstream_dev_offset(const struct cras_rstream* rstream,
 void cras_rstream_record_fetch_interval(struct cras_rstream* rstream,
                                         const struct timespec* now) {}
 
+void cras_rstream_record_reply(struct cras_rstream* rstream,
+                               const struct timespec* now) {}
+
 int cras_rstream_is_pending_reply(const struct cras_rstream* stream) {
   return cras_rstream_is_pending_reply_ret;
 }
 
+int cras_rstream_wake_for_reply(struct cras_rstream* stream) {
+  return 0;
+}
+
 float cras_rstream_get_volume_scaler(struct cras_rstream* rstream) {
   return 1.0f;
 }
@@ -1199,9 +1738,29 @@ int cras_set_rt_scheduling(int rt_lim) {
 }
 
 int cras_set_thread_priority(int priority) {
+  cras_set_thread_priority_called++;
   return 0;
 }
 
+int cras_set_thread_uclamp_min(uint32_t util_min) {
+  cras_set_thread_uclamp_min_called++;
+  cras_set_thread_uclamp_min_val = util_min;
+  return 0;
+}
+
+int cras_set_thread_affinity(uint32_t cpu_mask) {
+  return 0;
+}
+
+int cras_set_thread_deadline(uint64_t runtime_ns,
+                             uint64_t deadline_ns,
+                             uint64_t period_ns) {
+  cras_set_thread_deadline_called++;
+  cras_set_thread_deadline_runtime = runtime_ns;
+  cras_set_thread_deadline_period = period_ns;
+  return cras_set_thread_deadline_ret;
+}
+
 void cras_system_rm_select_fd(int fd) {}
 
 unsigned int dev_stream_capture(struct dev_stream* dev_stream,
@@ -1211,6 +1770,12 @@ unsigned int dev_stream_capture(struct dev_stream* dev_stream,
   return 0;
 }
 
+unsigned int dev_stream_capture_silence(struct dev_stream* dev_stream,
+                                        unsigned int frames,
+                                        float software_gain_scaler) {
+  return 0;
+}
+
 unsigned int dev_stream_capture_avail(const struct dev_stream* dev_stream) {
   return 0;
 }
@@ -1218,6 +1783,10 @@ unsigned int dev_stream_cb_threshold(const struct dev_stream* dev_stream) {
   return 0;
 }
 
+size_t dev_stream_mem_bytes(const struct dev_stream* dev_stream) {
+  return 0;
+}
+
 int dev_stream_capture_update_rstream(struct dev_stream* dev_stream) {
   return 0;
 }
@@ -1239,6 +1808,35 @@ void dev_stream_destroy(struct dev_stream* dev_stream) {
   free(dev_stream);
 }
 
+struct dev_stream* dev_stream_prepare(struct cras_rstream* stream,
+                                      const struct cras_audio_format* dev_fmt) {
+  return NULL;
+}
+
+int dev_stream_attach(struct dev_stream* dev_stream,
+                      unsigned int dev_id,
+                      const struct cras_audio_format* dev_fmt,
+                      void* dev_ptr,
+                      struct timespec* cb_ts,
+                      const struct timespec* sleep_interval_ts) {
+  return -EINVAL;
+}
+
+void dev_stream_discard(struct dev_stream* dev_stream) {
+  free(dev_stream);
+}
+
+void dev_stream_release_kept() {}
+
+void cras_fmt_conv_release_scratch() {}
+
+void cras_dsp_pipeline_release_scratch() {}
+
+void cras_rt_mem_get(uint32_t* locked_bytes, uint32_t* unlocked_bytes) {
+  *locked_bytes = 0;
+  *unlocked_bytes = 0;
+}
+
 int dev_stream_mix(struct dev_stream* dev_stream,
                    const struct cras_audio_format* fmt,
                    uint8_t* dst,
@@ -1247,6 +1845,54 @@ int dev_stream_mix(struct dev_stream* dev_stream,
   return num_to_write;
 }
 
+int dev_stream_copy(struct dev_stream* dev_stream,
+                    const struct cras_audio_format* fmt,
+                    uint8_t* dst,
+                    unsigned int num_to_write) {
+  dev_stream_copy_called++;
+  return num_to_write;
+}
+
+int dev_stream_mix_bus(struct dev_stream* dev_stream,
+                       const struct cras_audio_format* fmt,
+                       struct mix_bus* bus,
+                       unsigned int offset,
+                       unsigned int num_to_write,
+                       unsigned int index) {
+  dev_stream_mix_bus_called++;
+  dev_stream_mix_bus_index = index;
+  return num_to_write;
+}
+
+int dev_stream_passthrough(struct dev_stream* dev_stream,
+                           uint8_t* dst,
+                           unsigned int num_to_write) {
+  dev_stream_passthrough_called++;
+  return num_to_write;
+}
+
+int dev_stream_can_submix(const struct dev_stream* dev_stream) {
+  return 0;
+}
+
+struct dev_stream* const* dev_stream_mix_group(
+    const struct dev_stream* dev_stream,
+    unsigned int* num_streams) {
+  *num_streams = 0;
+  return NULL;
+}
+
+int dev_stream_mix_submix(struct dev_stream* const* streams,
+                          unsigned int num_streams,
+                          const struct cras_audio_format* fmt,
+                          uint8_t* dst,
+                          struct mix_bus* bus,
+                          unsigned int bus_offset,
+                          unsigned int num_to_write,
+                          unsigned int index) {
+  return 0;
+}
+
 int dev_stream_playback_frames(const struct dev_stream* dev_stream) {
   return dev_stream_playback_frames_ret;
 }
@@ -1259,14 +1905,19 @@ int dev_stream_poll_stream_fd(const struct dev_stream* dev_stream) {
   return dev_stream->stream->fd;
 }
 
+int dev_stream_wake_stream_fd(const struct dev_stream* dev_stream) {
+  return dev_stream->stream->fd;
+}
+
 int dev_stream_request_playback_samples(struct dev_stream* dev_stream,
                                         const struct timespec* now) {
   dev_stream_request_playback_samples_called++;
   return 0;
 }
 
-void dev_stream_set_delay(const struct dev_stream* dev_stream,
-                          unsigned int delay_frames) {}
+void dev_stream_set_delay(struct dev_stream* dev_stream,
+                          const struct dev_stream_delay* delay,
+                          const struct timespec* level_ts) {}
 
 void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
                              unsigned int dev_rate,
@@ -1274,6 +1925,16 @@ void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
                              double main_rate_ratio,
                              int coarse_rate_adjust) {}
 
+void dev_stream_set_shed(struct dev_stream* dev_stream, int shed) {
+  dev_stream->shed = shed;
+}
+
+void dev_stream_set_master_rate(struct dev_stream* dev_stream,
+                                unsigned int dev_rate,
+                                double dev_rate_ratio,
+                                double master_rate_ratio,
+                                int coarse_rate_adjust) {}
+
 void dev_stream_update_frames(const struct dev_stream* dev_stream) {}
 
 void dev_stream_update_next_wake_time(struct dev_stream* dev_stream) {
@@ -1283,6 +1944,7 @@ void dev_stream_update_next_wake_time(struct dev_stream* dev_stream) {
 int dev_stream_wake_time(struct dev_stream* dev_stream,
                          unsigned int curr_level,
                          struct timespec* level_tstamp,
+                         double dev_rate_ratio,
                          unsigned int cap_limit,
                          int is_cap_limit_stream,
                          struct timespec* wake_time) {
@@ -1425,6 +2087,28 @@ bool cras_iodev_is_on_internal_card(const struct cras_ionode* node) {
   return 0;
 }
 
+unsigned int cras_system_get_audio_thread_log_size() {
+  return AUDIO_THREAD_EVENT_LOG_SIZE;
+}
+
+void cras_system_state_snapshot_volume() {}
+
+bool cras_system_get_sched_deadline_enabled() {
+  return cras_system_get_sched_deadline_enabled_ret;
+}
+
+uint32_t cras_system_get_audio_thread_cpu_mask() {
+  return 0;
+}
+
+uint32_t cras_system_get_audio_thread_uclamp_min() {
+  return cras_system_get_audio_thread_uclamp_min_ret;
+}
+
+int cras_system_get_rt_priority() {
+  return 12;
+}
+
 //  From librt.
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
   *tp = clock_gettime_retspec;
@@ -1462,6 +2146,16 @@ int cras_audio_thread_event_severe_underrun() {
   return 0;
 }
 
+bool input_data_silence_gated(struct input_data* data,
+                              struct cras_rstream* stream) {
+  return false;
+}
+
+unsigned int input_data_get_processing_delay(struct input_data* data,
+                                             struct cras_rstream* stream) {
+  return 0;
+}
+
 float input_data_get_software_gain_scaler(struct input_data* data,
                                           float idev_sw_gain_scaler,
                                           struct cras_rstream* stream) {
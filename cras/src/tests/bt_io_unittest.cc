@@ -173,6 +173,9 @@ TEST_F(BtIoBasicSuite, CreateBtIo) {
   EXPECT_NE((void*)NULL, bt_iodev);
   EXPECT_EQ(&iodev_, active_profile_dev(bt_iodev));
   EXPECT_EQ(1, cras_iodev_list_add_output_called);
+  // Output fades in, also after a profile switch.
+  EXPECT_EQ(CRAS_IODEV_RAMP_REQUEST_UP_START_PLAYBACK,
+            bt_iodev->initial_ramp_request);
   bt_iodev->open_dev(bt_iodev);
   bt_iodev->format = &fake_fmt;
   bt_iodev->update_supported_formats(bt_iodev);
@@ -401,6 +404,10 @@ void cras_iodev_free_resources(struct cras_iodev* iodev) {
   cras_iodev_free_resources_called++;
 }
 
+struct cras_ramp* cras_ramp_create() {
+  return NULL;
+}
+
 //  From iodev list.
 int cras_iodev_list_add_output(struct cras_iodev* output) {
   cras_iodev_list_add_output_called++;
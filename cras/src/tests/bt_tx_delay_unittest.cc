@@ -0,0 +1,106 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_bt_tx_delay.h"
+}
+
+namespace {
+
+class BtTxDelay : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    memset(&delay_, 0, sizeof(delay_));
+    delay_.enabled = 1;
+  }
+
+  struct cras_bt_tx_delay delay_;
+};
+
+TEST_F(BtTxDelay, CountsFramesInFlight) {
+  cras_bt_tx_delay_sent(&delay_, 128);
+  cras_bt_tx_delay_sent(&delay_, 128);
+  cras_bt_tx_delay_sent(&delay_, 64);
+  EXPECT_EQ(320, cras_bt_tx_delay_frames(&delay_));
+
+  // A completion accounts for the packets before it too.
+  cras_bt_tx_delay_completed(&delay_, 1);
+  EXPECT_EQ(64, cras_bt_tx_delay_frames(&delay_));
+
+  // Reports of packets done or not sent are ignored.
+  cras_bt_tx_delay_completed(&delay_, 0);
+  cras_bt_tx_delay_completed(&delay_, 3);
+  EXPECT_EQ(64, cras_bt_tx_delay_frames(&delay_));
+
+  cras_bt_tx_delay_completed(&delay_, 2);
+  EXPECT_EQ(0, cras_bt_tx_delay_frames(&delay_));
+}
+
+TEST_F(BtTxDelay, IdsWrapAround) {
+  delay_.sent = UINT32_MAX;
+  delay_.completed = UINT32_MAX;
+
+  cras_bt_tx_delay_sent(&delay_, 100);
+  cras_bt_tx_delay_sent(&delay_, 100);
+  EXPECT_EQ(200, cras_bt_tx_delay_frames(&delay_));
+
+  cras_bt_tx_delay_completed(&delay_, UINT32_MAX);
+  EXPECT_EQ(100, cras_bt_tx_delay_frames(&delay_));
+  cras_bt_tx_delay_completed(&delay_, 0);
+  EXPECT_EQ(0, cras_bt_tx_delay_frames(&delay_));
+}
+
+TEST_F(BtTxDelay, LostReportCountsOldestDone) {
+  unsigned int i;
+
+  cras_bt_tx_delay_sent(&delay_, 10);
+  cras_bt_tx_delay_completed(&delay_, 0);
+  for (i = 0; i < CRAS_BT_TX_DELAY_MAX_PACKETS; i++)
+    cras_bt_tx_delay_sent(&delay_, 10);
+  EXPECT_EQ(10 * CRAS_BT_TX_DELAY_MAX_PACKETS,
+            cras_bt_tx_delay_frames(&delay_));
+
+  // No room left, the oldest packet in flight is taken as done.
+  cras_bt_tx_delay_sent(&delay_, 20);
+  EXPECT_EQ(10 * CRAS_BT_TX_DELAY_MAX_PACKETS + 10,
+            cras_bt_tx_delay_frames(&delay_));
+  EXPECT_TRUE(delay_.enabled);
+}
+
+TEST_F(BtTxDelay, DisablesWithoutCompletions) {
+  unsigned int i;
+
+  for (i = 0; i <= CRAS_BT_TX_DELAY_MAX_PACKETS; i++)
+    cras_bt_tx_delay_sent(&delay_, 10);
+  EXPECT_FALSE(delay_.enabled);
+  EXPECT_EQ(0, cras_bt_tx_delay_frames(&delay_));
+
+  cras_bt_tx_delay_sent(&delay_, 10);
+  EXPECT_EQ(0, cras_bt_tx_delay_frames(&delay_));
+}
+
+TEST_F(BtTxDelay, PollEmptyErrorQueue) {
+  int sock[2];
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_DGRAM, 0, sock));
+  EXPECT_EQ(0, cras_bt_tx_delay_poll(&delay_, sock[0]));
+
+  delay_.enabled = 0;
+  EXPECT_EQ(0, cras_bt_tx_delay_poll(&delay_, -1));
+
+  close(sock[0]);
+  close(sock[1]);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -95,6 +95,44 @@ TEST(ByteBuffer, SetUsedSizeReadWrite) {
   byte_buffer_destroy(&b);
 }
 
+TEST(ByteBuffer, MirroredSpansWrap) {
+  struct byte_buffer* b;
+  uint8_t* data;
+  unsigned int data_size, size;
+
+  b = byte_buffer_create_mirrored(100);
+  ASSERT_TRUE(b->mirrored);
+  size = b->max_size;
+  EXPECT_EQ(0, size % 4096);
+  EXPECT_EQ(size, buf_available(b));
+
+  // Its used size follows the mapping.
+  byte_buffer_set_used_size(b, 90);
+  EXPECT_EQ(size, b->used_size);
+
+  buf_increment_write(b, size - 10);
+  buf_increment_read(b, size - 20);
+
+  // What is free and queued is whole across the end.
+  data = buf_write_pointer_size(b, &data_size);
+  EXPECT_EQ(size - 10, data_size);
+  for (unsigned int i = 0; i < 30; i++)
+    data[i] = i;
+  buf_increment_write(b, 30);
+  EXPECT_EQ(20, b->write_idx);
+
+  data = buf_read_pointer_size(b, &data_size);
+  EXPECT_EQ(40, data_size);
+  for (unsigned int i = 0; i < 30; i++)
+    EXPECT_EQ(i, data[10 + i]);
+  // The bytes past the end are the ones at the start.
+  EXPECT_EQ(20, b->bytes[10]);
+  EXPECT_EQ(29, b->bytes[19]);
+
+  byte_buffer_destroy(&b);
+  EXPECT_EQ((void*)NULL, b);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -231,6 +231,15 @@ int cras_send_with_fds(int sockfd,
   return write(sockfd, buf, len);
 }
 
+int cras_send_batch(int sockfd,
+                    const void* const* bufs,
+                    const size_t* lens,
+                    unsigned int num_msgs) {
+  for (unsigned int i = 0; i < num_msgs; i++)
+    write(sockfd, bufs[i], lens[i]);
+  return num_msgs;
+}
+
 key_t cras_sys_state_shm_fd() {
   return 1;
 }
@@ -242,6 +251,11 @@ int stream_list_rm_all_client_streams(struct stream_list* list,
   return 0;
 }
 
+struct cras_rstream* stream_list_find(struct stream_list* list,
+                                      cras_stream_id_t id) {
+  return NULL;
+}
+
 int stream_list_rm(struct stream_list* list, cras_stream_id_t id) {
   stream_list_rm_called++;
   return 0;
@@ -0,0 +1,90 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
+
+extern "C" {
+#include "cmd_ring.h"
+}
+
+namespace {
+
+TEST(CmdRing, PushFrontPop) {
+  struct cmd_ring* ring = cmd_ring_create();
+  unsigned int val = 7;
+
+  ASSERT_NE((void*)NULL, ring);
+  EXPECT_EQ(NULL, cmd_ring_front(ring));
+  EXPECT_EQ(0, cmd_ring_push(ring, &val, sizeof(val)));
+  val = 8;
+  EXPECT_EQ(0, cmd_ring_push(ring, &val, sizeof(val)));
+
+  EXPECT_EQ(7, *(unsigned int*)cmd_ring_front(ring));
+  // Front doesn't consume.
+  EXPECT_EQ(7, *(unsigned int*)cmd_ring_front(ring));
+  cmd_ring_pop(ring);
+  EXPECT_EQ(8, *(unsigned int*)cmd_ring_front(ring));
+  cmd_ring_pop(ring);
+  EXPECT_EQ(NULL, cmd_ring_front(ring));
+  cmd_ring_destroy(ring);
+}
+
+TEST(CmdRing, FullAndOversized) {
+  struct cmd_ring* ring = cmd_ring_create();
+  uint8_t big[CMD_RING_SLOT_SIZE + 1] = {};
+  unsigned int i;
+
+  EXPECT_EQ(-EINVAL, cmd_ring_push(ring, big, sizeof(big)));
+  EXPECT_EQ(0, cmd_ring_push(ring, big, CMD_RING_SLOT_SIZE));
+  for (i = 1; i < CMD_RING_NUM_SLOTS; i++)
+    EXPECT_EQ(0, cmd_ring_push(ring, &i, sizeof(i)));
+  EXPECT_EQ(-EAGAIN, cmd_ring_push(ring, &i, sizeof(i)));
+
+  cmd_ring_pop(ring);
+  EXPECT_EQ(0, cmd_ring_push(ring, &i, sizeof(i)));
+  cmd_ring_destroy(ring);
+}
+
+static const unsigned int kNumCommands = 100000;
+
+static void* Producer(void* arg) {
+  struct cmd_ring* ring = (struct cmd_ring*)arg;
+
+  for (unsigned int i = 0; i < kNumCommands; i++) {
+    while (cmd_ring_push(ring, &i, sizeof(i)) == -EAGAIN)
+      sched_yield();
+  }
+  return NULL;
+}
+
+TEST(CmdRing, TwoThreadsKeepOrder) {
+  struct cmd_ring* ring = cmd_ring_create();
+  pthread_t tid;
+  unsigned int expected = 0;
+  unsigned int* cmd;
+
+  ASSERT_EQ(0, pthread_create(&tid, NULL, Producer, ring));
+  while (expected < kNumCommands) {
+    cmd = (unsigned int*)cmd_ring_front(ring);
+    if (!cmd) {
+      sched_yield();
+      continue;
+    }
+    ASSERT_EQ(expected, *cmd);
+    cmd_ring_pop(ring);
+    expected++;
+  }
+  pthread_join(tid, NULL);
+  EXPECT_EQ(NULL, cmd_ring_front(ring));
+  cmd_ring_destroy(ring);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -2,6 +2,7 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <fcntl.h>
 #include <gtest/gtest.h>
 #include <stdio.h>
 #include <unistd.h>
@@ -40,12 +41,36 @@ static int cras_system_set_capture_mute_called;
 static size_t cras_system_set_capture_mute_locked_value;
 static int cras_system_set_capture_mute_locked_called;
 static int cras_system_state_dump_snapshots_called;
+static int cras_iodev_list_set_loopback_target_called;
+static struct loopback_target cras_iodev_list_set_loopback_target_value;
 static size_t cras_make_fd_nonblocking_called;
+static int cras_sample_cache_add_called;
+static uint32_t cras_sample_cache_add_id;
+static struct cras_audio_format cras_sample_cache_add_format;
+static int cras_sample_cache_add_fd;
+static size_t cras_sample_cache_add_frames;
+static int cras_sample_cache_play_called;
+static uint32_t cras_sample_cache_play_id;
+static uint32_t cras_sample_cache_play_dev_idx;
+static int cras_sample_cache_remove_called;
+static uint32_t cras_sample_cache_remove_id;
+static int server_stream_add_monitor_called;
+static unsigned int server_stream_add_monitor_input;
+static unsigned int server_stream_add_monitor_output;
+static struct cras_audio_format server_stream_add_monitor_format;
+static uint32_t server_stream_add_monitor_effects;
+static float server_stream_add_monitor_gain;
+static int server_stream_rm_monitor_called;
+static int cras_server_resume_client_called;
+static size_t cras_server_resume_client_id;
+static int cras_server_resume_client_return;
 static audio_thread* iodev_get_thread_return;
 static int stream_list_add_stream_return;
 static unsigned int stream_list_add_stream_called;
 static unsigned int stream_list_disconnect_stream_called;
 static unsigned int cras_iodev_list_rm_input_called;
+static int cras_iodev_list_stream_batch_depth;
+static int cras_iodev_list_end_stream_batch_called;
 static unsigned int cras_iodev_list_rm_output_called;
 static struct cras_audio_shm mock_shm;
 static struct cras_rstream mock_rstream;
@@ -60,6 +85,8 @@ static size_t cras_observer_set_ops_called;
 static size_t cras_observer_ops_are_empty_called;
 static struct cras_observer_ops cras_observer_ops_are_empty_empty_ops;
 static size_t cras_observer_remove_called;
+static int cras_send_batch_called;
+static unsigned int cras_send_batch_num_msgs;
 
 void ResetStubData() {
   audio_thread_config_global_remix_called = 0;
@@ -81,13 +108,24 @@ void ResetStubData() {
   cras_system_set_capture_mute_locked_value = 0;
   cras_system_set_capture_mute_locked_called = 0;
   cras_system_state_dump_snapshots_called = 0;
+  cras_iodev_list_set_loopback_target_called = 0;
   cras_make_fd_nonblocking_called = 0;
+  cras_sample_cache_add_called = 0;
+  cras_sample_cache_add_fd = -1;
+  cras_sample_cache_play_called = 0;
+  cras_sample_cache_remove_called = 0;
+  server_stream_add_monitor_called = 0;
+  server_stream_rm_monitor_called = 0;
+  cras_server_resume_client_called = 0;
+  cras_server_resume_client_return = 0;
   iodev_get_thread_return = reinterpret_cast<audio_thread*>(0xad);
   stream_list_add_stream_return = 0;
   stream_list_add_stream_called = 0;
   stream_list_disconnect_stream_called = 0;
   cras_iodev_list_rm_output_called = 0;
   cras_iodev_list_rm_input_called = 0;
+  cras_iodev_list_stream_batch_depth = 0;
+  cras_iodev_list_end_stream_batch_called = 0;
   cras_observer_num_ops_registered = 0;
   cras_observer_register_notify_called = 0;
   cras_observer_add_called = 0;
@@ -101,6 +139,8 @@ void ResetStubData() {
   memset(&cras_observer_ops_are_empty_empty_ops, 0,
          sizeof(cras_observer_ops_are_empty_empty_ops));
   cras_observer_remove_called = 0;
+  cras_send_batch_called = 0;
+  cras_send_batch_num_msgs = 0;
 }
 
 namespace {
@@ -159,6 +199,7 @@ class RClientMessagesSuite : public testing::Test {
     connect_msg_.format.format = SND_PCM_FORMAT_S16_LE;
     connect_msg_.dev_idx = NO_DEVICE;
     connect_msg_.client_shm_size = 0;
+    connect_msg_.preroll_frames = 0;
     btlog = cras_bt_event_log_init();
     main_log = main_thread_event_log_init();
     ResetStubData();
@@ -408,6 +449,119 @@ TEST_F(RClientMessagesSuite, SetCaptureMute) {
   EXPECT_EQ(1, cras_system_set_capture_mute_locked_value);
 }
 
+TEST_F(RClientMessagesSuite, Batch) {
+  uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
+  struct cras_server_batch* batch = (struct cras_server_batch*)buf;
+  struct cras_set_system_volume volume;
+  struct cras_set_system_mute mute;
+  int rc;
+
+  cras_fill_server_batch(batch);
+  cras_fill_set_system_volume(&volume, 66);
+  cras_fill_set_system_mute(&mute, 1);
+  ASSERT_EQ(0, cras_server_batch_append(batch, sizeof(buf), &volume.header));
+  ASSERT_EQ(0, cras_server_batch_append(batch, sizeof(buf), &mute.header));
+
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 NULL, 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_system_set_volume_called);
+  EXPECT_EQ(66, cras_system_set_volume_value);
+  EXPECT_EQ(1, cras_system_set_mute_called);
+  EXPECT_EQ(1, cras_system_set_mute_value);
+
+  // A message running past the end of the batch is rejected.
+  batch->header.length--;
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 NULL, 0);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(2, cras_system_set_volume_called);
+  EXPECT_EQ(1, cras_system_set_mute_called);
+
+  // Batches don't nest.
+  cras_fill_server_batch(batch);
+  memcpy(batch->messages, batch, sizeof(*batch));
+  batch->header.length += sizeof(*batch);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 NULL, 0);
+  EXPECT_EQ(-EINVAL, rc);
+}
+
+TEST_F(RClientMessagesSuite, BatchConnectsStreams) {
+  uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
+  struct cras_server_batch* batch = (struct cras_server_batch*)buf;
+  struct cras_client_stream_connected out_msg;
+  int fds[3] = {100, 101, 102};
+  int rc;
+
+  cras_fill_server_batch(batch);
+  ASSERT_EQ(0,
+            cras_server_batch_append(batch, sizeof(buf), &connect_msg_.header));
+  connect_msg_.stream_id = stream_id_ + 1;
+  ASSERT_EQ(0,
+            cras_server_batch_append(batch, sizeof(buf), &connect_msg_.header));
+
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 fds, 2);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(2, stream_list_add_stream_called);
+  EXPECT_EQ(2, cras_make_fd_nonblocking_called);
+  EXPECT_EQ(1, cras_iodev_list_end_stream_batch_called);
+  EXPECT_EQ(0, cras_iodev_list_stream_batch_depth);
+  for (size_t id = stream_id_; id <= stream_id_ + 1; id++) {
+    rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+    EXPECT_EQ(sizeof(out_msg), rc);
+    EXPECT_EQ(id, out_msg.stream_id);
+    EXPECT_EQ(0, out_msg.err);
+  }
+
+  // Each connect needs its fd.
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 fds, 1);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(3, stream_list_add_stream_called);
+  EXPECT_EQ(0, cras_iodev_list_stream_batch_depth);
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(stream_id_, out_msg.stream_id);
+
+  // And fds without a connect are rejected.
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 fds, 3);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(5, stream_list_add_stream_called);
+  EXPECT_EQ(0, cras_iodev_list_stream_batch_depth);
+}
+
+TEST_F(RClientMessagesSuite, TruncatedConnectClosesFds) {
+  uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
+  struct cras_server_batch* batch = (struct cras_server_batch*)buf;
+  int fds[2];
+  int rc;
+
+  // Shorter than the messages of clients that don't send preroll_frames.
+  connect_msg_.header.length = CRAS_CONNECT_MESSAGE_MIN_LEN - 1;
+
+  ASSERT_EQ(0, pipe(fds));
+  rc = rclient_->ops->handle_message_from_client(rclient_, &connect_msg_.header,
+                                                 &fds[0], 1);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(-1, fcntl(fds[0], F_GETFD));
+  close(fds[1]);
+
+  // Nor is the fd leaked when the connect is in a batch.
+  ASSERT_EQ(0, pipe(fds));
+  cras_fill_server_batch(batch);
+  ASSERT_EQ(0,
+            cras_server_batch_append(batch, sizeof(buf), &connect_msg_.header));
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 &fds[0], 1);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(0, stream_list_add_stream_called);
+  EXPECT_EQ(0, cras_iodev_list_stream_batch_depth);
+  EXPECT_EQ(-1, fcntl(fds[0], F_GETFD));
+  close(fds[1]);
+}
+
 TEST_F(RClientMessagesSuite, DumpSnapshots) {
   struct cras_dump_snapshots msg;
   int rc;
@@ -418,6 +572,163 @@ TEST_F(RClientMessagesSuite, DumpSnapshots) {
   EXPECT_EQ(1, cras_system_state_dump_snapshots_called);
 }
 
+TEST_F(RClientMessagesSuite, SetLoopbackTarget) {
+  struct cras_set_loopback_target msg;
+  int rc;
+
+  cras_fill_set_loopback_target(&msg, LOOPBACK_TARGET_EXCLUDE, 0x1234,
+                                0x12340002);
+  rc =
+      rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_iodev_list_set_loopback_target_called);
+  EXPECT_EQ(LOOPBACK_TARGET_EXCLUDE,
+            cras_iodev_list_set_loopback_target_value.mode);
+  EXPECT_EQ(0x1234, cras_iodev_list_set_loopback_target_value.client_id);
+  EXPECT_EQ(0x12340002, cras_iodev_list_set_loopback_target_value.stream_id);
+
+  // A stream of another client is rejected.
+  cras_fill_set_loopback_target(&msg, LOOPBACK_TARGET_INCLUDE, 0x1234,
+                                0x43210002);
+  rc =
+      rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL, 0);
+  EXPECT_EQ(-EINVAL, rc);
+  EXPECT_EQ(1, cras_iodev_list_set_loopback_target_called);
+}
+
+TEST_F(RClientMessagesSuite, Samples) {
+  uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
+  struct cras_server_batch* batch = (struct cras_server_batch*)buf;
+  struct cras_upload_sample upload;
+  struct cras_play_sample play;
+  struct cras_remove_sample remove;
+  struct cras_audio_format fmt = {SND_PCM_FORMAT_S16_LE, 44100, 2};
+  int fds[2];
+  int rc;
+
+  ASSERT_EQ(0, pipe(fds));
+  close(fds[1]);
+  cras_fill_upload_sample(&upload, 7, &fmt, 441);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &upload.header,
+                                                 &fds[0], 1);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_sample_cache_add_called);
+  EXPECT_EQ(7, cras_sample_cache_add_id);
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, cras_sample_cache_add_format.format);
+  EXPECT_EQ(44100, cras_sample_cache_add_format.frame_rate);
+  EXPECT_EQ(2, cras_sample_cache_add_format.num_channels);
+  EXPECT_EQ(fds[0], cras_sample_cache_add_fd);
+  EXPECT_EQ(441, cras_sample_cache_add_frames);
+  // The server is done with the fd once the samples are cached.
+  EXPECT_EQ(-1, fcntl(fds[0], F_GETFD));
+
+  // An upload without samples is dropped.
+  rc = rclient_->ops->handle_message_from_client(rclient_, &upload.header,
+                                                 NULL, 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_sample_cache_add_called);
+
+  // Uploads in a batch take their fd.
+  ASSERT_EQ(0, pipe(fds));
+  close(fds[1]);
+  cras_fill_server_batch(batch);
+  ASSERT_EQ(0, cras_server_batch_append(batch, sizeof(buf), &upload.header));
+  rc = rclient_->ops->handle_message_from_client(rclient_, &batch->header,
+                                                 &fds[0], 1);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(2, cras_sample_cache_add_called);
+  EXPECT_EQ(fds[0], cras_sample_cache_add_fd);
+
+  cras_fill_play_sample(&play, 7, 3);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &play.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_sample_cache_play_called);
+  EXPECT_EQ(7, cras_sample_cache_play_id);
+  EXPECT_EQ(3, cras_sample_cache_play_dev_idx);
+
+  cras_fill_remove_sample(&remove, 7);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &remove.header,
+                                                 NULL, 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_sample_cache_remove_called);
+  EXPECT_EQ(7, cras_sample_cache_remove_id);
+}
+
+TEST_F(RClientMessagesSuite, MonitorRoute) {
+  struct cras_add_monitor_route add;
+  struct cras_rm_monitor_route rm;
+  struct cras_audio_format fmt = {SND_PCM_FORMAT_S16_LE, 48000, 1};
+  int rc;
+
+  cras_fill_add_monitor_route(&add, 5, 6, &fmt, APM_NOISE_SUPRESSION, 0.5f);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &add.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, server_stream_add_monitor_called);
+  EXPECT_EQ(5, server_stream_add_monitor_input);
+  EXPECT_EQ(6, server_stream_add_monitor_output);
+  EXPECT_EQ(48000, server_stream_add_monitor_format.frame_rate);
+  EXPECT_EQ(1, server_stream_add_monitor_format.num_channels);
+  EXPECT_EQ(APM_NOISE_SUPRESSION, server_stream_add_monitor_effects);
+  EXPECT_EQ(0.5f, server_stream_add_monitor_gain);
+
+  cras_fill_rm_monitor_route(&rm, 5, 6);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &rm.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, server_stream_rm_monitor_called);
+}
+
+TEST_F(RClientMessagesSuite, ResumeClient) {
+  struct cras_resume_client msg;
+  struct cras_client_resumed out_msg;
+  int rc;
+
+  cras_fill_resume_client(&msg, 40);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_server_resume_client_called);
+  EXPECT_EQ(40, cras_server_resume_client_id);
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(CRAS_CLIENT_RESUMED, out_msg.header.id);
+  EXPECT_EQ(40, out_msg.client_id);
+
+  // A refused client keeps the id it has.
+  cras_server_resume_client_return = -EBUSY;
+  cras_fill_resume_client(&msg, 41);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(40, out_msg.client_id);
+}
+
+TEST_F(RClientMessagesSuite, DrainStream) {
+  struct cras_drain_stream_message msg;
+  int rc;
+
+  mock_rstream.notify_drained = 0;
+  cras_fill_drain_stream_message(&msg, stream_id_);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, mock_rstream.notify_drained);
+  EXPECT_EQ(1, stream_list_disconnect_stream_called);
+
+  // Another client's stream is left alone.
+  mock_rstream.notify_drained = 0;
+  cras_fill_drain_stream_message(&msg, 0x20002);
+  rc = rclient_->ops->handle_message_from_client(rclient_, &msg.header, NULL,
+                                                 0);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, mock_rstream.notify_drained);
+  EXPECT_EQ(1, stream_list_disconnect_stream_called);
+}
+
 TEST_F(RClientMessagesSuite, ConfigGlobalRemix) {
   int rc;
   struct cras_config_global_remix msg;
@@ -570,6 +881,41 @@ TEST_F(RClientMessagesSuite, SendOutputVolumeChanged) {
   EXPECT_EQ(msg->volume, volume);
 }
 
+TEST_F(RClientMessagesSuite, HeldRepliesSentTogether) {
+  void* void_client = reinterpret_cast<void*>(rclient_);
+  struct cras_rclient_replies replies;
+  struct cras_client_volume_changed msgs[3];
+  struct cras_client_volume_changed fd_msg;
+  int fd = 5;
+  ssize_t rc;
+
+  replies.num = 0;
+  rclient_->held_replies = &replies;
+  send_output_volume_changed(void_client, 10);
+  send_output_volume_changed(void_client, 20);
+  EXPECT_EQ(0, cras_send_batch_called);
+
+  // A reply with fds goes out at once, after those held before it.
+  cras_fill_client_output_volume_changed(&fd_msg, 30);
+  rclient_send_message_to_client(rclient_, &fd_msg.header, &fd, 1);
+  EXPECT_EQ(1, cras_send_batch_called);
+  EXPECT_EQ(2, cras_send_batch_num_msgs);
+  rc = read(pipe_fds_[0], msgs, sizeof(msgs));
+  ASSERT_EQ((ssize_t)sizeof(msgs), rc);
+  EXPECT_EQ(10, msgs[0].volume);
+  EXPECT_EQ(20, msgs[1].volume);
+  EXPECT_EQ(30, msgs[2].volume);
+
+  send_output_volume_changed(void_client, 40);
+  EXPECT_EQ(0, rclient_send_held_replies(rclient_));
+  EXPECT_EQ(2, cras_send_batch_called);
+  EXPECT_EQ(1, cras_send_batch_num_msgs);
+  rclient_->held_replies = NULL;
+  rc = read(pipe_fds_[0], msgs, sizeof(msgs));
+  ASSERT_EQ((ssize_t)sizeof(msgs[0]), rc);
+  EXPECT_EQ(40, msgs[0].volume);
+}
+
 TEST_F(RClientMessagesSuite, SendOutputMuteChanged) {
   void* void_client = reinterpret_cast<void*>(rclient_);
   char buf[1024];
@@ -715,6 +1061,8 @@ extern "C" {
 struct cras_bt_event_log* btlog;
 struct main_thread_event_log* main_log;
 
+void cras_main_loop_stats_fill(struct main_thread_debug_info* info) {}
+
 struct audio_thread* cras_iodev_list_get_audio_thread() {
   return iodev_get_thread_return;
 }
@@ -765,6 +1113,10 @@ int audio_thread_event_log_shm_fd() {
   return -1;
 }
 
+int cras_observer_ring_event_fd() {
+  return -1;
+}
+
 #ifdef HAVE_WEBRTC_APM
 void cras_apm_list_reload_aec_config() {}
 #endif
@@ -872,6 +1224,15 @@ struct stream_list* cras_iodev_list_get_stream_list() {
   return NULL;
 }
 
+void cras_iodev_list_begin_stream_batch() {
+  cras_iodev_list_stream_batch_depth++;
+}
+
+void cras_iodev_list_end_stream_batch() {
+  cras_iodev_list_stream_batch_depth--;
+  cras_iodev_list_end_stream_batch_called++;
+}
+
 /* Handles sending a command to a test iodev. */
 void cras_iodev_list_test_dev_command(unsigned int iodev_idx,
                                       enum CRAS_TEST_IODEV_CMD command,
@@ -882,6 +1243,69 @@ void cras_iodev_list_configure_global_remix_converter(
     unsigned int num_channels,
     const float* coefficient) {}
 
+void cras_iodev_list_set_loopback_target(const struct loopback_target* target) {
+  cras_iodev_list_set_loopback_target_called++;
+  cras_iodev_list_set_loopback_target_value = *target;
+}
+
+int cras_sample_cache_add(uint32_t id,
+                          const struct cras_audio_format* format,
+                          int fd,
+                          size_t frames) {
+  cras_sample_cache_add_called++;
+  cras_sample_cache_add_id = id;
+  cras_sample_cache_add_format = *format;
+  cras_sample_cache_add_fd = fd;
+  cras_sample_cache_add_frames = frames;
+  return 0;
+}
+
+int cras_sample_cache_remove(uint32_t id) {
+  cras_sample_cache_remove_called++;
+  cras_sample_cache_remove_id = id;
+  return 0;
+}
+
+int cras_sample_cache_play(struct stream_list* stream_list,
+                           uint32_t id,
+                           uint32_t dev_idx) {
+  cras_sample_cache_play_called++;
+  cras_sample_cache_play_id = id;
+  cras_sample_cache_play_dev_idx = dev_idx;
+  return 0;
+}
+
+int server_stream_add_monitor(struct stream_list* stream_list,
+                              unsigned int input_dev_idx,
+                              unsigned int output_dev_idx,
+                              const struct cras_audio_format* format,
+                              uint32_t effects,
+                              float gain) {
+  server_stream_add_monitor_called++;
+  server_stream_add_monitor_input = input_dev_idx;
+  server_stream_add_monitor_output = output_dev_idx;
+  server_stream_add_monitor_format = *format;
+  server_stream_add_monitor_effects = effects;
+  server_stream_add_monitor_gain = gain;
+  return 0;
+}
+
+int server_stream_rm_monitor(struct stream_list* stream_list,
+                             unsigned int input_dev_idx,
+                             unsigned int output_dev_idx) {
+  server_stream_rm_monitor_called++;
+  return 0;
+}
+
+int cras_server_resume_client(struct cras_rclient* rclient, size_t old_id) {
+  cras_server_resume_client_called++;
+  cras_server_resume_client_id = old_id;
+  if (cras_server_resume_client_return)
+    return cras_server_resume_client_return;
+  rclient->id = old_id;
+  return 0;
+}
+
 int stream_list_add(struct stream_list* list,
                     struct cras_rstream_config* config,
                     struct cras_rstream** stream) {
@@ -901,6 +1325,11 @@ int stream_list_add(struct stream_list* list,
   return ret;
 }
 
+struct cras_rstream* stream_list_find(struct stream_list* list,
+                                      cras_stream_id_t id) {
+  return &mock_rstream;
+}
+
 int stream_list_rm(struct stream_list* list, cras_stream_id_t id) {
   stream_list_disconnect_stream_called++;
   return 0;
@@ -919,6 +1348,17 @@ int cras_send_with_fds(int sockfd,
   return write(sockfd, buf, len);
 }
 
+int cras_send_batch(int sockfd,
+                    const void* const* bufs,
+                    const size_t* lens,
+                    unsigned int num_msgs) {
+  cras_send_batch_called++;
+  cras_send_batch_num_msgs = num_msgs;
+  for (unsigned int i = 0; i < num_msgs; i++)
+    write(sockfd, bufs[i], lens[i]);
+  return num_msgs;
+}
+
 char* cras_iodev_list_get_hotword_models(cras_node_id_t node_id) {
   return NULL;
 }
@@ -967,6 +1407,10 @@ struct packet_status_logger* cras_hfp_ag_get_wbs_logger() {
   return NULL;
 }
 
+struct hfp_link_stats* cras_hfp_ag_get_link_stats() {
+  return NULL;
+}
+
 void detect_rtc_stream_pair(struct stream_list* list,
                             struct cras_rstream* stream) {
   return;
@@ -20,6 +20,9 @@ static int pthread_cond_timedwait_called;
 static int pthread_cond_timedwait_retval;
 static int close_called;
 static int sendmsg_called;
+static uint8_t sendmsg_buf[CRAS_SERV_MAX_MSG_SIZE];
+static size_t sendmsg_len;
+static size_t sendmsg_num_fds;
 static void* mmap_return_value;
 static int samples_ready_called;
 static int samples_ready_frames_value;
@@ -63,6 +66,7 @@ class CrasClientTestSuite : public testing::Test {
 
     memset(&client_, 0, sizeof(client_));
     client_.server_fd_state = CRAS_SOCKET_STATE_CONNECTED;
+    client_.stream_index = cras_id_map_create();
     memset(&stream_, 0, sizeof(stream_));
     stream_.id = FIRST_STREAM_ID;
 
@@ -74,6 +78,7 @@ class CrasClientTestSuite : public testing::Test {
   }
 
   virtual void TearDown() {
+    cras_id_map_destroy(client_.stream_index);
     if (stream_.config) {
       free(stream_.config);
       stream_.config = NULL;
@@ -302,6 +307,380 @@ TEST_F(CrasClientTestSuite, AddAndRemoveStream) {
   EXPECT_EQ(NULL, stream_from_id(&client_, stream_id));
 }
 
+TEST_F(CrasClientTestSuite, AddAndRemoveSharedStream) {
+  cras_stream_id_t stream_id;
+  int serv_fds[2];
+
+  struct client_stream* stream_ptr =
+      (struct client_stream*)calloc(1, sizeof(*stream_ptr));
+  stream_ptr->config =
+      (struct cras_stream_params*)malloc(sizeof(*(stream_ptr->config)));
+  memcpy(stream_ptr->config, stream_.config, sizeof(*(stream_.config)));
+  stream_ptr->wake_fds[0] = -1;
+  stream_ptr->wake_fds[1] = -1;
+
+  ASSERT_EQ(0, cras_client_set_shared_audio_threads(&client_, 2));
+  EXPECT_EQ(
+      0, client_thread_add_stream(&client_, stream_ptr, &stream_id, NO_DEVICE));
+  // The shared threads start with the first stream, no thread of its own.
+  EXPECT_EQ(2, pthread_create_called);
+  EXPECT_EQ(0, pthread_cond_timedwait_called);
+  EXPECT_EQ(-1, stream_ptr->wake_fds[0]);
+  ASSERT_NE((void*)NULL, stream_ptr->shared);
+  EXPECT_EQ(1, stream_ptr->shared->num_assigned);
+  EXPECT_EQ(-EBUSY, cras_client_set_shared_audio_threads(&client_, 1));
+
+  ASSERT_EQ(0, pipe(serv_fds));
+  client_.server_fd = serv_fds[1];
+  EXPECT_EQ(0, client_thread_rm_stream(&client_, stream_id));
+  EXPECT_EQ(0, pthread_join_called);
+  EXPECT_EQ(0, client_.shared_threads[0].num_assigned +
+                   client_.shared_threads[1].num_assigned);
+
+  shared_threads_stop(&client_);
+  EXPECT_EQ(2, pthread_join_called);
+  EXPECT_EQ(NULL, client_.shared_threads);
+}
+
+static cras_stream_id_t serviced_ids[4];
+static int num_serviced;
+
+int shared_samples_ready(cras_client* client,
+                         cras_stream_id_t stream_id,
+                         uint8_t* samples,
+                         size_t frames,
+                         const timespec* sample_ts,
+                         void* arg) {
+  serviced_ids[num_serviced++] = stream_id;
+  return frames;
+}
+
+TEST_F(CrasClientTestSuite, SharedThreadServicesByDeadline) {
+  struct shared_aud_thread shared = {};
+  struct client_stream streams[3];
+  struct client_stream* stream_ptrs[3];
+  struct epoll_event events[4];
+  struct audio_message msg = {AUDIO_MESSAGE_DATA_READY, 0, 480};
+  int sock[3][2];
+  unsigned int i;
+
+  shm_writable_frames_ = 480;
+  stream_.direction = CRAS_STREAM_INPUT;
+  stream_.config->buffer_frames = 480;
+  stream_.config->cb_threshold = 480;
+  stream_.config->format.frame_rate = 48000;
+  stream_.config->aud_cb = shared_samples_ready;
+  stream_.config->unified_cb = 0;
+  num_serviced = 0;
+
+  for (i = 0; i < 3; i++) {
+    ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_STREAM, 0, sock[i]));
+    streams[i] = stream_;
+    streams[i].id = i + 1;
+    streams[i].aud_fd = sock[i][0];
+    streams[i].shm = InitShm();
+    streams[i].shm->header->write_offset[0] = 480 * 4;
+    streams[i].shm->header->ts.tv_sec = 3 - i;
+    stream_ptrs[i] = &streams[i];
+  }
+  shared.epoll_fd = -1;
+  shared.streams = stream_ptrs;
+  shared.num_streams = 3;
+  shared.max_streams = 3;
+
+  // Stream 3 isn't ready, stream 2 is due before stream 1.
+  ASSERT_EQ(sizeof(msg), write(sock[0][1], &msg, sizeof(msg)));
+  ASSERT_EQ(sizeof(msg), write(sock[1][1], &msg, sizeof(msg)));
+  events[0].data.ptr = NULL;
+  events[1].data.ptr = &streams[0];
+  events[2].data.ptr = &streams[1];
+  events[3].data.ptr = &streams[2];
+  shared_thread_service_events(&shared, events, 4);
+
+  ASSERT_EQ(2, num_serviced);
+  EXPECT_EQ(2, serviced_ids[0]);
+  EXPECT_EQ(1, serviced_ids[1]);
+  EXPECT_EQ(3, shared.num_streams);
+
+  // A stream closed by the server isn't serviced anymore.
+  shutdown(sock[2][1], SHUT_WR);
+  shared_thread_service_events(&shared, &events[3], 1);
+  EXPECT_EQ(2, num_serviced);
+  EXPECT_EQ(2, shared.num_streams);
+  EXPECT_EQ(-1, shared_thread_find(&shared, &streams[2]));
+
+  for (i = 0; i < 3; i++) {
+    free(streams[i].shm->header);
+    free(streams[i].shm);
+  }
+}
+
+static struct cras_client_completion cb_completion;
+static int completion_cb_called;
+
+void completion_cb(struct cras_client* client,
+                   const struct cras_client_completion* completion,
+                   void* user_arg) {
+  completion_cb_called++;
+  cb_completion = *completion;
+}
+
+TEST_F(CrasClientTestSuite, AsyncCommandCompletions) {
+  struct cras_client_completion completion;
+  struct pollfd pollfd;
+
+  ASSERT_EQ(0, pipe(client_.command_fds));
+  ASSERT_EQ(0, pipe(client_.command_reply_fds));
+  client_.completion_fd = eventfd(0, EFD_NONBLOCK | EFD_SEMAPHORE);
+  pthread_mutex_init(&client_.completion_lock, NULL);
+  client_.thread.state = CRAS_THREAD_RUNNING;
+
+  // Both are queued without waiting, for a stream that doesn't exist.
+  EXPECT_EQ(0, cras_client_set_stream_volume_async(&client_, 0x99, 0.5, 7));
+  EXPECT_EQ(0, cras_client_rm_stream_async(&client_, 0x99, 8));
+  EXPECT_EQ(-EAGAIN, cras_client_get_completion(&client_, &completion));
+
+  handle_command_message(&client_, POLLIN);
+  handle_command_message(&client_, POLLIN);
+
+  pollfd.fd = client_.completion_fd;
+  pollfd.events = POLLIN;
+  EXPECT_EQ(1, poll(&pollfd, 1, 0));
+  EXPECT_EQ(0, cras_client_get_completion(&client_, &completion));
+  EXPECT_EQ(7, completion.tag);
+  EXPECT_EQ(-EINVAL, completion.result);
+  EXPECT_EQ(0x99, completion.stream_id);
+  EXPECT_EQ(0, cras_client_get_completion(&client_, &completion));
+  EXPECT_EQ(8, completion.tag);
+  EXPECT_EQ(0, completion.result);
+  EXPECT_EQ(0, poll(&pollfd, 1, 0));
+  EXPECT_EQ(-EAGAIN, cras_client_get_completion(&client_, &completion));
+
+  // Nothing was written for a waiting caller.
+  pollfd.fd = client_.command_reply_fds[0];
+  EXPECT_EQ(0, poll(&pollfd, 1, 0));
+
+  // With a callback the completion isn't queued.
+  completion_cb_called = 0;
+  cras_client_set_completion_cb(&client_, completion_cb, NULL);
+  EXPECT_EQ(0, cras_client_set_stream_volume_async(&client_, 0x99, 2.0, 9));
+  handle_command_message(&client_, POLLIN);
+  EXPECT_EQ(1, completion_cb_called);
+  EXPECT_EQ(9, cb_completion.tag);
+  EXPECT_EQ(-EINVAL, cb_completion.result);
+  EXPECT_EQ(-EAGAIN, cras_client_get_completion(&client_, &completion));
+
+  pthread_mutex_destroy(&client_.completion_lock);
+}
+
+TEST_F(CrasClientTestSuite, BatchCoalescesControlMessages) {
+  uint8_t buf[CRAS_SERV_MAX_MSG_SIZE];
+  struct cras_server_batch* batch = (struct cras_server_batch*)buf;
+  struct cras_set_system_volume* volume;
+  struct cras_set_node_attr* attr;
+  struct cras_set_system_mute* mute;
+  int fds[2];
+
+  ASSERT_EQ(0, pipe(fds));
+  fcntl(fds[0], F_SETFL, O_NONBLOCK);
+  client_.server_fd = fds[1];
+  client_.batch = (struct cras_server_batch*)client_.batch_buf;
+  cras_fill_server_batch(client_.batch);
+  pthread_mutex_init(&client_.batch_lock, NULL);
+
+  EXPECT_EQ(0, cras_client_begin_batch(&client_));
+  EXPECT_EQ(0, cras_client_set_system_volume(&client_, 10));
+  EXPECT_EQ(0, cras_client_set_node_volume(&client_, 1, 20));
+  EXPECT_EQ(0, cras_client_set_node_volume(&client_, 2, 30));
+  EXPECT_EQ(0, cras_client_set_system_mute(&client_, 1));
+  EXPECT_EQ(0, cras_client_set_system_volume(&client_, 40));
+  EXPECT_EQ(0, cras_client_set_node_volume(&client_, 1, 50));
+  EXPECT_EQ(-1, read(fds[0], buf, sizeof(buf)));
+
+  EXPECT_EQ(0, cras_client_end_batch(&client_));
+  EXPECT_EQ(-EINVAL, cras_client_end_batch(&client_));
+
+  // Superseded messages are dropped, the rest keep their order.
+  ASSERT_EQ(sizeof(*batch) + 2 * sizeof(*attr) + sizeof(*mute) +
+                sizeof(*volume),
+            read(fds[0], buf, sizeof(buf)));
+  EXPECT_EQ(CRAS_SERVER_BATCH, batch->header.id);
+  attr = (struct cras_set_node_attr*)batch->messages;
+  EXPECT_EQ(CRAS_SERVER_SET_NODE_ATTR, attr->header.id);
+  EXPECT_EQ(2, attr->node_id);
+  EXPECT_EQ(30, attr->value);
+  mute = (struct cras_set_system_mute*)(attr + 1);
+  EXPECT_EQ(CRAS_SERVER_SET_SYSTEM_MUTE, mute->header.id);
+  volume = (struct cras_set_system_volume*)(mute + 1);
+  EXPECT_EQ(CRAS_SERVER_SET_SYSTEM_VOLUME, volume->header.id);
+  EXPECT_EQ(40, volume->volume);
+  attr = (struct cras_set_node_attr*)(volume + 1);
+  EXPECT_EQ(1, attr->node_id);
+  EXPECT_EQ(50, attr->value);
+
+  // A lone message goes without the batch header.
+  EXPECT_EQ(0, cras_client_begin_batch(&client_));
+  EXPECT_EQ(0, cras_client_set_system_volume(&client_, 60));
+  EXPECT_EQ(0, cras_client_end_batch(&client_));
+  ASSERT_EQ(sizeof(*volume), read(fds[0], buf, sizeof(buf)));
+  volume = (struct cras_set_system_volume*)buf;
+  EXPECT_EQ(CRAS_SERVER_SET_SYSTEM_VOLUME, volume->header.id);
+  EXPECT_EQ(60, volume->volume);
+
+  pthread_mutex_destroy(&client_.batch_lock);
+}
+
+TEST_F(CrasClientTestSuite, BatchHoldsStreamConnects) {
+  struct cras_server_batch* batch = (struct cras_server_batch*)sendmsg_buf;
+  struct cras_connect_message connect;
+  struct cras_disconnect_stream_message disconnect;
+  struct cras_connect_message* held_connect;
+  int aud_fds[2];
+
+  ASSERT_EQ(0, pipe(aud_fds));
+  client_.batch = (struct cras_server_batch*)client_.batch_buf;
+  cras_fill_server_batch(client_.batch);
+  pthread_mutex_init(&client_.batch_lock, NULL);
+
+  memset(&connect, 0, sizeof(connect));
+  connect.header.id = CRAS_SERVER_CONNECT_STREAM;
+  connect.header.length = sizeof(connect);
+  connect.stream_id = 0x10002;
+  cras_fill_disconnect_stream_message(&disconnect, 0x10001);
+
+  EXPECT_EQ(0, cras_client_begin_batch(&client_));
+  EXPECT_EQ(0, write_message_with_fds_to_server(&client_, &connect.header,
+                                                &aud_fds[1], 1));
+  EXPECT_EQ(0, write_message_to_server(&client_, &disconnect.header));
+  EXPECT_EQ(0, sendmsg_called);
+  // The batch holds its own copy of the fd.
+  ASSERT_EQ(1, client_.num_batch_fds);
+  EXPECT_NE(aud_fds[1], client_.batch_fds[0]);
+
+  EXPECT_EQ(0, cras_client_end_batch(&client_));
+  EXPECT_EQ(1, sendmsg_called);
+  EXPECT_EQ(1, close_called);
+  EXPECT_EQ(0, client_.num_batch_fds);
+
+  ASSERT_EQ(sizeof(*batch) + sizeof(connect) + sizeof(disconnect),
+            sendmsg_len);
+  EXPECT_EQ(1, sendmsg_num_fds);
+  EXPECT_EQ(CRAS_SERVER_BATCH, batch->header.id);
+  held_connect = (struct cras_connect_message*)batch->messages;
+  EXPECT_EQ(CRAS_SERVER_CONNECT_STREAM, held_connect->header.id);
+  EXPECT_EQ(0x10002, held_connect->stream_id);
+  EXPECT_EQ(CRAS_SERVER_DISCONNECT_STREAM,
+            ((struct cras_server_message*)(held_connect + 1))->id);
+
+  pthread_mutex_destroy(&client_.batch_lock);
+}
+
+TEST(CrasClientTest, GetStateChanges) {
+  struct client_int client_int = {};
+  struct cras_client* client = &client_int.client;
+  struct cras_server_state* state;
+  uint32_t since = 0;
+
+  state = (struct cras_server_state*)calloc(1, sizeof(*state));
+  pthread_rwlock_init(&client_int.server_state_rwlock, NULL);
+  client->server_state = state;
+
+  state->update_count = 4;
+  state->journal[0].update_count = 2;
+  state->journal[0].changes = CRAS_STATE_CHANGE_STREAMS;
+  state->journal[1].update_count = 4;
+  state->journal[1].changes = CRAS_STATE_CHANGE_NODES;
+  state->journal_head = 2;
+
+  // Everything has changed on the first check.
+  EXPECT_EQ(CRAS_STATE_CHANGE_NODES | CRAS_STATE_CHANGE_DEVICES,
+            cras_client_get_state_changes(
+                client, CRAS_STATE_CHANGE_NODES | CRAS_STATE_CHANGE_DEVICES,
+                &since));
+  EXPECT_EQ(4, since);
+  EXPECT_EQ(0, cras_client_get_state_changes(client, CRAS_STATE_CHANGE_ALL,
+                                             &since));
+
+  state->update_count = 8;
+  state->journal[2].update_count = 6;
+  state->journal[2].changes = CRAS_STATE_CHANGE_CLIENTS;
+  state->journal[3].update_count = 8;
+  state->journal[3].changes = CRAS_STATE_CHANGE_STREAMS;
+  state->journal_head = 4;
+  EXPECT_EQ(CRAS_STATE_CHANGE_STREAMS,
+            cras_client_get_state_changes(
+                client, CRAS_STATE_CHANGE_NODES | CRAS_STATE_CHANGE_STREAMS,
+                &since));
+  EXPECT_EQ(8, since);
+
+  // Changes dropped from the journal count as everything changed.
+  for (unsigned i = 0; i < CRAS_STATE_JOURNAL_SIZE; i++) {
+    state->update_count += 2;
+    state->journal[state->journal_head % CRAS_STATE_JOURNAL_SIZE] = {
+        state->update_count, CRAS_STATE_CHANGE_CLIENTS};
+    state->journal_head++;
+  }
+  since = 10;
+  EXPECT_EQ(CRAS_STATE_CHANGE_CLIENTS,
+            cras_client_get_state_changes(client, CRAS_STATE_CHANGE_ALL,
+                                          &since));
+  since = 8;
+  EXPECT_EQ(CRAS_STATE_CHANGE_ALL,
+            cras_client_get_state_changes(client, CRAS_STATE_CHANGE_ALL,
+                                          &since));
+
+  pthread_rwlock_destroy(&client_int.server_state_rwlock);
+  free(state);
+}
+
+TEST(CrasClientTest, ReadObserverEvents) {
+  struct client_int client_int = {};
+  struct cras_client* client = &client_int.client;
+  struct cras_server_state* state;
+  struct cras_observer_event_ring* ring;
+  struct cras_observer_event buf[4];
+  uint64_t read_idx = 0, missing = 0;
+
+  state = (struct cras_server_state*)calloc(1, sizeof(*state));
+  pthread_rwlock_init(&client_int.server_state_rwlock, NULL);
+  client->server_state = state;
+  ring = &state->observer_events;
+
+  EXPECT_EQ(0, cras_client_read_observer_events(client, &read_idx, &missing,
+                                                buf, 4));
+
+  for (int i = 0; i < 6; i++) {
+    ring->events[i].id = CRAS_CLIENT_OUTPUT_VOLUME_CHANGED;
+    ring->events[i].values[0] = i;
+  }
+  ring->write_pos = 6;
+
+  // At most len events per call, oldest first.
+  EXPECT_EQ(4, cras_client_read_observer_events(client, &read_idx, &missing,
+                                                buf, 4));
+  EXPECT_EQ(4, read_idx);
+  EXPECT_EQ(0, missing);
+  EXPECT_EQ(0, buf[0].values[0]);
+  EXPECT_EQ(3, buf[3].values[0]);
+  EXPECT_EQ(2, cras_client_read_observer_events(client, &read_idx, &missing,
+                                                buf, 4));
+  EXPECT_EQ(6, read_idx);
+  EXPECT_EQ(5, buf[1].values[0]);
+
+  // A reader lapped by the ring skips the overwritten events.
+  for (int i = 6; i < CRAS_OBSERVER_EVENT_RING_SIZE + 8; i++)
+    ring->events[i % CRAS_OBSERVER_EVENT_RING_SIZE].values[0] = i;
+  ring->write_pos = CRAS_OBSERVER_EVENT_RING_SIZE + 8;
+  EXPECT_EQ(4, cras_client_read_observer_events(client, &read_idx, &missing,
+                                                buf, 4));
+  EXPECT_EQ(2, missing);
+  EXPECT_EQ(8, buf[0].values[0]);
+  EXPECT_EQ(12, read_idx);
+
+  pthread_rwlock_destroy(&client_int.server_state_rwlock);
+  free(state);
+}
+
 TEST_F(CrasClientTestSuite, SetOutputStreamVolume) {
   cras_stream_id_t stream_id;
 
@@ -378,7 +757,12 @@ int main(int argc, char** argv) {
 extern "C" {
 
 ssize_t sendmsg(int sockfd, const struct msghdr* msg, int flags) {
+  struct cmsghdr* cmsg = CMSG_FIRSTHDR(msg);
+
   ++sendmsg_called;
+  sendmsg_len = MIN(msg->msg_iov->iov_len, sizeof(sendmsg_buf));
+  memcpy(sendmsg_buf, msg->msg_iov->iov_base, sendmsg_len);
+  sendmsg_num_fds = cmsg ? (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int) : 0;
   return msg->msg_iov->iov_len;
 }
 
@@ -6,6 +6,8 @@
 
 #include <gtest/gtest.h>
 
+#include <thread>
+
 #include "cras_config.h"
 #include "cras_dsp_module.h"
 
@@ -43,6 +45,9 @@ struct data {
   int out_audio[MAX_MOCK_PORTS];
   int out_control[MAX_MOCK_PORTS];
   int properties;
+  int identity;
+  int mergeable;
+  int block_size;
 
   int instantiate_called;
   int sample_rate;
@@ -135,6 +140,10 @@ static int get_properties(struct dsp_module* module) {
   data->get_properties_called++;
   return data->properties;
 }
+static int get_block_size(struct dsp_module* module) {
+  struct data* data = (struct data*)module->data;
+  return data->block_size;
+}
 static void dump(struct dsp_module* module, struct dumper* d) {}
 
 static struct dsp_module* create_mock_module(struct plugin* plugin) {
@@ -165,6 +174,10 @@ static struct dsp_module* create_mock_module(struct plugin* plugin) {
   } else {
     data->properties = 0;
   }
+  data->identity = strcmp(plugin->label, "identity") == 0;
+  data->mergeable = strcmp(plugin->label, "mergeable") == 0;
+  /* A label "blockN" asks for blocks of N samples. */
+  sscanf(plugin->label, "block%d", &data->block_size);
 
   module = (struct dsp_module*)calloc(1, sizeof(struct dsp_module));
   module->data = data;
@@ -175,12 +188,14 @@ static struct dsp_module* create_mock_module(struct plugin* plugin) {
   module->deinstantiate = &deinstantiate;
   module->free_module = &free_module;
   module->get_properties = &get_properties;
+  module->get_block_size = &get_block_size;
   module->dump = &dump;
   return module;
 }
 
 static struct dsp_module* modules[MAX_MODULES];
 static struct dsp_module* cras_dsp_module_set_sink_ext_module_val;
+static int cras_dsp_module_merge_called;
 static int num_modules;
 static struct dsp_module* find_module(const char* name) {
   for (int i = 0; i < num_modules; i++) {
@@ -204,6 +219,24 @@ void cras_dsp_module_set_sink_ext_module(struct dsp_module* module,
                                          struct ext_dsp_module* ext_module) {
   cras_dsp_module_set_sink_ext_module_val = module;
 }
+int cras_dsp_module_is_identity(struct dsp_module* module) {
+  struct data* data = (struct data*)module->data;
+
+  /* An identity stops being one when its first input control is set. */
+  for (int i = 0; i < data->nr_in_control; i++) {
+    float* value = data->data_location[data->in_control[i]];
+    if (value && *value != 0)
+      return 0;
+  }
+  return data->identity;
+}
+int cras_dsp_module_merge(struct dsp_module* module, struct dsp_module* next) {
+  cras_dsp_module_merge_called++;
+  if (((struct data*)module->data)->mergeable &&
+      ((struct data*)next->data)->mergeable)
+    return 0;
+  return -EINVAL;
+}
 }
 
 namespace {
@@ -212,6 +245,7 @@ class DspPipelineTestSuite : public testing::Test {
  protected:
   virtual void SetUp() {
     num_modules = 0;
+    cras_dsp_module_merge_called = 0;
     strcpy(filename, FILENAME_TEMPLATE);
     int fd = mkstemp(filename);
     fp = fdopen(fd, "w");
@@ -272,6 +306,11 @@ TEST_F(DspPipelineTestSuite, Simple) {
   struct data* d1 = (struct data*)m1->data;
   struct data* d2 = (struct data*)m2->data;
 
+  /* The audio ports are connected on the first use of the buffers. */
+  ASSERT_EQ(0, d1->connect_port_called[0]);
+  ASSERT_EQ(1, d1->connect_port_called[1]);
+  ASSERT_TRUE(cras_dsp_pipeline_get_source_buffer(p, 0));
+
   /* check m1 */
   ASSERT_STREQ("m1", d1->title);
   ASSERT_EQ(3, d1->nr_ports);
@@ -330,6 +369,22 @@ TEST_F(DspPipelineTestSuite, Simple) {
   ASSERT_EQ(3, d2->input[0]);
   ASSERT_EQ(1000, d2->input[1]);
 
+  /* Both instances report the CPU time of the two runs. */
+  struct dumper* dumper = mem_dumper_create();
+  char* dump;
+  int dump_size;
+  cras_dsp_pipeline_dump(dumper, p);
+  mem_dumper_get(dumper, &dump, &dump_size);
+  std::string dump_str(dump, dump_size);
+  size_t pos = dump_str.find("cpu per frame");
+  ASSERT_NE(std::string::npos, pos);
+  EXPECT_NE(std::string::npos, dump_str.find("blocks 2\n", pos));
+  pos = dump_str.find("cpu per frame", pos + 1);
+  ASSERT_NE(std::string::npos, pos);
+  EXPECT_NE(std::string::npos, dump_str.find("blocks 2\n", pos));
+  EXPECT_EQ(std::string::npos, dump_str.find("cpu per frame", pos + 1));
+  mem_dumper_free(dumper);
+
   /* Expect the sink module "m2" is set. */
   cras_dsp_pipeline_set_sink_ext_module(p, &ext_mod);
   struct data* d = (struct data*)cras_dsp_module_set_sink_ext_module_val->data;
@@ -452,6 +507,7 @@ TEST_F(DspPipelineTestSuite, Complex) {
    *                     --(g)-- 6 --(h)--
    */
 
+  ASSERT_TRUE(cras_dsp_pipeline_get_source_buffer(p, 0));
   ASSERT_EQ(d0->data_location[0], d1->data_location[0]);
   ASSERT_EQ(d0->data_location[1], d1->data_location[1]);
   ASSERT_EQ(d1->data_location[2], d2->data_location[0]);
@@ -489,6 +545,7 @@ TEST_F(DspPipelineTestSuite, Complex) {
 
   cras_dsp_pipeline_deinstantiate(p);
   cras_dsp_pipeline_instantiate(p, 44100);
+  ASSERT_TRUE(cras_dsp_pipeline_get_source_buffer(p, 0));
 
   ASSERT_EQ(1, d5->deinstantiate_called);
   ASSERT_EQ(2, d5->instantiate_called);
@@ -510,6 +567,488 @@ TEST_F(DspPipelineTestSuite, Complex) {
   really_free_module(m5);
 }
 
+TEST_F(DspPipelineTestSuite, PlanarAndCrossfade) {
+  /*
+   *   capture:  a0 --(a)-- a1
+   *   playback: b0 --(b0)-- b1 --(b1)-- b2, b1 doubles the samples.
+   */
+  const char* content =
+      "[A0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={a}\n"
+      "[A1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={a}\n"
+      "[B0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={b0}\n"
+      "[B1]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={b0}\n"
+      "output_1={b1}\n"
+      "[B2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* pa = cras_dsp_pipeline_create(ini, &env, "capture");
+  struct pipeline* pb = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(pa);
+  ASSERT_TRUE(pb);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(pa));
+  ASSERT_EQ(0, cras_dsp_pipeline_load(pb));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(pa, 48000));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(pb, 48000));
+  ASSERT_EQ(5, num_modules);
+  struct data* da = (struct data*)find_module("a1")->data;
+  struct data* db = (struct data*)find_module("b2")->data;
+
+  /* Planar input goes to the source as is and comes out interleaved. */
+  float plane[] = {0.5f, -0.5f, 0.25f, 0.0f};
+  float* planes[] = {plane};
+  int16_t out[8];
+  ASSERT_EQ(0, cras_dsp_pipeline_apply_planar(pa, planes, (uint8_t*)out,
+                                              SND_PCM_FORMAT_S16_LE, 4));
+  ASSERT_EQ(1, da->run_called);
+  EXPECT_EQ(16384, out[0]);
+  EXPECT_EQ(-16384, out[1]);
+  EXPECT_EQ(8192, out[2]);
+  EXPECT_EQ(0, out[3]);
+
+  /* Fade from pa to pb over 4 frames, pa only runs during the fade. */
+  float ramp[8];
+  unsigned int fade_pos = 0;
+  for (int i = 0; i < 8; i++)
+    ramp[i] = 0.25f;
+  planes[0] = ramp;
+  ASSERT_EQ(0, cras_dsp_pipeline_apply_crossfade(
+                   pb, pa, planes, (uint8_t*)out, SND_PCM_FORMAT_S16_LE, 8,
+                   &fade_pos, 4));
+  EXPECT_EQ(4, fade_pos);
+  EXPECT_EQ(2, da->run_called);
+  EXPECT_EQ(2, db->run_called);
+  EXPECT_EQ(8192, out[0]);
+  EXPECT_EQ(10240, out[1]);
+  EXPECT_EQ(12288, out[2]);
+  EXPECT_EQ(14336, out[3]);
+  for (int i = 4; i < 8; i++)
+    EXPECT_EQ(16384, out[i]);
+
+  /* Interleaved input, the fade is over so only pb runs. */
+  for (int i = 0; i < 8; i++)
+    out[i] = 1000;
+  ASSERT_EQ(0, cras_dsp_pipeline_apply_crossfade(
+                   pb, pa, NULL, (uint8_t*)out, SND_PCM_FORMAT_S16_LE, 8,
+                   &fade_pos, 4));
+  EXPECT_EQ(2, da->run_called);
+  EXPECT_EQ(3, db->run_called);
+  for (int i = 0; i < 8; i++)
+    EXPECT_EQ(2000, out[i]);
+
+  /* A pipeline with an external module attached is not faded from. */
+  cras_dsp_pipeline_set_sink_ext_module(pa, &ext_mod);
+  fade_pos = 0;
+  ASSERT_EQ(0, cras_dsp_pipeline_apply_crossfade(
+                   pb, pa, planes, (uint8_t*)out, SND_PCM_FORMAT_S16_LE, 8,
+                   &fade_pos, 4));
+  EXPECT_EQ(4, fade_pos);
+  EXPECT_EQ(2, da->run_called);
+  for (int i = 0; i < 8; i++)
+    EXPECT_EQ(16384, out[i]);
+
+  cras_dsp_pipeline_free(pa);
+  cras_dsp_pipeline_free(pb);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, BypassAndMerge) {
+  /*
+   *   b0 --(b0)-- b1 --(b1)-- b2 --(b2)-- b3 --(b3)-- b4
+   *
+   * b1 is an identity and b3 can be merged into b2.
+   */
+  const char* content =
+      "[B0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={b0}\n"
+      "[B1]\n"
+      "library=builtin\n"
+      "label=identity\n"
+      "input_0={b0}\n"
+      "output_1={b1}\n"
+      "[B2]\n"
+      "library=builtin\n"
+      "label=mergeable\n"
+      "input_0={b1}\n"
+      "output_1={b2}\n"
+      "[B3]\n"
+      "library=builtin\n"
+      "label=mergeable\n"
+      "input_0={b2}\n"
+      "output_1={b3}\n"
+      "[B4]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b3}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+  ASSERT_EQ(5, num_modules);
+  EXPECT_EQ(1, cras_dsp_module_merge_called);
+
+  /* Only b2 runs, and doubles the samples once. */
+  int16_t buf[4] = {1000, 2000, -1000, 0};
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(p, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 4));
+  EXPECT_EQ(0, ((struct data*)find_module("b1")->data)->run_called);
+  EXPECT_EQ(1, ((struct data*)find_module("b2")->data)->run_called);
+  EXPECT_EQ(0, ((struct data*)find_module("b3")->data)->run_called);
+  EXPECT_EQ(1, ((struct data*)find_module("b4")->data)->run_called);
+  EXPECT_EQ(2000, buf[0]);
+  EXPECT_EQ(4000, buf[1]);
+  EXPECT_EQ(-2000, buf[2]);
+  EXPECT_EQ(0, buf[3]);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, SetControl) {
+  /*
+   *   b0 --(b0)-- b1 --(b1)-- b2
+   *
+   * b1 is an identity until its control on port 2 is set.
+   */
+  const char* content =
+      "[B0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={b0}\n"
+      "[B1]\n"
+      "library=builtin\n"
+      "label=identity\n"
+      "input_0={b0}\n"
+      "output_1={b1}\n"
+      "input_2=0\n"
+      "[B2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b1}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p, 48000));
+  ASSERT_EQ(3, num_modules);
+  struct data* d1 = (struct data*)find_module("b1")->data;
+
+  int16_t buf[2] = {1000, -1000};
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(p, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 2));
+  EXPECT_EQ(0, d1->run_called);
+  EXPECT_EQ(1000, buf[0]);
+
+  EXPECT_EQ(-ENOENT, cras_dsp_pipeline_set_control(p, "b9", 2, 1));
+  EXPECT_EQ(-ENOENT, cras_dsp_pipeline_set_control(p, "b1", 0, 1));
+  EXPECT_EQ(0, cras_dsp_pipeline_set_control(p, "B1", 2, 1));
+  EXPECT_EQ(1, *d1->data_location[2]);
+
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(p, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 2));
+  EXPECT_EQ(1, d1->run_called);
+  EXPECT_EQ(1.0f, d1->input[2]);
+  EXPECT_EQ(2000, buf[0]);
+  EXPECT_EQ(-2000, buf[1]);
+
+  cras_dsp_pipeline_free(p);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, PipelinesShareThreadScratch) {
+  const char* content =
+      "[A0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={a}\n"
+      "[A1]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={a}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* p1 = cras_dsp_pipeline_create(ini, &env, "playback");
+  struct pipeline* p2 = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(p1);
+  ASSERT_TRUE(p2);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p1));
+  ASSERT_EQ(0, cras_dsp_pipeline_load(p2));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p1, 48000));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(p2, 48000));
+
+  float* buf = cras_dsp_pipeline_get_source_buffer(p1, 0);
+  ASSERT_TRUE(buf);
+  EXPECT_EQ(buf, cras_dsp_pipeline_get_source_buffer(p2, 0));
+  EXPECT_EQ(buf, cras_dsp_pipeline_get_sink_buffer(p2, 0));
+
+  /* On another thread the pipeline connects to the scratch of that thread,
+   * and back to this one when it runs here again. */
+  float* other = NULL;
+  std::thread t([&] {
+    other = cras_dsp_pipeline_get_source_buffer(p1, 0);
+    cras_dsp_pipeline_release_scratch();
+  });
+  t.join();
+  EXPECT_TRUE(other);
+  EXPECT_NE(buf, other);
+  struct data* d = (struct data*)find_module("a1")->data;
+  EXPECT_EQ(other, d->data_location[0]);
+  EXPECT_EQ(buf, cras_dsp_pipeline_get_source_buffer(p1, 0));
+  EXPECT_EQ(buf, d->data_location[0]);
+
+  cras_dsp_pipeline_release_scratch();
+  cras_dsp_pipeline_free(p1);
+  cras_dsp_pipeline_free(p2);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, ReuseModules) {
+  /*
+   *   b0 --(b0)-- b1 --(b1)-- b2 --(b2)-- b3
+   *
+   * b1 is disabled in the second pipeline, which keeps the module of b2.
+   */
+  const char* content =
+      "[B0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={b0}\n"
+      "[B1]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "disable=disable_foo\n"
+      "input_0={b0}\n"
+      "output_1={b1}\n"
+      "[B2]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={b1}\n"
+      "output_1={b2}\n"
+      "input_2=3\n"
+      "[B3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b2}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_set_variable_boolean(&env, "disable_foo", 0);
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* pa = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(pa);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(pa));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(pa, 48000));
+  ASSERT_EQ(4, num_modules);
+  struct dsp_module* m2 = find_module("b2");
+  struct data* d2 = (struct data*)m2->data;
+
+  int16_t buf[2] = {1000, -1000};
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(pa, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 2));
+  EXPECT_EQ(1, d2->run_called);
+  EXPECT_EQ(4000, buf[0]);
+
+  /* Nothing is kept from a pipeline running at another rate. */
+  cras_expr_env_set_variable_boolean(&env, "disable_foo", 1);
+  struct pipeline* pb = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(pb);
+  EXPECT_EQ(0, cras_dsp_pipeline_reuse_modules(pb, pa, 44100));
+  EXPECT_EQ(1, cras_dsp_pipeline_reuse_modules(pb, pa, 48000));
+  ASSERT_EQ(0, cras_dsp_pipeline_load(pb));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(pb, 48000));
+  /* Only the source and the sink are loaded again. */
+  ASSERT_EQ(6, num_modules);
+  EXPECT_EQ(1, d2->connect_port_called[2]);
+
+  cras_dsp_pipeline_take_modules(pb);
+  EXPECT_EQ(2, d2->connect_port_called[2]);
+  EXPECT_EQ(3.0f, *d2->data_location[2]);
+  cras_dsp_pipeline_free(pa);
+  EXPECT_EQ(0, d2->deinstantiate_called);
+  EXPECT_EQ(0, d2->free_module_called);
+
+  /* The same module runs in the new pipeline, after b0 this time. */
+  buf[0] = 1000;
+  buf[1] = -1000;
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(pb, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 2));
+  EXPECT_EQ(1, d2->instantiate_called);
+  EXPECT_EQ(2, d2->run_called);
+  EXPECT_EQ(2000, buf[0]);
+  EXPECT_EQ(-2000, buf[1]);
+
+  cras_dsp_pipeline_free(pb);
+  EXPECT_EQ(1, d2->deinstantiate_called);
+  EXPECT_EQ(1, d2->free_module_called);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
+TEST_F(DspPipelineTestSuite, FixedBlockSize) {
+  /*
+   *   b0 --(b0)-- b1 --(b1)-- b2 --(b2)-- b3
+   *
+   * b1 runs on blocks of 4 samples, c1 wants another size.
+   */
+  const char* content =
+      "[B0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=playback\n"
+      "output_0={b0}\n"
+      "[B1]\n"
+      "library=builtin\n"
+      "label=block4\n"
+      "input_0={b0}\n"
+      "output_1={b1}\n"
+      "[B2]\n"
+      "library=builtin\n"
+      "label=foo\n"
+      "input_0={b1}\n"
+      "output_1={b2}\n"
+      "[B3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=playback\n"
+      "input_0={b2}\n"
+      "[C0]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={c0}\n"
+      "[C1]\n"
+      "library=builtin\n"
+      "label=block4\n"
+      "input_0={c0}\n"
+      "output_1={c1}\n"
+      "[C2]\n"
+      "library=builtin\n"
+      "label=block8\n"
+      "input_0={c1}\n"
+      "output_1={c2}\n"
+      "[C3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={c2}\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  struct pipeline* pc = cras_dsp_pipeline_create(ini, &env, "capture");
+  ASSERT_TRUE(pc);
+  EXPECT_EQ(-1, cras_dsp_pipeline_load(pc));
+  cras_dsp_pipeline_free(pc);
+
+  struct pipeline* pb = cras_dsp_pipeline_create(ini, &env, "playback");
+  ASSERT_TRUE(pb);
+  ASSERT_EQ(0, cras_dsp_pipeline_load(pb));
+  ASSERT_EQ(0, cras_dsp_pipeline_instantiate(pb, 48000));
+  EXPECT_EQ(4, cras_dsp_pipeline_get_block_size(pb));
+  EXPECT_EQ(4, cras_dsp_pipeline_get_delay(pb));
+  struct data* d1 = (struct data*)find_module("b1")->data;
+  struct data* d2 = (struct data*)find_module("b2")->data;
+
+  /* Three frames don't make a block, what comes out is the silence the
+   * pipeline starts with. */
+  int16_t buf[10] = {1, 2, 3};
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(pb, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 3));
+  EXPECT_EQ(0, d1->run_called);
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(0, buf[i]);
+
+  /* Every run takes a whole block, the output is a block late. */
+  for (int i = 0; i < 10; i++)
+    buf[i] = 4 + i;
+  ASSERT_EQ(0, cras_dsp_pipeline_apply(pb, (uint8_t*)buf,
+                                       SND_PCM_FORMAT_S16_LE, 10));
+  EXPECT_EQ(3, d1->run_called);
+  EXPECT_EQ(3, d2->run_called);
+  EXPECT_EQ(4, d1->sample_count);
+  EXPECT_EQ(4, d2->sample_count);
+  EXPECT_EQ(0, buf[0]);
+  for (int i = 1; i < 10; i++)
+    EXPECT_EQ(4 * i, buf[i]) << "frame " << i;
+
+  cras_dsp_pipeline_free(pb);
+  cras_dsp_ini_free(ini);
+  cras_expr_env_free(&env);
+
+  for (int i = 0; i < num_modules; i++)
+    really_free_module(modules[i]);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
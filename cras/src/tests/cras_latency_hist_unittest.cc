@@ -0,0 +1,71 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+extern "C" {
+#include "cras_latency_hist.h"
+}
+
+namespace {
+
+TEST(LatencyHist, BucketsAreContiguous) {
+  unsigned int idx;
+
+  EXPECT_EQ(0, cras_latency_hist_bucket(0));
+  EXPECT_EQ(3, cras_latency_hist_bucket(3));
+  for (idx = 0; idx < CRAS_LATENCY_HIST_BUCKETS; idx++) {
+    uint32_t start = cras_latency_hist_bucket_start(idx);
+
+    EXPECT_EQ(idx, cras_latency_hist_bucket(start));
+    if (idx) {
+      EXPECT_EQ(idx - 1, cras_latency_hist_bucket(start - 1));
+    }
+  }
+  EXPECT_EQ(CRAS_LATENCY_HIST_BUCKETS - 1,
+            cras_latency_hist_bucket(UINT32_MAX));
+}
+
+TEST(LatencyHist, BucketWidthIsBounded) {
+  unsigned int idx;
+
+  for (idx = 4; idx < CRAS_LATENCY_HIST_BUCKETS - 1; idx++) {
+    uint32_t start = cras_latency_hist_bucket_start(idx);
+    uint32_t end = cras_latency_hist_bucket_start(idx + 1);
+
+    EXPECT_LE((end - start) * 4, start);
+  }
+}
+
+TEST(LatencyHist, Percentiles) {
+  struct cras_latency_hist hist;
+  struct timespec start = {1, 999999000};
+  struct timespec end = {2, 1000};
+  unsigned int i;
+
+  memset(&hist, 0, sizeof(hist));
+  EXPECT_EQ(0, cras_latency_hist_percentile(&hist, 99));
+
+  for (i = 0; i < 98; i++)
+    cras_latency_hist_add_usec(&hist, 100);
+  cras_latency_hist_add_usec(&hist, 1000);
+  // Crosses a second boundary, 2 usec.
+  cras_latency_hist_add(&hist, &start, &end);
+
+  EXPECT_EQ(100, cras_latency_hist_count(&hist));
+  EXPECT_EQ(1000, hist.max_usec);
+  EXPECT_EQ(1, hist.counts[cras_latency_hist_bucket(2)]);
+  EXPECT_LE(100, cras_latency_hist_percentile(&hist, 50));
+  EXPECT_GT(125, cras_latency_hist_percentile(&hist, 50));
+  EXPECT_LE(1000, cras_latency_hist_percentile(&hist, 99.5));
+  EXPECT_EQ(1000, cras_latency_hist_percentile(&hist, 100));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -5,6 +5,8 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <vector>
+
 extern "C" {
 #include "cras_tm.h"
 #include "cras_types.h"
@@ -180,6 +182,55 @@ TEST_F(TimerTestSuite, AddTwoTimers) {
   cras_tm_cancel_timer(tm_, t1);
 }
 
+static std::vector<uintptr_t> fired;
+static struct cras_timer* cancel_in_cb;
+static struct cras_tm* cb_tm;
+
+void order_cb(struct cras_timer* t, void* data) {
+  fired.push_back((uintptr_t)data);
+  if (cancel_in_cb) {
+    cras_tm_cancel_timer(cb_tm, cancel_in_cb);
+    cancel_in_cb = NULL;
+  }
+}
+
+TEST_F(TimerTestSuite, ManyTimersFireInOrder) {
+  struct cras_timer* timers[100];
+  struct timespec ts;
+
+  fired.clear();
+  cancel_in_cb = NULL;
+  cb_tm = tm_;
+  time_now.tv_sec = 0;
+  time_now.tv_nsec = 0;
+  // Deadlines 0..49 ms, each twice, created out of order.
+  for (uintptr_t i = 0; i < 100; i++) {
+    timers[i] = cras_tm_create_timer(tm_, (i * 37) % 50, order_cb, (void*)i);
+    ASSERT_TRUE(timers[i]);
+  }
+
+  // Cancel timer 10, due at 20ms, now and timer 77, due at 49ms, from the
+  // first callback of the second pass.
+  cras_tm_cancel_timer(tm_, timers[10]);
+  time_now.tv_nsec = 19 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  ASSERT_EQ(40, fired.size());
+  ASSERT_EQ(1, cras_tm_get_next_timeout(tm_, &ts));
+  EXPECT_EQ(1000000, ts.tv_nsec);
+  cancel_in_cb = timers[77];
+
+  time_now.tv_nsec = 49 * 1000000;
+  cras_tm_call_callbacks(tm_);
+  EXPECT_EQ(98, fired.size());
+  EXPECT_EQ(0, cras_tm_get_next_timeout(tm_, &ts));
+
+  for (size_t i = 1; i < fired.size(); i++) {
+    unsigned int prev = (fired[i - 1] * 37) % 50, cur = (fired[i] * 37) % 50;
+    // Sorted by deadline, creation order among equal ones.
+    EXPECT_TRUE(prev < cur || (prev == cur && fired[i - 1] < fired[i]));
+  }
+}
+
 /* Stubs */
 extern "C" {
 
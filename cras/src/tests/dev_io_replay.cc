@@ -0,0 +1,257 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <stdio.h>
+
+#include <algorithm>
+
+extern "C" {
+#include "cras_flight_recorder.h"
+#include "cras_util.h"
+}
+
+#include "dev_io_replay.h"
+
+// The event log keeps the low 24 bits of the seconds.
+#define EVENT_SEC_MASK 0x00ffffff
+
+namespace {
+
+timespec replay_now;
+
+timespec event_time(const audio_thread_event* ev) {
+  timespec ts;
+  ts.tv_sec = ev->tag_sec & EVENT_SEC_MASK;
+  ts.tv_nsec = ev->nsec;
+  return ts;
+}
+
+bool timespec_before(const timespec* a, const timespec* b) {
+  return a->tv_sec < b->tv_sec ||
+         (a->tv_sec == b->tv_sec && a->tv_nsec < b->tv_nsec);
+}
+
+}  // namespace
+
+extern "C" {
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  *tp = replay_now;
+  return 0;
+}
+}
+
+void replay_clock_set(const timespec* now) {
+  replay_now = *now;
+}
+
+void replay_trace_from_events(const audio_thread_event* events,
+                              size_t num_events,
+                              ReplayTrace* trace) {
+  std::map<unsigned int, timespec> hw_tstamps;
+  std::map<cras_stream_id_t, timespec> fetches;
+
+  for (size_t i = 0; i < num_events; i++) {
+    const audio_thread_event* ev = &events[i];
+    timespec ts = event_time(ev);
+
+    switch (ev->tag_sec >> 24) {
+      case AUDIO_THREAD_FILL_AUDIO_TSTAMP:
+      case AUDIO_THREAD_READ_AUDIO_TSTAMP: {
+        timespec hw_tstamp;
+        hw_tstamp.tv_sec = ev->data2 & EVENT_SEC_MASK;
+        hw_tstamp.tv_nsec = ev->data3;
+        hw_tstamps[ev->data1] = hw_tstamp;
+        break;
+      }
+      case AUDIO_THREAD_FILL_AUDIO:
+      case AUDIO_THREAD_READ_AUDIO: {
+        ReplayLevel level;
+        level.ts = ts;
+        level.dev_idx = ev->data1;
+        level.hw_level = ev->data2;
+        auto tstamp = hw_tstamps.find(ev->data1);
+        if (tstamp != hw_tstamps.end() && timespec_is_nonzero(&tstamp->second))
+          level.hw_tstamp = tstamp->second;
+        else
+          level.hw_tstamp = ts;
+        trace->levels.push_back(level);
+        break;
+      }
+      case AUDIO_THREAD_FETCH_STREAM:
+        fetches[ev->data1] = ts;
+        trace->responses[ev->data1].push_back({0, 0});
+        break;
+      case AUDIO_THREAD_STREAM_FETCH_PENDING: {
+        auto fetch = fetches.find(ev->data1);
+        if (fetch == fetches.end())
+          break;
+        subtract_timespecs(&ts, &fetch->second,
+                           &trace->responses[ev->data1].back());
+        break;
+      }
+      default:
+        break;
+    }
+  }
+}
+
+int replay_trace_from_flight_record(const char* path, ReplayTrace* trace) {
+  cras_flight_record_header hdr;
+  std::vector<audio_thread_event> events;
+  long skip;
+  int rc = 0;
+
+  FILE* f = fopen(path, "rb");
+  if (!f)
+    return -errno;
+  if (fread(&hdr, sizeof(hdr), 1, f) != 1 ||
+      hdr.magic != CRAS_FLIGHT_RECORD_MAGIC ||
+      hdr.version != CRAS_FLIGHT_RECORD_VERSION) {
+    rc = -EINVAL;
+    goto out;
+  }
+  skip = hdr.num_devs * sizeof(audio_dev_debug_info) +
+         hdr.num_streams * sizeof(audio_stream_debug_info);
+  events.resize(hdr.num_events);
+  if (fseek(f, skip, SEEK_CUR) ||
+      fread(events.data(), sizeof(events[0]), events.size(), f) !=
+          events.size()) {
+    rc = -EINVAL;
+    goto out;
+  }
+  replay_trace_from_events(events.data(), events.size(), trace);
+out:
+  fclose(f);
+  return rc;
+}
+
+DevIoReplay::DevIoReplay(CRAS_STREAM_DIRECTION direction,
+                         size_t dev_cb_threshold,
+                         unsigned int rate)
+    : direction_(direction), dev_list_(NULL) {
+  fill_audio_format(&format_, rate);
+  dev_ = create_device(direction, dev_cb_threshold, &format_,
+                       direction == CRAS_STREAM_OUTPUT
+                           ? CRAS_NODE_TYPE_INTERNAL_SPEAKER
+                           : CRAS_NODE_TYPE_MIC);
+  dev_->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  dev_->dev->input_streaming = true;
+  DL_APPEND(dev_list_, dev_->odev.get());
+}
+
+DevIoReplay::~DevIoReplay() {
+  DL_DELETE(dev_list_, dev_->odev.get());
+}
+
+void DevIoReplay::AddStream(cras_stream_id_t id, size_t cb_threshold) {
+  ReplayStream s = {};
+
+  s.stream = create_stream(id, dev_->dev->info.idx, direction_, cb_threshold,
+                           &format_);
+  s.stream->rstream->stream_id = id;
+  s.stream->rstream->direction = direction_;
+  s.stream->dstream->dev_id = dev_->dev->info.idx;
+  add_stream_to_dev(dev_->dev, s.stream);
+  streams_.push_back(std::move(s));
+}
+
+void DevIoReplay::DrainStreams(const timespec* last, const timespec* now) {
+  timespec elapsed;
+  subtract_timespecs(now, last, &elapsed);
+  unsigned int played = cras_time_to_frames(&elapsed, format_.frame_rate);
+
+  for (auto& s : streams_) {
+    cras_audio_shm* shm = s.stream->rstream->shm;
+    int frames = cras_shm_get_frames(shm);
+    if (frames > 0)
+      cras_shm_buffer_read(shm, std::min(played, (unsigned int)frames));
+  }
+}
+
+void DevIoReplay::DeliverReplies(const timespec* now) {
+  for (auto& s : streams_) {
+    if (!s.pending || timespec_before(now, &s.reply_ts))
+      continue;
+    AddFakeDataToStream(s.stream.get(), s.stream->rstream->cb_threshold);
+    rstream_stub_pending_reply(s.stream->rstream.get(), 0);
+    s.pending = false;
+  }
+}
+
+void DevIoReplay::StartReplies(const ReplayTrace& trace, const timespec* now) {
+  for (auto& s : streams_) {
+    cras_rstream* rstream = s.stream->rstream.get();
+    timespec response = {0, 0};
+
+    if (rstream->num_fetches == s.num_fetches)
+      continue;
+    s.num_fetches = rstream->num_fetches;
+
+    auto responses = trace.responses.find(rstream->stream_id);
+    if (responses != trace.responses.end() && !responses->second.empty()) {
+      response = responses->second[s.next_response];
+      s.next_response = (s.next_response + 1) % responses->second.size();
+    }
+    s.reply_ts = *now;
+    add_timespecs(&s.reply_ts, &response);
+    s.pending = true;
+    rstream_stub_pending_reply(rstream, 1);
+  }
+}
+
+std::vector<ReplayWake> DevIoReplay::Run(const ReplayTrace& trace,
+                                         unsigned int dev_idx) {
+  std::vector<ReplayWake> wakes;
+  struct open_dev* odevs = direction_ == CRAS_STREAM_OUTPUT ? dev_list_ : NULL;
+  struct open_dev* idevs = direction_ == CRAS_STREAM_INPUT ? dev_list_ : NULL;
+  bool started = false;
+  timespec last;
+
+  for (auto const& level : trace.levels) {
+    if (level.dev_idx != dev_idx)
+      continue;
+
+    replay_clock_set(&level.ts);
+    if (!started) {
+      for (auto& s : streams_) {
+        s.stream->rstream->next_cb_ts = level.ts;
+        if (direction_ == CRAS_STREAM_OUTPUT)
+          AddFakeDataToStream(s.stream.get(),
+                              s.stream->rstream->cb_threshold);
+      }
+      started = true;
+    } else if (direction_ == CRAS_STREAM_OUTPUT) {
+      DrainStreams(&last, &level.ts);
+    }
+    last = level.ts;
+    DeliverReplies(&level.ts);
+
+    iodev_stub_frames_queued(dev_->dev.get(), level.hw_level,
+                             level.hw_tstamp);
+    unsigned int fetches_before = 0;
+    for (auto const& s : streams_)
+      fetches_before += s.stream->rstream->num_fetches;
+
+    dev_io_run(&odevs, &idevs, NULL);
+
+    ReplayWake wake;
+    wake.ts = level.ts;
+    wake.hw_level = level.hw_level;
+    wake.num_fetches = 0;
+    for (auto const& s : streams_)
+      wake.num_fetches += s.stream->rstream->num_fetches;
+    wake.num_fetches -= fetches_before;
+    StartReplies(trace, &level.ts);
+
+    wake.next_wake = level.ts;
+    wake.next_wake.tv_sec += 500;  // Far in the future.
+    if (direction_ == CRAS_STREAM_OUTPUT)
+      dev_io_next_output_wake(&odevs, &wake.next_wake);
+    else
+      dev_io_next_input_wake(&idevs, &wake.next_wake);
+    wakes.push_back(wake);
+  }
+  return wakes;
+}
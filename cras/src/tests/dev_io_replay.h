@@ -0,0 +1,97 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Offline replay of audio thread scheduling. A trace holds the hw levels the
+// audio thread read from a device and how long clients took to answer
+// fetches, as captured in an audio thread event log or a flight record.
+// DevIoReplay feeds them back through dev_io_run on fake devices and streams
+// with a virtual clock, so the same trace always gives the same schedule and
+// a scheduling change can be compared against field traces.
+
+#ifndef DEV_IO_REPLAY_H_
+#define DEV_IO_REPLAY_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <map>
+#include <vector>
+
+#include "dev_io_stubs.h"
+
+// A hw level read by the audio thread.
+struct ReplayLevel {
+  timespec ts;  // When it was read.
+  unsigned int dev_idx;
+  unsigned int hw_level;
+  timespec hw_tstamp;  // Time of the level given by the device.
+};
+
+struct ReplayTrace {
+  std::vector<ReplayLevel> levels;
+  // Time each stream took to reply, in the order of its fetches. The log
+  // only shows wakes that found a reply still pending, so these are lower
+  // bounds: zero when the next wake found the reply.
+  std::map<cras_stream_id_t, std::vector<timespec>> responses;
+};
+
+// Extracts a trace from events of an audio thread event log, oldest first.
+// Timestamps keep the 24 bits of seconds the log holds.
+void replay_trace_from_events(const audio_thread_event* events,
+                              size_t num_events,
+                              ReplayTrace* trace);
+
+// Loads a trace from a file written by the flight recorder.
+// Returns 0 on success or a negative error code.
+int replay_trace_from_flight_record(const char* path, ReplayTrace* trace);
+
+// Sets the time returned by clock_gettime in a binary linking the replay.
+void replay_clock_set(const timespec* now);
+
+// What dev_io did at a wake of the replay.
+struct ReplayWake {
+  timespec ts;
+  unsigned int hw_level;
+  unsigned int num_fetches;  // Fetches of all streams at this wake.
+  timespec next_wake;        // When dev_io asked to be woken next.
+};
+
+// Replays the levels of one device of a trace with streams attached to it.
+class DevIoReplay {
+ public:
+  DevIoReplay(CRAS_STREAM_DIRECTION direction,
+              size_t dev_cb_threshold,
+              unsigned int rate);
+  ~DevIoReplay();
+
+  void AddStream(cras_stream_id_t id, size_t cb_threshold);
+
+  // Runs dev_io for each level of dev_idx in the trace, at the time it was
+  // read. Output streams answer a fetch with cb_threshold frames once their
+  // recorded response time has passed.
+  std::vector<ReplayWake> Run(const ReplayTrace& trace, unsigned int dev_idx);
+
+ private:
+  struct ReplayStream {
+    StreamPtr stream;
+    unsigned int num_fetches;
+    size_t next_response;
+    bool pending;
+    timespec reply_ts;
+  };
+
+  // The stub device takes no samples from the streams, drain them at the
+  // device rate so they keep asking for more.
+  void DrainStreams(const timespec* last, const timespec* now);
+  void DeliverReplies(const timespec* now);
+  void StartReplies(const ReplayTrace& trace, const timespec* now);
+
+  CRAS_STREAM_DIRECTION direction_;
+  cras_audio_format format_;
+  DevicePtr dev_;
+  struct open_dev* dev_list_;
+  std::vector<ReplayStream> streams_;
+};
+
+#endif  // DEV_IO_REPLAY_H_
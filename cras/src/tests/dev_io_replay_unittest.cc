@@ -0,0 +1,263 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+
+extern "C" {
+#include "cras_flight_recorder.h"
+
+struct audio_thread_event_log* atlog;
+}
+
+#include "dev_io_replay.h"
+#include "metrics_stub.h"
+
+namespace {
+
+const unsigned int kDevIdx = 3;
+const cras_stream_id_t kStreamId = 0x10001;
+
+class DevIoReplaySuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    atlog = static_cast<audio_thread_event_log*>(calloc(1, sizeof(*atlog)));
+    atlog->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+    iodev_stub_reset();
+    rstream_stub_reset();
+  }
+
+  virtual void TearDown() { free(atlog); }
+
+  void AddEvent(enum AUDIO_THREAD_LOG_EVENTS tag,
+                const timespec& ts,
+                uint32_t data1,
+                uint32_t data2,
+                uint32_t data3) {
+    audio_thread_event ev;
+    ev.tag_sec = (tag << 24) | (ts.tv_sec & 0x00ffffff);
+    ev.nsec = ts.tv_nsec;
+    ev.data1 = data1;
+    ev.data2 = data2;
+    ev.data3 = data3;
+    events_.push_back(ev);
+  }
+
+  // Logs an output wake every 10ms reading the given levels, with a fetch
+  // of stream 0x10001 every other wake that is answered 3ms later.
+  void BuildPlaybackTrace(const std::vector<unsigned int>& levels) {
+    timespec ts = {100, 0};
+    for (size_t i = 0; i < levels.size(); i++) {
+      AddEvent(AUDIO_THREAD_FILL_AUDIO_TSTAMP, ts, kDevIdx, ts.tv_sec,
+               ts.tv_nsec);
+      AddEvent(AUDIO_THREAD_FILL_AUDIO, ts, kDevIdx, levels[i], 480);
+      if (i % 2 == 0) {
+        AddEvent(AUDIO_THREAD_FETCH_STREAM, ts, kStreamId, 480, 0);
+        timespec pending = ts;
+        pending.tv_nsec += 3000000;
+        AddEvent(AUDIO_THREAD_STREAM_FETCH_PENDING, pending, kStreamId, 0, 0);
+      }
+      ts.tv_nsec += 10000000;
+      if (ts.tv_nsec >= 1000000000) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000;
+      }
+    }
+  }
+
+  std::vector<audio_thread_event> events_;
+};
+
+TEST_F(DevIoReplaySuite, TraceFromEvents) {
+  ReplayTrace trace;
+
+  BuildPlaybackTrace({900, 420, 880});
+  replay_trace_from_events(events_.data(), events_.size(), &trace);
+
+  ASSERT_EQ(3, trace.levels.size());
+  EXPECT_EQ(kDevIdx, trace.levels[1].dev_idx);
+  EXPECT_EQ(420, trace.levels[1].hw_level);
+  EXPECT_EQ(100, trace.levels[1].ts.tv_sec);
+  EXPECT_EQ(10000000, trace.levels[1].ts.tv_nsec);
+  EXPECT_EQ(10000000, trace.levels[1].hw_tstamp.tv_nsec);
+
+  ASSERT_EQ(2, trace.responses[kStreamId].size());
+  EXPECT_EQ(0, trace.responses[kStreamId][0].tv_sec);
+  EXPECT_EQ(3000000, trace.responses[kStreamId][0].tv_nsec);
+}
+
+TEST_F(DevIoReplaySuite, PlaybackReplayIsDeterministic) {
+  ReplayTrace trace;
+  std::vector<unsigned int> levels;
+
+  for (int i = 0; i < 20; i++)
+    levels.push_back(i % 2 ? 480 : 960);
+  BuildPlaybackTrace(levels);
+  replay_trace_from_events(events_.data(), events_.size(), &trace);
+
+  std::vector<ReplayWake> first, second;
+  {
+    DevIoReplay replay(CRAS_STREAM_OUTPUT, 480, 48000);
+    replay.AddStream(kStreamId, 480);
+    first = replay.Run(trace, kDevIdx);
+  }
+  rstream_stub_reset();
+  iodev_stub_reset();
+  {
+    DevIoReplay replay(CRAS_STREAM_OUTPUT, 480, 48000);
+    replay.AddStream(kStreamId, 480);
+    second = replay.Run(trace, kDevIdx);
+  }
+
+  ASSERT_EQ(levels.size(), first.size());
+  ASSERT_EQ(first.size(), second.size());
+  unsigned int fetches = 0;
+  for (size_t i = 0; i < first.size(); i++) {
+    EXPECT_EQ(first[i].num_fetches, second[i].num_fetches);
+    EXPECT_EQ(first[i].next_wake.tv_sec, second[i].next_wake.tv_sec);
+    EXPECT_EQ(first[i].next_wake.tv_nsec, second[i].next_wake.tv_nsec);
+    // The device is always asked to wake after the level was read.
+    EXPECT_GE(first[i].next_wake.tv_sec, first[i].ts.tv_sec);
+    fetches += first[i].num_fetches;
+  }
+  EXPECT_GT(fetches, 0);
+}
+
+TEST_F(DevIoReplaySuite, SlowClientFetchesLess) {
+  ReplayTrace trace;
+  std::vector<unsigned int> levels(40, 480);
+  unsigned int fast = 0, slow = 0;
+
+  BuildPlaybackTrace(levels);
+  replay_trace_from_events(events_.data(), events_.size(), &trace);
+  {
+    DevIoReplay replay(CRAS_STREAM_OUTPUT, 480, 48000);
+    replay.AddStream(kStreamId, 480);
+    for (auto const& wake : replay.Run(trace, kDevIdx))
+      fast += wake.num_fetches;
+  }
+  rstream_stub_reset();
+  iodev_stub_reset();
+
+  // Replies take longer than the 10ms callback period.
+  trace.responses[kStreamId] = {{0, 25000000}};
+  {
+    DevIoReplay replay(CRAS_STREAM_OUTPUT, 480, 48000);
+    replay.AddStream(kStreamId, 480);
+    for (auto const& wake : replay.Run(trace, kDevIdx))
+      slow += wake.num_fetches;
+  }
+  EXPECT_GT(fast, slow);
+  EXPECT_GT(slow, 0);
+}
+
+TEST_F(DevIoReplaySuite, OtherDeviceIgnored) {
+  ReplayTrace trace;
+
+  BuildPlaybackTrace({900, 420});
+  replay_trace_from_events(events_.data(), events_.size(), &trace);
+
+  DevIoReplay replay(CRAS_STREAM_OUTPUT, 480, 48000);
+  replay.AddStream(kStreamId, 480);
+  EXPECT_EQ(0, replay.Run(trace, kDevIdx + 1).size());
+}
+
+TEST_F(DevIoReplaySuite, TraceFromFlightRecord) {
+  char tmpl[] = CRAS_UT_TMPDIR "/dev_io_replay_XXXXXX";
+  ASSERT_NE(nullptr, mkdtemp(tmpl));
+  std::string dir(tmpl);
+  std::string path = dir + "/cras_flight_record.0";
+  cras_audio_thread_snapshot snapshot = {};
+  ReplayTrace trace;
+
+  BuildPlaybackTrace({900, 420, 880, 400});
+  for (auto const& ev : events_)
+    atlog->log[atlog->write_pos++ % atlog->len] = ev;
+  snapshot.timestamp = {100, 50000000};
+  snapshot.event_type = AUDIO_THREAD_EVENT_UNDERRUN;
+  snapshot.size = sizeof(snapshot);
+
+  cras_flight_recorder_init(dir.c_str());
+  ASSERT_EQ(0, cras_flight_recorder_record(&snapshot, atlog));
+  cras_flight_recorder_deinit();
+
+  EXPECT_EQ(0, replay_trace_from_flight_record(path.c_str(), &trace));
+  unlink(path.c_str());
+  rmdir(dir.c_str());
+
+  ASSERT_EQ(4, trace.levels.size());
+  EXPECT_EQ(400, trace.levels[3].hw_level);
+  EXPECT_EQ(2, trace.responses[kStreamId].size());
+  EXPECT_EQ(-ENOENT, replay_trace_from_flight_record(path.c_str(), &trace));
+}
+
+/* Stubs */
+extern "C" {
+
+int input_data_get_for_stream(struct input_data* data,
+                              struct cras_rstream* stream,
+                              struct buffer_share* offsets,
+                              struct cras_audio_area** area,
+                              unsigned int* offset) {
+  return 0;
+}
+
+int input_data_put_for_stream(struct input_data* data,
+                              struct cras_rstream* stream,
+                              struct buffer_share* offsets,
+                              unsigned int frames) {
+  return 0;
+}
+
+bool input_data_silence_gated(struct input_data* data,
+                              struct cras_rstream* stream) {
+  return false;
+}
+
+unsigned int input_data_get_processing_delay(struct input_data* data,
+                                             struct cras_rstream* stream) {
+  return 0;
+}
+
+float input_data_get_software_gain_scaler(struct input_data* data,
+                                          float idev_sw_gain_scaler,
+                                          struct cras_rstream* stream) {
+  return 1.0;
+}
+
+struct cras_audio_format* cras_rstream_post_processing_format(
+    const struct cras_rstream* stream,
+    void* dev_ptr) {
+  return NULL;
+}
+
+int cras_audio_thread_event_drop_samples() {
+  return 0;
+}
+
+int cras_audio_thread_event_severe_underrun() {
+  return 0;
+}
+
+int cras_device_monitor_error_close(unsigned int dev_idx) {
+  return 0;
+}
+
+void* buffer_share_get_data(const struct buffer_share* mix, unsigned int id) {
+  return NULL;
+}
+
+void cras_apm_list_start_apm(struct cras_apm_list* list, void* dev_ptr) {}
+void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr) {}
+}  // extern "C"
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
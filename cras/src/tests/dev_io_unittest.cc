@@ -30,11 +30,15 @@ struct audio_thread_event_log* atlog;
 static float dev_stream_capture_software_gain_scaler_val;
 static float input_data_get_software_gain_scaler_val;
 static unsigned int dev_stream_capture_avail_ret = 480;
+static unsigned int dev_stream_request_playback_samples_called;
+static struct dev_stream* dev_stream_create_ret;
+static struct timespec dev_stream_create_cb_ts;
 struct set_dev_rate_data {
   unsigned int dev_rate;
   double dev_rate_ratio;
   double main_rate_ratio;
   int coarse_rate_adjust;
+  bool to_master;
 };
 std::unordered_map<struct dev_stream*, set_dev_rate_data> set_dev_rate_map;
 
@@ -44,10 +48,12 @@ class DevIoSuite : public testing::Test {
  protected:
   virtual void SetUp() {
     atlog = static_cast<audio_thread_event_log*>(calloc(1, sizeof(*atlog)));
+    atlog->len = AUDIO_THREAD_EVENT_LOG_SIZE;
     iodev_stub_reset();
     rstream_stub_reset();
     fill_audio_format(&format, 48000);
     set_dev_rate_map.clear();
+    dev_stream_create_ret = NULL;
     stream = create_stream(1, 1, CRAS_STREAM_INPUT, cb_threshold, &format);
   }
 
@@ -105,6 +111,220 @@ TEST_F(DevIoSuite, CaptureGain) {
   EXPECT_FLOAT_EQ(0.42f, dev_stream_capture_software_gain_scaler_val);
 }
 
+/*
+ * Streams whose callback time falls within their slack of the current wake are
+ * fetched in it, the others wait for their own deadline.
+ */
+TEST_F(DevIoSuite, PlaybackFetchCoalescesStreamsWithinSlack) {
+  struct open_dev* dev_list = NULL;
+  struct timespec start, soon = {0, 800 * 1000}, later = {0, 5000 * 1000};
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  StreamPtr stream2 =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  StreamPtr stream3 =
+      create_stream(3, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+
+  // A 10 ms callback period leaves 1 ms of slack.
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  stream->rstream->next_cb_ts = start;
+  stream2->rstream->next_cb_ts = start;
+  add_timespecs(&stream2->rstream->next_cb_ts, &soon);
+  stream3->rstream->next_cb_ts = start;
+  add_timespecs(&stream3->rstream->next_cb_ts, &later);
+
+  DL_APPEND(dev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+  add_stream_to_dev(dev->dev, stream2);
+  add_stream_to_dev(dev->dev, stream3);
+
+  dev_stream_request_playback_samples_called = 0;
+  dev_io_playback_fetch(dev_list);
+  EXPECT_EQ(2, dev_stream_request_playback_samples_called);
+  EXPECT_EQ(1, dev->odev->num_coalesced_fetches);
+}
+
+TEST_F(DevIoSuite, PlaybackFetchLeadsLateClient) {
+  struct open_dev* dev_list = NULL;
+  struct timespec start, later = {0, 3000 * 1000};
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  StreamPtr stream2 =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+
+  // Both are due in 3 ms, only the stream with a client replying 3 ms late
+  // is fetched now.
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  stream->rstream->next_cb_ts = start;
+  add_timespecs(&stream->rstream->next_cb_ts, &later);
+  stream->rstream->fetch_lead_ts = later;
+  stream2->rstream->next_cb_ts = stream->rstream->next_cb_ts;
+
+  DL_APPEND(dev_list, dev->odev.get());
+  add_stream_to_dev(dev->dev, stream);
+  add_stream_to_dev(dev->dev, stream2);
+
+  dev_stream_request_playback_samples_called = 0;
+  dev_io_playback_fetch(dev_list);
+  EXPECT_EQ(1, dev_stream_request_playback_samples_called);
+  EXPECT_EQ(0, dev->odev->num_coalesced_fetches);
+}
+
+TEST_F(DevIoSuite, MitigateBusyloopResetsDueDevice) {
+  struct open_dev* odev_list = NULL;
+  struct open_dev* idev_list = NULL;
+  struct timespec now, later = {0, 3000 * 1000};
+  DevicePtr out_dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                    CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  DevicePtr in_dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                   CRAS_NODE_TYPE_MIC);
+  StreamPtr out_stream =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+
+  // The output device and its stream are due, the input device isn't.
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  out_dev->odev->wake_ts = now;
+  out_stream->rstream->next_cb_ts = now;
+  in_dev->odev->wake_ts = now;
+  add_timespecs(&in_dev->odev->wake_ts, &later);
+
+  DL_APPEND(odev_list, out_dev->odev.get());
+  DL_APPEND(idev_list, in_dev->odev.get());
+  add_stream_to_dev(out_dev->dev, out_stream);
+  add_stream_to_dev(in_dev->dev, stream);
+
+  EXPECT_EQ(2, dev_io_mitigate_busyloop(&odev_list, &idev_list, &now));
+  EXPECT_EQ(1, iodev_stub_get_reset_request_count(out_dev->dev.get()));
+  EXPECT_EQ(0, iodev_stub_get_reset_request_count(in_dev->dev.get()));
+}
+
+/*
+ * An open device that is waiting for samples is padded to its minimum buffer
+ * level when its first stream attaches, not when it is added to the thread.
+ */
+TEST_F(DevIoSuite, AppendStreamPadsUnstartedDevice) {
+  struct open_dev* odev_list = NULL;
+  struct open_dev* idev_list = NULL;
+  struct timespec now;
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  StreamPtr out_stream =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  struct cras_iodev* iodev = dev->dev.get();
+
+  out_stream->rstream->direction = CRAS_STREAM_OUTPUT;
+  iodev->min_buffer_level = 480;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  iodev_stub_valid_frames(iodev, 100, now);
+  DL_APPEND(odev_list, dev->odev.get());
+
+  dev_stream_create_ret = out_stream->dstream.get();
+  EXPECT_EQ(0, dev_io_append_stream(&odev_list, &idev_list,
+                                    out_stream->rstream.get(), &iodev, 1,
+                                    NULL, 0));
+  EXPECT_EQ(380, iodev_stub_get_fill_zeros(iodev));
+}
+
+TEST_F(DevIoSuite, AppendStreamDoesntPadRunningDevice) {
+  struct open_dev* odev_list = NULL;
+  struct open_dev* idev_list = NULL;
+  struct timespec now;
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  StreamPtr out_stream =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  struct cras_iodev* iodev = dev->dev.get();
+
+  out_stream->rstream->direction = CRAS_STREAM_OUTPUT;
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev->min_buffer_level = 480;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  iodev_stub_valid_frames(iodev, 100, now);
+  DL_APPEND(odev_list, dev->odev.get());
+
+  dev_stream_create_ret = out_stream->dstream.get();
+  EXPECT_EQ(0, dev_io_append_stream(&odev_list, &idev_list,
+                                    out_stream->rstream.get(), &iodev, 1,
+                                    NULL, 0));
+  EXPECT_EQ(0, iodev_stub_get_fill_zeros(iodev));
+}
+
+/*
+ * The samples a FAST_START stream already holds, like a preroll, take the
+ * place of part of the padding.
+ */
+TEST_F(DevIoSuite, AppendFastStartStreamSamplesCountAsPadding) {
+  struct open_dev* odev_list = NULL;
+  struct open_dev* idev_list = NULL;
+  struct timespec now;
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  StreamPtr out_stream =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  struct cras_iodev* iodev = dev->dev.get();
+
+  out_stream->rstream->direction = CRAS_STREAM_OUTPUT;
+  out_stream->rstream->flags = FAST_START;
+  AddFakeDataToStream(out_stream.get(), 200);
+  iodev->min_buffer_level = 480;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  iodev_stub_valid_frames(iodev, 100, now);
+  DL_APPEND(odev_list, dev->odev.get());
+
+  dev_stream_create_ret = out_stream->dstream.get();
+  EXPECT_EQ(0, dev_io_append_stream(&odev_list, &idev_list,
+                                    out_stream->rstream.get(), &iodev, 1,
+                                    NULL, 0));
+  EXPECT_EQ(180, iodev_stub_get_fill_zeros(iodev));
+}
+
+/*
+ * A FAST_START stream is asked for samples as soon as it attaches, others
+ * when the device level drains to their callback threshold.
+ */
+TEST_F(DevIoSuite, AppendFastStartStreamFetchesImmediately) {
+  struct open_dev* odev_list = NULL;
+  struct open_dev* idev_list = NULL;
+  struct timespec start, end, wait = {0, 10 * 1000 * 1000};
+  DevicePtr dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  DevicePtr dev2 = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                 CRAS_NODE_TYPE_INTERNAL_SPEAKER);
+  StreamPtr out_stream =
+      create_stream(2, 1, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  StreamPtr fast_stream =
+      create_stream(3, 2, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+  struct cras_iodev* iodev = dev->dev.get();
+  struct cras_iodev* iodev2 = dev2->dev.get();
+
+  out_stream->rstream->direction = CRAS_STREAM_OUTPUT;
+  fast_stream->rstream->direction = CRAS_STREAM_OUTPUT;
+  fast_stream->rstream->flags = FAST_START;
+  iodev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev2->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  clock_gettime(CLOCK_MONOTONIC_RAW, &start);
+  // 10 ms above the callback threshold.
+  iodev_stub_valid_frames(iodev, 960, start);
+  iodev_stub_valid_frames(iodev2, 960, start);
+  DL_APPEND(odev_list, dev->odev.get());
+  DL_APPEND(odev_list, dev2->odev.get());
+
+  dev_stream_create_ret = out_stream->dstream.get();
+  EXPECT_EQ(0, dev_io_append_stream(&odev_list, &idev_list,
+                                    out_stream->rstream.get(), &iodev, 1,
+                                    NULL, 0));
+  add_timespecs(&start, &wait);
+  EXPECT_EQ(start.tv_sec, dev_stream_create_cb_ts.tv_sec);
+  EXPECT_EQ(start.tv_nsec, dev_stream_create_cb_ts.tv_nsec);
+
+  dev_stream_create_ret = fast_stream->dstream.get();
+  EXPECT_EQ(0, dev_io_append_stream(&odev_list, &idev_list,
+                                    fast_stream->rstream.get(), &iodev2, 1,
+                                    NULL, 0));
+  clock_gettime(CLOCK_MONOTONIC_RAW, &end);
+  EXPECT_FALSE(timespec_after(&dev_stream_create_cb_ts, &end));
+}
+
 /*
  * When input and output devices are on the internal sound card,
  * and their device rates are the same, use the estimated rate
@@ -165,6 +385,43 @@ TEST_F(DevIoSuite, InputOutputIndependentEstimatedRate) {
   EXPECT_FLOAT_EQ(0.8f, set_dev_rate_map[stream->dstream.get()].dev_rate_ratio);
 }
 
+/*
+ * A capture stream paired with playback on another card is resampled to the
+ * clock of the output device.
+ */
+TEST_F(DevIoSuite, VoiceCaptureFollowsPairedOutputClock) {
+  struct open_dev* idev_list = NULL;
+  struct open_dev* odev_list = NULL;
+  struct timespec ts;
+  DevicePtr out_dev = create_device(CRAS_STREAM_OUTPUT, cb_threshold, &format,
+                                    CRAS_NODE_TYPE_USB);
+  DevicePtr in_dev = create_device(CRAS_STREAM_INPUT, cb_threshold, &format,
+                                   CRAS_NODE_TYPE_MIC);
+  StreamPtr out_stream =
+      create_stream(1, 2, CRAS_STREAM_OUTPUT, cb_threshold, &format);
+
+  in_dev->dev->state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev_stub_frames_queued(in_dev->dev.get(), 20, ts);
+  DL_APPEND(idev_list, in_dev->odev.get());
+  add_stream_to_dev(in_dev->dev, stream);
+  DL_APPEND(odev_list, out_dev->odev.get());
+  add_stream_to_dev(out_dev->dev, out_stream);
+  iodev_stub_on_internal_card(out_dev->dev->active_node, 0);
+  iodev_stub_on_internal_card(in_dev->dev->active_node, 1);
+  stream->rstream->stream_type = CRAS_STREAM_TYPE_VOICE_COMMUNICATION;
+  out_stream->rstream->stream_type = CRAS_STREAM_TYPE_VOICE_COMMUNICATION;
+
+  iodev_stub_est_rate_ratio(in_dev->dev.get(), 0.8f);
+  iodev_stub_est_rate_ratio(out_dev->dev.get(), 1.2f);
+
+  dev_io_capture(&idev_list, &odev_list);
+
+  set_dev_rate_data& data = set_dev_rate_map[stream->dstream.get()];
+  EXPECT_TRUE(data.to_master);
+  EXPECT_FLOAT_EQ(0.8f, data.dev_rate_ratio);
+  EXPECT_FLOAT_EQ(1.2f, data.main_rate_ratio);
+}
+
 /*
  * If any hw_level is larger than 1.5 * largest_cb_level and
  * DROP_FRAMES_THRESHOLD_MS, reset all input devices.
@@ -369,6 +626,16 @@ int input_data_put_for_stream(struct input_data* data,
   return 0;
 }
 
+bool input_data_silence_gated(struct input_data* data,
+                              struct cras_rstream* stream) {
+  return false;
+}
+
+unsigned int input_data_get_processing_delay(struct input_data* data,
+                                             struct cras_rstream* stream) {
+  return 0;
+}
+
 float input_data_get_software_gain_scaler(struct input_data* data,
                                           float idev_sw_gain_scaler,
                                           struct cras_rstream* stream) {
@@ -399,6 +666,48 @@ int dev_stream_mix(struct dev_stream* dev_stream,
                    unsigned int num_to_write) {
   return 0;
 }
+int dev_stream_copy(struct dev_stream* dev_stream,
+                    const struct cras_audio_format* fmt,
+                    uint8_t* dst,
+                    unsigned int num_to_write) {
+  return 0;
+}
+int dev_stream_mix_bus(struct dev_stream* dev_stream,
+                       const struct cras_audio_format* fmt,
+                       struct mix_bus* bus,
+                       unsigned int offset,
+                       unsigned int num_to_write,
+                       unsigned int index) {
+  return 0;
+}
+
+int dev_stream_passthrough(struct dev_stream* dev_stream,
+                           uint8_t* dst,
+                           unsigned int num_to_write) {
+  return 0;
+}
+
+int dev_stream_can_submix(const struct dev_stream* dev_stream) {
+  return 0;
+}
+
+struct dev_stream* const* dev_stream_mix_group(
+    const struct dev_stream* dev_stream,
+    unsigned int* num_streams) {
+  *num_streams = 0;
+  return NULL;
+}
+
+int dev_stream_mix_submix(struct dev_stream* const* streams,
+                          unsigned int num_streams,
+                          const struct cras_audio_format* fmt,
+                          uint8_t* dst,
+                          struct mix_bus* bus,
+                          unsigned int bus_offset,
+                          unsigned int num_to_write,
+                          unsigned int index) {
+  return 0;
+}
 void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
                              unsigned int dev_rate,
                              double dev_rate_ratio,
@@ -409,6 +718,21 @@ void dev_stream_set_dev_rate(struct dev_stream* dev_stream,
   new_data.dev_rate_ratio = dev_rate_ratio;
   new_data.main_rate_ratio = main_rate_ratio;
   new_data.coarse_rate_adjust = coarse_rate_adjust;
+  new_data.to_master = false;
+
+  set_dev_rate_map[dev_stream] = new_data;
+}
+void dev_stream_set_master_rate(struct dev_stream* dev_stream,
+                                unsigned int dev_rate,
+                                double dev_rate_ratio,
+                                double master_rate_ratio,
+                                int coarse_rate_adjust) {
+  set_dev_rate_data new_data;
+  new_data.dev_rate = dev_rate;
+  new_data.dev_rate_ratio = dev_rate_ratio;
+  new_data.main_rate_ratio = master_rate_ratio;
+  new_data.coarse_rate_adjust = coarse_rate_adjust;
+  new_data.to_master = true;
 
   set_dev_rate_map[dev_stream] = new_data;
 }
@@ -418,6 +742,7 @@ int dev_stream_capture_update_rstream(struct dev_stream* dev_stream) {
 int dev_stream_wake_time(struct dev_stream* dev_stream,
                          unsigned int curr_level,
                          struct timespec* level_tstamp,
+                         double dev_rate_ratio,
                          unsigned int cap_limit,
                          int is_cap_limit_stream,
                          struct timespec* wake_time_out) {
@@ -426,8 +751,9 @@ int dev_stream_wake_time(struct dev_stream* dev_stream,
 int dev_stream_flush_old_audio_messages(struct dev_stream* dev_stream) {
   return 0;
 }
-void dev_stream_set_delay(const struct dev_stream* dev_stream,
-                          unsigned int delay_frames) {}
+void dev_stream_set_delay(struct dev_stream* dev_stream,
+                          const struct dev_stream_delay* delay,
+                          const struct timespec* level_ts) {}
 unsigned int dev_stream_capture(struct dev_stream* dev_stream,
                                 const struct cras_audio_area* area,
                                 unsigned int area_offset,
@@ -435,9 +761,16 @@ unsigned int dev_stream_capture(struct dev_stream* dev_stream,
   dev_stream_capture_software_gain_scaler_val = software_gain_scaler;
   return 0;
 }
+
+unsigned int dev_stream_capture_silence(struct dev_stream* dev_stream,
+                                        unsigned int frames,
+                                        float software_gain_scaler) {
+  return 0;
+}
 void dev_stream_update_next_wake_time(struct dev_stream* dev_stream) {}
 int dev_stream_request_playback_samples(struct dev_stream* dev_stream,
                                         const struct timespec* now) {
+  dev_stream_request_playback_samples_called++;
   return 0;
 }
 int dev_stream_playback_update_rstream(struct dev_stream* dev_stream) {
@@ -453,7 +786,16 @@ struct dev_stream* dev_stream_create(struct cras_rstream* stream,
                                      void* dev_ptr,
                                      struct timespec* cb_ts,
                                      const struct timespec* sleep_interval_ts) {
-  return 0;
+  dev_stream_create_cb_ts = *cb_ts;
+  return dev_stream_create_ret;
+}
+int dev_stream_attach(struct dev_stream* dev_stream,
+                      unsigned int dev_id,
+                      const struct cras_audio_format* dev_fmt,
+                      void* dev_ptr,
+                      struct timespec* cb_ts,
+                      const struct timespec* sleep_interval_ts) {
+  return -EINVAL;
 }
 int cras_device_monitor_error_close(unsigned int dev_idx) {
   return 0;
@@ -9,10 +9,13 @@ extern "C" {
 #include "audio_thread_log.h"
 #include "byte_buffer.h"
 #include "cras_audio_area.h"
+#include "cras_fmt_conv.h"
+#include "cras_mix.h"
 #include "cras_rstream.h"
 #include "cras_shm.h"
 #include "cras_types.h"
 #include "dev_stream.h"
+#include "mix_bus.h"
 }
 
 namespace {
@@ -63,7 +66,7 @@ struct cras_audio_area_copy_call {
 
 struct fmt_conv_call {
   struct cras_fmt_conv* conv;
-  uint8_t* in_buf;
+  const uint8_t* in_buf;
   uint8_t* out_buf;
   size_t in_frames;
   size_t out_frames;
@@ -87,13 +90,18 @@ struct rstream_get_readable_call {
 static int config_format_converter_called;
 static const struct cras_audio_format* config_format_converter_from_fmt;
 static int config_format_converter_frames;
+static enum CRAS_RESAMPLER_QUALITY config_format_converter_quality;
 static struct cras_fmt_conv* config_format_converter_conv;
 static struct cras_audio_format in_fmt;
 static struct cras_audio_format out_fmt;
 static struct cras_audio_area_copy_call copy_area_call;
 static struct fmt_conv_call conv_frames_call;
+static int cras_fmt_conv_convert_frames_called;
 static int cras_audio_area_create_num_channels_val;
 static int cras_fmt_conversion_needed_val;
+static snd_pcm_format_t mix_add_planar_fmt;
+static const uint8_t* mix_add_planar_src;
+static unsigned int mix_add_planar_frames;
 static int cras_fmt_conv_set_linear_resample_rates_called;
 static float cras_fmt_conv_set_linear_resample_rates_from;
 static float cras_fmt_conv_set_linear_resample_rates_to;
@@ -103,6 +111,11 @@ static struct mix_add_call mix_add_call;
 static struct rstream_get_readable_call rstream_get_readable_call;
 static unsigned int rstream_get_readable_num;
 static uint8_t* rstream_get_readable_ptr;
+static int16_t rstream_readable_samples[kBufferFrames * 2];
+static int cras_rstream_get_mute_ret;
+static float cras_rstream_get_volume_scaler_ret;
+static int cras_fmt_conv_resampling_val;
+static size_t cras_fmt_conv_delay_frames_val;
 
 static struct cras_audio_format* cras_rstream_post_processing_format_val;
 static int cras_rstream_audio_ready_called;
@@ -110,6 +123,10 @@ static int cras_rstream_audio_ready_count;
 static int cras_rstream_is_pending_reply_ret;
 static int cras_rstream_flush_old_audio_messages_called;
 static int cras_server_metrics_missed_cb_event_called;
+static int loopback_tap_mix_stream_called;
+static uint8_t* loopback_tap_mix_stream_frames;
+static unsigned int loopback_tap_mix_stream_nframes;
+static int loopback_tap_mix_stream_mute;
 
 static char* atlog_name;
 
@@ -138,26 +155,40 @@ class CreateSuite : public testing::Test {
     config_format_converter_from_fmt = NULL;
     config_format_converter_called = 0;
     cras_fmt_conversion_needed_val = 0;
+    cras_fmt_conv_resampling_val = 0;
+    cras_fmt_conv_delay_frames_val = 0;
     cras_fmt_conv_set_linear_resample_rates_called = 0;
+    cras_rstream_get_mute_ret = 0;
+    cras_rstream_get_volume_scaler_ret = 1.0;
+    for (size_t i = 0; i < kBufferFrames * 2; i++)
+      rstream_readable_samples[i] = i + 1;
 
     cras_rstream_audio_ready_called = 0;
     cras_rstream_audio_ready_count = 0;
     cras_rstream_is_pending_reply_ret = 0;
     cras_rstream_flush_old_audio_messages_called = 0;
     cras_server_metrics_missed_cb_event_called = 0;
+    loopback_tap_mix_stream_called = 0;
+    mix_add_planar_src = NULL;
+    mix_add_planar_frames = 0;
 
     memset(&copy_area_call, 0xff, sizeof(copy_area_call));
     memset(&conv_frames_call, 0xff, sizeof(conv_frames_call));
+    cras_fmt_conv_convert_frames_called = 0;
 
     ASSERT_FALSE(asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0);
     /* To avoid un-used variable warning. */
     atlog_rw_shm_fd = atlog_ro_shm_fd = -1;
-    atlog = audio_thread_event_log_init(atlog_name);
+    atlog =
+        audio_thread_event_log_init(atlog_name, AUDIO_THREAD_EVENT_LOG_SIZE);
 
     devstr.stream = &rstream_;
     devstr.conv = NULL;
     devstr.conv_buffer = NULL;
     devstr.conv_buffer_size_frames = 0;
+    devstr.shared_conv = NULL;
+    devstr.play_conv = NULL;
+    devstr.held = 0;
 
     area = (struct cras_audio_area*)calloc(
         1, sizeof(*area) + 2 * sizeof(struct cras_channel_area));
@@ -182,6 +213,7 @@ class CreateSuite : public testing::Test {
   }
 
   virtual void TearDown() {
+    dev_stream_release_kept();
     free(area);
     free(stream_area);
     free(rstream_.shm->header);
@@ -364,6 +396,41 @@ TEST_F(CreateSuite, CreateOutputWithSchedule) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, PrepareThenAttachOutput) {
+  struct dev_stream* dev_stream;
+  unsigned int dev_id = 9;
+  struct timespec init_cb_ts = {1, 2};
+
+  rstream_.direction = CRAS_STREAM_OUTPUT;
+  in_fmt = fmt_s16le_44_1;
+  out_fmt = fmt_s16le_48;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_prepare(&rstream_, &fmt_s16le_48);
+  ASSERT_NE(static_cast<struct dev_stream*>(NULL), dev_stream);
+  EXPECT_EQ(1, config_format_converter_called);
+  EXPECT_NE(static_cast<byte_buffer*>(NULL), dev_stream->conv_buffer);
+
+  // A device reopened in another format needs a new converter.
+  EXPECT_EQ(-EINVAL, dev_stream_attach(dev_stream, dev_id, &fmt_s16le_44_1,
+                                       (void*)0x55, &init_cb_ts, NULL));
+  EXPECT_EQ(0, dev_stream_attach(dev_stream, dev_id, &fmt_s16le_48,
+                                 (void*)0x55, &init_cb_ts, NULL));
+  EXPECT_EQ(1, config_format_converter_called);
+  EXPECT_EQ(dev_id, dev_stream->dev_id);
+  EXPECT_EQ(init_cb_ts.tv_sec, rstream_.next_cb_ts.tv_sec);
+  EXPECT_EQ(init_cb_ts.tv_nsec, rstream_.next_cb_ts.tv_nsec);
+  dev_stream_destroy(dev_stream);
+}
+
+TEST_F(CreateSuite, PrepareSkipsInputWithApm) {
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.apm_list = reinterpret_cast<struct cras_apm_list*>(0x99);
+  EXPECT_EQ(static_cast<struct dev_stream*>(NULL),
+            dev_stream_prepare(&rstream_, &fmt_s16le_48));
+  EXPECT_EQ(0, config_format_converter_called);
+  rstream_.apm_list = NULL;
+}
+
 TEST_F(CreateSuite, CreateSRC44from48Input) {
   struct dev_stream* dev_stream;
   struct cras_audio_format processed_fmt = fmt_s16le_48;
@@ -389,6 +456,54 @@ TEST_F(CreateSuite, CreateSRC44from48Input) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, CaptureTimestampFromLevelTime) {
+  struct timespec level_ts;
+
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.format = fmt_s16le_44_1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 44100;
+  devstr.stream = &rstream_;
+  clock_gettime_retspec.tv_sec = 20;
+  clock_gettime_retspec.tv_nsec = 0;
+
+  /* Ten seconds buffered before the level was read, timed exactly. */
+  level_ts.tv_sec = 12;
+  level_ts.tv_nsec = 500000;
+  struct dev_stream_delay delay = {.device = 441000};
+  dev_stream_set_delay(&devstr, &delay, &level_ts);
+  EXPECT_EQ(2, rstream_.shm->header->ts.tv_sec);
+  EXPECT_EQ(500000, rstream_.shm->header->ts.tv_nsec);
+
+  /* Without a level time the delay is counted from now. */
+  delay.device = 44100;
+  dev_stream_set_delay(&devstr, &delay, NULL);
+  EXPECT_EQ(19, rstream_.shm->header->ts.tv_sec);
+  EXPECT_EQ(0, rstream_.shm->header->ts.tv_nsec);
+}
+
+TEST_F(CreateSuite, PlaybackTimestampCountsEveryDelay) {
+  rstream_.direction = CRAS_STREAM_OUTPUT;
+  rstream_.format = fmt_s16le_48;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  devstr.stream = &rstream_;
+  clock_gettime_retspec.tv_sec = 20;
+  clock_gettime_retspec.tv_nsec = 0;
+
+  /* 100ms in the device, 10ms each in the DSP and the resampler. */
+  cras_fmt_conv_delay_frames_val = 480;
+  struct dev_stream_delay delay = {.device = 4800, .dsp = 480};
+  dev_stream_set_delay(&devstr, &delay, NULL);
+  EXPECT_EQ(4800, devstr.delay.device);
+  EXPECT_EQ(480, devstr.delay.dsp);
+  EXPECT_EQ(480, devstr.delay.conv);
+  EXPECT_EQ(0, devstr.delay.processing);
+  EXPECT_EQ(5760, dev_stream_delay_frames(&devstr));
+  EXPECT_EQ(20, rstream_.shm->header->ts.tv_sec);
+  EXPECT_EQ(120000000, rstream_.shm->header->ts.tv_nsec);
+}
+
 TEST_F(CreateSuite, CreateSRC48to44) {
   struct dev_stream* dev_stream;
 
@@ -547,6 +662,261 @@ TEST_F(CreateSuite, CaptureAvailConvBufHasSamples) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, ReusesDestroyedDevStreamBuffers) {
+  struct dev_stream* dev_stream;
+  struct byte_buffer* conv_buffer;
+  struct cras_audio_area* conv_area;
+
+  rstream_.format = fmt_s16le_48;
+  rstream_.direction = CRAS_STREAM_OUTPUT;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_44_1, (void*)0x55,
+                                 &cb_ts, NULL);
+  conv_buffer = dev_stream->conv_buffer;
+  conv_area = dev_stream->conv_area;
+  buf_increment_write(conv_buffer, 64);
+  dev_stream_destroy(dev_stream);
+
+  // The same sizes take the kept buffer and area, emptied.
+  cras_audio_area_create_num_channels_val = 0;
+  dev_stream = dev_stream_create(&rstream_, 0, &fmt_s16le_44_1, (void*)0x55,
+                                 &cb_ts, NULL);
+  EXPECT_EQ(conv_buffer, dev_stream->conv_buffer);
+  EXPECT_EQ(conv_area, dev_stream->conv_area);
+  EXPECT_EQ(0, buf_queued(dev_stream->conv_buffer));
+  EXPECT_EQ(0, cras_audio_area_create_num_channels_val);
+  dev_stream_destroy(dev_stream);
+}
+
+TEST_F(CreateSuite, CaptureStreamsShareConverter) {
+  struct cras_rstream rstream2 = rstream_;
+  struct cras_audio_area* stream_area2;
+  struct cras_audio_area* conv_areas[2];
+  struct dev_stream* dev_streams[2];
+  unsigned int stream_avail, nread;
+
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.format = fmt_s16le_44_1;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 44100;
+  cras_fmt_conversion_needed_val = 1;
+  cras_rstream_post_processing_format_val = NULL;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+
+  rstream2 = rstream_;
+  rstream2.stream_id = 0x10002;
+  SetupShm(&rstream2.shm);
+  stream_area2 = (struct cras_audio_area*)calloc(
+      1, sizeof(*area) + 2 * sizeof(struct cras_channel_area));
+  stream_area2->num_channels = 2;
+  rstream2.audio_area = stream_area2;
+
+  dev_streams[0] =
+      dev_stream_create(&rstream_, 0, &fmt_s16le_48, (void*)0x55, &cb_ts, NULL);
+  dev_streams[1] =
+      dev_stream_create(&rstream2, 0, &fmt_s16le_48, (void*)0x55, &cb_ts, NULL);
+  // One converter for each stream, and the one they share.
+  EXPECT_EQ(3, config_format_converter_called);
+  ASSERT_NE((void*)NULL, dev_streams[0]->shared_conv);
+  EXPECT_EQ(dev_streams[0]->shared_conv, dev_streams[1]->shared_conv);
+
+  for (int i = 0; i < 2; i++)
+    conv_areas[i] = dev_streams[i]->conv_area;
+
+  // The first stream converts the device frames for both, as many as the
+  // streams take, which is bound by cb_threshold.
+  stream_avail = cras_frames_at_rate(out_fmt.frame_rate, kBufferFrames / 2,
+                                     in_fmt.frame_rate);
+  nread = dev_stream_capture(dev_streams[0], area, 0, 1.0f);
+  EXPECT_EQ(stream_avail, nread);
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ((uint8_t*)cap_buf, conv_frames_call.in_buf);
+  EXPECT_EQ(stream_area, copy_area_call.dst);
+  EXPECT_EQ(conv_areas[0], copy_area_call.src);
+
+  // The second one only copies them.
+  nread = dev_stream_capture(dev_streams[1], area, 0, 1.0f);
+  EXPECT_EQ(stream_avail, nread);
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(stream_area2, copy_area_call.dst);
+  EXPECT_EQ(conv_areas[1], copy_area_call.src);
+  EXPECT_EQ(dev_streams[0]->shared_read, dev_streams[1]->shared_read);
+
+  dev_stream_destroy(dev_streams[0]);
+  dev_stream_destroy(dev_streams[1]);
+  free(stream_area2);
+  free(rstream2.shm->header);
+  free(rstream2.shm->samples);
+  free(rstream2.shm);
+}
+
+TEST_F(CreateSuite, PlaybackDevicesShareConverter) {
+  struct dev_stream* dev_streams[2];
+  struct cras_audio_format fmt;
+  unsigned int out_frames = cras_frames_at_rate(44100, 100, 48000);
+
+  rstream_.direction = CRAS_STREAM_OUTPUT;
+  rstream_.format = fmt_s16le_44_1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  cras_fmt_conversion_needed_val = 1;
+  cras_fmt_conv_resampling_val = 1;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+
+  // A single device converts through its own converter.
+  dev_streams[0] =
+      dev_stream_create(&rstream_, 1, &fmt_s16le_48, (void*)0x55, &cb_ts, NULL);
+  EXPECT_EQ(1, config_format_converter_called);
+  ASSERT_NE((void*)NULL, dev_streams[0]->play_conv);
+  dev_streams[1] =
+      dev_stream_create(&rstream_, 2, &fmt_s16le_48, (void*)0x56, &cb_ts, NULL);
+  // One converter for each device, and the one they share.
+  EXPECT_EQ(3, config_format_converter_called);
+  EXPECT_EQ(dev_streams[0]->play_conv, dev_streams[1]->play_conv);
+
+  rstream_playable_frames_ret = 100;
+  rstream_get_readable_num = 100;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(out_frames, dev_stream_playback_frames(dev_streams[0]));
+
+  // The first device converts the stream frames for both.
+  EXPECT_EQ(out_frames, dev_stream_mix(dev_streams[0], &fmt, (uint8_t*)0x5000,
+                                       out_frames));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_NE(dev_streams[0]->conv_buffer->bytes, conv_frames_call.out_buf);
+  EXPECT_EQ(out_frames, dev_stream_playback_frames(dev_streams[1]));
+
+  // The second one mixes the same frames.
+  EXPECT_EQ(out_frames, dev_stream_mix(dev_streams[1], &fmt, (uint8_t*)0x5000,
+                                       out_frames));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(dev_streams[0]->play_read, dev_streams[1]->play_read);
+  EXPECT_EQ(100, dev_streams[1]->play_in);
+
+  // Once its clock drifts the second device converts on its own.
+  dev_stream_set_dev_rate(dev_streams[1], 48000, 1.01, 1.0, 0);
+  EXPECT_EQ((void*)NULL, dev_streams[1]->play_conv);
+  EXPECT_EQ(out_frames, dev_stream_mix(dev_streams[1], &fmt, (uint8_t*)0x5000,
+                                       out_frames));
+  EXPECT_EQ(2, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(dev_streams[1]->conv_buffer->bytes, conv_frames_call.out_buf);
+
+  dev_stream_destroy(dev_streams[0]);
+  dev_stream_destroy(dev_streams[1]);
+}
+
+TEST_F(CreateSuite, StreamsOfOneFormatShareSubmix) {
+  struct cras_rstream rstream2;
+  struct dev_stream* dev_streams[2];
+  struct cras_audio_format fmt;
+  unsigned int out_frames = cras_frames_at_rate(44100, 100, 48000);
+
+  rstream_.direction = CRAS_STREAM_OUTPUT;
+  rstream_.format = fmt_s16le_44_1;
+  rstream_.main_dev.dev_id = 1;
+  rstream2 = rstream_;
+  rstream2.stream_id = rstream_.stream_id + 1;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  cras_fmt_conversion_needed_val = 1;
+  cras_fmt_conv_resampling_val = 1;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+
+  dev_streams[0] =
+      dev_stream_create(&rstream_, 1, &fmt_s16le_48, (void*)0x55, &cb_ts, NULL);
+  EXPECT_FALSE(dev_stream_can_submix(dev_streams[0]));
+  dev_streams[1] =
+      dev_stream_create(&rstream2, 1, &fmt_s16le_48, (void*)0x55, &cb_ts, NULL);
+  // One converter for each stream, and the one of their group.
+  EXPECT_EQ(3, config_format_converter_called);
+  EXPECT_EQ(dev_streams[0]->mix_group, dev_streams[1]->mix_group);
+  EXPECT_TRUE(dev_stream_can_submix(dev_streams[0]));
+  EXPECT_TRUE(dev_stream_can_submix(dev_streams[1]));
+
+  rstream_playable_frames_ret = 100;
+  rstream_get_readable_num = 100;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+
+  // The stream frames are summed, then converted once for both.
+  EXPECT_EQ(out_frames,
+            dev_stream_mix_submix(dev_streams, 2, &fmt, (uint8_t*)0x5000,
+                                  NULL, 0, out_frames, 1));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(100, conv_frames_call.in_frames);
+  EXPECT_NE(dev_streams[0]->conv_buffer->bytes, conv_frames_call.out_buf);
+  EXPECT_EQ((int16_t*)0x5000, mix_add_call.dst);
+  EXPECT_EQ(out_frames * 2, mix_add_call.count);
+  EXPECT_EQ(1.0f, mix_add_call.mix_vol);
+  EXPECT_EQ(out_frames, dev_streams[0]->submix_frames);
+  EXPECT_EQ(out_frames, dev_streams[1]->submix_frames);
+
+  // A stream following another device's clock is mixed alone.
+  rstream2.main_dev.dev_id = 2;
+  EXPECT_FALSE(dev_stream_can_submix(dev_streams[1]));
+  rstream2.main_dev.dev_id = 1;
+
+  // The group converter goes with the second stream.
+  dev_stream_destroy(dev_streams[1]);
+  EXPECT_FALSE(dev_stream_can_submix(dev_streams[0]));
+  dev_stream_destroy(dev_streams[0]);
+}
+
+TEST_F(CreateSuite, ShedStreamResamplesAtLowQuality) {
+  struct dev_stream* dev_stream;
+
+  rstream_.direction = CRAS_STREAM_OUTPUT;
+  rstream_.format = fmt_s16le_44_1;
+  rstream_.stream_type = CRAS_STREAM_TYPE_PRO_AUDIO;
+  cras_fmt_conversion_needed_val = 1;
+  cras_fmt_conv_resampling_val = 1;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream =
+      dev_stream_create(&rstream_, 1, &fmt_s16le_48, (void*)0x55, &cb_ts, NULL);
+  EXPECT_EQ(1, config_format_converter_called);
+
+  dev_stream_set_shed(dev_stream, 1);
+  EXPECT_EQ(2, config_format_converter_called);
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_LOW, config_format_converter_quality);
+  dev_stream_set_shed(dev_stream, 1);
+  EXPECT_EQ(2, config_format_converter_called);
+
+  dev_stream_set_shed(dev_stream, 0);
+  EXPECT_EQ(3, config_format_converter_called);
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_HIGH, config_format_converter_quality);
+
+  // Nothing to rebuild without resampling.
+  cras_fmt_conv_resampling_val = 0;
+  dev_stream_set_shed(dev_stream, 1);
+  EXPECT_EQ(3, config_format_converter_called);
+  EXPECT_EQ(1, dev_stream->shed);
+
+  dev_stream_destroy(dev_stream);
+}
+
+TEST_F(CreateSuite, CaptureSilenceSkipsConverter) {
+  int16_t* shm_samples = (int16_t*)rstream_.shm->samples;
+  unsigned int out_frames;
+  unsigned int nread;
+
+  SetUpFmtConv(48000, 44100, kBufferFrames * 2);
+  nread = dev_stream_capture_silence(&devstr, 480, 1.0f);
+
+  // Zeros are written for the device frames without converting them.
+  out_frames = cras_frames_at_rate(48000, 480, 44100);
+  EXPECT_EQ(480, nread);
+  EXPECT_EQ(0, cras_fmt_conv_convert_frames_called);
+  for (unsigned int i = 0; i < out_frames * 2; i++)
+    ASSERT_EQ(0, shm_samples[i]);
+  EXPECT_EQ(out_frames * 2, shm_samples[out_frames * 2]);
+
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
 TEST_F(CreateSuite, SetDevRateNotMainDev) {
   struct dev_stream* dev_stream;
   unsigned int dev_id = 9;
@@ -613,11 +983,35 @@ TEST_F(CreateSuite, SetDevRateMainDev) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, SetMasterRate) {
+  struct dev_stream* dev_stream;
+  unsigned int dev_id = 9;
+  unsigned int expected_ts_nsec;
+
+  rstream_.format = fmt_s16le_48;
+  rstream_.direction = CRAS_STREAM_INPUT;
+  rstream_.main_dev.dev_id = dev_id;
+  config_format_converter_conv = reinterpret_cast<struct cras_fmt_conv*>(0x33);
+  dev_stream = dev_stream_create(&rstream_, dev_id, &fmt_s16le_44_1,
+                                 (void*)0x55, &cb_ts, NULL);
+
+  // Resampled even on the main device, and paced by the master clock.
+  dev_stream_set_master_rate(dev_stream, 44100, 1.01, 1.0, 0);
+  EXPECT_EQ(1, cras_fmt_conv_set_linear_resample_rates_called);
+  EXPECT_EQ(44100, cras_fmt_conv_set_linear_resample_rates_from);
+  EXPECT_EQ(44541, cras_fmt_conv_set_linear_resample_rates_to);
+  expected_ts_nsec = 1000000000.0 * kBufferFrames / 2.0 / 48000.0;
+  EXPECT_EQ(0, rstream_.sleep_interval_ts.tv_sec);
+  EXPECT_EQ(expected_ts_nsec, rstream_.sleep_interval_ts.tv_nsec);
+  dev_stream_destroy(dev_stream);
+}
+
 TEST_F(CreateSuite, StreamMixNoFrames) {
   struct dev_stream dev_stream;
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
+  dev_stream.play_conv = NULL;
   rstream_playable_frames_ret = 0;
   fmt.num_channels = 2;
   fmt.format = SND_PCM_FORMAT_S16_LE;
@@ -630,21 +1024,50 @@ TEST_F(CreateSuite, StreamMixNoConv) {
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
+  dev_stream.play_conv = NULL;
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
   rstream_get_readable_num = nfr;
-  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
   rstream_get_readable_call.num_called = 0;
   fmt.num_channels = 2;
   fmt.format = SND_PCM_FORMAT_S16_LE;
   EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
   EXPECT_EQ((int16_t*)0x5000, mix_add_call.dst);
-  EXPECT_EQ((int16_t*)0x4000, mix_add_call.src);
+  EXPECT_EQ(rstream_readable_samples, mix_add_call.src);
   EXPECT_EQ(200, mix_add_call.count);
   EXPECT_EQ(1, mix_add_call.index);
   EXPECT_EQ(dev_stream.stream, rstream_get_readable_call.rstream);
   EXPECT_EQ(0, rstream_get_readable_call.offset);
   EXPECT_EQ(1, rstream_get_readable_call.num_called);
+  // The stream samples are offered to loopback taps as they are mixed.
+  EXPECT_EQ(1, loopback_tap_mix_stream_called);
+  EXPECT_EQ((uint8_t*)rstream_readable_samples,
+            loopback_tap_mix_stream_frames);
+  EXPECT_EQ(nfr, loopback_tap_mix_stream_nframes);
+}
+
+TEST_F(CreateSuite, StreamCopyNoConv) {
+  struct dev_stream dev_stream;
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  dev_stream.conv = NULL;
+  dev_stream.play_conv = NULL;
+  dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  rstream_get_readable_call.num_called = 0;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(nfr, dev_stream_copy(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ((int16_t*)0x5000, mix_add_call.dst);
+  EXPECT_EQ(rstream_readable_samples, mix_add_call.src);
+  EXPECT_EQ(200, mix_add_call.count);
+  // Index 0 overwrites the destination instead of summing into it.
+  EXPECT_EQ(0, mix_add_call.index);
+  EXPECT_EQ(1, rstream_get_readable_call.num_called);
 }
 
 TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
@@ -656,17 +1079,18 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   struct cras_audio_format fmt;
 
   dev_stream.conv = NULL;
+  dev_stream.play_conv = NULL;
   dev_stream.stream = reinterpret_cast<cras_rstream*>(0x5446);
   rstream_playable_frames_ret = nfr;
   rstream_get_readable_num = nfr / 2;
-  rstream_get_readable_ptr = reinterpret_cast<uint8_t*>(0x4000);
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
   rstream_get_readable_call.num_called = 0;
   fmt.num_channels = 2;
   fmt.format = SND_PCM_FORMAT_S16_LE;
   EXPECT_EQ(nfr, dev_stream_mix(&dev_stream, &fmt, (uint8_t*)0x5000, nfr));
   const unsigned int half_offset = nfr / 2 * bytes_per_frame;
   EXPECT_EQ((int16_t*)(0x5000 + half_offset), mix_add_call.dst);
-  EXPECT_EQ((int16_t*)0x4000, mix_add_call.src);
+  EXPECT_EQ(rstream_readable_samples, mix_add_call.src);
   EXPECT_EQ(nfr / 2 * num_channels, mix_add_call.count);
   EXPECT_EQ(1, mix_add_call.index);
   EXPECT_EQ(dev_stream.stream, rstream_get_readable_call.rstream);
@@ -674,6 +1098,119 @@ TEST_F(CreateSuite, StreamMixNoConvTwoPass) {
   EXPECT_EQ(2, rstream_get_readable_call.num_called);
 }
 
+TEST_F(CreateSuite, StreamMixMutedSkipsConv) {
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  SetUpFmtConv(48000, 48000, kBufferFrames);
+  cras_rstream_get_mute_ret = 1;
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(nfr, dev_stream_mix(&devstr, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(0, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(200, mix_add_call.count);
+  EXPECT_EQ(1, mix_add_call.mute);
+  EXPECT_EQ(1, loopback_tap_mix_stream_mute);
+
+  // No volume is the same as muted.
+  cras_rstream_get_mute_ret = 0;
+  cras_rstream_get_volume_scaler_ret = 0.0f;
+  EXPECT_EQ(nfr, dev_stream_mix(&devstr, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(0, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(1, mix_add_call.mute);
+
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
+TEST_F(CreateSuite, StreamMixSilenceSkipsConv) {
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  SetUpFmtConv(48000, 48000, kBufferFrames);
+  memset(rstream_readable_samples, 0, nfr * 4);
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(nfr, dev_stream_mix(&devstr, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(0, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(200, mix_add_call.count);
+  EXPECT_EQ(1, mix_add_call.mute);
+
+  // Only the frames mixed are checked, audio after them converts later.
+  rstream_get_readable_num = nfr + 1;
+  EXPECT_EQ(nfr, dev_stream_mix(&devstr, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(0, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(1, mix_add_call.mute);
+
+  rstream_readable_samples[5] = 1;
+  EXPECT_EQ(nfr, dev_stream_mix(&devstr, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(0, mix_add_call.mute);
+
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
+TEST_F(CreateSuite, StreamMixSilenceStillResamples) {
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+
+  // The resampler sees every frame to keep its state, only the mix of the
+  // converted silence is skipped.
+  SetUpFmtConv(44100, 48000, kBufferFrames);
+  cras_fmt_conv_resampling_val = 1;
+  cras_rstream_get_mute_ret = 1;
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(nfr, dev_stream_mix(&devstr, &fmt, (uint8_t*)0x5000, nfr));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ((uint8_t*)rstream_readable_samples, conv_frames_call.in_buf);
+  EXPECT_EQ(1, mix_add_call.mute);
+
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
+TEST_F(CreateSuite, StreamMixBusFloatSkipsConv) {
+  const unsigned int nfr = 100;
+  struct cras_audio_format fmt;
+  struct mix_bus* bus = mix_bus_create(2, nfr);
+
+  // A float stream only changing format for the device goes on the float
+  // bus as it is.
+  SetUpFmtConv(48000, 48000, kBufferFrames);
+  rstream_.format.format = SND_PCM_FORMAT_FLOAT_LE;
+  rstream_playable_frames_ret = nfr;
+  rstream_get_readable_num = nfr;
+  rstream_get_readable_ptr = (uint8_t*)rstream_readable_samples;
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  EXPECT_EQ(nfr, dev_stream_mix_bus(&devstr, &fmt, bus, 0, nfr, 1));
+  EXPECT_EQ(0, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(SND_PCM_FORMAT_FLOAT_LE, mix_add_planar_fmt);
+  EXPECT_EQ((uint8_t*)rstream_readable_samples, mix_add_planar_src);
+  EXPECT_EQ(nfr, mix_add_planar_frames);
+
+  // Resampling still goes through the converter.
+  cras_fmt_conv_resampling_val = 1;
+  EXPECT_EQ(nfr, dev_stream_mix_bus(&devstr, &fmt, bus, 0, nfr, 1));
+  EXPECT_EQ(1, cras_fmt_conv_convert_frames_called);
+  EXPECT_EQ(SND_PCM_FORMAT_S16_LE, mix_add_planar_fmt);
+
+  mix_bus_destroy(&bus);
+  free(devstr.conv_area);
+  byte_buffer_destroy(&devstr.conv_buffer);
+}
+
 TEST_F(CreateSuite, DevStreamFlushAudioMessages) {
   struct dev_stream* dev_stream;
   unsigned int dev_id = 9;
@@ -924,7 +1461,7 @@ TEST_F(CreateSuite, InputDevStreamWakeTimeByNextCbTs) {
   written_frames = rstream_.cb_threshold + 10;
   cras_shm_buffer_written(rstream_.shm, written_frames);
 
-  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp,
+  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp, 1.0,
                             rstream_.cb_threshold, 0, &wake_time_out);
 
   // The next wake up time is determined by next_cb_ts on dev_stream.
@@ -985,7 +1522,7 @@ TEST_F(CreateSuite, InputDevStreamWakeTimeByDevice) {
   out_fmt.frame_rate = 44100;
   in_fmt.frame_rate = 48000;
 
-  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp,
+  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp, 1.0,
                             rstream_.cb_threshold, 0, &wake_time_out);
 
   // The next wake up time is determined by needed time for device level
@@ -997,7 +1534,7 @@ TEST_F(CreateSuite, InputDevStreamWakeTimeByDevice) {
   // Assume current level is larger than cb_threshold.
   // The wake up time is determined by next_cb_ts.
   curr_level += rstream_.cb_threshold;
-  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp,
+  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp, 1.0,
                             rstream_.cb_threshold, 0, &wake_time_out);
   EXPECT_EQ(rstream_.next_cb_ts.tv_sec, wake_time_out.tv_sec);
   EXPECT_EQ(rstream_.next_cb_ts.tv_nsec, wake_time_out.tv_nsec);
@@ -1005,6 +1542,38 @@ TEST_F(CreateSuite, InputDevStreamWakeTimeByDevice) {
   dev_stream_destroy(dev_stream);
 }
 
+TEST_F(CreateSuite, InputDevStreamWakeTimeFollowsEstimatedRate) {
+  struct dev_stream* dev_stream;
+  unsigned int dev_id = 9;
+  int rc;
+  unsigned int curr_level = 100;
+  struct timespec level_tstamp = {.tv_sec = 1, .tv_nsec = 0};
+  struct timespec wake_time_out = {.tv_sec = 0, .tv_nsec = 0};
+  struct timespec expected_tstamp = level_tstamp;
+  struct timespec needed_time_for_device;
+
+  rstream_.direction = CRAS_STREAM_INPUT;
+  dev_stream = dev_stream_create(&rstream_, dev_id, &fmt_s16le_48, (void*)0x55,
+                                 &cb_ts, NULL);
+  rstream_.next_cb_ts.tv_sec = 1;
+  rstream_.next_cb_ts.tv_nsec = 0;
+  out_fmt.frame_rate = 48000;
+  in_fmt.frame_rate = 48000;
+
+  // The device captures 1% slower than its nominal 48000, so the 412 frames
+  // still needed take longer to arrive.
+  cras_frames_to_time_precise(rstream_.cb_threshold - curr_level,
+                              48000 * 0.99, &needed_time_for_device);
+  add_timespecs(&expected_tstamp, &needed_time_for_device);
+
+  rc = dev_stream_wake_time(dev_stream, curr_level, &level_tstamp, 0.99,
+                            rstream_.cb_threshold, 0, &wake_time_out);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(expected_tstamp.tv_sec, wake_time_out.tv_sec);
+  EXPECT_EQ(expected_tstamp.tv_nsec, wake_time_out.tv_nsec);
+  dev_stream_destroy(dev_stream);
+}
+
 TEST_F(CreateSuite, UpdateNextWakeTime) {
   struct dev_stream* dev_stream;
   unsigned int dev_id = 9;
@@ -1165,7 +1734,7 @@ unsigned int cras_rstream_playable_frames(struct cras_rstream* rstream,
 }
 
 float cras_rstream_get_volume_scaler(struct cras_rstream* rstream) {
-  return 1.0;
+  return cras_rstream_get_volume_scaler_ret;
 }
 
 uint8_t* cras_rstream_get_readable_frames(struct cras_rstream* rstream,
@@ -1179,7 +1748,7 @@ uint8_t* cras_rstream_get_readable_frames(struct cras_rstream* rstream,
 }
 
 int cras_rstream_get_mute(const struct cras_rstream* rstream) {
-  return 0;
+  return cras_rstream_get_mute_ret;
 }
 void cras_rstream_update_queued_frames(struct cras_rstream* rstream) {}
 
@@ -1198,22 +1767,27 @@ int config_format_converter(struct cras_fmt_conv** conv,
                             enum CRAS_STREAM_DIRECTION dir,
                             const struct cras_audio_format* from,
                             const struct cras_audio_format* to,
-                            unsigned int frames) {
+                            unsigned int frames,
+                            enum CRAS_RESAMPLER_QUALITY quality) {
   config_format_converter_called++;
   config_format_converter_from_fmt = from;
   config_format_converter_frames = frames;
+  config_format_converter_quality = quality;
   *conv = config_format_converter_conv;
   return 0;
 }
 
-void cras_fmt_conv_destroy(struct cras_fmt_conv* conv) {}
+void cras_fmt_conv_destroy(struct cras_fmt_conv** conv) {
+  *conv = NULL;
+}
 
 size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv* conv,
-                                    uint8_t* in_buf,
+                                    const uint8_t* in_buf,
                                     uint8_t* out_buf,
                                     unsigned int* in_frames,
-                                    unsigned int out_frames) {
+                                    size_t out_frames) {
   unsigned int ret;
+  cras_fmt_conv_convert_frames_called++;
   conv_frames_call.conv = conv;
   conv_frames_call.in_buf = in_buf;
   conv_frames_call.out_buf = out_buf;
@@ -1229,6 +1803,20 @@ size_t cras_fmt_conv_convert_frames(struct cras_fmt_conv* conv,
   return ret;
 }
 
+int cras_mix_add_planar(snd_pcm_format_t fmt,
+                        float* const* dst,
+                        const uint8_t* src,
+                        unsigned int num_channels,
+                        unsigned int frames,
+                        unsigned int index,
+                        int mute,
+                        float mix_vol) {
+  mix_add_planar_fmt = fmt;
+  mix_add_planar_src = src;
+  mix_add_planar_frames += frames;
+  return 0;
+}
+
 void cras_mix_add(snd_pcm_format_t fmt,
                   uint8_t* dst,
                   uint8_t* src,
@@ -1244,12 +1832,32 @@ void cras_mix_add(snd_pcm_format_t fmt,
   mix_add_call.mix_vol = mix_vol;
 }
 
+static void mix_add_s16_le(uint8_t* dst,
+                           uint8_t* src,
+                           unsigned int count,
+                           unsigned int index,
+                           int mute,
+                           float mix_vol) {
+  cras_mix_add(SND_PCM_FORMAT_S16_LE, dst, src, count, index, mute, mix_vol);
+}
+
+cras_mix_add_func cras_mix_get_add(snd_pcm_format_t fmt) {
+  return mix_add_s16_le;
+}
+
 struct cras_audio_area* cras_audio_area_create(int num_channels) {
+  struct cras_audio_area* area;
+
   cras_audio_area_create_num_channels_val = num_channels;
-  return NULL;
+  area = (struct cras_audio_area*)calloc(
+      1, sizeof(*area) + num_channels * sizeof(struct cras_channel_area));
+  area->num_channels = num_channels;
+  return area;
 }
 
-void cras_audio_area_destroy(struct cras_audio_area* area) {}
+void cras_audio_area_destroy(struct cras_audio_area* area) {
+  free(area);
+}
 
 void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
                                          const struct cras_audio_format* fmt,
@@ -1297,6 +1905,22 @@ int cras_fmt_conversion_needed(const struct cras_fmt_conv* conv) {
   return cras_fmt_conversion_needed_val;
 }
 
+int cras_fmt_conv_resampling(const struct cras_fmt_conv* conv) {
+  return cras_fmt_conv_resampling_val;
+}
+
+int cras_fmt_conv_format_only(const struct cras_fmt_conv* conv) {
+  return !cras_fmt_conv_resampling_val;
+}
+
+size_t cras_fmt_conv_delay_frames(const struct cras_fmt_conv* conv) {
+  return cras_fmt_conv_delay_frames_val;
+}
+
+float cras_fmt_conv_set_gain(struct cras_fmt_conv* conv, float gain) {
+  return gain;
+}
+
 void cras_fmt_conv_set_linear_resample_rates(struct cras_fmt_conv* conv,
                                              float from,
                                              float to) {
@@ -1319,6 +1943,24 @@ int cras_server_metrics_missed_cb_event(struct cras_rstream* stream) {
   return 0;
 }
 
+void loopback_tap_mix_stream(unsigned int dev_idx,
+                             const struct cras_rstream* stream,
+                             const struct cras_audio_format* fmt,
+                             uint8_t* frames,
+                             unsigned int nframes,
+                             int mute,
+                             float mix_vol) {
+  loopback_tap_mix_stream_called++;
+  loopback_tap_mix_stream_frames = frames;
+  loopback_tap_mix_stream_nframes = nframes;
+  loopback_tap_mix_stream_mute = mute;
+}
+
+bool loopback_tap_keeps_stream(unsigned int dev_idx,
+                               const struct cras_rstream* stream) {
+  return false;
+}
+
 //  From librt.
 int clock_gettime(clockid_t clk_id, struct timespec* tp) {
   tp->tv_sec = clock_gettime_retspec.tv_sec;
@@ -5,12 +5,18 @@
 #include <gtest/gtest.h>
 #include <math.h>
 
+#include <vector>
+
+#include "beamform.h"
 #include "crossover.h"
 #include "crossover2.h"
+#include "dcblock.h"
 #include "drc.h"
 #include "dsp_util.h"
+#include "echo_delay.h"
 #include "eq.h"
 #include "eq2.h"
+#include "fir.h"
 
 namespace {
 
@@ -95,6 +101,198 @@ TEST(InterleaveTest, All) {
   }
 }
 
+/* Returns sample i of a pattern that covers the whole range of format,
+ * stored in the first bytes of out, and its value as a float. */
+static float make_sample(snd_pcm_format_t format, int i, uint8_t* out) {
+  uint32_t x = (uint32_t)i * 2654435761u;
+  int16_t s16;
+  int32_t s32;
+
+  switch (format) {
+    case SND_PCM_FORMAT_S16_LE:
+      s16 = x >> 16;
+      memcpy(out, &s16, 2);
+      return s16 / 32768.0f;
+    case SND_PCM_FORMAT_S24_LE:
+      s32 = x & 0x00ffffff;
+      memcpy(out, &s32, 4);
+      return (int32_t)(x << 8) / 2147483648.0f;
+    case SND_PCM_FORMAT_S24_3LE:
+      memcpy(out, &x, 3);
+      return (int32_t)(x << 8) / 2147483648.0f;
+    default:
+      /* Floats hold 24 significant bits. */
+      s32 = x & 0xffffff00;
+      memcpy(out, &s32, 4);
+      return s32 / 2147483648.0f;
+  }
+}
+
+static int sample_size(snd_pcm_format_t format) {
+  switch (format) {
+    case SND_PCM_FORMAT_S16_LE:
+      return 2;
+    case SND_PCM_FORMAT_S24_3LE:
+      return 3;
+    default:
+      return 4;
+  }
+}
+
+TEST(InterleaveTest, MultichannelRoundTrip) {
+  const snd_pcm_format_t formats[] = {
+      SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S24_3LE,
+      SND_PCM_FORMAT_S32_LE};
+  /* Spans several blocks and leaves a partial vector at the end. */
+  const int FRAMES = 303;
+
+  for (snd_pcm_format_t format : formats) {
+    int size = sample_size(format);
+    for (int channels = 1; channels <= 8; channels++) {
+      std::vector<uint8_t> input(FRAMES * channels * size);
+      std::vector<uint8_t> output(input.size());
+      std::vector<float> expected(FRAMES * channels);
+      std::vector<float> planes(FRAMES * channels);
+      std::vector<float*> ptrs(channels);
+
+      for (int i = 0; i < FRAMES * channels; i++)
+        expected[i] = make_sample(format, i, &input[i * size]);
+      for (int c = 0; c < channels; c++)
+        ptrs[c] = &planes[c * FRAMES];
+
+      ASSERT_EQ(0, dsp_util_deinterleave(input.data(), ptrs.data(), channels,
+                                         format, FRAMES));
+      for (int i = 0; i < FRAMES; i++)
+        for (int c = 0; c < channels; c++)
+          ASSERT_EQ(expected[i * channels + c], ptrs[c][i])
+              << "format " << format << " channels " << channels;
+
+      ASSERT_EQ(0, dsp_util_interleave(ptrs.data(), output.data(), channels,
+                                       format, FRAMES));
+      EXPECT_EQ(input, output)
+          << "format " << format << " channels " << channels;
+    }
+  }
+}
+
+TEST(InterleaveTest, Saturation) {
+  const int FRAMES = 7;
+  const int CHANNELS = 4;
+  const float in[FRAMES] = {1.0f, -1.0f, 2.0f, -2.0f, 1e10f, -1e10f, 0.5f};
+  float planes[CHANNELS][FRAMES];
+  float* ptrs[CHANNELS];
+  int16_t s16[FRAMES * CHANNELS];
+  int32_t s32[FRAMES * CHANNELS];
+  uint8_t s243[FRAMES * CHANNELS * 3];
+
+  for (int c = 0; c < CHANNELS; c++) {
+    memcpy(planes[c], in, sizeof(in));
+    ptrs[c] = planes[c];
+  }
+
+  dsp_util_interleave(ptrs, (uint8_t*)s16, CHANNELS, SND_PCM_FORMAT_S16_LE,
+                      FRAMES);
+  for (int c = 0; c < CHANNELS; c++) {
+    EXPECT_EQ(32767, s16[0 * CHANNELS + c]);
+    EXPECT_EQ(-32768, s16[1 * CHANNELS + c]);
+    EXPECT_EQ(32767, s16[4 * CHANNELS + c]);
+    EXPECT_EQ(-32768, s16[5 * CHANNELS + c]);
+    EXPECT_EQ(16384, s16[6 * CHANNELS + c]);
+  }
+
+  dsp_util_interleave(ptrs, (uint8_t*)s32, CHANNELS, SND_PCM_FORMAT_S32_LE,
+                      FRAMES);
+  for (int c = 0; c < CHANNELS; c++) {
+    EXPECT_EQ(INT32_MAX, s32[0 * CHANNELS + c]);
+    EXPECT_EQ(INT32_MIN, s32[1 * CHANNELS + c]);
+    EXPECT_EQ(INT32_MAX, s32[2 * CHANNELS + c]);
+    EXPECT_EQ(INT32_MIN, s32[3 * CHANNELS + c]);
+    EXPECT_EQ(INT32_MAX, s32[4 * CHANNELS + c]);
+    EXPECT_EQ(INT32_MIN, s32[5 * CHANNELS + c]);
+    EXPECT_EQ(1 << 30, s32[6 * CHANNELS + c]);
+  }
+
+  dsp_util_interleave(ptrs, (uint8_t*)s32, CHANNELS, SND_PCM_FORMAT_S24_LE,
+                      FRAMES);
+  for (int c = 0; c < CHANNELS; c++) {
+    EXPECT_EQ(0x7fffff, s32[0 * CHANNELS + c]);
+    EXPECT_EQ(0x800000, s32[1 * CHANNELS + c]);
+    EXPECT_EQ(0x7fffff, s32[2 * CHANNELS + c]);
+    EXPECT_EQ(0x800000, s32[3 * CHANNELS + c]);
+    EXPECT_EQ(0x400000, s32[6 * CHANNELS + c]);
+  }
+
+  dsp_util_interleave(ptrs, s243, CHANNELS, SND_PCM_FORMAT_S24_3LE, FRAMES);
+  for (int c = 0; c < CHANNELS; c++) {
+    uint8_t* p = &s243[(0 * CHANNELS + c) * 3];
+    EXPECT_EQ(0xff, p[0]);
+    EXPECT_EQ(0xff, p[1]);
+    EXPECT_EQ(0x7f, p[2]);
+    p = &s243[(1 * CHANNELS + c) * 3];
+    EXPECT_EQ(0x00, p[0]);
+    EXPECT_EQ(0x00, p[1]);
+    EXPECT_EQ(0x80, p[2]);
+  }
+}
+
+TEST(StereoPlanesTest, InPlace) {
+  /* Leaves a partial vector at the end. */
+  const int FRAMES = 11;
+  float l[FRAMES], r[FRAMES];
+
+  for (int i = 0; i < FRAMES; i++) {
+    l[i] = i;
+    r[i] = 100 + i;
+  }
+  dsp_util_swap_stereo(l, r, l, r, FRAMES);
+  for (int i = 0; i < FRAMES; i++) {
+    ASSERT_EQ(100 + i, l[i]);
+    ASSERT_EQ(i, r[i]);
+  }
+  dsp_util_invert_left(l, r, l, r, FRAMES);
+  for (int i = 0; i < FRAMES; i++) {
+    ASSERT_EQ(-100 - i, l[i]);
+    ASSERT_EQ(i, r[i]);
+  }
+  dsp_util_mix_stereo(l, r, l, r, FRAMES);
+  for (int i = 0; i < FRAMES; i++) {
+    ASSERT_EQ(-100, l[i]);
+    ASSERT_EQ(-100, r[i]);
+  }
+}
+
+TEST(DcBlockTest, StereoMatchesMono) {
+  const int len = 4000;
+  std::vector<float> l(len), r(len), ref_l, ref_r;
+
+  for (int i = 0; i < len; i++) {
+    l[i] = 0.5f + 0.2f * sinf(i * 0.01f);
+    r[i] = -0.3f + 0.1f * sinf(i * 0.03f);
+  }
+  ref_l = l;
+  ref_r = r;
+
+  struct dcblock* ml = dcblock_new(0.995f, 48000);
+  struct dcblock* mr = dcblock_new(0.995f, 48000);
+  struct dcblock* sl = dcblock_new(0.995f, 48000);
+  struct dcblock* sr = dcblock_new(0.995f, 48000);
+  /* The 20ms ramp ends in the middle of a block. */
+  for (int start = 0; start < len; start += 500) {
+    dcblock_process(ml, &ref_l[start], 500);
+    dcblock_process(mr, &ref_r[start], 500);
+    dcblock_process_stereo(sl, sr, &l[start], &r[start], 500);
+  }
+  for (int i = 0; i < len; i++) {
+    ASSERT_EQ(ref_l[i], l[i]) << "at " << i;
+    ASSERT_EQ(ref_r[i], r[i]) << "at " << i;
+  }
+  EXPECT_NEAR(0, l[len - 1], 0.25f);
+  dcblock_free(ml);
+  dcblock_free(mr);
+  dcblock_free(sl);
+  dcblock_free(sr);
+}
+
 TEST(EqTest, All) {
   struct eq* eq;
   size_t len = 44100;
@@ -229,6 +427,53 @@ TEST(Eq2Test, All) {
   eq2_free(eq2);
 }
 
+TEST(Eq2Test, SetBiquad) {
+  struct eq2* eq2;
+  size_t len = 44100;
+  float NQ = len / 2;
+  float f_low = 10 / NQ;
+  float f_mid = 100 / NQ;
+  float f_high = 1000 / NQ;
+  float* data0 = (float*)calloc(len, sizeof(float));
+  float* data1 = (float*)calloc(len, sizeof(float));
+  size_t half = len / 2;
+  float max_step = 0;
+
+  dsp_enable_flush_denormal_to_zero();
+
+  add_sine(data0, len, f_low, 0, 1);
+  add_sine(data0, len, f_high, 0, 1);
+  add_sine(data1, len, f_high, 0, 1);
+
+  eq2 = eq2_new();
+  EXPECT_EQ(0, eq2_append_biquad(eq2, 0, BQ_PEAKING, f_mid, 1, 0));
+  EXPECT_EQ(-1, eq2_set_biquad(eq2, 0, 2, BQ_LOWPASS, f_mid, 0, 0));
+  eq2_process(eq2, data0, data1, half);
+
+  /* Turn the left peaking filter into a low pass and add one to the right */
+  EXPECT_EQ(0, eq2_set_biquad(eq2, 0, 0, BQ_LOWPASS, f_mid, 0, 0));
+  EXPECT_EQ(0, eq2_set_biquad(eq2, 1, 0, BQ_HIGHSHELF, f_mid, 0, -6));
+  for (size_t start = half; start < len; start += 100)
+    eq2_process(eq2, data0 + start, data1 + start,
+                std::min((size_t)100, len - start));
+
+  /* No step is much larger than the one of the 1000Hz sine */
+  for (size_t i = half - BIQUAD_INTERP_FRAMES;
+       i < half + 2 * BIQUAD_INTERP_FRAMES; i++)
+    max_step = std::max(max_step, fabsf(data0[i + 1] - data0[i]));
+  EXPECT_LT(max_step, 0.2);
+
+  /* The new filters are in place once the interpolation is done */
+  size_t tail = half - BIQUAD_INTERP_FRAMES;
+  EXPECT_NEAR(1, magnitude_at(data0 + len - tail, tail, f_low), 0.05);
+  EXPECT_NEAR(0, magnitude_at(data0 + len - tail, tail, f_high), 0.05);
+  EXPECT_NEAR(0.5, magnitude_at(data1 + len - tail, tail, f_high), 0.05);
+
+  eq2_free(eq2);
+  free(data0);
+  free(data1);
+}
+
 TEST(CrossoverTest, All) {
   struct crossover xo;
   size_t len = 44100;
@@ -361,7 +606,7 @@ TEST(DrcTest, All) {
   struct drc* drc;
 
   dsp_enable_flush_denormal_to_zero();
-  drc = drc_new(44100);
+  drc = drc_new(44100, 2);
 
   drc_set_param(drc, 0, PARAM_CROSSOVER_LOWER_FREQ, 0);
   drc_set_param(drc, 0, PARAM_ENABLED, 1);
@@ -417,6 +662,23 @@ TEST(DrcTest, All) {
   /* This is 20dB because of the post gain */
   EXPECT_NEAR(10, magnitude_at(data_right, len, f4), 1);
 
+  /* Drop the post gain of the top band while running */
+  drc_set_param(drc, 2, PARAM_POST_GAIN, 0);
+  drc_update(drc);
+  memset(data_right, 0, sizeof(float) * len);
+  add_sine(data_right, len, f4, 0, 1);
+  data[0] = data_left;
+  data[1] = data_right;
+  memset(data_left, 0, sizeof(float) * len);
+  add_sine(data_left, len, f4, 0, 1);
+  for (size_t start = 0; start < len; start += DRC_PROCESS_MAX_FRAMES) {
+    int chunk = std::min(len - start, (size_t)DRC_PROCESS_MAX_FRAMES);
+    drc_process(drc, data, chunk);
+    data[0] += chunk;
+    data[1] += chunk;
+  }
+  EXPECT_NEAR(1, magnitude_at(data_right + len / 2, len / 2, f4), 0.1);
+
   /* Test for empty input */
   drc_process(drc, data_empty, 0);
 
@@ -425,6 +687,252 @@ TEST(DrcTest, All) {
   free(data_right);
 }
 
+static struct drc* new_test_drc(int num_channels) {
+  struct drc* drc = drc_new(44100, num_channels);
+
+  for (int i = 0; i < DRC_NUM_KERNELS; i++) {
+    drc_set_param(drc, i, PARAM_CROSSOVER_LOWER_FREQ, i * 0.02);
+    drc_set_param(drc, i, PARAM_ENABLED, i != 1);
+    drc_set_param(drc, i, PARAM_THRESHOLD, -30);
+    drc_set_param(drc, i, PARAM_RATIO, 3);
+  }
+  drc_init(drc);
+  return drc;
+}
+
+TEST(DrcTest, Multichannel) {
+  size_t len = 4096;
+  std::vector<float> input[2], stereo[2], multi[5];
+  float* data[5];
+  struct drc* drc;
+
+  EXPECT_EQ(NULL, drc_new(44100, 0));
+  EXPECT_EQ(NULL, drc_new(44100, DRC_MAX_CHANNELS + 1));
+
+  dsp_enable_flush_denormal_to_zero();
+  for (int c = 0; c < 2; c++) {
+    input[c].resize(len);
+    add_sine(input[c].data(), len, 0.01 * (c + 1), 0, 1);
+    add_sine(input[c].data(), len, 0.3, 0, 0.5);
+  }
+
+  /* The reference is the stereo DRC */
+  drc = new_test_drc(2);
+  for (int c = 0; c < 2; c++) {
+    stereo[c] = input[c];
+    data[c] = stereo[c].data();
+  }
+  for (size_t start = 0; start < len; start += DRC_PROCESS_MAX_FRAMES) {
+    drc_process(drc, data, DRC_PROCESS_MAX_FRAMES);
+    data[0] += DRC_PROCESS_MAX_FRAMES;
+    data[1] += DRC_PROCESS_MAX_FRAMES;
+  }
+  drc_free(drc);
+
+  /* Channels repeating the stereo input get the same gain and output, with
+   * an even or odd number of channels. */
+  for (int n = 3; n <= 5; n++) {
+    drc = new_test_drc(n);
+    for (int c = 0; c < n; c++) {
+      multi[c] = input[c % 2];
+      data[c] = multi[c].data();
+    }
+    for (size_t start = 0; start < len; start += 1000) {
+      int frames = std::min(len - start, (size_t)1000);
+      drc_process(drc, data, frames);
+      for (int c = 0; c < n; c++)
+        data[c] += frames;
+    }
+    for (int c = 0; c < n; c++)
+      for (size_t i = 0; i < len; i++)
+        ASSERT_FLOAT_EQ(stereo[c % 2][i], multi[c][i])
+            << "channels " << n << " channel " << c << " frame " << i;
+    drc_free(drc);
+  }
+}
+
+TEST(FirTest, MatchesDirectConvolution) {
+  const int ir_len = 1500;
+  const int len = 8000;
+  const int block = 64;
+  float* ir = (float*)malloc(sizeof(float) * ir_len);
+  float* input = (float*)malloc(sizeof(float) * len);
+  float* data = (float*)malloc(sizeof(float) * len);
+  struct fir* fir;
+
+  srand(1);
+  for (int i = 0; i < ir_len; i++)
+    ir[i] = (rand() / (float)RAND_MAX - 0.5f) * expf(-i / 300.0f);
+  for (int i = 0; i < len; i++)
+    input[i] = rand() / (float)RAND_MAX - 0.5f;
+  memcpy(data, input, sizeof(float) * len);
+
+  fir = fir_new(ir, ir_len, block);
+  ASSERT_TRUE(fir);
+  EXPECT_EQ(block, fir_get_delay(fir));
+
+  /* Feed chunks which don't line up with the partitions. */
+  for (int start = 0, chunk = 1; start < len; start += chunk, chunk += 37) {
+    chunk = std::min(chunk, len - start);
+    fir_process(fir, data + start, chunk);
+  }
+
+  /* The output is the convolution delayed by one block. */
+  for (int i = 0; i < block; i++)
+    EXPECT_EQ(0, data[i]);
+  for (int i = block; i < len; i++) {
+    double expected = 0;
+    int n = i - block;
+    for (int j = 0; j < ir_len && j <= n; j++)
+      expected += ir[j] * input[n - j];
+    ASSERT_NEAR(expected, data[i], 1e-4) << "at " << i;
+  }
+
+  fir_free(fir);
+  free(ir);
+  free(input);
+  free(data);
+}
+
+TEST(FirTest, ProcessBlockHasNoDelay) {
+  const int ir_len = 200;
+  const int block = 64;
+  const int len = 8 * block;
+  float ir[ir_len];
+  float input[len];
+  float data[len];
+  struct fir* fir;
+
+  srand(2);
+  for (int i = 0; i < ir_len; i++)
+    ir[i] = rand() / (float)RAND_MAX - 0.5f;
+  for (int i = 0; i < len; i++)
+    input[i] = rand() / (float)RAND_MAX - 0.5f;
+  memcpy(data, input, sizeof(data));
+
+  fir = fir_new(ir, ir_len, block);
+  ASSERT_TRUE(fir);
+  for (int start = 0; start < len; start += block)
+    fir_process_block(fir, data + start);
+
+  for (int i = 0; i < len; i++) {
+    double expected = 0;
+    for (int j = 0; j < ir_len && j <= i; j++)
+      expected += ir[j] * input[i - j];
+    ASSERT_NEAR(expected, data[i], 1e-4) << "at " << i;
+  }
+  fir_free(fir);
+}
+
+TEST(FirTest, InvalidArguments) {
+  float ir[] = {1.0f};
+
+  EXPECT_EQ(NULL, fir_new(ir, 1, 48));
+  EXPECT_EQ(NULL, fir_new(ir, 1, 2));
+  EXPECT_EQ(NULL, fir_new(ir, 0, 64));
+  EXPECT_EQ(NULL, fir_new(NULL, 1, 64));
+}
+
+TEST(BeamformTest, DelayAndSumAcrossChunks) {
+  const int len = 300;
+  const int delays[2][3] = {{0, 5, 70}, {3, 3, 3}};
+  float mic[3][len], beam[2][len];
+  float in_chunk[3][len], out_chunk[2][len];
+  float* in[3];
+  float* out[2];
+  struct beamform* bf;
+
+  srand(3);
+  for (int i = 0; i < 3; i++)
+    for (int n = 0; n < len; n++)
+      mic[i][n] = rand() / (float)RAND_MAX - 0.5f;
+
+  bf = beamform_new(3, 2);
+  ASSERT_TRUE(bf);
+  for (int b = 0; b < 2; b++)
+    for (int i = 0; i < 3; i++)
+      beamform_set_delay(bf, b, i, delays[b][i]);
+  EXPECT_EQ(0, beamform_get_delay(bf));
+
+  /* Chunks shorter and longer than the delays. */
+  for (int start = 0, chunk = 1; start < len; start += chunk, chunk *= 3) {
+    chunk = std::min(chunk, len - start);
+    for (int i = 0; i < 3; i++) {
+      memcpy(in_chunk[i], mic[i] + start, chunk * sizeof(float));
+      in[i] = in_chunk[i];
+    }
+    for (int b = 0; b < 2; b++)
+      out[b] = out_chunk[b];
+    beamform_process(bf, in, out, chunk);
+    for (int b = 0; b < 2; b++)
+      memcpy(beam[b] + start, out_chunk[b], chunk * sizeof(float));
+  }
+
+  for (int b = 0; b < 2; b++) {
+    for (int n = 0; n < len; n++) {
+      float expected = 0;
+      for (int i = 0; i < 3; i++) {
+        /* Delays past the longest are clamped. */
+        int d = std::min(delays[b][i], BEAMFORM_MAX_DELAY);
+        if (n >= d)
+          expected += mic[i][n - d] / 3;
+      }
+      ASSERT_NEAR(expected, beam[b][n], 1e-6) << "beam " << b << " at " << n;
+    }
+  }
+  beamform_free(bf);
+}
+
+/* Noise at rate whose level changes every 50ms like speech, as it was
+ * delay_ms ago. */
+static void fill_echo(float* x, int count, int rate, int start, int delay_ms) {
+  for (int i = 0; i < count; i++) {
+    int ms = (start + i) * 1000 / rate - delay_ms;
+    float level = ms < 0 ? 0 : ((ms / 50) * 7919 % 10) / 10.0f;
+    x[i] = level * (rand() / (float)RAND_MAX - 0.5f);
+  }
+}
+
+TEST(EchoDelayTest, FindsDelayAcrossRates) {
+  float ref[480], cap[160];
+  struct echo_delay* ed;
+
+  srand(5);
+  ed = echo_delay_new();
+  ASSERT_TRUE(ed);
+  EXPECT_EQ(-1, echo_delay_get_ms(ed));
+
+  /* A 48kHz output echoed 120ms later in a 16kHz input, 10ms at a time.
+   * Only the envelopes are alike, the noise differs. */
+  for (int block = 0; block < 600; block++) {
+    fill_echo(ref, 480, 48000, block * 480, 0);
+    fill_echo(cap, 160, 16000, block * 160, 120);
+    echo_delay_add_reference(ed, ref, 480, 48000);
+    echo_delay_add_capture(ed, cap, 160, 16000);
+    echo_delay_update(ed);
+  }
+  EXPECT_NEAR(120, echo_delay_get_ms(ed), 2);
+  echo_delay_free(ed);
+}
+
+TEST(EchoDelayTest, NoEstimateWithoutEcho) {
+  float ref[480], cap[480];
+  struct echo_delay* ed;
+
+  srand(5);
+  ed = echo_delay_new();
+  ASSERT_TRUE(ed);
+  memset(cap, 0, sizeof(cap));
+  for (int block = 0; block < 600; block++) {
+    fill_echo(ref, 480, 48000, block * 480, 0);
+    echo_delay_add_reference(ed, ref, 480, 48000);
+    echo_delay_add_capture(ed, cap, 480, 48000);
+    echo_delay_update(ed);
+  }
+  EXPECT_EQ(-1, echo_delay_get_ms(ed));
+  echo_delay_free(ed);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
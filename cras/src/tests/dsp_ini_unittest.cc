@@ -73,6 +73,91 @@ TEST_F(DspIniTestSuite, OneSimplePlugin) {
   cras_dsp_ini_free(ini);
 }
 
+TEST_F(DspIniTestSuite, ImpulseResponse) {
+  fprintf(fp, "[Test]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=fir\n");
+  fprintf(fp, "impulse_response=/etc/cras/room.ir\n");
+  fprintf(fp, "[Other]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=eq\n");
+  CloseFile();
+
+  struct ini* ini = cras_dsp_ini_create(filename);
+  EXPECT_EQ(2, ARRAY_COUNT(&ini->plugins));
+  struct plugin* plugin = ARRAY_ELEMENT(&ini->plugins, 0);
+  EXPECT_STREQ("/etc/cras/room.ir", plugin->impulse_response);
+  plugin = ARRAY_ELEMENT(&ini->plugins, 1);
+  EXPECT_EQ(NULL, plugin->impulse_response);
+
+  cras_dsp_ini_free(ini);
+}
+
+TEST_F(DspIniTestSuite, FirmwareControl) {
+  fprintf(fp, "[Eq]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=eq2\n");
+  fprintf(fp, "firmware_control=EQIIR1.0 eqiir_coef_1\n");
+  fprintf(fp, "[Other]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=drc\n");
+  CloseFile();
+
+  struct ini* ini = cras_dsp_ini_create(filename);
+  EXPECT_EQ(2, ARRAY_COUNT(&ini->plugins));
+  struct plugin* plugin = ARRAY_ELEMENT(&ini->plugins, 0);
+  EXPECT_STREQ("EQIIR1.0 eqiir_coef_1", plugin->firmware_control);
+  EXPECT_STREQ("firmware:eq", plugin->firmware_var);
+  plugin = ARRAY_ELEMENT(&ini->plugins, 1);
+  EXPECT_EQ(NULL, plugin->firmware_control);
+  EXPECT_EQ(NULL, plugin->firmware_var);
+
+  cras_dsp_ini_free(ini);
+}
+
+TEST_F(DspIniTestSuite, Dependencies) {
+  const plugin_index_array* dependents;
+
+  fprintf(fp, "[Eq]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=eq2\n");
+  fprintf(fp, "disable=(or disable_eq (equal? dsp_name \"x\"))\n");
+  fprintf(fp, "firmware_control=EQIIR\n");
+  fprintf(fp, "[Drc]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=drc\n");
+  fprintf(fp, "disable=(equal? dsp_name \"y\")\n");
+  fprintf(fp, "[Other]\n");
+  fprintf(fp, "library=builtin\n");
+  fprintf(fp, "label=fir\n");
+  CloseFile();
+
+  struct ini* ini = cras_dsp_ini_create(filename);
+  ASSERT_TRUE(ini);
+  EXPECT_TRUE(ARRAY_ELEMENT(&ini->plugins, 0)->disable_prog);
+  EXPECT_FALSE(ARRAY_ELEMENT(&ini->plugins, 2)->disable_prog);
+
+  dependents = cras_dsp_ini_get_dependents(ini, "dsp_name");
+  ASSERT_TRUE(dependents);
+  ASSERT_EQ(2, ARRAY_COUNT(dependents));
+  EXPECT_EQ(0, *ARRAY_ELEMENT(dependents, 0));
+  EXPECT_EQ(1, *ARRAY_ELEMENT(dependents, 1));
+
+  dependents = cras_dsp_ini_get_dependents(ini, "disable_eq");
+  ASSERT_TRUE(dependents);
+  ASSERT_EQ(1, ARRAY_COUNT(dependents));
+  EXPECT_EQ(0, *ARRAY_ELEMENT(dependents, 0));
+
+  dependents = cras_dsp_ini_get_dependents(ini, "firmware:eq");
+  ASSERT_TRUE(dependents);
+  ASSERT_EQ(1, ARRAY_COUNT(dependents));
+  EXPECT_EQ(0, *ARRAY_ELEMENT(dependents, 0));
+
+  EXPECT_EQ(NULL, cras_dsp_ini_get_dependents(ini, "disable_drc"));
+
+  cras_dsp_ini_free(ini);
+}
+
 TEST_F(DspIniTestSuite, BuiltinPlugin) {
   fprintf(fp, "[foo]\n");
   fprintf(fp, "library=builtin\n");
@@ -0,0 +1,173 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <semaphore.h>
+
+extern "C" {
+#include "cras_dsp_offload.h"
+}
+
+namespace {
+
+static struct cras_audio_format fmt = {
+    SND_PCM_FORMAT_S16_LE,
+    48000,
+    1,
+};
+static struct cras_dsp_context* const kCtx =
+    reinterpret_cast<struct cras_dsp_context*>(0x123);
+// Long enough for a loaded machine to schedule the worker, so the tests
+// expecting no late frames don't depend on timing.
+static const unsigned int kLongWaitUs = 10000000;
+// When set, cras_dsp_apply() blocks until it is posted.
+static sem_t* cras_dsp_apply_block;
+
+// Checks that out holds the frames numbered from first, each having been
+// processed once, or is silent before frame 0.
+static void CheckOutput(const int16_t* out,
+                        unsigned int frames,
+                        int first) {
+  for (unsigned int i = 0; i < frames; i++) {
+    int expected = first + (int)i;
+    ASSERT_EQ(expected < 0 ? 0 : expected + 1000, out[i]) << "frame " << i;
+  }
+}
+
+static void Fill(int16_t* buf, unsigned int frames, int first) {
+  for (unsigned int i = 0; i < frames; i++)
+    buf[i] = first + i;
+}
+
+TEST(DspOffload, CreateInvalid) {
+  EXPECT_EQ(NULL, cras_dsp_offload_create(kCtx, &fmt, 0, 480));
+  EXPECT_EQ(NULL, cras_dsp_offload_create(kCtx, &fmt, 480, 0));
+}
+
+TEST(DspOffload, FixedDelayWithEqualBlocks) {
+  struct cras_dsp_offload* offload;
+  int16_t buf[240];
+  int pos = 0;
+
+  cras_dsp_offload_set_max_wait_us(kLongWaitUs);
+  offload = cras_dsp_offload_create(kCtx, &fmt, 240, 240);
+  ASSERT_NE((void*)NULL, offload);
+  EXPECT_EQ(240, cras_dsp_offload_get_latency(offload));
+
+  for (int i = 0; i < 20; i++) {
+    Fill(buf, 240, pos);
+    EXPECT_EQ(0, cras_dsp_offload_apply(offload, (uint8_t*)buf, 240));
+    CheckOutput(buf, 240, pos - 240);
+    pos += 240;
+  }
+  EXPECT_EQ(0, cras_dsp_offload_get_late_frames(offload));
+  cras_dsp_offload_destroy(offload);
+}
+
+TEST(DspOffload, FixedDelayWithVaryingBlocks) {
+  struct cras_dsp_offload* offload;
+  const unsigned int sizes[] = {1, 480, 13, 240, 700, 64, 239, 1000};
+  int16_t buf[1000];
+  int pos = 0;
+
+  cras_dsp_offload_set_max_wait_us(kLongWaitUs);
+  offload = cras_dsp_offload_create(kCtx, &fmt, 256, 480);
+  ASSERT_NE((void*)NULL, offload);
+
+  for (int i = 0; i < 40; i++) {
+    unsigned int frames = sizes[i % 8];
+
+    Fill(buf, frames, pos);
+    EXPECT_EQ(0, cras_dsp_offload_apply(offload, (uint8_t*)buf, frames));
+    // Blocks larger than the latency wait for the worker.
+    CheckOutput(buf, frames, pos - 256);
+    pos += frames;
+  }
+  EXPECT_EQ(0, cras_dsp_offload_get_late_frames(offload));
+  cras_dsp_offload_destroy(offload);
+}
+
+TEST(DspOffload, LateWorkerPlaysSilence) {
+  struct cras_dsp_offload* offload;
+  int16_t buf[480];
+  unsigned int late;
+  sem_t block;
+
+  // The worker is stuck until the audio thread gave up waiting for it.
+  sem_init(&block, 0, 0);
+  cras_dsp_apply_block = &block;
+  cras_dsp_offload_set_max_wait_us(1000);
+  offload = cras_dsp_offload_create(kCtx, &fmt, 120, 480);
+  ASSERT_NE((void*)NULL, offload);
+
+  Fill(buf, 480, 0);
+  EXPECT_EQ(0, cras_dsp_offload_apply(offload, (uint8_t*)buf, 480));
+  // The first 120 frames were the initial silence, the rest is late.
+  for (unsigned int i = 0; i < 480; i++)
+    ASSERT_EQ(0, buf[i]);
+  late = cras_dsp_offload_get_late_frames(offload);
+  EXPECT_EQ(360, late);
+
+  // Once the worker is quick again the delay doesn't change.
+  cras_dsp_apply_block = NULL;
+  sem_post(&block);
+  cras_dsp_offload_set_max_wait_us(kLongWaitUs);
+  for (int pos = 480; pos < 480 * 10; pos += 480) {
+    Fill(buf, 480, pos);
+    EXPECT_EQ(0, cras_dsp_offload_apply(offload, (uint8_t*)buf, 480));
+    CheckOutput(buf, 480, pos - 120);
+  }
+  EXPECT_EQ(late, cras_dsp_offload_get_late_frames(offload));
+  cras_dsp_offload_destroy(offload);
+  sem_destroy(&block);
+}
+
+}  // namespace
+
+extern "C" {
+
+int cras_dsp_apply(struct cras_dsp_context* ctx,
+                   uint8_t* buf,
+                   snd_pcm_format_t format,
+                   unsigned int frames) {
+  int16_t* samples = (int16_t*)buf;
+
+  sem_t* block = cras_dsp_apply_block;
+
+  EXPECT_EQ(kCtx, ctx);
+  if (block)
+    sem_wait(block);
+  for (unsigned int i = 0; i < frames; i++)
+    samples[i] += 1000;
+  return 0;
+}
+
+void cras_dsp_pipeline_release_scratch() {}
+
+int cras_set_rt_scheduling(int rt_lim) {
+  return -1;
+}
+
+int cras_set_thread_priority(int priority) {
+  return 0;
+}
+
+int cras_set_thread_affinity(uint32_t cpu_mask) {
+  return 0;
+}
+
+uint32_t cras_system_get_audio_thread_cpu_mask() {
+  return 0;
+}
+
+int cras_system_get_rt_priority() {
+  return 12;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
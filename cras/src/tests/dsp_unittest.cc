@@ -2,7 +2,10 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+#include <errno.h>
 #include <gtest/gtest.h>
+#include <pthread.h>
+#include <sched.h>
 
 #include "cras_dsp.h"
 #include "cras_dsp_module.h"
@@ -11,6 +14,8 @@
 
 namespace {
 
+static int builtin_modules_loaded;
+
 extern "C" {
 struct dsp_module* cras_dsp_module_load_ladspa(struct plugin* plugin) {
   return NULL;
@@ -96,6 +101,342 @@ TEST_F(DspTestSuite, Simple) {
   cras_dsp_stop();
 }
 
+static const char* kCaptureIni =
+    "[M1]\n"
+    "library=builtin\n"
+    "label=source\n"
+    "purpose=capture\n"
+    "output_0={audio}\n"
+    "[M2]\n"
+    "library=builtin\n"
+    "label=sink\n"
+    "purpose=capture\n"
+    "input_0={audio}\n"
+    "\n";
+
+TEST_F(DspTestSuite, LockPipeline) {
+  fprintf(fp, "%s", kCaptureIni);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(48000, "capture");
+  cras_dsp_load_pipeline(ctx);
+
+  struct pipeline* pipeline = cras_dsp_lock_pipeline(ctx);
+  ASSERT_TRUE(pipeline);
+  /* Nobody else gets the pipeline while it's locked. */
+  EXPECT_EQ(NULL, cras_dsp_get_pipeline(ctx));
+  cras_dsp_unlock_pipeline(ctx);
+  EXPECT_EQ(pipeline, cras_dsp_get_pipeline(ctx));
+  cras_dsp_put_pipeline(ctx);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
+TEST_F(DspTestSuite, SpreadReducedCaptureChannels) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={a0}\n"
+      "output_1={a1}\n"
+      "output_2={a2}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={a1}\n"
+      "\n";
+  int16_t buf[] = {1, 2, 3, 4, 5, 6, 7, 8, 9};
+
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(48000, "capture");
+  cras_dsp_load_pipeline(ctx);
+  ASSERT_EQ(3, cras_dsp_num_input_channels(ctx));
+  ASSERT_EQ(1, cras_dsp_num_output_channels(ctx));
+
+  /* The device keeps its three channels, each with the one output. */
+  EXPECT_EQ(0, cras_dsp_apply(ctx, (uint8_t*)buf, SND_PCM_FORMAT_S16_LE, 3));
+  for (int i = 0; i < 3; i++)
+    for (int c = 0; c < 3; c++)
+      EXPECT_EQ(3 * i + 2, buf[3 * i + c]);
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
+struct ApplyThreadArgs {
+  struct cras_dsp_context* ctx;
+  int stop;
+  int applied;
+};
+
+static void* ApplyThread(void* arg) {
+  struct ApplyThreadArgs* args = (struct ApplyThreadArgs*)arg;
+  int16_t buf[64];
+
+  while (!__atomic_load_n(&args->stop, __ATOMIC_ACQUIRE)) {
+    for (int i = 0; i < 64; i++)
+      buf[i] = i;
+    EXPECT_EQ(0, cras_dsp_apply(args->ctx, (uint8_t*)buf,
+                                SND_PCM_FORMAT_S16_LE, 64));
+    /* The pipelines pass the samples through, so they are untouched
+     * while fading between them too. */
+    for (int i = 0; i < 64; i++)
+      EXPECT_EQ(i, buf[i]);
+    __atomic_add_fetch(&args->applied, 1, __ATOMIC_RELEASE);
+  }
+  return NULL;
+}
+
+TEST_F(DspTestSuite, ReloadWhileApplying) {
+  fprintf(fp, "%s", kCaptureIni);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  struct ApplyThreadArgs args = {};
+  pthread_t tid;
+
+  args.ctx = cras_dsp_context_new(48000, "capture");
+  cras_dsp_load_pipeline(args.ctx);
+  ASSERT_EQ(0, pthread_create(&tid, NULL, ApplyThread, &args));
+  while (!__atomic_load_n(&args.applied, __ATOMIC_ACQUIRE))
+    sched_yield();
+
+  /* Each reload frees the pipeline it replaces while the other thread
+   * keeps running the current one. */
+  for (int i = 0; i < 20; i++)
+    cras_dsp_load_pipeline(args.ctx);
+  cras_dsp_reload_ini();
+
+  __atomic_store_n(&args.stop, 1, __ATOMIC_RELEASE);
+  pthread_join(tid, NULL);
+  EXPECT_TRUE(cras_dsp_get_pipeline(args.ctx));
+  cras_dsp_put_pipeline(args.ctx);
+
+  cras_dsp_context_free(args.ctx);
+  cras_dsp_stop();
+}
+
+struct FirmwareLoads {
+  int rc;
+  int loaded;
+  int bypassed;
+  int sample_rate;
+};
+
+static int LoadFirmware(const struct plugin* plugin,
+                        int sample_rate,
+                        int bypass,
+                        void* arg) {
+  struct FirmwareLoads* loads = (struct FirmwareLoads*)arg;
+
+  EXPECT_STREQ("EQIIR", plugin->firmware_control);
+  loads->sample_rate = sample_rate;
+  if (bypass) {
+    loads->bypassed++;
+    return 0;
+  }
+  loads->loaded++;
+  return loads->rc;
+}
+
+/* Returns true if the plugin titled title runs in the pipeline of ctx. */
+static bool RunsOnHost(struct cras_dsp_context* ctx, const char* title) {
+  struct pipeline* pipeline = cras_dsp_get_pipeline(ctx);
+  struct plugin* plugin;
+  bool found = false;
+  int i;
+
+  if (!pipeline)
+    return false;
+  ARRAY_ELEMENT_FOREACH (&cras_dsp_pipeline_get_ini(pipeline)->plugins, i,
+                         plugin) {
+    if (strcmp(plugin->title, title) == 0)
+      found = cras_dsp_pipeline_has_plugin(pipeline, plugin);
+  }
+  cras_dsp_put_pipeline(ctx);
+  return found;
+}
+
+TEST_F(DspTestSuite, LoadFirmware) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={in}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=eq2\n"
+      "firmware_control=EQIIR\n"
+      "input_0={in}\n"
+      "output_1={out}\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={out}\n"
+      "\n";
+  struct FirmwareLoads loads = {};
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  struct cras_dsp_context* playback = cras_dsp_context_new(48000, "playback");
+  struct cras_dsp_context* ctx = cras_dsp_context_new(48000, "capture");
+
+  /* Only the plugins of the pipeline of the context are offered. */
+  cras_dsp_load_firmware(playback, LoadFirmware, &loads);
+  EXPECT_EQ(0, loads.loaded);
+
+  cras_dsp_load_firmware(ctx, LoadFirmware, &loads);
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(1, loads.loaded);
+  EXPECT_EQ(48000, loads.sample_rate);
+  EXPECT_TRUE(RunsOnHost(ctx, "m1"));
+  EXPECT_FALSE(RunsOnHost(ctx, "m2"));
+
+  /* Back on the host without a device to load it. */
+  cras_dsp_load_firmware(ctx, NULL, NULL);
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_TRUE(RunsOnHost(ctx, "m2"));
+
+  /* Failing to load it bypasses the firmware. */
+  loads.rc = -ERANGE;
+  cras_dsp_load_firmware(ctx, LoadFirmware, &loads);
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(2, loads.loaded);
+  EXPECT_EQ(1, loads.bypassed);
+  EXPECT_TRUE(RunsOnHost(ctx, "m2"));
+
+  cras_dsp_context_free(playback);
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
+TEST_F(DspTestSuite, KeepPipeline) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={in}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=eq2\n"
+      "disable=(equal? dsp_name \"quiet\")\n"
+      "input_0={in}\n"
+      "output_1={out}\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={out}\n"
+      "\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(48000, "capture");
+  cras_dsp_load_pipeline(ctx);
+  ASSERT_TRUE(RunsOnHost(ctx, "m2"));
+  int loaded = builtin_modules_loaded;
+
+  /* No plugin depends on it. */
+  cras_dsp_set_variable_string(ctx, "other", "value");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(loaded, builtin_modules_loaded);
+
+  /* M2 depends on it, but stays enabled. */
+  cras_dsp_set_variable_string(ctx, "dsp_name", "loud");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(loaded, builtin_modules_loaded);
+  EXPECT_TRUE(RunsOnHost(ctx, "m2"));
+
+  cras_dsp_set_variable_string(ctx, "dsp_name", "quiet");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_LT(loaded, builtin_modules_loaded);
+  EXPECT_FALSE(RunsOnHost(ctx, "m2"));
+
+  /* A change reverted before the load doesn't rebuild either. */
+  loaded = builtin_modules_loaded;
+  cras_dsp_set_variable_string(ctx, "dsp_name", "loud");
+  cras_dsp_set_variable_string(ctx, "dsp_name", "quiet");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(loaded, builtin_modules_loaded);
+
+  /* Reloading the ini always rebuilds. */
+  cras_dsp_reload_ini();
+  EXPECT_LT(loaded, builtin_modules_loaded);
+  EXPECT_FALSE(RunsOnHost(ctx, "m2"));
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
+TEST_F(DspTestSuite, ReuseModules) {
+  const char* content =
+      "[M1]\n"
+      "library=builtin\n"
+      "label=source\n"
+      "purpose=capture\n"
+      "output_0={in}\n"
+      "[M2]\n"
+      "library=builtin\n"
+      "label=eq2\n"
+      "disable=(equal? dsp_name \"quiet\")\n"
+      "input_0={in}\n"
+      "output_1={mid}\n"
+      "[M3]\n"
+      "library=builtin\n"
+      "label=drc\n"
+      "input_0={mid}\n"
+      "output_1={out}\n"
+      "[M4]\n"
+      "library=builtin\n"
+      "label=sink\n"
+      "purpose=capture\n"
+      "input_0={out}\n"
+      "\n";
+  fprintf(fp, "%s", content);
+  CloseFile();
+
+  cras_dsp_init(filename);
+  struct cras_dsp_context* ctx = cras_dsp_context_new(48000, "capture");
+  cras_dsp_load_pipeline(ctx);
+  ASSERT_TRUE(RunsOnHost(ctx, "m3"));
+  int loaded = builtin_modules_loaded;
+
+  /* M3 is kept, only the source and the sink are loaded again. */
+  cras_dsp_set_variable_string(ctx, "dsp_name", "quiet");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(loaded + 2, builtin_modules_loaded);
+  EXPECT_FALSE(RunsOnHost(ctx, "m2"));
+  EXPECT_TRUE(RunsOnHost(ctx, "m3"));
+
+  /* Also from the pipeline of an ini read again. */
+  loaded = builtin_modules_loaded;
+  cras_dsp_reload_ini();
+  EXPECT_EQ(loaded + 2, builtin_modules_loaded);
+  EXPECT_TRUE(RunsOnHost(ctx, "m3"));
+
+  /* Re-enabling M2 loads it. */
+  loaded = builtin_modules_loaded;
+  cras_dsp_set_variable_string(ctx, "dsp_name", "loud");
+  cras_dsp_load_pipeline(ctx);
+  EXPECT_EQ(loaded + 3, builtin_modules_loaded);
+  EXPECT_TRUE(RunsOnHost(ctx, "m2"));
+
+  cras_dsp_context_free(ctx);
+  cras_dsp_stop();
+}
+
 static int empty_instantiate(struct dsp_module* module,
                              unsigned long sample_rate) {
   return 0;
@@ -143,10 +484,17 @@ struct dsp_module* cras_dsp_module_load_builtin(struct plugin* plugin) {
   struct dsp_module* module;
   module = (struct dsp_module*)calloc(1, sizeof(struct dsp_module));
   empty_init_module(module);
+  builtin_modules_loaded++;
   return module;
 }
 void cras_dsp_module_set_sink_ext_module(struct dsp_module* module,
                                          struct ext_dsp_module* ext_module) {}
+int cras_dsp_module_is_identity(struct dsp_module* module) {
+  return 0;
+}
+int cras_dsp_module_merge(struct dsp_module* module, struct dsp_module* next) {
+  return -EINVAL;
+}
 }  // extern "C"
 
 int main(int argc, char** argv) {
@@ -251,6 +251,30 @@ TEST_F(EDIDTestSuite, AudEDID) {
   }
 }
 
+TEST_F(EDIDTestSuite, CompressedAudio) {
+  static const uint8_t cea_ext[] = {
+      0x02, 0x03, 0x12, 0x40,
+      // Audio block: LPCM 2ch, AC-3 6ch, DTS 6ch.
+      0x29, 0x09, 0x07, 0x07, 0x15, 0x07, 0x50, 0x3d, 0x06, 0xc0,
+      // Audio block: DD+ 8ch.
+      0x23, 0x57, 0x06, 0x00,
+  };
+  unsigned int i;
+
+  EXPECT_EQ(0, edid_compressed_support(edid_, 1));
+  edid_[EDID_EXT_FLAG] = 1;
+  SetChecksum();
+  memcpy(edid_ + EDID_SIZE, cea_ext, sizeof(cea_ext));
+  EXPECT_EQ((1 << DBCA_FMT_AC3) | (1 << DBCA_FMT_DTS) | (1 << DBCA_FMT_EAC3),
+            edid_compressed_support(edid_, 1));
+  EXPECT_EQ(0, edid_compressed_support(edid_, 0));
+  // The short audio descriptors of an ELD are read the same way.
+  EXPECT_EQ(1 << DBCA_FMT_AC3, edid_sads_compressed_support(cea_ext + 5, 2));
+
+  for (i = 0; i < ARRAY_SIZE(test_no_aud_edids); i++)
+    EXPECT_EQ(0, edid_compressed_support(test_no_aud_edids[i], 1));
+}
+
 TEST_F(EDIDTestSuite, EDIDMonitorName) {
   unsigned int i;
   char buf[DTD_SIZE];
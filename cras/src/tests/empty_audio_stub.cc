@@ -4,6 +4,7 @@
  */
 
 extern "C" {
+#include "cras_stream_drain_handler.h"
 #include "polled_interval_checker.h"
 
 struct polled_interval* pic_polled_interval_create(int interval_sec) {
@@ -21,4 +22,8 @@ void pic_polled_interval_destroy(struct polled_interval** interval) {}
 void pic_update_current_time() {}
 
 void cras_non_empty_audio_send_msg(int non_empty) {}
+
+int cras_stream_drain_send_msg(cras_stream_id_t stream_id) {
+  return 0;
+}
 }
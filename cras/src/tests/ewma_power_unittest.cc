@@ -19,7 +19,7 @@ TEST(EWMAPower, RelativePowerValue) {
   for (i = 0; i < 480; i++)
     buf[i] = 0x00fe;
 
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
   EXPECT_EQ(48, ewma.step_fr);
 
   ewma_power_calculate(&ewma, buf, 1, 480);
@@ -44,7 +44,7 @@ TEST(EWMAPower, PowerInStereoData) {
   int i;
   float f;
 
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
 
   for (i = 0; i < 960; i += 2) {
     buf[i] = 0x0;
@@ -66,7 +66,7 @@ TEST(EWMAPower, PowerInStereoData) {
   EXPECT_LT(ewma.power, 1.0e-10);
 
   // Assume the data is silent in the other channel.
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
 
   for (i = 0; i < 960; i += 2) {
     buf[i] = 0x0ffe;
@@ -95,7 +95,7 @@ TEST(EWMAPower, PowerInAudioArea) {
     buf[i + 2] = 0x0;
     buf[i + 3] = 0x0ffe;
   }
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
   ewma_power_calculate_area(&ewma, buf, area, 480);
   f = ewma.power;
   EXPECT_LT(0.0f, f);
@@ -105,7 +105,7 @@ TEST(EWMAPower, PowerInAudioArea) {
   layout[CRAS_CH_FR] = 2;
   cras_audio_format_set_channel_layout(fmt, layout);
   cras_audio_area_config_channels(area, fmt);
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
   ewma_power_calculate_area(&ewma, buf, area, 480);
   EXPECT_GT(f, ewma.power);
 
@@ -113,7 +113,7 @@ TEST(EWMAPower, PowerInAudioArea) {
   layout[CRAS_CH_FL] = 1;
   cras_audio_format_set_channel_layout(fmt, layout);
   cras_audio_area_config_channels(area, fmt);
-  ewma_power_init(&ewma, 48000);
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
   ewma_power_calculate_area(&ewma, buf, area, 480);
   EXPECT_EQ(0.0f, ewma.power);
 
@@ -121,6 +121,75 @@ TEST(EWMAPower, PowerInAudioArea) {
   cras_audio_area_destroy(area);
 }
 
+TEST(EWMAPower, PowerInPlanarData) {
+  struct ewma_power ewma, ref;
+  int16_t buf[960];
+  float left[480], right[480];
+  float* planes[] = {left, right};
+  int i;
+
+  for (i = 0; i < 480; i++) {
+    buf[2 * i] = 0x0ffe;
+    buf[2 * i + 1] = 0x0;
+    left[i] = 0x0ffe / 32768.0f;
+    right[i] = 0.0f;
+  }
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate_planar(&ewma, planes, 2, 480);
+  EXPECT_LT(0.0f, ewma.power);
+
+  // Matches the power of the same samples interleaved.
+  ewma_power_init(&ref, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate(&ref, buf, 2, 480);
+  EXPECT_FLOAT_EQ(ref.power, ewma.power);
+}
+
+TEST(EWMAPower, PowerInS32Data) {
+  struct ewma_power ewma, ref;
+  int16_t buf[960];
+  int32_t buf32[960];
+  int i;
+
+  for (i = 0; i < 960; i++) {
+    buf[i] = i % 2 ? 0x0 : 0x0ffe;
+    buf32[i] = buf[i] * 65536;
+  }
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S32_LE, 48000);
+  ewma_power_calculate(&ewma, buf32, 2, 480);
+  ewma_power_init(&ref, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate(&ref, buf, 2, 480);
+  EXPECT_LT(0.0f, ewma.power);
+  EXPECT_FLOAT_EQ(ref.power, ewma.power);
+}
+
+TEST(EWMAPower, SetInterval) {
+  struct ewma_power ewma, ref;
+  int16_t buf[480];
+  int i;
+
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_set_interval(&ewma, 5);
+  EXPECT_EQ(240, ewma.step_fr);
+  ewma_power_init(&ref, SND_PCM_FORMAT_S16_LE, 48000);
+
+  for (i = 0; i < 480; i++)
+    buf[i] = 0x0ffe;
+  ewma_power_calculate(&ewma, buf, 1, 480);
+  ewma_power_calculate(&ref, buf, 1, 480);
+  EXPECT_FLOAT_EQ(ref.power, ewma.power);
+
+  // Sampling less often decays the power at the same pace.
+  for (i = 0; i < 480; i++)
+    buf[i] = 0x0;
+  for (i = 0; i < 10; i++) {
+    ewma_power_calculate(&ewma, buf, 1, 480);
+    ewma_power_calculate(&ref, buf, 1, 480);
+  }
+  EXPECT_NEAR(ref.power, ewma.power, ref.power * 0.1f);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
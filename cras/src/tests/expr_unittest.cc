@@ -4,6 +4,8 @@
 
 #include <gtest/gtest.h>
 
+#include <string>
+
 #include "cras_expr.h"
 
 namespace {
@@ -166,6 +168,13 @@ TEST(ExprTest, Environment) {
 
   /* an integer is not a boolean */
   EXPECT_EQ(-1, cras_expr_expression_eval_boolean(expr, &env2, &boolean));
+  EXPECT_EQ(-1, cras_expr_env_get_variable_boolean(&env2, "baz", &boolean));
+
+  /* variables are looked up by name, which needn't be parsable */
+  cras_expr_env_set_variable_boolean(&env2, "eq2:1", 1);
+  EXPECT_EQ(0, cras_expr_env_get_variable_boolean(&env2, "eq2:1", &boolean));
+  EXPECT_EQ(1, boolean);
+  EXPECT_EQ(-1, cras_expr_env_get_variable_boolean(&env1, "eq2:1", &boolean));
 
   cras_expr_value_free(&value);
   cras_expr_expression_free(expr);
@@ -240,6 +249,107 @@ TEST(ExprTest, Builtin) {
   cras_expr_env_free(&env);
 }
 
+static void expect_same_program_value(const char* str,
+                                      struct cras_expr_env* env) {
+  struct cras_expr_expression* expr;
+  struct cras_expr_program* prog;
+  struct cras_expr_value value = CRAS_EXPR_VALUE_INIT;
+  struct cras_expr_value prog_value = CRAS_EXPR_VALUE_INIT;
+
+  expr = cras_expr_expression_parse(str);
+  prog = cras_expr_program_compile(expr);
+  ASSERT_NE(nullptr, prog);
+  cras_expr_expression_eval(expr, env, &value);
+  cras_expr_program_eval(prog, env, &prog_value);
+  EXPECT_EQ(value.type, prog_value.type) << str;
+  if (value.type == CRAS_EXPR_VALUE_TYPE_BOOLEAN)
+    EXPECT_EQ(value.u.boolean, prog_value.u.boolean) << str;
+  if (value.type == CRAS_EXPR_VALUE_TYPE_INT)
+    EXPECT_EQ(value.u.integer, prog_value.u.integer) << str;
+  if (value.type == CRAS_EXPR_VALUE_TYPE_STRING)
+    EXPECT_STREQ(value.u.string, prog_value.u.string) << str;
+  cras_expr_value_free(&value);
+  cras_expr_value_free(&prog_value);
+  cras_expr_program_free(prog);
+  cras_expr_expression_free(expr);
+}
+
+TEST(ExprTest, Program) {
+  struct cras_expr_expression* expr;
+  struct cras_expr_program* prog;
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+  std::string nested = "#t";
+  char boolean = 0;
+
+  EXPECT_EQ(nullptr, cras_expr_program_compile(NULL));
+
+  cras_expr_env_install_builtins(&env);
+  cras_expr_env_set_variable_string(&env, "a", "hello");
+  cras_expr_env_set_variable_string(&env, "b", "world");
+  cras_expr_env_set_variable_integer(&env, "c", 3);
+
+  expect_same_program_value("-2", &env);
+  expect_same_program_value("\"hello\"", &env);
+  expect_same_program_value("a", &env);
+  expect_same_program_value("undefined", &env);
+  expect_same_program_value("()", &env);
+  expect_same_program_value("(1 2)", &env);
+  expect_same_program_value("(and)", &env);
+  expect_same_program_value("(and 1 a c)", &env);
+  expect_same_program_value("(and #f 4)", &env);
+  expect_same_program_value("(or #f (or a))", &env);
+  expect_same_program_value("(not (equal? c 3))", &env);
+  expect_same_program_value("(or (equal? \"test\" a) b)", &env);
+  expect_same_program_value("(equal? (or #f b) \"world\" b)", &env);
+
+  /* deeper than the stack the program starts with */
+  for (int i = 0; i < 40; i++)
+    nested = "(and c " + nested + ")";
+  expect_same_program_value(nested.c_str(), &env);
+
+  /* the variables read are listed once */
+  expr = cras_expr_expression_parse("(or (equal? a b) (equal? a \"x\"))");
+  prog = cras_expr_program_compile(expr);
+  ASSERT_EQ(4, cras_expr_program_get_num_variables(prog));
+  EXPECT_STREQ("or", cras_expr_program_get_variable(prog, 0));
+  EXPECT_STREQ("equal?", cras_expr_program_get_variable(prog, 1));
+  EXPECT_STREQ("a", cras_expr_program_get_variable(prog, 2));
+  EXPECT_STREQ("b", cras_expr_program_get_variable(prog, 3));
+
+  /* the slots found in one environment don't mislead another */
+  struct cras_expr_env env2 = CRAS_EXPR_ENV_INIT;
+  cras_expr_env_set_variable_string(&env2, "b", "x");
+  cras_expr_env_set_variable_string(&env2, "a", "x");
+  cras_expr_env_install_builtins(&env2);
+  EXPECT_EQ(0, cras_expr_program_eval_boolean(prog, &env, &boolean));
+  EXPECT_EQ(0, boolean);
+  EXPECT_EQ(0, cras_expr_program_eval_boolean(prog, &env2, &boolean));
+  EXPECT_EQ(1, boolean);
+  cras_expr_env_set_variable_string(&env2, "a", "y");
+  EXPECT_EQ(0, cras_expr_program_eval_boolean(prog, &env2, &boolean));
+  EXPECT_EQ(0, boolean);
+  cras_expr_program_free(prog);
+  cras_expr_expression_free(expr);
+
+  cras_expr_env_free(&env);
+  cras_expr_env_free(&env2);
+}
+
+TEST(ExprTest, SetVariableChanged) {
+  struct cras_expr_env env = CRAS_EXPR_ENV_INIT;
+
+  EXPECT_EQ(1, cras_expr_env_set_variable_boolean(&env, "a", 1));
+  EXPECT_EQ(0, cras_expr_env_set_variable_boolean(&env, "a", 2));
+  EXPECT_EQ(1, cras_expr_env_set_variable_boolean(&env, "a", 0));
+  EXPECT_EQ(1, cras_expr_env_set_variable_integer(&env, "a", 0));
+  EXPECT_EQ(0, cras_expr_env_set_variable_integer(&env, "a", 0));
+  EXPECT_EQ(1, cras_expr_env_set_variable_string(&env, "a", "foo"));
+  EXPECT_EQ(0, cras_expr_env_set_variable_string(&env, "a", "foo"));
+  EXPECT_EQ(1, cras_expr_env_set_variable_string(&env, "a", "bar"));
+
+  cras_expr_env_free(&env);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -0,0 +1,169 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+extern "C" {
+#include "cras_flight_recorder.h"
+}
+
+namespace {
+
+class FlightRecorderTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    char tmpl[] = CRAS_UT_TMPDIR "/flight_recorder_XXXXXX";
+    ASSERT_NE(nullptr, mkdtemp(tmpl));
+    dir_ = tmpl;
+    cras_flight_recorder_init(dir_.c_str());
+
+    log_ = (struct audio_thread_event_log*)calloc(1, sizeof(*log_));
+    log_->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+    memset(&snapshot_, 0, sizeof(snapshot_));
+    now_.tv_sec = 1000;
+    now_.tv_nsec = 0;
+  }
+
+  virtual void TearDown() {
+    cras_flight_recorder_deinit();
+    for (int i = 0; i < CRAS_FLIGHT_RECORDER_MAX_FILES; i++)
+      unlink(RecordPath(i).c_str());
+    rmdir(dir_.c_str());
+    free(log_);
+  }
+
+  std::string RecordPath(int n) {
+    return dir_ + "/cras_flight_record." + std::to_string(n);
+  }
+
+  // Logs an event tagged with its seconds, data1 identifies it.
+  void LogEvent(uint32_t sec, uint32_t id) {
+    struct audio_thread_event* ev =
+        &log_->log[log_->write_pos++ % log_->len];
+    ev->tag_sec = (AUDIO_THREAD_WAKE << 24) | (sec & 0x00ffffff);
+    ev->data1 = id;
+  }
+
+  int Record(enum CRAS_AUDIO_THREAD_EVENT_TYPE event_type) {
+    snapshot_.hdr.timestamp = now_;
+    snapshot_.hdr.event_type = event_type;
+    return cras_flight_recorder_record(&snapshot_.hdr, log_);
+  }
+
+  std::vector<uint8_t> ReadRecord(int n) {
+    std::vector<uint8_t> buf;
+    FILE* f = fopen(RecordPath(n).c_str(), "rb");
+    if (!f)
+      return buf;
+    int c;
+    while ((c = fgetc(f)) != EOF)
+      buf.push_back(c);
+    fclose(f);
+    return buf;
+  }
+
+  std::string dir_;
+  struct audio_thread_event_log* log_;
+  struct __attribute__((__packed__)) {
+    struct cras_audio_thread_snapshot hdr;
+    struct audio_dev_debug_info devs[1];
+    struct audio_stream_debug_info streams[2];
+  } snapshot_;
+  struct timespec now_;
+};
+
+TEST_F(FlightRecorderTestSuite, RecordsWindowBeforeTrigger) {
+  struct cras_flight_record_header hdr;
+  struct audio_thread_event ev;
+
+  LogEvent(now_.tv_sec - CRAS_FLIGHT_RECORDER_WINDOW_SEC - 5, 1);
+  LogEvent(now_.tv_sec - CRAS_FLIGHT_RECORDER_WINDOW_SEC, 2);
+  LogEvent(now_.tv_sec - 1, 3);
+  LogEvent(now_.tv_sec, 4);
+  snapshot_.hdr.num_devs = 1;
+  snapshot_.hdr.num_streams = 2;
+  snapshot_.streams[1].stream_id = 0x10002;
+
+  ASSERT_EQ(0, Record(AUDIO_THREAD_EVENT_UNDERRUN));
+
+  std::vector<uint8_t> buf = ReadRecord(0);
+  ASSERT_EQ(sizeof(hdr) + sizeof(snapshot_.devs[0]) +
+                2 * sizeof(snapshot_.streams[0]) + 3 * sizeof(ev),
+            buf.size());
+  memcpy(&hdr, buf.data(), sizeof(hdr));
+  EXPECT_EQ(CRAS_FLIGHT_RECORD_MAGIC, hdr.magic);
+  EXPECT_EQ(AUDIO_THREAD_EVENT_UNDERRUN, hdr.event_type);
+  EXPECT_EQ(1000, hdr.sec);
+  EXPECT_EQ(1, hdr.num_devs);
+  EXPECT_EQ(2, hdr.num_streams);
+  EXPECT_EQ(3, hdr.num_events);
+
+  size_t offset = sizeof(hdr) + sizeof(snapshot_.devs[0]);
+  struct audio_stream_debug_info stream;
+  memcpy(&stream, buf.data() + offset + sizeof(stream), sizeof(stream));
+  EXPECT_EQ(0x10002, stream.stream_id);
+
+  // The event older than the window is dropped, the rest kept in order.
+  offset += 2 * sizeof(stream);
+  memcpy(&ev, buf.data() + offset, sizeof(ev));
+  EXPECT_EQ(2, ev.data1);
+  memcpy(&ev, buf.data() + offset + 2 * sizeof(ev), sizeof(ev));
+  EXPECT_EQ(4, ev.data1);
+}
+
+TEST_F(FlightRecorderTestSuite, WrappedLog) {
+  struct cras_flight_record_header hdr;
+  struct audio_thread_event ev;
+
+  for (unsigned int i = 0; i < log_->len + 10; i++)
+    LogEvent(now_.tv_sec, i);
+
+  ASSERT_EQ(0, Record(AUDIO_THREAD_EVENT_BUSYLOOP));
+
+  std::vector<uint8_t> buf = ReadRecord(0);
+  ASSERT_EQ(sizeof(hdr) + log_->len * sizeof(ev), buf.size());
+  memcpy(&ev, buf.data() + sizeof(hdr), sizeof(ev));
+  EXPECT_EQ(10, ev.data1);
+}
+
+TEST_F(FlightRecorderTestSuite, RateLimitedAndRotated) {
+  LogEvent(now_.tv_sec, 1);
+  ASSERT_EQ(0, Record(AUDIO_THREAD_EVENT_UNDERRUN));
+
+  now_.tv_sec += CRAS_FLIGHT_RECORDER_MIN_INTERVAL_SEC - 1;
+  EXPECT_EQ(-EAGAIN, Record(AUDIO_THREAD_EVENT_BUSYLOOP));
+  EXPECT_EQ(0, ReadRecord(1).size());
+
+  for (int i = 1; i <= CRAS_FLIGHT_RECORDER_MAX_FILES; i++) {
+    now_.tv_sec += CRAS_FLIGHT_RECORDER_MIN_INTERVAL_SEC;
+    ASSERT_EQ(0, Record(AUDIO_THREAD_EVENT_BUSYLOOP));
+  }
+
+  // The oldest record was overwritten by the newest one.
+  struct cras_flight_record_header hdr;
+  std::vector<uint8_t> buf = ReadRecord(0);
+  ASSERT_GE(buf.size(), sizeof(hdr));
+  memcpy(&hdr, buf.data(), sizeof(hdr));
+  EXPECT_EQ(AUDIO_THREAD_EVENT_BUSYLOOP, hdr.event_type);
+}
+
+TEST_F(FlightRecorderTestSuite, Disabled) {
+  cras_flight_recorder_deinit();
+  LogEvent(now_.tv_sec, 1);
+  EXPECT_EQ(0, Record(AUDIO_THREAD_EVENT_UNDERRUN));
+  EXPECT_EQ(0, ReadRecord(0).size());
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
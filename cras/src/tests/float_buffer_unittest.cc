@@ -45,6 +45,62 @@ TEST(FloatBuffer, ReadWrite) {
   float_buffer_destroy(&b);
 }
 
+TEST(FloatBuffer, PlanesAligned) {
+  unsigned int readable = 10;
+  struct float_buffer* b = float_buffer_create(10, 3);
+  float* const* fp;
+
+  // Each plane starts aligned, wherever the positions are.
+  fp = float_buffer_write_pointer(b);
+  for (unsigned int i = 0; i < 3; i++)
+    EXPECT_EQ(0, (uintptr_t)fp[i] % FLOAT_BUFFER_ALIGN);
+
+  // The planes don't overlap.
+  for (unsigned int i = 0; i < 3; i++)
+    for (unsigned int j = 0; j < 10; j++)
+      fp[i][j] = i * 100 + j;
+  float_buffer_written(b, 10);
+  fp = float_buffer_read_pointer(b, 0, &readable);
+  EXPECT_EQ(10, readable);
+  for (unsigned int i = 0; i < 3; i++)
+    for (unsigned int j = 0; j < 10; j++)
+      EXPECT_EQ(i * 100 + j, fp[i][j]);
+
+  float_buffer_destroy(&b);
+}
+
+TEST(FloatBuffer, MirroredReadsAcrossTheEnd) {
+  struct float_buffer* b = float_buffer_create_mirrored(10, 2);
+  unsigned int size = b->buf->max_size, readable;
+  float* const* fp;
+
+  ASSERT_TRUE(b->buf->mirrored);
+  EXPECT_LE(10, size);
+  EXPECT_EQ(size, float_buffer_writable(b));
+
+  float_buffer_written(b, size - 4);
+  float_buffer_read(b, size - 4);
+
+  // A write and a read over the end are whole.
+  EXPECT_EQ(size, float_buffer_writable(b));
+  fp = float_buffer_write_pointer(b);
+  for (unsigned int i = 0; i < 8; i++) {
+    fp[0][i] = i;
+    fp[1][i] = -(float)i;
+  }
+  float_buffer_written(b, 8);
+
+  readable = 10;
+  fp = float_buffer_read_pointer(b, 2, &readable);
+  EXPECT_EQ(6, readable);
+  for (unsigned int i = 0; i < 6; i++) {
+    EXPECT_EQ(i + 2, fp[0][i]);
+    EXPECT_EQ(-(float)(i + 2), fp[1][i]);
+  }
+
+  float_buffer_destroy(&b);
+}
+
 }  // namespace
 
 int main(int argc, char** argv) {
@@ -847,6 +847,167 @@ TEST(FormatConverterOpsTest, TwentyToTwoS16LE) {
   }
 }
 
+// Test S24_LE to S32_LE and back keeps every bit.
+TEST(FormatConverterOpsTest, ConvertS24LEToS32LERoundTrip) {
+  const size_t samples = 4096;
+
+  S24LEPtr src = CreateS24LE(samples);
+  S32LEPtr mid = CreateS32LE(samples);
+  S24LEPtr dst = CreateS24LE(samples);
+  for (size_t i = 0; i < samples; ++i) {
+    // Sign extend the random 24 bits, like ALSA lays out S24_LE.
+    src[i] = (int32_t)((uint32_t)src[i] << 8) >> 8;
+  }
+
+  convert_s24le_to_s32le((uint8_t*)src.get(), samples, (uint8_t*)mid.get());
+  convert_s32le_to_s24le((uint8_t*)mid.get(), samples, (uint8_t*)dst.get());
+
+  for (size_t i = 0; i < samples; ++i) {
+    EXPECT_EQ((int32_t)((uint32_t)src[i] << 8), mid[i]);
+    EXPECT_EQ(src[i], dst[i]);
+  }
+}
+
+// Test S24_3LE to S32_LE and back keeps every bit.
+TEST(FormatConverterOpsTest, ConvertS243LEToS32LERoundTrip) {
+  const size_t samples = 4096;
+
+  S243LEPtr src = CreateS243LE(samples);
+  S32LEPtr mid = CreateS32LE(samples);
+  S243LEPtr dst = CreateS243LE(samples);
+
+  convert_s243le_to_s32le(src.get(), samples, (uint8_t*)mid.get());
+  convert_s32le_to_s243le((uint8_t*)mid.get(), samples, dst.get());
+
+  for (size_t i = 0; i < samples; ++i) {
+    EXPECT_EQ((int32_t)((uint32_t)ToS243LE(&src[i * 3]) << 8), mid[i]);
+    EXPECT_EQ(ToS243LE(&src[i * 3]), ToS243LE(&dst[i * 3]));
+  }
+}
+
+// Test U8 to S32_LE and back.
+TEST(FormatConverterOpsTest, ConvertU8ToS32LERoundTrip) {
+  const size_t samples = 256;
+
+  U8Ptr src = CreateU8(samples);
+  S32LEPtr mid = CreateS32LE(samples);
+  U8Ptr dst = CreateU8(samples);
+
+  convert_u8_to_s32le(src.get(), samples, (uint8_t*)mid.get());
+  convert_s32le_to_u8((uint8_t*)mid.get(), samples, dst.get());
+
+  for (size_t i = 0; i < samples; ++i) {
+    EXPECT_EQ(((int32_t)src[i] - 0x80) * (1 << 24), mid[i]);
+    EXPECT_EQ(src[i], dst[i]);
+  }
+}
+
+// Test Stereo to Mono conversion.  S32_LE, keeps the low bits and clips.
+TEST(FormatConverterOpsTest, StereoToMonoS32LE) {
+  const size_t frames = 3;
+  int32_t src[] = {0x123457, -0x123456, INT32_MAX, 1, INT32_MIN, -1};
+  int32_t dst[frames];
+
+  size_t ret = s32_stereo_to_mono((uint8_t*)src, frames, (uint8_t*)dst);
+  EXPECT_EQ(ret, frames);
+  EXPECT_EQ(1, dst[0]);
+  EXPECT_EQ(INT32_MAX, dst[1]);
+  EXPECT_EQ(INT32_MIN, dst[2]);
+}
+
+// Test 5.1 to Stereo conversion.  S32_LE.
+TEST(FormatConverterOpsTest, _51ToStereoS32LE) {
+  const size_t frames = 4096;
+  const size_t in_ch = 6;
+  const size_t out_ch = 2;
+  const size_t left = 0;
+  const size_t right = 1;
+  const size_t center = 2;
+
+  S32LEPtr src = CreateS32LE(frames * in_ch);
+  S32LEPtr dst = CreateS32LE(frames * out_ch);
+  for (size_t i = 0; i < frames * in_ch; ++i)
+    src[i] /= 2;
+
+  size_t ret =
+      s32_51_to_stereo((uint8_t*)src.get(), frames, (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+
+  const double normalized_factor = 0.585;
+
+  for (size_t i = 0; i < frames; ++i) {
+    double half_center = src[i * 6 + center] * 0.707 * normalized_factor;
+    int32_t l = normalized_factor * src[i * 6 + left] + half_center;
+    int32_t r = normalized_factor * src[i * 6 + right] + half_center;
+
+    EXPECT_EQ(l, dst[i * 2 + left]);
+    EXPECT_EQ(r, dst[i * 2 + right]);
+  }
+}
+
+// Test channel conversion with a coefficient matrix.  S32_LE.
+TEST(FormatConverterOpsTest, ConvertChannelsS32LE) {
+  const size_t frames = 4096;
+  const size_t in_ch = 2;
+  const size_t out_ch = 2;
+  float coef0[] = {0.5, 0.5};
+  float coef1[] = {1, 0};
+  float* mtx[] = {coef0, coef1};
+
+  S32LEPtr src = CreateS32LE(frames * in_ch);
+  S32LEPtr dst = CreateS32LE(frames * out_ch);
+
+  size_t ret = s32_convert_channels(mtx, in_ch, out_ch, (uint8_t*)src.get(),
+                                    frames, (uint8_t*)dst.get());
+  EXPECT_EQ(ret, frames);
+
+  for (size_t i = 0; i < frames; ++i) {
+    int32_t mean = ((double)src[i * 2] + src[i * 2 + 1]) / 2;
+    EXPECT_EQ(mean, dst[i * 2]);
+    EXPECT_EQ(src[i * 2], dst[i * 2 + 1]);
+  }
+}
+
+// The converters built for fixed channel counts match the generic ones.
+TEST(FormatConverterOpsTest, ConvertChannelsFixedCounts) {
+  const size_t frames = 257;
+  const size_t counts[][2] = {{6, 2}, {6, 4}, {4, 4}, {6, 6}, {8, 8}, {5, 3}};
+
+  for (auto& c : counts) {
+    const size_t in_ch = c[0], out_ch = c[1];
+    FloatPtr ch_conv_mtx = CreateFloat(out_ch * in_ch);
+    std::unique_ptr<float*[]> mtx(new float*[out_ch]);
+    for (size_t i = 0; i < out_ch; ++i)
+      mtx[i] = &ch_conv_mtx[i * in_ch];
+
+    S16LEPtr src16 = CreateS16LE(frames * in_ch);
+    S16LEPtr exp16 = CreateS16LE(frames * out_ch);
+    S16LEPtr dst16 = CreateS16LE(frames * out_ch);
+    s16_convert_channels(mtx.get(), in_ch, out_ch, (uint8_t*)src16.get(),
+                         frames, (uint8_t*)exp16.get());
+    EXPECT_EQ(frames, s16_convert_channels_func(in_ch, out_ch)(
+                          mtx.get(), in_ch, out_ch, (uint8_t*)src16.get(),
+                          frames, (uint8_t*)dst16.get()));
+    EXPECT_EQ(0, memcmp(exp16.get(), dst16.get(),
+                        frames * out_ch * sizeof(int16_t)))
+        << in_ch << " to " << out_ch;
+
+    S32LEPtr src32 = CreateS32LE(frames * in_ch);
+    S32LEPtr exp32 = CreateS32LE(frames * out_ch);
+    S32LEPtr dst32 = CreateS32LE(frames * out_ch);
+    s32_convert_channels(mtx.get(), in_ch, out_ch, (uint8_t*)src32.get(),
+                         frames, (uint8_t*)exp32.get());
+    EXPECT_EQ(frames, s32_convert_channels_func(in_ch, out_ch)(
+                          mtx.get(), in_ch, out_ch, (uint8_t*)src32.get(),
+                          frames, (uint8_t*)dst32.get()));
+    EXPECT_EQ(0, memcmp(exp32.get(), dst32.get(),
+                        frames * out_ch * sizeof(int32_t)))
+        << in_ch << " to " << out_ch;
+  }
+  EXPECT_EQ(s16_convert_channels, s16_convert_channels_func(5, 3));
+  EXPECT_EQ(s32_convert_channels, s32_convert_channels_func(5, 3));
+}
+
 extern "C" {}  // extern "C"
 
 int main(int argc, char** argv) {
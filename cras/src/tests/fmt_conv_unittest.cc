@@ -8,7 +8,9 @@
 
 extern "C" {
 #include "cras_fmt_conv.h"
+#include "cras_mem_stats.h"
 #include "cras_types.h"
+#include "polyphase_resampler.h"
 }
 
 static int mono_channel_layout[CRAS_CH_MAX] = {-1, -1, -1, -1, 0, -1,
@@ -23,6 +25,8 @@ static int surround_channel_unknown_layout[CRAS_CH_MAX] = {
     -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1};
 static int quad_channel_layout[CRAS_CH_MAX] = {0,  1,  2,  3,  -1, -1,
                                                -1, -1, -1, -1, -1};
+static int surround71_channel_layout[CRAS_CH_MAX] = {0, 1, 2,  3,  4, 5,
+                                                     6, 7, -1, -1, -1};
 static int linear_resampler_needed_val;
 static double linear_resampler_ratio = 1.0;
 static unsigned int linear_resampler_num_channels;
@@ -75,25 +79,23 @@ TEST(FormatConverterTest, SmallFramesSRCWithLinearResampler) {
   EXPECT_EQ(out_fmt.frame_rate, linear_resampler_src_rate);
   EXPECT_EQ(out_fmt.frame_rate, linear_resampler_dst_rate);
 
-  /* When process on small buffers doing SRC 16KHz -> 48KHz,
-   * speex does the work in two steps:
+  /* When process on small buffers doing SRC 16KHz -> 48KHz, the
+   * integer ratio resampler makes 3 frames out of each input frame
+   * and holds what doesn't fit for the next call:
    *
-   * (1) 0 -> 2 frames in output
-   * (2) 1 -> 1 frame in output
-   *
-   * Total result is 1 frame consumed in input and generated
-   * 3 frames in output.
+   * (1) 1 -> 2 frames in output, 1 held
+   * (2) 1 -> 1 held and 1 new frame in output, 2 held
    */
   out_frames = cras_fmt_conv_convert_frames(
       c, (uint8_t*)in_buf, (uint8_t*)out_buf, &in_frames, out_frames);
   EXPECT_EQ(2, out_frames);
-  EXPECT_EQ(0, in_frames);
+  EXPECT_EQ(1, in_frames);
 
   in_frames = 1;
   out_frames = 2;
   out_frames = cras_fmt_conv_convert_frames(
       c, (uint8_t*)in_buf, (uint8_t*)out_buf, &in_frames, out_frames);
-  EXPECT_EQ(1, out_frames);
+  EXPECT_EQ(2, out_frames);
   EXPECT_EQ(1, in_frames);
 
   cras_fmt_conv_destroy(&c);
@@ -343,16 +345,16 @@ TEST(FormatConverterTest, StereoToMono24bit) {
 
     in_buff = (int32_t*)malloc(buf_size * cras_get_format_bytes(&in_fmt));
     out_buff = (int32_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
-    // TODO(dgreid) - s/0x10000/1/ once it stays full bits the whole way.
+    // The lowest bit survives the conversion.
     for (i = 0; i < buf_size; i++) {
-      in_buff[i * 2] = 13450 << 16;
-      in_buff[i * 2 + 1] = -in_buff[i * 2] + 0x10000;
+      in_buff[i * 2] = test == 0 ? 13450 << 8 : 13450 << 16;
+      in_buff[i * 2 + 1] = -in_buff[i * 2] + 1;
     }
     out_frames = cras_fmt_conv_convert_frames(
         c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
     EXPECT_EQ(buf_size, out_frames);
     for (i = 0; i < buf_size; i++) {
-      EXPECT_EQ(0x10000, out_buff[i]);
+      EXPECT_EQ(1, out_buff[i]);
     }
 
     cras_fmt_conv_destroy(&c);
@@ -361,6 +363,45 @@ TEST(FormatConverterTest, StereoToMono24bit) {
   }
 }
 
+// Test 24 bit packed mono to stereo isn't narrowed on the way.
+TEST(FormatConverterTest, MonoToStereoS243LEFullWidth) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  uint8_t* in_buff;
+  uint8_t* out_buff;
+  unsigned int i;
+  const size_t buf_size = 100;
+  unsigned int in_buf_size = 100;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S24_3LE;
+  out_fmt.format = SND_PCM_FORMAT_S24_3LE;
+  in_fmt.num_channels = 1;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buff = (uint8_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (uint8_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(c, in_buff, out_buff,
+                                            &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (i = 0; i < buf_size; i++) {
+    EXPECT_EQ(0, memcmp(&in_buff[i * 3], &out_buff[i * 6], 3));
+    EXPECT_EQ(0, memcmp(&in_buff[i * 3], &out_buff[i * 6 + 3], 3));
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test 5.1 to Stereo mix.
 TEST(FormatConverterTest, SurroundToStereo) {
   struct cras_fmt_conv* c;
@@ -778,6 +819,81 @@ TEST(FormatConverterTest, ConvertS32LEToS16LE) {
   free(out_buff);
 }
 
+// Test float to 32 bit conversion and back, clipping out of range floats.
+TEST(FormatConverterTest, ConvertFloatLEToS32LEAndBack) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  float in_buff[] = {0.5f, -0.25f, 1.5f, -1.5f};
+  int32_t s32_buff[4];
+  float out_buff[4];
+  unsigned int in_frames = 2;
+  size_t out_frames;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_FLOAT_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, 2, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_NE(0, cras_fmt_conv_format_only(c));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)s32_buff, &in_frames, 2);
+  EXPECT_EQ(2, out_frames);
+  EXPECT_EQ(0x40000000, s32_buff[0]);
+  EXPECT_EQ(-0x20000000, s32_buff[1]);
+  EXPECT_EQ(INT32_MAX, s32_buff[2]);
+  EXPECT_EQ(INT32_MIN, s32_buff[3]);
+  cras_fmt_conv_destroy(&c);
+
+  c = cras_fmt_conv_create(&out_fmt, &in_fmt, 2, 0);
+  ASSERT_NE(c, (void*)NULL);
+  in_frames = 2;
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)s32_buff, (uint8_t*)out_buff, &in_frames, 2);
+  EXPECT_EQ(2, out_frames);
+  EXPECT_FLOAT_EQ(0.5f, out_buff[0]);
+  EXPECT_FLOAT_EQ(-0.25f, out_buff[1]);
+  EXPECT_FLOAT_EQ(1.0f, out_buff[2]);
+  EXPECT_FLOAT_EQ(-1.0f, out_buff[3]);
+  cras_fmt_conv_destroy(&c);
+}
+
+// Test float to 16 bit conversion goes through 32 bits, with channel
+// conversion on the way.
+TEST(FormatConverterTest, ConvertFloatLEToS16LEMonoToStereo) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  float in_buff[] = {0.5f, -0.25f};
+  int16_t out_buff[4];
+  unsigned int in_frames = 2;
+  size_t out_frames;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_FLOAT_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 1;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, 2, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(0, cras_fmt_conv_format_only(c));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_frames, 2);
+  EXPECT_EQ(2, out_frames);
+  EXPECT_EQ(16384, out_buff[0]);
+  EXPECT_EQ(16384, out_buff[1]);
+  EXPECT_EQ(-8192, out_buff[2]);
+  EXPECT_EQ(-8192, out_buff[3]);
+  cras_fmt_conv_destroy(&c);
+}
+
 // Test 24 to 16 bit conversion.
 TEST(FormatConverterTest, ConvertS24LEToS16LE) {
   struct cras_fmt_conv* c;
@@ -1235,6 +1351,7 @@ TEST(FormatConverterTest, ConvertS16LEToS16LEStereoToQuad) {
 
   c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
   ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(0, cras_fmt_conv_delay_frames(c));
 
   out_frames = cras_fmt_conv_in_frames_to_out(c, buf_size);
   EXPECT_EQ(buf_size, out_frames);
@@ -1276,6 +1393,217 @@ TEST(FormatConverterTest, ConvertS16LEToS16LEStereoToQuad) {
   free(out_buff);
 }
 
+// Test 16 bit 7.1 to stereo downmix by the channel layouts.
+TEST(FormatConverterTest, ConvertS16LEToS16LEDownmix71ToStereo) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 8;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = surround71_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buff = (int16_t*)calloc(buf_size, cras_get_format_bytes(&in_fmt));
+  for (unsigned int i = 0; i < buf_size; i++) {
+    in_buff[8 * i + CRAS_CH_FC] = 1000;
+    in_buff[8 * i + CRAS_CH_SL] = 2000;
+  }
+
+  out_buff = (int16_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  // The left row sums 1 + 0.866 + 0.5 + 0.707 + 0.707 + 1 before it is
+  // normalized. The center splits to both sides, side left only goes left.
+  for (unsigned int i = 0; i < buf_size; i++) {
+    EXPECT_NEAR(2707 / 4.78, out_buff[2 * i], 2);
+    EXPECT_NEAR(707 / 4.78, out_buff[2 * i + 1], 2);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// A gain set on a converter mixing through a matrix is applied by it.
+TEST(FormatConverterTest, GainFoldedIntoChannelMatrix) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  const size_t buf_size = 480;
+  unsigned int in_frames;
+  int16_t in_buff[8 * buf_size];
+  int16_t out_buff[2 * buf_size];
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 8;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = surround71_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+  for (unsigned int i = 0; i < 8 * buf_size; i++)
+    in_buff[i] = 1000;
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  in_frames = buf_size;
+  cras_fmt_conv_convert_frames(c, (uint8_t*)in_buff, (uint8_t*)out_buff,
+                               &in_frames, buf_size);
+  int16_t unity = out_buff[0];
+
+  EXPECT_EQ(1.0f, cras_fmt_conv_set_gain(c, 0.5f));
+  in_frames = buf_size;
+  cras_fmt_conv_convert_frames(c, (uint8_t*)in_buff, (uint8_t*)out_buff,
+                               &in_frames, buf_size);
+  EXPECT_NEAR(unity / 2, out_buff[0], 3);
+  EXPECT_NEAR(unity / 2, out_buff[2 * buf_size - 1], 3);
+
+  // Back to unity from the coefficients kept aside.
+  EXPECT_EQ(1.0f, cras_fmt_conv_set_gain(c, 1.0f));
+  in_frames = buf_size;
+  cras_fmt_conv_convert_frames(c, (uint8_t*)in_buff, (uint8_t*)out_buff,
+                               &in_frames, buf_size);
+  EXPECT_EQ(unity, out_buff[0]);
+  cras_fmt_conv_destroy(&c);
+
+  // Without a matrix the gain is left to the caller.
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 1;
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(0.5f, cras_fmt_conv_set_gain(c, 0.5f));
+  cras_fmt_conv_destroy(&c);
+}
+
+// Test 32 bit 7.1 to 5.1 downmix, the sides fold into the rears.
+TEST(FormatConverterTest, ConvertS32LEToS32LEDownmix71To51) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int32_t* in_buff;
+  int32_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S32_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 8;
+  out_fmt.num_channels = 6;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = surround71_channel_layout[i];
+    out_fmt.channel_layout[i] = surround_channel_center_layout[i];
+  }
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buff = (int32_t*)calloc(buf_size, cras_get_format_bytes(&in_fmt));
+  for (unsigned int i = 0; i < buf_size; i++) {
+    in_buff[8 * i + CRAS_CH_FL] = 100000;
+    in_buff[8 * i + CRAS_CH_RL] = 60000;
+    in_buff[8 * i + CRAS_CH_SL] = 40000;
+  }
+
+  out_buff = (int32_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  // Rear left sums two channels, so every channel is halved.
+  for (unsigned int i = 0; i < buf_size; i++) {
+    EXPECT_NEAR(50000, out_buff[6 * i + CRAS_CH_FL], 1);
+    EXPECT_EQ(0, out_buff[6 * i + CRAS_CH_FR]);
+    EXPECT_NEAR(50000, out_buff[6 * i + CRAS_CH_RL], 1);
+    EXPECT_EQ(0, out_buff[6 * i + CRAS_CH_RR]);
+    EXPECT_EQ(0, out_buff[6 * i + CRAS_CH_FC]);
+    EXPECT_EQ(0, out_buff[6 * i + CRAS_CH_LFE]);
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test 16 bit stereo to 7.1 upmix, only the front channels are played.
+TEST(FormatConverterTest, ConvertS16LEToS16LEStereoTo71) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 4096;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 8;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (unsigned int i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = surround71_channel_layout[i];
+  }
+  swap_channel_layout(out_fmt.channel_layout, CRAS_CH_FL, CRAS_CH_SR);
+
+  c = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c, (void*)NULL);
+
+  in_buff = (int16_t*)malloc(buf_size * cras_get_format_bytes(&in_fmt));
+  for (unsigned int i = 0; i < buf_size; i++) {
+    in_buff[2 * i] = 40;
+    in_buff[2 * i + 1] = 80;
+  }
+
+  out_buff = (int16_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(buf_size, out_frames);
+  for (unsigned int i = 0; i < buf_size; i++) {
+    for (unsigned int ch = 0; ch < 8; ch++) {
+      if (ch == out_fmt.channel_layout[CRAS_CH_FL])
+        EXPECT_EQ(40, out_buff[8 * i + ch]);
+      else if (ch == out_fmt.channel_layout[CRAS_CH_FR])
+        EXPECT_EQ(80, out_buff[8 * i + ch]);
+      else
+        EXPECT_EQ(0, out_buff[8 * i + ch]);
+    }
+  }
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
 // Test 32 bit 5.1 to 16 bit stereo conversion with SRC 1 to 2.
 TEST(FormatConverterTest, ConvertS32LEToS16LEDownmix51ToStereo48To96) {
   struct cras_fmt_conv* c;
@@ -1577,6 +1905,114 @@ TEST(FormatConverterTest, Convert96to48PostLinearResample) {
   free(out_buff);
 }
 
+// Test SRC from 44.1 to 48 kHz through the polyphase resampler.
+TEST(FormatConverterTest, Convert44to48Polyphase) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+
+  size_t out_frames;
+  int16_t* in_buff;
+  int16_t* out_buff;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 441 * 8;
+  int i;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create_with_quality(&in_fmt, &out_fmt, buf_size, 0,
+                                        CRAS_RESAMPLER_QUALITY_HIGH);
+  ASSERT_NE(c, (void*)NULL);
+  EXPECT_EQ(1, cras_fmt_conversion_needed(c));
+  EXPECT_EQ(1, cras_fmt_conv_resampling(c));
+  // The filter delays the audio by half its taps.
+  EXPECT_LT(0, cras_fmt_conv_delay_frames(c));
+
+  in_buff = (int16_t*)calloc(buf_size, cras_get_format_bytes(&in_fmt));
+  out_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  EXPECT_EQ(441 * 8, in_buf_size);
+  EXPECT_EQ(480 * 8, out_frames);
+  for (i = 0; i < 480 * 8 * 2; i++)
+    EXPECT_EQ(0, out_buff[i]);
+
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(out_buff);
+}
+
+// Test that block-wise conversion of a long period matches running each
+// stage over the whole period.
+TEST(FormatConverterTest, BlockedConvertMatchesSingleStages) {
+  struct cras_fmt_conv* c;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  struct polyphase_resampler* pr;
+
+  size_t out_frames;
+  int16_t* in_buff;
+  int32_t* in_s32;
+  int32_t* out_buff;
+  int32_t* expected;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size = 441 * 8;
+  unsigned int expected_in = in_buf_size;
+  unsigned int expected_fr;
+  unsigned int i;
+
+  ResetStub();
+  in_fmt.format = SND_PCM_FORMAT_S16_LE;
+  out_fmt.format = SND_PCM_FORMAT_S32_LE;
+  in_fmt.num_channels = 2;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 44100;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++) {
+    in_fmt.channel_layout[i] = stereo_channel_layout[i];
+    out_fmt.channel_layout[i] = stereo_channel_layout[i];
+  }
+
+  c = cras_fmt_conv_create_with_quality(&in_fmt, &out_fmt, buf_size, 0,
+                                        CRAS_RESAMPLER_QUALITY_MEDIUM);
+  ASSERT_NE(c, (void*)NULL);
+  pr = polyphase_resampler_create(2, 44100, 48000, POLYPHASE_QUALITY_MEDIUM);
+  ASSERT_NE(pr, (void*)NULL);
+
+  in_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  in_s32 = (int32_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  expected = (int32_t*)malloc(buf_size * cras_get_format_bytes(&out_fmt));
+  out_frames = cras_fmt_conv_convert_frames(
+      c, (uint8_t*)in_buff, (uint8_t*)out_buff, &in_buf_size, buf_size);
+  // The S32_LE output keeps the resampler running on S32_LE.
+  for (i = 0; i < expected_in * 2; i++)
+    in_s32[i] = (int32_t)((uint32_t)in_buff[i] << 16);
+  expected_fr = polyphase_resampler_process_s32(pr, in_s32, &expected_in,
+                                                expected, buf_size);
+  EXPECT_EQ(expected_in, in_buf_size);
+  ASSERT_EQ(expected_fr, out_frames);
+  for (i = 0; i < out_frames * 2; i++)
+    EXPECT_EQ(expected[i], out_buff[i]);
+
+  polyphase_resampler_destroy(pr);
+  cras_fmt_conv_destroy(&c);
+  free(in_buff);
+  free(in_s32);
+  free(out_buff);
+  free(expected);
+}
+
 // Test format converter created in config_format_converter
 TEST(FormatConverterTest, ConfigConverter) {
   int i;
@@ -1596,7 +2032,8 @@ TEST(FormatConverterTest, ConfigConverter) {
     out_fmt.channel_layout[i] = stereo_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096,
+                          CRAS_RESAMPLER_QUALITY_DEFAULT);
   ASSERT_NE(c, (void*)NULL);
 
   cras_fmt_conv_destroy(&c);
@@ -1622,9 +2059,11 @@ TEST(FormatConverterTest, ConfigConverterNoNeed) {
     out_fmt.channel_layout[i] = stereo_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_OUTPUT, &in_fmt, &out_fmt, 4096,
+                          CRAS_RESAMPLER_QUALITY_DEFAULT);
   EXPECT_NE(c, (void*)NULL);
   EXPECT_EQ(0, cras_fmt_conversion_needed(c));
+  EXPECT_EQ(0, cras_fmt_conv_resampling(c));
   cras_fmt_conv_destroy(&c);
 }
 
@@ -1650,12 +2089,75 @@ TEST(FormatConverterTest, ConfigConverterNoNeedForInput) {
     out_fmt.channel_layout[i] = kmic_channel_layout[i];
   }
 
-  config_format_converter(&c, CRAS_STREAM_INPUT, &in_fmt, &out_fmt, 4096);
+  config_format_converter(&c, CRAS_STREAM_INPUT, &in_fmt, &out_fmt, 4096,
+                          CRAS_RESAMPLER_QUALITY_DEFAULT);
   EXPECT_NE(c, (void*)NULL);
   EXPECT_EQ(0, cras_fmt_conversion_needed(c));
   cras_fmt_conv_destroy(&c);
 }
 
+// Converters on the same thread share scratch buffers, allocated on the
+// first conversion and freed only on release.
+TEST(FormatConverterTest, ConvertersShareScratch) {
+  struct cras_fmt_conv *c1, *c2;
+  struct cras_audio_format in_fmt;
+  struct cras_audio_format out_fmt;
+  struct cras_mem_usage usage;
+  const size_t buf_size = 4096;
+  unsigned int in_buf_size;
+  int32_t* in_buff;
+  int16_t* out_buff;
+  uint64_t before;
+  int i;
+
+  ResetStub();
+  cras_fmt_conv_release_scratch();
+  in_fmt.format = SND_PCM_FORMAT_S32_LE;
+  out_fmt.format = SND_PCM_FORMAT_S16_LE;
+  in_fmt.num_channels = 6;
+  out_fmt.num_channels = 2;
+  in_fmt.frame_rate = 48000;
+  out_fmt.frame_rate = 48000;
+  for (i = 0; i < CRAS_CH_MAX; i++)
+    in_fmt.channel_layout[i] = surround_channel_center_layout[i];
+
+  cras_mem_stats_get(&usage);
+  before = usage.bytes[CRAS_MEM_FMT_CONV];
+  c1 = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size, 0);
+  ASSERT_NE(c1, (void*)NULL);
+  c2 = cras_fmt_conv_create(&in_fmt, &out_fmt, buf_size / 2, 0);
+  ASSERT_NE(c2, (void*)NULL);
+  cras_mem_stats_get(&usage);
+  EXPECT_EQ(before, usage.bytes[CRAS_MEM_FMT_CONV]);
+
+  in_buff = (int32_t*)ralloc(buf_size * cras_get_format_bytes(&in_fmt));
+  out_buff = (int16_t*)ralloc(buf_size * cras_get_format_bytes(&out_fmt));
+  in_buf_size = buf_size;
+  EXPECT_EQ(buf_size, cras_fmt_conv_convert_frames(c1, (uint8_t*)in_buff,
+                                                   (uint8_t*)out_buff,
+                                                   &in_buf_size, buf_size));
+  cras_mem_stats_get(&usage);
+  uint64_t scratch = usage.bytes[CRAS_MEM_FMT_CONV] - before;
+  EXPECT_GT(scratch, 0);
+
+  in_buf_size = buf_size / 2;
+  EXPECT_EQ(buf_size / 2, cras_fmt_conv_convert_frames(
+                              c2, (uint8_t*)in_buff, (uint8_t*)out_buff,
+                              &in_buf_size, buf_size / 2));
+  cras_mem_stats_get(&usage);
+  EXPECT_EQ(before + scratch, usage.bytes[CRAS_MEM_FMT_CONV]);
+
+  cras_fmt_conv_destroy(&c1);
+  cras_fmt_conv_destroy(&c2);
+  cras_mem_stats_get(&usage);
+  EXPECT_EQ(before + scratch, usage.bytes[CRAS_MEM_FMT_CONV]);
+  cras_fmt_conv_release_scratch();
+  cras_mem_stats_get(&usage);
+  EXPECT_EQ(before, usage.bytes[CRAS_MEM_FMT_CONV]);
+  free(in_buff);
+  free(out_buff);
+}
+
 TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
   float coeff[4] = {0.5, 0.5, 0.26, 0.73};
   struct cras_fmt_conv* conv;
@@ -1671,8 +2173,8 @@ TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
 
   memcpy(res, buf, 50 * 4);
 
-  /* Remix conversion will not apply for non S16_LE format. */
-  fmt.format = SND_PCM_FORMAT_S24_LE;
+  /* A remix matrix isn't applied to packed 24 bit samples. */
+  fmt.format = SND_PCM_FORMAT_S24_3LE;
   cras_channel_remix_convert(conv, &fmt, (uint8_t*)buf, 50);
   for (i = 0; i < 100; i++)
     EXPECT_EQ(res[i], buf[i]);
@@ -1700,6 +2202,49 @@ TEST(ChannelRemixTest, ChannelRemixAppliedOrNot) {
   free(res);
 }
 
+TEST(ChannelRemixTest, ChannelRemixWideFormats) {
+  float coeff[4] = {0.5, 0.5, 0.25, 0.75};
+  float swap[4] = {0, 1, 1, 0};
+  struct cras_fmt_conv* conv;
+  struct cras_audio_format fmt;
+  int32_t buf[4] = {0x1000, 0x2000, -0x400, 0x800};
+
+  fmt.num_channels = 2;
+  fmt.format = SND_PCM_FORMAT_S32_LE;
+  conv = cras_channel_remix_conv_create(2, coeff);
+  cras_channel_remix_convert(conv, &fmt, (uint8_t*)buf, 2);
+  EXPECT_EQ(0x1800, buf[0]);
+  EXPECT_EQ(0x1c00, buf[1]);
+  EXPECT_EQ(0x200, buf[2]);
+  EXPECT_EQ(0x500, buf[3]);
+  cras_fmt_conv_destroy(&conv);
+
+  /* Swapped speakers take any sample width. */
+  fmt.format = SND_PCM_FORMAT_S24_LE;
+  conv = cras_channel_remix_conv_create(2, swap);
+  cras_channel_remix_convert(conv, &fmt, (uint8_t*)buf, 2);
+  EXPECT_EQ(0x1c00, buf[0]);
+  EXPECT_EQ(0x1800, buf[1]);
+  EXPECT_EQ(0x500, buf[2]);
+  EXPECT_EQ(0x200, buf[3]);
+  cras_fmt_conv_destroy(&conv);
+}
+
+TEST(ChannelRemixTest, ChannelRemixPlanar) {
+  float coeff[4] = {0.5, 0.5, 0.25, 0.75};
+  struct cras_fmt_conv* conv;
+  float left[] = {1.0f}, right[] = {-1.0f};
+  float* planes[] = {left, right};
+
+  conv = cras_channel_remix_conv_create(2, coeff);
+  EXPECT_EQ(0, cras_channel_remix_convert_planar(conv, planes, 6, 1));
+  EXPECT_FLOAT_EQ(1.0f, left[0]);
+  EXPECT_EQ(1, cras_channel_remix_convert_planar(conv, planes, 2, 1));
+  EXPECT_FLOAT_EQ(0.0f, left[0]);
+  EXPECT_FLOAT_EQ(-0.5f, right[0]);
+  cras_fmt_conv_destroy(&conv);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
@@ -289,6 +289,9 @@ void cras_bt_device_notify_profile_dropped(
 void hfp_info_set_wbs_logger(struct hfp_info* info,
                              struct packet_status_logger* wbs_logger) {}
 
+void hfp_info_set_link_stats(struct hfp_info* info,
+                             struct hfp_link_stats* link_stats) {}
+
 void cras_observer_notify_bt_battery_changed(const char* address,
                                              uint32_t level) {
   return;
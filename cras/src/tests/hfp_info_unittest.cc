@@ -31,6 +31,8 @@ static timespec ts;
 void ResetStubData() {
   sbc_codec_stub_reset();
   cras_msbc_plc_create_called = 0;
+  cras_msbc_plc_handle_good_frames_called = 0;
+  cras_msbc_plc_handle_bad_frames_called = 0;
 
   format.format = SND_PCM_FORMAT_S16_LE;
   format.num_channels = 1;
@@ -255,10 +257,9 @@ TEST(HfpInfo, StartHfpInfoAndRead) {
   info = hfp_info_create();
   ASSERT_NE(info, (void*)NULL);
 
-  /* Start and send two chunk of fake data */
+  /* Start and send a chunk of fake data */
   hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info);
   send(sock[0], sample, 48, 0);
-  send(sock[0], sample, 48, 0);
 
   /* Trigger thread callback */
   thread_cb((struct hfp_info*)cb_data, POLLIN);
@@ -273,6 +274,7 @@ TEST(HfpInfo, StartHfpInfoAndRead) {
   /* Trigger thread callback after idev added. */
   ts.tv_sec = 0;
   ts.tv_nsec = 5000000;
+  send(sock[0], sample, 48, 0);
   thread_cb((struct hfp_info*)cb_data, POLLIN);
 
   rc = hfp_buf_queued(info, dev.direction);
@@ -302,7 +304,6 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
 
   hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info);
   send(sock[0], sample, 48, 0);
-  send(sock[0], sample, 48, 0);
 
   /* Trigger thread callback */
   thread_cb((struct hfp_info*)cb_data, POLLIN);
@@ -318,6 +319,7 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
   ASSERT_EQ(0, hfp_buf_queued(info, dev.direction));
 
   /* Put some fake data and trigger thread callback again */
+  send(sock[0], sample, 48, 0);
   buf_increment_write(info->playback_buf, 1008);
   thread_cb((struct hfp_info*)cb_data, POLLIN);
 
@@ -330,18 +332,56 @@ TEST(HfpInfo, StartHfpInfoAndWrite) {
   hfp_info_destroy(info);
 }
 
+TEST(HfpInfo, StartHfpInfoAndReadWriteBatch) {
+  int rc;
+  int sock[2];
+  uint8_t sample[480];
+
+  ResetStubData();
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+
+  hfp_info_start(sock[1], 48, HFP_CODEC_ID_CVSD, info);
+  ASSERT_EQ(0, hfp_info_add_iodev(info, CRAS_STREAM_INPUT, dev.format));
+  ASSERT_EQ(0, hfp_info_add_iodev(info, CRAS_STREAM_OUTPUT, dev.format));
+  buf_increment_write(info->playback_buf, 480);
+
+  /* Three packets queued before the audio thread wakes up. */
+  send(sock[0], sample, 48, 0);
+  send(sock[0], sample, 48, 0);
+  send(sock[0], sample, 48, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+
+  /* All read in one wake, and as many written back. */
+  ASSERT_EQ(3 * 48 / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+  ASSERT_EQ((480 - 3 * 48) / 2, hfp_buf_queued(info, CRAS_STREAM_OUTPUT));
+  for (int i = 0; i < 3; i++) {
+    rc = recv(sock[0], sample, 48, MSG_DONTWAIT);
+    ASSERT_EQ(48, rc);
+  }
+  ASSERT_EQ(-1, recv(sock[0], sample, 48, MSG_DONTWAIT));
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+}
+
+/* The first three bytes of msbc_sco_pkt are h2 header, frame count and mSBC
+ * sync word. The second octet of H2 header is composed by 4 bits fixed 0x8
+ * and 4 bits sequence number 0000, 0011, 1100, 1111.
+ */
+static const uint8_t h2_headers[4] = {0x08, 0x38, 0xc8, 0xf8};
+static const uint8_t msbc_sco_pkt[] = {
+    0x01, 0x00, 0xAD, 0xad, 0x00, 0x00, 0xc5, 0x00, 0x00, 0x00, 0x00, 0x77,
+    0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb,
+    0x77, 0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6,
+    0xdb, 0x77, 0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd,
+    0xb6, 0xdb, 0x77, 0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6c};
+
 void send_mSBC_packet(int fd, unsigned seq, int broken_pkt) {
-  /* The first three bytes of hci_sco_buf are h2 header, frame count and mSBC
-   * sync word. The second octet of H2 header is composed by 4 bits fixed 0x8
-   * and 4 bits sequence number 0000, 0011, 1100, 1111.
-   */
-  uint8_t headers[4] = {0x08, 0x38, 0xc8, 0xf8};
-  uint8_t hci_sco_buf[] = {
-      0x01, 0x00, 0xAD, 0xad, 0x00, 0x00, 0xc5, 0x00, 0x00, 0x00, 0x00, 0x77,
-      0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6, 0xdb,
-      0x77, 0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd, 0xb6,
-      0xdb, 0x77, 0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6d, 0xdd,
-      0xb6, 0xdb, 0x77, 0x6d, 0xb6, 0xdd, 0xdb, 0x6d, 0xb7, 0x76, 0xdb, 0x6c};
+  uint8_t hci_sco_buf[sizeof(msbc_sco_pkt)];
   struct msghdr msg = {0};
   struct iovec iov;
   struct cmsghdr* cmsg;
@@ -349,7 +389,8 @@ void send_mSBC_packet(int fd, unsigned seq, int broken_pkt) {
   char control[control_size] = {0};
   uint8_t pkt_status = 0;
 
-  hci_sco_buf[1] = headers[seq % 4];
+  memcpy(hci_sco_buf, msbc_sco_pkt, sizeof(hci_sco_buf));
+  hci_sco_buf[1] = h2_headers[seq % 4];
 
   /* Assume typical 60 bytes case. */
   msg.msg_iov = &iov;
@@ -470,6 +511,93 @@ TEST(HfpInfo, StartHfpInfoAndReadMsbc) {
   hfp_info_destroy(info);
 }
 
+TEST(HfpInfo, ReadWriteMsbcFramesAcrossPackets) {
+  int sock[2];
+  uint8_t stream[2 * MSBC_PKT_SIZE];
+  uint8_t sample[2 * MSBC_PKT_SIZE];
+
+  ResetStubData();
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
+  set_sbc_codec_encoded_out(57);
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+
+  /* Two mSBC frames carried in five 24 bytes packets. */
+  hfp_info_start(sock[1], 24, HFP_CODEC_ID_MSBC, info);
+  ASSERT_EQ(0, hfp_info_add_iodev(info, CRAS_STREAM_INPUT, dev.format));
+  for (int i = 0; i < 2; i++) {
+    memcpy(stream + i * MSBC_PKT_SIZE, msbc_sco_pkt, MSBC_PKT_SIZE);
+    stream[i * MSBC_PKT_SIZE + 1] = h2_headers[i];
+  }
+
+  /* The second frame is split between two wakes. */
+  for (int i = 0; i < 3; i++)
+    send(sock[0], stream + i * 24, 24, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  ASSERT_EQ(MSBC_CODE_SIZE / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+
+  for (int i = 3; i < 5; i++)
+    send(sock[0], stream + i * 24, 24, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  ASSERT_EQ(2 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+  ASSERT_EQ(2, cras_msbc_plc_handle_good_frames_called);
+  ASSERT_EQ(0, cras_msbc_plc_handle_bad_frames_called);
+
+  /* Five packets written back carry two whole encoded frames. */
+  for (int i = 0; i < 5; i++)
+    ASSERT_EQ(24, recv(sock[0], sample + i * 24, 24, MSG_DONTWAIT));
+  ASSERT_EQ(-1, recv(sock[0], sample, 24, MSG_DONTWAIT));
+  for (int i = 0; i < 2; i++) {
+    EXPECT_EQ(0x01, sample[i * MSBC_PKT_SIZE]);
+    EXPECT_EQ(h2_headers[i], sample[i * MSBC_PKT_SIZE + 1]);
+  }
+
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+}
+
+TEST(HfpInfo, ReadMsbcBatchDecodesInOneCall) {
+  int sock[2];
+  uint8_t sample[4 * MSBC_PKT_SIZE];
+
+  ResetStubData();
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+  hfp_info_start(sock[1], MSBC_PKT_SIZE, HFP_CODEC_ID_MSBC, info);
+  ASSERT_EQ(0, hfp_info_add_iodev(info, CRAS_STREAM_INPUT, dev.format));
+
+  /* Three good packets in a row are decoded together. */
+  for (int i = 0; i < 3; i++)
+    send_mSBC_packet(sock[0], i, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  EXPECT_EQ(1, get_msbc_codec_decode_frames_called());
+  EXPECT_EQ(3 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+  EXPECT_EQ(3, cras_msbc_plc_handle_good_frames_called);
+
+  /* A lost packet ends the batch, the rest goes one packet at a time. */
+  send_mSBC_packet(sock[0], 3, 0);
+  send_mSBC_packet(sock[0], 4, 0);
+  send_mSBC_packet(sock[0], 6, 0);
+  send_mSBC_packet(sock[0], 7, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  EXPECT_EQ(2, get_msbc_codec_decode_frames_called());
+  EXPECT_EQ(8 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+  EXPECT_EQ(7, cras_msbc_plc_handle_good_frames_called);
+  EXPECT_EQ(1, cras_msbc_plc_handle_bad_frames_called);
+
+  while (recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT) > 0)
+    ;
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+}
+
 TEST(HfpInfo, StartHfpInfoAndWriteMsbc) {
   int rc;
   int sock[2];
@@ -484,7 +612,7 @@ TEST(HfpInfo, StartHfpInfoAndWriteMsbc) {
   ASSERT_NE(info, (void*)NULL);
 
   hfp_info_start(sock[1], 63, HFP_CODEC_ID_MSBC, info);
-  send(sock[0], sample, 63, 0);
+  send(sock[0], sample, 60, 0);
 
   /* Trigger thread callback */
   thread_cb((struct hfp_info*)cb_data, POLLIN);
@@ -496,7 +624,7 @@ TEST(HfpInfo, StartHfpInfoAndWriteMsbc) {
   ASSERT_EQ(0, hfp_buf_queued(info, dev.direction));
 
   /* Put some fake data and trigger thread callback again */
-  send(sock[0], sample, 63, 0);
+  send(sock[0], sample, 60, 0);
   buf_increment_write(info->playback_buf, 240);
   thread_cb((struct hfp_info*)cb_data, POLLIN);
 
@@ -529,6 +657,54 @@ TEST(HfpInfo, WBSLoggerPacketStatusDumpBinary) {
   }
 }
 
+TEST(HfpInfo, ConcealLateMsbcPacketsOnTime) {
+  int sock[2];
+  uint8_t sample[2 * MSBC_PKT_SIZE];
+
+  ResetStubData();
+
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+  set_sbc_codec_decoded_out(MSBC_CODE_SIZE);
+
+  info = hfp_info_create();
+  ASSERT_NE(info, (void*)NULL);
+  hfp_info_start(sock[1], MSBC_PKT_SIZE, HFP_CODEC_ID_MSBC, info);
+  ASSERT_EQ(0, hfp_info_add_iodev(info, CRAS_STREAM_INPUT, dev.format));
+
+  send_mSBC_packet(sock[0], 0, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  EXPECT_EQ(0, hfp_conceal_late_input(info));
+  hfp_buf_release(info, CRAS_STREAM_INPUT, MSBC_CODE_SIZE / 2);
+
+  /* Three frames overdue, only the one capture is short of is concealed. */
+  info->last_read_ts.tv_nsec -= 3 * MSBC_FRAME_USEC * 1000;
+  if (info->last_read_ts.tv_nsec < 0) {
+    info->last_read_ts.tv_sec--;
+    info->last_read_ts.tv_nsec += 1000000000;
+  }
+  EXPECT_EQ(MSBC_CODE_SIZE / 2, hfp_conceal_late_input(info));
+  EXPECT_EQ(MSBC_CODE_SIZE / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+  EXPECT_EQ(1, cras_msbc_plc_handle_bad_frames_called);
+  EXPECT_EQ(0, hfp_conceal_late_input(info));
+
+  /* The late packet concealed is dropped, the next one decoded. */
+  send_mSBC_packet(sock[0], 1, 0);
+  send_mSBC_packet(sock[0], 2, 0);
+  thread_cb((struct hfp_info*)cb_data, POLLIN);
+  EXPECT_EQ(2 * MSBC_CODE_SIZE / 2, hfp_buf_queued(info, CRAS_STREAM_INPUT));
+  EXPECT_EQ(2, cras_msbc_plc_handle_good_frames_called);
+  EXPECT_EQ(1, cras_msbc_plc_handle_bad_frames_called);
+  EXPECT_EQ(0, info->msbc_num_lost_frames);
+
+  /* The lateness raised the wait reported as delay. */
+  EXPECT_LT(0, hfp_rx_delay_frames(info));
+
+  while (recv(sock[0], sample, sizeof(sample), MSG_DONTWAIT) > 0)
+    ;
+  hfp_info_stop(info);
+  hfp_info_destroy(info);
+}
+
 }  // namespace
 
 extern "C" {
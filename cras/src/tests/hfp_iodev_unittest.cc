@@ -328,6 +328,18 @@ int hfp_buf_queued(struct hfp_info* info,
   return 0;
 }
 
+unsigned int hfp_tx_delay_frames(struct hfp_info* info) {
+  return 0;
+}
+
+unsigned int hfp_rx_delay_frames(struct hfp_info* info) {
+  return 0;
+}
+
+int hfp_conceal_late_input(struct hfp_info* info) {
+  return 0;
+}
+
 int hfp_buf_size(struct hfp_info* info, enum CRAS_STREAM_DIRECTION direction) {
   return fake_buffer_size;
 }
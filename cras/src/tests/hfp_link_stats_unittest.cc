@@ -0,0 +1,103 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "hfp_link_stats.h"
+}
+
+namespace {
+
+class HfpLinkStats : public testing::Test {
+ protected:
+  virtual void SetUp() { hfp_link_stats_init(&stats_); }
+
+  void LoseBurst(unsigned int len) {
+    unsigned int i;
+
+    for (i = 0; i < len; i++)
+      hfp_link_stats_packet(&stats_, true);
+    hfp_link_stats_packet(&stats_, false);
+  }
+
+  struct hfp_link_stats stats_;
+};
+
+TEST_F(HfpLinkStats, LossBursts) {
+  hfp_link_stats_packet(&stats_, false);
+  LoseBurst(1);
+  LoseBurst(3);
+  LoseBurst(4);
+  LoseBurst(7);
+  LoseBurst(8);
+  LoseBurst(20);
+
+  EXPECT_EQ(50, stats_.packets);
+  EXPECT_EQ(43, stats_.lost);
+  EXPECT_EQ(20, stats_.max_burst);
+  EXPECT_EQ(1, stats_.bursts[0]);
+  EXPECT_EQ(0, stats_.bursts[1]);
+  EXPECT_EQ(1, stats_.bursts[2]);
+  EXPECT_EQ(2, stats_.bursts[3]);
+  EXPECT_EQ(1, stats_.bursts[4]);
+  EXPECT_EQ(1, stats_.bursts[5]);
+
+  // A burst in progress counts for the longest only.
+  hfp_link_stats_packet(&stats_, true);
+  hfp_link_stats_packet(&stats_, true);
+  EXPECT_EQ(2, stats_.burst);
+  EXPECT_EQ(0, stats_.bursts[1]);
+}
+
+TEST_F(HfpLinkStats, PlcCost) {
+  hfp_link_stats_plc(&stats_, 30);
+  hfp_link_stats_plc(&stats_, 90);
+
+  EXPECT_EQ(2, stats_.plc_calls);
+  EXPECT_EQ(120, stats_.plc_usec);
+  EXPECT_EQ(90, stats_.max_plc_usec);
+}
+
+TEST_F(HfpLinkStats, Jitter) {
+  unsigned int i;
+
+  // The first read has no interval.
+  hfp_link_stats_wake(&stats_, 1000000, 7500);
+  EXPECT_EQ(0, stats_.jitter_usec);
+
+  // Reads as far apart as the audio they bring don't add jitter.
+  for (i = 0; i < 10; i++)
+    hfp_link_stats_wake(&stats_, 7500, 7500);
+  EXPECT_EQ(0, stats_.jitter_usec);
+
+  // One late by 1.6ms moves it by a sixteenth.
+  hfp_link_stats_wake(&stats_, 9100, 7500);
+  EXPECT_EQ(100, stats_.jitter_usec);
+  hfp_link_stats_wake(&stats_, 5900, 7500);
+  EXPECT_EQ(193, stats_.jitter_usec);
+
+  // And it settles back down.
+  for (i = 0; i < 200; i++)
+    hfp_link_stats_wake(&stats_, 15000, 15000);
+  EXPECT_GT(16, stats_.jitter_usec);
+  EXPECT_EQ(193, stats_.max_jitter_usec);
+  EXPECT_EQ(213, stats_.wakes);
+}
+
+TEST_F(HfpLinkStats, QueueDepth) {
+  hfp_link_stats_queue_depth(&stats_, 3);
+  hfp_link_stats_queue_depth(&stats_, 5);
+  hfp_link_stats_queue_depth(&stats_, 2);
+
+  EXPECT_EQ(2, stats_.queue_depth);
+  EXPECT_EQ(5, stats_.max_queue_depth);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
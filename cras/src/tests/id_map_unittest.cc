@@ -0,0 +1,78 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+
+#include <map>
+
+extern "C" {
+#include "cras_id_map.h"
+}
+
+namespace {
+
+static void* Value(uint32_t id) {
+  return reinterpret_cast<void*>(static_cast<uintptr_t>(id) + 1);
+}
+
+TEST(IdMapTest, InsertFindRemove) {
+  struct cras_id_map* map = cras_id_map_create();
+
+  ASSERT_NE((void*)NULL, map);
+  EXPECT_EQ((void*)NULL, cras_id_map_find(map, 3));
+  EXPECT_EQ(0, cras_id_map_insert(map, 3, Value(3)));
+  EXPECT_EQ(-EEXIST, cras_id_map_insert(map, 3, Value(4)));
+  EXPECT_EQ(-EINVAL, cras_id_map_insert(map, 4, NULL));
+  EXPECT_EQ(Value(3), cras_id_map_find(map, 3));
+  EXPECT_EQ(1, cras_id_map_size(map));
+  EXPECT_EQ(Value(3), cras_id_map_remove(map, 3));
+  EXPECT_EQ((void*)NULL, cras_id_map_remove(map, 3));
+  EXPECT_EQ(0, cras_id_map_size(map));
+  cras_id_map_destroy(map);
+
+  EXPECT_EQ((void*)NULL, cras_id_map_find(NULL, 3));
+  EXPECT_EQ(0, cras_id_map_size(NULL));
+}
+
+// Stream ids of many clients, added and removed in an interleaved order,
+// checked against std::map.
+TEST(IdMapTest, ManyStreamIds) {
+  struct cras_id_map* map = cras_id_map_create();
+  std::map<uint32_t, void*> ref;
+
+  ASSERT_NE((void*)NULL, map);
+  for (uint32_t client = 1; client <= 40; client++) {
+    for (uint32_t s = 0; s < 8; s++) {
+      uint32_t id = (client << 16) | s;
+      ASSERT_EQ(0, cras_id_map_insert(map, id, Value(id)));
+      ref[id] = Value(id);
+    }
+    // Drop every other stream of an earlier client.
+    if (client > 3) {
+      for (uint32_t s = 0; s < 8; s += 2) {
+        uint32_t id = ((client - 3) << 16) | s;
+        EXPECT_EQ(Value(id), cras_id_map_remove(map, id));
+        ref.erase(id);
+      }
+    }
+  }
+
+  EXPECT_EQ(ref.size(), cras_id_map_size(map));
+  for (uint32_t client = 1; client <= 40; client++) {
+    for (uint32_t s = 0; s < 8; s++) {
+      uint32_t id = (client << 16) | s;
+      void* expected = ref.count(id) ? ref[id] : NULL;
+      EXPECT_EQ(expected, cras_id_map_find(map, id));
+    }
+  }
+  cras_id_map_destroy(map);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
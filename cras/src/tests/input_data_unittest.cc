@@ -79,6 +79,56 @@ TEST(InputData, GetForInputStream) {
   buffer_share_destroy(offsets);
 }
 
+TEST(InputData, SilenceGatedStreamSkipsApm) {
+  void* dev_ptr = reinterpret_cast<void*>(0x123);
+  struct input_data* data;
+  struct cras_rstream stream;
+  struct buffer_share* offsets;
+  struct cras_audio_area* area;
+  struct cras_audio_area dev_area;
+  unsigned int offset;
+
+  stream.stream_id = 111;
+  stream.flags = SILENCE_GATE_OK;
+
+  data = input_data_create(dev_ptr);
+  data->ext.configure(&data->ext, 8192, 2, 48000);
+  offsets = buffer_share_create(8192);
+  buffer_share_add_id(offsets, 111, NULL);
+  buffer_share_add_id(offsets, 222, NULL);
+  buffer_share_offset_update(offsets, 111, 100);
+
+  dev_area.frames = 600;
+  data->area = &dev_area;
+  data->silent = true;
+  EXPECT_TRUE(input_data_silence_gated(data, &stream));
+
+#ifdef HAVE_WEBRTC_APM
+  cras_apm_list_process_called = 0;
+  cras_apm_list_get_active_ret = FAKE_CRAS_APM_PTR;
+#endif  // HAVE_WEBRTC_APM
+  input_data_get_for_stream(data, &stream, offsets, &area, &offset);
+
+  // The stream reads the device area as if it had no APM.
+  EXPECT_EQ(&dev_area, area);
+  EXPECT_EQ(100, offset);
+#ifdef HAVE_WEBRTC_APM
+  EXPECT_EQ(0, cras_apm_list_process_called);
+#endif  // HAVE_WEBRTC_APM
+  input_data_put_for_stream(data, &stream, offsets, 200);
+  EXPECT_EQ(300, buffer_share_id_offset(offsets, 111));
+
+  // Streams which didn't opt in aren't gated.
+  stream.flags = 0;
+  EXPECT_FALSE(input_data_silence_gated(data, &stream));
+
+#ifdef HAVE_WEBRTC_APM
+  cras_apm_list_get_active_ret = NULL;
+#endif  // HAVE_WEBRTC_APM
+  input_data_destroy(&data);
+  buffer_share_destroy(offsets);
+}
+
 TEST(InputData, GetSWCaptureGain) {
   void* dev_ptr = reinterpret_cast<void*>(0x123);
   struct input_data* data = NULL;
@@ -118,6 +168,9 @@ extern "C" {
 struct cras_apm* cras_apm_list_get_active_apm(void* stream_ptr, void* dev_ptr) {
   return cras_apm_list_get_active_ret;
 }
+unsigned int cras_apm_list_get_delay(struct cras_apm* apm) {
+  return 0;
+}
 int cras_apm_list_process(struct cras_apm* apm,
                           struct float_buffer* input,
                           unsigned int offset) {
@@ -0,0 +1,252 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include "int_ratio_resampler.h"
+}
+
+namespace {
+
+static const unsigned int kChannels = 2;
+
+static void FillSine(std::vector<int16_t>* buf,
+                     unsigned int frames,
+                     double freq,
+                     unsigned int rate) {
+  buf->resize(frames * kChannels);
+  for (unsigned int i = 0; i < frames; i++) {
+    int16_t s = 16384 * sin(2 * M_PI * freq * i / rate);
+    (*buf)[i * kChannels] = s;
+    (*buf)[i * kChannels + 1] = -s;
+  }
+}
+
+// Returns the rms of channel ch, skipping the filter's warm up.
+static double Rms(const int16_t* buf, unsigned int frames, unsigned int ch) {
+  double sum = 0;
+  for (unsigned int i = 100; i < frames; i++)
+    sum += (double)buf[i * kChannels + ch] * buf[i * kChannels + ch];
+  return sqrt(sum / (frames - 100));
+}
+
+TEST(IntRatioResampler, CreateRejectsUnsupportedRates) {
+  EXPECT_EQ((void*)NULL, int_ratio_resampler_create(2, 44100, 48000));
+  EXPECT_EQ((void*)NULL, int_ratio_resampler_create(2, 48000, 48000));
+  EXPECT_EQ((void*)NULL, int_ratio_resampler_create(2, 48000, 32000));
+  EXPECT_EQ((void*)NULL, int_ratio_resampler_create(2, 96000, 8000));
+  EXPECT_EQ((void*)NULL, int_ratio_resampler_create(0, 48000, 16000));
+
+  struct int_ratio_resampler* ir = int_ratio_resampler_create(2, 48000, 16000);
+  ASSERT_NE((void*)NULL, ir);
+  EXPECT_EQ(24, int_ratio_resampler_latency(ir));
+  int_ratio_resampler_destroy(ir);
+
+  ir = int_ratio_resampler_create(2, 16000, 48000);
+  ASSERT_NE((void*)NULL, ir);
+  EXPECT_EQ(8, int_ratio_resampler_latency(ir));
+  int_ratio_resampler_destroy(ir);
+}
+
+TEST(IntRatioResampler, FrameCountsFollowRatio) {
+  static const unsigned int rates[][2] = {
+    { 48000, 16000 }, { 48000, 8000 }, { 96000, 48000 }, { 16000, 48000 }
+  };
+  std::vector<int16_t> in, out(20000 * kChannels);
+
+  for (unsigned int r = 0; r < 4; r++) {
+    unsigned int in_frames = rates[r][0] / 10;
+    FillSine(&in, in_frames, 440, rates[r][0]);
+    struct int_ratio_resampler* ir =
+        int_ratio_resampler_create(kChannels, rates[r][0], rates[r][1]);
+    ASSERT_NE((void*)NULL, ir);
+    unsigned int count = in_frames;
+    unsigned int produced = int_ratio_resampler_process_s16(
+        ir, in.data(), &count, out.data(), 20000);
+    EXPECT_EQ(in_frames, count);
+    EXPECT_EQ(rates[r][1] / 10, produced);
+    int_ratio_resampler_destroy(ir);
+  }
+}
+
+TEST(IntRatioResampler, LimitedOutputConsumesLimitedInput) {
+  std::vector<int16_t> in, out(160 * kChannels);
+  FillSine(&in, 4800, 1000, 48000);
+  struct int_ratio_resampler* ir =
+      int_ratio_resampler_create(kChannels, 48000, 16000);
+  unsigned int count = 4800;
+  unsigned int produced =
+      int_ratio_resampler_process_s16(ir, in.data(), &count, out.data(), 160);
+  EXPECT_EQ(160, produced);
+  // The span of the last of 160 frames at 16k ends on frame 159 * 3.
+  EXPECT_EQ(159 * 3 + 1, count);
+  int_ratio_resampler_destroy(ir);
+}
+
+TEST(IntRatioResampler, DecimateChunkedMatchesOneShot) {
+  const unsigned int in_frames = 4800;
+  std::vector<int16_t> in, whole(2000 * kChannels), chunked(2000 * kChannels);
+  FillSine(&in, in_frames, 440, 48000);
+
+  struct int_ratio_resampler* ir =
+      int_ratio_resampler_create(kChannels, 48000, 16000);
+  unsigned int count = in_frames;
+  unsigned int total = int_ratio_resampler_process_s16(
+      ir, in.data(), &count, whole.data(), 2000);
+  int_ratio_resampler_reset(ir);
+
+  unsigned int in_off = 0, out_off = 0;
+  while (in_off < in_frames) {
+    count = std::min(97u, in_frames - in_off);
+    out_off += int_ratio_resampler_process_s16(
+        ir, &in[in_off * kChannels], &count, &chunked[out_off * kChannels],
+        std::min(29u, 2000 - out_off));
+    in_off += count;
+  }
+  count = 0;
+  out_off += int_ratio_resampler_process_s16(
+      ir, NULL, &count, &chunked[out_off * kChannels], 2000 - out_off);
+
+  ASSERT_EQ(total, out_off);
+  for (unsigned int i = 0; i < total * kChannels; i++)
+    ASSERT_EQ(whole[i], chunked[i]) << "sample " << i;
+  int_ratio_resampler_destroy(ir);
+}
+
+TEST(IntRatioResampler, InterpolateChunkedMatchesOneShot) {
+  const unsigned int in_frames = 1600;
+  std::vector<int16_t> in, whole(6000 * kChannels), chunked(6000 * kChannels);
+  FillSine(&in, in_frames, 440, 16000);
+
+  struct int_ratio_resampler* ir =
+      int_ratio_resampler_create(kChannels, 16000, 48000);
+  unsigned int count = in_frames;
+  unsigned int total = int_ratio_resampler_process_s16(
+      ir, in.data(), &count, whole.data(), 6000);
+  int_ratio_resampler_reset(ir);
+
+  // Output chunks that split the interpolated blocks.
+  unsigned int in_off = 0, out_off = 0;
+  while (in_off < in_frames) {
+    count = std::min(31u, in_frames - in_off);
+    out_off += int_ratio_resampler_process_s16(
+        ir, &in[in_off * kChannels], &count, &chunked[out_off * kChannels],
+        std::min(61u, 6000 - out_off));
+    in_off += count;
+  }
+  count = 0;
+  out_off += int_ratio_resampler_process_s16(
+      ir, NULL, &count, &chunked[out_off * kChannels], 6000 - out_off);
+
+  ASSERT_EQ(total, out_off);
+  for (unsigned int i = 0; i < total * kChannels; i++)
+    ASSERT_EQ(whole[i], chunked[i]) << "sample " << i;
+  int_ratio_resampler_destroy(ir);
+}
+
+TEST(IntRatioResampler, InterpolateKeepsInputFrames) {
+  std::vector<int16_t> in, out(4800 * kChannels);
+  FillSine(&in, 1600, 1000, 16000);
+  struct int_ratio_resampler* ir =
+      int_ratio_resampler_create(kChannels, 16000, 48000);
+  unsigned int count = 1600;
+  unsigned int produced =
+      int_ratio_resampler_process_s16(ir, in.data(), &count, out.data(), 4800);
+  ASSERT_GT(produced, 4000);
+  // The outputs on the center tap are the input frames themselves, delayed
+  // by the latency.
+  unsigned int delay = int_ratio_resampler_latency(ir);
+  for (unsigned int i = 0; (i + delay) * 3 < produced; i++) {
+    ASSERT_EQ(in[i * kChannels], out[(i + delay) * 3 * kChannels]);
+    ASSERT_EQ(in[i * kChannels + 1], out[(i + delay) * 3 * kChannels + 1]);
+  }
+  int_ratio_resampler_destroy(ir);
+}
+
+TEST(IntRatioResampler, PassbandKeepsLevelStopbandRejects) {
+  static const unsigned int rates[][2] = {
+    { 48000, 16000 }, { 48000, 8000 }, { 96000, 48000 }, { 16000, 48000 }
+  };
+  std::vector<int16_t> in, out(20000 * kChannels);
+
+  for (unsigned int r = 0; r < 4; r++) {
+    unsigned int src_rate = rates[r][0], dst_rate = rates[r][1];
+    unsigned int low = std::min(src_rate, dst_rate);
+    unsigned int in_frames = src_rate / 5;
+    double in_rms, out_rms;
+
+    // A tone at a fifth of the lower Nyquist frequency passes untouched.
+    FillSine(&in, in_frames, low / 10, src_rate);
+    in_rms = Rms(in.data(), in_frames, 0);
+    struct int_ratio_resampler* ir =
+        int_ratio_resampler_create(kChannels, src_rate, dst_rate);
+    unsigned int count = in_frames;
+    unsigned int produced = int_ratio_resampler_process_s16(
+        ir, in.data(), &count, out.data(), 20000);
+    out_rms = Rms(out.data(), produced, 0);
+    EXPECT_NEAR(in_rms, out_rms, in_rms * 0.01) << src_rate << "->"
+                                                << dst_rate;
+    int_ratio_resampler_destroy(ir);
+
+    if (src_rate < dst_rate)
+      continue;
+    // A tone well past the lower Nyquist frequency would alias.
+    FillSine(&in, in_frames, low * 0.7, src_rate);
+    ir = int_ratio_resampler_create(kChannels, src_rate, dst_rate);
+    count = in_frames;
+    produced = int_ratio_resampler_process_s16(ir, in.data(), &count,
+                                               out.data(), 20000);
+    out_rms = Rms(out.data(), produced, 0);
+    EXPECT_LT(out_rms, in_rms / 500) << src_rate << "->" << dst_rate;
+    int_ratio_resampler_destroy(ir);
+  }
+}
+
+TEST(IntRatioResampler, InterpolateRejectsImages) {
+  const unsigned int in_frames = 3200;
+  std::vector<int16_t> in, out(9600 * kChannels);
+  FillSine(&in, in_frames, 1000, 16000);
+  struct int_ratio_resampler* ir =
+      int_ratio_resampler_create(kChannels, 16000, 48000);
+  unsigned int count = in_frames;
+  unsigned int produced =
+      int_ratio_resampler_process_s16(ir, in.data(), &count, out.data(), 9600);
+
+  // Compare against the tone at the output rate, delayed by the latency.
+  double err = 0, sig = 0;
+  for (unsigned int i = 300; i < produced; i++) {
+    double ref = 16384 * sin(2 * M_PI * 1000 * (i / 3.0 - 8) / 16000);
+    double d = out[i * kChannels] - ref;
+    err += d * d;
+    sig += ref * ref;
+  }
+  EXPECT_LT(err, sig / 1e5);
+  int_ratio_resampler_destroy(ir);
+}
+
+TEST(IntRatioResampler, S32FullScaleDoesNotWrap) {
+  std::vector<int32_t> in(480 * kChannels, INT32_MAX), out(240 * kChannels);
+  struct int_ratio_resampler* ir =
+      int_ratio_resampler_create(kChannels, 48000, 24000);
+  unsigned int count = 480;
+  unsigned int produced =
+      int_ratio_resampler_process_s32(ir, in.data(), &count, out.data(), 240);
+  ASSERT_GT(produced, 200);
+  // Rounding may land just past INT32_MAX, which must clip and not wrap.
+  EXPECT_GT(out[200 * kChannels], INT32_MAX - 4096);
+  int_ratio_resampler_destroy(ir);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -40,9 +40,16 @@ static cras_iodev* audio_thread_add_open_dev_dev;
 static int audio_thread_add_open_dev_called;
 static int audio_thread_rm_open_dev_called;
 static int audio_thread_is_dev_open_ret;
-static struct audio_thread thread;
+static int audio_thread_is_dev_open_called;
+static struct audio_thread threads[3];
+static unsigned int audio_thread_create_called;
+static unsigned int max_audio_threads_ret;
+static struct audio_thread* audio_thread_add_open_dev_thread;
+static struct audio_thread* audio_thread_add_stream_thread;
 static struct cras_iodev loopback_input;
 static int cras_iodev_close_called;
+static int cras_iodev_save_resume_format_called;
+static int cras_iodev_drop_resume_format_called;
 static struct cras_iodev* cras_iodev_close_dev;
 static struct cras_iodev mock_hotword_iodev;
 static struct cras_iodev mock_empty_iodev[2];
@@ -52,7 +59,13 @@ static struct cras_rstream* stream_list_get_ret;
 static int server_stream_create_called;
 static int server_stream_destroy_called;
 static int audio_thread_drain_stream_return;
+static int audio_thread_add_stream_async_called;
+static int audio_thread_sync_called;
+static int stream_list_begin_batch_called;
+static int stream_list_end_batch_called;
 static int audio_thread_drain_stream_called;
+static int cras_rclient_send_message_called;
+static unsigned int cras_rclient_send_message_id;
 static int cras_tm_create_timer_called;
 static int cras_tm_cancel_timer_called;
 static void (*cras_tm_timer_cb)(struct cras_timer* t, void* data);
@@ -96,6 +109,10 @@ static int audio_thread_disconnect_stream_called;
 static struct cras_iodev fake_sco_in_dev, fake_sco_out_dev;
 static struct cras_ionode fake_sco_in_node, fake_sco_out_node;
 static int server_state_hotword_pause_at_suspend;
+static int warm_standby_ms_ret;
+static int mic_keep_warm_ms_ret;
+static bool native_rate_enabled_ret;
+static int cras_apm_list_release_idle_called;
 
 int dev_idx_in_vector(std::vector<unsigned int> v, unsigned int idx) {
   return std::find(v.begin(), v.end(), idx) != v.end();
@@ -112,18 +129,28 @@ class IoDevTestSuite : public testing::Test {
     cras_iodev_list_reset();
 
     cras_iodev_close_called = 0;
+    cras_iodev_save_resume_format_called = 0;
+    cras_iodev_drop_resume_format_called = 0;
     stream_list_get_ret = 0;
     server_stream_create_called = 0;
     server_stream_destroy_called = 0;
     audio_thread_drain_stream_return = 0;
+    audio_thread_add_stream_async_called = 0;
+    audio_thread_sync_called = 0;
+    stream_list_begin_batch_called = 0;
+    stream_list_end_batch_called = 0;
     audio_thread_drain_stream_called = 0;
+    cras_rclient_send_message_called = 0;
     cras_tm_create_timer_called = 0;
     cras_tm_cancel_timer_called = 0;
 
     audio_thread_disconnect_stream_called = 0;
     audio_thread_disconnect_stream_stream = NULL;
     audio_thread_is_dev_open_ret = 0;
+    audio_thread_is_dev_open_called = 0;
     stream_list_has_pinned_stream_ret.clear();
+    audio_thread_create_called = 0;
+    max_audio_threads_ret = 1;
 
     sample_rates_[0] = 44100;
     sample_rates_[1] = 48000;
@@ -240,6 +267,10 @@ class IoDevTestSuite : public testing::Test {
     mock_empty_iodev[1].update_active_node = update_active_node;
     mock_hotword_iodev.update_active_node = update_active_node;
     server_state_hotword_pause_at_suspend = 0;
+    warm_standby_ms_ret = 0;
+    native_rate_enabled_ret = false;
+    mic_keep_warm_ms_ret = 0;
+    cras_apm_list_release_idle_called = 0;
   }
 
   virtual void TearDown() {
@@ -331,6 +362,7 @@ TEST_F(IoDevTestSuite, SetSuspendResume) {
   audio_thread_rm_open_dev_called = 0;
   observer_ops->suspend_changed(NULL, 1);
   EXPECT_EQ(1, audio_thread_rm_open_dev_called);
+  EXPECT_EQ(2, cras_iodev_save_resume_format_called);
 
   /* Test disable/enable dev won't cause add_stream to audio_thread. */
   audio_thread_add_stream_called = 0;
@@ -356,6 +388,7 @@ TEST_F(IoDevTestSuite, SetSuspendResume) {
   EXPECT_EQ(1, audio_thread_add_open_dev_called);
   EXPECT_EQ(2, audio_thread_add_stream_called);
   EXPECT_EQ(&rstream3, audio_thread_add_stream_stream);
+  EXPECT_EQ(2, cras_iodev_drop_resume_format_called);
 
   cras_iodev_list_deinit();
   EXPECT_EQ(3, cras_observer_notify_active_node_called);
@@ -426,6 +459,115 @@ TEST_F(IoDevTestSuite, ReopenDevForHigherChannels) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, PassthroughStreamNeedsDecodingSink) {
+  struct cras_rstream rstream, rstream2;
+  struct cras_rstream* stream_list = NULL;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  rstream.format = fmt_;
+  rstream.flags = PASSTHROUGH;
+  rstream2.format = fmt_;
+  rstream2.flags = PASSTHROUGH;
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+
+  /* The sink doesn't decode any compressed format, so the stream is left
+   * to the fallback device. */
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_NE(&d1_, audio_thread_add_stream_dev);
+  stream_rm_cb(&rstream);
+
+  node1.compressed_formats = 1 << 2;
+  audio_thread_add_stream_called = 0;
+  EXPECT_EQ(0, stream_add_cb(&rstream));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(&d1_, audio_thread_add_stream_dev);
+
+  /* Only one passthrough stream plays at a time. */
+  DL_APPEND(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  EXPECT_EQ(-EBUSY, stream_add_cb(&rstream2));
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, ReopenDevAtNativeRate) {
+  struct cras_rstream rstream, rstream2, rstream3;
+  struct cras_rstream* stream_list = NULL;
+  snd_pcm_format_t pcm_formats[] = {SND_PCM_FORMAT_S16_LE,
+                                    static_cast<snd_pcm_format_t>(0)};
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  memset(&rstream3, 0, sizeof(rstream3));
+  rstream.format = fmt_;
+  rstream2.format = fmt_;
+  rstream2.format.frame_rate = 44100;
+  rstream3.format = fmt_;
+  rstream3.format.frame_rate = 96000;
+  native_rate_enabled_ret = true;
+
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  d1_.supported_formats = pcm_formats;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+
+  cras_iodev_list_add_active_node(CRAS_STREAM_OUTPUT,
+                                  cras_make_node_id(d1_.info.idx, 1));
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(48000, d1_.format->frame_rate);
+
+  /* Streams at different rates are mixed at the rate d1 is open at. */
+  audio_thread_add_stream_called = 0;
+  cras_iodev_open_called = 0;
+  DL_APPEND(stream_list, &rstream2);
+  stream_add_cb(&rstream2);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(0, cras_iodev_open_called);
+
+  /* d1 doesn't support 96k, keep it at 48k. */
+  DL_DELETE(stream_list, &rstream);
+  DL_DELETE(stream_list, &rstream2);
+  DL_APPEND(stream_list, &rstream3);
+  stream_list_get_ret = stream_list;
+  audio_thread_add_stream_called = 0;
+  stream_add_cb(&rstream3);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(0, cras_iodev_open_called);
+
+  /* The only stream plays 44.1k, re-open d1 at it through the fallback
+   * device and ramp the stream in. */
+  DL_DELETE(stream_list, &rstream3);
+  DL_APPEND(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  audio_thread_add_stream_called = 0;
+  d1_.initial_ramp_request = CRAS_IODEV_RAMP_REQUEST_NONE;
+  stream_add_cb(&rstream2);
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+  EXPECT_EQ(2, cras_iodev_open_called);
+  EXPECT_EQ(44100, d1_.format->frame_rate);
+  EXPECT_EQ(CRAS_IODEV_RAMP_REQUEST_UP_START_PLAYBACK,
+            d1_.initial_ramp_request);
+
+  cras_iodev_list_deinit();
+}
+
 /* Check that after resume, all output devices enter ramp mute state if there is
  * any output stream. */
 TEST_F(IoDevTestSuite, RampMuteAfterResume) {
@@ -572,6 +714,108 @@ TEST_F(IoDevTestSuite, InitDevWithEchoRef) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, StreamBatchWaitsForThreadOnce) {
+  struct cras_rstream rstream, rstream2;
+  struct cras_rstream* stream_list = NULL;
+
+  memset(&rstream, 0, sizeof(rstream));
+  memset(&rstream2, 0, sizeof(rstream2));
+  rstream.direction = CRAS_STREAM_OUTPUT;
+  rstream2.direction = CRAS_STREAM_OUTPUT;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_OUTPUT;
+  d1_.format = &fmt_;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 0));
+
+  cras_iodev_list_begin_stream_batch();
+  cras_iodev_list_begin_stream_batch();
+  EXPECT_EQ(1, stream_list_begin_batch_called);
+
+  DL_APPEND(stream_list, &rstream);
+  DL_APPEND(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  stream_add_cb(&rstream2);
+  EXPECT_EQ(2, audio_thread_add_stream_async_called);
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+
+  /* Only the outermost end waits for the thread. */
+  cras_iodev_list_end_stream_batch();
+  EXPECT_EQ(0, audio_thread_sync_called);
+  cras_iodev_list_end_stream_batch();
+  EXPECT_EQ(1, audio_thread_sync_called);
+  EXPECT_EQ(1, stream_list_end_batch_called);
+
+  /* Out of a batch, adds wait for the thread again. */
+  cras_iodev_list_end_stream_batch();
+  DL_DELETE(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  stream_rm_cb(&rstream2);
+  DL_APPEND(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream2);
+  EXPECT_EQ(2, audio_thread_add_stream_async_called);
+  EXPECT_EQ(3, audio_thread_add_stream_called);
+  EXPECT_EQ(1, audio_thread_sync_called);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, InputKeptWarmAfterLastStream) {
+  struct cras_rstream rstream;
+  struct cras_rstream* stream_list = NULL;
+
+  memset(&rstream, 0, sizeof(rstream));
+  rstream.direction = CRAS_STREAM_INPUT;
+  mic_keep_warm_ms_ret = 500;
+  clock_gettime_retspec.tv_sec = 10;
+  clock_gettime_retspec.tv_nsec = 0;
+  cras_iodev_list_init();
+
+  d1_.direction = CRAS_STREAM_INPUT;
+  d1_.format = &fmt_;
+  ASSERT_EQ(0, cras_iodev_list_add_input(&d1_));
+  cras_iodev_list_select_node(CRAS_STREAM_INPUT,
+                              cras_make_node_id(d1_.info.idx, 0));
+
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+
+  /* The mic keeps running after the last capture stream. */
+  DL_DELETE(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_rm_cb(&rstream);
+  EXPECT_EQ(0, cras_iodev_close_called);
+  EXPECT_EQ(1, cras_tm_create_timer_called);
+
+  /* The next stream attaches without opening it again. */
+  DL_APPEND(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+
+  DL_DELETE(stream_list, &rstream);
+  stream_list_get_ret = stream_list;
+  stream_rm_cb(&rstream);
+  EXPECT_EQ(0, cras_iodev_close_called);
+
+  clock_gettime_retspec.tv_sec = 11;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(&d1_, cras_iodev_close_dev);
+#ifdef HAVE_WEBRTC_APM
+  EXPECT_EQ(1, cras_apm_list_release_idle_called);
+#endif
+
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, SelectNodeOpenFailShouldScheduleRetry) {
   struct cras_rstream rstream;
   struct cras_rstream* stream_list = NULL;
@@ -744,6 +988,66 @@ TEST_F(IoDevTestSuite, PinnedStreamInitFailShouldScheduleRetry) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, PinnedDevicesRunOnClockDomainThreads) {
+  struct cras_rstream rstream1, rstream2;
+  struct cras_rstream* stream_list = NULL;
+  int domain_a, domain_b;
+
+  memset(&rstream1, 0, sizeof(rstream1));
+  memset(&rstream2, 0, sizeof(rstream2));
+  max_audio_threads_ret = 3;
+  cras_iodev_list_init();
+
+  d1_.clock_domain = &domain_a;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d2_.clock_domain = &domain_b;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d2_));
+  d1_.format = &fmt_;
+  d2_.format = &fmt_;
+
+  rstream1.is_pinned = 1;
+  rstream1.pinned_dev_idx = d1_.info.idx;
+  rstream2.is_pinned = 1;
+  rstream2.pinned_dev_idx = d2_.info.idx;
+  DL_APPEND(stream_list, &rstream1);
+  DL_APPEND(stream_list, &rstream2);
+  stream_list_get_ret = stream_list;
+
+  // Each clock domain goes to its own extra thread.
+  stream_add_cb(&rstream1);
+  EXPECT_EQ(&threads[1], d1_.thread);
+  EXPECT_EQ(&threads[1], audio_thread_add_open_dev_thread);
+  EXPECT_EQ(&threads[1], audio_thread_add_stream_thread);
+  stream_add_cb(&rstream2);
+  EXPECT_EQ(&threads[2], d2_.thread);
+  EXPECT_EQ(&threads[2], audio_thread_add_stream_thread);
+
+  // Enabled devices share streams, they move to the main audio thread.
+  cras_iodev_close_called = 0;
+  audio_thread_add_stream_called = 0;
+  cras_iodev_list_enable_dev(&d1_);
+  EXPECT_EQ(1, cras_iodev_close_called);
+  EXPECT_EQ(&d1_, cras_iodev_close_dev);
+  EXPECT_EQ(&threads[0], d1_.thread);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(&rstream1, audio_thread_add_stream_stream);
+  EXPECT_EQ(&threads[0], audio_thread_add_stream_thread);
+  EXPECT_EQ(&threads[2], d2_.thread);
+
+  // Disabled again with its pinned stream, it goes back to an extra thread.
+  stream_list_has_pinned_stream_ret[d1_.info.idx] = 1;
+  audio_thread_add_stream_called = 0;
+  cras_iodev_list_disable_dev(&d1_, false);
+  EXPECT_NE(&threads[0], d1_.thread);
+  EXPECT_NE((void*)NULL, d1_.thread);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(d1_.thread, audio_thread_add_stream_thread);
+
+  cras_iodev_list_rm_output(&d1_);
+  cras_iodev_list_rm_output(&d2_);
+  cras_iodev_list_deinit();
+}
+
 static void device_enabled_cb(struct cras_iodev* dev, void* cb_data) {
   device_enabled_dev = dev;
   device_enabled_count++;
@@ -1583,6 +1887,114 @@ TEST_F(IoDevTestSuite, DrainTimerCancel) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, SelectNodeKeepsOldOutputOnStandby) {
+  struct cras_rstream rstream;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  warm_standby_ms_ret = 2000;
+  cras_iodev_list_init();
+
+  node1.idx = 1;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  node2.idx = 2;
+  rc = cras_iodev_list_add_output(&d2_);
+  ASSERT_EQ(0, rc);
+
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 1));
+  DL_APPEND(stream_list_get_ret, &rstream);
+  stream_add_cb(&rstream);
+  EXPECT_EQ(1, cras_iodev_open_called);
+
+  // d1_ only loses its stream, it stays open for the standby time.
+  audio_thread_disconnect_stream_called = 0;
+  clock_gettime_retspec.tv_sec = 10;
+  clock_gettime_retspec.tv_nsec = 0;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d2_.info.idx, 2));
+  EXPECT_EQ(&d2_, cras_iodev_list_get_first_enabled_iodev(CRAS_STREAM_OUTPUT));
+  EXPECT_EQ(0, cras_iodev_list_dev_is_enabled(&d1_));
+  EXPECT_EQ(CRAS_IODEV_STATE_OPEN, d1_.state);
+  EXPECT_EQ(1, audio_thread_disconnect_stream_called);
+  // The fallback device and d2_ opened.
+  EXPECT_EQ(3, cras_iodev_open_called);
+
+  // Switching back only attaches the stream to d1_, with a ramp in.
+  audio_thread_add_stream_called = 0;
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 1));
+  EXPECT_EQ(3, cras_iodev_open_called);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+  EXPECT_EQ(&d1_, audio_thread_add_stream_dev);
+  EXPECT_EQ(CRAS_IODEV_RAMP_REQUEST_UP_START_PLAYBACK,
+            d1_.initial_ramp_request);
+  EXPECT_EQ(CRAS_IODEV_STATE_OPEN, d2_.state);
+
+  // d2_ is closed once its standby time is over.
+  clock_gettime_retspec.tv_sec = 13;
+  cras_tm_timer_cb(NULL, NULL);
+  EXPECT_EQ(CRAS_IODEV_STATE_CLOSE, d2_.state);
+  EXPECT_EQ(&d2_, cras_iodev_close_dev);
+  EXPECT_EQ(CRAS_IODEV_STATE_OPEN, d1_.state);
+
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, StandbyOutputsOpenWithStream) {
+  struct cras_rstream rstream;
+  int card, other_card;
+  int rc;
+
+  memset(&rstream, 0, sizeof(rstream));
+  warm_standby_ms_ret = 2000;
+  cras_iodev_list_init();
+
+  // d2_ shares the card of d1_, d3_ is an other card.
+  d1_.clock_domain = &card;
+  d2_.clock_domain = &card;
+  d3_.clock_domain = &other_card;
+  node1.idx = 1;
+  node2.idx = 2;
+  node2.plugged = 1;
+  node3.idx = 3;
+  node3.plugged = 1;
+  rc = cras_iodev_list_add_output(&d1_);
+  ASSERT_EQ(0, rc);
+  rc = cras_iodev_list_add_output(&d2_);
+  ASSERT_EQ(0, rc);
+  rc = cras_iodev_list_add_output(&d3_);
+  ASSERT_EQ(0, rc);
+
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d1_.info.idx, 1));
+  EXPECT_EQ(0, cras_iodev_open_called);
+
+  DL_APPEND(stream_list_get_ret, &rstream);
+  stream_add_cb(&rstream);
+  EXPECT_EQ(2, cras_iodev_open_called);
+  EXPECT_EQ(CRAS_IODEV_STATE_OPEN, d2_.state);
+  EXPECT_EQ(CRAS_IODEV_STATE_CLOSE, d3_.state);
+  EXPECT_EQ(1, audio_thread_add_stream_called);
+
+  // HDMI is kept ready whatever card it's on.
+  node3.type = CRAS_NODE_TYPE_HDMI;
+  DL_DELETE(stream_list_get_ret, &rstream);
+  DL_APPEND(stream_list_get_ret, &rstream);
+  stream_add_cb(&rstream);
+  EXPECT_EQ(3, cras_iodev_open_called);
+  EXPECT_EQ(CRAS_IODEV_STATE_OPEN, d3_.state);
+
+  // Switching to d2_ doesn't open it again.
+  cras_iodev_list_select_node(CRAS_STREAM_OUTPUT,
+                              cras_make_node_id(d2_.info.idx, 2));
+  EXPECT_EQ(3, cras_iodev_open_called);
+  EXPECT_EQ(&d2_, audio_thread_add_stream_dev);
+
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, RemoveThenSelectActiveNode) {
   int rc;
   cras_node_id_t id;
@@ -1777,6 +2189,75 @@ TEST_F(IoDevTestSuite, AddRemovePinnedStream) {
   cras_iodev_list_deinit();
 }
 
+TEST_F(IoDevTestSuite, PinnedStreamOnRunningDevice) {
+  struct cras_rstream rstream1, rstream2;
+  int domain;
+
+  memset(&rstream1, 0, sizeof(rstream1));
+  memset(&rstream2, 0, sizeof(rstream2));
+  max_audio_threads_ret = 3;
+  cras_iodev_list_init();
+
+  d1_.clock_domain = &domain;
+  ASSERT_EQ(0, cras_iodev_list_add_output(&d1_));
+  d1_.format = &fmt_;
+  rstream1.is_pinned = 1;
+  rstream1.pinned_dev_idx = d1_.info.idx;
+  rstream2.is_pinned = 1;
+  rstream2.pinned_dev_idx = d1_.info.idx;
+
+  EXPECT_EQ(0, stream_add_cb(&rstream1));
+  EXPECT_EQ(&threads[1], d1_.thread);
+  EXPECT_EQ(1, audio_thread_is_dev_open_called);
+
+  // The device runs already, the stream goes straight to its thread.
+  d1_.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  update_active_node_called = 0;
+  EXPECT_EQ(0, stream_add_cb(&rstream2));
+  EXPECT_EQ(1, audio_thread_is_dev_open_called);
+  EXPECT_EQ(0, update_active_node_called);
+  EXPECT_EQ(2, audio_thread_add_stream_called);
+  EXPECT_EQ(&threads[1], audio_thread_add_stream_thread);
+
+  // Only the thread of the device drains, enabled devices are left alone.
+  stream_list_has_pinned_stream_ret[d1_.info.idx] = 1;
+  cras_iodev_close_called = 0;
+  audio_thread_drain_stream_called = 0;
+  EXPECT_EQ(0, stream_rm_cb(&rstream2));
+  EXPECT_EQ(1, audio_thread_drain_stream_called);
+  EXPECT_EQ(0, cras_iodev_close_called);
+
+  d1_.state = CRAS_IODEV_STATE_CLOSE;
+  cras_iodev_list_rm_output(&d1_);
+  cras_iodev_list_deinit();
+}
+
+TEST_F(IoDevTestSuite, NotifyClientOfDrainedStream) {
+  struct cras_rstream rstream;
+
+  memset(&rstream, 0, sizeof(rstream));
+  cras_iodev_list_init();
+
+  // Still draining, nothing to tell yet.
+  rstream.notify_drained = 1;
+  rstream.client = reinterpret_cast<struct cras_rclient*>(0x33);
+  audio_thread_drain_stream_return = 10;
+  EXPECT_EQ(10, stream_rm_cb(&rstream));
+  EXPECT_EQ(0, cras_rclient_send_message_called);
+
+  audio_thread_drain_stream_return = 0;
+  EXPECT_EQ(0, stream_rm_cb(&rstream));
+  EXPECT_EQ(1, cras_rclient_send_message_called);
+  EXPECT_EQ(CRAS_CLIENT_STREAM_DRAINED, cras_rclient_send_message_id);
+
+  // The client went away while the stream drained.
+  rstream.client = NULL;
+  EXPECT_EQ(0, stream_rm_cb(&rstream));
+  EXPECT_EQ(1, cras_rclient_send_message_called);
+
+  cras_iodev_list_deinit();
+}
+
 TEST_F(IoDevTestSuite, SuspendResumePinnedStream) {
   struct cras_rstream rstream;
 
@@ -2061,6 +2542,8 @@ struct cras_server_state* cras_system_state_update_begin() {
 
 void cras_system_state_update_complete() {}
 
+void cras_system_state_journal_change(uint32_t changes) {}
+
 int cras_system_get_mute() {
   return system_get_mute_return;
 }
@@ -2070,7 +2553,7 @@ bool cras_system_get_noise_cancellation_enabled() {
 }
 
 struct audio_thread* audio_thread_create() {
-  return &thread;
+  return &threads[audio_thread_create_called++ % 3];
 }
 
 int audio_thread_start(struct audio_thread* thread) {
@@ -2094,6 +2577,7 @@ void audio_thread_remove_streams(struct audio_thread* thread,
 int audio_thread_add_open_dev(struct audio_thread* thread,
                               struct cras_iodev* dev) {
   audio_thread_add_open_dev_dev = dev;
+  audio_thread_add_open_dev_thread = thread;
   audio_thread_add_open_dev_called++;
   return 0;
 }
@@ -2107,6 +2591,7 @@ int audio_thread_rm_open_dev(struct audio_thread* thread,
 
 int audio_thread_is_dev_open(struct audio_thread* thread,
                              struct cras_iodev* dev) {
+  audio_thread_is_dev_open_called++;
   return audio_thread_is_dev_open_ret;
 }
 
@@ -2115,11 +2600,25 @@ int audio_thread_add_stream(struct audio_thread* thread,
                             struct cras_iodev** devs,
                             unsigned int num_devs) {
   audio_thread_add_stream_called++;
+  audio_thread_add_stream_thread = thread;
   audio_thread_add_stream_stream = stream;
   audio_thread_add_stream_dev = (num_devs ? devs[0] : NULL);
   return 0;
 }
 
+int audio_thread_add_stream_async(struct audio_thread* thread,
+                                  struct cras_rstream* stream,
+                                  struct cras_iodev** devs,
+                                  unsigned int num_devs) {
+  audio_thread_add_stream_async_called++;
+  return audio_thread_add_stream(thread, stream, devs, num_devs);
+}
+
+int audio_thread_sync(struct audio_thread* thread) {
+  audio_thread_sync_called++;
+  return 0;
+}
+
 int audio_thread_disconnect_stream(struct audio_thread* thread,
                                    struct cras_rstream* stream,
                                    struct cras_iodev* iodev) {
@@ -2175,6 +2674,9 @@ struct cras_iodev* loopback_iodev_create(enum CRAS_LOOPBACK_TYPE type) {
 
 void loopback_iodev_destroy(struct cras_iodev* iodev) {}
 
+void loopback_iodev_set_target(struct cras_iodev* loopdev,
+                               const struct loopback_target* target) {}
+
 int cras_iodev_open(struct cras_iodev* iodev,
                     unsigned int cb_level,
                     const struct cras_audio_format* fmt) {
@@ -2198,6 +2700,14 @@ int cras_iodev_set_format(struct cras_iodev* iodev,
   return 0;
 }
 
+void cras_iodev_save_resume_format(struct cras_iodev* iodev) {
+  cras_iodev_save_resume_format_called++;
+}
+
+void cras_iodev_drop_resume_format(struct cras_iodev* iodev) {
+  cras_iodev_drop_resume_format_called++;
+}
+
 int cras_iodev_set_mute(struct cras_iodev* iodev) {
   set_mute_called++;
   set_mute_dev_vector.push_back(iodev);
@@ -2212,6 +2722,15 @@ bool cras_iodev_support_noise_cancellation(const struct cras_iodev* iodev) {
   return true;
 }
 
+uint64_t cras_iodev_get_dsp_effects(const struct cras_iodev* iodev) {
+  return 0;
+}
+
+void cras_iodev_get_dsp_format(const struct cras_iodev* iodev,
+                               struct cras_audio_format* fmt) {
+  *fmt = *iodev->format;
+}
+
 int cras_iodev_start_volume_ramp(struct cras_iodev* odev,
                                  unsigned int old_volume,
                                  unsigned int new_volume) {
@@ -2238,6 +2757,14 @@ struct stream_list* stream_list_create(stream_callback* add_cb,
 
 void stream_list_destroy(struct stream_list* list) {}
 
+void stream_list_begin_batch(struct stream_list* list) {
+  stream_list_begin_batch_called++;
+}
+
+void stream_list_end_batch(struct stream_list* list) {
+  stream_list_end_batch_called++;
+}
+
 struct cras_rstream* stream_list_get(struct stream_list* list) {
   return stream_list_get_ret;
 }
@@ -2339,10 +2866,14 @@ int audio_thread_dev_start_ramp(struct audio_thread* thread,
 struct cras_apm* cras_apm_list_add_apm(struct cras_apm_list* list,
                                        void* dev_ptr,
                                        const struct cras_audio_format* fmt,
-                                       bool is_internal_dev) {
+                                       bool is_internal_dev,
+                                       uint64_t dsp_effects) {
   return NULL;
 }
 void cras_apm_list_remove_apm(struct cras_apm_list* list, void* dev_ptr) {}
+void cras_apm_list_release_idle(void* dev_ptr) {
+  cras_apm_list_release_idle_called++;
+}
 int cras_apm_list_init(const char* device_config_dir) {
   return 0;
 }
@@ -2359,4 +2890,31 @@ bool cras_system_get_hotword_pause_at_suspend() {
   return !!server_state_hotword_pause_at_suspend;
 }
 
+unsigned int cras_system_get_max_audio_threads() {
+  return max_audio_threads_ret;
+}
+
+int cras_system_get_warm_standby_ms() {
+  return warm_standby_ms_ret;
+}
+
+int cras_system_get_mic_keep_warm_ms() {
+  return mic_keep_warm_ms_ret;
+}
+
+bool cras_system_get_native_rate_enabled() {
+  return native_rate_enabled_ret;
+}
+
+void audio_thread_set_main_callback_thread(struct audio_thread* thread) {}
+
+int cras_rclient_send_message(const struct cras_rclient* client,
+                              const struct cras_client_message* msg,
+                              int* fds,
+                              unsigned int num_fds) {
+  cras_rclient_send_message_called++;
+  cras_rclient_send_message_id = msg->id;
+  return 0;
+}
+
 }  // extern "C"
@@ -24,6 +24,8 @@ std::unordered_map<cras_iodev*, timespec> drop_time_map;
 std::unordered_map<const cras_iodev*, double> est_rate_ratio_map;
 std::unordered_map<const cras_iodev*, int> update_rate_map;
 std::unordered_map<const cras_ionode*, int> on_internal_card_map;
+std::unordered_map<const cras_iodev*, int> reset_request_map;
+std::unordered_map<const cras_iodev*, unsigned int> fill_zeros_map;
 }  // namespace
 
 void iodev_stub_reset() {
@@ -33,6 +35,8 @@ void iodev_stub_reset() {
   est_rate_ratio_map.clear();
   update_rate_map.clear();
   on_internal_card_map.clear();
+  reset_request_map.clear();
+  fill_zeros_map.clear();
 }
 
 void iodev_stub_est_rate_ratio(cras_iodev* iodev, double ratio) {
@@ -49,7 +53,7 @@ void iodev_stub_on_internal_card(cras_ionode* node, int data) {
 
 void iodev_stub_frames_queued(cras_iodev* iodev, int ret, timespec ts) {
   cb_data data = {ret, ts};
-  frames_queued_map.insert({iodev, data});
+  frames_queued_map[iodev] = data;
 }
 
 void iodev_stub_valid_frames(cras_iodev* iodev, int ret, timespec ts) {
@@ -57,6 +61,11 @@ void iodev_stub_valid_frames(cras_iodev* iodev, int ret, timespec ts) {
   valid_frames_map.insert({iodev, data});
 }
 
+int iodev_stub_get_reset_request_count(cras_iodev* iodev) {
+  auto elem = reset_request_map.find(iodev);
+  return elem == reset_request_map.end() ? 0 : elem->second;
+}
+
 bool iodev_stub_get_drop_time(cras_iodev* iodev, timespec* ts) {
   auto elem = drop_time_map.find(iodev);
   if (elem != drop_time_map.end()) {
@@ -66,6 +75,11 @@ bool iodev_stub_get_drop_time(cras_iodev* iodev, timespec* ts) {
   return false;
 }
 
+unsigned int iodev_stub_get_fill_zeros(cras_iodev* iodev) {
+  auto elem = fill_zeros_map.find(iodev);
+  return elem == fill_zeros_map.end() ? 0 : elem->second;
+}
+
 extern "C" {
 
 int cras_iodev_add_stream(struct cras_iodev* iodev, struct dev_stream* stream) {
@@ -142,6 +156,14 @@ int cras_iodev_put_output_buffer(struct cras_iodev* iodev,
   return 0;
 }
 
+int cras_iodev_put_output_bus(struct cras_iodev* iodev,
+                              uint8_t* frames,
+                              unsigned int nframes,
+                              int* non_empty,
+                              struct cras_fmt_conv* output_converter) {
+  return 0;
+}
+
 int cras_iodev_get_input_buffer(struct cras_iodev* iodev, unsigned* frames) {
   return 0;
 }
@@ -183,6 +205,7 @@ int cras_iodev_output_underrun(struct cras_iodev* odev,
 }
 
 int cras_iodev_reset_request(struct cras_iodev* iodev) {
+  reset_request_map[iodev]++;
   return 0;
 }
 
@@ -209,6 +232,11 @@ void cras_iodev_update_highest_hw_level(struct cras_iodev* iodev,
 void cras_iodev_start_stream(struct cras_iodev* iodev,
                              struct dev_stream* stream) {}
 
+int cras_iodev_fill_odev_zeros(struct cras_iodev* odev, unsigned int frames) {
+  fill_zeros_map[odev] += frames;
+  return 0;
+}
+
 int cras_iodev_drop_frames_by_time(struct cras_iodev* iodev,
                                    struct timespec ts) {
   drop_time_map.insert({iodev, ts});
@@ -222,4 +250,17 @@ bool cras_iodev_is_on_internal_card(const struct cras_ionode* node) {
   }
   return 1;
 }
+
+void loopback_tap_mix_stream(unsigned int dev_idx,
+                             const struct cras_rstream* stream,
+                             const struct cras_audio_format* fmt,
+                             uint8_t* frames,
+                             unsigned int nframes,
+                             int mute,
+                             float mix_vol) {}
+
+bool loopback_tap_keeps_stream(unsigned int dev_idx,
+                               const struct cras_rstream* stream) {
+  return false;
+}
 }  // extern "C"
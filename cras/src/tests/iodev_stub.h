@@ -20,6 +20,10 @@ void iodev_stub_frames_queued(cras_iodev* iodev, int ret, timespec ts);
 
 void iodev_stub_valid_frames(cras_iodev* iodev, int ret, timespec ts);
 
+int iodev_stub_get_reset_request_count(cras_iodev* iodev);
+
 bool iodev_stub_get_drop_time(cras_iodev* iodev, timespec* ts);
 
+unsigned int iodev_stub_get_fill_zeros(cras_iodev* iodev);
+
 #endif  // IODEV_STUB_H_
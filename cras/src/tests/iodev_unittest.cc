@@ -5,6 +5,8 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <vector>
+
 extern "C" {
 #include "audio_thread_log.h"
 #include "cras_audio_area.h"
@@ -14,6 +16,8 @@ extern "C" {
 #include "cras_rstream.h"
 #include "dev_stream.h"
 #include "input_data.h"
+#include "mix_bus.h"
+#include "rate_estimator.h"
 #include "utlist.h"
 
 // Mock software volume scalers.
@@ -48,19 +52,38 @@ static unsigned int cras_system_get_volume_return;
 static int cras_dsp_get_pipeline_called;
 static int cras_dsp_get_pipeline_ret;
 static int cras_dsp_put_pipeline_called;
+static int cras_dsp_lock_pipeline_called;
+static int cras_dsp_unlock_pipeline_called;
 static int cras_dsp_pipeline_get_source_buffer_called;
 static int cras_dsp_pipeline_get_sink_buffer_called;
 static float cras_dsp_pipeline_source_buffer[2][DSP_BUFFER_SIZE];
 static float cras_dsp_pipeline_sink_buffer[2][DSP_BUFFER_SIZE];
 static int cras_dsp_pipeline_get_delay_called;
-static int cras_dsp_pipeline_apply_called;
+static int cras_dsp_apply_called;
 static int cras_dsp_pipeline_set_sink_ext_module_called;
-static int cras_dsp_pipeline_apply_sample_count;
+static int cras_dsp_apply_sample_count;
 static unsigned int cras_mix_mute_count;
+static bool cras_system_get_float_mix_bus_enabled_return;
+static bool cras_system_get_dsp_offload_enabled_return;
+static bool cras_system_get_native_rate_enabled_return;
+static bool cras_system_get_noise_cancellation_enabled_return;
+static unsigned int cras_dsp_offload_create_latency;
+static unsigned int cras_dsp_offload_create_max_frames;
+static int cras_dsp_offload_destroy_called;
+static int cras_dsp_offload_apply_called;
+static int dsp_util_interleave_called;
+static int cras_dsp_apply_planar_called;
+static unsigned int cras_dsp_apply_planar_frames;
+static float* const* cras_dsp_apply_planar_planes;
+static unsigned int cras_dsp_apply_planar_num_planes;
+static int cras_channel_remix_convert_called;
+static int cras_channel_remix_convert_planar_called;
+static int cras_channel_remix_convert_planar_ret;
 static unsigned int cras_dsp_num_input_channels_return;
 static unsigned int cras_dsp_num_output_channels_return;
 struct cras_dsp_context* cras_dsp_context_new_return;
 static unsigned int cras_dsp_load_mock_pipeline_called;
+static unsigned int cras_dsp_load_firmware_called;
 static unsigned int rate_estimator_add_frames_num_frames;
 static unsigned int rate_estimator_add_frames_called;
 static int cras_system_get_mute_return;
@@ -100,20 +123,24 @@ static cras_ramp_cb cras_ramp_start_cb;
 static void* cras_ramp_start_cb_data;
 static int cras_device_monitor_set_device_mute_state_called;
 unsigned int cras_device_monitor_set_device_mute_state_dev_idx;
-static snd_pcm_format_t cras_scale_buffer_increment_fmt;
-static uint8_t* cras_scale_buffer_increment_buff;
-static unsigned int cras_scale_buffer_increment_frame;
-static float cras_scale_buffer_increment_scaler;
-static float cras_scale_buffer_increment_increment;
-static float cras_scale_buffer_increment_target;
-static int cras_scale_buffer_increment_channel;
+static snd_pcm_format_t cras_scale_buffer_gains_fmt;
+static uint8_t* cras_scale_buffer_gains_buff;
+static unsigned int cras_scale_buffer_gains_frame;
+static std::vector<float> cras_scale_buffer_gains_gains;
+static int cras_scale_buffer_gains_channel;
 static struct cras_audio_format audio_fmt;
 static int buffer_share_add_id_called;
 static int buffer_share_get_new_write_point_ret;
 static int ext_mod_configure_called;
 static struct input_data* input_data_create_ret;
 static double rate_estimator_get_rate_ret;
+static int rate_estimator_reset_rate_called;
+static int rate_estimator_check_batch_called;
+static unsigned int rate_estimator_check_batch_num;
+static int rate_estimator_check_batch_levels[16];
 static int cras_audio_thread_event_dev_overrun_called;
+// Samples put to output devices, not silence unless a test clears them.
+static uint8_t output_frames[4096];
 
 static char* atlog_name;
 
@@ -124,6 +151,7 @@ int update_channel_layout(struct cras_iodev* iodev) {
 }
 
 void ResetStubData() {
+  memset(output_frames, 0x11, sizeof(output_frames));
   cras_iodev_list_disable_dev_called = 0;
   select_node_called = 0;
   notify_nodes_changed_called = 0;
@@ -135,6 +163,8 @@ void ResetStubData() {
   cras_dsp_get_pipeline_called = 0;
   cras_dsp_get_pipeline_ret = 0;
   cras_dsp_put_pipeline_called = 0;
+  cras_dsp_lock_pipeline_called = 0;
+  cras_dsp_unlock_pipeline_called = 0;
   cras_dsp_pipeline_get_source_buffer_called = 0;
   cras_dsp_pipeline_get_sink_buffer_called = 0;
   memset(&cras_dsp_pipeline_source_buffer, 0,
@@ -142,18 +172,34 @@ void ResetStubData() {
   memset(&cras_dsp_pipeline_sink_buffer, 0,
          sizeof(cras_dsp_pipeline_sink_buffer));
   cras_dsp_pipeline_get_delay_called = 0;
-  cras_dsp_pipeline_apply_called = 0;
+  cras_dsp_apply_called = 0;
   cras_dsp_pipeline_set_sink_ext_module_called = 0;
-  cras_dsp_pipeline_apply_sample_count = 0;
+  cras_dsp_apply_sample_count = 0;
   cras_dsp_num_input_channels_return = 2;
   cras_dsp_num_output_channels_return = 2;
   cras_dsp_context_new_return = NULL;
   cras_dsp_load_mock_pipeline_called = 0;
+  cras_dsp_load_firmware_called = 0;
   rate_estimator_add_frames_num_frames = 0;
   rate_estimator_add_frames_called = 0;
   cras_system_get_mute_return = 0;
   cras_system_get_volume_return = 100;
   cras_mix_mute_count = 0;
+  cras_system_get_float_mix_bus_enabled_return = false;
+  cras_system_get_dsp_offload_enabled_return = false;
+  cras_system_get_native_rate_enabled_return = false;
+  cras_dsp_offload_create_latency = 0;
+  cras_dsp_offload_create_max_frames = 0;
+  cras_dsp_offload_destroy_called = 0;
+  cras_dsp_offload_apply_called = 0;
+  dsp_util_interleave_called = 0;
+  cras_dsp_apply_planar_called = 0;
+  cras_dsp_apply_planar_frames = 0;
+  cras_dsp_apply_planar_planes = NULL;
+  cras_dsp_apply_planar_num_planes = 0;
+  cras_channel_remix_convert_called = 0;
+  cras_channel_remix_convert_planar_called = 0;
+  cras_channel_remix_convert_planar_ret = 1;
   pre_dsp_hook_called = 0;
   pre_dsp_hook_frames = NULL;
   post_dsp_hook_called = 0;
@@ -178,7 +224,8 @@ void ResetStubData() {
     }
     /* To avoid un-used variable warning. */
     atlog_rw_shm_fd = atlog_ro_shm_fd = -1;
-    atlog = audio_thread_event_log_init(atlog_name);
+    atlog =
+        audio_thread_event_log_init(atlog_name, AUDIO_THREAD_EVENT_LOG_SIZE);
   }
   device_monitor_reset_device_called = 0;
   output_underrun_called = 0;
@@ -196,19 +243,20 @@ void ResetStubData() {
   cras_device_monitor_set_device_mute_state_called = 0;
   cras_device_monitor_set_device_mute_state_dev_idx = 0;
   cras_scale_buffer_called = 0;
-  cras_scale_buffer_increment_fmt = SND_PCM_FORMAT_UNKNOWN;
-  cras_scale_buffer_increment_buff = NULL;
-  cras_scale_buffer_increment_frame = 0;
-  cras_scale_buffer_increment_scaler = 0;
-  cras_scale_buffer_increment_increment = 0;
-  cras_scale_buffer_increment_target = 0.0;
-  cras_scale_buffer_increment_channel = 0;
+  cras_scale_buffer_gains_fmt = SND_PCM_FORMAT_UNKNOWN;
+  cras_scale_buffer_gains_buff = NULL;
+  cras_scale_buffer_gains_frame = 0;
+  cras_scale_buffer_gains_gains.clear();
+  cras_scale_buffer_gains_channel = 0;
   audio_fmt.format = SND_PCM_FORMAT_S16_LE;
   audio_fmt.frame_rate = 48000;
   audio_fmt.num_channels = 2;
   buffer_share_add_id_called = 0;
   ext_mod_configure_called = 0;
   rate_estimator_get_rate_ret = 0;
+  rate_estimator_reset_rate_called = 0;
+  rate_estimator_check_batch_called = 0;
+  rate_estimator_check_batch_num = 0;
   cras_audio_thread_event_dev_overrun_called = 0;
 }
 
@@ -387,6 +435,31 @@ TEST_F(IoDevSetFormatTestSuite, LimitLowRate) {
   EXPECT_EQ(2, iodev_.format->num_channels);
 }
 
+TEST_F(IoDevSetFormatTestSuite, NativeLowRate) {
+  struct cras_audio_format fmt;
+  int rc;
+
+  sample_rates_[0] = 48000;
+  sample_rates_[1] = 8000;
+  sample_rates_[2] = 0;
+  iodev_.direction = CRAS_STREAM_OUTPUT;
+  cras_system_get_native_rate_enabled_return = true;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 8000;
+  fmt.num_channels = 2;
+  rc = cras_iodev_set_format(&iodev_, &fmt);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(8000, iodev_.format->frame_rate);
+  cras_iodev_free_format(&iodev_);
+
+  // Inputs keep capturing at the higher rate.
+  iodev_.direction = CRAS_STREAM_INPUT;
+  rc = cras_iodev_set_format(&iodev_, &fmt);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(48000, iodev_.format->frame_rate);
+}
+
 TEST_F(IoDevSetFormatTestSuite, UnsupportedChannelCount) {
   struct cras_audio_format fmt;
   int rc;
@@ -485,6 +558,39 @@ TEST_F(IoDevSetFormatTestSuite, UpdateChannelLayoutFail6ch) {
     EXPECT_EQ(iodev_.format->channel_layout[i], default_6ch_layout[i]);
 }
 
+static int load_dsp_firmware_called;
+static int load_dsp_firmware_sample_rate;
+
+static int load_dsp_firmware(struct cras_iodev* iodev,
+                             const struct plugin* plugin,
+                             int sample_rate,
+                             int bypass) {
+  load_dsp_firmware_called++;
+  load_dsp_firmware_sample_rate = sample_rate;
+  return 0;
+}
+
+TEST_F(IoDevSetFormatTestSuite, LoadDspFirmware) {
+  struct cras_audio_format fmt;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  cras_dsp_context_new_return = reinterpret_cast<cras_dsp_context*>(0xf0f);
+
+  // Devices without the op run every plugin on the host.
+  EXPECT_EQ(0, cras_iodev_set_format(&iodev_, &fmt));
+  EXPECT_EQ(0, cras_dsp_load_firmware_called);
+  cras_iodev_free_format(&iodev_);
+
+  load_dsp_firmware_called = 0;
+  iodev_.load_dsp_firmware = load_dsp_firmware;
+  EXPECT_EQ(0, cras_iodev_set_format(&iodev_, &fmt));
+  EXPECT_EQ(1, cras_dsp_load_firmware_called);
+  EXPECT_EQ(1, load_dsp_firmware_called);
+  EXPECT_EQ(48000, load_dsp_firmware_sample_rate);
+}
+
 // Put buffer tests
 
 static int get_buffer(cras_iodev* iodev,
@@ -553,7 +659,7 @@ static int loopback_hook_control(bool start, void* cb_data) {
 TEST(IoDevPutOutputBuffer, SystemMuted) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -611,7 +717,7 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMute) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
   struct cras_ionode ionode;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -640,7 +746,7 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMute) {
 TEST(IoDevPutOutputBuffer, SystemMutedWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -685,7 +791,7 @@ TEST(IoDevPutOutputBuffer, NodeVolumeZeroShouldMuteWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
   struct cras_ionode ionode;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -733,7 +839,7 @@ TEST(IoDevPutOutputBuffer, NoDSP) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
   struct cras_ionode ionode;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -762,7 +868,7 @@ TEST(IoDevPutOutputBuffer, NoDSP) {
 TEST(IoDevPutOutputBuffer, DSP) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
   struct cras_loopback pre_dsp;
   struct cras_loopback post_dsp;
@@ -799,14 +905,184 @@ TEST(IoDevPutOutputBuffer, DSP) {
   EXPECT_EQ((void*)0x5678, post_dsp_hook_cb_data);
   EXPECT_EQ(32, put_buffer_nframes);
   EXPECT_EQ(32, rate_estimator_add_frames_num_frames);
-  EXPECT_EQ(32, cras_dsp_pipeline_apply_sample_count);
+  EXPECT_EQ(32, cras_dsp_apply_sample_count);
+  EXPECT_EQ(cras_dsp_get_pipeline_called, cras_dsp_put_pipeline_called);
+}
+
+TEST(IoDevPutOutputBus, DSPReadsBus) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  struct cras_loopback post_dsp;
+  int non_empty = 0;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.rate_est = reinterpret_cast<struct rate_estimator*>(0xdeadbeef);
+  iodev.mix_bus = mix_bus_create(2, 64);
+  iodev.mix_bus->planes[1][5] = 0.5f;
+  post_dsp.type = LOOPBACK_POST_DSP;
+  post_dsp.hook_data = post_dsp_hook;
+  post_dsp.hook_control = loopback_hook_control;
+  post_dsp.cb_data = (void*)0x5678;
+  DL_APPEND(iodev.loopbacks, &post_dsp);
+
+  rc = cras_iodev_put_output_bus(&iodev, frames, 32, &non_empty, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, non_empty);
+  // The pipeline runs on the bus, the only interleave is its output.
+  EXPECT_EQ(1, cras_dsp_apply_planar_called);
+  EXPECT_EQ(32, cras_dsp_apply_planar_frames);
+  EXPECT_EQ(iodev.mix_bus->planes, cras_dsp_apply_planar_planes);
+  EXPECT_EQ(2, cras_dsp_apply_planar_num_planes);
+  EXPECT_EQ(0, cras_dsp_apply_called);
+  EXPECT_EQ(0, dsp_util_interleave_called);
+  EXPECT_EQ(1, post_dsp_hook_called);
+  EXPECT_EQ(frames, post_dsp_hook_frames);
+  EXPECT_EQ(32, put_buffer_nframes);
+  EXPECT_EQ(32, rate_estimator_add_frames_num_frames);
   EXPECT_EQ(cras_dsp_get_pipeline_called, cras_dsp_put_pipeline_called);
+  mix_bus_destroy(&iodev.mix_bus);
+}
+
+TEST(IoDevPutOutputBus, PreDSPLoopbackGetsInterleavedMix) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  struct cras_loopback pre_dsp;
+  int non_empty = 1;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.mix_bus = mix_bus_create(2, 64);
+  pre_dsp.type = LOOPBACK_POST_MIX_PRE_DSP;
+  pre_dsp.hook_data = pre_dsp_hook;
+  pre_dsp.hook_control = loopback_hook_control;
+  pre_dsp.cb_data = (void*)0x1234;
+  DL_APPEND(iodev.loopbacks, &pre_dsp);
+
+  rc = cras_iodev_put_output_bus(&iodev, frames, 32, &non_empty, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, non_empty);
+  EXPECT_EQ(1, dsp_util_interleave_called);
+  EXPECT_EQ(1, pre_dsp_hook_called);
+  EXPECT_EQ(frames, pre_dsp_hook_frames);
+  // The mix is already interleaved, the DSP runs on it in place.
+  EXPECT_EQ(0, cras_dsp_apply_planar_called);
+  EXPECT_EQ(1, cras_dsp_apply_called);
+  EXPECT_EQ(32, cras_dsp_apply_sample_count);
+  EXPECT_EQ(32, put_buffer_nframes);
+  mix_bus_destroy(&iodev.mix_bus);
+}
+
+TEST(IoDevPutOutputBus, NoDSPRemixesFloatMix) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  struct cras_fmt_conv* remix = reinterpret_cast<cras_fmt_conv*>(0x77);
+  struct cras_loopback post_dsp;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.mix_bus = mix_bus_create(2, 64);
+  iodev.mix_bus->planes[0][3] = 0.25f;
+
+  rc = cras_iodev_put_output_bus(&iodev, output_frames, 22, NULL, remix);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_channel_remix_convert_planar_called);
+  EXPECT_EQ(0, cras_channel_remix_convert_called);
+
+  // A post DSP loopback takes the mix before the remix.
+  post_dsp.type = LOOPBACK_POST_DSP;
+  post_dsp.hook_data = post_dsp_hook;
+  post_dsp.cb_data = NULL;
+  DL_APPEND(iodev.loopbacks, &post_dsp);
+  rc = cras_iodev_put_output_bus(&iodev, output_frames, 22, NULL, remix);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_channel_remix_convert_planar_called);
+  EXPECT_EQ(1, cras_channel_remix_convert_called);
+  mix_bus_destroy(&iodev.mix_bus);
+}
+
+TEST(IoDevPutOutputBus, NoDSPInterleavesOnce) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.mix_bus = mix_bus_create(2, 64);
+  iodev.mix_bus->planes[0][3] = 0.25f;
+
+  rc = cras_iodev_put_output_bus(&iodev, frames, 22, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, dsp_util_interleave_called);
+  EXPECT_EQ(0, cras_dsp_apply_planar_called);
+  EXPECT_EQ(0, cras_dsp_apply_called);
+  EXPECT_EQ(22, put_buffer_nframes);
+  mix_bus_destroy(&iodev.mix_bus);
+}
+
+TEST(IoDevPutOutputBus, SilentBusClearsOutput) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.mix_bus = mix_bus_create(2, 64);
+
+  // Nothing was mixed, the output is cleared instead of interleaved.
+  rc = cras_iodev_put_output_bus(&iodev, frames, 22, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, dsp_util_interleave_called);
+  EXPECT_EQ(22, cras_mix_mute_count);
+  EXPECT_EQ(22, put_buffer_nframes);
+  mix_bus_destroy(&iodev.mix_bus);
 }
 
 TEST(IoDevPutOutputBuffer, SoftVol) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -832,10 +1108,117 @@ TEST(IoDevPutOutputBuffer, SoftVol) {
   EXPECT_EQ(SND_PCM_FORMAT_S16_LE, cras_scale_buffer_fmt);
 }
 
+TEST(IoDevPutOutputBuffer, SilenceSkipsSoftVol) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  int non_empty = 1;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(output_frames, 0, sizeof(output_frames));
+  iodev.software_volume_needed = 1;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.rate_est = reinterpret_cast<struct rate_estimator*>(0xdeadbeef);
+
+  cras_system_get_volume_return = 13;
+  softvol_scalers[13] = 0.435;
+
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 53, &non_empty, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, non_empty);
+  EXPECT_EQ(0, cras_scale_buffer_called);
+  EXPECT_EQ(53, put_buffer_nframes);
+  EXPECT_EQ(53, rate_estimator_add_frames_num_frames);
+}
+
+TEST(IoDevPutOutputBuffer, SoftVolScalesNonSilentBlocks) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  struct cras_loopback pre_dsp;
+  int non_empty = 0;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(output_frames, 0, sizeof(output_frames));
+  iodev.software_volume_needed = 1;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 48000;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+  iodev.rate_est = reinterpret_cast<struct rate_estimator*>(0xdeadbeef);
+  pre_dsp.type = LOOPBACK_POST_MIX_PRE_DSP;
+  pre_dsp.hook_data = pre_dsp_hook;
+  pre_dsp.hook_control = loopback_hook_control;
+  pre_dsp.cb_data = (void*)0x1234;
+  DL_APPEND(iodev.loopbacks, &pre_dsp);
+
+  cras_system_get_volume_return = 13;
+  softvol_scalers[13] = 0.435;
+
+  // Three blocks of at most 256 frames, only the last one has audio.
+  output_frames[4 * 520] = 1;
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 600, &non_empty, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, non_empty);
+  EXPECT_EQ(3, pre_dsp_hook_called);
+  EXPECT_EQ(frames + 4 * 512, pre_dsp_hook_frames);
+  EXPECT_EQ(1, cras_scale_buffer_called);
+  EXPECT_EQ(softvol_scalers[13], cras_scale_buffer_scaler);
+  EXPECT_EQ(600, put_buffer_nframes);
+  EXPECT_EQ(600, rate_estimator_add_frames_num_frames);
+}
+
+TEST(IoDevPutOutputBuffer, SilenceSkipsDspAfterHold) {
+  struct cras_audio_format fmt;
+  struct cras_iodev iodev;
+  uint8_t* frames = output_frames;
+  int rc;
+
+  ResetStubData();
+  memset(&iodev, 0, sizeof(iodev));
+  memset(output_frames, 0, sizeof(output_frames));
+  iodev.dsp_context = reinterpret_cast<cras_dsp_context*>(0x15);
+  cras_dsp_get_pipeline_ret = 0x25;
+
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.frame_rate = 480;
+  fmt.num_channels = 2;
+  iodev.format = &fmt;
+  iodev.put_buffer = put_buffer;
+
+  // The DSP runs on silence for half a second to let its tail out.
+  for (int i = 0; i < 5; i++) {
+    rc = cras_iodev_put_output_buffer(&iodev, frames, 48, NULL, nullptr);
+    EXPECT_EQ(0, rc);
+  }
+  EXPECT_EQ(5, cras_dsp_apply_called);
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 48, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(5, cras_dsp_apply_called);
+  EXPECT_EQ(48, put_buffer_nframes);
+
+  // It runs again as soon as there's audio.
+  output_frames[7] = 1;
+  rc = cras_iodev_put_output_buffer(&iodev, frames, 48, NULL, nullptr);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(6, cras_dsp_apply_called);
+}
+
 TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
   int n_frames = 53;
   float ramp_scaler = 0.2;
@@ -887,21 +1270,17 @@ TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
   // cras_scale_buffer is not called.
   EXPECT_EQ(0, cras_scale_buffer_called);
 
-  // Verify the arguments passed to cras_scale_buffer_increment.
-  EXPECT_EQ(fmt.format, cras_scale_buffer_increment_fmt);
-  EXPECT_EQ(frames, cras_scale_buffer_increment_buff);
-  EXPECT_EQ(n_frames, cras_scale_buffer_increment_frame);
-  // Initial scaler will be product of software volume scaler and
-  // ramp scaler.
+  // Verify the arguments passed to cras_scale_buffer_gains.
+  EXPECT_EQ(fmt.format, cras_scale_buffer_gains_fmt);
+  EXPECT_EQ(frames, cras_scale_buffer_gains_buff);
+  EXPECT_EQ(n_frames, cras_scale_buffer_gains_frame);
+  // The gains will be product of software volume scaler and ramp scaler.
+  ASSERT_EQ(n_frames, cras_scale_buffer_gains_gains.size());
   EXPECT_FLOAT_EQ(softvol_scalers[volume] * ramp_scaler,
-                  cras_scale_buffer_increment_scaler);
-  // Increment scaler will be product of software volume scaler and
-  // ramp increment.
-  EXPECT_FLOAT_EQ(softvol_scalers[volume] * increment,
-                  cras_scale_buffer_increment_increment);
-  EXPECT_FLOAT_EQ(softvol_scalers[volume] * target,
-                  cras_scale_buffer_increment_target);
-  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_increment_channel);
+                  cras_scale_buffer_gains_gains[0]);
+  EXPECT_FLOAT_EQ(softvol_scalers[volume] * (ramp_scaler + 52 * increment),
+                  cras_scale_buffer_gains_gains[52]);
+  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_gains_channel);
 
   EXPECT_EQ(n_frames, put_buffer_nframes);
   EXPECT_EQ(n_frames, rate_estimator_add_frames_num_frames);
@@ -910,7 +1289,7 @@ TEST(IoDevPutOutputBuffer, SoftVolWithRamp) {
 TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
   int n_frames = 53;
   float ramp_scaler = 0.2;
@@ -954,14 +1333,15 @@ TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
   // cras_scale_buffer is not called.
   EXPECT_EQ(0, cras_scale_buffer_called);
 
-  // Verify the arguments passed to cras_scale_buffer_increment.
-  EXPECT_EQ(fmt.format, cras_scale_buffer_increment_fmt);
-  EXPECT_EQ(frames, cras_scale_buffer_increment_buff);
-  EXPECT_EQ(n_frames, cras_scale_buffer_increment_frame);
-  EXPECT_FLOAT_EQ(ramp_scaler, cras_scale_buffer_increment_scaler);
-  EXPECT_FLOAT_EQ(increment, cras_scale_buffer_increment_increment);
-  EXPECT_FLOAT_EQ(1.0, cras_scale_buffer_increment_target);
-  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_increment_channel);
+  // Verify the arguments passed to cras_scale_buffer_gains.
+  EXPECT_EQ(fmt.format, cras_scale_buffer_gains_fmt);
+  EXPECT_EQ(frames, cras_scale_buffer_gains_buff);
+  EXPECT_EQ(n_frames, cras_scale_buffer_gains_frame);
+  ASSERT_EQ(n_frames, cras_scale_buffer_gains_gains.size());
+  EXPECT_FLOAT_EQ(ramp_scaler, cras_scale_buffer_gains_gains[0]);
+  EXPECT_FLOAT_EQ(ramp_scaler + 52 * increment,
+                  cras_scale_buffer_gains_gains[52]);
+  EXPECT_EQ(fmt.num_channels, cras_scale_buffer_gains_channel);
 
   EXPECT_EQ(n_frames, put_buffer_nframes);
   EXPECT_EQ(n_frames, rate_estimator_add_frames_num_frames);
@@ -970,7 +1350,7 @@ TEST(IoDevPutOutputBuffer, NoSoftVolWithRamp) {
 TEST(IoDevPutOutputBuffer, Scale32Bit) {
   struct cras_audio_format fmt;
   struct cras_iodev iodev;
-  uint8_t* frames = reinterpret_cast<uint8_t*>(0x44);
+  uint8_t* frames = output_frames;
   int rc;
 
   ResetStubData();
@@ -1272,6 +1652,35 @@ TEST(IoDev, OpenOutputDeviceWithLowRateFmt) {
   EXPECT_EQ(240, iodev.min_cb_level);
 }
 
+static int close_dev(struct cras_iodev* iodev) {
+  return 0;
+}
+
+TEST(IoDev, OpenOutputDeviceWithFloatMixBus) {
+  struct cras_iodev iodev;
+
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.configure_dev = configure_dev;
+  iodev.close_dev = close_dev;
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  iodev.format = &audio_fmt;
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  ResetStubData();
+  cras_system_get_float_mix_bus_enabled_return = true;
+
+  iodev.state = CRAS_IODEV_STATE_CLOSE;
+
+  iodev_buffer_size = 1024;
+  cras_iodev_open(&iodev, 240, &audio_fmt);
+  ASSERT_NE((void*)NULL, iodev.mix_bus);
+  EXPECT_EQ(2, iodev.mix_bus->num_channels);
+  EXPECT_EQ(1024, iodev.mix_bus->max_frames);
+
+  cras_iodev_close(&iodev);
+  EXPECT_EQ((void*)NULL, iodev.mix_bus);
+}
+
 int fake_start(const struct cras_iodev* iodev) {
   return 0;
 }
@@ -1297,6 +1706,47 @@ TEST(IoDev, OpenOutputDeviceWithStart) {
   EXPECT_EQ(CRAS_IODEV_STATE_OPEN, iodev.state);
 }
 
+TEST(IoDev, OpenOutputDeviceWithDspOffload) {
+  struct cras_iodev iodev;
+  uint8_t buf[480 * 4];
+
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.configure_dev = configure_dev;
+  iodev.close_dev = close_dev;
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  iodev.format = &audio_fmt;
+  ResetStubData();
+  // Opening replaces the context, as there's no pipeline to hold the
+  // ext dsp module.
+  cras_dsp_context_new_return = reinterpret_cast<cras_dsp_context*>(0xf0f);
+  iodev.dsp_context = cras_dsp_context_new_return;
+  cras_system_get_dsp_offload_enabled_return = true;
+
+  iodev.state = CRAS_IODEV_STATE_CLOSE;
+  iodev.start = fake_start;
+
+  iodev_buffer_size = 1024;
+  cras_iodev_open(&iodev, 240, &audio_fmt);
+  ASSERT_NE((void*)NULL, iodev.dsp_offload);
+  EXPECT_EQ(240, cras_dsp_offload_create_latency);
+  EXPECT_EQ(1024, cras_dsp_offload_create_max_frames);
+
+  // The offload latency counts whether or not there's a pipeline.
+  EXPECT_EQ(240, cras_iodev_get_dsp_delay(&iodev));
+
+  // The DSP runs through the offload.
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  EXPECT_EQ(0, cras_iodev_put_output_buffer(&iodev, buf, 480, NULL, NULL));
+  EXPECT_EQ(1, cras_dsp_offload_apply_called);
+  EXPECT_EQ(0, cras_dsp_apply_called);
+
+  cras_iodev_close(&iodev);
+  EXPECT_EQ((void*)NULL, iodev.dsp_offload);
+  EXPECT_EQ(1, cras_dsp_offload_destroy_called);
+}
+
 TEST(IoDev, OpenInputDeviceNoStart) {
   struct cras_iodev iodev;
 
@@ -1360,6 +1810,63 @@ TEST(IoDev, OpenInputDeviceWithLowRateFmt) {
   EXPECT_EQ(240, iodev.min_cb_level);
 }
 
+static int update_supported_formats_called;
+static int update_supported_formats(struct cras_iodev* iodev) {
+  update_supported_formats_called++;
+  return 0;
+}
+
+TEST(IoDev, OpenRestoresFormatSavedAtSuspend) {
+  struct cras_iodev iodev;
+  struct cras_ionode node;
+  size_t rates[] = {48000, 0};
+  size_t channel_counts[] = {2, 0};
+  snd_pcm_format_t formats[] = {SND_PCM_FORMAT_S16_LE, (snd_pcm_format_t)0};
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&node, 0, sizeof(node));
+  node.idx = 1;
+  iodev.supported_rates = rates;
+  iodev.supported_channel_counts = channel_counts;
+  iodev.supported_formats = formats;
+  iodev.active_node = &node;
+  iodev.configure_dev = configure_dev;
+  iodev.update_supported_formats = update_supported_formats;
+  iodev.direction = CRAS_STREAM_INPUT;
+  iodev.format = &audio_fmt;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  ResetStubData();
+  update_supported_formats_called = 0;
+
+  cras_iodev_save_resume_format(&iodev);
+  ASSERT_NE(nullptr, iodev.resume_format);
+  iodev.format = NULL;
+  iodev.state = CRAS_IODEV_STATE_CLOSE;
+
+  // Reopening on the same node skips format negotiation.
+  cras_audio_format low_rate_fmt = audio_fmt;
+  low_rate_fmt.frame_rate = 8000;
+  iodev_buffer_size = 1024;
+  EXPECT_EQ(0, cras_iodev_open(&iodev, 40, &low_rate_fmt));
+  EXPECT_EQ(nullptr, iodev.resume_format);
+  ASSERT_NE(nullptr, iodev.format);
+  EXPECT_EQ(48000, iodev.format->frame_rate);
+  EXPECT_EQ(0, update_supported_formats_called);
+  cras_iodev_free_format(&iodev);
+
+  // A saved format doesn't carry over to another node.
+  iodev.format = &audio_fmt;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  cras_iodev_save_resume_format(&iodev);
+  iodev.format = NULL;
+  iodev.state = CRAS_IODEV_STATE_CLOSE;
+  node.idx = 2;
+  cras_iodev_open(&iodev, 40, &low_rate_fmt);
+  EXPECT_EQ(nullptr, iodev.resume_format);
+  EXPECT_EQ(1, update_supported_formats_called);
+  cras_iodev_free_format(&iodev);
+}
+
 static int simple_no_stream(struct cras_iodev* dev, int enable) {
   simple_no_stream_enable = enable;
   simple_no_stream_called++;
@@ -1380,9 +1887,11 @@ TEST(IoDev, AddRmStream) {
   iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
   iodev.get_buffer = get_buffer;
   iodev.put_buffer = put_buffer;
+  rstream1.stream_id = 1;
   rstream1.cb_threshold = 800;
   stream1.stream = &rstream1;
   stream1.is_running = 0;
+  rstream2.stream_id = 2;
   rstream2.cb_threshold = 400;
   stream2.stream = &rstream2;
   stream2.is_running = 0;
@@ -1417,6 +1926,83 @@ TEST(IoDev, AddRmStream) {
   EXPECT_EQ(512, iodev.min_cb_level);
 }
 
+TEST(IoDev, AdaptiveStreamFollowsDeviceCbLevel) {
+  struct cras_iodev iodev;
+  struct cras_rstream rstream1, rstream2;
+  struct dev_stream stream1, stream2;
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&rstream1, 0, sizeof(rstream1));
+  memset(&rstream2, 0, sizeof(rstream2));
+  memset(&stream1, 0, sizeof(stream1));
+  memset(&stream2, 0, sizeof(stream2));
+  iodev.configure_dev = configure_dev;
+  iodev.no_stream = simple_no_stream;
+  iodev.format = &audio_fmt;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev.get_buffer = get_buffer;
+  iodev.put_buffer = put_buffer;
+  rstream1.stream_id = 1;
+  rstream1.cb_threshold = 960;
+  rstream1.format = audio_fmt;
+  stream1.stream = &rstream1;
+  rstream2.stream_id = 2;
+  rstream2.cb_threshold = 240;
+  rstream2.flags = ADAPTIVE_CB;
+  rstream2.format = audio_fmt;
+  stream2.stream = &rstream2;
+  ResetStubData();
+
+  iodev_buffer_size = 4096;
+  cras_iodev_open(&iodev, rstream2.cb_threshold, &audio_fmt);
+
+  // Alone, the adaptive stream keeps its size.
+  cras_iodev_add_stream(&iodev, &stream2);
+  cras_iodev_start_stream(&iodev, &stream2);
+  EXPECT_EQ(240, rstream2.cb_threshold);
+  EXPECT_EQ(240, iodev.min_cb_level);
+
+  // It follows the device waking for a 960 frame stream.
+  cras_iodev_add_stream(&iodev, &stream1);
+  cras_iodev_start_stream(&iodev, &stream1);
+  EXPECT_EQ(960, rstream2.cb_threshold);
+  EXPECT_EQ(960, iodev.min_cb_level);
+  EXPECT_EQ(960, iodev.max_cb_level);
+
+  cras_iodev_rm_stream(&iodev, &rstream1);
+  EXPECT_EQ(960, rstream2.cb_threshold);
+  cras_iodev_rm_stream(&iodev, &rstream2);
+}
+
+TEST(IoDev, AddLowLatencyStreamFirst) {
+  struct cras_iodev iodev;
+  struct cras_rstream rstream1, rstream2;
+  struct dev_stream stream1, stream2;
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&rstream1, 0, sizeof(rstream1));
+  memset(&rstream2, 0, sizeof(rstream2));
+  memset(&stream1, 0, sizeof(stream1));
+  memset(&stream2, 0, sizeof(stream2));
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  rstream1.stream_id = 1;
+  rstream1.direction = CRAS_STREAM_OUTPUT;
+  stream1.stream = &rstream1;
+  rstream2.stream_id = 2;
+  rstream2.direction = CRAS_STREAM_OUTPUT;
+  rstream2.flags = LOW_LATENCY;
+  stream2.stream = &rstream2;
+  ResetStubData();
+
+  cras_iodev_add_stream(&iodev, &stream1);
+  cras_iodev_add_stream(&iodev, &stream2);
+  EXPECT_EQ(&stream2, iodev.streams);
+  EXPECT_EQ(&stream1, iodev.streams->next);
+
+  cras_iodev_rm_stream(&iodev, &rstream1);
+  cras_iodev_rm_stream(&iodev, &rstream2);
+}
+
 TEST(IoDev, RmStreamUpdateFetchTime) {
   struct cras_iodev iodev;
   struct cras_rstream rstream1, rstream2, rstream3;
@@ -1438,6 +2024,9 @@ TEST(IoDev, RmStreamUpdateFetchTime) {
   rstream1.direction = CRAS_STREAM_OUTPUT;
   rstream2.direction = CRAS_STREAM_OUTPUT;
   rstream3.direction = CRAS_STREAM_OUTPUT;
+  rstream1.stream_id = 1;
+  rstream2.stream_id = 2;
+  rstream3.stream_id = 3;
   stream1.stream = &rstream1;
   stream2.stream = &rstream2;
   stream3.stream = &rstream3;
@@ -2112,6 +2701,49 @@ TEST(IoDev, FramesToPlayInSleep) {
   EXPECT_EQ(got_frames, hw_level - fmt.frame_rate / 1000 * 5);
 }
 
+TEST(IoDev, FramesToPlayInSleepHwPtrGranularity) {
+  struct cras_iodev iodev;
+  struct cras_audio_format fmt;
+  unsigned int min_cb_level = 512;
+  unsigned int got_hw_level, got_frames;
+  struct timespec hw_tstamp;
+  struct cras_rstream rstream;
+  struct dev_stream stream;
+
+  memset(&iodev, 0, sizeof(iodev));
+  memset(&fmt, 0, sizeof(fmt));
+  iodev.frames_queued = frames_queued;
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  iodev.buffer_size = BUFFER_SIZE;
+  iodev.min_cb_level = min_cb_level;
+  iodev.hw_ptr_granularity = 48;
+  iodev.state = CRAS_IODEV_STATE_NORMAL_RUN;
+  iodev.format = &fmt;
+  fmt.frame_rate = 48000;
+  rstream.cb_threshold = min_cb_level;
+  stream.stream = &rstream;
+
+  ResetStubData();
+
+  cras_iodev_add_stream(&iodev, &stream);
+  cras_iodev_start_stream(&iodev, &stream);
+  dev_stream_playback_frames_ret = 100;
+
+  // 100 frames to min_cb_level, wake up a step early on a step boundary.
+  fr_queued = min_cb_level + 100;
+  got_frames =
+      cras_iodev_frames_to_play_in_sleep(&iodev, &got_hw_level, &hw_tstamp);
+  EXPECT_EQ(min_cb_level + 100, got_hw_level);
+  EXPECT_EQ(48, got_frames);
+
+  // A sleep within one step is kept.
+  fr_queued = min_cb_level + 40;
+  got_frames =
+      cras_iodev_frames_to_play_in_sleep(&iodev, &got_hw_level, &hw_tstamp);
+  EXPECT_EQ(40, got_frames);
+  dev_stream_playback_frames_ret = 0;
+}
+
 TEST(IoDev, GetNumUnderruns) {
   struct cras_iodev iodev;
   memset(&iodev, 0, sizeof(iodev));
@@ -2227,26 +2859,27 @@ TEST(IoDev, SetExtDspMod) {
 
   cras_iodev_open(&iodev, 240, &fmt);
   EXPECT_EQ(1, ext_mod_configure_called);
-  EXPECT_EQ(1, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(1, cras_dsp_lock_pipeline_called);
   EXPECT_EQ(1, cras_dsp_pipeline_set_sink_ext_module_called);
 
   cras_iodev_set_ext_dsp_module(&iodev, NULL);
   EXPECT_EQ(1, ext_mod_configure_called);
-  EXPECT_EQ(2, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(2, cras_dsp_lock_pipeline_called);
   EXPECT_EQ(2, cras_dsp_pipeline_set_sink_ext_module_called);
 
   cras_iodev_set_ext_dsp_module(&iodev, &ext);
   EXPECT_EQ(2, ext_mod_configure_called);
-  EXPECT_EQ(3, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(3, cras_dsp_lock_pipeline_called);
   EXPECT_EQ(3, cras_dsp_pipeline_set_sink_ext_module_called);
 
   /* If pipeline doesn't exist, mock pipeline should be loaded. */
   cras_dsp_get_pipeline_ret = 0x0;
   cras_iodev_set_ext_dsp_module(&iodev, &ext);
   EXPECT_EQ(3, ext_mod_configure_called);
-  EXPECT_EQ(5, cras_dsp_get_pipeline_called);
+  EXPECT_EQ(5, cras_dsp_lock_pipeline_called);
   EXPECT_EQ(1, cras_dsp_load_mock_pipeline_called);
   EXPECT_EQ(4, cras_dsp_pipeline_set_sink_ext_module_called);
+  EXPECT_EQ(cras_dsp_lock_pipeline_called, cras_dsp_unlock_pipeline_called);
 }
 
 TEST(IoDev, InputDspOffset) {
@@ -2418,6 +3051,62 @@ TEST(IoDev, OnInternalCard) {
   EXPECT_EQ(0, cras_iodev_is_on_internal_card(&node));
 }
 
+TEST(IoDev, UpdateRatesInBatches) {
+  struct cras_iodev iodevs[10];
+  struct cras_iodev* devs[10];
+  unsigned int levels[10];
+  struct timespec tstamps[10];
+  struct cras_audio_format fmt;
+
+  ResetStubData();
+  fmt.frame_rate = 48000;
+  for (int i = 0; i < 10; i++) {
+    memset(&iodevs[i], 0, sizeof(iodevs[i]));
+    iodevs[i].direction = CRAS_STREAM_OUTPUT;
+    iodevs[i].format = &fmt;
+    devs[i] = &iodevs[i];
+    levels[i] = i;
+    tstamps[i] = {.tv_sec = 1, .tv_nsec = 0};
+  }
+
+  EXPECT_EQ(10, cras_iodev_update_rates(devs, levels, tstamps, 10));
+  EXPECT_EQ(2, rate_estimator_check_batch_called);
+  ASSERT_EQ(10, rate_estimator_check_batch_num);
+  for (int i = 0; i < 10; i++)
+    EXPECT_EQ(i, rate_estimator_check_batch_levels[i]);
+  // The output device at level 0 underran, its estimator starts over.
+  EXPECT_EQ(1, rate_estimator_reset_rate_called);
+}
+
+static int support_noise_cancellation_ret;
+static int support_noise_cancellation(const struct cras_iodev* iodev) {
+  return support_noise_cancellation_ret;
+}
+
+TEST(IoDev, DspEffects) {
+  struct cras_iodev iodev;
+
+  memset(&iodev, 0, sizeof(iodev));
+  iodev.direction = CRAS_STREAM_INPUT;
+  iodev.support_noise_cancellation = support_noise_cancellation;
+
+  // The node can cancel noise, but only does once it's enabled.
+  support_noise_cancellation_ret = 1;
+  cras_system_get_noise_cancellation_enabled_return = false;
+  EXPECT_EQ(0, cras_iodev_get_dsp_effects(&iodev));
+  cras_system_get_noise_cancellation_enabled_return = true;
+  EXPECT_EQ(APM_NOISE_SUPRESSION, cras_iodev_get_dsp_effects(&iodev));
+
+  support_noise_cancellation_ret = 0;
+  EXPECT_EQ(0, cras_iodev_get_dsp_effects(&iodev));
+
+  // Output devices don't apply any stream effect.
+  support_noise_cancellation_ret = 1;
+  iodev.direction = CRAS_STREAM_OUTPUT;
+  EXPECT_EQ(0, cras_iodev_get_dsp_effects(&iodev));
+  cras_system_get_noise_cancellation_enabled_return = false;
+}
+
 extern "C" {
 
 struct main_thread_event_log* main_log;
@@ -2436,8 +3125,19 @@ int pthread_join(pthread_t thread, void** value_ptr) {
 
 // Fromt fmt_conv
 void cras_channel_remix_convert(struct cras_fmt_conv* conv,
+                                const struct cras_audio_format* fmt,
                                 uint8_t* in_buf,
-                                size_t frames) {}
+                                size_t frames) {
+  cras_channel_remix_convert_called++;
+}
+
+int cras_channel_remix_convert_planar(struct cras_fmt_conv* conv,
+                                      float* const* planes,
+                                      unsigned int num_planes,
+                                      size_t nframes) {
+  cras_channel_remix_convert_planar_called++;
+  return cras_channel_remix_convert_planar_ret;
+}
 
 size_t cras_fmt_conv_in_frames_to_out(struct cras_fmt_conv* conv,
                                       size_t in_frames) {
@@ -2495,6 +3195,12 @@ void cras_dsp_context_free(struct cras_dsp_context* ctx) {
 }
 
 void cras_dsp_load_pipeline(struct cras_dsp_context* ctx) {}
+void cras_dsp_load_firmware(struct cras_dsp_context* ctx,
+                            cras_dsp_firmware_load_t load,
+                            void* arg) {
+  cras_dsp_load_firmware_called++;
+  load(NULL, dsp_context_new_sample_rate, 0, arg);
+}
 void cras_dsp_load_mock_pipeline(struct cras_dsp_context* ctx,
                                  unsigned int num_channels) {
   cras_dsp_load_mock_pipeline_called++;
@@ -2517,6 +3223,15 @@ void cras_dsp_put_pipeline(struct cras_dsp_context* ctx) {
   cras_dsp_put_pipeline_called++;
 }
 
+struct pipeline* cras_dsp_lock_pipeline(struct cras_dsp_context* ctx) {
+  cras_dsp_lock_pipeline_called++;
+  return reinterpret_cast<struct pipeline*>(cras_dsp_get_pipeline_ret);
+}
+
+void cras_dsp_unlock_pipeline(struct cras_dsp_context* ctx) {
+  cras_dsp_unlock_pipeline_called++;
+}
+
 float* cras_dsp_pipeline_get_source_buffer(struct pipeline* pipeline,
                                            int index) {
   cras_dsp_pipeline_get_source_buffer_called++;
@@ -2533,15 +3248,32 @@ int cras_dsp_pipeline_get_delay(struct pipeline* pipeline) {
   return 0;
 }
 
-int cras_dsp_pipeline_apply(struct pipeline* pipeline,
-                            uint8_t* buf,
-                            snd_pcm_format_t format,
-                            unsigned int frames) {
-  cras_dsp_pipeline_apply_called++;
-  cras_dsp_pipeline_apply_sample_count = frames;
+int cras_dsp_apply(struct cras_dsp_context* ctx,
+                   uint8_t* buf,
+                   snd_pcm_format_t format,
+                   unsigned int frames) {
+  cras_dsp_apply_called++;
+  cras_dsp_apply_sample_count = frames;
+  return 0;
+}
+
+int cras_dsp_apply_planar(struct cras_dsp_context* ctx,
+                          float* const* planes,
+                          unsigned int num_planes,
+                          uint8_t* buf,
+                          snd_pcm_format_t format,
+                          unsigned int frames) {
+  cras_dsp_apply_planar_called++;
+  cras_dsp_apply_planar_planes = planes;
+  cras_dsp_apply_planar_num_planes = num_planes;
+  cras_dsp_apply_planar_frames = frames;
   return 0;
 }
 
+int cras_dsp_pipeline_get_num_input_channels(struct pipeline* pipeline) {
+  return cras_dsp_num_input_channels_return;
+}
+
 void cras_dsp_pipeline_add_statistic(struct pipeline* pipeline,
                                      const struct timespec* time_delta,
                                      int samples) {}
@@ -2631,20 +3363,19 @@ void cras_scale_buffer(snd_pcm_format_t fmt,
   cras_scale_buffer_scaler = scaler;
 }
 
-void cras_scale_buffer_increment(snd_pcm_format_t fmt,
-                                 uint8_t* buff,
-                                 unsigned int frame,
-                                 float scaler,
-                                 float increment,
-                                 float target,
-                                 int channel) {
-  cras_scale_buffer_increment_fmt = fmt;
-  cras_scale_buffer_increment_buff = buff;
-  cras_scale_buffer_increment_frame = frame;
-  cras_scale_buffer_increment_scaler = scaler;
-  cras_scale_buffer_increment_increment = increment;
-  cras_scale_buffer_increment_target = target;
-  cras_scale_buffer_increment_channel = channel;
+void cras_scale_buffer_gains(snd_pcm_format_t fmt,
+                             uint8_t* buff,
+                             unsigned int frame,
+                             const float* gains,
+                             int channel) {
+  if (cras_scale_buffer_gains_gains.empty()) {
+    cras_scale_buffer_gains_fmt = fmt;
+    cras_scale_buffer_gains_buff = buff;
+  }
+  cras_scale_buffer_gains_frame += frame;
+  cras_scale_buffer_gains_gains.insert(cras_scale_buffer_gains_gains.end(),
+                                       gains, gains + frame);
+  cras_scale_buffer_gains_channel = channel;
 }
 
 size_t cras_mix_mute_buffer(uint8_t* dst, size_t frame_bytes, size_t count) {
@@ -2667,16 +3398,42 @@ void rate_estimator_add_frames(struct rate_estimator* re, int fr) {
 
 int rate_estimator_check(struct rate_estimator* re,
                          int level,
-                         struct timespec* now) {
+                         const struct timespec* now) {
   return 0;
 }
 
-void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {}
+void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {
+  rate_estimator_reset_rate_called++;
+}
 
-double rate_estimator_get_rate(struct rate_estimator* re) {
+double rate_estimator_get_rate(const struct rate_estimator* re) {
   return rate_estimator_get_rate_ret;
 }
 
+double rate_estimator_get_confidence(const struct rate_estimator* re) {
+  return 0.0;
+}
+
+void rate_estimator_set_outlier_rejection(struct rate_estimator* re,
+                                          int enable) {}
+
+int rate_estimator_check_batch(struct rate_estimator_sample* samples,
+                               unsigned int num) {
+  rate_estimator_check_batch_called++;
+  for (unsigned int i = 0; i < num; i++) {
+    rate_estimator_check_batch_levels[rate_estimator_check_batch_num++] =
+        samples[i].level;
+    samples[i].updated = 1;
+  }
+  return num;
+}
+
+size_t cras_rstream_set_cb_threshold(struct cras_rstream* stream,
+                                     size_t cb_threshold) {
+  stream->cb_threshold = cb_threshold;
+  return cb_threshold;
+}
+
 unsigned int dev_stream_cb_threshold(const struct dev_stream* dev_stream) {
   if (dev_stream->stream)
     return dev_stream->stream->cb_threshold;
@@ -2729,6 +3486,15 @@ struct cras_ramp_action cras_ramp_get_current_action(
   return cras_ramp_get_current_action_ret;
 }
 
+void cras_ramp_action_gains(const struct cras_ramp_action* action,
+                            unsigned int offset,
+                            float scale,
+                            float* gains,
+                            unsigned int frames) {
+  for (unsigned int i = 0; i < frames; i++)
+    gains[i] = (action->scaler + (offset + i) * action->increment) * scale;
+}
+
 int cras_ramp_update_ramped_frames(struct cras_ramp* ramp, int num_frames) {
   cras_ramp_update_ramped_frames_num_frames = num_frames;
   return 0;
@@ -2776,18 +3542,96 @@ int cras_server_metrics_device_volume(struct cras_iodev* iodev) {
   return 0;
 }
 
-void ewma_power_init(struct ewma_power* ewma, unsigned int rate){};
+void ewma_power_init(struct ewma_power* ewma,
+                     snd_pcm_format_t format,
+                     unsigned int rate){};
 
 void ewma_power_calculate(struct ewma_power* ewma,
-                          const int16_t* buf,
+                          const void* buf,
                           unsigned int channels,
                           unsigned int size){};
 
 void ewma_power_calculate_area(struct ewma_power* ewma,
-                               const int16_t* buf,
+                               const void* buf,
                                struct cras_audio_area* area,
                                unsigned int size){};
 
+void ewma_power_calculate_planar(struct ewma_power* ewma,
+                                 float* const* planes,
+                                 unsigned int channels,
+                                 unsigned int size){};
+
+int cras_level_meter_add(enum CRAS_LEVEL_METER_TYPE type, uint32_t id) {
+  return -1;
+}
+
+void cras_level_meter_rm(int meter) {}
+
+void cras_level_meter_update(int meter, const struct ewma_power* ewma) {}
+
+void silence_gate_init(struct silence_gate* gate, unsigned int rate) {}
+
+void silence_gate_disable(struct silence_gate* gate) {}
+
+bool silence_gate_process_area(struct silence_gate* gate,
+                               const int16_t* buf,
+                               const struct cras_audio_area* area,
+                               unsigned int size) {
+  return false;
+}
+
+bool cras_system_get_float_mix_bus_enabled() {
+  return cras_system_get_float_mix_bus_enabled_return;
+}
+
+bool cras_system_get_dsp_offload_enabled() {
+  return cras_system_get_dsp_offload_enabled_return;
+}
+
+bool cras_system_get_native_rate_enabled() {
+  return cras_system_get_native_rate_enabled_return;
+}
+
+bool cras_system_get_noise_cancellation_enabled() {
+  return cras_system_get_noise_cancellation_enabled_return;
+}
+
+struct cras_dsp_offload* cras_dsp_offload_create(
+    struct cras_dsp_context* ctx,
+    const struct cras_audio_format* fmt,
+    unsigned int latency_frames,
+    unsigned int max_frames) {
+  cras_dsp_offload_create_latency = latency_frames;
+  cras_dsp_offload_create_max_frames = max_frames;
+  return reinterpret_cast<struct cras_dsp_offload*>(0x0ff);
+}
+
+void cras_dsp_offload_destroy(struct cras_dsp_offload* offload) {
+  if (offload)
+    cras_dsp_offload_destroy_called++;
+}
+
+int cras_dsp_offload_apply(struct cras_dsp_offload* offload,
+                           uint8_t* buf,
+                           unsigned int frames) {
+  cras_dsp_offload_apply_called++;
+  return 0;
+}
+
+unsigned int cras_dsp_offload_get_latency(
+    const struct cras_dsp_offload* offload) {
+  return cras_dsp_offload_create_latency;
+}
+
+int dsp_util_interleave(float* const* input,
+                        uint8_t* output,
+                        int channels,
+                        snd_pcm_format_t format,
+                        int frames) {
+  dsp_util_interleave_called++;
+  return 0;
+}
+
 }  // extern "C"
 }  //  namespace
 
@@ -0,0 +1,94 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <gtest/gtest.h>
+#include <stdint.h>
+
+extern "C" {
+#include "cras_lea_config.h"
+}
+
+namespace {
+
+TEST(LeaConfig, CapabilitiesRoundTrip) {
+  uint8_t caps[32];
+  uint8_t config[32];
+  struct cras_lea_config cfg;
+  int caps_len, len;
+
+  caps_len = cras_lea_get_capabilities(caps, sizeof(caps));
+  ASSERT_GT(caps_len, 0);
+  EXPECT_EQ(-ENOSPC, cras_lea_get_capabilities(caps, 4));
+
+  // With its own capabilities it picks 48kHz, 10ms, 100 octets.
+  len = cras_lea_select_configuration(caps, caps_len, config, sizeof(config));
+  ASSERT_EQ(16, len);
+  ASSERT_EQ(0, cras_lea_parse_configuration(config, len, &cfg));
+  EXPECT_EQ(48000, cfg.rate);
+  EXPECT_EQ(10000, cfg.frame_us);
+  EXPECT_EQ(100, cfg.frame_bytes);
+}
+
+TEST(LeaConfig, SelectCommonRateAndDuration) {
+  // 16kHz and 24kHz, 7.5ms only, octets 26..40.
+  const uint8_t caps[] = {0x03, 0x01, 0x14, 0x00, 0x02, 0x02, 0x01,
+                          0x05, 0x04, 26,   0x00, 40,   0x00};
+  uint8_t config[32];
+  struct cras_lea_config cfg;
+  int len;
+
+  len = cras_lea_select_configuration(caps, sizeof(caps), config,
+                                      sizeof(config));
+  ASSERT_GT(len, 0);
+  ASSERT_EQ(0, cras_lea_parse_configuration(config, len, &cfg));
+  EXPECT_EQ(24000, cfg.rate);
+  EXPECT_EQ(7500, cfg.frame_us);
+  // The 45 octets preset is clamped to the remote maximum.
+  EXPECT_EQ(40, cfg.frame_bytes);
+}
+
+TEST(LeaConfig, SelectNoCommonRate) {
+  // 8kHz only.
+  const uint8_t caps[] = {0x03, 0x01, 0x01, 0x00};
+  uint8_t config[32];
+
+  EXPECT_EQ(-EINVAL, cras_lea_select_configuration(caps, sizeof(caps), config,
+                                                   sizeof(config)));
+  // A truncated LTV is ignored.
+  EXPECT_EQ(-EINVAL, cras_lea_select_configuration(caps, 3, config,
+                                                   sizeof(config)));
+}
+
+TEST(LeaConfig, ParseRejectsUnsupported) {
+  // 16kHz, 10ms, 40 octets.
+  uint8_t config[] = {0x02, 0x01, 0x03, 0x02, 0x02, 0x01, 0x03, 0x04, 40, 0x00};
+  struct cras_lea_config cfg;
+
+  ASSERT_EQ(0, cras_lea_parse_configuration(config, sizeof(config), &cfg));
+  EXPECT_EQ(16000, cfg.rate);
+  EXPECT_EQ(10000, cfg.frame_us);
+  EXPECT_EQ(40, cfg.frame_bytes);
+
+  // 11.025kHz.
+  config[2] = 0x02;
+  EXPECT_EQ(-EINVAL,
+            cras_lea_parse_configuration(config, sizeof(config), &cfg));
+  config[2] = 0x03;
+
+  // Too large a frame.
+  config[8] = 200;
+  EXPECT_EQ(-EINVAL,
+            cras_lea_parse_configuration(config, sizeof(config), &cfg));
+
+  // No duration.
+  EXPECT_EQ(-EINVAL, cras_lea_parse_configuration(config, 3, &cfg));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
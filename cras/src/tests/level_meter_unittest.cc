@@ -0,0 +1,86 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_level_meter.h"
+#include "ewma_power.h"
+}
+
+namespace {
+
+TEST(LevelMeter, PublishesPeakAndRms) {
+  struct cras_level_meter shared[CRAS_MAX_LEVEL_METERS] = {};
+  struct ewma_power ewma;
+  int16_t buf[480];
+  int meter;
+
+  cras_level_meter_share(shared);
+  meter = cras_level_meter_add(CRAS_LEVEL_METER_DEVICE, 3);
+  ASSERT_LE(0, meter);
+  EXPECT_EQ(CRAS_LEVEL_METER_DEVICE, shared[meter].type);
+  EXPECT_EQ(3, shared[meter].id);
+  EXPECT_EQ(0, shared[meter].seq % 2);
+
+  // A full scale half square wave, sampled on its high half.
+  for (int i = 0; i < 480; i++)
+    buf[i] = i % 96 < 48 ? 16384 : 0;
+  ewma_power_init(&ewma, SND_PCM_FORMAT_S16_LE, 48000);
+  ewma_power_calculate(&ewma, buf, 1, 480);
+  cras_level_meter_update(meter, &ewma);
+  EXPECT_NEAR(0.5f, shared[meter].peak, 0.01f);
+  EXPECT_GT(shared[meter].rms, 0.0f);
+  EXPECT_LE(shared[meter].rms, 0.5f);
+
+  // The peak falls back slower than the power over silence.
+  for (int i = 0; i < 480; i++)
+    buf[i] = 0;
+  for (int i = 0; i < 10; i++)
+    ewma_power_calculate(&ewma, buf, 1, 480);
+  cras_level_meter_update(meter, &ewma);
+  EXPECT_GT(shared[meter].peak, 0.25f);
+  EXPECT_LT(shared[meter].peak, 0.5f);
+  EXPECT_LT(shared[meter].rms, 0.01f);
+
+  cras_level_meter_rm(meter);
+  EXPECT_EQ(CRAS_LEVEL_METER_NONE, shared[meter].type);
+  cras_level_meter_share(NULL);
+}
+
+TEST(LevelMeter, SharedLater) {
+  struct cras_level_meter shared[CRAS_MAX_LEVEL_METERS] = {};
+  int meter;
+
+  meter = cras_level_meter_add(CRAS_LEVEL_METER_STREAM, 0x10002);
+  ASSERT_LE(0, meter);
+  cras_level_meter_share(shared);
+  EXPECT_EQ(CRAS_LEVEL_METER_STREAM, shared[meter].type);
+  EXPECT_EQ(0x10002, shared[meter].id);
+
+  cras_level_meter_rm(meter);
+  cras_level_meter_share(NULL);
+}
+
+TEST(LevelMeter, RunsOutOfMeters) {
+  int meters[CRAS_MAX_LEVEL_METERS];
+
+  for (int i = 0; i < CRAS_MAX_LEVEL_METERS; i++) {
+    meters[i] = cras_level_meter_add(CRAS_LEVEL_METER_DEVICE, i);
+    ASSERT_LE(0, meters[i]);
+  }
+  EXPECT_EQ(-ENOSPC, cras_level_meter_add(CRAS_LEVEL_METER_DEVICE, 99));
+  // Updates of a meter that wasn't added are ignored.
+  cras_level_meter_update(-ENOSPC, NULL);
+
+  for (int i = 0; i < CRAS_MAX_LEVEL_METERS; i++)
+    cras_level_meter_rm(meters[i]);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
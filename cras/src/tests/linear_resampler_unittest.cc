@@ -214,6 +214,32 @@ void cras_mix_add_scale_stride(int fmt,
 
 }  //  extern "C"
 
+TEST(LinearResampler, ResampleS32KeepsLowBits) {
+  int32_t* in = (int32_t*)in_buf;
+  int32_t* out = (int32_t*)out_buf;
+  unsigned int count = 100;
+  int i, rc;
+  struct linear_resampler* lr;
+
+  memset(out_buf, 0, BUF_SIZE);
+  for (i = 0; i < 100; i++) {
+    in[i * 2] = 0x10000001 + i * 2;
+    in[i * 2 + 1] = -0x10000001 - i * 2;
+  }
+
+  lr = linear_resampler_create(2, 8, 24000, 48000);
+  rc = linear_resampler_resample(lr, in_buf, &count, out_buf, 199);
+  EXPECT_EQ(199, rc);
+  EXPECT_EQ(100, count);
+
+  /* Every other output frame falls between two input frames. */
+  for (i = 0; i < 199; i++) {
+    EXPECT_EQ(0x10000001 + i, out[i * 2]);
+    EXPECT_EQ(-0x10000001 - i, out[i * 2 + 1]);
+  }
+  linear_resampler_destroy(lr);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
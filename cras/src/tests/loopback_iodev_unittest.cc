@@ -6,6 +6,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 
+#include <vector>
+
 extern "C" {
 // For audio_thread_log.h use.
 struct audio_thread_event_log* atlog;
@@ -16,6 +18,8 @@ int atlog_ro_shm_fd;
 #include "cras_iodev.h"
 #include "cras_iodev_list.h"
 #include "cras_loopback_iodev.h"
+#include "cras_loopback_tap.h"
+#include "cras_rstream.h"
 #include "cras_shm.h"
 #include "cras_types.h"
 #include "dev_stream.h"
@@ -31,6 +35,8 @@ static const unsigned int kBufferSize = kBufferFrames * kFrameBytes;
 static struct timespec time_now;
 static cras_audio_area* mock_audio_area;
 static loopback_hook_data_t loop_hook;
+static loopback_hook_control_t loop_control;
+static void* loop_hook_cb_data;
 static struct cras_iodev* enabled_dev;
 static unsigned int cras_iodev_list_add_input_called;
 static unsigned int cras_iodev_list_rm_input_called;
@@ -60,6 +66,8 @@ class LoopBackTestSuite : public testing::Test {
     loop_in_->format = &fmt_;
 
     loop_hook = NULL;
+    loop_control = NULL;
+    loop_hook_cb_data = NULL;
     cras_iodev_list_add_input_called = 0;
     cras_iodev_list_rm_input_called = 0;
     cras_iodev_list_set_device_enabled_callback_called = 0;
@@ -69,7 +77,8 @@ class LoopBackTestSuite : public testing::Test {
     ASSERT_FALSE(asprintf(&atlog_name, "/ATlog-%d", getpid()) < 0);
     /* To avoid un-used variable warning. */
     atlog_rw_shm_fd = atlog_ro_shm_fd = -1;
-    atlog = audio_thread_event_log_init(atlog_name);
+    atlog =
+        audio_thread_event_log_init(atlog_name, AUDIO_THREAD_EVENT_LOG_SIZE);
   }
 
   virtual void TearDown() {
@@ -102,11 +111,11 @@ TEST_F(LoopBackTestSuite, InstallLoopHook) {
   EXPECT_EQ(1, cras_iodev_list_set_device_enabled_callback_called);
   EXPECT_EQ(1, cras_iodev_list_register_loopback_called);
 
-  // Signal an output device is enabled.
+  // Signal the output device read already is enabled.
   device_enabled_callback_cb(&iodev, device_enabled_callback_cb_data);
 
-  // Expect that a hook was added to the iodev
-  EXPECT_EQ(2, cras_iodev_list_register_loopback_called);
+  // Expect that the hook on the iodev is kept.
+  EXPECT_EQ(1, cras_iodev_list_register_loopback_called);
   ASSERT_NE(reinterpret_cast<loopback_hook_data_t>(NULL), loop_hook);
 
   // Check zero frames queued.
@@ -114,15 +123,16 @@ TEST_F(LoopBackTestSuite, InstallLoopHook) {
 
   device_disabled_callback_cb(&iodev, device_enabled_callback_cb_data);
   EXPECT_EQ(1, cras_iodev_list_unregister_loopback_called);
-  EXPECT_EQ(3, cras_iodev_list_register_loopback_called);
+  EXPECT_EQ(2, cras_iodev_list_register_loopback_called);
 
   enabled_dev->info.idx = 456;
   device_enabled_callback_cb(&iodev, device_enabled_callback_cb_data);
-  EXPECT_EQ(4, cras_iodev_list_register_loopback_called);
+  EXPECT_EQ(2, cras_iodev_list_unregister_loopback_called);
+  EXPECT_EQ(3, cras_iodev_list_register_loopback_called);
 
   // Close loopback devices.
   EXPECT_EQ(0, loop_in_->close_dev(loop_in_));
-  EXPECT_EQ(2, cras_iodev_list_unregister_loopback_called);
+  EXPECT_EQ(3, cras_iodev_list_unregister_loopback_called);
   EXPECT_EQ(2, cras_iodev_list_set_device_enabled_callback_called);
 }
 
@@ -200,8 +210,9 @@ TEST_F(LoopBackTestSuite, SimpleLoopback) {
   loop_in_->configure_dev(loop_in_);
   ASSERT_NE(reinterpret_cast<void*>(NULL), loop_hook);
 
-  // Loopback callback for the hook.
-  loop_hook(buf_, nframes, &fmt_, loop_in_);
+  // The output starts, then plays through the hook.
+  loop_control(true, loop_hook_cb_data);
+  loop_hook(buf_, nframes, &fmt_, loop_hook_cb_data);
 
   // Verify frames from loopback record.
   loop_in_->get_buffer(loop_in_, &area, &nread);
@@ -216,6 +227,185 @@ TEST_F(LoopBackTestSuite, SimpleLoopback) {
   EXPECT_EQ(0, loop_in_->close_dev(loop_in_));
 }
 
+static int tap_started;
+
+static int TapStart(bool start, void* cb_data) {
+  tap_started = start;
+  return 0;
+}
+
+TEST_F(LoopBackTestSuite, ReadersShareTap) {
+  struct cras_iodev iodev;
+  struct loopback_tap_reader* reader;
+  cras_audio_area* area;
+  const uint8_t* buf;
+  unsigned int nframes = 1024;
+  unsigned int nread = nframes;
+
+  iodev.info.idx = 123;
+  enabled_dev = &iodev;
+  tap_started = 0;
+
+  loop_in_->configure_dev(loop_in_);
+  reader = loopback_tap_attach(LOOPBACK_POST_MIX_PRE_DSP, NULL, 123, TapStart,
+                               NULL);
+  ASSERT_NE(reinterpret_cast<void*>(NULL), reader);
+  // The second reader is served by the same tap.
+  EXPECT_EQ(1, cras_iodev_list_register_loopback_called);
+
+  loop_control(true, loop_hook_cb_data);
+  EXPECT_EQ(1, tap_started);
+  loop_hook(buf_, nframes, &fmt_, loop_hook_cb_data);
+
+  // Both read the frames in place, from their own positions.
+  loop_in_->get_buffer(loop_in_, &area, &nread);
+  EXPECT_EQ(nframes, nread);
+  buf = loopback_tap_reader_get(reader, &nframes);
+  EXPECT_EQ(nread, nframes);
+  EXPECT_EQ(area->channels[0].buf, buf);
+  EXPECT_EQ(0, memcmp(buf, buf_, nframes * kFrameBytes));
+  loop_in_->put_buffer(loop_in_, nread);
+  EXPECT_EQ(nframes, loopback_tap_reader_queued(reader));
+  loopback_tap_reader_put(reader, 100);
+  EXPECT_EQ(nframes - 100, loopback_tap_reader_queued(reader));
+
+  // The tap stays registered until its last reader detaches.
+  EXPECT_EQ(0, loop_in_->close_dev(loop_in_));
+  EXPECT_EQ(0, cras_iodev_list_unregister_loopback_called);
+  loopback_tap_detach(reader);
+  EXPECT_EQ(1, cras_iodev_list_unregister_loopback_called);
+}
+
+TEST_F(LoopBackTestSuite, TapReaderOverrun) {
+  struct loopback_tap_reader* reader;
+  const uint8_t* buf;
+  unsigned int nframes = kBufferFrames;
+
+  reader = loopback_tap_attach(LOOPBACK_POST_DSP, NULL, 123, TapStart, NULL);
+  ASSERT_NE(reinterpret_cast<void*>(NULL), reader);
+  loop_control(true, loop_hook_cb_data);
+
+  // A ring and 100 frames more are written before the reader reads.
+  loop_hook(buf_, 100, &fmt_, loop_hook_cb_data);
+  loop_hook(buf_, LOOPBACK_TAP_FRAMES, &fmt_, loop_hook_cb_data);
+  EXPECT_EQ(LOOPBACK_TAP_FRAMES, loopback_tap_reader_queued(reader));
+
+  // The oldest 100 frames are lost, the rest read in one span over the
+  // wrap of the mirrored ring.
+  buf = loopback_tap_reader_get(reader, &nframes);
+  EXPECT_EQ(100, loopback_tap_reader_overruns(reader));
+  EXPECT_EQ(LOOPBACK_TAP_FRAMES, nframes);
+  EXPECT_EQ(0, memcmp(buf, buf_, nframes * kFrameBytes));
+  loopback_tap_reader_put(reader, nframes);
+  EXPECT_EQ(0, loopback_tap_reader_queued(reader));
+
+  loopback_tap_detach(reader);
+}
+
+// Mixes nframes of value into the taps as stream id is rendered for dev 123.
+static void MixStream(cras_stream_id_t id,
+                      int16_t value,
+                      unsigned int nframes) {
+  struct cras_rstream stream;
+  std::vector<int16_t> samples(nframes * 2, value);
+  struct cras_audio_format fmt;
+
+  stream.stream_id = id;
+  fmt.format = SND_PCM_FORMAT_S16_LE;
+  fmt.num_channels = 2;
+  loopback_tap_mix_stream(123, &stream, &fmt, (uint8_t*)samples.data(),
+                          nframes, 0, 1.0f);
+}
+
+// Reads nframes from reader and checks every sample is value.
+static void ExpectTapSamples(struct loopback_tap_reader* reader,
+                             int16_t value,
+                             unsigned int nframes) {
+  unsigned int nread = nframes;
+  const int16_t* buf = (const int16_t*)loopback_tap_reader_get(reader, &nread);
+
+  ASSERT_EQ(nframes, nread);
+  for (unsigned int i = 0; i < nframes * 2; i++)
+    ASSERT_EQ(value, buf[i]);
+  loopback_tap_reader_put(reader, nread);
+}
+
+TEST_F(LoopBackTestSuite, TargetIncludesClientStreams) {
+  struct loopback_target target = {LOOPBACK_TARGET_INCLUDE, 0x10, 0};
+  struct loopback_tap_reader* reader;
+
+  reader = loopback_tap_attach(LOOPBACK_POST_MIX_PRE_DSP, &target, 123,
+                               TapStart, NULL);
+  ASSERT_NE(reinterpret_cast<void*>(NULL), reader);
+  loop_control(true, loop_hook_cb_data);
+
+  // Both streams of client 0x10 are mixed, the other client isn't.
+  MixStream(0x100001, 1, 100);
+  MixStream(0x100002, 2, 100);
+  MixStream(0x200001, 4, 100);
+  EXPECT_EQ(0, loopback_tap_reader_queued(reader));
+
+  // Frames are readable once the device plays them.
+  loop_hook(buf_, 100, &fmt_, loop_hook_cb_data);
+  EXPECT_EQ(100, loopback_tap_reader_queued(reader));
+  ExpectTapSamples(reader, 3, 100);
+
+  // A stream ahead of the device keeps its frames for the next period.
+  MixStream(0x100001, 1, 150);
+  loop_hook(buf_, 100, &fmt_, loop_hook_cb_data);
+  ExpectTapSamples(reader, 1, 100);
+  loop_hook(buf_, 100, &fmt_, loop_hook_cb_data);
+  ExpectTapSamples(reader, 1, 50);
+  // The device plays silence where no stream was mixed.
+  ExpectTapSamples(reader, 0, 50);
+
+  loopback_tap_detach(reader);
+}
+
+TEST_F(LoopBackTestSuite, TargetExcludesStream) {
+  struct loopback_target target = {LOOPBACK_TARGET_EXCLUDE, 0x10, 0x100002};
+  struct loopback_tap_reader* reader;
+
+  reader = loopback_tap_attach(LOOPBACK_POST_MIX_PRE_DSP, &target, 123,
+                               TapStart, NULL);
+  ASSERT_NE(reinterpret_cast<void*>(NULL), reader);
+  loop_control(true, loop_hook_cb_data);
+
+  MixStream(0x100001, 1, 100);
+  MixStream(0x100002, 2, 100);
+  MixStream(0x200001, 4, 100);
+  loop_hook(buf_, 100, &fmt_, loop_hook_cb_data);
+  ExpectTapSamples(reader, 5, 100);
+
+  // Post DSP audio can't be split by stream.
+  EXPECT_EQ(NULL, loopback_tap_attach(LOOPBACK_POST_DSP, &target, 123,
+                                      TapStart, NULL));
+
+  loopback_tap_detach(reader);
+}
+
+TEST_F(LoopBackTestSuite, SetTargetSwitchesTap) {
+  struct loopback_target target = {LOOPBACK_TARGET_INCLUDE, 0x10, 0};
+  struct cras_iodev iodev;
+
+  iodev.info.idx = 123;
+  enabled_dev = &iodev;
+
+  // Kept for the next open while closed.
+  loopback_iodev_set_target(loop_in_, &target);
+  EXPECT_EQ(0, cras_iodev_list_register_loopback_called);
+
+  loop_in_->configure_dev(loop_in_);
+  EXPECT_EQ(1, cras_iodev_list_register_loopback_called);
+
+  target.mode = LOOPBACK_TARGET_ALL;
+  loopback_iodev_set_target(loop_in_, &target);
+  EXPECT_EQ(1, cras_iodev_list_unregister_loopback_called);
+  EXPECT_EQ(2, cras_iodev_list_register_loopback_called);
+
+  EXPECT_EQ(0, loop_in_->close_dev(loop_in_));
+}
+
 // TODO(chinyue): Test closing last iodev while streaming loopback data.
 
 /* Stubs */
@@ -245,17 +435,33 @@ void cras_iodev_list_register_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
                                        unsigned int output_dev_idx,
                                        loopback_hook_data_t hook_data,
                                        loopback_hook_control_t hook_start,
-                                       unsigned int loopback_dev_idx) {
+                                       void* cb_data) {
   cras_iodev_list_register_loopback_called++;
   loop_hook = hook_data;
+  loop_control = hook_start;
+  loop_hook_cb_data = cb_data;
 }
 
 void cras_iodev_list_unregister_loopback(enum CRAS_LOOPBACK_TYPE loopback_type,
                                          unsigned int output_dev_idx,
-                                         unsigned int loopback_dev_idx) {
+                                         void* cb_data) {
   cras_iodev_list_unregister_loopback_called++;
 }
 
+void cras_mix_add(snd_pcm_format_t fmt,
+                  uint8_t* dst,
+                  uint8_t* src,
+                  unsigned int count,
+                  unsigned int index,
+                  int mute,
+                  float mix_vol) {
+  int16_t* out = (int16_t*)dst;
+  const int16_t* in = (const int16_t*)src;
+
+  for (unsigned int i = 0; i < count; i++)
+    out[i] = index ? out[i] + in[i] : in[i];
+}
+
 int cras_iodev_list_add_input(struct cras_iodev* input) {
   cras_iodev_list_add_input_called++;
   return 0;
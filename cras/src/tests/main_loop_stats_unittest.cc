@@ -0,0 +1,92 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_latency_hist.h"
+#include "cras_main_loop_stats.h"
+}
+
+namespace {
+
+class MainLoopStatsTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    cras_main_loop_stats_reset();
+    memset(&info_, 0, sizeof(info_));
+  }
+
+  static timespec At(long usec) {
+    timespec ts = {usec / 1000000, (usec % 1000000) * 1000};
+    return ts;
+  }
+
+  main_thread_debug_info info_;
+};
+
+TEST_F(MainLoopStatsTestSuite, UntaggedFdIsGenericCallback) {
+  cras_main_loop_stats_tag_fd(5, CRAS_MAIN_HANDLER_UDEV);
+  cras_main_loop_stats_tag_fd(7, CRAS_MAIN_HANDLER_DBUS);
+
+  EXPECT_EQ(CRAS_MAIN_HANDLER_UDEV, cras_main_loop_stats_fd_handler(5));
+  EXPECT_EQ(CRAS_MAIN_HANDLER_DBUS, cras_main_loop_stats_fd_handler(7));
+  EXPECT_EQ(CRAS_MAIN_HANDLER_FD, cras_main_loop_stats_fd_handler(6));
+
+  cras_main_loop_stats_untag_fd(5);
+  EXPECT_EQ(CRAS_MAIN_HANDLER_FD, cras_main_loop_stats_fd_handler(5));
+  EXPECT_EQ(CRAS_MAIN_HANDLER_DBUS, cras_main_loop_stats_fd_handler(7));
+}
+
+TEST_F(MainLoopStatsTestSuite, TimesEachHandler) {
+  timespec t0 = At(1000), t1 = At(1300), t2 = At(1350), t3 = At(1400);
+  struct cras_main_loop_stall stall;
+
+  cras_main_loop_stats_pass_begin(&t0);
+  cras_main_loop_stats_add(CRAS_MAIN_HANDLER_CLIENT, &t0, &t1);
+  cras_main_loop_stats_add(CRAS_MAIN_HANDLER_TIMER, &t1, &t2);
+  EXPECT_EQ(0, cras_main_loop_stats_pass_end(&t3, &stall));
+
+  cras_main_loop_stats_fill(&info_);
+  EXPECT_EQ(1, cras_latency_hist_count(
+                   &info_.handler_hist[CRAS_MAIN_HANDLER_CLIENT]));
+  EXPECT_EQ(300, info_.handler_hist[CRAS_MAIN_HANDLER_CLIENT].max_usec);
+  EXPECT_EQ(50, info_.handler_hist[CRAS_MAIN_HANDLER_TIMER].max_usec);
+  EXPECT_EQ(0, cras_latency_hist_count(
+                   &info_.handler_hist[CRAS_MAIN_HANDLER_DBUS]));
+  EXPECT_EQ(1, cras_latency_hist_count(&info_.loop_hist));
+  EXPECT_EQ(400, info_.loop_hist.max_usec);
+  EXPECT_EQ(0, info_.num_stalls);
+}
+
+TEST_F(MainLoopStatsTestSuite, StallBlamesLongestHandler) {
+  timespec t0 = At(0), t1 = At(20000),
+           t2 = At(20000 + CRAS_MAIN_LOOP_STALL_USEC);
+  timespec end = At(40000 + CRAS_MAIN_LOOP_STALL_USEC);
+  struct cras_main_loop_stall stall;
+
+  cras_main_loop_stats_pass_begin(&t0);
+  cras_main_loop_stats_add(CRAS_MAIN_HANDLER_CLIENT, &t0, &t1);
+  cras_main_loop_stats_add(CRAS_MAIN_HANDLER_UDEV, &t1, &t2);
+  cras_main_loop_stats_add(CRAS_MAIN_HANDLER_ALERT, &t2, &end);
+  ASSERT_EQ(1, cras_main_loop_stats_pass_end(&end, &stall));
+
+  EXPECT_EQ(CRAS_MAIN_HANDLER_UDEV, stall.handler);
+  EXPECT_EQ(CRAS_MAIN_LOOP_STALL_USEC, stall.handler_usec);
+  EXPECT_EQ(40000 + CRAS_MAIN_LOOP_STALL_USEC, stall.pass_usec);
+
+  // The next pass is short and starts over.
+  cras_main_loop_stats_pass_begin(&end);
+  EXPECT_EQ(0, cras_main_loop_stats_pass_end(&end, &stall));
+  cras_main_loop_stats_fill(&info_);
+  EXPECT_EQ(1, info_.num_stalls);
+  EXPECT_EQ(2, cras_latency_hist_count(&info_.loop_hist));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,64 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+
+extern "C" {
+#include "cras_mem_stats.h"
+}
+
+namespace {
+
+TEST(MemStats, CountsBytesAndPeak) {
+  struct cras_mem_usage before, after;
+
+  cras_mem_stats_get(&before);
+  cras_mem_stats_add(CRAS_MEM_DSP, 100);
+  cras_mem_stats_add(CRAS_MEM_DSP, 50);
+  cras_mem_stats_sub(CRAS_MEM_DSP, 120);
+  cras_mem_stats_get(&after);
+
+  EXPECT_EQ(before.bytes[CRAS_MEM_DSP] + 30, after.bytes[CRAS_MEM_DSP]);
+  EXPECT_EQ(before.bytes[CRAS_MEM_DSP] + 150, after.peak_bytes[CRAS_MEM_DSP]);
+  EXPECT_EQ(before.bytes[CRAS_MEM_SHM], after.bytes[CRAS_MEM_SHM]);
+
+  cras_mem_stats_sub(CRAS_MEM_DSP, 30);
+}
+
+TEST(MemStats, PeakKeptAfterFree) {
+  struct cras_mem_usage usage;
+
+  cras_mem_stats_add(CRAS_MEM_BT, 4096);
+  cras_mem_stats_sub(CRAS_MEM_BT, 4096);
+  cras_mem_stats_add(CRAS_MEM_BT, 1024);
+  cras_mem_stats_get(&usage);
+
+  EXPECT_EQ(1024, usage.bytes[CRAS_MEM_BT]);
+  EXPECT_EQ(4096, usage.peak_bytes[CRAS_MEM_BT]);
+
+  cras_mem_stats_sub(CRAS_MEM_BT, 1024);
+}
+
+TEST(MemStats, PublishesToSharedState) {
+  struct cras_mem_usage shared = {};
+
+  cras_mem_stats_add(CRAS_MEM_APM, 64);
+  cras_mem_stats_share(&shared);
+  EXPECT_EQ(64, shared.bytes[CRAS_MEM_APM]);
+
+  cras_mem_stats_add(CRAS_MEM_APM, 64);
+  EXPECT_EQ(128, shared.bytes[CRAS_MEM_APM]);
+  EXPECT_EQ(128, shared.peak_bytes[CRAS_MEM_APM]);
+
+  cras_mem_stats_share(NULL);
+  cras_mem_stats_sub(CRAS_MEM_APM, 128);
+  EXPECT_EQ(128, shared.bytes[CRAS_MEM_APM]);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -50,6 +50,15 @@ int cras_server_metrics_hfp_packet_loss(float packet_loss_ratio) {
   return 0;
 }
 
+int cras_server_metrics_hfp_link_stats(const struct hfp_link_stats* stats) {
+  return 0;
+}
+
+int cras_server_metrics_bt_profile_switch_time(const struct timespec* time,
+                                               bool to_a2dp) {
+  return 0;
+}
+
 int cras_server_metrics_hfp_sco_connection_error(
     enum CRAS_METRICS_BT_SCO_ERROR_TYPE type) {
   return 0;
@@ -63,4 +72,10 @@ int cras_server_metrics_busyloop_length(unsigned count) {
   return 0;
 }
 
+void cras_server_metrics_start_batching() {}
+
+int cras_server_metrics_flush_batch(bool force) {
+  return 0;
+}
+
 }  // extern "C"
@@ -5,8 +5,11 @@
 #include <gtest/gtest.h>
 #include <stdio.h>
 
+#include <vector>
+
 extern "C" {
 #include "cras_mix.h"
+#include "cras_mix_ops.h"
 #include "cras_shm.h"
 #include "cras_types.h"
 }
@@ -1260,6 +1263,435 @@ TEST_F(MixTestSuiteS24_3LE, StrideCopy) {
   TestScaleStride(0.1);
 }
 
+// Runs every SIMD ops table this build and CPU provide against the scalar
+// table on the same inputs.
+class MixOpsConformanceTest : public testing::Test {
+ protected:
+  static const size_t kSamples = 1027;
+
+  virtual void SetUp() {
+    tables_.clear();
+#if defined HAVE_SSE42
+    if (__builtin_cpu_supports("sse4.2"))
+      tables_.push_back(&mixer_ops_sse42);
+#endif
+#if defined HAVE_AVX
+    if (__builtin_cpu_supports("avx"))
+      tables_.push_back(&mixer_ops_avx);
+#endif
+#if defined HAVE_AVX2
+    if (__builtin_cpu_supports("avx2"))
+      tables_.push_back(&mixer_ops_avx2);
+#endif
+#if defined HAVE_FMA
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+      tables_.push_back(&mixer_ops_fma);
+#endif
+#if defined HAVE_NEON
+    tables_.push_back(&mixer_ops_neon);
+#endif
+  }
+
+  // Fills with a full scale pattern so that sums clip.
+  void Fill(snd_pcm_format_t fmt, uint8_t* buf, unsigned int seed) {
+    for (size_t i = 0; i < kSamples; i++) {
+      int32_t v = (int32_t)(uint32_t)(i * 2654435761u + seed);
+      switch (fmt) {
+        case SND_PCM_FORMAT_S16_LE:
+          ((int16_t*)buf)[i] = v >> 16;
+          break;
+        case SND_PCM_FORMAT_S24_LE:
+          ((int32_t*)buf)[i] = (int32_t)v >> 8;
+          break;
+        default:
+          ((int32_t*)buf)[i] = v;
+          break;
+      }
+    }
+  }
+
+  // Float rounding may differ by an ulp between compiler flags, so allow a
+  // relative error that is tiny compared with the sample range.
+  void ExpectNear(snd_pcm_format_t fmt, const uint8_t* a, const uint8_t* b) {
+    for (size_t i = 0; i < kSamples; i++) {
+      int64_t x, y;
+      if (fmt == SND_PCM_FORMAT_S16_LE) {
+        x = ((int16_t*)a)[i];
+        y = ((int16_t*)b)[i];
+      } else {
+        x = ((int32_t*)a)[i];
+        y = ((int32_t*)b)[i];
+      }
+      int64_t tol = 1 + llabs(x) / (1 << 22);
+      ASSERT_LE(llabs(x - y), tol) << "fmt " << fmt << " sample " << i;
+    }
+  }
+
+  // The per-frame scalers scale_buffer_increment steps through.
+  static void RampGains(float scaler,
+                        float increment,
+                        float target,
+                        float* gains,
+                        size_t frames) {
+    for (size_t i = 0; i < frames; i++, scaler += increment) {
+      if ((scaler > target && increment > 0) ||
+          (scaler < target && increment < 0))
+        gains[i] = target;
+      else
+        gains[i] = scaler;
+    }
+  }
+
+  void RunAll(const struct cras_mix_ops* ops, snd_pcm_format_t fmt) {
+    const float vols[] = {0.0f, 0.25f, 0.5f, 0.999f, 1.0f};
+    uint8_t ref_dst[kSamples * 4], simd_dst[kSamples * 4], src[kSamples * 4];
+
+    Fill(fmt, src, 7);
+    for (float vol : vols) {
+      for (unsigned int index = 0; index < 2; index++) {
+        Fill(fmt, ref_dst, 3);
+        Fill(fmt, simd_dst, 3);
+        mixer_ops.add(fmt, ref_dst, src, kSamples, index, 0, vol);
+        ops->add(fmt, simd_dst, src, kSamples, index, 0, vol);
+        ExpectNear(fmt, ref_dst, simd_dst);
+
+        Fill(fmt, simd_dst, 3);
+        ops->get_add(fmt)(simd_dst, src, kSamples, index, 0, vol);
+        ExpectNear(fmt, ref_dst, simd_dst);
+      }
+
+      Fill(fmt, ref_dst, 3);
+      Fill(fmt, simd_dst, 3);
+      mixer_ops.scale_buffer(fmt, ref_dst, kSamples, vol);
+      ops->scale_buffer(fmt, simd_dst, kSamples, vol);
+      ExpectNear(fmt, ref_dst, simd_dst);
+
+      Fill(fmt, ref_dst, 3);
+      Fill(fmt, simd_dst, 3);
+      size_t bytes = snd_pcm_format_physical_width(fmt) / 8;
+      mixer_ops.add_scale_stride(fmt, ref_dst, src, kSamples, bytes, bytes,
+                                 vol);
+      ops->add_scale_stride(fmt, simd_dst, src, kSamples, bytes, bytes, vol);
+      ExpectNear(fmt, ref_dst, simd_dst);
+    }
+
+    const struct {
+      float start, increment, target;
+    } ramps[] = {
+        {0.0f, 0.001f, 1.0f},
+        {1.0f, -0.002f, 0.0f},
+        {0.2f, 0.01f, 0.6f},
+    };
+    for (auto& r : ramps) {
+      for (int step = 1; step <= 6; step++) {
+        Fill(fmt, ref_dst, 3);
+        Fill(fmt, simd_dst, 3);
+        mixer_ops.scale_buffer_increment(fmt, ref_dst, kSamples, r.start,
+                                         r.increment, r.target, step);
+        ops->scale_buffer_increment(fmt, simd_dst, kSamples, r.start,
+                                    r.increment, r.target, step);
+        ExpectNear(fmt, ref_dst, simd_dst);
+
+        float gains[kSamples];
+        RampGains(r.start, r.increment, r.target, gains, kSamples / step);
+        Fill(fmt, simd_dst, 3);
+        ops->scale_buffer_gains(fmt, simd_dst, kSamples, gains, step);
+        ExpectNear(fmt, ref_dst, simd_dst);
+      }
+    }
+
+    // General matrices, with and without a SIMD layout, over a length
+    // that isn't a whole number of SIMD blocks.
+    const float mtx2[] = {0.5f, 0.5f, 0.26f, 0.73f};
+    float mtx[8 * 8];
+    for (unsigned int n : {2, 4, 6, 8}) {
+      for (unsigned int i = 0; i < n * n; i++)
+        mtx[i] = n == 2 ? mtx2[i] : (float)((i * 7) % 5) / 4.0f - 0.4f;
+      Fill(fmt, ref_dst, 3);
+      Fill(fmt, simd_dst, 3);
+      mixer_ops.remix(fmt, ref_dst, kSamples / n, n, mtx,
+                      CRAS_MIX_REMIX_MATRIX);
+      ops->remix(fmt, simd_dst, kSamples / n, n, mtx, CRAS_MIX_REMIX_MATRIX);
+      ExpectNear(fmt, ref_dst, simd_dst);
+    }
+  }
+
+  std::vector<const struct cras_mix_ops*> tables_;
+};
+
+TEST_F(MixOpsConformanceTest, MatchesScalarOps) {
+  const snd_pcm_format_t fmts[] = {SND_PCM_FORMAT_S16_LE,
+                                   SND_PCM_FORMAT_S24_LE,
+                                   SND_PCM_FORMAT_S32_LE};
+  for (auto ops : tables_)
+    for (auto fmt : fmts)
+      RunAll(ops, fmt);
+}
+
+TEST(MixScaleGains, MatchesIncrement) {
+  const snd_pcm_format_t fmts[] = {
+      SND_PCM_FORMAT_S16_LE, SND_PCM_FORMAT_S24_LE, SND_PCM_FORMAT_S32_LE,
+      SND_PCM_FORMAT_S24_3LE};
+  const unsigned int kFrames = 300;
+  const int kChannels = 2;
+  float gains[kFrames];
+  uint8_t expected[kFrames * kChannels * 4], buf[kFrames * kChannels * 4];
+
+  // Ramps down from 1 to silence over a buffer longer than one block.
+  float scaler = 1.0f;
+  for (unsigned int i = 0; i < kFrames; i++, scaler -= 0.004f)
+    gains[i] = scaler < 0 ? 0 : scaler;
+  for (auto fmt : fmts) {
+    size_t bytes = kFrames * kChannels * snd_pcm_format_physical_width(fmt) / 8;
+    for (size_t i = 0; i < bytes; i++)
+      expected[i] = buf[i] = i * 37 + 11;
+
+    cras_scale_buffer_increment(fmt, expected, kFrames, 1.0f, -0.004f, 0.0f,
+                                kChannels);
+    cras_scale_buffer_gains(fmt, buf, kFrames, gains, kChannels);
+    EXPECT_EQ(0, memcmp(expected, buf, bytes)) << "fmt " << fmt;
+  }
+}
+
+TEST(MixAddPlanar, S16OverwriteThenAdd) {
+  int16_t src[] = {16384, -16384, 8192, -32768};
+  float left[2], right[2];
+  float* planes[] = {left, right};
+
+  EXPECT_EQ(0, cras_mix_add_planar(SND_PCM_FORMAT_S16_LE, planes,
+                                   (uint8_t*)src, 2, 2, 0, 0, 1.0f));
+  EXPECT_FLOAT_EQ(0.5f, left[0]);
+  EXPECT_FLOAT_EQ(-0.5f, right[0]);
+  EXPECT_FLOAT_EQ(0.25f, left[1]);
+  EXPECT_FLOAT_EQ(-1.0f, right[1]);
+
+  // A second stream is summed without clipping, at its volume.
+  EXPECT_EQ(0, cras_mix_add_planar(SND_PCM_FORMAT_S16_LE, planes,
+                                   (uint8_t*)src, 2, 2, 1, 0, 0.5f));
+  EXPECT_FLOAT_EQ(0.75f, left[0]);
+  EXPECT_FLOAT_EQ(-0.75f, right[0]);
+  EXPECT_FLOAT_EQ(0.375f, left[1]);
+  EXPECT_FLOAT_EQ(-1.5f, right[1]);
+}
+
+TEST(MixAddPlanar, MutedStream) {
+  int16_t src[] = {16384, -16384};
+  float left[] = {0.1f}, right[] = {0.2f};
+  float* planes[] = {left, right};
+
+  cras_mix_add_planar(SND_PCM_FORMAT_S16_LE, planes, (uint8_t*)src, 2, 1, 1,
+                      1, 1.0f);
+  EXPECT_FLOAT_EQ(0.1f, left[0]);
+  EXPECT_FLOAT_EQ(0.2f, right[0]);
+  cras_mix_add_planar(SND_PCM_FORMAT_S16_LE, planes, (uint8_t*)src, 2, 1, 0,
+                      1, 1.0f);
+  EXPECT_FLOAT_EQ(0.0f, left[0]);
+  EXPECT_FLOAT_EQ(0.0f, right[0]);
+}
+
+TEST(MixAddPlanar, WideFormats) {
+  int32_t s32[] = {0x40000000, -0x20000000};
+  int32_t s24[] = {0x00400000, (int32_t)0x00e00000};
+  uint8_t s243[] = {0x00, 0x00, 0x40, 0x00, 0x00, 0xe0};
+  float left[1], right[1];
+  float* planes[] = {left, right};
+
+  cras_mix_add_planar(SND_PCM_FORMAT_S32_LE, planes, (uint8_t*)s32, 2, 1, 0,
+                      0, 1.0f);
+  EXPECT_FLOAT_EQ(0.5f, left[0]);
+  EXPECT_FLOAT_EQ(-0.25f, right[0]);
+  cras_mix_add_planar(SND_PCM_FORMAT_S24_LE, planes, (uint8_t*)s24, 2, 1, 0,
+                      0, 1.0f);
+  EXPECT_FLOAT_EQ(0.5f, left[0]);
+  EXPECT_FLOAT_EQ(-0.25f, right[0]);
+  cras_mix_add_planar(SND_PCM_FORMAT_S24_3LE, planes, s243, 2, 1, 0, 0, 1.0f);
+  EXPECT_FLOAT_EQ(0.5f, left[0]);
+  EXPECT_FLOAT_EQ(-0.25f, right[0]);
+
+  EXPECT_EQ(-EINVAL, cras_mix_add_planar(SND_PCM_FORMAT_U8, planes,
+                                         (uint8_t*)s32, 2, 1, 0, 0, 1.0f));
+}
+
+TEST(MixAddPlanar, Float) {
+  float src[] = {0.5f, -1.5f};
+  float left[1], right[1];
+  float* planes[] = {left, right};
+
+  // Floats are taken as they are, beyond full scale too.
+  EXPECT_EQ(0, cras_mix_add_planar(SND_PCM_FORMAT_FLOAT_LE, planes,
+                                   (uint8_t*)src, 2, 1, 0, 0, 1.0f));
+  EXPECT_FLOAT_EQ(0.5f, left[0]);
+  EXPECT_FLOAT_EQ(-1.5f, right[0]);
+  EXPECT_EQ(0, cras_mix_add_planar(SND_PCM_FORMAT_FLOAT_LE, planes,
+                                   (uint8_t*)src, 2, 1, 1, 0, 0.5f));
+  EXPECT_FLOAT_EQ(0.75f, left[0]);
+  EXPECT_FLOAT_EQ(-2.25f, right[0]);
+}
+
+TEST(MixAddPlanar, ChannelCounts) {
+  const unsigned int kFrames = 5;
+  int16_t src[kFrames * 8];
+  float planes_buf[8][kFrames];
+  float* planes[8];
+
+  for (unsigned int i = 0; i < kFrames * 8; i++)
+    src[i] = (int16_t)(i * 1021 - 16384);
+  for (unsigned int ch = 0; ch < 8; ch++)
+    planes[ch] = planes_buf[ch];
+
+  // The counts with their own loops and the ones without deinterleave the
+  // same way.
+  for (unsigned int n = 1; n <= 8; n++) {
+    EXPECT_EQ(0, cras_mix_add_planar(SND_PCM_FORMAT_S16_LE, planes,
+                                     (uint8_t*)src, n, kFrames, 0, 0, 0.5f));
+    for (unsigned int ch = 0; ch < n; ch++)
+      for (unsigned int i = 0; i < kFrames; i++)
+        EXPECT_FLOAT_EQ(src[i * n + ch] / 32768.0f * 0.5f, planes[ch][i])
+            << n << " channels";
+  }
+}
+
+TEST(MixGetAdd, Unsupported) {
+  int16_t dst[] = {1, 2}, src[] = {3, 4};
+
+  cras_mix_get_add(SND_PCM_FORMAT_U8)((uint8_t*)dst, (uint8_t*)src, 2, 1, 0,
+                                      1.0f);
+  EXPECT_EQ(1, dst[0]);
+  EXPECT_EQ(2, dst[1]);
+
+  cras_mix_get_add(SND_PCM_FORMAT_S16_LE)((uint8_t*)dst, (uint8_t*)src, 2, 1,
+                                          0, 1.0f);
+  EXPECT_EQ(4, dst[0]);
+  EXPECT_EQ(6, dst[1]);
+}
+
+TEST(MixFloat, AddAndScale) {
+  float dst[] = {0.0f, 0.0f, 0.0f};
+  float src[] = {0.5f, -0.25f, 0.75f};
+
+  cras_mix_add(SND_PCM_FORMAT_FLOAT_LE, (uint8_t*)dst, (uint8_t*)src, 3, 0, 0,
+               1.0f);
+  EXPECT_FLOAT_EQ(0.5f, dst[0]);
+  EXPECT_FLOAT_EQ(-0.25f, dst[1]);
+  // Sums over full scale aren't clipped.
+  cras_mix_add(SND_PCM_FORMAT_FLOAT_LE, (uint8_t*)dst, (uint8_t*)src, 3, 1, 0,
+               0.5f);
+  EXPECT_FLOAT_EQ(0.75f, dst[0]);
+  EXPECT_FLOAT_EQ(-0.375f, dst[1]);
+  EXPECT_FLOAT_EQ(1.125f, dst[2]);
+
+  cras_scale_buffer(SND_PCM_FORMAT_FLOAT_LE, (uint8_t*)dst, 3, 0.5f);
+  EXPECT_FLOAT_EQ(0.375f, dst[0]);
+  cras_scale_buffer_increment(SND_PCM_FORMAT_FLOAT_LE, (uint8_t*)dst, 3,
+                              0.0f, 1.0f, 1.0f, 1);
+  EXPECT_FLOAT_EQ(0.0f, dst[0]);
+  EXPECT_FLOAT_EQ(-0.1875f, dst[1]);
+
+  cras_mix_add_scale_stride(SND_PCM_FORMAT_FLOAT_LE, (uint8_t*)dst,
+                            (uint8_t*)src, 3, 4, 4, 1.0f);
+  EXPECT_FLOAT_EQ(0.5f, dst[0]);
+  EXPECT_FLOAT_EQ(-0.4375f, dst[1]);
+}
+
+TEST(MixRemix, Kinds) {
+  const float swap[] = {0, 1, 1, 0};
+  const float left_to_both[] = {1, 0, 1, 0};
+  const float fan_out[] = {1, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 1, 0, 0};
+  const float mono[] = {0.5f, 0.5f, 0.5f, 0.5f};
+  const float sum[] = {1, 1, 1, 1};
+  const float matrix[] = {0.5f, 0.5f, 0.26f, 0.73f};
+
+  EXPECT_EQ(CRAS_MIX_REMIX_SELECT, cras_mix_remix_kind(swap, 2));
+  EXPECT_EQ(CRAS_MIX_REMIX_SELECT, cras_mix_remix_kind(left_to_both, 2));
+  EXPECT_EQ(CRAS_MIX_REMIX_SELECT, cras_mix_remix_kind(fan_out, 4));
+  EXPECT_EQ(CRAS_MIX_REMIX_MONO, cras_mix_remix_kind(mono, 2));
+  EXPECT_EQ(CRAS_MIX_REMIX_MONO, cras_mix_remix_kind(sum, 2));
+  EXPECT_EQ(CRAS_MIX_REMIX_MATRIX, cras_mix_remix_kind(matrix, 2));
+}
+
+TEST(MixRemix, SelectCopiesSamples) {
+  const float swap[] = {0, 1, 1, 0};
+  const float fan_out[] = {1, 0, 0, 0, 0, 1, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0};
+  int16_t s16[] = {1, 2, 3, 4};
+  uint8_t s243[] = {1, 2, 3, 4, 5, 6};
+  int32_t s32[] = {1, 2, 3, 4, 5, 6, 7, 8};
+
+  EXPECT_EQ(0, cras_mix_remix(SND_PCM_FORMAT_S16_LE, (uint8_t*)s16, 2, 2,
+                              swap, CRAS_MIX_REMIX_SELECT));
+  EXPECT_EQ(2, s16[0]);
+  EXPECT_EQ(1, s16[1]);
+  EXPECT_EQ(4, s16[2]);
+  EXPECT_EQ(3, s16[3]);
+
+  EXPECT_EQ(0, cras_mix_remix(SND_PCM_FORMAT_S24_3LE, s243, 1, 2, swap,
+                              CRAS_MIX_REMIX_SELECT));
+  EXPECT_EQ(4, s243[0]);
+  EXPECT_EQ(6, s243[2]);
+  EXPECT_EQ(1, s243[3]);
+  EXPECT_EQ(3, s243[5]);
+
+  // The first two channels to the last two, the last one silenced.
+  EXPECT_EQ(0, cras_mix_remix(SND_PCM_FORMAT_S32_LE, (uint8_t*)s32, 2, 4,
+                              fan_out, CRAS_MIX_REMIX_SELECT));
+  EXPECT_EQ(1, s32[0]);
+  EXPECT_EQ(2, s32[1]);
+  EXPECT_EQ(1, s32[2]);
+  EXPECT_EQ(0, s32[3]);
+  EXPECT_EQ(5, s32[4]);
+  EXPECT_EQ(6, s32[5]);
+  EXPECT_EQ(5, s32[6]);
+  EXPECT_EQ(0, s32[7]);
+}
+
+TEST(MixRemix, MonoClips) {
+  const float sum[] = {1, 1, 1, 1};
+  int16_t s16[] = {20000, 20000, -100, 50};
+  int32_t s32[] = {0x60000000, 0x60000000};
+
+  cras_mix_remix(SND_PCM_FORMAT_S16_LE, (uint8_t*)s16, 2, 2, sum,
+                 CRAS_MIX_REMIX_MONO);
+  EXPECT_EQ(32767, s16[0]);
+  EXPECT_EQ(32767, s16[1]);
+  EXPECT_EQ(-50, s16[2]);
+  EXPECT_EQ(-50, s16[3]);
+
+  cras_mix_remix(SND_PCM_FORMAT_S32_LE, (uint8_t*)s32, 1, 2, sum,
+                 CRAS_MIX_REMIX_MONO);
+  EXPECT_EQ(INT32_MAX, s32[0]);
+  EXPECT_EQ(INT32_MAX, s32[1]);
+}
+
+TEST(MixRemix, Unsupported) {
+  const float matrix[] = {0.5f, 0.5f, 0.26f, 0.73f};
+  uint8_t buf[12] = {};
+
+  EXPECT_EQ(-EINVAL, cras_mix_remix(SND_PCM_FORMAT_S24_3LE, buf, 2, 2,
+                                    matrix, CRAS_MIX_REMIX_MATRIX));
+  EXPECT_EQ(-EINVAL, cras_mix_remix(SND_PCM_FORMAT_U8, buf, 2, 2, matrix,
+                                    CRAS_MIX_REMIX_SELECT));
+}
+
+TEST(MixRemix, Planar) {
+  const float matrix[] = {0.5f, 0.5f, 0.25f, 0.75f};
+  const float mono[] = {0.5f, 0.5f, 0.5f, 0.5f};
+  float left[300], right[300];
+  float* planes[] = {left, right};
+
+  for (int i = 0; i < 300; i++) {
+    left[i] = 0.5f;
+    right[i] = -0.25f;
+  }
+  cras_mix_remix_planar(planes, 300, 2, matrix, CRAS_MIX_REMIX_MATRIX);
+  EXPECT_FLOAT_EQ(0.125f, left[0]);
+  EXPECT_FLOAT_EQ(-0.0625f, right[0]);
+  EXPECT_FLOAT_EQ(0.125f, left[299]);
+  EXPECT_FLOAT_EQ(-0.0625f, right[299]);
+
+  cras_mix_remix_planar(planes, 300, 2, mono, CRAS_MIX_REMIX_MONO);
+  EXPECT_FLOAT_EQ(0.03125f, left[10]);
+  EXPECT_FLOAT_EQ(0.03125f, right[10]);
+}
+
 /* Stubs */
 extern "C" {}  // extern "C"
 
@@ -0,0 +1,132 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_messages.h"
+#include "cras_observer.h"
+#include "cras_observer_ring.h"
+#include "cras_system_state.h"
+#include "cras_types.h"
+}
+
+namespace {
+
+static struct cras_server_state server_state;
+static struct cras_observer_ops ring_ops;
+static size_t cras_observer_add_called;
+static size_t cras_observer_remove_called;
+
+class ObserverRingTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    memset(&server_state, 0, sizeof(server_state));
+    memset(&ring_ops, 0, sizeof(ring_ops));
+    cras_observer_add_called = 0;
+    cras_observer_remove_called = 0;
+    ASSERT_EQ(0, cras_observer_ring_init());
+    ASSERT_EQ(1, cras_observer_add_called);
+    fd_ = cras_observer_ring_event_fd();
+    ASSERT_GE(fd_, 0);
+  }
+
+  virtual void TearDown() {
+    cras_observer_ring_deinit();
+    EXPECT_EQ(1, cras_observer_remove_called);
+    EXPECT_EQ(-1, cras_observer_ring_event_fd());
+  }
+
+  // Returns the eventfd count, resetting it.
+  uint64_t ReadEventFd() {
+    uint64_t count = 0;
+    if (read(fd_, &count, sizeof(count)) != sizeof(count))
+      return 0;
+    return count;
+  }
+
+  int fd_;
+};
+
+TEST_F(ObserverRingTest, RecordsEvents) {
+  struct cras_observer_event_ring* ring = &server_state.observer_events;
+
+  ring_ops.output_mute_changed(NULL, 1, 0, 1);
+  ring_ops.active_node_changed(NULL, CRAS_STREAM_INPUT, 0x100000002);
+  ring_ops.num_active_streams_changed(NULL, CRAS_STREAM_OUTPUT, 3);
+  ASSERT_EQ(3, ring->write_pos);
+
+  EXPECT_EQ(CRAS_CLIENT_OUTPUT_MUTE_CHANGED, ring->events[0].id);
+  EXPECT_EQ(1, ring->events[0].values[0]);
+  EXPECT_EQ(0, ring->events[0].values[1]);
+  EXPECT_EQ(1, ring->events[0].values[2]);
+  EXPECT_EQ(CRAS_CLIENT_ACTIVE_NODE_CHANGED, ring->events[1].id);
+  EXPECT_EQ(CRAS_STREAM_INPUT, ring->events[1].direction);
+  EXPECT_EQ(0x100000002, ring->events[1].node_id);
+  EXPECT_EQ(CRAS_CLIENT_NUM_ACTIVE_STREAMS_CHANGED, ring->events[2].id);
+  EXPECT_EQ(CRAS_STREAM_OUTPUT, ring->events[2].direction);
+  EXPECT_EQ(3, ring->events[2].values[0]);
+}
+
+TEST_F(ObserverRingTest, WrapsAround) {
+  struct cras_observer_event_ring* ring = &server_state.observer_events;
+  int i;
+
+  for (i = 0; i < CRAS_OBSERVER_EVENT_RING_SIZE + 2; i++)
+    ring_ops.output_volume_changed(NULL, i);
+  EXPECT_EQ(CRAS_OBSERVER_EVENT_RING_SIZE + 2, ring->write_pos);
+  EXPECT_EQ(CRAS_OBSERVER_EVENT_RING_SIZE, ring->events[0].values[0]);
+  EXPECT_EQ(CRAS_OBSERVER_EVENT_RING_SIZE + 1, ring->events[1].values[0]);
+  EXPECT_EQ(2, ring->events[2].values[0]);
+}
+
+TEST_F(ObserverRingTest, FlushSignalsOncePerBatch) {
+  // Nothing added, nothing signaled.
+  cras_observer_ring_flush();
+  EXPECT_EQ(0, ReadEventFd());
+
+  ring_ops.nodes_changed(NULL);
+  ring_ops.output_volume_changed(NULL, 50);
+  ring_ops.capture_gain_changed(NULL, 200);
+  cras_observer_ring_flush();
+  cras_observer_ring_flush();
+  EXPECT_EQ(1, ReadEventFd());
+
+  // The count is reset before each signal.
+  ring_ops.nodes_changed(NULL);
+  cras_observer_ring_flush();
+  ring_ops.nodes_changed(NULL);
+  cras_observer_ring_flush();
+  EXPECT_EQ(1, ReadEventFd());
+}
+
+}  // namespace
+
+extern "C" {
+
+struct cras_server_state* cras_system_state_get_no_lock() {
+  return &server_state;
+}
+
+struct cras_observer_client* cras_observer_add(
+    const struct cras_observer_ops* ops,
+    void* context) {
+  cras_observer_add_called++;
+  ring_ops = *ops;
+  return reinterpret_cast<struct cras_observer_client*>(&ring_ops);
+}
+
+void cras_observer_remove(struct cras_observer_client* client) {
+  cras_observer_remove_called++;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -25,6 +25,8 @@ static alert_callback_map cras_alert_create_prepare_map;
 static alert_callback_map cras_alert_add_callback_map;
 typedef std::map<struct cras_alert*, unsigned int> alert_flags_map;
 static alert_flags_map cras_alert_create_flags_map;
+typedef std::map<struct cras_alert*, size_t> alert_key_size_map;
+static alert_key_size_map cras_alert_set_key_size_map;
 static struct cras_alert* cras_alert_pending_alert_value;
 static void* cras_alert_pending_data_value = NULL;
 static size_t cras_alert_pending_data_size_value;
@@ -68,6 +70,7 @@ static void ResetStubData() {
   cras_alert_create_return_values.clear();
   cras_alert_create_prepare_map.clear();
   cras_alert_create_flags_map.clear();
+  cras_alert_set_key_size_map.clear();
   cras_alert_add_callback_map.clear();
   cras_alert_pending_alert_value = NULL;
   cras_alert_pending_data_size_value = 0;
@@ -229,8 +232,16 @@ class ObserverTest : public testing::Test {
               cras_alert_create_prepare_map[g_observer->alerts.nodes]);
     EXPECT_EQ(reinterpret_cast<void*>(active_node_alert),
               cras_alert_add_callback_map[g_observer->alerts.active_node]);
-    EXPECT_EQ(CRAS_ALERT_FLAG_KEEP_ALL_DATA,
+    EXPECT_EQ(CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED,
               cras_alert_create_flags_map[g_observer->alerts.active_node]);
+    EXPECT_EQ(offsetof(struct cras_observer_alert_data_active_node, node_id),
+              cras_alert_set_key_size_map[g_observer->alerts.active_node]);
+    EXPECT_EQ(
+        CRAS_ALERT_FLAG_MERGE_BY_KEY | CRAS_ALERT_FLAG_SKIP_UNCHANGED,
+        cras_alert_create_flags_map[g_observer->alerts.output_node_volume]);
+    EXPECT_EQ(
+        sizeof(cras_node_id_t),
+        cras_alert_set_key_size_map[g_observer->alerts.output_node_volume]);
     EXPECT_EQ(
         reinterpret_cast<void*>(output_node_volume_alert),
         cras_alert_add_callback_map[g_observer->alerts.output_node_volume]);
@@ -686,6 +697,10 @@ struct cras_alert* cras_alert_create(cras_alert_prepare prepare,
   return alert;
 }
 
+void cras_alert_set_key_size(struct cras_alert* alert, size_t key_size) {
+  cras_alert_set_key_size_map[alert] = key_size;
+}
+
 int cras_alert_add_callback(struct cras_alert* alert,
                             cras_alert_cb cb,
                             void* arg) {
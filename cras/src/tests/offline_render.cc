@@ -0,0 +1,269 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+extern "C" {
+#include "cras_iodev.h"
+#include "cras_messages.h"
+#include "cras_rstream.h"
+#include "cras_shm.h"
+#include "cras_util.h"
+#include "test_iodev.h"
+#include "utlist.h"
+}
+
+#include "offline_render.h"
+
+namespace {
+
+// The thread sleeps at most this long when nothing asks to be woken.
+const timespec kMaxSleep = {20, 0};
+// Moves the clock on when dev_io asks to run again at the same time.
+const timespec kMinSleep = {0, 1000000};
+const uint16_t kClientId = 1;
+
+timespec render_now = {100, 0};
+
+uint64_t host_time_ns() {
+  timespec ts;
+  // clock_gettime itself reads the virtual clock.
+  syscall(SYS_clock_gettime, CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void send_reply(int sock, enum CRAS_AUDIO_MESSAGE_ID id, unsigned int frames) {
+  audio_message msg;
+
+  memset(&msg, 0, sizeof(msg));
+  msg.id = id;
+  msg.frames = frames;
+  if (write(sock, &msg, sizeof(msg)) != sizeof(msg))
+    fprintf(stderr, "Failed to reply to the server: %d\n", errno);
+}
+
+}  // namespace
+
+extern "C" {
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  // The server runs on the raw clock, other clocks stay real for whatever
+  // times the render from the outside.
+  if (clk_id != CLOCK_MONOTONIC_RAW)
+    return syscall(SYS_clock_gettime, clk_id, tp);
+  *tp = render_now;
+  return 0;
+}
+}
+
+void offline_render_clock_set(const timespec* now) {
+  render_now = *now;
+}
+
+OfflineRender::OfflineRender(CRAS_STREAM_DIRECTION direction,
+                             const cras_audio_format& fmt,
+                             size_t cb_threshold,
+                             int dev_fd)
+    : direction_(direction),
+      cb_threshold_(cb_threshold),
+      odevs_(NULL),
+      idevs_(NULL) {
+  OpenDevice(fmt, dev_fd);
+}
+
+OfflineRender::~OfflineRender() {
+  struct open_dev** devs = direction_ == CRAS_STREAM_OUTPUT ? &odevs_ : &idevs_;
+  for (auto& client : clients_)
+    dev_io_remove_stream(devs, client.rstream, NULL);
+  while (*devs)
+    dev_io_rm_open_dev(devs, *devs);
+  for (cras_iodev* iodev : iodevs_) {
+    cras_iodev_close(iodev);
+    test_iodev_destroy(iodev);
+  }
+
+  for (auto& client : clients_) {
+    cras_audio_shm_destroy(client.shm);
+    close(client.sock);
+    cras_rstream_destroy(client.rstream);
+  }
+}
+
+int OfflineRender::OpenDevice(const cras_audio_format& fmt, int dev_fd) {
+  cras_iodev* iodev = test_iodev_create(direction_, TEST_IODEV_OFFLINE);
+  int rc;
+
+  if (!iodev)
+    return -ENOMEM;
+  // Streams on several devices track each one by index, as the device list
+  // would number them.
+  iodev->info.idx = MAX_SPECIAL_DEVICE_IDX + iodevs_.size();
+  test_iodev_set_fd(iodev, dev_fd);
+  rc = cras_iodev_open(iodev, cb_threshold_, &fmt);
+  if (rc) {
+    test_iodev_destroy(iodev);
+    return rc;
+  }
+
+  struct open_dev* adev =
+      reinterpret_cast<struct open_dev*>(calloc(1, sizeof(*adev)));
+  adev->dev = iodev;
+  if (direction_ == CRAS_STREAM_OUTPUT)
+    DL_APPEND(odevs_, adev);
+  else
+    DL_APPEND(idevs_, adev);
+  iodevs_.push_back(iodev);
+  return 0;
+}
+
+const cras_audio_format* OfflineRender::DevFormat() const {
+  return iodevs_[0]->format;
+}
+
+int OfflineRender::AddDevice(int dev_fd) {
+  return OpenDevice(*DevFormat(), dev_fd);
+}
+
+int OfflineRender::AddStream(const cras_audio_format& fmt,
+                             size_t cb_threshold,
+                             int fd) {
+  cras_rstream_config config = {};
+  cras_shm_info header_info, samples_info;
+  Client client = {};
+  int sock[2];
+  int rc;
+
+  if (socketpair(AF_UNIX, SOCK_STREAM, 0, sock))
+    return -errno;
+
+  config.stream_id = cras_get_stream_id(kClientId, clients_.size());
+  config.stream_type = CRAS_STREAM_TYPE_DEFAULT;
+  config.client_type = CRAS_CLIENT_TYPE_TEST;
+  config.direction = direction_;
+  config.dev_idx = NO_DEVICE;
+  config.format = &fmt;
+  config.buffer_frames = cb_threshold * 2;
+  config.cb_threshold = cb_threshold;
+  config.audio_fd = sock[1];
+  config.client_shm_fd = -1;
+  rc = cras_rstream_create(&config, &client.rstream);
+  if (rc) {
+    close(sock[0]);
+    close(sock[1]);
+    return rc;
+  }
+  client.sock = sock[0];
+  client.fd = fd;
+
+  // Map the stream shm the way a client does, writable for playback.
+  cras_audio_shm* shm = client.rstream->shm;
+  rc = cras_shm_info_init_with_fd(shm->header_info.fd, shm->header_info.length,
+                                  &header_info);
+  if (!rc)
+    rc = cras_shm_info_init_with_fd(shm->samples_info.fd,
+                                    shm->samples_info.length, &samples_info);
+  if (!rc)
+    rc = cras_audio_shm_create(
+        &header_info, &samples_info,
+        direction_ == CRAS_STREAM_OUTPUT ? PROT_WRITE : PROT_READ,
+        &client.shm);
+  if (rc) {
+    close(client.sock);
+    cras_rstream_destroy(client.rstream);
+    return rc;
+  }
+  cras_shm_copy_shared_config(client.shm);
+
+  rc = dev_io_append_stream(&odevs_, &idevs_, client.rstream, iodevs_.data(),
+                            iodevs_.size(), NULL, 0);
+  if (rc) {
+    cras_audio_shm_destroy(client.shm);
+    close(client.sock);
+    cras_rstream_destroy(client.rstream);
+    return rc;
+  }
+  clients_.push_back(client);
+  return 0;
+}
+
+void OfflineRender::Play(Client* client, unsigned int frames) {
+  uint8_t* buf = cras_shm_get_write_buffer_base(client->shm);
+  size_t bytes;
+  ssize_t nread;
+
+  frames = std::min(frames, (unsigned int)client->rstream->cb_threshold);
+  bytes = frames * cras_shm_frame_bytes(client->shm);
+  nread = read(client->fd, buf, bytes);
+  if (nread < 0)
+    nread = 0;
+  memset(buf + nread, 0, bytes - nread);
+  cras_shm_buffer_written_start(client->shm, frames);
+  send_reply(client->sock, AUDIO_MESSAGE_DATA_READY, frames);
+}
+
+void OfflineRender::Capture(Client* client, unsigned int frames) {
+  uint8_t* buf = cras_shm_get_read_buffer_base(client->shm);
+
+  frames = std::min(frames, (unsigned int)client->rstream->cb_threshold);
+  // Like libcras, skip a buffer the server overran.
+  if (cras_shm_get_curr_read_frames(client->shm) < frames)
+    return;
+  if (write(client->fd, buf, frames * cras_shm_frame_bytes(client->shm)) < 0)
+    fprintf(stderr, "Failed to write captured samples: %d\n", errno);
+  cras_shm_buffer_read_current(client->shm, frames);
+  send_reply(client->sock, AUDIO_MESSAGE_DATA_CAPTURED, frames);
+}
+
+bool OfflineRender::ServeClients() {
+  bool served = false;
+
+  for (auto& client : clients_) {
+    audio_message msg;
+
+    while (recv(client.sock, &msg, sizeof(msg), MSG_DONTWAIT) ==
+           sizeof(msg)) {
+      if (msg.id == AUDIO_MESSAGE_REQUEST_DATA)
+        Play(&client, msg.frames);
+      else if (msg.id == AUDIO_MESSAGE_DATA_READY)
+        Capture(&client, msg.frames);
+      served = true;
+    }
+  }
+  return served;
+}
+
+OfflineRenderStats OfflineRender::Run(const timespec& duration) {
+  OfflineRenderStats stats = {};
+  uint64_t real_start = host_time_ns();
+  timespec end = render_now;
+
+  add_timespecs(&end, &duration);
+  while (timespec_after(&end, &render_now)) {
+    dev_io_run(&odevs_, &idevs_, NULL);
+    stats.num_wakes++;
+    // Clients answer at once, their replies wake the thread right away.
+    if (ServeClients()) {
+      dev_io_run(&odevs_, &idevs_, NULL);
+      stats.num_wakes++;
+    }
+
+    timespec next = render_now;
+    add_timespecs(&next, &kMaxSleep);
+    dev_io_next_output_wake(&odevs_, &next);
+    dev_io_next_input_wake(&idevs_, &next);
+    if (!timespec_after(&next, &render_now)) {
+      next = render_now;
+      add_timespecs(&next, &kMinSleep);
+    }
+    render_now = timespec_after(&next, &end) ? end : next;
+  }
+  stats.real_ns = host_time_ns() - real_start;
+  return stats;
+}
@@ -0,0 +1,90 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// Offline rendering through the server's device I/O. An offline test iodev
+// plays to or captures from a file at its rate by a virtual clock, and each
+// stream has a client that reads or writes its own file over the audio
+// socket and shm, as libcras does. The clock jumps straight to every wake
+// dev_io asks for, so a render runs as fast as the host allows and the same
+// files always render to the same bytes. Mixing, format conversion,
+// resampling, volume and the capture path run the server's code.
+
+#ifndef OFFLINE_RENDER_H_
+#define OFFLINE_RENDER_H_
+
+#include <stdint.h>
+#include <time.h>
+
+#include <vector>
+
+extern "C" {
+#include "cras_types.h"
+#include "dev_io.h"
+}
+
+struct cras_audio_shm;
+struct cras_iodev;
+struct cras_rstream;
+
+struct OfflineRenderStats {
+  unsigned int num_wakes;  // Times dev_io ran.
+  uint64_t real_ns;        // Host time the render took.
+};
+
+class OfflineRender {
+ public:
+  // Opens an offline device asking for fmt, playing to or capturing from
+  // dev_fd. Check Ok() before use.
+  OfflineRender(CRAS_STREAM_DIRECTION direction,
+                const cras_audio_format& fmt,
+                size_t cb_threshold,
+                int dev_fd);
+  ~OfflineRender();
+
+  bool Ok() const { return !iodevs_.empty(); }
+
+  // The format the first device was opened with.
+  const cras_audio_format* DevFormat() const;
+
+  // Opens one more offline device like the first one, playing to or
+  // capturing from dev_fd. Streams added after it run on every device.
+  // Returns 0 on success or a negative error code.
+  int AddDevice(int dev_fd);
+
+  // Adds a stream whose client reads what it plays from fd, silence past the
+  // end of the file, or writes what it captures to fd.
+  // Returns 0 on success or a negative error code.
+  int AddStream(const cras_audio_format& fmt, size_t cb_threshold, int fd);
+
+  // Runs the device for duration of virtual time.
+  OfflineRenderStats Run(const timespec& duration);
+
+ private:
+  struct Client {
+    cras_rstream* rstream;
+    cras_audio_shm* shm;  // The client's own mapping of the stream shm.
+    int sock;             // The client end of the audio socket.
+    int fd;
+  };
+
+  // Answers the messages the server sent to clients, returns true if any.
+  bool ServeClients();
+  void Play(Client* client, unsigned int frames);
+  void Capture(Client* client, unsigned int frames);
+
+  // Opens an offline device and appends it to the open devices.
+  int OpenDevice(const cras_audio_format& fmt, int dev_fd);
+
+  CRAS_STREAM_DIRECTION direction_;
+  size_t cb_threshold_;
+  std::vector<cras_iodev*> iodevs_;
+  struct open_dev* odevs_;
+  struct open_dev* idevs_;
+  std::vector<Client> clients_;
+};
+
+// Sets the time returned by clock_gettime in a binary linking the render.
+void offline_render_clock_set(const timespec* now);
+
+#endif  // OFFLINE_RENDER_H_
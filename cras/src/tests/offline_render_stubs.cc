@@ -0,0 +1,362 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//
+// What the server code linked into an offline render calls outside of it:
+// no DSP, APM, metrics, shm pool or device list, and a device rate that
+// never drifts on the virtual clock.
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "audio_thread_log.h"
+#include "cras_dsp.h"
+#include "cras_main_thread_log.h"
+#include "cras_rstream.h"
+#include "cras_shm.h"
+
+struct audio_thread_event_log* atlog;
+struct main_thread_event_log* main_log;
+
+int cras_audio_thread_event_drop_samples() {
+  return 0;
+}
+
+int cras_audio_thread_event_severe_underrun() {
+  return 0;
+}
+
+int cras_audio_thread_event_underrun() {
+  return 0;
+}
+
+int cras_audio_thread_event_dev_overrun() {
+  return 0;
+}
+
+int cras_device_monitor_error_close(unsigned int dev_idx) {
+  return 0;
+}
+
+int cras_device_monitor_reset_device(unsigned int dev_idx) {
+  return 0;
+}
+
+int cras_device_monitor_set_device_mute_state(unsigned int dev_idx) {
+  return 0;
+}
+
+int cras_iodev_list_add_output(struct cras_iodev* output) {
+  return 0;
+}
+
+int cras_iodev_list_add_input(struct cras_iodev* input) {
+  return 0;
+}
+
+int cras_iodev_list_rm_output(struct cras_iodev* output) {
+  return 0;
+}
+
+int cras_iodev_list_rm_input(struct cras_iodev* input) {
+  return 0;
+}
+
+void cras_iodev_list_disable_dev(struct cras_iodev* dev, bool force_close) {}
+
+void cras_iodev_list_notify_active_node_changed(
+    enum CRAS_STREAM_DIRECTION direction) {}
+
+void cras_iodev_list_notify_nodes_changed() {}
+
+struct audio_thread* cras_iodev_list_get_audio_thread() {
+  return NULL;
+}
+
+void audio_thread_rm_callback(int fd) {}
+
+int audio_thread_rm_callback_sync(struct audio_thread* thread, int fd) {
+  return 0;
+}
+
+size_t cras_system_get_volume() {
+  return 100;
+}
+
+int cras_system_get_mute() {
+  return 0;
+}
+
+int cras_system_get_capture_mute() {
+  return 0;
+}
+
+bool cras_system_get_float_mix_bus_enabled() {
+  return false;
+}
+
+bool cras_system_get_dsp_offload_enabled() {
+  return false;
+}
+
+bool cras_system_get_native_rate_enabled() {
+  return false;
+}
+
+bool cras_system_get_noise_cancellation_enabled() {
+  return false;
+}
+
+void cras_system_state_stream_added(enum CRAS_STREAM_DIRECTION direction,
+                                    enum CRAS_CLIENT_TYPE client_type) {}
+
+void cras_system_state_stream_removed(enum CRAS_STREAM_DIRECTION direction,
+                                      enum CRAS_CLIENT_TYPE client_type) {}
+
+int cras_server_metrics_stream_create(
+    const struct cras_rstream_config* config) {
+  return 0;
+}
+
+int cras_server_metrics_stream_destroy(const struct cras_rstream* stream) {
+  return 0;
+}
+
+int cras_server_metrics_device_runtime(struct cras_iodev* iodev) {
+  return 0;
+}
+
+int cras_server_metrics_device_volume(struct cras_iodev* iodev) {
+  return 0;
+}
+
+int cras_server_metrics_highest_device_delay(
+    unsigned int hw_level,
+    unsigned int largest_cb_level,
+    enum CRAS_STREAM_DIRECTION direction) {
+  return 0;
+}
+
+int cras_server_metrics_highest_hw_level(unsigned hw_level,
+                                         enum CRAS_STREAM_DIRECTION direction) {
+  return 0;
+}
+
+int cras_server_metrics_missed_cb_event(struct cras_rstream* stream) {
+  return 0;
+}
+
+int cras_server_metrics_num_underruns(unsigned num_underruns) {
+  return 0;
+}
+
+int cras_non_empty_audio_send_msg(int non_empty) {
+  return 0;
+}
+
+int cras_stream_drain_send_msg(cras_stream_id_t stream_id) {
+  return 0;
+}
+
+struct cras_audio_shm* cras_shm_pool_get(uint16_t client_id,
+                                         size_t samples_size,
+                                         int samples_prot) {
+  return NULL;
+}
+
+void cras_shm_pool_put(uint16_t client_id,
+                       size_t samples_size,
+                       int samples_prot,
+                       struct cras_audio_shm* shm) {
+  cras_audio_shm_destroy(shm);
+}
+
+// No DSP pipeline is loaded, the device plays the mix as is.
+struct cras_dsp_context* cras_dsp_context_new(int sample_rate,
+                                              const char* purpose) {
+  return NULL;
+}
+
+void cras_dsp_context_free(struct cras_dsp_context* ctx) {}
+
+void cras_dsp_set_variable_string(struct cras_dsp_context* ctx,
+                                  const char* key,
+                                  const char* value) {}
+
+void cras_dsp_set_variable_boolean(struct cras_dsp_context* ctx,
+                                   const char* key,
+                                   char value) {}
+
+void cras_dsp_load_pipeline(struct cras_dsp_context* ctx) {}
+
+void cras_dsp_load_firmware(struct cras_dsp_context* ctx,
+                            cras_dsp_firmware_load_t load,
+                            void* arg) {}
+
+void cras_dsp_load_mock_pipeline(struct cras_dsp_context* ctx,
+                                 unsigned int num_channels) {}
+
+struct pipeline* cras_dsp_get_pipeline(struct cras_dsp_context* ctx) {
+  return NULL;
+}
+
+void cras_dsp_put_pipeline(struct cras_dsp_context* ctx) {}
+
+struct pipeline* cras_dsp_lock_pipeline(struct cras_dsp_context* ctx) {
+  return NULL;
+}
+
+void cras_dsp_unlock_pipeline(struct cras_dsp_context* ctx) {}
+
+void cras_dsp_pipeline_set_sink_ext_module(struct pipeline* pipeline,
+                                           struct ext_dsp_module* ext_module) {}
+
+int cras_dsp_pipeline_get_delay(struct pipeline* pipeline) {
+  return 0;
+}
+
+unsigned int cras_dsp_num_output_channels(const struct cras_dsp_context* ctx) {
+  return 0;
+}
+
+unsigned int cras_dsp_num_input_channels(const struct cras_dsp_context* ctx) {
+  return 0;
+}
+
+int cras_dsp_apply(struct cras_dsp_context* ctx,
+                   uint8_t* buf,
+                   snd_pcm_format_t format,
+                   unsigned int frames) {
+  return 0;
+}
+
+int cras_dsp_apply_planar(struct cras_dsp_context* ctx,
+                          float* const* planes,
+                          unsigned int num_planes,
+                          uint8_t* buf,
+                          snd_pcm_format_t format,
+                          unsigned int frames) {
+  return 0;
+}
+
+struct cras_dsp_offload* cras_dsp_offload_create(
+    struct cras_dsp_context* ctx,
+    const struct cras_audio_format* fmt,
+    unsigned int latency_frames,
+    unsigned int max_frames) {
+  return NULL;
+}
+
+void cras_dsp_offload_destroy(struct cras_dsp_offload* offload) {}
+
+int cras_dsp_offload_apply(struct cras_dsp_offload* offload,
+                           uint8_t* buf,
+                           unsigned int frames) {
+  return 0;
+}
+
+unsigned int cras_dsp_offload_get_latency(
+    const struct cras_dsp_offload* offload) {
+  return 0;
+}
+
+// The device keeps its nominal rate, as the virtual clock has no drift.
+struct rate_estimator {
+  unsigned int rate;
+};
+
+struct rate_estimator* rate_estimator_create(unsigned int rate,
+                                             const struct timespec* window_size,
+                                             double smooth_factor) {
+  struct rate_estimator* re =
+      static_cast<struct rate_estimator*>(calloc(1, sizeof(*re)));
+  re->rate = rate;
+  return re;
+}
+
+void rate_estimator_destroy(struct rate_estimator* re) {
+  free(re);
+}
+
+void rate_estimator_add_frames(struct rate_estimator* re, int fr) {}
+
+int rate_estimator_check(struct rate_estimator* re,
+                         int level,
+                         struct timespec* now) {
+  return 0;
+}
+
+void rate_estimator_reset_rate(struct rate_estimator* re, unsigned int rate) {
+  re->rate = rate;
+}
+
+double rate_estimator_get_rate(struct rate_estimator* re) {
+  return re->rate;
+}
+
+double rate_estimator_get_confidence(const struct rate_estimator* re) {
+  return 0.0;
+}
+
+void rate_estimator_set_outlier_rejection(struct rate_estimator* re,
+                                          int enable) {}
+
+int rate_estimator_check_batch(struct rate_estimator_sample* samples,
+                               unsigned int num) {
+  return 0;
+}
+
+// Nothing loops back from an offline render.
+void loopback_tap_mix_stream(unsigned int dev_idx,
+                             const struct cras_rstream* stream,
+                             const struct cras_audio_format* fmt,
+                             uint8_t* frames,
+                             unsigned int nframes,
+                             int mute,
+                             float mix_vol) {}
+
+bool loopback_tap_keeps_stream(unsigned int dev_idx,
+                               const struct cras_rstream* stream) {
+  return false;
+}
+
+#ifdef HAVE_WEBRTC_APM
+// Streams are rendered without APM.
+struct cras_apm_list* cras_apm_list_create(void* stream_ptr, uint64_t effects) {
+  return NULL;
+}
+struct cras_apm* cras_apm_list_get_active_apm(void* stream_ptr, void* dev_ptr) {
+  return NULL;
+}
+void cras_apm_list_start_apm(struct cras_apm_list* list, void* dev_ptr) {}
+void cras_apm_list_stop_apm(struct cras_apm_list* list, void* dev_ptr) {}
+uint64_t cras_apm_list_get_effects(struct cras_apm_list* list) {
+  return 0;
+}
+int cras_apm_list_destroy(struct cras_apm_list* list) {
+  return 0;
+}
+void cras_apm_list_remove_apm(struct cras_apm_list* list, void* dev_ptr) {}
+int cras_apm_list_process(struct cras_apm* apm,
+                          struct float_buffer* input,
+                          unsigned int offset) {
+  return 0;
+}
+struct cras_audio_area* cras_apm_list_get_processed(struct cras_apm* apm) {
+  return NULL;
+}
+void cras_apm_list_put_processed(struct cras_apm* apm, unsigned int frames) {}
+struct cras_audio_format* cras_apm_list_get_format(struct cras_apm* apm) {
+  return NULL;
+}
+unsigned int cras_apm_list_get_delay(struct cras_apm* apm) {
+  return 0;
+}
+bool cras_apm_list_get_use_tuned_settings(struct cras_apm* apm) {
+  return false;
+}
+#endif  // HAVE_WEBRTC_APM
+
+}  // extern "C"
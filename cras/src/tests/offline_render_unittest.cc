@@ -0,0 +1,191 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include "audio_thread_log.h"
+#include "cras_main_thread_log.h"
+#include "cras_iodev.h"
+#include "cras_rstream.h"
+#include "cras_rstream_config.h"
+#include "dev_stream.h"
+#include "input_data.h"
+}
+
+#include "offline_render.h"
+
+namespace {
+
+class OfflineRenderSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    atlog = static_cast<audio_thread_event_log*>(calloc(1, sizeof(*atlog)));
+    atlog->len = AUDIO_THREAD_EVENT_LOG_SIZE;
+    main_log = main_thread_event_log_init();
+    timespec start = {100, 0};
+    offline_render_clock_set(&start);
+  }
+
+  virtual void TearDown() {
+    for (FILE* f : files_)
+      fclose(f);
+    main_thread_event_log_deinit(main_log);
+    free(atlog);
+  }
+
+  cras_audio_format Format(size_t rate, size_t num_channels) {
+    cras_audio_format fmt = {};
+    fmt.format = SND_PCM_FORMAT_S16_LE;
+    fmt.frame_rate = rate;
+    fmt.num_channels = num_channels;
+    for (size_t i = 0; i < CRAS_CH_MAX; i++)
+      fmt.channel_layout[i] = i < num_channels ? i : -1;
+    return fmt;
+  }
+
+  // Returns a temporary file holding samples, read from the start.
+  int SampleFile(const std::vector<int16_t>& samples) {
+    FILE* f = tmpfile();
+    files_.push_back(f);
+    fwrite(samples.data(), sizeof(samples[0]), samples.size(), f);
+    fflush(f);
+    rewind(f);
+    return fileno(f);
+  }
+
+  std::vector<int16_t> ReadSamples(int fd) {
+    std::vector<int16_t> samples;
+    int16_t s;
+    lseek(fd, 0, SEEK_SET);
+    while (read(fd, &s, sizeof(s)) == sizeof(s))
+      samples.push_back(s);
+    return samples;
+  }
+
+  // A pattern with no zero sample.
+  std::vector<int16_t> Pattern(size_t num_samples) {
+    std::vector<int16_t> samples(num_samples);
+    for (size_t i = 0; i < num_samples; i++)
+      samples[i] = (i % 2000) + 1;
+    return samples;
+  }
+
+  std::vector<FILE*> files_;
+};
+
+TEST_F(OfflineRenderSuite, PlaybackIsBitExact) {
+  cras_audio_format fmt = Format(48000, 2);
+  std::vector<int16_t> in = Pattern(48000 * 2);
+  int out_fd = SampleFile({});
+
+  {
+    OfflineRender render(CRAS_STREAM_OUTPUT, fmt, 480, out_fd);
+    ASSERT_TRUE(render.Ok());
+    EXPECT_EQ(48000, render.DevFormat()->frame_rate);
+    ASSERT_EQ(0, render.AddStream(fmt, 480, SampleFile(in)));
+    render.Run({2, 0});
+  }
+
+  // The device starts with some silence, then plays the stream unchanged.
+  std::vector<int16_t> out = ReadSamples(out_fd);
+  auto first = std::find_if(out.begin(), out.end(),
+                            [](int16_t s) { return s != 0; });
+  ASSERT_NE(out.end(), first);
+  ASSERT_GE(out.end() - first, (long)in.size());
+  EXPECT_TRUE(std::equal(in.begin(), in.end(), first));
+}
+
+TEST_F(OfflineRenderSuite, MixAndResampleIsDeterministic) {
+  cras_audio_format fmt = Format(48000, 2);
+  cras_audio_format fmt_44k = Format(44100, 1);
+  std::vector<int16_t> a = Pattern(48000 * 2);
+  std::vector<int16_t> b = Pattern(44100);
+  std::vector<std::vector<int16_t>> outs;
+
+  for (int i = 0; i < 2; i++) {
+    int out_fd = SampleFile({});
+    {
+      timespec start = {100, 0};
+      offline_render_clock_set(&start);
+      OfflineRender render(CRAS_STREAM_OUTPUT, fmt, 480, out_fd);
+      ASSERT_TRUE(render.Ok());
+      ASSERT_EQ(0, render.AddStream(fmt, 480, SampleFile(a)));
+      ASSERT_EQ(0, render.AddStream(fmt_44k, 441, SampleFile(b)));
+      render.Run({1, 500000000});
+    }
+    outs.push_back(ReadSamples(out_fd));
+  }
+
+  EXPECT_GT(outs[0].size(), 48000);
+  EXPECT_EQ(outs[0], outs[1]);
+}
+
+TEST_F(OfflineRenderSuite, CaptureIsBitExact) {
+  cras_audio_format fmt = Format(48000, 2);
+  std::vector<int16_t> in = Pattern(48000 * 2);
+  int out_fd = SampleFile({});
+
+  {
+    OfflineRender render(CRAS_STREAM_INPUT, fmt, 480, SampleFile(in));
+    ASSERT_TRUE(render.Ok());
+    ASSERT_EQ(0, render.AddStream(fmt, 480, out_fd));
+    render.Run({1, 0});
+  }
+
+  // The stream gets a continuous part of what the device captured.
+  std::vector<int16_t> out = ReadSamples(out_fd);
+  ASSERT_GT(out.size(), 48000);
+  auto start = std::search(in.begin(), in.end(), out.begin(), out.end());
+  EXPECT_NE(in.end(), start);
+}
+
+TEST_F(OfflineRenderSuite, StreamPlaysOnEveryDevice) {
+  cras_audio_format fmt = Format(48000, 2);
+  std::vector<int16_t> in = Pattern(48000 * 2);
+  int out_a = SampleFile({}), out_b = SampleFile({});
+
+  {
+    OfflineRender render(CRAS_STREAM_OUTPUT, fmt, 480, out_a);
+    ASSERT_TRUE(render.Ok());
+    ASSERT_EQ(0, render.AddDevice(out_b));
+    ASSERT_EQ(0, render.AddStream(fmt, 480, SampleFile(in)));
+    render.Run({2, 0});
+  }
+
+  // Each device plays the whole stream after its own lead in of silence.
+  for (int fd : {out_a, out_b}) {
+    std::vector<int16_t> out = ReadSamples(fd);
+    auto first = std::find_if(out.begin(), out.end(),
+                              [](int16_t s) { return s != 0; });
+    ASSERT_NE(out.end(), first);
+    ASSERT_GE(out.end() - first, (long)in.size());
+    EXPECT_TRUE(std::equal(in.begin(), in.end(), first));
+  }
+}
+
+TEST_F(OfflineRenderSuite, FasterThanRealTime) {
+  cras_audio_format fmt = Format(48000, 2);
+  OfflineRender render(CRAS_STREAM_OUTPUT, fmt, 480, -1);
+
+  ASSERT_TRUE(render.Ok());
+  for (int i = 0; i < 4; i++)
+    ASSERT_EQ(0, render.AddStream(fmt, 480, -1));
+  OfflineRenderStats stats = render.Run({10, 0});
+
+  EXPECT_GT(stats.num_wakes, 1000);
+  EXPECT_LT(stats.real_ns, 10000000000ULL);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
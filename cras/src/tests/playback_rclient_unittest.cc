@@ -23,6 +23,7 @@ static unsigned int cras_make_fd_nonblocking_called;
 static unsigned int cras_observer_remove_called;
 static int stream_list_add_called;
 static int stream_list_add_return;
+static uint32_t stream_list_add_preroll_frames;
 static unsigned int stream_list_rm_called;
 static struct cras_audio_shm mock_shm;
 static struct cras_rstream mock_rstream;
@@ -33,6 +34,7 @@ void ResetStubData() {
   cras_observer_remove_called = 0;
   stream_list_add_called = 0;
   stream_list_add_return = 0;
+  stream_list_add_preroll_frames = 0;
   stream_list_rm_called = 0;
 }
 
@@ -122,6 +124,55 @@ TEST_F(CPRMessageSuite, StreamConnectMessage) {
   EXPECT_EQ(stream_id, out_msg.stream_id);
 }
 
+TEST_F(CPRMessageSuite, StreamConnectMessageWithPreroll) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  struct cras_connect_message msg;
+  cras_stream_id_t stream_id = 0x10002;
+  cras_fill_connect_message(&msg, CRAS_STREAM_OUTPUT, stream_id,
+                            CRAS_STREAM_TYPE_DEFAULT, CRAS_CLIENT_TYPE_UNKNOWN,
+                            480, 240, /*flags=*/FAST_START, /*effects=*/0, fmt,
+                            NO_DEVICE);
+  msg.preroll_frames = 200;
+
+  fd_ = 100;
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, &fd_, 1);
+  EXPECT_EQ(1, stream_list_add_called);
+  EXPECT_EQ(200, stream_list_add_preroll_frames);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(0, out_msg.err);
+}
+
+// Clients built before preroll_frames was added send shorter messages.
+TEST_F(CPRMessageSuite, StreamConnectMessageWithoutPreroll) {
+  struct cras_client_stream_connected out_msg;
+  int rc;
+
+  struct cras_connect_message msg;
+  cras_stream_id_t stream_id = 0x10002;
+  cras_fill_connect_message(&msg, CRAS_STREAM_OUTPUT, stream_id,
+                            CRAS_STREAM_TYPE_DEFAULT, CRAS_CLIENT_TYPE_UNKNOWN,
+                            480, 240, /*flags=*/0, /*effects=*/0, fmt,
+                            NO_DEVICE);
+  msg.header.length = CRAS_CONNECT_MESSAGE_MIN_LEN;
+  // Past the end of the message, must not be read.
+  msg.preroll_frames = 200;
+
+  fd_ = 100;
+  rclient_->ops->handle_message_from_client(rclient_, &msg.header, &fd_, 1);
+  EXPECT_EQ(1, cras_make_fd_nonblocking_called);
+  EXPECT_EQ(1, stream_list_add_called);
+  EXPECT_EQ(0, stream_list_add_preroll_frames);
+
+  rc = read(pipe_fds_[0], &out_msg, sizeof(out_msg));
+  EXPECT_EQ(sizeof(out_msg), rc);
+  EXPECT_EQ(0, out_msg.err);
+  EXPECT_EQ(stream_id, out_msg.stream_id);
+}
+
 TEST_F(CPRMessageSuite, StreamConnectMessageInvalidDirection) {
   struct cras_client_stream_connected out_msg;
   int rc;
@@ -261,6 +312,15 @@ int cras_send_with_fds(int sockfd,
   return write(sockfd, buf, len);
 }
 
+int cras_send_batch(int sockfd,
+                    const void* const* bufs,
+                    const size_t* lens,
+                    unsigned int num_msgs) {
+  for (unsigned int i = 0; i < num_msgs; i++)
+    write(sockfd, bufs[i], lens[i]);
+  return num_msgs;
+}
+
 key_t cras_sys_state_shm_fd() {
   return 1;
 }
@@ -272,6 +332,11 @@ int stream_list_rm_all_client_streams(struct stream_list* list,
   return 0;
 }
 
+struct cras_rstream* stream_list_find(struct stream_list* list,
+                                      cras_stream_id_t id) {
+  return NULL;
+}
+
 int stream_list_rm(struct stream_list* list, cras_stream_id_t id) {
   stream_list_rm_called++;
   return 0;
@@ -285,6 +350,7 @@ int stream_list_add(struct stream_list* list,
   *stream = &mock_rstream;
 
   stream_list_add_called++;
+  stream_list_add_preroll_frames = config->preroll_frames;
   ret = stream_list_add_return;
   if (ret)
     stream_list_add_return = -EINVAL;
@@ -0,0 +1,179 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <math.h>
+#include <stdint.h>
+
+#include <algorithm>
+#include <vector>
+
+extern "C" {
+#include "polyphase_resampler.h"
+}
+
+namespace {
+
+static const unsigned int kChannels = 2;
+
+static void FillSine(std::vector<int16_t>* buf,
+                     unsigned int frames,
+                     double freq,
+                     unsigned int rate) {
+  buf->resize(frames * kChannels);
+  for (unsigned int i = 0; i < frames; i++) {
+    int16_t s = 16384 * sin(2 * M_PI * freq * i / rate);
+    (*buf)[i * kChannels] = s;
+    (*buf)[i * kChannels + 1] = -s;
+  }
+}
+
+// Returns the rms of channel ch, skipping the filter's warm up.
+static double Rms(const int16_t* buf, unsigned int frames, unsigned int ch) {
+  double sum = 0;
+  for (unsigned int i = 100; i < frames; i++)
+    sum += (double)buf[i * kChannels + ch] * buf[i * kChannels + ch];
+  return sqrt(sum / (frames - 100));
+}
+
+TEST(PolyphaseResampler, CreateRejectsUnsupportedRates) {
+  EXPECT_EQ((void*)NULL, polyphase_resampler_create(2, 44100, 48001,
+                                                    POLYPHASE_QUALITY_LOW));
+  EXPECT_EQ((void*)NULL,
+            polyphase_resampler_create(0, 44100, 48000, POLYPHASE_QUALITY_LOW));
+  struct polyphase_resampler* pr =
+      polyphase_resampler_create(2, 44100, 48000, POLYPHASE_QUALITY_HIGH);
+  ASSERT_NE((void*)NULL, pr);
+  EXPECT_EQ(32, polyphase_resampler_latency(pr));
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, FrameCountsFollowRatio) {
+  const unsigned int in_frames = 4410;
+  std::vector<int16_t> in, out(6000 * kChannels);
+  FillSine(&in, in_frames, 1000, 44100);
+
+  for (int q = POLYPHASE_QUALITY_LOW; q <= POLYPHASE_QUALITY_HIGH; q++) {
+    struct polyphase_resampler* pr = polyphase_resampler_create(
+        kChannels, 44100, 48000, (enum POLYPHASE_QUALITY)q);
+    ASSERT_NE((void*)NULL, pr);
+    unsigned int count = in_frames;
+    unsigned int produced = polyphase_resampler_process_s16(
+        pr, in.data(), &count, out.data(), 6000);
+    EXPECT_EQ(in_frames, count);
+    EXPECT_NEAR(4800, produced, 2);
+    polyphase_resampler_destroy(pr);
+  }
+}
+
+TEST(PolyphaseResampler, LimitedOutputConsumesLimitedInput) {
+  std::vector<int16_t> in, out(480 * kChannels);
+  FillSine(&in, 4410, 1000, 44100);
+  struct polyphase_resampler* pr =
+      polyphase_resampler_create(kChannels, 44100, 48000,
+                                 POLYPHASE_QUALITY_MEDIUM);
+  unsigned int count = 4410;
+  unsigned int produced =
+      polyphase_resampler_process_s16(pr, in.data(), &count, out.data(), 480);
+  EXPECT_EQ(480, produced);
+  // 480 frames at 48k need about 441 frames at 44.1k.
+  EXPECT_LE(count, 441 + 2);
+  EXPECT_GE(count, 441 - 2);
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, ChunkedMatchesOneShot) {
+  const unsigned int in_frames = 2000;
+  std::vector<int16_t> in, whole(4000 * kChannels), chunked(4000 * kChannels);
+  FillSine(&in, in_frames, 440, 32000);
+
+  struct polyphase_resampler* pr =
+      polyphase_resampler_create(kChannels, 32000, 48000,
+                                 POLYPHASE_QUALITY_HIGH);
+  unsigned int count = in_frames;
+  unsigned int total =
+      polyphase_resampler_process_s16(pr, in.data(), &count, whole.data(),
+                                      4000);
+  polyphase_resampler_reset(pr);
+
+  unsigned int in_off = 0, out_off = 0;
+  while (in_off < in_frames) {
+    count = std::min(97u, in_frames - in_off);
+    out_off += polyphase_resampler_process_s16(
+        pr, &in[in_off * kChannels], &count, &chunked[out_off * kChannels], 61);
+    in_off += count;
+  }
+  // Drain output that is still computable from buffered input.
+  count = 0;
+  out_off += polyphase_resampler_process_s16(
+      pr, NULL, &count, &chunked[out_off * kChannels], 4000 - out_off);
+
+  ASSERT_EQ(total, out_off);
+  for (unsigned int i = 0; i < total * kChannels; i++)
+    ASSERT_EQ(whole[i], chunked[i]) << "sample " << i;
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, PassbandKeepsLevelStopbandRejects) {
+  std::vector<int16_t> in, out(10000 * kChannels);
+  struct polyphase_resampler* pr;
+  unsigned int count, produced;
+
+  // 1kHz is well inside the passband of 48k to 44.1k.
+  FillSine(&in, 9600, 1000, 48000);
+  pr = polyphase_resampler_create(kChannels, 48000, 44100,
+                                  POLYPHASE_QUALITY_HIGH);
+  count = 9600;
+  produced = polyphase_resampler_process_s16(pr, in.data(), &count,
+                                             out.data(), 10000);
+  EXPECT_NEAR(16384 / sqrt(2), Rms(out.data(), produced, 0), 200);
+  EXPECT_NEAR(16384 / sqrt(2), Rms(out.data(), produced, 1), 200);
+  polyphase_resampler_destroy(pr);
+
+  // 23kHz can't be represented at 44.1k and must be filtered out.
+  FillSine(&in, 9600, 23000, 48000);
+  pr = polyphase_resampler_create(kChannels, 48000, 44100,
+                                  POLYPHASE_QUALITY_HIGH);
+  count = 9600;
+  produced = polyphase_resampler_process_s16(pr, in.data(), &count,
+                                             out.data(), 10000);
+  EXPECT_GT(100, Rms(out.data(), produced, 0));
+  polyphase_resampler_destroy(pr);
+}
+
+TEST(PolyphaseResampler, FloatAndS32Paths) {
+  const unsigned int in_frames = 1000;
+  std::vector<float> fin(in_frames * kChannels), fout(3000 * kChannels);
+  std::vector<int32_t> iin(in_frames * kChannels), iout(3000 * kChannels);
+  for (unsigned int i = 0; i < in_frames * kChannels; i++) {
+    fin[i] = 0.5f;
+    iin[i] = INT32_MAX;
+  }
+
+  struct polyphase_resampler* pr =
+      polyphase_resampler_create(kChannels, 16000, 48000,
+                                 POLYPHASE_QUALITY_MEDIUM);
+  unsigned int count = in_frames;
+  unsigned int produced = polyphase_resampler_process_float(
+      pr, fin.data(), &count, fout.data(), 3000);
+  EXPECT_NEAR(3000, produced, 3);
+  // DC passes with unity gain once the filter has warmed up.
+  EXPECT_NEAR(0.5f, fout[1000 * kChannels], 0.01f);
+
+  polyphase_resampler_reset(pr);
+  count = in_frames;
+  produced = polyphase_resampler_process_s32(pr, iin.data(), &count,
+                                             iout.data(), 3000);
+  // Full scale must clip rather than wrap around through the filter overshoot.
+  for (unsigned int i = 1000 * kChannels; i < produced * kChannels; i++)
+    ASSERT_GT(iout[i], INT32_MAX / 2);
+  polyphase_resampler_destroy(pr);
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
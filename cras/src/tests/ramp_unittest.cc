@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <math.h>
 #include <stdio.h>
 
 extern "C" {
@@ -402,42 +403,90 @@ TEST(RampTestSuite, PartialRamp) {
   int ramped_frames = 600;
   struct cras_ramp* ramp;
   struct cras_ramp_action action;
-  float down_increment = (to_one - from_one) / duration_frames;
-  float up_increment;
+  float down_ratio = powf(to_one / from_one, 1.0f / duration_frames);
+  float up_ratio;
   float scaler;
 
   ResetStubData();
 
   ramp = cras_ramp_create();
-  // Ramp down.
+  // Ramp down, by the same number of dB every frame.
   cras_volume_ramp_start(ramp, from_one, to_one, duration_frames, NULL, NULL);
 
   rc = cras_ramp_update_ramped_frames(ramp, ramped_frames);
 
-  scaler = from_one + ramped_frames * down_increment;
+  // Half way in dB.
+  scaler = sqrtf(from_one * to_one);
   action = cras_ramp_get_current_action(ramp);
   EXPECT_EQ(0, rc);
   EXPECT_EQ(CRAS_RAMP_ACTION_PARTIAL, action.type);
-  EXPECT_FLOAT_EQ(scaler, action.scaler);
-  EXPECT_FLOAT_EQ(down_increment, action.increment);
+  EXPECT_NEAR(scaler, action.scaler, 1e-4);
+  EXPECT_FLOAT_EQ(0.0, action.increment);
+  EXPECT_FLOAT_EQ(down_ratio, action.ratio);
   EXPECT_FLOAT_EQ(to_one, action.target);
 
   // Ramp up starting from current scaler.
   cras_volume_ramp_start(ramp, from_two, to_two, duration_frames, NULL, NULL);
 
   // we start by multiplying by previous scaler
-  scaler = scaler * from_two;
+  scaler = action.scaler * from_two;
   action = cras_ramp_get_current_action(ramp);
-  up_increment = (to_two - scaler) / duration_frames;
-  EXPECT_EQ(0, rc);
+  up_ratio = powf(to_two / scaler, 1.0f / duration_frames);
   EXPECT_EQ(CRAS_RAMP_ACTION_PARTIAL, action.type);
   EXPECT_FLOAT_EQ(scaler, action.scaler);
-  EXPECT_FLOAT_EQ(up_increment, action.increment);
+  EXPECT_FLOAT_EQ(0.0, action.increment);
+  EXPECT_FLOAT_EQ(up_ratio, action.ratio);
   EXPECT_FLOAT_EQ(to_two, action.target);
 
   cras_ramp_destroy(ramp);
 }
 
+TEST(RampTestSuite, LinearGains) {
+  struct cras_ramp_action action = {
+      .type = CRAS_RAMP_ACTION_PARTIAL,
+      .scaler = 0.5,
+      .increment = -0.1,
+      .ratio = 1.0,
+      .target = 0.2,
+  };
+  float gains[4];
+
+  // Starts two frames in, the last frame stops at the target.
+  cras_ramp_action_gains(&action, 2, 0.5, gains, 4);
+  EXPECT_FLOAT_EQ(0.15, gains[0]);
+  EXPECT_FLOAT_EQ(0.1, gains[1]);
+  EXPECT_FLOAT_EQ(0.1, gains[2]);
+  EXPECT_FLOAT_EQ(0.1, gains[3]);
+}
+
+TEST(RampTestSuite, VolumeRampGains) {
+  int duration_frames = 480;
+  struct cras_ramp* ramp;
+  struct cras_ramp_action action;
+  float gains[500];
+
+  ResetStubData();
+
+  ramp = cras_ramp_create();
+  cras_volume_ramp_start(ramp, 0.01, 1.0, duration_frames, NULL, NULL);
+  action = cras_ramp_get_current_action(ramp);
+  cras_ramp_action_gains(&action, 0, 1.0, gains, 100);
+  cras_ramp_action_gains(&action, 100, 1.0, gains + 100, 400);
+
+  // 40dB in 480 frames, each one 1/12 dB louder than the one before.
+  EXPECT_FLOAT_EQ(0.01, gains[0]);
+  for (int i = 1; i < duration_frames; i++)
+    EXPECT_NEAR(powf(10, 1.0f / 240), gains[i] / gains[i - 1], 1e-5);
+  EXPECT_NEAR(0.1, gains[240], 1e-5);
+  // Stops at the target.
+  for (int i = duration_frames; i < 500; i++) {
+    EXPECT_NEAR(1.0, gains[i], 1e-3);
+    EXPECT_LE(gains[i], 1.0);
+  }
+
+  cras_ramp_destroy(ramp);
+}
+
 void ramp_callback(void* arg) {
   callback_called++;
   callback_arg = arg;
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <math.h>
 
 extern "C" {
 #include "rate_estimator.h"
@@ -176,6 +177,165 @@ TEST(RateEstimatorTest, EstimateInputLinear2) {
   rate_estimator_destroy(re);
 }
 
+TEST(RateEstimatorTest, StaleTimestampIgnored) {
+  struct rate_estimator* re;
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+  int i, rc, level = 1000;
+
+  re = rate_estimator_create(10000, &window, 0.0f);
+  for (i = 0; i < 10; i++) {
+    rc = rate_estimator_check(re, level, &t);
+    EXPECT_EQ(0, rc);
+
+    /* Device consumes 10 frames in each ms. Later in the window the
+     * level is read again before the hardware timestamp moves on, those
+     * samples must not count. */
+    level -= 1;
+    if (i >= 5) {
+      rc = rate_estimator_check(re, level, &t);
+      EXPECT_EQ(0, rc);
+    }
+    level -= 9;
+    t.tv_nsec += 1000000;
+  }
+  t.tv_nsec += 1;
+  rc = rate_estimator_check(re, level, &t);
+  EXPECT_EQ(1, rc);
+  EXPECT_GT(10001, rate_estimator_get_rate(re));
+  EXPECT_LT(9999, rate_estimator_get_rate(re));
+
+  rate_estimator_destroy(re);
+}
+
+TEST(RateEstimatorTest, OutlierRejected) {
+  struct rate_estimator* re[2];
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+  struct timespec late;
+  static struct timespec this_window = {.tv_sec = 0, .tv_nsec = 50000000};
+  int i, k, rc, level = 4000;
+
+  re[0] = rate_estimator_create(48000, &this_window, 0.0f);
+  re[1] = rate_estimator_create(48000, &this_window, 0.0f);
+  rate_estimator_set_outlier_rejection(re[1], 1);
+  for (i = 0; i < 50; i++) {
+    /* Device consumes 48 frames in each ms. One level is stamped well
+     * after it was read, as when the audio thread is preempted between
+     * the two. */
+    late = t;
+    if (i == 45)
+      late.tv_nsec += 200000;
+    for (k = 0; k < 2; k++) {
+      rc = rate_estimator_check(re[k], level, &late);
+      EXPECT_EQ(0, rc);
+    }
+    level -= 48;
+    t.tv_nsec += 1000000;
+  }
+  t.tv_nsec += 1;
+  for (k = 0; k < 2; k++) {
+    rc = rate_estimator_check(re[k], level, &t);
+    EXPECT_EQ(1, rc);
+  }
+  EXPECT_LT(1, fabs(48000 - rate_estimator_get_rate(re[0])));
+  EXPECT_GT(48001, rate_estimator_get_rate(re[1]));
+  EXPECT_LT(47999, rate_estimator_get_rate(re[1]));
+  /* The outlier costs the robust estimator some confidence. */
+  EXPECT_GT(1, rate_estimator_get_confidence(re[1]));
+  EXPECT_LT(0.8, rate_estimator_get_confidence(re[1]));
+
+  rate_estimator_destroy(re[0]);
+  rate_estimator_destroy(re[1]);
+}
+
+TEST(RateEstimatorTest, Confidence) {
+  struct rate_estimator* re;
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+  int i, rc, level = 1000;
+
+  re = rate_estimator_create(10000, &window, 0.0f);
+  EXPECT_EQ(0, rate_estimator_get_confidence(re));
+  for (i = 0; i < 10; i++) {
+    rc = rate_estimator_check(re, level, &t);
+    EXPECT_EQ(0, rc);
+    level -= 10;
+    t.tv_nsec += 1000000;
+  }
+  t.tv_nsec += 1;
+  rc = rate_estimator_check(re, level, &t);
+  EXPECT_EQ(1, rc);
+  EXPECT_LT(0.99, rate_estimator_get_confidence(re));
+
+  rate_estimator_reset_rate(re, 10000);
+  EXPECT_EQ(0, rate_estimator_get_confidence(re));
+
+  rate_estimator_destroy(re);
+}
+
+TEST(RateEstimatorTest, LongWindow) {
+  struct rate_estimator* re;
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+  static struct timespec long_window = {.tv_sec = 1, .tv_nsec = 0};
+  int i, rc, level = 1000;
+
+  /* A thousand samples, more than a window keeps. */
+  re = rate_estimator_create(48000, &long_window, 0.0f);
+  rate_estimator_set_outlier_rejection(re, 1);
+  for (i = 0; i <= 1000; i++) {
+    rc = rate_estimator_check(re, level, &t);
+    EXPECT_EQ(0, rc);
+    rate_estimator_add_frames(re, 48);
+    t.tv_nsec += 1000000;
+    if (t.tv_nsec >= 1000000000) {
+      t.tv_sec++;
+      t.tv_nsec -= 1000000000;
+    }
+  }
+  t.tv_nsec += 1;
+  rc = rate_estimator_check(re, level, &t);
+  EXPECT_EQ(1, rc);
+  EXPECT_GT(48001, rate_estimator_get_rate(re));
+  EXPECT_LT(47999, rate_estimator_get_rate(re));
+
+  rate_estimator_destroy(re);
+}
+
+TEST(RateEstimatorTest, CheckBatch) {
+  struct rate_estimator_sample samples[3];
+  struct timespec t = {.tv_sec = 1, .tv_nsec = 0};
+  int i, k, rc;
+
+  samples[0].re = rate_estimator_create(10000, &window, 0.0f);
+  samples[1].re = NULL;
+  samples[2].re = rate_estimator_create(20000, &window, 0.0f);
+  for (i = 0; i <= 10; i++) {
+    for (k = 0; k < 3; k++) {
+      samples[k].level = 1000 - i * 10 * (k + 1);
+      samples[k].now = t;
+    }
+    rc = rate_estimator_check_batch(samples, 3);
+    EXPECT_EQ(0, rc);
+    for (k = 0; k < 3; k++)
+      EXPECT_EQ(0, samples[k].updated);
+    t.tv_nsec += 1000000;
+  }
+  for (k = 0; k < 3; k++) {
+    samples[k].level -= 10 * (k + 1);
+    samples[k].now = t;
+  }
+  rc = rate_estimator_check_batch(samples, 3);
+  EXPECT_EQ(2, rc);
+  EXPECT_EQ(1, samples[0].updated);
+  EXPECT_EQ(0, samples[1].updated);
+  EXPECT_EQ(1, samples[2].updated);
+  EXPECT_GT(10001, rate_estimator_get_rate(samples[0].re));
+  EXPECT_LT(9999, rate_estimator_get_rate(samples[0].re));
+  EXPECT_GT(20001, rate_estimator_get_rate(samples[2].re));
+  EXPECT_LT(19999, rate_estimator_get_rate(samples[2].re));
+
+  rate_estimator_destroy(samples[0].re);
+  rate_estimator_destroy(samples[2].re);
+}
+
 int main(int argc, char** argv) {
   ::testing::InitGoogleTest(&argc, argv);
   return RUN_ALL_TESTS();
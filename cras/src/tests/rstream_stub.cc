@@ -52,6 +52,9 @@ extern "C" {
 void cras_rstream_record_fetch_interval(struct cras_rstream* rstream,
                                         const struct timespec* now) {}
 
+void cras_rstream_record_reply(struct cras_rstream* rstream,
+                               const struct timespec* now) {}
+
 void cras_rstream_dev_attach(struct cras_rstream* rstream,
                              unsigned int dev_id,
                              void* dev_ptr) {}
@@ -113,6 +116,10 @@ int cras_rstream_is_pending_reply(const struct cras_rstream* rstream) {
   return 0;
 }
 
+int cras_rstream_wake_for_reply(struct cras_rstream* rstream) {
+  return 0;
+}
+
 int cras_rstream_flush_old_audio_messages(struct cras_rstream* rstream) {
   return 0;
 }
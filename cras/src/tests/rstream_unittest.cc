@@ -12,7 +12,9 @@
 extern "C" {
 #include "cras_audio_area.h"
 #include "cras_messages.h"
+#include "cras_rclient.h"
 #include "cras_rstream.h"
+#include "cras_sample_cache.h"
 #include "cras_shm.h"
 }
 
@@ -41,6 +43,9 @@ class RstreamTestSuite : public testing::Test {
     config_.cb_threshold = 2048;
     config_.client_shm_size = 0;
     config_.client_shm_fd = -1;
+    config_.buffer_offsets[0] = 0;
+    config_.buffer_offsets[1] = 0;
+    config_.preroll_frames = 0;
 
     // Create a socket pair because it will be used in rstream.
     rc = socketpair(AF_UNIX, SOCK_STREAM, 0, sock);
@@ -49,6 +54,9 @@ class RstreamTestSuite : public testing::Test {
     client_fd_ = sock[0];
 
     config_.client = NULL;
+    config_.sample = NULL;
+    config_.monitor = NULL;
+    config_.is_monitor = 0;
   }
 
   virtual void TearDown() {
@@ -99,6 +107,20 @@ TEST_F(RstreamTestSuite, InvalidStreamType) {
   EXPECT_NE(0, rc);
 }
 
+TEST_F(RstreamTestSuite, InvalidPassthrough) {
+  struct cras_rstream* s;
+
+  config_.flags = PASSTHROUGH;
+  fmt_.format = SND_PCM_FORMAT_S32_LE;
+  EXPECT_NE(0, cras_rstream_create(&config_, &s));
+  fmt_.format = SND_PCM_FORMAT_S16_LE;
+  fmt_.num_channels = 6;
+  EXPECT_NE(0, cras_rstream_create(&config_, &s));
+  fmt_.num_channels = 2;
+  config_.direction = CRAS_STREAM_INPUT;
+  EXPECT_NE(0, cras_rstream_create(&config_, &s));
+}
+
 TEST_F(RstreamTestSuite, InvalidBufferSize) {
   struct cras_rstream* s;
   int rc;
@@ -117,6 +139,28 @@ TEST_F(RstreamTestSuite, InvalidCallbackThreshold) {
   EXPECT_NE(0, rc);
 }
 
+TEST_F(RstreamTestSuite, LowLatencyCallbackThreshold) {
+  struct cras_rstream* s;
+  int rc;
+
+  // Half a millisecond is below the normal minimum.
+  config_.buffer_frames = 48;
+  config_.cb_threshold = 24;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_NE(0, rc);
+
+  config_.flags = LOW_LATENCY;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(24, cras_rstream_get_cb_threshold(s));
+  cras_rstream_destroy(s);
+
+  // Still bounded at a quarter of a millisecond.
+  config_.cb_threshold = 12;
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_NE(0, rc);
+}
+
 TEST_F(RstreamTestSuite, InvalidStreamPointer) {
   int rc;
 
@@ -230,6 +274,26 @@ TEST_F(RstreamTestSuite, VerifyStreamTypes) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, DestroyAddsUsageToClient) {
+  struct cras_rstream* s;
+  struct cras_rclient client = {};
+  int rc;
+
+  config_.client = &client;
+  client.ended_usage.cpu_ns = 1000;
+  client.ended_usage.num_fetches = 1;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  s->cpu_ns = 2500;
+  s->num_fetches = 3;
+  s->num_missed_cb = 2;
+  cras_rstream_destroy(s);
+
+  EXPECT_EQ(3500, client.ended_usage.cpu_ns);
+  EXPECT_EQ(4, client.ended_usage.num_fetches);
+  EXPECT_EQ(2, client.ended_usage.num_missed_cb);
+}
+
 TEST_F(RstreamTestSuite, OutputStreamIsPendingReply) {
   struct cras_rstream* s;
   int rc;
@@ -344,6 +408,290 @@ TEST_F(RstreamTestSuite, InputStreamFlushMessages) {
   cras_rstream_destroy(s);
 }
 
+TEST_F(RstreamTestSuite, LateRepliesSetFetchLead) {
+  struct cras_rstream* s;
+  struct timespec ts = {1, 0}, reply;
+  int rc, i;
+
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  s->sleep_interval_ts.tv_sec = 0;
+  s->sleep_interval_ts.tv_nsec = 10000000;
+
+  // Replies within the callback period don't move the fetch.
+  for (i = 0; i < 16; i++) {
+    rc = cras_rstream_request_audio(s, &ts);
+    ASSERT_LT(0, rc);
+    cras_shm_set_callback_pending(cras_rstream_shm(s), 0);
+    reply = ts;
+    reply.tv_nsec += 9000000;
+    cras_rstream_record_reply(s, &reply);
+    ts.tv_sec++;
+  }
+  EXPECT_FALSE(timespec_is_nonzero(cras_rstream_fetch_lead(s)));
+
+  // Replies 2 ms late on one callback in ten move it 2 ms earlier.
+  for (i = 0; i < 16; i++) {
+    rc = cras_rstream_request_audio(s, &ts);
+    ASSERT_LT(0, rc);
+    cras_shm_set_callback_pending(cras_rstream_shm(s), 0);
+    reply = ts;
+    reply.tv_nsec += (i % 10) ? 9000000 : 12000000;
+    cras_rstream_record_reply(s, &reply);
+    ts.tv_sec++;
+  }
+  EXPECT_EQ(0, cras_rstream_fetch_lead(s)->tv_sec);
+  EXPECT_EQ(2000000, cras_rstream_fetch_lead(s)->tv_nsec);
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, SetCbThresholdWithinLimits) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.flags = ADAPTIVE_CB;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+
+  // 10 ms at 48 kHz, the sleep interval follows.
+  EXPECT_EQ(480, cras_rstream_set_cb_threshold(s, 480));
+  EXPECT_EQ(480, cras_rstream_get_cb_threshold(s));
+  EXPECT_EQ(0, s->sleep_interval_ts.tv_sec);
+  EXPECT_EQ(10000000, s->sleep_interval_ts.tv_nsec);
+
+  // Kept between just over 1 ms and the buffer size.
+  EXPECT_EQ(49, cras_rstream_set_cb_threshold(s, 10));
+  EXPECT_EQ(4096, cras_rstream_set_cb_threshold(s, 8192));
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, OutputStreamDoorbell) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  struct timespec ts;
+  int rc;
+
+  config_.flags = SHM_DOORBELL;
+
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  shm = cras_rstream_shm(s);
+  ASSERT_TRUE(cras_shm_doorbell(shm));
+
+  // The request is rung on the doorbell, nothing goes to the socket.
+  clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+  rc = cras_rstream_request_audio(s, &ts);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(1, cras_shm_wait_doorbell(shm, 0));
+  EXPECT_EQ(AUDIO_MESSAGE_REQUEST_DATA, shm->header->doorbell_id);
+  EXPECT_EQ(config_.cb_threshold, shm->header->doorbell_frames);
+  EXPECT_EQ(-1, recv(client_fd_, &rc, sizeof(rc), MSG_DONTWAIT));
+
+  // Before the next callback the reply is looked for in shm.
+  s->next_cb_ts = ts;
+  s->next_cb_ts.tv_sec += 1;
+  EXPECT_EQ(1, cras_rstream_wake_for_reply(s));
+
+  // Late, the client is asked to send the reply on the socket.
+  s->next_cb_ts = ts;
+  EXPECT_EQ(0, cras_rstream_wake_for_reply(s));
+  EXPECT_EQ(1, cras_shm_doorbell_reply(shm));
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+
+  // The next request clears the ask.
+  rc = cras_rstream_request_audio(s, &ts);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_shm_doorbell_reply(shm));
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, InputStreamDoorbell) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  int rc;
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.flags = SHM_DOORBELL;
+
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  shm = cras_rstream_shm(s);
+  ASSERT_TRUE(cras_shm_doorbell(shm));
+
+  rc = cras_rstream_audio_ready(s, 10);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(1, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(1, cras_shm_wait_doorbell(shm, 0));
+  EXPECT_EQ(AUDIO_MESSAGE_DATA_READY, shm->header->doorbell_id);
+  EXPECT_EQ(10, shm->header->doorbell_frames);
+
+  EXPECT_EQ(0, cras_shm_doorbell_reply(shm));
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, DoorbellNotForDevTiming) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.flags = SHM_DOORBELL | USE_DEV_TIMING;
+
+  rc = cras_rstream_create(&config_, &s);
+  EXPECT_EQ(0, rc);
+  EXPECT_FALSE(cras_shm_doorbell(cras_rstream_shm(s)));
+
+  // Falls back to the socket.
+  rc = cras_rstream_audio_ready(s, 10);
+  EXPECT_GT(rc, 0);
+
+  cras_rstream_destroy(s);
+}
+
+// Frames the client wrote to its shm before connecting are played first.
+TEST_F(RstreamTestSuite, OutputStreamPreroll) {
+  struct cras_rstream* s;
+  int fd, rc;
+
+  fd = memfd_create("rstream_unittest", 0);
+  ASSERT_LE(0, fd);
+  ASSERT_EQ(0, ftruncate(fd, 32768));
+  config_.client_shm_fd = fd;
+  config_.client_shm_size = 32768;
+  config_.buffer_offsets[1] = 16384;
+  config_.preroll_frames = 1000;
+
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(1000, cras_shm_get_frames(cras_rstream_shm(s)));
+  cras_rstream_destroy(s);
+
+  // No more than the first buffer holds.
+  config_.preroll_frames = 8192;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(4096, cras_shm_get_frames(cras_rstream_shm(s)));
+  cras_rstream_destroy(s);
+  close(fd);
+}
+
+TEST_F(RstreamTestSuite, PrerollNeedsClientShm) {
+  struct cras_rstream* s;
+  int rc;
+
+  config_.preroll_frames = 1000;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(0, cras_shm_get_frames(cras_rstream_shm(s)));
+  cras_rstream_destroy(s);
+}
+
+TEST_F(RstreamTestSuite, ServerStreamPlaysSample) {
+  struct cras_rstream* s;
+  struct cras_audio_shm* shm;
+  struct cras_sample* sample;
+  struct timespec now = {1, 0};
+  int16_t* samples;
+  int rc;
+
+  sample = (struct cras_sample*)calloc(1, sizeof(*sample));
+  sample->format = fmt_;
+  sample->frames = 3000;
+  sample->samples = (uint8_t*)malloc(sample->frames * 4);
+  samples = (int16_t*)sample->samples;
+  for (size_t i = 0; i < sample->frames * 2; i++)
+    samples[i] = i;
+  sample->refs = 1;
+
+  close(config_.audio_fd);
+  config_.audio_fd = -1;
+  config_.flags = SERVER_ONLY;
+  config_.sample = sample;
+  rc = cras_rstream_create(&config_, &s);
+  ASSERT_EQ(0, rc);
+  EXPECT_EQ(2, sample->refs);
+  shm = cras_rstream_shm(s);
+
+  // Fetches are filled from the sample right away, no reply is awaited.
+  rc = cras_rstream_request_audio(s, &now);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(s));
+  EXPECT_EQ(2048, cras_shm_get_frames(shm));
+  EXPECT_EQ(0, memcmp(cras_shm_get_read_buffer_base(shm), samples, 2048 * 4));
+  EXPECT_EQ(0, cras_rstream_get_is_draining(s));
+
+  // The last block drains the stream.
+  rc = cras_rstream_request_audio(s, &now);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(3000, cras_shm_get_frames(shm));
+  EXPECT_EQ(1, cras_rstream_get_is_draining(s));
+
+  cras_rstream_destroy(s);
+  EXPECT_EQ(1, sample->refs);
+  cras_sample_put(sample);
+}
+
+TEST_F(RstreamTestSuite, MonitorRouteWritesPlayback) {
+  struct cras_rstream *in, *out;
+  struct cras_audio_shm *in_shm, *out_shm;
+  struct timespec now = {1, 0};
+  int16_t* buf;
+  int rc;
+
+  close(config_.audio_fd);
+  config_.audio_fd = -1;
+  config_.flags = SERVER_ONLY;
+  config_.buffer_frames = 240;
+  config_.cb_threshold = 240;
+  config_.is_monitor = 1;
+  rc = cras_rstream_create(&config_, &out);
+  ASSERT_EQ(0, rc);
+  out_shm = cras_rstream_shm(out);
+
+  config_.stream_id = 556;
+  config_.direction = CRAS_STREAM_INPUT;
+  config_.is_monitor = 0;
+  config_.monitor = out;
+  rc = cras_rstream_create(&config_, &in);
+  ASSERT_EQ(0, rc);
+  in_shm = cras_rstream_shm(in);
+
+  // Captured frames are written to the playback stream as they are ready,
+  // and read from the capture stream.
+  buf = (int16_t*)cras_shm_get_write_buffer_base(in_shm);
+  for (int i = 0; i < 240 * 2; i++)
+    buf[i] = i;
+  cras_shm_buffer_written(in_shm, 240);
+  rc = cras_rstream_audio_ready(in, 240);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_shm_get_frames(in_shm));
+  EXPECT_EQ(240, cras_shm_get_frames(out_shm));
+  EXPECT_EQ(0, memcmp(cras_shm_get_read_buffer_base(out_shm), buf, 240 * 4));
+
+  // A fetch after a write asks no one and adds nothing.
+  rc = cras_rstream_request_audio(out, &now);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(0, cras_rstream_is_pending_reply(out));
+  EXPECT_EQ(240, cras_shm_get_frames(out_shm));
+
+  // Once played out, a fetch without a write since plays silence.
+  cras_shm_buffer_read(out_shm, 240);
+  rc = cras_rstream_request_audio(out, &now);
+  EXPECT_EQ(0, rc);
+  EXPECT_EQ(240, cras_shm_get_frames(out_shm));
+  buf = (int16_t*)cras_shm_get_read_buffer_base(out_shm);
+  for (int i = 0; i < 240 * 2; i++)
+    ASSERT_EQ(0, buf[i]);
+
+  cras_rstream_destroy(in);
+  cras_rstream_destroy(out);
+}
+
 }  //  namespace
 
 int main(int argc, char** argv) {
@@ -391,10 +739,15 @@ unsigned int buffer_share_id_offset(const struct buffer_share* mix,
                                     unsigned int id) {
   return 0;
 }
-void ewma_power_init(struct ewma_power* ewma, unsigned int rate) {}
+void ewma_power_init(struct ewma_power* ewma,
+                     snd_pcm_format_t format,
+                     unsigned int rate) {}
+
+void ewma_power_set_interval(struct ewma_power* ewma,
+                             unsigned int interval_ms) {}
 
 void ewma_power_calculate(struct ewma_power* ewma,
-                          const int16_t* buf,
+                          const void* buf,
                           unsigned int channels,
                           unsigned int size) {}
 
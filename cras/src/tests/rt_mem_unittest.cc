@@ -0,0 +1,100 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_rt_mem.h"
+}
+
+namespace {
+
+class RtMemTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    page_ = sysconf(_SC_PAGESIZE);
+    ASSERT_EQ(0, posix_memalign(&bufs_[0], page_, 3 * page_));
+    ASSERT_EQ(0, posix_memalign(&bufs_[1], page_, page_));
+  }
+
+  virtual void TearDown() {
+    cras_rt_mem_remove(bufs_[0]);
+    cras_rt_mem_remove(bufs_[1]);
+    cras_rt_mem_set_budget(0);
+    free(bufs_[0]);
+    free(bufs_[1]);
+  }
+
+  // Returns true if the test may lock pages pages.
+  bool CanLock(size_t pages) {
+    struct rlimit rl;
+
+    return getrlimit(RLIMIT_MEMLOCK, &rl) == 0 &&
+           rl.rlim_cur >= pages * page_;
+  }
+
+  size_t page_;
+  void* bufs_[2];
+  uint32_t locked_;
+  uint32_t unlocked_;
+};
+
+TEST_F(RtMemTestSuite, NoBudgetOnlyPrefaults) {
+  cras_rt_mem_add(bufs_[0], 3 * page_);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(0, locked_);
+  EXPECT_EQ(3 * page_, unlocked_);
+
+  cras_rt_mem_remove(bufs_[0]);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(0, unlocked_);
+}
+
+TEST_F(RtMemTestSuite, CountsWholePages) {
+  // One byte across a page boundary spans two pages.
+  cras_rt_mem_add((uint8_t*)bufs_[0] + page_ - 1, 2);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(2 * page_, unlocked_);
+  cras_rt_mem_remove((uint8_t*)bufs_[0] + page_ - 1);
+}
+
+TEST_F(RtMemTestSuite, LocksWithinBudget) {
+  if (!CanLock(3))
+    GTEST_SKIP() << "RLIMIT_MEMLOCK too low";
+
+  cras_rt_mem_set_budget(3 * page_);
+  cras_rt_mem_add(bufs_[1], page_);
+  cras_rt_mem_add(bufs_[0], 3 * page_);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(page_, locked_);
+  EXPECT_EQ(3 * page_, unlocked_);
+
+  // Freed budget is used by later regions only.
+  cras_rt_mem_remove(bufs_[1]);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(0, locked_);
+  EXPECT_EQ(3 * page_, unlocked_);
+  cras_rt_mem_remove(bufs_[0]);
+  cras_rt_mem_add(bufs_[0], 3 * page_);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(3 * page_, locked_);
+  EXPECT_EQ(0, unlocked_);
+}
+
+TEST_F(RtMemTestSuite, RemoveUnknownIgnored) {
+  cras_rt_mem_add(bufs_[1], page_);
+  cras_rt_mem_remove(bufs_[0]);
+  cras_rt_mem_get(&locked_, &unlocked_);
+  EXPECT_EQ(page_, unlocked_);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
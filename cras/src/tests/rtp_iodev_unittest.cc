@@ -0,0 +1,318 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <arpa/inet.h>
+#include <gtest/gtest.h>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_audio_area.h"
+#include "cras_iodev.h"
+#include "cras_rtp_iodev.h"
+#include "rtp.h"
+}
+
+static struct timespec clock_gettime_retspec;
+static struct cras_audio_format fake_format;
+static cras_audio_area mock_audio_area;
+static uint8_t* config_buf_pointers_base;
+static int cras_iodev_list_add_output_called;
+static int cras_iodev_list_add_input_called;
+
+namespace {
+
+static const unsigned int kPacketFrames = 240;
+
+class RtpIodevTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    struct sockaddr_in* in;
+    socklen_t len = sizeof(peer_addr_);
+
+    cras_iodev_list_add_output_called = 0;
+    cras_iodev_list_add_input_called = 0;
+    clock_gettime_retspec.tv_sec = 100;
+    clock_gettime_retspec.tv_nsec = 0;
+    fake_format.format = SND_PCM_FORMAT_S16_LE;
+    fake_format.frame_rate = 48000;
+    fake_format.num_channels = 2;
+
+    // The other end, bound to a free port on loopback.
+    peer_ = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    ASSERT_LE(0, peer_);
+    memset(&peer_addr_, 0, sizeof(peer_addr_));
+    in = (struct sockaddr_in*)&peer_addr_;
+    in->sin_family = AF_INET;
+    in->sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    ASSERT_EQ(0, bind(peer_, (struct sockaddr*)&peer_addr_, sizeof(*in)));
+    ASSERT_EQ(0, getsockname(peer_, (struct sockaddr*)&peer_addr_, &len));
+
+    memset(&config_, 0, sizeof(config_));
+    config_.name = "Living Room";
+    config_.frame_rate = 48000;
+    config_.num_channels = 2;
+    config_.packet_frames = kPacketFrames;
+    config_.jitter_frames = 2 * kPacketFrames;
+    config_.payload_type = 96;
+    iodev_ = NULL;
+  }
+
+  virtual void TearDown() {
+    if (iodev_) {
+      iodev_->close_dev(iodev_);
+      rtp_iodev_destroy(iodev_);
+    }
+    close(peer_);
+  }
+
+  void AdvanceMs(unsigned int ms) {
+    clock_gettime_retspec.tv_nsec += ms * 1000000;
+    while (clock_gettime_retspec.tv_nsec >= 1000000000) {
+      clock_gettime_retspec.tv_sec++;
+      clock_gettime_retspec.tv_nsec -= 1000000000;
+    }
+  }
+
+  // Sends an RTP packet of kPacketFrames stereo frames of value to the
+  // input device at addr.
+  void SendPacket(const struct sockaddr_in* addr,
+                  uint32_t ts,
+                  int16_t value) {
+    uint8_t packet[sizeof(struct rtp_header) + kPacketFrames * 4];
+    struct rtp_header* header = (struct rtp_header*)packet;
+    uint16_t* payload = (uint16_t*)(packet + sizeof(*header));
+
+    memset(packet, 0, sizeof(packet));
+    header->v = 2;
+    header->pt = 96;
+    header->timestamp = htonl(ts);
+    header->ssrc = htonl(0x1234);
+    for (unsigned int i = 0; i < kPacketFrames * 2; i++)
+      payload[i] = htons(value);
+    ASSERT_EQ(sizeof(packet),
+              sendto(peer_, packet, sizeof(packet), 0,
+                     (const struct sockaddr*)addr, sizeof(*addr)));
+  }
+
+  void WriteFrames(unsigned int frames, int16_t value) {
+    struct cras_audio_area* area;
+    unsigned int n = frames;
+
+    ASSERT_EQ(0, iodev_->get_buffer(iodev_, &area, &n));
+    ASSERT_EQ(frames, n);
+    for (unsigned int i = 0; i < frames * 2; i++)
+      ((int16_t*)config_buf_pointers_base)[i] = value;
+    ASSERT_EQ(0, iodev_->put_buffer(iodev_, frames));
+  }
+
+  struct rtp_iodev_config config_;
+  struct cras_iodev* iodev_;
+  struct sockaddr_storage peer_addr_;
+  int peer_;
+};
+
+TEST_F(RtpIodevTestSuite, InvalidConfigs) {
+  config_.direction = CRAS_STREAM_OUTPUT;
+  memcpy(&config_.addr, &peer_addr_, sizeof(peer_addr_));
+  config_.addr_len = sizeof(struct sockaddr_in);
+
+  config_.num_channels = 3;
+  EXPECT_EQ(NULL, rtp_iodev_create(&config_));
+  config_.num_channels = 2;
+  config_.packet_frames = 0;
+  EXPECT_EQ(NULL, rtp_iodev_create(&config_));
+  config_.packet_frames = 1000;
+  EXPECT_EQ(NULL, rtp_iodev_create(&config_));
+  config_.packet_frames = kPacketFrames;
+  config_.clock = "/nonexistent/ptp";
+  EXPECT_EQ(NULL, rtp_iodev_create(&config_));
+  EXPECT_EQ(0, cras_iodev_list_add_output_called);
+}
+
+TEST_F(RtpIodevTestSuite, OutputSendsDuePackets) {
+  struct timespec ts;
+  uint8_t packet[2048];
+  struct rtp_header* header = (struct rtp_header*)packet;
+  uint16_t* payload = (uint16_t*)(packet + sizeof(*header));
+  uint32_t first_ts;
+
+  config_.direction = CRAS_STREAM_OUTPUT;
+  memcpy(&config_.addr, &peer_addr_, sizeof(peer_addr_));
+  config_.addr_len = sizeof(struct sockaddr_in);
+  iodev_ = rtp_iodev_create(&config_);
+  ASSERT_NE((void*)NULL, iodev_);
+  EXPECT_EQ(1, cras_iodev_list_add_output_called);
+  EXPECT_EQ(CRAS_NODE_TYPE_NETWORK, iodev_->active_node->type);
+  EXPECT_STREQ("Living Room", iodev_->active_node->name);
+  iodev_->format = &fake_format;
+  ASSERT_EQ(0, iodev_->configure_dev(iodev_));
+
+  WriteFrames(kPacketFrames, 0x0102);
+  WriteFrames(3 * kPacketFrames, 0x0304);
+  EXPECT_EQ(4 * kPacketFrames, iodev_->frames_queued(iodev_, &ts));
+  EXPECT_EQ(-1, recv(peer_, packet, sizeof(packet), 0));
+
+  // Nothing is sent before it is due on the clock.
+  AdvanceMs(5);
+  EXPECT_EQ(3 * kPacketFrames, iodev_->frames_queued(iodev_, &ts));
+  ASSERT_EQ(sizeof(*header) + kPacketFrames * 4,
+            recv(peer_, packet, sizeof(packet), 0));
+  EXPECT_EQ(2, header->v);
+  EXPECT_EQ(96, header->pt);
+  EXPECT_EQ(1, header->m);
+  EXPECT_EQ(htons(0x0102), payload[0]);
+  EXPECT_EQ(htons(0x0102), payload[kPacketFrames * 2 - 1]);
+  first_ts = ntohl(header->timestamp);
+  EXPECT_EQ(-1, recv(peer_, packet, sizeof(packet), 0));
+
+  // Two packets are due at once and go out in one batch.
+  AdvanceMs(10);
+  EXPECT_EQ(kPacketFrames, iodev_->frames_queued(iodev_, &ts));
+  ASSERT_LT(0, recv(peer_, packet, sizeof(packet), 0));
+  EXPECT_EQ(0, header->m);
+  EXPECT_EQ(first_ts + kPacketFrames, ntohl(header->timestamp));
+  EXPECT_EQ(htons(0x0304), payload[0]);
+  ASSERT_LT(0, recv(peer_, packet, sizeof(packet), 0));
+  EXPECT_EQ(first_ts + 2 * kPacketFrames, ntohl(header->timestamp));
+
+  // What isn't written in time goes out as silence, keeping the clock.
+  AdvanceMs(10);
+  EXPECT_EQ(0, iodev_->frames_queued(iodev_, &ts));
+  ASSERT_LT(0, recv(peer_, packet, sizeof(packet), 0));
+  EXPECT_EQ(htons(0x0304), payload[0]);
+  ASSERT_LT(0, recv(peer_, packet, sizeof(packet), 0));
+  EXPECT_EQ(first_ts + 4 * kPacketFrames, ntohl(header->timestamp));
+  EXPECT_EQ(0, payload[0]);
+}
+
+TEST_F(RtpIodevTestSuite, InputJitterBuffer) {
+  struct sockaddr_in addr;
+  socklen_t len = sizeof(addr);
+  struct timespec ts;
+  struct cras_audio_area* area;
+  unsigned int frames;
+  int16_t* samples;
+  int tmp;
+
+  // Find a free port for the device to listen on.
+  tmp = socket(AF_INET, SOCK_DGRAM, 0);
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  ASSERT_EQ(0, bind(tmp, (struct sockaddr*)&addr, sizeof(addr)));
+  ASSERT_EQ(0, getsockname(tmp, (struct sockaddr*)&addr, &len));
+  close(tmp);
+
+  config_.direction = CRAS_STREAM_INPUT;
+  memcpy(&config_.addr, &addr, sizeof(addr));
+  config_.addr_len = sizeof(addr);
+  iodev_ = rtp_iodev_create(&config_);
+  ASSERT_NE((void*)NULL, iodev_);
+  EXPECT_EQ(1, cras_iodev_list_add_input_called);
+  iodev_->format = &fake_format;
+  ASSERT_EQ(0, iodev_->configure_dev(iodev_));
+
+  // Nothing plays out until the jitter buffer holds jitter_frames.
+  SendPacket(&addr, 5000, 1);
+  EXPECT_EQ(0, iodev_->frames_queued(iodev_, &ts));
+  AdvanceMs(5);
+  EXPECT_EQ(0, iodev_->frames_queued(iodev_, &ts));
+  SendPacket(&addr, 5000 + kPacketFrames, 2);
+  EXPECT_EQ(0, iodev_->frames_queued(iodev_, &ts));
+
+  // Then frames are due at the rate of the clock.
+  AdvanceMs(5);
+  EXPECT_EQ(kPacketFrames, iodev_->frames_queued(iodev_, &ts));
+  frames = 1000;
+  iodev_->get_buffer(iodev_, &area, &frames);
+  ASSERT_EQ(kPacketFrames, frames);
+  samples = (int16_t*)config_buf_pointers_base;
+  EXPECT_EQ(1, samples[0]);
+  EXPECT_EQ(1, samples[kPacketFrames * 2 - 1]);
+  EXPECT_EQ(0, iodev_->put_buffer(iodev_, frames));
+
+  // A lost packet plays as silence, a late one is dropped.
+  SendPacket(&addr, 5000 + 3 * kPacketFrames, 4);
+  AdvanceMs(15);
+  EXPECT_EQ(3 * kPacketFrames, iodev_->frames_queued(iodev_, &ts));
+  SendPacket(&addr, 5000, 9);
+  frames = 3 * kPacketFrames;
+  iodev_->get_buffer(iodev_, &area, &frames);
+  ASSERT_EQ(3 * kPacketFrames, frames);
+  samples = (int16_t*)config_buf_pointers_base;
+  EXPECT_EQ(2, samples[0]);
+  EXPECT_EQ(0, samples[kPacketFrames * 2]);
+  EXPECT_EQ(4, samples[kPacketFrames * 4]);
+  EXPECT_EQ(0, iodev_->put_buffer(iodev_, frames));
+  EXPECT_EQ(0, iodev_->frames_queued(iodev_, &ts));
+}
+
+}  // namespace
+
+extern "C" {
+
+int cras_iodev_default_no_stream_playback(struct cras_iodev* odev, int enable) {
+  return 0;
+}
+
+void cras_iodev_init_audio_area(struct cras_iodev* iodev, int num_channels) {
+  iodev->area = &mock_audio_area;
+}
+
+void cras_iodev_free_audio_area(struct cras_iodev* iodev) {}
+
+void cras_audio_area_config_buf_pointers(struct cras_audio_area* area,
+                                         const struct cras_audio_format* fmt,
+                                         uint8_t* base_buffer) {
+  config_buf_pointers_base = base_buffer;
+}
+
+int cras_iodev_list_add_output(struct cras_iodev* output) {
+  cras_iodev_list_add_output_called++;
+  return 0;
+}
+
+int cras_iodev_list_add_input(struct cras_iodev* input) {
+  cras_iodev_list_add_input_called++;
+  return 0;
+}
+
+int cras_iodev_list_rm_input(struct cras_iodev* input) {
+  return 0;
+}
+
+int cras_iodev_list_rm_output(struct cras_iodev* output) {
+  return 0;
+}
+
+void cras_iodev_free_resources(struct cras_iodev* iodev) {}
+
+void cras_iodev_add_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = node;
+}
+
+void cras_iodev_rm_node(struct cras_iodev* iodev, struct cras_ionode* node) {
+  iodev->nodes = NULL;
+}
+
+void cras_iodev_set_active_node(struct cras_iodev* iodev,
+                                struct cras_ionode* node) {
+  iodev->active_node = node;
+}
+
+//  From librt.
+int clock_gettime(clockid_t clk_id, struct timespec* tp) {
+  tp->tv_sec = clock_gettime_retspec.tv_sec;
+  tp->tv_nsec = clock_gettime_retspec.tv_nsec;
+  return 0;
+}
+
+}  // extern "C"
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,133 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_sample_cache.h"
+#include "cras_types.h"
+}
+
+namespace {
+
+static int server_stream_play_sample_called;
+static unsigned int server_stream_play_sample_dev_idx;
+static struct cras_sample* server_stream_play_sample_sample;
+
+class SampleCacheTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    server_stream_play_sample_called = 0;
+    server_stream_play_sample_sample = NULL;
+    fmt_.format = SND_PCM_FORMAT_S16_LE;
+    fmt_.frame_rate = 48000;
+    fmt_.num_channels = 2;
+    fd_ = fileno(tmpfile());
+    for (size_t i = 0; i < sizeof(data_) / sizeof(data_[0]); i++)
+      data_[i] = i;
+    ASSERT_EQ(sizeof(data_), write(fd_, data_, sizeof(data_)));
+  }
+
+  virtual void TearDown() {
+    cras_sample_cache_clear();
+    close(fd_);
+  }
+
+  struct cras_audio_format fmt_;
+  int16_t data_[480 * 2];
+  int fd_;
+};
+
+TEST_F(SampleCacheTestSuite, AddPlayRemove) {
+  struct cras_sample* sample;
+
+  EXPECT_EQ(0, cras_sample_cache_add(3, &fmt_, fd_, 480));
+  EXPECT_EQ(0, cras_sample_cache_play(NULL, 3, 5));
+  EXPECT_EQ(1, server_stream_play_sample_called);
+  EXPECT_EQ(5, server_stream_play_sample_dev_idx);
+  sample = server_stream_play_sample_sample;
+  ASSERT_NE((void*)NULL, sample);
+  EXPECT_EQ(3, sample->id);
+  EXPECT_EQ(480, sample->frames);
+  EXPECT_EQ(0, memcmp(data_, sample->samples, sizeof(data_)));
+
+  EXPECT_EQ(0, cras_sample_cache_remove(3));
+  EXPECT_EQ(-ENOENT, cras_sample_cache_remove(3));
+  EXPECT_EQ(-ENOENT, cras_sample_cache_play(NULL, 3, NO_DEVICE));
+  EXPECT_EQ(1, server_stream_play_sample_called);
+}
+
+TEST_F(SampleCacheTestSuite, ReplaceKeepsPlayingSample) {
+  struct cras_sample* old;
+
+  ASSERT_EQ(0, cras_sample_cache_add(3, &fmt_, fd_, 480));
+  ASSERT_EQ(0, cras_sample_cache_play(NULL, 3, NO_DEVICE));
+  // A stream playing the sample holds its own reference.
+  old = cras_sample_get(server_stream_play_sample_sample);
+
+  ASSERT_EQ(0, cras_sample_cache_add(3, &fmt_, fd_, 240));
+  EXPECT_EQ(1, old->refs);
+  EXPECT_EQ(480, old->frames);
+  cras_sample_put(old);
+
+  ASSERT_EQ(0, cras_sample_cache_play(NULL, 3, NO_DEVICE));
+  EXPECT_EQ(240, server_stream_play_sample_sample->frames);
+}
+
+TEST_F(SampleCacheTestSuite, InvalidUploads) {
+  struct cras_audio_format fmt = fmt_;
+
+  // The file holds fewer frames than uploaded.
+  EXPECT_EQ(-EINVAL, cras_sample_cache_add(3, &fmt_, fd_, 481));
+  EXPECT_EQ(-EINVAL, cras_sample_cache_add(3, &fmt_, fd_, 0));
+  EXPECT_EQ(-EINVAL, cras_sample_cache_add(
+                         3, &fmt_, fd_, CRAS_SAMPLE_MAX_BYTES / 4 + 1));
+  fmt.num_channels = 0;
+  EXPECT_EQ(-EINVAL, cras_sample_cache_add(3, &fmt, fd_, 480));
+  fmt = fmt_;
+  fmt.frame_rate = 1000;
+  EXPECT_EQ(-EINVAL, cras_sample_cache_add(3, &fmt, fd_, 480));
+  EXPECT_EQ(-ENOENT, cras_sample_cache_play(NULL, 3, NO_DEVICE));
+}
+
+TEST_F(SampleCacheTestSuite, CacheFull) {
+  size_t frames = CRAS_SAMPLE_MAX_BYTES / 4;
+  int16_t* big = (int16_t*)calloc(frames, 4);
+  uint32_t id;
+
+  ASSERT_EQ(0, ftruncate(fd_, 0));
+  ASSERT_EQ(frames * 4, pwrite(fd_, big, frames * 4, 0));
+  free(big);
+
+  for (id = 0; id < CRAS_SAMPLE_CACHE_MAX_BYTES / CRAS_SAMPLE_MAX_BYTES; id++)
+    EXPECT_EQ(0, cras_sample_cache_add(id, &fmt_, fd_, frames));
+  EXPECT_EQ(-ENOSPC, cras_sample_cache_add(id, &fmt_, fd_, frames));
+
+  // Replacing a sample only counts the difference.
+  EXPECT_EQ(0, cras_sample_cache_add(0, &fmt_, fd_, frames));
+  EXPECT_EQ(0, cras_sample_cache_remove(0));
+  EXPECT_EQ(0, cras_sample_cache_add(id, &fmt_, fd_, frames));
+}
+
+}  //  namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
+
+extern "C" {
+
+int server_stream_play_sample(struct stream_list* stream_list,
+                              unsigned int dev_idx,
+                              struct cras_sample* sample) {
+  server_stream_play_sample_called++;
+  server_stream_play_sample_dev_idx = dev_idx;
+  server_stream_play_sample_sample = sample;
+  return 0;
+}
+
+}  // extern "C"
@@ -4,6 +4,8 @@
  */
 #include <stdlib.h>
 
+#include <algorithm>
+
 extern "C" {
 #include "cras_audio_codec.h"
 #include "sbc_codec_stub.h"
@@ -21,9 +23,11 @@ static uint8_t subbands_val;
 static uint8_t alloc_val;
 static uint8_t blocks_val;
 static uint8_t bitpool_val;
+static uint8_t set_bitpool_val;
 static struct cras_audio_codec* sbc_codec;
 static size_t decode_out_decoded_return_val;
 static int decode_fail;
+static int decode_frames_called;
 static size_t encode_out_encoded_return_val;
 static int encode_fail;
 static int cras_sbc_get_frame_length_val;
@@ -42,11 +46,13 @@ void sbc_codec_stub_reset() {
   alloc_val = 0;
   blocks_val = 0;
   bitpool_val = 0;
+  set_bitpool_val = 0;
 
   sbc_codec = NULL;
   decode_out_decoded_return_val = 0;
   encode_out_encoded_return_val = 0;
   decode_fail = 0;
+  decode_frames_called = 0;
   encode_fail = 0;
 
   cras_sbc_get_frame_length_val = 5;
@@ -89,6 +95,10 @@ uint8_t get_sbc_codec_create_bitpool_val() {
   return bitpool_val;
 }
 
+uint8_t get_sbc_codec_set_bitpool_val() {
+  return set_bitpool_val;
+}
+
 int get_sbc_codec_destroy_called() {
   return destroy_called;
 }
@@ -101,6 +111,10 @@ void set_sbc_codec_decoded_fail(int fail) {
   decode_fail = fail;
 }
 
+int get_msbc_codec_decode_frames_called() {
+  return decode_frames_called;
+}
+
 void set_sbc_codec_encoded_out(size_t ret) {
   encode_out_encoded_return_val = ret;
 }
@@ -160,6 +174,22 @@ struct cras_audio_codec* cras_msbc_codec_create() {
   return sbc_codec;
 }
 
+int cras_msbc_decode_frames(struct cras_audio_codec* codec,
+                            const uint8_t* input,
+                            size_t stride,
+                            unsigned int frames,
+                            uint8_t* output,
+                            size_t output_len) {
+  decode_frames_called++;
+  if (decode_fail)
+    return 0;
+  // Each frame decodes to the size set for decode.
+  if (decode_out_decoded_return_val)
+    frames = std::min<size_t>(frames,
+                              output_len / decode_out_decoded_return_val);
+  return frames;
+}
+
 void cras_sbc_codec_destroy(struct cras_audio_codec* codec) {
   destroy_called++;
   free(codec);
@@ -172,3 +202,9 @@ int cras_sbc_get_codesize(struct cras_audio_codec* codec) {
 int cras_sbc_get_frame_length(struct cras_audio_codec* codec) {
   return cras_sbc_get_frame_length_val;
 }
+
+void cras_sbc_set_bitpool(struct cras_audio_codec* codec, uint8_t bitpool) {
+  // Fake the frame length to follow the bitpool.
+  set_bitpool_val = bitpool;
+  cras_sbc_get_frame_length_val = bitpool;
+}
@@ -20,8 +20,10 @@ uint8_t get_sbc_codec_create_alloc_val();
 uint8_t get_sbc_codec_create_blocks_val();
 uint8_t get_sbc_codec_create_bitpool_val();
 int get_sbc_codec_destroy_called();
+uint8_t get_sbc_codec_set_bitpool_val();
 void set_sbc_codec_decoded_out(size_t ret);
 void set_sbc_codec_decoded_fail(int fail);
+int get_msbc_codec_decode_frames_called();
 void set_sbc_codec_encoded_out(size_t ret);
 void set_sbc_codec_encoded_fail(int fail);
 
@@ -32,8 +34,15 @@ struct cras_audio_codec* cras_sbc_codec_create(uint8_t freq,
                                                uint8_t blocks,
                                                uint8_t bitpool);
 struct cras_audio_codec* cras_msbc_codec_create();
+int cras_msbc_decode_frames(struct cras_audio_codec* codec,
+                            const uint8_t* input,
+                            size_t stride,
+                            unsigned int frames,
+                            uint8_t* output,
+                            size_t output_len);
 void cras_sbc_codec_destroy(struct cras_audio_codec* codec);
 int cras_sbc_get_codesize(struct cras_audio_codec* codec);
 int cras_sbc_get_frame_length(struct cras_audio_codec* codec);
+void cras_sbc_set_bitpool(struct cras_audio_codec* codec, uint8_t bitpool);
 
 #endif  // SBC_CODEC_STUB_H_
@@ -3,6 +3,7 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 #include <stdio.h>
 
 #include <vector>
@@ -16,10 +17,18 @@ extern "C" {
 static enum CRAS_MAIN_MESSAGE_TYPE type_set;
 static struct timespec clock_gettime_retspec;
 std::vector<struct cras_server_metrics_message> sent_msgs;
+std::vector<struct cras_server_metrics_batch_message> sent_batches;
+static int log_histogram_called;
+static int begin_batch_called;
+static int end_batch_called;
 
 void ResetStubData() {
   type_set = (enum CRAS_MAIN_MESSAGE_TYPE)0;
   sent_msgs.clear();
+  sent_batches.clear();
+  log_histogram_called = 0;
+  begin_batch_called = 0;
+  end_batch_called = 0;
 }
 
 namespace {
@@ -356,6 +365,101 @@ TEST(ServerMetricsTestSuite, SetMetricsBusyloopLength) {
   EXPECT_EQ(sent_msgs[0].data.value, 5);
 }
 
+TEST(ServerMetricsTestSuite, SetMetricsBtProfileSwitchTime) {
+  ResetStubData();
+  struct timespec time = {1, 250000000};
+
+  cras_server_metrics_bt_profile_switch_time(&time, true);
+  cras_server_metrics_bt_profile_switch_time(&time, false);
+
+  EXPECT_EQ(sent_msgs.size(), 2);
+  EXPECT_EQ(sent_msgs[0].header.type, CRAS_MAIN_METRICS);
+  EXPECT_EQ(sent_msgs[0].metrics_type, BT_PROFILE_SWITCH_TIME_TO_A2DP);
+  EXPECT_EQ(sent_msgs[0].data.value, 1250);
+  EXPECT_EQ(sent_msgs[1].metrics_type, BT_PROFILE_SWITCH_TIME_TO_HFP);
+  EXPECT_EQ(sent_msgs[1].data.value, 1250);
+}
+
+TEST(ServerMetricsTestSuite, SetMetricsHfpLinkStats) {
+  ResetStubData();
+  struct hfp_link_stats stats;
+
+  memset(&stats, 0, sizeof(stats));
+  stats.packets = 1000;
+  stats.max_burst = 5;
+  stats.plc_calls = 4;
+  stats.plc_usec = 400;
+  stats.wakes = 500;
+  stats.max_jitter_usec = 1200;
+
+  cras_server_metrics_hfp_link_stats(&stats);
+
+  // Nothing was queued to the controller, so no depth is logged.
+  ASSERT_EQ(sent_msgs.size(), 3);
+  EXPECT_EQ(sent_msgs[0].metrics_type, BT_SCO_MAX_LOSS_BURST);
+  EXPECT_EQ(sent_msgs[0].data.value, 5);
+  EXPECT_EQ(sent_msgs[1].metrics_type, BT_SCO_PLC_COST);
+  EXPECT_EQ(sent_msgs[1].data.value, 100);
+  EXPECT_EQ(sent_msgs[2].metrics_type, BT_SCO_JITTER);
+  EXPECT_EQ(sent_msgs[2].data.value, 1200);
+}
+
+static void* BatchingThread(void* arg) {
+  cras_server_metrics_start_batching();
+
+  clock_gettime_retspec.tv_sec = 100;
+  clock_gettime_retspec.tv_nsec = 0;
+  cras_server_metrics_highest_hw_level(1000, CRAS_STREAM_INPUT);
+  cras_server_metrics_highest_hw_level(1000, CRAS_STREAM_INPUT);
+  cras_server_metrics_num_underruns(10);
+
+  // Held until flushed or old enough.
+  EXPECT_EQ(0, cras_server_metrics_flush_batch(false));
+  EXPECT_EQ(0, sent_batches.size());
+  clock_gettime_retspec.tv_sec = 100 + CRAS_METRICS_BATCH_MAX_AGE_SECONDS;
+  EXPECT_EQ(0, cras_server_metrics_flush_batch(false));
+  EXPECT_EQ(1, sent_batches.size());
+
+  // A full batch is sent right away.
+  for (unsigned i = 0; i < METRICS_BATCH_SIZE; i++)
+    cras_server_metrics_num_underruns(i);
+  EXPECT_EQ(2, sent_batches.size());
+  EXPECT_EQ(0, cras_server_metrics_flush_batch(true));
+  EXPECT_EQ(2, sent_batches.size());
+  return NULL;
+}
+
+TEST(ServerMetricsTestSuite, BatchedMetrics) {
+  pthread_t tid;
+
+  ResetStubData();
+  // Batching is per thread, keep it off the thread running the other tests.
+  ASSERT_EQ(0, pthread_create(&tid, NULL, BatchingThread, NULL));
+  pthread_join(tid, NULL);
+
+  EXPECT_EQ(0, sent_msgs.size());
+  ASSERT_EQ(2, sent_batches.size());
+  EXPECT_EQ(CRAS_MAIN_METRICS, sent_batches[0].header.type);
+  EXPECT_EQ(METRICS_BATCH, sent_batches[0].metrics_type);
+  ASSERT_EQ(2, sent_batches[0].num_records);
+  EXPECT_EQ(offsetof(struct cras_server_metrics_batch_message, records) +
+                2 * sizeof(struct cras_server_metrics_record),
+            sent_batches[0].header.length);
+  EXPECT_EQ(HIGHEST_INPUT_HW_LEVEL, sent_batches[0].records[0].metrics_type);
+  EXPECT_EQ(2, sent_batches[0].records[0].count);
+  EXPECT_EQ(1000, sent_batches[0].records[0].data.value);
+  EXPECT_EQ(NUM_UNDERRUNS, sent_batches[0].records[1].metrics_type);
+  EXPECT_EQ(1, sent_batches[0].records[1].count);
+  EXPECT_EQ(10, sent_batches[0].records[1].data.value);
+  EXPECT_EQ(METRICS_BATCH_SIZE, sent_batches[1].num_records);
+
+  // The main thread logs each sample, all through one metrics handle.
+  handle_metrics_message(&sent_batches[0].header, NULL);
+  EXPECT_EQ(3, log_histogram_called);
+  EXPECT_EQ(1, begin_batch_called);
+  EXPECT_EQ(1, end_batch_called);
+}
+
 extern "C" {
 
 int cras_main_message_add_handler(enum CRAS_MAIN_MESSAGE_TYPE type,
@@ -369,14 +473,32 @@ void cras_metrics_log_histogram(const char* name,
                                 int sample,
                                 int min,
                                 int max,
-                                int nbuckets) {}
+                                int nbuckets) {
+  log_histogram_called++;
+}
 
 void cras_metrics_log_sparse_histogram(const char* name, int sample) {}
 
+void cras_metrics_begin_batch() {
+  begin_batch_called++;
+}
+
+void cras_metrics_end_batch() {
+  end_batch_called++;
+}
+
 int cras_main_message_send(struct cras_main_message* msg) {
   // Copy the sent message so we can examine it in the test later.
   struct cras_server_metrics_message sent_msg;
+  struct cras_server_metrics_batch_message sent_batch;
+
   memcpy(&sent_msg, msg, sizeof(sent_msg));
+  if (sent_msg.metrics_type == METRICS_BATCH) {
+    memset(&sent_batch, 0, sizeof(sent_batch));
+    memcpy(&sent_batch, msg, msg->length);
+    sent_batches.push_back(sent_batch);
+    return 0;
+  }
   sent_msgs.push_back(sent_msg);
   return 0;
 }
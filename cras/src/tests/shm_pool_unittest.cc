@@ -0,0 +1,103 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <fcntl.h>
+#include <gtest/gtest.h>
+#include <stdio.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern "C" {
+#include "cras_shm.h"
+#include "cras_shm_pool.h"
+}
+
+namespace {
+
+static struct cras_audio_shm* CreateShm(uint32_t samples_size, int prot) {
+  struct cras_shm_info header_info, samples_info;
+  struct cras_audio_shm* shm;
+
+  if (cras_shm_info_init("/cras-pool-test-header", cras_shm_header_size(),
+                         &header_info))
+    return NULL;
+  if (cras_shm_info_init_samples("/cras-pool-test-samples", samples_size,
+                                 &samples_info)) {
+    cras_shm_info_cleanup(&header_info);
+    return NULL;
+  }
+  if (cras_audio_shm_create(&header_info, &samples_info, prot, &shm))
+    return NULL;
+  return shm;
+}
+
+class ShmPoolTest : public testing::Test {
+ protected:
+  virtual void TearDown() {
+    cras_shm_pool_deinit();
+    EXPECT_EQ(0, cras_shm_pool_num_entries());
+  }
+};
+
+TEST_F(ShmPoolTest, MemfdIsSealed) {
+  struct cras_audio_shm* shm = CreateShm(4096, PROT_READ);
+
+  ASSERT_NE((void*)NULL, shm);
+  int seals = fcntl(shm->samples_info.fd, F_GET_SEALS);
+  if (seals >= 0) {
+    EXPECT_TRUE(seals & F_SEAL_SHRINK);
+    EXPECT_TRUE(seals & F_SEAL_GROW);
+    EXPECT_NE(0, ftruncate(shm->samples_info.fd, 0));
+    EXPECT_EQ('\0', shm->samples_info.name[0]);
+  }
+  cras_audio_shm_destroy(shm);
+}
+
+TEST_F(ShmPoolTest, ReuseForSameClientOnly) {
+  struct cras_audio_shm* shm = CreateShm(4096, PROT_READ);
+
+  ASSERT_NE((void*)NULL, shm);
+  cras_shm_set_used_size(shm, 2048);
+  cras_shm_set_volume_scaler(shm, 0.5);
+  shm->header->write_offset[0] = 100;
+  cras_shm_pool_put(1, 4096, PROT_READ, shm);
+  EXPECT_EQ(1, cras_shm_pool_num_entries());
+
+  EXPECT_EQ((void*)NULL, cras_shm_pool_get(2, 4096, PROT_READ));
+  EXPECT_EQ((void*)NULL, cras_shm_pool_get(1, 8192, PROT_READ));
+  EXPECT_EQ((void*)NULL, cras_shm_pool_get(1, 4096, PROT_WRITE));
+
+  EXPECT_EQ(shm, cras_shm_pool_get(1, 4096, PROT_READ));
+  EXPECT_EQ(0, cras_shm_pool_num_entries());
+  EXPECT_EQ(0, shm->header->write_offset[0]);
+  EXPECT_EQ(0, shm->header->config.used_size);
+  EXPECT_EQ(1.0, cras_shm_get_volume_scaler(shm));
+  cras_audio_shm_destroy(shm);
+}
+
+TEST_F(ShmPoolTest, ReleaseClientAndEvictOldest) {
+  struct cras_audio_shm* first = CreateShm(4096, PROT_WRITE);
+
+  ASSERT_NE((void*)NULL, first);
+  cras_shm_pool_put(3, 4096, PROT_WRITE, first);
+  for (unsigned int i = 0; i < CRAS_SHM_POOL_MAX_ENTRIES; i++) {
+    struct cras_audio_shm* shm = CreateShm(4096, PROT_WRITE);
+    ASSERT_NE((void*)NULL, shm);
+    cras_shm_pool_put(4 + i % 2, 4096, PROT_WRITE, shm);
+  }
+  EXPECT_EQ(CRAS_SHM_POOL_MAX_ENTRIES, cras_shm_pool_num_entries());
+  // The first area was the oldest, it's gone.
+  EXPECT_EQ((void*)NULL, cras_shm_pool_get(3, 4096, PROT_WRITE));
+
+  cras_shm_pool_release_client(4);
+  EXPECT_EQ(CRAS_SHM_POOL_MAX_ENTRIES / 2, cras_shm_pool_num_entries());
+  EXPECT_EQ((void*)NULL, cras_shm_pool_get(4, 4096, PROT_WRITE));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -317,6 +317,130 @@ TEST_F(ShmTestSuite, WrapWithNonstandardBufferLocations) {
             shm_.header->read_offset[1]);
 }
 
+TEST_F(ShmTestSuite, ReadBufferSplitInSegments) {
+  struct cras_shm_segment segments[3] = {
+      {1000, 16},
+      {200, 40},
+      {1800, 400},
+  };
+
+  // Buffer 0 is 20 frames over the first two segments, buffer 1 is
+  // contiguous.
+  cras_shm_set_buffer_segments(&shm_, 0, segments, 2);
+  cras_shm_set_buffer_offset(&shm_, 1, 600);
+  shm_.header->write_offset[0] = 80;
+  shm_.header->write_offset[1] = 40;
+  EXPECT_TRUE(cras_shm_read_buffer_segmented(&shm_));
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples + 1000, buf_);
+  EXPECT_EQ(4, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 4, &frames_);
+  EXPECT_EQ(shm_.samples + 200, buf_);
+  EXPECT_EQ(10, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 9, &frames_);
+  EXPECT_EQ(shm_.samples + 220, buf_);
+  EXPECT_EQ(5, frames_);
+
+  // Past the end of the segments.
+  shm_.header->write_offset[0] = 100;
+  buf_ = cras_shm_get_readable_frames(&shm_, 14, &frames_);
+  EXPECT_EQ(NULL, buf_);
+  EXPECT_EQ(0, frames_);
+
+  // Reading on into the next buffer.
+  shm_.header->write_offset[0] = 56;
+  buf_ = cras_shm_get_readable_frames(&shm_, 14, &frames_);
+  EXPECT_EQ(shm_.samples + 600, buf_);
+  EXPECT_EQ(10, frames_);
+
+  // A segment past the samples area is cut short.
+  cras_shm_set_buffer_segments(&shm_, 0, &segments[2], 1);
+  shm_.header->write_offset[0] = 400;
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples + 1800, buf_);
+  EXPECT_EQ(62, frames_);
+
+  cras_shm_set_buffer_segments(&shm_, 0, segments, 0);
+  EXPECT_FALSE(cras_shm_read_buffer_segmented(&shm_));
+}
+
+TEST_F(ShmTestSuite, RingQueuesSeveralBuffersAhead) {
+  cras_shm_set_used_size(&shm_, 256);
+  cras_shm_set_ring(&shm_, cras_shm_calculate_ring_size(256));
+  ASSERT_TRUE(cras_shm_is_ring(&shm_));
+
+  // Three callbacks of 48 frames queue ahead without the server reading.
+  for (int i = 0; i < 3; i++) {
+    EXPECT_TRUE(cras_shm_is_buffer_available(&shm_));
+    EXPECT_EQ(shm_.samples + i * 192, cras_shm_get_write_buffer_base(&shm_));
+    cras_shm_buffer_written_start(&shm_, 48);
+  }
+  EXPECT_EQ(144, cras_shm_get_frames(&shm_));
+  EXPECT_EQ(112, cras_shm_get_num_writeable(&shm_));
+  // Less than a buffer of 64 frames is free.
+  cras_shm_buffer_written_start(&shm_, 50);
+  EXPECT_FALSE(cras_shm_is_buffer_available(&shm_));
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples, buf_);
+  EXPECT_EQ(194, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 100, &frames_);
+  EXPECT_EQ(shm_.samples + 400, buf_);
+  EXPECT_EQ(94, frames_);
+  cras_shm_buffer_read(&shm_, 150);
+  EXPECT_EQ(44, cras_shm_get_frames(&shm_));
+  EXPECT_TRUE(cras_shm_is_buffer_available(&shm_));
+}
+
+TEST_F(ShmTestSuite, RingWrapsAtItsEnd) {
+  cras_shm_set_used_size(&shm_, 256);
+  cras_shm_set_ring(&shm_, 1024);
+  shm_.header->ring_read = 0xffffffff - 99;
+  shm_.header->ring_write = 0xffffffff - 99;
+
+  // Writes stop at the end of the ring, the next one starts over.
+  EXPECT_EQ(shm_.samples + 1024 - 100, cras_shm_get_write_buffer_base(&shm_));
+  EXPECT_EQ(25, cras_shm_get_num_writeable(&shm_));
+  cras_shm_buffer_written_start(&shm_, 25);
+  EXPECT_EQ(shm_.samples, cras_shm_get_write_buffer_base(&shm_));
+  EXPECT_EQ(231, cras_shm_get_num_writeable(&shm_));
+  cras_shm_buffer_written_start(&shm_, 40);
+  EXPECT_EQ(65, cras_shm_get_frames(&shm_));
+
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples + 1024 - 100, buf_);
+  EXPECT_EQ(25, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 30, &frames_);
+  EXPECT_EQ(shm_.samples + 20, buf_);
+  EXPECT_EQ(35, frames_);
+  buf_ = cras_shm_get_readable_frames(&shm_, 65, &frames_);
+  EXPECT_EQ(NULL, buf_);
+  EXPECT_EQ(0, frames_);
+
+  // Reading past what is queued stops at the write counter.
+  cras_shm_buffer_read(&shm_, 100);
+  EXPECT_EQ(0, cras_shm_get_frames(&shm_));
+  EXPECT_EQ(shm_.header->ring_write, shm_.header->ring_read);
+}
+
+TEST_F(ShmTestSuite, RingLimitsBogusWriteCounter) {
+  cras_shm_set_used_size(&shm_, 256);
+  cras_shm_set_ring(&shm_, 1024);
+  shm_.header->ring_write = 5000;
+
+  EXPECT_EQ(256, cras_shm_get_frames(&shm_));
+  buf_ = cras_shm_get_readable_frames(&shm_, 0, &frames_);
+  EXPECT_EQ(shm_.samples, buf_);
+  EXPECT_EQ(256, frames_);
+  EXPECT_EQ(0, cras_shm_get_num_writeable(&shm_));
+
+  // Back to the A/B buffers.
+  cras_shm_set_ring(&shm_, 0);
+  EXPECT_FALSE(cras_shm_is_ring(&shm_));
+  EXPECT_EQ(0, cras_shm_get_frames(&shm_));
+}
+
 TEST_F(ShmTestSuite, PlaybackWithDifferentSequentialBufferLocations) {
   uint32_t frame_bytes = cras_shm_frame_bytes(&shm_);
   uint32_t used_frames = 24;
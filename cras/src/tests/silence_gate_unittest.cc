@@ -0,0 +1,87 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdlib.h>
+
+extern "C" {
+#include "cras_audio_area.h"
+#include "silence_gate.h"
+}
+
+namespace {
+
+class SilenceGateTestSuite : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    area = (struct cras_audio_area*)calloc(
+        1, sizeof(*area) + 2 * sizeof(struct cras_channel_area));
+    area->num_channels = 2;
+    for (int i = 0; i < 2; i++)
+      area->channels[i].ch_set = 1;
+    silence_gate_init(&gate, 48000);
+  }
+
+  virtual void TearDown() { free(area); }
+
+  // Feeds 10ms blocks of stereo frames with the given sample on channel 1.
+  bool Feed(int16_t value, int blocks) {
+    bool silent = false;
+
+    for (int i = 0; i < 960; i += 2) {
+      buf[i] = 0;
+      buf[i + 1] = value;
+    }
+    for (int i = 0; i < blocks; i++)
+      silent = silence_gate_process_area(&gate, buf, area, 480);
+    return silent;
+  }
+
+  struct silence_gate gate;
+  struct cras_audio_area* area;
+  int16_t buf[960];
+};
+
+TEST_F(SilenceGateTestSuite, ClosesAfterHold) {
+  // Not before 300ms of silence.
+  EXPECT_FALSE(Feed(0, 29));
+  EXPECT_TRUE(Feed(0, 1));
+  EXPECT_TRUE(Feed(0, 10));
+}
+
+TEST_F(SilenceGateTestSuite, OpensOnFirstLoudBlock) {
+  EXPECT_TRUE(Feed(0, 30));
+  EXPECT_FALSE(Feed(1000, 1));
+
+  // A single loud frame is enough.
+  EXPECT_TRUE(Feed(0, 30));
+  buf[501] = -1000;
+  EXPECT_FALSE(silence_gate_process_area(&gate, buf, area, 480));
+}
+
+TEST_F(SilenceGateTestSuite, Hysteresis) {
+  // Between the levels an open gate doesn't close.
+  EXPECT_FALSE(Feed(20, 100));
+
+  // And a closed one doesn't open.
+  EXPECT_TRUE(Feed(0, 30));
+  EXPECT_TRUE(Feed(20, 100));
+}
+
+TEST_F(SilenceGateTestSuite, IgnoresUnsetChannels) {
+  area->channels[1].ch_set = 0;
+  EXPECT_TRUE(Feed(1000, 30));
+}
+
+TEST_F(SilenceGateTestSuite, Disabled) {
+  silence_gate_disable(&gate);
+  EXPECT_FALSE(Feed(0, 100));
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -20,10 +20,11 @@ static int added_cb(struct cras_rstream* rstream) {
 
 static unsigned int rm_called;
 static struct cras_rstream* rmed_stream;
+static int rm_drain_delay;
 static int removed_cb(struct cras_rstream* rstream) {
   rm_called++;
   rmed_stream = rstream;
-  return 0;
+  return rm_drain_delay;
 }
 
 static unsigned int create_called;
@@ -53,11 +54,18 @@ static void destroy_rstream_cb(struct cras_rstream* rstream) {
   free(rstream);
 }
 
+static unsigned int create_timer_called;
+static unsigned int create_timer_ms;
+static unsigned int cancel_timer_called;
+
 static void reset_test_data() {
   add_called = 0;
   rm_called = 0;
+  rm_drain_delay = 0;
   create_called = 0;
   destroy_called = 0;
+  create_timer_called = 0;
+  cancel_timer_called = 0;
 }
 
 TEST(StreamList, AddRemove) {
@@ -84,6 +92,72 @@ TEST(StreamList, AddRemove) {
   stream_list_destroy(l);
 }
 
+TEST(StreamList, BatchHoldsRemovals) {
+  struct stream_list* l;
+  struct cras_rstream *s1, *s2;
+  struct cras_rstream_config s1_config, s2_config;
+
+  s1_config.stream_id = 0x3003;
+  s1_config.direction = CRAS_STREAM_OUTPUT;
+  s1_config.format = NULL;
+  s2_config = s1_config;
+  s2_config.stream_id = 0x3004;
+
+  reset_test_data();
+  l = stream_list_create(added_cb, removed_cb, create_rstream_cb,
+                         destroy_rstream_cb, NULL);
+  stream_list_begin_batch(l);
+  stream_list_add(l, &s1_config, &s1);
+  stream_list_add(l, &s2_config, &s2);
+  EXPECT_EQ(2, add_called);
+  EXPECT_EQ(0, stream_list_rm(l, 0x3003));
+  EXPECT_EQ(0, stream_list_rm(l, 0x3004));
+  EXPECT_EQ(NULL, stream_list_get(l));
+  EXPECT_EQ(0, rm_called);
+  EXPECT_EQ(0, destroy_called);
+
+  stream_list_end_batch(l);
+  EXPECT_EQ(2, rm_called);
+  EXPECT_EQ(2, destroy_called);
+  stream_list_destroy(l);
+}
+
+TEST(StreamList, DrainedStreamDestroyed) {
+  struct stream_list* l;
+  struct cras_rstream* s1;
+  struct cras_rstream_config s1_config;
+
+  s1_config.stream_id = 0x3003;
+  s1_config.direction = CRAS_STREAM_OUTPUT;
+  s1_config.format = NULL;
+
+  reset_test_data();
+  l = stream_list_create(added_cb, removed_cb, create_rstream_cb,
+                         destroy_rstream_cb, NULL);
+  stream_list_add(l, &s1_config, &s1);
+  EXPECT_EQ(s1, stream_list_find(l, 0x3003));
+
+  rm_drain_delay = 20;
+  EXPECT_EQ(0, stream_list_rm(l, 0x3003));
+  EXPECT_EQ(NULL, stream_list_find(l, 0x3003));
+  EXPECT_EQ(1, rm_called);
+  EXPECT_EQ(0, destroy_called);
+  EXPECT_EQ(1, create_timer_called);
+  EXPECT_EQ(120, create_timer_ms);
+
+  // Unknown streams are ignored.
+  rm_drain_delay = 0;
+  stream_list_stream_drained(l, 0x3004);
+  EXPECT_EQ(1, rm_called);
+
+  stream_list_stream_drained(l, 0x3003);
+  EXPECT_EQ(2, rm_called);
+  EXPECT_EQ(1, destroy_called);
+  EXPECT_EQ(s1, destroyed_stream);
+  EXPECT_EQ(1, cancel_timer_called);
+  stream_list_destroy(l);
+}
+
 TEST(StreamList, AddInDescendingOrderByChannels) {
   struct stream_list* l;
   struct cras_rstream* s1;
@@ -202,10 +276,14 @@ struct cras_timer* cras_tm_create_timer(struct cras_tm* tm,
                                         void (*cb)(struct cras_timer* t,
                                                    void* data),
                                         void* cb_data) {
+  create_timer_called++;
+  create_timer_ms = ms;
   return reinterpret_cast<struct cras_timer*>(0x404);
 }
 
-void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {}
+void cras_tm_cancel_timer(struct cras_tm* tm, struct cras_timer* t) {
+  cancel_timer_called++;
+}
 }
 
 }  // namespace
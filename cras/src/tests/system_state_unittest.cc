@@ -3,12 +3,14 @@
 // found in the LICENSE file.
 
 #include <gtest/gtest.h>
+#include <pthread.h>
 #include <stdio.h>
 #include <string.h>
 
 extern "C" {
 #include "cras_alert.h"
 #include "cras_board_config.h"
+#include "cras_fmt_conv.h"
 #include "cras_shm.h"
 #include "cras_system_state.h"
 #include "cras_types.h"
@@ -18,6 +20,9 @@ namespace {
 static struct cras_alsa_card* kFakeAlsaCard;
 size_t cras_alsa_card_create_called;
 size_t cras_alsa_card_destroy_called;
+static size_t cras_alsa_card_probe_called;
+static size_t cras_alsa_card_add_devices_called;
+static size_t cras_alsa_card_probe_fail_index;
 static size_t add_stub_called;
 static size_t rm_stub_called;
 static size_t add_task_stub_called;
@@ -42,10 +47,16 @@ static size_t cras_observer_notify_input_streams_with_permission_called;
 static size_t cras_iodev_list_reset_for_noise_cancellation_called;
 static struct cras_board_config fake_board_config;
 static size_t cras_alert_process_all_pending_alerts_called;
+static unsigned int playback_wake_fuzz_us_val;
+static unsigned int capture_wake_fuzz_us_val;
+static enum CRAS_RESAMPLER_QUALITY default_resampler_quality_val;
 
 static void ResetStubData() {
   cras_alsa_card_create_called = 0;
   cras_alsa_card_destroy_called = 0;
+  cras_alsa_card_probe_called = 0;
+  cras_alsa_card_add_devices_called = 0;
+  cras_alsa_card_probe_fail_index = 100;
   kFakeAlsaCard = reinterpret_cast<struct cras_alsa_card*>(0x33);
   add_stub_called = 0;
   rm_stub_called = 0;
@@ -65,6 +76,9 @@ static void ResetStubData() {
   cras_alert_process_all_pending_alerts_called = 0;
   cras_iodev_list_reset_for_noise_cancellation_called = 0;
   memset(&fake_board_config, 0, sizeof(fake_board_config));
+  playback_wake_fuzz_us_val = 0;
+  capture_wake_fuzz_us_val = 0;
+  default_resampler_quality_val = CRAS_RESAMPLER_QUALITY_DEFAULT;
 }
 
 static int add_stub(int fd,
@@ -323,6 +337,53 @@ TEST(SystemStateSuite, AddCard) {
   cras_system_state_deinit();
 }
 
+TEST(SystemStateSuite, AddCards) {
+  cras_alsa_card_info infos[3];
+
+  ResetStubData();
+  for (int i = 0; i < 3; i++) {
+    infos[i].card_type = ALSA_CARD_TYPE_INTERNAL;
+    infos[i].card_index = i;
+  }
+  do_sys_init();
+  EXPECT_EQ(0, cras_system_add_alsa_cards(infos, 3));
+  EXPECT_EQ(3, cras_alsa_card_probe_called);
+  EXPECT_EQ(3, cras_alsa_card_add_devices_called);
+  for (int i = 0; i < 3; i++)
+    EXPECT_TRUE(cras_system_alsa_card_exists(i));
+
+  // Cards already added are dropped after probing.
+  EXPECT_EQ(-EEXIST, cras_system_add_alsa_cards(&infos[1], 1));
+  EXPECT_EQ(3, cras_alsa_card_add_devices_called);
+  EXPECT_EQ(1, cras_alsa_card_destroy_called);
+
+  for (int i = 0; i < 3; i++)
+    EXPECT_EQ(0, cras_system_remove_alsa_card(i));
+  EXPECT_EQ(4, cras_alsa_card_destroy_called);
+  cras_system_state_deinit();
+}
+
+TEST(SystemStateSuite, AddCardsOneFailsProbe) {
+  cras_alsa_card_info infos[3];
+
+  ResetStubData();
+  for (int i = 0; i < 3; i++) {
+    infos[i].card_type = ALSA_CARD_TYPE_INTERNAL;
+    infos[i].card_index = i;
+  }
+  cras_alsa_card_probe_fail_index = 1;
+  do_sys_init();
+  EXPECT_EQ(-ENOMEM, cras_system_add_alsa_cards(infos, 3));
+  EXPECT_EQ(3, cras_alsa_card_probe_called);
+  EXPECT_EQ(2, cras_alsa_card_add_devices_called);
+  EXPECT_TRUE(cras_system_alsa_card_exists(0));
+  EXPECT_FALSE(cras_system_alsa_card_exists(1));
+  EXPECT_TRUE(cras_system_alsa_card_exists(2));
+  cras_system_remove_alsa_card(0);
+  cras_system_remove_alsa_card(2);
+  cras_system_state_deinit();
+}
+
 TEST(SystemSettingsRegisterSelectDescriptor, AddSelectFd) {
   void* stub_data = reinterpret_cast<void*>(44);
   void* select_data = reinterpret_cast<void*>(33);
@@ -425,6 +486,184 @@ TEST(SystemSettingsStreamCount, StreamCountByDirection) {
   cras_system_state_deinit();
 }
 
+TEST(SystemStateSuite, StateChangeJournal) {
+  struct cras_server_state* state;
+  const struct cras_state_change* entry;
+
+  ResetStubData();
+  do_sys_init();
+  state = cras_system_state_get_no_lock();
+  EXPECT_EQ(0, state->journal_head);
+
+  cras_system_state_stream_added(CRAS_STREAM_OUTPUT, CRAS_CLIENT_TYPE_CHROME);
+  ASSERT_EQ(1, state->journal_head);
+  entry = &state->journal[0];
+  EXPECT_EQ(state->update_count, entry->update_count);
+  EXPECT_EQ(CRAS_STATE_CHANGE_STREAMS, entry->changes);
+
+  // An update that notes no change isn't journaled.
+  cras_system_state_update_begin();
+  cras_system_state_update_complete();
+  EXPECT_EQ(1, state->journal_head);
+
+  cras_system_state_update_begin();
+  cras_system_state_journal_change(CRAS_STATE_CHANGE_DEVICES);
+  cras_system_state_journal_change(CRAS_STATE_CHANGE_NODES);
+  cras_system_state_update_complete();
+  ASSERT_EQ(2, state->journal_head);
+  entry = &state->journal[1];
+  EXPECT_EQ(state->update_count, entry->update_count);
+  EXPECT_EQ(CRAS_STATE_CHANGE_DEVICES | CRAS_STATE_CHANGE_NODES,
+            entry->changes);
+
+  // The journal wraps around.
+  for (int i = 0; i < CRAS_STATE_JOURNAL_SIZE; i++) {
+    cras_system_state_update_begin();
+    cras_system_state_journal_change(CRAS_STATE_CHANGE_CLIENTS);
+    cras_system_state_update_complete();
+  }
+  EXPECT_EQ(CRAS_STATE_JOURNAL_SIZE + 2, state->journal_head);
+  entry = &state->journal[1];
+  EXPECT_EQ(state->update_count, entry->update_count);
+  EXPECT_EQ(CRAS_STATE_CHANGE_CLIENTS, entry->changes);
+
+  cras_system_state_stream_removed(CRAS_STREAM_OUTPUT,
+                                   CRAS_CLIENT_TYPE_CHROME);
+  cras_system_state_deinit();
+}
+
+TEST(SystemStateSuite, GetChanges) {
+  uint32_t since = 0;
+
+  ResetStubData();
+  do_sys_init();
+  cras_system_set_volume(50);
+  EXPECT_EQ(CRAS_STATE_CHANGE_ALL, cras_system_state_get_changes(&since));
+  EXPECT_EQ(0, cras_system_state_get_changes(&since));
+
+  cras_system_state_update_begin();
+  cras_system_state_journal_change(CRAS_STATE_CHANGE_NODES);
+  cras_system_state_update_complete();
+  cras_system_state_stream_added(CRAS_STREAM_OUTPUT, CRAS_CLIENT_TYPE_CHROME);
+  EXPECT_EQ(CRAS_STATE_CHANGE_NODES | CRAS_STATE_CHANGE_STREAMS,
+            cras_system_state_get_changes(&since));
+  EXPECT_EQ(0, cras_system_state_get_changes(&since));
+
+  // Older than the journal reports everything changed.
+  for (int i = 0; i <= CRAS_STATE_JOURNAL_SIZE; i++) {
+    cras_system_state_update_begin();
+    cras_system_state_journal_change(CRAS_STATE_CHANGE_CLIENTS);
+    cras_system_state_update_complete();
+  }
+  EXPECT_EQ(CRAS_STATE_CHANGE_ALL, cras_system_state_get_changes(&since));
+
+  cras_system_state_stream_removed(CRAS_STREAM_OUTPUT,
+                                   CRAS_CLIENT_TYPE_CHROME);
+  cras_system_state_deinit();
+}
+
+struct volume_snapshot_reader {
+  pthread_barrier_t snapshot_taken;
+  pthread_barrier_t volume_changed;
+  size_t volume_before;
+  size_t volume_after;
+  int mute_after;
+};
+
+static void* volume_snapshot_reader_thread(void* arg) {
+  struct volume_snapshot_reader* reader =
+      (struct volume_snapshot_reader*)arg;
+
+  cras_system_state_snapshot_volume();
+  pthread_barrier_wait(&reader->snapshot_taken);
+  pthread_barrier_wait(&reader->volume_changed);
+  // Still sees the snapshot until the next one.
+  reader->volume_before = cras_system_get_volume();
+  cras_system_state_snapshot_volume();
+  reader->volume_after = cras_system_get_volume();
+  reader->mute_after = cras_system_get_mute();
+  return NULL;
+}
+
+TEST(SystemStateSuite, VolumeSnapshot) {
+  struct cras_server_state* state;
+  struct volume_snapshot_reader reader;
+  pthread_t thread;
+
+  ResetStubData();
+  do_sys_init();
+  state = cras_system_state_get_no_lock();
+  cras_system_set_volume(40);
+  ASSERT_EQ(1, state->journal_head);
+  EXPECT_EQ(CRAS_STATE_CHANGE_VOLUME, state->journal[0].changes);
+  EXPECT_EQ(0, state->update_count & 1);
+
+  pthread_barrier_init(&reader.snapshot_taken, NULL, 2);
+  pthread_barrier_init(&reader.volume_changed, NULL, 2);
+  ASSERT_EQ(0, pthread_create(&thread, NULL, volume_snapshot_reader_thread,
+                              &reader));
+  pthread_barrier_wait(&reader.snapshot_taken);
+  cras_system_set_volume(60);
+  cras_system_set_user_mute(1);
+  pthread_barrier_wait(&reader.volume_changed);
+  pthread_join(thread, NULL);
+
+  EXPECT_EQ(40, reader.volume_before);
+  EXPECT_EQ(60, reader.volume_after);
+  EXPECT_EQ(1, reader.mute_after);
+  // The main thread keeps reading the shared state.
+  EXPECT_EQ(60, cras_system_get_volume());
+
+  pthread_barrier_destroy(&reader.snapshot_taken);
+  pthread_barrier_destroy(&reader.volume_changed);
+  cras_system_state_deinit();
+}
+
+static struct cras_audio_thread_snapshot* NewSnapshot(uint32_t num_events,
+                                                      uint32_t id) {
+  size_t size = sizeof(struct cras_audio_thread_snapshot) +
+                num_events * sizeof(struct audio_thread_event);
+  struct cras_audio_thread_snapshot* snapshot =
+      (struct cras_audio_thread_snapshot*)calloc(1, size);
+  snapshot->size = size;
+  snapshot->num_events = num_events;
+  snapshot->cpu = id;
+  return snapshot;
+}
+
+TEST(SystemStateSuite, AudioThreadSnapshots) {
+  const struct cras_audio_thread_snapshot_buffer* buf;
+  const struct cras_audio_thread_snapshot* snapshot;
+  struct cras_server_state* state;
+  uint32_t big = AUDIO_THREAD_EVENT_LOG_SIZE;
+  int i;
+
+  ResetStubData();
+  do_sys_init();
+  state = cras_system_state_get_no_lock();
+  buf = &state->snapshot_buffer;
+
+  // Only the latest CRAS_MAX_AUDIO_THREAD_SNAPSHOTS are kept.
+  for (i = 0; i < CRAS_MAX_AUDIO_THREAD_SNAPSHOTS + 2; i++)
+    cras_system_state_add_snapshot(NewSnapshot(1, i));
+  cras_system_state_dump_snapshots();
+  ASSERT_EQ(CRAS_MAX_AUDIO_THREAD_SNAPSHOTS, buf->num_snapshots);
+  snapshot = (const struct cras_audio_thread_snapshot*)buf->data;
+  EXPECT_EQ(2, snapshot->cpu);
+  EXPECT_EQ(CRAS_MAX_AUDIO_THREAD_SNAPSHOTS * snapshot->size, buf->size);
+
+  // Big snapshots push the old ones out to fit in the buffer.
+  for (i = 0; i < 5; i++)
+    cras_system_state_add_snapshot(NewSnapshot(big, 100 + i));
+  cras_system_state_dump_snapshots();
+  EXPECT_LE(buf->size, CRAS_AUDIO_THREAD_SNAPSHOT_BUFFER_SIZE);
+  ASSERT_LT(buf->num_snapshots, 5);
+  snapshot = (const struct cras_audio_thread_snapshot*)buf->data;
+  EXPECT_EQ(105 - buf->num_snapshots, snapshot->cpu);
+
+  cras_system_state_deinit();
+}
+
 TEST(SystemStateSuite, IgnoreUCMSuffix) {
   fake_board_config.ucm_ignore_suffix = strdup("TEST1,TEST2,TEST3");
   do_sys_init();
@@ -463,6 +702,34 @@ TEST(SystemStateSuite, SetNoiseCancellationEnabled) {
   cras_system_state_deinit();
 }
 
+TEST(SystemStateSuite, PerfProfile) {
+  const struct cras_server_state* state;
+
+  ResetStubData();
+  fake_board_config.rt_priority = 20;
+  fake_board_config.playback_wake_fuzz_us = 300;
+  fake_board_config.capture_wake_fuzz_us = 2000;
+  fake_board_config.resampler_quality = CRAS_RESAMPLER_QUALITY_LOW;
+  fake_board_config.max_audio_threads = 0;
+  fake_board_config.cpu_affinity = 0xc;
+  do_sys_init();
+
+  EXPECT_EQ(20, cras_system_get_rt_priority());
+  EXPECT_EQ(300, playback_wake_fuzz_us_val);
+  EXPECT_EQ(2000, capture_wake_fuzz_us_val);
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_LOW, default_resampler_quality_val);
+
+  // Clients see the profile as the server runs it.
+  state = cras_system_state_get_no_lock();
+  EXPECT_EQ(20, state->perf_profile.rt_priority);
+  EXPECT_EQ(300, state->perf_profile.playback_wake_fuzz_us);
+  EXPECT_EQ(2000, state->perf_profile.capture_wake_fuzz_us);
+  EXPECT_EQ(CRAS_RESAMPLER_QUALITY_LOW, state->perf_profile.resampler_quality);
+  EXPECT_EQ(1, state->perf_profile.max_audio_threads);
+  EXPECT_EQ(0xc, state->perf_profile.audio_thread_cpu_mask);
+  cras_system_state_deinit();
+}
+
 extern "C" {
 
 struct cras_alsa_card* cras_alsa_card_create(
@@ -474,12 +741,33 @@ struct cras_alsa_card* cras_alsa_card_create(
   return kFakeAlsaCard;
 }
 
+struct cras_alsa_card* cras_alsa_card_probe(
+    const struct cras_alsa_card_info* info,
+    const char* device_config_dir,
+    const char* ucm_suffix) {
+  // Called from several threads.
+  __atomic_fetch_add(&cras_alsa_card_probe_called, 1, __ATOMIC_RELAXED);
+  if (info->card_index == cras_alsa_card_probe_fail_index)
+    return NULL;
+  // Fake cards from probing tell their index.
+  return reinterpret_cast<struct cras_alsa_card*>(0x100 + info->card_index);
+}
+
+int cras_alsa_card_add_devices(struct cras_alsa_card* alsa_card,
+                               struct cras_alsa_card_info* info,
+                               struct cras_device_blocklist* blocklist) {
+  cras_alsa_card_add_devices_called++;
+  return 0;
+}
+
 void cras_alsa_card_destroy(struct cras_alsa_card* alsa_card) {
   cras_alsa_card_destroy_called++;
 }
 
 size_t cras_alsa_card_get_index(const struct cras_alsa_card* alsa_card) {
-  return 0;
+  uintptr_t card = reinterpret_cast<uintptr_t>(alsa_card);
+
+  return card >= 0x100 ? card - 0x100 : 0;
 }
 
 struct cras_device_blocklist* cras_device_blocklist_create(
@@ -559,6 +847,19 @@ void cras_board_config_get(const char* config_path,
   *board_config = fake_board_config;
 }
 
+void dev_io_set_playback_wake_fuzz_us(unsigned int us) {
+  playback_wake_fuzz_us_val = us;
+}
+
+void dev_stream_set_capture_wake_fuzz_us(unsigned int us) {
+  capture_wake_fuzz_us_val = us;
+}
+
+void dev_stream_set_default_resampler_quality(
+    enum CRAS_RESAMPLER_QUALITY quality) {
+  default_resampler_quality_val = quality;
+}
+
 void cras_alert_process_all_pending_alerts() {
   cras_alert_process_all_pending_alerts_called++;
 }
@@ -0,0 +1,73 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+
+#include <gtest/gtest.h>
+#include <stdint.h>
+#include <time.h>
+
+extern "C" {
+#include "cras_timebase.h"
+}
+
+namespace {
+
+static int64_t Ns(const struct timespec& ts) {
+  return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+TEST(TimebaseTest, RawToMonotonic) {
+  struct cras_timebase tb;
+  struct timespec raw, mono, converted;
+
+  cras_timebase_init(&tb, CLOCK_MONOTONIC_RAW, CLOCK_MONOTONIC);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &raw);
+  clock_gettime(CLOCK_MONOTONIC, &mono);
+  ASSERT_EQ(0, cras_timebase_convert(&tb, &raw, &converted));
+
+  EXPECT_NE(0, tb.calibrated_ns);
+  EXPECT_GE(converted.tv_nsec, 0);
+  EXPECT_LT(converted.tv_nsec, 1000000000);
+  // Within 10ms of a direct read, allowing for preemption between reads.
+  EXPECT_LT(llabs(Ns(converted) - Ns(mono)), 10000000);
+}
+
+TEST(TimebaseTest, SameClockPassesThrough) {
+  struct cras_timebase tb;
+  struct timespec ts = {.tv_sec = 12, .tv_nsec = 345};
+  struct timespec converted;
+
+  cras_timebase_init(&tb, CLOCK_MONOTONIC, CLOCK_MONOTONIC);
+  ASSERT_EQ(0, cras_timebase_convert(&tb, &ts, &converted));
+  EXPECT_EQ(12, converted.tv_sec);
+  EXPECT_EQ(345, converted.tv_nsec);
+  EXPECT_EQ(0, tb.calibrated_ns);
+}
+
+TEST(TimebaseTest, RecalibratesForDistantTimestamp) {
+  struct cras_timebase tb;
+  struct timespec now, converted;
+  int64_t calibrated;
+
+  cras_timebase_init(&tb, CLOCK_MONOTONIC_RAW, CLOCK_MONOTONIC);
+  clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+  ASSERT_EQ(0, cras_timebase_convert(&tb, &now, &converted));
+  calibrated = tb.calibrated_ns;
+
+  // Close to the last calibration, the offset is reused.
+  now.tv_nsec += now.tv_nsec < 500000000 ? 1000000 : -1000000;
+  ASSERT_EQ(0, cras_timebase_convert(&tb, &now, &converted));
+  EXPECT_EQ(calibrated, tb.calibrated_ns);
+
+  // A timestamp from long ago forces a new calibration.
+  now.tv_sec -= 1;
+  ASSERT_EQ(0, cras_timebase_convert(&tb, &now, &converted));
+  EXPECT_NE(calibrated, tb.calibrated_ns);
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -35,6 +35,7 @@ class TimingSuite : public testing::Test {
  protected:
   virtual void SetUp() {
     atlog = static_cast<audio_thread_event_log*>(calloc(1, sizeof(*atlog)));
+    atlog->len = AUDIO_THREAD_EVENT_LOG_SIZE;
     iodev_stub_reset();
     rstream_stub_reset();
   }
@@ -125,7 +126,8 @@ TEST_F(TimingSuite, NewInputStreamInit) {
   RstreamPtr rstream =
       create_rstream(1, CRAS_STREAM_INPUT, 480, &format, shm.get());
 
-  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1);
+  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1,
+                       NULL, 0);
 
   EXPECT_EQ(0, rstream->next_cb_ts.tv_sec);
   EXPECT_EQ(0, rstream->next_cb_ts.tv_nsec);
@@ -844,7 +846,8 @@ TEST_F(TimingSuite, NewOutputStreamInitExistMatchedStream) {
   RstreamPtr rstream =
       create_rstream(1, CRAS_STREAM_OUTPUT, 480, &format, shm.get());
 
-  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &out_iodev, 1);
+  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &out_iodev, 1,
+                       NULL, 0);
 
   EXPECT_EQ(in_stream->rstream->next_cb_ts.tv_sec, rstream->next_cb_ts.tv_sec);
   EXPECT_EQ(in_stream->rstream->next_cb_ts.tv_nsec,
@@ -880,7 +883,8 @@ TEST_F(TimingSuite, NewOutputStreamInitStreamInDevice) {
   RstreamPtr rstream =
       create_rstream(1, CRAS_STREAM_OUTPUT, 480, &format, shm.get());
 
-  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1);
+  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1,
+                       NULL, 0);
 
   EXPECT_EQ(stream->rstream->next_cb_ts.tv_sec, rstream->next_cb_ts.tv_sec);
   EXPECT_EQ(stream->rstream->next_cb_ts.tv_nsec, rstream->next_cb_ts.tv_nsec);
@@ -909,7 +913,8 @@ TEST_F(TimingSuite, NewOutputStreamInitNoStreamNoFramesInDevice) {
   RstreamPtr rstream =
       create_rstream(1, CRAS_STREAM_OUTPUT, 480, &format, shm.get());
 
-  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1);
+  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1,
+                       NULL, 0);
 
   EXPECT_EQ(start.tv_sec, rstream->next_cb_ts.tv_sec);
   EXPECT_EQ(start.tv_nsec, rstream->next_cb_ts.tv_nsec);
@@ -941,7 +946,8 @@ TEST_F(TimingSuite, NewOutputStreamInitNoStreamSomeFramesInDevice) {
   RstreamPtr rstream =
       create_rstream(1, CRAS_STREAM_OUTPUT, 480, &format, shm.get());
 
-  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1);
+  dev_io_append_stream(&odev_list_, &idev_list_, rstream.get(), &iodev, 1,
+                       NULL, 0);
 
   // The next_cb_ts should be 10ms from now. At that time there are
   // only 480 valid frames in the device.
@@ -1210,6 +1216,16 @@ int input_data_put_for_stream(struct input_data* data,
   return 0;
 }
 
+bool input_data_silence_gated(struct input_data* data,
+                              struct cras_rstream* stream) {
+  return false;
+}
+
+unsigned int input_data_get_processing_delay(struct input_data* data,
+                                             struct cras_rstream* stream) {
+  return 0;
+}
+
 float input_data_get_software_gain_scaler(struct input_data* data,
                                           float idev_sw_gain_scaler,
                                           struct cras_rstream* stream) {
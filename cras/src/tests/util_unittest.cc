@@ -135,6 +135,56 @@ TEST(Util, SendRecvFileDescriptor) {
   close(new_fd);
 }
 
+TEST(Util, SendRecvBatch) {
+  int sock[2];
+  int fd[2];
+  const char* sent[] = {"one", "two!", "three"};
+  size_t lens[] = {4, 5, 6};
+  char bufs[4][16];
+  int fds[4][2];
+  struct cras_recv_msg msgs[4];
+
+  ASSERT_EQ(0, pipe(fd));
+  ASSERT_EQ(0, socketpair(AF_UNIX, SOCK_SEQPACKET, 0, sock));
+
+  // One message with an fd ahead of a batch, all read in one call.
+  ASSERT_EQ(4, cras_send_with_fds(sock[0], "fd!", 4, &fd[1], 1));
+  ASSERT_EQ(3, cras_send_batch(sock[0], (const void* const*)sent, lens, 3));
+  for (unsigned int i = 0; i < 4; i++) {
+    msgs[i].buf = bufs[i];
+    msgs[i].len = sizeof(bufs[i]);
+    msgs[i].fds = fds[i];
+    msgs[i].num_fds = 2;
+  }
+  ASSERT_EQ(4, cras_recv_batch_with_fds(sock[1], msgs, 4));
+  EXPECT_EQ(4, msgs[0].len);
+  EXPECT_STREQ("fd!", bufs[0]);
+  ASSERT_EQ(1, msgs[0].num_fds);
+  EXPECT_NE(-1, fds[0][0]);
+  EXPECT_EQ(-1, fds[0][1]);
+  for (unsigned int i = 1; i < 4; i++) {
+    EXPECT_EQ(lens[i - 1], msgs[i].len);
+    EXPECT_STREQ(sent[i - 1], bufs[i]);
+    EXPECT_EQ(0, msgs[i].num_fds);
+  }
+
+  ASSERT_EQ(1, write(fds[0][0], "a", 1));
+  ASSERT_EQ(1, read(fd[0], bufs[0], 1));
+  EXPECT_EQ('a', bufs[0][0]);
+
+  // Only what is queued is returned.
+  ASSERT_EQ(1, cras_send_batch(sock[0], (const void* const*)sent, lens, 1));
+  msgs[0].len = sizeof(bufs[0]);
+  msgs[0].num_fds = 2;
+  EXPECT_EQ(1, cras_recv_batch_with_fds(sock[1], msgs, 4));
+
+  close(fds[0][0]);
+  close(fd[0]);
+  close(fd[1]);
+  close(sock[0]);
+  close(sock[1]);
+}
+
 TEST(Util, SendRecvNoDescriptors) {
   char buf[256] = {0};
   char msg[] = "no descriptors";
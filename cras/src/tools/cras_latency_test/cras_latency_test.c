@@ -0,0 +1,627 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Measures output and round trip latency. A playback stream plays a short
+ * chirp once a period, while a capture stream pinned to a loopback device
+ * and, optionally, one from a microphone record it. The chirp is found in
+ * each recording by cross-correlation, and its capture time is compared with
+ * the time the client wrote it and with the play time the server reported
+ * for it, which counts the device's hardware level and delay_frames.
+ */
+#include <errno.h>
+#include <getopt.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_client.h"
+#include "cras_types.h"
+#include "cras_util.h"
+
+#define PLAYBACK_CHANNELS 2
+#define MAX_MARKERS 1000
+
+/* Chirp sweep and length, short enough to be told apart from its echo. */
+static const double chirp_start_hz = 1000.0;
+static const double chirp_end_hz = 6000.0;
+static const unsigned int chirp_ms = 5;
+/* Correlation peaks below this are taken as the chirp not being heard. */
+static const float detect_threshold = 0.5;
+
+/* One chirp played.
+ *    frame - Index of its first frame in the playback stream.
+ *    write_ts - When the client wrote it.
+ *    reported_ts - When the server reported it would be played.
+ */
+struct marker {
+	uint64_t frame;
+	struct timespec write_ts;
+	struct timespec reported_ts;
+};
+
+/* The time stamps of one capture callback.
+ *    frame - Index of its first frame in the recording.
+ *    captured_ts - When the server reported the first frame was captured.
+ *    cb_ts - When the client received it.
+ */
+struct capture_mark {
+	uint64_t frame;
+	struct timespec captured_ts;
+	struct timespec cb_ts;
+};
+
+/* A recording of the first channel of a capture stream. */
+struct recording {
+	const char *name;
+	cras_stream_id_t id;
+	int running;
+	float *samples;
+	uint64_t num_frames;
+	uint64_t max_frames;
+	struct capture_mark *marks;
+	size_t num_marks;
+	size_t max_marks;
+};
+
+static struct {
+	size_t rate;
+	size_t block_size;
+	unsigned int period_ms;
+	unsigned int num_markers;
+	enum CRAS_NODE_TYPE loopback_type;
+	int output_dev;
+	int input_dev;
+	int mic;
+} config = {
+	.rate = 48000,
+	.block_size = 480,
+	.period_ms = 500,
+	.num_markers = 10,
+	.loopback_type = CRAS_NODE_TYPE_POST_MIX_PRE_DSP,
+	.output_dev = -1,
+	.input_dev = -1,
+};
+
+static float *chirp;
+static size_t chirp_frames;
+
+static struct marker markers[MAX_MARKERS];
+static unsigned int num_markers;
+static uint64_t frames_written;
+
+static struct recording loopback = { .name = "loopback" };
+static struct recording mic = { .name = "mic" };
+
+static double ts_to_ms(const struct timespec *ts)
+{
+	return ts->tv_sec * 1000.0 + ts->tv_nsec / 1000000.0;
+}
+
+static void add_frames_to_ts(struct timespec *ts, int64_t frames)
+{
+	struct timespec diff;
+
+	if (frames >= 0) {
+		cras_frames_to_time(frames, config.rate, &diff);
+		add_timespecs(ts, &diff);
+	} else {
+		cras_frames_to_time(-frames, config.rate, &diff);
+		subtract_timespecs(ts, &diff, ts);
+	}
+}
+
+static int create_chirp(void)
+{
+	double k, t;
+	size_t i;
+
+	chirp_frames = config.rate * chirp_ms / 1000;
+	chirp = (float *)calloc(chirp_frames, sizeof(*chirp));
+	if (!chirp)
+		return -ENOMEM;
+
+	/* Linear sweep under a Hann window. */
+	k = (chirp_end_hz - chirp_start_hz) * 1000.0 / chirp_ms;
+	for (i = 0; i < chirp_frames; i++) {
+		t = (double)i / config.rate;
+		chirp[i] = 0.5 * sin(2 * M_PI * (chirp_start_hz * t +
+						 k * t * t / 2)) *
+			   (0.5 - 0.5 * cos(2 * M_PI * i / (chirp_frames - 1)));
+	}
+	return 0;
+}
+
+/* Run from the playback stream's callback thread. */
+static int playback_callback(struct cras_client *client,
+			     cras_stream_id_t stream_id,
+			     uint8_t *captured_samples,
+			     uint8_t *playback_samples, unsigned int frames,
+			     const struct timespec *captured_time,
+			     const struct timespec *playback_time,
+			     void *user_arg)
+{
+	int16_t *out = (int16_t *)playback_samples;
+	uint64_t period = config.rate * config.period_ms / 1000;
+	struct timespec now;
+	unsigned int i, ch;
+
+	clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+	for (i = 0; i < frames; i++) {
+		uint64_t pos = frames_written + i;
+		uint64_t offset = pos % period;
+		int16_t sample = 0;
+
+		/* Leave the first period silent while the streams settle. */
+		if (pos >= period && offset < chirp_frames)
+			sample = chirp[offset] * INT16_MAX;
+		if (pos >= period && offset == 0 &&
+		    num_markers < config.num_markers) {
+			struct marker *m = &markers[num_markers++];
+
+			m->frame = pos;
+			m->write_ts = now;
+			m->reported_ts = *playback_time;
+			add_frames_to_ts(&m->reported_ts, i);
+		}
+		for (ch = 0; ch < PLAYBACK_CHANNELS; ch++)
+			out[i * PLAYBACK_CHANNELS + ch] = sample;
+	}
+	frames_written += frames;
+	return frames;
+}
+
+/* Run from the capture streams' callback threads. */
+static int capture_callback(struct cras_client *client,
+			    cras_stream_id_t stream_id,
+			    uint8_t *captured_samples,
+			    uint8_t *playback_samples, unsigned int frames,
+			    const struct timespec *captured_time,
+			    const struct timespec *playback_time,
+			    void *user_arg)
+{
+	struct recording *rec = (struct recording *)user_arg;
+	int16_t *in = (int16_t *)captured_samples;
+	struct capture_mark *mark;
+	unsigned int n, i;
+
+	if (rec->num_marks == rec->max_marks)
+		return frames;
+	n = MIN(frames, rec->max_frames - rec->num_frames);
+
+	mark = &rec->marks[rec->num_marks++];
+	mark->frame = rec->num_frames;
+	mark->captured_ts = *captured_time;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &mark->cb_ts);
+	for (i = 0; i < n; i++)
+		rec->samples[rec->num_frames++] = in[i] / (float)INT16_MAX;
+	return frames;
+}
+
+static int stream_error(struct cras_client *client, cras_stream_id_t stream_id,
+			int err, void *arg)
+{
+	fprintf(stderr, "Stream %x error %d\n", stream_id, err);
+	return 0;
+}
+
+static int alloc_recording(struct recording *rec, uint64_t frames)
+{
+	rec->max_frames = frames;
+	rec->samples = (float *)calloc(frames, sizeof(*rec->samples));
+	rec->max_marks = frames / config.block_size + 1;
+	rec->marks = (struct capture_mark *)calloc(rec->max_marks,
+						   sizeof(*rec->marks));
+	if (!rec->samples || !rec->marks)
+		return -ENOMEM;
+	return 0;
+}
+
+static void free_recording(struct recording *rec)
+{
+	free(rec->samples);
+	free(rec->marks);
+}
+
+/* Returns the capture mark holding frame. */
+static const struct capture_mark *mark_of_frame(const struct recording *rec,
+						uint64_t frame)
+{
+	size_t i;
+
+	for (i = 1; i < rec->num_marks; i++)
+		if (rec->marks[i].frame > frame)
+			break;
+	return &rec->marks[i - 1];
+}
+
+/* Returns the first recorded frame captured at ts or later. */
+static uint64_t frame_at_time(const struct recording *rec,
+			      const struct timespec *ts)
+{
+	struct timespec diff;
+	size_t i;
+
+	for (i = 0; i < rec->num_marks; i++) {
+		if (timespec_after(&rec->marks[i].captured_ts, ts))
+			break;
+	}
+	if (i == 0)
+		return 0;
+	subtract_timespecs(ts, &rec->marks[i - 1].captured_ts, &diff);
+	return MIN(rec->marks[i - 1].frame +
+			   cras_time_to_frames(&diff, config.rate),
+		   rec->num_frames);
+}
+
+/* Finds the chirp between the recorded frames start and end.
+ * Returns 0 and sets the capture time of its first frame and when the client
+ * received it, or -ENOENT if the chirp isn't heard there. */
+static int find_chirp(const struct recording *rec, uint64_t start,
+		      uint64_t end, struct timespec *captured_ts,
+		      struct timespec *cb_ts)
+{
+	const struct capture_mark *mark;
+	double chirp_energy = 0, energy = 0, corr, score, best = 0;
+	uint64_t best_frame = 0, i;
+	size_t j;
+
+	if (end > rec->num_frames)
+		end = rec->num_frames;
+	if (end < start + chirp_frames)
+		return -ENOENT;
+
+	for (j = 0; j < chirp_frames; j++) {
+		chirp_energy += chirp[j] * chirp[j];
+		energy += rec->samples[start + j] * rec->samples[start + j];
+	}
+	for (i = start; i + chirp_frames <= end; i++) {
+		if (i > start) {
+			float out = rec->samples[i - 1];
+			float in = rec->samples[i + chirp_frames - 1];
+
+			energy += in * in - out * out;
+		}
+		if (energy <= 0)
+			continue;
+		corr = 0;
+		for (j = 0; j < chirp_frames; j++)
+			corr += rec->samples[i + j] * chirp[j];
+		score = corr / sqrt(energy * chirp_energy);
+		if (score > best) {
+			best = score;
+			best_frame = i;
+		}
+	}
+	if (best < detect_threshold)
+		return -ENOENT;
+
+	mark = mark_of_frame(rec, best_frame);
+	*captured_ts = mark->captured_ts;
+	add_frames_to_ts(captured_ts, best_frame - mark->frame);
+	*cb_ts = mark->cb_ts;
+	return 0;
+}
+
+/* Returns the latency in ms of the chirp in rec from when it was written,
+ * or NAN if it isn't found. Sets rt_ms to when the client received it. */
+static double measure(const struct recording *rec, const struct marker *m,
+		      double *rt_ms)
+{
+	struct timespec from, to, captured_ts, cb_ts;
+
+	*rt_ms = NAN;
+	if (!rec->running)
+		return NAN;
+
+	/* Look from a quarter period before it was written to the next. */
+	from = m->write_ts;
+	add_frames_to_ts(&from, -(int64_t)config.rate * config.period_ms / 4000);
+	to = m->write_ts;
+	add_frames_to_ts(&to, config.rate * config.period_ms / 1000);
+	if (find_chirp(rec, frame_at_time(rec, &from), frame_at_time(rec, &to),
+		       &captured_ts, &cb_ts))
+		return NAN;
+	*rt_ms = ts_to_ms(&cb_ts) - ts_to_ms(&m->write_ts);
+	return ts_to_ms(&captured_ts) - ts_to_ms(&m->write_ts);
+}
+
+struct stat_acc {
+	double sum;
+	double min;
+	double max;
+	unsigned int n;
+};
+
+static void acc_add(struct stat_acc *acc, double v)
+{
+	if (isnan(v))
+		return;
+	if (!acc->n || v < acc->min)
+		acc->min = v;
+	if (!acc->n || v > acc->max)
+		acc->max = v;
+	acc->sum += v;
+	acc->n++;
+}
+
+static void acc_print(const char *label, const struct stat_acc *acc)
+{
+	if (!acc->n) {
+		printf("%-26s %8s\n", label, "-");
+		return;
+	}
+	printf("%-26s %8.2f %8.2f %8.2f %5u/%u\n", label, acc->sum / acc->n,
+	       acc->min, acc->max, acc->n, num_markers);
+}
+
+static void print_results(void)
+{
+	struct stat_acc reported = {}, lb = {}, dev = {}, acoustic = {},
+			error = {}, rt = {};
+	double lb_ms, mic_ms, rt_ms, unused;
+	unsigned int i;
+
+	printf("%6s %10s %10s %10s %10s\n", "marker", "reported", "loopback",
+	       "mic", "mic_to_app");
+	for (i = 0; i < num_markers; i++) {
+		const struct marker *m = &markers[i];
+		double rep_ms = ts_to_ms(&m->reported_ts) -
+				ts_to_ms(&m->write_ts);
+
+		lb_ms = measure(&loopback, m, &unused);
+		mic_ms = measure(&mic, m, &rt_ms);
+		printf("%6u %10.2f %10.2f %10.2f %10.2f\n", i, rep_ms, lb_ms,
+		       mic_ms, rt_ms);
+
+		acc_add(&reported, rep_ms);
+		acc_add(&lb, lb_ms);
+		acc_add(&dev, rep_ms - lb_ms);
+		acc_add(&acoustic, mic_ms);
+		acc_add(&error, mic_ms - rep_ms);
+		acc_add(&rt, rt_ms);
+	}
+
+	printf("\n%-26s %8s %8s %8s %7s\n", "ms", "mean", "min", "max",
+	       "found");
+	acc_print("reported output", &reported);
+	acc_print(config.loopback_type == CRAS_NODE_TYPE_POST_DSP ?
+			  "write to post dsp" :
+			  "write to post mix",
+		  &lb);
+	acc_print("reported device delay", &dev);
+	if (mic.running) {
+		acc_print("write to mic", &acoustic);
+		acc_print("mic minus reported", &error);
+		acc_print("round trip to app", &rt);
+	}
+}
+
+static struct cras_stream_params *create_params(
+	enum CRAS_STREAM_DIRECTION direction, size_t num_channels,
+	cras_unified_cb_t cb, void *arg)
+{
+	struct cras_stream_params *params;
+	struct cras_audio_format *fmt;
+
+	fmt = cras_audio_format_create(SND_PCM_FORMAT_S16_LE, config.rate,
+				       num_channels);
+	if (!fmt)
+		return NULL;
+	params = cras_client_unified_params_create(direction,
+						   config.block_size,
+						   CRAS_STREAM_TYPE_DEFAULT, 0,
+						   arg, cb, stream_error, fmt);
+	cras_audio_format_destroy(fmt);
+	return params;
+}
+
+static int add_stream(struct cras_client *client, int dev_idx,
+		      cras_stream_id_t *id, struct cras_stream_params *params)
+{
+	if (dev_idx >= 0)
+		return cras_client_add_pinned_stream(client, dev_idx, id,
+						     params);
+	return cras_client_add_stream(client, id, params);
+}
+
+static int run_test(struct cras_client *client)
+{
+	struct cras_stream_params *out_params = NULL, *lb_params = NULL,
+				  *mic_params = NULL;
+	cras_stream_id_t out_id;
+	struct timespec duration;
+	int lb_dev, rc;
+
+	lb_dev = cras_client_get_first_dev_type_idx(
+		client, config.loopback_type, CRAS_STREAM_INPUT);
+	if (lb_dev < 0) {
+		fprintf(stderr, "No loopback device.\n");
+		return lb_dev;
+	}
+
+	out_params = create_params(CRAS_STREAM_OUTPUT, PLAYBACK_CHANNELS,
+				   playback_callback, NULL);
+	lb_params = create_params(CRAS_STREAM_INPUT, 1, capture_callback,
+				  &loopback);
+	if (config.mic)
+		mic_params = create_params(CRAS_STREAM_INPUT, 1,
+					   capture_callback, &mic);
+	if (!out_params || !lb_params || (config.mic && !mic_params)) {
+		rc = -ENOMEM;
+		goto out;
+	}
+
+	/* Capture first so the first chirp can't be missed. */
+	rc = cras_client_add_pinned_stream(client, lb_dev, &loopback.id,
+					   lb_params);
+	if (rc < 0) {
+		fprintf(stderr, "Failed to add loopback stream: %d\n", rc);
+		goto out;
+	}
+	loopback.running = 1;
+	if (config.mic) {
+		rc = add_stream(client, config.input_dev, &mic.id, mic_params);
+		if (rc < 0) {
+			fprintf(stderr, "Failed to add mic stream: %d\n", rc);
+			goto out;
+		}
+		mic.running = 1;
+	}
+	rc = add_stream(client, config.output_dev, &out_id, out_params);
+	if (rc < 0) {
+		fprintf(stderr, "Failed to add playback stream: %d\n", rc);
+		goto out;
+	}
+
+	/* A settling period, the markers and a period for the last to come
+	 * back. */
+	cras_frames_to_time((uint64_t)config.rate * config.period_ms *
+				    (config.num_markers + 2) / 1000,
+			    config.rate, &duration);
+	nanosleep(&duration, NULL);
+
+	cras_client_rm_stream(client, out_id);
+out:
+	/* Removing a stream waits for its callback thread to stop, after
+	 * that the recordings are only read here. */
+	if (mic.running)
+		cras_client_rm_stream(client, mic.id);
+	if (loopback.running)
+		cras_client_rm_stream(client, loopback.id);
+	if (!rc)
+		print_results();
+	cras_client_stream_params_destroy(out_params);
+	cras_client_stream_params_destroy(lb_params);
+	cras_client_stream_params_destroy(mic_params);
+	return rc;
+}
+
+static struct option long_options[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "rate", required_argument, 0, 'r' },
+	{ "block_size", required_argument, 0, 'b' },
+	{ "period_ms", required_argument, 0, 'p' },
+	{ "markers", required_argument, 0, 'm' },
+	{ "post_dsp", no_argument, 0, 'd' },
+	{ "output_dev", required_argument, 0, 'o' },
+	{ "mic", no_argument, 0, 'i' },
+	{ "input_dev", required_argument, 0, 'I' },
+	{ 0, 0, 0, 0 }
+};
+
+static void show_usage(void)
+{
+	printf("--help - Shows this message and exits.\n");
+	printf("--rate <N> - Stream sample rate, default 48000.\n");
+	printf("--block_size <N> - Callback threshold in frames, "
+	       "default 480.\n");
+	printf("--period_ms <N> - Time between chirps, longer than the "
+	       "latency measured, default 500.\n");
+	printf("--markers <N> - Number of chirps played, default 10, "
+	       "at most %d.\n",
+	       MAX_MARKERS);
+	printf("--post_dsp - Record the loopback after the output DSP "
+	       "instead of before it.\n");
+	printf("--output_dev <N> - Play to this device instead of the "
+	       "selected output.\n");
+	printf("--mic - Also record from a microphone for the round trip.\n");
+	printf("--input_dev <N> - Record the microphone from this device "
+	       "instead of the selected input.\n");
+	printf("Latencies are in ms from when the client wrote each chirp.\n");
+}
+
+int main(int argc, char **argv)
+{
+	struct cras_client *client;
+	uint64_t max_frames;
+	int c, option_index = 0;
+	int rc;
+
+	while (1) {
+		c = getopt_long(argc, argv, "h", long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'r':
+			config.rate = atoi(optarg);
+			break;
+		case 'b':
+			config.block_size = atoi(optarg);
+			break;
+		case 'p':
+			config.period_ms = atoi(optarg);
+			break;
+		case 'm':
+			config.num_markers = atoi(optarg);
+			break;
+		case 'd':
+			config.loopback_type = CRAS_NODE_TYPE_POST_DSP;
+			break;
+		case 'o':
+			config.output_dev = atoi(optarg);
+			break;
+		case 'i':
+			config.mic = 1;
+			break;
+		case 'I':
+			config.mic = 1;
+			config.input_dev = atoi(optarg);
+			break;
+		default:
+			show_usage();
+			return 0;
+		}
+	}
+
+	if (!config.rate || !config.block_size ||
+	    config.period_ms <= 2 * chirp_ms || !config.num_markers ||
+	    config.num_markers > MAX_MARKERS) {
+		show_usage();
+		return -EINVAL;
+	}
+
+	rc = create_chirp();
+	if (rc)
+		return rc;
+	/* Room for everything captured while the streams run, and some. */
+	max_frames = (uint64_t)config.rate * config.period_ms *
+		     (config.num_markers + 4) / 1000;
+	rc = alloc_recording(&loopback, max_frames);
+	if (!rc && config.mic)
+		rc = alloc_recording(&mic, max_frames);
+	if (rc)
+		goto free_exit;
+
+	rc = cras_client_create(&client);
+	if (rc < 0) {
+		fprintf(stderr, "Couldn't create client.\n");
+		goto free_exit;
+	}
+	rc = cras_client_connect(client);
+	if (rc) {
+		fprintf(stderr, "Couldn't connect to server.\n");
+		goto destroy_exit;
+	}
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client);
+
+	printf("%zu Hz, block %zu, %u chirps every %u ms\n", config.rate,
+	       config.block_size, config.num_markers, config.period_ms);
+	rc = run_test(client);
+
+	cras_client_stop(client);
+destroy_exit:
+	cras_client_destroy(client);
+free_exit:
+	free_recording(&loopback);
+	free_recording(&mic);
+	free(chirp);
+	return rc;
+}
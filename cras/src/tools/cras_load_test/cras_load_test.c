@@ -0,0 +1,600 @@
+/* Copyright 2021 The Chromium OS Authors. All rights reserved.
+ * Use of this source code is governed by a BSD-style license that can be
+ * found in the LICENSE file.
+ *
+ * Synthetic load for server scaling tests. Runs a number of playback and
+ * capture streams whose clients answer after a configurable delay, removing
+ * and re-adding them at a configurable rate. Every interval it prints the CPU
+ * used by the server process, and the audio thread wakes, missed callbacks
+ * and underruns counted in the audio thread log.
+ */
+#include <dirent.h>
+#include <errno.h>
+#include <getopt.h>
+#include <inttypes.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/param.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "cras_client.h"
+#include "cras_types.h"
+#include "cras_util.h"
+
+#define MAX_LOAD_STREAMS 64
+
+/* How often the audio thread log is read, it must not lap in between. */
+static const struct timespec tick_ts = { 0, 50 * 1000 * 1000 /* 50 ms. */ };
+
+enum response_dist {
+	RESPONSE_CONST,
+	RESPONSE_UNIFORM,
+	RESPONSE_EXP,
+};
+
+struct load_stream {
+	cras_stream_id_t id;
+	struct cras_stream_params *params;
+	unsigned int seed;
+	int running;
+};
+
+/* Counts of one reporting interval.
+ *    wakes - Audio thread wakes.
+ *    missed_cb - Fetches skipped because a client hadn't answered in time.
+ *    underruns, severe_underruns - Output device underruns.
+ *    missing - Log events lost because the log lapped between reads.
+ */
+struct load_counts {
+	uint64_t wakes;
+	uint64_t missed_cb;
+	uint64_t underruns;
+	uint64_t severe_underruns;
+	uint64_t missing;
+};
+
+static struct {
+	size_t rate;
+	size_t num_channels;
+	size_t block_size;
+	snd_pcm_format_t format;
+	int aec;
+	int ns;
+	int agc;
+	enum response_dist dist;
+	unsigned int response_us;
+	unsigned int spread_us;
+	unsigned int churn_ms;
+	unsigned int duration_sec;
+	unsigned int interval_sec;
+} config = {
+	.rate = 48000,
+	.num_channels = 2,
+	.block_size = 480,
+	.format = SND_PCM_FORMAT_S16_LE,
+	.dist = RESPONSE_CONST,
+	.duration_sec = 30,
+	.interval_sec = 5,
+};
+
+static struct load_stream streams[MAX_LOAD_STREAMS];
+static unsigned int num_streams;
+static unsigned int num_playback;
+
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static struct {
+	const char *name;
+	snd_pcm_format_t format;
+} supported_formats[] = {
+	{ "S16_LE", SND_PCM_FORMAT_S16_LE },
+	{ "S24_LE", SND_PCM_FORMAT_S24_LE },
+	{ "S32_LE", SND_PCM_FORMAT_S32_LE },
+	{ NULL, 0 },
+};
+
+/* Returns how long a client takes to answer, in microseconds. */
+static unsigned int response_time_us(unsigned int *seed)
+{
+	double u = (double)rand_r(seed) / ((double)RAND_MAX + 1.0);
+
+	switch (config.dist) {
+	case RESPONSE_UNIFORM:
+		if (config.spread_us > config.response_us)
+			return u * (config.response_us + config.spread_us);
+		return config.response_us - config.spread_us +
+		       u * 2 * config.spread_us;
+	case RESPONSE_EXP:
+		return -log(1.0 - u) * config.response_us;
+	default:
+		return config.response_us;
+	}
+}
+
+static void respond_after_delay(struct load_stream *stream)
+{
+	unsigned int us = response_time_us(&stream->seed);
+	struct timespec ts = { us / 1000000, (us % 1000000) * 1000 };
+
+	if (us)
+		nanosleep(&ts, NULL);
+}
+
+/* Run from the stream's callback thread. */
+static int load_callback(struct cras_client *client,
+			 cras_stream_id_t stream_id, uint8_t *captured_samples,
+			 uint8_t *playback_samples, unsigned int frames,
+			 const struct timespec *captured_time,
+			 const struct timespec *playback_time, void *user_arg)
+{
+	struct load_stream *stream = (struct load_stream *)user_arg;
+
+	respond_after_delay(stream);
+	if (playback_samples)
+		memset(playback_samples, 0,
+		       frames * snd_pcm_format_physical_width(config.format) /
+			       8 * config.num_channels);
+	return frames;
+}
+
+static int load_stream_error(struct cras_client *client,
+			     cras_stream_id_t stream_id, int err, void *arg)
+{
+	struct load_stream *stream = (struct load_stream *)arg;
+
+	fprintf(stderr, "Stream %x error %d\n", stream_id, err);
+	stream->running = 0;
+	return 0;
+}
+
+static int create_stream_params(struct load_stream *stream,
+				enum CRAS_STREAM_DIRECTION direction)
+{
+	struct cras_audio_format *fmt;
+
+	fmt = cras_audio_format_create(config.format, config.rate,
+				       config.num_channels);
+	if (!fmt)
+		return -ENOMEM;
+	stream->params = cras_client_unified_params_create(
+		direction, config.block_size, CRAS_STREAM_TYPE_DEFAULT, 0,
+		stream, load_callback, load_stream_error, fmt);
+	cras_audio_format_destroy(fmt);
+	if (!stream->params)
+		return -ENOMEM;
+
+	if (direction == CRAS_STREAM_INPUT) {
+		if (config.aec)
+			cras_client_stream_params_enable_aec(stream->params);
+		if (config.ns)
+			cras_client_stream_params_enable_ns(stream->params);
+		if (config.agc)
+			cras_client_stream_params_enable_agc(stream->params);
+	}
+	return 0;
+}
+
+static int start_load_stream(struct cras_client *client,
+			     struct load_stream *stream)
+{
+	int rc;
+
+	rc = cras_client_add_stream(client, &stream->id, stream->params);
+	if (rc < 0) {
+		fprintf(stderr, "Failed to add stream: %d\n", rc);
+		return rc;
+	}
+	stream->running = 1;
+	return 0;
+}
+
+static void stop_load_stream(struct cras_client *client,
+			     struct load_stream *stream)
+{
+	if (!stream->running)
+		return;
+	cras_client_rm_stream(client, stream->id);
+	stream->running = 0;
+}
+
+/* Returns the pid of the server, 0 if it isn't found. */
+static pid_t find_server_pid(void)
+{
+	struct dirent *ent;
+	char path[sizeof("/proc//comm") + sizeof(ent->d_name)];
+	char comm[32];
+	pid_t pid = 0;
+	DIR *dir;
+	FILE *f;
+
+	dir = opendir("/proc");
+	if (!dir)
+		return 0;
+	while (!pid && (ent = readdir(dir))) {
+		if (ent->d_name[0] < '0' || ent->d_name[0] > '9')
+			continue;
+		snprintf(path, sizeof(path), "/proc/%s/comm", ent->d_name);
+		f = fopen(path, "r");
+		if (!f)
+			continue;
+		if (fgets(comm, sizeof(comm), f) && !strcmp(comm, "cras\n"))
+			pid = atoi(ent->d_name);
+		fclose(f);
+	}
+	closedir(dir);
+	return pid;
+}
+
+/* Returns the user and system CPU time of pid in clock ticks, or 0. */
+static uint64_t read_cpu_ticks(pid_t pid)
+{
+	char path[64];
+	unsigned long utime, stime;
+	char *p, buf[1024];
+	FILE *f;
+	int i;
+
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+	f = fopen(path, "r");
+	if (!f)
+		return 0;
+	p = fgets(buf, sizeof(buf), f);
+	fclose(f);
+	if (!p)
+		return 0;
+
+	/* The command name may hold spaces, fields are counted after it. */
+	p = strrchr(buf, ')');
+	for (i = 0; p && i < 12; i++)
+		p = strchr(p + 1, ' ');
+	if (!p || sscanf(p, " %lu %lu", &utime, &stime) != 2)
+		return 0;
+	return utime + stime;
+}
+
+static void count_events(const struct audio_thread_event_log *log, int len,
+			 struct load_counts *counts)
+{
+	int i;
+
+	for (i = 0; i < len; i++) {
+		switch (log->log[i].tag_sec >> 24) {
+		case AUDIO_THREAD_WAKE:
+			counts->wakes++;
+			break;
+		case AUDIO_THREAD_STREAM_SKIP_CB:
+			counts->missed_cb++;
+			break;
+		case AUDIO_THREAD_UNDERRUN:
+			counts->underruns++;
+			break;
+		case AUDIO_THREAD_SEVERE_UNDERRUN:
+			counts->severe_underruns++;
+			break;
+		default:
+			break;
+		}
+	}
+}
+
+static void print_counts(const char *label, double secs, double cpu_secs,
+			 const struct load_counts *counts)
+{
+	unsigned int running = 0, i;
+
+	for (i = 0; i < num_streams; i++)
+		running += streams[i].running;
+
+	printf("%-8s %7.1f %7u ", label, secs, running);
+	if (cpu_secs >= 0)
+		printf("%6.1f%% ", 100.0 * cpu_secs / secs);
+	else
+		printf("%7s ", "-");
+	printf("%9.1f %9" PRIu64 " %9" PRIu64 " %6" PRIu64 " %7" PRIu64 "\n",
+	       counts->wakes / secs, counts->missed_cb, counts->underruns,
+	       counts->severe_underruns, counts->missing);
+}
+
+static void unlock_main_thread(struct cras_client *client)
+{
+	pthread_mutex_lock(&done_mutex);
+	pthread_cond_signal(&done_cond);
+	pthread_mutex_unlock(&done_mutex);
+}
+
+static int wait_for_atlog_access(struct cras_client *client)
+{
+	struct timespec wait_time;
+	int rc;
+
+	cras_client_get_atlog_access(client, unlock_main_thread);
+	clock_gettime(CLOCK_REALTIME, &wait_time);
+	wait_time.tv_sec += 2;
+
+	pthread_mutex_lock(&done_mutex);
+	rc = pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
+	pthread_mutex_unlock(&done_mutex);
+	return rc;
+}
+
+static int run_load(struct cras_client *client)
+{
+	static struct audio_thread_event_log log;
+	struct load_counts interval = {}, total = {};
+	struct timespec start, now, last_report, last_churn, diff;
+	uint64_t read_idx = 0, missing, start_ticks = 0, last_ticks = 0;
+	double clk_tck = sysconf(_SC_CLK_TCK);
+	unsigned int next_churn = 0;
+	pid_t server_pid;
+	unsigned int i;
+	int len;
+
+	server_pid = find_server_pid();
+	if (!server_pid)
+		fprintf(stderr, "Server process not found, no CPU usage.\n");
+
+	if (wait_for_atlog_access(client)) {
+		fprintf(stderr, "Failed to get audio thread log.\n");
+		return -EIO;
+	}
+	/* Start counting from the current end of the log. */
+	while (cras_client_read_atlog(client, &read_idx, &missing, &log) > 0)
+		;
+
+	for (i = 0; i < num_streams; i++)
+		start_load_stream(client, &streams[i]);
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	last_report = last_churn = start;
+	if (server_pid)
+		start_ticks = last_ticks = read_cpu_ticks(server_pid);
+
+	printf("%-8s %7s %7s %7s %9s %9s %9s %6s %7s\n", "", "time_s",
+	       "streams", "cpu", "wakes/s", "missed_cb", "underruns", "severe",
+	       "missing");
+
+	while (1) {
+		nanosleep(&tick_ts, NULL);
+		clock_gettime(CLOCK_MONOTONIC, &now);
+
+		len = cras_client_read_atlog(client, &read_idx, &missing, &log);
+		if (len < 0) {
+			fprintf(stderr, "Failed to read audio thread log.\n");
+			break;
+		}
+		count_events(&log, len, &interval);
+		interval.missing += missing;
+
+		subtract_timespecs(&now, &last_churn, &diff);
+		if (config.churn_ms && num_streams &&
+		    diff.tv_sec * 1000 + diff.tv_nsec / 1000000 >=
+			    config.churn_ms) {
+			stop_load_stream(client, &streams[next_churn]);
+			start_load_stream(client, &streams[next_churn]);
+			next_churn = (next_churn + 1) % num_streams;
+			last_churn = now;
+		}
+
+		subtract_timespecs(&now, &last_report, &diff);
+		if (diff.tv_sec < config.interval_sec)
+			continue;
+
+		uint64_t ticks = server_pid ? read_cpu_ticks(server_pid) : 0;
+		print_counts("interval",
+			     diff.tv_sec + diff.tv_nsec / 1000000000.0,
+			     server_pid ? (ticks - last_ticks) / clk_tck : -1,
+			     &interval);
+		last_ticks = ticks;
+		last_report = now;
+		total.wakes += interval.wakes;
+		total.missed_cb += interval.missed_cb;
+		total.underruns += interval.underruns;
+		total.severe_underruns += interval.severe_underruns;
+		total.missing += interval.missing;
+		memset(&interval, 0, sizeof(interval));
+
+		subtract_timespecs(&now, &start, &diff);
+		if (diff.tv_sec >= config.duration_sec)
+			break;
+	}
+
+	for (i = 0; i < num_streams; i++)
+		stop_load_stream(client, &streams[i]);
+
+	subtract_timespecs(&last_report, &start, &diff);
+	print_counts("total", diff.tv_sec + diff.tv_nsec / 1000000000.0,
+		     server_pid ? (last_ticks - start_ticks) / clk_tck : -1,
+		     &total);
+	return 0;
+}
+
+static int parse_response(const char *arg)
+{
+	char dist[16];
+	int n;
+
+	config.spread_us = 0;
+	n = sscanf(arg, "%15[a-z]:%u:%u", dist, &config.response_us,
+		   &config.spread_us);
+	if (n < 2)
+		return -EINVAL;
+	if (!strcmp(dist, "const"))
+		config.dist = RESPONSE_CONST;
+	else if (!strcmp(dist, "uniform"))
+		config.dist = RESPONSE_UNIFORM;
+	else if (!strcmp(dist, "exp"))
+		config.dist = RESPONSE_EXP;
+	else
+		return -EINVAL;
+	return 0;
+}
+
+static int parse_effects(char *arg)
+{
+	char *effect;
+
+	for (effect = strtok(arg, ","); effect; effect = strtok(NULL, ",")) {
+		if (!strcmp(effect, "aec"))
+			config.aec = 1;
+		else if (!strcmp(effect, "ns"))
+			config.ns = 1;
+		else if (!strcmp(effect, "agc"))
+			config.agc = 1;
+		else
+			return -EINVAL;
+	}
+	return 0;
+}
+
+static struct option long_options[] = {
+	{ "help", no_argument, 0, 'h' },
+	{ "playback", required_argument, 0, 'p' },
+	{ "capture", required_argument, 0, 'c' },
+	{ "rate", required_argument, 0, 'r' },
+	{ "num_channels", required_argument, 0, 'n' },
+	{ "format", required_argument, 0, 'f' },
+	{ "block_size", required_argument, 0, 'b' },
+	{ "effects", required_argument, 0, 'e' },
+	{ "response", required_argument, 0, 'R' },
+	{ "churn_ms", required_argument, 0, 'C' },
+	{ "duration", required_argument, 0, 'd' },
+	{ "interval", required_argument, 0, 'i' },
+	{ 0, 0, 0, 0 }
+};
+
+static void show_usage(void)
+{
+	printf("--help - Shows this message and exits.\n");
+	printf("--playback <N> - Number of playback streams.\n");
+	printf("--capture <N> - Number of capture streams.\n");
+	printf("--rate <N> - Stream sample rate, default 48000.\n");
+	printf("--num_channels <N> - Stream channels, default 2.\n");
+	printf("--format <name> - S16_LE, S24_LE or S32_LE.\n");
+	printf("--block_size <N> - Callback threshold in frames, "
+	       "default 480.\n");
+	printf("--effects <list> - Comma separated effects of capture "
+	       "streams: aec, ns, agc.\n");
+	printf("--response <dist>:<us>[:<spread_us>] - Time clients take to "
+	       "answer a callback. dist is const, uniform (us +/- spread_us) "
+	       "or exp (mean us). Default const:0.\n");
+	printf("--churn_ms <N> - Remove and re-add one stream every N ms.\n");
+	printf("--duration <N> - Seconds to run, default 30.\n");
+	printf("--interval <N> - Seconds between reports, default 5.\n");
+	printf("At most %d streams in total.\n", MAX_LOAD_STREAMS);
+}
+
+int main(int argc, char **argv)
+{
+	struct cras_client *client;
+	unsigned int num_capture = 0;
+	int c, option_index = 0;
+	unsigned int i;
+	int rc;
+
+	while (1) {
+		c = getopt_long(argc, argv, "h", long_options, &option_index);
+		if (c == -1)
+			break;
+		switch (c) {
+		case 'p':
+			num_playback = atoi(optarg);
+			break;
+		case 'c':
+			num_capture = atoi(optarg);
+			break;
+		case 'r':
+			config.rate = atoi(optarg);
+			break;
+		case 'n':
+			config.num_channels = atoi(optarg);
+			break;
+		case 'f':
+			for (i = 0; supported_formats[i].name; i++) {
+				if (!strcasecmp(optarg,
+						supported_formats[i].name)) {
+					config.format =
+						supported_formats[i].format;
+					break;
+				}
+			}
+			if (!supported_formats[i].name) {
+				printf("Unsupported format: %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'b':
+			config.block_size = atoi(optarg);
+			break;
+		case 'e':
+			if (parse_effects(optarg)) {
+				printf("Unsupported effects: %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'R':
+			if (parse_response(optarg)) {
+				printf("Invalid response time: %s\n", optarg);
+				return -EINVAL;
+			}
+			break;
+		case 'C':
+			config.churn_ms = atoi(optarg);
+			break;
+		case 'd':
+			config.duration_sec = atoi(optarg);
+			break;
+		case 'i':
+			config.interval_sec = MAX(atoi(optarg), 1);
+			break;
+		default:
+			show_usage();
+			return 0;
+		}
+	}
+
+	num_streams = num_playback + num_capture;
+	if (!num_streams || num_streams > MAX_LOAD_STREAMS) {
+		show_usage();
+		return -EINVAL;
+	}
+
+	for (i = 0; i < num_streams; i++) {
+		streams[i].seed = i + 1;
+		rc = create_stream_params(&streams[i], i < num_playback ?
+								CRAS_STREAM_OUTPUT :
+								CRAS_STREAM_INPUT);
+		if (rc)
+			return rc;
+	}
+
+	rc = cras_client_create(&client);
+	if (rc < 0) {
+		fprintf(stderr, "Couldn't create client.\n");
+		return rc;
+	}
+	rc = cras_client_connect(client);
+	if (rc) {
+		fprintf(stderr, "Couldn't connect to server.\n");
+		goto destroy_exit;
+	}
+	cras_client_run_thread(client);
+	cras_client_connected_wait(client);
+
+	printf("%u playback, %u capture, %zu Hz, %zu ch, block %zu\n",
+	       num_playback, num_capture, config.rate, config.num_channels,
+	       config.block_size);
+	rc = run_load(client);
+
+	cras_client_stop(client);
+destroy_exit:
+	cras_client_destroy(client);
+	for (i = 0; i < num_streams; i++)
+		cras_client_stream_params_destroy(streams[i].params);
+	return rc;
+}
@@ -9,9 +9,11 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
 #include <sys/select.h>
+#include <time.h>
 #include <unistd.h>
 
 #include "cras_client.h"
@@ -188,6 +190,569 @@ static void server_connection_callback(struct cras_client *client,
 	printf("server %s\n", status_str);
 }
 
+static void set_observer_callbacks(struct cras_client *client)
+{
+	cras_client_set_output_volume_changed_callback(client,
+						       output_volume_changed);
+	cras_client_set_output_mute_changed_callback(client,
+						     output_mute_changed);
+	cras_client_set_capture_mute_changed_callback(client,
+						      capture_mute_changed);
+	cras_client_set_nodes_changed_callback(client, nodes_changed);
+	cras_client_set_active_node_changed_callback(client,
+						     active_node_changed);
+	cras_client_set_output_node_volume_changed_callback(
+		client, output_node_volume_changed);
+	cras_client_set_node_left_right_swapped_changed_callback(
+		client, node_left_right_swapped_changed);
+	cras_client_set_input_node_gain_changed_callback(
+		client, input_node_gain_changed);
+	cras_client_set_num_active_streams_changed_callback(
+		client, num_active_streams_changed);
+	cras_client_set_state_change_callback_context(client, client);
+}
+
+/* Live mode polls the audio and main thread debug info every interval. The
+ * info callbacks run on the client thread and only wake the main thread
+ * through live_pipe, which then copies and draws the snapshots. Rates and
+ * counter increments are taken between two consecutive snapshots.
+ */
+enum live_request {
+	LIVE_IDLE,
+	LIVE_AUDIO,
+	LIVE_MAIN,
+};
+
+struct live_snapshot {
+	struct timespec ts;
+	struct audio_debug_info audio;
+	struct main_thread_debug_info main;
+};
+
+/* Percentiles in microseconds of the durations recorded in an interval. */
+struct live_hist_stats {
+	uint64_t count;
+	uint32_t p50;
+	uint32_t p90;
+	uint32_t p99;
+	uint32_t max;
+};
+
+/* The CPU time of the streams of a client over an interval. */
+struct live_client_cpu {
+	uint32_t client_id;
+	unsigned int num_streams;
+	uint64_t cpu_ns;
+};
+
+static int live_pipe[2] = { -1, -1 };
+static struct live_snapshot live_snapshots[2];
+
+static void live_info_ready(struct cras_client *client)
+{
+	char c = 0;
+
+	if (write(live_pipe[1], &c, 1) < 0)
+		syslog(LOG_ERR, "Couldn't wake main thread: %s",
+		       strerror(errno));
+}
+
+static uint32_t count_delta(uint32_t cur, uint32_t prev)
+{
+	return cur >= prev ? cur - prev : cur;
+}
+
+/* Fills stats with the durations cur recorded since prev. A histogram that
+ * went backwards belongs to a reopened device or stream and is used whole.
+ * The maximum can't be split per interval and is the overall one. */
+static void hist_stats(const struct cras_latency_hist *cur,
+		       const struct cras_latency_hist *prev,
+		       struct live_hist_stats *stats)
+{
+	struct cras_latency_hist delta;
+	unsigned int i;
+
+	delta = *cur;
+	for (i = 0; prev && i < CRAS_LATENCY_HIST_BUCKETS; i++) {
+		if (cur->counts[i] < prev->counts[i]) {
+			delta = *cur;
+			break;
+		}
+		delta.counts[i] = cur->counts[i] - prev->counts[i];
+	}
+	stats->count = cras_latency_hist_count(&delta);
+	stats->p50 = cras_latency_hist_percentile(&delta, 50);
+	stats->p90 = cras_latency_hist_percentile(&delta, 90);
+	stats->p99 = cras_latency_hist_percentile(&delta, 99);
+	stats->max = delta.max_usec;
+}
+
+static const char *stage_name(enum CRAS_STREAM_DIRECTION direction,
+			      unsigned int stage)
+{
+	static const char *const output_names[] = { "fetch", "write" };
+	static const char *const input_names[] = { "capture", "send" };
+
+	return direction == CRAS_STREAM_INPUT ? input_names[stage] :
+						output_names[stage];
+}
+
+static const struct audio_dev_debug_info *
+find_dev(const struct audio_debug_info *info,
+	 const struct audio_dev_debug_info *dev)
+{
+	unsigned int i;
+
+	for (i = 0; i < info->num_devs && i < MAX_DEBUG_DEVS; i++) {
+		if (info->devs[i].direction == dev->direction &&
+		    strncmp(info->devs[i].dev_name, dev->dev_name,
+			    sizeof(dev->dev_name)) == 0)
+			return &info->devs[i];
+	}
+	return NULL;
+}
+
+static const struct audio_stream_debug_info *
+find_stream(const struct audio_debug_info *info, uint64_t stream_id)
+{
+	unsigned int i;
+
+	for (i = 0; i < info->num_streams && i < MAX_DEBUG_STREAMS; i++) {
+		if (info->streams[i].stream_id == stream_id)
+			return &info->streams[i];
+	}
+	return NULL;
+}
+
+/* Returns the CPU time a stream took since prev, or since it was added if it
+ * is new. */
+static uint64_t stream_cpu_ns(const struct audio_stream_debug_info *stream,
+			      const struct audio_stream_debug_info *prev)
+{
+	if (prev && stream->cpu_ns >= prev->cpu_ns)
+		return stream->cpu_ns - prev->cpu_ns;
+	return stream->cpu_ns;
+}
+
+/* Counts the audio thread wakes logged after *last_ns and moves *last_ns to
+ * the newest. Wakes that scrolled out of the log between two polls are
+ * missed, so very high wake rates read low. */
+static unsigned int count_new_wakes(const struct audio_thread_event_log *log,
+				    uint64_t *last_ns)
+{
+	const struct audio_thread_event *ev;
+	uint64_t ns, newest = *last_ns;
+	unsigned int i, len, wakes = 0;
+
+	len = log->len < AUDIO_THREAD_EVENT_LOG_SIZE ?
+		      log->len :
+		      AUDIO_THREAD_EVENT_LOG_SIZE;
+	for (i = 0; i < len; i++) {
+		ev = &log->log[i];
+		if (((ev->tag_sec >> 24) & 0xff) != AUDIO_THREAD_WAKE)
+			continue;
+		ns = (uint64_t)(ev->tag_sec & 0x00ffffff) * 1000000000ULL +
+		     ev->nsec;
+		if (ns <= *last_ns)
+			continue;
+		wakes++;
+		if (ns > newest)
+			newest = ns;
+	}
+	*last_ns = newest;
+	return wakes;
+}
+
+/* Sums the CPU time of the streams per client. Returns the number of
+ * clients. */
+static unsigned int sum_client_cpu(const struct audio_debug_info *cur,
+				   const struct audio_debug_info *prev,
+				   struct live_client_cpu *clients)
+{
+	const struct audio_stream_debug_info *stream;
+	unsigned int i, j, num_clients = 0;
+	uint32_t client_id;
+
+	for (i = 0; i < cur->num_streams && i < MAX_DEBUG_STREAMS; i++) {
+		stream = &cur->streams[i];
+		client_id = stream->stream_id >> 16;
+		for (j = 0; j < num_clients; j++)
+			if (clients[j].client_id == client_id)
+				break;
+		if (j == num_clients) {
+			clients[j].client_id = client_id;
+			clients[j].num_streams = 0;
+			clients[j].cpu_ns = 0;
+			num_clients++;
+		}
+		clients[j].num_streams++;
+		clients[j].cpu_ns += stream_cpu_ns(
+			stream, find_stream(prev, stream->stream_id));
+	}
+	return num_clients;
+}
+
+static double percent_of(uint64_t ns, uint64_t interval_ns)
+{
+	return interval_ns ? 100.0 * ns / interval_ns : 0;
+}
+
+static void print_dashboard_hist(const char *name,
+				 const struct live_hist_stats *stats)
+{
+	printf("    %-8s count %6" PRIu64 "  p50 %6u  p90 %6u  p99 %6u"
+	       "  max %6u\n",
+	       name, stats->count, stats->p50, stats->p90, stats->p99,
+	       stats->max);
+}
+
+static void print_dashboard(const struct live_snapshot *cur,
+			    const struct live_snapshot *prev,
+			    uint64_t interval_ns, unsigned int wakes,
+			    unsigned int interval_ms)
+{
+	const struct audio_dev_debug_info *dev, *prev_dev;
+	const struct audio_stream_debug_info *stream, *prev_stream;
+	struct live_client_cpu clients[MAX_DEBUG_STREAMS];
+	struct live_hist_stats stats;
+	double sec = interval_ns / 1000000000.0;
+	unsigned int i, stage, num_clients;
+
+	/* Moves to the top left and clears the screen. */
+	printf("\033[H\033[2J");
+	printf("cras_monitor live, every %u ms, press q to quit\n\n",
+	       interval_ms);
+
+	printf("Audio thread: cpu %d  wakes/s %.1f  migrations +%u"
+	       "  faults minor +%u major +%u\n",
+	       cur->audio.cpu, wakes / sec,
+	       count_delta(cur->audio.cpu_migrations,
+			   prev->audio.cpu_migrations),
+	       count_delta(cur->audio.minor_faults, prev->audio.minor_faults),
+	       count_delta(cur->audio.major_faults, prev->audio.major_faults));
+	hist_stats(&cur->main.loop_hist, &prev->main.loop_hist, &stats);
+	printf("Main thread: loops/s %.1f  stalls +%u\n", stats.count / sec,
+	       count_delta(cur->main.num_stalls, prev->main.num_stalls));
+	print_dashboard_hist("loop", &stats);
+
+	printf("\nDevices:\n");
+	for (i = 0; i < cur->audio.num_devs && i < MAX_DEBUG_DEVS; i++) {
+		dev = &cur->audio.devs[i];
+		prev_dev = find_dev(&prev->audio, dev);
+		printf("  %-6s %-32.*s underruns +%u (%u)  severe +%u (%u)\n",
+		       dev->direction == CRAS_STREAM_INPUT ? "Input" :
+							     "Output",
+		       (int)sizeof(dev->dev_name), dev->dev_name,
+		       count_delta(dev->num_underruns,
+				   prev_dev ? prev_dev->num_underruns : 0),
+		       dev->num_underruns,
+		       count_delta(dev->num_severe_underruns,
+				   prev_dev ? prev_dev->num_severe_underruns :
+					      0),
+		       dev->num_severe_underruns);
+		for (stage = 0; stage < CRAS_NUM_DEV_IO_STAGES; stage++) {
+			hist_stats(&dev->stage_hist[stage],
+				   prev_dev ? &prev_dev->stage_hist[stage] :
+					      NULL,
+				   &stats);
+			print_dashboard_hist(stage_name(dev->direction, stage),
+					     &stats);
+		}
+	}
+
+	printf("\nStreams:\n");
+	for (i = 0; i < cur->audio.num_streams && i < MAX_DEBUG_STREAMS; i++) {
+		stream = &cur->audio.streams[i];
+		prev_stream = find_stream(&prev->audio, stream->stream_id);
+		printf("  0x%.6" PRIx64 " %-6s %-26s cpu %5.2f%%"
+		       "  missed_cb +%u (%u)  overruns +%u (%u)\n",
+		       stream->stream_id,
+		       stream->direction == CRAS_STREAM_INPUT ? "Input" :
+								"Output",
+		       cras_client_type_str(stream->client_type),
+		       percent_of(stream_cpu_ns(stream, prev_stream),
+				  interval_ns),
+		       count_delta(stream->num_missed_cb,
+				   prev_stream ? prev_stream->num_missed_cb :
+						 0),
+		       stream->num_missed_cb,
+		       count_delta(stream->num_overruns,
+				   prev_stream ? prev_stream->num_overruns : 0),
+		       stream->num_overruns);
+		for (stage = 0; stage < CRAS_NUM_DEV_IO_STAGES; stage++) {
+			hist_stats(&stream->stage_hist[stage],
+				   prev_stream ?
+					   &prev_stream->stage_hist[stage] :
+					   NULL,
+				   &stats);
+			print_dashboard_hist(
+				stage_name(stream->direction, stage), &stats);
+		}
+	}
+
+	printf("\nClients:\n");
+	num_clients = sum_client_cpu(&cur->audio, &prev->audio, clients);
+	for (i = 0; i < num_clients; i++)
+		printf("  client %-5u streams %u  cpu %5.2f%%\n",
+		       clients[i].client_id, clients[i].num_streams,
+		       percent_of(clients[i].cpu_ns, interval_ns));
+	fflush(stdout);
+}
+
+static void print_json_string(const char *str, size_t max_len)
+{
+	size_t i;
+
+	putchar('"');
+	for (i = 0; i < max_len && str[i]; i++) {
+		if (str[i] == '"' || str[i] == '\\')
+			printf("\\%c", str[i]);
+		else if ((unsigned char)str[i] < 0x20)
+			printf("\\u%04x", (unsigned char)str[i]);
+		else
+			putchar(str[i]);
+	}
+	putchar('"');
+}
+
+static void print_json_hist(const char *name,
+			    const struct live_hist_stats *stats)
+{
+	printf("\"%s\":{\"count\":%" PRIu64 ",\"p50\":%u,\"p90\":%u"
+	       ",\"p99\":%u,\"max\":%u}",
+	       name, stats->count, stats->p50, stats->p90, stats->p99,
+	       stats->max);
+}
+
+static void print_json_stages(const struct cras_latency_hist *hists,
+			      const struct cras_latency_hist *prev_hists,
+			      enum CRAS_STREAM_DIRECTION direction)
+{
+	struct live_hist_stats stats;
+	unsigned int stage;
+
+	printf("\"stages_usec\":{");
+	for (stage = 0; stage < CRAS_NUM_DEV_IO_STAGES; stage++) {
+		hist_stats(&hists[stage],
+			   prev_hists ? &prev_hists[stage] : NULL, &stats);
+		printf("%s", stage ? "," : "");
+		print_json_hist(stage_name(direction, stage), &stats);
+	}
+	printf("}");
+}
+
+/* Prints one JSON object per line, for collectors to parse. */
+static void print_json(const struct live_snapshot *cur,
+		       const struct live_snapshot *prev, uint64_t interval_ns,
+		       unsigned int wakes)
+{
+	const struct audio_dev_debug_info *dev, *prev_dev;
+	const struct audio_stream_debug_info *stream, *prev_stream;
+	struct live_client_cpu clients[MAX_DEBUG_STREAMS];
+	struct live_hist_stats stats;
+	double sec = interval_ns / 1000000000.0;
+	struct timespec now;
+	unsigned int i, num_clients;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+	printf("{\"time\":%ld.%03ld,\"interval_ms\":%" PRIu64,
+	       (long)now.tv_sec, now.tv_nsec / 1000000, interval_ns / 1000000);
+
+	printf(",\"audio_thread\":{\"cpu\":%d,\"wakes_per_sec\":%.1f"
+	       ",\"cpu_migrations\":%u,\"minor_faults\":%u"
+	       ",\"major_faults\":%u}",
+	       cur->audio.cpu, wakes / sec,
+	       count_delta(cur->audio.cpu_migrations,
+			   prev->audio.cpu_migrations),
+	       count_delta(cur->audio.minor_faults, prev->audio.minor_faults),
+	       count_delta(cur->audio.major_faults, prev->audio.major_faults));
+
+	hist_stats(&cur->main.loop_hist, &prev->main.loop_hist, &stats);
+	printf(",\"main_thread\":{\"loops_per_sec\":%.1f,\"stalls\":%u,",
+	       stats.count / sec,
+	       count_delta(cur->main.num_stalls, prev->main.num_stalls));
+	print_json_hist("loop_usec", &stats);
+	printf(",\"handlers_usec\":{");
+	for (i = 0; i < CRAS_NUM_MAIN_HANDLERS; i++) {
+		hist_stats(&cur->main.handler_hist[i],
+			   &prev->main.handler_hist[i], &stats);
+		printf("%s", i ? "," : "");
+		print_json_hist(cras_main_handler_str(i), &stats);
+	}
+	printf("}}");
+
+	printf(",\"devs\":[");
+	for (i = 0; i < cur->audio.num_devs && i < MAX_DEBUG_DEVS; i++) {
+		dev = &cur->audio.devs[i];
+		prev_dev = find_dev(&prev->audio, dev);
+		printf("%s{\"name\":", i ? "," : "");
+		print_json_string(dev->dev_name, sizeof(dev->dev_name));
+		printf(",\"direction\":\"%s\",\"underruns\":%u"
+		       ",\"severe_underruns\":%u,\"total_underruns\":%u"
+		       ",\"total_severe_underruns\":%u,",
+		       string_for_direction(dev->direction),
+		       count_delta(dev->num_underruns,
+				   prev_dev ? prev_dev->num_underruns : 0),
+		       count_delta(dev->num_severe_underruns,
+				   prev_dev ? prev_dev->num_severe_underruns :
+					      0),
+		       dev->num_underruns, dev->num_severe_underruns);
+		print_json_stages(dev->stage_hist,
+				  prev_dev ? prev_dev->stage_hist : NULL,
+				  dev->direction);
+		printf("}");
+	}
+
+	printf("],\"streams\":[");
+	for (i = 0; i < cur->audio.num_streams && i < MAX_DEBUG_STREAMS; i++) {
+		stream = &cur->audio.streams[i];
+		prev_stream = find_stream(&prev->audio, stream->stream_id);
+		printf("%s{\"id\":%" PRIu64 ",\"client_id\":%u"
+		       ",\"direction\":\"%s\",\"client_type\":\"%s\""
+		       ",\"stream_type\":\"%s\",\"cpu_percent\":%.2f"
+		       ",\"missed_cb\":%u,\"overruns\":%u"
+		       ",\"total_missed_cb\":%u,\"total_overruns\":%u,",
+		       i ? "," : "", stream->stream_id,
+		       (uint32_t)(stream->stream_id >> 16),
+		       string_for_direction(stream->direction),
+		       cras_client_type_str(stream->client_type),
+		       cras_stream_type_str(stream->stream_type),
+		       percent_of(stream_cpu_ns(stream, prev_stream),
+				  interval_ns),
+		       count_delta(stream->num_missed_cb,
+				   prev_stream ? prev_stream->num_missed_cb :
+						 0),
+		       count_delta(stream->num_overruns,
+				   prev_stream ? prev_stream->num_overruns : 0),
+		       stream->num_missed_cb, stream->num_overruns);
+		print_json_stages(stream->stage_hist,
+				  prev_stream ? prev_stream->stage_hist : NULL,
+				  stream->direction);
+		printf("}");
+	}
+
+	printf("],\"clients\":[");
+	num_clients = sum_client_cpu(&cur->audio, &prev->audio, clients);
+	for (i = 0; i < num_clients; i++)
+		printf("%s{\"client_id\":%u,\"streams\":%u"
+		       ",\"cpu_percent\":%.2f}",
+		       i ? "," : "", clients[i].client_id,
+		       clients[i].num_streams,
+		       percent_of(clients[i].cpu_ns, interval_ns));
+	printf("]}\n");
+	fflush(stdout);
+}
+
+/* Polls the debug info every interval_ms until q is read from stdin. */
+static int run_live(struct cras_client *client, unsigned int interval_ms,
+		    bool json)
+{
+	struct live_snapshot *cur = &live_snapshots[0];
+	struct live_snapshot *prev = &live_snapshots[1];
+	struct live_snapshot *tmp;
+	enum live_request pending = LIVE_IDLE;
+	const struct audio_debug_info *audio_info;
+	const struct main_thread_debug_info *main_info;
+	struct timespec interval, next, now, diff;
+	bool have_prev = false, watch_stdin = true;
+	uint64_t last_wake_ns = 0, elapsed_ns;
+	unsigned int wakes;
+	struct timeval tv;
+	fd_set fds;
+	char c;
+	int rc;
+
+	if (pipe(live_pipe)) {
+		syslog(LOG_ERR, "Couldn't create pipe: %s", strerror(errno));
+		return -errno;
+	}
+
+	ms_to_timespec(interval_ms, &interval);
+	clock_gettime(CLOCK_MONOTONIC, &next);
+	if (!json) {
+		printf("\033[H\033[2Jcras_monitor live, waiting for the first"
+		       " snapshots\n");
+		fflush(stdout);
+	}
+
+	while (1) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		if (!timespec_after(&next, &now)) {
+			add_timespecs(&next, &interval);
+			if (timespec_after(&now, &next))
+				next = now;
+			/* A poll still pending after an interval is left to
+			 * finish, the server may be restarting. */
+			if (pending == LIVE_IDLE &&
+			    cras_client_update_audio_debug_info(
+				    client, live_info_ready) == 0)
+				pending = LIVE_AUDIO;
+			continue;
+		}
+
+		subtract_timespecs(&next, &now, &diff);
+		tv.tv_sec = diff.tv_sec;
+		tv.tv_usec = diff.tv_nsec / 1000;
+		FD_ZERO(&fds);
+		FD_SET(live_pipe[0], &fds);
+		if (watch_stdin)
+			FD_SET(STDIN_FILENO, &fds);
+		rc = select(live_pipe[0] + 1, &fds, NULL, NULL, &tv);
+		if (rc < 0 && errno != EINTR)
+			return -errno;
+		if (rc <= 0)
+			continue;
+
+		if (watch_stdin && FD_ISSET(STDIN_FILENO, &fds)) {
+			rc = read(STDIN_FILENO, &c, 1);
+			/* Collectors may run with no input at all. */
+			if (rc <= 0)
+				watch_stdin = false;
+			else if (c == 'q')
+				return 0;
+		}
+		if (!FD_ISSET(live_pipe[0], &fds))
+			continue;
+		if (read(live_pipe[0], &c, 1) != 1)
+			continue;
+
+		if (pending == LIVE_AUDIO) {
+			clock_gettime(CLOCK_MONOTONIC, &cur->ts);
+			audio_info = cras_client_get_audio_debug_info(client);
+			if (audio_info)
+				cur->audio = *audio_info;
+			/* The client runs one debug info request at a time. */
+			if (audio_info &&
+			    cras_client_update_main_thread_debug_info(
+				    client, live_info_ready) == 0)
+				pending = LIVE_MAIN;
+			else
+				pending = LIVE_IDLE;
+			continue;
+		}
+		if (pending != LIVE_MAIN)
+			continue;
+		pending = LIVE_IDLE;
+		main_info = cras_client_get_main_thread_debug_info(client);
+		if (!main_info)
+			continue;
+		cur->main = *main_info;
+
+		wakes = count_new_wakes(&cur->audio.log, &last_wake_ns);
+		subtract_timespecs(&cur->ts, &prev->ts, &diff);
+		elapsed_ns = diff.tv_sec * 1000000000ULL + diff.tv_nsec;
+		if (have_prev && json)
+			print_json(cur, prev, elapsed_ns, wakes);
+		else if (have_prev)
+			print_dashboard(cur, prev, elapsed_ns, wakes,
+					interval_ms);
+		tmp = prev;
+		prev = cur;
+		cur = tmp;
+		have_prev = true;
+	}
+}
+
 static void print_usage(const char *command)
 {
 	fprintf(stderr,
@@ -195,7 +760,12 @@ static void print_usage(const char *command)
 		"  Where [options] are:\n"
 		"    --sync|-s  - Use the synchronous connection functions.\n"
 		"    --log-level|-l <n>  - Set the syslog level (7 == "
-		"LOG_DEBUG).\n",
+		"LOG_DEBUG).\n"
+		"    --live|-L <ms>  - Show a dashboard of audio and main "
+		"thread health,\n"
+		"                      refreshed every <ms> milliseconds.\n"
+		"    --json|-j  - With --live, print one JSON object per "
+		"refresh instead.\n",
 		command);
 }
 
@@ -205,18 +775,22 @@ int main(int argc, char **argv)
 	int rc;
 	int option_character;
 	bool synchronous = false;
+	bool json = false;
+	int live_interval_ms = 0;
 	int log_level = LOG_WARNING;
 	static struct option long_options[] = {
 		{ "sync", no_argument, NULL, 's' },
 		{ "log-level", required_argument, NULL, 'l' },
+		{ "live", required_argument, NULL, 'L' },
+		{ "json", no_argument, NULL, 'j' },
 		{ NULL, 0, NULL, 0 },
 	};
 
 	while (true) {
 		int option_index = 0;
 
-		option_character = getopt_long(argc, argv, "sl:", long_options,
-					       &option_index);
+		option_character = getopt_long(argc, argv, "sl:L:j",
+					       long_options, &option_index);
 		if (option_character == -1)
 			break;
 		switch (option_character) {
@@ -230,12 +804,26 @@ int main(int argc, char **argv)
 			else if (log_level > LOG_DEBUG)
 				log_level = LOG_DEBUG;
 			break;
+		case 'L':
+			live_interval_ms = atoi(optarg);
+			if (live_interval_ms <= 0) {
+				fprintf(stderr, "%s: Invalid interval.\n",
+					argv[0]);
+				return 1;
+			}
+			break;
+		case 'j':
+			json = true;
+			break;
 		default:
 			print_usage(argv[0]);
 			return 1;
 		}
 	}
 
+	if (json && !live_interval_ms)
+		live_interval_ms = 1000;
+
 	if (optind < argc) {
 		fprintf(stderr, "%s: Extra arguments.\n", argv[0]);
 		print_usage(argv[0]);
@@ -251,8 +839,9 @@ int main(int argc, char **argv)
 		return rc;
 	}
 
-	cras_client_set_connection_status_cb(client, server_connection_callback,
-					     NULL);
+	if (!live_interval_ms)
+		cras_client_set_connection_status_cb(
+			client, server_connection_callback, NULL);
 
 	if (synchronous) {
 		rc = cras_client_connect(client);
@@ -262,24 +851,9 @@ int main(int argc, char **argv)
 		}
 	}
 
-	cras_client_set_output_volume_changed_callback(client,
-						       output_volume_changed);
-	cras_client_set_output_mute_changed_callback(client,
-						     output_mute_changed);
-	cras_client_set_capture_mute_changed_callback(client,
-						      capture_mute_changed);
-	cras_client_set_nodes_changed_callback(client, nodes_changed);
-	cras_client_set_active_node_changed_callback(client,
-						     active_node_changed);
-	cras_client_set_output_node_volume_changed_callback(
-		client, output_node_volume_changed);
-	cras_client_set_node_left_right_swapped_changed_callback(
-		client, node_left_right_swapped_changed);
-	cras_client_set_input_node_gain_changed_callback(
-		client, input_node_gain_changed);
-	cras_client_set_num_active_streams_changed_callback(
-		client, num_active_streams_changed);
-	cras_client_set_state_change_callback_context(client, client);
+	/* Live mode owns stdout, events would break its output. */
+	if (!live_interval_ms)
+		set_observer_callbacks(client);
 
 	rc = cras_client_run_thread(client);
 	if (rc != 0) {
@@ -295,6 +869,17 @@ int main(int argc, char **argv)
 		}
 	}
 
+	if (live_interval_ms) {
+		/* Debug info can only be asked for once connected. */
+		rc = cras_client_connected_wait(client);
+		if (rc) {
+			syslog(LOG_ERR, "Couldn't connect to server.");
+			goto destroy_exit;
+		}
+		rc = run_live(client, live_interval_ms, json);
+		goto destroy_exit;
+	}
+
 	while (1) {
 		int rc;
 		char c;
@@ -83,6 +83,7 @@ struct {
 	{ "S16_LE", SND_PCM_FORMAT_S16_LE },
 	{ "S24_LE", SND_PCM_FORMAT_S24_LE },
 	{ "S32_LE", SND_PCM_FORMAT_S32_LE },
+	{ "FLOAT_LE", SND_PCM_FORMAT_FLOAT_LE },
 	{ NULL, 0 },
 };
 
@@ -513,21 +514,20 @@ static float get_ewma_power_as_float(uint32_t data)
 	return (f < 1.0e-10f) ? -INFINITY : 10.0f * log10f(f);
 }
 
-static void show_alog_tag(const struct audio_thread_event_log *log,
-			  unsigned int tag_idx, int32_t sec_offset,
-			  int32_t nsec_offset)
+static void show_alog_tag(const struct audio_thread_event *ev,
+			  int32_t sec_offset, int32_t nsec_offset)
 {
-	unsigned int tag = (log->log[tag_idx].tag_sec >> 24) & 0xff;
-	unsigned int sec = log->log[tag_idx].tag_sec & 0x00ffffff;
-	unsigned int nsec = log->log[tag_idx].nsec;
-	unsigned int data1 = log->log[tag_idx].data1;
-	unsigned int data2 = log->log[tag_idx].data2;
-	unsigned int data3 = log->log[tag_idx].data3;
+	unsigned int tag = (ev->tag_sec >> 24) & 0xff;
+	unsigned int sec = ev->tag_sec & 0x00ffffff;
+	unsigned int nsec = ev->nsec;
+	unsigned int data1 = ev->data1;
+	unsigned int data2 = ev->data2;
+	unsigned int data3 = ev->data3;
 	time_t lt;
 	struct tm t;
 
 	/* Skip unused log entries. */
-	if (log->log[tag_idx].tag_sec == 0 && log->log[tag_idx].nsec == 0)
+	if (ev->tag_sec == 0 && ev->nsec == 0)
 		return;
 
 	/* Convert from monotonic raw clock to realtime clock. */
@@ -639,8 +639,8 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		       data2);
 		break;
 	case AUDIO_THREAD_DEV_STREAM_MIX:
-		printf("%-30s written:%u read:%u\n", "DEV_STREAM_MIX", data1,
-		       data2);
+		printf("%-30s written:%u read:%u silent:%u\n",
+		       "DEV_STREAM_MIX", data1, data2, data3);
 		break;
 	case AUDIO_THREAD_CAPTURE_POST:
 		printf("%-30s stream:%x thresh:%u rd_buf:%u\n", "CAPTURE_POST",
@@ -731,8 +731,8 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 		printf("%-30s nframes_committed:%u\n", "LOOPBACK_PUT", data1);
 		break;
 	case AUDIO_THREAD_LOOPBACK_GET:
-		printf("%-30s nframes_requested:%u avail:%u\n", "LOOPBACK_GET",
-		       data1, data2);
+		printf("%-30s nframes_requested:%u avail:%u overruns:%u\n",
+		       "LOOPBACK_GET", data1, data2, data3);
 		break;
 	case AUDIO_THREAD_LOOPBACK_SAMPLE_HOOK:
 		printf("%-30s frames_to_copy:%u frames_copied:%u\n",
@@ -748,6 +748,134 @@ static void show_alog_tag(const struct audio_thread_event_log *log,
 	}
 }
 
+/* Returns count as a rate over a runtime, 0 if the runtime is zero. */
+static double per_second(uint32_t count, uint32_t sec, uint32_t nsec)
+{
+	double runtime = sec + nsec / 1000000000.0;
+
+	return runtime > 0 ? count / runtime : 0;
+}
+
+/* Prints the percentiles of hist in microseconds, if it has samples. */
+static void print_hist_usec(const char *name,
+			    const struct cras_latency_hist *hist)
+{
+	if (!cras_latency_hist_count(hist))
+		return;
+	printf("%s_usec: count %" PRIu64 " p50 %u p90 %u p99 %u max %u\n",
+	       name, cras_latency_hist_count(hist),
+	       cras_latency_hist_percentile(hist, 50),
+	       cras_latency_hist_percentile(hist, 90),
+	       cras_latency_hist_percentile(hist, 99), hist->max_usec);
+}
+
+/* Prints the percentiles of the time spent in each stage, in microseconds. */
+static void print_stage_hists(const struct cras_latency_hist *hists,
+			      enum CRAS_STREAM_DIRECTION direction)
+{
+	static const char *const output_names[] = { "fetch", "write" };
+	static const char *const input_names[] = { "capture", "send" };
+	const char *const *names = (direction == CRAS_STREAM_INPUT) ?
+					   input_names :
+					   output_names;
+	int i;
+
+	for (i = 0; i < CRAS_NUM_DEV_IO_STAGES; i++)
+		print_hist_usec(names[i], &hists[i]);
+}
+
+static void print_dev_debug_info(const struct audio_dev_debug_info *dev)
+{
+	printf("%s dev: %s\n",
+	       (dev->direction == CRAS_STREAM_INPUT) ? "Input" : "Output",
+	       dev->dev_name);
+	printf("buffer_size: %u\n"
+	       "min_buffer_level: %u\n"
+	       "min_cb_level: %u\n"
+	       "max_cb_level: %u\n"
+	       "frame_rate: %u\n"
+	       "num_channels: %u\n"
+	       "est_rate_ratio: %lf\n"
+	       "num_underruns: %u\n"
+	       "num_severe_underruns: %u\n"
+	       "highest_hw_level: %u\n"
+	       "runtime: %u.%09u\n"
+	       "longest_wake: %u.%09u\n"
+	       "software_gain_scaler: %lf\n"
+	       "coalesced_fetches: %u (%.2f wakes/s saved)\n",
+	       (unsigned int)dev->buffer_size,
+	       (unsigned int)dev->min_buffer_level,
+	       (unsigned int)dev->min_cb_level, (unsigned int)dev->max_cb_level,
+	       (unsigned int)dev->frame_rate, (unsigned int)dev->num_channels,
+	       dev->est_rate_ratio, (unsigned int)dev->num_underruns,
+	       (unsigned int)dev->num_severe_underruns,
+	       (unsigned int)dev->highest_hw_level,
+	       (unsigned int)dev->runtime_sec, (unsigned int)dev->runtime_nsec,
+	       (unsigned int)dev->longest_wake_sec,
+	       (unsigned int)dev->longest_wake_nsec, dev->software_gain_scaler,
+	       (unsigned int)dev->num_coalesced_fetches,
+	       per_second(dev->num_coalesced_fetches, dev->runtime_sec,
+			  dev->runtime_nsec));
+	print_stage_hists(dev->stage_hist, dev->direction);
+}
+
+static void
+print_stream_debug_info(const struct audio_stream_debug_info *stream)
+{
+	int channel;
+
+	printf("stream: 0x%" PRIx64 " dev: %u\n", stream->stream_id,
+	       (unsigned int)stream->dev_idx);
+	printf("direction: %s\n",
+	       (stream->direction == CRAS_STREAM_INPUT) ? "Input" : "Output");
+	printf("stream_type: %s\n", cras_stream_type_str(stream->stream_type));
+	printf("client_type: %s\n", cras_client_type_str(stream->client_type));
+	printf("buffer_frames: %u\n"
+	       "cb_threshold: %u\n"
+	       "effects: 0x%.4x\n"
+	       "frame_rate: %u\n"
+	       "num_channels: %u\n"
+	       "longest_fetch_sec: %u.%09u\n"
+	       "num_overruns: %u\n"
+	       "is_pinned: %x\n"
+	       "pinned_dev_idx: %x\n"
+	       "num_missed_cb: %u\n"
+	       "%s: %lf\n"
+	       "runtime: %u.%09u\n"
+	       "latency_us: %u\n"
+	       "cpu_us: %" PRIu64 "\n"
+	       "num_fetches: %u\n"
+	       "shm_bytes: %u\n"
+	       "conv_bytes: %u\n"
+	       "delay_us: device %u dsp %u conv %u processing %u\n",
+	       (unsigned int)stream->buffer_frames,
+	       (unsigned int)stream->cb_threshold,
+	       (unsigned int)stream->effects, (unsigned int)stream->frame_rate,
+	       (unsigned int)stream->num_channels,
+	       (unsigned int)stream->longest_fetch_sec,
+	       (unsigned int)stream->longest_fetch_nsec,
+	       (unsigned int)stream->num_overruns,
+	       (unsigned int)stream->is_pinned,
+	       (unsigned int)stream->pinned_dev_idx,
+	       (unsigned int)stream->num_missed_cb,
+	       (stream->direction == CRAS_STREAM_INPUT) ? "gain" : "volume",
+	       stream->stream_volume, (unsigned int)stream->runtime_sec,
+	       (unsigned int)stream->runtime_nsec,
+	       (unsigned int)stream->latency_us, stream->cpu_ns / 1000,
+	       (unsigned int)stream->num_fetches,
+	       (unsigned int)stream->shm_bytes,
+	       (unsigned int)stream->conv_bytes,
+	       (unsigned int)stream->device_delay_us,
+	       (unsigned int)stream->dsp_delay_us,
+	       (unsigned int)stream->conv_delay_us,
+	       (unsigned int)stream->processing_delay_us);
+	printf("channel map:");
+	for (channel = 0; channel < CRAS_CH_MAX; channel++)
+		printf("%d ", stream->channel_layout[channel]);
+	printf("\n");
+	print_stage_hists(stream->stage_hist, stream->direction);
+}
+
 static void print_audio_debug_info(const struct audio_debug_info *info)
 {
 	time_t sec_offset;
@@ -755,44 +883,21 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 	int i, j;
 
 	printf("Audio Debug Stats:\n");
+	printf("audio_thread_cpu: %d\n"
+	       "cpu_migrations: %u\n",
+	       info->cpu, info->cpu_migrations);
+	printf("page_faults: minor %u major %u\n"
+	       "rt_memory: locked %u unlocked %u\n",
+	       info->minor_faults, info->major_faults, info->rt_locked_bytes,
+	       info->rt_unlocked_bytes);
+	printf("rt_guard: allocs %u blocking_calls %u\n", info->rt_allocs,
+	       info->rt_blocking_calls);
 	printf("-------------devices------------\n");
 	if (info->num_devs > MAX_DEBUG_DEVS)
 		return;
 
 	for (i = 0; i < info->num_devs; i++) {
-		printf("%s dev: %s\n",
-		       (info->devs[i].direction == CRAS_STREAM_INPUT) ?
-			       "Input" :
-			       "Output",
-		       info->devs[i].dev_name);
-		printf("buffer_size: %u\n"
-		       "min_buffer_level: %u\n"
-		       "min_cb_level: %u\n"
-		       "max_cb_level: %u\n"
-		       "frame_rate: %u\n"
-		       "num_channels: %u\n"
-		       "est_rate_ratio: %lf\n"
-		       "num_underruns: %u\n"
-		       "num_severe_underruns: %u\n"
-		       "highest_hw_level: %u\n"
-		       "runtime: %u.%09u\n"
-		       "longest_wake: %u.%09u\n"
-		       "software_gain_scaler: %lf\n",
-		       (unsigned int)info->devs[i].buffer_size,
-		       (unsigned int)info->devs[i].min_buffer_level,
-		       (unsigned int)info->devs[i].min_cb_level,
-		       (unsigned int)info->devs[i].max_cb_level,
-		       (unsigned int)info->devs[i].frame_rate,
-		       (unsigned int)info->devs[i].num_channels,
-		       info->devs[i].est_rate_ratio,
-		       (unsigned int)info->devs[i].num_underruns,
-		       (unsigned int)info->devs[i].num_severe_underruns,
-		       (unsigned int)info->devs[i].highest_hw_level,
-		       (unsigned int)info->devs[i].runtime_sec,
-		       (unsigned int)info->devs[i].runtime_nsec,
-		       (unsigned int)info->devs[i].longest_wake_sec,
-		       (unsigned int)info->devs[i].longest_wake_nsec,
-		       info->devs[i].software_gain_scaler);
+		print_dev_debug_info(&info->devs[i]);
 		printf("\n");
 	}
 
@@ -801,51 +906,8 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 		return;
 
 	for (i = 0; i < info->num_streams; i++) {
-		int channel;
-		printf("stream: 0x%" PRIx64 " dev: %u\n",
-		       info->streams[i].stream_id,
-		       (unsigned int)info->streams[i].dev_idx);
-		printf("direction: %s\n",
-		       (info->streams[i].direction == CRAS_STREAM_INPUT) ?
-			       "Input" :
-			       "Output");
-		printf("stream_type: %s\n",
-		       cras_stream_type_str(info->streams[i].stream_type));
-		printf("client_type: %s\n",
-		       cras_client_type_str(info->streams[i].client_type));
-		printf("buffer_frames: %u\n"
-		       "cb_threshold: %u\n"
-		       "effects: 0x%.4x\n"
-		       "frame_rate: %u\n"
-		       "num_channels: %u\n"
-		       "longest_fetch_sec: %u.%09u\n"
-		       "num_overruns: %u\n"
-		       "is_pinned: %x\n"
-		       "pinned_dev_idx: %x\n"
-		       "num_missed_cb: %u\n"
-		       "%s: %lf\n"
-		       "runtime: %u.%09u\n",
-		       (unsigned int)info->streams[i].buffer_frames,
-		       (unsigned int)info->streams[i].cb_threshold,
-		       (unsigned int)info->streams[i].effects,
-		       (unsigned int)info->streams[i].frame_rate,
-		       (unsigned int)info->streams[i].num_channels,
-		       (unsigned int)info->streams[i].longest_fetch_sec,
-		       (unsigned int)info->streams[i].longest_fetch_nsec,
-		       (unsigned int)info->streams[i].num_overruns,
-		       (unsigned int)info->streams[i].is_pinned,
-		       (unsigned int)info->streams[i].pinned_dev_idx,
-		       (unsigned int)info->streams[i].num_missed_cb,
-		       (info->streams[i].direction == CRAS_STREAM_INPUT) ?
-			       "gain" :
-			       "volume",
-		       info->streams[i].stream_volume,
-		       (unsigned int)info->streams[i].runtime_sec,
-		       (unsigned int)info->streams[i].runtime_nsec);
-		printf("channel map:");
-		for (channel = 0; channel < CRAS_CH_MAX; channel++)
-			printf("%d ", info->streams[i].channel_layout[channel]);
-		printf("\n\n");
+		print_stream_debug_info(&info->streams[i]);
+		printf("\n");
 	}
 
 	printf("Audio Thread Event Log:\n");
@@ -855,12 +917,57 @@ static void print_audio_debug_info(const struct audio_debug_info *info)
 	i = 0;
 	printf("start at %d\n", j);
 	for (; i < info->log.len; i++) {
-		show_alog_tag(&info->log, j, sec_offset, nsec_offset);
+		show_alog_tag(&info->log.log[j], sec_offset, nsec_offset);
 		j++;
 		j %= info->log.len;
 	}
 }
 
+static void print_mem_usage(struct cras_client *client)
+{
+	struct cras_mem_usage usage;
+	unsigned int i;
+
+	if (cras_client_get_mem_usage(client, &usage))
+		return;
+	printf("Memory usage (bytes):\n");
+	printf("\t%-20s %12s %12s\n", "Subsystem", "Now", "Peak");
+	for (i = 0; i < CRAS_NUM_MEM_SUBSYS; i++)
+		printf("\t%-20s %12" PRIu64 " %12" PRIu64 "\n",
+		       cras_mem_subsys_str(i), usage.bytes[i],
+		       usage.peak_bytes[i]);
+}
+
+static void print_perf_profile(struct cras_client *client)
+{
+	static const char *const quality_names[] = {
+		"default", "low", "medium", "high"
+	};
+	struct cras_perf_profile profile;
+	const char *quality = "unknown";
+
+	if (cras_client_get_perf_profile(client, &profile))
+		return;
+	if (profile.resampler_quality >= 0 &&
+	    profile.resampler_quality < (int)ARRAY_SIZE(quality_names))
+		quality = quality_names[profile.resampler_quality];
+
+	printf("Performance profile:\n");
+	printf("\trt_priority: %d\n", profile.rt_priority);
+	printf("\tplayback_wake_fuzz_us: %d\n", profile.playback_wake_fuzz_us);
+	printf("\tcapture_wake_fuzz_us: %d\n", profile.capture_wake_fuzz_us);
+	printf("\tresampler_quality: %s\n", quality);
+	printf("\tmax_audio_threads: %u\n", profile.max_audio_threads);
+	printf("\taudio_thread_cpu_mask: 0x%x\n",
+	       profile.audio_thread_cpu_mask);
+	printf("\taudio_thread_uclamp_min: %u\n",
+	       profile.audio_thread_uclamp_min);
+	printf("\tsched_deadline: %d\n", profile.sched_deadline);
+	printf("\taudio_thread_log_size: %u\n", profile.audio_thread_log_size);
+	printf("\tdefault_output_buffer_size: %d\n",
+	       profile.default_output_buffer_size);
+}
+
 static void audio_debug_info(struct cras_client *client)
 {
 	const struct audio_debug_info *info;
@@ -868,6 +975,7 @@ static void audio_debug_info(struct cras_client *client)
 	if (!info)
 		return;
 	print_audio_debug_info(info);
+	print_mem_usage(client);
 
 	/* Signal main thread we are done after the last chunk. */
 	pthread_mutex_lock(&done_mutex);
@@ -955,6 +1063,18 @@ static void show_mainlog_tag(const struct main_thread_event_log *log,
 	case MAIN_THREAD_STREAM_REMOVED:
 		printf("%-30s stream 0x%x\n", "STREAM_REMOVED", data1);
 		break;
+	case MAIN_THREAD_STARTUP_STAGE:
+		printf("%-30s %s after %u ms\n", "STARTUP_STAGE",
+		       (data1 == CRAS_STARTUP_SERVING ? "serving" : "complete"),
+		       data2);
+		break;
+	case MAIN_THREAD_LOOP_STALL:
+		printf("%-30s %u us, %s ran %u us\n", "LOOP_STALL", data3,
+		       cras_main_handler_str(data1), data2);
+		break;
+	case MAIN_THREAD_DEV_STANDBY:
+		printf("%-30s dev %u for %u ms\n", "DEV_STANDBY", data1, data2);
+		break;
 	default:
 		printf("%-30s\n", "UNKNOWN");
 		break;
@@ -1085,6 +1205,22 @@ static void show_btlog_tag(const struct cras_bt_event_log *log,
 	case BT_TRANSPORT_UPDATE_VOLUME:
 		printf("%-30s %d\n", "TRANSPORT_UPDATE_VOLUME", data1);
 		break;
+	case BT_PROPERTIES_BATCH:
+		printf("%-30s signals %u took %u us\n", "PROPERTIES_BATCH",
+		       data1, data2);
+		break;
+	case BT_INTERFACES_ADDED:
+		printf("%-30s %u took %u us\n", "INTERFACES_ADDED", data1,
+		       data2);
+		break;
+	case BT_INTERFACES_REMOVED:
+		printf("%-30s %u took %u us\n", "INTERFACES_REMOVED", data1,
+		       data2);
+		break;
+	case BT_MANAGED_OBJECTS:
+		printf("%-30s objects %u took %u us\n", "MANAGED_OBJECTS",
+		       data1, data2);
+		break;
 	default:
 		printf("%-30s\n", "UNKNOWN");
 		break;
@@ -1107,6 +1243,27 @@ static void convert_to_time_str(const struct timespec *ts, time_t sec_offset,
 		 time_nsec);
 }
 
+static void show_hfp_link_stats(const struct hfp_link_stats *stats)
+{
+	static const char *burst_names[HFP_LINK_STATS_BURST_BUCKETS] = {
+		"1", "2", "3", "4-7", "8-15", "16+"
+	};
+	int i;
+
+	printf("-------------HFP link quality-----------\n");
+	printf("Packets lost: %u/%u\n", stats->lost, stats->packets);
+	printf("Loss bursts by length:");
+	for (i = 0; i < HFP_LINK_STATS_BURST_BUCKETS; i++)
+		printf(" %s:%u", burst_names[i], stats->bursts[i]);
+	printf("\nLongest loss burst: %u\n", stats->max_burst);
+	printf("PLC: %u calls, %u us total, %u us max\n", stats->plc_calls,
+	       stats->plc_usec, stats->max_plc_usec);
+	printf("SCO jitter: %u us, %u us max, over %u reads\n",
+	       stats->jitter_usec, stats->max_jitter_usec, stats->wakes);
+	printf("Controller queue: %u packets, %u max\n", stats->queue_depth,
+	       stats->max_queue_depth);
+}
+
 static void cras_bt_debug_info(struct cras_client *client)
 {
 	const struct cras_bt_debug_info *info;
@@ -1144,6 +1301,8 @@ static void cras_bt_debug_info(struct cras_client *client)
 	printf("In binary format:\n");
 	packet_status_logger_dump_binary(&wbs_logger);
 
+	show_hfp_link_stats(&info->hfp_link_stats);
+
 	/* Signal main thread we are done after the last chunk. */
 	pthread_mutex_lock(&done_mutex);
 	pthread_cond_signal(&done_cond);
@@ -1168,6 +1327,13 @@ static void main_thread_debug_info(struct cras_client *client)
 		j %= info->main_log.len;
 	}
 
+	printf("Main loop handlers:\n");
+	for (i = 0; i < CRAS_NUM_MAIN_HANDLERS; i++)
+		print_hist_usec(cras_main_handler_str(i),
+				&info->handler_hist[i]);
+	print_hist_usec("pass", &info->loop_hist);
+	printf("stalls: %u\n", info->num_stalls);
+
 	/* Signal main thread we are done after the last chunk. */
 	pthread_mutex_lock(&done_mutex);
 	pthread_cond_signal(&done_cond);
@@ -1177,6 +1343,13 @@ static void main_thread_debug_info(struct cras_client *client)
 static void print_cras_audio_thread_snapshot(
 	const struct cras_audio_thread_snapshot *snapshot)
 {
+	const struct audio_dev_debug_info *devs;
+	const struct audio_stream_debug_info *streams;
+	const struct audio_thread_event *events;
+	time_t sec_offset;
+	int32_t nsec_offset;
+	unsigned int i;
+
 	printf("-------------snapshot------------\n");
 	printf("Event time: %" PRId64 ".%ld\n",
 	       (int64_t)snapshot->timestamp.tv_sec,
@@ -1208,27 +1381,74 @@ static void print_cras_audio_thread_snapshot(
 	default:
 		printf("no such type\n");
 	}
-	print_audio_debug_info(&snapshot->audio_debug_info);
+
+	printf("audio_thread_cpu: %d\n"
+	       "cpu_migrations: %u\n",
+	       snapshot->cpu, snapshot->cpu_migrations);
+	printf("page_faults: minor %u major %u\n"
+	       "rt_memory: locked %u unlocked %u\n",
+	       snapshot->minor_faults, snapshot->major_faults,
+	       snapshot->rt_locked_bytes, snapshot->rt_unlocked_bytes);
+	printf("-------------devices------------\n");
+	devs = cras_audio_thread_snapshot_devs(snapshot);
+	for (i = 0; i < snapshot->num_devs; i++) {
+		print_dev_debug_info(&devs[i]);
+		printf("\n");
+	}
+	printf("-------------stream_dump------------\n");
+	streams = cras_audio_thread_snapshot_streams(snapshot);
+	for (i = 0; i < snapshot->num_streams; i++) {
+		print_stream_debug_info(&streams[i]);
+		printf("\n");
+	}
+
+	printf("Audio Thread Event Log since the previous snapshot:\n");
+	fill_time_offset(&sec_offset, &nsec_offset);
+	events = cras_audio_thread_snapshot_events(snapshot);
+	for (i = 0; i < snapshot->num_events; i++)
+		show_alog_tag(&events[i], sec_offset, nsec_offset);
+}
+
+/* Returns true if the snapshot at offset, entries included, fits in buf. */
+static bool snapshot_fits(const struct cras_audio_thread_snapshot_buffer *buf,
+			  uint32_t offset)
+{
+	const struct cras_audio_thread_snapshot *snapshot;
+	uint64_t size;
+
+	if (offset + sizeof(*snapshot) > buf->size)
+		return false;
+	snapshot = (const struct cras_audio_thread_snapshot *)(buf->data +
+							       offset);
+	size = sizeof(*snapshot) +
+	       (uint64_t)snapshot->num_devs *
+		       sizeof(struct audio_dev_debug_info) +
+	       (uint64_t)snapshot->num_streams *
+		       sizeof(struct audio_stream_debug_info) +
+	       (uint64_t)snapshot->num_events *
+		       sizeof(struct audio_thread_event);
+	return snapshot->size == size && offset + size <= buf->size;
 }
 
 static void audio_thread_snapshots(struct cras_client *client)
 {
 	const struct cras_audio_thread_snapshot_buffer *snapshot_buffer;
+	const struct cras_audio_thread_snapshot *snapshot;
+	uint32_t offset = 0;
 	uint32_t i;
-	int j;
 	int count = 0;
 
 	snapshot_buffer = cras_client_get_audio_thread_snapshot_buffer(client);
-	i = snapshot_buffer->pos;
-	for (j = 0; j < CRAS_MAX_AUDIO_THREAD_SNAPSHOTS; j++) {
-		if (snapshot_buffer->snapshots[i].timestamp.tv_sec ||
-		    snapshot_buffer->snapshots[i].timestamp.tv_nsec) {
-			print_cras_audio_thread_snapshot(
-				&snapshot_buffer->snapshots[i]);
-			count++;
+	for (i = 0; i < snapshot_buffer->num_snapshots; i++) {
+		if (!snapshot_fits(snapshot_buffer, offset)) {
+			printf("Snapshot %u is corrupted.\n", i);
+			break;
 		}
-		i++;
-		i %= CRAS_MAX_AUDIO_THREAD_SNAPSHOTS;
+		snapshot = (const struct cras_audio_thread_snapshot
+				    *)(snapshot_buffer->data + offset);
+		print_cras_audio_thread_snapshot(snapshot);
+		offset += snapshot->size;
+		count++;
 	}
 	printf("There are %d, snapshots.\n", count);
 
@@ -1556,6 +1776,8 @@ static void print_server_info(struct cras_client *client)
 	print_device_lists(client);
 	print_attached_client_list(client);
 	print_active_stream_info(client);
+	print_mem_usage(client);
+	print_perf_profile(client);
 }
 
 static void show_audio_thread_snapshots(struct cras_client *client)
@@ -1682,7 +1904,7 @@ static void show_atlog(time_t sec_offset, int32_t nsec_offset,
 		printf("%" PRIu64 " logs are missing.\n", missing);
 
 	for (i = 0; i < len; ++i) {
-		show_alog_tag(log, i, sec_offset, nsec_offset);
+		show_alog_tag(&log->log[i], sec_offset, nsec_offset);
 	}
 }
 
@@ -1693,14 +1915,12 @@ static void unlock_main_thread(struct cras_client *client)
 	pthread_mutex_unlock(&done_mutex);
 }
 
-static void cras_show_continuous_atlog(struct cras_client *client)
+/* Gets access to the live audio thread log, waiting up to two seconds.
+ * Returns 0 on success. */
+static int wait_for_atlog_access(struct cras_client *client)
 {
-	struct audio_thread_event_log log;
 	struct timespec wait_time;
-	static time_t sec_offset;
-	static int32_t nsec_offset;
-	static uint64_t atlog_read_idx = 0, missing;
-	int len, rc;
+	int rc;
 
 	cras_client_run_thread(client);
 	cras_client_connected_wait(client); /* To synchronize data. */
@@ -1713,7 +1933,18 @@ static void cras_show_continuous_atlog(struct cras_client *client)
 	rc = pthread_cond_timedwait(&done_cond, &done_mutex, &wait_time);
 	pthread_mutex_unlock(&done_mutex);
 
-	if (rc)
+	return rc;
+}
+
+static void cras_show_continuous_atlog(struct cras_client *client)
+{
+	struct audio_thread_event_log log;
+	static time_t sec_offset;
+	static int32_t nsec_offset;
+	static uint64_t atlog_read_idx = 0, missing;
+	int len;
+
+	if (wait_for_atlog_access(client))
 		goto fail;
 
 	fill_time_offset(&sec_offset, &nsec_offset);
@@ -1735,6 +1966,114 @@ fail:
 	printf("Failed to get audio thread log.\n");
 }
 
+/* Layout of the file written by --follow_atlog_file. The header is followed
+ * by chunks, each a struct atlog_file_chunk and then num_events raw
+ * struct audio_thread_event entries exactly as the server logged them. Event
+ * times are CLOCK_MONOTONIC_RAW, add the header offset to get realtime.
+ */
+#define ATLOG_FILE_MAGIC 0x474c5441 /* "ATLG" */
+#define ATLOG_FILE_VERSION 1
+
+struct __attribute__((__packed__)) atlog_file_header {
+	uint32_t magic;
+	uint32_t version;
+	int64_t sec_offset;
+	int32_t nsec_offset;
+	uint32_t event_size;
+};
+
+/* Members:
+ *    missing - Number of events lost before this chunk because the reader
+ *      fell more than a full log behind.
+ *    num_events - Number of events following this chunk header.
+ */
+struct __attribute__((__packed__)) atlog_file_chunk {
+	uint64_t missing;
+	uint32_t num_events;
+};
+
+static int write_all(int fd, const void *buf, size_t len)
+{
+	const uint8_t *p = (const uint8_t *)buf;
+	ssize_t rc;
+
+	while (len) {
+		rc = write(fd, p, len);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			return -errno;
+		}
+		p += rc;
+		len -= rc;
+	}
+	return 0;
+}
+
+/* Tails the audio thread log into a binary file until write fails or the
+ * server goes away, so hours of events can be kept for later decoding. */
+static void cras_record_continuous_atlog(struct cras_client *client,
+					 const char *file_name)
+{
+	struct audio_thread_event_log log;
+	struct atlog_file_header header;
+	struct atlog_file_chunk chunk;
+	time_t sec_offset;
+	int32_t nsec_offset;
+	uint64_t atlog_read_idx = 0, missing = 0, total = 0;
+	int fd, len;
+
+	fd = open(file_name, O_CREAT | O_TRUNC | O_WRONLY, 0644);
+	if (fd < 0) {
+		printf("Failed to open %s: %s\n", file_name, strerror(errno));
+		return;
+	}
+
+	if (wait_for_atlog_access(client)) {
+		printf("Failed to get audio thread log.\n");
+		goto close_file;
+	}
+
+	fill_time_offset(&sec_offset, &nsec_offset);
+	header.magic = ATLOG_FILE_MAGIC;
+	header.version = ATLOG_FILE_VERSION;
+	header.sec_offset = sec_offset;
+	header.nsec_offset = nsec_offset;
+	header.event_size = sizeof(struct audio_thread_event);
+	if (write_all(fd, &header, sizeof(header)))
+		goto write_fail;
+
+	while (1) {
+		len = cras_client_read_atlog(client, &atlog_read_idx, &missing,
+					     &log);
+		if (len < 0)
+			break;
+		if (len > 0) {
+			chunk.missing = missing;
+			chunk.num_events = len;
+			if (write_all(fd, &chunk, sizeof(chunk)) ||
+			    write_all(fd, log.log,
+				      len * sizeof(struct audio_thread_event)))
+				goto write_fail;
+			total += len;
+			if (missing)
+				fprintf(stderr, "%" PRIu64 " logs are missing.\n",
+					missing);
+			/* A full buffer means more is waiting, keep going. */
+			if (len == AUDIO_THREAD_EVENT_LOG_SIZE)
+				continue;
+		}
+		nanosleep(&follow_atlog_sleep_ts, NULL);
+	}
+	printf("Audio thread log ended after %" PRIu64 " events.\n", total);
+	goto close_file;
+
+write_fail:
+	printf("Failed to write %s: %s\n", file_name, strerror(errno));
+close_file:
+	close(fd);
+}
+
 // clang-format off
 static struct option long_options[] = {
 	{"show_latency",        no_argument,            &show_latency, 1},
@@ -1791,6 +2130,7 @@ static struct option long_options[] = {
 	{"dump_bt",             no_argument,            0, 'H'},
 	{"set_wbs_enabled",     required_argument,      0, 'I'},
 	{"follow_atlog",	no_argument,		0, 'J'},
+	{"follow_atlog_file",	required_argument,	0, 'O'},
 	{"connection_type",     required_argument,      0, 'K'},
 	{"loopback_file",       required_argument,      0, 'L'},
 	{"mute_loop_test",      required_argument,      0, 'M'},
@@ -1851,6 +2191,9 @@ static void show_usage()
 	       "Seconds to record or playback.\n");
 	printf("--follow_atlog - "
 	       "Continuously dumps audio thread event log.\n");
+	printf("--follow_atlog_file <name> - "
+	       "Continuously records audio thread event log to a binary "
+	       "file.\n");
 	printf("--format <name> - "
 	       "The sample format. Either ");
 	for (i = 0; supported_formats[i].name; ++i)
@@ -2335,6 +2678,9 @@ int main(int argc, char **argv)
 		case 'J':
 			cras_show_continuous_atlog(client);
 			break;
+		case 'O':
+			cras_record_continuous_atlog(client, optarg);
+			break;
 		case 'K':
 			new_conn_type = atoi(optarg);
 			if (cras_validate_connection_type(new_conn_type)) {
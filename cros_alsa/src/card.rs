@@ -2,15 +2,18 @@
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
 
+use std::collections::HashMap;
 use std::error;
 use std::fmt;
+use std::time::{Duration, Instant};
 
 use remain::sorted;
 
-use crate::control::{self, Control};
+use crate::control::{self, check_elem, Control};
 use crate::control_primitive;
-use crate::control_primitive::{Ctl, ElemId, ElemIface};
+use crate::control_primitive::{Ctl, ElemId, ElemIface, ElemInfo};
 use crate::control_tlv::{self, ControlTLV};
+use crate::elem::{self, Elem};
 
 pub type Result<T> = std::result::Result<T, Error>;
 
@@ -24,6 +27,8 @@ pub enum Error {
     Control(control::Error),
     /// Error occurs in ControlTLV.
     ControlTLV(control_tlv::Error),
+    /// Error occurs in Elem.
+    Elem(elem::Error),
 }
 
 impl error::Error for Error {}
@@ -40,6 +45,12 @@ impl From<control_tlv::Error> for Error {
     }
 }
 
+impl From<elem::Error> for Error {
+    fn from(err: elem::Error) -> Error {
+        Error::Elem(err)
+    }
+}
+
 impl From<control_primitive::Error> for Error {
     fn from(err: control_primitive::Error) -> Error {
         Error::AlsaControlAPI(err)
@@ -53,15 +64,27 @@ impl fmt::Display for Error {
             AlsaControlAPI(e) => write!(f, "{}", e),
             Control(e) => write!(f, "{}", e),
             ControlTLV(e) => write!(f, "{}", e),
+            Elem(e) => write!(f, "{}", e),
         }
     }
 }
 
+// The id and info of a mixer control kept by `Card` once it is looked up by name. The id
+// carries the numid of the control, so accessing it needs no name lookup in the kernel.
+#[derive(Debug)]
+struct CachedElem {
+    id: ElemId,
+    info: ElemInfo,
+}
+
 /// `Card` represents a sound card.
+/// It keeps the controls it has looked up by name, so accessing a control again neither
+/// allocates a new id nor reads the control info.
 #[derive(Debug)]
 pub struct Card {
     handle: Ctl,
     name: String,
+    elems: HashMap<String, CachedElem>,
 }
 
 impl Card {
@@ -80,6 +103,7 @@ impl Card {
         Ok(Card {
             name: card_name.to_owned(),
             handle,
+            elems: HashMap::new(),
         })
     }
 
@@ -100,8 +124,12 @@ impl Card {
     where
         T: Control<'a>,
     {
-        let id = ElemId::new(ElemIface::Mixer, control_name)?;
-        Ok(T::from(&mut self.handle, id)?)
+        let elem = Self::cached_elem(&mut self.handle, &mut self.elems, control_name)?;
+        Ok(T::from_info(
+            &mut self.handle,
+            elem.id.try_clone()?,
+            &elem.info,
+        )?)
     }
 
     /// Creates a `ControlTLV` from control name.
@@ -111,7 +139,104 @@ impl Card {
     /// * If control name is an invalid CString.
     /// * If control does not exist.
     pub fn control_tlv_by_name<'a>(&'a mut self, control_name: &str) -> Result<ControlTLV<'a>> {
-        let id = ElemId::new(ElemIface::Mixer, control_name)?;
-        Ok(ControlTLV::new(&mut self.handle, id)?)
+        let elem = Self::cached_elem(&mut self.handle, &mut self.elems, control_name)?;
+        Ok(ControlTLV::from_info(
+            &mut self.handle,
+            elem.id.try_clone()?,
+            &elem.info,
+        )?)
+    }
+
+    /// Reads the values of many mixer controls of the same type in one pass, ex:
+    /// `card.load_controls::<[i32; 1]>(&["Left Rdc", "Right Rdc"])`.
+    ///
+    /// # Errors
+    ///
+    /// * If a control name is an invalid CString.
+    /// * If a control does not exist.
+    /// * If `E` mismatches the type or the number of value entries of a mixer control.
+    /// * If it fails to read from a control.
+    pub fn load_controls<E: Elem>(&mut self, control_names: &[&str]) -> Result<Vec<E::T>> {
+        control_names
+            .iter()
+            .map(|&control_name| {
+                let elem = Self::cached_elem(&mut self.handle, &mut self.elems, control_name)?;
+                check_elem(&elem.id, &elem.info, E::elem_type(), E::size())?;
+                Ok(E::load(&mut self.handle, &elem.id)?)
+            })
+            .collect()
+    }
+
+    /// Writes the values of many mixer controls of the same type in one pass, ex:
+    /// `card.save_controls::<[i32; 1], _, _>(vec![("Left Rdc", [rdc_l]), ("Right Rdc", [rdc_r])])`.
+    ///
+    /// # Errors
+    ///
+    /// * If a control name is an invalid CString.
+    /// * If a control does not exist.
+    /// * If `E` mismatches the type or the number of value entries of a mixer control.
+    /// * If it fails to write to a control.
+    pub fn save_controls<E, S, I>(&mut self, values: I) -> Result<()>
+    where
+        E: Elem,
+        S: AsRef<str>,
+        I: IntoIterator<Item = (S, E::T)>,
+    {
+        for (control_name, val) in values {
+            let elem = Self::cached_elem(&mut self.handle, &mut self.elems, control_name.as_ref())?;
+            check_elem(&elem.id, &elem.info, E::elem_type(), E::size())?;
+            E::save(&mut self.handle, &elem.id, val)?;
+        }
+        Ok(())
+    }
+
+    /// Subscribes to the changes of the controls of the card, which are waited for by
+    /// `wait_event`.
+    ///
+    /// # Errors
+    ///
+    /// * If snd_ctl_subscribe_events() fails.
+    pub fn subscribe_events(&mut self) -> Result<()> {
+        Ok(self.handle.subscribe_events()?)
+    }
+
+    /// Blocks until a control of the card changes or `timeout` passes. A removed control is
+    /// dropped from the controls the card keeps.
+    /// `subscribe_events` must have been called first.
+    ///
+    /// # Results
+    ///
+    /// * `Some(String)` - the name of the changed control.
+    /// * `None` - no control changed in `timeout`.
+    ///
+    /// # Errors
+    ///
+    /// * If it fails to wait for or to read the change.
+    pub fn wait_event(&mut self, timeout: Duration) -> Result<Option<String>> {
+        let deadline = Instant::now() + timeout;
+        while let Some(remaining) = deadline.checked_duration_since(Instant::now()) {
+            if let Some(event) = self.handle.read_elem_event(remaining)? {
+                let name = event.id.name()?.to_owned();
+                if event.removed() {
+                    self.elems.remove(&name);
+                }
+                return Ok(Some(name));
+            }
+        }
+        Ok(None)
+    }
+
+    // Looks up the control by name once and keeps its id and info.
+    fn cached_elem<'b>(
+        handle: &mut Ctl,
+        elems: &'b mut HashMap<String, CachedElem>,
+        control_name: &str,
+    ) -> Result<&'b CachedElem> {
+        if !elems.contains_key(control_name) {
+            let info = ElemInfo::new(handle, &ElemId::new(ElemIface::Mixer, control_name)?)?;
+            let id = info.id()?;
+            elems.insert(control_name.to_owned(), CachedElem { id, info });
+        }
+        Ok(&elems[control_name])
     }
 }
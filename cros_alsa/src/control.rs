@@ -123,41 +123,59 @@ pub trait Control<'a>: Sized + 'a {
     /// Use `ElemType::load()` and `ElemType::save()` to read or write the mixer control.
     type Item: Elem;
 
-    /// Called by `Self::from(handle: &'a mut Ctl, id: ElemId)` to create a `Control`.
+    /// Called by `Self::from_info(handle: &'a mut Ctl, id: ElemId, info: &ElemInfo)` to create
+    /// a `Control`.
     fn new(handle: &'a mut Ctl, id: ElemId) -> Self;
-    /// Called by `Card` to create a `Control`.
+    /// Creates a `Control` after reading the `ElemInfo` of the mixer control.
     fn from(handle: &'a mut Ctl, id: ElemId) -> Result<Self> {
         let info = ElemInfo::new(handle, &id)?;
-        if info.elem_type()? != Self::elem_type() {
-            return Err(Error::MismatchElemType(
-                id.name()?.to_owned(),
-                info.elem_type()?,
-                Self::elem_type(),
-            ));
-        }
-
-        if info.count() != Self::size() {
-            return Err(Error::MismatchElemCount(
-                id.name()?.to_owned(),
-                info.count(),
-                Self::size(),
-            ));
-        }
-
+        Self::from_info(handle, id, &info)
+    }
+    /// Called by `Card` to create a `Control` from the `ElemInfo` it keeps for the mixer
+    /// control.
+    fn from_info(handle: &'a mut Ctl, id: ElemId, info: &ElemInfo) -> Result<Self> {
+        check_elem(&id, info, Self::elem_type(), Self::size())?;
         Ok(Self::new(handle, id))
     }
-    /// Called by `Self::from(handle: &'a mut Ctl, id: ElemId)` to validate the data type of a
+    /// Called by `Self::from_info(handle: &'a mut Ctl, id: ElemId, info: &ElemInfo)` to
+    /// validate the data type of a
     /// `Control`.
     fn elem_type() -> ElemType {
         Self::Item::elem_type()
     }
-    /// Called by `Self::from(handle: &'a mut Ctl, id: ElemId)` to validate the number of value
-    /// entries of a `Control`.
+    /// Called by `Self::from_info(handle: &'a mut Ctl, id: ElemId, info: &ElemInfo)` to
+    /// validate the number of value entries of a `Control`.
     fn size() -> usize {
         Self::Item::size()
     }
 }
 
+/// Validates that the mixer control described by `info` can be read and written as
+/// `elem_type` values of `size` entries.
+///
+/// # Errors
+///
+/// * If `elem_type` mismatches the type of the mixer control.
+/// * If `size` mismatches the number of value entries of the mixer control.
+pub fn check_elem(id: &ElemId, info: &ElemInfo, elem_type: ElemType, size: usize) -> Result<()> {
+    if info.elem_type()? != elem_type {
+        return Err(Error::MismatchElemType(
+            id.name()?.to_owned(),
+            info.elem_type()?,
+            elem_type,
+        ));
+    }
+
+    if info.count() != size {
+        return Err(Error::MismatchElemCount(
+            id.name()?.to_owned(),
+            info.count(),
+            size,
+        ));
+    }
+    Ok(())
+}
+
 /// Each mixer control could implement the `ControlOps` trait to allow itself to read and
 /// write the underlying hardware`. Users could hold `Ctl` and `ElemID` as `handle` and `id`
 /// in their control structure and use `#[derive(ControlOps)]` macro to generate default
@@ -10,6 +10,7 @@ use std::marker::PhantomData;
 use std::ptr;
 use std::slice;
 use std::str;
+use std::time::Duration;
 
 use alsa_sys::*;
 use libc::strlen;
@@ -42,6 +43,12 @@ pub enum Error {
     ControlNotFound(String),
     /// Failed to call snd_ctl_open().
     CtlOpenFailed(FFIError, String),
+    /// Failed to call snd_ctl_read().
+    CtlReadFailed(FFIError),
+    /// Failed to call snd_ctl_subscribe_events().
+    CtlSubscribeEventsFailed(FFIError),
+    /// Failed to call snd_ctl_wait().
+    CtlWaitFailed(FFIError),
     /// snd_ctl_elem_id_get_name() returns null.
     ElemIdGetNameFailed,
     /// Failed to call snd_ctl_elem_id_malloc().
@@ -50,6 +57,8 @@ pub enum Error {
     ElemInfoMallocFailed(FFIError),
     /// Failed to call snd_ctl_elem_value_malloc().
     ElemValueMallocFailed(FFIError),
+    /// Failed to call snd_ctl_event_malloc().
+    EventMallocFailed(FFIError),
     /// The slice used to create a CStr does not have one and only one null
     /// byte positioned at the end.
     FromBytesWithNulError(FromBytesWithNulError),
@@ -71,10 +80,14 @@ impl fmt::Display for Error {
         match self {
             ControlNotFound(name) => write!(f, "control: {} does not exist", name),
             CtlOpenFailed(e, name) => write!(f, "{} snd_ctl_open failed: {}", name, e,),
+            CtlReadFailed(e) => write!(f, "snd_ctl_read failed: {}", e),
+            CtlSubscribeEventsFailed(e) => write!(f, "snd_ctl_subscribe_events failed: {}", e),
+            CtlWaitFailed(e) => write!(f, "snd_ctl_wait failed: {}", e),
             ElemIdGetNameFailed => write!(f, "snd_ctl_elem_id_get_name failed"),
             ElemIdMallocFailed(e) => write!(f, "snd_ctl_elem_id_malloc failed: {}", e),
             ElemInfoMallocFailed(e) => write!(f, "snd_ctl_elem_info_malloc failed: {}", e),
             ElemValueMallocFailed(e) => write!(f, "snd_ctl_elem_value_malloc failed: {}", e),
+            EventMallocFailed(e) => write!(f, "snd_ctl_event_malloc failed: {}", e),
             FromBytesWithNulError(e) => write!(f, "invalid CString: {}", e),
             InvalidElemType(v) => write!(f, "invalid ElemType: {}", v),
             NulError(e) => write!(f, "invalid CString: {}", e),
@@ -183,6 +196,29 @@ impl ElemId {
     /// * If memory allocation fails.
     /// * If ctl_name is not a valid CString.
     pub fn new(iface: ElemIface, ctl_name: &str) -> Result<ElemId> {
+        let id = Self::alloc()?;
+        // Safe because id.as_mut_ptr() is a valid snd_ctl_elem_id_t*.
+        unsafe { snd_ctl_elem_id_set_interface(id.as_mut_ptr(), iface as u32) };
+        let name = CString::new(ctl_name)?;
+        // Safe because id.as_mut_ptr() is a valid snd_ctl_elem_id_t* and name is a safe CString.
+        unsafe { snd_ctl_elem_id_set_name(id.as_mut_ptr(), name.as_ptr()) };
+        Ok(id)
+    }
+
+    /// Creates a copy of the `ElemId` by `snd_ctl_elem_id_copy()`.
+    ///
+    /// # Errors
+    ///
+    /// * If memory allocation fails.
+    pub fn try_clone(&self) -> Result<ElemId> {
+        let id = Self::alloc()?;
+        // Safe because both pointers are valid snd_ctl_elem_id_t*.
+        unsafe { snd_ctl_elem_id_copy(id.as_mut_ptr(), self.as_ptr()) };
+        Ok(id)
+    }
+
+    // Allocates an empty `ElemId`.
+    fn alloc() -> Result<ElemId> {
         let mut id_ptr = ptr::null_mut();
         // Safe because we provide a valid id_ptr to be filled,
         // and we validate the return code before using id_ptr.
@@ -191,15 +227,14 @@ impl ElemId {
             return Err(Error::ElemIdMallocFailed(FFIError::Rc(rc)));
         }
         let id = ptr::NonNull::new(id_ptr).ok_or(Error::ElemIdMallocFailed(FFIError::NullPtr))?;
-
-        // Safe because id.as_ptr() is a valid snd_ctl_elem_id_t*.
-        unsafe { snd_ctl_elem_id_set_interface(id.as_ptr(), iface as u32) };
-        let name = CString::new(ctl_name)?;
-        // Safe because id.as_ptr() is a valid snd_ctl_elem_id_t* and name is a safe CString.
-        unsafe { snd_ctl_elem_id_set_name(id.as_ptr(), name.as_ptr()) };
         Ok(ElemId(id, PhantomData))
     }
 
+    // Borrows the mutable inner pointer.
+    fn as_mut_ptr(&self) -> *mut snd_ctl_elem_id_t {
+        self.0.as_ptr()
+    }
+
     /// Borrows the const inner pointer.
     pub fn as_ptr(&self) -> *const snd_ctl_elem_id_t {
         self.0.as_ptr()
@@ -227,6 +262,12 @@ impl ElemId {
     }
 }
 
+impl fmt::Debug for ElemId {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        write!(f, "ElemId({})", self.name()?)
+    }
+}
+
 /// [snd_ctl_elem_value_t](https://www.alsa-project.org/alsa-doc/alsa-lib/group___control.html#ga266b478eb64f1cdd75e337df4b4b995e) wrapper.
 pub struct ElemValue(
     ptr::NonNull<snd_ctl_elem_value_t>,
@@ -339,6 +380,74 @@ impl ElemInfo {
         // Safe because self.0.as_ptr() is a valid snd_ctl_elem_info_t*.
         unsafe { snd_ctl_elem_info_is_tlv_writable(self.0.as_ptr()) as usize == 1 }
     }
+
+    /// Gets the `ElemId` of the control by `snd_ctl_elem_info_get_id()`.
+    /// Unlike the `ElemId` the info is created with, it carries the numid of the control, so
+    /// the kernel finds the control without comparing names when it is accessed by this id.
+    ///
+    /// # Errors
+    ///
+    /// * If memory allocation fails.
+    pub fn id(&self) -> Result<ElemId> {
+        let id = ElemId::alloc()?;
+        // Safe because self.0.as_ptr() is a valid snd_ctl_elem_info_t* and id.as_mut_ptr() is a
+        // valid snd_ctl_elem_id_t*.
+        unsafe { snd_ctl_elem_info_get_id(self.0.as_ptr(), id.as_mut_ptr()) };
+        Ok(id)
+    }
+}
+
+impl fmt::Debug for ElemInfo {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        f.debug_struct("ElemInfo")
+            .field("elem_type", &self.elem_type().map_err(|_| fmt::Error)?)
+            .field("count", &self.count())
+            .finish()
+    }
+}
+
+/// An element event read from a `Ctl` by `Ctl::read_elem_event`.
+#[derive(Debug)]
+pub struct ElemEvent {
+    /// The id of the changed control.
+    pub id: ElemId,
+    /// The SND_CTL_EVENT_MASK_* bits of the change.
+    pub mask: u32,
+}
+
+impl ElemEvent {
+    // SND_CTL_EVENT_MASK_REMOVE is defined as (~0U).
+    const MASK_REMOVE: u32 = !0;
+
+    /// Returns whether the control has been removed.
+    pub fn removed(&self) -> bool {
+        self.mask == Self::MASK_REMOVE
+    }
+}
+
+// snd_ctl_event_t wrapper.
+struct Event(ptr::NonNull<snd_ctl_event_t>, PhantomData<snd_ctl_event_t>);
+
+impl Drop for Event {
+    fn drop(&mut self) {
+        // Safe because self.0.as_ptr() is a valid snd_ctl_event_t*.
+        unsafe { snd_ctl_event_free(self.0.as_ptr()) };
+    }
+}
+
+impl Event {
+    fn new() -> Result<Event> {
+        let mut event_ptr = ptr::null_mut();
+        // Safe because we provide a valid event_ptr to be filled,
+        // and we validate the return code before using event_ptr.
+        let rc = unsafe { snd_ctl_event_malloc(&mut event_ptr) };
+        if rc < 0 {
+            return Err(Error::EventMallocFailed(FFIError::Rc(rc)));
+        }
+        let event =
+            ptr::NonNull::new(event_ptr).ok_or(Error::EventMallocFailed(FFIError::NullPtr))?;
+        Ok(Event(event, PhantomData))
+    }
 }
 
 /// [snd_ctl_t](https://www.alsa-project.org/alsa-doc/alsa-lib/group___control.html#ga06628f38def84a0fe3da74041db9d51f) wrapper.
@@ -384,6 +493,62 @@ impl Ctl {
     pub fn as_mut_ptr(&mut self) -> *mut snd_ctl_t {
         self.0.as_ptr()
     }
+
+    /// Safe `snd_ctl_subscribe_events()` wrapper.
+    /// Subscribes to the events of the controls, which are read by `read_elem_event`.
+    ///
+    /// # Errors
+    ///
+    /// * If `snd_ctl_subscribe_events()` fails.
+    pub fn subscribe_events(&mut self) -> Result<()> {
+        // Safe because self.as_mut_ptr() is a valid snd_ctl_t*.
+        let rc = unsafe { snd_ctl_subscribe_events(self.as_mut_ptr(), 1) };
+        if rc < 0 {
+            return Err(Error::CtlSubscribeEventsFailed(FFIError::Rc(rc)));
+        }
+        Ok(())
+    }
+
+    /// Blocks until a control changes or `timeout` passes, and reads the change.
+    /// `subscribe_events` must have been called first.
+    ///
+    /// # Results
+    ///
+    /// * `Some(ElemEvent)` - the change of a control.
+    /// * `None` - no control changed in `timeout`.
+    ///
+    /// # Errors
+    ///
+    /// * If `snd_ctl_wait()` or `snd_ctl_read()` fails.
+    pub fn read_elem_event(&mut self, timeout: Duration) -> Result<Option<ElemEvent>> {
+        let event = Event::new()?;
+        // Safe because self.as_mut_ptr() is a valid snd_ctl_t*.
+        let rc = unsafe { snd_ctl_wait(self.as_mut_ptr(), timeout.as_millis() as i32) };
+        if rc < 0 {
+            return Err(Error::CtlWaitFailed(FFIError::Rc(rc)));
+        }
+        if rc == 0 {
+            return Ok(None);
+        }
+        // Safe because self.as_mut_ptr() is a valid snd_ctl_t* and event.0.as_ptr() is a
+        // valid snd_ctl_event_t*.
+        let rc = unsafe { snd_ctl_read(self.as_mut_ptr(), event.0.as_ptr()) };
+        if rc < 0 {
+            return Err(Error::CtlReadFailed(FFIError::Rc(rc)));
+        }
+        // Safe because event.0.as_ptr() is a valid snd_ctl_event_t*.
+        if rc == 0 || unsafe { snd_ctl_event_get_type(event.0.as_ptr()) } != SND_CTL_EVENT_ELEM {
+            return Ok(None);
+        }
+        let id = ElemId::alloc()?;
+        // Safe because event.0.as_ptr() is a valid snd_ctl_event_t* of an element event and
+        // id.as_mut_ptr() is a valid snd_ctl_elem_id_t*.
+        let mask = unsafe {
+            snd_ctl_event_elem_get_id(event.0.as_ptr(), id.as_mut_ptr());
+            snd_ctl_event_elem_get_mask(event.0.as_ptr())
+        };
+        Ok(Some(ElemEvent { id, mask }))
+    }
 }
 
 /// Safe [snd_strerror](https://www.alsa-project.org/alsa-doc/alsa-lib/group___error.html#ga182bbadf2349e11602bc531e8cf22f7e) wrapper.
@@ -196,17 +196,33 @@ impl Into<Vec<u32>> for TLV {
 pub struct ControlTLV<'a> {
     handle: &'a mut Ctl,
     id: ElemId,
+    // The ElemInfo fields of the control, which do not change while it exists.
+    size: usize,
+    readable: bool,
+    writable: bool,
 }
 
 impl<'a> ControlTLV<'a> {
-    /// Called by `Card` to create a `ControlTLV`.
+    /// Creates a `ControlTLV` after reading the `ElemInfo` of the byte control.
     pub fn new(handle: &'a mut Ctl, id: ElemId) -> Result<Self> {
         let info = ElemInfo::new(handle, &id)?;
+        Self::from_info(handle, id, &info)
+    }
+
+    /// Called by `Card` to create a `ControlTLV` from the `ElemInfo` it keeps for the byte
+    /// control.
+    pub fn from_info(handle: &'a mut Ctl, id: ElemId, info: &ElemInfo) -> Result<Self> {
         if info.count() % size_of::<u32>() != 0 {
             return Err(Error::InvalidTLVSize(id.name()?.to_owned(), info.count()));
         }
         match info.elem_type()? {
-            ElemType::Bytes => Ok(Self { handle, id }),
+            ElemType::Bytes => Ok(Self {
+                handle,
+                id,
+                size: info.count(),
+                readable: info.tlv_readable(),
+                writable: info.tlv_writable(),
+            }),
             _ => Err(Error::InvalidTLVType(
                 id.name()?.to_owned(),
                 info.elem_type()?,
@@ -221,11 +237,11 @@ impl<'a> ControlTLV<'a> {
     ///
     /// * If it fails to read from the control.
     pub fn load(&mut self) -> Result<TLV> {
-        if !ElemInfo::new(self.handle, &self.id)?.tlv_readable() {
+        if !self.readable {
             return Err(Error::TLVNotReadable);
         }
 
-        let tlv_size = ElemInfo::new(self.handle, &self.id)?.count() + TLV::TLV_HEADER_SIZE_BYTES;
+        let tlv_size = self.size + TLV::TLV_HEADER_SIZE_BYTES;
 
         let mut tlv_buf = vec![0; tlv_size / size_of::<u32>()];
         // Safe because handle.as_mut_ptr() is a valid *mut snd_ctl_t, id_as_ptr is valid and
@@ -255,7 +271,7 @@ impl<'a> ControlTLV<'a> {
     ///
     /// * If it fails to write to the control.
     pub fn save(&mut self, tlv: TLV) -> Result<bool> {
-        if !ElemInfo::new(self.handle, &self.id)?.tlv_writable() {
+        if !self.writable {
             return Err(Error::TLVNotReadable);
         }
         // Safe because handle.as_mut_ptr() is a valid *mut snd_ctl_t, id_as_ptr is valid and
@@ -49,7 +49,7 @@ pub mod elem;
 
 pub use self::card::Card;
 pub use self::control::{Control, ControlOps, IntControl, StereoVolumeControl, SwitchControl};
-pub use self::control_primitive::{Ctl, ElemId};
+pub use self::control_primitive::{Ctl, ElemEvent, ElemId, ElemInfo};
 pub use self::control_tlv::{ControlTLV, TLV};
 
 pub use self::card::Error as CardError;
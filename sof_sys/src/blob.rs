@@ -0,0 +1,179 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+//! Safe access to the binary blobs SOF components take through ALSA bytes controls.
+//!
+//! The TLV value of a SOF bytes control is a `sof_abi_hdr` followed by the data of
+//! the component, both in 32 bit words.
+use std::error;
+use std::fmt;
+use std::mem;
+
+use crate::bindings::sof_abi_hdr;
+
+/// The `sof_abi_hdr::magic` of every blob, 'S', 'O', 'F', '\0'.
+pub const SOF_ABI_MAGIC: u32 = 0x0046_4F53;
+
+#[derive(Debug, PartialEq)]
+/// Error of parsing a `SofBlob`.
+pub enum Error {
+    /// The value is shorter than a `sof_abi_hdr`.
+    TooShort(usize),
+    /// The header does not start with `SOF_ABI_MAGIC`.
+    InvalidMagic(u32),
+    /// `sof_abi_hdr::size` does not match the data that follows the header.
+    InvalidSize(u32, usize),
+}
+
+impl error::Error for Error {}
+
+impl fmt::Display for Error {
+    fn fmt(&self, f: &mut fmt::Formatter) -> fmt::Result {
+        use Error::*;
+        match self {
+            TooShort(len) => write!(f, "sof blob of {} words has no header", len),
+            InvalidMagic(magic) => write!(f, "invalid sof blob magic: {:#x}", magic),
+            InvalidSize(size, len) => write!(
+                f,
+                "sof blob header size {} does not match {} data bytes",
+                size, len
+            ),
+        }
+    }
+}
+
+/// `Result` of parsing a `SofBlob`.
+pub type Result<T> = std::result::Result<T, Error>;
+
+#[derive(Debug, Clone, PartialEq)]
+/// A SOF component blob, the `sof_abi_hdr` words followed by the component data.
+pub struct SofBlob {
+    words: Vec<u32>,
+}
+
+impl SofBlob {
+    /// Number of 32 bit words of a `sof_abi_hdr`.
+    pub const HEADER_WORDS: usize = mem::size_of::<sof_abi_hdr>() / mem::size_of::<u32>();
+    const MAGIC_POS: usize = 0;
+    const TYPE_POS: usize = 1;
+    const SIZE_POS: usize = 2;
+    const ABI_POS: usize = 3;
+
+    /// Creates a `SofBlob` from the TLV value of a SOF bytes control.
+    ///
+    /// # Errors
+    ///
+    /// * The value is shorter than the header.
+    /// * The header magic is not `SOF_ABI_MAGIC`.
+    /// * The header size does not match the length of the data.
+    pub fn from_words(words: Vec<u32>) -> Result<Self> {
+        if words.len() < Self::HEADER_WORDS {
+            return Err(Error::TooShort(words.len()));
+        }
+        if words[Self::MAGIC_POS] != SOF_ABI_MAGIC {
+            return Err(Error::InvalidMagic(words[Self::MAGIC_POS]));
+        }
+        let data_bytes = (words.len() - Self::HEADER_WORDS) * mem::size_of::<u32>();
+        if words[Self::SIZE_POS] as usize != data_bytes {
+            return Err(Error::InvalidSize(words[Self::SIZE_POS], data_bytes));
+        }
+        Ok(Self { words })
+    }
+
+    /// The component specific type of the data.
+    pub fn data_type(&self) -> u32 {
+        self.words[Self::TYPE_POS]
+    }
+
+    /// The SOF ABI version the data follows.
+    pub fn abi(&self) -> u32 {
+        self.words[Self::ABI_POS]
+    }
+
+    /// The component data.
+    pub fn data(&self) -> &[u32] {
+        &self.words[Self::HEADER_WORDS..]
+    }
+
+    /// The component data, which can be changed in place.
+    pub fn data_mut(&mut self) -> &mut [u32] {
+        &mut self.words[Self::HEADER_WORDS..]
+    }
+
+    /// Replaces the component data, keeping the type and ABI version of the header.
+    pub fn set_data(&mut self, data: &[u32]) {
+        self.words.truncate(Self::HEADER_WORDS);
+        self.words.extend_from_slice(data);
+        self.words[Self::SIZE_POS] = (data.len() * mem::size_of::<u32>()) as u32;
+    }
+
+    /// The words to write back to the bytes control.
+    pub fn as_words(&self) -> &[u32] {
+        &self.words
+    }
+}
+
+impl Into<Vec<u32>> for SofBlob {
+    fn into(self) -> Vec<u32> {
+        self.words
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn words(data: &[u32]) -> Vec<u32> {
+        let mut words = vec![0u32; SofBlob::HEADER_WORDS];
+        words[0] = SOF_ABI_MAGIC;
+        words[1] = 3;
+        words[2] = (data.len() * 4) as u32;
+        words[3] = 0x0300_1000;
+        words.extend_from_slice(data);
+        words
+    }
+
+    #[test]
+    fn from_words_ok() {
+        let blob = SofBlob::from_words(words(&[1, 2, 3])).unwrap();
+        assert_eq!(blob.data_type(), 3);
+        assert_eq!(blob.abi(), 0x0300_1000);
+        assert_eq!(blob.data(), &[1, 2, 3]);
+    }
+
+    #[test]
+    fn from_words_too_short() {
+        assert_eq!(
+            SofBlob::from_words(vec![SOF_ABI_MAGIC; 4]).unwrap_err(),
+            Error::TooShort(4)
+        );
+    }
+
+    #[test]
+    fn from_words_invalid_magic() {
+        let mut words = words(&[]);
+        words[0] = 0;
+        assert_eq!(
+            SofBlob::from_words(words).unwrap_err(),
+            Error::InvalidMagic(0)
+        );
+    }
+
+    #[test]
+    fn from_words_invalid_size() {
+        let mut words = words(&[1, 2]);
+        words.pop();
+        assert_eq!(
+            SofBlob::from_words(words).unwrap_err(),
+            Error::InvalidSize(8, 4)
+        );
+    }
+
+    #[test]
+    fn set_data_keeps_header() {
+        let mut blob = SofBlob::from_words(words(&[1, 2, 3])).unwrap();
+        blob.set_data(&[4, 5]);
+        assert_eq!(blob.as_words(), words(&[4, 5]).as_slice());
+        assert!(SofBlob::from_words(blob.into()).is_ok());
+    }
+}
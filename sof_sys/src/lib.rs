@@ -8,5 +8,7 @@
 #![allow(non_snake_case)]
 
 pub mod bindings;
+mod blob;
 #[allow(unused_imports)]
 pub use bindings::sof_abi_hdr;
+pub use blob::{Error, Result, SofBlob, SOF_ABI_MAGIC};
@@ -1,10 +1,8 @@
 // Copyright 2020 The Chromium OS Authors. All rights reserved.
 // Use of this source code is governed by a BSD-style license that can be
 // found in the LICENSE file.
-use std::mem;
-
 use cros_alsa::{Card, TLV};
-use sof_sys::sof_abi_hdr;
+use sof_sys::SofBlob;
 
 use dsm::{self, Error, Result};
 
@@ -56,7 +54,7 @@ pub struct DSMParam {
 impl DSMParam {
     const DWORD_PER_PARAM: usize = 2;
     const VALUE_OFFSET: usize = 1;
-    const SOF_HEADER_SIZE: usize = mem::size_of::<sof_abi_hdr>() / mem::size_of::<i32>();
+    const SOF_HEADER_SIZE: usize = SofBlob::HEADER_WORDS;
 
     /// Creates an `DSMParam`.
     /// # Arguments
@@ -8,9 +8,9 @@
 mod dsm_param;
 mod settings;
 
+use std::fs;
 use std::path::{Path, PathBuf};
 use std::time::Duration;
-use std::{fs, thread};
 
 use cros_alsa::{Card, IntControl};
 use dsm::{CalibData, Error, Result, SpeakerStatus, ZeroPlayer, DSM};
@@ -56,9 +56,8 @@ impl Amp for Max98373 {
         } else {
             match dsm.check_speaker_over_heated_workflow()? {
                 SpeakerStatus::Hot(previous_calib) => previous_calib,
-                SpeakerStatus::Cold => {
-                    let all_temp = self.get_ambient_temp()?;
-                    let all_rdc = self.do_rdc_calibration()?;
+                SpeakerStatus::Cold => dsm.cached_calibration_workflow(|| {
+                    let (all_temp, all_rdc) = self.do_calibration()?;
                     all_rdc
                         .iter()
                         .zip(all_temp)
@@ -66,8 +65,8 @@ impl Amp for Max98373 {
                         .map(|(ch, (&rdc, temp))| {
                             dsm.decide_calibration_value_workflow(ch, CalibData { rdc, temp })
                         })
-                        .collect::<Result<Vec<_>>>()?
-                }
+                        .collect::<Result<Vec<_>>>()
+                })?,
             }
         };
         self.apply_calibration_value(&calib)?;
@@ -110,28 +109,38 @@ impl Max98373 {
         })
     }
 
-    /// Triggers the amplifier calibration and reads the calibrated rdc.
+    /// Measures the ambient temperature and the rdc of the amplifiers.
     /// To get accurate calibration results, the main thread calibrates the amplifier while
-    /// the `zero_player` starts another thread to play zeros to the speakers.
-    fn do_rdc_calibration(&mut self) -> Result<Vec<i32>> {
+    /// the `zero_player` starts another thread to play zeros to the speakers. Both are
+    /// measured within one playback, so the speakers are found and the stream is set up
+    /// only once.
+    fn do_calibration(&mut self) -> Result<(Vec<f32>, Vec<i32>)> {
         let mut zero_player: ZeroPlayer = Default::default();
-        zero_player.start(Self::RDC_CALIB_WARM_UP_TIME)?;
+        zero_player.start(Self::TEMP_CALIB_WARM_UP_TIME)?;
+        let all_temp = self.get_ambient_temp()?;
+        let all_rdc = self.do_rdc_calibration(&zero_player)?;
+        zero_player.stop()?;
+        Ok((all_temp, all_rdc))
+    }
+
+    /// Triggers the amplifier calibration and reads the calibrated rdc.
+    /// The rdc is sampled every Self::RDC_CALIB_INTERVAL of playback once playback of zeros
+    /// has lasted for Self::RDC_CALIB_WARM_UP_TIME.
+    fn do_rdc_calibration(&mut self, zero_player: &ZeroPlayer) -> Result<Vec<i32>> {
+        zero_player.wait_playback_time(Self::RDC_CALIB_WARM_UP_TIME)?;
         // Playback of zeros is started for Self::RDC_CALIB_WARM_UP_TIME, and the main thread
         // can start the calibration.
-        self.set_spt_mode(SPTMode::OFF)?;
-        self.set_calibration_mode(CalibMode::ON)?;
-        // Playback of zeros is started, and the main thread can start the calibration.
+        self.set_spt_and_calibration_mode(SPTMode::OFF, CalibMode::ON)?;
         let mut avg_rdc = vec![0; self.setting.num_channels()];
-        for _ in 0..Self::CALIB_REPEAT_TIMES {
+        for n in 0..Self::CALIB_REPEAT_TIMES {
+            let playback_time = Self::RDC_CALIB_WARM_UP_TIME + Self::RDC_CALIB_INTERVAL * n as u32;
+            zero_player.wait_playback_time(playback_time)?;
             let rdc = self.get_adaptive_rdc()?;
             for i in 0..self.setting.num_channels() {
                 avg_rdc[i] += rdc[i];
             }
-            thread::sleep(Self::RDC_CALIB_INTERVAL);
         }
-        self.set_spt_mode(SPTMode::ON)?;
-        self.set_calibration_mode(CalibMode::OFF)?;
-        zero_player.stop()?;
+        self.set_spt_and_calibration_mode(SPTMode::ON, CalibMode::OFF)?;
 
         avg_rdc = avg_rdc
             .iter()
@@ -182,9 +191,8 @@ impl Max98373 {
     }
 
     /// Returns the ambient temperature in celsius degree.
+    /// Must be called when playback of zeros has lasted for Self::TEMP_CALIB_WARM_UP_TIME.
     fn get_ambient_temp(&mut self) -> Result<Vec<f32>> {
-        let mut zero_player: ZeroPlayer = Default::default();
-        zero_player.start(Self::TEMP_CALIB_WARM_UP_TIME)?;
         let mut temps = Vec::new();
         for x in 0..self.setting.num_channels() as usize {
             let temp = self
@@ -194,7 +202,6 @@ impl Max98373 {
             let celsius = Self::measured_temp_to_celsius(temp);
             temps.push(celsius);
         }
-        zero_player.stop()?;
 
         Ok(temps)
     }
@@ -213,29 +220,16 @@ impl Max98373 {
         (celsius * (1 << 19) as f32) as i32
     }
 
-    /// Sets the amp to the given smart pilot signal mode.
-    fn set_spt_mode(&mut self, mode: SPTMode) -> Result<()> {
-        let mut dsm_param = DSMParam::new(
-            &mut self.card,
-            self.setting.num_channels(),
-            &self.setting.dsm_param_read_ctrl,
-        )?;
-        dsm_param.set_spt_mode(mode);
-        self.card
-            .control_tlv_by_name(&self.setting.dsm_param_write_ctrl)?
-            .save(dsm_param.into())
-            .map_err(Error::DSMParamUpdateFailed)?;
-        Ok(())
-    }
-
-    /// Sets the amp to the given the calibration mode.
-    fn set_calibration_mode(&mut self, mode: CalibMode) -> Result<()> {
+    /// Sets the amp to the given smart pilot signal mode and calibration mode with one
+    /// read and one write of the dsm param.
+    fn set_spt_and_calibration_mode(&mut self, spt: SPTMode, calib: CalibMode) -> Result<()> {
         let mut dsm_param = DSMParam::new(
             &mut self.card,
             self.setting.num_channels(),
             &self.setting.dsm_param_read_ctrl,
         )?;
-        dsm_param.set_calibration_mode(mode);
+        dsm_param.set_spt_mode(spt);
+        dsm_param.set_calibration_mode(calib);
         self.card
             .control_tlv_by_name(&self.setting.dsm_param_write_ctrl)?
             .save(dsm_param.into())
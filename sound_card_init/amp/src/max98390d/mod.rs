@@ -11,13 +11,14 @@ use std::time::Duration;
 use std::{
     fs,
     path::{Path, PathBuf},
+    thread,
 };
 
-use cros_alsa::{Card, IntControl, SwitchControl};
+use cros_alsa::{Card, SwitchControl};
 use dsm::{CalibData, Error, Result, SpeakerStatus, TempConverter, ZeroPlayer, DSM};
 
 use crate::{Amp, CONF_DIR};
-use settings::{AmpCalibSettings, DeviceSettings};
+use settings::{AmpCalibCtrl, AmpCalibSettings, DeviceSettings};
 
 /// Amp volume mode emulation used by set_volume().
 #[derive(PartialEq, Clone, Copy)]
@@ -63,12 +64,13 @@ impl Amp for Max98390 {
         self.set_volume(VolumeMode::Low)?;
         let calib = match dsm.check_speaker_over_heated_workflow()? {
             SpeakerStatus::Hot(previous_calib) => previous_calib,
-            SpeakerStatus::Cold => self
-                .do_calibration()?
-                .iter()
-                .enumerate()
-                .map(|(ch, calib_data)| dsm.decide_calibration_value_workflow(ch, *calib_data))
-                .collect::<Result<Vec<_>>>()?,
+            SpeakerStatus::Cold => dsm.cached_calibration_workflow(|| {
+                self.do_calibration()?
+                    .iter()
+                    .enumerate()
+                    .map(|(ch, calib_data)| dsm.decide_calibration_value_workflow(ch, *calib_data))
+                    .collect::<Result<Vec<_>>>()
+            })?,
         };
         self.apply_calibration_value(calib)?;
         self.set_volume(VolumeMode::High)?;
@@ -108,62 +110,76 @@ impl Max98390 {
 
     /// Sets the card volume control to given VolumeMode.
     fn set_volume(&mut self, mode: VolumeMode) -> Result<()> {
-        for control in &self.setting.controls {
-            self.card
-                .control_by_name::<IntControl>(&control.volume_ctrl)?
-                .set(mode as i32)?;
-        }
+        self.card.save_controls::<[i32; 1], _, _>(
+            self.setting
+                .controls
+                .iter()
+                .map(|control| (&control.volume_ctrl, [mode as i32])),
+        )?;
         Ok(())
     }
 
     /// Applies the calibration value to the amp.
     fn apply_calibration_value(&mut self, calib: Vec<CalibData>) -> Result<()> {
-        for (ch, &CalibData { rdc, temp }) in calib.iter().enumerate() {
-            self.card
-                .control_by_name::<IntControl>(&self.setting.controls[ch].rdc_ctrl)?
-                .set(rdc)?;
-            self.card
-                .control_by_name::<IntControl>(&self.setting.controls[ch].temp_ctrl)?
-                .set(Self::celsius_to_dsm_unit(temp))?;
-        }
+        let values = calib.iter().zip(&self.setting.controls).flat_map(
+            |(&CalibData { rdc, temp }, control)| {
+                vec![
+                    (&control.rdc_ctrl, [rdc]),
+                    (&control.temp_ctrl, [Self::celsius_to_dsm_unit(temp)]),
+                ]
+            },
+        );
+        self.card.save_controls::<[i32; 1], _, _>(values)?;
         Ok(())
     }
 
     /// Triggers the amplifier calibration and reads the calibrated rdc and ambient_temp value
     /// from the mixer control.
-    /// To get accurate calibration results, the main thread calibrates the amplifier while
-    /// the `zero_player` starts another thread to play zeros to the speakers.
+    /// To get accurate calibration results, the amplifiers are calibrated while the
+    /// `zero_player` starts another thread to play zeros to the speakers. The channels have
+    /// their own mixer controls, so each one is calibrated in its own thread.
     fn do_calibration(&mut self) -> Result<Vec<CalibData>> {
         let mut zero_player: ZeroPlayer = Default::default();
         zero_player.start(Self::RDC_CALIB_WARM_UP_TIME)?;
-        // Playback of zeros is started for Self::RDC_CALIB_WARM_UP_TIME, and the main thread
+        // Playback of zeros is started for Self::RDC_CALIB_WARM_UP_TIME, and the channels
         // can start the calibration.
-        let setting = &self.setting;
-        let card = &mut self.card;
-        let calib = setting
+        let card_name = self.card.name().to_owned();
+        let workers = self
+            .setting
             .controls
             .iter()
+            .cloned()
             .map(|control| {
-                card.control_by_name::<SwitchControl>(&control.calib_ctrl)?
-                    .on()?;
-                let rdc = card
-                    .control_by_name::<IntControl>(&control.rdc_ctrl)?
-                    .get()?;
-                let temp = card
-                    .control_by_name::<IntControl>(&control.temp_ctrl)?
-                    .get()?;
-                card.control_by_name::<SwitchControl>(&control.calib_ctrl)?
-                    .off()?;
-                Ok(CalibData {
-                    rdc,
-                    temp: Self::dsm_unit_to_celsius(temp),
+                let card_name = card_name.clone();
+                thread::spawn(move || -> Result<CalibData> {
+                    let mut card = Card::new(&card_name)?;
+                    Self::calibrate_channel(&mut card, &control)
                 })
             })
+            .collect::<Vec<_>>();
+        let calib = workers
+            .into_iter()
+            .map(|worker| worker.join().map_err(Error::WorkerPanics)?)
             .collect::<Result<Vec<CalibData>>>()?;
         zero_player.stop()?;
         Ok(calib)
     }
 
+    /// Calibrates the amplifier of one channel with its mixer controls.
+    fn calibrate_channel(card: &mut Card, control: &AmpCalibCtrl) -> Result<CalibData> {
+        card.control_by_name::<SwitchControl>(&control.calib_ctrl)?
+            .on()?;
+        let values = card
+            .load_controls::<[i32; 1]>(&[control.rdc_ctrl.as_str(), control.temp_ctrl.as_str()])?;
+        let (rdc, temp) = (values[0][0], values[1][0]);
+        card.control_by_name::<SwitchControl>(&control.calib_ctrl)?
+            .off()?;
+        Ok(CalibData {
+            rdc,
+            temp: Self::dsm_unit_to_celsius(temp),
+        })
+    }
+
     /// Converts the ambient temperature from celsius to the DSM unit.
     #[inline]
     fn celsius_to_dsm_unit(celsius: f32) -> i32 {
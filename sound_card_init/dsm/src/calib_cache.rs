@@ -0,0 +1,231 @@
+// Copyright 2021 The Chromium OS Authors. All rights reserved.
+// Use of this source code is governed by a BSD-style license that can be
+// found in the LICENSE file.
+use std::fs::{remove_file, File};
+use std::io::{prelude::*, BufReader, BufWriter};
+use std::path::PathBuf;
+use std::time::Duration;
+
+use serde::{Deserialize, Serialize};
+use sys_util::info;
+
+use crate::datastore::Datastore;
+use crate::error::{Error, Result};
+use crate::CalibData;
+
+/// The calibration values of a sound card and what they are validated against.
+#[derive(Debug, Deserialize, Serialize, Clone)]
+struct CalibCacheData {
+    /// The (VPD::dsm_calib_r0, VPD::dsm_calib_temp) of each channel when the values
+    /// were decided.
+    vpd: Vec<(i32, i32)>,
+    /// The calibration value applied to each channel.
+    calib: Vec<CalibData>,
+    /// The unix time at which the values were calibrated.
+    calib_time: Duration,
+}
+
+impl CalibCacheData {
+    // FNV-1a over the little endian bytes of the fields.
+    fn checksum(&self) -> u32 {
+        let mut bytes = Vec::new();
+        for &(r0, temp) in &self.vpd {
+            bytes.extend_from_slice(&r0.to_le_bytes());
+            bytes.extend_from_slice(&temp.to_le_bytes());
+        }
+        for calib in &self.calib {
+            bytes.extend_from_slice(&calib.rdc.to_le_bytes());
+            bytes.extend_from_slice(&calib.temp.to_bits().to_le_bytes());
+        }
+        bytes.extend_from_slice(&self.calib_time.as_secs().to_le_bytes());
+        bytes.extend_from_slice(&self.calib_time.subsec_nanos().to_le_bytes());
+        bytes.iter().fold(0x811c_9dc5, |hash, &b| {
+            (hash ^ b as u32).wrapping_mul(0x0100_0193)
+        })
+    }
+}
+
+/// `CalibCache`, which stores the calibration values decided by the latest boot time
+/// calibration in yaml format, so that the following boots can apply them without
+/// playing zeros to calibrate again.
+#[derive(Debug, Deserialize, Serialize)]
+pub struct CalibCache {
+    data: CalibCacheData,
+    checksum: u32,
+}
+
+impl CalibCache {
+    const CALIB_CACHE_FILE: &'static str = "calib_cache";
+
+    /// Creates a `CalibCache` of the calibration values decided at `calib_time`.
+    ///
+    /// # Arguments
+    ///
+    /// * `vpd` - (VPD::dsm_calib_r0, VPD::dsm_calib_temp) of each channel.
+    /// * `calib` - the calibration value of each channel.
+    /// * `calib_time` - the unix time of the calibration.
+    pub fn new(vpd: Vec<(i32, i32)>, calib: Vec<CalibData>, calib_time: Duration) -> Self {
+        let data = CalibCacheData {
+            vpd,
+            calib,
+            calib_time,
+        };
+        Self {
+            checksum: data.checksum(),
+            data,
+        }
+    }
+
+    /// Creates a `CalibCache` and initializes its fields from the cache file.
+    pub fn from_file(snd_card: &str) -> Result<CalibCache> {
+        let path = Self::path(snd_card);
+        let reader =
+            BufReader::new(File::open(&path).map_err(|e| Error::FileIOFailed(path.to_owned(), e))?);
+        let cache: CalibCache =
+            serde_yaml::from_reader(reader).map_err(|e| Error::SerdeError(path.to_owned(), e))?;
+        Ok(cache)
+    }
+
+    /// Saves a `CalibCache` to file.
+    pub fn save(&self, snd_card: &str) -> Result<()> {
+        let path = Self::path(snd_card);
+
+        let mut writer = BufWriter::new(
+            File::create(&path).map_err(|e| Error::FileIOFailed(path.to_owned(), e))?,
+        );
+        writer
+            .write_all(
+                serde_yaml::to_string(self)
+                    .map_err(|e| Error::SerdeError(path.to_owned(), e))?
+                    .as_bytes(),
+            )
+            .map_err(|e| Error::FileIOFailed(path.to_owned(), e))?;
+        writer
+            .flush()
+            .map_err(|e| Error::FileIOFailed(path.to_owned(), e))?;
+        info!(
+            "update CalibCache {}: {:?}",
+            path.to_string_lossy(),
+            self.data
+        );
+        Ok(())
+    }
+
+    /// Deletes the cache file.
+    pub fn delete(snd_card: &str) -> Result<()> {
+        let path = Self::path(snd_card);
+        remove_file(&path).map_err(|e| Error::FileIOFailed(path.to_owned(), e))?;
+        info!("calib cache: {:#?} is deleted.", path);
+        Ok(())
+    }
+
+    /// Returns the cached calibration values if they can still be applied.
+    ///
+    /// # Arguments
+    ///
+    /// * `vpd` - the current (VPD::dsm_calib_r0, VPD::dsm_calib_temp) of each channel.
+    /// * `now` - the current unix time.
+    /// * `max_age` - how long after the calibration the values can be applied.
+    /// * `temp_range` - the (lower, upper) limits of the valid ambient temperature.
+    ///
+    /// # Errors
+    ///
+    /// * The checksum does not match the cached values.
+    /// * The VPD values changed, which means the speakers may have been replaced.
+    /// * The values are older than `max_age`, or the clock went back.
+    /// * The ambient temperature at the calibration is out of `temp_range`.
+    pub fn validate(
+        self,
+        vpd: &[(i32, i32)],
+        now: Duration,
+        max_age: Duration,
+        temp_range: (f32, f32),
+    ) -> Result<Vec<CalibData>> {
+        if self.checksum != self.data.checksum() {
+            return Err(Error::InvalidCalibCache("checksum mismatch"));
+        }
+        if self.data.vpd != vpd || self.data.calib.len() != vpd.len() {
+            return Err(Error::InvalidCalibCache("vpd changed"));
+        }
+        match now.checked_sub(self.data.calib_time) {
+            Some(age) if age < max_age => (),
+            _ => return Err(Error::InvalidCalibCache("expired")),
+        }
+        let (lower, upper) = temp_range;
+        if self
+            .data
+            .calib
+            .iter()
+            .any(|calib| calib.temp < lower || calib.temp > upper)
+        {
+            return Err(Error::InvalidCalibCache("temperature out of range"));
+        }
+        Ok(self.data.calib)
+    }
+
+    fn path(snd_card: &str) -> PathBuf {
+        PathBuf::from(Datastore::DATASTORE_DIR)
+            .join(snd_card)
+            .join(Self::CALIB_CACHE_FILE)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    const VPD: [(i32, i32); 2] = [(1123160, 25), (1157049, 26)];
+    const TEMP_RANGE: (f32, f32) = (0.0, 40.0);
+    const MAX_AGE: Duration = Duration::from_secs(100);
+
+    fn cache(temp: f32) -> CalibCache {
+        let calib = VPD
+            .iter()
+            .map(|&(rdc, _)| CalibData { rdc, temp })
+            .collect();
+        CalibCache::new(VPD.to_vec(), calib, Duration::from_secs(1000))
+    }
+
+    #[test]
+    fn valid_cache() {
+        let calib = cache(25.0)
+            .validate(&VPD, Duration::from_secs(1050), MAX_AGE, TEMP_RANGE)
+            .unwrap();
+        assert_eq!(calib.len(), 2);
+        assert_eq!(calib[1].rdc, 1157049);
+    }
+
+    #[test]
+    fn corrupted_cache() {
+        let mut cache = cache(25.0);
+        cache.data.calib[0].rdc += 1;
+        assert!(cache
+            .validate(&VPD, Duration::from_secs(1050), MAX_AGE, TEMP_RANGE)
+            .is_err());
+    }
+
+    #[test]
+    fn vpd_changed() {
+        let vpd = [(1123160, 25), (1157050, 26)];
+        assert!(cache(25.0)
+            .validate(&vpd, Duration::from_secs(1050), MAX_AGE, TEMP_RANGE)
+            .is_err());
+    }
+
+    #[test]
+    fn expired_cache() {
+        assert!(cache(25.0)
+            .validate(&VPD, Duration::from_secs(1100), MAX_AGE, TEMP_RANGE)
+            .is_err());
+        assert!(cache(25.0)
+            .validate(&VPD, Duration::from_secs(999), MAX_AGE, TEMP_RANGE)
+            .is_err());
+    }
+
+    #[test]
+    fn temperature_out_of_range() {
+        assert!(cache(41.0)
+            .validate(&VPD, Duration::from_secs(1050), MAX_AGE, TEMP_RANGE)
+            .is_err());
+    }
+}
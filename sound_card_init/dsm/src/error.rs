@@ -28,6 +28,7 @@ pub enum Error {
     DSMParamUpdateFailed(cros_alsa::ControlTLVError),
     FileIOFailed(PathBuf, io::Error),
     InternalSpeakerNotFound,
+    InvalidCalibCache(&'static str),
     InvalidDatastore,
     InvalidDSMParam,
     InvalidShutDownTime,
@@ -43,6 +44,7 @@ pub enum Error {
     SystemTimeError(time::SystemTimeError),
     UnsupportedSoundCard(String),
     VPDParseFailed(String, ParseIntError),
+    WaitNodeChangeFailed(libcras::Error),
     WorkerPanics(Box<dyn Any + Send + 'static>),
     ZeroPlayerIsNotRunning,
     ZeroPlayerIsRunning,
@@ -105,6 +107,7 @@ impl fmt::Display for Error {
                 "invalid calibration temperature: {}, and there is no datastore",
                 temp
             ),
+            InvalidCalibCache(reason) => write!(f, "invalid calibration cache: {}", reason),
             InvalidDatastore => write!(f, "invalid datastore format"),
             InvalidDSMParam => write!(f, "invalid dsm param from kcontrol"),
             LargeCalibrationDiff(calib) => {
@@ -120,6 +123,7 @@ impl fmt::Display for Error {
             SystemTimeError(e) => write!(f, "{}", e),
             UnsupportedSoundCard(name) => write!(f, "unsupported sound card: {}", name),
             VPDParseFailed(file_path, e) => write!(f, "failed to parse vpd {}: {}", file_path, e),
+            WaitNodeChangeFailed(e) => write!(f, "failed to wait for node change: {}", e),
             WorkerPanics(e) => write!(f, "run_play_zero_worker panics: {:#?}", e),
             ZeroPlayerIsNotRunning => write!(f, "zero player is not running"),
             ZeroPlayerIsRunning => write!(f, "zero player is running"),
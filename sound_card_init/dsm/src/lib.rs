@@ -3,27 +3,27 @@
 // found in the LICENSE file.
 //! `dsm` crate implements the required initialization workflows for smart amps.
 
+mod calib_cache;
 mod datastore;
 mod error;
 pub mod utils;
 mod vpd;
 mod zero_player;
 
-use std::{
-    thread,
-    time::{Duration, SystemTime, UNIX_EPOCH},
-};
+use std::time::{Duration, SystemTime, UNIX_EPOCH};
 
-use libcras::{CrasClient, CrasNodeType};
+use libcras::CrasClient;
+use serde::{Deserialize, Serialize};
 use sys_util::{error, info};
 
+use crate::calib_cache::CalibCache;
 use crate::datastore::Datastore;
 pub use crate::error::{Error, Result};
-use crate::utils::{run_time, shutdown_time};
+use crate::utils::{internal_speaker, run_time, shutdown_time};
 use crate::vpd::VPD;
 pub use crate::zero_player::ZeroPlayer;
 
-#[derive(Debug, Clone, Copy)]
+#[derive(Debug, Clone, Copy, Deserialize, Serialize)]
 /// `CalibData` represents the calibration data.
 pub struct CalibData {
     /// The DC resistance of the speaker is DSM unit.
@@ -91,6 +91,8 @@ pub struct DSM {
 
 impl DSM {
     const SPEAKER_COOL_DOWN_TIME: Duration = Duration::from_secs(180);
+    const SPEAKER_READY_TIMEOUT: Duration = Duration::from_millis(1500);
+    const CALIB_CACHE_MAX_AGE: Duration = Duration::from_secs(7 * 24 * 60 * 60);
     const CALI_ERROR_UPPER_LIMIT: f32 = 0.3;
     const CALI_ERROR_LOWER_LIMIT: f32 = 0.03;
 
@@ -175,6 +177,9 @@ impl DSM {
                         error!("error delete datastore: {}", e);
                     }
                 }
+                if let Err(e) = CalibCache::delete(&self.snd_card) {
+                    error!("error delete calib cache: {}", e);
+                }
                 Err(err)
             }
         }
@@ -245,6 +250,61 @@ impl DSM {
         }
     }
 
+    /// Applies the calibration values cached by a recent boot time calibration, or calls
+    /// `calibrate` and caches the values it returns. The cache is used when it was calibrated
+    /// within `CALIB_CACHE_MAX_AGE` against the same VPD values and at a valid ambient
+    /// temperature, so that these boots skip playing zeros for the calibration.
+    /// This workflow should be used when the speakers are not overheated.
+    ///
+    /// # Arguments
+    ///
+    /// * `calibrate` - the boot time calibration of the amp, which returns the values decided
+    ///   by `decide_calibration_value_workflow`.
+    ///
+    /// # Results
+    ///
+    /// * `Vec<CalibData>` - the calibration values to be applied.
+    ///
+    /// # Errors
+    ///
+    /// * `calibrate` fails.
+    pub fn cached_calibration_workflow<F>(&self, calibrate: F) -> Result<Vec<CalibData>>
+    where
+        F: FnOnce() -> Result<Vec<CalibData>>,
+    {
+        let vpd = self.get_all_vpd_value();
+        let now = SystemTime::now()
+            .duration_since(UNIX_EPOCH)
+            .map_err(Error::SystemTimeError)?;
+        if let Ok(vpd) = &vpd {
+            match CalibCache::from_file(&self.snd_card).and_then(|cache| {
+                cache.validate(
+                    vpd,
+                    now,
+                    Self::CALIB_CACHE_MAX_AGE,
+                    (self.temp_lower_limit, self.temp_upper_limit),
+                )
+            }) {
+                Ok(calib) => {
+                    info!("apply cached calibration values: {:?}", calib);
+                    return Ok(calib);
+                }
+                Err(e) => info!("{}, start boot time calibration", e),
+            }
+        }
+
+        let calib = calibrate()?;
+        match vpd {
+            Ok(vpd) => {
+                if let Err(e) = CalibCache::new(vpd, calib.clone(), now).save(&self.snd_card) {
+                    error!("failed to save calib cache: {}", e);
+                }
+            }
+            Err(e) => error!("calib cache is not saved: {}", e),
+        }
+        Ok(calib)
+    }
+
     /// Gets the calibration values from vpd.
     ///
     /// # Results
@@ -266,25 +326,9 @@ impl DSM {
     ///
     /// * Failed to wait the internal speakers to be ready.
     pub fn wait_for_speakers_ready(&self) -> Result<()> {
-        let find_speaker = || -> Result<()> {
-            let cras_client = CrasClient::new().map_err(Error::CrasClientFailed)?;
-            let _node = cras_client
-                .output_nodes()
-                .find(|node| node.node_type == CrasNodeType::CRAS_NODE_TYPE_INTERNAL_SPEAKER)
-                .ok_or(Error::InternalSpeakerNotFound)?;
-            Ok(())
-        };
-        // TODO(b/155007305): Implement cras_client.wait_node_change and use it here.
-        const RETRY: usize = 3;
-        const RETRY_INTERVAL: Duration = Duration::from_millis(500);
-        for _ in 0..RETRY {
-            match find_speaker() {
-                Ok(_) => return Ok(()),
-                Err(e) => error!("retry on finding speaker: {}", e),
-            };
-            thread::sleep(RETRY_INTERVAL);
-        }
-        Err(Error::InternalSpeakerNotFound)
+        let mut cras_client = CrasClient::new().map_err(Error::CrasClientFailed)?;
+        internal_speaker::wait(&mut cras_client, Self::SPEAKER_READY_TIMEOUT)?;
+        Ok(())
     }
 
     fn is_first_boot(&self) -> bool {
@@ -325,6 +369,12 @@ impl DSM {
         }
     }
 
+    fn get_all_vpd_value(&self) -> Result<Vec<(i32, i32)>> {
+        (0..self.num_channels)
+            .map(|ch| VPD::new(ch).map(|vpd| (vpd.dsm_calib_r0, vpd.dsm_calib_temp)))
+            .collect::<Result<Vec<_>>>()
+    }
+
     fn get_vpd_calibration_value(&self, channel: usize) -> Result<CalibData> {
         let vpd = VPD::new(channel)?;
         Ok(CalibData {
@@ -30,6 +30,43 @@ pub mod shutdown_time {
     }
 }
 
+/// The utils to find the internal speaker node in CRAS.
+pub mod internal_speaker {
+    use std::time::Instant;
+
+    use libcras::{CrasClient, CrasIonodeInfo, CrasNodeType};
+
+    use super::*;
+
+    /// Blocks until CRAS has an internal speaker node or `timeout` passes. Instead of
+    /// polling, it sleeps until CRAS notifies that its nodes have changed.
+    ///
+    /// # Errors
+    ///
+    /// * Failed to wait for the node changes notified by CRAS.
+    /// * The internal speaker is not found before `timeout`.
+    pub fn wait(cras_client: &mut CrasClient, timeout: Duration) -> Result<CrasIonodeInfo> {
+        let deadline = Instant::now() + timeout;
+        cras_client
+            .register_node_change()
+            .map_err(Error::WaitNodeChangeFailed)?;
+        loop {
+            if let Some(node) = cras_client
+                .output_nodes()
+                .find(|node| node.node_type == CrasNodeType::CRAS_NODE_TYPE_INTERNAL_SPEAKER)
+            {
+                return Ok(node);
+            }
+            let remaining = deadline
+                .checked_duration_since(Instant::now())
+                .ok_or(Error::InternalSpeakerNotFound)?;
+            cras_client
+                .wait_node_change(remaining)
+                .map_err(Error::WaitNodeChangeFailed)?;
+        }
+    }
+}
+
 /// The utils to create and parse sound_card_init run time file.
 pub mod run_time {
     use std::time::SystemTime;
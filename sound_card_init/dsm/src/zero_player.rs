@@ -9,10 +9,11 @@ use std::thread::JoinHandle;
 use std::time::Duration;
 
 use audio_streams::SampleFormat;
-use libcras::{CrasClient, CrasNodeType};
+use libcras::CrasClient;
 use sys_util::error;
 
 use crate::error::{Error, Result};
+use crate::utils::internal_speaker;
 
 /// `ZeroPlayer` provides the functionality to play zeros sample in the background thread.
 #[derive(Default)]
@@ -39,7 +40,7 @@ impl ZeroPlayer {
         self.thread_info.is_some()
     }
 
-    /// Starts to play zeros for at most `max_playback_time`.
+    /// Starts to play zeros in the background thread.
     /// This function blocks and returns until playback has started for `min_playback_time`.
     /// This function must be called when self.running() returns false.
     ///
@@ -57,18 +58,37 @@ impl ZeroPlayer {
         if self.running() {
             return Err(Error::ZeroPlayerIsRunning);
         }
-        self.thread_info = Some(PlayZeroWorkerInfo::new(min_playback_time));
-        if let Some(thread_info) = &mut self.thread_info {
-            // Block until playback of zeros has started for min_playback_time or timeout.
-            let (lock, cvar) = &*(thread_info.ready);
-            let result = cvar.wait_timeout_while(
-                lock.lock()?,
-                min_playback_time + ZeroPlayer::TIMEOUT,
-                |&mut is_ready| !is_ready,
-            )?;
-            if result.1.timed_out() {
-                return Err(Error::StartPlaybackTimeout);
-            }
+        self.thread_info = Some(PlayZeroWorkerInfo::new());
+        self.wait_playback_time(min_playback_time)
+    }
+
+    /// Blocks until zeros have been played for `playback_time` since the playback started.
+    /// The background thread wakes up the caller as it writes the buffers, so the time is
+    /// paced by the playback itself.
+    /// This function must be called when self.running() returns true.
+    ///
+    /// # Arguments
+    ///
+    /// * `playback_time` - It blocks and returns until playback has lasted for
+    ///                     `playback_time`.
+    ///
+    /// # Errors
+    ///
+    /// * If it's called when the `ZeroPlayer` is not running.
+    /// * Playback has not lasted for `playback_time` in time.
+    pub fn wait_playback_time(&self, playback_time: Duration) -> Result<()> {
+        let thread_info = self
+            .thread_info
+            .as_ref()
+            .ok_or(Error::ZeroPlayerIsNotRunning)?;
+        let (lock, cvar) = &*(thread_info.played);
+        let result = cvar.wait_timeout_while(
+            lock.lock()?,
+            playback_time + ZeroPlayer::TIMEOUT,
+            |played| *played < playback_time,
+        )?;
+        if result.1.timed_out() {
+            return Err(Error::StartPlaybackTimeout);
         }
         Ok(())
     }
@@ -94,9 +114,9 @@ struct PlayZeroWorkerInfo {
     thread: Option<JoinHandle<Result<()>>>,
     // Uses `thread_run` to notify the background thread to stop.
     thread_run: Arc<AtomicBool>,
-    // The background thread uses `ready` to notify the main thread that playback
-    // of zeros has started for min_playback_time.
-    ready: Arc<(Mutex<bool>, Condvar)>,
+    // The background thread uses `played` to notify the main thread how long
+    // playback of zeros has lasted.
+    played: Arc<(Mutex<Duration>, Condvar)>,
 }
 
 impl Drop for PlayZeroWorkerInfo {
@@ -109,17 +129,17 @@ impl Drop for PlayZeroWorkerInfo {
 
 impl PlayZeroWorkerInfo {
     // Spawns the PlayZeroWorker.
-    fn new(min_playback_time: Duration) -> Self {
+    fn new() -> Self {
         let thread_run = Arc::new(AtomicBool::new(false));
-        let ready = Arc::new((Mutex::new(false), Condvar::new()));
-        let mut worker = PlayZeroWorker::new(min_playback_time, thread_run.clone(), ready.clone());
+        let played = Arc::new((Mutex::new(Duration::from_secs(0)), Condvar::new()));
+        let mut worker = PlayZeroWorker::new(thread_run.clone(), played.clone());
         Self {
             thread: Some(thread::spawn(move || -> Result<()> {
                 worker.run()?;
                 Ok(())
             })),
             thread_run,
-            ready,
+            played,
         }
     }
 
@@ -138,12 +158,11 @@ impl PlayZeroWorkerInfo {
 }
 
 struct PlayZeroWorker {
-    min_playback_time: Duration,
     // Uses `thread_run` to notify the background thread to stop.
     thread_run: Arc<AtomicBool>,
-    // The background thread uses `ready` to notify the main thread that playback
-    // of zeros has started for min_playback_time.
-    ready: Arc<(Mutex<bool>, Condvar)>,
+    // The background thread uses `played` to notify the main thread how long
+    // playback of zeros has lasted.
+    played: Arc<(Mutex<Duration>, Condvar)>,
 }
 
 impl PlayZeroWorker {
@@ -152,31 +171,18 @@ impl PlayZeroWorker {
     const NUM_CHANNELS: usize = 2;
     const FORMAT: SampleFormat = SampleFormat::S16LE;
 
-    fn new(
-        min_playback_time: Duration,
-        thread_run: Arc<AtomicBool>,
-        ready: Arc<(Mutex<bool>, Condvar)>,
-    ) -> Self {
-        Self {
-            min_playback_time,
-            thread_run,
-            ready,
-        }
+    fn new(thread_run: Arc<AtomicBool>, played: Arc<(Mutex<Duration>, Condvar)>) -> Self {
+        Self { thread_run, played }
     }
 
     fn run(&mut self) -> Result<()> {
         let mut cras_client = CrasClient::new().map_err(Error::CrasClientFailed)?;
-        // TODO(b/155007305): Implement cras_client.wait_node_change and use it here.
-        let node = cras_client
-            .output_nodes()
-            .find(|node| node.node_type == CrasNodeType::CRAS_NODE_TYPE_INTERNAL_SPEAKER)
-            .ok_or(Error::InternalSpeakerNotFound)?;
+        let node = internal_speaker::wait(&mut cras_client, ZeroPlayer::TIMEOUT)?;
         let local_buffer =
             vec![0u8; Self::FRAMES_PER_BUFFER * Self::NUM_CHANNELS * Self::FORMAT.sample_bytes()];
-        let min_playback_iterations = (Self::FRAME_RATE
-            * self.min_playback_time.as_millis() as u32)
-            / Self::FRAMES_PER_BUFFER as u32
-            / 1000;
+        let buffer_time = Duration::from_micros(
+            Self::FRAMES_PER_BUFFER as u64 * 1_000_000 / Self::FRAME_RATE as u64,
+        );
         let (_control, mut stream) = cras_client
             .new_pinned_playback_stream(
                 node.iodev_index,
@@ -187,7 +193,6 @@ impl PlayZeroWorker {
             )
             .map_err(|e| Error::NewPlayStreamFailed(e))?;
 
-        let mut iter = 0;
         self.thread_run.store(true, Ordering::Relaxed);
         while self.thread_run.load(Ordering::Relaxed) {
             let mut buffer = stream
@@ -195,14 +200,10 @@ impl PlayZeroWorker {
                 .map_err(|e| Error::NextPlaybackBufferFailed(e))?;
             let _write_frames = buffer.write(&local_buffer).map_err(Error::PlaybackFailed)?;
 
-            // Notifies the main thread that playback of zeros has started for min_playback_time.
-            if iter == min_playback_iterations {
-                let (lock, cvar) = &*self.ready;
-                let mut is_ready = lock.lock()?;
-                *is_ready = true;
-                cvar.notify_one();
-            }
-            iter += 1;
+            // Notifies the main thread how long playback of zeros has lasted.
+            let (lock, cvar) = &*self.played;
+            *lock.lock()? += buffer_time;
+            cvar.notify_all();
         }
         Ok(())
     }